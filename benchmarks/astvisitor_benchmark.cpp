@@ -0,0 +1,435 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Times the phases of the ASTVisitor on synthetic headers with a controlled
+// shape, without the cost of the probes and of the abigen command line. Each
+// shape stresses a different part of the analysis: class expansion, type
+// dependency enumeration and the function type propagation in finalize()
+//
+// Usage: astvisitor_benchmark [--scale <factor>] [--shape <name>]
+//
+// The scale multiplies the size of every shape; by default all the shapes
+// are measured, both with the eager and with the lazy type expansion. Each
+// shape is also parsed a second time, and the benchmark fails if the two
+// translation units do not produce the functions in the same order
+
+#include "astvisitor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <clang/AST/Mangle.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/Tooling.h>
+
+namespace {
+/// How many times each measurement is repeated; the fastest run is kept
+const std::size_t kIterationCount = 5U;
+
+/// A synthetic header shape
+struct BenchmarkShape final {
+  /// The shape name, used with --shape
+  std::string name;
+
+  /// What the shape stresses
+  std::string description;
+
+  /// Generates the source buffer for the given size
+  std::string (*generator)(std::size_t size);
+
+  /// The default size, multiplied by the scale factor
+  std::size_t default_size;
+};
+
+/// A chain of classes, each one deriving from the previous one; every class
+/// adds a member, a method and a free function taking it as a parameter.
+/// The last class holds a function pointer, so every function reaching it
+/// through the bases is blacklisted
+std::string generateDeepInheritance(std::size_t size) {
+  std::stringstream buffer;
+  buffer << "struct Class0 { int member0; void method0(int); };\n";
+
+  for (std::size_t i = 1U; i < size; ++i) {
+    buffer << "struct Class" << i << " : Class" << (i - 1U) << " { int member"
+           << i << "; void method" << i << "(Class" << (i - 1U) << " *); };\n";
+  }
+
+  buffer << "struct Leaf : Class" << (size - 1U)
+         << " { void (*callback)(int); };\n";
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "void useClass" << i << "(Class" << i << " *);\n";
+  }
+
+  buffer << "void useLeaf(Leaf *);\n";
+  return buffer.str();
+}
+
+/// Many structures with a large number of fields, each one referencing the
+/// previous structures; one field out of 64 is a function pointer
+std::string generateWideStructs(std::size_t size) {
+  const std::size_t kFieldCount = 256U;
+
+  std::stringstream buffer;
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "struct Wide" << i << " {\n";
+
+    for (std::size_t field = 0U; field < kFieldCount; ++field) {
+      if (field % 64U == 63U && i % 2U == 1U) {
+        buffer << "  void (*field" << field << ")(void);\n";
+
+      } else if (i > 0U && field % 8U == 0U) {
+        buffer << "  struct Wide" << (field / 8U) % i << " *field" << field
+               << ";\n";
+
+      } else {
+        buffer << "  int field" << field << ";\n";
+      }
+    }
+
+    buffer << "};\n";
+  }
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "void useWide" << i << "(struct Wide" << i << " *);\n";
+  }
+
+  return buffer.str();
+}
+
+/// Long chains of typedefs, each chain ending with a function that uses the
+/// last alias; every other chain starts from a function pointer
+std::string generateTypedefChains(std::size_t size) {
+  const std::size_t kChainLength = 64U;
+
+  std::stringstream buffer;
+
+  for (std::size_t chain = 0U; chain < size; ++chain) {
+    if (chain % 2U == 0U) {
+      buffer << "typedef struct ChainRoot" << chain << " { int value; } T"
+             << chain << "_0;\n";
+    } else {
+      buffer << "typedef void (*T" << chain << "_0)(int);\n";
+    }
+
+    for (std::size_t link = 1U; link < kChainLength; ++link) {
+      buffer << "typedef T" << chain << "_" << (link - 1U) << " T" << chain
+             << "_" << link << ";\n";
+    }
+
+    buffer << "void useChain" << chain << "(T" << chain << "_"
+           << (kChainLength - 1U) << " *);\n";
+  }
+
+  return buffer.str();
+}
+
+/// Structures with many function pointer members, shared by many functions;
+/// exercises the function type propagation in finalize()
+std::string generateFunctionPointerMembers(std::size_t size) {
+  const std::size_t kMemberCount = 64U;
+  const std::size_t kFunctionsPerStruct = 16U;
+
+  std::stringstream buffer;
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "struct Callbacks" << i << " {\n";
+
+    for (std::size_t member = 0U; member < kMemberCount; ++member) {
+      buffer << "  int (*callback" << member << ")(struct Callbacks" << i
+             << " *, int";
+
+      for (std::size_t parameter = 0U; parameter < member % 4U; ++parameter) {
+        buffer << ", long";
+      }
+
+      buffer << ");\n";
+    }
+
+    buffer << "};\n";
+
+    for (std::size_t function = 0U; function < kFunctionsPerStruct;
+         ++function) {
+      buffer << "void useCallbacks" << i << "_" << function
+             << "(struct Callbacks" << i << " *);\n";
+    }
+  }
+
+  return buffer.str();
+}
+
+/// A large overload set, with each overload taking a different structure;
+/// stresses the name mangling and the duplicate detection
+std::string generateOverloads(std::size_t size) {
+  std::stringstream buffer;
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "struct Argument" << i << " { int value; Argument" << i
+           << " *next; };\n";
+  }
+
+  buffer << "namespace overloads {\n";
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    buffer << "void process(Argument" << i << " *);\n";
+    buffer << "void process(Argument" << i << " *, int);\n";
+    buffer << "int process(const Argument" << i << " &, long);\n";
+  }
+
+  buffer << "}\n";
+  return buffer.str();
+}
+
+/// The shapes that can be measured
+const std::vector<BenchmarkShape> kShapeList = {
+    {"deep-inheritance", "class expansion through long base chains",
+     generateDeepInheritance, 400U},
+
+    {"wide-structs", "type dependency enumeration over many fields",
+     generateWideStructs, 200U},
+
+    {"typedef-chains", "type dependency enumeration through aliases",
+     generateTypedefChains, 400U},
+
+    {"function-pointers", "function type propagation in finalize()",
+     generateFunctionPointerMembers, 200U},
+
+    {"overloads", "name mangling of large overload sets", generateOverloads,
+     3000U}};
+
+/// The time spent in each phase of a single visitor run, in milliseconds
+struct VisitorTimings final {
+  /// Visiting the function declarations, which expands the classes and
+  /// (in eager mode) enumerates the type dependencies
+  double visit_time{0.0};
+
+  /// Building the type graph and propagating the function types
+  double finalize_time{0.0};
+
+  /// How many functions have been whitelisted
+  std::size_t whitelisted_count{0U};
+
+  /// How many functions have been blacklisted
+  std::size_t blacklisted_count{0U};
+
+  /// The mangled names of the blacklisted and then of the whitelisted
+  /// functions, in output order
+  std::string output_order;
+};
+
+/// Returns the milliseconds elapsed since the given time point
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/// Runs a new visitor over the given translation unit; returns false if the
+/// visitor could not be created
+bool runVisitor(VisitorTimings &timings, clang::ASTUnit &ast_unit,
+                bool lazy_type_expansion) {
+  ASTVisitorSettings visitor_settings;
+  visitor_settings.lazy_type_expansion = lazy_type_expansion;
+
+  IASTVisitorRef ast_visitor;
+  if (!ASTVisitor::create(ast_visitor, visitor_settings).succeeded()) {
+    return false;
+  }
+
+  auto &ast_context = ast_unit.getASTContext();
+  std::unique_ptr<clang::MangleContext> name_mangler(
+      ast_context.createMangleContext());
+
+  ast_visitor->initialize(&ast_context, &ast_unit.getSourceManager(),
+                          name_mangler.get());
+
+  auto visit_start = std::chrono::steady_clock::now();
+  ast_visitor->TraverseDecl(ast_context.getTranslationUnitDecl());
+  timings.visit_time = millisecondsSince(visit_start);
+
+  auto finalize_start = std::chrono::steady_clock::now();
+  ast_visitor->finalize();
+  timings.finalize_time = millisecondsSince(finalize_start);
+
+  auto whitelisted_function_list = ast_visitor->whitelistedFunctions();
+  auto blacklisted_function_list = ast_visitor->blacklistedFunctions();
+
+  timings.whitelisted_count = whitelisted_function_list.size();
+  timings.blacklisted_count = blacklisted_function_list.size();
+
+  timings.output_order.clear();
+  for (const auto &function : blacklisted_function_list) {
+    timings.output_order += "B " + function.mangled_name + "\n";
+  }
+
+  for (const auto &function : whitelisted_function_list) {
+    timings.output_order += "W " + function.mangled_name + "\n";
+  }
+
+  return true;
+}
+
+/// Keeps the fastest run of each phase
+bool measureVisitor(VisitorTimings &best_timings, clang::ASTUnit &ast_unit,
+                    bool lazy_type_expansion) {
+  for (std::size_t i = 0U; i < kIterationCount; ++i) {
+    VisitorTimings timings;
+    if (!runVisitor(timings, ast_unit, lazy_type_expansion)) {
+      return false;
+    }
+
+    if (i == 0U) {
+      best_timings = timings;
+      continue;
+    }
+
+    best_timings.visit_time =
+        std::min(best_timings.visit_time, timings.visit_time);
+
+    best_timings.finalize_time =
+        std::min(best_timings.finalize_time, timings.finalize_time);
+  }
+
+  return true;
+}
+
+/// Prints a single row of the result table
+void printTimings(const std::string &shape_name, const std::string &mode,
+                  const VisitorTimings &timings, bool stable_order) {
+  std::cout << std::left << std::setw(20) << shape_name << std::setw(8)
+            << mode << std::right << std::setw(12) << timings.visit_time
+            << std::setw(14) << timings.finalize_time << std::setw(13)
+            << timings.whitelisted_count << std::setw(13)
+            << timings.blacklisted_count << std::setw(8)
+            << (stable_order ? "yes" : "no") << "\n";
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  double scale = 1.0;
+  std::string selected_shape;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+
+    if ((argument == "--scale" || argument == "--shape") && i + 1 < argc) {
+      std::string value = argv[++i];
+
+      if (argument == "--shape") {
+        selected_shape = value;
+        continue;
+      }
+
+      try {
+        scale = std::stod(value);
+      } catch (...) {
+        scale = 0.0;
+      }
+
+      if (scale <= 0.0) {
+        std::cerr << "Invalid scale factor: " << value << "\n";
+        return EXIT_FAILURE;
+      }
+
+      continue;
+    }
+
+    std::cerr << "Usage: astvisitor_benchmark [--scale <factor>] "
+                 "[--shape <name>]\n";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << std::left << std::setw(20) << "Shape" << std::setw(8) << "Mode"
+            << std::right << std::setw(12) << "Visit (ms)" << std::setw(14)
+            << "Finalize (ms)" << std::setw(13) << "Whitelisted"
+            << std::setw(13) << "Blacklisted" << std::setw(8) << "Stable"
+            << "\n";
+
+  bool shape_found = false;
+  bool output_order_stable = true;
+
+  for (const auto &shape : kShapeList) {
+    if (!selected_shape.empty() && shape.name != selected_shape) {
+      continue;
+    }
+
+    shape_found = true;
+
+    auto size = std::max(
+        std::size_t{2U},
+        static_cast<std::size_t>(static_cast<double>(shape.default_size) *
+                                 scale));
+
+    auto source_buffer = shape.generator(size);
+
+    // The second translation unit is alive at the same time as the first
+    // one, so its declarations are allocated at different addresses
+    auto ast_unit = clang::tooling::buildASTFromCodeWithArgs(
+        source_buffer, {"-std=c++14"}, "benchmark.cpp");
+
+    auto second_ast_unit = clang::tooling::buildASTFromCodeWithArgs(
+        source_buffer, {"-std=c++14"}, "benchmark.cpp");
+
+    if (!ast_unit || !second_ast_unit) {
+      std::cerr << "Failed to build the AST of the " << shape.name
+                << " shape\n";
+      return EXIT_FAILURE;
+    }
+
+    for (auto lazy_type_expansion : {false, true}) {
+      VisitorTimings timings;
+      VisitorTimings second_timings;
+      if (!measureVisitor(timings, *ast_unit, lazy_type_expansion) ||
+          !runVisitor(second_timings, *second_ast_unit, lazy_type_expansion)) {
+        std::cerr << "Failed to create the AST visitor\n";
+        return EXIT_FAILURE;
+      }
+
+      auto stable_order = timings.output_order == second_timings.output_order;
+      if (!stable_order) {
+        output_order_stable = false;
+      }
+
+      printTimings(shape.name, lazy_type_expansion ? "lazy" : "eager",
+                   timings, stable_order);
+    }
+  }
+
+  if (!shape_found) {
+    std::cerr << "Unknown shape: " << selected_shape << "\nAvailable shapes:\n";
+    for (const auto &shape : kShapeList) {
+      std::cerr << "  " << shape.name << ": " << shape.description << "\n";
+    }
+
+    return EXIT_FAILURE;
+  }
+
+  if (!output_order_stable) {
+    std::cerr << "The order of the functions changed across translation "
+                 "units\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Merges the metrics files written by `abigen generate --metrics-file` and
+// `abigen compile --metrics-file` into a single results file, then compares
+// the wall time of each phase and the peak memory usage of each run against
+// a stored baseline. The exit code is non-zero when a regression is found
+//
+// Usage: benchmark_compare --output <results.json> [--baseline <path>]
+//                          [--tolerance <fraction>] <run.json>...
+//
+// Each run is named after its metrics file, without the .json extension
+
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <json11.hpp>
+
+namespace {
+/// Changes below this amount of seconds are considered noise
+const double kMinimumTimeDifference = 0.1;
+
+/// Changes below this amount of bytes are considered noise
+const double kMinimumMemoryDifference = 16.0 * 1024.0 * 1024.0;
+
+/// The command line options
+struct Options final {
+  /// Where the merged results are saved
+  std::string output_path;
+
+  /// The results of a previous run; optional
+  std::string baseline_path;
+
+  /// How much slower (or larger) a measurement can get before it is flagged
+  double tolerance{0.15};
+
+  /// The metrics files of the runs
+  std::vector<std::string> metrics_file_list;
+};
+
+/// Parses the command line, returning false if it is not valid
+bool parseOptions(Options &options, int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    std::string argument = argv[i];
+
+    if (argument == "--output" || argument == "--baseline" ||
+        argument == "--tolerance") {
+      if (i + 1 >= argc) {
+        std::cerr << "Missing value for " << argument << "\n";
+        return false;
+      }
+
+      std::string value = argv[++i];
+
+      if (argument == "--output") {
+        options.output_path = value;
+
+      } else if (argument == "--baseline") {
+        options.baseline_path = value;
+
+      } else {
+        try {
+          options.tolerance = std::stod(value);
+        } catch (...) {
+          std::cerr << "Invalid tolerance: " << value << "\n";
+          return false;
+        }
+      }
+
+      continue;
+    }
+
+    options.metrics_file_list.push_back(argument);
+  }
+
+  if (options.output_path.empty() || options.metrics_file_list.empty()) {
+    std::cerr << "Usage: benchmark_compare --output <results.json> "
+                 "[--baseline <path>] [--tolerance <fraction>] "
+                 "<run.json>...\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Loads the given JSON file; returns false if it can't be read or parsed
+bool loadJsonFile(json11::Json &json, const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    return false;
+  }
+
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+
+  std::string error;
+  json = json11::Json::parse(buffer.str(), error);
+
+  return error.empty();
+}
+
+/// Returns the run name of the given metrics file
+std::string getRunName(const std::string &path) {
+  auto name_start = path.find_last_of("/\\");
+  auto name = (name_start == std::string::npos) ? path
+                                                : path.substr(name_start + 1U);
+
+  const std::string extension = ".json";
+  if (name.size() > extension.size() &&
+      name.compare(name.size() - extension.size(), extension.size(),
+                   extension) == 0) {
+    name.resize(name.size() - extension.size());
+  }
+
+  return name;
+}
+
+/// Returns the wall time of the given phase, or a negative value if the
+/// phase is not found
+double getPhaseWallTime(const json11::Json &run, const std::string &name) {
+  for (const auto &phase : run["phases"].array_items()) {
+    if (phase["name"].string_value() == name) {
+      return phase["wall_time"].number_value();
+    }
+  }
+
+  return -1.0;
+}
+
+/// Compares a single measurement, printing it along with the baseline;
+/// returns false if it has regressed
+bool compareMeasurement(const std::string &run_name, const std::string &label,
+                        double baseline, double current, double scale,
+                        double minimum_difference, double tolerance) {
+  auto regressed = current > baseline * (1.0 + tolerance) &&
+                   current - baseline > minimum_difference;
+
+  auto change = (baseline > 0.0) ? (current - baseline) * 100.0 / baseline
+                                 : 0.0;
+
+  std::cout << "  " << std::left << std::setw(20) << run_name << std::setw(32)
+            << label << std::right << std::setw(12) << baseline / scale
+            << std::setw(12) << current / scale << std::setw(9) << std::showpos
+            << change << std::noshowpos << "%"
+            << (regressed ? "  REGRESSION" : "") << "\n";
+
+  return !regressed;
+}
+
+/// Compares the results against the baseline; returns false if any of the
+/// measurements has regressed
+bool compareResults(const json11::Json &baseline, const json11::Json &results,
+                    double tolerance) {
+  std::cout << std::fixed << std::setprecision(3);
+  std::cout << "  " << std::left << std::setw(20) << "Run" << std::setw(32)
+            << "Measurement" << std::right << std::setw(12) << "Baseline"
+            << std::setw(12) << "Current" << std::setw(10) << "Change"
+            << "\n";
+
+  bool succeeded = true;
+
+  for (const auto &p : results.object_items()) {
+    const auto &run_name = p.first;
+    const auto &run = p.second;
+
+    const auto &baseline_run = baseline[run_name];
+    if (!baseline_run.is_object()) {
+      std::cout << "  " << run_name << ": not found in the baseline\n";
+      continue;
+    }
+
+    for (const auto &phase : run["phases"].array_items()) {
+      const auto &phase_name = phase["name"].string_value();
+
+      auto baseline_wall_time = getPhaseWallTime(baseline_run, phase_name);
+      if (baseline_wall_time < 0.0) {
+        continue;
+      }
+
+      if (!compareMeasurement(run_name, phase_name + " (s)",
+                              baseline_wall_time,
+                              phase["wall_time"].number_value(), 1.0,
+                              kMinimumTimeDifference, tolerance)) {
+        succeeded = false;
+      }
+    }
+
+    if (!compareMeasurement(
+            run_name, "Peak RSS (MiB)",
+            baseline_run["peak_resident_memory"].number_value(),
+            run["peak_resident_memory"].number_value(), 1024.0 * 1024.0,
+            kMinimumMemoryDifference, tolerance)) {
+      succeeded = false;
+    }
+  }
+
+  return succeeded;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(options, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  json11::Json::object result_object;
+
+  for (const auto &metrics_file : options.metrics_file_list) {
+    json11::Json run;
+    if (!loadJsonFile(run, metrics_file)) {
+      std::cerr << "Failed to load the metrics file: " << metrics_file << "\n";
+      return EXIT_FAILURE;
+    }
+
+    result_object[getRunName(metrics_file)] = run;
+  }
+
+  json11::Json results = result_object;
+
+  {
+    std::ofstream output_file(options.output_path,
+                              std::ios::out | std::ios::trunc);
+
+    output_file << results.dump() << "\n";
+    if (!output_file) {
+      std::cerr << "Failed to write the results file: " << options.output_path
+                << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "Benchmark results saved to " << options.output_path << "\n\n";
+
+  if (options.baseline_path.empty()) {
+    return EXIT_SUCCESS;
+  }
+
+  json11::Json baseline;
+  if (!loadJsonFile(baseline, options.baseline_path)) {
+    std::cout << "No baseline found at " << options.baseline_path
+              << "; nothing to compare\n";
+    return EXIT_SUCCESS;
+  }
+
+  if (!compareResults(baseline, results, options.tolerance)) {
+    std::cerr << "\nOne or more measurements regressed by more than "
+              << options.tolerance * 100.0 << "%\n";
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
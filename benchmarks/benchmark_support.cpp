@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "benchmark_support.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+/// Extensions of the files counted as headers
+const std::vector<std::string> kHeaderExtensionList = {".h", ".hh", ".hpp",
+                                                       ".hxx", ".h++"};
+}  // namespace
+
+bool parseNumber(std::size_t &value, const std::string &string_value) {
+  try {
+    std::size_t processed_count = 0U;
+    auto parsed_value = std::stoull(string_value, &processed_count);
+    if (processed_count != string_value.size()) {
+      return false;
+    }
+
+    value = static_cast<std::size_t>(parsed_value);
+    return true;
+
+  } catch (...) {
+    return false;
+  }
+}
+
+bool parseSize(std::size_t &value, const std::string &string_value) {
+  std::size_t parsed_value;
+  if (!parseNumber(parsed_value, string_value) || parsed_value == 0U) {
+    return false;
+  }
+
+  value = parsed_value;
+  return true;
+}
+
+bool parseOptionList(int argc, char *argv[],
+                     const OptionHandler &option_handler,
+                     std::vector<std::string> *argument_list) {
+  for (int i = 1; i < argc; ++i) {
+    std::string option = argv[i];
+
+    if (argument_list != nullptr && option == "--") {
+      argument_list->assign(argv + i + 1, argv + argc);
+      break;
+    }
+
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << option << "\n";
+      return false;
+    }
+
+    std::string value = argv[++i];
+    if (!option_handler(option, value)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool enumerateHeaders(std::vector<std::string> &header_list,
+                      const std::string &header_folder) {
+  header_list.clear();
+
+  std::error_code error;
+  stdfs::recursive_directory_iterator it(header_folder, error);
+  if (error) {
+    return false;
+  }
+
+  for (; it != stdfs::recursive_directory_iterator(); it.increment(error)) {
+    if (error) {
+      return false;
+    }
+
+    if (!it->is_regular_file(error)) {
+      continue;
+    }
+
+    auto extension = it->path().extension().string();
+    if (std::find(kHeaderExtensionList.begin(), kHeaderExtensionList.end(),
+                  extension) == kHeaderExtensionList.end()) {
+      continue;
+    }
+
+    header_list.push_back(
+        stdfs::relative(it->path(), header_folder, error).generic_string());
+  }
+
+  std::sort(header_list.begin(), header_list.end());
+  return true;
+}
+
+ProcessMeasurement runProcess(const std::string &executable_path,
+                              const std::vector<std::string> &argument_list) {
+  ProcessMeasurement measurement;
+
+  std::vector<char *> argv;
+  argv.push_back(const_cast<char *>(executable_path.c_str()));
+  for (const auto &argument : argument_list) {
+    argv.push_back(const_cast<char *>(argument.c_str()));
+  }
+
+  argv.push_back(nullptr);
+
+  auto start_time = std::chrono::steady_clock::now();
+
+  auto process_id = fork();
+  if (process_id == -1) {
+    return measurement;
+  }
+
+  if (process_id == 0) {
+    // The output of the runs would hide the progress of the benchmark
+    auto null_file = freopen("/dev/null", "w", stdout);
+    static_cast<void>(null_file);
+    null_file = freopen("/dev/null", "w", stderr);
+    static_cast<void>(null_file);
+
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+
+  // wait4 reports the usage of the child along with the grandchildren it
+  // waited for, such as the remote probe workers
+  int status = 0;
+  struct rusage resource_usage {};
+  if (wait4(process_id, &status, 0, &resource_usage) == -1) {
+    return measurement;
+  }
+
+  measurement.wall_time = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - start_time)
+                              .count();
+
+  auto L_seconds = [](const struct timeval &value) -> double {
+    return static_cast<double>(value.tv_sec) +
+           static_cast<double>(value.tv_usec) / 1000000.0;
+  };
+
+  measurement.cpu_time =
+      L_seconds(resource_usage.ru_utime) + L_seconds(resource_usage.ru_stime);
+
+#if defined(__APPLE__)
+  measurement.peak_resident_memory =
+      static_cast<std::size_t>(resource_usage.ru_maxrss);
+#else
+  measurement.peak_resident_memory =
+      static_cast<std::size_t>(resource_usage.ru_maxrss) * 1024U;
+#endif
+
+  if (WIFEXITED(status)) {
+    measurement.exit_code = WEXITSTATUS(status);
+  }
+
+  return measurement;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+/// The measurements of a process run by runProcess
+struct ProcessMeasurement final {
+  /// Elapsed time, in seconds
+  double wall_time{0.0};
+
+  /// User and system time of the process and of its children, in seconds
+  double cpu_time{0.0};
+
+  /// Peak resident memory, in bytes
+  std::size_t peak_resident_memory{0U};
+
+  /// The exit code of the process; -1 if it could not be started or if it
+  /// has been terminated by a signal
+  int exit_code{-1};
+};
+
+/// Receives each option of the command line along with its value; returns
+/// false if they are not valid, after printing the reason
+using OptionHandler =
+    std::function<bool(const std::string &option, const std::string &value)>;
+
+/// Parses a number, returning false if it is not valid
+bool parseNumber(std::size_t &value, const std::string &string_value);
+
+/// Parses a size value, returning false if it is not a positive number
+bool parseSize(std::size_t &value, const std::string &string_value);
+
+/// Passes every option of the command line to the handler; each option takes
+/// a value. When the argument list is not null, the arguments following "--"
+/// are stored in it. Returns false if the command line is not valid
+bool parseOptionList(int argc, char *argv[],
+                     const OptionHandler &option_handler,
+                     std::vector<std::string> *argument_list);
+
+/// Returns the headers found in the given folder, relative to it and sorted
+/// by path
+bool enumerateHeaders(std::vector<std::string> &header_list,
+                      const std::string &header_folder);
+
+/// Runs the given executable with its output discarded, waiting for it to
+/// terminate
+ProcessMeasurement runProcess(const std::string &executable_path,
+                              const std::vector<std::string> &argument_list);
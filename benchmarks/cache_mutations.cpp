@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures how well the caches survive changes to a header corpus. A copy
+// of the corpus is generated once with an empty cache folder, and then
+// again after each scripted mutation, using the same cache folder; the
+// wall time, the CPU time, the amount of compilations and the hit rates of
+// the probe cache and of the precompiled header cache of each run are saved
+// to a CSV file. The mutations are:
+//
+//   leaf_edit       a declaration is appended to a header that no other
+//                   header includes
+//   widely_included a declaration is appended to the header included by
+//                   the most other headers
+//   add_header      a new header is added to the corpus
+//   remove_header   the header edited by leaf_edit is removed
+//   flag_change     an empty include search path is added to the compiler
+//                   settings
+//
+// Usage: cache_mutations --abigen <path> --header-folder <path>
+//                        --work-folder <path> --output <results.csv>
+//                        [--mutations <mutation,...>]
+//                        -- <generate arguments>...
+//
+// The generate arguments must select the profile, the language and the
+// output path; the header folder, the cache folder and the metrics file are
+// added by the benchmark. The corpus is copied to the work folder, and the
+// mutated header is restored after each warm run, so every run starts from
+// the cache of the cold run plus the entries added by the previous
+// mutations. The included headers are matched by file name only
+
+#include "benchmark_support.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <json11.hpp>
+
+namespace {
+/// The mutations applied when --mutations is not given
+const std::vector<std::string> kMutationList = {
+    "leaf_edit", "widely_included", "add_header", "remove_header",
+    "flag_change"};
+
+/// The declaration appended by the edit mutations; an extern variable can
+/// be declared more than once, so the header guards do not matter
+const std::string kMutationDeclaration =
+    "\nextern int abigen_benchmark_mutation;\n";
+
+/// The name of the header added by the add_header mutation
+const std::string kAddedHeaderName = "abigen_benchmark_added.h";
+
+/// The command line options
+struct Options final {
+  /// The abigen executable
+  std::string abigen_path;
+
+  /// The header corpus; it is never modified
+  std::string header_folder;
+
+  /// Where the corpus copy, the cache and the metrics files are kept
+  std::string work_folder;
+
+  /// Where the CSV results are saved
+  std::string output_path;
+
+  /// The mutations to measure, in order
+  std::vector<std::string> mutation_list{kMutationList};
+
+  /// Passed to the generate command as they are
+  std::vector<std::string> generate_argument_list;
+};
+
+/// The measurements of a single run
+struct RunMeasurement final {
+  /// Elapsed time, in seconds
+  double wall_time{0.0};
+
+  /// User and system time of abigen and of its children, in seconds
+  double cpu_time{0.0};
+
+  /// How many probes have been compiled by clang
+  std::size_t compile_count{0U};
+
+  /// Lookups served and missed by the probe cache
+  std::size_t probe_cache_hits{0U};
+  std::size_t probe_cache_misses{0U};
+
+  /// Lookups served and missed by the precompiled header cache
+  std::size_t pch_cache_hits{0U};
+  std::size_t pch_cache_misses{0U};
+
+  /// How many headers have been accepted
+  std::size_t accepted_header_count{0U};
+
+  /// The exit code of abigen; -1 if it could not be started or if it has
+  /// been terminated by a signal
+  int exit_code{-1};
+};
+
+/// Parses the command line, returning false if it is not valid
+bool parseOptions(Options &options, int argc, char *argv[]) {
+  auto L_optionHandler = [&options](const std::string &option,
+                                   const std::string &value) -> bool {
+    if (option == "--abigen") {
+      options.abigen_path = value;
+
+    } else if (option == "--header-folder") {
+      options.header_folder = value;
+
+    } else if (option == "--work-folder") {
+      options.work_folder = value;
+
+    } else if (option == "--output") {
+      options.output_path = value;
+
+    } else if (option == "--mutations") {
+      options.mutation_list.clear();
+
+      std::stringstream stream(value);
+      std::string mutation;
+
+      while (std::getline(stream, mutation, ',')) {
+        if (std::find(kMutationList.begin(), kMutationList.end(), mutation) ==
+            kMutationList.end()) {
+          std::cerr << "Unknown mutation: " << mutation << "\n";
+          return false;
+        }
+
+        options.mutation_list.push_back(mutation);
+      }
+
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  if (!parseOptionList(argc, argv, L_optionHandler,
+                       &options.generate_argument_list)) {
+    return false;
+  }
+
+  if (options.abigen_path.empty() || options.header_folder.empty() ||
+      options.work_folder.empty() || options.output_path.empty() ||
+      options.generate_argument_list.empty()) {
+    std::cerr << "Usage: cache_mutations --abigen <path> --header-folder "
+                 "<path> --work-folder <path> --output <results.csv> "
+                 "[--mutations <mutation,...>] -- <generate arguments>...\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Counts how many headers of the corpus include each file name
+std::unordered_map<std::string, std::size_t>
+countIncludingHeaders(const std::vector<std::string> &header_list,
+                      const std::string &header_folder) {
+  static const std::regex include_regex(
+      R"(^\s*#\s*include\s*[<"]([^>"]+)[>"])");
+
+  std::unordered_map<std::string, std::size_t> includer_count_map;
+
+  for (const auto &header : header_list) {
+    std::ifstream header_file(stdfs::path(header_folder) / header);
+
+    std::vector<std::string> included_name_list;
+    std::string line;
+
+    while (std::getline(header_file, line)) {
+      std::smatch match;
+      if (std::regex_search(line, match, include_regex)) {
+        included_name_list.push_back(
+            stdfs::path(match[1].str()).filename().string());
+      }
+    }
+
+    std::sort(included_name_list.begin(), included_name_list.end());
+    included_name_list.erase(
+        std::unique(included_name_list.begin(), included_name_list.end()),
+        included_name_list.end());
+
+    for (const auto &included_name : included_name_list) {
+      ++includer_count_map[included_name];
+    }
+  }
+
+  return includer_count_map;
+}
+
+/// Replaces the destination folder with a copy of the source one
+bool copyFolder(const std::string &source_folder,
+                const std::string &destination_folder) {
+  std::error_code error;
+  stdfs::remove_all(destination_folder, error);
+  if (error) {
+    return false;
+  }
+
+  stdfs::create_directories(destination_folder, error);
+  if (error) {
+    return false;
+  }
+
+  stdfs::copy(source_folder, destination_folder,
+              stdfs::copy_options::recursive, error);
+
+  return !error;
+}
+
+/// Appends the mutation declaration to the given file
+bool appendDeclaration(const stdfs::path &path) {
+  std::ofstream file(path, std::ios::out | std::ios::app);
+  file << kMutationDeclaration;
+
+  return static_cast<bool>(file);
+}
+
+/// Returns the given statistic of a metrics file, or zero if it is missing
+std::size_t getStatistic(const json11::Json &metrics,
+                         const std::string &name) {
+  return static_cast<std::size_t>(metrics["statistics"][name].number_value());
+}
+
+/// Runs abigen with the given arguments, waiting for it to terminate, and
+/// reads the metrics file it has written
+RunMeasurement runAbigen(const std::string &abigen_path,
+                         const std::vector<std::string> &argument_list,
+                         const std::string &metrics_path) {
+  RunMeasurement measurement;
+
+  auto process_measurement = runProcess(abigen_path, argument_list);
+  measurement.wall_time = process_measurement.wall_time;
+  measurement.cpu_time = process_measurement.cpu_time;
+  measurement.exit_code = process_measurement.exit_code;
+
+  std::ifstream metrics_file(metrics_path);
+  std::stringstream buffer;
+  buffer << metrics_file.rdbuf();
+
+  std::string error;
+  auto metrics = json11::Json::parse(buffer.str(), error);
+  if (!error.empty()) {
+    return measurement;
+  }
+
+  measurement.compile_count =
+      static_cast<std::size_t>(metrics["probes"]["count"].number_value());
+
+  measurement.probe_cache_hits = getStatistic(metrics, "Probe cache hits");
+  measurement.probe_cache_misses = getStatistic(metrics, "Probe cache misses");
+  measurement.pch_cache_hits = getStatistic(metrics, "PCH cache hits");
+  measurement.pch_cache_misses = getStatistic(metrics, "PCH cache misses");
+  measurement.accepted_header_count =
+      getStatistic(metrics, "Accepted headers");
+
+  return measurement;
+}
+
+/// Returns the fraction of the lookups served by a cache
+double getHitRate(std::size_t hit_count, std::size_t miss_count) {
+  auto lookup_count = hit_count + miss_count;
+  return (lookup_count != 0U) ? static_cast<double>(hit_count) /
+                                    static_cast<double>(lookup_count)
+                              : 0.0;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(options, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  std::vector<std::string> header_list;
+  if (!enumerateHeaders(header_list, options.header_folder) ||
+      header_list.empty()) {
+    std::cerr << "Failed to enumerate the headers in the following folder: "
+              << options.header_folder << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // The leaf is the first header that no other header includes, and the
+  // widely included header the one with the most includers
+  auto includer_count_map =
+      countIncludingHeaders(header_list, options.header_folder);
+
+  auto L_includerCount = [&](const std::string &header) -> std::size_t {
+    auto it = includer_count_map.find(stdfs::path(header).filename().string());
+    return (it != includer_count_map.end()) ? it->second : 0U;
+  };
+
+  auto leaf_header = header_list.front();
+  auto leaf_it = std::find_if(header_list.begin(), header_list.end(),
+                              [&](const std::string &header) -> bool {
+                                return L_includerCount(header) == 0U;
+                              });
+
+  if (leaf_it != header_list.end()) {
+    leaf_header = *leaf_it;
+  }
+
+  auto widely_included_header = header_list.front();
+  for (const auto &header : header_list) {
+    if (L_includerCount(header) > L_includerCount(widely_included_header)) {
+      widely_included_header = header;
+    }
+  }
+
+  const auto work_folder = stdfs::path(options.work_folder);
+  const auto corpus_folder = (work_folder / "headers").string();
+  const auto cache_folder = (work_folder / "cache").string();
+  const auto metrics_folder = work_folder / "metrics";
+  const auto empty_include_folder = (work_folder / "empty_include").string();
+
+  std::error_code error;
+  stdfs::remove_all(cache_folder, error);
+  stdfs::create_directories(metrics_folder, error);
+  stdfs::create_directories(empty_include_folder, error);
+
+  if (!copyFolder(options.header_folder, corpus_folder)) {
+    std::cerr << "Failed to copy the corpus to the work folder: "
+              << corpus_folder << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream output_file(options.output_path,
+                            std::ios::out | std::ios::trunc);
+  if (!output_file) {
+    std::cerr << "Failed to create the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  output_file << "run,header,wall_time,cpu_time,compilations,"
+                 "probe_cache_hit_rate,pch_cache_hit_rate,accepted_headers,"
+                 "exit_code\n";
+
+  output_file << std::fixed << std::setprecision(3);
+  std::cout << std::fixed << std::setprecision(3);
+
+  bool succeeded = true;
+
+  auto L_run = [&](const std::string &run_name, const std::string &header,
+                   const std::vector<std::string> &extra_argument_list) {
+    auto metrics_path = (metrics_folder / (run_name + ".json")).string();
+    stdfs::remove(metrics_path, error);
+
+    std::vector<std::string> argument_list = {"generate"};
+    argument_list.insert(argument_list.end(),
+                         options.generate_argument_list.begin(),
+                         options.generate_argument_list.end());
+
+    argument_list.insert(argument_list.end(),
+                         {"-f", corpus_folder, "--cache-dir", cache_folder,
+                          "--metrics-file", metrics_path});
+
+    argument_list.insert(argument_list.end(), extra_argument_list.begin(),
+                         extra_argument_list.end());
+
+    auto measurement =
+        runAbigen(options.abigen_path, argument_list, metrics_path);
+
+    if (measurement.exit_code != 0) {
+      succeeded = false;
+    }
+
+    auto probe_cache_hit_rate = getHitRate(measurement.probe_cache_hits,
+                                           measurement.probe_cache_misses);
+
+    auto pch_cache_hit_rate =
+        getHitRate(measurement.pch_cache_hits, measurement.pch_cache_misses);
+
+    output_file << run_name << "," << header << "," << measurement.wall_time
+                << "," << measurement.cpu_time << ","
+                << measurement.compile_count << "," << probe_cache_hit_rate
+                << "," << pch_cache_hit_rate << ","
+                << measurement.accepted_header_count << ","
+                << measurement.exit_code << "\n";
+
+    std::cout << "  " << std::left << std::setw(16) << run_name << std::right
+              << std::setw(10) << measurement.wall_time << " s, "
+              << std::setw(6) << measurement.compile_count
+              << " compilations, probe cache hit rate "
+              << probe_cache_hit_rate
+              << (measurement.exit_code != 0 ? "  FAILED" : "") << "\n";
+  };
+
+  L_run("cold", "", {});
+
+  for (const auto &mutation : options.mutation_list) {
+    std::string header;
+    std::vector<std::string> extra_argument_list;
+    bool mutated = true;
+
+    if (mutation == "leaf_edit") {
+      header = leaf_header;
+      mutated = appendDeclaration(stdfs::path(corpus_folder) / header);
+
+    } else if (mutation == "widely_included") {
+      header = widely_included_header;
+      mutated = appendDeclaration(stdfs::path(corpus_folder) / header);
+
+    } else if (mutation == "add_header") {
+      header = kAddedHeaderName;
+
+      std::ofstream added_header(stdfs::path(corpus_folder) / header);
+      added_header << "#pragma once\n\nint abigen_benchmark_added(int);\n";
+      mutated = static_cast<bool>(added_header);
+
+    } else if (mutation == "remove_header") {
+      header = leaf_header;
+      mutated = stdfs::remove(stdfs::path(corpus_folder) / header, error);
+
+    } else if (mutation == "flag_change") {
+      extra_argument_list = {"-i", empty_include_folder};
+    }
+
+    if (!mutated) {
+      std::cerr << "Failed to apply the " << mutation << " mutation\n";
+      return EXIT_FAILURE;
+    }
+
+    L_run(mutation, header, extra_argument_list);
+
+    // Only the mutated header is restored; copying the whole corpus again
+    // would also touch the files the mutation left alone
+    error.clear();
+    if (header == kAddedHeaderName) {
+      stdfs::remove(stdfs::path(corpus_folder) / header, error);
+
+    } else if (!header.empty()) {
+      stdfs::copy_file(stdfs::path(options.header_folder) / header,
+                       stdfs::path(corpus_folder) / header,
+                       stdfs::copy_options::overwrite_existing, error);
+    }
+
+    if (error) {
+      std::cerr << "Failed to restore the following header: " << header
+                << "\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!output_file) {
+    std::cerr << "Failed to write the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "\nCache mutation results saved to " << options.output_path
+            << "\n";
+
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
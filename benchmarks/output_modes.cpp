@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Produces the ABI artifact of a header corpus with each output mode, and
+// saves the generate time, the compile time and peak memory, the artifact
+// size and the time mcsema-lift takes to load the artifact to a CSV file,
+// so that the fastest mode can be picked for each library. The modes are:
+//
+//   full          generate, then compile the implementation file
+//   single_array  same as full, with a single __mcsema_externs array
+//   sliced        generate --sliced-header, then compile (C only)
+//   sharded       generate --shards, then compile the shard folder
+//   per_header    generate --header-sublibraries, then compile the folder
+//   bitcode       generate --emit-bitcode; no compile step
+//   definitions   generate --mcsema-definitions; no compile step
+//
+// Usage: output_modes --abigen <path> --header-folder <path>
+//                     --profile <name> --language <name>
+//                     --output-folder <path> --output <results.csv>
+//                     [--modes <mode,...>] [--jobs <count>]
+//                     [--shards <count>] [--mcsema-lift <path>
+//                     --cfg <path> [--definitions-flag <flag>]]
+//                     [-- <generate arguments>...]
+//
+// Each mode writes to its own subfolder of the output folder. The load time
+// is only measured when mcsema-lift and a CFG of a binary using the corpus
+// are given; the bitcode is passed with --abi_libraries, and the mcsema
+// definitions with the given flag (--library by default)
+
+#include "benchmark_support.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+/// The modes measured when --modes is not given
+const std::vector<std::string> kOutputModeList = {
+    "full",       "single_array", "sliced",     "sharded",
+    "per_header", "bitcode",      "definitions"};
+
+/// The command line options
+struct Options final {
+  /// The abigen executable
+  std::string abigen_path;
+
+  /// The header corpus
+  std::string header_folder;
+
+  /// The profile used by generate and compile
+  std::string profile;
+
+  /// The language used by generate and compile
+  std::string language;
+
+  /// Where the artifacts of each mode are saved
+  std::string output_folder;
+
+  /// Where the CSV results are saved
+  std::string output_path;
+
+  /// The modes to measure
+  std::vector<std::string> mode_list{kOutputModeList};
+
+  /// The job count passed to generate and compile
+  std::size_t jobs{1U};
+
+  /// The shard count of the sharded mode
+  std::size_t shards{4U};
+
+  /// The mcsema-lift executable; the load time is not measured when empty
+  std::string mcsema_lift_path;
+
+  /// The CFG lifted when measuring the load time
+  std::string cfg_path;
+
+  /// The mcsema-lift flag receiving the mcsema definitions
+  std::string definitions_flag{"--library"};
+
+  /// Passed to the generate command as they are
+  std::vector<std::string> generate_argument_list;
+};
+
+/// The measurements of a single mode
+struct ModeMeasurement final {
+  /// Elapsed time of the generate command, in seconds
+  double generate_time{0.0};
+
+  /// Elapsed time of the compile command, in seconds; zero for the modes
+  /// without a compile step
+  double compile_time{0.0};
+
+  /// Peak resident memory of the compile command, in KiB; zero for the
+  /// modes without a compile step
+  std::uint64_t compile_peak_memory{0U};
+
+  /// The size of the artifact loaded by mcsema, in bytes
+  std::uintmax_t artifact_size{0U};
+
+  /// Elapsed time of mcsema-lift, in seconds; zero when not measured
+  double load_time{0.0};
+
+  /// The exit code of the first command that failed, or zero
+  int exit_code{0};
+};
+
+/// Parses the command line, returning false if it is not valid
+bool parseOptions(Options &options, int argc, char *argv[]) {
+  auto L_optionHandler = [&options](const std::string &option,
+                                   const std::string &value) -> bool {
+    if (option == "--abigen") {
+      options.abigen_path = value;
+
+    } else if (option == "--header-folder") {
+      options.header_folder = value;
+
+    } else if (option == "--profile") {
+      options.profile = value;
+
+    } else if (option == "--language") {
+      options.language = value;
+
+    } else if (option == "--output-folder") {
+      options.output_folder = value;
+
+    } else if (option == "--output") {
+      options.output_path = value;
+
+    } else if (option == "--jobs") {
+      if (!parseSize(options.jobs, value)) {
+        std::cerr << "Invalid job count: " << value << "\n";
+        return false;
+      }
+
+    } else if (option == "--shards") {
+      if (!parseSize(options.shards, value)) {
+        std::cerr << "Invalid shard count: " << value << "\n";
+        return false;
+      }
+
+    } else if (option == "--modes") {
+      options.mode_list.clear();
+
+      std::stringstream stream(value);
+      std::string mode;
+
+      while (std::getline(stream, mode, ',')) {
+        if (std::find(kOutputModeList.begin(), kOutputModeList.end(), mode) ==
+            kOutputModeList.end()) {
+          std::cerr << "Unknown output mode: " << mode << "\n";
+          return false;
+        }
+
+        options.mode_list.push_back(mode);
+      }
+
+    } else if (option == "--mcsema-lift") {
+      options.mcsema_lift_path = value;
+
+    } else if (option == "--cfg") {
+      options.cfg_path = value;
+
+    } else if (option == "--definitions-flag") {
+      options.definitions_flag = value;
+
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  if (!parseOptionList(argc, argv, L_optionHandler,
+                       &options.generate_argument_list)) {
+    return false;
+  }
+
+  if (options.abigen_path.empty() || options.header_folder.empty() ||
+      options.profile.empty() || options.language.empty() ||
+      options.output_folder.empty() || options.output_path.empty() ||
+      options.mode_list.empty()) {
+    std::cerr << "Usage: output_modes --abigen <path> --header-folder <path> "
+                 "--profile <name> --language <name> --output-folder <path> "
+                 "--output <results.csv> [--modes <mode,...>] "
+                 "[--jobs <count>] [--shards <count>] [--mcsema-lift <path> "
+                 "--cfg <path> [--definitions-flag <flag>]] [-- <generate "
+                 "arguments>...]\n";
+    return false;
+  }
+
+  if (options.mcsema_lift_path.empty() != options.cfg_path.empty()) {
+    std::cerr << "The load time needs both --mcsema-lift and --cfg\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Produces and loads the artifact of the given mode
+ModeMeasurement measureMode(const Options &options, const std::string &mode) {
+  ModeMeasurement measurement;
+
+  auto mode_folder = stdfs::path(options.output_folder) / mode;
+
+  // Artifacts left by a previous run would be picked up by the shard folder
+  // compilation
+  std::error_code error;
+  stdfs::remove_all(mode_folder, error);
+  stdfs::create_directories(mode_folder, error);
+
+  auto output_path = (mode_folder / "abi_library").string();
+
+  std::vector<std::string> generate_argument_list = {
+      "generate", "-p", options.profile, "-l", options.language,
+      "-f", options.header_folder, "-j", std::to_string(options.jobs),
+      "-o", output_path};
+
+  std::vector<std::string> compile_source_list;
+  std::string artifact_path = output_path + ".bc";
+
+  if (mode == "full") {
+    compile_source_list.push_back(output_path + ".cpp");
+
+  } else if (mode == "single_array") {
+    generate_argument_list.push_back("--extern-array-size");
+    generate_argument_list.push_back("0");
+    compile_source_list.push_back(output_path + ".cpp");
+
+  } else if (mode == "sliced") {
+    generate_argument_list.push_back("--sliced-header");
+    compile_source_list.push_back(output_path + ".cpp");
+
+  } else if (mode == "sharded") {
+    generate_argument_list.push_back("--shards");
+    generate_argument_list.push_back(std::to_string(options.shards));
+
+    // The compile command picks up the .cpp shards inside the folder
+    compile_source_list.push_back(mode_folder.string());
+
+  } else if (mode == "per_header") {
+    generate_argument_list.push_back("--header-sublibraries");
+    compile_source_list.push_back(output_path + "_headers");
+
+  } else if (mode == "bitcode") {
+    generate_argument_list.push_back("--emit-bitcode");
+
+  } else if (mode == "definitions") {
+    generate_argument_list.push_back("--mcsema-definitions");
+    artifact_path = output_path + ".defs.txt";
+  }
+
+  generate_argument_list.insert(generate_argument_list.end(),
+                                options.generate_argument_list.begin(),
+                                options.generate_argument_list.end());
+
+  auto process_measurement =
+      runProcess(options.abigen_path, generate_argument_list);
+
+  measurement.generate_time = process_measurement.wall_time;
+  measurement.exit_code = process_measurement.exit_code;
+
+  if (measurement.exit_code != 0) {
+    return measurement;
+  }
+
+  if (!compile_source_list.empty()) {
+    std::vector<std::string> compile_argument_list = {
+        "compile", "-p", options.profile, "-l", options.language,
+        "-j",      std::to_string(options.jobs), "-o", artifact_path};
+
+    for (const auto &source_path : compile_source_list) {
+      compile_argument_list.push_back("-f");
+      compile_argument_list.push_back(source_path);
+    }
+
+    process_measurement =
+        runProcess(options.abigen_path, compile_argument_list);
+
+    measurement.compile_time = process_measurement.wall_time;
+    measurement.compile_peak_memory =
+        process_measurement.peak_resident_memory / 1024U;
+    measurement.exit_code = process_measurement.exit_code;
+
+    if (measurement.exit_code != 0) {
+      return measurement;
+    }
+  }
+
+  measurement.artifact_size = stdfs::file_size(artifact_path, error);
+  if (error) {
+    measurement.artifact_size = 0U;
+    measurement.exit_code = -1;
+    return measurement;
+  }
+
+  if (!options.mcsema_lift_path.empty()) {
+    std::vector<std::string> lift_argument_list = {
+        "--output", (mode_folder / "lifted.bc").string(), "--arch", "amd64",
+        "--os", "linux", "--cfg", options.cfg_path};
+
+    lift_argument_list.push_back(mode == "definitions"
+                                     ? options.definitions_flag
+                                     : std::string("--abi_libraries"));
+
+    lift_argument_list.push_back(artifact_path);
+
+    process_measurement =
+        runProcess(options.mcsema_lift_path, lift_argument_list);
+
+    measurement.load_time = process_measurement.wall_time;
+    measurement.exit_code = process_measurement.exit_code;
+  }
+
+  return measurement;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(options, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  std::ofstream output_file(options.output_path,
+                            std::ios::out | std::ios::trunc);
+  if (!output_file) {
+    std::cerr << "Failed to create the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  output_file << "mode,generate_time,compile_time,compile_peak_kib,"
+                 "total_time,artifact_kib,load_time,exit_code\n";
+
+  output_file << std::fixed << std::setprecision(3);
+  std::cout << std::fixed << std::setprecision(3);
+
+  bool succeeded = true;
+
+  std::string fastest_mode;
+  double fastest_time = 0.0;
+
+  for (const auto &mode : options.mode_list) {
+    auto measurement = measureMode(options, mode);
+    if (measurement.exit_code != 0) {
+      succeeded = false;
+    }
+
+    // The load time is paid each time the artifact is used, but it is only
+    // known when mcsema-lift has been given
+    auto total_time = measurement.generate_time + measurement.compile_time +
+                      measurement.load_time;
+
+    auto artifact_kib = static_cast<double>(measurement.artifact_size) / 1024.0;
+
+    output_file << mode << "," << measurement.generate_time << ","
+                << measurement.compile_time << ","
+                << measurement.compile_peak_memory << "," << total_time << ","
+                << artifact_kib << "," << measurement.load_time << ","
+                << measurement.exit_code << "\n";
+
+    std::cout << "  " << std::setw(12) << std::left << mode << std::right
+              << " generate " << std::setw(9) << measurement.generate_time
+              << " s, compile " << std::setw(9) << measurement.compile_time
+              << " s (" << measurement.compile_peak_memory
+              << " KiB peak), artifact " << std::setw(10) << artifact_kib
+              << " KiB, load " << std::setw(9) << measurement.load_time
+              << " s" << (measurement.exit_code != 0 ? "  FAILED" : "")
+              << "\n";
+
+    if (measurement.exit_code == 0 &&
+        (fastest_mode.empty() || total_time < fastest_time)) {
+      fastest_mode = mode;
+      fastest_time = total_time;
+    }
+  }
+
+  if (!output_file) {
+    std::cerr << "Failed to write the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  if (!fastest_mode.empty()) {
+    std::cout << "\nFastest mode: " << fastest_mode << " (" << fastest_time
+              << " s)\n";
+  }
+
+  std::cout << "Output mode results saved to " << options.output_path << "\n";
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Measures the per-declaration cost of the checks used by the ASTVisitor to
+// dispatch on the declaration kind, comparing the C++ dynamic_cast with the
+// LLVM-style isa/cast helpers
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/Tooling.h>
+#include <llvm/Support/Casting.h>
+
+namespace {
+/// How many classes are generated in the benchmark buffer
+const std::size_t kClassCount = 500U;
+
+/// How many methods are generated for each class
+const std::size_t kMethodCount = 20U;
+
+/// How many free functions are generated in the benchmark buffer
+const std::size_t kFunctionCount = 10000U;
+
+/// How many times each check is repeated over the declaration list
+const std::size_t kIterationCount = 200U;
+
+/// A list of function declarations
+using FunctionDeclList = std::vector<clang::FunctionDecl *>;
+
+/// Collects all the function declarations in the translation unit
+class FunctionCollector final
+    : public clang::RecursiveASTVisitor<FunctionCollector> {
+ public:
+  /// The declarations that have been found
+  FunctionDeclList function_decl_list;
+
+  /// Called for each function (or method) declaration
+  bool VisitFunctionDecl(clang::FunctionDecl *declaration) {
+    function_decl_list.push_back(declaration);
+    return true;
+  }
+};
+
+/// Generates a source buffer with both methods and free functions
+std::string generateBenchmarkBuffer() {
+  std::stringstream buffer;
+
+  for (std::size_t i = 0U; i < kClassCount; ++i) {
+    buffer << "struct Base" << i << " { virtual ~Base" << i << "(); };\n";
+    buffer << "struct Class" << i << " : Base" << i << " {\n";
+    buffer << "  Class" << i << "();\n";
+    buffer << "  ~Class" << i << "();\n";
+
+    for (std::size_t j = 0U; j < kMethodCount; ++j) {
+      buffer << "  int method" << j << "(int, char *);\n";
+    }
+
+    buffer << "};\n";
+  }
+
+  for (std::size_t i = 0U; i < kFunctionCount; ++i) {
+    buffer << "int function" << i << "(int, char *);\n";
+  }
+
+  return buffer.str();
+}
+
+/// The checks performed by the ASTVisitor for each function, implemented
+/// with dynamic_cast
+std::size_t dynamicCastChecks(clang::FunctionDecl *decl) {
+  std::size_t result = 0U;
+
+  auto method_decl = dynamic_cast<clang::CXXMethodDecl *>(decl);
+  if (method_decl != nullptr) {
+    result += reinterpret_cast<std::uintptr_t>(method_decl->getParent()) & 1U;
+
+    if (dynamic_cast<clang::CXXConstructorDecl *>(decl) != nullptr) {
+      result += 2U;
+    } else if (dynamic_cast<clang::CXXDestructorDecl *>(decl) != nullptr) {
+      result += 4U;
+    }
+  }
+
+  return result;
+}
+
+/// The checks performed by the ASTVisitor for each function, implemented
+/// with the LLVM-style helpers
+std::size_t llvmCastChecks(clang::FunctionDecl *decl) {
+  std::size_t result = 0U;
+
+  auto method_decl = llvm::dyn_cast<clang::CXXMethodDecl>(decl);
+  if (method_decl != nullptr) {
+    result += reinterpret_cast<std::uintptr_t>(method_decl->getParent()) & 1U;
+
+    if (llvm::isa<clang::CXXConstructorDecl>(decl)) {
+      result += 2U;
+    } else if (llvm::isa<clang::CXXDestructorDecl>(decl)) {
+      result += 4U;
+    }
+  }
+
+  return result;
+}
+
+/// Runs the given check over the declaration list, returning the average
+/// amount of nanoseconds per declaration
+template <typename Check>
+double measure(const FunctionDeclList &function_decl_list, Check check) {
+  // The result is accumulated so that the checks are not optimized away
+  volatile std::size_t sink = 0U;
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (std::size_t i = 0U; i < kIterationCount; ++i) {
+    std::size_t result = 0U;
+    for (auto decl : function_decl_list) {
+      result += check(decl);
+    }
+
+    sink = sink + result;
+  }
+
+  auto end = std::chrono::steady_clock::now();
+
+  auto elapsed =
+      std::chrono::duration<double, std::nano>(end - start).count();
+
+  return elapsed / static_cast<double>(kIterationCount *
+                                       function_decl_list.size());
+}
+}  // namespace
+
+int main() {
+  auto ast_unit = clang::tooling::buildASTFromCode(generateBenchmarkBuffer());
+  if (!ast_unit) {
+    std::cerr << "Failed to build the benchmark AST\n";
+    return EXIT_FAILURE;
+  }
+
+  FunctionCollector collector;
+  collector.TraverseDecl(ast_unit->getASTContext().getTranslationUnitDecl());
+
+  const auto &function_decl_list = collector.function_decl_list;
+  if (function_decl_list.empty()) {
+    std::cerr << "No function declaration found\n";
+    return EXIT_FAILURE;
+  }
+
+  // Both implementations must agree before their timings are compared
+  for (auto decl : function_decl_list) {
+    if (dynamicCastChecks(decl) != llvmCastChecks(decl)) {
+      std::cerr << "The two implementations returned different results\n";
+      return EXIT_FAILURE;
+    }
+  }
+
+  auto dynamic_cast_time = measure(function_decl_list, dynamicCastChecks);
+  auto llvm_cast_time = measure(function_decl_list, llvmCastChecks);
+
+  std::cout << "Declarations: " << function_decl_list.size() << "\n";
+  std::cout << "dynamic_cast: " << dynamic_cast_time << " ns/decl\n";
+  std::cout << "isa/dyn_cast: " << llvm_cast_time << " ns/decl\n";
+
+  return EXIT_SUCCESS;
+}
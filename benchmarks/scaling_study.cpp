@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Runs `abigen generate` over a header corpus with an increasing amount of
+// jobs (1, 2, 4, ... up to the maximum) and on increasing subsets of its
+// headers, and saves the wall time, the CPU time, the speedup, the parallel
+// efficiency and the peak memory usage of each run to a CSV file
+//
+// Usage: scaling_study --abigen <path> --header-folder <path>
+//                      --output <results.csv> [--max-jobs <count>]
+//                      [--subset-sizes <count,...>] [--repetitions <count>]
+//                      -- <generate arguments>...
+//
+// The generate arguments must select the profile, the language and the
+// output path; the header folder and the job count are added by the study.
+// Subsets are made of the first headers of the folder in path order, each
+// selected with --include-glob; the whole corpus is always measured last.
+// The speedup and the efficiency are relative to the single job run on the
+// same subset. CPU time and peak memory are taken from the resource usage
+// of the abigen process and of the children it waited for
+
+#include "benchmark_support.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+/// The command line options
+struct Options final {
+  /// The abigen executable
+  std::string abigen_path;
+
+  /// The header corpus
+  std::string header_folder;
+
+  /// Where the CSV results are saved
+  std::string output_path;
+
+  /// The highest job count measured
+  std::size_t max_jobs{1U};
+
+  /// The header counts of the subsets; the whole corpus is always added
+  std::vector<std::size_t> subset_size_list;
+
+  /// How many times each run is repeated; the fastest one is kept
+  std::size_t repetitions{1U};
+
+  /// Passed to the generate command as they are
+  std::vector<std::string> generate_argument_list;
+};
+
+/// Parses the command line, returning false if it is not valid
+bool parseOptions(Options &options, int argc, char *argv[]) {
+  auto hardware_thread_count = std::thread::hardware_concurrency();
+  options.max_jobs = (hardware_thread_count != 0U) ? hardware_thread_count : 1U;
+
+  auto L_optionHandler = [&options](const std::string &option,
+                                   const std::string &value) -> bool {
+    if (option == "--abigen") {
+      options.abigen_path = value;
+
+    } else if (option == "--header-folder") {
+      options.header_folder = value;
+
+    } else if (option == "--output") {
+      options.output_path = value;
+
+    } else if (option == "--max-jobs") {
+      if (!parseSize(options.max_jobs, value)) {
+        std::cerr << "Invalid job count: " << value << "\n";
+        return false;
+      }
+
+    } else if (option == "--repetitions") {
+      if (!parseSize(options.repetitions, value)) {
+        std::cerr << "Invalid repetition count: " << value << "\n";
+        return false;
+      }
+
+    } else if (option == "--subset-sizes") {
+      std::stringstream stream(value);
+      std::string item;
+
+      while (std::getline(stream, item, ',')) {
+        std::size_t subset_size;
+        if (!parseSize(subset_size, item)) {
+          std::cerr << "Invalid subset size: " << item << "\n";
+          return false;
+        }
+
+        options.subset_size_list.push_back(subset_size);
+      }
+
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  if (!parseOptionList(argc, argv, L_optionHandler,
+                       &options.generate_argument_list)) {
+    return false;
+  }
+
+  if (options.abigen_path.empty() || options.header_folder.empty() ||
+      options.output_path.empty() || options.generate_argument_list.empty()) {
+    std::cerr << "Usage: scaling_study --abigen <path> --header-folder <path> "
+                 "--output <results.csv> [--max-jobs <count>] "
+                 "[--subset-sizes <count,...>] [--repetitions <count>] -- "
+                 "<generate arguments>...\n";
+    return false;
+  }
+
+  std::sort(options.subset_size_list.begin(), options.subset_size_list.end());
+  options.subset_size_list.erase(std::unique(options.subset_size_list.begin(),
+                                             options.subset_size_list.end()),
+                                 options.subset_size_list.end());
+
+  return true;
+}
+
+/// Returns the job counts to measure: the powers of two below the maximum,
+/// followed by the maximum itself
+std::vector<std::size_t> getJobCountList(std::size_t max_jobs) {
+  std::vector<std::size_t> job_count_list;
+  for (std::size_t job_count = 1U; job_count < max_jobs; job_count *= 2U) {
+    job_count_list.push_back(job_count);
+  }
+
+  job_count_list.push_back(max_jobs);
+  return job_count_list;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(options, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  // The headers are sorted by path, so that each subset contains the smaller
+  // ones
+  std::vector<std::string> header_list;
+  if (!enumerateHeaders(header_list, options.header_folder)) {
+    std::cerr << "Failed to enumerate the headers in the following folder: "
+              << options.header_folder << "\n";
+    return EXIT_FAILURE;
+  }
+
+  // Subsets that are not smaller than the corpus are measured by the last
+  // run
+  std::vector<std::size_t> subset_size_list;
+  for (auto subset_size : options.subset_size_list) {
+    if (subset_size < header_list.size()) {
+      subset_size_list.push_back(subset_size);
+    }
+  }
+
+  subset_size_list.push_back(header_list.size());
+
+  std::ofstream output_file(options.output_path,
+                            std::ios::out | std::ios::trunc);
+  if (!output_file) {
+    std::cerr << "Failed to create the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  output_file << "headers,jobs,wall_time,cpu_time,speedup,efficiency,"
+                 "peak_rss_mib,exit_code\n";
+
+  output_file << std::fixed << std::setprecision(3);
+  std::cout << std::fixed << std::setprecision(3);
+
+  bool succeeded = true;
+
+  for (auto subset_size : subset_size_list) {
+    std::vector<std::string> subset_argument_list;
+    if (subset_size < header_list.size()) {
+      for (std::size_t i = 0U; i < subset_size; ++i) {
+        subset_argument_list.push_back("--include-glob");
+        subset_argument_list.push_back(header_list[i]);
+      }
+    }
+
+    double single_job_wall_time = 0.0;
+
+    for (auto job_count : getJobCountList(options.max_jobs)) {
+      std::vector<std::string> argument_list = {"generate"};
+      argument_list.insert(argument_list.end(),
+                           options.generate_argument_list.begin(),
+                           options.generate_argument_list.end());
+
+      argument_list.push_back("-f");
+      argument_list.push_back(options.header_folder);
+      argument_list.push_back("-j");
+      argument_list.push_back(std::to_string(job_count));
+
+      argument_list.insert(argument_list.end(), subset_argument_list.begin(),
+                           subset_argument_list.end());
+
+      ProcessMeasurement measurement;
+      for (std::size_t i = 0U; i < options.repetitions; ++i) {
+        auto current_measurement =
+            runProcess(options.abigen_path, argument_list);
+
+        if (i == 0U || current_measurement.exit_code != 0 ||
+            current_measurement.wall_time < measurement.wall_time) {
+          measurement = current_measurement;
+        }
+
+        if (measurement.exit_code != 0) {
+          break;
+        }
+      }
+
+      if (measurement.exit_code != 0) {
+        succeeded = false;
+      }
+
+      if (job_count == 1U) {
+        single_job_wall_time = measurement.wall_time;
+      }
+
+      auto speedup = (measurement.wall_time > 0.0)
+                         ? single_job_wall_time / measurement.wall_time
+                         : 0.0;
+
+      auto efficiency = speedup / static_cast<double>(job_count);
+      auto peak_rss_mib =
+          static_cast<double>(measurement.peak_resident_memory) /
+          (1024.0 * 1024.0);
+
+      output_file << subset_size << "," << job_count << ","
+                  << measurement.wall_time << "," << measurement.cpu_time << ","
+                  << speedup << "," << efficiency << "," << peak_rss_mib << ","
+                  << measurement.exit_code << "\n";
+
+      std::cout << "  " << std::setw(6) << subset_size << " headers, "
+                << std::setw(3) << job_count << " jobs: " << std::setw(10)
+                << measurement.wall_time << " s, speedup " << speedup
+                << ", efficiency " << efficiency
+                << (measurement.exit_code != 0 ? "  FAILED" : "") << "\n";
+    }
+  }
+
+  if (!output_file) {
+    std::cerr << "Failed to write the results file: " << options.output_path
+              << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << "\nScaling results saved to " << options.output_path << "\n";
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,398 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Writes a synthetic C header tree that exercises the probe loop at a
+// realistic scale, without shipping a real SDK in the repository
+//
+// Usage: synthetic_sdk --output <folder> [--headers <count>]
+//                      [--depth <levels>] [--broken <count>]
+//                      [--order-dependent <count>] [--ambiguous <count>]
+//                      [--seed <value>]
+//
+// Headers are split in modules of kModuleHeaderCount files, and each one
+// declares a structure and a few functions (some taking a callback, which
+// abigen blacklists). The depth is the length of the longest #include
+// chain. Broken headers never compile; order dependent headers use the
+// structure of a later header without including it, so they are only
+// accepted once that header is; ambiguous headers share their name with
+// the ones of the other modules, and can only be included through their
+// module folder. The same seed always produces the same tree
+
+#include "benchmark_support.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+/// How many headers each module folder contains
+const std::size_t kModuleHeaderCount = 100U;
+
+/// How many functions each header declares
+const std::size_t kFunctionsPerHeader = 4U;
+
+/// The most headers a header includes
+const std::size_t kMaxIncludeCount = 3U;
+
+/// The name of the ambiguous headers, found in several modules
+const std::string kAmbiguousHeaderName = "common.h";
+
+/// The command line options
+struct Options final {
+  /// Where the tree is written; it must not exist yet, or be empty
+  std::string output_folder;
+
+  /// Total amount of headers
+  std::size_t header_count{1000U};
+
+  /// Length of the longest include chain
+  std::size_t depth{4U};
+
+  /// Headers that never compile
+  std::size_t broken_count{10U};
+
+  /// Headers needing a later header to be included first
+  std::size_t order_dependent_count{10U};
+
+  /// Headers sharing their name with the ones of the other modules
+  std::size_t ambiguous_count{10U};
+
+  /// Seed of the random generator
+  std::uint32_t seed{1U};
+};
+
+/// The kind of each generated header
+enum class HeaderKind { Regular, Broken, OrderDependent, Ambiguous };
+
+/// A generated header
+struct SyntheticHeader final {
+  /// The path relative to the output folder
+  std::string path;
+
+  /// What the header exercises
+  HeaderKind kind{HeaderKind::Regular};
+
+  /// Length of the include chain ending at this header
+  std::size_t level{1U};
+
+  /// The headers it includes
+  std::vector<std::size_t> include_list;
+
+  /// Order dependent headers: the header that must be included first
+  std::size_t required_header{0U};
+};
+
+/// Parses the command line, returning false if it is not valid
+bool parseOptions(Options &options, int argc, char *argv[]) {
+  auto L_optionHandler = [&options](const std::string &option,
+                                   const std::string &value) -> bool {
+    if (option == "--output") {
+      options.output_folder = value;
+      return true;
+    }
+
+    std::size_t number;
+    if (!parseNumber(number, value)) {
+      std::cerr << "Invalid value for " << option << ": " << value << "\n";
+      return false;
+    }
+
+    if (option == "--headers") {
+      options.header_count = number;
+    } else if (option == "--depth") {
+      options.depth = number;
+    } else if (option == "--broken") {
+      options.broken_count = number;
+    } else if (option == "--order-dependent") {
+      options.order_dependent_count = number;
+    } else if (option == "--ambiguous") {
+      options.ambiguous_count = number;
+    } else if (option == "--seed") {
+      options.seed = static_cast<std::uint32_t>(number);
+    } else {
+      std::cerr << "Unknown option: " << option << "\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  if (!parseOptionList(argc, argv, L_optionHandler, nullptr)) {
+    return false;
+  }
+
+  if (options.output_folder.empty()) {
+    std::cerr << "Usage: synthetic_sdk --output <folder> [--headers <count>] "
+                 "[--depth <levels>] [--broken <count>] "
+                 "[--order-dependent <count>] [--ambiguous <count>] "
+                 "[--seed <value>]\n";
+    return false;
+  }
+
+  if (options.header_count == 0U || options.depth == 0U) {
+    std::cerr << "The header count and the depth must not be zero\n";
+    return false;
+  }
+
+  if (options.broken_count + options.order_dependent_count +
+          options.ambiguous_count >
+      options.header_count) {
+    std::cerr << "There are more special headers than headers\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Returns the folder of the given module
+std::string getModuleFolder(std::size_t header_index) {
+  std::stringstream stream;
+  stream << "sdk/module" << std::setw(3) << std::setfill('0')
+         << header_index / kModuleHeaderCount;
+
+  return stream.str();
+}
+
+/// Builds the header list: the kinds are assigned at random, and each header
+/// includes some of the previous ones, without exceeding the depth
+std::vector<SyntheticHeader> generateHeaderList(const Options &options) {
+  std::mt19937 random_generator(options.seed);
+
+  std::vector<SyntheticHeader> header_list(options.header_count);
+
+  std::vector<std::size_t> index_list(options.header_count);
+  for (std::size_t i = 0U; i < index_list.size(); ++i) {
+    index_list[i] = i;
+  }
+
+  std::shuffle(index_list.begin(), index_list.end(), random_generator);
+
+  // Order dependent headers need a later one, so the last header is never
+  // one of them; the counts have been validated, so there are enough
+  // candidates once the special headers are spread across the others
+  auto index_it = index_list.begin();
+  auto L_assignKind = [&](std::size_t count, HeaderKind kind) {
+    for (std::size_t i = 0U; i < count && index_it != index_list.end();) {
+      auto header_index = *index_it++;
+      if (kind == HeaderKind::OrderDependent &&
+          header_index + 1U == options.header_count) {
+        continue;
+      }
+
+      header_list[header_index].kind = kind;
+      ++i;
+    }
+  };
+
+  L_assignKind(options.broken_count, HeaderKind::Broken);
+  L_assignKind(options.order_dependent_count, HeaderKind::OrderDependent);
+  L_assignKind(options.ambiguous_count, HeaderKind::Ambiguous);
+
+  // Only one ambiguous header fits in each module folder
+  std::vector<bool> ambiguous_module_flags(
+      options.header_count / kModuleHeaderCount + 1U, false);
+
+  for (std::size_t i = 0U; i < header_list.size(); ++i) {
+    auto &header = header_list[i];
+    auto module_index = i / kModuleHeaderCount;
+
+    if (header.kind == HeaderKind::Ambiguous) {
+      if (ambiguous_module_flags[module_index]) {
+        header.kind = HeaderKind::Regular;
+      } else {
+        ambiguous_module_flags[module_index] = true;
+      }
+    }
+
+    std::stringstream stream;
+    stream << getModuleFolder(i) << "/";
+
+    if (header.kind == HeaderKind::Ambiguous) {
+      stream << kAmbiguousHeaderName;
+    } else {
+      stream << "header" << std::setw(5) << std::setfill('0') << i << ".h";
+    }
+
+    header.path = stream.str();
+
+    if (header.kind == HeaderKind::OrderDependent) {
+      std::uniform_int_distribution<std::size_t> distribution(
+          i + 1U, options.header_count - 1U);
+
+      // The required header must itself compile on its own
+      header.required_header = distribution(random_generator);
+      if (header_list[header.required_header].kind != HeaderKind::Regular) {
+        header.kind = HeaderKind::Regular;
+      }
+    }
+
+    // Broken and order dependent headers are never included, or they
+    // would break the headers including them
+    if (i == 0U) {
+      continue;
+    }
+
+    std::uniform_int_distribution<std::size_t> count_distribution(
+        0U, kMaxIncludeCount);
+
+    std::uniform_int_distribution<std::size_t> index_distribution(0U, i - 1U);
+
+    auto include_count = count_distribution(random_generator);
+    for (std::size_t attempt = 0U; attempt < include_count * 2U; ++attempt) {
+      if (header.include_list.size() == include_count) {
+        break;
+      }
+
+      auto included_index = index_distribution(random_generator);
+      const auto &included_header = header_list[included_index];
+
+      if (included_header.kind == HeaderKind::Broken ||
+          included_header.kind == HeaderKind::OrderDependent ||
+          included_header.level >= options.depth ||
+          std::find(header.include_list.begin(), header.include_list.end(),
+                    included_index) != header.include_list.end()) {
+        continue;
+      }
+
+      header.include_list.push_back(included_index);
+      header.level = std::max(header.level, included_header.level + 1U);
+    }
+  }
+
+  return header_list;
+}
+
+/// Returns the source of the given header
+std::string generateHeaderSource(const std::vector<SyntheticHeader> &list,
+                                 std::size_t header_index) {
+  const auto &header = list[header_index];
+
+  std::stringstream stream;
+  stream << "#pragma once\n\n";
+
+  for (auto included_index : header.include_list) {
+    stream << "#include <" << list[included_index].path << ">\n";
+  }
+
+  if (!header.include_list.empty()) {
+    stream << "\n";
+  }
+
+  const std::string type_name = "sdk_type_" + std::to_string(header_index);
+
+  stream << "struct " << type_name << " {\n";
+  stream << "  int value;\n";
+
+  for (auto included_index : header.include_list) {
+    stream << "  struct sdk_type_" << included_index << " *field_"
+           << included_index << ";\n";
+  }
+
+  // The structure of the required header is only complete when that header
+  // has been included first
+  if (header.kind == HeaderKind::OrderDependent) {
+    stream << "  struct sdk_type_" << header.required_header << " required;\n";
+  }
+
+  stream << "};\n\n";
+
+  for (std::size_t i = 0U; i < kFunctionsPerHeader; ++i) {
+    stream << "int sdk_function_" << header_index << "_" << i << "(struct "
+           << type_name << " *object";
+
+    // One function in each header takes a callback
+    if (i == 0U) {
+      stream << ", void (*callback)(int)";
+    }
+
+    stream << ");\n";
+  }
+
+  if (header.kind == HeaderKind::Broken) {
+    stream << "\nint sdk_broken_" << header_index << "(;\n";
+  }
+
+  return stream.str();
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  Options options;
+  if (!parseOptions(options, argc, argv)) {
+    return EXIT_FAILURE;
+  }
+
+  auto header_list = generateHeaderList(options);
+
+  std::error_code error;
+  stdfs::create_directories(options.output_folder, error);
+  if (error) {
+    std::cerr << "Failed to create the output folder: "
+              << options.output_folder << "\n";
+    return EXIT_FAILURE;
+  }
+
+  std::size_t kind_count_list[4] = {};
+  std::size_t max_level = 0U;
+
+  for (std::size_t i = 0U; i < header_list.size(); ++i) {
+    const auto &header = header_list[i];
+
+    auto path = stdfs::path(options.output_folder) / header.path;
+    stdfs::create_directories(path.parent_path(), error);
+    if (error) {
+      std::cerr << "Failed to create the following folder: "
+                << path.parent_path().string() << "\n";
+      return EXIT_FAILURE;
+    }
+
+    std::ofstream header_file(path.string(), std::ios::out | std::ios::trunc);
+    header_file << generateHeaderSource(header_list, i);
+
+    if (!header_file) {
+      std::cerr << "Failed to write the following header: " << path.string()
+                << "\n";
+      return EXIT_FAILURE;
+    }
+
+    ++kind_count_list[static_cast<std::size_t>(header.kind)];
+    max_level = std::max(max_level, header.level);
+  }
+
+  std::cout << "Synthetic SDK written to " << options.output_folder << "\n\n";
+  std::cout << "  Headers:              " << header_list.size() << "\n";
+  std::cout << "  Include depth:        " << max_level << "\n";
+  std::cout << "  Broken:               "
+            << kind_count_list[static_cast<std::size_t>(HeaderKind::Broken)]
+            << "\n";
+  std::cout << "  Order dependent:      "
+            << kind_count_list[static_cast<std::size_t>(
+                   HeaderKind::OrderDependent)]
+            << "\n";
+  std::cout << "  Ambiguous:            "
+            << kind_count_list[static_cast<std::size_t>(HeaderKind::Ambiguous)]
+            << "\n";
+
+  return EXIT_SUCCESS;
+}
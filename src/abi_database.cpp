@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "abi_database.h"
+#include "abi_library_columns.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <array>
+#include <cstring>
+#include <type_traits>
+
+namespace {
+/// The first bytes of each database
+const std::array<char, 8> kABIDatabaseMagic = {
+    {'A', 'B', 'I', 'G', 'E', 'N', 'D', 'B'}};
+
+/// Incremented each time the database format changes
+const std::uint32_t kABIDatabaseVersion = 4U;
+
+/// Serializes the database fields; integers are stored in the host byte
+/// order, strings and lists are prefixed by their size
+class DatabaseWriter final {
+  /// The serialized data
+  std::string buffer;
+
+ public:
+  /// Appends the given integer
+  void write(std::uint32_t value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  /// Appends the given 64-bit integer
+  void write(std::uint64_t value) {
+    buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  /// Appends the given string
+  void write(const std::string &value) {
+    write(static_cast<std::uint32_t>(value.size()));
+    buffer.append(value);
+  }
+
+  /// Appends the given string list
+  void write(const StringList &value) {
+    write(static_cast<std::uint32_t>(value.size()));
+    for (const auto &str : value) {
+      write(str);
+    }
+  }
+
+  /// Appends the given location
+  void write(const SourceCodeLocation &location) {
+    write(location.file_id);
+    write(location.line);
+    write(location.column);
+  }
+
+  /// Appends the given column, prefixed by its element count; the elements
+  /// are copied with a single append
+  template <typename Type>
+  void writeColumn(const std::vector<Type> &column) {
+    static_assert(std::is_trivially_copyable<Type>::value,
+                  "Columns must hold trivially copyable values");
+
+    write(static_cast<std::uint32_t>(column.size()));
+    buffer.append(reinterpret_cast<const char *>(column.data()),
+                  column.size() * sizeof(Type));
+  }
+
+  /// Appends all the columns of an ABI library
+  void write(const ABILibraryColumns &columns) {
+    write(columns.string_data);
+    writeColumn(columns.string_offset_list);
+    writeColumn(columns.whitelisted_location_list);
+    writeColumn(columns.whitelisted_friendly_name_list);
+    writeColumn(columns.whitelisted_mangled_name_list);
+    writeColumn(columns.whitelisted_argument_count_list);
+    writeColumn(columns.whitelisted_calling_convention_list);
+    writeColumn(columns.whitelisted_no_return_list);
+    writeColumn(columns.opaque_type_offset_list);
+    writeColumn(columns.opaque_type_data);
+    writeColumn(columns.blacklisted_location_list);
+    writeColumn(columns.blacklisted_friendly_name_list);
+    writeColumn(columns.blacklisted_mangled_name_list);
+    writeColumn(columns.blacklisted_reason_list);
+    writeColumn(columns.reason_data_kind_list);
+    writeColumn(columns.reason_data_offset_list);
+    writeColumn(columns.function_pointer_type_list);
+    writeColumn(columns.function_pointer_offset_list);
+    writeColumn(columns.payload_location_list);
+    writeColumn(columns.payload_spelling_list);
+  }
+
+  /// Returns the serialized data
+  const std::string &data() const { return buffer; }
+};
+
+/// Parses the fields written by the DatabaseWriter class; each method
+/// returns false when the data is truncated
+class DatabaseReader final {
+  /// The data that has not been parsed yet
+  llvm::StringRef remaining_data;
+
+ public:
+  /// Constructor
+  DatabaseReader(llvm::StringRef data) : remaining_data(data) {}
+
+  /// Reads the given amount of bytes
+  bool read(llvm::StringRef &value, std::size_t size) {
+    if (size > remaining_data.size()) {
+      return false;
+    }
+
+    value = remaining_data.substr(0U, size);
+    remaining_data = remaining_data.substr(size);
+    return true;
+  }
+
+  /// Reads an integer
+  bool read(std::uint32_t &value) {
+    llvm::StringRef data;
+    if (!read(data, sizeof(value))) {
+      return false;
+    }
+
+    std::memcpy(&value, data.data(), sizeof(value));
+    return true;
+  }
+
+  /// Reads a 64-bit integer
+  bool read(std::uint64_t &value) {
+    llvm::StringRef data;
+    if (!read(data, sizeof(value))) {
+      return false;
+    }
+
+    std::memcpy(&value, data.data(), sizeof(value));
+    return true;
+  }
+
+  /// Reads an element count; each element takes at least one integer, so
+  /// that a corrupted count can't cause huge allocations
+  bool readCount(std::size_t &count) {
+    std::uint32_t value;
+    if (!read(value) || value > remaining_data.size() / sizeof(value)) {
+      return false;
+    }
+
+    count = value;
+    return true;
+  }
+
+  /// Reads a string
+  bool read(std::string &value) {
+    std::uint32_t size;
+    llvm::StringRef data;
+    if (!read(size) || !read(data, size)) {
+      return false;
+    }
+
+    value = data.str();
+    return true;
+  }
+
+  /// Reads a string list
+  bool read(StringList &value) {
+    std::size_t count;
+    if (!readCount(count)) {
+      return false;
+    }
+
+    value.resize(count);
+    for (auto &str : value) {
+      if (!read(str)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// Reads a location
+  bool read(SourceCodeLocation &location) {
+    return read(location.file_id) && read(location.line) &&
+           read(location.column);
+  }
+
+  /// Reads a column written by DatabaseWriter::writeColumn()
+  template <typename Type>
+  bool readColumn(std::vector<Type> &column) {
+    static_assert(std::is_trivially_copyable<Type>::value,
+                  "Columns must hold trivially copyable values");
+
+    std::uint32_t count;
+    if (!read(count) || count > remaining_data.size() / sizeof(Type)) {
+      return false;
+    }
+
+    llvm::StringRef data;
+    if (!read(data, count * sizeof(Type))) {
+      return false;
+    }
+
+    column.resize(count);
+    if (count != 0U) {
+      std::memcpy(column.data(), data.data(), data.size());
+    }
+
+    return true;
+  }
+
+  /// Reads all the columns of an ABI library
+  bool read(ABILibraryColumns &columns) {
+    return read(columns.string_data) &&
+           readColumn(columns.string_offset_list) &&
+           readColumn(columns.whitelisted_location_list) &&
+           readColumn(columns.whitelisted_friendly_name_list) &&
+           readColumn(columns.whitelisted_mangled_name_list) &&
+           readColumn(columns.whitelisted_argument_count_list) &&
+           readColumn(columns.whitelisted_calling_convention_list) &&
+           readColumn(columns.whitelisted_no_return_list) &&
+           readColumn(columns.opaque_type_offset_list) &&
+           readColumn(columns.opaque_type_data) &&
+           readColumn(columns.blacklisted_location_list) &&
+           readColumn(columns.blacklisted_friendly_name_list) &&
+           readColumn(columns.blacklisted_mangled_name_list) &&
+           readColumn(columns.blacklisted_reason_list) &&
+           readColumn(columns.reason_data_kind_list) &&
+           readColumn(columns.reason_data_offset_list) &&
+           readColumn(columns.function_pointer_type_list) &&
+           readColumn(columns.function_pointer_offset_list) &&
+           readColumn(columns.payload_location_list) &&
+           readColumn(columns.payload_spelling_list);
+  }
+
+  /// Returns true if all the data has been parsed
+  bool empty() const { return remaining_data.empty(); }
+};
+}  // namespace
+
+bool readABIDatabaseColumns(ABIDatabase &database, ABILibraryColumns &columns,
+                            const std::string &path) {
+  database = {};
+  columns = {};
+
+  auto buffer_exp = llvm::MemoryBuffer::getFile(path, -1, false);
+  if (!buffer_exp) {
+    return false;
+  }
+
+  const auto &buffer = buffer_exp.get();
+  DatabaseReader reader(buffer->getBuffer());
+
+  llvm::StringRef magic;
+  std::uint32_t version;
+  if (!reader.read(magic, kABIDatabaseMagic.size()) ||
+      std::memcmp(magic.data(), kABIDatabaseMagic.data(), magic.size()) != 0 ||
+      !reader.read(version) || version != kABIDatabaseVersion) {
+    return false;
+  }
+
+  auto &abi_library = database.abi_library;
+  if (!reader.read(database.profile_name) || !reader.read(database.language) ||
+      !reader.read(database.base_includes) ||
+      !reader.read(abi_library.header_list) ||
+      !reader.read(abi_library.file_path_list) ||
+      !reader.read(abi_library.sliced_header)) {
+    return false;
+  }
+
+  std::size_t count;
+  if (!reader.readCount(count)) {
+    return false;
+  }
+
+  abi_library.file_include_line_list.resize(count);
+  for (auto &line : abi_library.file_include_line_list) {
+    if (!reader.read(line)) {
+      return false;
+    }
+  }
+
+  if (!reader.read(columns) || !reader.empty()) {
+    return false;
+  }
+
+  auto function_count = columns.whitelisted_mangled_name_list.size();
+  if (columns.whitelisted_friendly_name_list.size() != function_count ||
+      columns.whitelisted_argument_count_list.size() != function_count ||
+      columns.whitelisted_calling_convention_list.size() != function_count ||
+      columns.whitelisted_no_return_list.size() != function_count ||
+      columns.opaque_type_offset_list.size() != function_count + 1U) {
+    return false;
+  }
+
+  function_count = columns.blacklisted_mangled_name_list.size();
+  if (columns.blacklisted_friendly_name_list.size() != function_count ||
+      columns.blacklisted_reason_list.size() != function_count) {
+    return false;
+  }
+
+  return !columns.string_offset_list.empty() &&
+         columns.string_offset_list.back() == columns.string_data.size();
+}
+
+bool readABIDatabase(ABIDatabase &database, const std::string &path) {
+  // The functions are stored in the columnar layout, which is validated
+  // while being converted back
+  ABILibraryColumns columns;
+  if (!readABIDatabaseColumns(database, columns, path)) {
+    return false;
+  }
+
+  auto &abi_library = database.abi_library;
+  if (!unpackABILibraryFunctions(abi_library, columns)) {
+    return false;
+  }
+
+  // Every location must reference a known file
+  auto file_count = abi_library.file_path_list.size();
+  if (abi_library.file_include_line_list.size() != file_count) {
+    return false;
+  }
+
+  for (const auto &function : abi_library.whitelisted_function_list) {
+    if (function.location.file_id >= file_count) {
+      return false;
+    }
+  }
+
+  for (const auto &function : abi_library.blacklisted_function_list) {
+    if (function.location.file_id >= file_count) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool writeABIDatabase(const ABIDatabase &database, const std::string &path) {
+  DatabaseWriter writer;
+
+  std::string header(kABIDatabaseMagic.begin(), kABIDatabaseMagic.end());
+  const auto &abi_library = database.abi_library;
+
+  writer.write(kABIDatabaseVersion);
+  writer.write(database.profile_name);
+  writer.write(database.language);
+  writer.write(database.base_includes);
+  writer.write(abi_library.header_list);
+  writer.write(abi_library.file_path_list);
+  writer.write(abi_library.sliced_header);
+
+  writer.write(
+      static_cast<std::uint32_t>(abi_library.file_include_line_list.size()));
+  for (auto line : abi_library.file_include_line_list) {
+    writer.write(line);
+  }
+
+  ABILibraryColumns columns;
+  packABILibraryFunctions(columns, abi_library);
+  writer.write(columns);
+
+  return writeFileAtomically(path, header + writer.data());
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "abi_library_columns.h"
+#include "types.h"
+
+/// The name suffix of the database saved next to the ABI library
+const std::string kABIDatabaseExtension = ".abidb";
+
+/// The results of a generate run, saved so that the ABI library can be
+/// rendered again (with a different language, shard count or function
+/// selection) without parsing the headers
+struct ABIDatabase final {
+  /// The profile used to generate the library
+  std::string profile_name;
+
+  /// The language used to parse the headers
+  std::string language;
+
+  /// The base includes, as rendered in the ABI library
+  StringList base_includes;
+
+  /// The analysis results
+  ABILibrary abi_library;
+};
+
+/// Reads the given database; the file is memory mapped while it is being
+/// parsed. Returns false if it is missing or malformed
+bool readABIDatabase(ABIDatabase &database, const std::string &path);
+
+/// Reads the given database, leaving the functions in the columnar layout
+/// they are saved with; the function lists of the ABI library are left
+/// empty. This is much faster than readABIDatabase() for the tools that
+/// only compare or look up the functions. The columns are not validated,
+/// except for their sizes
+bool readABIDatabaseColumns(ABIDatabase &database, ABILibraryColumns &columns,
+                            const std::string &path);
+
+/// Saves the given database, replacing the previous one atomically
+bool writeABIDatabase(const ABIDatabase &database, const std::string &path);
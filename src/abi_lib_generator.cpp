@@ -15,10 +15,24 @@
  */
 
 #include "abi_lib_generator.h"
+#include "content_hash.h"
+#include "header_dependencies.h"
+#include "header_map.h"
+#include "output_file.h"
 #include "std_filesystem.h"
+#include "task_executor.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
 #include <fstream>
 #include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace {
 // clang-format off
@@ -83,121 +97,269 @@ void generateAbigenHeader(std::ostream &stream, const Profile &profile) {
   stream << "*/\n\n";
 }
 
-std::ostream &operator<<(std::ostream &stream,
-                         const SourceCodeLocation &location) {
-  stream << location.file_path << "@" << location.line << ":"
-         << location.column;
-  return stream;
-}
+/// Formats the output into a large buffer, which is written to a temporary
+/// file each time it fills up. The temporary file only replaces the
+/// destination when the contents have changed
+class BufferedFileWriter final {
+  /// The destination path
+  std::string path;
 
-std::ostream &operator<<(std::ostream &stream,
-                         BlacklistedFunction::Reason blacklist_reason) {
-  switch (blacklist_reason) {
-    case BlacklistedFunction::Reason::FunctionPointer: {
-      stream << "FunctionPointer";
-      break;
+  /// The temporary path the output is written to
+  std::string temporary_path;
+
+  /// The temporary file
+  std::ofstream file;
+
+  /// The pending output
+  std::string buffer;
+
+  /// If set, the output is moved here when the writer is closed, and no
+  /// file is written
+  std::string *memory_output{nullptr};
+
+  /// How much output is accumulated before writing it to the file
+  static constexpr std::size_t kFlushThreshold = 4U * 1024U * 1024U;
+
+  /// Writes the pending output to the file
+  void flush() {
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    buffer.clear();
+  }
+
+ public:
+  /// Removes the temporary file if the writer has not been closed
+  ~BufferedFileWriter() {
+    if (!temporary_path.empty()) {
+      file.close();
+
+      std::error_code error;
+      stdfs::remove(temporary_path, error);
     }
+  }
+
+  /// Opens the temporary file, returning false in case of error. When a
+  /// memory output is passed, the whole output is kept in memory instead
+  bool open(const std::string &destination_path,
+            std::string *destination_buffer = nullptr) {
+    path = destination_path;
 
-    case BlacklistedFunction::Reason::DuplicateName: {
-      stream << "DuplicateName";
-      break;
+    if (destination_buffer != nullptr) {
+      memory_output = destination_buffer;
+      return true;
     }
 
-    case BlacklistedFunction::Reason::Variadic: {
-      stream << "Variadic";
-      break;
+    temporary_path = getTemporaryOutputPath(path);
+
+    file.open(temporary_path,
+              std::ios::out | std::ios::trunc | std::ios::binary);
+    buffer.reserve(kFlushThreshold + 4096U);
+
+    return static_cast<bool>(file);
+  }
+
+  /// Writes the remaining output and closes the file, which then replaces
+  /// the destination if its contents are different. Returns false in case
+  /// of error
+  bool close() {
+    if (memory_output != nullptr) {
+      *memory_output = std::move(buffer);
+      buffer.clear();
+      return true;
     }
 
-    case BlacklistedFunction::Reason::Templated: {
-      stream << "Templated";
-      break;
+    flush();
+    file.close();
+
+    auto succeeded = static_cast<bool>(file);
+
+    auto closed_path = std::move(temporary_path);
+    temporary_path.clear();
+
+    if (!succeeded) {
+      std::error_code error;
+      stdfs::remove(closed_path, error);
+      return false;
     }
+
+    return replaceFileIfChanged(closed_path, path);
   }
 
-  return stream;
-}
-}  // namespace
+  /// Appends the given string
+  BufferedFileWriter &operator<<(std::string_view str) {
+    buffer.append(str.data(), str.size());
 
-ABILibGeneratorStatus generateABILibrary(
-    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
-    const Profile &profile) {
-  // Open the destination files
-  auto header_file_path = cmdline_options.output + ".h";
-  auto cpp_file_path = cmdline_options.output + ".cpp";
-  auto header_file_name = stdfs::path(header_file_path).filename().string();
+    if (memory_output == nullptr && buffer.size() >= kFlushThreshold) {
+      flush();
+    }
 
-  std::fstream header_file(header_file_path, std::fstream::out);
-  if (!header_file) {
-    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
-                                 "Failed to create the header file");
+    return *this;
   }
 
-  std::fstream implementation_file(cpp_file_path, std::fstream::out);
-  if (!implementation_file) {
-    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
-                                 "Failed to create the implementation file");
+  /// Appends the given character
+  BufferedFileWriter &operator<<(char c) {
+    buffer.push_back(c);
+    return *this;
   }
 
-  // Generate the header file
-  generateAbigenHeader(header_file, profile);
+  /// Appends the given number
+  BufferedFileWriter &operator<<(std::uint32_t value) {
+    char number_buffer[16];
+    auto result =
+        std::to_chars(number_buffer, number_buffer + sizeof(number_buffer),
+                      value);
 
-  if (!abi_library.blacklisted_function_list.empty()) {
-    header_file << "/*\n\n";
-    header_file << "  Blacklisted functions\n\n";
+    return *this << std::string_view(
+               number_buffer,
+               static_cast<std::size_t>(result.ptr - number_buffer));
+  }
 
-    header_file
-        << "  The following is a list of functions that have not been "
-           "included\n"
-        << "  in the library and the reason why they have been blacklisted\n\n";
+  /// Appends the given string, left aligned and padded with spaces to the
+  /// given width
+  BufferedFileWriter &padded(std::string_view str, std::size_t width) {
+    *this << str;
 
-    header_file << std::setiosflags(std::ios::left);
+    if (str.size() < width) {
+      buffer.append(width - str.size(), ' ');
+    }
 
-    for (const auto &function : abi_library.blacklisted_function_list) {
-      header_file << "    " << std::setfill(' ') << std::setw(20)
-                  << function.reason << function.friendly_name << " ("
-                  << function.mangled_name << ")"
-                  << "\n";
+    return *this;
+  }
+};
 
-      header_file << "    " << std::setfill(' ') << std::setw(20) << " "
-                  << function.location << "\n";
+/// Used to print a source code location along with its file path
+struct LocationFormatter final {
+  /// The location to print
+  const SourceCodeLocation &location;
 
-      if (function.reason == BlacklistedFunction::Reason::DuplicateName) {
-        auto duplicate_locations =
-            std::get<BlacklistedFunction::DuplicateFunctionLocations>(
-                function.reason_data);
+  /// The file paths referenced by the location
+  const StringList &file_path_list;
+};
 
-        header_file << "    Duplicates:\n";
-        for (const auto &loc : duplicate_locations) {
-          header_file << "      " << loc << "\n";
-        }
+BufferedFileWriter &operator<<(BufferedFileWriter &writer,
+                               const LocationFormatter &formatter) {
+  const auto &location = formatter.location;
 
-      } else if (function.reason ==
-                 BlacklistedFunction::Reason::FunctionPointer) {
-        auto blacklisted_type_locs =
-            std::get<BlacklistedFunction::FunctionPointerLocations>(
-                function.reason_data);
-
-        if (!blacklisted_type_locs.empty()) {
-          header_file << "\n                        Caused by:\n";
-          for (const auto &p : blacklisted_type_locs) {
-            const auto &loc = p.first;
-            const auto &name = p.second;
-
-            header_file << "                          \"" << name << "\" at "
-                        << loc << "\n";
-          }
-        }
+  // File paths are only resolved when rendering
+  if (location.file_id < formatter.file_path_list.size()) {
+    writer << formatter.file_path_list[location.file_id];
+  } else {
+    writer << "<unknown>";
+  }
+
+  writer << '@' << location.line << ':' << location.column;
+  return writer;
+}
+
+/// Returns the path of the file receiving the blacklist report, or an empty
+/// string when the report is written in the header
+std::string getBlacklistReportPath(const CommandLineOptions &cmdline_options) {
+  if (cmdline_options.blacklist_report == "text") {
+    return cmdline_options.output + ".blacklist.txt";
+
+  } else if (cmdline_options.blacklist_report == "json") {
+    return cmdline_options.output + ".json";
+  }
+
+  return std::string();
+}
+
+/// Generates the list of blacklisted functions, along with the reason why
+/// each of them has been left out of the library
+void generateBlacklistReport(BufferedFileWriter &report_file,
+                             const ABILibrary &abi_library) {
+  auto L_location = [&abi_library](const SourceCodeLocation &location) {
+    return LocationFormatter{location, abi_library.file_path_list};
+  };
+
+  report_file << "  Blacklisted functions\n\n";
+
+  report_file
+      << "  The following is a list of functions that have not been "
+         "included\n"
+      << "  in the library and the reason why they have been blacklisted\n\n";
+
+  for (const auto &function : abi_library.blacklisted_function_list) {
+    report_file << "    ";
+    report_file.padded(getBlacklistReasonName(function.reason), 20U)
+        << function.friendly_name << " (" << function.mangled_name << ")"
+        << "\n";
+
+    report_file << "    ";
+    report_file.padded(" ", 20U) << L_location(function.location) << "\n";
+
+    // The reason data is only accessed by reference, as it can be large
+    if (function.reason == BlacklistedFunction::Reason::DuplicateName) {
+      const auto &duplicate_locations =
+          std::get<BlacklistedFunction::DuplicateFunctionLocations>(
+              function.reason_data);
+
+      report_file << "    Duplicates:\n";
+      for (const auto &loc : duplicate_locations) {
+        report_file << "      " << L_location(loc) << "\n";
       }
 
-      header_file << "\n";
+    } else if (function.reason ==
+               BlacklistedFunction::Reason::FunctionPointer) {
+      const auto &blacklisted_type_locs =
+          std::get<BlacklistedFunction::FunctionPointerLocations>(
+              function.reason_data);
+
+      if (!blacklisted_type_locs.empty()) {
+        report_file << "\n                        Caused by:\n";
+        for (const auto &p : blacklisted_type_locs) {
+          const auto &loc = p.first;
+          const auto &name = p.second;
+
+          report_file << "                          \"" << name << "\" at "
+                      << L_location(loc) << "\n";
+        }
+      }
     }
 
-    header_file << std::resetiosflags(std::ios::adjustfield);
-    header_file << "*/\n\n";
+    report_file << "\n";
+  }
+}
+
+/// Generates the header file, containing the blacklist (unless it is saved
+/// to its own file) and the include directives
+ABILibGeneratorStatus generateHeaderFile(
+    BufferedFileWriter &header_file, const CommandLineOptions &cmdline_options,
+    const ABILibrary &abi_library, const std::string &abigen_header) {
+  header_file << abigen_header;
+
+  // Large blacklists would otherwise be lexed by every translation unit that
+  // includes the header
+  if (!abi_library.blacklisted_function_list.empty()) {
+    auto report_path = getBlacklistReportPath(cmdline_options);
+
+    if (report_path.empty()) {
+      header_file << "/*\n\n";
+      generateBlacklistReport(header_file, abi_library);
+      header_file << "*/\n\n";
+
+    } else {
+      header_file << "// "
+                  << std::to_string(
+                         abi_library.blacklisted_function_list.size())
+                  << " blacklisted functions, listed in "
+                  << stdfs::path(report_path).filename().string() << "\n\n";
+    }
   }
 
   header_file << "#pragma once\n\n";
 
+  if (!abi_library.sliced_header.empty()) {
+    header_file << "// Declarations sliced out of the discovered headers\n";
+    header_file << abi_library.sliced_header;
+
+    if (!header_file.close()) {
+      return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                   "Failed to write the header file");
+    }
+
+    return ABILibGeneratorStatus(true);
+  }
+
   if (!cmdline_options.base_includes.empty()) {
     header_file << "// Base includes\n";
     for (const auto &base_include : cmdline_options.base_includes) {
@@ -212,38 +374,1210 @@ ABILibGeneratorStatus generateABILibrary(
     header_file << "#include \"" << header << "\"\n";
   }
 
-  // Generate the implementation file
-  generateAbigenHeader(implementation_file, profile);
-  implementation_file << "#include \"" << header_file_name << "\"\n\n";
+  if (!header_file.close()) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to write the header file");
+  }
+
+  return ABILibGeneratorStatus(true);
+}
+
+/// Used to print a string as a quoted and escaped JSON string
+struct JSONStringFormatter final {
+  /// The string to print
+  std::string_view str;
+};
+
+BufferedFileWriter &operator<<(BufferedFileWriter &writer,
+                               const JSONStringFormatter &formatter) {
+  static const char kHexDigits[] = "0123456789abcdef";
+
+  writer << '"';
+
+  // Only the characters that JSON forbids are escaped; anything else
+  // (including UTF-8 sequences) is copied as is
+  auto str = formatter.str;
+  std::size_t run_start = 0U;
+
+  for (std::size_t i = 0U; i < str.size(); ++i) {
+    auto c = static_cast<unsigned char>(str[i]);
+    if (c >= 0x20U && c != '"' && c != '\\') {
+      continue;
+    }
+
+    writer << str.substr(run_start, i - run_start);
+    run_start = i + 1U;
+
+    switch (c) {
+      case '"':
+        writer << "\\\"";
+        break;
+
+      case '\\':
+        writer << "\\\\";
+        break;
+
+      case '\n':
+        writer << "\\n";
+        break;
+
+      case '\t':
+        writer << "\\t";
+        break;
+
+      default:
+        writer << "\\u00" << kHexDigits[c >> 4U] << kHexDigits[c & 0xFU];
+        break;
+    }
+  }
+
+  writer << str.substr(run_start) << '"';
+  return writer;
+}
+
+/// Used to print a source code location as a JSON object
+struct JSONLocationFormatter final {
+  /// The location to print
+  const SourceCodeLocation &location;
+
+  /// The file paths referenced by the location
+  const StringList &file_path_list;
+};
+
+BufferedFileWriter &operator<<(BufferedFileWriter &writer,
+                               const JSONLocationFormatter &formatter) {
+  const auto &location = formatter.location;
+
+  std::string_view file_path = "<unknown>";
+  if (location.file_id < formatter.file_path_list.size()) {
+    file_path = formatter.file_path_list[location.file_id];
+  }
+
+  writer << "{\"file\": " << JSONStringFormatter{file_path}
+         << ", \"line\": " << location.line
+         << ", \"column\": " << location.column << '}';
+
+  return writer;
+}
+
+/// Generates the JSON report, describing the whitelisted and blacklisted
+/// functions. The report is written while it is being formatted, as it can be
+/// as large as the blacklist comment in the header
+ABILibGeneratorStatus generateJSONReport(BufferedFileWriter &report_file,
+                                         const ABILibrary &abi_library) {
+  auto L_location = [&abi_library](const SourceCodeLocation &location) {
+    return JSONLocationFormatter{location, abi_library.file_path_list};
+  };
+
+  // Prints the separator of each list element but the first one
+  auto L_separator = [&report_file](std::size_t index) {
+    if (index != 0U) {
+      report_file << ',';
+    }
+
+    report_file << "\n    ";
+  };
+
+  report_file << "{\n  \"version\": 1,\n  \"headers\": [";
+
+  for (std::size_t i = 0U; i < abi_library.header_list.size(); ++i) {
+    L_separator(i);
+    report_file << JSONStringFormatter{abi_library.header_list[i]};
+  }
+
+  report_file << "\n  ],\n  \"whitelisted_functions\": [";
+
+  for (std::size_t i = 0U; i < abi_library.whitelisted_function_list.size();
+       ++i) {
+    const auto &function = abi_library.whitelisted_function_list[i];
+
+    L_separator(i);
+    report_file << "{\"name\": " << JSONStringFormatter{function.friendly_name}
+                << ", \"mangled_name\": "
+                << JSONStringFormatter{function.mangled_name}
+                << ", \"location\": " << L_location(function.location) << '}';
+  }
+
+  report_file << "\n  ],\n  \"blacklisted_functions\": [";
+
+  for (std::size_t i = 0U; i < abi_library.blacklisted_function_list.size();
+       ++i) {
+    const auto &function = abi_library.blacklisted_function_list[i];
+
+    L_separator(i);
+    report_file << "{\"name\": " << JSONStringFormatter{function.friendly_name}
+                << ", \"mangled_name\": "
+                << JSONStringFormatter{function.mangled_name}
+                << ", \"reason\": "
+                << JSONStringFormatter{getBlacklistReasonName(function.reason)}
+                << ", \"location\": " << L_location(function.location);
+
+    if (function.reason == BlacklistedFunction::Reason::DuplicateName) {
+      const auto &duplicate_locations =
+          std::get<BlacklistedFunction::DuplicateFunctionLocations>(
+              function.reason_data);
+
+      report_file << ", \"duplicates\": [";
+      for (std::size_t j = 0U; j < duplicate_locations.size(); ++j) {
+        report_file << (j != 0U ? ", " : "")
+                    << L_location(duplicate_locations[j]);
+      }
+
+      report_file << ']';
+
+    } else if (function.reason ==
+               BlacklistedFunction::Reason::FunctionPointer) {
+      const auto &blacklisted_type_locs =
+          std::get<BlacklistedFunction::FunctionPointerLocations>(
+              function.reason_data);
+
+      report_file << ", \"caused_by\": [";
+      for (std::size_t j = 0U; j < blacklisted_type_locs.size(); ++j) {
+        const auto &p = blacklisted_type_locs[j];
+
+        report_file << (j != 0U ? ", " : "")
+                    << "{\"type\": " << JSONStringFormatter{p.second}
+                    << ", \"location\": " << L_location(p.first) << '}';
+      }
+
+      report_file << ']';
+    }
+
+    report_file << '}';
+  }
+
+  report_file << "\n  ]\n}\n";
+
+  if (!report_file.close()) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to write the JSON report");
+  }
+
+  return ABILibGeneratorStatus(true);
+}
+
+/// Describes one of the implementation files
+struct ImplementationFileDescriptor final {
+  /// The destination path
+  std::string path;
+
+  /// The include directives at the top of the file
+  std::string include_block;
+
+  /// The name of the array referencing the functions
+  std::string array_name;
+
+  /// Where the functions of this file start in the function order list
+  std::size_t first_function;
+
+  /// Where the functions of this file end in the function order list
+  std::size_t last_function;
+};
+
+/// Returns the letter used by the mcsema external definitions for the given
+/// calling convention
+char getCallingConventionLetter(
+    WhitelistedFunction::CallingConvention calling_convention) {
+  switch (calling_convention) {
+  case WhitelistedFunction::CallingConvention::CallerCleanup:
+    return 'C';
+
+  case WhitelistedFunction::CallingConvention::CalleeCleanup:
+    return 'E';
+
+  case WhitelistedFunction::CallingConvention::FastCall:
+    return 'F';
+  }
+
+  return 'C';
+}
+
+/// Generates the mcsema external definitions of the whitelisted functions,
+/// one per line: name, argument count, calling convention and whether the
+/// function never returns (Y) or not (N). The prototypes come from the AST,
+/// so the ABI library does not have to be compiled to bitcode
+ABILibGeneratorStatus generateMcsemaDefinitions(
+    BufferedFileWriter &definitions_file, const ABILibrary &abi_library) {
+  for (const auto &function : abi_library.whitelisted_function_list) {
+    definitions_file << function.mangled_name << ' ' << function.argument_count
+                     << ' '
+                     << getCallingConventionLetter(function.calling_convention)
+                     << ' ' << (function.no_return ? 'Y' : 'N') << '\n';
+  }
+
+  if (!definitions_file.close()) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to write the mcsema definitions");
+  }
+
+  return ABILibGeneratorStatus(true);
+}
+
+/// Generates one implementation file, referencing its slice of the
+/// whitelisted functions; when the memory output is passed, the file is
+/// rendered there instead of being saved
+ABILibGeneratorStatus generateImplementationFile(
+    const ImplementationFileDescriptor &file_descriptor,
+    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
+    const std::vector<std::size_t> &function_order,
+    const std::string &abigen_header, std::string *memory_output) {
+  BufferedFileWriter implementation_file;
+  if (!implementation_file.open(file_descriptor.path, memory_output)) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to create the implementation file");
+  }
+
+  auto L_location = [&abi_library](const SourceCodeLocation &location) {
+    return LocationFormatter{location, abi_library.file_path_list};
+  };
+
+  implementation_file << abigen_header;
+  implementation_file << file_descriptor.include_block;
 
   if (cmdline_options.language.find("cxx") != std::string::npos) {
     implementation_file << "extern \"C\" {\n";
   }
 
-  implementation_file << "__attribute__((used))\n";
-  implementation_file << "void *__mcsema_externs[] = {\n";
+  // The functions are split across arrays of at most extern_array_size
+  // elements; the first one keeps the array name, and the next ones get a
+  // _part<index> suffix. An empty file still defines the first array
+  auto function_count =
+      file_descriptor.last_function - file_descriptor.first_function;
+
+  auto array_size = cmdline_options.extern_array_size;
+  if (array_size == 0U || array_size > function_count) {
+    array_size = std::max<std::size_t>(function_count, 1U);
+  }
 
-  for (auto it = abi_library.whitelisted_function_list.begin();
-       it != abi_library.whitelisted_function_list.end(); it++) {
-    const auto &function = *it;
+  auto array_count = std::max<std::size_t>(
+      (function_count + array_size - 1U) / array_size, 1U);
 
-    implementation_file << "  // Location: " << function.location << "\n";
+  for (std::size_t array_index = 0U; array_index < array_count;
+       ++array_index) {
+    auto first_function =
+        file_descriptor.first_function + array_index * array_size;
 
-    implementation_file << "  // " << function.friendly_name << "\n";
+    auto last_function = std::min(first_function + array_size,
+                                  file_descriptor.last_function);
 
-    implementation_file << "  (void *)(" << function.mangled_name << ")";
-    if (std::next(it, 1) != abi_library.whitelisted_function_list.end()) {
-      implementation_file << ",\n";
+    if (array_index != 0U) {
+      implementation_file << "\n";
     }
 
-    implementation_file << "\n";
-  }
+    implementation_file << "__attribute__((used))\n";
+    implementation_file << "void *" << file_descriptor.array_name;
+    if (array_index != 0U) {
+      implementation_file << "_part" << std::to_string(array_index);
+    }
+
+    implementation_file << "[] = {\n";
 
-  implementation_file << "};\n";
+    for (auto i = first_function; i < last_function; ++i) {
+      const auto &function =
+          abi_library.whitelisted_function_list[function_order[i]];
+
+      implementation_file << "  // Location: "
+                          << L_location(function.location) << "\n";
+
+      implementation_file << "  // " << function.friendly_name << "\n";
+
+      implementation_file << "  (void *)(" << function.mangled_name << ")";
+      if (i + 1U != last_function) {
+        implementation_file << ",\n";
+      }
+
+      implementation_file << "\n";
+    }
+
+    implementation_file << "};\n";
+  }
 
   if (cmdline_options.language.find("cxx") != std::string::npos) {
     implementation_file << "}\n";
   }
 
+  if (!implementation_file.close()) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to write the implementation file");
+  }
+
+  return ABILibGeneratorStatus(true);
+}
+
+/// Returns the include group of the given function: 0 for the functions
+/// declared by the base includes, i + 1 for the ones declared by the i-th
+/// discovered header (or by a file it includes), and the header count + 1
+/// when the declaring file is unknown
+std::size_t getIncludeGroup(const CommandLineOptions &cmdline_options,
+                            const ABILibrary &abi_library,
+                            const WhitelistedFunction &function) {
+  auto unknown_group = abi_library.header_list.size() + 1U;
+
+  // The generated source buffer has one #include directive per line: first
+  // the base includes, then the discovered headers
+  auto file_id = function.location.file_id;
+  if (file_id >= abi_library.file_include_line_list.size() ||
+      abi_library.file_include_line_list[file_id] == 0U) {
+    return unknown_group;
+  }
+
+  auto line_index =
+      static_cast<std::size_t>(abi_library.file_include_line_list[file_id]) -
+      1U;
+
+  if (line_index < cmdline_options.base_includes.size()) {
+    return 0U;
+  }
+
+  auto header_index = line_index - cmdline_options.base_includes.size();
+  if (header_index >= abi_library.header_list.size()) {
+    return unknown_group;
+  }
+
+  return header_index + 1U;
+}
+
+/// Returns how many of the discovered headers (in order) must be included
+/// to declare the given function
+std::size_t getRequiredHeaderCount(const CommandLineOptions &cmdline_options,
+                                   const ABILibrary &abi_library,
+                                   const WhitelistedFunction &function) {
+  // Each header has been accepted on top of the ones that come before it,
+  // so the whole prefix is needed; all of them are needed when the
+  // declaring file is unknown
+  return std::min(getIncludeGroup(cmdline_options, abi_library, function),
+                  abi_library.header_list.size());
+}
+
+/// Returns the include directives of an implementation file that needs the
+/// discovered headers marked in the given set, which are included in their
+/// original order; the ABI library header is included instead when it
+/// contains the sliced declarations
+std::string getIncludeBlock(const CommandLineOptions &cmdline_options,
+                            const ABILibrary &abi_library,
+                            const std::vector<bool> &header_set,
+                            const std::string &header_include_path) {
+  if (!abi_library.sliced_header.empty()) {
+    return "#include \"" + header_include_path + "\"\n\n";
+  }
+
+  std::stringstream include_block;
+  for (const auto &base_include : cmdline_options.base_includes) {
+    include_block << "#include <" << base_include << ">\n";
+  }
+
+  for (std::size_t i = 0U; i < header_set.size(); ++i) {
+    if (header_set[i]) {
+      include_block << "#include \"" << abi_library.header_list[i] << "\"\n";
+    }
+  }
+
+  include_block << "\n";
+  return include_block.str();
+}
+
+/// Returns the include directives of an implementation file that needs the
+/// given amount of discovered headers
+std::string getIncludeBlock(const CommandLineOptions &cmdline_options,
+                            const ABILibrary &abi_library,
+                            std::size_t required_header_count,
+                            const std::string &header_include_path) {
+  std::vector<bool> header_set(abi_library.header_list.size(), false);
+  std::fill_n(header_set.begin(),
+              std::min(required_header_count, header_set.size()), true);
+
+  return getIncludeBlock(cmdline_options, abi_library, header_set,
+                         header_include_path);
+}
+
+/// Returns true if the shards only include the headers that declare their
+/// functions, along with the headers those include; this needs the resolved
+/// header paths, and is pointless with the sliced header
+bool usesHeaderShardPartitioning(const CommandLineOptions &cmdline_options,
+                                 const ABILibrary &abi_library) {
+  if (!abi_library.sliced_header.empty() ||
+      abi_library.header_path_list.size() != abi_library.header_list.size() ||
+      cmdline_options.shard_partitioning == "prefix") {
+    return false;
+  }
+
+  // Without the minimal probe prefix, a header may only compile on top of
+  // the headers accepted before it
+  return cmdline_options.shard_partitioning == "headers" ||
+         cmdline_options.minimal_probe_prefix;
+}
+
+/// Returns, for each discovered header, the set of discovered headers that
+/// must be included along with it: itself, and the ones it includes,
+/// directly or not. The include directives are scanned from the resolved
+/// paths; a header that can't be scanned needs all the headers accepted
+/// before it
+std::vector<std::vector<bool>> getHeaderClosureList(
+    const ABILibrary &abi_library) {
+  auto header_count = abi_library.header_list.size();
+
+  // Each header can also be reached through the shorter spellings of its
+  // include directive, as in "Frontend/Utils.h" for "clang/Frontend/Utils.h"
+  std::vector<HeaderDescriptor> header_files(header_count);
+  std::vector<bool> scannable_header_list(header_count, false);
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    auto directive = stdfs::path(abi_library.header_list[i]);
+
+    auto &header_desc = header_files[i];
+    header_desc.name = directive.filename().string();
+    header_desc.path = abi_library.header_path_list[i];
+
+    StringList folder_name_list;
+    for (const auto &folder_name : directive.parent_path()) {
+      folder_name_list.push_back(folder_name.string());
+    }
+
+    for (std::size_t j = 0U; j < folder_name_list.size(); ++j) {
+      stdfs::path prefix;
+      for (auto k = j; k < folder_name_list.size(); ++k) {
+        prefix /= folder_name_list[k];
+      }
+
+      header_desc.possible_prefixes.push_back(prefix.string());
+    }
+
+    std::error_code error;
+    scannable_header_list[i] = !header_desc.path.empty() &&
+                               stdfs::is_regular_file(header_desc.path, error);
+  }
+
+  auto dependency_list = getHeaderDependencies(header_files);
+
+  std::vector<std::vector<bool>> closure_list(header_count);
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    auto &closure = closure_list[i];
+    closure.assign(header_count, false);
+    closure[i] = true;
+
+    std::vector<std::size_t> pending_header_list = {i};
+
+    while (!pending_header_list.empty()) {
+      auto current_index = pending_header_list.back();
+      pending_header_list.pop_back();
+
+      auto L_reach = [&](std::size_t dependency_index) {
+        if (!closure[dependency_index]) {
+          closure[dependency_index] = true;
+          pending_header_list.push_back(dependency_index);
+        }
+      };
+
+      if (!scannable_header_list[current_index]) {
+        for (std::size_t j = 0U; j < current_index; ++j) {
+          L_reach(j);
+        }
+
+        continue;
+      }
+
+      for (auto dependency_index : dependency_list[current_index]) {
+        L_reach(dependency_index);
+      }
+    }
+  }
+
+  return closure_list;
+}
+
+/// Returns the estimated parsing cost of each discovered header: its size,
+/// or the average size when it can't be read
+std::vector<std::uint64_t> getHeaderCostList(const ABILibrary &abi_library) {
+  auto header_count = abi_library.header_list.size();
+
+  std::vector<std::uint64_t> cost_list(header_count, 0U);
+  std::vector<bool> known_cost_list(header_count, false);
+
+  std::uint64_t total_known_cost = 0U;
+  std::size_t known_cost_count = 0U;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    std::error_code error;
+    auto file_size = stdfs::file_size(abi_library.header_path_list[i], error);
+    if (error) {
+      continue;
+    }
+
+    cost_list[i] = static_cast<std::uint64_t>(file_size);
+    known_cost_list[i] = true;
+
+    total_known_cost += cost_list[i];
+    ++known_cost_count;
+  }
+
+  auto average_cost = (known_cost_count != 0U)
+                          ? std::max<std::uint64_t>(
+                                total_known_cost / known_cost_count, 1U)
+                          : 1U;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    if (!known_cost_list[i] || cost_list[i] == 0U) {
+      cost_list[i] = average_cost;
+    }
+  }
+
+  return cost_list;
+}
+
+/// Assigns each include group to one of the shards, returning the shard of
+/// each group along with the set of headers each shard includes. A shard's
+/// work is estimated as the cost of the headers it includes. The groups are
+/// placed from the most expensive one, each in the shard whose include set
+/// grows the least without going over its share of the work, or else in the
+/// shard that ends up with the least work
+std::vector<std::size_t> partitionIncludeGroups(
+    std::vector<std::vector<bool>> &shard_header_set_list,
+    const std::vector<std::vector<bool>> &group_header_set_list,
+    const std::vector<std::uint64_t> &header_cost_list,
+    std::size_t shard_count) {
+  auto group_count = group_header_set_list.size();
+  auto header_count = header_cost_list.size();
+
+  auto L_setCost = [&](const std::vector<bool> &header_set) -> std::uint64_t {
+    std::uint64_t cost = 0U;
+    for (std::size_t i = 0U; i < header_count; ++i) {
+      if (header_set[i]) {
+        cost += header_cost_list[i];
+      }
+    }
+
+    return cost;
+  };
+
+  std::vector<std::uint64_t> group_cost_list(group_count);
+  std::vector<bool> used_header_set(header_count, false);
+
+  for (std::size_t i = 0U; i < group_count; ++i) {
+    group_cost_list[i] = L_setCost(group_header_set_list[i]);
+
+    for (std::size_t j = 0U; j < header_count; ++j) {
+      if (group_header_set_list[i][j]) {
+        used_header_set[j] = true;
+      }
+    }
+  }
+
+  // Each shard may go a little over an even split of the headers, so that
+  // it can keep the groups sharing its headers
+  auto largest_group_cost =
+      group_cost_list.empty()
+          ? 0U
+          : *std::max_element(group_cost_list.begin(), group_cost_list.end());
+
+  auto shard_capacity =
+      std::max(largest_group_cost,
+               (L_setCost(used_header_set) / shard_count) * 11U / 10U);
+
+  std::vector<std::size_t> group_order(group_count);
+  for (std::size_t i = 0U; i < group_count; ++i) {
+    group_order[i] = i;
+  }
+
+  std::stable_sort(group_order.begin(), group_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return group_cost_list[lhs] > group_cost_list[rhs];
+                   });
+
+  shard_header_set_list.assign(shard_count,
+                               std::vector<bool>(header_count, false));
+
+  std::vector<std::uint64_t> shard_cost_list(shard_count, 0U);
+  std::vector<std::size_t> group_shard_list(group_count, 0U);
+
+  for (auto group_index : group_order) {
+    const auto &group_header_set = group_header_set_list[group_index];
+
+    auto best_shard = shard_count;
+    std::uint64_t best_added_cost = 0U;
+
+    auto fallback_shard = shard_count;
+    std::uint64_t fallback_cost = 0U;
+
+    for (std::size_t shard = 0U; shard < shard_count; ++shard) {
+      const auto &shard_header_set = shard_header_set_list[shard];
+
+      std::uint64_t added_cost = 0U;
+      for (std::size_t i = 0U; i < header_count; ++i) {
+        if (group_header_set[i] && !shard_header_set[i]) {
+          added_cost += header_cost_list[i];
+        }
+      }
+
+      auto new_cost = shard_cost_list[shard] + added_cost;
+
+      if (new_cost <= shard_capacity &&
+          (best_shard == shard_count || added_cost < best_added_cost ||
+           (added_cost == best_added_cost &&
+            new_cost < shard_cost_list[best_shard] + best_added_cost))) {
+        best_shard = shard;
+        best_added_cost = added_cost;
+      }
+
+      if (fallback_shard == shard_count || new_cost < fallback_cost) {
+        fallback_shard = shard;
+        fallback_cost = new_cost;
+      }
+    }
+
+    auto shard = (best_shard != shard_count) ? best_shard : fallback_shard;
+    group_shard_list[group_index] = shard;
+
+    auto &shard_header_set = shard_header_set_list[shard];
+    for (std::size_t i = 0U; i < header_count; ++i) {
+      if (group_header_set[i] && !shard_header_set[i]) {
+        shard_header_set[i] = true;
+        shard_cost_list[shard] += header_cost_list[i];
+      }
+    }
+  }
+
+  return group_shard_list;
+}
+
+/// Returns the name of the sub-library of the given include group. Names
+/// only depend on the header, so that the files of the other headers keep
+/// their path when one is added or removed
+std::string getHeaderSublibraryName(const ABILibrary &abi_library,
+                                    std::size_t include_group) {
+  if (include_group == 0U) {
+    return "base_includes";
+  }
+
+  if (include_group > abi_library.header_list.size()) {
+    return "unknown_headers";
+  }
+
+  const auto &header = abi_library.header_list[include_group - 1U];
+
+  std::string name;
+  for (auto c : header) {
+    name.push_back(std::isalnum(static_cast<unsigned char>(c)) != 0 ? c : '_');
+  }
+
+  // Different headers can end up with the same name once sanitized
+  auto header_hash = updateContentHash(kInitialContentHash, header);
+  return name + "_" + contentHashToString(header_hash).substr(0U, 8U);
+}
+
+/// Returns the folder containing the header sub-libraries
+std::string getHeaderSublibraryFolder(
+    const CommandLineOptions &cmdline_options) {
+  return cmdline_options.output + "_headers";
+}
+
+/// Splits the whitelisted functions by the header that declares them, one
+/// implementation file per header. Each file includes the same headers the
+/// function needs in the single file library, so it compiles on its own
+std::vector<ImplementationFileDescriptor> createHeaderSublibraryList(
+    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
+    std::vector<std::size_t> &function_order,
+    const std::string &header_file_name) {
+  const auto &function_list = abi_library.whitelisted_function_list;
+
+  std::vector<std::size_t> include_group_list(function_list.size());
+  for (std::size_t i = 0U; i < function_list.size(); ++i) {
+    include_group_list[i] =
+        getIncludeGroup(cmdline_options, abi_library, function_list[i]);
+  }
+
+  std::stable_sort(function_order.begin(), function_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return include_group_list[lhs] < include_group_list[rhs];
+                   });
+
+  auto folder_path = stdfs::path(getHeaderSublibraryFolder(cmdline_options));
+
+  std::vector<ImplementationFileDescriptor> file_list;
+
+  auto function_count = function_order.size();
+  for (std::size_t first_function = 0U; first_function < function_count;) {
+    auto include_group = include_group_list[function_order[first_function]];
+
+    auto last_function = first_function + 1U;
+    while (last_function < function_count &&
+           include_group_list[function_order[last_function]] ==
+               include_group) {
+      ++last_function;
+    }
+
+    auto name = getHeaderSublibraryName(abi_library, include_group);
+
+    ImplementationFileDescriptor file_descriptor;
+    file_descriptor.path = (folder_path / (name + ".cpp")).string();
+    file_descriptor.array_name = "__mcsema_externs_" + name;
+    file_descriptor.first_function = first_function;
+    file_descriptor.last_function = last_function;
+    file_descriptor.include_block = getIncludeBlock(
+        cmdline_options, abi_library,
+        std::min(include_group, abi_library.header_list.size()),
+        "../" + header_file_name);
+
+    file_list.push_back(std::move(file_descriptor));
+    first_function = last_function;
+  }
+
+  return file_list;
+}
+
+/// Removes the sub-libraries left by the previous runs for the headers that
+/// no longer declare any whitelisted function, so that compiling the folder
+/// does not pick them up
+bool removeStaleHeaderSublibraries(
+    const CommandLineOptions &cmdline_options,
+    const std::vector<ImplementationFileDescriptor> &file_list) {
+  std::unordered_set<std::string> file_name_set;
+  for (const auto &file_descriptor : file_list) {
+    file_name_set.insert(stdfs::path(file_descriptor.path).filename().string());
+  }
+
+  std::error_code error;
+  StringList stale_file_list;
+
+  for (const auto &entry : stdfs::directory_iterator(
+           getHeaderSublibraryFolder(cmdline_options), error)) {
+    const auto &path = entry.path();
+    if (path.extension() == ".cpp" &&
+        file_name_set.count(path.filename().string()) == 0U) {
+      stale_file_list.push_back(path.string());
+    }
+  }
+
+  if (error) {
+    return false;
+  }
+
+  for (const auto &stale_file : stale_file_list) {
+    if (!stdfs::remove(stale_file, error) && error) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Splits the whitelisted functions into the shards by the headers that
+/// declare them (see partitionIncludeGroups), so that each shard only
+/// includes the headers its functions need
+std::vector<ImplementationFileDescriptor> createHeaderShardList(
+    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
+    std::vector<std::size_t> &function_order,
+    const std::string &header_file_name) {
+  const auto &function_list = abi_library.whitelisted_function_list;
+  auto header_count = abi_library.header_list.size();
+
+  // The functions of the base includes need no header, and the ones whose
+  // declaring file is unknown need all of them
+  auto header_closure_list = getHeaderClosureList(abi_library);
+
+  std::vector<std::size_t> include_group_list(function_list.size());
+  std::unordered_map<std::size_t, std::size_t> group_index_map;
+  std::vector<std::vector<bool>> group_header_set_list;
+
+  for (std::size_t i = 0U; i < function_list.size(); ++i) {
+    auto include_group =
+        getIncludeGroup(cmdline_options, abi_library, function_list[i]);
+
+    include_group_list[i] = include_group;
+    if (!group_index_map
+             .insert({include_group, group_header_set_list.size()})
+             .second) {
+      continue;
+    }
+
+    if (include_group == 0U) {
+      group_header_set_list.emplace_back(header_count, false);
+    } else if (include_group > header_count) {
+      group_header_set_list.emplace_back(header_count, true);
+    } else {
+      group_header_set_list.push_back(
+          header_closure_list[include_group - 1U]);
+    }
+  }
+
+  auto shard_count = cmdline_options.shards;
+
+  std::vector<std::vector<bool>> shard_header_set_list;
+  auto group_shard_list =
+      partitionIncludeGroups(shard_header_set_list, group_header_set_list,
+                             getHeaderCostList(abi_library), shard_count);
+
+  std::vector<std::size_t> function_shard_list(function_list.size());
+  for (std::size_t i = 0U; i < function_list.size(); ++i) {
+    function_shard_list[i] =
+        group_shard_list[group_index_map.at(include_group_list[i])];
+  }
+
+  std::stable_sort(function_order.begin(), function_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return std::make_pair(function_shard_list[lhs],
+                                           include_group_list[lhs]) <
+                            std::make_pair(function_shard_list[rhs],
+                                           include_group_list[rhs]);
+                   });
+
+  std::vector<ImplementationFileDescriptor> file_list;
+
+  std::size_t first_function = 0U;
+  for (std::size_t i = 0U; i < shard_count; ++i) {
+    auto last_function = first_function;
+    while (last_function < function_order.size() &&
+           function_shard_list[function_order[last_function]] == i) {
+      ++last_function;
+    }
+
+    ImplementationFileDescriptor file_descriptor;
+    file_descriptor.path =
+        cmdline_options.output + "_" + std::to_string(i) + ".cpp";
+
+    file_descriptor.array_name = "__mcsema_externs_" + std::to_string(i);
+    file_descriptor.first_function = first_function;
+    file_descriptor.last_function = last_function;
+    file_descriptor.include_block =
+        getIncludeBlock(cmdline_options, abi_library, shard_header_set_list[i],
+                        header_file_name);
+
+    file_list.push_back(std::move(file_descriptor));
+    first_function = last_function;
+  }
+
+  return file_list;
+}
+
+/// Splits the whitelisted functions into the implementation files
+std::vector<ImplementationFileDescriptor> createImplementationFileList(
+    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
+    std::vector<std::size_t> &function_order,
+    const std::string &header_file_name) {
+  const auto &function_list = abi_library.whitelisted_function_list;
+
+  function_order.resize(function_list.size());
+  for (std::size_t i = 0U; i < function_order.size(); ++i) {
+    function_order[i] = i;
+  }
+
+  std::vector<ImplementationFileDescriptor> file_list;
+
+  if (cmdline_options.shards <= 1U && !cmdline_options.header_sublibraries) {
+    ImplementationFileDescriptor file_descriptor;
+    file_descriptor.path = cmdline_options.output + ".cpp";
+    file_descriptor.include_block = "#include \"" + header_file_name + "\"\n\n";
+    file_descriptor.array_name = "__mcsema_externs";
+    file_descriptor.first_function = 0U;
+    file_descriptor.last_function = function_order.size();
+
+    file_list.push_back(std::move(file_descriptor));
+    return file_list;
+  }
+
+  if (cmdline_options.header_sublibraries) {
+    return createHeaderSublibraryList(cmdline_options, abi_library,
+                                      function_order, header_file_name);
+  }
+
+  if (usesHeaderShardPartitioning(cmdline_options, abi_library)) {
+    return createHeaderShardList(cmdline_options, abi_library, function_order,
+                                 header_file_name);
+  }
+
+  // Sort the functions by the headers they need, so that the first shards
+  // only have to include a small part of the header list
+  std::vector<std::size_t> required_header_count_list(function_list.size());
+  for (std::size_t i = 0U; i < function_list.size(); ++i) {
+    required_header_count_list[i] =
+        getRequiredHeaderCount(cmdline_options, abi_library, function_list[i]);
+  }
+
+  std::stable_sort(function_order.begin(), function_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return required_header_count_list[lhs] <
+                            required_header_count_list[rhs];
+                   });
+
+  auto shard_count = cmdline_options.shards;
+  auto function_count = function_order.size();
+
+  for (std::size_t i = 0U; i < shard_count; ++i) {
+    ImplementationFileDescriptor file_descriptor;
+    file_descriptor.path =
+        cmdline_options.output + "_" + std::to_string(i) + ".cpp";
+
+    file_descriptor.array_name = "__mcsema_externs_" + std::to_string(i);
+    file_descriptor.first_function = (function_count * i) / shard_count;
+    file_descriptor.last_function = (function_count * (i + 1U)) / shard_count;
+
+    std::size_t required_header_count = 0U;
+    if (file_descriptor.first_function != file_descriptor.last_function) {
+      auto last_function_index =
+          function_order[file_descriptor.last_function - 1U];
+
+      required_header_count = required_header_count_list[last_function_index];
+    }
+
+    // The sliced header is small enough to be included by every shard
+    file_descriptor.include_block =
+        getIncludeBlock(cmdline_options, abi_library, required_header_count,
+                        header_file_name);
+
+    file_list.push_back(std::move(file_descriptor));
+  }
+
+  return file_list;
+}
+}  // namespace
+
+const char *getBlacklistReasonName(
+    BlacklistedFunction::Reason blacklist_reason) {
+  switch (blacklist_reason) {
+    case BlacklistedFunction::Reason::FunctionPointer:
+      return "FunctionPointer";
+
+    case BlacklistedFunction::Reason::DuplicateName:
+      return "DuplicateName";
+
+    case BlacklistedFunction::Reason::Variadic:
+      return "Variadic";
+
+    case BlacklistedFunction::Reason::Templated:
+      return "Templated";
+
+    case BlacklistedFunction::Reason::NotExported:
+      return "NotExported";
+
+    case BlacklistedFunction::Reason::InternalLinkage:
+      return "InternalLinkage";
+  }
+
+  return "Unknown";
+}
+
+ABILibGeneratorStatus generateABILibrary(
+    const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
+    const Profile &profile, StringList *output_file_list,
+    RenderedFileMap *rendered_file_map) {
+  if (output_file_list != nullptr) {
+    output_file_list->clear();
+  }
+
+  if (rendered_file_map != nullptr) {
+    rendered_file_map->clear();
+  }
+
+  // Returns where the given file is rendered in memory, or null if it is
+  // saved; all the entries are created up front, so that the worker threads
+  // never modify the map itself
+  auto L_memoryOutput = [&](const std::string &path) -> std::string * {
+    return (rendered_file_map != nullptr) ? &(*rendered_file_map)[path]
+                                          : nullptr;
+  };
+
+  // Open the destination files
+  auto header_file_path = cmdline_options.output + ".h";
+  auto header_file_name = stdfs::path(header_file_path).filename().string();
+
+  BufferedFileWriter header_file;
+  if (!header_file.open(header_file_path, L_memoryOutput(header_file_path))) {
+    return ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                 "Failed to create the header file");
+  }
+
+  // The abigen header is the same for all the files
+  std::stringstream abigen_header_stream;
+  generateAbigenHeader(abigen_header_stream, profile);
+  auto abigen_header = abigen_header_stream.str();
+
+  std::vector<std::size_t> function_order;
+  auto implementation_file_list = createImplementationFileList(
+      cmdline_options, abi_library, function_order, header_file_name);
+
+  std::vector<std::string *> implementation_output_list;
+  for (const auto &file_descriptor : implementation_file_list) {
+    implementation_output_list.push_back(L_memoryOutput(file_descriptor.path));
+  }
+
+  if (cmdline_options.header_sublibraries && rendered_file_map == nullptr) {
+    std::error_code error;
+    stdfs::create_directories(getHeaderSublibraryFolder(cmdline_options),
+                              error);
+
+    if (error) {
+      return ABILibGeneratorStatus(
+          false, ABILibGeneratorError::IOError,
+          "Failed to create the header sub-library folder");
+    }
+  }
+
+  // The files do not depend on each other; write the implementation files
+  // while the header is being generated
+  std::vector<ABILibGeneratorStatus> implementation_status_list(
+      implementation_file_list.size());
+
+  std::atomic_size_t next_file{0U};
+
+  auto L_worker = [&](std::size_t) {
+    while (true) {
+      auto file_index = next_file.fetch_add(1U);
+      if (file_index >= implementation_file_list.size()) {
+        break;
+      }
+
+      implementation_status_list[file_index] = generateImplementationFile(
+          implementation_file_list[file_index], cmdline_options, abi_library,
+          function_order, abigen_header,
+          implementation_output_list[file_index]);
+    }
+  };
+
+  auto lane_count = std::min(implementation_file_list.size(),
+                             getTaskThreadBudget());
+
+  TaskGroup task_group;
+  for (std::size_t i = 0U; i < lane_count; ++i) {
+    task_group.run([&L_worker, i]() { L_worker(i); });
+  }
+
+  auto header_status = generateHeaderFile(header_file, cmdline_options,
+                                          abi_library, abigen_header);
+
+  auto write_json_report =
+      cmdline_options.json_report || cmdline_options.blacklist_report == "json";
+
+  auto report_status = ABILibGeneratorStatus(true);
+  if (write_json_report) {
+    BufferedFileWriter report_file;
+    if (report_file.open(cmdline_options.output + ".json")) {
+      report_status = generateJSONReport(report_file, abi_library);
+
+    } else {
+      report_status =
+          ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                "Failed to create the JSON report");
+    }
+  }
+
+  auto blacklist_report_status = ABILibGeneratorStatus(true);
+  if (cmdline_options.blacklist_report == "text") {
+    BufferedFileWriter blacklist_report_file;
+    if (blacklist_report_file.open(getBlacklistReportPath(cmdline_options))) {
+      generateBlacklistReport(blacklist_report_file, abi_library);
+
+      if (!blacklist_report_file.close()) {
+        blacklist_report_status =
+            ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                  "Failed to write the blacklist report");
+      }
+
+    } else {
+      blacklist_report_status =
+          ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                "Failed to create the blacklist report");
+    }
+  }
+
+  // Sliced libraries do not include the headers
+  auto header_map_status = ABILibGeneratorStatus(true);
+  auto emit_header_map = cmdline_options.emit_header_map &&
+                         abi_library.sliced_header.empty() &&
+                         !abi_library.header_path_list.empty();
+
+  if (emit_header_map) {
+    std::vector<std::pair<std::string, std::string>> include_path_list;
+
+    for (std::size_t i = 0U; i < abi_library.header_list.size() &&
+                             i < abi_library.header_path_list.size();
+         ++i) {
+      if (!abi_library.header_path_list[i].empty()) {
+        include_path_list.push_back(
+            {abi_library.header_list[i], abi_library.header_path_list[i]});
+      }
+    }
+
+    if (!writeFileIfChanged(cmdline_options.output + ".hmap",
+                            serializeResolvedHeaderMap(include_path_list))) {
+      header_map_status =
+          ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                "Failed to create the header map");
+    }
+  }
+
+  auto definitions_status = ABILibGeneratorStatus(true);
+  if (cmdline_options.mcsema_definitions) {
+    BufferedFileWriter definitions_file;
+    if (definitions_file.open(cmdline_options.output + ".defs.txt")) {
+      definitions_status =
+          generateMcsemaDefinitions(definitions_file, abi_library);
+
+    } else {
+      definitions_status =
+          ABILibGeneratorStatus(false, ABILibGeneratorError::IOError,
+                                "Failed to create the mcsema definitions");
+    }
+  }
+
+  task_group.wait();
+
+  if (!header_status.succeeded()) {
+    return header_status;
+  }
+
+  if (!report_status.succeeded()) {
+    return report_status;
+  }
+
+  if (!blacklist_report_status.succeeded()) {
+    return blacklist_report_status;
+  }
+
+  if (!header_map_status.succeeded()) {
+    return header_map_status;
+  }
+
+  if (!definitions_status.succeeded()) {
+    return definitions_status;
+  }
+
+  for (const auto &implementation_status : implementation_status_list) {
+    if (!implementation_status.succeeded()) {
+      return implementation_status;
+    }
+  }
+
+  if (cmdline_options.header_sublibraries && rendered_file_map == nullptr &&
+      !removeStaleHeaderSublibraries(cmdline_options,
+                                     implementation_file_list)) {
+    return ABILibGeneratorStatus(
+        false, ABILibGeneratorError::IOError,
+        "Failed to remove the stale header sub-libraries");
+  }
+
+  if (output_file_list != nullptr) {
+    output_file_list->push_back(header_file_path);
+
+    for (const auto &file_descriptor : implementation_file_list) {
+      output_file_list->push_back(file_descriptor.path);
+    }
+
+    if (write_json_report) {
+      output_file_list->push_back(cmdline_options.output + ".json");
+    }
+
+    if (cmdline_options.blacklist_report == "text") {
+      output_file_list->push_back(getBlacklistReportPath(cmdline_options));
+    }
+
+    if (cmdline_options.mcsema_definitions) {
+      output_file_list->push_back(cmdline_options.output + ".defs.txt");
+    }
+
+    if (emit_header_map) {
+      output_file_list->push_back(cmdline_options.output + ".hmap");
+    }
+  }
+
   return ABILibGeneratorStatus(true);
 }
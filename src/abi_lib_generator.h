@@ -26,8 +26,20 @@ enum class ABILibGeneratorError { IOError, Unknown };
 /// Status object used by the generateABILibrary function
 using ABILibGeneratorStatus = IStatus<ABILibGeneratorError>;
 
+/// Returns the name of the given blacklist reason, as written in the
+/// generated files
+const char *getBlacklistReasonName(
+    BlacklistedFunction::Reason blacklist_reason);
+
 /// Generates the ABI library using the provided command line options with the
-/// given ABI library state
+/// given ABI library state. Files whose contents would not change are left
+/// untouched. If passed, the output file list receives the path of every
+/// file that belongs to the library. The header map is only saved when the
+/// ABI library contains the resolved header paths. When the rendered file
+/// map is passed, the header and the implementation files are rendered into
+/// it, keyed on their output path, instead of being saved; the reports and
+/// the header map are still written to disk
 ABILibGeneratorStatus generateABILibrary(
     const CommandLineOptions &cmdline_options, const ABILibrary &abi_library,
-    const Profile &profile);
+    const Profile &profile, StringList *output_file_list = nullptr,
+    RenderedFileMap *rendered_file_map = nullptr);
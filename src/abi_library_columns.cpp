@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "abi_library_columns.h"
+
+#include <iterator>
+#include <unordered_map>
+
+namespace {
+/// Interns the strings while the columns are being built
+class StringTableBuilder final {
+  /// The table being built
+  ABILibraryColumns &columns;
+
+  /// Maps each string to its identifier
+  std::unordered_map<std::string, StringId> string_id_map;
+
+ public:
+  /// Constructor
+  StringTableBuilder(ABILibraryColumns &columns) : columns(columns) {
+    columns.string_offset_list.push_back(0U);
+  }
+
+  /// Returns the identifier of the given string, adding it to the table if
+  /// it is new
+  StringId intern(const std::string &value) {
+    auto it = string_id_map.find(value);
+    if (it != string_id_map.end()) {
+      return it->second;
+    }
+
+    auto string_id =
+        static_cast<StringId>(columns.string_offset_list.size() - 1U);
+
+    columns.string_data.append(value);
+    columns.string_offset_list.push_back(
+        static_cast<std::uint32_t>(columns.string_data.size()));
+
+    string_id_map.insert({value, string_id});
+    return string_id;
+  }
+};
+
+/// Appends the type locations to the payload columns
+void packTypeLocations(
+    ABILibraryColumns &columns, StringTableBuilder &string_table,
+    const BlacklistedFunction::FunctionPointerLocations &location_list) {
+  for (const auto &p : location_list) {
+    columns.payload_location_list.push_back(p.first);
+    columns.payload_spelling_list.push_back(string_table.intern(p.second));
+  }
+}
+
+/// Returns false if the given offset list does not describe the given amount
+/// of entries, contiguous and in order, within a payload of the given size
+bool validateOffsetList(const std::vector<std::uint32_t> &offset_list,
+                        std::size_t entry_count, std::size_t payload_size) {
+  if (offset_list.size() != entry_count + 1U || offset_list.front() != 0U ||
+      offset_list.back() != payload_size) {
+    return false;
+  }
+
+  for (std::size_t i = 1U; i < offset_list.size(); ++i) {
+    if (offset_list[i] < offset_list[i - 1U]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+}  // namespace
+
+void packABILibraryFunctions(ABILibraryColumns &columns,
+                             const ABILibrary &abi_library) {
+  columns = {};
+  StringTableBuilder string_table(columns);
+
+  const auto &whitelisted_function_list = abi_library.whitelisted_function_list;
+  auto whitelisted_count = whitelisted_function_list.size();
+
+  columns.whitelisted_location_list.reserve(whitelisted_count);
+  columns.whitelisted_friendly_name_list.reserve(whitelisted_count);
+  columns.whitelisted_mangled_name_list.reserve(whitelisted_count);
+  columns.whitelisted_argument_count_list.reserve(whitelisted_count);
+  columns.whitelisted_calling_convention_list.reserve(whitelisted_count);
+  columns.whitelisted_no_return_list.reserve(whitelisted_count);
+  columns.opaque_type_offset_list.reserve(whitelisted_count + 1U);
+
+  columns.opaque_type_offset_list.push_back(0U);
+
+  for (const auto &function : whitelisted_function_list) {
+    columns.whitelisted_location_list.push_back(function.location);
+    columns.whitelisted_friendly_name_list.push_back(
+        string_table.intern(function.friendly_name));
+    columns.whitelisted_mangled_name_list.push_back(
+        string_table.intern(function.mangled_name));
+    columns.whitelisted_argument_count_list.push_back(function.argument_count);
+    columns.whitelisted_calling_convention_list.push_back(
+        static_cast<std::uint8_t>(function.calling_convention));
+    columns.whitelisted_no_return_list.push_back(function.no_return ? 1U : 0U);
+
+    columns.opaque_type_data.insert(columns.opaque_type_data.end(),
+                                    function.opaque_type_list.begin(),
+                                    function.opaque_type_list.end());
+
+    columns.opaque_type_offset_list.push_back(
+        static_cast<std::uint32_t>(columns.opaque_type_data.size()));
+  }
+
+  const auto &blacklisted_function_list = abi_library.blacklisted_function_list;
+  auto blacklisted_count = blacklisted_function_list.size();
+
+  columns.blacklisted_location_list.reserve(blacklisted_count);
+  columns.blacklisted_friendly_name_list.reserve(blacklisted_count);
+  columns.blacklisted_mangled_name_list.reserve(blacklisted_count);
+  columns.blacklisted_reason_list.reserve(blacklisted_count);
+  columns.reason_data_kind_list.reserve(blacklisted_count);
+  columns.reason_data_offset_list.reserve(blacklisted_count + 1U);
+
+  columns.reason_data_offset_list.push_back(0U);
+
+  for (const auto &function : blacklisted_function_list) {
+    columns.blacklisted_location_list.push_back(function.location);
+    columns.blacklisted_friendly_name_list.push_back(
+        string_table.intern(function.friendly_name));
+    columns.blacklisted_mangled_name_list.push_back(
+        string_table.intern(function.mangled_name));
+    columns.blacklisted_reason_list.push_back(
+        static_cast<std::uint8_t>(function.reason));
+    columns.reason_data_kind_list.push_back(
+        static_cast<std::uint8_t>(function.reason_data.index()));
+
+    if (const auto duplicate_locations =
+            std::get_if<BlacklistedFunction::DuplicateFunctionLocations>(
+                &function.reason_data)) {
+      for (const auto &location : *duplicate_locations) {
+        columns.payload_location_list.push_back(location);
+        columns.payload_spelling_list.push_back(kNoStringId);
+      }
+
+    } else if (const auto pointer_locations = std::get_if<
+                   BlacklistedFunction::FunctionPointerLocations>(
+                   &function.reason_data)) {
+      packTypeLocations(columns, string_table, *pointer_locations);
+    }
+
+    columns.reason_data_offset_list.push_back(
+        static_cast<std::uint32_t>(columns.payload_location_list.size()));
+  }
+
+  // The map is ordered, so the identities are sorted
+  columns.function_pointer_offset_list.push_back(
+      static_cast<std::uint32_t>(columns.payload_location_list.size()));
+
+  for (const auto &p : abi_library.function_pointer_type_map) {
+    columns.function_pointer_type_list.push_back(p.first);
+    packTypeLocations(columns, string_table, p.second);
+
+    columns.function_pointer_offset_list.push_back(
+        static_cast<std::uint32_t>(columns.payload_location_list.size()));
+  }
+}
+
+bool unpackABILibraryFunctions(ABILibrary &abi_library,
+                               const ABILibraryColumns &columns) {
+  abi_library.whitelisted_function_list.clear();
+  abi_library.blacklisted_function_list.clear();
+  abi_library.function_pointer_type_map.clear();
+
+  // Validate the string table and the payload before reading them
+  const auto &string_offset_list = columns.string_offset_list;
+  if (!validateOffsetList(string_offset_list,
+                          string_offset_list.empty()
+                              ? 0U
+                              : string_offset_list.size() - 1U,
+                          columns.string_data.size())) {
+    return false;
+  }
+
+  auto string_count = string_offset_list.size() - 1U;
+
+  auto L_string = [&](std::string &value, StringId string_id) -> bool {
+    if (string_id >= string_count) {
+      return false;
+    }
+
+    auto start = string_offset_list[string_id];
+    value.assign(columns.string_data, start,
+                 string_offset_list[string_id + 1U] - start);
+
+    return true;
+  };
+
+  const auto &payload_location_list = columns.payload_location_list;
+  const auto &payload_spelling_list = columns.payload_spelling_list;
+  if (payload_spelling_list.size() != payload_location_list.size()) {
+    return false;
+  }
+
+  auto L_typeLocations =
+      [&](BlacklistedFunction::FunctionPointerLocations &location_list,
+          std::uint32_t start, std::uint32_t end) -> bool {
+    location_list.resize(end - start);
+
+    for (auto i = start; i < end; ++i) {
+      auto &p = location_list[i - start];
+      p.first = payload_location_list[i];
+      if (!L_string(p.second, payload_spelling_list[i])) {
+        return false;
+      }
+    }
+
+    return true;
+  };
+
+  // Whitelisted functions
+  auto whitelisted_count = columns.whitelisted_location_list.size();
+  if (columns.whitelisted_friendly_name_list.size() != whitelisted_count ||
+      columns.whitelisted_mangled_name_list.size() != whitelisted_count ||
+      columns.whitelisted_argument_count_list.size() != whitelisted_count ||
+      columns.whitelisted_calling_convention_list.size() !=
+          whitelisted_count ||
+      columns.whitelisted_no_return_list.size() != whitelisted_count ||
+      !validateOffsetList(columns.opaque_type_offset_list, whitelisted_count,
+                          columns.opaque_type_data.size())) {
+    return false;
+  }
+
+  abi_library.whitelisted_function_list.resize(whitelisted_count);
+
+  for (std::size_t i = 0U; i < whitelisted_count; ++i) {
+    auto &function = abi_library.whitelisted_function_list[i];
+
+    auto calling_convention = columns.whitelisted_calling_convention_list[i];
+    if (calling_convention >
+        static_cast<std::uint8_t>(
+            WhitelistedFunction::CallingConvention::FastCall)) {
+      return false;
+    }
+
+    function.location = columns.whitelisted_location_list[i];
+    if (!L_string(function.friendly_name,
+                  columns.whitelisted_friendly_name_list[i]) ||
+        !L_string(function.mangled_name,
+                  columns.whitelisted_mangled_name_list[i])) {
+      return false;
+    }
+
+    function.argument_count = columns.whitelisted_argument_count_list[i];
+    function.calling_convention =
+        static_cast<WhitelistedFunction::CallingConvention>(calling_convention);
+    function.no_return = columns.whitelisted_no_return_list[i] != 0U;
+
+    auto opaque_type_begin = std::next(
+        columns.opaque_type_data.begin(),
+        static_cast<std::ptrdiff_t>(columns.opaque_type_offset_list[i]));
+
+    auto opaque_type_end = std::next(
+        columns.opaque_type_data.begin(),
+        static_cast<std::ptrdiff_t>(columns.opaque_type_offset_list[i + 1U]));
+
+    function.opaque_type_list.assign(opaque_type_begin, opaque_type_end);
+  }
+
+  // Blacklisted functions; their payload comes first, followed by the one
+  // of the function pointer type map
+  auto blacklisted_count = columns.blacklisted_location_list.size();
+  const auto &reason_data_offset_list = columns.reason_data_offset_list;
+
+  if (columns.blacklisted_friendly_name_list.size() != blacklisted_count ||
+      columns.blacklisted_mangled_name_list.size() != blacklisted_count ||
+      columns.blacklisted_reason_list.size() != blacklisted_count ||
+      columns.reason_data_kind_list.size() != blacklisted_count ||
+      columns.function_pointer_offset_list.empty() ||
+      !validateOffsetList(reason_data_offset_list, blacklisted_count,
+                          columns.function_pointer_offset_list.front())) {
+    return false;
+  }
+
+  abi_library.blacklisted_function_list.resize(blacklisted_count);
+
+  for (std::size_t i = 0U; i < blacklisted_count; ++i) {
+    auto &function = abi_library.blacklisted_function_list[i];
+
+    auto reason = columns.blacklisted_reason_list[i];
+    if (reason > static_cast<std::uint8_t>(
+                     BlacklistedFunction::Reason::InternalLinkage)) {
+      return false;
+    }
+
+    function.location = columns.blacklisted_location_list[i];
+    if (!L_string(function.friendly_name,
+                  columns.blacklisted_friendly_name_list[i]) ||
+        !L_string(function.mangled_name,
+                  columns.blacklisted_mangled_name_list[i])) {
+      return false;
+    }
+
+    function.reason = static_cast<BlacklistedFunction::Reason>(reason);
+
+    auto start = reason_data_offset_list[i];
+    auto end = reason_data_offset_list[i + 1U];
+
+    if (columns.reason_data_kind_list[i] == 0U) {
+      BlacklistedFunction::DuplicateFunctionLocations location_list(
+          std::next(payload_location_list.begin(),
+                    static_cast<std::ptrdiff_t>(start)),
+          std::next(payload_location_list.begin(),
+                    static_cast<std::ptrdiff_t>(end)));
+
+      function.reason_data = std::move(location_list);
+
+    } else if (columns.reason_data_kind_list[i] == 1U) {
+      BlacklistedFunction::FunctionPointerLocations location_list;
+      if (!L_typeLocations(location_list, start, end)) {
+        return false;
+      }
+
+      function.reason_data = std::move(location_list);
+
+    } else {
+      return false;
+    }
+  }
+
+  // Function pointer type map
+  const auto &function_pointer_offset_list =
+      columns.function_pointer_offset_list;
+
+  auto type_count = columns.function_pointer_type_list.size();
+  if (function_pointer_offset_list.size() != type_count + 1U ||
+      function_pointer_offset_list.back() != payload_location_list.size()) {
+    return false;
+  }
+
+  for (std::size_t i = 0U; i < type_count; ++i) {
+    auto start = function_pointer_offset_list[i];
+    auto end = function_pointer_offset_list[i + 1U];
+    if (end < start) {
+      return false;
+    }
+
+    BlacklistedFunction::FunctionPointerLocations location_list;
+    if (!L_typeLocations(location_list, start, end)) {
+      return false;
+    }
+
+    abi_library.function_pointer_type_map.insert(
+        {columns.function_pointer_type_list[i], std::move(location_list)});
+  }
+
+  return true;
+}
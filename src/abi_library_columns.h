@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "types.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Identifies a string of the ABILibraryColumns string table
+using StringId = std::uint32_t;
+
+/// Used for the payload entries that have no spelling
+const StringId kNoStringId = 0xFFFFFFFFU;
+
+/// A compact, columnar copy of an ABILibrary: each field of the functions is
+/// stored in its own vector, names and spellings are interned in a single
+/// string table, and the variable length data (opaque types, blacklist
+/// reasons) is stored in shared payload vectors indexed by offset lists
+/// holding one more element than the function count. Every column is a
+/// vector of trivially copyable values, so that it can be saved and loaded
+/// with a single copy
+struct ABILibraryColumns final {
+  /// The characters of all the interned strings, one after the other
+  std::string string_data;
+
+  /// String i spans from string_offset_list[i] to string_offset_list[i + 1]
+  std::vector<std::uint32_t> string_offset_list;
+
+  /// Whitelisted functions: locations
+  std::vector<SourceCodeLocation> whitelisted_location_list;
+
+  /// Whitelisted functions: friendly names
+  std::vector<StringId> whitelisted_friendly_name_list;
+
+  /// Whitelisted functions: mangled names
+  std::vector<StringId> whitelisted_mangled_name_list;
+
+  /// Whitelisted functions: fixed argument counts
+  std::vector<std::uint32_t> whitelisted_argument_count_list;
+
+  /// Whitelisted functions: calling conventions
+  std::vector<std::uint8_t> whitelisted_calling_convention_list;
+
+  /// Whitelisted functions: one if the function never returns
+  std::vector<std::uint8_t> whitelisted_no_return_list;
+
+  /// Whitelisted functions: offsets into the opaque type data
+  std::vector<std::uint32_t> opaque_type_offset_list;
+
+  /// The opaque type lists of all the whitelisted functions
+  TypeIdentityList opaque_type_data;
+
+  /// Blacklisted functions: locations
+  std::vector<SourceCodeLocation> blacklisted_location_list;
+
+  /// Blacklisted functions: friendly names
+  std::vector<StringId> blacklisted_friendly_name_list;
+
+  /// Blacklisted functions: mangled names
+  std::vector<StringId> blacklisted_mangled_name_list;
+
+  /// Blacklisted functions: reason codes
+  std::vector<std::uint8_t> blacklisted_reason_list;
+
+  /// Blacklisted functions: the alternative held by the reason data
+  std::vector<std::uint8_t> reason_data_kind_list;
+
+  /// Blacklisted functions: offsets into the payload columns
+  std::vector<std::uint32_t> reason_data_offset_list;
+
+  /// The identities of the function pointer type map, sorted
+  TypeIdentityList function_pointer_type_list;
+
+  /// Function pointer type map: offsets into the payload columns
+  std::vector<std::uint32_t> function_pointer_offset_list;
+
+  /// Payload: the locations of the reason data and of the function pointer
+  /// type map
+  std::vector<SourceCodeLocation> payload_location_list;
+
+  /// Payload: the spelling of each location, or kNoStringId for the
+  /// locations of the duplicated functions
+  std::vector<StringId> payload_spelling_list;
+};
+
+/// Converts the functions of the given library to the columnar layout; the
+/// other fields of the library are not converted
+void packABILibraryFunctions(ABILibraryColumns &columns,
+                             const ABILibrary &abi_library);
+
+/// Converts the columns back to the functions of the given library, leaving
+/// the other fields untouched. Returns false if the columns are not
+/// consistent, i.e.: when they have been read from a corrupted file
+bool unpackABILibraryFunctions(ABILibrary &abi_library,
+                               const ABILibraryColumns &columns);
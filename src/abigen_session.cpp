@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "abigen_session.h"
+#include "output_capture.h"
+
+/// Private class data
+struct AbigenSession::PrivateData final {
+  /// The profiles, scanned once for the whole session
+  ProfileManagerRef profile_manager;
+
+  /// The supported languages
+  LanguageManager language_manager;
+
+  /// The caches shared by the commands
+  ResidentStateRef resident_state;
+};
+
+AbigenSession::AbigenSession(const std::string &state_directory)
+    : d(new PrivateData) {
+  auto profile_manager_status = ProfileManager::create(d->profile_manager);
+  if (!profile_manager_status.succeeded()) {
+    throw Status(false, StatusCode::ProfileManagerError,
+                 profile_manager_status.toString());
+  }
+
+  auto resident_state_status =
+      ResidentState::create(d->resident_state, state_directory);
+  if (!resident_state_status.succeeded()) {
+    throw Status(false, StatusCode::ResidentStateError,
+                 resident_state_status.toString());
+  }
+}
+
+AbigenSession::Status AbigenSession::create(
+    AbigenSessionRef &obj, const std::string &state_directory) {
+  obj.reset();
+
+  try {
+    auto ptr = new AbigenSession(state_directory);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+AbigenSession::~AbigenSession() {}
+
+ProfileMap AbigenSession::profiles() const {
+  ProfileMap profile_map;
+
+  d->profile_manager->enumerate<ProfileMap *>(
+      [](const Profile &profile, ProfileMap *profile_map) -> bool {
+        profile_map->insert({profile.name, profile});
+        return true;
+      },
+      &profile_map);
+
+  return profile_map;
+}
+
+AbigenSession::Status AbigenSession::generate(
+    ABILibrary &abi_library, const CommandLineOptions &cmdline_options,
+    std::string *command_output) {
+  abi_library = {};
+
+  // Requests share the caches of the session, unless they bring their own
+  auto options = cmdline_options;
+  if (!options.resident_state) {
+    options.resident_state = d->resident_state;
+  }
+
+  std::string output;
+  bool succeeded;
+
+  {
+    ScopedOutputCapture output_capture;
+    ScopedOutputCapture::setThreadOutput(&output);
+
+    succeeded = runGenerateCommand(d->profile_manager, d->language_manager,
+                                   options, &abi_library);
+
+    ScopedOutputCapture::setThreadOutput(nullptr);
+  }
+
+  if (command_output != nullptr) {
+    *command_output = output;
+  }
+
+  if (!succeeded) {
+    const auto &cancellation_flag = options.cancellation_flag;
+    if (cancellation_flag && cancellation_flag->load()) {
+      return Status(false, StatusCode::Cancelled, output);
+    }
+
+    return Status(false, StatusCode::GenerationError, output);
+  }
+
+  return Status(true);
+}
+
+AbigenSession::Status AbigenSession::compile(
+    std::string &bitcode, const CommandLineOptions &cmdline_options,
+    std::string *command_output) {
+  bitcode.clear();
+
+  auto options = cmdline_options;
+  if (!options.resident_state) {
+    options.resident_state = d->resident_state;
+  }
+
+  std::string output;
+  bool succeeded;
+
+  {
+    ScopedOutputCapture output_capture;
+    ScopedOutputCapture::setThreadOutput(&output);
+
+    succeeded = runCompileCommand(d->profile_manager, d->language_manager,
+                                  options, &bitcode);
+
+    ScopedOutputCapture::setThreadOutput(nullptr);
+  }
+
+  if (command_output != nullptr) {
+    *command_output = output;
+  }
+
+  if (!succeeded) {
+    return Status(false, StatusCode::CompilationError, output);
+  }
+
+  return Status(true);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "cmdline.h"
+#include "istatus.h"
+#include "resident_state.h"
+#include "types.h"
+
+#include <memory>
+#include <string>
+
+class AbigenSession;
+
+/// A reference to an AbigenSession object
+using AbigenSessionRef = std::unique_ptr<AbigenSession>;
+
+/// The AbigenSession runs the generate and compile commands inside the
+/// process that links the abigen library. The profiles are scanned once, and
+/// the file system caches and the precompiled base includes are kept across
+/// the calls, as done by the serve command. The options are the ones filled
+/// by the command line parser; the other commands are not exposed. Progress
+/// is streamed through CommandLineOptions::event_callback, and a request is
+/// cancelled by raising CommandLineOptions::cancellation_flag. All methods
+/// are thread safe
+class AbigenSession final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  AbigenSession(const std::string &state_directory);
+
+ public:
+  /// Status code, used with AbigenSession::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    ProfileManagerError,
+    ResidentStateError,
+    GenerationError,
+    CompilationError,
+    Cancelled,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new AbigenSession object; the precompiled headers are saved
+  /// inside the given folder. If the folder is empty, a temporary folder is
+  /// used and then removed when the object is destroyed
+  static Status create(AbigenSessionRef &obj,
+                       const std::string &state_directory = std::string());
+
+  /// Destructor
+  ~AbigenSession();
+
+  /// Returns the profiles found when the session has been created
+  ProfileMap profiles() const;
+
+  /// Runs the generate command, returning the ABI library of the selected
+  /// profile; a single profile can be selected. The output files are still
+  /// written next to the output path, since the compile command reads them.
+  /// If passed, the command output receives the messages printed by the
+  /// command; on failure, they are also the message of the status. Runs
+  /// stopped by the cancellation flag return Cancelled
+  Status generate(ABILibrary &abi_library,
+                  const CommandLineOptions &cmdline_options,
+                  std::string *command_output = nullptr);
+
+  /// Runs the compile command, returning the linked bitcode; the output file
+  /// is only written when the output path is not empty. The command output
+  /// is handled as in generate()
+  Status compile(std::string &bitcode,
+                 const CommandLineOptions &cmdline_options,
+                 std::string *command_output = nullptr);
+
+  /// Disable the copy constructor
+  AbigenSession(const AbigenSession &other) = delete;
+
+  /// Disable the assignment operator
+  AbigenSession &operator=(const AbigenSession &other) = delete;
+};
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "analysis_cache.h"
+#include "abi_database.h"
+#include "output_file.h"
+#include "server_metrics.h"
+#include "std_filesystem.h"
+
+#include <atomic>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+/// The first line of each cache entry
+const std::string kAnalysisCacheEntryHeader = "abigen-analysis-cache 1";
+
+/// Reads the header and the results lines of the given entry; the name of
+/// the results file is returned even if the dependencies are not validated
+bool readEntryHeader(std::string &results_file_name, std::ifstream &entry_file,
+                     const std::string &header_path) {
+  results_file_name.clear();
+
+  std::string line;
+  if (!std::getline(entry_file, line) || line != kAnalysisCacheEntryHeader) {
+    return false;
+  }
+
+  // Make sure this is the entry we are looking for, in case of collisions
+  if (!std::getline(entry_file, line) || line != "header " + header_path) {
+    return false;
+  }
+
+  const std::string results_tag = "results ";
+  if (!std::getline(entry_file, line) ||
+      line.compare(0U, results_tag.size(), results_tag) != 0) {
+    return false;
+  }
+
+  results_file_name = line.substr(results_tag.size());
+  return results_file_name.find('/') == std::string::npos;
+}
+}  // namespace
+
+/// Private class data
+struct AnalysisCache::PrivateData final {
+  /// The folder containing the cache entries
+  stdfs::path cache_directory;
+
+  /// Hash of the settings that can change the results of the analysis
+  ContentHash configuration_hash{0U};
+
+  /// If set, the file hashes are taken from this index instead of the map
+  FileFingerprintIndexRef fingerprint_index;
+
+  /// Content hashes for the files that have been read during this run
+  FileHashCache file_hash_cache;
+
+  /// Cache hits
+  std::atomic_size_t hit_count{0U};
+
+  /// Cache misses
+  std::atomic_size_t miss_count{0U};
+};
+
+AnalysisCache::AnalysisCache(const std::string &cache_directory,
+                             ContentHash configuration_hash,
+                             FileFingerprintIndexRef fingerprint_index)
+    : d(new PrivateData) {
+  d->cache_directory = stdfs::path(cache_directory) / "analysis";
+  d->configuration_hash = configuration_hash;
+  d->fingerprint_index = std::move(fingerprint_index);
+
+  std::error_code error;
+  stdfs::create_directories(d->cache_directory, error);
+  if (error) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the analysis cache directory: " +
+                     d->cache_directory.string());
+  }
+}
+
+bool AnalysisCache::getFileHash(ContentHash &hash, const std::string &path) {
+  if (d->fingerprint_index) {
+    return d->fingerprint_index->fingerprint(hash, path);
+  }
+
+  return d->file_hash_cache.getFileHash(hash, path);
+}
+
+std::string AnalysisCache::entryPath(const std::string &header_path) const {
+  auto entry_hash =
+      updateContentHash(kInitialContentHash, d->configuration_hash);
+
+  entry_hash = updateContentHash(entry_hash, header_path);
+
+  auto entry_name = contentHashToString(entry_hash);
+  auto entry_path =
+      d->cache_directory / entry_name.substr(0U, 2U) / entry_name;
+
+  return entry_path.string();
+}
+
+AnalysisCache::Status AnalysisCache::create(AnalysisCacheRef &obj,
+                                            const std::string &cache_directory,
+                                            ContentHash configuration_hash,
+                                            FileFingerprintIndexRef
+                                                fingerprint_index) {
+  obj.reset();
+
+  try {
+    auto ptr = new AnalysisCache(cache_directory, configuration_hash,
+                                 std::move(fingerprint_index));
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+AnalysisCache::~AnalysisCache() {}
+
+bool AnalysisCache::lookup(ABILibrary &results,
+                           const std::string &header_path) {
+  results = {};
+
+  auto L_miss = [&]() -> bool {
+    d->miss_count++;
+    addServerCounter(ServerCounter::AnalysisCacheMisses);
+    return false;
+  };
+
+  stdfs::path entry_path = entryPath(header_path);
+
+  std::ifstream entry_file(entry_path.string());
+  if (!entry_file) {
+    return L_miss();
+  }
+
+  std::string results_file_name;
+  if (!readEntryHeader(results_file_name, entry_file, header_path)) {
+    return L_miss();
+  }
+
+  // Validate the dependencies
+  std::string line;
+  while (std::getline(entry_file, line)) {
+    std::string path;
+    ContentHash expected_hash;
+    if (!parseDependencyLine(path, expected_hash, line)) {
+      return L_miss();
+    }
+
+    ContentHash current_hash;
+    if (!getFileHash(current_hash, path) || current_hash != expected_hash) {
+      return L_miss();
+    }
+  }
+
+  auto results_path = entry_path.parent_path() / results_file_name;
+
+  ABIDatabase database;
+  if (!readABIDatabase(database, results_path.string())) {
+    return L_miss();
+  }
+
+  d->hit_count++;
+  addServerCounter(ServerCounter::AnalysisCacheHits);
+
+  results = std::move(database.abi_library);
+  return true;
+}
+
+void AnalysisCache::store(const std::string &header_path,
+                          const ABILibrary &results,
+                          const StringList &dependency_list) {
+  stdfs::path entry_path = entryPath(header_path);
+
+  std::error_code error;
+  stdfs::create_directories(entry_path.parent_path(), error);
+  if (error) {
+    return;
+  }
+
+  // Each generation gets its own results file, so that the readers of the
+  // previous entry never load mismatched results
+  std::random_device random_device;
+  auto results_file_name = entry_path.filename().string() + "_" +
+                           std::to_string(random_device()) +
+                           kABIDatabaseExtension;
+
+  std::stringstream buffer;
+  buffer << kAnalysisCacheEntryHeader << "\n";
+  buffer << "header " << header_path << "\n";
+  buffer << "results " << results_file_name << "\n";
+
+  for (const auto &path : dependency_list) {
+    ContentHash hash;
+    if (!getFileHash(hash, path)) {
+      // We can't validate this entry later on
+      return;
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  auto results_path = entry_path.parent_path() / results_file_name;
+
+  ABIDatabase database;
+  database.abi_library = results;
+
+  if (!writeABIDatabase(database, results_path.string())) {
+    return;
+  }
+
+  std::string previous_results_file_name;
+
+  {
+    std::ifstream entry_file(entry_path.string());
+    if (entry_file) {
+      readEntryHeader(previous_results_file_name, entry_file, header_path);
+    }
+  }
+
+  if (!writeFileAtomically(entry_path, buffer.str())) {
+    stdfs::remove(results_path, error);
+    return;
+  }
+
+  if (!previous_results_file_name.empty() &&
+      previous_results_file_name != results_file_name) {
+    stdfs::remove(entry_path.parent_path() / previous_results_file_name,
+                  error);
+  }
+}
+
+std::size_t AnalysisCache::hitCount() const { return d->hit_count; }
+
+std::size_t AnalysisCache::missCount() const { return d->miss_count; }
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "content_hash.h"
+#include "file_fingerprints.h"
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+
+class AnalysisCache;
+
+/// A reference to an AnalysisCache object
+using AnalysisCacheRef = std::shared_ptr<AnalysisCache>;
+
+/// The AnalysisCache persists the results of the final analysis for each
+/// header, i.e.: the functions located in it, before duplicate detection.
+/// Each entry is keyed on the analysis configuration and on the header
+/// path, and records the content hash of the files the results depend on;
+/// an entry is only used when none of those files has changed
+class AnalysisCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  AnalysisCache(const std::string &cache_directory,
+                ContentHash configuration_hash,
+                FileFingerprintIndexRef fingerprint_index);
+
+  /// Returns the content hash of the given file, reusing the previous result
+  /// if the file has already been hashed during this run
+  bool getFileHash(ContentHash &hash, const std::string &path);
+
+  /// Returns the path of the entry for the given header
+  std::string entryPath(const std::string &header_path) const;
+
+ public:
+  /// Status code, used with AnalysisCache::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new AnalysisCache object. The configuration hash should
+  /// identify all the settings (and the source buffer) that can change the
+  /// results of the analysis. If a fingerprint index is passed, the file
+  /// hashes are taken from it
+  static Status create(AnalysisCacheRef &obj,
+                       const std::string &cache_directory,
+                       ContentHash configuration_hash,
+                       FileFingerprintIndexRef fingerprint_index = nullptr);
+
+  /// Destructor
+  ~AnalysisCache();
+
+  /// Looks up the results of the functions located in the given header;
+  /// returns false if the cache does not contain a valid entry. This method
+  /// is thread safe
+  bool lookup(ABILibrary &results, const std::string &header_path);
+
+  /// Saves the results of the functions located in the given header, along
+  /// with the files they depend on. This method is thread safe
+  void store(const std::string &header_path, const ABILibrary &results,
+             const StringList &dependency_list);
+
+  /// Returns the amount of headers whose results have been served from the
+  /// cache
+  std::size_t hitCount() const;
+
+  /// Returns the amount of headers that had to be analyzed again
+  std::size_t missCount() const;
+
+  /// Disable the copy constructor
+  AnalysisCache(const AnalysisCache &other) = delete;
+
+  /// Disable the assignment operator
+  AnalysisCache &operator=(const AnalysisCache &other) = delete;
+};
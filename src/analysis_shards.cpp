@@ -0,0 +1,388 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "analysis_shards.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+/// Identifies a function inside the shard list
+struct ShardFunctionReference final {
+  /// The shard index
+  std::size_t shard_index;
+
+  /// True if the function is in the whitelist
+  bool whitelisted;
+
+  /// The index of the function in the list
+  std::size_t function_index;
+};
+
+/// Remaps the file identifier of the given location
+void remapLocation(SourceCodeLocation &location,
+                   const std::vector<FileId> &file_id_map) {
+  if (location.file_id < file_id_map.size()) {
+    location.file_id = file_id_map[location.file_id];
+  }
+}
+}  // namespace
+
+void mergeAnalysisShards(ABILibrary &abi_library,
+                         std::vector<ABILibrary> &shard_list) {
+  abi_library.blacklisted_function_list.clear();
+  abi_library.whitelisted_function_list.clear();
+  abi_library.function_pointer_type_map.clear();
+  abi_library.file_path_list.clear();
+  abi_library.file_include_line_list.clear();
+
+  // Build the merged path list, and move every location to it
+  std::unordered_map<std::string, FileId> file_id_map;
+
+  for (auto &shard : shard_list) {
+    std::vector<FileId> shard_file_id_map;
+    shard_file_id_map.reserve(shard.file_path_list.size());
+
+    for (std::size_t i = 0U; i < shard.file_path_list.size(); ++i) {
+      auto &file_path = shard.file_path_list[i];
+
+      auto file_id = static_cast<FileId>(abi_library.file_path_list.size());
+      auto insert_status = file_id_map.insert({file_path, file_id});
+
+      if (insert_status.second) {
+        abi_library.file_path_list.push_back(std::move(file_path));
+        abi_library.file_include_line_list.push_back(
+            i < shard.file_include_line_list.size()
+                ? shard.file_include_line_list[i]
+                : 0U);
+      }
+
+      shard_file_id_map.push_back(insert_status.first->second);
+    }
+
+    for (auto &function : shard.whitelisted_function_list) {
+      remapLocation(function.location, shard_file_id_map);
+    }
+
+    for (auto &function : shard.blacklisted_function_list) {
+      remapLocation(function.location, shard_file_id_map);
+
+      if (auto duplicate_locations =
+              std::get_if<BlacklistedFunction::DuplicateFunctionLocations>(
+                  &function.reason_data)) {
+        for (auto &location : *duplicate_locations) {
+          remapLocation(location, shard_file_id_map);
+        }
+
+      } else if (auto function_pointer_locations = std::get_if<
+                     BlacklistedFunction::FunctionPointerLocations>(
+                     &function.reason_data)) {
+        for (auto &p : *function_pointer_locations) {
+          remapLocation(p.first, shard_file_id_map);
+        }
+      }
+    }
+
+    // Types are identified by their spelling, so the same type found by
+    // another shard is only reported once
+    for (auto &p : shard.function_pointer_type_map) {
+      for (auto &type_location : p.second) {
+        remapLocation(type_location.first, shard_file_id_map);
+      }
+
+      abi_library.function_pointer_type_map.insert(std::move(p));
+    }
+  }
+
+  auto L_location = [&](const ShardFunctionReference &ref)
+      -> const SourceCodeLocation & {
+    const auto &shard = shard_list[ref.shard_index];
+    if (ref.whitelisted) {
+      return shard.whitelisted_function_list[ref.function_index].location;
+    } else {
+      return shard.blacklisted_function_list[ref.function_index].location;
+    }
+  };
+
+  // Functions that are dropped from the output: the ones blacklisted as
+  // duplicates, plus the copies of a redeclared function
+  std::vector<std::vector<bool>> blacklisted_duplicate_flags;
+  std::vector<std::vector<bool>> whitelisted_duplicate_flags;
+
+  for (const auto &shard : shard_list) {
+    blacklisted_duplicate_flags.emplace_back(
+        shard.blacklisted_function_list.size(), false);
+
+    whitelisted_duplicate_flags.emplace_back(
+        shard.whitelisted_function_list.size(), false);
+  }
+
+  auto L_flag = [&](const ShardFunctionReference &ref)
+      -> std::vector<bool>::reference {
+    auto &flag_list = ref.whitelisted ? whitelisted_duplicate_flags
+                                      : blacklisted_duplicate_flags;
+
+    return flag_list[ref.shard_index][ref.function_index];
+  };
+
+  // Group the functions by mangled name, in shard order. When redeclarations
+  // are merged, the shards that visited different redeclarations of the same
+  // function report it at the same location; only the first copy is kept
+  std::unordered_map<std::string, std::vector<ShardFunctionReference>>
+      name_to_function_map;
+
+  auto L_addReference = [&](const std::string &mangled_name,
+                            const ShardFunctionReference &ref) {
+    auto &reference_list = name_to_function_map[mangled_name];
+    const auto &location = L_location(ref);
+
+    for (const auto &other_reference : reference_list) {
+      const auto &other_location = L_location(other_reference);
+
+      if (location.file_id == other_location.file_id &&
+          location.line == other_location.line &&
+          location.column == other_location.column) {
+        L_flag(ref) = true;
+        return;
+      }
+    }
+
+    reference_list.push_back(ref);
+  };
+
+  for (std::size_t i = 0U; i < shard_list.size(); ++i) {
+    const auto &shard = shard_list[i];
+
+    for (std::size_t j = 0U; j < shard.blacklisted_function_list.size(); ++j) {
+      const auto &function = shard.blacklisted_function_list[j];
+      L_addReference(function.mangled_name, {i, false, j});
+    }
+
+    for (std::size_t j = 0U; j < shard.whitelisted_function_list.size(); ++j) {
+      const auto &function = shard.whitelisted_function_list[j];
+      L_addReference(function.mangled_name, {i, true, j});
+    }
+  }
+
+  // Duplicates take precedence over any other reason, exactly like in
+  // ASTVisitor::finalize()
+  for (const auto &p : name_to_function_map) {
+    const auto &reference_list = p.second;
+
+    if (reference_list.size() == 1U) {
+      continue;
+    }
+
+    BlacklistedFunction func = {};
+    func.mangled_name = p.first;
+    func.reason = BlacklistedFunction::Reason::DuplicateName;
+
+    const auto &first_reference = reference_list.front();
+    const auto &first_shard = shard_list[first_reference.shard_index];
+
+    func.location = L_location(first_reference);
+    if (first_reference.whitelisted) {
+      const auto &function =
+          first_shard.whitelisted_function_list[first_reference.function_index];
+
+      func.friendly_name = function.friendly_name;
+      func.alternate_mangled_name = function.alternate_mangled_name;
+    } else {
+      const auto &function =
+          first_shard.blacklisted_function_list[first_reference.function_index];
+
+      func.friendly_name = function.friendly_name;
+      func.alternate_mangled_name = function.alternate_mangled_name;
+    }
+
+    BlacklistedFunction::DuplicateFunctionLocations locations = {};
+
+    for (const auto &reference : reference_list) {
+      if (&reference != &first_reference) {
+        locations.push_back(L_location(reference));
+      }
+
+      L_flag(reference) = true;
+    }
+
+    func.reason_data = locations;
+    abi_library.blacklisted_function_list.push_back(std::move(func));
+  }
+
+  // Move the remaining functions
+  for (std::size_t i = 0U; i < shard_list.size(); ++i) {
+    auto &shard = shard_list[i];
+
+    for (std::size_t j = 0U; j < shard.blacklisted_function_list.size(); ++j) {
+      if (!blacklisted_duplicate_flags[i][j]) {
+        abi_library.blacklisted_function_list.push_back(
+            std::move(shard.blacklisted_function_list[j]));
+      }
+    }
+
+    for (std::size_t j = 0U; j < shard.whitelisted_function_list.size(); ++j) {
+      if (whitelisted_duplicate_flags[i][j]) {
+        continue;
+      }
+
+      auto &function = shard.whitelisted_function_list[j];
+
+      // The shard only saw the declaration of a type that another shard
+      // found to reach a function pointer
+      BlacklistedFunction::FunctionPointerLocations bad_type_locs;
+      for (auto type_identity : function.opaque_type_list) {
+        auto it = abi_library.function_pointer_type_map.find(type_identity);
+        if (it != abi_library.function_pointer_type_map.end()) {
+          bad_type_locs.insert(bad_type_locs.end(), it->second.begin(),
+                               it->second.end());
+        }
+      }
+
+      if (bad_type_locs.empty()) {
+        abi_library.whitelisted_function_list.push_back(std::move(function));
+        continue;
+      }
+
+      BlacklistedFunction func = {};
+      func.location = function.location;
+      func.friendly_name = std::move(function.friendly_name);
+      func.mangled_name = std::move(function.mangled_name);
+      func.alternate_mangled_name = std::move(function.alternate_mangled_name);
+      func.reason = BlacklistedFunction::Reason::FunctionPointer;
+      func.reason_data = std::move(bad_type_locs);
+
+      abi_library.blacklisted_function_list.push_back(std::move(func));
+    }
+  }
+
+  shard_list.clear();
+
+  sortFunctionLists(abi_library.blacklisted_function_list,
+                    abi_library.whitelisted_function_list,
+                    abi_library.file_path_list);
+}
+
+std::vector<std::size_t> rankFilePaths(const StringList &file_path_list) {
+  std::vector<std::size_t> path_order(file_path_list.size());
+  for (std::size_t i = 0U; i < path_order.size(); ++i) {
+    path_order[i] = i;
+  }
+
+  std::sort(path_order.begin(), path_order.end(),
+            [&](std::size_t lhs, std::size_t rhs) -> bool {
+              return file_path_list[lhs] < file_path_list[rhs];
+            });
+
+  std::vector<std::size_t> file_rank_list(file_path_list.size());
+  for (std::size_t i = 0U; i < path_order.size(); ++i) {
+    file_rank_list[path_order[i]] = i;
+  }
+
+  return file_rank_list;
+}
+
+bool locationPrecedes(const std::vector<std::size_t> &file_rank_list,
+                      const SourceCodeLocation &lhs,
+                      const SourceCodeLocation &rhs) {
+  // Identifiers without a path are sorted last
+  auto L_fileRank = [&](FileId file_id) -> std::size_t {
+    return file_id < file_rank_list.size() ? file_rank_list[file_id]
+                                           : file_rank_list.size() + file_id;
+  };
+
+  if (lhs.file_id != rhs.file_id) {
+    return L_fileRank(lhs.file_id) < L_fileRank(rhs.file_id);
+  }
+
+  if (lhs.line != rhs.line) {
+    return lhs.line < rhs.line;
+  }
+
+  return lhs.column < rhs.column;
+}
+
+bool functionPrecedes(const std::vector<std::size_t> &file_rank_list,
+                      const SourceCodeLocation &lhs_location,
+                      std::string_view lhs_mangled_name,
+                      const SourceCodeLocation &rhs_location,
+                      std::string_view rhs_mangled_name) {
+  if (locationPrecedes(file_rank_list, lhs_location, rhs_location)) {
+    return true;
+  }
+
+  if (locationPrecedes(file_rank_list, rhs_location, lhs_location)) {
+    return false;
+  }
+
+  return lhs_mangled_name < rhs_mangled_name;
+}
+
+void sortFunctionLists(BlacklistedFunctionList &blacklisted_function_list,
+                       WhitelistedFunctionList &whitelisted_function_list,
+                       const StringList &file_path_list) {
+  auto file_rank_list = rankFilePaths(file_path_list);
+
+  auto L_functionPrecedes = [&](const auto &lhs, const auto &rhs) -> bool {
+    return functionPrecedes(file_rank_list, lhs.location, lhs.mangled_name,
+                            rhs.location, rhs.mangled_name);
+  };
+
+  auto L_locationPrecedes = [&](const SourceCodeLocation &lhs,
+                                const SourceCodeLocation &rhs) -> bool {
+    return locationPrecedes(file_rank_list, lhs, rhs);
+  };
+
+  // The lists are usually sorted already; stable_sort keeps the order of
+  // the entries that compare equal, such as the copies of a redeclaration
+  for (auto &function : blacklisted_function_list) {
+    if (auto duplicate_locations =
+            std::get_if<BlacklistedFunction::DuplicateFunctionLocations>(
+                &function.reason_data)) {
+      std::stable_sort(duplicate_locations->begin(),
+                       duplicate_locations->end(), L_locationPrecedes);
+
+    } else if (auto function_pointer_locations = std::get_if<
+                   BlacklistedFunction::FunctionPointerLocations>(
+                   &function.reason_data)) {
+      std::stable_sort(
+          function_pointer_locations->begin(),
+          function_pointer_locations->end(),
+          [&](const auto &lhs, const auto &rhs) -> bool {
+            if (L_locationPrecedes(lhs.first, rhs.first)) {
+              return true;
+            }
+
+            if (L_locationPrecedes(rhs.first, lhs.first)) {
+              return false;
+            }
+
+            return lhs.second < rhs.second;
+          });
+    }
+  }
+
+  if (!std::is_sorted(blacklisted_function_list.begin(),
+                      blacklisted_function_list.end(), L_functionPrecedes)) {
+    std::stable_sort(blacklisted_function_list.begin(),
+                     blacklisted_function_list.end(), L_functionPrecedes);
+  }
+
+  if (!std::is_sorted(whitelisted_function_list.begin(),
+                      whitelisted_function_list.end(), L_functionPrecedes)) {
+    std::stable_sort(whitelisted_function_list.begin(),
+                     whitelisted_function_list.end(), L_functionPrecedes);
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "types.h"
+
+#include <string_view>
+#include <vector>
+
+/// Merges the results produced by visitors that analyzed different shards of
+/// the same translation unit; the shards must have been processed with
+/// duplicate detection deferred (see ASTVisitorSettings). File identifiers
+/// are remapped to a single path list, and the functions sharing the same
+/// mangled name across all the shards are blacklisted, as the serial path
+/// would do; entries sharing both the mangled name and the location are
+/// copies of the same (redeclared) function, and only the first one is kept.
+/// Whitelisted functions referencing an incomplete type that another shard
+/// found to reach a function pointer are blacklisted, using the type
+/// identities. The shard list is consumed, and the header list of the
+/// output is left untouched
+void mergeAnalysisShards(ABILibrary &abi_library,
+                         std::vector<ABILibrary> &shard_list);
+
+/// Returns the rank of each file identifier, i.e. the position of its path
+/// in the sorted path list. Locations are ordered on their paths rather than
+/// on their identifiers, which depend on the order the files were reached in
+std::vector<std::size_t> rankFilePaths(const StringList &file_path_list);
+
+/// Returns true if the first location comes before the second one: by file
+/// path, then by line and column. The ranks come from rankFilePaths()
+bool locationPrecedes(const std::vector<std::size_t> &file_rank_list,
+                      const SourceCodeLocation &lhs,
+                      const SourceCodeLocation &rhs);
+
+/// Returns true if the first function comes before the second one: by
+/// location, then by mangled name
+bool functionPrecedes(const std::vector<std::size_t> &file_rank_list,
+                      const SourceCodeLocation &lhs_location,
+                      std::string_view lhs_mangled_name,
+                      const SourceCodeLocation &rhs_location,
+                      std::string_view rhs_mangled_name);
+
+/// Sorts the function lists with functionPrecedes(), along with the
+/// locations saved by each blacklisted function, so that the output does not
+/// depend on the iteration order of the maps used during the analysis.
+/// Lists that are already sorted are left untouched
+void sortFunctionLists(BlacklistedFunctionList &blacklisted_function_list,
+                       WhitelistedFunctionList &whitelisted_function_list,
+                       const StringList &file_path_list);
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "compilerinstance.h"
+#include "generate_utils.h"
+#include "task_executor.h"
+#include "time_report.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#include <json11.hpp>
+
+namespace {
+/// The cost of including a single header on its own
+struct HeaderCost final {
+  /// The header path
+  std::string path;
+
+  /// The include directive that has been measured: the first one that
+  /// preprocesses, or the first one when none does
+  std::string include_directive;
+
+  /// True if the header could be preprocessed
+  bool preprocessed{false};
+
+  /// True if the header could be parsed
+  bool parsed{false};
+
+  /// How long the preprocessor took, in seconds
+  double preprocess_time{0.0};
+
+  /// How long the whole compilation took, preprocessor included, in seconds
+  double parse_time{0.0};
+
+  /// The amount of tokens produced by the preprocessor
+  std::size_t token_count{0U};
+
+  /// The amount of files read through the header, at any depth
+  std::size_t include_count{0U};
+
+  /// The amount of function declarations found in the translation unit
+  std::size_t function_count{0U};
+};
+
+/// Counts the function declarations of a translation unit
+class FunctionCounter final : public IASTVisitor {
+  /// The declarations found so far
+  std::size_t function_count{0U};
+
+ public:
+  /// Destructor
+  virtual ~FunctionCounter() override = default;
+
+  /// Resets the counter for the new translation unit
+  virtual void initialize(clang::ASTContext *, clang::SourceManager *,
+                          clang::MangleContext *,
+                          clang::MangleContext *) override {
+    function_count = 0U;
+  }
+
+  /// Counts the given declaration
+  virtual bool VisitFunctionDecl(clang::FunctionDecl *) override {
+    ++function_count;
+    return true;
+  }
+
+  /// Records are not needed to count the functions
+  virtual void VisitRecordDefinition(clang::RecordDecl *) override {}
+
+  /// Called after the last AST callback
+  virtual void finalize() override {}
+
+  /// No function is blacklisted
+  virtual BlacklistedFunctionList blacklistedFunctions() const override {
+    return {};
+  }
+
+  /// No function is whitelisted
+  virtual WhitelistedFunctionList whitelistedFunctions() const override {
+    return {};
+  }
+
+  /// No declaration is kept
+  virtual std::vector<clang::FunctionDecl *> whitelistedFunctionDeclarations()
+      const override {
+    return {};
+  }
+
+  /// No file path is kept
+  virtual StringList filePathList() const override { return {}; }
+
+  /// There are no results to move
+  virtual void takeResults(ABILibrary &) override {}
+
+  /// Returns the amount of function declarations found
+  std::size_t functionCount() const { return function_count; }
+};
+
+/// Measures the given source buffer; the dependency list receives the files
+/// read by the preprocessor
+void measureSourceBuffer(HeaderCost &cost, StringList &dependency_list,
+                         CompilerInstance &compiler,
+                         const std::string &source_buffer) {
+  Stopwatch preprocess_stopwatch;
+  cost.preprocessed = compiler
+                          .preprocess(source_buffer, &dependency_list, nullptr,
+                                      nullptr, &cost.token_count)
+                          .succeeded();
+
+  cost.preprocess_time = preprocess_stopwatch.elapsed().wall_time;
+
+  auto function_counter = std::make_shared<FunctionCounter>();
+
+  Stopwatch parse_stopwatch;
+  cost.parsed =
+      compiler.processAST(source_buffer, function_counter).succeeded();
+
+  cost.parse_time = parse_stopwatch.elapsed().wall_time;
+  cost.function_count = function_counter->functionCount();
+}
+
+/// Measures the given header on top of the base includes, removing the cost
+/// of the base includes themselves
+HeaderCost
+measureHeader(CompilerInstance &compiler,
+              const HeaderDescriptor &header_descriptor,
+              const StringList &base_includes, const HeaderCost &baseline_cost,
+              const std::unordered_set<std::string> &baseline_files) {
+  HeaderCost cost;
+  cost.path = header_descriptor.path;
+
+  auto include_directive_list = generateIncludeDirectives(header_descriptor);
+  if (include_directive_list.empty()) {
+    return cost;
+  }
+
+  // The prefixes that do not resolve to the header fail quickly
+  StringList dependency_list;
+
+  for (const auto &include_directive : include_directive_list) {
+    auto source_buffer =
+        generateSourceBuffer({include_directive}, base_includes);
+
+    if (compiler.preprocess(source_buffer).succeeded()) {
+      cost.include_directive = include_directive;
+      break;
+    }
+  }
+
+  if (cost.include_directive.empty()) {
+    cost.include_directive = include_directive_list.front();
+  }
+
+  measureSourceBuffer(
+      cost, dependency_list, compiler,
+      generateSourceBuffer({cost.include_directive}, base_includes));
+
+  cost.preprocess_time =
+      std::max(cost.preprocess_time - baseline_cost.preprocess_time, 0.0);
+
+  cost.parse_time = std::max(cost.parse_time - baseline_cost.parse_time, 0.0);
+
+  cost.token_count -= std::min(cost.token_count, baseline_cost.token_count);
+
+  cost.function_count -=
+      std::min(cost.function_count, baseline_cost.function_count);
+
+  // The header itself is not one of its includes
+  for (const auto &path : dependency_list) {
+    if (path != header_descriptor.path && baseline_files.count(path) == 0U) {
+      ++cost.include_count;
+    }
+  }
+
+  return cost;
+}
+
+/// Returns the value the headers are ranked on
+double getSortKey(const HeaderCost &cost, const std::string &sort_order) {
+  if (sort_order == "preprocess") {
+    return cost.preprocess_time;
+  } else if (sort_order == "tokens") {
+    return static_cast<double>(cost.token_count);
+  } else if (sort_order == "includes") {
+    return static_cast<double>(cost.include_count);
+  } else if (sort_order == "functions") {
+    return static_cast<double>(cost.function_count);
+  }
+
+  return cost.parse_time;
+}
+
+/// Returns a short description of the outcome of the measurements
+std::string getHeaderStatus(const HeaderCost &cost) {
+  if (!cost.preprocessed) {
+    return "preprocess error";
+  } else if (!cost.parsed) {
+    return "parse error";
+  }
+
+  return "ok";
+}
+
+/// Saves all the measurements to the given file as JSON
+bool writeHeaderCostFile(const std::vector<HeaderCost> &cost_list,
+                         const HeaderCost &baseline_cost,
+                         const std::string &path) {
+  auto L_costObject = [](const HeaderCost &cost) -> json11::Json::object {
+    return json11::Json::object{
+        {"preprocess_time", cost.preprocess_time},
+        {"parse_time", cost.parse_time},
+        {"tokens", static_cast<double>(cost.token_count)},
+        {"includes", static_cast<double>(cost.include_count)},
+        {"functions", static_cast<double>(cost.function_count)}};
+  };
+
+  json11::Json::array header_array;
+  for (const auto &cost : cost_list) {
+    auto header_object = L_costObject(cost);
+    header_object.insert({"path", cost.path});
+    header_object.insert({"include_directive", cost.include_directive});
+    header_object.insert({"status", getHeaderStatus(cost)});
+
+    header_array.push_back(std::move(header_object));
+  }
+
+  json11::Json report = json11::Json::object{
+      {"base_includes", L_costObject(baseline_cost)},
+      {"headers", header_array}};
+
+  std::ofstream report_file(path, std::ios::out | std::ios::trunc);
+  report_file << report.dump() << "\n";
+
+  return static_cast<bool>(report_file);
+}
+}  // namespace
+
+/// Handler for the 'analyze_headers' command
+bool analyzeHeadersCommandHandler(ProfileManagerRef &profile_manager,
+                                  const LanguageManager &language_manager,
+                                  const CommandLineOptions &cmdline_options) {
+  CompilerInstanceSettings compiler_settings;
+  if (!createCompilerInstanceSettings(compiler_settings, profile_manager,
+                                      language_manager, cmdline_options)) {
+    return false;
+  }
+
+  // Failures are reported in the table; their diagnostics are not needed
+  compiler_settings.stop_at_first_error = true;
+  compiler_settings.ignore_warnings = true;
+
+  HeaderFilter header_filter;
+  header_filter.include_globs = cmdline_options.include_globs;
+  header_filter.exclude_globs = cmdline_options.exclude_globs;
+
+  std::vector<HeaderDescriptor> header_files;
+  if (!enumerateIncludeFiles(header_files, cmdline_options.header_folders,
+                             cmdline_options.jobs, header_filter)) {
+    return false;
+  }
+
+  auto worker_count = std::min(cmdline_options.jobs, header_files.size());
+  worker_count = std::max(worker_count, std::size_t(1U));
+
+  std::vector<CompilerInstanceRef> compiler_list;
+  for (std::size_t i = 0U; i < worker_count; ++i) {
+    CompilerInstanceRef compiler;
+    auto compiler_status =
+        CompilerInstance::create(compiler, compiler_settings);
+
+    if (!compiler_status.succeeded()) {
+      std::cerr << compiler_status.toString() << "\n";
+      return false;
+    }
+
+    compiler_list.push_back(std::move(compiler));
+  }
+
+  const auto &base_includes = cmdline_options.base_includes;
+
+  // Each header is measured on top of the base includes, whose own cost is
+  // subtracted
+  HeaderCost baseline_cost;
+  std::unordered_set<std::string> baseline_files;
+
+  if (!base_includes.empty()) {
+    StringList dependency_list;
+    measureSourceBuffer(baseline_cost, dependency_list, *compiler_list.front(),
+                        generateSourceBuffer(StringList(), base_includes));
+
+    if (!baseline_cost.parsed) {
+      std::cerr << "The base includes can't be compiled on their own\n";
+      return false;
+    }
+
+    baseline_files.insert(dependency_list.begin(), dependency_list.end());
+    baseline_cost.include_count = baseline_files.size();
+  }
+
+  std::cerr << "Analyzing " << header_files.size() << " headers\n\n";
+
+  std::vector<HeaderCost> cost_list(header_files.size());
+  std::atomic_size_t next_header_index{0U};
+
+  auto L_worker = [&](std::size_t worker_index) {
+    auto &compiler = *compiler_list[worker_index];
+
+    while (true) {
+      auto header_index = next_header_index++;
+      if (header_index >= header_files.size()) {
+        break;
+      }
+
+      cost_list[header_index] =
+          measureHeader(compiler, header_files[header_index], base_includes,
+                        baseline_cost, baseline_files);
+    }
+  };
+
+  Stopwatch analysis_stopwatch;
+
+  runTaskLanes(worker_count, TaskPriority::Normal, L_worker);
+
+  auto analysis_time = analysis_stopwatch.elapsed().wall_time;
+
+  const auto &sort_order = cmdline_options.header_report_order;
+  std::stable_sort(cost_list.begin(), cost_list.end(),
+                   [&sort_order](const HeaderCost &lhs,
+                                 const HeaderCost &rhs) -> bool {
+                     return getSortKey(lhs, sort_order) >
+                            getSortKey(rhs, sort_order);
+                   });
+
+  auto row_count = cost_list.size();
+  if (cmdline_options.header_report_limit != 0U) {
+    row_count = std::min(row_count, cmdline_options.header_report_limit);
+  }
+
+  // The table is formatted in a separate buffer, like the time report
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(2);
+
+  output << "Header costs, sorted by " << sort_order << " (" << row_count
+         << "/" << cost_list.size() << " headers)\n\n";
+
+  output << "  Preprocess (ms)  Parse (ms)    Tokens  Includes  Functions  "
+            "Status            Header\n";
+
+  for (std::size_t i = 0U; i < row_count; ++i) {
+    const auto &cost = cost_list[i];
+
+    output << "  " << std::right << std::setw(15)
+           << cost.preprocess_time * 1000.0 << std::setw(12)
+           << cost.parse_time * 1000.0 << std::setw(10) << cost.token_count
+           << std::setw(10) << cost.include_count << std::setw(11)
+           << cost.function_count << "  " << std::left << std::setw(16)
+           << getHeaderStatus(cost) << "  " << cost.path << "\n";
+  }
+
+  std::size_t failed_header_count = 0U;
+  double total_parse_time = 0.0;
+
+  for (const auto &cost : cost_list) {
+    if (!cost.parsed) {
+      ++failed_header_count;
+    }
+
+    total_parse_time += cost.parse_time;
+  }
+
+  output << "\n" << failed_header_count << " headers can't be compiled on "
+         << "their own; " << total_parse_time << "s spent parsing the "
+         << "headers, " << analysis_time << "s elapsed\n";
+
+  if (!base_includes.empty()) {
+    output << "The cost of the base includes (" << baseline_cost.parse_time
+           << "s, " << baseline_cost.token_count << " tokens, "
+           << baseline_cost.include_count
+           << " files) is not charged to the headers\n";
+  }
+
+  std::cout << output.str();
+
+  if (!cmdline_options.header_report_path.empty() &&
+      !writeHeaderCostFile(cost_list, baseline_cost,
+                           cmdline_options.header_report_path)) {
+    std::cerr << "Failed to write the header report: "
+              << cmdline_options.header_report_path << "\n";
+    return false;
+  }
+
+  return true;
+}
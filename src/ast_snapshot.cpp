@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ast_snapshot.h"
+#include "generate_utils.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+/// The first line of each snapshot descriptor
+const std::string kASTSnapshotHeader = "abigen-ast-snapshot 1";
+}  // namespace
+
+std::string getASTSnapshotPath(const std::string &cache_directory,
+                               const std::string &profile_name,
+                               const std::string &language) {
+  auto file_name = profile_name + "_" + language + ".snapshot";
+  return (stdfs::path(cache_directory) / "ast_snapshots" / file_name).string();
+}
+
+CompilerInstance::Status saveASTSnapshot(
+    ASTSnapshot &snapshot, const std::string &descriptor_path,
+    const std::string &source_buffer,
+    const CompilerInstanceSettings &compiler_settings) {
+  auto snapshot_directory = stdfs::path(descriptor_path).parent_path();
+
+  std::error_code error;
+  stdfs::create_directories(snapshot_directory, error);
+
+  if (error) {
+    return CompilerInstance::Status(
+        false, CompilerInstance::StatusCode::PrecompiledHeaderError,
+        "Failed to create the AST snapshot folder: " +
+            snapshot_directory.string());
+  }
+
+  ASTSnapshot previous_snapshot;
+  auto previous_snapshot_found =
+      readASTSnapshot(previous_snapshot, descriptor_path);
+
+  // Each snapshot gets its own file name, so that the processes loading the
+  // previous one never see a partial file. clang records the path of the
+  // source buffer it saves next to the AST, so the file is never renamed
+  std::random_device random_device;
+  auto ast_path = stdfs::absolute(descriptor_path + "_" +
+                                      std::to_string(random_device()) + ".ast",
+                                  error)
+                      .string();
+
+  if (error) {
+    return CompilerInstance::Status(
+        false, CompilerInstance::StatusCode::PrecompiledHeaderError,
+        "Failed to resolve the AST snapshot path: " + descriptor_path);
+  }
+
+  // The AST is written as a chain-less precompiled header, which is what
+  // clang -emit-ast produces as well
+  auto snapshot_settings = compiler_settings;
+  snapshot_settings.bitcode_output_path.clear();
+  snapshot_settings.sliced_header_output_path.clear();
+  snapshot_settings.module_cache_path.clear();
+  snapshot_settings.module_map_file_list.clear();
+  snapshot_settings.traversal_folders.clear();
+  snapshot_settings.time_report.reset();
+
+  CompilerInstanceRef compiler;
+  auto status = CompilerInstance::create(compiler, snapshot_settings);
+  if (!status.succeeded()) {
+    return status;
+  }
+
+  StringList dependency_list;
+  status = compiler->generatePrecompiledHeader(source_buffer, ast_path,
+                                               &dependency_list);
+
+  if (!status.succeeded()) {
+    stdfs::remove(ast_path, error);
+    stdfs::remove(ast_path + ".h", error);
+    return status;
+  }
+
+  // The source buffer saved next to the AST is not a dependency
+  snapshot.dependency_map.clear();
+
+  for (const auto &path : dependency_list) {
+    if (path == ast_path + ".h") {
+      continue;
+    }
+
+    ContentHash hash;
+    if (!hashFileContents(hash, path)) {
+      stdfs::remove(ast_path, error);
+      stdfs::remove(ast_path + ".h", error);
+
+      return CompilerInstance::Status(
+          false, CompilerInstance::StatusCode::PrecompiledHeaderError,
+          "Failed to hash a file read by the AST snapshot: " + path);
+    }
+
+    snapshot.dependency_map.insert({path, hash});
+  }
+
+  snapshot.ast_path = ast_path;
+  snapshot.settings_hash = hashCompilerInstanceSettings(snapshot_settings);
+
+  std::stringstream buffer;
+  buffer << kASTSnapshotHeader << "\n";
+  buffer << "settings " << contentHashToString(snapshot.settings_hash) << "\n";
+  buffer << "profile " << snapshot.profile_name << "\n";
+  buffer << "language " << snapshot.language << "\n";
+  buffer << "ast " << snapshot.ast_path << "\n";
+
+  for (const auto &base_include : snapshot.base_includes) {
+    buffer << "base_include " << base_include << "\n";
+  }
+
+  for (const auto &include_directive : snapshot.header_list) {
+    buffer << "header " << include_directive << "\n";
+  }
+
+  for (const auto &p : snapshot.dependency_map) {
+    writeDependencyLine(buffer, p.first, p.second);
+  }
+
+  if (!writeFileAtomically(descriptor_path, buffer.str())) {
+    stdfs::remove(ast_path, error);
+    stdfs::remove(ast_path + ".h", error);
+
+    return CompilerInstance::Status(
+        false, CompilerInstance::StatusCode::PrecompiledHeaderError,
+        "Failed to write the AST snapshot: " + descriptor_path);
+  }
+
+  if (previous_snapshot_found && previous_snapshot.ast_path != ast_path) {
+    stdfs::remove(previous_snapshot.ast_path, error);
+    stdfs::remove(previous_snapshot.ast_path + ".h", error);
+  }
+
+  return CompilerInstance::Status(true);
+}
+
+bool readASTSnapshot(ASTSnapshot &snapshot,
+                     const std::string &descriptor_path) {
+  snapshot = {};
+
+  std::ifstream descriptor_file(descriptor_path);
+  if (!descriptor_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(descriptor_file, line) || line != kASTSnapshotHeader) {
+    return false;
+  }
+
+  const std::string settings_tag = "settings ";
+  if (!std::getline(descriptor_file, line) ||
+      line.compare(0U, settings_tag.size(), settings_tag) != 0 ||
+      !contentHashFromString(snapshot.settings_hash,
+                             line.substr(settings_tag.size()))) {
+    return false;
+  }
+
+  // The fixed fields come first, in this order
+  for (auto field : {std::make_pair("profile ", &snapshot.profile_name),
+                     std::make_pair("language ", &snapshot.language),
+                     std::make_pair("ast ", &snapshot.ast_path)}) {
+    const std::string tag = field.first;
+
+    if (!std::getline(descriptor_file, line) ||
+        line.compare(0U, tag.size(), tag) != 0) {
+      return false;
+    }
+
+    *field.second = line.substr(tag.size());
+  }
+
+  const std::string base_include_tag = "base_include ";
+  const std::string header_tag = "header ";
+
+  while (std::getline(descriptor_file, line)) {
+    if (line.compare(0U, base_include_tag.size(), base_include_tag) == 0) {
+      snapshot.base_includes.push_back(line.substr(base_include_tag.size()));
+      continue;
+    }
+
+    if (line.compare(0U, header_tag.size(), header_tag) == 0) {
+      snapshot.header_list.push_back(line.substr(header_tag.size()));
+      continue;
+    }
+
+    std::string path;
+    ContentHash hash;
+    if (!parseDependencyLine(path, hash, line)) {
+      return false;
+    }
+
+    snapshot.dependency_map.insert({std::move(path), hash});
+  }
+
+  std::error_code error;
+  return stdfs::exists(snapshot.ast_path, error);
+}
+
+StringList getModifiedASTSnapshotFiles(const ASTSnapshot &snapshot) {
+  StringList modified_file_list;
+
+  for (const auto &p : snapshot.dependency_map) {
+    ContentHash current_hash;
+    if (!hashFileContents(current_hash, p.first) || current_hash != p.second) {
+      modified_file_list.push_back(p.first);
+    }
+  }
+
+  std::sort(modified_file_list.begin(), modified_file_list.end());
+  return modified_file_list;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "compilerinstance.h"
+#include "content_hash.h"
+#include "types.h"
+
+#include <unordered_map>
+
+/// The translation unit of a final pass, serialized with clang's AST writer
+/// in the cache folder. The AST file is loaded lazily as a precompiled
+/// header on top of an empty source buffer, so that the AST visitor can be
+/// run again without parsing the headers
+struct ASTSnapshot final {
+  /// The profile used to parse the headers
+  std::string profile_name;
+
+  /// The language used to parse the headers
+  std::string language;
+
+  /// The hash of the compiler settings the AST has been built with; the file
+  /// can only be loaded with the same ones
+  ContentHash settings_hash{0U};
+
+  /// The base includes, as rendered in the ABI library
+  StringList base_includes;
+
+  /// The accepted include directives, in the order they have been parsed
+  StringList header_list;
+
+  /// The absolute path of the AST file
+  std::string ast_path;
+
+  /// The content hash of each file read while building the AST; the AST
+  /// file itself is loaded without validating them
+  std::unordered_map<std::string, ContentHash> dependency_map;
+};
+
+/// Returns the path of the snapshot descriptor of the given profile and
+/// language inside the cache folder
+std::string getASTSnapshotPath(const std::string &cache_directory,
+                               const std::string &profile_name,
+                               const std::string &language);
+
+/// Parses the given source buffer with the specified settings, writes its
+/// AST to a new file next to the descriptor, and then replaces the
+/// descriptor atomically; the AST file of the previous snapshot is removed.
+/// The AST path and the settings hash of the snapshot are updated
+CompilerInstance::Status saveASTSnapshot(
+    ASTSnapshot &snapshot, const std::string &descriptor_path,
+    const std::string &source_buffer,
+    const CompilerInstanceSettings &compiler_settings);
+
+/// Reads the given snapshot descriptor. Returns false if it is missing or
+/// malformed, or if the AST file it references no longer exists
+bool readASTSnapshot(ASTSnapshot &snapshot, const std::string &descriptor_path);
+
+/// Returns the files read while building the AST that have been modified or
+/// removed since then; the snapshot can only be used when the list is empty
+StringList getModifiedASTSnapshotFiles(const ASTSnapshot &snapshot);
@@ -1,50 +1,469 @@
 #include "astvisitor.h"
+#include "analysis_shards.h"
+#include "content_hash.h"
 #include "generate_utils.h"
+#include "task_executor.h"
+#include "type_dependency_graph.h"
 #include "types.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Support/Casting.h>
 
 namespace {
-/// A node in the type dependency tree
-struct TypeDependencyNode final {
-  /// The type for this node
-  const clang::Type *type{nullptr};
+/// A spelling of a type, along with the declaration that used it. Names and
+/// locations are only computed when the type is reported, as most types are
+/// never part of a blacklist report
+struct TypeSpelling final {
+  /// The type as written (i.e.: `foo_t`, `const struct foo *`)
+  clang::QualType spelled_type;
+
+  /// The field, parameter or class declaration where it has been found
+  const clang::Decl *declaration;
+};
 
-  /// The type referencing this one
-  TypeList parents;
+/// The distinct spellings of a type, in the order they have been found
+using TypeSpellingList = std::vector<TypeSpelling>;
 
-  /// The list of types referenced by this node
-  TypeList children;
-};
+/// The type information map contains the spellings of each canonical type
+/// we have found; it is only used to report the types that caused a function
+/// to be blacklisted
+using TypeInformationMap =
+    std::unordered_map<const clang::Type *, TypeSpellingList>;
 
-/// This node contains the location and name for a given type
-struct TypeInformation final {
-  /// Type name
-  std::string name;
+/// The information collected for each function; names are computed once and
+/// interned
+struct FunctionRecord final {
+  /// The mangled name
+  llvm::StringRef mangled_name;
 
-  /// Type location
+  /// The name produced by the alternate mangler; empty when dual mangling is
+  /// disabled
+  llvm::StringRef alternate_mangled_name;
+
+  /// The friendly (i.e.: unmangled) name
+  llvm::StringRef friendly_name;
+
+  /// Where the function is declared
   SourceCodeLocation location;
+
+  /// The first level of type dependencies; methods share the list of their
+  /// class, and functions share the list of the other functions taking the
+  /// same set of parameter types
+  TypeListRef referenced_types;
+
+  /// Set when the function has been blacklisted by VisitFunctionDecl; its
+  /// types are never expanded, and the referenced type list is empty
+  std::optional<BlacklistedFunction::Reason> early_rejection_reason;
 };
 
-/// A reference to a type node
-using TypeDependencyNodeRef = std::shared_ptr<TypeDependencyNode>;
+/// A map used to tie a function to its dependencies; when redeclarations are
+/// merged, functions are keyed on their canonical declaration
+using FunctionMap = std::unordered_map<clang::FunctionDecl *, FunctionRecord>;
 
-/// The type dependency tree
-using TypeDependencyTree =
-    std::unordered_map<const clang::Type *, TypeDependencyNodeRef>;
+/// The types referenced by each class, including the member and method
+/// parameter types of its bases
+using ClassTypeMap =
+    std::unordered_map<const clang::CXXRecordDecl *, TypeListRef>;
 
-/// The type information map contains name and location for each type
-/// we have found
-using TypeInformationMap =
-    std::unordered_map<const clang::Type *, TypeInformation>;
+/// The parameter type lists of the functions, keyed on the hash of their
+/// canonical types; lists with the same hash are compared before being
+/// shared
+using SignatureTypeMap = std::unordered_multimap<ContentHash, TypeListRef>;
+
+/// Whether a type can reach a function type; used by the lazy mode
+enum class TypeReachability : std::uint8_t { Unknown, Reachable, Unreachable };
+
+/// The language policy of the C translation units: there are no classes nor
+/// methods, and only the overloadable functions have a mangled name
+struct CLanguagePolicy final {
+  /// True if records may be classes, with bases and methods
+  static constexpr bool kHasClasses = false;
+};
+
+/// The language policy of the C++ translation units
+struct CXXLanguagePolicy final {
+  /// True if records may be classes, with bases and methods
+  static constexpr bool kHasClasses = true;
+};
+
+/// Returns the canonical, unqualified version of the given type. This is the
+/// identity of the type dependency graph nodes, so that typedefs, elaborated
+/// names and qualified spellings of the same type share a single node
+const clang::Type *getCanonicalType(const clang::Type *type) {
+  return type->getCanonicalTypeUnqualified().getTypePtr();
+}
+
+/// Returns true if the given type is a function type
+bool isFunctionType(const clang::Type *type) {
+  // clang-format off
+  return (
+    type->isFunctionNoProtoType() ||
+    type->isFunctionPointerType() ||
+    type->isFunctionProtoType() ||
+    type->isFunctionType()
+  );
+  // clang-format on
+}
+
+/// Returns true if the given canonical type is a class or structure whose
+/// definition is not visible; other translation units may see it
+bool isOpaqueRecordType(const clang::Type *type) {
+  return llvm::isa<clang::RecordType>(type) && type->isIncompleteType();
+}
+
+/// Flags the nodes whose type matches the predicate, together with every
+/// node that can reach one of them through its children. The parent edges
+/// are walked once, starting from all the matching nodes at the same time;
+/// each node is queued at most once, so this is O(V + E). If passed, the
+/// step count receives the amount of parent edges that have been walked
+template <typename Predicate>
+std::vector<bool> flagAncestorNodes(const TypeDependencyGraph &graph,
+                                    Predicate predicate,
+                                    std::size_t *step_count = nullptr) {
+  std::vector<bool> node_flags(graph.nodeCount(), false);
+  std::queue<TypeNodeId> propagation_queue;
+
+  for (TypeNodeId node_id = 0U; node_id < graph.nodeCount(); ++node_id) {
+    if (predicate(graph.type(node_id))) {
+      node_flags[node_id] = true;
+      propagation_queue.push(node_id);
+    }
+  }
+
+  while (!propagation_queue.empty()) {
+    auto current_node_id = propagation_queue.front();
+    propagation_queue.pop();
+
+    for (auto parent_node_id : graph.parents(current_node_id)) {
+      if (step_count != nullptr) {
+        ++(*step_count);
+      }
+
+      if (!node_flags[parent_node_id]) {
+        node_flags[parent_node_id] = true;
+        propagation_queue.push(parent_node_id);
+      }
+    }
+  }
+
+  return node_flags;
+}
+
+/// The strongly connected components of the subgraph formed by the flagged
+/// nodes, following the child edges
+struct NodeComponentGraph final {
+  /// The component of each flagged node
+  TypeNodeIdList node_component_list;
+
+  /// The amount of components. They are numbered in the order Tarjan's
+  /// algorithm completes them, so every child component has a lower number
+  /// than its parents
+  std::size_t component_count{0U};
+
+  /// Where the child components of each component start; has one more
+  /// element than the component count
+  std::vector<std::size_t> child_offset_list;
+
+  /// The distinct child components of each component, in CSR form
+  TypeNodeIdList child_list;
+};
+
+/// Condenses the subgraph formed by the flagged nodes into its strongly
+/// connected components, using an iterative version of Tarjan's algorithm
+NodeComponentGraph condenseFlaggedNodes(const TypeDependencyGraph &graph,
+                                        const std::vector<bool> &node_flags) {
+  constexpr auto kUnvisited = std::numeric_limits<TypeNodeId>::max();
+
+  auto node_count = graph.nodeCount();
+
+  NodeComponentGraph component_graph;
+  auto &node_component_list = component_graph.node_component_list;
+  node_component_list.assign(node_count, kUnvisited);
+
+  TypeNodeIdList index_list(node_count, kUnvisited);
+  TypeNodeIdList low_link_list(node_count, 0U);
+  std::vector<bool> on_stack_flags(node_count, false);
+  TypeNodeIdList component_stack;
+  std::vector<std::pair<TypeNodeId, std::size_t>> dfs_stack;
+  TypeNodeId next_index = 0U;
+
+  auto L_push = [&](TypeNodeId node_id) {
+    index_list[node_id] = low_link_list[node_id] = next_index++;
+    on_stack_flags[node_id] = true;
+
+    component_stack.push_back(node_id);
+    dfs_stack.push_back({node_id, 0U});
+  };
+
+  for (TypeNodeId root_node_id = 0U; root_node_id < node_count;
+       ++root_node_id) {
+    if (!node_flags[root_node_id] || index_list[root_node_id] != kUnvisited) {
+      continue;
+    }
+
+    L_push(root_node_id);
+
+    while (!dfs_stack.empty()) {
+      auto node_id = dfs_stack.back().first;
+      auto child_node_list = graph.children(node_id);
+
+      if (dfs_stack.back().second < child_node_list.size()) {
+        auto child_node_id = child_node_list[dfs_stack.back().second++];
+        if (!node_flags[child_node_id]) {
+          continue;
+        }
+
+        if (index_list[child_node_id] == kUnvisited) {
+          L_push(child_node_id);
+
+        } else if (on_stack_flags[child_node_id]) {
+          low_link_list[node_id] =
+              std::min(low_link_list[node_id], index_list[child_node_id]);
+        }
+
+        continue;
+      }
+
+      dfs_stack.pop_back();
+      if (!dfs_stack.empty()) {
+        auto parent_node_id = dfs_stack.back().first;
+        low_link_list[parent_node_id] =
+            std::min(low_link_list[parent_node_id], low_link_list[node_id]);
+      }
+
+      if (low_link_list[node_id] != index_list[node_id]) {
+        continue;
+      }
+
+      auto component =
+          static_cast<TypeNodeId>(component_graph.component_count++);
+
+      TypeNodeId member_node_id;
+      do {
+        member_node_id = component_stack.back();
+        component_stack.pop_back();
+
+        on_stack_flags[member_node_id] = false;
+        node_component_list[member_node_id] = component;
+      } while (member_node_id != node_id);
+    }
+  }
+
+  // Edges inside a component are dropped, along with the duplicates
+  std::vector<std::pair<TypeNodeId, TypeNodeId>> component_edge_list;
+  for (TypeNodeId node_id = 0U; node_id < node_count; ++node_id) {
+    if (!node_flags[node_id]) {
+      continue;
+    }
+
+    auto component = node_component_list[node_id];
+    for (auto child_node_id : graph.children(node_id)) {
+      if (node_flags[child_node_id] &&
+          node_component_list[child_node_id] != component) {
+        component_edge_list.push_back(
+            {component, node_component_list[child_node_id]});
+      }
+    }
+  }
+
+  std::sort(component_edge_list.begin(), component_edge_list.end());
+  component_edge_list.erase(
+      std::unique(component_edge_list.begin(), component_edge_list.end()),
+      component_edge_list.end());
+
+  auto &child_offset_list = component_graph.child_offset_list;
+  child_offset_list.assign(component_graph.component_count + 1U, 0U);
+
+  for (const auto &edge : component_edge_list) {
+    ++child_offset_list[edge.first + 1U];
+  }
+
+  for (std::size_t i = 1U; i < child_offset_list.size(); ++i) {
+    child_offset_list[i] += child_offset_list[i - 1U];
+  }
+
+  component_graph.child_list.reserve(component_edge_list.size());
+  for (const auto &edge : component_edge_list) {
+    component_graph.child_list.push_back(edge.second);
+  }
+
+  return component_graph;
+}
+
+/// Returns the reason why the given function is blacklisted no matter which
+/// types it references: variadic and templated functions, and the ones that
+/// can't be referenced from another translation unit (such as static inline
+/// functions)
+std::optional<BlacklistedFunction::Reason>
+getEarlyRejectionReason(const clang::FunctionDecl *declaration) {
+  if (declaration->isVariadic()) {
+    return BlacklistedFunction::Reason::Variadic;
+  }
+
+  if (declaration->isTemplated()) {
+    return BlacklistedFunction::Reason::Templated;
+  }
+
+  if (!declaration->isExternallyVisible()) {
+    return BlacklistedFunction::Reason::InternalLinkage;
+  }
+
+  return std::nullopt;
+}
+
+/// Returns the redeclaration of the given function that appears first in the
+/// translation unit, skipping the implicit ones (i.e.: library builtins); the
+/// canonical declaration is returned if all of them are implicit
+const clang::FunctionDecl *getFirstExplicitDeclaration(
+    const clang::SourceManager &source_manager,
+    const clang::FunctionDecl *declaration) {
+  const clang::FunctionDecl *first_declaration = nullptr;
+
+  for (auto redeclaration : declaration->redecls()) {
+    if (redeclaration->isImplicit()) {
+      continue;
+    }
+
+    if (first_declaration == nullptr ||
+        source_manager.isBeforeInTranslationUnit(
+            redeclaration->getLocation(), first_declaration->getLocation())) {
+      first_declaration = redeclaration;
+    }
+  }
+
+  return first_declaration != nullptr ? first_declaration
+                                      : declaration->getCanonicalDecl();
+}
+
+/// Saves the prototype information needed by the mcsema external definitions
+void describePrototype(WhitelistedFunction &function,
+                       const clang::FunctionDecl *declaration) {
+  function.argument_count = declaration->getNumParams();
+
+  auto method = llvm::dyn_cast<clang::CXXMethodDecl>(declaration);
+  if (method != nullptr && method->isInstance()) {
+    ++function.argument_count;
+  }
+
+  function.no_return = declaration->isNoReturn();
+
+  auto function_type = declaration->getType()->getAs<clang::FunctionType>();
+  if (function_type == nullptr) {
+    return;
+  }
+
+  switch (function_type->getCallConv()) {
+  case clang::CC_X86StdCall:
+  case clang::CC_X86ThisCall:
+  case clang::CC_X86Pascal:
+    function.calling_convention =
+        WhitelistedFunction::CallingConvention::CalleeCleanup;
+    break;
+
+  case clang::CC_X86FastCall:
+    function.calling_convention =
+        WhitelistedFunction::CallingConvention::FastCall;
+    break;
+
+  default:
+    break;
+  }
+}
+
+/// Estimates the memory used by the given unordered map, counting one
+/// allocation for each element plus the bucket array
+template <typename MapType>
+std::size_t estimateUnorderedMapMemory(const MapType &map) {
+  auto node_size = sizeof(typename MapType::value_type) + 2U * sizeof(void *);
+  return map.size() * node_size + map.bucket_count() * sizeof(void *);
+}
+
+/// Estimates the memory used by the given string pool, counting the bucket
+/// array and one allocation for each interned string
+std::size_t estimateStringPoolMemory(const llvm::StringSet<> &string_pool) {
+  auto memory_usage = static_cast<std::size_t>(string_pool.getNumBuckets()) *
+                      (sizeof(void *) + sizeof(unsigned));
+
+  for (const auto &entry : string_pool) {
+    memory_usage += sizeof(entry) + entry.getKeyLength() + 1U;
+  }
+
+  return memory_usage;
+}
+
+/// The children of the types expanded on multiple threads, keyed by type.
+/// The map is split in shards, each one with its own lock, so that the
+/// threads seldom wait on each other; each type is claimed by the first
+/// thread that reaches it, and only that thread expands it
+class ConcurrentTypeChildrenMap final {
+  /// The children of a type, in the order they have been collected
+  using ChildTypeList = std::vector<const clang::Type *>;
+
+  /// A shard of the map
+  struct Shard final {
+    /// Protects the child map
+    std::mutex mutex;
+
+    /// The types of this shard that have been claimed, along with their
+    /// children once they have been expanded
+    llvm::DenseMap<const clang::Type *, ChildTypeList> child_map;
+  };
+
+  /// The shards of the map
+  std::array<Shard, 64> shard_list;
+
+  /// Returns the shard that owns the given type
+  Shard &shard(const clang::Type *type) {
+    auto hash = llvm::DenseMapInfo<const clang::Type *>::getHashValue(type);
+    return shard_list[hash % shard_list.size()];
+  }
+
+ public:
+  /// Claims the given type; returns false if it has already been claimed
+  bool claim(const clang::Type *type) {
+    auto &type_shard = shard(type);
+
+    std::lock_guard<std::mutex> lock(type_shard.mutex);
+    return type_shard.child_map.insert({type, ChildTypeList()}).second;
+  }
 
-/// A map used to tie a function to its dependencies
-using FunctionMap = std::unordered_map<clang::FunctionDecl *, TypeList>;
+  /// Saves the children of a type claimed by the calling thread
+  void setChildren(const clang::Type *type, ChildTypeList child_list) {
+    auto &type_shard = shard(type);
+
+    std::lock_guard<std::mutex> lock(type_shard.mutex);
+    type_shard.child_map[type] = std::move(child_list);
+  }
+
+  /// Returns the children of the given type; must only be called once all
+  /// the threads have finished
+  const ChildTypeList &children(const clang::Type *type) {
+    return shard(type).child_map[type];
+  }
+};
 }  // namespace
 
 /// Private class data
 struct ASTVisitor::PrivateData final {
+  /// Visitor settings
+  ASTVisitorSettings settings;
+
   // The AST context received from the ASTConsumer
   clang::ASTContext *ast_context{nullptr};
 
@@ -54,16 +473,87 @@ struct ASTVisitor::PrivateData final {
   /// The name mangler received from the ASTConsumer
   clang::MangleContext *name_mangler{nullptr};
 
-  /// The type dependency tree
-  TypeDependencyTree type_dependency_tree;
+  /// The mangler for the other convention, when dual mangling is enabled
+  clang::MangleContext *alternate_name_mangler{nullptr};
+
+  /// The type dependency graph; outside of the lazy mode, a type has been
+  /// enumerated if and only if it has a node
+  TypeDependencyGraph type_dependency_graph;
 
   /// This variable map functions to their type dependencies
   FunctionMap function_map;
 
-  /// The list of types that we have already enumerated
-  TypeList enumerated_type_list;
+  /// The functions skipped because they are not in the imported symbol set,
+  /// because the function filter rejects them, or because their results are
+  /// cached; keyed like the function map
+  std::unordered_set<const clang::FunctionDecl *> filtered_function_set;
+
+  /// Each class is only expanded once per translation unit
+  ClassTypeMap class_type_map;
+
+  /// Each set of parameter types is only enumerated once per translation
+  /// unit
+  SignatureTypeMap signature_type_map;
+
+  /// Lazy mode: the children of each expanded node
+  std::vector<TypeNodeIdList> expanded_child_list;
+
+  /// The children of the type being expanded; shared by
+  /// enumerateTypeDependencies() and expandTypeNode(), which are never
+  /// nested
+  TypeList type_children_scratch;
+
+  /// True if the type dependencies are expanded on multiple threads by
+  /// finalize(); set by initialize()
+  bool queue_type_expansion{false};
+
+  /// True if the functions are visited while the translation unit is
+  /// parsed; set by initialize()
+  bool analyze_while_parsing{false};
+
+  /// The root types queued for finalize(), in the order they would have
+  /// been enumerated
+  std::vector<const clang::Type *> queued_root_type_list;
+
+  /// Protects the class type map, the summarized type map and the type
+  /// information map while the types are expanded on multiple threads; the
+  /// source manager is only used with this lock held, as its lookups update
+  /// internal caches
+  std::mutex expansion_mutex;
+
+  /// Lazy mode: true for each node that has been expanded
+  std::vector<bool> expanded_node_flags;
 
-  /// Name and location for each type we encountered
+  /// Lazy mode: the memoized reachability of each node
+  std::vector<TypeReachability> reachability_list;
+
+  /// True for each record whose expansion stopped at its first tainted
+  /// child; may be shorter than the node list
+  std::vector<bool> truncated_node_flags;
+
+  /// The reachability of the record types looked up in the type summary;
+  /// Unknown for the ones it does not list
+  llvm::DenseMap<const clang::Type *, TypeReachability> summarized_type_map;
+
+  /// The string pool used to intern function names
+  llvm::StringSet<> string_pool;
+
+  /// Buffer reused for each mangled name
+  llvm::SmallString<256> mangling_buffer;
+
+  /// The counters of this visitor, merged into the shared ones by
+  /// finalize(); updated with the expansion mutex held while the types are
+  /// expanded on multiple threads
+  VisitorStatistics statistics;
+
+  /// The costs attributed to each header, reported to the time report by
+  /// finalize(); only updated when the settings have a time report
+  std::unordered_map<const clang::FileEntry *, HeaderCost> header_cost_map;
+
+  /// The file paths referenced by the source code locations
+  FilePathTable file_path_table;
+
+  /// The spellings and locations of each canonical type we encountered
   TypeInformationMap type_info_map;
 
   /// The list of blacklisted functions
@@ -71,24 +561,57 @@ struct ASTVisitor::PrivateData final {
 
   /// The list of whitelisted functions
   WhitelistedFunctionList whitelisted_function_list;
+
+  /// The classes and structures that caused a function to be blacklisted,
+  /// keyed on their identity
+  std::map<TypeIdentity, BlacklistedFunction::FunctionPointerLocations>
+      function_pointer_type_map;
+
+  /// The declarations of the whitelisted functions
+  std::vector<clang::FunctionDecl *> whitelisted_function_decl_list;
+
+  /// Analysis cache: true for each file whose results have been loaded from
+  /// the cache, false for the files that have to be analyzed
+  llvm::DenseMap<const clang::FileEntry *, bool> cached_file_map;
+
+  /// Analysis cache: the cached results, in the order the files have been
+  /// found
+  std::vector<ABILibrary> cached_result_list;
+
+  /// Analysis cache: the mangled names of the analyzed functions that are
+  /// also declared in a cached file; the cached results for these names
+  /// are discarded
+  std::unordered_set<std::string> reanalyzed_name_set;
+
+  /// Analysis cache: the file that first included each file
+  llvm::DenseMap<const clang::FileEntry *, const clang::FileEntry *>
+      includer_map;
+
+  /// Analysis cache: the files first included by each file
+  llvm::DenseMap<const clang::FileEntry *,
+                 std::vector<const clang::FileEntry *>>
+      included_file_map;
 };
 
-ASTVisitor::ASTVisitor() : d(new PrivateData) {}
+ASTVisitor::ASTVisitor(const ASTVisitorSettings &settings)
+    : d(new PrivateData) {
+  d->settings = settings;
+}
 
 bool ASTVisitor::isClassMethod(clang::FunctionDecl *decl) {
-  auto method_decl = dynamic_cast<clang::CXXMethodDecl *>(decl);
-  return (method_decl != nullptr);
+  return llvm::isa<clang::CXXMethodDecl>(decl);
 }
 
 clang::CXXRecordDecl *ASTVisitor::getClass(clang::FunctionDecl *decl) {
-  auto cxx_record = dynamic_cast<clang::CXXMethodDecl *>(decl);
-  assert(cxx_record != nullptr && "Not a class method!");
+  assert(llvm::isa<clang::CXXMethodDecl>(decl) && "Not a class method!");
 
-  return cxx_record->getParent();
+  auto method_decl = llvm::cast<clang::CXXMethodDecl>(decl);
+  return method_decl->getParent();
 }
 
 ClassList ASTVisitor::collectClasses(clang::CXXRecordDecl *decl) {
-  ClassList class_list = {decl};
+  ClassList class_list;
+  class_list.insert(decl);
 
   for (const auto &base_class_specifier : decl->bases()) {
     auto cxx_record_decl = base_class_specifier.getType()->getAsCXXRecordDecl();
@@ -98,11 +621,9 @@ ClassList ASTVisitor::collectClasses(clang::CXXRecordDecl *decl) {
   }
 
   for (const auto &class_decl : class_list) {
-    TypeInformation class_type = {};
-    class_type.location =
-        getSourceCodeLocation(*d->ast_context, *d->source_manager, class_decl);
-    class_type.name = class_decl->getNameAsString();
-    d->type_info_map.insert({class_decl->getTypeForDecl(), class_type});
+    auto class_type = class_decl->getTypeForDecl();
+    addTypeSpelling(getCanonicalType(class_type),
+                    clang::QualType(class_type, 0U), class_decl);
   }
 
   return class_list;
@@ -120,9 +641,8 @@ MethodList ASTVisitor::collectClassMethods(const ClassList &class_list) {
   return method_list;
 }
 
-TypeList ASTVisitor::collectClassMemberTypes(const ClassList &class_list) {
-  TypeList type_list;
-
+void ASTVisitor::collectClassMemberTypes(TypeList &type_list,
+                                         const ClassList &class_list) {
   for (const auto &cxx_record : class_list) {
     for (auto field : cxx_record->fields()) {
       auto type_source_info = field->getTypeSourceInfo();
@@ -131,24 +651,16 @@ TypeList ASTVisitor::collectClassMemberTypes(const ClassList &class_list) {
       }
 
       auto type_loc = type_source_info->getTypeLoc();
-      auto field_type = type_loc.getTypePtr();
+      auto field_type = getCanonicalType(type_loc.getTypePtr());
 
       type_list.insert(field_type);
-
-      TypeInformation type_info = {};
-      type_info.location =
-          getSourceCodeLocation(*d->ast_context, *d->source_manager, field);
-      type_info.name = field->getType().getAsString();
-      d->type_info_map.insert({field_type, type_info});
+      addTypeSpelling(field_type, field->getType(), field);
     }
   }
-
-  return type_list;
 }
 
-TypeList ASTVisitor::collectRecordMemberTypes(clang::RecordDecl *decl) {
-  TypeList type_list;
-
+void ASTVisitor::collectRecordMemberTypes(TypeList &type_list,
+                                          clang::RecordDecl *decl) {
   for (auto field : decl->fields()) {
     auto type_source_info = field->getTypeSourceInfo();
     if (type_source_info == nullptr) {
@@ -156,500 +668,2193 @@ TypeList ASTVisitor::collectRecordMemberTypes(clang::RecordDecl *decl) {
     }
 
     auto type_loc = type_source_info->getTypeLoc();
-    auto field_type = type_loc.getTypePtr();
+    auto field_type = getCanonicalType(type_loc.getTypePtr());
 
     type_list.insert(field_type);
+    addTypeSpelling(field_type, field->getType(), field);
+  }
+}
+
+void ASTVisitor::collectFunctionParameterTypes(TypeList &type_list,
+                                               clang::FunctionDecl *decl) {
+  for (const auto &param : decl->parameters()) {
+    auto type_source_info = param->getTypeSourceInfo();
+    if (type_source_info == nullptr) {
+      continue;
+    }
+
+    auto type_loc = type_source_info->getTypeLoc();
+    auto type = type_loc.getTypePtr();
+    if (type == nullptr) {
+      throw std::logic_error("Failed to acquire the Type ptr");
+    }
+
+    type = getCanonicalType(type);
+
+    type_list.insert(type);
+    addTypeSpelling(type, param->getType(), param);
+  }
+}
+
+SourceCodeLocation ASTVisitor::getDeclarationLocation(
+    const clang::Decl *declaration) {
+  return getSourceCodeLocation(*d->ast_context, *d->source_manager,
+                               declaration, d->file_path_table);
+}
+
+const clang::FileEntry *ASTVisitor::getDeclarationFile(
+    const clang::Decl *declaration) {
+  auto full_start_location =
+      d->ast_context->getFullLoc(declaration->getLocStart());
+
+#if LLVM_MAJOR_VERSION > 5
+  return full_start_location.getFileEntry();
+#else
+  return d->source_manager->getFileEntryForID(full_start_location.getFileID());
+#endif
+}
+
+bool ASTVisitor::isCachedFile(const clang::FileEntry *file_entry) {
+  // Functions declared in the main file are always analyzed
+  if (file_entry == nullptr) {
+    return false;
+  }
+
+  auto it = d->cached_file_map.find(file_entry);
+  if (it != d->cached_file_map.end()) {
+    return it->second;
+  }
+
+  ABILibrary results;
+  auto cached = d->settings.analysis_cache->lookup(
+      results, std::string(file_entry->getName()));
+
+  if (cached) {
+    d->cached_result_list.push_back(std::move(results));
+  }
+
+  d->cached_file_map.insert({file_entry, cached});
+  return cached;
+}
+
+bool ASTVisitor::collectFileDependencies(StringList &dependency_list,
+                                         const clang::FileEntry *file_entry,
+                                         const TypeList &root_type_list) {
+  dependency_list.clear();
+
+  std::unordered_set<const clang::FileEntry *> dependency_set;
+  std::vector<const clang::FileEntry *> pending_file_list;
+
+  auto L_addFile = [&](const clang::FileEntry *dependency) {
+    if (dependency != nullptr && dependency_set.insert(dependency).second) {
+      dependency_list.push_back(std::string(dependency->getName()));
+    }
+  };
+
+  // The headers it has been included through
+  for (auto includer = file_entry; includer != nullptr;) {
+    L_addFile(includer);
+
+    auto it = d->includer_map.find(includer);
+    includer = (it != d->includer_map.end()) ? it->second : nullptr;
+  }
+
+  // The headers it includes
+  pending_file_list.push_back(file_entry);
+
+  while (!pending_file_list.empty()) {
+    auto current_file = pending_file_list.back();
+    pending_file_list.pop_back();
+
+    auto it = d->included_file_map.find(current_file);
+    if (it == d->included_file_map.end()) {
+      continue;
+    }
+
+    for (auto included_file : it->second) {
+      if (dependency_set.count(included_file) == 0U) {
+        L_addFile(included_file);
+        pending_file_list.push_back(included_file);
+      }
+    }
+  }
+
+  // The headers declaring the reachable types, along with the ones where
+  // their reported spellings have been found
+  const auto &type_dependency_graph = d->type_dependency_graph;
+
+  std::unordered_set<TypeNodeId> visited_node_set;
+  std::queue<TypeNodeId> node_queue;
+
+  for (const auto &type : root_type_list) {
+    TypeNodeId node_id;
+    if (type_dependency_graph.findNode(node_id, type) &&
+        visited_node_set.insert(node_id).second) {
+      node_queue.push(node_id);
+    }
+  }
+
+  while (!node_queue.empty()) {
+    auto node_id = node_queue.front();
+    node_queue.pop();
+
+    auto type = type_dependency_graph.type(node_id);
+
+    if (auto tag_decl = type->getAsTagDecl()) {
+      auto definition = tag_decl->getDefinition();
+      if (definition == nullptr) {
+        return false;
+      }
+
+      L_addFile(getDeclarationFile(definition));
+    }
+
+    auto type_info_it = d->type_info_map.find(type);
+    if (type_info_it != d->type_info_map.end()) {
+      for (const auto &spelling : type_info_it->second) {
+        L_addFile(getDeclarationFile(spelling.declaration));
+      }
+    }
+
+    for (auto child_node_id : type_dependency_graph.children(node_id)) {
+      if (visited_node_set.insert(child_node_id).second) {
+        node_queue.push(child_node_id);
+      }
+    }
+  }
+
+  return true;
+}
+
+void ASTVisitor::mergeCachedResults() {
+  auto &source_manager = *d->source_manager;
+
+  // Rebuild the include tree, using the first inclusion of each file
+  for (auto it = source_manager.fileinfo_begin();
+       it != source_manager.fileinfo_end(); ++it) {
+    const auto file_entry = it->first;
+    if (file_entry == nullptr) {
+      continue;
+    }
+
+    // Files that have been looked up but never entered have no identifier
+    auto file_id = source_manager.translateFile(file_entry);
+    if (file_id.isInvalid()) {
+      continue;
+    }
+
+    auto include_location = source_manager.getIncludeLoc(file_id);
+    if (include_location.isInvalid()) {
+      continue;
+    }
+
+    auto includer = source_manager.getFileEntryForID(
+        source_manager.getFileID(include_location));
+    if (includer == nullptr) {
+      continue;
+    }
+
+    d->includer_map.insert({file_entry, includer});
+    d->included_file_map[includer].push_back(file_entry);
+  }
+
+  // Group the results and the referenced types by the file they are located
+  // in
+  const auto &file_path_table = d->file_path_table;
+  auto file_count = file_path_table.file_path_list.size();
+
+  std::vector<std::vector<std::size_t>> whitelist_index(file_count);
+  for (std::size_t i = 0U; i < d->whitelisted_function_list.size(); ++i) {
+    const auto &location = d->whitelisted_function_list[i].location;
+    whitelist_index[location.file_id].push_back(i);
+  }
+
+  std::vector<std::vector<std::size_t>> blacklist_index(file_count);
+  for (std::size_t i = 0U; i < d->blacklisted_function_list.size(); ++i) {
+    const auto &location = d->blacklisted_function_list[i].location;
+    blacklist_index[location.file_id].push_back(i);
+  }
+
+  std::vector<TypeList> root_type_list(file_count);
+  for (const auto &p : d->function_map) {
+    const auto &function_record = p.second;
+    const auto &referenced_types = *function_record.referenced_types;
+
+    root_type_list[function_record.location.file_id].insert(
+        referenced_types.begin(), referenced_types.end());
+  }
+
+  // Save the results of each file that has been analyzed, even when no
+  // function is located in it; its redeclarations would otherwise be
+  // analyzed again in the following runs
+  for (const auto &p : d->cached_file_map) {
+    const auto &file_entry = p.first;
+    if (p.second) {
+      continue;
+    }
+
+    ABILibrary results;
+    TypeList empty_type_list;
+    const auto *file_root_type_list = &empty_type_list;
+
+    auto file_id_it = file_path_table.file_entry_map.find(file_entry);
+    if (file_id_it != file_path_table.file_entry_map.end()) {
+      auto file_id = file_id_it->second;
+      file_root_type_list = &root_type_list[file_id];
+
+      // Each entry has its own path list
+      std::unordered_map<FileId, FileId> local_file_id_map;
+
+      auto L_location = [&](SourceCodeLocation location) {
+        auto local_file_id =
+            static_cast<FileId>(results.file_path_list.size());
+
+        auto insert_status =
+            local_file_id_map.insert({location.file_id, local_file_id});
+
+        if (insert_status.second) {
+          results.file_path_list.push_back(
+              file_path_table.file_path_list[location.file_id]);
+
+          results.file_include_line_list.push_back(
+              file_path_table.include_line_list[location.file_id]);
+        }
+
+        location.file_id = insert_status.first->second;
+        return location;
+      };
+
+      for (auto function_index : whitelist_index[file_id]) {
+        auto function = d->whitelisted_function_list[function_index];
+        function.location = L_location(function.location);
+
+        results.whitelisted_function_list.push_back(std::move(function));
+      }
+
+      for (auto function_index : blacklist_index[file_id]) {
+        auto function = d->blacklisted_function_list[function_index];
+        function.location = L_location(function.location);
+
+        if (auto duplicate_locations =
+                std::get_if<BlacklistedFunction::DuplicateFunctionLocations>(
+                    &function.reason_data)) {
+          for (auto &location : *duplicate_locations) {
+            location = L_location(location);
+          }
+
+        } else if (auto function_pointer_locations = std::get_if<
+                       BlacklistedFunction::FunctionPointerLocations>(
+                       &function.reason_data)) {
+          for (auto &type_location : *function_pointer_locations) {
+            type_location.first = L_location(type_location.first);
+          }
+        }
+
+        results.blacklisted_function_list.push_back(std::move(function));
+      }
+    }
+
+    StringList dependency_list;
+    if (collectFileDependencies(dependency_list, file_entry,
+                                *file_root_type_list)) {
+      d->settings.analysis_cache->store(std::string(file_entry->getName()),
+                                        results, dependency_list);
+    }
+  }
+
+  // Merge the new results with the cached ones, and blacklist the
+  // duplicates across all of them. The new results come first, so that
+  // their include lines take precedence
+  std::vector<ABILibrary> result_list(1U);
+
+  auto &new_results = result_list.front();
+  new_results.blacklisted_function_list =
+      std::move(d->blacklisted_function_list);
+  new_results.whitelisted_function_list =
+      std::move(d->whitelisted_function_list);
+  new_results.function_pointer_type_map =
+      std::move(d->function_pointer_type_map);
+  new_results.file_path_list = std::move(d->file_path_table.file_path_list);
+  new_results.file_include_line_list =
+      std::move(d->file_path_table.include_line_list);
+
+  for (auto &cached_results : d->cached_result_list) {
+    auto L_reanalyzed = [&](const auto &function) -> bool {
+      return d->reanalyzed_name_set.count(function.mangled_name) != 0U;
+    };
+
+    auto &whitelist = cached_results.whitelisted_function_list;
+    whitelist.erase(
+        std::remove_if(whitelist.begin(), whitelist.end(), L_reanalyzed),
+        whitelist.end());
+
+    auto &blacklist = cached_results.blacklisted_function_list;
+    blacklist.erase(
+        std::remove_if(blacklist.begin(), blacklist.end(), L_reanalyzed),
+        blacklist.end());
+
+    result_list.push_back(std::move(cached_results));
+  }
+
+  d->cached_result_list.clear();
+
+  ABILibrary abi_library;
+  mergeAnalysisShards(abi_library, result_list);
+
+  // The file identifiers now refer to the merged path list; no location is
+  // computed after finalize(), so the file entry map is just dropped
+  d->blacklisted_function_list =
+      std::move(abi_library.blacklisted_function_list);
+  d->whitelisted_function_list =
+      std::move(abi_library.whitelisted_function_list);
+  d->function_pointer_type_map =
+      std::move(abi_library.function_pointer_type_map);
+
+  d->file_path_table = {};
+  d->file_path_table.file_path_list = std::move(abi_library.file_path_list);
+  d->file_path_table.include_line_list =
+      std::move(abi_library.file_include_line_list);
+}
+
+llvm::StringRef ASTVisitor::internString(llvm::StringRef str) {
+  return d->string_pool.insert(str).first->getKey();
+}
+
+template <typename LanguagePolicy>
+llvm::StringRef ASTVisitor::getMangledFunctionName(
+    clang::FunctionDecl *function_declaration,
+    clang::MangleContext *name_mangler) {
+  // In C, only the functions marked as overloadable are mangled; this is
+  // the same check the mangler starts with
+  if constexpr (!LanguagePolicy::kHasClasses) {
+    if (!function_declaration->hasAttr<clang::OverloadableAttr>()) {
+      return internString(function_declaration->getName());
+    }
+  }
+
+  if (!name_mangler->shouldMangleCXXName(function_declaration)) {
+    return internString(function_declaration->getName());
+  }
+
+  d->statistics.add(VisitorStatistic::ManglingCalls);
+
+  d->mangling_buffer.clear();
+  llvm::raw_svector_ostream stream(d->mangling_buffer);
+
+  name_mangler->mangleName(function_declaration, stream);
+  return internString(stream.str());
+}
+
+template <typename LanguagePolicy>
+llvm::StringRef ASTVisitor::getFriendlyFunctionName(
+    clang::FunctionDecl *function_declaration) {
+  if constexpr (!LanguagePolicy::kHasClasses) {
+    if (!function_declaration->getDeclName().isIdentifier()) {
+      return "<Missing friendly name>";
+    }
+
+    return internString(function_declaration->getName());
+  }
+
+  std::string class_name;
+  if (isClassMethod(function_declaration)) {
+    auto class_record = getClass(function_declaration);
+    class_name = class_record->getNameAsString();
+  }
+
+  if (!function_declaration->getDeclName().isIdentifier()) {
+    if (llvm::isa<clang::CXXConstructorDecl>(function_declaration)) {
+      return internString(class_name + " constructor");
+
+    } else if (llvm::isa<clang::CXXDestructorDecl>(function_declaration)) {
+      return internString(class_name + " destructor");
+
+    } else {
+      return "<Missing friendly name>";
+    }
+
+  } else {
+    auto name = function_declaration->getName();
+
+    if (!class_name.empty()) {
+      return internString(class_name + "::" + name.str());
+    } else {
+      return internString(name);
+    }
+  }
+}
+
+void ASTVisitor::addTypeSpelling(const clang::Type *type,
+                                 clang::QualType spelled_type,
+                                 const clang::Decl *declaration) {
+  std::lock_guard<std::mutex> lock(d->expansion_mutex);
+  auto &spelling_list = d->type_info_map[type];
+
+  for (const auto &spelling : spelling_list) {
+    if (spelling.spelled_type == spelled_type) {
+      return;
+    }
+  }
+
+  spelling_list.push_back({spelled_type, declaration});
+}
+
+void ASTVisitor::collectTypeLocations(
+    BlacklistedFunction::FunctionPointerLocations &type_location_list,
+    const clang::Type *type) {
+  auto it = d->type_info_map.find(type);
+  if (it == d->type_info_map.end()) {
+    return;
+  }
+
+  // Different sugar may still print the same way; only report each name
+  // once
+  llvm::StringSet<> reported_name_set;
+
+  for (const auto &spelling : it->second) {
+    std::string type_name;
+    if (auto type_decl =
+            llvm::dyn_cast<clang::TypeDecl>(spelling.declaration)) {
+      type_name = type_decl->getNameAsString();
+    } else {
+      type_name = spelling.spelled_type.getAsString();
+    }
+
+    if (!reported_name_set.insert(type_name).second) {
+      continue;
+    }
+
+    type_location_list.push_back(std::make_pair(
+        getDeclarationLocation(spelling.declaration), std::move(type_name)));
+  }
+}
+
+TypeIdentity ASTVisitor::getTypeIdentity(TypeNodeId node_id) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+
+  auto identity = type_dependency_graph.identity(node_id);
+  if (identity != 0U) {
+    return identity;
+  }
+
+  identity = computeTypeIdentity(type_dependency_graph.type(node_id));
+
+  type_dependency_graph.setIdentity(node_id, identity);
+  return identity;
+}
+
+TypeIdentity ASTVisitor::computeTypeIdentity(const clang::Type *type) {
+  // Anonymous types are spelled with the location of their declaration
+  auto spelling = clang::QualType(type, 0U).getAsString(
+      d->ast_context->getPrintingPolicy());
+
+  auto identity = updateContentHash(kInitialContentHash, spelling);
+  if (identity == 0U) {
+    identity = 1U;
+  }
+
+  return identity;
+}
+
+bool ASTVisitor::isSummarizedType(const clang::Type *type, bool &reachable) {
+  reachable = false;
+
+  if (!d->settings.type_summary || !llvm::isa<clang::RecordType>(type)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(d->expansion_mutex);
+
+  auto it = d->summarized_type_map.find(type);
+  if (it == d->summarized_type_map.end()) {
+    auto reachability = TypeReachability::Unknown;
+
+    // Records with the same spelling may be defined by the headers being
+    // analyzed; only the definitions found in the system headers are the
+    // ones the summary has seen
+    auto record_decl = llvm::cast<clang::RecordType>(type)->getDecl();
+    auto definition = record_decl->getDefinition();
+
+    if (definition != nullptr &&
+        d->source_manager->isInSystemHeader(definition->getLocation())) {
+      const auto &reachability_map = d->settings.type_summary->reachability_map;
+
+      auto summary_it = reachability_map.find(computeTypeIdentity(type));
+      if (summary_it != reachability_map.end()) {
+        reachability = summary_it->second ? TypeReachability::Reachable
+                                          : TypeReachability::Unreachable;
+      }
+    }
+
+    it = d->summarized_type_map.insert({type, reachability}).first;
+  }
+
+  reachable = (it->second == TypeReachability::Reachable);
+  return it->second != TypeReachability::Unknown;
+}
+
+bool ASTVisitor::isTaintedType(const clang::Type *type) {
+  if (isFunctionType(type)) {
+    return true;
+  }
+
+  bool reachable;
+  return isSummarizedType(type, reachable) && reachable;
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::buildTypeSummary() {
+  auto &type_dependency_graph = d->type_dependency_graph;
+  auto &summary = *d->settings.type_summary_output;
+
+  // The type list grows while the records are being expanded
+  std::vector<const clang::Type *> type_list(d->ast_context->getTypes().begin(),
+                                             d->ast_context->getTypes().end());
+
+  TypeNodeIdList record_node_list;
+
+  for (auto type : type_list) {
+    auto record_type = llvm::dyn_cast<clang::RecordType>(type);
+    if (record_type == nullptr || type->isDependentType() ||
+        !type->isCanonicalUnqualified()) {
+      continue;
+    }
+
+    auto definition = record_type->getDecl()->getDefinition();
+    if (definition == nullptr ||
+        !d->source_manager->isInSystemHeader(definition->getLocation())) {
+      continue;
+    }
+
+    enumerateTypeDependencies<LanguagePolicy>(type);
+
+    TypeNodeId node_id;
+    if (type_dependency_graph.findNode(node_id, type)) {
+      record_node_list.push_back(node_id);
+    }
+  }
+
+  type_dependency_graph.finalize();
+
+  std::size_t propagation_step_count = 0U;
+  auto tainted_node_flags = flagAncestorNodes(
+      type_dependency_graph, isFunctionType, &propagation_step_count);
+
+  d->statistics.add(VisitorStatistic::TaintPropagationSteps,
+                    propagation_step_count);
+
+  auto opaque_node_flags =
+      flagAncestorNodes(type_dependency_graph, isOpaqueRecordType);
+
+  // Records reaching an incomplete one are left out, unless they are tainted
+  // anyway: the incomplete records they reach are reported for whitelisted
+  // functions
+  for (auto node_id : record_node_list) {
+    if (!tainted_node_flags[node_id] && opaque_node_flags[node_id]) {
+      continue;
+    }
+
+    summary.reachability_map.insert(
+        {getTypeIdentity(node_id), tainted_node_flags[node_id]});
+  }
+}
+
+ASTVisitor::Status ASTVisitor::create(IASTVisitorRef &ref,
+                                      const ASTVisitorSettings &settings) {
+  ref.reset();
+
+  try {
+    auto ptr = new ASTVisitor(settings);
+    ref.reset(ptr);
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ASTVisitor::~ASTVisitor() {}
+
+void ASTVisitor::initialize(clang::ASTContext *ast_context,
+                            clang::SourceManager *source_manager,
+                            clang::MangleContext *name_mangler,
+                            clang::MangleContext *alternate_name_mangler) {
+  d->ast_context = ast_context;
+  d->source_manager = source_manager;
+  d->name_mangler = name_mangler;
+  d->alternate_name_mangler = alternate_name_mangler;
+
+  // Declarations loaded from an external source (precompiled headers,
+  // modules) may be deserialized while they are read, which is not thread
+  // safe; they are also never visited while parsing
+  auto external_source = ast_context->getExternalSource() != nullptr;
+
+  d->analyze_while_parsing =
+      d->settings.analyze_while_parsing && !external_source;
+
+  // Outside of the lazy mode, the types referenced while parsing are queued
+  // as well: the records they lead to may not be defined yet
+  d->queue_type_expansion =
+      (d->settings.type_expansion_threads > 1U || d->analyze_while_parsing) &&
+      !d->settings.lazy_type_expansion && !external_source;
+
+  d->queued_root_type_list.clear();
+
+  d->type_dependency_graph.clear();
+  d->function_map.clear();
+  d->filtered_function_set.clear();
+  d->class_type_map.clear();
+  d->signature_type_map.clear();
+  d->expanded_child_list.clear();
+  d->expanded_node_flags.clear();
+  d->reachability_list.clear();
+  d->truncated_node_flags.clear();
+  d->summarized_type_map.clear();
+  d->string_pool.clear();
+  d->file_path_table = {};
+  d->type_info_map.clear();
+  d->blacklisted_function_list.clear();
+  d->whitelisted_function_list.clear();
+  d->whitelisted_function_decl_list.clear();
+  d->function_pointer_type_map.clear();
+  d->cached_file_map.clear();
+  d->cached_result_list.clear();
+  d->reanalyzed_name_set.clear();
+  d->includer_map.clear();
+  d->included_file_map.clear();
+  d->header_cost_map.clear();
+}
+
+TypeListRef ASTVisitor::collectClassReferencedTypes(
+    clang::CXXRecordDecl *decl, bool &created) {
+  if (auto definition = decl->getDefinition()) {
+    decl = definition;
+  }
+
+  created = false;
+
+  {
+    std::lock_guard<std::mutex> lock(d->expansion_mutex);
+
+    auto it = d->class_type_map.find(decl);
+    if (it != d->class_type_map.end()) {
+      d->statistics.add(VisitorStatistic::RepeatedClassExpansions);
+      return it->second;
+    }
+  }
+
+  // The lock is not held while the class is expanded; when two threads
+  // expand the same class, the list saved by the first one is used
+  auto class_list = collectClasses(decl);
+  auto method_list = collectClassMethods(class_list);
+
+  auto referenced_types = std::make_shared<TypeList>();
+  collectClassMemberTypes(*referenced_types, class_list);
+
+  for (const auto &method : method_list) {
+    collectFunctionParameterTypes(*referenced_types, method);
+  }
+
+  std::lock_guard<std::mutex> lock(d->expansion_mutex);
+  d->statistics.add(VisitorStatistic::ClassExpansions);
+
+  auto insert_status = d->class_type_map.insert({decl, referenced_types});
+  created = insert_status.second;
+
+  return insert_status.first->second;
+}
+
+TypeListRef ASTVisitor::getSignatureTypeList(const TypeList &type_list,
+                                             bool &created) {
+  // Pointers are sorted, so that the hash does not depend on the order
+  // the set iterates in
+  std::vector<const clang::Type *> sorted_type_list(type_list.begin(),
+                                                    type_list.end());
+
+  std::sort(sorted_type_list.begin(), sorted_type_list.end());
+
+  auto signature_hash = kInitialContentHash;
+  for (auto type : sorted_type_list) {
+    signature_hash = updateContentHash(
+        signature_hash,
+        static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(type)));
+  }
+
+  auto range = d->signature_type_map.equal_range(signature_hash);
+  for (auto it = range.first; it != range.second; ++it) {
+    const auto &shared_type_list = *it->second;
+    if (shared_type_list.size() != type_list.size()) {
+      continue;
+    }
+
+    auto same_types = std::all_of(
+        sorted_type_list.begin(), sorted_type_list.end(),
+        [&](const clang::Type *type) -> bool {
+          return shared_type_list.count(type) != 0U;
+        });
+
+    if (same_types) {
+      created = false;
+      return it->second;
+    }
+  }
+
+  TypeListRef shared_type_list = std::make_shared<TypeList>(type_list);
+  d->signature_type_map.insert({signature_hash, shared_type_list});
+
+  created = true;
+  return shared_type_list;
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::collectTypeChildren(TypeList &type_children,
+                                     const clang::Type *type) {
+  // Nodes are canonical types, so there is no sugar (typedefs, elaborated
+  // names, qualifiers) left to desugar here; collected children are
+  // canonicalized as well
+  type_children.clear();
+
+  // Summarized records are leaves; isTaintedType() reports whether they can
+  // reach a function type
+  bool reachable;
+  if (isSummarizedType(type, reachable)) {
+    return;
+  }
+
+  if (type->isPointerType()) {
+    // Pointers: get the type they are pointing to
+    auto pointee_type = type->getPointeeType().getTypePtr();
+    type_children.insert(getCanonicalType(pointee_type));
+
+  } else if (type->isRecordType()) {
+    // Structures (Records): Enumerate the member types and the methods
+    // C records are never classes
+    clang::CXXRecordDecl *cxx_record_decl = nullptr;
+    if constexpr (LanguagePolicy::kHasClasses) {
+      cxx_record_decl = type->getAsCXXRecordDecl();
+    }
+
+    if (cxx_record_decl != nullptr) {
+      if (cxx_record_decl->hasDefinition()) {
+        bool created;
+        type_children = *collectClassReferencedTypes(cxx_record_decl, created);
+      }
+#if LLVM_MAJOR_VERSION <= 6
+    } else if (llvm::dyn_cast_or_null<clang::RecordDecl>(
+                   type->getAsTagDecl()) != nullptr) {
+      auto record_decl = llvm::cast<clang::RecordDecl>(type->getAsTagDecl());
+#else
+    } else if (type->getAsRecordDecl() != nullptr) {
+      auto record_decl = type->getAsRecordDecl();
+#endif
+
+      collectRecordMemberTypes(type_children, record_decl);
+
+    } else {
+      throw std::logic_error("Unhandled record type");
+    }
+
+  } else if (type->getArrayElementTypeNoTypeQual() != nullptr) {
+    // Arrays: the the base element type
+    auto array_element_type = type->getArrayElementTypeNoTypeQual();
+    type_children.insert(getCanonicalType(array_element_type));
+  }
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::enumerateTypeDependencies(const TypeList &root_type_list) {
+  for (const auto &type : root_type_list) {
+    enumerateTypeDependencies<LanguagePolicy>(type);
+  }
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::enumerateTypeDependencies(const clang::Type *root_type) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+
+  // Nodes are only created right before being queued, so a type that already
+  // has a node has already been enumerated
+  bool created;
+  auto root_node_id = type_dependency_graph.getOrCreateNode(root_type, created);
+  if (!created) {
+    return;
+  }
+
+  std::queue<TypeNodeId> queue;
+  queue.push(root_node_id);
+  d->statistics.add(VisitorStatistic::EnqueuedTypes);
+
+  while (!queue.empty()) {
+    // Get the next type from the queue
+    auto current_node_id = queue.front();
+    queue.pop();
+
+    expandNodeChildren<LanguagePolicy>(current_node_id, queue, true);
+  }
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::expandNodeChildren(TypeNodeId node_id,
+                                    std::queue<TypeNodeId> &queue,
+                                    bool stop_at_tainted_child) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+  auto type = type_dependency_graph.type(node_id);
+
+  auto &type_children = d->type_children_scratch;
+  collectTypeChildren<LanguagePolicy>(type_children, type);
+
+  auto L_addChild = [&](const clang::Type *child_type) {
+    bool created;
+    auto child_node_id =
+        type_dependency_graph.getOrCreateNode(child_type, created);
+
+    if (created) {
+      queue.push(child_node_id);
+      d->statistics.add(VisitorStatistic::EnqueuedTypes);
+    }
+
+    type_dependency_graph.addEdge(node_id, child_node_id);
+  };
+
+  // A record is tainted as soon as one of its children is, so the other
+  // members and methods are not explored; the cause list only needs them
+  // for the functions that are reported
+  if (stop_at_tainted_child && type->isRecordType()) {
+    for (const auto &child_type : type_children) {
+      if (!isTaintedType(child_type)) {
+        continue;
+      }
+
+      L_addChild(child_type);
+
+      auto &truncated_node_flags = d->truncated_node_flags;
+      if (node_id >= truncated_node_flags.size()) {
+        truncated_node_flags.resize(type_dependency_graph.nodeCount(), false);
+      }
+
+      truncated_node_flags[node_id] = true;
+      return;
+    }
+  }
+
+  for (const auto &child_type : type_children) {
+    L_addChild(child_type);
+  }
+}
+
+template <typename LanguagePolicy>
+bool ASTVisitor::expandTruncatedNodes(
+    const std::vector<bool> &blacklisted_node_flags) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+  auto &truncated_node_flags = d->truncated_node_flags;
+
+  if (std::find(truncated_node_flags.begin(), truncated_node_flags.end(),
+                true) == truncated_node_flags.end()) {
+    return false;
+  }
+
+  // Walk the blacklisted nodes reachable from the functions, just like the
+  // cause lists are collected
+  std::vector<bool> visited_node_flags(type_dependency_graph.nodeCount(),
+                                       false);
+  std::queue<TypeNodeId> bad_type_queue;
+
+  for (const auto &p : d->function_map) {
+    for (const auto &type : *p.second.referenced_types) {
+      TypeNodeId node_id;
+      if (type_dependency_graph.findNode(node_id, type) &&
+          blacklisted_node_flags[node_id]) {
+        bad_type_queue.push(node_id);
+      }
+    }
+  }
+
+  TypeNodeIdList truncated_node_list;
+
+  while (!bad_type_queue.empty()) {
+    auto node_id = bad_type_queue.front();
+    bad_type_queue.pop();
+
+    if (visited_node_flags[node_id]) {
+      continue;
+    }
+
+    visited_node_flags[node_id] = true;
+
+    if (node_id < truncated_node_flags.size() &&
+        truncated_node_flags[node_id]) {
+      truncated_node_list.push_back(node_id);
+    }
+
+    for (auto child_node_id : type_dependency_graph.children(node_id)) {
+      if (blacklisted_node_flags[child_node_id]) {
+        bad_type_queue.push(child_node_id);
+      }
+    }
+  }
+
+  if (truncated_node_list.empty()) {
+    return false;
+  }
+
+  // The function map is keyed on pointers; expanding the nodes in order
+  // keeps the graph the same on every run
+  std::sort(truncated_node_list.begin(), truncated_node_list.end());
+
+  // The new children are enumerated as usual; the records among them that
+  // end up truncated are expanded by the next call
+  std::queue<TypeNodeId> queue;
+
+  for (auto node_id : truncated_node_list) {
+    truncated_node_flags[node_id] = false;
+    expandNodeChildren<LanguagePolicy>(node_id, queue, false);
+
+    while (!queue.empty()) {
+      auto current_node_id = queue.front();
+      queue.pop();
+
+      expandNodeChildren<LanguagePolicy>(current_node_id, queue, true);
+    }
+  }
+
+  return true;
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::queueTypeDependencies(const TypeList &root_type_list) {
+  if (!d->queue_type_expansion) {
+    enumerateTypeDependencies<LanguagePolicy>(root_type_list);
+    return;
+  }
+
+  d->queued_root_type_list.insert(d->queued_root_type_list.end(),
+                                  root_type_list.begin(), root_type_list.end());
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::enumerateQueuedTypeDependencies() {
+  auto &type_dependency_graph = d->type_dependency_graph;
+  const auto &root_type_list = d->queued_root_type_list;
+
+  ConcurrentTypeChildrenMap type_children_map;
+  std::atomic_size_t next_root_index{0U};
+
+  std::mutex exception_mutex;
+  std::exception_ptr expansion_exception;
+
+  // Each thread takes the next root type, and expands all the types that
+  // can be reached from it and that no other thread has claimed yet. The AST
+  // is only read; the visitor state is protected by the expansion mutex
+  // The records whose expansion stopped at their first tainted child, as
+  // done by expandNodeChildren()
+  std::mutex truncated_type_mutex;
+  std::vector<const clang::Type *> truncated_type_list;
+
+  auto L_expandTypes = [&](std::size_t) {
+    TypeList type_children;
+    std::vector<const clang::Type *> pending_type_list;
+    std::vector<const clang::Type *> local_truncated_type_list;
+
+    try {
+      for (;;) {
+        auto root_index = next_root_index++;
+        if (root_index >= root_type_list.size()) {
+          break;
+        }
+
+        pending_type_list.push_back(root_type_list[root_index]);
+
+        while (!pending_type_list.empty()) {
+          auto type = pending_type_list.back();
+          pending_type_list.pop_back();
+
+          if (!type_children_map.claim(type)) {
+            continue;
+          }
+
+          collectTypeChildren<LanguagePolicy>(type_children, type);
+
+          const clang::Type *tainted_child_type = nullptr;
+          if (type->isRecordType()) {
+            for (const auto &child_type : type_children) {
+              if (isTaintedType(child_type)) {
+                tainted_child_type = child_type;
+                break;
+              }
+            }
+          }
+
+          std::vector<const clang::Type *> child_list;
+          if (tainted_child_type != nullptr) {
+            child_list.push_back(tainted_child_type);
+            local_truncated_type_list.push_back(type);
+
+          } else {
+            child_list.assign(type_children.begin(), type_children.end());
+          }
+
+          pending_type_list.insert(pending_type_list.end(), child_list.begin(),
+                                   child_list.end());
+
+          type_children_map.setChildren(type, std::move(child_list));
+        }
+      }
+
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(exception_mutex);
+      if (!expansion_exception) {
+        expansion_exception = std::current_exception();
+      }
+
+      // Stop the other threads as well
+      next_root_index = root_type_list.size();
+    }
+
+    std::lock_guard<std::mutex> lock(truncated_type_mutex);
+    truncated_type_list.insert(truncated_type_list.end(),
+                               local_truncated_type_list.begin(),
+                               local_truncated_type_list.end());
+  };
+
+  auto thread_count =
+      std::min(d->settings.type_expansion_threads, root_type_list.size());
+
+  runTaskLanes(thread_count, TaskPriority::Normal, L_expandTypes);
+
+  if (expansion_exception) {
+    std::rethrow_exception(expansion_exception);
+  }
+
+  // The nodes are created by this thread alone, walking the types in the
+  // order they have been queued; the graph is then the same no matter how
+  // the types have been split across the threads
+  for (auto root_type : root_type_list) {
+    bool created;
+    auto root_node_id =
+        type_dependency_graph.getOrCreateNode(root_type, created);
+
+    if (!created) {
+      continue;
+    }
+
+    std::queue<TypeNodeId> queue;
+    queue.push(root_node_id);
+    d->statistics.add(VisitorStatistic::EnqueuedTypes);
+
+    while (!queue.empty()) {
+      auto current_node_id = queue.front();
+      queue.pop();
+
+      const auto &child_list = type_children_map.children(
+          type_dependency_graph.type(current_node_id));
+
+      for (auto child_type : child_list) {
+        auto child_node_id =
+            type_dependency_graph.getOrCreateNode(child_type, created);
+
+        if (created) {
+          queue.push(child_node_id);
+          d->statistics.add(VisitorStatistic::EnqueuedTypes);
+        }
+
+        type_dependency_graph.addEdge(current_node_id, child_node_id);
+      }
+    }
+  }
+
+  // Every claimed type is reachable from a root, so it has a node by now
+  auto &truncated_node_flags = d->truncated_node_flags;
+  truncated_node_flags.resize(type_dependency_graph.nodeCount(), false);
+
+  for (auto type : truncated_type_list) {
+    TypeNodeId node_id;
+    if (type_dependency_graph.findNode(node_id, type)) {
+      truncated_node_flags[node_id] = true;
+    }
+  }
+
+  d->queued_root_type_list.clear();
+}
+
+template <typename LanguagePolicy>
+const TypeNodeIdList &ASTVisitor::expandTypeNode(TypeNodeId node_id) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+
+  if (node_id >= d->expanded_node_flags.size()) {
+    d->expanded_node_flags.resize(type_dependency_graph.nodeCount(), false);
+    d->expanded_child_list.resize(type_dependency_graph.nodeCount());
+  }
+
+  if (d->expanded_node_flags[node_id]) {
+    return d->expanded_child_list[node_id];
+  }
+
+  TypeNodeIdList child_node_list;
+  auto &child_type_list = d->type_children_scratch;
+  collectTypeChildren<LanguagePolicy>(child_type_list,
+                                      type_dependency_graph.type(node_id));
+
+  for (const auto &child_type : child_type_list) {
+    bool created;
+    auto child_node_id =
+        type_dependency_graph.getOrCreateNode(child_type, created);
+
+    type_dependency_graph.addEdge(node_id, child_node_id);
+    child_node_list.push_back(child_node_id);
+  }
+
+  // New nodes may have been created; grow the lists before storing the
+  // children, as this can invalidate references into them
+  d->expanded_node_flags.resize(type_dependency_graph.nodeCount(), false);
+  d->expanded_child_list.resize(type_dependency_graph.nodeCount());
+
+  d->expanded_node_flags[node_id] = true;
+  d->expanded_child_list[node_id] = std::move(child_node_list);
+
+  return d->expanded_child_list[node_id];
+}
+
+template <typename LanguagePolicy>
+bool ASTVisitor::reachesFunctionType(TypeNodeId root_node_id, bool parsing) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+  auto &reachability_list = d->reachability_list;
+
+  auto L_reachability = [&](TypeNodeId node_id) -> TypeReachability & {
+    if (node_id >= reachability_list.size()) {
+      reachability_list.resize(type_dependency_graph.nodeCount(),
+                               TypeReachability::Unknown);
+    }
+
+    return reachability_list[node_id];
+  };
+
+  if (L_reachability(root_node_id) != TypeReachability::Unknown) {
+    return L_reachability(root_node_id) == TypeReachability::Reachable;
+  }
+
+  // This is an iterative version of Tarjan's strongly connected components
+  // algorithm, so that cycles between types are handled correctly: a
+  // component is unreachable only once all of its members and successors
+  // have been explored. As soon as a function type is found, every node on
+  // the component stack can reach it (through the current DFS path), and
+  // the remaining children are never expanded. While parsing, a component
+  // that depends on a record without a definition is pending: it is left
+  // unknown instead of unreachable, and will be explored again
+  struct VisitState final {
+    std::size_t index;
+    std::size_t low_link;
+    bool on_stack;
+    bool pending;
+  };
+
+  struct StackFrame final {
+    TypeNodeId node_id;
+    std::size_t next_child;
+  };
+
+  std::unordered_map<TypeNodeId, VisitState> visit_state_map;
+  std::vector<StackFrame> dfs_stack;
+  TypeNodeIdList component_stack;
+  std::size_t next_index = 0U;
+
+  // Returns true if the new node is a function type
+  auto L_push = [&](TypeNodeId node_id) -> bool {
+    auto type = type_dependency_graph.type(node_id);
+
+    visit_state_map[node_id] = {next_index, next_index, true,
+                                parsing && isOpaqueRecordType(type)};
+    ++next_index;
+
+    dfs_stack.push_back({node_id, 0U});
+    component_stack.push_back(node_id);
+
+    return isTaintedType(type);
+  };
+
+  bool found = L_push(root_node_id);
+
+  // Records that may still get a definition are not expanded yet; their
+  // children would be memoized
+  const TypeNodeIdList pending_child_list;
+
+  while (!found && !dfs_stack.empty()) {
+    auto current_node_id = dfs_stack.back().node_id;
+    auto current_type = type_dependency_graph.type(current_node_id);
+
+    const auto &child_node_list =
+        (parsing && isOpaqueRecordType(current_type))
+            ? pending_child_list
+            : expandTypeNode<LanguagePolicy>(current_node_id);
+
+    if (dfs_stack.back().next_child < child_node_list.size()) {
+      auto child_node_id = child_node_list[dfs_stack.back().next_child];
+      dfs_stack.back().next_child++;
+
+      auto child_reachability = L_reachability(child_node_id);
+      if (child_reachability == TypeReachability::Reachable) {
+        found = true;
+        break;
+      }
+
+      if (child_reachability == TypeReachability::Unreachable) {
+        continue;
+      }
+
+      auto visit_state_it = visit_state_map.find(child_node_id);
+      if (visit_state_it == visit_state_map.end()) {
+        found = L_push(child_node_id);
+        continue;
+      }
+
+      auto &current_state = visit_state_map.at(current_node_id);
+      if (visit_state_it->second.on_stack) {
+        current_state.low_link =
+            std::min(current_state.low_link, visit_state_it->second.index);
+
+      } else {
+        // The child belongs to a pending component
+        current_state.pending = true;
+      }
+
+      continue;
+    }
+
+    // All the children have been explored
+    dfs_stack.pop_back();
+
+    auto current_state = visit_state_map.at(current_node_id);
+    if (!dfs_stack.empty()) {
+      auto &parent_state = visit_state_map.at(dfs_stack.back().node_id);
+      parent_state.low_link =
+          std::min(parent_state.low_link, current_state.low_link);
+
+      parent_state.pending = parent_state.pending || current_state.pending;
+    }
+
+    if (current_state.low_link != current_state.index) {
+      continue;
+    }
+
+    // This is the root of a component that can't reach any function type,
+    // at least until the records it depends on get a definition
+    TypeNodeId member_node_id;
+    do {
+      member_node_id = component_stack.back();
+      component_stack.pop_back();
+
+      visit_state_map.at(member_node_id).on_stack = false;
+      if (!current_state.pending) {
+        L_reachability(member_node_id) = TypeReachability::Unreachable;
+      }
+    } while (member_node_id != current_node_id);
+  }
+
+  if (found) {
+    for (auto node_id : component_stack) {
+      L_reachability(node_id) = TypeReachability::Reachable;
+    }
+  }
+
+  return found;
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::precomputeReachability(const TypeList &type_list) {
+  auto &type_dependency_graph = d->type_dependency_graph;
+
+  for (const auto &type : type_list) {
+    bool created;
+    auto node_id = type_dependency_graph.getOrCreateNode(type, created);
+    reachesFunctionType<LanguagePolicy>(node_id, true);
+  }
+}
+
+template <typename LanguagePolicy>
+void ASTVisitor::expandReferencedTypes() {
+  auto &type_dependency_graph = d->type_dependency_graph;
+
+  for (const auto &p : d->function_map) {
+    const auto &function_record = p.second;
+
+    for (const auto &type : *function_record.referenced_types) {
+      bool created;
+      auto node_id = type_dependency_graph.getOrCreateNode(type, created);
+      reachesFunctionType<LanguagePolicy>(node_id);
+    }
+  }
+}
+
+bool ASTVisitor::VisitFunctionDecl(clang::FunctionDecl *declaration) {
+  d->statistics.add(VisitorStatistic::FunctionVisits);
+
+  if (d->settings.time_report) {
+    ++d->header_cost_map[getDeclarationFile(declaration)]
+          .visited_function_count;
+  }
+
+  // Summaries only look at the records defined by the system headers
+  if (d->settings.type_summary_output) {
+    return true;
+  }
+
+  if (d->settings.language == Language::C) {
+    return visitFunctionDecl<CLanguagePolicy>(declaration);
+  }
+
+  return visitFunctionDecl<CXXLanguagePolicy>(declaration);
+}
+
+void ASTVisitor::VisitRecordDefinition(clang::RecordDecl *declaration) {
+  // Only the records that a previous query could not expand are looked at,
+  // so that the lazy mode still skips the types no function references
+  if (!d->analyze_while_parsing || !d->settings.lazy_type_expansion ||
+      d->settings.type_summary_output || declaration->isDependentType()) {
+    return;
+  }
+
+  auto type = getCanonicalType(declaration->getTypeForDecl());
+
+  TypeNodeId node_id;
+  if (!d->type_dependency_graph.findNode(node_id, type)) {
+    return;
+  }
+
+  if (node_id < d->reachability_list.size() &&
+      d->reachability_list[node_id] != TypeReachability::Unknown) {
+    return;
+  }
+
+  if (d->settings.language == Language::C) {
+    reachesFunctionType<CLanguagePolicy>(node_id, true);
+  } else {
+    reachesFunctionType<CXXLanguagePolicy>(node_id, true);
+  }
+}
+
+template <typename LanguagePolicy>
+bool ASTVisitor::visitFunctionDecl(clang::FunctionDecl *declaration) {
+  // Redeclarations share the entry of the canonical declaration; skip them
+  // before expanding the types and mangling the name again
+  auto function_key = declaration;
+  if (d->settings.merge_redeclarations) {
+    function_key = declaration->getCanonicalDecl();
+
+    if (d->function_map.count(function_key) != 0U ||
+        d->filtered_function_set.count(function_key) != 0U) {
+      return true;
+    }
+  }
+
+  // The names are matched before anything else, so that the functions
+  // outside of the selected namespaces never expand their classes and types
+  if (d->settings.function_filter &&
+      !d->settings.function_filter->accepts(declaration)) {
+    d->filtered_function_set.insert(function_key);
+    return true;
+  }
+
+  // Functions whose results are cached are skipped before mangling their
+  // names, unless one of their redeclarations is in a file that has to be
+  // analyzed; the cached results for their names are then discarded
+  bool cached_redeclaration = false;
+
+  if (d->settings.analysis_cache) {
+    bool cached = false;
+
+    if (d->settings.merge_redeclarations) {
+      cached = true;
+
+      for (auto redeclaration : declaration->redecls()) {
+        if (redeclaration->isImplicit()) {
+          continue;
+        }
+
+        if (isCachedFile(getDeclarationFile(redeclaration))) {
+          cached_redeclaration = true;
+        } else {
+          cached = false;
+        }
+      }
+
+      // The location is taken from this file
+      auto first_declaration =
+          getFirstExplicitDeclaration(*d->source_manager, declaration);
+
+      if (!isCachedFile(getDeclarationFile(first_declaration))) {
+        cached = false;
+      }
+
+    } else {
+      cached = isCachedFile(getDeclarationFile(declaration));
+    }
+
+    if (cached) {
+      d->filtered_function_set.insert(function_key);
+      return true;
+    }
+  }
+
+  // When only the imports of a binary are needed, the name is checked before
+  // the types are expanded
+  auto mangled_name =
+      getMangledFunctionName<LanguagePolicy>(declaration, d->name_mangler);
+
+  if (cached_redeclaration) {
+    d->reanalyzed_name_set.insert(mangled_name.str());
+  }
+
+  if (d->settings.imported_symbols &&
+      d->settings.imported_symbols->count(mangled_name.str()) == 0U) {
+    d->filtered_function_set.insert(function_key);
+    return true;
+  }
+
+  // These checks do not depend on the types, which are then not expanded
+  auto early_rejection_reason = getEarlyRejectionReason(declaration);
+
+  // Gather all the referenced types
+  TypeListRef referenced_types;
+
+  bool class_method = false;
+  if constexpr (LanguagePolicy::kHasClasses) {
+    class_method = isClassMethod(declaration);
+  }
+
+  if (early_rejection_reason) {
+    d->statistics.add(VisitorStatistic::EarlyRejections);
+
+    static const TypeListRef kEmptyTypeList = std::make_shared<TypeList>();
+    referenced_types = kEmptyTypeList;
+
+  } else if (class_method) {
+    // Methods share the type list of their class; when the class has already
+    // been expanded, its types are also part of the dependency tree
+    bool created;
+    referenced_types =
+        collectClassReferencedTypes(getClass(declaration), created);
+
+    if (created && !d->settings.lazy_type_expansion) {
+      queueTypeDependencies<LanguagePolicy>(*referenced_types);
+
+    } else if (created && d->analyze_while_parsing) {
+      precomputeReachability<LanguagePolicy>(*referenced_types);
+    }
+
+  } else {
+    // The spellings are still recorded for each function, as their
+    // locations are reported
+    TypeList parameter_type_list;
+    collectFunctionParameterTypes(parameter_type_list, declaration);
+
+    bool created;
+    referenced_types = getSignatureTypeList(parameter_type_list, created);
+
+    // Build the type dependency tree; the lazy mode defers this to
+    // finalize(), unless the reachability can be computed while parsing
+    if (created && !d->settings.lazy_type_expansion) {
+      queueTypeDependencies<LanguagePolicy>(*referenced_types);
+
+    } else if (created && d->analyze_while_parsing) {
+      precomputeReachability<LanguagePolicy>(*referenced_types);
+    }
+  }
+
+  // Save this function (or method) along with the first level of
+  // type dependencies; names and location are only computed once. Merged
+  // functions are located at their first explicit declaration, so that every
+  // shard reports the same location no matter which redeclaration it visited
+  FunctionRecord function_record;
+  function_record.mangled_name = mangled_name;
+  if (d->alternate_name_mangler != nullptr) {
+    function_record.alternate_mangled_name =
+        getMangledFunctionName<LanguagePolicy>(declaration,
+                                               d->alternate_name_mangler);
+  }
+
+  function_record.friendly_name =
+      getFriendlyFunctionName<LanguagePolicy>(declaration);
+  function_record.referenced_types = referenced_types;
+  function_record.early_rejection_reason = early_rejection_reason;
+
+  if (d->settings.merge_redeclarations) {
+    function_record.location = getDeclarationLocation(
+        getFirstExplicitDeclaration(*d->source_manager, declaration));
+  } else {
+    function_record.location = getDeclarationLocation(declaration);
+  }
+
+  d->function_map.insert({function_key, std::move(function_record)});
+
+  return true;
+}
+
+void ASTVisitor::blacklistDuplicateFunctions(
+    const std::vector<std::size_t> &file_rank_list) {
+  // Find duplicated functions; interned names can be compared by pointer,
+  // but the map is keyed on the string contents anyway
+  llvm::DenseMap<llvm::StringRef, std::vector<clang::FunctionDecl *>>
+      name_to_function_map;
+
+  for (const auto &p : d->function_map) {
+    const auto &function_decl = p.first;
+    const auto &function_record = p.second;
+
+    name_to_function_map[function_record.mangled_name].push_back(
+        function_decl);
+  }
+
+  for (auto &p : name_to_function_map) {
+    auto &function_decl_list = p.second;
+
+    if (function_decl_list.size() == 1U) {
+      continue;
+    }
+
+    // The function map is keyed on pointers; sort the group so that the
+    // same function is reported on every run
+    std::sort(function_decl_list.begin(), function_decl_list.end(),
+              [&](clang::FunctionDecl *lhs, clang::FunctionDecl *rhs) -> bool {
+                return locationPrecedes(file_rank_list,
+                                        d->function_map.at(lhs).location,
+                                        d->function_map.at(rhs).location);
+              });
 
-    TypeInformation type_info = {};
-    type_info.location =
-        getSourceCodeLocation(*d->ast_context, *d->source_manager, field);
-    type_info.name = field->getType().getAsString();
-    d->type_info_map.insert({field_type, type_info});
-  }
+    auto first_function_decl = function_decl_list.front();
+    const auto &first_function_record =
+        d->function_map.at(first_function_decl);
 
-  return type_list;
-}
+    BlacklistedFunction func = {};
+    func.location = first_function_record.location;
+    func.mangled_name = first_function_record.mangled_name.str();
+    func.alternate_mangled_name =
+        first_function_record.alternate_mangled_name.str();
+    func.friendly_name = first_function_record.friendly_name.str();
+    func.reason = BlacklistedFunction::Reason::DuplicateName;
 
-TypeList ASTVisitor::collectFunctionParameterTypes(clang::FunctionDecl *decl) {
-  TypeList type_list;
+    BlacklistedFunction::DuplicateFunctionLocations locations = {};
 
-  for (const auto &param : decl->parameters()) {
-    auto type_source_info = param->getTypeSourceInfo();
-    if (type_source_info == nullptr) {
-      continue;
-    }
+    d->function_map.erase(first_function_decl);
 
-    auto type_loc = type_source_info->getTypeLoc();
-    auto type = type_loc.getTypePtr();
-    if (type == nullptr) {
-      throw std::logic_error("Failed to acquire the Type ptr");
-    }
+    for (auto func_decl_list_it = function_decl_list.begin() + 1;
+         func_decl_list_it != function_decl_list.end(); func_decl_list_it++) {
+      const auto &next_func_decl = *func_decl_list_it;
 
-    type_list.insert(type);
+      auto next_func_it = d->function_map.find(next_func_decl);
+      locations.push_back(next_func_it->second.location);
 
-    TypeInformation type_info = {};
-    type_info.location =
-        getSourceCodeLocation(*d->ast_context, *d->source_manager, param);
+      d->function_map.erase(next_func_it);
+    }
 
-    type_info.name = param->getType().getAsString();
-    d->type_info_map.insert({type, type_info});
+    func.reason_data = locations;
+    d->blacklisted_function_list.push_back(func);
   }
-
-  return type_list;
 }
 
-std::string ASTVisitor::getMangledFunctionName(
-    clang::FunctionDecl *function_declaration) {
-  std::string function_name;
+void ASTVisitor::finalize() {
+  finalizeAnalysis();
 
-  if (d->name_mangler->shouldMangleCXXName(function_declaration)) {
-    std::string buffer;
-    llvm::raw_string_ostream stream(buffer);
+  auto &statistics = d->statistics;
+  statistics.add(VisitorStatistic::GraphNodes,
+                 d->type_dependency_graph.nodeCount());
 
-    d->name_mangler->mangleName(function_declaration, stream);
-    function_name = stream.str();
-  } else {
-    function_name = function_declaration->getName().str();
-  }
+  statistics.add(VisitorStatistic::GraphEdges,
+                 d->type_dependency_graph.edgeCount());
 
-  return function_name;
-}
+  statistics.add(VisitorStatistic::TypeInformationMapEntries,
+                 d->type_info_map.size());
 
-std::string ASTVisitor::getFriendlyFunctionName(
-    clang::FunctionDecl *function_declaration) {
-  std::string class_name;
-  if (isClassMethod(function_declaration)) {
-    auto class_record = getClass(function_declaration);
-    class_name = class_record->getNameAsString();
+  if (d->settings.statistics) {
+    d->settings.statistics->merge(statistics);
   }
+}
 
-  if (!function_declaration->getDeclName().isIdentifier()) {
-    if (dynamic_cast<clang::CXXConstructorDecl *>(function_declaration) !=
-        nullptr) {
-      return class_name + " constructor";
+void ASTVisitor::finalizeAnalysis() {
+  // Shards are finalized concurrently, each on its own thread
+  ScopedPhaseTimer phase_timer(d->settings.time_report, "ASTVisitor::finalize",
+                               CPUTimeScope::Thread);
 
-    } else if (dynamic_cast<clang::CXXDestructorDecl *>(function_declaration) !=
-               nullptr) {
-      return class_name + " destructor";
+  auto &type_dependency_graph = d->type_dependency_graph;
 
+  if (d->settings.type_summary_output) {
+    if (d->settings.language == Language::C) {
+      buildTypeSummary<CLanguagePolicy>();
     } else {
-      return "<Missing friendly name>";
+      buildTypeSummary<CXXLanguagePolicy>();
     }
 
-  } else {
-    auto name = function_declaration->getName().str();
+    return;
+  }
 
-    if (!class_name.empty()) {
-      return class_name + "::" + name;
+  // In lazy mode, only the types needed to answer the reachability query of
+  // each function are expanded; the graph is then built from the edges that
+  // have been discovered
+  if (d->settings.lazy_type_expansion) {
+    if (d->settings.language == Language::C) {
+      expandReferencedTypes<CLanguagePolicy>();
     } else {
-      return name;
+      expandReferencedTypes<CXXLanguagePolicy>();
     }
   }
-}
 
-bool ASTVisitor::getTypeInformation(std::string &type_name,
-                                    SourceCodeLocation &type_location,
-                                    const clang::Type *type) {
-  type_name.clear();
-  type_location = {};
-
-  auto it = d->type_info_map.find(type);
-  if (it == d->type_info_map.end()) {
-    return false;
+  // The types queued while the declarations were visited are expanded on
+  // multiple threads
+  if (!d->queued_root_type_list.empty()) {
+    if (d->settings.language == Language::C) {
+      enumerateQueuedTypeDependencies<CLanguagePolicy>();
+    } else {
+      enumerateQueuedTypeDependencies<CXXLanguagePolicy>();
+    }
   }
 
-  const auto &type_info = it->second;
-  type_location = type_info.location;
-  type_name = type_info.name;
+  type_dependency_graph.finalize();
 
-  return true;
-}
+  // When the analysis is sharded, the values of all the shards are summed
+  if (d->settings.time_report) {
+    auto &time_report = *d->settings.time_report;
 
-ASTVisitor::Status ASTVisitor::create(IASTVisitorRef &ref) {
-  ref.reset();
+    time_report.addStatistic("Type graph nodes",
+                             type_dependency_graph.nodeCount());
 
-  try {
-    auto ptr = new ASTVisitor();
-    ref.reset(ptr);
-    return Status(true);
+    time_report.addStatistic("Type graph edges",
+                             type_dependency_graph.edgeCount());
 
-  } catch (const std::bad_alloc &) {
-    return Status(false, StatusCode::MemoryAllocationFailure);
+    time_report.addStatistic("Type graph (estimated bytes)",
+                             type_dependency_graph.memoryUsage());
 
-  } catch (const Status &status) {
-    return status;
-  }
-}
+    time_report.addStatistic("Function map entries", d->function_map.size());
+    time_report.addStatistic("Distinct parameter type sets",
+                             d->signature_type_map.size());
+    time_report.addStatistic("Function map (estimated bytes)",
+                             estimateUnorderedMapMemory(d->function_map));
 
-ASTVisitor::~ASTVisitor() {}
+    time_report.addStatistic("Type information map entries",
+                             d->type_info_map.size());
 
-void ASTVisitor::initialize(clang::ASTContext *ast_context,
-                            clang::SourceManager *source_manager,
-                            clang::MangleContext *name_mangler) {
-  d->ast_context = ast_context;
-  d->source_manager = source_manager;
-  d->name_mangler = name_mangler;
+    // Spelling lists are allocated separately from the map nodes
+    auto type_info_map_memory = estimateUnorderedMapMemory(d->type_info_map);
+    for (const auto &p : d->type_info_map) {
+      type_info_map_memory += p.second.capacity() * sizeof(TypeSpelling);
+    }
 
-  d->type_dependency_tree.clear();
-  d->function_map.clear();
-  d->enumerated_type_list.clear();
-  d->type_info_map.clear();
-  d->blacklisted_function_list.clear();
-  d->whitelisted_function_list.clear();
-}
+    time_report.addStatistic("Type information map (estimated bytes)",
+                             type_info_map_memory);
 
-void ASTVisitor::enumerateTypeDependencies(const TypeList &root_type_list) {
-  for (const auto &type : root_type_list) {
-    enumerateTypeDependencies(type);
+    time_report.addStatistic("String pool entries", d->string_pool.size());
+    time_report.addStatistic("String pool (estimated bytes)",
+                             estimateStringPoolMemory(d->string_pool));
   }
-}
-
-void ASTVisitor::enumerateTypeDependencies(const clang::Type *root_type) {
-  std::queue<const clang::Type *> queue;
-  queue.push(root_type);
 
-  while (!queue.empty()) {
-    // Get the next type from the queue
-    auto current_type = queue.front();
-    queue.pop();
+  auto node_count = type_dependency_graph.nodeCount();
+  std::vector<bool> blacklisted_node_flags(node_count, false);
 
-    // Skip this type if we already know about it
-    if (d->enumerated_type_list.count(current_type) != 0) {
-      continue;
+  if (d->settings.lazy_type_expansion) {
+    for (TypeNodeId node_id = 0U; node_id < node_count; ++node_id) {
+      blacklisted_node_flags[node_id] =
+          node_id < d->reachability_list.size() &&
+          d->reachability_list[node_id] == TypeReachability::Reachable;
     }
 
-    d->enumerated_type_list.insert(current_type);
+  } else {
+    // A type is blacklisted when it is a function type (or a summarized
+    // record reaching one), or when it can reach one through its children.
+    // The truncated records reached by the blacklisted functions are then
+    // expanded in full, until their cause lists are complete
+    while (true) {
+      std::size_t propagation_step_count = 0U;
+      blacklisted_node_flags = flagAncestorNodes(
+          type_dependency_graph,
+          [&](const clang::Type *type) -> bool { return isTaintedType(type); },
+          &propagation_step_count);
+
+      d->statistics.add(VisitorStatistic::TaintPropagationSteps,
+                        propagation_step_count);
+
+      bool expanded;
+      if (d->settings.language == Language::C) {
+        expanded =
+            expandTruncatedNodes<CLanguagePolicy>(blacklisted_node_flags);
+      } else {
+        expanded =
+            expandTruncatedNodes<CXXLanguagePolicy>(blacklisted_node_flags);
+      }
 
-    // Get (or create a new one) the node for this type
-    TypeDependencyNodeRef current_node_ref;
+      if (!expanded) {
+        break;
+      }
 
-    auto type_tree_it = d->type_dependency_tree.find(current_type);
-    if (type_tree_it == d->type_dependency_tree.end()) {
-      current_node_ref = std::make_shared<TypeDependencyNode>();
-      current_node_ref->type = current_type;
-      d->type_dependency_tree.insert({current_type, current_node_ref});
-    } else {
-      current_node_ref = type_tree_it->second;
+      type_dependency_graph.finalize();
     }
 
-    // Expand the type we have
-    std::unordered_set<const clang::Type *> current_type_children = {};
-
-    if (current_type->isPointerType()) {
-      // Pointers: get the type they are pointing to
-      auto pointee_type = current_type->getPointeeType().getTypePtr();
-      current_type_children.insert(pointee_type);
-
-    } else if (current_type->isRecordType()) {
-      // Structures (Records): Enumerate the member types and the methods
-      TypeList referenced_types;
+    node_count = type_dependency_graph.nodeCount();
+  }
 
-      if (current_type->getAsCXXRecordDecl() != nullptr) {
-        auto cxx_record_decl = current_type->getAsCXXRecordDecl();
-        if (cxx_record_decl->hasDefinition()) {
-          auto class_list = collectClasses(cxx_record_decl);
-          auto method_list = collectClassMethods(class_list);
+  // Incomplete classes and structures may hide a function pointer that
+  // another translation unit can see. Flag the nodes that can reach one, so
+  // that listing the opaque types of each whitelisted function only visits
+  // these
+  auto opaque_node_flags =
+      flagAncestorNodes(type_dependency_graph, isOpaqueRecordType);
+
+  std::vector<std::size_t> opaque_visit_stamp_list(node_count, 0U);
+  std::size_t opaque_visit_stamp = 0U;
+
+  auto L_collectOpaqueTypes = [&](const TypeList &root_type_list)
+      -> TypeIdentityList {
+    TypeIdentityList opaque_type_list;
+    std::queue<TypeNodeId> opaque_type_queue;
+    ++opaque_visit_stamp;
+
+    for (const auto &type : root_type_list) {
+      TypeNodeId node_id;
+      if (type_dependency_graph.findNode(node_id, type) &&
+          opaque_node_flags[node_id]) {
+        opaque_type_queue.push(node_id);
+      }
+    }
 
-          referenced_types = collectClassMemberTypes(class_list);
-          for (const auto &method : method_list) {
-            auto parameter_type_list = collectFunctionParameterTypes(method);
+    while (!opaque_type_queue.empty()) {
+      auto node_id = opaque_type_queue.front();
+      opaque_type_queue.pop();
 
-            for (const auto &param_type : parameter_type_list) {
-              referenced_types.insert(param_type);
-            }
-          }
-        }
-#if LLVM_MAJOR_VERSION <= 6
-      } else if (current_type->getAsTagDecl() != nullptr &&
-                 dynamic_cast<clang::RecordDecl *>(
-                     current_type->getAsTagDecl()) != nullptr) {
-        auto record_decl =
-            dynamic_cast<clang::RecordDecl *>(current_type->getAsTagDecl());
-#else
-      } else if (current_type->getAsRecordDecl() != nullptr) {
-        auto record_decl = current_type->getAsRecordDecl();
-#endif
+      if (opaque_visit_stamp_list[node_id] == opaque_visit_stamp) {
+        continue;
+      }
 
-        referenced_types = collectRecordMemberTypes(record_decl);
+      opaque_visit_stamp_list[node_id] = opaque_visit_stamp;
 
-      } else {
-        throw std::logic_error("Unhandled record type");
+      if (isOpaqueRecordType(type_dependency_graph.type(node_id))) {
+        opaque_type_list.push_back(getTypeIdentity(node_id));
       }
 
-      for (const auto &child_type : referenced_types) {
-        current_type_children.insert(child_type);
+      for (auto child_node_id : type_dependency_graph.children(node_id)) {
+        if (opaque_node_flags[child_node_id]) {
+          opaque_type_queue.push(child_node_id);
+        }
       }
+    }
 
-    } else if (current_type->getArrayElementTypeNoTypeQual() != nullptr) {
-      // Arrays: the the base element type
-      auto array_element_type = current_type->getArrayElementTypeNoTypeQual();
-      current_type_children.insert(array_element_type);
+    std::sort(opaque_type_list.begin(), opaque_type_list.end());
+    return opaque_type_list;
+  };
 
-    } else if (current_type->getAs<clang::TypedefType>() != nullptr) {
-      // Type definitions (either with `typedef` or `using`): get the underlying
-      // type
-      auto typedef_type = current_type->getAs<clang::TypedefType>();
+  auto L_isBlacklisted = [&](const clang::Type *type,
+                             TypeNodeId &node_id) -> bool {
+    return type_dependency_graph.findNode(node_id, type) &&
+           blacklisted_node_flags[node_id];
+  };
 
-      auto underlying_type =
-          typedef_type->getDecl()->getUnderlyingType().getTypePtr();
+  auto file_rank_list = rankFilePaths(d->file_path_table.file_path_list);
 
-      current_type_children.insert(underlying_type);
+  // When the results of several visitors (or cached results) are merged,
+  // duplicates can only be detected after the merge
+  if (!d->settings.defer_duplicate_detection && !d->settings.analysis_cache) {
+    blacklistDuplicateFunctions(file_rank_list);
+  }
 
-    } else if (!current_type->isCanonicalUnqualified()) {
-      auto qual_type = current_type->getCanonicalTypeUnqualified();
-      current_type_children.insert(qual_type.getTypePtr());
-    }
+  // The function map is keyed on pointers; filter the functions in source
+  // order, so that the output is the same on every run
+  std::vector<const FunctionMap::value_type *> sorted_function_list;
+  sorted_function_list.reserve(d->function_map.size());
 
-    // Append the children type we found to the current type; add the child type
-    // to the queue only if it is new
-    for (const auto &child_type : current_type_children) {
-      current_node_ref->children.insert(child_type);
+  for (const auto &p : d->function_map) {
+    sorted_function_list.push_back(&p);
+  }
 
-      TypeDependencyNodeRef child_node_ref;
-      type_tree_it = d->type_dependency_tree.find(child_type);
-      if (type_tree_it != d->type_dependency_tree.end()) {
-        child_node_ref = type_tree_it->second;
-      } else {
-        child_node_ref = std::make_shared<TypeDependencyNode>();
-        child_node_ref->type = child_type;
+  std::sort(sorted_function_list.begin(), sorted_function_list.end(),
+            [&](const FunctionMap::value_type *lhs,
+                const FunctionMap::value_type *rhs) -> bool {
+              const auto &lhs_record = lhs->second;
+              const auto &rhs_record = rhs->second;
+
+              return functionPrecedes(
+                  file_rank_list, lhs_record.location,
+                  std::string_view(lhs_record.mangled_name.data(),
+                                   lhs_record.mangled_name.size()),
+                  rhs_record.location,
+                  std::string_view(rhs_record.mangled_name.data(),
+                                   rhs_record.mangled_name.size()));
+            });
+
+  // Unless the full cause lists have been requested, each blacklisted
+  // function only reports the shortest chain of types that leads to a
+  // function type. The distance of every blacklisted type from the nearest
+  // function type is computed once, walking up the parents of the function
+  // types, and each chain then follows the recorded next hops
+  constexpr auto kUnreachedDistance = std::numeric_limits<std::size_t>::max();
+
+  std::vector<std::size_t> witness_distance_list;
+  TypeNodeIdList witness_next_hop_list;
+
+  if (!d->settings.full_blacklist_causes) {
+    witness_distance_list.assign(node_count, kUnreachedDistance);
+    witness_next_hop_list.assign(node_count, 0U);
+
+    std::queue<TypeNodeId> witness_queue;
+    for (TypeNodeId node_id = 0U; node_id < node_count; ++node_id) {
+      if (blacklisted_node_flags[node_id] &&
+          isTaintedType(type_dependency_graph.type(node_id))) {
+        witness_distance_list[node_id] = 0U;
+        witness_next_hop_list[node_id] = node_id;
+        witness_queue.push(node_id);
+      }
+    }
 
-        d->type_dependency_tree.insert({child_type, child_node_ref});
+    while (!witness_queue.empty()) {
+      auto node_id = witness_queue.front();
+      witness_queue.pop();
 
-        queue.push(child_type);
-      }
+      for (auto parent_node_id : type_dependency_graph.parents(node_id)) {
+        if (blacklisted_node_flags[parent_node_id] &&
+            witness_distance_list[parent_node_id] == kUnreachedDistance) {
+          witness_distance_list[parent_node_id] =
+              witness_distance_list[node_id] + 1U;
 
-      child_node_ref->parents.insert(current_type);
+          witness_next_hop_list[parent_node_id] = node_id;
+          witness_queue.push(parent_node_id);
+        }
+      }
     }
   }
-}
 
-bool ASTVisitor::VisitFunctionDecl(clang::FunctionDecl *declaration) {
-  // Gather all the referenced types
-  TypeList referenced_types;
+  // Collecting the bad types only reads the dependency graph, so the work
+  // is split in contiguous slices that are processed on their own threads;
+  // the results are then consumed in order, and the output does not depend
+  // on the thread count
+  std::vector<TypeList> bad_type_list_list(sorted_function_list.size());
+
+  auto L_runSlices = [&](std::size_t item_count,
+                         const std::function<void(std::size_t, std::size_t)>
+                             &slice_callback) {
+    auto thread_count = std::min(d->settings.finalize_threads, item_count);
+    if (thread_count <= 1U) {
+      slice_callback(0U, item_count);
+      return;
+    }
 
-  if (isClassMethod(declaration)) {
-    auto class_list = collectClasses(getClass(declaration));
+    auto slice_size = (item_count + thread_count - 1U) / thread_count;
 
-    referenced_types = collectClassMemberTypes(class_list);
-    auto method_list = collectClassMethods(class_list);
+    runTaskLanes(thread_count, TaskPriority::Normal, [&](std::size_t i) {
+      auto first_index = std::min(i * slice_size, item_count);
+      auto last_index = std::min(first_index + slice_size, item_count);
 
-    for (const auto &method : method_list) {
-      auto parameter_type_list = collectFunctionParameterTypes(method);
+      slice_callback(first_index, last_index);
+    });
+  };
 
-      referenced_types.reserve(referenced_types.size() +
-                               parameter_type_list.size());
+  auto L_collectBadTypes = [&](std::size_t first_index,
+                               std::size_t last_index) {
+    // Functions sharing their type list (methods of the same class, or
+    // functions with the same parameter types) also share the result
+    std::unordered_map<const TypeList *, std::size_t> first_index_map;
 
-      std::move(parameter_type_list.begin(), parameter_type_list.end(),
-                std::inserter(referenced_types, referenced_types.begin()));
-    }
+    for (auto index = first_index; index < last_index; ++index) {
+      const auto &function_record = sorted_function_list[index]->second;
 
-  } else {
-    referenced_types = collectFunctionParameterTypes(declaration);
-  }
+      auto first_index_it = first_index_map.insert(
+          {function_record.referenced_types.get(), index});
 
-  // Build the type dependency tree
-  enumerateTypeDependencies(referenced_types);
+      if (!first_index_it.second) {
+        bad_type_list_list[index] =
+            bad_type_list_list[first_index_it.first->second];
 
-  // Save this function (or method) along with the first level of
-  // type dependencies
-  d->function_map.insert({declaration, referenced_types});
+        continue;
+      }
 
-  return true;
-}
+      // Search for bad types (function pointers)
+      std::queue<TypeNodeId> bad_type_queue;
+      for (const auto &type_dependency : *function_record.referenced_types) {
+        TypeNodeId node_id;
+        if (L_isBlacklisted(type_dependency, node_id)) {
+          bad_type_queue.push(node_id);
+        }
+      }
 
-void ASTVisitor::finalize() {
-  // clang-format off
-  auto L_isFunction = [](const clang::Type *type) -> bool {
-    return (
-      type->isFunctionNoProtoType() ||
-      type->isFunctionPointerType() ||
-      type->isFunctionProtoType() ||
-      type->isFunctionType()
-    );
-  };
-  // clang-format on
+      if (bad_type_queue.empty()) {
+        continue;
+      }
+
+      auto &bad_type_list = bad_type_list_list[index];
 
-  std::unordered_set<const clang::Type *> blacklisted_type_list;
+      // Start from the referenced type that is closest to a function type;
+      // ties go to the lowest node, since the type list is not ordered
+      auto witness_node_id = bad_type_queue.front();
+      while (!bad_type_queue.empty()) {
+        auto node_id = bad_type_queue.front();
+        bad_type_queue.pop();
 
-  for (const auto &p : d->type_dependency_tree) {
-    const auto &type = p.first;
-    const auto &type_node_ref = p.second;
+        const auto &distance = witness_distance_list[node_id];
+        const auto &witness_distance = witness_distance_list[witness_node_id];
 
-    // If we already blacklisted this type, skip it
-    if (blacklisted_type_list.count(type) != 0) {
-      continue;
-    }
+        if (distance < witness_distance ||
+            (distance == witness_distance && node_id < witness_node_id)) {
+          witness_node_id = node_id;
+        }
+      }
 
-    // Test whether this type has any child type that should be
-    // blacklisted
-    std::queue<const clang::Type *> propagation_queue;
+      // Types that the lazy expansion has flagged without reaching their
+      // function type are reported on their own
+      bad_type_list.insert(type_dependency_graph.type(witness_node_id));
 
-    for (const auto &child_type : type_node_ref->children) {
-      if (L_isFunction(child_type)) {
-        propagation_queue.push(child_type);
+      while (witness_distance_list[witness_node_id] != 0U &&
+             witness_distance_list[witness_node_id] != kUnreachedDistance) {
+        witness_node_id = witness_next_hop_list[witness_node_id];
+        bad_type_list.insert(type_dependency_graph.type(witness_node_id));
       }
     }
+  };
 
-    // If this type is bannable or depends on bannable child types, then also
-    // add the current type to the propagation queue
-    if (!propagation_queue.empty()) {
-      propagation_queue.push(type);
-    }
+  // The full cause list of a function is every blacklisted type reachable
+  // from it. Instead of visiting the graph once for each function, the
+  // functions are tracked as bits: each sweep seeds the components of the
+  // blacklisted subgraph with the bits of up to kCauseSourcesPerSweep
+  // functions, and ORs them into the child components in topological order,
+  // so that every type ends up with the set of functions reaching it
+  constexpr std::size_t kCauseSourceWordCount = 4U;
+  constexpr std::size_t kCauseSourcesPerSweep = kCauseSourceWordCount * 64U;
+
+  // The functions whose type list is shared with a previous one, and the
+  // index of that function
+  std::vector<std::pair<std::size_t, std::size_t>> shared_cause_list;
+
+  // The function of each source, and the blacklisted types it references
+  std::vector<std::size_t> cause_source_index_list;
+  std::vector<TypeNodeIdList> cause_source_root_list;
+
+  NodeComponentGraph component_graph;
+
+  auto L_sweepCauseSources = [&](std::size_t first_sweep,
+                                 std::size_t last_sweep) {
+    const auto &node_component_list = component_graph.node_component_list;
+    const auto &child_offset_list = component_graph.child_offset_list;
+    const auto &component_child_list = component_graph.child_list;
+
+    std::vector<std::uint64_t> component_bit_list(
+        component_graph.component_count * kCauseSourceWordCount);
+
+    for (auto sweep = first_sweep; sweep < last_sweep; ++sweep) {
+      auto first_source = sweep * kCauseSourcesPerSweep;
+      auto last_source = std::min(first_source + kCauseSourcesPerSweep,
+                                  cause_source_index_list.size());
+
+      std::fill(component_bit_list.begin(), component_bit_list.end(), 0U);
+
+      for (auto source = first_source; source < last_source; ++source) {
+        auto bit = source - first_source;
+        auto mask = std::uint64_t(1U) << (bit % 64U);
+
+        for (auto root_node_id : cause_source_root_list[source]) {
+          component_bit_list[node_component_list[root_node_id] *
+                                 kCauseSourceWordCount +
+                             bit / 64U] |= mask;
+        }
+      }
 
-    // Add this type if it's blacklistable and we didn't add it already
-    if (L_isFunction(type) && propagation_queue.front() != type) {
-      propagation_queue.push(type);
-    }
+      // Parents have higher component numbers than their children
+      for (auto component = component_graph.component_count;
+           component-- > 0U;) {
+        const auto *bits =
+            &component_bit_list[component * kCauseSourceWordCount];
+
+        std::uint64_t any_bit = 0U;
+        for (std::size_t word = 0U; word < kCauseSourceWordCount; ++word) {
+          any_bit |= bits[word];
+        }
 
-    // Blacklist the types we collected, and also propagate the status upward
-    TypeList propagated_types;
+        if (any_bit == 0U) {
+          continue;
+        }
 
-    while (!propagation_queue.empty()) {
-      auto current_type = propagation_queue.front();
-      propagation_queue.pop();
+        for (auto i = child_offset_list[component];
+             i < child_offset_list[component + 1U]; ++i) {
+          auto *child_bits =
+              &component_bit_list[component_child_list[i] *
+                                  kCauseSourceWordCount];
 
-      if (propagated_types.count(current_type) != 0) {
-        continue;
+          for (std::size_t word = 0U; word < kCauseSourceWordCount; ++word) {
+            child_bits[word] |= bits[word];
+          }
+        }
       }
 
-      propagated_types.insert(current_type);
+      // The types are inserted in node order, so the output does not depend
+      // on how the sources have been grouped
+      for (TypeNodeId node_id = 0U; node_id < node_count; ++node_id) {
+        if (!blacklisted_node_flags[node_id]) {
+          continue;
+        }
 
-      blacklisted_type_list.insert(current_type);
+        const auto *bits =
+            &component_bit_list[node_component_list[node_id] *
+                                kCauseSourceWordCount];
 
-      for (const auto &parent_type :
-           d->type_dependency_tree.at(current_type)->parents) {
-        blacklisted_type_list.insert(parent_type);
-        propagation_queue.push(parent_type);
+        for (std::size_t word = 0U; word < kCauseSourceWordCount; ++word) {
+          auto source = first_source + word * 64U;
 
-        auto it = d->type_dependency_tree.find(parent_type);
-        if (it != d->type_dependency_tree.end()) {
-          for (const auto &next_parent : it->second->parents) {
-            propagation_queue.push(next_parent);
+          for (auto word_bits = bits[word]; word_bits != 0U;
+               word_bits >>= 1U, ++source) {
+            if ((word_bits & 1U) != 0U) {
+              bad_type_list_list[cause_source_index_list[source]].insert(
+                  type_dependency_graph.type(node_id));
+            }
           }
         }
       }
     }
-  }
-
-  // Find duplicated functions
-  std::unordered_map<std::string, std::vector<clang::FunctionDecl *>>
-      name_to_function_map;
-
-  for (const auto &p : d->function_map) {
-    const auto &function_decl = p.first;
-    auto function_name = getMangledFunctionName(function_decl);
+  };
 
-    auto it = name_to_function_map.find(function_name);
-    if (it != name_to_function_map.end()) {
-      auto &vec = it->second;
-      vec.push_back(function_decl);
-    } else {
-      name_to_function_map.insert({function_name, {function_decl}});
-    }
-  }
+  if (!d->settings.full_blacklist_causes) {
+    L_runSlices(sorted_function_list.size(), L_collectBadTypes);
 
-  for (const auto &p : name_to_function_map) {
-    const auto &mangled_function_name = p.first;
-    const auto &function_decl_list = p.second;
+  } else {
+    // Functions sharing their type list (methods of the same class, or
+    // functions with the same parameter types) also share the result
+    std::unordered_map<const TypeList *, std::size_t> first_index_map;
 
-    if (function_decl_list.size() == 1U) {
-      continue;
-    }
+    for (std::size_t index = 0U; index < sorted_function_list.size();
+         ++index) {
+      const auto &function_record = sorted_function_list[index]->second;
 
-    auto first_function_decl = function_decl_list.front();
-    auto friendly_function_name = getFriendlyFunctionName(first_function_decl);
+      auto first_index_it = first_index_map.insert(
+          {function_record.referenced_types.get(), index});
 
-    auto first_function_location = getSourceCodeLocation(
-        *d->ast_context, *d->source_manager, first_function_decl);
+      if (!first_index_it.second) {
+        shared_cause_list.push_back({index, first_index_it.first->second});
+        continue;
+      }
 
-    BlacklistedFunction func = {};
-    func.location = first_function_location;
-    func.mangled_name = mangled_function_name;
-    func.friendly_name = friendly_function_name;
-    func.reason = BlacklistedFunction::Reason::DuplicateName;
+      TypeNodeIdList root_node_list;
+      for (const auto &type_dependency : *function_record.referenced_types) {
+        TypeNodeId node_id;
+        if (L_isBlacklisted(type_dependency, node_id)) {
+          root_node_list.push_back(node_id);
+        }
+      }
 
-    BlacklistedFunction::DuplicateFunctionLocations locations = {};
+      if (!root_node_list.empty()) {
+        cause_source_index_list.push_back(index);
+        cause_source_root_list.push_back(std::move(root_node_list));
+      }
+    }
 
-    d->function_map.erase(first_function_decl);
+    if (!cause_source_index_list.empty()) {
+      component_graph =
+          condenseFlaggedNodes(type_dependency_graph, blacklisted_node_flags);
 
-    for (auto func_decl_list_it = function_decl_list.begin() + 1;
-         func_decl_list_it != function_decl_list.end(); func_decl_list_it++) {
-      const auto &next_func_decl = *func_decl_list_it;
-      d->function_map.erase(next_func_decl);
+      auto sweep_count =
+          (cause_source_index_list.size() + kCauseSourcesPerSweep - 1U) /
+          kCauseSourcesPerSweep;
 
-      auto next_func_location = getSourceCodeLocation(
-          *d->ast_context, *d->source_manager, next_func_decl);
-      locations.push_back(next_func_location);
+      L_runSlices(sweep_count, L_sweepCauseSources);
     }
 
-    func.reason_data = locations;
-    d->blacklisted_function_list.push_back(func);
+    for (const auto &p : shared_cause_list) {
+      bad_type_list_list[p.first] = bad_type_list_list[p.second];
+    }
   }
 
-  // Filter the remaining functions
-  for (const auto &p : d->function_map) {
-    const auto &function_decl = p.first;
-    const auto &type_dependencies = p.second;
+  // Records are saved by identity, so that the merge can blacklist the
+  // functions of the translation units that did not see their definition
+  auto L_saveFunctionPointerRecord = [&](TypeNodeId node_id) {
+    auto type = type_dependency_graph.type(node_id);
+    if (!llvm::isa<clang::RecordType>(type)) {
+      return;
+    }
 
-    auto mangled_function_name = getMangledFunctionName(function_decl);
-    auto friendly_function_name = getFriendlyFunctionName(function_decl);
+    auto insert_status = d->function_pointer_type_map.insert(
+        {getTypeIdentity(node_id),
+         BlacklistedFunction::FunctionPointerLocations()});
+
+    if (insert_status.second) {
+      collectTypeLocations(insert_status.first->second, type);
+    }
+  };
 
-    auto function_location = getSourceCodeLocation(
-        *d->ast_context, *d->source_manager, function_decl);
+  // The witness chains leave out most of the records; the merge needs all
+  // of the ones reachable from a blacklisted function, which a single visit
+  // shared by every function can list
+  if (!d->settings.full_blacklist_causes) {
+    std::vector<bool> visited_node_flags(node_count, false);
+    std::unordered_set<const TypeList *> visited_type_list_set;
+    std::queue<TypeNodeId> bad_type_queue;
+
+    for (const auto &p : sorted_function_list) {
+      const auto &referenced_types = p->second.referenced_types;
+      if (!visited_type_list_set.insert(referenced_types.get()).second) {
+        continue;
+      }
 
-    // Search for bad types (function pointers)
-    TypeList bad_type_list = {};
-    for (const auto &type_dependency : type_dependencies) {
-      if (blacklisted_type_list.count(type_dependency) != 0) {
-        bad_type_list.insert(type_dependency);
+      for (const auto &type_dependency : *referenced_types) {
+        TypeNodeId node_id;
+        if (L_isBlacklisted(type_dependency, node_id) &&
+            !visited_node_flags[node_id]) {
+          visited_node_flags[node_id] = true;
+          bad_type_queue.push(node_id);
+        }
       }
     }
 
-    // List all the types that are related to the function pointer we found
-    if (!bad_type_list.empty()) {
-      TypeList visited_types;
-      TypeList bad_type_queue = bad_type_list;
+    while (!bad_type_queue.empty()) {
+      auto node_id = bad_type_queue.front();
+      bad_type_queue.pop();
 
-      while (!bad_type_queue.empty()) {
-        TypeList pending_types = {};
+      L_saveFunctionPointerRecord(node_id);
 
-        for (const auto &bad_type : bad_type_queue) {
-          if (visited_types.count(bad_type) != 0U) {
-            continue;
-          }
+      for (auto child_node_id : type_dependency_graph.children(node_id)) {
+        if (blacklisted_node_flags[child_node_id] &&
+            !visited_node_flags[child_node_id]) {
+          visited_node_flags[child_node_id] = true;
+          bad_type_queue.push(child_node_id);
+        }
+      }
+    }
+  }
 
-          visited_types.insert(bad_type);
+  // Filter the remaining functions; the type locations are interned in the
+  // file path table, so this part is serial
+  for (std::size_t index = 0U; index < sorted_function_list.size(); ++index) {
+    const auto &function_decl = sorted_function_list[index]->first;
+    const auto &function_record = sorted_function_list[index]->second;
 
-          const auto &type_node_ref = d->type_dependency_tree.at(bad_type);
-          for (const auto &child_type : type_node_ref->children) {
-            if (blacklisted_type_list.count(child_type) == 0U) {
-              continue;
-            }
+    const auto &mangled_function_name = function_record.mangled_name;
+    const auto &alternate_mangled_function_name =
+        function_record.alternate_mangled_name;
+    const auto &friendly_function_name = function_record.friendly_name;
+    const auto &function_location = function_record.location;
 
-            pending_types.insert(child_type);
-          }
-        }
+    const auto &bad_type_list = bad_type_list_list[index];
 
-        bad_type_queue = pending_types;
-      }
+    if (function_record.early_rejection_reason) {
+      BlacklistedFunction func = {};
+      func.location = function_location;
+      func.friendly_name = friendly_function_name.str();
+      func.mangled_name = mangled_function_name.str();
+      func.alternate_mangled_name = alternate_mangled_function_name.str();
+      func.reason = *function_record.early_rejection_reason;
 
-      bad_type_list = visited_types;
+      d->blacklisted_function_list.push_back(func);
+      continue;
+    }
 
+    if (!bad_type_list.empty()) {
       BlacklistedFunction func = {};
       func.location = function_location;
-      func.friendly_name = friendly_function_name;
-      func.mangled_name = mangled_function_name;
+      func.friendly_name = friendly_function_name.str();
+      func.mangled_name = mangled_function_name.str();
+      func.alternate_mangled_name = alternate_mangled_function_name.str();
       func.reason = BlacklistedFunction::Reason::FunctionPointer;
 
       BlacklistedFunction::FunctionPointerLocations bad_type_locs = {};
 
       for (const auto &bad_type : bad_type_list) {
-        std::string type_name;
-        SourceCodeLocation type_location;
-        if (!getTypeInformation(type_name, type_location, bad_type)) {
-          continue;
-        } else {
-          bad_type_locs.push_back(std::make_pair(type_location, type_name));
+        collectTypeLocations(bad_type_locs, bad_type);
+
+        TypeNodeId node_id;
+        if (d->settings.full_blacklist_causes &&
+            type_dependency_graph.findNode(node_id, bad_type)) {
+          L_saveFunctionPointerRecord(node_id);
         }
       }
 
@@ -663,23 +2868,15 @@ void ASTVisitor::finalize() {
       continue;
     }
 
-    if (function_decl->isVariadic()) {
-      BlacklistedFunction func = {};
-      func.location = function_location;
-      func.friendly_name = friendly_function_name;
-      func.mangled_name = mangled_function_name;
-      func.reason = BlacklistedFunction::Reason::Variadic;
-
-      d->blacklisted_function_list.push_back(func);
-      continue;
-    }
-
-    if (function_decl->isTemplated()) {
+    if (d->settings.exported_symbols &&
+        d->settings.exported_symbols->count(mangled_function_name.str()) ==
+            0U) {
       BlacklistedFunction func = {};
       func.location = function_location;
-      func.friendly_name = friendly_function_name;
-      func.mangled_name = mangled_function_name;
-      func.reason = BlacklistedFunction::Reason::Templated;
+      func.friendly_name = friendly_function_name.str();
+      func.mangled_name = mangled_function_name.str();
+      func.alternate_mangled_name = alternate_mangled_function_name.str();
+      func.reason = BlacklistedFunction::Reason::NotExported;
 
       d->blacklisted_function_list.push_back(func);
       continue;
@@ -687,11 +2884,69 @@ void ASTVisitor::finalize() {
 
     WhitelistedFunction func = {};
     func.location = function_location;
-    func.friendly_name = friendly_function_name;
-    func.mangled_name = mangled_function_name;
+    func.friendly_name = friendly_function_name.str();
+    func.mangled_name = mangled_function_name.str();
+    func.alternate_mangled_name = alternate_mangled_function_name.str();
+    describePrototype(func, function_decl);
+    func.opaque_type_list =
+        L_collectOpaqueTypes(*function_record.referenced_types);
 
     d->whitelisted_function_list.push_back(func);
+    d->whitelisted_function_decl_list.push_back(function_decl);
   }
+
+  if (d->settings.time_report) {
+    reportHeaderCosts();
+  }
+
+  // The merge sorts its own output
+  if (d->settings.analysis_cache) {
+    mergeCachedResults();
+    return;
+  }
+
+  // The duplicates have been blacklisted first, and the locations of the
+  // bad types have been collected from unordered sets
+  sortFunctionLists(d->blacklisted_function_list,
+                    d->whitelisted_function_list,
+                    d->file_path_table.file_path_list);
+}
+
+void ASTVisitor::reportHeaderCosts() {
+  const auto &type_dependency_graph = d->type_dependency_graph;
+
+  auto node_count = static_cast<TypeNodeId>(type_dependency_graph.nodeCount());
+  for (TypeNodeId node_id = 0U; node_id < node_count; ++node_id) {
+    auto tag_declaration = type_dependency_graph.type(node_id)->getAsTagDecl();
+    if (tag_declaration != nullptr) {
+      ++d->header_cost_map[getDeclarationFile(tag_declaration)]
+            .type_node_count;
+    }
+  }
+
+  // The costs of the functions declared in the main buffer are not reported
+  std::unordered_map<std::string, HeaderCost> path_cost_map;
+  for (const auto &p : d->header_cost_map) {
+    if (p.first != nullptr) {
+      path_cost_map[std::string(p.first->getName())] += p.second;
+    }
+  }
+
+  const auto &file_path_list = d->file_path_table.file_path_list;
+  for (const auto &function : d->blacklisted_function_list) {
+    if (function.location.file_id < file_path_list.size()) {
+      const auto &file_path = file_path_list[function.location.file_id];
+      if (file_path != "main.cpp") {
+        ++path_cost_map[file_path].blacklisted_function_count;
+      }
+    }
+  }
+
+  for (const auto &p : path_cost_map) {
+    d->settings.time_report->addHeaderCost(p.first, p.second);
+  }
+
+  d->header_cost_map.clear();
 }
 
 BlacklistedFunctionList ASTVisitor::blacklistedFunctions() const {
@@ -701,3 +2956,33 @@ BlacklistedFunctionList ASTVisitor::blacklistedFunctions() const {
 WhitelistedFunctionList ASTVisitor::whitelistedFunctions() const {
   return d->whitelisted_function_list;
 }
+
+std::vector<clang::FunctionDecl *> ASTVisitor::whitelistedFunctionDeclarations()
+    const {
+  return d->whitelisted_function_decl_list;
+}
+
+StringList ASTVisitor::filePathList() const {
+  return d->file_path_table.file_path_list;
+}
+
+void ASTVisitor::takeResults(ABILibrary &abi_library) {
+  abi_library.blacklisted_function_list =
+      std::move(d->blacklisted_function_list);
+
+  abi_library.whitelisted_function_list =
+      std::move(d->whitelisted_function_list);
+
+  abi_library.function_pointer_type_map =
+      std::move(d->function_pointer_type_map);
+
+  abi_library.file_path_list = std::move(d->file_path_table.file_path_list);
+  abi_library.file_include_line_list =
+      std::move(d->file_path_table.include_line_list);
+
+  d->blacklisted_function_list.clear();
+  d->whitelisted_function_list.clear();
+  d->whitelisted_function_decl_list.clear();
+  d->function_pointer_type_map.clear();
+  d->file_path_table = {};
+}
@@ -1,23 +1,129 @@
 #pragma once
 
+#include "analysis_cache.h"
+#include "binary_symbols.h"
 #include "compilerinstance.h"
+#include "function_filter.h"
 #include "istatus.h"
+#include "time_report.h"
+#include "type_dependency_graph.h"
+#include "type_summary.h"
 #include "types.h"
+#include "visitor_statistics.h"
 
 #include <memory>
-#include <unordered_set>
+#include <queue>
 
 #include <clang/AST/Mangle.h>
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/StringRef.h>
 
-/// A list of classes, used when enumerating base classes
-using ClassList = std::unordered_set<clang::CXXRecordDecl *>;
+/// A list of classes, used when enumerating base classes. These lists are
+/// built for every class and type that is expanded, and they usually hold a
+/// handful of pointers; the small sets keep them inline, without a node
+/// allocation per element
+using ClassList = llvm::SmallPtrSet<clang::CXXRecordDecl *, 4>;
 
 /// A list of method, used when acquiring the method list of a class hierarchy
-using MethodList = std::unordered_set<clang::CXXMethodDecl *>;
+using MethodList = llvm::SmallPtrSet<clang::CXXMethodDecl *, 16>;
 
 /// A list of correlated types
-using TypeList = std::unordered_set<const clang::Type *>;
+using TypeList = llvm::SmallPtrSet<const clang::Type *, 8>;
+
+/// A reference to a shared type list
+using TypeListRef = std::shared_ptr<const TypeList>;
+
+/// Settings for the AST visitor
+struct ASTVisitorSettings final {
+  /// If true, type dependencies are not expanded while visiting the
+  /// functions; finalize() only expands the types it needs to decide whether
+  /// a function can reach a function type, and stops at the first one found.
+  /// The cause list of a blacklisted function may then be incomplete, but it
+  /// always contains at least one path to a function type
+  bool lazy_type_expansion{false};
+
+  /// If true, functions sharing the same mangled name are not blacklisted
+  /// by finalize(); used when the results of several visitors are merged
+  /// with mergeAnalysisShards()
+  bool defer_duplicate_detection{false};
+
+  /// If true, the redeclarations of a function are merged into a single
+  /// entry, keyed on the canonical declaration and located at the first
+  /// explicit declaration; only distinct functions sharing the same mangled
+  /// name are blacklisted as duplicates. When false, each redeclaration is
+  /// recorded and reported on its own
+  bool merge_redeclarations{true};
+
+  /// If set, only the functions whose mangled name is in this set are
+  /// analyzed; the other ones are neither whitelisted nor blacklisted
+  SymbolNameSetRef imported_symbols;
+
+  /// If set, the functions that would be whitelisted but whose mangled name
+  /// is not in this set are blacklisted as NotExported
+  SymbolNameSetRef exported_symbols;
+
+  /// If set, the functions rejected by this filter are skipped before their
+  /// classes and types are expanded; they are neither whitelisted nor
+  /// blacklisted
+  FunctionNameFilterRef function_filter;
+
+  /// If set, the records defined in the system headers that are listed in
+  /// this summary are not expanded, and their reachability is taken from
+  /// it. The cause list of a blacklisted function then stops at the
+  /// summarized records
+  TypeSummaryRef type_summary;
+
+  /// If set, no function is analyzed; finalize() fills this summary with the
+  /// records defined in the system headers of the translation unit
+  std::shared_ptr<TypeSummary> type_summary_output;
+
+  /// If set, the functions located in a header whose results are in this
+  /// cache are not analyzed; finalize() merges the cached results with the
+  /// new ones (detecting duplicates across all of them) and saves the results
+  /// of the headers that have been analyzed. The whitelisted declarations
+  /// then only cover the functions that have been analyzed
+  AnalysisCacheRef analysis_cache;
+
+  /// How many threads finalize() uses to collect the types that cause each
+  /// function to be blacklisted; the results do not depend on this value
+  std::size_t finalize_threads{1U};
+
+  /// If true, a blacklisted function reports every blacklisted type it can
+  /// reach. Otherwise, finalize() only reports the shortest chain of types
+  /// leading from one of its parameters (or class members) to a function
+  /// type, which is much cheaper to compute on large libraries
+  bool full_blacklist_causes{false};
+
+  /// If greater than one, the type dependencies of the functions are not
+  /// enumerated while the declarations are visited; finalize() expands all
+  /// of them on this many threads, and then builds the graph in the order
+  /// the types have been queued, so the graph does not depend on this value.
+  /// Ignored in lazy mode, and when the AST has an external source (such as
+  /// a precompiled header), since clang may then deserialize declarations
+  /// while they are being read
+  std::size_t type_expansion_threads{1U};
+
+  /// If true, the functions are visited while the translation unit is
+  /// parsed, as each top-level declaration is completed. In lazy mode, the
+  /// reachability of their types, and of each record whose definition is
+  /// completed later on, is computed right away; finalize() then only has
+  /// to answer the queries that depended on records that were still
+  /// incomplete. The other modes expand the types in finalize(), as the
+  /// multithreaded expansion does. Ignored when the AST has an external
+  /// source, since its declarations are never passed to the consumer
+  bool analyze_while_parsing{false};
+
+  /// The language of the translation units; the C visitor skips the class,
+  /// method and C++ mangling checks altogether
+  Language language{Language::CXX};
+
+  /// If set, the time spent in finalize() is added to this report
+  TimeReportRef time_report;
+
+  /// If set, finalize() adds the counters of the visitor to this object
+  VisitorStatisticsRef statistics;
+};
 
 /// This class is used to receive events from the AST
 class ASTVisitor final : public IASTVisitor {
@@ -27,7 +133,7 @@ class ASTVisitor final : public IASTVisitor {
   std::unique_ptr<PrivateData> d;
 
   /// Private constructor; use ::create() instead
-  ASTVisitor();
+  ASTVisitor(const ASTVisitorSettings &settings);
 
   /// Returns true if the given function declaration is in fact a method
   bool isClassMethod(clang::FunctionDecl *decl);
@@ -41,32 +147,189 @@ class ASTVisitor final : public IASTVisitor {
   /// Returns all the methods contained in the given class list
   MethodList collectClassMethods(const ClassList &class_list);
 
-  /// Returns all the types used by the methods of the given classes
-  TypeList collectClassMemberTypes(const ClassList &class_list);
+  /// Adds all the types used by the methods of the given classes to the type
+  /// list
+  void collectClassMemberTypes(TypeList &type_list,
+                               const ClassList &class_list);
+
+  /// Adds all the types used in the member variables of the given class to
+  /// the type list
+  void collectRecordMemberTypes(TypeList &type_list, clang::RecordDecl *decl);
 
-  /// Returns all the types used in the member variables of the given class
-  TypeList collectRecordMemberTypes(clang::RecordDecl *decl);
+  /// Adds the types passed to the function or method to the type list
+  void collectFunctionParameterTypes(TypeList &type_list,
+                                     clang::FunctionDecl *decl);
 
-  /// Returns the types passed to the function or method
-  TypeList collectFunctionParameterTypes(clang::FunctionDecl *decl);
+  /// Returns the member and method parameter types of the given class and
+  /// its bases. Results are cached for the whole translation unit; created is
+  /// set to true when the class is expanded for the first time
+  TypeListRef collectClassReferencedTypes(clang::CXXRecordDecl *decl,
+                                          bool &created);
+
+  /// Returns the shared copy of the given parameter type list; functions
+  /// taking the same set of canonical types get the same list. Created is
+  /// set to true when the list is seen for the first time
+  TypeListRef getSignatureTypeList(const TypeList &type_list, bool &created);
+
+  /// Replaces the contents of the given list with the types directly
+  /// referenced by the given type; callers reuse the same list, so that its
+  /// storage is only allocated once. The member templates taking a
+  /// LanguagePolicy are instantiated once for C and once for C++; the C
+  /// instantiation compiles the class handling out
+  template <typename LanguagePolicy>
+  void collectTypeChildren(TypeList &type_children, const clang::Type *type);
+
+  /// Returns true if the given type is a record listed in the type summary;
+  /// reachable is then set to true if it can reach a function type. Results
+  /// are memoized for the whole translation unit
+  bool isSummarizedType(const clang::Type *type, bool &reachable);
+
+  /// Returns true if the given type is a function type, or a summarized
+  /// record that can reach one
+  bool isTaintedType(const clang::Type *type);
+
+  /// Fills the type summary output with the records defined in the system
+  /// headers of the translation unit
+  template <typename LanguagePolicy>
+  void buildTypeSummary();
 
   /// Descends into the given type list, enumerating all child types
+  template <typename LanguagePolicy>
   void enumerateTypeDependencies(const TypeList &root_type_list);
 
+  /// Enumerates the dependencies of the given types, or queues them for
+  /// finalize() when the types are expanded on multiple threads
+  template <typename LanguagePolicy>
+  void queueTypeDependencies(const TypeList &root_type_list);
+
+  /// Expands the queued types on multiple threads, and then adds them to the
+  /// type dependency graph
+  template <typename LanguagePolicy>
+  void enumerateQueuedTypeDependencies();
+
   /// Descends into the given type, enumerating all child types
+  template <typename LanguagePolicy>
   void enumerateTypeDependencies(const clang::Type *root_type);
 
-  /// Returns the mangled name for the given function
-  std::string getMangledFunctionName(clang::FunctionDecl *function_declaration);
+  /// Adds the children of the given node to the graph, queueing the ones
+  /// that are new. When stop_at_tainted_child is true, a record with a
+  /// tainted child only gets that child, and is flagged as truncated
+  template <typename LanguagePolicy>
+  void expandNodeChildren(TypeNodeId node_id, std::queue<TypeNodeId> &queue,
+                          bool stop_at_tainted_child);
+
+  /// Expands the rest of the truncated records that are reachable from the
+  /// blacklisted functions through blacklisted nodes, so that their cause
+  /// list is complete. Returns false if there was nothing to expand; the
+  /// graph has to be finalized again otherwise
+  template <typename LanguagePolicy>
+  bool expandTruncatedNodes(const std::vector<bool> &blacklisted_node_flags);
+
+  /// Returns the children of the given node, expanding it first if it has
+  /// not been expanded yet; used by the lazy mode
+  template <typename LanguagePolicy>
+  const TypeNodeIdList &expandTypeNode(TypeNodeId node_id);
+
+  /// Returns true if the given node can reach a function type, expanding
+  /// only the nodes that are needed. Results are memoized for every node
+  /// that is visited; used by the lazy mode. When parsing is true, the
+  /// records without a definition are not expanded, as they may still get
+  /// one, and the nodes that depend on them are not memoized unless they
+  /// can reach a function type anyway
+  template <typename LanguagePolicy>
+  bool reachesFunctionType(TypeNodeId root_node_id, bool parsing = false);
+
+  /// Answers the reachability query of the given types with the
+  /// declarations parsed so far; used when analyzing while parsing
+  template <typename LanguagePolicy>
+  void precomputeReachability(const TypeList &type_list);
+
+  /// Expands the types referenced by each function, answering their
+  /// reachability query; used by the lazy mode
+  template <typename LanguagePolicy>
+  void expandReferencedTypes();
+
+  /// Implements finalize(); the counters are published by the caller
+  void finalizeAnalysis();
+
+  /// Implements VisitFunctionDecl() for the given language
+  template <typename LanguagePolicy>
+  bool visitFunctionDecl(clang::FunctionDecl *declaration);
+
+  /// Moves the functions sharing the same mangled name from the function map
+  /// to the blacklist; the first function of each group in source order is
+  /// the one that is reported. The ranks come from rankFilePaths()
+  void blacklistDuplicateFunctions(
+      const std::vector<std::size_t> &file_rank_list);
+
+  /// Returns the source code location for the given declaration
+  SourceCodeLocation getDeclarationLocation(const clang::Decl *declaration);
+
+  /// Returns the file containing the given declaration, or nullptr if it is
+  /// the main file
+  const clang::FileEntry *getDeclarationFile(const clang::Decl *declaration);
+
+  /// Returns true if the results of the functions located in the given file
+  /// have been loaded from the analysis cache; each file is only looked up
+  /// once
+  bool isCachedFile(const clang::FileEntry *file_entry);
 
-  /// Returns the friendly (i.e.: unmangled) function name
-  std::string getFriendlyFunctionName(
+  /// Returns the files the results of the given header depend on: the header
+  /// itself, the headers it has been included through, the headers it
+  /// includes and the ones declaring the types reachable from the given
+  /// roots. Returns false if one of those types is incomplete, as the header
+  /// declaring it later on can't be known
+  bool collectFileDependencies(StringList &dependency_list,
+                               const clang::FileEntry *file_entry,
+                               const TypeList &root_type_list);
+
+  /// Saves the results of the headers that have been analyzed to the
+  /// analysis cache, and merges the cached results of the other ones
+  void mergeCachedResults();
+
+  /// Attributes the visited functions, the type graph nodes and the
+  /// blacklisted functions to the headers declaring them, and adds them to
+  /// the time report
+  void reportHeaderCosts();
+
+  /// Returns a copy of the given string from the string pool; the returned
+  /// reference is valid until the next initialize() call
+  llvm::StringRef internString(llvm::StringRef str);
+
+  /// Returns the name of the given function, mangled with the specified
+  /// mangler; the name is interned
+  template <typename LanguagePolicy>
+  llvm::StringRef getMangledFunctionName(
+      clang::FunctionDecl *function_declaration,
+      clang::MangleContext *name_mangler);
+
+  /// Returns the friendly (i.e.: unmangled) function name; the name is
+  /// interned
+  template <typename LanguagePolicy>
+  llvm::StringRef getFriendlyFunctionName(
       clang::FunctionDecl *function_declaration);
 
-  /// Returns name and location for the given type
-  bool getTypeInformation(std::string &type_name,
-                          SourceCodeLocation &type_location,
-                          const clang::Type *type);
+  /// Records a spelling of the given canonical type, along with the
+  /// declaration using it; spellings that have already been recorded are
+  /// ignored
+  void addTypeSpelling(const clang::Type *type, clang::QualType spelled_type,
+                       const clang::Decl *declaration);
+
+  /// Returns the identity of the given node, computing it the first time;
+  /// the identity is the hash of the canonical spelling, which is the same
+  /// in every translation unit
+  TypeIdentity getTypeIdentity(TypeNodeId node_id);
+
+  /// Computes the identity of the given canonical type, without storing it
+  /// in the graph; see getTypeIdentity()
+  TypeIdentity computeTypeIdentity(const clang::Type *type);
+
+  /// Appends the recorded spellings of the given canonical type, along with
+  /// their locations, to the given list; names and locations are computed
+  /// here, as only the blacklisted types are ever reported
+  void collectTypeLocations(
+      BlacklistedFunction::FunctionPointerLocations &type_location_list,
+      const clang::Type *type);
 
  public:
   /// Status code, used with ASTVisitor::Status
@@ -76,20 +339,26 @@ class ASTVisitor final : public IASTVisitor {
   using Status = IStatus<StatusCode>;
 
   /// Factory method
-  static Status create(IASTVisitorRef &ref);
+  static Status create(IASTVisitorRef &ref,
+                       const ASTVisitorSettings &settings = {});
 
   /// Destructor
   virtual ~ASTVisitor();
 
   /// This method is called when entering a new translation unit
-  virtual void initialize(clang::ASTContext *ast_context,
-                          clang::SourceManager *source_manager,
-                          clang::MangleContext *name_mangler) override;
+  virtual void initialize(
+      clang::ASTContext *ast_context, clang::SourceManager *source_manager,
+      clang::MangleContext *name_mangler,
+      clang::MangleContext *alternate_name_mangler) override;
 
   /// This method is called each time a new function (or method) declaration is
   /// found
   virtual bool VisitFunctionDecl(clang::FunctionDecl *declaration) override;
 
+  /// This method is called each time a record definition is completed,
+  /// while the translation unit is parsed
+  virtual void VisitRecordDefinition(clang::RecordDecl *declaration) override;
+
   /// Called after the last AST callback
   virtual void finalize() override;
 
@@ -98,4 +367,15 @@ class ASTVisitor final : public IASTVisitor {
 
   /// Returns the whitelisted functions
   virtual WhitelistedFunctionList whitelistedFunctions() const override;
+
+  /// Returns the declarations of the whitelisted functions
+  virtual std::vector<clang::FunctionDecl *> whitelistedFunctionDeclarations()
+      const override;
+
+  /// Returns the file paths referenced by the function locations
+  virtual StringList filePathList() const override;
+
+  /// Moves the function lists and the file path list into the given ABI
+  /// library
+  virtual void takeResults(ABILibrary &abi_library) override;
 };
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "command_runner.h"
+#include "output_capture.h"
+#include "resident_state.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <json11.hpp>
+
+namespace {
+/// The state of a batch job
+enum class BatchJobState { Pending, Running, Succeeded, Failed, Skipped };
+
+/// A single command of the batch manifest
+struct BatchJob final {
+  /// The job name, used in the output and to express the dependencies
+  std::string name;
+
+  /// The command line, without the program name
+  StringList argument_list;
+
+  /// The indexes of the jobs that must succeed before this one can start
+  std::vector<std::size_t> dependency_list;
+
+  /// The current state
+  BatchJobState state{BatchJobState::Pending};
+};
+
+/// A list of batch jobs
+using BatchJobList = std::vector<BatchJob>;
+
+/// Formats the given amount of seconds; the flags of the shared output
+/// streams are left untouched, since other threads may be using them
+std::string formatSeconds(double seconds) {
+  std::stringstream buffer;
+  buffer << std::fixed << std::setprecision(2) << seconds << "s";
+  return buffer.str();
+}
+
+/// Loads the given manifest file. The manifest contains a "jobs" array; each
+/// job has a unique "name", the "arguments" of the abigen command to execute
+/// and an optional "depends_on" list with the names of the jobs that must
+/// have succeeded before it is started (i.e.: to compile the output of a
+/// generate job)
+bool loadBatchManifest(BatchJobList &job_list, std::string &error,
+                       const std::string &path) {
+  job_list.clear();
+  error.clear();
+
+  std::ifstream manifest_file(path);
+  if (!manifest_file) {
+    error = "Failed to open the manifest file";
+    return false;
+  }
+
+  std::string json_manifest((std::istreambuf_iterator<char>(manifest_file)),
+                            std::istreambuf_iterator<char>());
+
+  std::string error_messages;
+  const auto json = json11::Json::parse(json_manifest, error_messages);
+  if (!error_messages.empty() || !json["jobs"].is_array()) {
+    error = "The manifest must be a JSON object with a \"jobs\" array";
+    return false;
+  }
+
+  std::unordered_map<std::string, std::size_t> job_index_map;
+
+  for (const auto &item : json["jobs"].array_items()) {
+    if (!item["name"].is_string() || !item["arguments"].is_array()) {
+      error = "Each job must have a \"name\" and an \"arguments\" list";
+      return false;
+    }
+
+    BatchJob job;
+    job.name = item["name"].string_value();
+
+    for (const auto &argument : item["arguments"].array_items()) {
+      if (!argument.is_string()) {
+        error = "The arguments of the job " + job.name + " must be strings";
+        return false;
+      }
+
+      job.argument_list.push_back(argument.string_value());
+    }
+
+    if (!job_index_map.insert({job.name, job_list.size()}).second) {
+      error = "The job name " + job.name + " is used more than once";
+      return false;
+    }
+
+    job_list.push_back(std::move(job));
+  }
+
+  // Resolve the dependencies once all the names are known, so that the jobs
+  // can be listed in any order
+  for (std::size_t i = 0U; i < job_list.size(); ++i) {
+    const auto &item = json["jobs"].array_items().at(i);
+
+    for (const auto &dependency : item["depends_on"].array_items()) {
+      auto it = job_index_map.find(dependency.string_value());
+      if (it == job_index_map.end()) {
+        error = "The job " + job_list.at(i).name +
+                " depends on an unknown job: " + dependency.string_value();
+        return false;
+      }
+
+      job_list.at(i).dependency_list.push_back(it->second);
+    }
+  }
+
+  return true;
+}
+}  // namespace
+
+/// Handler for the 'batch' command
+bool batchCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options) {
+  BatchJobList job_list;
+  std::string error;
+  if (!loadBatchManifest(job_list, error, cmdline_options.manifest_path)) {
+    std::cerr << error << ": " << cmdline_options.manifest_path << "\n";
+    return false;
+  }
+
+  ResidentStateRef resident_state;
+  auto status = ResidentState::create(resident_state,
+                                      cmdline_options.state_directory);
+  if (!status.succeeded()) {
+    std::cerr << status.toString() << "\n";
+    return false;
+  }
+
+  auto worker_count = std::min(cmdline_options.jobs, job_list.size());
+  std::cout << "Executing " << job_list.size() << " jobs, up to "
+            << worker_count << " at a time\n";
+
+  std::mutex job_list_mutex;
+  std::condition_variable job_list_cv;
+  std::size_t running_job_count{0U};
+
+  auto batch_start_time = std::chrono::steady_clock::now();
+
+  // Each job writes to its own buffer, which is printed as a whole once the
+  // job has finished
+  ScopedOutputCapture output_capture;
+
+  // Returns the index of a job that can be started, or job_list.size() when
+  // all the jobs have been started. Jobs depending on a failed job are
+  // skipped; the lock must be held
+  auto L_nextJob = [&](std::unique_lock<std::mutex> &lock) -> std::size_t {
+    for (;;) {
+      bool pending_job_found = false;
+      bool job_skipped = false;
+
+      for (std::size_t i = 0U; i < job_list.size(); ++i) {
+        auto &job = job_list.at(i);
+        if (job.state != BatchJobState::Pending) {
+          continue;
+        }
+
+        bool ready = true;
+        bool skip = false;
+
+        for (auto dependency : job.dependency_list) {
+          auto dependency_state = job_list.at(dependency).state;
+
+          if (dependency_state == BatchJobState::Failed ||
+              dependency_state == BatchJobState::Skipped) {
+            skip = true;
+            break;
+          }
+
+          if (dependency_state != BatchJobState::Succeeded) {
+            ready = false;
+          }
+        }
+
+        if (skip) {
+          job.state = BatchJobState::Skipped;
+          job_skipped = true;
+
+          std::cout << "==> " << job.name
+                    << ": skipped, a dependency has failed\n";
+          continue;
+        }
+
+        if (ready) {
+          return i;
+        }
+
+        pending_job_found = true;
+      }
+
+      if (!pending_job_found) {
+        return job_list.size();
+      }
+
+      // The remaining jobs are waiting for each other
+      if (running_job_count == 0U && !job_skipped) {
+        for (auto &job : job_list) {
+          if (job.state == BatchJobState::Pending) {
+            job.state = BatchJobState::Skipped;
+
+            std::cout << "==> " << job.name
+                      << ": skipped, its dependencies form a cycle\n";
+          }
+        }
+
+        return job_list.size();
+      }
+
+      if (!job_skipped) {
+        job_list_cv.wait(lock);
+      }
+    }
+  };
+
+  auto L_worker = [&]() {
+    std::unique_lock<std::mutex> lock(job_list_mutex);
+
+    for (;;) {
+      auto job_index = L_nextJob(lock);
+      if (job_index >= job_list.size()) {
+        break;
+      }
+
+      auto &job = job_list.at(job_index);
+      job.state = BatchJobState::Running;
+      ++running_job_count;
+
+      lock.unlock();
+
+      auto start_time = std::chrono::steady_clock::now();
+
+      std::string output;
+      ScopedOutputCapture::setThreadOutput(&output);
+
+      bool succeeded = false;
+
+      try {
+        succeeded = runCommandLine(profile_manager, language_manager,
+                                   resident_state, job.argument_list);
+
+      } catch (const std::exception &exception) {
+        output += std::string("Unhandled exception: ") + exception.what() +
+                  "\n";
+      }
+
+      ScopedOutputCapture::setThreadOutput(nullptr);
+
+      std::chrono::duration<double> elapsed_time =
+          std::chrono::steady_clock::now() - start_time;
+
+      lock.lock();
+
+      job.state = succeeded ? BatchJobState::Succeeded : BatchJobState::Failed;
+      --running_job_count;
+
+      std::cout << "==> " << job.name << ": "
+                << (succeeded ? "succeeded" : "failed") << " in "
+                << formatSeconds(elapsed_time.count()) << "\n"
+                << output << std::flush;
+
+      job_list_cv.notify_all();
+    }
+
+    job_list_cv.notify_all();
+  };
+
+  std::vector<std::thread> thread_list;
+  for (std::size_t i = 1U; i < worker_count; ++i) {
+    thread_list.emplace_back(L_worker);
+  }
+
+  L_worker();
+
+  for (auto &thread : thread_list) {
+    thread.join();
+  }
+
+  std::size_t succeeded_job_count = 0U;
+  std::size_t failed_job_count = 0U;
+  std::size_t skipped_job_count = 0U;
+
+  for (const auto &job : job_list) {
+    if (job.state == BatchJobState::Succeeded) {
+      ++succeeded_job_count;
+
+    } else if (job.state == BatchJobState::Failed) {
+      ++failed_job_count;
+
+    } else {
+      ++skipped_job_count;
+    }
+  }
+
+  std::chrono::duration<double> batch_elapsed_time =
+      std::chrono::steady_clock::now() - batch_start_time;
+
+  std::cout << "\n"
+            << succeeded_job_count << " jobs succeeded, " << failed_job_count
+            << " failed, " << skipped_job_count << " skipped in "
+            << formatSeconds(batch_elapsed_time.count())
+            << "; the precompiled base includes have been reused "
+            << resident_state->precompiledHeaderHitCount() << " times\n";
+
+  return failed_job_count == 0U && skipped_job_count == 0U;
+}
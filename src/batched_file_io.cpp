@@ -0,0 +1,876 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "batched_file_io.h"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Minimal builds leave io_uring out; see the ABIGEN_ENABLE_IO_URING CMake
+// option
+#if !defined(ABIGEN_IO_URING)
+#define ABIGEN_IO_URING 1
+#endif
+
+// clang-format off
+#if ABIGEN_IO_URING && defined(__linux__) && __has_include(<linux/io_uring.h>)
+  #include <linux/io_uring.h>
+  #include <sys/mman.h>
+  #include <sys/syscall.h>
+  #include <sys/sysmacros.h>
+
+  #if !defined(STATX_BASIC_STATS)
+    #include <linux/stat.h>
+  #endif
+
+  // The operations used below, and the probe that checks for them, have
+  // been added by Linux 5.6; older headers lack the macro
+  #if defined(IO_URING_OP_SUPPORTED) && defined(__NR_io_uring_setup)
+    #define ABIGEN_HAS_IO_URING
+  #endif
+#endif
+// clang-format on
+
+namespace {
+/// The size of the buffer used to read ahead the files where the kernel
+/// can't be asked to do it
+const std::size_t kReadAheadBufferSize = 65536U;
+
+/// Converts the output of stat() to a BatchedFileStatus
+BatchedFileStatus convertFileStatus(const struct stat &file_status) {
+#if defined(__APPLE__)
+  const auto &modification_time = file_status.st_mtimespec;
+#else
+  const auto &modification_time = file_status.st_mtim;
+#endif
+
+  BatchedFileStatus status;
+  status.mode = static_cast<std::uint32_t>(file_status.st_mode);
+  status.user_id = static_cast<std::uint32_t>(file_status.st_uid);
+  status.group_id = static_cast<std::uint32_t>(file_status.st_gid);
+  status.size = static_cast<std::uint64_t>(file_status.st_size);
+  status.modification_time_sec =
+      static_cast<std::int64_t>(modification_time.tv_sec);
+  status.modification_time_nsec =
+      static_cast<std::uint32_t>(modification_time.tv_nsec);
+  status.device = static_cast<std::uint64_t>(file_status.st_dev);
+  status.inode = static_cast<std::uint64_t>(file_status.st_ino);
+
+  return status;
+}
+
+/// Reads the status of the given file with stat()
+BatchedFileStatus statFile(const std::string &path) {
+  struct stat file_status = {};
+  if (stat(path.c_str(), &file_status) != 0) {
+    BatchedFileStatus status;
+    status.error = errno;
+    return status;
+  }
+
+  return convertFileStatus(file_status);
+}
+
+/// Reads the given file into the buffer, starting at the specified offset;
+/// the buffer is shrunk if the file ends before it is full
+bool readFileDescriptor(std::string &buffer, int file_descriptor,
+                        std::size_t offset) {
+  while (offset < buffer.size()) {
+    auto read_size = pread(file_descriptor, &buffer[offset],
+                           buffer.size() - offset, static_cast<off_t>(offset));
+
+    if (read_size < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      return false;
+    }
+
+    if (read_size == 0) {
+      buffer.resize(offset);
+      break;
+    }
+
+    offset += static_cast<std::size_t>(read_size);
+  }
+
+  return true;
+}
+
+/// Reads the contents of the given regular file with the blocking calls
+bool readFileContents(std::string &contents, const std::string &path) {
+  contents.clear();
+
+  auto file_descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_descriptor < 0) {
+    return false;
+  }
+
+  struct stat file_status = {};
+  bool succeeded = fstat(file_descriptor, &file_status) == 0 &&
+                   S_ISREG(file_status.st_mode);
+
+  if (succeeded) {
+    contents.resize(static_cast<std::size_t>(file_status.st_size));
+    succeeded = readFileDescriptor(contents, file_descriptor, 0U);
+  }
+
+  close(file_descriptor);
+  return succeeded;
+}
+
+/// Reads ahead the given file with the blocking calls; returns false if it is
+/// not a regular file, or if it could not be opened
+bool readAheadFile(BatchedFileStatus &status, const std::string &path,
+                   std::uint64_t max_file_size) {
+  auto file_descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (file_descriptor < 0) {
+    status = statFile(path);
+    return false;
+  }
+
+  struct stat file_status = {};
+  if (fstat(file_descriptor, &file_status) != 0) {
+    close(file_descriptor);
+
+    status = statFile(path);
+    return false;
+  }
+
+  status = convertFileStatus(file_status);
+  if (!status.isRegularFile()) {
+    close(file_descriptor);
+    return false;
+  }
+
+  if (status.size <= max_file_size) {
+#if defined(__linux__)
+    // The kernel reads the file asynchronously
+    posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_WILLNEED);
+#else
+    char buffer[kReadAheadBufferSize];
+    while (::read(file_descriptor, buffer, sizeof(buffer)) > 0) {
+    }
+#endif
+  }
+
+  close(file_descriptor);
+  return true;
+}
+
+#if defined(ABIGEN_HAS_IO_URING)
+/// How many submission queue entries each ring has
+const unsigned kRingEntryCount = 64U;
+
+/// Marks the operations that have not completed
+const int kIncompleteResult = INT_MIN;
+
+/// Linked reads are limited to this size; larger files are read with the
+/// blocking calls
+const std::uint64_t kMaxRingReadSize = 1U << 30;
+
+/// The operations that the BatchedFileReader submits
+const std::array<std::uint8_t, 5U> kRequiredOperationList = {
+    IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_FADVISE,
+    IORING_OP_CLOSE};
+
+/// Converts the output of statx() to a BatchedFileStatus
+BatchedFileStatus convertFileStatus(const struct statx &file_status) {
+  BatchedFileStatus status;
+  status.mode = file_status.stx_mode;
+  status.user_id = file_status.stx_uid;
+  status.group_id = file_status.stx_gid;
+  status.size = file_status.stx_size;
+  status.modification_time_sec =
+      static_cast<std::int64_t>(file_status.stx_mtime.tv_sec);
+  status.modification_time_nsec = file_status.stx_mtime.tv_nsec;
+  status.device =
+      static_cast<std::uint64_t>(makedev(file_status.stx_dev_major,
+                                         file_status.stx_dev_minor));
+  status.inode = file_status.stx_ino;
+
+  return status;
+}
+
+/// A minimal io_uring instance, set up with the raw system calls so that no
+/// library is needed. Each submission waits for all of its operations
+class IoUring final {
+  /// The ring file descriptor
+  int ring_fd{-1};
+
+  /// The submission queue ring
+  void *sq_ring{MAP_FAILED};
+
+  /// The size of the submission queue ring
+  std::size_t sq_ring_size{0U};
+
+  /// The completion queue ring; it may share the mapping of the submission
+  /// queue ring
+  void *cq_ring{MAP_FAILED};
+
+  /// The size of the completion queue ring
+  std::size_t cq_ring_size{0U};
+
+  /// The submission queue entries
+  io_uring_sqe *sqe_list{nullptr};
+
+  /// The size of the submission queue entry mapping
+  std::size_t sqe_list_size{0U};
+
+  /// The tail of the submission queue, shared with the kernel
+  unsigned *sq_tail{nullptr};
+
+  /// The index mask of the submission queue
+  unsigned sq_mask{0U};
+
+  /// The indirection array of the submission queue
+  unsigned *sq_array{nullptr};
+
+  /// How many entries the submission queue has
+  unsigned sq_entry_count{0U};
+
+  /// The head of the completion queue, shared with the kernel
+  unsigned *cq_head{nullptr};
+
+  /// The tail of the completion queue, shared with the kernel
+  unsigned *cq_tail{nullptr};
+
+  /// The index mask of the completion queue
+  unsigned cq_mask{0U};
+
+  /// The completion queue entries
+  io_uring_cqe *cqe_list{nullptr};
+
+  /// The next submission queue tail
+  unsigned next_sq_tail{0U};
+
+  /// How many entries have been queued since the last submission
+  unsigned queued_count{0U};
+
+  /// Returns a pointer inside the given mapping
+  template <typename Type>
+  static Type *ringPointer(void *ring, unsigned offset) {
+    return reinterpret_cast<Type *>(static_cast<char *>(ring) + offset);
+  }
+
+  /// Returns true if the kernel supports all the required operations
+  bool probeOperations() {
+    std::vector<std::uint8_t> buffer(sizeof(io_uring_probe) +
+                                     256U * sizeof(io_uring_probe_op));
+
+    auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe,
+                256U) < 0) {
+      return false;
+    }
+
+    for (auto operation : kRequiredOperationList) {
+      if (operation > probe->last_op ||
+          (probe->ops[operation].flags & IO_URING_OP_SUPPORTED) == 0U) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+ public:
+  /// Constructor
+  IoUring() = default;
+
+  /// Destructor
+  ~IoUring() {
+    if (sqe_list != nullptr) {
+      munmap(sqe_list, sqe_list_size);
+    }
+
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+      munmap(cq_ring, cq_ring_size);
+    }
+
+    if (sq_ring != MAP_FAILED) {
+      munmap(sq_ring, sq_ring_size);
+    }
+
+    if (ring_fd >= 0) {
+      close(ring_fd);
+    }
+  }
+
+  /// Sets up the ring; returns false if io_uring is not available
+  bool initialize() {
+    io_uring_params params = {};
+    auto fd = syscall(__NR_io_uring_setup, kRingEntryCount, &params);
+    if (fd < 0) {
+      return false;
+    }
+
+    ring_fd = static_cast<int>(fd);
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    bool single_mapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0U;
+    if (single_mapping) {
+      sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    }
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+      return false;
+    }
+
+    if (single_mapping) {
+      cq_ring = sq_ring;
+
+    } else {
+      cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+      if (cq_ring == MAP_FAILED) {
+        return false;
+      }
+    }
+
+    sqe_list_size = params.sq_entries * sizeof(io_uring_sqe);
+    auto sqe_mapping =
+        mmap(nullptr, sqe_list_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_mapping == MAP_FAILED) {
+      return false;
+    }
+
+    sqe_list = static_cast<io_uring_sqe *>(sqe_mapping);
+
+    sq_tail = ringPointer<unsigned>(sq_ring, params.sq_off.tail);
+    sq_mask = *ringPointer<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_array = ringPointer<unsigned>(sq_ring, params.sq_off.array);
+    sq_entry_count = params.sq_entries;
+
+    cq_head = ringPointer<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = ringPointer<unsigned>(cq_ring, params.cq_off.tail);
+    cq_mask = *ringPointer<unsigned>(cq_ring, params.cq_off.ring_mask);
+    cqe_list = ringPointer<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+
+    next_sq_tail = *sq_tail;
+
+    return probeOperations();
+  }
+
+  /// Returns how many operations can be queued before each submission
+  unsigned capacity() const { return sq_entry_count; }
+
+  /// Queues a new operation, returning the entry to fill; the user data
+  /// selects the result list slot that receives its outcome
+  io_uring_sqe *queue(std::uint8_t opcode, std::uint64_t user_data) {
+    if (queued_count >= sq_entry_count) {
+      return nullptr;
+    }
+
+    auto index = next_sq_tail & sq_mask;
+    auto sqe = &sqe_list[index];
+
+    std::memset(sqe, 0, sizeof(io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = user_data;
+
+    sq_array[index] = index;
+    ++next_sq_tail;
+    ++queued_count;
+
+    return sqe;
+  }
+
+  /// Submits the queued operations and waits for them, storing the result
+  /// of each one in the slot selected by its user data. Slots of operations
+  /// that could not complete are left untouched; returns false if the ring
+  /// can no longer be used
+  bool submit(std::vector<int> &result_list) {
+    auto submit_count = queued_count;
+    queued_count = 0U;
+
+    __atomic_store_n(sq_tail, next_sq_tail, __ATOMIC_RELEASE);
+
+    unsigned pending_submit_count = submit_count;
+    unsigned completed_count = 0U;
+    bool succeeded = true;
+
+    while (completed_count < submit_count) {
+      auto wait_count = submit_count - completed_count;
+      auto submitted_count = syscall(__NR_io_uring_enter, ring_fd,
+                                     pending_submit_count, wait_count,
+                                     IORING_ENTER_GETEVENTS, nullptr, 0);
+
+      if (submitted_count >= 0) {
+        pending_submit_count -= static_cast<unsigned>(submitted_count);
+
+      } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        if (!succeeded) {
+          break;
+        }
+
+        // The entries the kernel did not consume are never going to
+        // complete; only wait for the ones in flight
+        succeeded = false;
+        submit_count -= pending_submit_count;
+        pending_submit_count = 0U;
+
+        if (completed_count >= submit_count) {
+          break;
+        }
+      }
+
+      auto head = *cq_head;
+      auto tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; ++head) {
+        const auto &cqe = cqe_list[head & cq_mask];
+        if (cqe.user_data < result_list.size()) {
+          result_list[cqe.user_data] = cqe.res;
+        }
+
+        ++completed_count;
+      }
+
+      __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return succeeded;
+  }
+
+  /// Disable the copy constructor
+  IoUring(const IoUring &other) = delete;
+
+  /// Disable the assignment operator
+  IoUring &operator=(const IoUring &other) = delete;
+};
+
+/// The outcome of opening and stating a single file of a batch
+struct OpenedFile final {
+  /// The file descriptor; negative if the file has not been opened
+  int file_descriptor{-1};
+
+  /// The status read by statx()
+  BatchedFileStatus status;
+
+  /// False if the ring failed before both operations completed
+  bool completed{false};
+};
+
+/// Opens the given files and reads their status with a single submission;
+/// returns false if the ring can no longer be used
+bool openFileBatch(std::vector<OpenedFile> &opened_file_list, IoUring &ring,
+                   const std::string *path_list, std::size_t path_count) {
+  opened_file_list.assign(path_count, OpenedFile());
+
+  std::vector<struct statx> statx_list(path_count);
+  std::vector<int> result_list(path_count * 2U, kIncompleteResult);
+
+  for (std::size_t i = 0U; i < path_count; ++i) {
+    auto path = path_list[i].c_str();
+
+    auto sqe = ring.queue(IORING_OP_OPENAT, i * 2U);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<std::uint64_t>(path);
+    sqe->open_flags = O_RDONLY | O_CLOEXEC;
+
+    sqe = ring.queue(IORING_OP_STATX, i * 2U + 1U);
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<std::uint64_t>(path);
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = reinterpret_cast<std::uint64_t>(&statx_list[i]);
+  }
+
+  auto succeeded = ring.submit(result_list);
+
+  for (std::size_t i = 0U; i < path_count; ++i) {
+    auto &opened_file = opened_file_list[i];
+
+    auto open_result = result_list[i * 2U];
+    auto statx_result = result_list[i * 2U + 1U];
+
+    if (open_result != kIncompleteResult && open_result >= 0) {
+      opened_file.file_descriptor = open_result;
+    }
+
+    if (statx_result == kIncompleteResult) {
+      continue;
+    }
+
+    if (statx_result < 0) {
+      opened_file.status.error = -statx_result;
+    } else {
+      opened_file.status = convertFileStatus(statx_list[i]);
+    }
+
+    opened_file.completed = open_result != kIncompleteResult;
+  }
+
+  return succeeded;
+}
+
+/// Closes the given file once the previous submission queue entry (which
+/// must be linked to it) completes
+void queueLinkedClose(IoUring &ring, io_uring_sqe *previous_sqe,
+                      int file_descriptor, std::uint64_t user_data) {
+  previous_sqe->flags |= IOSQE_IO_LINK;
+
+  auto sqe = ring.queue(IORING_OP_CLOSE, user_data);
+  sqe->fd = file_descriptor;
+}
+
+/// Closes all the files that have been opened; used when the ring fails
+/// before their close operations can be queued
+void closeOpenedFiles(const std::vector<OpenedFile> &opened_file_list) {
+  for (const auto &opened_file : opened_file_list) {
+    if (opened_file.file_descriptor >= 0) {
+      close(opened_file.file_descriptor);
+    }
+  }
+}
+
+/// Closes the files whose linked close operation has been cancelled, as it
+/// happens when the operation before it fails. Files whose close did not
+/// complete at all are left open, since they may be closed already
+void closeCancelledFiles(const std::vector<OpenedFile> &opened_file_list,
+                         const std::vector<int> &close_result_list) {
+  for (std::size_t i = 0U; i < opened_file_list.size(); ++i) {
+    if (opened_file_list[i].file_descriptor >= 0 &&
+        close_result_list[i] == -ECANCELED) {
+      close(opened_file_list[i].file_descriptor);
+    }
+  }
+}
+#endif
+}  // namespace
+
+bool BatchedFileStatus::isRegularFile() const {
+  return error == 0 && S_ISREG(static_cast<mode_t>(mode));
+}
+
+/// Private class data
+struct BatchedFileReader::PrivateData final {
+#if defined(ABIGEN_HAS_IO_URING)
+  /// The ring; null when the blocking calls are used
+  std::unique_ptr<IoUring> ring;
+
+  /// Opens and reads ahead a single batch of files
+  void readAheadBatch(BatchedFileStatus *status_list,
+                      std::vector<bool> &opened_file_list,
+                      std::size_t first_index, const std::string *path_list,
+                      std::size_t path_count, std::uint64_t max_file_size);
+
+  /// Opens and reads a single batch of files
+  void readBatch(std::string *contents_list, std::vector<bool> &read_file_list,
+                 std::size_t first_index, const std::string *path_list,
+                 std::size_t path_count);
+#endif
+};
+
+#if defined(ABIGEN_HAS_IO_URING)
+void BatchedFileReader::PrivateData::readAheadBatch(
+    BatchedFileStatus *status_list, std::vector<bool> &opened_file_list,
+    std::size_t first_index, const std::string *path_list,
+    std::size_t path_count, std::uint64_t max_file_size) {
+  std::vector<OpenedFile> batch;
+  if (!openFileBatch(batch, *ring, path_list, path_count)) {
+    ring.reset();
+    closeOpenedFiles(batch);
+  }
+
+  // Each advice is linked to the close of its file, and the files that are
+  // not read ahead are just closed; the advice results go past the end of
+  // the list, and are ignored
+  std::vector<int> close_result_list(path_count, kIncompleteResult);
+
+  for (std::size_t i = 0U; ring && i < path_count; ++i) {
+    auto file_descriptor = batch[i].file_descriptor;
+    if (file_descriptor < 0) {
+      continue;
+    }
+
+    const auto &status = batch[i].status;
+    if (!batch[i].completed || !status.isRegularFile() ||
+        status.size > max_file_size) {
+      auto sqe = ring->queue(IORING_OP_CLOSE, i);
+      sqe->fd = file_descriptor;
+      continue;
+    }
+
+    auto sqe = ring->queue(IORING_OP_FADVISE, path_count + i);
+    sqe->fd = file_descriptor;
+    sqe->fadvise_advice = POSIX_FADV_WILLNEED;
+
+    queueLinkedClose(*ring, sqe, file_descriptor, i);
+  }
+
+  if (ring && !ring->submit(close_result_list)) {
+    ring.reset();
+  }
+
+  closeCancelledFiles(batch, close_result_list);
+
+  for (std::size_t i = 0U; i < path_count; ++i) {
+    auto file_index = first_index + i;
+
+    if (!batch[i].completed) {
+      opened_file_list[file_index] = readAheadFile(
+          status_list[file_index], path_list[i], max_file_size);
+
+      continue;
+    }
+
+    status_list[file_index] = batch[i].status;
+    opened_file_list[file_index] =
+        batch[i].file_descriptor >= 0 && batch[i].status.isRegularFile();
+  }
+}
+
+void BatchedFileReader::PrivateData::readBatch(
+    std::string *contents_list, std::vector<bool> &read_file_list,
+    std::size_t first_index, const std::string *path_list,
+    std::size_t path_count) {
+  std::vector<OpenedFile> batch;
+  if (!openFileBatch(batch, *ring, path_list, path_count)) {
+    ring.reset();
+    closeOpenedFiles(batch);
+  }
+
+  // Each read is linked to the close of its file; a short read breaks the
+  // link, and the file is then read again with the blocking calls
+  std::vector<int> result_list(path_count * 2U, kIncompleteResult);
+  std::vector<bool> queued_read_list(path_count, false);
+
+  for (std::size_t i = 0U; ring && i < path_count; ++i) {
+    auto file_descriptor = batch[i].file_descriptor;
+    if (file_descriptor < 0) {
+      continue;
+    }
+
+    auto &contents = contents_list[i];
+    const auto &status = batch[i].status;
+
+    if (!batch[i].completed || !status.isRegularFile() || status.size == 0U ||
+        status.size > kMaxRingReadSize) {
+      auto sqe = ring->queue(IORING_OP_CLOSE, path_count + i);
+      sqe->fd = file_descriptor;
+      continue;
+    }
+
+    contents.resize(static_cast<std::size_t>(status.size));
+
+    auto sqe = ring->queue(IORING_OP_READ, i);
+    sqe->fd = file_descriptor;
+    sqe->addr = reinterpret_cast<std::uint64_t>(&contents[0]);
+    sqe->len = static_cast<std::uint32_t>(contents.size());
+
+    queueLinkedClose(*ring, sqe, file_descriptor, path_count + i);
+    queued_read_list[i] = true;
+  }
+
+  if (ring && !ring->submit(result_list)) {
+    ring.reset();
+  }
+
+  closeCancelledFiles(
+      batch, std::vector<int>(result_list.begin() + path_count,
+                              result_list.end()));
+
+  for (std::size_t i = 0U; i < path_count; ++i) {
+    auto file_index = first_index + i;
+    auto &contents = contents_list[i];
+    const auto &status = batch[i].status;
+
+    bool read_completed =
+        queued_read_list[i] &&
+        result_list[i] == static_cast<int>(contents.size());
+
+    if (read_completed) {
+      read_file_list[file_index] = true;
+
+    } else if (batch[i].completed && status.isRegularFile() &&
+               status.size == 0U && batch[i].file_descriptor >= 0) {
+      contents.clear();
+      read_file_list[file_index] = true;
+
+    } else if (batch[i].completed && !status.isRegularFile()) {
+      contents.clear();
+      read_file_list[file_index] = false;
+
+    } else {
+      read_file_list[file_index] = readFileContents(contents, path_list[i]);
+    }
+  }
+}
+#endif
+
+BatchedFileReader::BatchedFileReader(bool allow_io_uring)
+    : d(new PrivateData) {
+#if defined(ABIGEN_HAS_IO_URING)
+  if (allow_io_uring) {
+    d->ring.reset(new IoUring);
+    if (!d->ring->initialize()) {
+      d->ring.reset();
+    }
+  }
+#else
+  static_cast<void>(allow_io_uring);
+#endif
+}
+
+BatchedFileReader::Status BatchedFileReader::create(BatchedFileReaderRef &obj,
+                                                    bool allow_io_uring) {
+  obj.reset();
+
+  try {
+    auto ptr = new BatchedFileReader(allow_io_uring);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+BatchedFileReader::~BatchedFileReader() {}
+
+bool BatchedFileReader::usesIoUring() const {
+#if defined(ABIGEN_HAS_IO_URING)
+  return d->ring != nullptr;
+#else
+  return false;
+#endif
+}
+
+void BatchedFileReader::status(std::vector<BatchedFileStatus> &status_list,
+                              const StringList &path_list) {
+  status_list.assign(path_list.size(), BatchedFileStatus());
+
+  std::size_t next_index = 0U;
+
+#if defined(ABIGEN_HAS_IO_URING)
+  std::vector<struct statx> statx_list;
+  std::vector<int> result_list;
+
+  while (d->ring && next_index < path_list.size()) {
+    auto path_count = std::min<std::size_t>(d->ring->capacity(),
+                                            path_list.size() - next_index);
+
+    statx_list.resize(path_count);
+    result_list.assign(path_count, kIncompleteResult);
+
+    for (std::size_t i = 0U; i < path_count; ++i) {
+      auto sqe = d->ring->queue(IORING_OP_STATX, i);
+      sqe->fd = AT_FDCWD;
+      sqe->addr = reinterpret_cast<std::uint64_t>(
+          path_list[next_index + i].c_str());
+      sqe->len = STATX_BASIC_STATS;
+      sqe->off = reinterpret_cast<std::uint64_t>(&statx_list[i]);
+    }
+
+    if (!d->ring->submit(result_list)) {
+      d->ring.reset();
+    }
+
+    for (std::size_t i = 0U; i < path_count; ++i) {
+      auto &status = status_list[next_index + i];
+
+      if (result_list[i] == kIncompleteResult) {
+        status = statFile(path_list[next_index + i]);
+      } else if (result_list[i] < 0) {
+        status.error = -result_list[i];
+      } else {
+        status = convertFileStatus(statx_list[i]);
+      }
+    }
+
+    next_index += path_count;
+  }
+#endif
+
+  for (; next_index < path_list.size(); ++next_index) {
+    status_list[next_index] = statFile(path_list[next_index]);
+  }
+}
+
+void BatchedFileReader::readAhead(std::vector<BatchedFileStatus> &status_list,
+                                  std::vector<bool> &opened_file_list,
+                                  const StringList &path_list,
+                                  std::uint64_t max_file_size) {
+  status_list.assign(path_list.size(), BatchedFileStatus());
+  opened_file_list.assign(path_list.size(), false);
+
+  std::size_t next_index = 0U;
+
+#if defined(ABIGEN_HAS_IO_URING)
+  // Each file takes two entries: open and statx, then advice and close
+  while (d->ring && next_index < path_list.size()) {
+    auto path_count = std::min<std::size_t>(d->ring->capacity() / 2U,
+                                            path_list.size() - next_index);
+
+    d->readAheadBatch(status_list.data(), opened_file_list, next_index,
+                      &path_list[next_index], path_count, max_file_size);
+
+    next_index += path_count;
+  }
+#endif
+
+  for (; next_index < path_list.size(); ++next_index) {
+    opened_file_list[next_index] = readAheadFile(
+        status_list[next_index], path_list[next_index], max_file_size);
+  }
+}
+
+void BatchedFileReader::read(std::vector<std::string> &contents_list,
+                             std::vector<bool> &read_file_list,
+                             const StringList &path_list) {
+  contents_list.assign(path_list.size(), std::string());
+  read_file_list.assign(path_list.size(), false);
+
+  std::size_t next_index = 0U;
+
+#if defined(ABIGEN_HAS_IO_URING)
+  // Each file takes two entries: open and statx, then read and close
+  while (d->ring && next_index < path_list.size()) {
+    auto path_count = std::min<std::size_t>(d->ring->capacity() / 2U,
+                                            path_list.size() - next_index);
+
+    d->readBatch(&contents_list[next_index], read_file_list, next_index,
+                 &path_list[next_index], path_count);
+
+    next_index += path_count;
+  }
+#endif
+
+  for (; next_index < path_list.size(); ++next_index) {
+    read_file_list[next_index] =
+        readFileContents(contents_list[next_index], path_list[next_index]);
+  }
+}
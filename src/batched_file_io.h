@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "types.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class BatchedFileReader;
+
+/// A reference to a BatchedFileReader object
+using BatchedFileReaderRef = std::shared_ptr<BatchedFileReader>;
+
+/// The status of a file, as returned by the BatchedFileReader
+struct BatchedFileStatus final {
+  /// Zero if the status has been read, otherwise the errno value
+  int error{0};
+
+  /// The file type and permissions, as in st_mode
+  std::uint32_t mode{0U};
+
+  /// The owner of the file
+  std::uint32_t user_id{0U};
+
+  /// The group of the file
+  std::uint32_t group_id{0U};
+
+  /// The file size, in bytes
+  std::uint64_t size{0U};
+
+  /// The modification time, in seconds since the epoch
+  std::int64_t modification_time_sec{0};
+
+  /// The nanoseconds of the modification time
+  std::uint32_t modification_time_nsec{0U};
+
+  /// The device containing the file
+  std::uint64_t device{0U};
+
+  /// The inode of the file
+  std::uint64_t inode{0U};
+
+  /// Returns true if the status has been read, and describes a regular file
+  bool isRegularFile() const;
+};
+
+/// The BatchedFileReader opens, stats and reads lists of files. On Linux,
+/// each batch of files is submitted to an io_uring instance, and the whole
+/// batch costs a couple of system calls instead of a few per file. When the
+/// kernel does not support the operations (or forbids io_uring, as some
+/// container runtimes do), or on other platforms, the files are processed one
+/// at a time with the blocking calls. Paths follow symbolic links. Each
+/// object owns its ring, and must only be used by one thread at a time
+class BatchedFileReader final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  BatchedFileReader(bool allow_io_uring);
+
+ public:
+  /// Status code, used with BatchedFileReader::Status
+  enum class StatusCode { MemoryAllocationFailure, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new BatchedFileReader object; io_uring is only used if
+  /// allowed, and if the kernel supports it
+  static Status create(BatchedFileReaderRef &obj, bool allow_io_uring = true);
+
+  /// Destructor
+  ~BatchedFileReader();
+
+  /// Returns true if the batches are submitted through io_uring
+  bool usesIoUring() const;
+
+  /// Reads the status of the given files
+  void status(std::vector<BatchedFileStatus> &status_list,
+              const StringList &path_list);
+
+  /// Reads the status of the given files, and asks the kernel to read the
+  /// regular files that are not larger than the given size into the page
+  /// cache (other platforms read them once). The flag list marks the regular
+  /// files that could be opened
+  void readAhead(std::vector<BatchedFileStatus> &status_list,
+                 std::vector<bool> &opened_file_list,
+                 const StringList &path_list, std::uint64_t max_file_size);
+
+  /// Reads the contents of the given regular files; the flag list marks the
+  /// ones that could be read
+  void read(std::vector<std::string> &contents_list,
+            std::vector<bool> &read_file_list, const StringList &path_list);
+
+  /// Disable the copy constructor
+  BatchedFileReader(const BatchedFileReader &other) = delete;
+
+  /// Disable the assignment operator
+  BatchedFileReader &operator=(const BatchedFileReader &other) = delete;
+};
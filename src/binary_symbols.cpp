@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "binary_symbols.h"
+
+#include <llvm/Object/Binary.h>
+#include <llvm/Object/COFF.h>
+#include <llvm/Object/ELFObjectFile.h>
+#include <llvm/Support/Error.h>
+
+namespace {
+/// Collects the dynamic symbols of the given ELF file; the undefined ones
+/// when reading the imports, and the defined ones otherwise
+void readELFDynamicSymbols(SymbolNameSet &symbol_set,
+                           const llvm::object::ELFObjectFileBase &elf_file,
+                           bool undefined) {
+  for (const auto &symbol : elf_file.getDynamicSymbolIterators()) {
+#if LLVM_MAJOR_VERSION >= 11
+    auto flags_exp = symbol.getFlags();
+    if (!flags_exp) {
+      llvm::consumeError(flags_exp.takeError());
+      continue;
+    }
+
+    auto flags = flags_exp.get();
+#else
+    auto flags = symbol.getFlags();
+#endif
+
+    if (((flags & llvm::object::SymbolRef::SF_Undefined) != 0U) !=
+        undefined) {
+      continue;
+    }
+
+    auto name_exp = symbol.getName();
+    if (!name_exp) {
+      llvm::consumeError(name_exp.takeError());
+      continue;
+    }
+
+    auto name = name_exp.get();
+    if (!name.empty()) {
+      symbol_set.insert(name.str());
+    }
+  }
+}
+
+/// Collects the names listed by the given import directory entries
+template <typename ImportDirectoryRange>
+void readCOFFImportDirectories(SymbolNameSet &symbol_set,
+                               const ImportDirectoryRange &directory_range) {
+  for (const auto &directory : directory_range) {
+    for (const auto &symbol : directory.imported_symbols()) {
+      bool is_ordinal = false;
+      llvm::StringRef name;
+
+#if LLVM_MAJOR_VERSION >= 11
+      if (auto error = symbol.isOrdinal(is_ordinal)) {
+        llvm::consumeError(std::move(error));
+        continue;
+      }
+
+      if (is_ordinal) {
+        continue;
+      }
+
+      if (auto error = symbol.getSymbolName(name)) {
+        llvm::consumeError(std::move(error));
+        continue;
+      }
+#else
+      if (symbol.isOrdinal(is_ordinal) || is_ordinal ||
+          symbol.getSymbolName(name)) {
+        continue;
+      }
+#endif
+
+      if (!name.empty()) {
+        symbol_set.insert(name.str());
+      }
+    }
+  }
+}
+
+/// Collects the names listed in the export table of the given PE file;
+/// entries exported by ordinal only have an empty name and are skipped
+void readCOFFExports(SymbolNameSet &symbol_set,
+                     const llvm::object::COFFObjectFile &coff_file) {
+  for (const auto &entry : coff_file.export_directories()) {
+    llvm::StringRef name;
+
+#if LLVM_MAJOR_VERSION >= 11
+    if (auto error = entry.getSymbolName(name)) {
+      llvm::consumeError(std::move(error));
+      continue;
+    }
+#else
+    if (entry.getSymbolName(name)) {
+      continue;
+    }
+#endif
+
+    if (!name.empty()) {
+      symbol_set.insert(name.str());
+    }
+  }
+}
+
+/// Reads the imported or exported symbols of the given binary
+bool readBinarySymbols(SymbolNameSet &symbol_set, std::string &error_message,
+                       const std::string &path, bool imports) {
+  symbol_set.clear();
+  error_message.clear();
+
+  // The file is memory mapped by the MemoryBuffer that backs the binary
+  auto binary_exp = llvm::object::createBinary(path);
+  if (!binary_exp) {
+    error_message = "Failed to open the binary " + path + ": " +
+                    llvm::toString(binary_exp.takeError());
+    return false;
+  }
+
+  auto binary = binary_exp.get().getBinary();
+
+  if (auto elf_file =
+          llvm::dyn_cast<llvm::object::ELFObjectFileBase>(binary)) {
+    readELFDynamicSymbols(symbol_set, *elf_file, imports);
+
+  } else if (auto coff_file =
+                 llvm::dyn_cast<llvm::object::COFFObjectFile>(binary)) {
+    if (imports) {
+      readCOFFImportDirectories(symbol_set, coff_file->import_directories());
+
+      readCOFFImportDirectories(symbol_set,
+                                coff_file->delay_import_directories());
+    } else {
+      readCOFFExports(symbol_set, *coff_file);
+    }
+
+  } else {
+    error_message =
+        "Unsupported binary format (only ELF and PE files are supported): " +
+        path;
+    return false;
+  }
+
+  return true;
+}
+}  // namespace
+
+bool readBinaryImports(SymbolNameSet &symbol_set, std::string &error_message,
+                       const std::string &path) {
+  return readBinarySymbols(symbol_set, error_message, path, true);
+}
+
+bool readBinaryExports(SymbolNameSet &symbol_set, std::string &error_message,
+                       const std::string &path) {
+  return readBinarySymbols(symbol_set, error_message, path, false);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+
+/// A set of symbol names, read from a binary
+using SymbolNameSet = std::unordered_set<std::string>;
+
+/// A reference to a shared symbol name set
+using SymbolNameSetRef = std::shared_ptr<const SymbolNameSet>;
+
+/// Reads the symbols imported by the given ELF or PE file: the undefined
+/// dynamic symbols of an ELF file, or the names listed in the import (and
+/// delay import) tables of a PE file. Imports by ordinal have no name and
+/// are skipped. The file is memory mapped; returns false and sets the error
+/// message if it can't be read or is not in a supported format
+bool readBinaryImports(SymbolNameSet &symbol_set, std::string &error_message,
+                       const std::string &path);
+
+/// Reads the symbols exported by the given ELF or PE file: the defined
+/// dynamic symbols of an ELF file, or the names listed in the export table
+/// of a PE file. Errors are reported like in readBinaryImports()
+bool readBinaryExports(SymbolNameSet &symbol_set, std::string &error_message,
+                       const std::string &path);
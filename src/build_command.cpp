@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "output_file.h"
+#include "resident_state.h"
+#include "std_filesystem.h"
+
+#include <iostream>
+#include <memory>
+
+/// Handler for the 'build' command
+bool buildCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options) {
+  if (cmdline_options.watch || cmdline_options.emit_bitcode) {
+    std::cerr << "The --watch and --emit-bitcode options can't be used by "
+                 "the build command\n";
+    return false;
+  }
+
+  // The rendered files are keyed on their path; the generated sources find
+  // their header through it, so it must not depend on the working directory
+  auto build_options = cmdline_options;
+
+  std::error_code error;
+  auto output_path = stdfs::absolute(cmdline_options.output, error);
+  if (error) {
+    std::cerr << "Invalid output path: " << cmdline_options.output << "\n";
+    return false;
+  }
+
+  build_options.output = output_path.string();
+
+  // Both phases share the cached lookups of the profile folders
+  if (!build_options.resident_state) {
+    auto resident_state_status = ResidentState::create(
+        build_options.resident_state, cmdline_options.state_directory);
+
+    if (!resident_state_status.succeeded()) {
+      std::cerr << resident_state_status.toString() << "\n";
+      return false;
+    }
+  }
+
+  // The dependency file is written by the compile phase, which knows about
+  // every header that has been read
+  auto generate_options = build_options;
+  generate_options.depfile_path.clear();
+
+  auto source_file_map = std::make_shared<RenderedFileMap>();
+  if (!runGenerateCommand(profile_manager, language_manager, generate_options,
+                          nullptr, source_file_map.get())) {
+    return false;
+  }
+
+  if (cmdline_options.emit_sources) {
+    for (const auto &file_entry : *source_file_map) {
+      auto parent_path = stdfs::path(file_entry.first).parent_path();
+      stdfs::create_directories(parent_path, error);
+
+      if (error || !writeFileIfChanged(file_entry.first, file_entry.second)) {
+        std::cerr << "Failed to save the source file: " << file_entry.first
+                  << "\n";
+        return false;
+      }
+    }
+  }
+
+  auto compile_options = build_options;
+  compile_options.output = build_options.output + ".bc";
+  compile_options.metrics_file.clear();
+
+  if (cmdline_options.emit_header_map) {
+    compile_options.header_map_path = build_options.output + ".hmap";
+  }
+
+  return runCompileCommand(profile_manager, language_manager, compile_options,
+                           nullptr, source_file_map);
+}
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "compilerinstance.h"
+#include "generate_utils.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+
+namespace {
+/// Language enumeration callback used to collect all the language definitions
+bool languageListCallback(const std::string &definition, Language, int,
+                          StringList *language_list) {
+  language_list->push_back(definition);
+  return true;
+}
+
+/// Precompiles the system headers of the given profile and language
+bool buildProfilePrecompiledHeader(const Profile &profile,
+                                   const LanguageManager &language_manager,
+                                   const std::string &language_definition,
+                                   const CommandLineOptions &cmdline_options) {
+  CompilerInstanceSettings compiler_settings;
+  compiler_settings.profile = profile;
+  compiler_settings.enable_gnu_extensions =
+      cmdline_options.enable_gnu_extensions;
+
+  if (!language_manager.parseLanguageDefinition(
+          compiler_settings.language, compiler_settings.language_standard,
+          language_definition)) {
+    std::cerr << "Invalid language definition\n";
+    return false;
+  }
+
+  const auto language = compiler_settings.language;
+  const auto standard = compiler_settings.language_standard;
+
+  compiler_settings.stop_at_first_error = true;
+  compiler_settings.ignore_warnings = true;
+
+  CompilerInstanceRef compiler;
+  auto compiler_status = CompilerInstance::create(compiler, compiler_settings);
+  if (!compiler_status.succeeded()) {
+    std::cerr << compiler_status.toString() << "\n";
+    return false;
+  }
+
+  // Headers that can't be compiled with this profile and language (or that
+  // conflict with the ones before them) are left out
+  auto system_header_list = getSystemHeaderList(language, standard);
+
+  StringList header_list;
+  for (const auto &header : system_header_list) {
+    header_list.push_back(header);
+
+    auto source_buffer = generateSourceBuffer(header_list, StringList());
+    if (!compiler->processAST(source_buffer).succeeded()) {
+      header_list.pop_back();
+    }
+  }
+
+  if (header_list.empty()) {
+    std::cerr << "  " << language_definition
+              << ": none of the system headers could be compiled\n";
+    return false;
+  }
+
+  auto folder = stdfs::path(ProfileManager::precompiledHeaderFolder(
+      profile, cmdline_options.cache_directory));
+
+  std::error_code error;
+  stdfs::create_directories(folder, error);
+  if (error) {
+    std::cerr << "Failed to create the following folder: " << folder.string()
+              << "\n";
+    return false;
+  }
+
+  // Each build gets its own file name, so that the processes loading the
+  // previous one never see a partial file
+  std::random_device random_device;
+
+  auto pch_file_name =
+      ProfileManager::precompiledHeaderName(
+          language, standard, compiler_settings.enable_gnu_extensions) +
+      "_" + std::to_string(random_device()) + ".pch";
+
+  ProfilePrecompiledHeader precompiled_header;
+  precompiled_header.path = (folder / pch_file_name).string();
+
+  precompiled_header.settings_hash = hashProfileSettings(compiler_settings);
+  precompiled_header.header_list = header_list;
+
+  StringList dependency_list;
+  compiler_status = compiler->generatePrecompiledHeader(
+      generateSourceBuffer(header_list, StringList()), precompiled_header.path,
+      &dependency_list);
+
+  // The source buffer is saved next to the precompiled header, and it is
+  // not a dependency
+  auto prefix_file_path = precompiled_header.path + ".h";
+  dependency_list.erase(std::remove(dependency_list.begin(),
+                                    dependency_list.end(), prefix_file_path),
+                        dependency_list.end());
+
+  bool succeeded = compiler_status.succeeded();
+  if (succeeded) {
+    auto status = ProfileManager::savePrecompiledHeader(
+        precompiled_header, profile, language, standard,
+        compiler_settings.enable_gnu_extensions,
+        cmdline_options.cache_directory, dependency_list);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      succeeded = false;
+    }
+
+  } else {
+    std::cerr << compiler_status.toString() << "\n";
+  }
+
+  if (!succeeded) {
+    stdfs::remove(precompiled_header.path, error);
+    stdfs::remove(prefix_file_path, error);
+    return false;
+  }
+
+  std::cout << "  " << language_definition << ": " << header_list.size() << "/"
+            << system_header_list.size() << " headers precompiled into "
+            << precompiled_header.path << "\n";
+
+  return true;
+}
+}  // namespace
+
+/// Handler for the 'build_profile_pch' command
+bool buildProfilePCHCommandHandler(ProfileManagerRef &profile_manager,
+                                   const LanguageManager &language_manager,
+                                   const CommandLineOptions &cmdline_options) {
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, cmdline_options.profile_name);
+  if (!prof_mgr_status.succeeded()) {
+    std::cerr << prof_mgr_status.toString() << "\n";
+    return false;
+  }
+
+  // All the supported languages are built when none has been specified
+  StringList language_list;
+  if (cmdline_options.language.empty()) {
+    language_manager.enumerate(languageListCallback, &language_list);
+  } else {
+    language_list.push_back(cmdline_options.language);
+  }
+
+  std::cout << "Precompiling the system headers of the " << profile.name
+            << " profile\n\n";
+
+  bool succeeded = true;
+  for (const auto &language_definition : language_list) {
+    if (!buildProfilePrecompiledHeader(profile, language_manager,
+                                       language_definition, cmdline_options)) {
+      succeeded = false;
+    }
+  }
+
+  return succeeded;
+}
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "astvisitor.h"
+#include "cmdline.h"
+#include "compilerinstance.h"
+#include "generate_utils.h"
+#include "type_summary.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+/// Language enumeration callback used to collect all the language definitions
+bool languageListCallback(const std::string &definition, Language, int,
+                          StringList *language_list) {
+  language_list->push_back(definition);
+  return true;
+}
+
+/// Summarizes the records defined by the system headers of the given profile
+/// and language
+bool buildProfileTypeSummary(const Profile &profile,
+                             const LanguageManager &language_manager,
+                             const std::string &language_definition,
+                             const CommandLineOptions &cmdline_options) {
+  CompilerInstanceSettings compiler_settings;
+  compiler_settings.profile = profile;
+  compiler_settings.enable_gnu_extensions =
+      cmdline_options.enable_gnu_extensions;
+
+  if (!language_manager.parseLanguageDefinition(
+          compiler_settings.language, compiler_settings.language_standard,
+          language_definition)) {
+    std::cerr << "Invalid language definition\n";
+    return false;
+  }
+
+  const auto language = compiler_settings.language;
+  const auto standard = compiler_settings.language_standard;
+
+  compiler_settings.stop_at_first_error = true;
+  compiler_settings.ignore_warnings = true;
+
+  CompilerInstanceRef compiler;
+  auto compiler_status = CompilerInstance::create(compiler, compiler_settings);
+  if (!compiler_status.succeeded()) {
+    std::cerr << compiler_status.toString() << "\n";
+    return false;
+  }
+
+  // Headers that can't be compiled with this profile and language (or that
+  // conflict with the ones before them) are left out
+  auto system_header_list = getSystemHeaderList(language, standard);
+
+  StringList header_list;
+  for (const auto &header : system_header_list) {
+    header_list.push_back(header);
+
+    auto source_buffer = generateSourceBuffer(header_list, StringList());
+    if (!compiler->processAST(source_buffer).succeeded()) {
+      header_list.pop_back();
+    }
+  }
+
+  if (header_list.empty()) {
+    std::cerr << "  " << language_definition
+              << ": none of the system headers could be compiled\n";
+    return false;
+  }
+
+  auto type_summary = std::make_shared<TypeSummary>();
+  type_summary->settings_hash = hashProfileSettings(compiler_settings);
+
+  ASTVisitorSettings visitor_settings;
+  visitor_settings.language = language;
+  visitor_settings.type_summary_output = type_summary;
+
+  IASTVisitorRef ast_visitor;
+  auto ast_visitor_status = ASTVisitor::create(ast_visitor, visitor_settings);
+  if (!ast_visitor_status.succeeded()) {
+    std::cerr << ast_visitor_status.toString() << "\n";
+    return false;
+  }
+
+  StringList dependency_list;
+  compiler_status =
+      compiler->processAST(generateSourceBuffer(header_list, StringList()),
+                           ast_visitor, &dependency_list);
+
+  if (!compiler_status.succeeded()) {
+    std::cerr << compiler_status.toString() << "\n";
+    return false;
+  }
+
+  if (!saveTypeSummary(*type_summary, compiler_settings,
+                       cmdline_options.cache_directory, dependency_list)) {
+    std::cerr << "Failed to save the type summary of the " << profile.name
+              << " profile\n";
+    return false;
+  }
+
+  auto reachable_count = std::count_if(
+      type_summary->reachability_map.begin(),
+      type_summary->reachability_map.end(),
+      [](const std::pair<const TypeIdentity, bool> &p) { return p.second; });
+
+  std::cout << "  " << language_definition << ": "
+            << type_summary->reachability_map.size()
+            << " system types summarized, " << reachable_count
+            << " reach a function type\n";
+
+  return true;
+}
+}  // namespace
+
+/// Handler for the 'build_profile_summary' command
+bool buildProfileSummaryCommandHandler(
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options) {
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, cmdline_options.profile_name);
+  if (!prof_mgr_status.succeeded()) {
+    std::cerr << prof_mgr_status.toString() << "\n";
+    return false;
+  }
+
+  // All the supported languages are summarized when none has been specified
+  StringList language_list;
+  if (cmdline_options.language.empty()) {
+    language_manager.enumerate(languageListCallback, &language_list);
+  } else {
+    language_list.push_back(cmdline_options.language);
+  }
+
+  std::cout << "Summarizing the system types of the " << profile.name
+            << " profile\n\n";
+
+  bool succeeded = true;
+  for (const auto &language_definition : language_list) {
+    if (!buildProfileTypeSummary(profile, language_manager,
+                                 language_definition, cmdline_options)) {
+      succeeded = false;
+    }
+  }
+
+  return succeeded;
+}
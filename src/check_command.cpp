@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "abi_lib_generator.h"
+#include "analysis_cache.h"
+#include "astvisitor.h"
+#include "cmdline.h"
+#include "compilerinstance.h"
+#include "generate_utils.h"
+#include "header_lockfile.h"
+#include "pch_cache.h"
+#include "std_filesystem.h"
+#include "time_report.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+
+namespace {
+/// Returns the canonical version of the given path, or an empty string if
+/// it does not exist
+std::string getCanonicalPath(const stdfs::path &path) {
+  std::error_code error;
+  auto canonical_path = stdfs::canonical(path, error);
+
+  return error ? std::string() : canonical_path.string();
+}
+
+/// Returns the file the given include directive resolves to inside the
+/// header folders, or an empty string if none contains it
+std::string resolveIncludeDirective(const std::string &include_directive,
+                                    const StringList &header_folders) {
+  for (const auto &folder : header_folders) {
+    auto header_path =
+        getCanonicalPath(stdfs::path(folder) / include_directive);
+
+    if (!header_path.empty()) {
+      return header_path;
+    }
+  }
+
+  return std::string();
+}
+
+/// Determines the include directive of the checked header, which is either
+/// an include directive or the path of a file, and the file it resolves to.
+/// The position receives the index of the directive in the include list,
+/// or the size of the list when the header has not been accepted yet
+void getCheckedHeader(std::string &include_directive, std::string &header_path,
+                      std::size_t &position, const std::string &header,
+                      const StringList &include_list,
+                      const StringList &header_folders) {
+  position = include_list.size();
+
+  auto it = std::find(include_list.begin(), include_list.end(), header);
+  if (it != include_list.end()) {
+    include_directive = header;
+    header_path = resolveIncludeDirective(header, header_folders);
+    position = static_cast<std::size_t>(it - include_list.begin());
+    return;
+  }
+
+  header_path = getCanonicalPath(header);
+  include_directive = header;
+
+  if (header_path.empty()) {
+    header_path = resolveIncludeDirective(header, header_folders);
+    return;
+  }
+
+  for (std::size_t i = 0U; i < include_list.size(); ++i) {
+    if (resolveIncludeDirective(include_list[i], header_folders) ==
+        header_path) {
+      include_directive = include_list[i];
+      position = i;
+      return;
+    }
+  }
+
+  // New headers are included relative to the folder containing them
+  for (const auto &folder : header_folders) {
+    auto folder_path = getCanonicalPath(folder);
+    if (folder_path.empty()) {
+      continue;
+    }
+
+    folder_path.push_back('/');
+    if (header_path.compare(0U, folder_path.size(), folder_path) == 0) {
+      include_directive = header_path.substr(folder_path.size());
+      return;
+    }
+  }
+}
+}  // namespace
+
+bool checkCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options) {
+  Stopwatch check_stopwatch;
+
+  HeaderLockfile lockfile;
+  if (!readHeaderLockfile(lockfile, cmdline_options.lockfile_path)) {
+    std::cerr << "The lockfile could not be read: "
+              << cmdline_options.lockfile_path << "\n";
+    return false;
+  }
+
+  CompilerInstanceSettings compiler_settings;
+  if (!createCompilerInstanceSettings(compiler_settings, profile_manager,
+                                      language_manager, cmdline_options)) {
+    return false;
+  }
+
+  // Same key as the one of the generate command
+  const auto &base_includes = cmdline_options.base_includes;
+
+  auto configuration_hash = hashCompilerInstanceSettings(compiler_settings);
+  configuration_hash =
+      updateContentHash(configuration_hash, cmdline_options.probe_tiers);
+  configuration_hash = updateContentHash(configuration_hash, base_includes);
+
+  if (configuration_hash != lockfile.configuration_hash) {
+    std::cerr << "The lockfile has been written with different settings; "
+                 "the outcome may not match the one of the generate "
+                 "command\n\n";
+  }
+
+  std::string include_directive;
+  std::string header_path;
+  std::size_t position;
+  getCheckedHeader(include_directive, header_path, position,
+                   cmdline_options.check_header, lockfile.include_list,
+                   cmdline_options.header_folders);
+
+  // The header is checked on top of the headers accepted before it; the
+  // prefix is the one the generate command precompiles with
+  // --use-precompiled-prefix, so its cached precompiled header is reused
+  StringList prefix_list(
+      lockfile.include_list.begin(),
+      std::next(lockfile.include_list.begin(),
+                static_cast<std::ptrdiff_t>(position)));
+
+  auto prefix_buffer = generateSourceBuffer(prefix_list, base_includes);
+
+  auto final_compiler_settings = compiler_settings;
+  std::string source_buffer;
+
+  PCHCacheRef pch_cache;
+  if (!cmdline_options.cache_directory.empty()) {
+    auto pch_cache_status =
+        PCHCache::create(pch_cache, cmdline_options.cache_directory);
+
+    if (!pch_cache_status.succeeded()) {
+      std::cerr << pch_cache_status.toString() << "\n";
+      return false;
+    }
+
+    final_compiler_settings.precompiled_header =
+        pch_cache->precompiledHeader(compiler_settings, prefix_buffer);
+  }
+
+  if (final_compiler_settings.precompiled_header.empty()) {
+    source_buffer = prefix_buffer;
+  }
+
+  appendIncludeDirective(source_buffer, include_directive);
+
+  // Only the declarations next to the header are visited; the others come
+  // from the prefix, and have already been checked by the generate command
+  if (!header_path.empty()) {
+    final_compiler_settings.traversal_folders = {
+        stdfs::path(header_path).parent_path().string()};
+  }
+
+  ASTVisitorSettings visitor_settings;
+  visitor_settings.language = compiler_settings.language;
+
+  if (!cmdline_options.cache_directory.empty()) {
+    auto analysis_configuration_hash =
+        updateContentHash(configuration_hash, prefix_buffer);
+    analysis_configuration_hash =
+        updateContentHash(analysis_configuration_hash, include_directive);
+
+    AnalysisCacheRef analysis_cache;
+    auto analysis_cache_status =
+        AnalysisCache::create(analysis_cache, cmdline_options.cache_directory,
+                              analysis_configuration_hash);
+
+    if (!analysis_cache_status.succeeded()) {
+      std::cerr << analysis_cache_status.toString() << "\n";
+      return false;
+    }
+
+    visitor_settings.analysis_cache = analysis_cache;
+  }
+
+  IASTVisitorRef visitor_ref;
+  auto visitor_status = ASTVisitor::create(visitor_ref, visitor_settings);
+  if (!visitor_status.succeeded()) {
+    std::cerr << "Failed to create the ASTVisitor object: "
+              << visitor_status.toString() << "\n";
+    return false;
+  }
+
+  CompilerInstanceRef compiler;
+  auto compiler_status =
+      CompilerInstance::create(compiler, final_compiler_settings);
+  if (!compiler_status.succeeded()) {
+    std::cerr << compiler_status.toString() << "\n";
+    return false;
+  }
+
+  compiler_status = compiler->processAST(source_buffer, visitor_ref);
+  auto check_time = check_stopwatch.elapsed().wall_time;
+
+  std::cerr << std::fixed << std::setprecision(2);
+
+  if (!compiler_status.succeeded()) {
+    std::cerr << compiler_status.toString() << "\n\n"
+              << include_directive << ": rejected on top of " << position
+              << " accepted headers (" << check_time << " s)\n";
+    return false;
+  }
+
+  ABILibrary abi_library;
+  visitor_ref->takeResults(abi_library);
+
+  // The functions of the other headers in the same folder are not reported
+  auto L_inCheckedHeader = [&](const SourceCodeLocation &location) -> bool {
+    if (header_path.empty()) {
+      return true;
+    }
+
+    const auto &file_path = abi_library.file_path_list.at(location.file_id);
+    return file_path == header_path || getCanonicalPath(file_path) ==
+                                           header_path;
+  };
+
+  std::size_t whitelisted_count = 0U;
+  for (const auto &function : abi_library.whitelisted_function_list) {
+    if (L_inCheckedHeader(function.location)) {
+      ++whitelisted_count;
+    }
+  }
+
+  std::size_t blacklisted_count = 0U;
+  for (const auto &function : abi_library.blacklisted_function_list) {
+    if (!L_inCheckedHeader(function.location)) {
+      continue;
+    }
+
+    if (blacklisted_count++ == 0U) {
+      std::cout << "Blacklisted functions\n\n";
+    }
+
+    std::cout << "  " << std::setw(20) << std::left
+              << getBlacklistReasonName(function.reason) << " "
+              << function.friendly_name << " (" << function.mangled_name
+              << ")\n";
+  }
+
+  if (blacklisted_count != 0U) {
+    std::cout << "\n";
+  }
+
+  std::cerr << include_directive << ": accepted on top of " << position
+            << " accepted headers, " << whitelisted_count
+            << " functions whitelisted, " << blacklisted_count
+            << " blacklisted ("
+            << (final_compiler_settings.precompiled_header.empty()
+                    ? "prefix parsed"
+                    : "prefix loaded from the precompiled header")
+            << ", " << check_time << " s)\n";
+
+  return !cmdline_options.fail_on_blacklist || blacklisted_count == 0U;
+}
@@ -15,6 +15,944 @@
  */
 
 #include "cmdline.h"
+#include "probe_executor.h"
+#include "probe_strategy.h"
+#include "worker_placement.h"
+
+#include <algorithm>
+#include <functional>
+#include <sstream>
+
+namespace {
+/// Parses a comma separated list; returns false if the list is empty, or
+/// if an item is empty or repeated
+bool parseCommaSeparatedList(StringList &item_list,
+                             const std::string &definition) {
+  item_list.clear();
+
+  std::stringstream buffer(definition);
+  std::string item;
+
+  while (std::getline(buffer, item, ',')) {
+    if (item.empty() ||
+        std::find(item_list.begin(), item_list.end(), item) !=
+            item_list.end()) {
+      return false;
+    }
+
+    item_list.push_back(item);
+  }
+
+  return !item_list.empty();
+}
+
+/// Returns a validator accepting the integers greater than zero; the name
+/// describes the value in the error message
+std::function<std::string(const std::string &)> getPositiveIntegerValidator(
+    const std::string &value_name) {
+  return [value_name](const std::string &value) -> std::string {
+    try {
+      if (std::stoul(value) != 0U) {
+        return "";
+      }
+    } catch (...) {
+    }
+
+    return "The " + value_name + " must be a positive integer";
+  };
+}
+
+/// Registers the option selecting where the blacklisted functions are
+/// reported
+void addBlacklistReportOption(CLI::App *command,
+                              CommandLineOptions &cmdline_options) {
+  auto blacklist_report_option = command->add_option(
+      "--blacklist-report", cmdline_options.blacklist_report,
+      "Where the blacklisted functions are reported: header, text "
+      "(<output>.blacklist.txt), json (<output>.json) (default: header)");
+
+  // clang-format off
+  blacklist_report_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "header" && value != "text" && value != "json") {
+          return "Invalid blacklist report";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+}
+
+/// Registers the options of the 'generate' command; they are shared with
+/// the 'build' command, which runs it before compiling the results
+void addGenerateOptions(CLI::App *generate_cmd,
+                        CommandLineOptions &cmdline_options,
+                        ProfileManagerRef &profile_manager,
+                        LanguageManager &language_manager) {
+  // The profile determines the options and include folders we will use when
+  // parsing the include headers
+  auto profile_option = generate_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options. A comma separated list generates one library for each "
+      "profile, saved as <output>_<profile>; the header order accepted by "
+      "the first profile is verified and reused by the other ones");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &value) -> std::string {
+        StringList profile_name_list;
+        if (!parseProfileNameList(profile_name_list, value)) {
+          return "Invalid profile list";
+        }
+
+        for (const auto &profile_name : profile_name_list) {
+          Profile profile;
+          auto status = profile_manager->get(profile, profile_name);
+          if (!status.succeeded()) {
+            return status.message();
+          }
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  /// The language used to parse the include headers
+  auto language_option =
+      generate_cmd->add_option("-l,--language", cmdline_options.language,
+                               "Language name; use the list_languages command "
+                               "to list the available options");
+
+  language_option->required(true)->take_last();
+
+  // clang-format off
+  language_option->check(
+      [&language_manager](const std::string &definition) -> std::string {
+        Language language;
+        int standard;
+        if (!language_manager.parseLanguageDefinition(language, standard, definition)) {
+          return "Invalid language";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  generate_cmd
+      ->add_flag("-x,--enable-gnu-extensions",
+                 cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("-z,--use-visual-cxx-mangling",
+                 cmdline_options.use_visual_cxx_mangling,
+                 "Use Visual C++ name mangling")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--dual-mangling", cmdline_options.dual_mangling,
+                 "Also generate the ABI library for the other name mangling "
+                 "convention, from the same analysis pass; it is saved to "
+                 "the output path followed by _msvc (or _itanium when "
+                 "the Visual C++ mangling is used)")
+      ->take_last();
+
+  // The headers are probed once, for the first triple; the final analysis
+  // of each triple runs on its own thread
+  auto target_triples_option = generate_cmd->add_option(
+      "--target-triples", cmdline_options.target_triples,
+      "Comma separated list of target triples; one library is generated for "
+      "each triple, saved as <output>_<triple>. The default target of the "
+      "host is used when omitted");
+
+  // clang-format off
+  target_triples_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        StringList target_triple_list;
+        if (!parseTargetTripleList(target_triple_list, value)) {
+          return "Invalid target triple list";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  generate_cmd
+      ->add_flag("--verify-target-triples",
+                 cmdline_options.verify_target_triples,
+                 "Verify the include list accepted for the first target "
+                 "triple with each of the other ones, probing the headers it "
+                 "left out")
+      ->take_last();
+
+  generate_cmd->add_option("-i,--include-search-paths",
+                           cmdline_options.additional_include_folders,
+                           "Additional include folders");
+
+  // The folder to scan for include files
+  generate_cmd
+      ->add_option("-f,--header-folders", cmdline_options.header_folders,
+                   "Header folders; uncompressed .tar archives, and the "
+                   "folders inside them, are read without extracting them")
+      ->required();
+
+  // Filters applied while walking the header folders
+  generate_cmd->add_option(
+      "--include-glob", cmdline_options.include_globs,
+      "Only probe the headers matching these patterns; patterns without a "
+      "'/' are matched against the file name");
+
+  generate_cmd->add_option(
+      "--exclude-glob", cmdline_options.exclude_globs,
+      "Skip the headers and folders matching these patterns (i.e.: detail, "
+      "tests/**, win32)");
+
+  // Include files that will always be added inside the ABI library
+  generate_cmd->add_option(
+      "-b,--base-includes", cmdline_options.base_includes,
+      "Includes that should always be present in the ABI header");
+
+  // Where the output should be saved
+  generate_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Output path, including the file name without the extension")
+      ->required();
+
+  // How many headers can be probed at the same time
+  auto jobs_option = generate_cmd->add_option(
+      "-j,--jobs", cmdline_options.jobs,
+      "Amount of headers that are probed concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  generate_cmd
+      ->add_option("--memory-budget", cmdline_options.memory_budget,
+                   "Memory (in MiB) that the concurrent probes can use; "
+                   "workers wait for each other based on the memory measured "
+                   "by the previous probes of each header")
+      ->take_last();
+
+  // Keeps the precompiled prefix of each worker in the memory of the node
+  // it runs on
+  auto worker_placement_option = generate_cmd->add_option(
+      "--worker-placement", cmdline_options.worker_placement,
+      "Pin the probe workers and the analysis shards: none, node, core "
+      "(default: none)");
+
+  // clang-format off
+  worker_placement_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        WorkerPlacement placement;
+        if (!parseWorkerPlacement(placement, value)) {
+          return "Invalid worker placement";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  generate_cmd
+      ->add_flag("-c,--precompiled-prefix",
+                 cmdline_options.use_precompiled_prefix,
+                 "Precompile the accepted headers, parsing only the new header "
+                 "in each probe")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--fork-probes", cmdline_options.fork_probes,
+                 "Parse the accepted headers once for each group of probes, "
+                 "and fork a process parsing each probed header on top of "
+                 "them; only used while abigen runs no other thread")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--race-include-directives",
+                 cmdline_options.race_include_directives,
+                 "Compile the include directives of ambiguous headers "
+                 "concurrently, cancelling the ones that are no longer needed")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--isolate-probes", cmdline_options.isolate_probes,
+                 "Probe the headers in worker processes, so that a crash or "
+                 "a hang of clang only fails the header being probed")
+      ->take_last();
+
+  // The base includes are parsed only once
+  generate_cmd
+      ->add_flag("--precompile-base-includes",
+                 cmdline_options.precompile_base_includes,
+                 "Precompile the base includes once, and load them in each "
+                 "probe and in the final pass; the header is cached in the "
+                 "--cache-dir folder, when set")
+      ->take_last();
+
+  // The precompiled prefixes are large, and a new one is published each
+  // time a header is accepted
+  generate_cmd
+      ->add_option("--pch-cache-size-limit",
+                   cmdline_options.pch_cache_size_limit,
+                   "Size in megabytes of the precompiled headers kept in the "
+                   "--cache-dir folder, evicting the least recently used "
+                   "ones")
+      ->take_last();
+
+  // The system headers are parsed only once per profile and language
+  generate_cmd
+      ->add_flag("--profile-pch", cmdline_options.use_profile_pch,
+                 "Load the system headers precompiled by the build_profile_pch "
+                 "command; they are also added to the base includes of the "
+                 "ABI library")
+      ->take_last();
+
+  // The system records are analyzed only once per profile and language
+  generate_cmd
+      ->add_flag("--profile-summary", cmdline_options.use_profile_summary,
+                 "Look up the records defined by the system headers in the "
+                 "summary built by the build_profile_summary command, "
+                 "instead of expanding their members")
+      ->take_last();
+
+  // Where the probe results and the header folder listings are cached
+  // across runs
+  generate_cmd
+      ->add_option("--cache-dir", cmdline_options.cache_directory,
+                   "Folder used to cache the probe results and the header "
+                   "folder listings across runs")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--remote-cache", cmdline_options.remote_cache_url,
+                   "http:// URL of a shared cache server; the --cache-dir "
+                   "folder downloads the probe results and the precompiled "
+                   "headers it is missing, and uploads the new ones")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--cache-size-limit", cmdline_options.cache_size_limit,
+                   "Size in megabytes the --cache-dir folder is trimmed to "
+                   "at the end of the run, removing the least recently used "
+                   "files; requires --remote-cache")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--incremental-analysis",
+                 cmdline_options.incremental_analysis,
+                 "Cache the final analysis results of each header in the "
+                 "--cache-dir folder, and only analyze again the headers "
+                 "that have changed")
+      ->take_last();
+
+  // The probe and analysis caches make the following passes incremental
+  generate_cmd
+      ->add_flag("--watch", cmdline_options.watch,
+                 "Keep running, and generate the ABI library again when the "
+                 "headers change; uses a temporary --cache-dir when none is "
+                 "set, and enables --incremental-analysis when possible")
+      ->take_last();
+
+  generate_cmd->add_option(
+      "--remote-workers", cmdline_options.remote_workers,
+      "Addresses (host:port) of 'abigen worker' processes the probes are "
+      "dispatched to, along with the local jobs");
+
+  generate_cmd
+      ->add_option("--module-cache", cmdline_options.module_cache_directory,
+                   "Build the accepted headers as clang modules in this "
+                   "folder, and import them in the final pass")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--reuse-clang-state", cmdline_options.reuse_clang_state,
+                 "Keep the file manager and target information alive across "
+                 "probes")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--shared-stat-cache", cmdline_options.shared_stat_cache,
+                 "Share the file system lookups made by clang across all the "
+                 "probes and workers")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--prefetch-headers", cmdline_options.prefetch_headers,
+                 "Read ahead the candidate headers and the system headers of "
+                 "the profile on background threads; speeds up cold runs")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--header-map", cmdline_options.use_header_map,
+                 "Resolve the headers found in the header folders with a "
+                 "single lookup in a clang header map, instead of searching "
+                 "each folder")
+      ->take_last();
+
+  // Lets the compile command skip the header search for the library
+  generate_cmd
+      ->add_flag("--emit-header-map", cmdline_options.emit_header_map,
+                 "Save a clang header map resolving the included headers to "
+                 "the paths found while probing, to be passed to the compile "
+                 "command with --header-map")
+      ->take_last();
+
+  // Lets the compile command skip the parsing of the accepted headers
+  generate_cmd
+      ->add_flag("--emit-pch", cmdline_options.emit_pch,
+                 "Precompile the ABI library header with the compile command "
+                 "arguments, to be passed to the compile command with --pch")
+      ->take_last();
+
+  // The checks performed by each probe, from the cheapest one
+  auto probe_tiers_option = generate_cmd->add_option(
+      "--probe-tiers", cmdline_options.probe_tiers,
+      "Comma separated list of probe tiers: preprocess, parse (default: "
+      "parse)");
+
+  // clang-format off
+  probe_tiers_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        ProbeTierList probe_tier_list;
+        if (!parseProbeTierList(probe_tier_list, value)) {
+          return "Invalid probe tier list";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  generate_cmd
+      ->add_flag("--stop-at-first-error", cmdline_options.stop_at_first_error,
+                 "Abort each probe as soon as the first error is emitted")
+      ->take_last();
+
+  // Probes only need the outcome; formatting the warnings of noisy headers
+  // takes a good share of each probe
+  generate_cmd
+      ->add_flag("--verbose-diagnostics", cmdline_options.verbose_diagnostics,
+                 "Render the warnings of the probes, and print the "
+                 "diagnostics of each probe; by default the probes ignore "
+                 "warnings")
+      ->take_last();
+
+  // Inline functions and templates make up most of the parsing time of C++
+  // headers
+  generate_cmd
+      ->add_flag("--skip-function-bodies",
+                 cmdline_options.skip_function_bodies,
+                 "Do not parse the function bodies in the probes and in the "
+                 "final pass; headers that only fail inside a function body "
+                 "are accepted, and the errors are reported by the compile "
+                 "command instead")
+      ->take_last();
+
+  // Most failures of the later sweeps are caused by missing files or by
+  // identifiers that no accepted header declares
+  generate_cmd
+      ->add_flag("--classify-failures", cmdline_options.classify_probe_failures,
+                 "Classify the probe failures: headers including a missing "
+                 "file or redefining a declaration are dropped, and the ones "
+                 "using an undeclared identifier are only probed again once "
+                 "it may have been declared; only used by the sequential "
+                 "probe strategy")
+      ->take_last();
+
+  // SDKs that are not self-contained otherwise need one sweep for each
+  // level of their missing prerequisites
+  generate_cmd
+      ->add_flag("--discover-prerequisites",
+                 cmdline_options.discover_prerequisites,
+                 "Index the identifiers declared by the candidate headers; a "
+                 "header failing on an undeclared identifier is probed again "
+                 "right after the headers declaring it. Requires "
+                 "--classify-failures")
+      ->take_last();
+
+  // Regenerating an unchanged library then only costs a couple of
+  // compilations
+  generate_cmd
+      ->add_flag("--lockfile", cmdline_options.use_lockfile,
+                 "Start from the include list saved in <output>.lock by the "
+                 "previous run; the headers it discarded are not probed "
+                 "again unless they have changed or a new header has been "
+                 "accepted")
+      ->take_last();
+
+  // A new release of an SDK mostly ships the same headers with small
+  // edits, which miss the exact hash caches
+  generate_cmd
+      ->add_option("--warm-start", cmdline_options.warm_start_path,
+                   "Start from the include list of the given lockfile or "
+                   "ABI database, written by a run on a previous version of "
+                   "the headers; headers are matched by include directive, "
+                   "and only the new or failing ones are probed")
+      ->take_last();
+
+  // Long runs on preemptible machines would otherwise lose all the probes
+  generate_cmd
+      ->add_option("--checkpoint-interval", cmdline_options.checkpoint_interval,
+                   "How often the probe state is saved to <output>.checkpoint, "
+                   "in seconds; zero disables the checkpoints")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--resume", cmdline_options.resume,
+                 "Resume the probing from the checkpoint saved by an "
+                 "interrupted run with the same settings and headers")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--final-pass-recovery-limit",
+                   cmdline_options.final_pass_recovery_limit,
+                   "How many accepted headers can be dropped when they no "
+                   "longer compile together in the final pass, before "
+                   "running it again; zero disables the recovery")
+      ->take_last();
+
+  // A single header stuck in a template instantiation storm would otherwise
+  // stall the whole run
+  generate_cmd
+      ->add_option("--probe-timeout", cmdline_options.probe_timeout,
+                   "Abort the probes running for longer than this many "
+                   "seconds, and quarantine the headers that caused them; "
+                   "zero disables the limit")
+      ->take_last();
+
+  // A partial library produced on time is sometimes worth more than the
+  // complete one
+  generate_cmd
+      ->add_option("--time-budget", cmdline_options.probing_time_budget,
+                   "Stop probing the headers after this many seconds, and "
+                   "generate the library from the ones accepted so far; the "
+                   "headers declaring the most functions are probed first. "
+                   "Zero disables the limit")
+      ->take_last();
+
+  // Most of the candidate directives of a nested header resolve to another
+  // file, or to no file at all
+  generate_cmd
+      ->add_flag("--resolve-directives",
+                 cmdline_options.resolve_include_directives,
+                 "Skip the include directives that do not resolve to the "
+                 "probed header, trying the prefix accepted for its siblings "
+                 "first")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--skip-included-headers",
+                 cmdline_options.skip_included_headers,
+                 "Do not probe the guarded headers that an accepted header "
+                 "has already included")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--time-report", cmdline_options.time_report,
+                 "Print the time and peak memory of each phase, the memory "
+                 "used by the analysis, the costliest headers and the "
+                 "slowest probes")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--stats", cmdline_options.visitor_statistics,
+                 "Print the counters of the AST visitor: visited functions, "
+                 "expanded classes and types, type graph size, taint "
+                 "propagation steps and mangling calls")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--hw-counters", cmdline_options.hardware_counters,
+                 "Sample the hardware counters (cycles, instructions, LLC "
+                 "misses, page faults and dTLB misses) of each phase; "
+                 "implies --time-report")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--trace-file", cmdline_options.trace_file,
+                   "Save a Chrome trace event file of the run, which can be "
+                   "opened with chrome://tracing or Perfetto")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--metrics-file", cmdline_options.metrics_file,
+                   "Save the phase timings and the memory usage of the run "
+                   "as a JSON file")
+      ->take_last();
+
+  // The profiler uses a timer signal, so it also works where perf can't be
+  // attached
+  generate_cmd
+      ->add_option("--profile-samples", cmdline_options.profile_samples,
+                   "Sample the stacks of all the threads during the run and "
+                   "save them as folded stacks (tagged with the phase and "
+                   "the candidate header), which flame graph tools can load")
+      ->take_last();
+
+  // The recorder is always on, since the runs that need it are the ones
+  // nobody expected to investigate
+  generate_cmd
+      ->add_option("--flight-recorder", cmdline_options.flight_recorder_path,
+                   "Where the recent events (phases, probes and cache misses) "
+                   "are saved on crashes, on SIGUSR1 and when the deadline "
+                   "is exceeded (default: the output path followed by "
+                   "\".flight\")")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--no-flight-recorder",
+                 cmdline_options.disable_flight_recorder,
+                 "Do not record the recent events of the run")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--flight-recorder-deadline",
+                   cmdline_options.flight_recorder_deadline,
+                   "Also save the recent events once the run has lasted this "
+                   "many seconds")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--events", cmdline_options.event_destination,
+                   "Write the progress events of the run as newline-delimited "
+                   "JSON to this file descriptor number or file path")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--record-probes", cmdline_options.probe_log_path,
+                   "Record each probe (candidate, prefix, outcome and timing) "
+                   "to this file, to be replayed by the simulate command")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--depfile", cmdline_options.depfile_path,
+                   "Save a Make-style dependency file listing the headers "
+                   "the ABI library has been generated from")
+      ->take_last();
+
+  // Probing the headers in dependency order, or in the order in which the
+  // previous run accepted them, accepts most of them during the first sweep
+  auto header_order_option = generate_cmd->add_option(
+      "--header-order", cmdline_options.header_order,
+      "The order in which headers are probed: walk, dependencies, umbrella, "
+      "history (default: walk)");
+
+  // clang-format off
+  header_order_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "walk" && value != "dependencies" &&
+            value != "umbrella" && value != "history") {
+          return "Invalid header order";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  // Freeing the AST of a large translation unit takes a noticeable share of
+  // each compilation
+  auto clang_teardown_option = generate_cmd->add_option(
+      "--clang-teardown", cmdline_options.clang_teardown,
+      "How the clang state of each compilation is released: destroy, "
+      "background, leak (default: destroy)");
+
+  // clang-format off
+  clang_teardown_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "destroy" && value != "background" && value != "leak") {
+          return "Invalid clang teardown mode";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  generate_cmd
+      ->add_flag("--huge-pages", cmdline_options.huge_pages,
+                 "Back the type graph and the AST of the final pass with "
+                 "transparent huge pages, to reduce the TLB misses of the "
+                 "AST walks")
+      ->take_last();
+
+  std::string probe_strategy_names;
+  for (const auto &name : ProbeStrategy::strategyNameList()) {
+    probe_strategy_names += (probe_strategy_names.empty() ? "" : ", ") + name;
+  }
+
+  auto probe_strategy_option = generate_cmd->add_option(
+      "--strategy,--probe-strategy", cmdline_options.probe_strategy,
+      "How headers are probed: " + probe_strategy_names +
+          ", or auto to pick one (and the batch size) after probing a "
+          "sample of the headers (default: sequential)");
+
+  // clang-format off
+  probe_strategy_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        const auto &name_list = ProbeStrategy::strategyNameList();
+        if (value != "auto" &&
+            std::find(name_list.begin(), name_list.end(), value) ==
+            name_list.end()) {
+          return "Invalid probe strategy";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  // Keeps the probes small when most headers only need a few others
+  generate_cmd
+      ->add_flag("--minimal-probe-prefix", cmdline_options.minimal_probe_prefix,
+                 "Probe each header on top of the accepted headers it "
+                 "includes only, and confirm them with a single compilation; "
+                 "the headers rejected this way are then probed with the "
+                 "selected strategy")
+      ->take_last();
+
+  // Loosely coupled libraries under the same root no longer wait on each
+  // other
+  generate_cmd
+      ->add_flag("--component-probes", cmdline_options.component_probes,
+                 "Probe the connected components of the include graph "
+                 "concurrently, each until no new header is accepted, and "
+                 "confirm the union with a single compilation")
+      ->take_last();
+
+  auto batch_size_option = generate_cmd->add_option(
+      "--batch-size", cmdline_options.batch_size,
+      "Amount of headers tested at once by the batch probe strategy, and "
+      "by the attribute strategy when it falls back to it");
+
+  batch_size_option->take_last()->check(
+      getPositiveIntegerValidator("batch size"));
+
+  generate_cmd
+      ->add_flag("--scoped-traversal", cmdline_options.scoped_traversal,
+                 "Only analyze the functions declared inside the header "
+                 "folders")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--lazy-type-expansion", cmdline_options.lazy_type_expansion,
+                 "Only expand the type dependencies needed to decide whether "
+                 "a function can be used; the reported causes may be "
+                 "incomplete")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--analyze-while-parsing",
+                 cmdline_options.analyze_while_parsing,
+                 "Visit the functions as the declarations are parsed; with "
+                 "--lazy-type-expansion, the types they use are also "
+                 "checked as soon as their records are complete")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--report-redeclarations",
+                 cmdline_options.report_redeclarations,
+                 "Record each redeclaration of a function on its own; "
+                 "redeclared functions are then blacklisted as duplicates")
+      ->take_last();
+
+  // Matched before the classes and types of each function are expanded, so
+  // that the namespaces we do not care about (such as std) cost nothing
+  generate_cmd->add_option(
+      "--include-namespace", cmdline_options.include_namespaces,
+      "Only analyze the functions declared in the namespaces matching these "
+      "regular expressions (i.e.: mylib(::.*)?); an empty match selects the "
+      "global namespace");
+
+  generate_cmd->add_option(
+      "--exclude-name", cmdline_options.exclude_names,
+      "Skip the functions whose qualified name matches these regular "
+      "expressions (i.e.: boost::detail::.*, .*\\(anonymous namespace\\).*)");
+
+  generate_cmd
+      ->add_option("--binary", cmdline_options.binary_path,
+                   "Only generate the functions imported by this ELF or PE "
+                   "file")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--verify-against", cmdline_options.verify_library_path,
+                   "Blacklist the functions that are not exported by this "
+                   "shared library (ELF or PE)")
+      ->take_last();
+
+  auto analysis_shards_option = generate_cmd->add_option(
+      "--analysis-shards", cmdline_options.analysis_shards,
+      "Amount of shards (and threads) used by the final analysis");
+
+  analysis_shards_option->take_last()->check(
+      getPositiveIntegerValidator("shard count"));
+
+  // Each group is parsed in its own translation unit, so that the whole
+  // library never has to be kept in memory
+  generate_cmd
+      ->add_option("--analysis-group-size",
+                   cmdline_options.analysis_group_size,
+                   "Analyze the accepted headers in groups of this size, one "
+                   "translation unit per group; zero analyzes all of them at "
+                   "once")
+      ->take_last();
+
+  // The analysis workers compete with the probes for the CPU, but the
+  // final pass no longer waits for the last sweep
+  generate_cmd
+      ->add_flag("--pipeline-analysis", cmdline_options.pipeline_analysis,
+                 "Analyze each group of accepted headers while the probing "
+                 "goes on; requires --analysis-group-size")
+      ->take_last();
+
+  // One extra translation unit stays in memory while the probes run
+  generate_cmd
+      ->add_flag("--reuse-probe-ast", cmdline_options.reuse_probe_ast,
+                 "Keep the AST of the last accepted probe, and run the final "
+                 "analysis on it instead of parsing the headers again")
+      ->take_last();
+
+  auto finalize_threads_option = generate_cmd->add_option(
+      "--finalize-threads", cmdline_options.finalize_threads,
+      "Amount of threads used by each shard to filter the functions");
+
+  finalize_threads_option->take_last()->check(
+      getPositiveIntegerValidator("thread count"));
+
+  generate_cmd
+      ->add_flag("--full-blacklist-causes",
+                 cmdline_options.full_blacklist_causes,
+                 "List every blacklisted type reachable from a blacklisted "
+                 "function, instead of the shortest path to a function type")
+      ->take_last();
+
+  auto expansion_threads_option = generate_cmd->add_option(
+      "--type-expansion-threads", cmdline_options.type_expansion_threads,
+      "Amount of threads used by each shard to expand the type dependencies "
+      "of the functions it has found");
+
+  expansion_threads_option->take_last()->check(
+      getPositiveIntegerValidator("thread count"));
+
+  auto shards_option = generate_cmd->add_option(
+      "--shards", cmdline_options.shards,
+      "Amount of implementation files to generate; each one can be compiled "
+      "separately");
+
+  shards_option->take_last()->check(getPositiveIntegerValidator("shard count"));
+
+  auto shard_partitioning_option = generate_cmd->add_option(
+      "--shard-partitioning", cmdline_options.shard_partitioning,
+      "How the functions are split into the shards: prefix, headers (each "
+      "shard only includes the headers declaring its functions), or auto "
+      "to use headers along with --minimal-probe-prefix (default: auto)");
+
+  // clang-format off
+  shard_partitioning_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "auto" && value != "prefix" && value != "headers") {
+          return "Invalid shard partitioning";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  // clang spends far more time and memory on a single huge initializer list
+  // than on many small ones
+  generate_cmd
+      ->add_option("--extern-array-size", cmdline_options.extern_array_size,
+                   "Maximum amount of functions referenced by each "
+                   "__mcsema_externs array; 0 emits a single array per "
+                   "implementation file (default: 4096)")
+      ->take_last();
+
+  // Each file only changes with the functions of its header, so the compile
+  // cache can skip the others
+  generate_cmd
+      ->add_flag("--header-sublibraries", cmdline_options.header_sublibraries,
+                 "Generate one implementation file per discovered header, "
+                 "inside the <output>_headers folder, instead of following "
+                 "--shards")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--emit-bitcode", cmdline_options.emit_bitcode,
+                 "Also write the ABI library bitcode to <output>.bc, reusing "
+                 "the AST of the final analysis")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--sliced-header", cmdline_options.sliced_header,
+                 "Declare the whitelisted functions (and the types they "
+                 "need) in the generated header, instead of including the "
+                 "discovered headers; C only")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--json-report", cmdline_options.json_report,
+                 "Also save the whitelisted and blacklisted functions to "
+                 "<output>.json")
+      ->take_last();
+
+  addBlacklistReportOption(generate_cmd, cmdline_options);
+
+  generate_cmd
+      ->add_flag("--mcsema-definitions", cmdline_options.mcsema_definitions,
+                 "Also save the mcsema external definitions of the "
+                 "whitelisted functions to <output>.defs.txt")
+      ->take_last();
+
+  generate_cmd
+      ->add_flag("--save-database", cmdline_options.save_database,
+                 "Also save the analysis results to <output>.abidb; use the "
+                 "render command to emit the ABI library again from it")
+      ->take_last();
+
+  // Trying a different blacklist policy or output format no longer means
+  // parsing the whole SDK again
+  generate_cmd
+      ->add_flag("--save-ast", cmdline_options.save_ast,
+                 "Also serialize the AST of the final pass to the --cache-dir "
+                 "folder; use --from-ast to analyze it again")
+      ->take_last();
+
+  generate_cmd
+      ->add_option("--from-ast", cmdline_options.ast_snapshot_path,
+                   "Skip the header enumeration and the probing, and run the "
+                   "analysis on the AST snapshot saved with --save-ast")
+      ->take_last();
+}
+}  // namespace
+
+bool parseProfileNameList(StringList &profile_name_list,
+                          const std::string &definition) {
+  return parseCommaSeparatedList(profile_name_list, definition);
+}
+
+bool parseTargetTripleList(StringList &target_triple_list,
+                           const std::string &definition) {
+  return parseCommaSeparatedList(target_triple_list, definition);
+}
+
+std::size_t getThreadBudget(const CLI::App &command,
+                            const CommandLineOptions &cmdline_options) {
+  for (const auto option : command.get_options()) {
+    if (option->check_lname("jobs") && option->count() > 0U) {
+      return cmdline_options.jobs;
+    }
+  }
+
+  return 0U;
+}
 
 void initializeCommandLineParser(CLI::App &cmdline_parser,
                                  CommandLineOptions &cmdline_options,
@@ -24,27 +962,587 @@ void initializeCommandLineParser(CLI::App &cmdline_parser,
   cmdline_parser.require_subcommand();
 
   //
-  // Initialize the 'version' command
+  // Initialize the 'version' command
+  //
+
+  auto version_cmd =
+      cmdline_parser.add_subcommand("version", "Prints the abigen version");
+
+  command_map.insert({version_cmd, versionCommandHandler});
+
+  //
+  // Initialize the 'generate' command
+  //
+
+  auto generate_cmd =
+      cmdline_parser.add_subcommand("generate", "Generate an ABI library");
+
+  addGenerateOptions(generate_cmd, cmdline_options, profile_manager,
+                     language_manager);
+
+  command_map.insert({generate_cmd, generateCommandHandler});
+
+  //
+  // Initialize the 'compile' command
+  //
+
+  auto compile_cmd =
+      cmdline_parser.add_subcommand("compile", "Compiles an ABI library");
+
+  // The profile determines the options and include folders we will use when
+  // parsing the include headers
+  auto profile_option =
+      compile_cmd->add_option("-p,--profile", cmdline_options.profile_name,
+                              "Profile name; use the list_profiles command to "
+                              "list the available options");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  /// The language used to parse the include headers
+  auto language_option =
+      compile_cmd->add_option("-l,--language", cmdline_options.language,
+                              "Language name; use the list_languages command "
+                              "to list the available options");
+
+  language_option->required(true)->take_last();
+
+  // clang-format off
+  language_option->check(
+      [&language_manager](const std::string &definition) -> std::string {
+        Language language;
+        int standard;
+        if (!language_manager.parseLanguageDefinition(language, standard, definition)) {
+          return "Invalid language";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  compile_cmd
+      ->add_flag("-x,--enable-gnu-extensions",
+                 cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
+      ->take_last();
+
+  compile_cmd
+      ->add_flag("-z,--use-visual-cxx-mangling",
+                 cmdline_options.use_visual_cxx_mangling,
+                 "Use Visual C++ name mangling")
+      ->take_last();
+
+  compile_cmd->add_option("-i,--include-search-paths",
+                          cmdline_options.additional_include_folders,
+                          "Additional include folders");
+
+  // Libraries generated with --target-triples must be compiled for the
+  // same triple
+  compile_cmd
+      ->add_option("--target-triple", cmdline_options.target_triples,
+                   "Target triple of the modules; x86_64-pc-linux-gnu is "
+                   "used when omitted")
+      ->take_last();
+
+  // The source files to compile
+  compile_cmd
+      ->add_option("-f,--source-file",
+                   cmdline_options.abi_library_source_file_list,
+                   "Source files, or folders containing the .cpp shards; "
+                   "the modules are linked together")
+      ->required();
+
+  // How many source files can be compiled at the same time
+  auto jobs_option = compile_cmd->add_option(
+      "-j,--jobs", cmdline_options.jobs,
+      "Amount of source files that are compiled concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  // Where the generated bitcode is cached across runs
+  compile_cmd
+      ->add_option("--cache-dir", cmdline_options.cache_directory,
+                   "Folder used to cache the generated bitcode across runs")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--remote-cache", cmdline_options.remote_cache_url,
+                   "http:// URL of a shared cache server; the --cache-dir "
+                   "folder downloads the bitcode it is missing, and uploads "
+                   "the new one")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--cache-size-limit", cmdline_options.cache_size_limit,
+                   "Size in megabytes the --cache-dir folder is trimmed to "
+                   "at the end of the run, removing the least recently used "
+                   "files; requires --remote-cache")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--module-cache", cmdline_options.module_cache_directory,
+                   "Folder containing the clang modules built by the "
+                   "generate command")
+      ->take_last();
+
+  compile_cmd->add_option(
+      "--module-map", cmdline_options.module_map_files,
+      "Module maps to load, such as the one saved by generate --module-cache");
+
+  compile_cmd
+      ->add_option("--metrics-file", cmdline_options.metrics_file,
+                   "Save the phase timings and the memory usage of the run "
+                   "as a JSON file")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--depfile", cmdline_options.depfile_path,
+                   "Save a Make-style dependency file listing the source "
+                   "files and the headers the bitcode has been compiled from")
+      ->take_last();
+
+  compile_cmd
+      ->add_flag("--strip-bitcode", cmdline_options.strip_bitcode,
+                 "Only keep the declarations referenced by the "
+                 "__mcsema_externs arrays, without bodies or metadata")
+      ->take_last();
+
+  // Loading the bitcode of a large library is slow when a lift only needs a
+  // few of its functions
+  compile_cmd
+      ->add_flag("--lazy-bitcode", cmdline_options.lazy_bitcode,
+                 "Add a module summary index to the bitcode; consumers can "
+                 "read it with llvm::getModuleSummaryIndex(), open the module "
+                 "with llvm::getLazyBitcodeModule(), and materialize only "
+                 "the functions they need")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--header-map", cmdline_options.header_map_path,
+                   "The header map saved by generate --emit-header-map; the "
+                   "headers it lists are found without searching the "
+                   "include folders")
+      ->take_last();
+
+  compile_cmd
+      ->add_option("--pch", cmdline_options.precompiled_header_path,
+                   "The precompiled header saved by generate --emit-pch; it "
+                   "is only loaded when the compile options and the headers "
+                   "have not changed")
+      ->take_last();
+
+  // Lets a pipeline read the bitcode without a round trip through the disk
+  compile_cmd
+      ->add_option("--output-fd", cmdline_options.output_fd,
+                   "Write the bitcode to this open file descriptor (such as a "
+                   "pipe or a memfd); the output path then only names it in "
+                   "the dependency file")
+      ->take_last();
+
+  // Include files that will always be added inside the ABI library
+  compile_cmd->add_option(
+      "-b,--base-includes", cmdline_options.base_includes,
+      "Includes that should always be present in the ABI header");
+
+  // Where the output should be saved
+  compile_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Output path, including the file name without the "
+                   "extension; - writes the bitcode to the standard output")
+      ->required();
+
+  command_map.insert({compile_cmd, compileCommandHandler});
+
+  //
+  // Initialize the 'build' command
+  //
+
+  // The generated sources are compiled from memory, skipping the round trip
+  // through the output folder
+  auto build_cmd = cmdline_parser.add_subcommand(
+      "build", "Generates an ABI library and compiles it to <output>.bc");
+
+  addGenerateOptions(build_cmd, cmdline_options, profile_manager,
+                     language_manager);
+
+  build_cmd
+      ->add_flag("--strip-bitcode", cmdline_options.strip_bitcode,
+                 "Only keep the declarations referenced by the "
+                 "__mcsema_externs arrays, without bodies or metadata")
+      ->take_last();
+
+  build_cmd
+      ->add_flag("--lazy-bitcode", cmdline_options.lazy_bitcode,
+                 "Add a module summary index to the bitcode")
+      ->take_last();
+
+  build_cmd
+      ->add_flag("--emit-sources", cmdline_options.emit_sources,
+                 "Also save the header and the implementation files that "
+                 "have been compiled")
+      ->take_last();
+
+  command_map.insert({build_cmd, buildCommandHandler});
+
+  //
+  // Initialize the 'merge' command
+  //
+
+  auto merge_cmd = cmdline_parser.add_subcommand(
+      "merge",
+      "Links several ABI library bitcode files into a single library, "
+      "merging their shared declarations and types");
+
+  merge_cmd
+      ->add_option("-i,--input", cmdline_options.merge_input_list,
+                   "The bitcode files saved by the compile command")
+      ->required();
+
+  // Independent pairs of libraries are linked at the same time
+  jobs_option = merge_cmd->add_option(
+      "-j,--jobs", cmdline_options.jobs,
+      "Amount of library pairs that are linked concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  merge_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Path of the merged bitcode file")
+      ->required()
+      ->take_last();
+
+  command_map.insert({merge_cmd, mergeCommandHandler});
+
+  //
+  // Initialize the 'render' command
+  //
+
+  auto render_cmd = cmdline_parser.add_subcommand(
+      "render",
+      "Emits an ABI library from the database saved by the generate command, "
+      "without parsing the headers again");
+
+  // Exactly one of the database and of the AST snapshot is required; this
+  // is checked by the command handler
+  render_cmd
+      ->add_option("-d,--database", cmdline_options.database_path,
+                   "The database saved with generate --save-database")
+      ->take_last();
+
+  // The AST visitor is run again on the snapshot, so the analysis options
+  // keep their default values
+  render_cmd
+      ->add_option("--from-ast", cmdline_options.ast_snapshot_path,
+                   "The AST snapshot saved with generate --save-ast; it is "
+                   "analyzed again instead of reading a database")
+      ->take_last();
+
+  render_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Output path, including the file name without the extension")
+      ->required()
+      ->take_last();
+
+  profile_option =
+      render_cmd->add_option("-p,--profile", cmdline_options.profile_name,
+                             "Profile name, only used for the comments of the "
+                             "generated files; defaults to the one saved in "
+                             "the database");
+
+  profile_option->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  language_option =
+      render_cmd->add_option("-l,--language", cmdline_options.language,
+                             "Language name; C++ languages wrap the "
+                             "declarations in an extern \"C\" block. "
+                             "Defaults to the one saved in the database");
+
+  language_option->take_last();
+
+  // clang-format off
+  language_option->check(
+      [&language_manager](const std::string &definition) -> std::string {
+        Language language;
+        int standard;
+        if (!language_manager.parseLanguageDefinition(language, standard, definition)) {
+          return "Invalid language";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  shards_option = render_cmd->add_option(
+      "--shards", cmdline_options.shards,
+      "Amount of implementation files to generate; each one can be compiled "
+      "separately");
+
+  shards_option->take_last()->check(getPositiveIntegerValidator("shard count"));
+
+  render_cmd
+      ->add_flag("--header-sublibraries", cmdline_options.header_sublibraries,
+                 "Generate one implementation file per discovered header, "
+                 "inside the <output>_headers folder, instead of following "
+                 "--shards")
+      ->take_last();
+
+  render_cmd
+      ->add_option("--symbols", cmdline_options.symbol_list_path,
+                   "Only emit the whitelisted functions whose mangled name is "
+                   "listed in this file, one per line")
+      ->take_last();
+
+  render_cmd
+      ->add_flag("--json-report", cmdline_options.json_report,
+                 "Also save the whitelisted and blacklisted functions to "
+                 "<output>.json")
+      ->take_last();
+
+  addBlacklistReportOption(render_cmd, cmdline_options);
+
+  render_cmd
+      ->add_flag("--mcsema-definitions", cmdline_options.mcsema_definitions,
+                 "Also save the mcsema external definitions of the "
+                 "whitelisted functions to <output>.defs.txt")
+      ->take_last();
+
+  command_map.insert({render_cmd, renderCommandHandler});
+
+  //
+  // Initialize the 'diff' command
+  //
+
+  auto diff_cmd = cmdline_parser.add_subcommand(
+      "diff",
+      "Compares the functions and the headers of two databases saved by the "
+      "generate command, without parsing the headers again");
+
+  diff_cmd
+      ->add_option("old", cmdline_options.diff_old_database,
+                   "The database of the previous version")
+      ->required();
+
+  diff_cmd
+      ->add_option("new", cmdline_options.diff_new_database,
+                   "The database of the new version")
+      ->required();
+
+  diff_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Save the differences to this file instead of printing "
+                   "them")
+      ->take_last();
+
+  diff_cmd
+      ->add_flag("--exit-code", cmdline_options.diff_exit_code,
+                 "Fail when the databases are different")
+      ->take_last();
+
+  command_map.insert({diff_cmd, diffCommandHandler});
+
+  //
+  // Initialize the 'list_profiles' command
+  //
+
+  auto list_profiles_cmd = cmdline_parser.add_subcommand(
+      "list_profiles", "List the available profiles");
+
+  list_profiles_cmd->add_flag("-v,--verbose",
+                              cmdline_options.verbose_profile_list,
+                              "Show a more verbose profile list");
+
+  command_map.insert({list_profiles_cmd, listProfilesCommandHandler});
+
+  //
+  // Initialize the 'pack_profile' command
+  //
+
+  auto pack_profile_cmd = cmdline_parser.add_subcommand(
+      "pack_profile",
+      "Packs the profile headers in a single archive, that is used in place "
+      "of the loose files");
+
+  profile_option =
+      pack_profile_cmd->add_option("-p,--profile", cmdline_options.profile_name,
+                                   "Profile name; use the list_profiles "
+                                   "command to list the available options");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  pack_profile_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Output path; defaults to profile.pack inside the profile "
+                   "folder, where it is automatically used")
+      ->take_last();
+
+  command_map.insert({pack_profile_cmd, packProfileCommandHandler});
+
+  //
+  // Initialize the 'import_profile' command
+  //
+
+  auto import_profile_cmd = cmdline_parser.add_subcommand(
+      "import_profile",
+      "Copies the profile headers to a content-addressed store shared by all "
+      "the profiles, and writes a manifest that is used in place of the "
+      "loose files");
+
+  profile_option = import_profile_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  // Headers that are identical across profiles are saved only once; the
+  // same store should be used for all the profiles
+  import_profile_cmd
+      ->add_option("-s,--store", cmdline_options.profile_store,
+                   "The store folder, shared by all the imported profiles")
+      ->required(true)
+      ->take_last();
+
+  import_profile_cmd
+      ->add_option("-o,--output", cmdline_options.output,
+                   "Output path; defaults to profile.manifest inside the "
+                   "profile folder, where it is automatically used")
+      ->take_last();
+
+  command_map.insert({import_profile_cmd, importProfileCommandHandler});
+
+  //
+  // Initialize the 'build_profile_pch' command
   //
 
-  auto version_cmd =
-      cmdline_parser.add_subcommand("version", "Prints the abigen version");
+  auto build_profile_pch_cmd = cmdline_parser.add_subcommand(
+      "build_profile_pch",
+      "Precompiles a standard set of system headers for the given profile, "
+      "so that the generate command can load them with --profile-pch");
 
-  command_map.insert({version_cmd, versionCommandHandler});
+  profile_option = build_profile_pch_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  language_option = build_profile_pch_cmd->add_option(
+      "-l,--language", cmdline_options.language,
+      "Language name; all the supported languages are built when omitted");
+
+  language_option->take_last();
+
+  // clang-format off
+  language_option->check(
+      [&language_manager](const std::string &definition) -> std::string {
+        Language language;
+        int standard;
+        if (!language_manager.parseLanguageDefinition(language, standard, definition)) {
+          return "Invalid language";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  build_profile_pch_cmd
+      ->add_flag("-x,--enable-gnu-extensions",
+                 cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
+      ->take_last();
+
+  build_profile_pch_cmd
+      ->add_option("--cache-dir", cmdline_options.cache_directory,
+                   "Save the headers in this folder instead of the profile "
+                   "folder; the generate command searches both")
+      ->take_last();
+
+  command_map.insert({build_profile_pch_cmd, buildProfilePCHCommandHandler});
 
   //
-  // Initialize the 'generate' command
+  // Initialize the 'build_profile_summary' command
   //
 
-  auto generate_cmd =
-      cmdline_parser.add_subcommand("generate", "Generate an ABI library");
+  auto build_profile_summary_cmd = cmdline_parser.add_subcommand(
+      "build_profile_summary",
+      "Records whether each type defined by a standard set of system headers "
+      "can reach a function type, so that the generate command can look them "
+      "up with --profile-summary");
 
-  // The profile determines the options and include folders we will use when
-  // parsing the include headers
-  auto profile_option =
-      generate_cmd->add_option("-p,--profile", cmdline_options.profile_name,
-                               "Profile name; use the list_profiles command to "
-                               "list the available options");
+  profile_option = build_profile_summary_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options");
 
   profile_option->required(true)->take_last();
 
@@ -62,13 +1560,12 @@ void initializeCommandLineParser(CLI::App &cmdline_parser,
   );
   // clang-format on
 
-  /// The language used to parse the include headers
-  auto language_option =
-      generate_cmd->add_option("-l,--language", cmdline_options.language,
-                               "Language name; use the list_languages command "
-                               "to list the available options");
+  language_option = build_profile_summary_cmd->add_option(
+      "-l,--language", cmdline_options.language,
+      "Language name; all the supported languages are summarized when "
+      "omitted");
 
-  language_option->required(true)->take_last();
+  language_option->take_last();
 
   // clang-format off
   language_option->check(
@@ -84,53 +1581,323 @@ void initializeCommandLineParser(CLI::App &cmdline_parser,
   );
   // clang-format on
 
-  generate_cmd
+  build_profile_summary_cmd
       ->add_flag("-x,--enable-gnu-extensions",
                  cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
       ->take_last();
 
-  generate_cmd
-      ->add_flag("-z,--use-visual-cxx-mangling",
-                 cmdline_options.use_visual_cxx_mangling,
-                 "Use Visual C++ name mangling")
+  build_profile_summary_cmd
+      ->add_option("--cache-dir", cmdline_options.cache_directory,
+                   "Save the summaries in this folder instead of the profile "
+                   "folder; the generate command searches both")
       ->take_last();
 
-  generate_cmd->add_option("-i,--include-search-paths",
-                           cmdline_options.additional_include_folders,
-                           "Additional include folders");
+  command_map.insert(
+      {build_profile_summary_cmd, buildProfileSummaryCommandHandler});
 
-  // The folder to scan for include files
-  generate_cmd
+  //
+  // Initialize the 'serve' command
+  //
+
+  auto serve_cmd = cmdline_parser.add_subcommand(
+      "serve",
+      "Executes generate and compile requests received on a Unix socket, "
+      "keeping the profiles and the caches loaded across requests");
+
+  serve_cmd
+      ->add_option("--socket", cmdline_options.socket_path,
+                   "Path of the Unix socket to listen on")
+      ->required()
+      ->take_last();
+
+  // How many requests can be executed at the same time
+  jobs_option = serve_cmd->add_option("-j,--jobs", cmdline_options.jobs,
+                                      "Amount of requests that are executed "
+                                      "concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  serve_cmd
+      ->add_option("--state-dir", cmdline_options.state_directory,
+                   "Folder where the precompiled headers shared across "
+                   "requests are saved; defaults to a temporary folder")
+      ->take_last();
+
+  // Long running servers are monitored by scraping this endpoint
+  serve_cmd
+      ->add_option("--metrics-address", cmdline_options.metrics_address,
+                   "Address (host:port) of the HTTP endpoint serving the "
+                   "request, probe and cache metrics in the Prometheus "
+                   "format on /metrics")
+      ->take_last();
+
+  // The clang state of each request fragments the heap; without the trims,
+  // the resident memory keeps growing
+  serve_cmd
+      ->add_option("--heap-trim-interval", cmdline_options.heap_trim_interval,
+                   "Return the free heap memory to the system after this "
+                   "many requests, once the server is idle; 0 disables it "
+                   "(default: 1)")
+      ->take_last();
+
+  command_map.insert({serve_cmd, serveCommandHandler});
+
+  //
+  // Initialize the 'batch' command
+  //
+
+  auto batch_cmd = cmdline_parser.add_subcommand(
+      "batch",
+      "Executes the generate and compile jobs listed in a JSON manifest, "
+      "sharing the profiles and the caches across them");
+
+  batch_cmd
+      ->add_option("manifest", cmdline_options.manifest_path,
+                   "Manifest file; a \"jobs\" array of objects with a "
+                   "\"name\", the \"arguments\" of the command and an "
+                   "optional \"depends_on\" list of job names")
+      ->required();
+
+  // How many jobs can be executed at the same time
+  jobs_option = batch_cmd->add_option("-j,--jobs", cmdline_options.jobs,
+                                      "Amount of jobs that are executed "
+                                      "concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  batch_cmd
+      ->add_option("--state-dir", cmdline_options.state_directory,
+                   "Folder where the precompiled headers shared across "
+                   "jobs are saved; defaults to a temporary folder")
+      ->take_last();
+
+  command_map.insert({batch_cmd, batchCommandHandler});
+
+  //
+  // Initialize the 'worker' command
+  //
+
+  auto worker_cmd = cmdline_parser.add_subcommand(
+      "worker",
+      "Probes the headers dispatched by generate --remote-workers, listening "
+      "for the coordinators on a TCP address");
+
+  worker_cmd
+      ->add_option("--listen", cmdline_options.listen_address,
+                   "Address to listen on (i.e.: 0.0.0.0:7800)")
+      ->take_last();
+
+  worker_cmd
+      ->add_option("--connection-fd", cmdline_options.worker_connection_fd,
+                   "Serve a single coordinator on this inherited socket "
+                   "instead of listening; used by generate --isolate-probes")
+      ->take_last();
+
+  // How many headers can be probed at the same time
+  jobs_option = worker_cmd->add_option("-j,--jobs", cmdline_options.jobs,
+                                       "Amount of headers each coordinator "
+                                       "can probe concurrently");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  worker_cmd
+      ->add_option("--state-dir", cmdline_options.state_directory,
+                   "Folder where the header packs received from the "
+                   "coordinators are kept; defaults to a temporary folder")
+      ->take_last();
+
+  command_map.insert({worker_cmd, workerCommandHandler});
+
+  //
+  // Initialize the 'simulate' command
+  //
+
+  auto simulate_cmd = cmdline_parser.add_subcommand(
+      "simulate",
+      "Replays the probes recorded by generate --record-probes under each "
+      "probe strategy, projecting the compilations and time they need");
+
+  simulate_cmd
+      ->add_option("--probe-log", cmdline_options.probe_log_path,
+                   "The log saved with generate --record-probes")
+      ->required()
+      ->take_last();
+
+  auto simulated_header_order_option = simulate_cmd->add_option(
+      "--header-order", cmdline_options.simulated_header_order,
+      "The order in which the simulated runs probe the headers: recorded, "
+      "reverse, accepted (default: recorded)");
+
+  // clang-format off
+  simulated_header_order_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "recorded" && value != "reverse" && value != "accepted") {
+          return "Invalid header order";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  jobs_option = simulate_cmd->add_option(
+      "-j,--jobs", cmdline_options.simulated_jobs,
+      "Amount of headers the sequential strategy probes concurrently "
+      "(default: the job count of the recorded run)");
+
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  batch_size_option = simulate_cmd->add_option(
+      "--batch-size", cmdline_options.batch_size,
+      "Amount of headers tested at once by the batch probe strategy");
+
+  batch_size_option->take_last()->check(
+      getPositiveIntegerValidator("batch size"));
+
+  command_map.insert({simulate_cmd, simulateCommandHandler});
+
+  //
+  // Initialize the 'analyze_headers' command
+  //
+
+  auto analyze_headers_cmd = cmdline_parser.add_subcommand(
+      "analyze_headers",
+      "Measures the cost of including each header on its own, ranking the "
+      "most expensive ones");
+
+  profile_option = analyze_headers_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options");
+
+  profile_option->required(true)->take_last();
+
+  // clang-format off
+  profile_option->check(
+      [&profile_manager](const std::string &profile_name) -> std::string {
+        Profile profile;
+        auto status = profile_manager->get(profile, profile_name);
+        if (!status.succeeded()) {
+          return status.message();
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  language_option = analyze_headers_cmd->add_option(
+      "-l,--language", cmdline_options.language,
+      "Language name; use the list_languages command to list the available "
+      "options");
+
+  language_option->required(true)->take_last();
+
+  // clang-format off
+  language_option->check(
+      [&language_manager](const std::string &definition) -> std::string {
+        Language language;
+        int standard;
+        if (!language_manager.parseLanguageDefinition(language, standard, definition)) {
+          return "Invalid language";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  analyze_headers_cmd
+      ->add_flag("-x,--enable-gnu-extensions",
+                 cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
+      ->take_last();
+
+  analyze_headers_cmd->add_option("-i,--include-search-paths",
+                                  cmdline_options.additional_include_folders,
+                                  "Additional include folders");
+
+  analyze_headers_cmd
       ->add_option("-f,--header-folders", cmdline_options.header_folders,
-                   "Header folders")
+                   "Header folders; uncompressed .tar archives, and the "
+                   "folders inside them, are read without extracting them")
       ->required();
 
-  // Include files that will always be added inside the ABI library
-  generate_cmd->add_option(
+  analyze_headers_cmd->add_option(
+      "--include-glob", cmdline_options.include_globs,
+      "Only measure the headers matching these patterns; patterns without a "
+      "'/' are matched against the file name");
+
+  analyze_headers_cmd->add_option(
+      "--exclude-glob", cmdline_options.exclude_globs,
+      "Skip the headers and folders matching these patterns");
+
+  // The base includes are measured once, and their cost is not charged to
+  // the headers
+  analyze_headers_cmd->add_option(
       "-b,--base-includes", cmdline_options.base_includes,
-      "Includes that should always be present in the ABI header");
+      "Includes that are placed before each header");
 
-  // Where the output should be saved
-  generate_cmd
-      ->add_option("-o,--output", cmdline_options.output,
-                   "Output path, including the file name without the extension")
-      ->required();
+  jobs_option = analyze_headers_cmd->add_option(
+      "-j,--jobs", cmdline_options.jobs,
+      "Amount of headers that are measured concurrently");
 
-  command_map.insert({generate_cmd, generateCommandHandler});
+  jobs_option->take_last()->check(getPositiveIntegerValidator("job count"));
+
+  auto header_report_order_option = analyze_headers_cmd->add_option(
+      "--sort", cmdline_options.header_report_order,
+      "The measurement the headers are ranked on: parse, preprocess, tokens, "
+      "includes, functions (default: parse)");
+
+  // clang-format off
+  header_report_order_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        if (value != "parse" && value != "preprocess" && value != "tokens" &&
+            value != "includes" && value != "functions") {
+          return "Invalid sort order";
+        }
+
+        return "";
+      }
+  );
+  // clang-format on
+
+  analyze_headers_cmd
+      ->add_option("--top", cmdline_options.header_report_limit,
+                   "Amount of headers printed; 0 prints all of them "
+                   "(default: 25)")
+      ->take_last();
+
+  analyze_headers_cmd
+      ->add_option("--json", cmdline_options.header_report_path,
+                   "Save every measurement to this file as JSON")
+      ->take_last();
+
+  command_map.insert({analyze_headers_cmd, analyzeHeadersCommandHandler});
 
   //
-  // Initialize the 'compile' command
+  // Initialize the 'check' command
   //
 
-  auto compile_cmd =
-      cmdline_parser.add_subcommand("compile", "Compiles an ABI library");
+  auto check_cmd = cmdline_parser.add_subcommand(
+      "check",
+      "Checks that a single header is still accepted on top of the include "
+      "list of a lockfile, and lists its blacklisted functions");
 
-  // The profile determines the options and include folders we will use when
-  // parsing the include headers
-  profile_option =
-      compile_cmd->add_option("-p,--profile", cmdline_options.profile_name,
-                              "Profile name; use the list_profiles command to "
-                              "list the available options");
+  check_cmd
+      ->add_option("header", cmdline_options.check_header,
+                   "The header to check: an include directive, or the path "
+                   "of a file inside the header folders")
+      ->required();
+
+  check_cmd
+      ->add_option("--lockfile", cmdline_options.lockfile_path,
+                   "The lockfile saved by the generate command (<output>.lock)")
+      ->required();
+
+  profile_option = check_cmd->add_option(
+      "-p,--profile", cmdline_options.profile_name,
+      "Profile name; use the list_profiles command to list the available "
+      "options");
 
   profile_option->required(true)->take_last();
 
@@ -148,11 +1915,10 @@ void initializeCommandLineParser(CLI::App &cmdline_parser,
   );
   // clang-format on
 
-  /// The language used to parse the include headers
-  language_option =
-      compile_cmd->add_option("-l,--language", cmdline_options.language,
-                              "Language name; use the list_languages command "
-                              "to list the available options");
+  language_option = check_cmd->add_option(
+      "-l,--language", cmdline_options.language,
+      "Language name; use the list_languages command to list the available "
+      "options");
 
   language_option->required(true)->take_last();
 
@@ -170,52 +1936,92 @@ void initializeCommandLineParser(CLI::App &cmdline_parser,
   );
   // clang-format on
 
-  compile_cmd
+  check_cmd
       ->add_flag("-x,--enable-gnu-extensions",
                  cmdline_options.enable_gnu_extensions, "Enable GNU extensions")
       ->take_last();
 
-  compile_cmd
+  check_cmd
       ->add_flag("-z,--use-visual-cxx-mangling",
                  cmdline_options.use_visual_cxx_mangling,
                  "Use Visual C++ name mangling")
       ->take_last();
 
-  compile_cmd->add_option("-i,--include-search-paths",
-                          cmdline_options.additional_include_folders,
-                          "Additional include folders");
-
-  // The source file to compile
-  compile_cmd
-      ->add_option("-f,--source-file", cmdline_options.abi_library_source_file,
-                   "Source file")
+  check_cmd
+      ->add_option("-f,--header-folders", cmdline_options.header_folders,
+                   "Header folders, as passed to the generate command")
       ->required();
 
-  // Include files that will always be added inside the ABI library
-  compile_cmd->add_option(
-      "-b,--base-includes", cmdline_options.base_includes,
-      "Includes that should always be present in the ABI header");
+  check_cmd->add_option("-b,--base-includes", cmdline_options.base_includes,
+                        "Includes that are placed before each header");
 
-  // Where the output should be saved
-  compile_cmd
-      ->add_option("-o,--output", cmdline_options.output,
-                   "Output path, including the file name without the extension")
-      ->required();
+  // The precompiled prefixes saved by the generate command are found here
+  check_cmd
+      ->add_option("--cache-dir", cmdline_options.cache_directory,
+                   "The cache folder of the generate command; the include "
+                   "list preceding the header is loaded from a precompiled "
+                   "header kept there")
+      ->take_last();
 
-  command_map.insert({compile_cmd, compileCommandHandler});
+  check_cmd
+      ->add_flag("--fail-on-blacklist", cmdline_options.fail_on_blacklist,
+                 "Also fail when one of the functions of the header is "
+                 "blacklisted")
+      ->take_last();
+
+  command_map.insert({check_cmd, checkCommandHandler});
 
   //
-  // Initialize the 'list_profiles' command
+  // Initialize the 'trace_diff' command
   //
 
-  auto list_profiles_cmd = cmdline_parser.add_subcommand(
-      "list_profiles", "List the available profiles");
+  auto trace_diff_cmd = cmdline_parser.add_subcommand(
+      "trace_diff",
+      "Compares the phase times, the probe times of each header and the "
+      "counters of two trace or metrics files saved by the generate command");
 
-  list_profiles_cmd->add_flag("-v,--verbose",
-                              cmdline_options.verbose_profile_list,
-                              "Show a more verbose profile list");
+  trace_diff_cmd
+      ->add_option("old", cmdline_options.trace_diff_old_file,
+                   "The trace or metrics file of the previous run")
+      ->required();
 
-  command_map.insert({list_profiles_cmd, listProfilesCommandHandler});
+  trace_diff_cmd
+      ->add_option("new", cmdline_options.trace_diff_new_file,
+                   "The trace or metrics file of the new run")
+      ->required();
+
+  auto threshold_option = trace_diff_cmd->add_option(
+      "--threshold", cmdline_options.trace_diff_threshold,
+      "Relative slowdown above which a phase or a header is reported as a "
+      "regression (0.1 is 10%)");
+
+  // clang-format off
+  threshold_option->take_last()->check(
+      [](const std::string &value) -> std::string {
+        try {
+          if (std::stod(value) >= 0.0) {
+            return "";
+          }
+        } catch (...) {
+        }
+
+        return "The threshold must be a non-negative number";
+      }
+  );
+  // clang-format on
+
+  auto limit_option = trace_diff_cmd->add_option(
+      "--limit", cmdline_options.trace_diff_limit,
+      "Amount of headers and counters to print");
+
+  limit_option->take_last()->check(getPositiveIntegerValidator("limit"));
+
+  trace_diff_cmd
+      ->add_flag("--exit-code", cmdline_options.trace_diff_exit_code,
+                 "Fail when there are significant regressions")
+      ->take_last();
+
+  command_map.insert({trace_diff_cmd, traceDiffCommandHandler});
 
   //
   // Initialize the 'list_languages' command
@@ -16,16 +16,22 @@
 
 #pragma once
 
+#include "event_stream.h"
 #include "languagemanager.h"
 #include "profilemanager.h"
 
+#include <atomic>
+#include <memory>
 #include <unordered_set>
 
 #include <CLI/CLI.hpp>
 
+class ResidentState;
+
 /// Command line options
 struct CommandLineOptions final {
-  /// The profile to use when generating the ABI library
+  /// The profile to use when generating the ABI library; the generate
+  /// command also accepts a comma separated list of profiles
   std::string profile_name;
 
   /// The language used to parse the include headers
@@ -37,8 +43,20 @@ struct CommandLineOptions final {
   /// The primary folder that will be scanned for include files
   std::vector<std::string> header_folders;
 
-  /// Source file used when compiling ABI libraries
-  std::string abi_library_source_file;
+  /// If not empty, only the headers matching one of these patterns are
+  /// probed
+  StringList include_globs;
+
+  /// Headers and folders matching these patterns are skipped during the
+  /// header enumeration
+  StringList exclude_globs;
+
+  /// Source files (or folders containing them) used when compiling ABI
+  /// libraries
+  StringList abi_library_source_file_list;
+
+  /// The ABI library bitcode files linked together by the merge command
+  StringList merge_input_list;
 
   /// Include files that should always be added at the top of the ABI library
   std::vector<std::string> base_includes;
@@ -50,12 +68,555 @@ struct CommandLineOptions final {
   /// If true, show a verbose list when printing the profile list
   bool verbose_profile_list{false};
 
+  /// The content-addressed store receiving the profile files imported by
+  /// the import_profile command
+  std::string profile_store;
+
   /// Additional include directories
   std::vector<std::string> additional_include_folders;
 
   /// If true, name mangling will follow the Microsoft Visual C++ convention
   /// instead of the standard one
   bool use_visual_cxx_mangling{false};
+
+  /// If true, the functions are also mangled with the other convention, and
+  /// a second ABI library is generated from the same analysis pass; its
+  /// output path ends with "_msvc" (or "_itanium" with Visual C++ mangling)
+  bool dual_mangling{false};
+
+  /// Comma separated list of target triples (i.e.:
+  /// "x86_64-pc-linux-gnu,aarch64-linux-gnu"); the default target of the
+  /// host is used when empty. The generate command splits the list, and
+  /// each library is compiled for a single triple
+  std::string target_triples;
+
+  /// If true, the include list accepted for the first target triple is
+  /// verified (and completed) for each of the other triples, instead of
+  /// being reused as is
+  bool verify_target_triples{false};
+
+  /// How many headers can be probed concurrently when generating the ABI
+  /// library. When passed, it also caps the threads that all the parallel
+  /// stages of the command share (see getThreadBudget)
+  std::size_t jobs{1U};
+
+  /// The memory that the concurrent probes can use, in MiB; zero means that
+  /// only the memory limit of the control group is enforced
+  std::size_t memory_budget{0U};
+
+  /// Where the probe workers and the analysis shards run: "none" leaves
+  /// them to the scheduler, "node" pins each of them to a NUMA node and
+  /// "core" to a single CPU
+  std::string worker_placement{"none"};
+
+  /// If true, the accepted headers are precompiled after each successful
+  /// probe so that the following probes only have to parse the new header
+  bool use_precompiled_prefix{false};
+
+  /// If true, the accepted headers are parsed once for each group of probes,
+  /// and a child process is forked for each probed header; the children
+  /// share the parsed state copy-on-write, and only parse their own header.
+  /// Nothing is forked while the process runs other threads, as a child
+  /// could inherit a lock one of them holds
+  bool fork_probes{false};
+
+  /// If true, the include directives of the headers that have more than one
+  /// are compiled concurrently, and the ones made useless by an accepted
+  /// directive are cancelled
+  bool race_include_directives{false};
+
+  /// If true, the generate command probes the headers in worker processes
+  /// that are respawned when clang crashes or hangs, instead of its own
+  /// threads
+  bool isolate_probes{false};
+
+  /// If true, the base includes are precompiled once (and cached across runs
+  /// when a cache folder is set); the probes and the final pass then load
+  /// them from the precompiled header
+  bool precompile_base_includes{false};
+
+  /// If not zero, the least recently used precompiled headers (base
+  /// includes and accepted prefixes) are evicted from the cache folder
+  /// until it fits in this many megabytes
+  std::size_t pch_cache_size_limit{0U};
+
+  /// If true, the system headers precompiled by the build_profile_pch
+  /// command are loaded before the base includes
+  bool use_profile_pch{false};
+
+  /// If true, the records defined by the system headers are looked up in the
+  /// summary built by the build_profile_summary command instead of being
+  /// expanded
+  bool use_profile_summary{false};
+
+  /// If true, the include list saved in the lockfile next to the output by
+  /// the previous generate run is verified first, and only the headers it
+  /// does not settle are probed
+  bool use_lockfile{false};
+
+  /// If not empty, the lockfile or the ABI database written by a generate
+  /// run on a previous version of the headers; its include list is verified
+  /// first, matching the headers by include directive
+  std::string warm_start_path;
+
+  /// How often, in seconds, the generate command saves the probe state next
+  /// to the output; zero disables the checkpoints
+  std::size_t checkpoint_interval{60U};
+
+  /// If true, the generate command resumes the probing from the checkpoint
+  /// saved by an interrupted run
+  bool resume{false};
+
+  /// How many accepted headers the generate command may drop when the final
+  /// pass fails, before running it again; zero makes the failure fatal
+  std::size_t final_pass_recovery_limit{16U};
+
+  /// If not empty, probe results (generate) or bitcode (compile) are saved
+  /// in this folder and reused in the following runs
+  std::string cache_directory;
+
+  /// If not empty, the cache folder sits in front of the HTTP server at this
+  /// URL; missing entries are downloaded from it, and new ones uploaded
+  std::string remote_cache_url;
+
+  /// If not zero, the least recently used files of the cache folder are
+  /// removed at the end of the run, until it fits in this many megabytes
+  std::size_t cache_size_limit{0U};
+
+  /// If true, the results of the final analysis are cached for each header
+  /// in the cache folder, and only the headers that have changed (along with
+  /// the ones depending on them) are analyzed again
+  bool incremental_analysis{false};
+
+  /// If true, the generate command keeps running after the first pass, and
+  /// generates the ABI library again each time a file inside the header
+  /// folders changes
+  bool watch{false};
+
+  /// If not empty, the accepted headers are built as clang modules in this
+  /// folder; the final pass (generate) and the compilation of the library
+  /// (compile) import them instead of parsing the headers again
+  std::string module_cache_directory;
+
+  /// The module maps loaded by the compile command; generate writes the one
+  /// describing the accepted headers to <output>.modulemap
+  StringList module_map_files;
+
+  /// Addresses (host:port) of the worker processes the generate command
+  /// dispatches probes to; the header folders are shipped to each of them
+  StringList remote_workers;
+
+  /// The TCP address the worker command listens on
+  std::string listen_address;
+
+  /// The connection served by the worker command instead of listening,
+  /// when it has been started as an isolated worker by generate
+  /// --isolate-probes; -1 if there is none
+  int worker_connection_fd{-1};
+
+  /// If true, each compiler instance keeps its file manager and target
+  /// information alive across probes
+  bool reuse_clang_state{false};
+
+  /// If true, the results of the stat() calls and folder listings made by
+  /// clang are shared by all the compiler instances for the whole run
+  bool shared_stat_cache{false};
+
+  /// If true, the candidate headers and the system headers of the profile
+  /// are read ahead on background threads while the probing starts
+  bool prefetch_headers{false};
+
+  /// If true, the headers found in the header folders are resolved through
+  /// a clang header map, instead of searching each folder in turn
+  bool use_header_map{false};
+
+  /// If true, a header map resolving the included headers to the paths
+  /// found by the generate command is saved next to the ABI library
+  bool emit_header_map{false};
+
+  /// If true, the generate command precompiles the ABI library header with
+  /// the arguments of the compile command, saving it as <output>.pch
+  bool emit_pch{false};
+
+  /// Comma separated list of the checks each probe has to pass
+  std::string probe_tiers{"parse"};
+
+  /// If true, probes stop at the first error without rendering diagnostics
+  bool stop_at_first_error{false};
+
+  /// If true, the probes render their warnings, and the diagnostics of each
+  /// probe are printed; otherwise warnings are only reported by the final
+  /// pass
+  bool verbose_diagnostics{false};
+
+  /// If true, the probes and the final pass do not parse the function bodies
+  bool skip_function_bodies{false};
+
+  /// If true, probe failures are classified from the diagnostics; headers
+  /// that can never be accepted are dropped, and the ones using an
+  /// undeclared identifier wait until an accepted header declares it
+  bool classify_probe_failures{false};
+
+  /// If true, a header failing on an undeclared identifier is probed again
+  /// right after the candidate headers that appear to declare it; requires
+  /// the failure classification
+  bool discover_prerequisites{false};
+
+  /// If not zero, probes running for longer than this many seconds are
+  /// aborted, and the headers that caused them are quarantined
+  std::size_t probe_timeout{0U};
+
+  /// If not zero, the header probing stops compiling after this many
+  /// seconds, and the final pass uses the headers accepted so far; the
+  /// headers declaring the most functions are probed first
+  std::size_t probing_time_budget{0U};
+
+  /// If true, include directives are resolved against the header search
+  /// paths before probing them, and the prefix depth that has been accepted
+  /// in each folder is tried first
+  bool resolve_include_directives{false};
+
+  /// If true, headers that have already been included (through an include
+  /// guard or #pragma once) by an accepted header are not probed
+  bool skip_included_headers{false};
+
+  /// If true, the time and peak memory of each phase, the memory used by the
+  /// final analysis, the headers that cost the most to the final pass and
+  /// the time spent in each probe are printed at the end of the run
+  bool time_report{false};
+
+  /// If true, the counters of the AST visitor (visited functions, expanded
+  /// classes and types, type graph size, ...) are printed at the end of the
+  /// run
+  bool visitor_statistics{false};
+
+  /// If true, the cycles, instructions, last level cache misses, page
+  /// faults and data TLB misses of each phase are sampled on Linux, and
+  /// printed with the time report
+  bool hardware_counters{false};
+
+  /// If not empty, the phases and the compilations of the run are saved to
+  /// this file in the Chrome trace event format
+  std::string trace_file;
+
+  /// If not empty, the phase timings, the peak memory usage and the memory
+  /// statistics of the run are saved to this file as JSON
+  std::string metrics_file;
+
+  /// If not empty, the stacks of all the threads are sampled during
+  /// the run and saved to this file as folded stacks
+  std::string profile_samples;
+
+  /// Where the flight recorder saves the recent events of the run when it
+  /// crashes, receives SIGUSR1 or exceeds its deadline; the default is the
+  /// output path followed by ".flight"
+  std::string flight_recorder_path;
+
+  /// If true, the flight recorder is not started
+  bool disable_flight_recorder{false};
+
+  /// If not zero, the flight recorder also saves the recent events once the
+  /// run has lasted this many seconds
+  std::size_t flight_recorder_deadline{0U};
+
+  /// If not empty, the progress events of the run (probes, sweeps, phases
+  /// and final counts) are written as newline-delimited JSON to this file
+  /// descriptor number or file path
+  std::string event_destination;
+
+  /// If not empty, a Make-style dependency file listing the outputs of the
+  /// run and every file they have been generated from is saved to this path
+  std::string depfile_path;
+
+  /// If true, the compile command turns the function bodies of the linked
+  /// bitcode into declarations, and drops everything that the
+  /// __mcsema_externs arrays do not reference
+  bool strip_bitcode{false};
+
+  /// If true, the compile command saves a module summary index along with
+  /// the bitcode, so that consumers can materialize only the functions they
+  /// need
+  bool lazy_bitcode{false};
+
+  /// If true, the build command also saves the header and the
+  /// implementation files it has compiled from memory
+  bool emit_sources{false};
+
+  /// If not empty, the header map saved by generate --emit-header-map, which
+  /// the compile command searches before the include folders
+  std::string header_map_path;
+
+  /// If not empty, the precompiled header saved by generate --emit-pch; the
+  /// compile command loads it when its manifest is still valid
+  std::string precompiled_header_path;
+
+  /// If not -1, the compile command streams the bitcode to this inherited
+  /// file descriptor (such as a pipe or a memfd) instead of the output path
+  int output_fd{-1};
+
+  /// The probe log written by generate --record-probes, and replayed by the
+  /// simulate command
+  std::string probe_log_path;
+
+  /// The header order used by the simulate command: recorded, reverse or
+  /// accepted
+  std::string simulated_header_order{"recorded"};
+
+  /// How many headers the simulated sequential strategy probes concurrently;
+  /// zero uses the worker count of the recorded run
+  std::size_t simulated_jobs{0U};
+
+  /// The measurement the analyze_headers command ranks the headers on:
+  /// parse, preprocess, tokens, includes or functions
+  std::string header_report_order{"parse"};
+
+  /// How many headers the analyze_headers command prints; zero prints all of
+  /// them
+  std::size_t header_report_limit{25U};
+
+  /// If not empty, the analyze_headers command saves every measurement to
+  /// this file as JSON
+  std::string header_report_path;
+
+  /// The order in which headers are probed: "walk" keeps the directory walk
+  /// order, "dependencies" places each header after the ones it includes,
+  /// "umbrella" starts from the headers including the most other ones (and
+  /// skips the headers an accepted one has already included), and
+  /// "history" uses the outcome recorded in the lockfile by the previous
+  /// run, and the probe history kept in the cache folder
+  std::string header_order{"walk"};
+
+  /// How the clang state of each compilation is released: "destroy" frees
+  /// it before moving on, "background" hands it to a background thread, and
+  /// "leak" also never frees the state of the final pass, which is only
+  /// done when the process exits afterwards (not in watch mode, nor in the
+  /// long running processes)
+  std::string clang_teardown{"destroy"};
+
+  /// If true, the type graph arrays are backed by transparent huge pages,
+  /// and the heap holding the AST of the final pass is advised and
+  /// collapsed into huge pages before it is walked (Linux only)
+  bool huge_pages{false};
+
+  /// How headers are probed: "sequential" tests one header at a time,
+  /// "batch" tests groups of headers and bisects the ones that fail, and
+  /// "attribute" compiles all of them at once, dropping the headers the
+  /// errors are attributed to until the rest compiles. "auto" probes a
+  /// small sample of the headers first, and picks the strategy and the
+  /// batch size that are predicted to be the fastest
+  std::string probe_strategy{"sequential"};
+
+  /// If true, each header is first probed on top of the accepted headers it
+  /// includes, directly or not, instead of the whole include list; the
+  /// accepted headers are then confirmed together with a single compilation
+  bool minimal_probe_prefix{false};
+
+  /// If true, the connected components of the include graph are first
+  /// probed concurrently, each with its own fixpoint loop; the union of the
+  /// accepted headers is then confirmed with a single compilation
+  bool component_probes{false};
+
+  /// How many headers are tested at once by the batch probe strategy (and
+  /// by the attribute strategy, when it falls back to it)
+  std::size_t batch_size{32U};
+
+  /// If true, only the declarations found inside the header folders are
+  /// analyzed
+  bool scoped_traversal{false};
+
+  /// If true, type dependencies are only expanded when needed to decide
+  /// whether a function can be used
+  bool lazy_type_expansion{false};
+
+  /// If true, the final analysis visits the functions while the headers
+  /// are parsed instead of after the whole translation unit
+  bool analyze_while_parsing{false};
+
+  /// If true, the final analysis records each redeclaration of a function on
+  /// its own instead of merging them, and reports them as duplicates
+  bool report_redeclarations{false};
+
+  /// If not empty, only the functions declared in a namespace whose whole
+  /// qualified name matches one of these regular expressions are analyzed
+  StringList include_namespaces;
+
+  /// The functions whose whole qualified name matches one of these regular
+  /// expressions are not analyzed
+  StringList exclude_names;
+
+  /// If not empty, only the functions imported by this binary (ELF or PE)
+  /// are analyzed and added to the ABI library
+  std::string binary_path;
+
+  /// If not empty, the functions that are not exported by this shared
+  /// library (ELF or PE) are blacklisted
+  std::string verify_library_path;
+
+  /// How many shards the final analysis is split in; each shard is
+  /// processed on its own thread
+  std::size_t analysis_shards{1U};
+
+  /// If not zero, the final analysis compiles the accepted headers in
+  /// groups of this size, one translation unit at a time, and merges the
+  /// results; the peak memory usage is then bounded by the largest group
+  std::size_t analysis_group_size{0U};
+
+  /// If true, each analysis group is analyzed as soon as enough headers have
+  /// been accepted to fill it, while the probing goes on
+  bool pipeline_analysis{false};
+
+  /// If true, the translation unit of the last accepted probe is kept
+  /// alive, and the final analysis visits it instead of parsing the accepted
+  /// headers again when it has been built from the same source buffer
+  bool reuse_probe_ast{false};
+
+  /// How many threads each shard of the final analysis uses to filter the
+  /// functions it has found
+  std::size_t finalize_threads{1U};
+
+  /// If true, each blacklisted function lists all the blacklisted types it
+  /// can reach instead of the shortest path to a function type
+  bool full_blacklist_causes{false};
+
+  /// How many threads each shard of the final analysis uses to expand the
+  /// type dependencies of the functions it has found
+  std::size_t type_expansion_threads{1U};
+
+  /// How many implementation files are generated; each one references a
+  /// slice of the whitelisted functions
+  std::size_t shards{1U};
+
+  /// How the whitelisted functions are split into the shards: "prefix"
+  /// sorts them by the position of their header, each shard including the
+  /// discovered headers up to its last function; "headers" groups them by
+  /// the headers that declare them, each shard only including those headers
+  /// and the ones they include, which requires the discovered headers to
+  /// compile on their own. "auto" picks "headers" when the headers have been
+  /// accepted with the minimal probe prefix, "prefix" otherwise
+  std::string shard_partitioning{"auto"};
+
+  /// How many functions each extern array of the implementation files
+  /// references at most; zero emits a single array per file
+  std::size_t extern_array_size{4096U};
+
+  /// If true, one implementation file is generated for each discovered
+  /// header declaring whitelisted functions, inside the <output>_headers
+  /// folder, instead of following the shard count
+  bool header_sublibraries{false};
+
+  /// If true, the header of the ABI library contains the declarations needed
+  /// by the whitelisted functions, sliced out of the final AST, instead of
+  /// including the discovered headers. C only
+  bool sliced_header{false};
+
+  /// If true, the generate command also writes the bitcode of the ABI
+  /// library, so that the compile command is not needed
+  bool emit_bitcode{false};
+
+  /// If true, the whitelisted and blacklisted functions (with the reasons
+  /// and locations reported in the header) are also saved to <output>.json
+  bool json_report{false};
+
+  /// Where the blacklisted functions are reported: "header" writes them as a
+  /// comment at the top of <output>.h, while "text" and "json" save them to
+  /// <output>.blacklist.txt and <output>.json, keeping the header minimal
+  std::string blacklist_report{"header"};
+
+  /// If true, the mcsema external definitions of the whitelisted functions
+  /// are also saved to <output>.defs.txt, straight from the AST
+  bool mcsema_definitions{false};
+
+  /// If true, the generate command also saves the analysis results to
+  /// <output>.abidb, so that the render command can emit the library again
+  bool save_database{false};
+
+  /// If true, the generate command also serializes the AST of the final pass
+  /// to the cache folder, so that it can be visited again with --from-ast
+  bool save_ast{false};
+
+  /// The database read by the render command
+  std::string database_path;
+
+  /// The older database compared by the diff command
+  std::string diff_old_database;
+
+  /// The newer database compared by the diff command
+  std::string diff_new_database;
+
+  /// If true, the diff command fails when the databases are different
+  bool diff_exit_code{false};
+
+  /// The header verified by the check command: one of the include
+  /// directives of the lockfile, or the path of a file
+  std::string check_header;
+
+  /// The lockfile saved by the generate command, read by the check command
+  std::string lockfile_path;
+
+  /// If true, the check command also fails when one of the functions of the
+  /// header is blacklisted
+  bool fail_on_blacklist{false};
+
+  /// The older trace or metrics file compared by the trace_diff command
+  std::string trace_diff_old_file;
+
+  /// The newer trace or metrics file compared by the trace_diff command
+  std::string trace_diff_new_file;
+
+  /// The relative slowdown (0.1 is 10%) above which the trace_diff command
+  /// reports a phase or a header as a regression
+  double trace_diff_threshold{0.1};
+
+  /// How many headers and counters the trace_diff command prints
+  std::size_t trace_diff_limit{20U};
+
+  /// If true, the trace_diff command fails when there are significant
+  /// regressions
+  bool trace_diff_exit_code{false};
+
+  /// If not empty, the generate and render commands neither enumerate nor
+  /// parse the headers: the AST snapshot described by this file is loaded
+  /// instead, and only the AST visitor is run
+  std::string ast_snapshot_path;
+
+  /// If not empty, the render command only emits the whitelisted functions
+  /// whose mangled name is listed (one per line) in this file
+  std::string symbol_list_path;
+
+  /// The Unix socket the serve command listens on
+  std::string socket_path;
+
+  /// If not empty, the serve command exposes its metrics to Prometheus over
+  /// HTTP on this address (host:port)
+  std::string metrics_address;
+
+  /// Where the serve and batch commands save the precompiled headers they
+  /// keep across commands; a temporary folder is used when empty
+  std::string state_directory;
+
+  /// The serve command gives the free heap memory back to the operating
+  /// system once this many requests have completed, as soon as no request
+  /// is running; zero disables the trims
+  std::size_t heap_trim_interval{1U};
+
+  /// The manifest listing the jobs executed by the batch command
+  std::string manifest_path;
+
+  /// Set by the serve and batch commands on the options of each command they
+  /// execute; the file system caches and the precompiled base includes are
+  /// then shared with the other commands
+  std::shared_ptr<ResidentState> resident_state;
+
+  /// Set by the programs embedding abigen to cancel the generate command.
+  /// Once the flag is raised, the running compilations are aborted from the
+  /// clang callbacks, no new probe is started and the command fails without
+  /// writing its outputs
+  std::shared_ptr<std::atomic_bool> cancellation_flag;
+
+  /// Set by the programs embedding abigen; receives the progress events of
+  /// the generate command (see event_destination), which are then no longer
+  /// written to the event destination
+  EventCallback event_callback;
 };
 
 /// Command handler
@@ -81,16 +642,139 @@ bool compileCommandHandler(ProfileManagerRef &profile_manager,
                            const LanguageManager &language_manager,
                            const CommandLineOptions &cmdline_options);
 
+/// Runs the 'generate' command; when the ABI library is passed, it receives
+/// the results of the selected profile, which must be a single one. The
+/// output files are written as usual, unless the rendered file map is
+/// passed: the header and the implementation files are then rendered into
+/// it instead (again, for a single profile)
+bool runGenerateCommand(ProfileManagerRef &profile_manager,
+                        const LanguageManager &language_manager,
+                        const CommandLineOptions &cmdline_options,
+                        ABILibrary *abi_library,
+                        RenderedFileMap *rendered_file_map = nullptr);
+
+/// Runs the 'compile' command; when the bitcode is passed, it receives the
+/// linked module, and the output file is only written if the output path
+/// is not empty. When the source file map is passed, its .cpp files are
+/// compiled from memory instead of the source file list, along with the
+/// header they include; the compile cache is not used in that case
+bool runCompileCommand(
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options, std::string *bitcode,
+    std::shared_ptr<const RenderedFileMap> source_file_map = nullptr);
+
+/// Precompiles the given header with the clang arguments the 'compile'
+/// command uses for the same options, and saves it along with a manifest
+/// of the files it has been built from; compile --pch loads it as long as
+/// none of them has changed
+bool buildCompilePrecompiledHeader(ProfileManagerRef &profile_manager,
+                                   const LanguageManager &language_manager,
+                                   const CommandLineOptions &cmdline_options,
+                                   const std::string &header_path,
+                                   const std::string &pch_path);
+
+/// Handler for the 'build' command
+bool buildCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'merge' command
+bool mergeCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'render' command
+bool renderCommandHandler(ProfileManagerRef &profile_manager,
+                          const LanguageManager &language_manager,
+                          const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'diff' command
+bool diffCommandHandler(ProfileManagerRef &profile_manager,
+                        const LanguageManager &language_manager,
+                        const CommandLineOptions &cmdline_options);
+
 /// Handler for the 'list_profiles' command
 bool listProfilesCommandHandler(ProfileManagerRef &profile_manager,
                                 const LanguageManager &language_manager,
                                 const CommandLineOptions &cmdline_options);
 
+/// Handler for the 'pack_profile' command
+bool packProfileCommandHandler(ProfileManagerRef &profile_manager,
+                               const LanguageManager &language_manager,
+                               const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'import_profile' command
+bool importProfileCommandHandler(ProfileManagerRef &profile_manager,
+                                 const LanguageManager &language_manager,
+                                 const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'build_profile_pch' command
+bool buildProfilePCHCommandHandler(ProfileManagerRef &profile_manager,
+                                   const LanguageManager &language_manager,
+                                   const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'build_profile_summary' command
+bool buildProfileSummaryCommandHandler(
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'serve' command
+bool serveCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'batch' command
+bool batchCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'worker' command
+bool workerCommandHandler(ProfileManagerRef &profile_manager,
+                          const LanguageManager &language_manager,
+                          const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'simulate' command
+bool simulateCommandHandler(ProfileManagerRef &profile_manager,
+                            const LanguageManager &language_manager,
+                            const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'analyze_headers' command
+bool analyzeHeadersCommandHandler(ProfileManagerRef &profile_manager,
+                                  const LanguageManager &language_manager,
+                                  const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'check' command
+bool checkCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options);
+
+/// Handler for the 'trace_diff' command
+bool traceDiffCommandHandler(ProfileManagerRef &profile_manager,
+                             const LanguageManager &language_manager,
+                             const CommandLineOptions &cmdline_options);
+
 /// Handler for the 'list_languages" command
 bool listLanguagesCommandHandler(ProfileManagerRef &profile_manager,
                                  const LanguageManager &language_manager,
                                  const CommandLineOptions &cmdline_options);
 
+/// Parses a comma separated list of profile names (i.e.:
+/// "ubuntu1604,ubuntu1804"); returns false if the list is empty or if a
+/// name is repeated
+bool parseProfileNameList(StringList &profile_name_list,
+                          const std::string &definition);
+
+/// Parses a comma separated list of target triples; returns false if the
+/// list is empty or if a triple is repeated
+bool parseTargetTripleList(StringList &target_triple_list,
+                           const std::string &definition);
+
+/// Returns how many threads the parallel stages of the given command can
+/// share: the value of its --jobs option when it has been passed, zero (one
+/// thread for each core) otherwise
+std::size_t getThreadBudget(const CLI::App &command,
+                            const CommandLineOptions &cmdline_options);
+
 /// Initializes the command line parser
 void initializeCommandLineParser(CLI::App &cmdline_parser,
                                  CommandLineOptions &cmdline_options,
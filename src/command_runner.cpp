@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "command_runner.h"
+
+#include <iostream>
+#include <vector>
+
+bool runCommandLine(ProfileManagerRef &profile_manager,
+                    const LanguageManager &language_manager,
+                    const ResidentStateRef &resident_state,
+                    const StringList &argument_list) {
+  if (!argument_list.empty() &&
+      (argument_list.front() == "serve" || argument_list.front() == "batch" ||
+       argument_list.front() == "worker")) {
+    std::cerr << "The " << argument_list.front()
+              << " command can't be executed from another command\n";
+    return false;
+  }
+
+  // Each command gets its own parser, since the options are bound to it
+  auto command_language_manager = language_manager;
+
+  CLI::App cmdline_parser{"McSema ABI library generator"};
+  CommandLineOptions cmdline_options;
+
+  CommandMap command_map;
+  initializeCommandLineParser(cmdline_parser, cmdline_options, profile_manager,
+                              command_language_manager, command_map);
+
+  std::vector<std::string> argv_storage = {"abigen"};
+  argv_storage.insert(argv_storage.end(), argument_list.begin(),
+                      argument_list.end());
+
+  std::vector<char *> argv;
+  for (auto &argument : argv_storage) {
+    argv.push_back(&argument[0]);
+  }
+
+  try {
+    cmdline_parser.parse(static_cast<int>(argv.size()), argv.data());
+
+  } catch (const CLI::ParseError &error) {
+    return cmdline_parser.exit(error) == 0;
+  }
+
+  cmdline_options.resident_state = resident_state;
+
+  for (const auto &p : command_map) {
+    const auto &subcommand = p.first;
+    const auto &callback = p.second;
+
+    if (cmdline_parser.got_subcommand(subcommand)) {
+      return callback(profile_manager, command_language_manager,
+                      cmdline_options);
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "cmdline.h"
+#include "resident_state.h"
+#include "types.h"
+
+#include <string>
+
+/// Executes the abigen command described by the given argument list (the
+/// program name excluded) inside the current process, sharing the given
+/// resident state. The commands that execute other commands (serve, batch)
+/// are rejected. Returns true if the command succeeded
+bool runCommandLine(ProfileManagerRef &profile_manager,
+                    const LanguageManager &language_manager,
+                    const ResidentStateRef &resident_state,
+                    const StringList &argument_list);
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "compile_cache.h"
+#include "flight_recorder.h"
+#include "output_file.h"
+#include "server_metrics.h"
+#include "std_filesystem.h"
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+namespace {
+/// The first line of each cache entry
+const std::string kCompileCacheEntryHeader = "abigen-compile-cache 1";
+}  // namespace
+
+/// Private class data
+struct CompileCache::PrivateData final {
+  /// The folder containing the cache entries
+  stdfs::path cache_directory;
+
+  /// Hash of the settings that can change the generated bitcode
+  ContentHash configuration_hash{0U};
+
+  /// If set, the remote cache in front of which the cache folder sits
+  RemoteCacheRef remote_cache;
+
+  /// Content hashes for the files that have been read during this run
+  FileHashCache file_hash_cache;
+
+  /// Cache hits
+  std::atomic_size_t hit_count{0U};
+
+  /// Cache misses
+  std::atomic_size_t miss_count{0U};
+};
+
+CompileCache::CompileCache(const std::string &cache_directory,
+                           ContentHash configuration_hash,
+                           RemoteCacheRef remote_cache)
+    : d(new PrivateData) {
+  d->cache_directory = stdfs::path(cache_directory) / "bitcode";
+  d->configuration_hash = configuration_hash;
+  d->remote_cache = std::move(remote_cache);
+
+  std::error_code error;
+  stdfs::create_directories(d->cache_directory, error);
+  if (error) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the compile cache directory: " +
+                     d->cache_directory.string());
+  }
+}
+
+bool CompileCache::getFileHash(ContentHash &hash, const std::string &path) {
+  return d->file_hash_cache.getFileHash(hash, path);
+}
+
+bool CompileCache::entryPath(std::string &entry_path,
+                             const std::string &source_file) {
+  entry_path.clear();
+
+  ContentHash source_hash;
+  if (!getFileHash(source_hash, source_file)) {
+    return false;
+  }
+
+  auto entry_hash =
+      updateContentHash(kInitialContentHash, d->configuration_hash);
+
+  entry_hash = updateContentHash(entry_hash, source_file);
+  entry_hash = updateContentHash(entry_hash, source_hash);
+
+  auto entry_name = contentHashToString(entry_hash);
+  entry_path =
+      (d->cache_directory / entry_name.substr(0U, 2U) / entry_name).string();
+
+  return true;
+}
+
+CompileCache::Status CompileCache::create(CompileCacheRef &obj,
+                                          const std::string &cache_directory,
+                                          ContentHash configuration_hash,
+                                          RemoteCacheRef remote_cache) {
+  obj.reset();
+
+  try {
+    auto ptr = new CompileCache(cache_directory, configuration_hash,
+                                std::move(remote_cache));
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+CompileCache::~CompileCache() {}
+
+bool CompileCache::lookup(std::string &bitcode,
+                          const std::string &source_file,
+                          StringList *dependency_list) {
+  bitcode.clear();
+
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  auto L_miss = [&]() -> bool {
+    bitcode.clear();
+
+    if (dependency_list != nullptr) {
+      dependency_list->clear();
+    }
+
+    d->miss_count++;
+    addServerCounter(ServerCounter::CompileCacheMisses);
+    recordFlightEvent(FlightEventType::CompileCacheMiss, source_file);
+    return false;
+  };
+
+  std::string entry_path;
+  if (!entryPath(entry_path, source_file)) {
+    return L_miss();
+  }
+
+  // Entries computed on other machines are fetched from the remote cache,
+  // along with their bitcode
+  std::ifstream entry_file(entry_path);
+  if (!entry_file && d->remote_cache && d->remote_cache->fetch(entry_path) &&
+      d->remote_cache->fetch(entry_path + ".bc")) {
+    entry_file.open(entry_path);
+  }
+
+  if (!entry_file) {
+    return L_miss();
+  }
+
+  // Make sure this is the entry we are looking for, in case of collisions
+  std::string line;
+  if (!std::getline(entry_file, line) || line != kCompileCacheEntryHeader) {
+    return L_miss();
+  }
+
+  if (!std::getline(entry_file, line) || line != "source " + source_file) {
+    return L_miss();
+  }
+
+  const std::string bitcode_tag = "bitcode ";
+
+  ContentHash expected_bitcode_hash;
+  if (!std::getline(entry_file, line) ||
+      line.compare(0U, bitcode_tag.size(), bitcode_tag) != 0 ||
+      !contentHashFromString(expected_bitcode_hash,
+                             line.substr(bitcode_tag.size()))) {
+    return L_miss();
+  }
+
+  // Validate the dependencies
+  while (std::getline(entry_file, line)) {
+    std::string path;
+    ContentHash expected_hash;
+    if (!parseDependencyLine(path, expected_hash, line)) {
+      return L_miss();
+    }
+
+    ContentHash current_hash;
+    if (!getFileHash(current_hash, path) || current_hash != expected_hash) {
+      return L_miss();
+    }
+
+    if (dependency_list != nullptr) {
+      dependency_list->push_back(std::move(path));
+    }
+  }
+
+  // The bitcode file may have been replaced by a concurrent writer
+  std::ifstream bitcode_file(entry_path + ".bc",
+                             std::ios::in | std::ios::binary);
+  if (!bitcode_file) {
+    return L_miss();
+  }
+
+  std::stringstream bitcode_buffer;
+  bitcode_buffer << bitcode_file.rdbuf();
+  bitcode = bitcode_buffer.str();
+
+  if (updateContentHash(kInitialContentHash, bitcode.data(), bitcode.size()) !=
+      expected_bitcode_hash) {
+    return L_miss();
+  }
+
+  d->hit_count++;
+  addServerCounter(ServerCounter::CompileCacheHits);
+
+  if (d->remote_cache) {
+    d->remote_cache->touch(entry_path);
+    d->remote_cache->touch(entry_path + ".bc");
+  }
+
+  return true;
+}
+
+void CompileCache::store(const std::string &source_file,
+                         const std::string &bitcode,
+                         const StringList &dependency_list) {
+  std::string entry_path;
+  if (!entryPath(entry_path, source_file)) {
+    return;
+  }
+
+  auto bitcode_hash =
+      updateContentHash(kInitialContentHash, bitcode.data(), bitcode.size());
+
+  std::stringstream buffer;
+  buffer << kCompileCacheEntryHeader << "\n";
+  buffer << "source " << source_file << "\n";
+  buffer << "bitcode " << contentHashToString(bitcode_hash) << "\n";
+
+  for (const auto &path : dependency_list) {
+    ContentHash hash;
+    if (!getFileHash(hash, path)) {
+      // We can't validate this entry later on
+      return;
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  std::error_code error;
+  stdfs::create_directories(stdfs::path(entry_path).parent_path(), error);
+  if (error) {
+    return;
+  }
+
+  // The bitcode is saved first, so that a valid entry always references a
+  // complete file
+  if (!writeFileAtomically(entry_path + ".bc", bitcode)) {
+    return;
+  }
+
+  if (!writeFileAtomically(entry_path, buffer.str())) {
+    return;
+  }
+
+  // The upload queue preserves this order as well
+  if (d->remote_cache) {
+    d->remote_cache->upload(entry_path + ".bc");
+    d->remote_cache->upload(entry_path);
+  }
+}
+
+std::size_t CompileCache::hitCount() const { return d->hit_count; }
+
+std::size_t CompileCache::missCount() const { return d->miss_count; }
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "istatus.h"
+#include "remote_cache.h"
+#include "types.h"
+
+#include <memory>
+
+class CompileCache;
+
+/// A reference to a CompileCache object
+using CompileCacheRef = std::shared_ptr<CompileCache>;
+
+/// The CompileCache persists the bitcode generated by the compile command.
+/// Each entry is keyed on the compiler configuration, the path of the source
+/// file and its content hash, and also records the content hash of every
+/// header that clang read; an entry is only used when none of those files has
+/// changed
+class CompileCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  CompileCache(const std::string &cache_directory,
+               ContentHash configuration_hash, RemoteCacheRef remote_cache);
+
+  /// Returns the content hash of the given file, reusing the previous result
+  /// if the file has already been hashed during this run
+  bool getFileHash(ContentHash &hash, const std::string &path);
+
+  /// Returns the path of the entry for the given source file, without
+  /// extension; the bitcode is saved next to it
+  bool entryPath(std::string &entry_path, const std::string &source_file);
+
+ public:
+  /// Status code, used with CompileCache::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new CompileCache object. The configuration hash should
+  /// identify all the settings that can change the generated bitcode. If a
+  /// remote cache is passed, missing entries are downloaded from it, and new
+  /// ones are uploaded
+  static Status create(CompileCacheRef &obj, const std::string &cache_directory,
+                       ContentHash configuration_hash,
+                       RemoteCacheRef remote_cache = nullptr);
+
+  /// Destructor
+  ~CompileCache();
+
+  /// Looks up the bitcode of the given source file; returns false if the
+  /// cache does not contain a valid entry. If passed, the dependency list
+  /// receives the files the entry depends on. This method is thread safe
+  bool lookup(std::string &bitcode, const std::string &source_file,
+              StringList *dependency_list = nullptr);
+
+  /// Saves the bitcode of the given source file, along with the files it
+  /// depends on. This method is thread safe
+  void store(const std::string &source_file, const std::string &bitcode,
+             const StringList &dependency_list);
+
+  /// Returns the amount of lookups that have been served from the cache
+  std::size_t hitCount() const;
+
+  /// Returns the amount of lookups that could not be served from the cache
+  std::size_t missCount() const;
+
+  /// Disable the copy constructor
+  CompileCache(const CompileCache &other) = delete;
+
+  /// Disable the assignment operator
+  CompileCache &operator=(const CompileCache &other) = delete;
+};
@@ -14,73 +14,127 @@
  * limitations under the License.
  */
 
+#include <llvm/Analysis/ModuleSummaryAnalysis.h>
+#include <llvm/Analysis/ProfileSummaryInfo.h>
+#include <llvm/Bitcode/BitcodeReader.h>
 #include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
 #include <clang/AST/Mangle.h>
 #include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/TargetInfo.h>
 #include <clang/CodeGen/CodeGenAction.h>
+#include <clang/Frontend/FrontendActions.h>
 #include <clang/Frontend/FrontendOptions.h>
 #include <clang/Frontend/TextDiagnosticPrinter.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/PreprocessorOptions.h>
 #include <clang/Parse/ParseAST.h>
 
+#include "compile_cache.h"
 #include "generate_command.h"
 #include "generate_utils.h"
+#include "output_file.h"
+#include "resident_state.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+#include "time_report.h"
 
-/// Handler for the 'compile' command
-bool compileCommandHandler(ProfileManagerRef &profile_manager,
-                           const LanguageManager &language_manager,
-                           const CommandLineOptions &cmdline_options) {
-  CompilerInstanceSettings clang_settings;
-  clang_settings.additional_include_folders =
-      cmdline_options.additional_include_folders;
-  clang_settings.enable_gnu_extensions = cmdline_options.enable_gnu_extensions;
-  clang_settings.use_visual_cxx_mangling =
-      cmdline_options.use_visual_cxx_mangling;
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
 
-  auto prof_mgr_status = profile_manager->get(clang_settings.profile,
-                                              cmdline_options.profile_name);
-  if (!prof_mgr_status.succeeded()) {
-    std::cerr << prof_mgr_status.toString() << "\n";
-    return false;
-  }
+#include <json11.hpp>
 
-  if (!language_manager.parseLanguageDefinition(
-          clang_settings.language, clang_settings.language_standard,
-          cmdline_options.language)) {
-    std::cerr << "Invalid language definition\n";
-    return false;
+namespace {
+/// Expands the folders found in the input list to the .cpp files they
+/// contain; the files of each folder are sorted by name, so that the output
+/// does not depend on the directory order
+bool collectSourceFiles(StringList &source_file_list,
+                        const StringList &input_list) {
+  source_file_list.clear();
+
+  for (const auto &input : input_list) {
+    std::error_code error;
+    if (!stdfs::is_directory(input, error)) {
+      source_file_list.push_back(input);
+      continue;
+    }
+
+    StringList folder_file_list;
+    for (const auto &entry : stdfs::directory_iterator(input, error)) {
+      if (entry.path().extension() == ".cpp") {
+        folder_file_list.push_back(entry.path().string());
+      }
+    }
+
+    if (error) {
+      std::cerr << "Failed to enumerate the source files in " << input
+                << "\n";
+      return false;
+    }
+
+    std::sort(folder_file_list.begin(), folder_file_list.end());
+    source_file_list.insert(source_file_list.end(), folder_file_list.begin(),
+                            folder_file_list.end());
   }
 
-  std::unique_ptr<clang::CompilerInstance> compiler;
-  auto status = createClangCompilerInstance(compiler, clang_settings);
-  if (!status.succeeded()) {
+  if (source_file_list.empty()) {
+    std::cerr << "No source file to compile\n";
     return false;
   }
 
-  std::string clang_output_buffer;
-  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
-
-  clang::DiagnosticsEngine &diagnostics_engine = compiler->getDiagnostics();
+  return true;
+}
 
-  clang::TextDiagnosticPrinter diagnostic_consumer(
-      clang_output_stream, &diagnostics_engine.getDiagnosticOptions());
+/// The clang invocations shared by the source files, keyed on the file
+/// extension (which selects the input language)
+using CompileInvocationMap =
+    std::unordered_map<std::string, std::shared_ptr<clang::CompilerInvocation>>;
 
-  diagnostics_engine.setClient(&diagnostic_consumer, false);
+/// Returns the clang arguments used for the ABI library source files,
+/// without the input file
+std::vector<std::string> getCompileArguments(
+    const CompilerInstanceSettings &clang_settings,
+    const CommandLineOptions &cmdline_options) {
+  // The libraries have historically been compiled for x86-64, no matter
+  // which host is running abigen
+  auto target_triple = clang_settings.target_triple.empty()
+                           ? std::string("x86_64-pc-linux-gnu")
+                           : clang_settings.target_triple;
 
-  // Replicate the invocation here to make this work
   std::vector<std::string> clang_arguments = {
       "-triple",
-      "x86_64-pc-linux-gnu",
+      target_triple,
       "-nostdsysteminc",
       "-nobuiltininc",
       "-resource-dir",
       clang_settings.profile.root_path + "/" +
           clang_settings.profile.resource_dir};
 
+  // The -I folders are searched before the system ones, so the headers of
+  // the library are found in the header map with a single lookup; the map
+  // only lists the names that a single folder contains
+  if (!cmdline_options.header_map_path.empty()) {
+    std::error_code error;
+    auto absolute_path =
+        stdfs::absolute(cmdline_options.header_map_path, error);
+
+    clang_arguments.push_back("-I");
+    clang_arguments.push_back(error ? cmdline_options.header_map_path
+                                    : absolute_path.string());
+  }
+
   auto path_list_it =
       clang_settings.profile.internal_isystem.find(clang_settings.language);
   if (path_list_it != clang_settings.profile.internal_isystem.end()) {
@@ -104,9 +158,28 @@ bool compileCommandHandler(ProfileManagerRef &profile_manager,
     }
   }
 
+  // The header search options of the compiler instance are replaced along
+  // with the rest of the invocation, so the folders are passed again here
+  for (const auto &path : clang_settings.additional_include_folders) {
+    std::error_code error;
+    auto absolute_path = stdfs::absolute(path, error);
+
+    clang_arguments.push_back("-isystem");
+    clang_arguments.push_back(error ? path : absolute_path.string());
+  }
+
+  if (!clang_settings.module_cache_path.empty()) {
+    clang_arguments.push_back("-fmodules");
+    clang_arguments.push_back("-fmodules-cache-path=" +
+                              clang_settings.module_cache_path);
+
+    for (const auto &module_map_path : clang_settings.module_map_file_list) {
+      clang_arguments.push_back("-fmodule-map-file=" + module_map_path);
+    }
+  }
+
   clang_arguments.push_back("-S");
   clang_arguments.push_back("-emit-llvm");
-  clang_arguments.push_back(cmdline_options.abi_library_source_file);
 
   std::string language_flag = "-std=";
   switch (clang_settings.language) {
@@ -129,35 +202,1046 @@ bool compileCommandHandler(ProfileManagerRef &profile_manager,
   language_flag += std::to_string(clang_settings.language_standard);
   clang_arguments.push_back(language_flag);
 
-  std::vector<const char *> invocation;
-  for (const auto &arg : clang_arguments) {
-    invocation.push_back(arg.c_str());
+  return clang_arguments;
+}
+
+/// Initializes the compiler settings of the ABI library source files
+/// according to the command line options
+bool getCompileSettings(CompilerInstanceSettings &clang_settings,
+                        ProfileManagerRef &profile_manager,
+                        const LanguageManager &language_manager,
+                        const CommandLineOptions &cmdline_options) {
+  clang_settings = {};
+  clang_settings.additional_include_folders =
+      cmdline_options.additional_include_folders;
+  clang_settings.enable_gnu_extensions = cmdline_options.enable_gnu_extensions;
+  clang_settings.use_visual_cxx_mangling =
+      cmdline_options.use_visual_cxx_mangling;
+  clang_settings.target_triple = cmdline_options.target_triples;
+  clang_settings.module_cache_path = cmdline_options.module_cache_directory;
+  clang_settings.module_map_file_list = cmdline_options.module_map_files;
+
+  auto prof_mgr_status = profile_manager->get(clang_settings.profile,
+                                              cmdline_options.profile_name);
+  if (!prof_mgr_status.succeeded()) {
+    std::cerr << prof_mgr_status.toString() << "\n";
+    return false;
   }
 
-  auto compiler_invocation = std::make_shared<clang::CompilerInvocation>();
-  clang::CompilerInvocation::CreateFromArgs(
-      *compiler_invocation.get(), &invocation[0],
-      &invocation[0] + invocation.size(), compiler->getDiagnostics());
-  compiler->setInvocation(compiler_invocation);
+  if (!language_manager.parseLanguageDefinition(
+          clang_settings.language, clang_settings.language_standard,
+          cmdline_options.language)) {
+    std::cerr << "Invalid language definition\n";
+    return false;
+  }
 
-  clang::EmitLLVMOnlyAction compiler_action;
-  if (!compiler->ExecuteAction(compiler_action)) {
-    std::cerr << "Error: " << clang_output_buffer << "\n";
-    return 1;
+  // Requests executed by the serve command (and the build command) share the
+  // cached lookups of the profile folders
+  if (cmdline_options.resident_state) {
+    clang_settings.file_system_cache =
+        cmdline_options.resident_state->fileSystemCache(clang_settings.profile);
   }
 
-  std::error_code stream_error_code;
-  llvm::raw_fd_ostream output_stream(cmdline_options.output, stream_error_code,
-                                     llvm::sys::fs::F_None);
+  return true;
+}
+
+/// Hashes the clang arguments of the source files; a precompiled header can
+/// only be loaded by compilations using the arguments it has been built with
+ContentHash hashCompileArguments(const CompilerInstanceSettings &clang_settings,
+                                 const CommandLineOptions &cmdline_options) {
+  return updateContentHash(
+      hashCompilerInstanceSettings(clang_settings),
+      getCompileArguments(clang_settings, cmdline_options));
+}
+
+/// Returns the path of the manifest saved next to the given precompiled
+/// header; it lists the compile arguments and the files the header has been
+/// built from
+std::string getPrecompiledHeaderManifestPath(const std::string &pch_path) {
+  return pch_path + ".json";
+}
+
+/// Returns true if the precompiled header saved by generate --emit-pch can be
+/// loaded by compilations using the given arguments hash; this is the case
+/// when none of the files it has been built from has changed. The dependency
+/// list receives these files, and the reason is set when the header can't be
+/// used
+bool validatePrecompiledHeader(StringList &dependency_list,
+                               std::string &reason,
+                               const std::string &pch_path,
+                               ContentHash arguments_hash) {
+  dependency_list.clear();
+  reason.clear();
+
+  std::ifstream manifest_file(getPrecompiledHeaderManifestPath(pch_path));
+
+  std::stringstream buffer;
+  buffer << manifest_file.rdbuf();
+
+  std::string error;
+  auto manifest = json11::Json::parse(buffer.str(), error);
+
+  std::error_code error_code;
+  if (!manifest_file || !error.empty() || !manifest.is_object() ||
+      !stdfs::is_regular_file(pch_path, error_code)) {
+    reason = "the header or its manifest can't be read";
+    return false;
+  }
+
+  if (manifest["arguments"].string_value() !=
+      contentHashToString(arguments_hash)) {
+    reason = "it has been built with different compile options";
+    return false;
+  }
+
+  for (const auto &file_entry : manifest["files"].array_items()) {
+    const auto &path = file_entry["path"].string_value();
+
+    ContentHash hash;
+    if (!hashFileContents(hash, path) ||
+        contentHashToString(hash) != file_entry["hash"].string_value()) {
+      reason = path + " has changed since it has been built";
+      return false;
+    }
+
+    dependency_list.push_back(path);
+  }
+
+  return true;
+}
+
+/// Parses the clang invocation once for each extension found in the source
+/// file list, using the first file with that extension as the input; the
+/// input is replaced before each compilation. If a precompiled header is
+/// passed, the invocations load it before each source file
+bool createCompileInvocations(CompileInvocationMap &invocation_map,
+                              std::string &error_message,
+                              const CompilerInstanceSettings &clang_settings,
+                              const CommandLineOptions &cmdline_options,
+                              const StringList &source_file_list,
+                              const std::string &precompiled_header) {
+  invocation_map.clear();
+  error_message.clear();
+
+  auto clang_arguments = getCompileArguments(clang_settings, cmdline_options);
+  if (!precompiled_header.empty()) {
+    clang_arguments.push_back("-include-pch");
+    clang_arguments.push_back(precompiled_header);
+  }
+
+  std::string clang_output_buffer;
+  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
+
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticIDs> diagnostic_ids(
+      new clang::DiagnosticIDs());
+
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions> diagnostic_options(
+      new clang::DiagnosticOptions());
+
+  clang::TextDiagnosticPrinter diagnostic_consumer(clang_output_stream,
+                                                   diagnostic_options.get());
+
+  clang::DiagnosticsEngine diagnostics_engine(
+      diagnostic_ids, diagnostic_options, &diagnostic_consumer, false);
+
+  for (const auto &source_file : source_file_list) {
+    auto extension = stdfs::path(source_file).extension().string();
+    if (invocation_map.count(extension) != 0U) {
+      continue;
+    }
+
+    auto arguments = clang_arguments;
+    arguments.push_back(source_file);
+
+    std::vector<const char *> invocation;
+    for (const auto &arg : arguments) {
+      invocation.push_back(arg.c_str());
+    }
+
+    auto compiler_invocation = std::make_shared<clang::CompilerInvocation>();
+    if (!clang::CompilerInvocation::CreateFromArgs(
+            *compiler_invocation.get(), &invocation[0],
+            &invocation[0] + invocation.size(), diagnostics_engine) ||
+        compiler_invocation->getFrontendOpts().Inputs.size() != 1U) {
+      clang_output_stream.flush();
+      error_message = "Failed to create the clang invocation for " +
+                      source_file + ": " + clang_output_buffer;
+
+      return false;
+    }
+
+    invocation_map.insert({extension, std::move(compiler_invocation)});
+  }
+
+  return true;
+}
+
+/// Compiles the given source file, returning the bitcode in the output
+/// buffer. The compiler instance is reused across calls, keeping its file
+/// manager, and each call copies the given invocation; one compiler
+/// instance (and LLVM context) is needed for each thread. If a dependency
+/// list is passed, it will receive the path of each file that has been read
+bool compileSourceFile(std::string &bitcode, std::string &error_message,
+                       clang::CompilerInstance &compiler,
+                       const clang::CompilerInvocation &base_invocation,
+                       const std::string &source_file,
+                       StringList *dependency_list = nullptr) {
+  bitcode.clear();
+  error_message.clear();
+
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  std::string clang_output_buffer;
+  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
+
+  clang::DiagnosticsEngine &diagnostics_engine = compiler.getDiagnostics();
+  diagnostics_engine.Reset();
+
+  clang::TextDiagnosticPrinter diagnostic_consumer(
+      clang_output_stream, &diagnostics_engine.getDiagnosticOptions());
+
+  diagnostics_engine.setClient(&diagnostic_consumer, false);
+
+  auto compiler_invocation =
+      std::make_shared<clang::CompilerInvocation>(base_invocation);
+
+  auto &input_list = compiler_invocation->getFrontendOpts().Inputs;
+  auto input_kind = input_list.front().getKind();
+
+  input_list.clear();
+  input_list.push_back(clang::FrontendInputFile(source_file, input_kind));
+
+  compiler.setInvocation(compiler_invocation);
+
+  // Each file gets a new source manager, so that the dependency list only
+  // contains its own files; the file manager (and its stat cache) is kept
+  compiler.setSourceManager(nullptr);
+
+  llvm::LLVMContext llvm_context;
+  clang::EmitLLVMOnlyAction compiler_action(&llvm_context);
+  auto action_succeeded = compiler.ExecuteAction(compiler_action);
+
+  // The printer only lives until the end of this function
+  diagnostics_engine.setClient(nullptr, false);
+
+  if (!action_succeeded) {
+    clang_output_stream.flush();
+    error_message = clang_output_buffer;
+    return false;
+  }
 
   auto module = compiler_action.takeModule();
-  llvm::WriteBitcodeToFile(*module.get(), output_stream);
+  if (!module) {
+    error_message = "No module has been generated";
+    return false;
+  }
+
+  if (dependency_list != nullptr && compiler.hasSourceManager()) {
+    *dependency_list = getSourceManagerFileList(compiler.getSourceManager());
+  }
+
+  // LLVM contexts can't be shared across threads; the module is moved to
+  // the final context through its bitcode
+  llvm::raw_string_ostream bitcode_stream(bitcode);
+  llvm::WriteBitcodeToFile(*module.get(), bitcode_stream);
+  bitcode_stream.flush();
+
+  return true;
+}
+
+/// Statistics collected by stripABIBitcode()
+struct BitcodeStripStatistics final {
+  /// Function bodies turned into declarations
+  std::size_t stripped_body_count{0U};
+
+  /// Functions, variables and aliases that have been erased
+  std::size_t erased_global_count{0U};
+};
+
+/// Reduces the module to what mcsema needs: the __mcsema_externs arrays and
+/// the declarations of the functions they reference. Function bodies and
+/// variable initializers are dropped, along with the globals nothing
+/// references anymore, the static constructors and the debug information.
+/// Returns false if the module has no __mcsema_externs array
+bool stripABIBitcode(BitcodeStripStatistics &statistics,
+                     llvm::Module &module) {
+  statistics = {};
+
+  const llvm::StringRef kExternArrayPrefix = "__mcsema_externs";
+
+  std::vector<llvm::GlobalValue *> root_list;
+  for (auto &global_variable : module.globals()) {
+    if (global_variable.getName().startswith(kExternArrayPrefix)) {
+      root_list.push_back(&global_variable);
+    }
+  }
+
+  if (root_list.empty()) {
+    return false;
+  }
+
+  std::unordered_set<const llvm::GlobalValue *> root_set(root_list.begin(),
+                                                         root_list.end());
+
+  // The special arrays are rebuilt at the end, with the roots only
+  for (const auto &name : {"llvm.used", "llvm.compiler.used",
+                           "llvm.global_ctors", "llvm.global_dtors"}) {
+    if (auto global_variable = module.getNamedGlobal(name)) {
+      global_variable->eraseFromParent();
+    }
+  }
+
+  // Aliases can't point to declarations; the functions referenced through
+  // an alias get a declaration of their own, under the alias name
+  for (auto it = module.alias_begin(); it != module.alias_end();) {
+    auto &alias = *it++;
+
+    alias.removeDeadConstantUsers();
+    if (alias.use_empty()) {
+      alias.eraseFromParent();
+      statistics.erased_global_count++;
+      continue;
+    }
+
+    auto function_type =
+        llvm::dyn_cast<llvm::FunctionType>(alias.getValueType());
+
+    if (function_type == nullptr) {
+      continue;
+    }
+
+    auto declaration = llvm::Function::Create(
+        function_type, llvm::GlobalValue::ExternalLinkage, "", &module);
+
+    declaration->takeName(&alias);
+    alias.replaceAllUsesWith(
+        llvm::ConstantExpr::getBitCast(declaration, alias.getType()));
+
+    alias.eraseFromParent();
+  }
+
+  for (auto &function : module) {
+    if (function.isDeclaration()) {
+      continue;
+    }
+
+    // Declarations can't be in a comdat
+    function.deleteBody();
+    function.setComdat(nullptr);
+    function.setVisibility(llvm::GlobalValue::DefaultVisibility);
+
+    statistics.stripped_body_count++;
+  }
+
+  for (auto &global_variable : module.globals()) {
+    if (root_set.count(&global_variable) != 0U ||
+        !global_variable.hasInitializer()) {
+      continue;
+    }
+
+    global_variable.setInitializer(nullptr);
+    global_variable.setLinkage(llvm::GlobalValue::ExternalLinkage);
+    global_variable.setComdat(nullptr);
+    global_variable.setVisibility(llvm::GlobalValue::DefaultVisibility);
+  }
+
+  // Nothing but the roots references other globals now, so a single pass
+  // is enough; the constants that referenced the erased globals go first
+  for (auto it = module.begin(); it != module.end();) {
+    auto &function = *it++;
+
+    function.removeDeadConstantUsers();
+    if (function.use_empty()) {
+      function.eraseFromParent();
+      statistics.erased_global_count++;
+    }
+  }
+
+  for (auto it = module.global_begin(); it != module.global_end();) {
+    auto &global_variable = *it++;
+    if (root_set.count(&global_variable) != 0U) {
+      continue;
+    }
+
+    global_variable.removeDeadConstantUsers();
+    if (global_variable.use_empty()) {
+      global_variable.eraseFromParent();
+      statistics.erased_global_count++;
+    }
+  }
+
+  // Comdats that no longer have any member
+  std::unordered_set<const llvm::Comdat *> used_comdat_set;
+  for (const auto &global_object : module.global_objects()) {
+    if (auto comdat = global_object.getComdat()) {
+      used_comdat_set.insert(comdat);
+    }
+  }
+
+  auto &comdat_table = module.getComdatSymbolTable();
+  for (auto it = comdat_table.begin(); it != comdat_table.end();) {
+    auto current_it = it++;
+    if (used_comdat_set.count(&current_it->second) == 0U) {
+      comdat_table.erase(current_it);
+    }
+  }
+
+  // Debug information and named metadata go too; the module flags are
+  // kept, since they describe the target
+  llvm::StripDebugInfo(module);
+
+  std::vector<llvm::NamedMDNode *> named_metadata_list;
+  for (auto &named_metadata : module.named_metadata()) {
+    if (named_metadata.getName() != "llvm.module.flags") {
+      named_metadata_list.push_back(&named_metadata);
+    }
+  }
+
+  for (auto named_metadata : named_metadata_list) {
+    module.eraseNamedMetadata(named_metadata);
+  }
+
+  llvm::appendToUsed(module, root_list);
+  return true;
+}
+
+/// Writes the given module to the stream. Function bodies always live in
+/// their own blocks, which llvm::getLazyBitcodeModule() skips until each
+/// function is materialized; lazy bitcode also carries a module summary
+/// index, listing every global along with the ones it references, so that
+/// consumers can pick the declarations they need with
+/// llvm::getModuleSummaryIndex() before loading the module at all. Returns
+/// the amount of summaries in the index
+std::size_t writeModuleBitcode(llvm::raw_ostream &stream, llvm::Module &module,
+                               bool lazy_bitcode) {
+  if (!lazy_bitcode) {
+    llvm::WriteBitcodeToFile(module, stream);
+    return 0U;
+  }
+
+  llvm::ProfileSummaryInfo profile_summary_info(module);
+  auto summary_index =
+      llvm::buildModuleSummaryIndex(module, nullptr, &profile_summary_info);
+
+  std::size_t summary_count = 0U;
+  for (const auto &p : summary_index) {
+    summary_count += p.second.SummaryList.size();
+  }
+
+  llvm::WriteBitcodeToFile(module, stream, false, &summary_index);
+  return summary_count;
+}
+
+/// Links the given bitcode buffers in order, saving the resulting module to
+/// the output path; a single buffer is saved as it is. Each buffer is
+/// released as soon as its module has been parsed. When the bitcode output
+/// is passed, it receives the module, and the output path may be empty.
+/// When the output descriptor is not -1, the module is streamed to it
+/// instead of the output path, without any temporary file. The linked
+/// module is reduced with stripABIBitcode() when requested, and is written
+/// with writeModuleBitcode()
+bool linkBitcode(std::vector<std::string> &bitcode_list,
+                 const StringList &source_file_list,
+                 const std::string &output_path, int output_fd,
+                 std::string *bitcode_output, bool strip_bitcode,
+                 bool lazy_bitcode) {
+  auto file_count = bitcode_list.size();
+
+  // The descriptor is owned by the caller, and is left open
+  auto L_streamBitcode = [&](auto L_write) -> bool {
+    llvm::raw_fd_ostream output_stream(output_fd, false);
+    L_write(output_stream);
+    output_stream.flush();
+
+    if (output_stream.has_error()) {
+      output_stream.clear_error();
+
+      std::cerr << "Failed to write the output to the file descriptor "
+                << output_fd << "\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  // The bitcode returned to the caller is only saved when an output path
+  // has been given
+  auto L_saveBitcode = [&](const std::string &bitcode) -> bool {
+    if (output_fd >= 0) {
+      return L_streamBitcode(
+          [&](llvm::raw_ostream &output_stream) { output_stream << bitcode; });
+    }
+
+    if (!output_path.empty() && !writeFileIfChanged(output_path, bitcode)) {
+      std::cerr << "Failed to save the output to file\n";
+      return false;
+    }
+
+    return true;
+  };
+
+  // There is nothing to link when compiling a single file; the bitcode can
+  // be copied as it is
+  if (file_count == 1U && !strip_bitcode && !lazy_bitcode) {
+    if (bitcode_output == nullptr) {
+      return L_saveBitcode(bitcode_list.front());
+    }
+
+    *bitcode_output = std::move(bitcode_list.front());
+    return L_saveBitcode(*bitcode_output);
+  }
+
+  // Link the modules in the order of the source file list
+  llvm::LLVMContext llvm_context;
+  std::unique_ptr<llvm::Module> output_module;
+  std::unique_ptr<llvm::Linker> linker;
+
+  for (std::size_t i = 0U; i < file_count; ++i) {
+    llvm::MemoryBufferRef bitcode_buffer(bitcode_list[i], source_file_list[i]);
+
+    auto module_exp = llvm::parseBitcodeFile(bitcode_buffer, llvm_context);
+    if (!module_exp) {
+      llvm::consumeError(module_exp.takeError());
+      std::cerr << "Failed to load the bitcode of " << source_file_list[i]
+                << "\n";
+      return false;
+    }
+
+    // The buffer is no longer needed once the module has been parsed
+    auto module = std::move(module_exp.get());
+    std::string().swap(bitcode_list[i]);
+
+    if (!output_module) {
+      output_module = std::move(module);
+      linker = llvm::make_unique<llvm::Linker>(*output_module);
+      continue;
+    }
+
+    // Returns true on error
+    if (linker->linkInModule(std::move(module))) {
+      std::cerr << "Failed to link the bitcode of " << source_file_list[i]
+                << "\n";
+      return false;
+    }
+  }
+
+  if (strip_bitcode) {
+    BitcodeStripStatistics statistics;
+    if (!stripABIBitcode(statistics, *output_module)) {
+      std::cerr << "The bitcode can't be stripped: the __mcsema_externs "
+                   "array is missing\n";
+      return false;
+    }
+
+    std::cerr << "Bitcode stripping: " << statistics.stripped_body_count
+              << " function bodies removed, "
+              << statistics.erased_global_count
+              << " unreferenced globals erased\n";
+  }
+
+  auto L_printSummaryCount = [&](std::size_t summary_count) {
+    if (lazy_bitcode) {
+      std::cerr << "Lazy bitcode: " << summary_count
+                << " globals listed in the module summary index\n";
+    }
+  };
+
+  if (bitcode_output != nullptr) {
+    bitcode_output->clear();
+
+    {
+      llvm::raw_string_ostream output_stream(*bitcode_output);
+      L_printSummaryCount(
+          writeModuleBitcode(output_stream, *output_module, lazy_bitcode));
+    }
+
+    return L_saveBitcode(*bitcode_output);
+  }
+
+  if (output_fd >= 0) {
+    return L_streamBitcode([&](llvm::raw_ostream &output_stream) {
+      L_printSummaryCount(
+          writeModuleBitcode(output_stream, *output_module, lazy_bitcode));
+    });
+  }
+
+  // The output is only replaced when the linked module has changed
+  auto temporary_path = getTemporaryOutputPath(output_path);
+  std::error_code stream_error_code;
+
+  {
+    llvm::raw_fd_ostream output_stream(temporary_path, stream_error_code,
+                                       llvm::sys::fs::F_None);
+
+    L_printSummaryCount(
+        writeModuleBitcode(output_stream, *output_module, lazy_bitcode));
+    output_stream.flush();
+  }
 
-  output_stream.flush();
   if (stream_error_code) {
+    std::error_code error;
+    stdfs::remove(temporary_path, error);
+
     std::cerr << "Failed to save the output to file\n";
     return false;
   }
 
+  if (!replaceFileIfChanged(temporary_path, output_path)) {
+    std::cerr << "Failed to save the output to file\n";
+    return false;
+  }
+
+  return true;
+}
+}  // namespace
+
+bool buildCompilePrecompiledHeader(ProfileManagerRef &profile_manager,
+                                   const LanguageManager &language_manager,
+                                   const CommandLineOptions &cmdline_options,
+                                   const std::string &header_path,
+                                   const std::string &pch_path) {
+  CompilerInstanceSettings clang_settings;
+  if (!getCompileSettings(clang_settings, profile_manager, language_manager,
+                          cmdline_options)) {
+    return false;
+  }
+
+  // The source files are C++ no matter the language, and so is the header
+  // they include; the output is written next to the final one, and only
+  // replaces it once the manifest is ready
+  auto temporary_path = getTemporaryOutputPath(pch_path);
+
+  auto clang_arguments = getCompileArguments(clang_settings, cmdline_options);
+  clang_arguments.erase(
+      std::remove_if(clang_arguments.begin(), clang_arguments.end(),
+                     [](const std::string &argument) -> bool {
+                       return argument == "-S" || argument == "-emit-llvm";
+                     }),
+      clang_arguments.end());
+
+  clang_arguments.insert(clang_arguments.end(),
+                         {"-emit-pch", "-x", "c++-header", "-o",
+                          temporary_path, header_path});
+
+  std::vector<const char *> invocation;
+  for (const auto &argument : clang_arguments) {
+    invocation.push_back(argument.c_str());
+  }
+
+  std::unique_ptr<clang::CompilerInstance> compiler;
+  auto status = createClangCompilerInstance(compiler, clang_settings);
+  if (!status.succeeded()) {
+    std::cerr << status.toString() << "\n";
+    return false;
+  }
+
+  std::string clang_output_buffer;
+  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
+
+  clang::DiagnosticsEngine &diagnostics_engine = compiler->getDiagnostics();
+  diagnostics_engine.Reset();
+
+  clang::TextDiagnosticPrinter diagnostic_consumer(
+      clang_output_stream, &diagnostics_engine.getDiagnosticOptions());
+
+  diagnostics_engine.setClient(&diagnostic_consumer, false);
+
+  auto compiler_invocation = std::make_shared<clang::CompilerInvocation>();
+  auto succeeded = clang::CompilerInvocation::CreateFromArgs(
+      *compiler_invocation.get(), &invocation[0],
+      &invocation[0] + invocation.size(), diagnostics_engine);
+
+  if (succeeded) {
+    compiler->setInvocation(compiler_invocation);
+
+    clang::GeneratePCHAction compiler_action;
+    succeeded = compiler->ExecuteAction(compiler_action);
+  }
+
+  // The printer only lives until the end of this function
+  diagnostics_engine.setClient(nullptr, false);
+
+  std::error_code error;
+  if (!succeeded) {
+    stdfs::remove(temporary_path, error);
+
+    clang_output_stream.flush();
+    std::cerr << "Failed to precompile " << header_path << ": "
+              << clang_output_buffer << "\n";
+    return false;
+  }
+
+  // Paths are made absolute, so that the compile command can validate the
+  // header from any working directory
+  json11::Json::array file_array;
+  auto dependency_list = getSourceManagerFileList(compiler->getSourceManager());
+
+  for (const auto &path : dependency_list) {
+    auto absolute_path = stdfs::absolute(path, error);
+
+    ContentHash hash;
+    if (error || !hashFileContents(hash, absolute_path.string())) {
+      stdfs::remove(temporary_path, error);
+
+      std::cerr << "Failed to hash the precompiled header dependency " << path
+                << "\n";
+      return false;
+    }
+
+    file_array.push_back(json11::Json::object{
+        {"path", absolute_path.string()}, {"hash", contentHashToString(hash)}});
+  }
+
+  json11::Json manifest = json11::Json::object{
+      {"arguments", contentHashToString(
+                        hashCompileArguments(clang_settings, cmdline_options))},
+      {"files", file_array}};
+
+  if (!writeFileIfChanged(getPrecompiledHeaderManifestPath(pch_path),
+                          manifest.dump() + "\n") ||
+      !replaceFileIfChanged(temporary_path, pch_path)) {
+    std::cerr << "Failed to save the precompiled header " << pch_path << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+bool runCompileCommand(ProfileManagerRef &profile_manager,
+                       const LanguageManager &language_manager,
+                       const CommandLineOptions &cmdline_options,
+                       std::string *bitcode,
+                       std::shared_ptr<const RenderedFileMap> source_file_map) {
+  if (!cmdline_options.module_map_files.empty() &&
+      cmdline_options.module_cache_directory.empty()) {
+    std::cerr << "The --module-map option requires --module-cache\n";
+    return false;
+  }
+
+  if (!cmdline_options.remote_cache_url.empty() &&
+      cmdline_options.cache_directory.empty()) {
+    std::cerr << "The --remote-cache option requires --cache-dir\n";
+    return false;
+  }
+
+  if (cmdline_options.cache_size_limit != 0U &&
+      cmdline_options.remote_cache_url.empty()) {
+    std::cerr << "The --cache-size-limit option requires --remote-cache\n";
+    return false;
+  }
+
+  if (!cmdline_options.header_map_path.empty()) {
+    std::error_code error;
+    if (!stdfs::is_regular_file(cmdline_options.header_map_path, error)) {
+      std::cerr << "The header map does not exist: "
+                << cmdline_options.header_map_path << "\n";
+      return false;
+    }
+  }
+
+  CompilerInstanceSettings clang_settings;
+  if (!getCompileSettings(clang_settings, profile_manager, language_manager,
+                          cmdline_options)) {
+    return false;
+  }
+
+  StringList source_file_list;
+  if (source_file_map) {
+    for (const auto &file_entry : *source_file_map) {
+      if (stdfs::path(file_entry.first).extension() == ".cpp") {
+        source_file_list.push_back(file_entry.first);
+      }
+    }
+
+    if (source_file_list.empty()) {
+      std::cerr << "No source file has been generated\n";
+      return false;
+    }
+
+    clang_settings.in_memory_file_map = source_file_map;
+
+  } else if (!collectSourceFiles(
+                 source_file_list,
+                 cmdline_options.abi_library_source_file_list)) {
+    return false;
+  }
+
+  // The in-memory files never reach the cache folder, and their paths may
+  // not even exist on disk; the caches are skipped altogether
+  auto use_caches =
+      !cmdline_options.cache_directory.empty() && !source_file_map;
+
+  // The bitcode missing from the cache folder is downloaded from the remote
+  // cache, when set
+  RemoteCacheRef remote_cache;
+  if (use_caches && !cmdline_options.remote_cache_url.empty()) {
+    auto remote_cache_status = RemoteCache::create(
+        remote_cache, cmdline_options.remote_cache_url,
+        cmdline_options.cache_directory,
+        static_cast<std::uint64_t>(cmdline_options.cache_size_limit) * 1024U *
+            1024U);
+
+    if (!remote_cache_status.succeeded()) {
+      std::cerr << remote_cache_status.toString() << "\n";
+      return false;
+    }
+  }
+
+  // The compile cache is keyed on the compiler settings; the abigen version
+  // they include also identifies the clang arguments used for each source
+  // file
+  CompileCacheRef compile_cache;
+  if (use_caches) {
+    auto compile_cache_status = CompileCache::create(
+        compile_cache, cmdline_options.cache_directory,
+        hashCompilerInstanceSettings(clang_settings), remote_cache);
+
+    if (!compile_cache_status.succeeded()) {
+      std::cerr << compile_cache_status.toString() << "\n";
+      return false;
+    }
+  }
+
+  TimeReportRef time_report;
+  if (!cmdline_options.metrics_file.empty()) {
+    time_report = std::make_shared<TimeReport>();
+  }
+
+  // Compile the source files on the worker threads; the results are stored
+  // by index, so that the link order does not depend on the scheduling
+  auto file_count = source_file_list.size();
+
+  std::vector<std::string> bitcode_list(file_count);
+  std::vector<std::string> error_message_list(file_count);
+
+  // std::vector<bool> packs its elements, and can't be written concurrently
+  std::vector<std::uint8_t> succeeded_list(file_count, 0U);
+
+  // The files read by each source file, needed by the compile cache and by
+  // the dependency file
+  auto collect_dependencies =
+      compile_cache || !cmdline_options.depfile_path.empty();
+
+  std::vector<StringList> dependency_list_list(file_count);
+
+  std::atomic_size_t next_file{0U};
+
+  // The header included by the source files is loaded from the precompiled
+  // header saved by the generate command, when it is still valid
+  std::string precompiled_header;
+  StringList pch_dependency_list;
+
+  if (!cmdline_options.precompiled_header_path.empty()) {
+    std::string reason;
+    if (validatePrecompiledHeader(
+            pch_dependency_list, reason,
+            cmdline_options.precompiled_header_path,
+            hashCompileArguments(clang_settings, cmdline_options))) {
+      precompiled_header = cmdline_options.precompiled_header_path;
+
+    } else {
+      std::cerr << "Precompiled header: not used, " << reason
+                << "; the headers are parsed as text\n";
+    }
+  }
+
+  // The invocation is only parsed once; each worker then builds a single
+  // compiler instance, on the first file the compile cache can't serve. The
+  // ones loading the precompiled header fall back to the others when a
+  // source file does not compile on top of it
+  CompileInvocationMap invocation_map;
+  CompileInvocationMap pch_invocation_map;
+
+  {
+    std::string error_message;
+    if (!createCompileInvocations(invocation_map, error_message,
+                                  clang_settings, cmdline_options,
+                                  source_file_list, std::string())) {
+      std::cerr << error_message << "\n";
+      return false;
+    }
+
+    if (!precompiled_header.empty() &&
+        !createCompileInvocations(pch_invocation_map, error_message,
+                                  clang_settings, cmdline_options,
+                                  source_file_list, precompiled_header)) {
+      std::cerr << error_message << "\n";
+      return false;
+    }
+  }
+
+  std::atomic_size_t pch_compilation_count{0U};
+  std::atomic_size_t pch_fallback_count{0U};
+
+  auto L_worker = [&](std::size_t) {
+    std::unique_ptr<clang::CompilerInstance> compiler;
+
+    while (true) {
+      auto file_index = next_file.fetch_add(1U);
+      if (file_index >= file_count) {
+        break;
+      }
+
+      const auto &source_file = source_file_list[file_index];
+      auto &bitcode = bitcode_list[file_index];
+
+      // Entries are keyed on the absolute path, so that they can be found
+      // from any working directory
+      std::error_code error;
+      auto cache_key = stdfs::absolute(source_file, error).string();
+      if (error) {
+        cache_key = source_file;
+      }
+
+      auto &dependency_list = dependency_list_list[file_index];
+
+      if (compile_cache &&
+          compile_cache->lookup(bitcode, cache_key, &dependency_list)) {
+        succeeded_list[file_index] = true;
+        continue;
+      }
+
+      if (!compiler) {
+        auto status = createClangCompilerInstance(compiler, clang_settings);
+        if (!status.succeeded()) {
+          compiler.reset();
+          error_message_list[file_index] = status.toString();
+          continue;
+        }
+      }
+
+      auto extension = stdfs::path(source_file).extension().string();
+
+      if (!pch_invocation_map.empty()) {
+        succeeded_list[file_index] = compileSourceFile(
+            bitcode, error_message_list[file_index], *compiler,
+            *pch_invocation_map.at(extension), source_file,
+            collect_dependencies ? &dependency_list : nullptr);
+
+        // The files read through the precompiled header are not always
+        // listed by the source manager
+        if (succeeded_list[file_index]) {
+          dependency_list.insert(dependency_list.end(),
+                                 pch_dependency_list.begin(),
+                                 pch_dependency_list.end());
+
+          ++pch_compilation_count;
+        } else {
+          ++pch_fallback_count;
+        }
+      }
+
+      if (!succeeded_list[file_index]) {
+        succeeded_list[file_index] = compileSourceFile(
+            bitcode, error_message_list[file_index], *compiler,
+            *invocation_map.at(extension), source_file,
+            collect_dependencies ? &dependency_list : nullptr);
+      }
+
+      if (compile_cache && succeeded_list[file_index]) {
+        compile_cache->store(cache_key, bitcode, dependency_list);
+      }
+    }
+  };
+
+  {
+    ScopedPhaseTimer phase_timer(time_report, "Source compilation");
+
+    auto thread_count = std::min(cmdline_options.jobs, file_count);
+    runTaskLanes(thread_count, TaskPriority::Normal, L_worker);
+  }
+
+  bool succeeded = true;
+  for (std::size_t i = 0U; i < file_count; ++i) {
+    if (!succeeded_list[i]) {
+      std::cerr << "Error: " << source_file_list[i] << ": "
+                << error_message_list[i] << "\n";
+
+      succeeded = false;
+    }
+  }
+
+  if (compile_cache) {
+    std::cerr << "Compile cache: " << compile_cache->hitCount() << " hits, "
+              << compile_cache->missCount() << " misses\n";
+  }
+
+  if (!precompiled_header.empty()) {
+    std::cerr << "Precompiled header: " << pch_compilation_count
+              << " source files compiled on top of it, " << pch_fallback_count
+              << " parsed as text\n";
+  }
+
+  if (remote_cache) {
+    remote_cache->waitForUploads();
+
+    std::cerr << "Remote cache: " << remote_cache->downloadCount()
+              << " downloads, " << remote_cache->uploadCount() << " uploads, "
+              << remote_cache->errorCount() << " errors\n";
+  }
+
+  if (!succeeded) {
+    return false;
+  }
+
+  // "-o -" streams the bitcode to the standard output; with --output-fd,
+  // the output path only names the target of the dependency file
+  auto output_fd = cmdline_options.output_fd;
+  if (output_fd < 0 && cmdline_options.output == "-") {
+    output_fd = 1;
+  }
+
+  {
+    ScopedPhaseTimer phase_timer(time_report, "Bitcode linking");
+
+    if (!linkBitcode(bitcode_list, source_file_list, cmdline_options.output,
+                     output_fd, bitcode, cmdline_options.strip_bitcode,
+                     cmdline_options.lazy_bitcode)) {
+      return false;
+    }
+  }
+
+  if (!cmdline_options.depfile_path.empty() &&
+      !cmdline_options.output.empty() && cmdline_options.output != "-") {
+    StringList dependency_list;
+    if (!source_file_map) {
+      dependency_list = source_file_list;
+    }
+
+    for (const auto &file_dependency_list : dependency_list_list) {
+      for (const auto &dependency : file_dependency_list) {
+        if (source_file_map && source_file_map->count(dependency) != 0U) {
+          continue;
+        }
+
+        dependency_list.push_back(dependency);
+      }
+    }
+
+    if (!writeDependencyFile(cmdline_options.depfile_path,
+                             {cmdline_options.output}, dependency_list)) {
+      std::cerr << "Failed to write the dependency file: "
+                << cmdline_options.depfile_path << "\n";
+      return false;
+    }
+  }
+
+  if (time_report &&
+      !time_report->writeMetricsFile(cmdline_options.metrics_file)) {
+    std::cerr << "Failed to write the metrics file: "
+              << cmdline_options.metrics_file << "\n";
+    return false;
+  }
+
   return true;
 }
+
+/// Handler for the 'compile' command
+bool compileCommandHandler(ProfileManagerRef &profile_manager,
+                           const LanguageManager &language_manager,
+                           const CommandLineOptions &cmdline_options) {
+  return runCompileCommand(profile_manager, language_manager, cmdline_options,
+                           nullptr);
+}
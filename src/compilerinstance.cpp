@@ -15,10 +15,29 @@
  */
 
 #include "compilerinstance.h"
+#include "flight_recorder.h"
 #include "generate_utils.h"
+#include "huge_pages.h"
 #include "std_filesystem.h"
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <clang/AST/Mangle.h>
 #include <clang/AST/RecursiveASTVisitor.h>
@@ -26,16 +45,842 @@
 #include <clang/CodeGen/CodeGenAction.h>
 #include <clang/Frontend/FrontendOptions.h>
 #include <clang/Frontend/TextDiagnosticPrinter.h>
+#include <clang/Lex/LexDiagnostic.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/PreprocessorOptions.h>
 #include <clang/Parse/ParseAST.h>
+#include <clang/Sema/Sema.h>
+#include <clang/Sema/SemaDiagnostic.h>
+#include <clang/Sema/TemplateInstCallback.h>
+#include <clang/Serialization/ASTWriter.h>
+
+namespace {
+/// A diagnostic consumer that only counts errors and warnings, without
+/// rendering them
+class CountingDiagnosticConsumer final : public clang::DiagnosticConsumer {
+ public:
+  virtual ~CountingDiagnosticConsumer() override = default;
+
+  virtual void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                                const clang::Diagnostic &info) override {
+    // The base class updates the error and warning counters
+    clang::DiagnosticConsumer::HandleDiagnostic(level, info);
+  }
+};
+
+/// Returns the given diagnostic argument as a string; an empty string is
+/// returned for the argument kinds that do not name anything
+std::string getDiagnosticArgument(const clang::Diagnostic &diagnostic,
+                                  unsigned int index) {
+  if (index >= diagnostic.getNumArgs()) {
+    return std::string();
+  }
+
+  switch (diagnostic.getArgKind(index)) {
+    case clang::DiagnosticsEngine::ak_std_string:
+      return diagnostic.getArgStdStr(index);
+
+    case clang::DiagnosticsEngine::ak_c_string:
+      return diagnostic.getArgCStr(index);
+
+    case clang::DiagnosticsEngine::ak_identifierinfo: {
+      auto identifier = diagnostic.getArgIdentifier(index);
+      return (identifier != nullptr) ? identifier->getName().str()
+                                     : std::string();
+    }
+
+    case clang::DiagnosticsEngine::ak_declarationname:
+      return clang::DeclarationName::getFromOpaqueInteger(
+                 diagnostic.getRawArg(index))
+          .getAsString();
+
+    default:
+      return std::string();
+  }
+}
+
+/// Classifies the given error diagnostic
+CompilationErrorCause getCompilationErrorCause(
+    const clang::Diagnostic &diagnostic) {
+  CompilationErrorCause error_cause;
+  error_cause.kind = CompilationErrorKind::Unknown;
+
+  switch (diagnostic.getID()) {
+    case clang::diag::err_pp_file_not_found: {
+      // The main source buffer only contains the include directives
+      const auto &location = diagnostic.getLocation();
+      auto in_main_file = diagnostic.hasSourceManager() &&
+                          location.isValid() &&
+                          diagnostic.getSourceManager().isInMainFile(location);
+
+      error_cause.kind = in_main_file
+                             ? CompilationErrorKind::MissingIncludeDirective
+                             : CompilationErrorKind::MissingFile;
+
+      error_cause.name = getDiagnosticArgument(diagnostic, 0U);
+      break;
+    }
+
+    case clang::diag::err_pp_hash_error:
+      error_cause.kind = CompilationErrorKind::ErrorDirective;
+      error_cause.name = getDiagnosticArgument(diagnostic, 0U);
+      break;
+
+    case clang::diag::err_redefinition:
+    case clang::diag::err_redefinition_different_kind:
+    case clang::diag::err_redefinition_different_typedef:
+      error_cause.kind = CompilationErrorKind::Redefinition;
+      error_cause.name = getDiagnosticArgument(diagnostic, 0U);
+      break;
+
+    case clang::diag::err_unknown_typename:
+    case clang::diag::err_unknown_typename_suggest:
+    case clang::diag::err_undeclared_var_use:
+    case clang::diag::err_undeclared_var_use_suggest:
+      error_cause.kind = CompilationErrorKind::UndeclaredIdentifier;
+      error_cause.name = getDiagnosticArgument(diagnostic, 0U);
+      break;
+
+    default:
+      break;
+  }
+
+  // Without a name, the cause can't be acted upon
+  if (error_cause.kind == CompilationErrorKind::UndeclaredIdentifier &&
+      error_cause.name.empty()) {
+    error_cause.kind = CompilationErrorKind::Unknown;
+  }
+
+  return error_cause;
+}
+
+/// Returns the line of the main source buffer containing the #include
+/// directive through which the given diagnostic has been reached, following
+/// the include stack of its location; errors reported on the directive
+/// itself return its own line. Zero is returned when the diagnostic has no
+/// location
+std::size_t getMainFileIncludeLine(const clang::Diagnostic &diagnostic) {
+  if (!diagnostic.hasSourceManager() || !diagnostic.getLocation().isValid()) {
+    return 0U;
+  }
+
+  const auto &source_manager = diagnostic.getSourceManager();
+  auto main_file_id = source_manager.getMainFileID();
+
+  auto location = source_manager.getExpansionLoc(diagnostic.getLocation());
+
+  while (location.isValid()) {
+    auto file_id = source_manager.getFileID(location);
+    if (file_id == main_file_id) {
+      return source_manager.getExpansionLineNumber(location);
+    }
+
+    location = source_manager.getIncludeLoc(file_id);
+    if (location.isValid()) {
+      location = source_manager.getExpansionLoc(location);
+    }
+  }
+
+  return 0U;
+}
+
+/// Forwards the diagnostics to another consumer, recording the cause of the
+/// first error and the include directives every error comes from
+class ErrorCauseDiagnosticConsumer final : public clang::DiagnosticConsumer {
+  /// The consumer receiving the diagnostics
+  clang::DiagnosticConsumer &consumer;
+
+  /// Receives the cause of the first error
+  CompilationErrorCause &error_cause;
+
+ public:
+  /// Constructor
+  ErrorCauseDiagnosticConsumer(clang::DiagnosticConsumer &consumer,
+                               CompilationErrorCause &error_cause)
+      : consumer(consumer), error_cause(error_cause) {
+    error_cause = {};
+  }
+
+  virtual ~ErrorCauseDiagnosticConsumer() override = default;
+
+  virtual void BeginSourceFile(
+      const clang::LangOptions &language_options,
+      const clang::Preprocessor *preprocessor) override {
+    consumer.BeginSourceFile(language_options, preprocessor);
+  }
+
+  virtual void EndSourceFile() override { consumer.EndSourceFile(); }
+
+  virtual void HandleDiagnostic(clang::DiagnosticsEngine::Level level,
+                                const clang::Diagnostic &info) override {
+    clang::DiagnosticConsumer::HandleDiagnostic(level, info);
+    consumer.HandleDiagnostic(level, info);
+
+    if (level < clang::DiagnosticsEngine::Error) {
+      return;
+    }
+
+    if (error_cause.kind == CompilationErrorKind::None) {
+      auto include_line_list = std::move(error_cause.include_line_list);
+
+      error_cause = getCompilationErrorCause(info);
+      error_cause.include_line_list = std::move(include_line_list);
+    }
+
+    auto include_line = getMainFileIncludeLine(info);
+    if (include_line == 0U) {
+      return;
+    }
+
+    auto &include_line_list = error_cause.include_line_list;
+
+    auto it = std::lower_bound(include_line_list.begin(),
+                               include_line_list.end(), include_line);
+
+    if (it == include_line_list.end() || *it != include_line) {
+      include_line_list.insert(it, include_line);
+    }
+  }
+};
+
+/// Aborts a compilation once its time budget has been exhausted, or once its
+/// cancellation flag has been raised. Clang can't be interrupted from
+/// another thread, so the deadline is checked from the preprocessor and
+/// template instantiation callbacks; when it expires, a fatal error is
+/// reported. Clang then stops entering #include directives and
+/// instantiating templates, and the compilation winds down quickly
+class CompilationDeadline final {
+  /// The diagnostics engine of the compilation
+  clang::DiagnosticsEngine &diagnostics_engine;
+
+  /// The time budget, in seconds; zero if the compilation has none
+  std::size_t time_budget{0U};
+
+  /// When the time budget runs out
+  std::chrono::steady_clock::time_point expiration_time;
+
+  /// Raised by another thread to abort the compilation, if set
+  const std::atomic_bool *cancellation_flag{nullptr};
+
+  /// Raised to abort every compilation of the run, if set
+  const std::atomic_bool *run_cancellation_flag{nullptr};
+
+  /// True once the deadline has expired
+  bool expired{false};
+
+  /// True if the deadline has expired because of the cancellation flag
+  bool cancelled{false};
+
+ public:
+  /// Constructor
+  CompilationDeadline(clang::DiagnosticsEngine &diagnostics_engine,
+                      std::chrono::steady_clock::time_point start_time,
+                      std::size_t time_budget,
+                      const std::atomic_bool *cancellation_flag = nullptr,
+                      const std::atomic_bool *run_cancellation_flag = nullptr)
+      : diagnostics_engine(diagnostics_engine),
+        time_budget(time_budget),
+        expiration_time(start_time + std::chrono::seconds(time_budget)),
+        cancellation_flag(cancellation_flag),
+        run_cancellation_flag(run_cancellation_flag) {}
+
+  /// Starts the time budget again from the given time
+  void restart(std::chrono::steady_clock::time_point start_time) {
+    expiration_time = start_time + std::chrono::seconds(time_budget);
+  }
+
+  /// Stops checking the cancellation flags; called before the deadline
+  /// outlives the compilation
+  void detachCancellationFlag() {
+    cancellation_flag = nullptr;
+    run_cancellation_flag = nullptr;
+  }
+
+  /// Reports the fatal error if the deadline has expired
+  void check() {
+    if (expired) {
+      return;
+    }
+
+    cancelled =
+        (cancellation_flag != nullptr && cancellation_flag->load()) ||
+        (run_cancellation_flag != nullptr && run_cancellation_flag->load());
+    if (!cancelled && (time_budget == 0U ||
+                       std::chrono::steady_clock::now() < expiration_time)) {
+      return;
+    }
+
+    expired = true;
+
+    auto diagnostic_id = diagnostics_engine.getCustomDiagID(
+        clang::DiagnosticsEngine::Error,
+        cancelled ? "the compilation has been cancelled"
+                  : "the compilation has exceeded its time budget");
+
+    diagnostics_engine.Report(diagnostic_id);
+
+    // Custom diagnostics do not count as uncompilable errors, which is what
+    // stops the template instantiations; the fatal error must stay fatal
+    // even when the compilation recovers from the other ones
+    diagnostics_engine.setFatalsAsError(false);
+    diagnostics_engine.Report(clang::diag::fatal_too_many_errors);
+  }
+
+  /// Returns true if the deadline has expired
+  bool hasExpired() const { return expired; }
+
+  /// Returns true if the deadline has expired because of the cancellation
+  /// flag
+  bool wasCancelled() const { return cancelled; }
+};
+
+/// Checks the compilation deadline while preprocessing
+class DeadlinePPCallbacks final : public clang::PPCallbacks {
+  /// The compilation deadline
+  CompilationDeadline &deadline;
+
+ public:
+  /// Constructor
+  DeadlinePPCallbacks(CompilationDeadline &deadline) : deadline(deadline) {}
+
+  virtual ~DeadlinePPCallbacks() override = default;
+
+  virtual void FileChanged(clang::SourceLocation, FileChangeReason,
+                           clang::SrcMgr::CharacteristicKind,
+                           clang::FileID) override {
+    deadline.check();
+  }
+
+  virtual void MacroExpands(const clang::Token &,
+                            const clang::MacroDefinition &, clang::SourceRange,
+                            const clang::MacroArgs *) override {
+    deadline.check();
+  }
+};
+
+/// Charges the time and the AST memory of the frontend to the file on top
+/// of the include stack, at each include boundary. The parser pulls the
+/// tokens as it goes, so this covers the semantic analysis of each header
+/// too; the buffers without a file (the main one and the predefines) are
+/// not tracked
+class HeaderCostPPCallbacks final : public clang::PPCallbacks {
+  /// The source manager of the compilation
+  clang::SourceManager &source_manager;
+
+  /// The AST context of the compilation
+  const clang::ASTContext &ast_context;
+
+  /// The files being read, innermost last
+  std::vector<const clang::FileEntry *> file_stack;
+
+  /// When the costs have last been charged
+  std::chrono::steady_clock::time_point last_charge_time;
+
+  /// The AST memory allocated when the costs have last been charged
+  std::size_t last_ast_bytes{0U};
+
+  /// The costs of each file
+  std::unordered_map<const clang::FileEntry *, HeaderCost> header_cost_map;
+
+ public:
+  /// Constructor
+  HeaderCostPPCallbacks(clang::SourceManager &source_manager,
+                        const clang::ASTContext &ast_context)
+      : source_manager(source_manager),
+        ast_context(ast_context),
+        last_charge_time(std::chrono::steady_clock::now()),
+        last_ast_bytes(ast_context.getASTAllocatedMemory()) {}
+
+  virtual ~HeaderCostPPCallbacks() override = default;
+
+  virtual void FileChanged(clang::SourceLocation location,
+                           FileChangeReason reason,
+                           clang::SrcMgr::CharacteristicKind,
+                           clang::FileID) override {
+    if (reason == EnterFile) {
+      charge();
+      file_stack.push_back(source_manager.getFileEntryForID(
+          source_manager.getFileID(source_manager.getExpansionLoc(location))));
+
+    } else if (reason == ExitFile) {
+      charge();
+      if (!file_stack.empty()) {
+        file_stack.pop_back();
+      }
+    }
+  }
+
+  /// Charges the costs since the last include boundary to the current file
+  void charge() {
+    auto now = std::chrono::steady_clock::now();
+    auto ast_bytes = ast_context.getASTAllocatedMemory();
+
+    if (!file_stack.empty() && file_stack.back() != nullptr) {
+      auto &header_cost = header_cost_map[file_stack.back()];
+      header_cost.parse_time +=
+          std::chrono::duration<double>(now - last_charge_time).count();
+
+      if (ast_bytes > last_ast_bytes) {
+        header_cost.ast_bytes += ast_bytes - last_ast_bytes;
+      }
+    }
+
+    last_charge_time = now;
+    last_ast_bytes = ast_bytes;
+  }
+
+  /// Adds the costs of each header to the given report
+  void report(TimeReport &time_report) {
+    charge();
+
+    for (const auto &p : header_cost_map) {
+      time_report.addHeaderCost(std::string(p.first->getName()), p.second);
+    }
+  }
+};
+
+/// Invokes a handler when the preprocessor is about to enter the given
+/// header, before its contents are read; used by forkProcessAST
+class ForkPointPPCallbacks final : public clang::PPCallbacks {
+  /// The path of the header, as spelled by its #include directive
+  std::string fork_point_path;
+
+  /// The handler
+  std::function<void(const clang::FileEntry *)> handler;
+
+ public:
+  /// Constructor
+  ForkPointPPCallbacks(const std::string &fork_point_path,
+                       std::function<void(const clang::FileEntry *)> handler)
+      : fork_point_path(fork_point_path), handler(std::move(handler)) {}
+
+  virtual ~ForkPointPPCallbacks() override = default;
+
+  // clang-format off
+  virtual void InclusionDirective(
+      clang::SourceLocation, const clang::Token &, llvm::StringRef file_name,
+      bool, clang::CharSourceRange, const clang::FileEntry *file_entry,
+      llvm::StringRef, llvm::StringRef, const clang::Module *
+#if LLVM_MAJOR_VERSION >= 7
+      , clang::SrcMgr::CharacteristicKind
+#endif
+      ) override {
+    // clang-format on
+    if (file_entry != nullptr && file_name == fork_point_path) {
+      handler(file_entry);
+    }
+  }
+};
+
+/// Checks the compilation deadline before each template instantiation
+class DeadlineTemplateInstantiationCallback final
+    : public clang::TemplateInstantiationCallback {
+  /// The compilation deadline
+  CompilationDeadline &deadline;
+
+ public:
+  /// Constructor
+  DeadlineTemplateInstantiationCallback(CompilationDeadline &deadline)
+      : deadline(deadline) {}
+
+  virtual ~DeadlineTemplateInstantiationCallback() override = default;
+
+  virtual void initialize(const clang::Sema &) override {}
+
+  virtual void finalize(const clang::Sema &) override {}
+
+  virtual void atTemplateBegin(
+      const clang::Sema &, const clang::Sema::CodeSynthesisContext &) override {
+    deadline.check();
+  }
+
+  virtual void atTemplateEnd(
+      const clang::Sema &, const clang::Sema::CodeSynthesisContext &) override {
+  }
+};
+
+/// Counts the template instantiations performed by Sema
+class CountingTemplateInstantiationCallback final
+    : public clang::TemplateInstantiationCallback {
+  /// The instantiation counter
+  std::uint64_t &instantiation_count;
+
+ public:
+  /// Constructor
+  CountingTemplateInstantiationCallback(std::uint64_t &instantiation_count)
+      : instantiation_count(instantiation_count) {}
+
+  virtual ~CountingTemplateInstantiationCallback() override = default;
+
+  virtual void initialize(const clang::Sema &) override {}
+
+  virtual void finalize(const clang::Sema &) override {}
+
+  virtual void atTemplateBegin(
+      const clang::Sema &,
+      const clang::Sema::CodeSynthesisContext &context) override {
+    // Default arguments, deductions and the other synthesis contexts are
+    // not counted
+    if (context.Kind ==
+        clang::Sema::CodeSynthesisContext::TemplateInstantiation) {
+      ++instantiation_count;
+    }
+  }
+
+  virtual void atTemplateEnd(
+      const clang::Sema &, const clang::Sema::CodeSynthesisContext &) override {
+  }
+};
+
+/// Returns the size of the files and buffers read by the source manager
+std::uint64_t getSourceManagerByteCount(clang::SourceManager &source_manager) {
+  std::uint64_t byte_count = 0U;
+
+  for (auto it = source_manager.fileinfo_begin();
+       it != source_manager.fileinfo_end(); ++it) {
+    byte_count += it->second->getSize();
+  }
+
+  return byte_count;
+}
+
+/// Counts the declarations of the translation unit, walking the nested
+/// declaration contexts; declarations that are still in an external source,
+/// such as a precompiled header, are not deserialized
+std::uint64_t getDeclarationCount(clang::ASTContext &ast_context) {
+  std::uint64_t declaration_count = 0U;
+
+  std::vector<const clang::DeclContext *> pending_context_list = {
+      ast_context.getTranslationUnitDecl()};
+
+  while (!pending_context_list.empty()) {
+    auto decl_context = pending_context_list.back();
+    pending_context_list.pop_back();
+
+    for (const auto declaration : decl_context->noload_decls()) {
+      ++declaration_count;
+
+      auto nested_context = llvm::dyn_cast<clang::DeclContext>(declaration);
+      if (nested_context != nullptr) {
+        pending_context_list.push_back(nested_context);
+      }
+    }
+  }
+
+  return declaration_count;
+}
+
+/// Adds the given frontend statistics to the time report
+void recordFrontendStatistics(TimeReport &time_report,
+                              const FrontendStatistics &frontend_statistics) {
+  time_report.addStatistic("Frontend source (bytes)",
+                           frontend_statistics.source_bytes);
+
+  time_report.addStatistic("Frontend tokens", frontend_statistics.token_count);
+
+  time_report.addStatistic("Frontend declarations",
+                           frontend_statistics.declaration_count);
+
+  time_report.addStatistic("Frontend template instantiations",
+                           frontend_statistics.template_instantiation_count);
+}
+
+/// Adds the memory used by the AST and by the source manager to the given
+/// time report; must be called before the compiler instance is destroyed
+void recordFrontendMemoryStatistics(TimeReport &time_report,
+                                    clang::CompilerInstance &compiler) {
+  auto &ast_context = compiler.getASTContext();
+  time_report.addStatistic("ASTContext allocator (bytes)",
+                           ast_context.getASTAllocatedMemory());
+
+  time_report.addStatistic("ASTContext side tables (bytes)",
+                           ast_context.getSideTableAllocatedMemory());
+
+  auto &source_manager = compiler.getSourceManager();
+  auto memory_buffer_sizes = source_manager.getMemoryBufferSizes();
+
+  time_report.addStatistic("SourceManager buffers, malloc (bytes)",
+                           memory_buffer_sizes.malloc_bytes);
+
+  time_report.addStatistic("SourceManager buffers, mmap (bytes)",
+                           memory_buffer_sizes.mmap_bytes);
+
+  time_report.addStatistic("SourceManager data structures (bytes)",
+                           source_manager.getDataStructureSizes());
+
+  time_report.addStatistic("Preprocessor (bytes)",
+                           compiler.getPreprocessor().getTotalMemory());
+}
+
+/// Returns the memory used by the AST, the source manager and the
+/// preprocessor; must be called before the compiler instance is destroyed
+std::size_t getFrontendMemoryUsage(clang::CompilerInstance &compiler) {
+  std::size_t memory_usage = 0U;
+
+  if (compiler.hasASTContext()) {
+    auto &ast_context = compiler.getASTContext();
+    memory_usage += ast_context.getASTAllocatedMemory();
+    memory_usage += ast_context.getSideTableAllocatedMemory();
+  }
+
+  auto &source_manager = compiler.getSourceManager();
+  auto memory_buffer_sizes = source_manager.getMemoryBufferSizes();
+
+  memory_usage += memory_buffer_sizes.malloc_bytes;
+  memory_usage += memory_buffer_sizes.mmap_bytes;
+  memory_usage += source_manager.getDataStructureSizes();
+  memory_usage += compiler.getPreprocessor().getTotalMemory();
+
+  return memory_usage;
+}
+
+/// How many compilations can wait for the background teardown thread; past
+/// this, the callers destroy their own state, so that the memory used by the
+/// pending ones stays bounded
+const std::size_t kMaxPendingTeardownCount = 4U;
+
+/// The clang state of a finished compilation; the compiler is destroyed
+/// before the deadline it references
+struct FinishedCompilation final {
+  /// Referenced by the preprocessor and by Sema
+  std::unique_ptr<CompilationDeadline> deadline;
+
+  /// The clang compiler
+  std::unique_ptr<clang::CompilerInstance> compiler;
+};
+
+/// Destroys the clang state of the finished compilations on a thread of its
+/// own. The queue is never destroyed: the compilations still pending when
+/// the process exits are simply not released
+class BackgroundTeardownQueue final {
+  /// Protects the pending list
+  std::mutex mutex;
+
+  /// Signaled when a compilation is added
+  std::condition_variable cv;
+
+  /// The compilations waiting to be destroyed
+  std::deque<FinishedCompilation> pending_list;
+
+  /// Constructor; starts the teardown thread
+  BackgroundTeardownQueue() {
+    std::thread([this]() {
+      std::unique_lock<std::mutex> lock(mutex);
+
+      while (true) {
+        cv.wait(lock, [this]() -> bool { return !pending_list.empty(); });
+
+        auto compilation = std::move(pending_list.front());
+        pending_list.pop_front();
+
+        lock.unlock();
+        compilation = FinishedCompilation();
+        lock.lock();
+      }
+    })
+        .detach();
+  }
+
+ public:
+  /// Returns the queue, creating it the first time
+  static BackgroundTeardownQueue &get() {
+    static auto queue = new BackgroundTeardownQueue;
+    return *queue;
+  }
+
+  /// Queues the given compilation; returns false, leaving it untouched, if
+  /// too many are already waiting
+  bool push(FinishedCompilation &compilation) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (pending_list.size() >= kMaxPendingTeardownCount) {
+        return false;
+      }
+
+      pending_list.push_back(std::move(compilation));
+    }
+
+    cv.notify_one();
+    return true;
+  }
+};
+
+/// Releases the clang state of a compilation when the scope ends, as chosen
+/// by the settings; the state that has been moved elsewhere in the meantime
+/// (i.e.: into a parsed translation unit) is left alone. Must be declared
+/// after the compiler and its deadline
+class ScopedClangTeardown final {
+  /// The compiler of the compilation
+  std::unique_ptr<clang::CompilerInstance> &compiler;
+
+  /// The deadline of the compilation
+  std::unique_ptr<CompilationDeadline> &deadline;
+
+  /// How the state is released
+  ClangTeardown teardown;
+
+  /// If set and raised when the scope ends, the state is leaked, since the
+  /// process is about to exit
+  const bool *process_exiting{nullptr};
+
+ public:
+  /// Constructor; the state shared across calls, and the one reading the
+  /// in-memory files, is never destroyed by the background thread, since it
+  /// could outlive the objects it references
+  ScopedClangTeardown(std::unique_ptr<clang::CompilerInstance> &compiler,
+                      std::unique_ptr<CompilationDeadline> &deadline,
+                      const CompilerInstanceSettings &settings,
+                      const bool *process_exiting = nullptr)
+      : compiler(compiler),
+        deadline(deadline),
+        teardown(settings.clang_teardown),
+        process_exiting(process_exiting) {
+    if (teardown == ClangTeardown::Background &&
+        (settings.reuse_clang_state || settings.in_memory_file_map)) {
+      teardown = ClangTeardown::Destroy;
+    }
+  }
+
+  /// Destructor
+  ~ScopedClangTeardown() {
+    if (process_exiting != nullptr && *process_exiting) {
+      teardown = ClangTeardown::Leak;
+    }
+
+    if (!compiler || teardown == ClangTeardown::Destroy) {
+      return;
+    }
+
+    // The diagnostic consumers of the compilation have already been
+    // destroyed
+    compiler->getDiagnostics().setClient(new clang::IgnoringDiagConsumer,
+                                         true);
+
+    if (teardown == ClangTeardown::Leak) {
+      compiler.release();
+      deadline.release();
+      return;
+    }
+
+    FinishedCompilation compilation;
+    compilation.deadline = std::move(deadline);
+    compilation.compiler = std::move(compiler);
+
+    if (!BackgroundTeardownQueue::get().push(compilation)) {
+      compilation = FinishedCompilation();
+    }
+  }
+
+  /// Disable the copy constructor
+  ScopedClangTeardown(const ScopedClangTeardown &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedClangTeardown &operator=(const ScopedClangTeardown &other) = delete;
+};
+}  // namespace
 
 /// Private class data
 struct CompilerInstance::PrivateData final {
   /// The compiler settings, such as language and include directories
   CompilerInstanceSettings compiler_settings;
+
+  /// The clang objects reused across processAST calls, when enabled
+  ClangSharedState shared_state;
+
+  /// The memory used by the frontend in the last compilation
+  std::size_t frontend_memory_usage{0U};
+
+  /// The frontend statistics of the last compilation
+  FrontendStatistics frontend_statistics;
+
+  /// The empty header included after the prefix by forkProcessAST; it is
+  /// created when first needed, and removed by the destructor
+  stdfs::path fork_point_path;
+
+  /// Called when the fork point header is about to be entered; only set
+  /// while forkProcessAST is running
+  std::function<void(clang::SourceManager &, const clang::FileEntry *,
+                     CompilationDeadline *)>
+      fork_point_handler;
+
+  /// True in the child processes created by forkProcessAST
+  bool fork_child{false};
+
+  /// Aborts the running compilation when raised, if set
+  const std::atomic_bool *cancellation_flag{nullptr};
 };
 
+/// Private class data
+struct ParsedTranslationUnit::PrivateData final {
+  /// The source buffer; the source manager owns its own copy
+  std::string source_buffer;
+
+  /// The settings of the compiler instance that parsed the buffer
+  CompilerInstanceSettings compiler_settings;
+
+  /// Referenced by the preprocessor and by Sema: it must outlive the compiler
+  std::unique_ptr<CompilationDeadline> deadline;
+
+  /// The clang compiler owning the AST
+  std::unique_ptr<clang::CompilerInstance> compiler;
+};
+
+ParsedTranslationUnit::ParsedTranslationUnit() : d(new PrivateData) {}
+
+ParsedTranslationUnit::~ParsedTranslationUnit() {
+  ScopedClangTeardown teardown(d->compiler, d->deadline, d->compiler_settings);
+}
+
+const std::string &ParsedTranslationUnit::sourceBuffer() const {
+  return d->source_buffer;
+}
+
+const CompilerInstanceSettings &ParsedTranslationUnit::settings() const {
+  return d->compiler_settings;
+}
+
+CompilerInstance::Status ParsedTranslationUnit::visit(
+    IASTVisitorRef ast_visitor, const CompilerInstanceSettings &settings,
+    StringList *dependency_list) {
+  auto &compiler = *d->compiler;
+
+  std::string clang_output_buffer;
+  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
+
+  // The errors reported while emitting the bitcode are rendered, as they
+  // are by processAST
+  clang::DiagnosticsEngine &diagnostics_engine = compiler.getDiagnostics();
+  clang::TextDiagnosticPrinter diagnostic_consumer(
+      clang_output_stream, &diagnostics_engine.getDiagnosticOptions());
+
+  diagnostics_engine.setClient(&diagnostic_consumer, false);
+  diagnostic_consumer.BeginSourceFile(compiler.getLangOpts(),
+                                      &compiler.getPreprocessor());
+
+  visitParsedTranslationUnit(compiler, ast_visitor, settings);
+
+  if (settings.time_report) {
+    recordFrontendMemoryStatistics(*settings.time_report, compiler);
+  }
+
+  diagnostic_consumer.EndSourceFile();
+  clang_output_stream.flush();
+
+  diagnostics_engine.setClient(new clang::IgnoringDiagConsumer, true);
+
+  if (dependency_list != nullptr) {
+    *dependency_list = getSourceManagerFileList(compiler.getSourceManager());
+  }
+
+  if (diagnostic_consumer.getNumErrors() != 0) {
+    return CompilerInstance::Status(
+        false, CompilerInstance::StatusCode::CompilationError,
+        clang_output_buffer);
+  }
+
+  return CompilerInstance::Status(true);
+}
+
 CompilerInstance::CompilerInstance(const CompilerInstanceSettings &settings)
     : d(new PrivateData) {
   d->compiler_settings = settings;
@@ -59,13 +904,534 @@ CompilerInstance::Status CompilerInstance::create(
   }
 }
 
-CompilerInstance::~CompilerInstance() {}
+CompilerInstance::~CompilerInstance() {
+  if (!d->fork_point_path.empty()) {
+    std::error_code error;
+    stdfs::remove(d->fork_point_path, error);
+  }
+}
+
+CompilerInstance::Status CompilerInstance::runFrontend(
+    const std::string &buffer, IASTVisitorRef ast_visitor,
+    StringList *dependency_list, StringList *guarded_file_list,
+    CompilationErrorCause *error_cause, bool preprocess_only,
+    std::size_t *token_count, ParsedTranslationUnitRef *parsed_unit) {
+  auto start_time = std::chrono::steady_clock::now();
+  d->frontend_memory_usage = 0U;
+  d->frontend_statistics = FrontendStatistics();
+
+  if (parsed_unit != nullptr) {
+    parsed_unit->reset();
+  }
+
+  const auto &run_cancellation_flag = d->compiler_settings.cancellation_flag;
+  if (run_cancellation_flag && run_cancellation_flag->load()) {
+    if (error_cause != nullptr) {
+      error_cause->kind = CompilationErrorKind::Unknown;
+      error_cause->name.clear();
+    }
+
+    return Status(false, StatusCode::CompilationCancelled);
+  }
+
+  // Referenced by the preprocessor and by Sema: it must outlive the compiler
+  std::unique_ptr<CompilationDeadline> deadline;
+
+  std::unique_ptr<clang::CompilerInstance> compiler;
+  ScopedClangTeardown teardown(compiler, deadline, d->compiler_settings,
+                               &d->fork_child);
+
+  auto status = createClangCompilerInstance(
+      compiler, d->compiler_settings, ast_visitor, clang::TU_Complete,
+      d->compiler_settings.reuse_clang_state ? &d->shared_state : nullptr);
+
+  if (!status.succeeded()) {
+    return status;
+  }
+
+  auto &source_manager = compiler->getSourceManager();
+
+  // A translation unit that is handed over outlives the caller's buffer
+  auto main_buffer =
+      (parsed_unit != nullptr)
+          ? llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(buffer),
+                                                 llvm::StringRef("main.cpp"))
+          : llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(buffer),
+                                             llvm::StringRef("main.cpp"));
+
+  clang::FileID file_id = source_manager.createFileID(std::move(main_buffer));
+
+  source_manager.setMainFileID(file_id);
+
+  std::string clang_output_buffer;
+  llvm::raw_string_ostream clang_output_stream(clang_output_buffer);
+
+  clang::DiagnosticsEngine &diagnostics_engine = compiler->getDiagnostics();
+
+  // When stopping at the first error, the diagnostics are never shown to
+  // the user: only count them instead of rendering the text
+  std::unique_ptr<clang::DiagnosticConsumer> diagnostic_consumer;
+  if (d->compiler_settings.stop_at_first_error) {
+    diagnostic_consumer = llvm::make_unique<CountingDiagnosticConsumer>();
+    diagnostics_engine.setErrorLimit(1U);
+
+  } else {
+    diagnostic_consumer = llvm::make_unique<clang::TextDiagnosticPrinter>(
+        clang_output_stream, &diagnostics_engine.getDiagnosticOptions());
+  }
+
+  // The counters are still read from the wrapped consumer
+  std::unique_ptr<ErrorCauseDiagnosticConsumer> error_cause_consumer;
+  if (error_cause != nullptr) {
+    error_cause_consumer = llvm::make_unique<ErrorCauseDiagnosticConsumer>(
+        *diagnostic_consumer, *error_cause);
+
+    diagnostics_engine.setClient(error_cause_consumer.get(), false);
+
+  } else {
+    diagnostics_engine.setClient(diagnostic_consumer.get(), false);
+  }
+
+  auto &active_consumer = *diagnostics_engine.getClient();
+
+  clang::Preprocessor &preprocessor = compiler->getPreprocessor();
+
+  if (d->compiler_settings.time_budget != 0U ||
+      d->cancellation_flag != nullptr || run_cancellation_flag) {
+    deadline = llvm::make_unique<CompilationDeadline>(
+        diagnostics_engine, start_time, d->compiler_settings.time_budget,
+        d->cancellation_flag, run_cancellation_flag.get());
+
+    preprocessor.addPPCallbacks(
+        llvm::make_unique<DeadlinePPCallbacks>(*deadline));
+  }
+
+  if (d->fork_point_handler) {
+    auto deadline_ptr = deadline.get();
+
+    preprocessor.addPPCallbacks(llvm::make_unique<ForkPointPPCallbacks>(
+        d->fork_point_path.string(),
+        [this, &source_manager,
+         deadline_ptr](const clang::FileEntry *file_entry) {
+          d->fork_point_handler(source_manager, file_entry, deadline_ptr);
+        }));
+  }
+
+  // Like the memory statistics, the header costs are only collected by the
+  // compilations that have a time report (i.e.: the final pass)
+  HeaderCostPPCallbacks *header_cost_callbacks = nullptr;
+  if (d->compiler_settings.time_report && !preprocess_only) {
+    auto callbacks = llvm::make_unique<HeaderCostPPCallbacks>(
+        source_manager, compiler->getASTContext());
+
+    header_cost_callbacks = callbacks.get();
+    preprocessor.addPPCallbacks(std::move(callbacks));
+  }
+
+  active_consumer.BeginSourceFile(compiler->getLangOpts(), &preprocessor);
+
+  if (preprocess_only) {
+    // Missing includes, #error directives and unbalanced conditionals are
+    // all reported while lexing; skip the parser and semantic analysis
+    preprocessor.EnterMainSourceFile();
+
+    std::size_t lexed_token_count = 0U;
+
+    clang::Token token;
+    do {
+      preprocessor.Lex(token);
+      ++lexed_token_count;
+
+      if ((d->compiler_settings.stop_at_first_error &&
+           diagnostics_engine.hasErrorOccurred()) ||
+          (deadline && deadline->hasExpired())) {
+        break;
+      }
+    } while (token.isNot(clang::tok::eof));
+
+    preprocessor.EndSourceFile();
+
+    // The end of file token is not part of the source
+    if (token.is(clang::tok::eof)) {
+      --lexed_token_count;
+    }
+
+    d->frontend_statistics.token_count = lexed_token_count;
+
+    if (token_count != nullptr) {
+      *token_count = lexed_token_count;
+    }
+
+  } else {
+    bool skip_function_bodies = compiler->getFrontendOpts().SkipFunctionBodies;
+
+    // Sema is created here rather than by ParseAST, so that the deadline
+    // can be checked on each template instantiation
+    compiler->createSema(clang::TU_Complete, nullptr);
+
+    auto &sema = compiler->getSema();
+    if (deadline) {
+      sema.TemplateInstCallbacks.push_back(
+          llvm::make_unique<DeadlineTemplateInstantiationCallback>(*deadline));
+    }
+
+    auto &frontend_statistics = d->frontend_statistics;
+    sema.TemplateInstCallbacks.push_back(
+        llvm::make_unique<CountingTemplateInstantiationCallback>(
+            frontend_statistics.template_instantiation_count));
+
+    // The token watcher is not available on older releases; the token count
+    // is left at zero there
+#if LLVM_MAJOR_VERSION >= 9
+    preprocessor.setTokenWatcher(
+        [&frontend_statistics](const clang::Token &token) {
+          if (token.isNot(clang::tok::eof)) {
+            ++frontend_statistics.token_count;
+          }
+        });
+#endif
+
+    // Only the existing mappings can be advised; the ones that malloc
+    // creates while parsing are collapsed by the consumer afterwards
+    if (d->compiler_settings.huge_page_advice) {
+      adviseHeapHugePages(false);
+    }
+
+    clang::ParseAST(sema, false, skip_function_bodies);
+
+#if LLVM_MAJOR_VERSION >= 9
+    preprocessor.setTokenWatcher(nullptr);
+#endif
+
+    frontend_statistics.declaration_count =
+        getDeclarationCount(compiler->getASTContext());
+
+    if (d->compiler_settings.time_report) {
+      recordFrontendMemoryStatistics(*d->compiler_settings.time_report,
+                                     *compiler);
+    }
+
+    if (header_cost_callbacks != nullptr) {
+      header_cost_callbacks->report(*d->compiler_settings.time_report);
+    }
+  }
+
+  // The main source buffer is not part of the file information
+  d->frontend_statistics.source_bytes =
+      buffer.size() + getSourceManagerByteCount(source_manager);
+
+  if (d->compiler_settings.time_report) {
+    recordFrontendStatistics(*d->compiler_settings.time_report,
+                             d->frontend_statistics);
+  }
+
+  d->frontend_memory_usage = getFrontendMemoryUsage(*compiler);
+
+  active_consumer.EndSourceFile();
+  clang_output_stream.flush();
+
+  if (dependency_list != nullptr) {
+    *dependency_list = getSourceManagerFileList(source_manager);
+  }
+
+  // The include guards are detected by the lexer, when each file ends
+  if (guarded_file_list != nullptr) {
+    *guarded_file_list = getSourceManagerGuardedFileList(
+        source_manager, preprocessor.getHeaderSearchInfo());
+  }
+
+  if (deadline && deadline->wasCancelled()) {
+    if (error_cause != nullptr) {
+      error_cause->kind = CompilationErrorKind::Unknown;
+      error_cause->name.clear();
+    }
+
+    return Status(false, StatusCode::CompilationCancelled,
+                  clang_output_buffer);
+  }
+
+  if (deadline && deadline->hasExpired()) {
+    if (error_cause != nullptr) {
+      error_cause->kind = CompilationErrorKind::Timeout;
+      error_cause->name.clear();
+    }
+
+    return Status(false, StatusCode::CompilationTimeout, clang_output_buffer);
+  }
+
+  if (diagnostic_consumer->getNumErrors() != 0) {
+    return Status(false, StatusCode::CompilationError, clang_output_buffer);
+  }
+
+  // The diagnostic consumers are about to be destroyed; the translation
+  // unit reports to a silent one until it is visited
+  if (parsed_unit != nullptr && !preprocess_only) {
+    diagnostics_engine.setClient(new clang::IgnoringDiagConsumer, true);
+
+    ParsedTranslationUnitRef unit(new ParsedTranslationUnit);
+    unit->d->source_buffer = buffer;
+    unit->d->compiler_settings = d->compiler_settings;
+    unit->d->deadline = std::move(deadline);
+    if (unit->d->deadline) {
+      unit->d->deadline->detachCancellationFlag();
+    }
+    unit->d->compiler = std::move(compiler);
+
+    *parsed_unit = std::move(unit);
+  }
+
+  if (diagnostic_consumer->getNumWarnings() != 0) {
+    return Status(true, StatusCode::CompilationWarning, clang_output_buffer);
+  }
+
+  return Status(true);
+}
 
 CompilerInstance::Status CompilerInstance::processAST(
-    const std::string &buffer, IASTVisitorRef ast_visitor) {
+    const std::string &buffer, IASTVisitorRef ast_visitor,
+    StringList *dependency_list, StringList *guarded_file_list,
+    CompilationErrorCause *error_cause, ParsedTranslationUnitRef *parsed_unit) {
+  return runFrontend(buffer, ast_visitor, dependency_list, guarded_file_list,
+                     error_cause, false, nullptr, parsed_unit);
+}
+
+CompilerInstance::Status CompilerInstance::preprocess(
+    const std::string &buffer, StringList *dependency_list,
+    StringList *guarded_file_list, CompilationErrorCause *error_cause,
+    std::size_t *token_count) {
+  return runFrontend(buffer, IASTVisitorRef(), dependency_list,
+                     guarded_file_list, error_cause, true, token_count,
+                     nullptr);
+}
+
+CompilerInstance::Status CompilerInstance::forkProcessAST(
+    const std::string &prefix_buffer, const StringList &include_directive_list,
+    std::size_t process_count, std::vector<bool> &accepted_list) {
+  accepted_list.assign(include_directive_list.size(), false);
+
+  if (d->fork_point_path.empty()) {
+    std::random_device random_device;
+
+    std::error_code error;
+    auto fork_point_path =
+        stdfs::temp_directory_path(error) /
+        ("abigen-fork-point-" + std::to_string(random_device()) + ".h");
+
+    std::ofstream fork_point_file(fork_point_path.string(),
+                                  std::ios::out | std::ios::trunc);
+
+    if (error || !fork_point_file) {
+      return Status(false, StatusCode::ProcessCreationError,
+                    "Failed to create the fork point header: " +
+                        fork_point_path.string());
+    }
+
+    d->fork_point_path = fork_point_path;
+  }
+
+  /// A child process, with the include directive it parses
+  struct ForkedChild final {
+    /// The process identifier
+    pid_t process_id;
+
+    /// The index of the include directive
+    std::size_t directive_index;
+
+    /// When the child has been forked
+    std::chrono::steady_clock::time_point start_time;
+  };
+
+  // Children are reaped in the order they have been created; the ones that
+  // exit with a failure, or that are killed, reject their directive
+  std::deque<ForkedChild> running_child_list;
+  bool fork_point_reached = false;
+  bool fork_refused = false;
+
+  // The children stop themselves once the time budget has been spent; the
+  // ones still running a second later are stuck, and are killed
+  const auto time_budget = d->compiler_settings.time_budget;
+  const auto wait_limit = std::chrono::seconds(time_budget + 1U);
+
+  auto L_waitOldestChild = [&]() {
+    auto child = running_child_list.front();
+    running_child_list.pop_front();
+
+    int exit_status = 0;
+    pid_t wait_result;
+
+    if (time_budget != 0U) {
+      for (;;) {
+        wait_result = waitpid(child.process_id, &exit_status, WNOHANG);
+        if (wait_result != 0 && !(wait_result == -1 && errno == EINTR)) {
+          break;
+        }
+
+        if (std::chrono::steady_clock::now() - child.start_time >=
+            wait_limit) {
+          kill(child.process_id, SIGKILL);
+          break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+      if (wait_result > 0) {
+        accepted_list[child.directive_index] = WIFEXITED(exit_status) &&
+                                               WEXITSTATUS(exit_status) == 0;
+        return;
+      }
+    }
+
+    do {
+      wait_result = waitpid(child.process_id, &exit_status, 0);
+    } while (wait_result == -1 && errno == EINTR);
+
+    accepted_list[child.directive_index] = wait_result == child.process_id &&
+                                           WIFEXITED(exit_status) &&
+                                           WEXITSTATUS(exit_status) == 0;
+  };
+
+  // The fork point header is empty in this process; each child replaces it
+  // with its own include directive before the preprocessor reads it
+  d->fork_point_handler = [&](clang::SourceManager &source_manager,
+                              const clang::FileEntry *file_entry,
+                              CompilationDeadline *deadline) {
+    fork_point_reached = true;
+
+    // The caller checks too, but threads may have been started since then
+    if (!canForkProcess()) {
+      fork_refused = true;
+      return;
+    }
+
+    for (std::size_t i = 0U; i < include_directive_list.size(); ++i) {
+      while (running_child_list.size() >=
+             std::max<std::size_t>(process_count, 1U)) {
+        L_waitOldestChild();
+      }
+
+      auto child_pid = fork();
+      if (child_pid == 0) {
+        d->fork_child = true;
+
+        // A parser crash in the child is expected, and handled by the
+        // parent; it must not replace the flight recorder dump
+        FlightRecorder::deactivateInChildProcess();
+
+        std::string fork_point_contents;
+        appendIncludeDirective(fork_point_contents, include_directive_list[i]);
+
+        source_manager.overrideFileContents(
+            file_entry, llvm::MemoryBuffer::getMemBufferCopy(
+                            fork_point_contents, d->fork_point_path.string()));
+
+        if (deadline != nullptr) {
+          deadline->restart(std::chrono::steady_clock::now());
+        }
+
+        return;
+      }
+
+      if (child_pid > 0) {
+        running_child_list.push_back(
+            {child_pid, i, std::chrono::steady_clock::now()});
+      }
+    }
+
+    while (!running_child_list.empty()) {
+      L_waitOldestChild();
+    }
+
+    // The time spent waiting is not charged to the prefix
+    if (deadline != nullptr) {
+      deadline->restart(std::chrono::steady_clock::now());
+    }
+  };
+
+  auto buffer = prefix_buffer;
+  buffer.append("#include \"");
+  buffer.append(d->fork_point_path.string());
+  buffer.append("\"\n");
+
+  auto status = runFrontend(buffer, IASTVisitorRef(), nullptr, nullptr,
+                            nullptr, false, nullptr, nullptr);
+
+  // The children never return to the caller: the destructors would release
+  // the state they share with the parent
+  if (d->fork_child) {
+    _exit(status.succeeded() ? 0 : 1);
+  }
+
+  d->fork_point_handler = nullptr;
+
+  if (fork_refused) {
+    return Status(false, StatusCode::ProcessCreationError,
+                  "The process has more than one thread, and can't be "
+                  "forked safely");
+  }
+
+  if (!fork_point_reached && status.succeeded()) {
+    return Status(false, StatusCode::ProcessCreationError,
+                  "The fork point header has not been reached");
+  }
+
+  return status;
+}
+
+bool CompilerInstance::canForkProcess() {
+#if defined(__linux__)
+  std::error_code error;
+  std::size_t thread_count = 0U;
+
+  for (const auto &entry :
+       stdfs::directory_iterator("/proc/self/task", error)) {
+    static_cast<void>(entry);
+    ++thread_count;
+  }
+
+  return !error && thread_count == 1U;
+
+#else
+  return false;
+#endif
+}
+
+CompilerInstance::Status CompilerInstance::generatePrecompiledHeader(
+    const std::string &buffer, const std::string &output_path,
+    StringList *dependency_list) {
+  const auto &run_cancellation_flag = d->compiler_settings.cancellation_flag;
+  if (run_cancellation_flag && run_cancellation_flag->load()) {
+    return Status(false, StatusCode::CompilationCancelled);
+  }
+
+  // clang records the path of the original source file inside the precompiled
+  // header, so the buffer is saved to disk next to it
+  auto prefix_path = output_path + ".h";
+
+  {
+    std::ofstream prefix_file(prefix_path,
+                              std::ios::out | std::ios::trunc);
+    prefix_file << buffer;
+
+    if (!prefix_file) {
+      return Status(false, StatusCode::PrecompiledHeaderError,
+                    "Failed to write the prefix file: " + prefix_path);
+    }
+  }
+
+  // Precompiled headers are never chained
+  auto compiler_settings = d->compiler_settings;
+  compiler_settings.precompiled_header.clear();
+
+  // Referenced by the preprocessor: it must outlive the compiler
+  std::unique_ptr<CompilationDeadline> deadline;
+
   std::unique_ptr<clang::CompilerInstance> compiler;
-  auto status =
-      createClangCompilerInstance(compiler, d->compiler_settings, ast_visitor);
+  ScopedClangTeardown teardown(compiler, deadline, compiler_settings);
+
+  auto status = createClangCompilerInstance(
+      compiler, compiler_settings, IASTVisitorRef(), clang::TU_Prefix,
+      compiler_settings.reuse_clang_state ? &d->shared_state : nullptr);
 
   if (!status.succeeded()) {
     return status;
@@ -73,9 +1439,14 @@ CompilerInstance::Status CompilerInstance::processAST(
 
   auto &source_manager = compiler->getSourceManager();
 
-  clang::FileID file_id =
-      source_manager.createFileID(llvm::MemoryBuffer::getMemBuffer(
-          llvm::StringRef(buffer), llvm::StringRef("main.cpp")));
+  auto prefix_file_entry = compiler->getFileManager().getFile(prefix_path);
+  if (prefix_file_entry == nullptr) {
+    return Status(false, StatusCode::PrecompiledHeaderError,
+                  "Failed to open the prefix file: " + prefix_path);
+  }
+
+  clang::FileID file_id = source_manager.createFileID(
+      prefix_file_entry, clang::SourceLocation(), clang::SrcMgr::C_User);
 
   source_manager.setMainFileID(file_id);
 
@@ -91,20 +1462,71 @@ CompilerInstance::Status CompilerInstance::processAST(
 
   clang::Preprocessor &preprocessor = compiler->getPreprocessor();
 
+  // The time budget only applies to the probes; only the cancellation flag
+  // is checked here
+  if (run_cancellation_flag) {
+    deadline = llvm::make_unique<CompilationDeadline>(
+        diagnostics_engine, std::chrono::steady_clock::now(), 0U, nullptr,
+        run_cancellation_flag.get());
+
+    preprocessor.addPPCallbacks(
+        llvm::make_unique<DeadlinePPCallbacks>(*deadline));
+  }
+
+  // Replace the default consumer with the PCH writer
+  auto pch_buffer = std::make_shared<clang::PCHBuffer>();
+  compiler->setASTConsumer(llvm::make_unique<clang::PCHGenerator>(
+      preprocessor, output_path, "", pch_buffer,
+      compiler->getFrontendOpts().ModuleFileExtensions));
+
   diagnostic_consumer.BeginSourceFile(compiler->getLangOpts(), &preprocessor);
 
   clang::ParseAST(preprocessor, &compiler->getASTConsumer(),
-                  compiler->getASTContext());
+                  compiler->getASTContext(), false, clang::TU_Prefix);
 
   diagnostic_consumer.EndSourceFile();
 
-  if (diagnostic_consumer.getNumErrors() != 0) {
+  if (dependency_list != nullptr) {
+    *dependency_list = getSourceManagerFileList(source_manager);
+  }
+
+  clang_output_stream.flush();
+  if (deadline && deadline->wasCancelled()) {
+    return Status(false, StatusCode::CompilationCancelled,
+                  clang_output_buffer);
+  }
+
+  if (diagnostic_consumer.getNumErrors() != 0 || !pch_buffer->IsComplete) {
     return Status(false, StatusCode::CompilationError, clang_output_buffer);
   }
 
-  if (diagnostic_consumer.getNumWarnings() != 0) {
-    return Status(true, StatusCode::CompilationWarning, clang_output_buffer);
+  std::ofstream output_file(output_path, std::ios::out | std::ios::trunc |
+                                             std::ios::binary);
+
+  output_file.write(pch_buffer->Data.data(),
+                    static_cast<std::streamsize>(pch_buffer->Data.size()));
+
+  if (!output_file) {
+    return Status(false, StatusCode::PrecompiledHeaderError,
+                  "Failed to write the precompiled header: " + output_path);
   }
 
   return Status(true);
 }
+
+void CompilerInstance::setPrecompiledHeader(const std::string &path) {
+  d->compiler_settings.precompiled_header = path;
+}
+
+void CompilerInstance::setCancellationFlag(
+    const std::atomic_bool *cancellation_flag) {
+  d->cancellation_flag = cancellation_flag;
+}
+
+std::size_t CompilerInstance::frontendMemoryUsage() const {
+  return d->frontend_memory_usage;
+}
+
+const FrontendStatistics &CompilerInstance::frontendStatistics() const {
+  return d->frontend_statistics;
+}
@@ -14,15 +14,41 @@
  * limitations under the License.
  */
 
+#include "file_system_cache.h"
+#include "header_map.h"
+#include "profile_pack.h"
 #include "profilemanager.h"
+#include "time_report.h"
 
 #include <clang/AST/ASTContext.h>
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Basic/FileManager.h>
+#include <clang/Basic/TargetInfo.h>
 #include <clang/Frontend/CompilerInstance.h>
 
+#include <atomic>
+
 #pragma once
 
-/// Settings for the clang compiler instance
+/// How the clang state of a compilation (the compiler instance, along with
+/// its AST, preprocessor and source manager) is released once it is over
+enum class ClangTeardown {
+  /// The state is destroyed before the call returns
+  Destroy,
+
+  /// The state is destroyed by a background thread while the caller goes on;
+  /// it is destroyed by the caller instead when the thread is falling
+  /// behind, or when the clang state is reused across calls
+  Background,
+
+  /// The state is never released, as clang does with -disable-free; only
+  /// meant for the compilations that run once before the process exits
+  Leak
+};
+
+/// Settings for the clang compiler instance. Settings are copied freely
+/// across threads: the objects they share through a reference (caches,
+/// header maps, profile packs and time reports) are all thread safe
 struct CompilerInstanceSettings final {
   /// The profile to use
   Profile profile;
@@ -42,6 +68,141 @@ struct CompilerInstanceSettings final {
   /// Whether to use standard C++ name mangling rules or the Visual C++
   /// compatibility mode
   bool use_visual_cxx_mangling{false};
+
+  /// If true, the visitor also receives a mangler for the other convention,
+  /// so that one analysis pass produces the names of both
+  bool dual_mangling{false};
+
+  /// The target triple; the default target of the host is used when empty
+  std::string target_triple;
+
+  /// An optional precompiled header that is loaded before parsing the source
+  /// buffer
+  std::string precompiled_header;
+
+  /// If not empty, clang modules are enabled, and the modules built from
+  /// the module maps are saved in this folder and reused across instances
+  std::string module_cache_path;
+
+  /// The module maps loaded when modules are enabled; the headers they
+  /// list are imported from the prebuilt modules instead of being parsed
+  StringList module_map_file_list;
+
+  /// If true, the file manager (along with its stat cache) and the target
+  /// information are kept alive across processAST calls; only the per
+  /// translation unit state is recreated
+  bool reuse_clang_state{false};
+
+  /// If true, the bodies of the functions are skipped by the parser, except
+  /// when they are needed to complete a declaration (such as constexpr and
+  /// auto functions); errors inside the skipped bodies are not reported
+  bool skip_function_bodies{false};
+
+  /// If true, parsing is aborted as soon as the first error is emitted and
+  /// diagnostics are counted rather than rendered; the status message will
+  /// be empty on failure. Meant for probes, where only the outcome matters
+  bool stop_at_first_error{false};
+
+  /// If true, warnings are ignored by the diagnostics engine, so they are
+  /// neither rendered nor counted. Meant for probes, where warnings do not
+  /// change the outcome
+  bool ignore_warnings{false};
+
+  /// If true, fatal errors (such as missing include files) are reported as
+  /// regular errors, and the compilation goes on past them. Meant for the
+  /// compilations that attribute their errors to the include directives
+  bool recover_from_fatal_errors{false};
+
+  /// If not zero, processAST and preprocess abort the compilation once it
+  /// has been running for this many seconds. Clang is stopped cooperatively:
+  /// the deadline is checked on each macro expansion, file change and
+  /// template instantiation
+  std::size_t time_budget{0U};
+
+  /// If not empty, the AST visitor only receives the top-level declarations
+  /// found inside these folders
+  StringList traversal_folders;
+
+  /// When greater than one, the declarations of the translation unit are
+  /// split in this many shards, and the AST visitor only receives the ones
+  /// belonging to shard_index. Declarations are assigned in a round robin
+  /// fashion, after namespaces and linkage specifications have been
+  /// flattened, so the shards are the same for every instance parsing the
+  /// same source buffer
+  std::size_t shard_count{1U};
+
+  /// The shard that is traversed; see shard_count
+  std::size_t shard_index{0U};
+
+  /// If true, each top-level declaration is passed to the AST visitor as
+  /// soon as it has been parsed, together with the record definitions as
+  /// they are completed; finalize() is still called at the end of the
+  /// translation unit. The visitor sees the same declarations in the same
+  /// order. Ignored when the AST has an external source, whose
+  /// declarations are never passed to the consumer
+  bool traverse_while_parsing{false};
+
+  /// If set, the file system queries made by clang are answered through
+  /// this cache, which is shared by all the compiler instances using these
+  /// settings
+  FileSystemCacheRef file_system_cache;
+
+  /// If set, this header map is searched before the additional include
+  /// folders; it only maps the headers the folder search would find, so it
+  /// is not part of the settings hash
+  HeaderMapRef header_map;
+
+  /// Folders served from memory by these packs, at their mount points, on
+  /// top of the file system; used for the header archives, and by the remote
+  /// workers to read the headers shipped by the coordinator
+  std::vector<ProfilePackRef> header_pack_list;
+
+  /// If set, these files are served from memory on top of everything else;
+  /// used by the build command to compile the ABI library without saving
+  /// it. The compiler instances must not outlive the map
+  std::shared_ptr<const RenderedFileMap> in_memory_file_map;
+
+  /// If not empty, processAST writes a bitcode file referencing the
+  /// whitelisted functions found by the AST visitor, reusing the AST that
+  /// has just been built
+  std::string bitcode_output_path;
+
+  /// If not empty, processAST writes a self-contained C header declaring the
+  /// whitelisted functions found by the AST visitor to this file; nothing is
+  /// written when the functions can't be sliced out of the translation unit
+  std::string sliced_header_output_path;
+
+  /// If set, the memory used by the AST, the source manager and the
+  /// preprocessor is added to the memory statistics of this report after
+  /// each processAST call
+  TimeReportRef time_report;
+
+  /// If set, raising this flag aborts the processAST, preprocess and
+  /// generatePrecompiledHeader calls of every compiler instance using these
+  /// settings; it is checked like the time budget, and the calls started
+  /// afterwards return CompilationCancelled right away
+  std::shared_ptr<const std::atomic_bool> cancellation_flag;
+
+  /// How the clang state of each compilation is released; it does not
+  /// change the outcome, so it is not part of the settings hash
+  ClangTeardown clang_teardown{ClangTeardown::Destroy};
+
+  /// If true, the heap is advised as a transparent huge page area before
+  /// parsing, and the pages holding the AST are collapsed into huge pages
+  /// before the AST visitor walks it. Like the teardown, it is not part of
+  /// the settings hash
+  bool huge_page_advice{false};
+};
+
+/// The clang objects that do not depend on the translation unit, and that can
+/// be shared across clang::CompilerInstance objects created with the same
+/// settings
+struct ClangSharedState final {
+  /// The file manager, caching stat() results and directory lookups
+  llvm::IntrusiveRefCntPtr<clang::FileManager> file_manager;
+
+  /// The target information
+  llvm::IntrusiveRefCntPtr<clang::TargetInfo> target_information;
 };
 
 class IASTVisitor;
@@ -55,15 +216,22 @@ class IASTVisitor : public clang::RecursiveASTVisitor<IASTVisitor> {
   /// Destructor
   virtual ~IASTVisitor() = default;
 
-  /// This method is called when entering a new translation unit
+  /// This method is called when entering a new translation unit; the
+  /// alternate mangler is only passed when dual mangling is enabled
   virtual void initialize(clang::ASTContext *ast_context,
                           clang::SourceManager *source_manager,
-                          clang::MangleContext *name_mangler) = 0;
+                          clang::MangleContext *name_mangler,
+                          clang::MangleContext *alternate_name_mangler) = 0;
 
   /// This method is called each time a new function (or method) declaration is
   /// found
   virtual bool VisitFunctionDecl(clang::FunctionDecl *declaration) = 0;
 
+  /// This method is called each time a record definition is completed; only
+  /// when the declarations are traversed while parsing, and before the
+  /// functions referencing the record are visited
+  virtual void VisitRecordDefinition(clang::RecordDecl *declaration) = 0;
+
   /// Called after the last AST callback
   virtual void finalize() = 0;
 
@@ -72,6 +240,61 @@ class IASTVisitor : public clang::RecursiveASTVisitor<IASTVisitor> {
 
   /// Returns the whitelisted functions
   virtual WhitelistedFunctionList whitelistedFunctions() const = 0;
+
+  /// Returns the declarations of the whitelisted functions, in the same
+  /// order; they are only valid until the AST is destroyed
+  virtual std::vector<clang::FunctionDecl *> whitelistedFunctionDeclarations()
+      const = 0;
+
+  /// Returns the file paths referenced by the function locations
+  virtual StringList filePathList() const = 0;
+
+  /// Moves the function lists and the file path list into the given ABI
+  /// library, without copying them; the visitor will return empty lists
+  /// until the next translation unit is processed
+  virtual void takeResults(ABILibrary &abi_library) = 0;
+};
+
+/// The kind of the first error emitted by a compilation
+enum class CompilationErrorKind {
+  /// No error has been emitted
+  None,
+
+  /// The error does not belong to any of the other kinds
+  Unknown,
+
+  /// A file included by the main source buffer could not be found
+  MissingIncludeDirective,
+
+  /// A file included by one of the headers could not be found
+  MissingFile,
+
+  /// A declaration conflicts with a previous one
+  Redefinition,
+
+  /// An #error directive has been reached
+  ErrorDirective,
+
+  /// An identifier or a type name has been used without being declared
+  UndeclaredIdentifier,
+
+  /// The compilation has been aborted after exceeding its time budget
+  Timeout
+};
+
+/// The cause of the first error emitted by a compilation
+struct CompilationErrorCause final {
+  /// The error kind
+  CompilationErrorKind kind{CompilationErrorKind::None};
+
+  /// The missing file, the undeclared identifier or the #error message,
+  /// depending on the error kind
+  std::string name;
+
+  /// The lines (starting from 1) of the main source buffer holding the
+  /// #include directives through which every error has been reached, in
+  /// ascending order and without duplicates
+  std::vector<std::size_t> include_line_list;
 };
 
 class CompilerInstance;
@@ -79,6 +302,11 @@ class CompilerInstance;
 /// A reference to a clang compiler instance object
 using CompilerInstanceRef = std::unique_ptr<CompilerInstance>;
 
+class ParsedTranslationUnit;
+
+/// A reference to a ParsedTranslationUnit object
+using ParsedTranslationUnitRef = std::shared_ptr<ParsedTranslationUnit>;
+
 /// AST callback
 using ASTCallback = bool (*)(clang::Decl *declaration,
                              clang::ASTContext &ast_context,
@@ -86,7 +314,9 @@ using ASTCallback = bool (*)(clang::Decl *declaration,
                              void *user_defined,
                              clang::MangleContext *name_mangler);
 
-/// A wrapper around clang::CompilerInstance
+/// A wrapper around clang::CompilerInstance. Objects are not thread safe:
+/// each thread compiling concurrently must create its own, while different
+/// objects can be used at the same time
 class CompilerInstance final {
   struct PrivateData;
 
@@ -101,6 +331,13 @@ class CompilerInstance final {
     MemoryAllocationFailure,
     CompilationError,
     CompilationWarning,
+    CompilationTimeout,
+    CompilationCancelled,
+    PrecompiledHeaderError,
+    ModuleMapError,
+    ProfilePackError,
+    ProcessCreationError,
+    InvalidTargetTriple,
     Unknown
   };
 
@@ -120,13 +357,133 @@ class CompilerInstance final {
   /// Destructor
   ~CompilerInstance();
 
-  /// Processes the AST of the given source code
+  /// Processes the AST of the given source code. If a dependency list is
+  /// passed, it will receive the path of each file that has been read; the
+  /// guarded file list receives the ones protected by an include guard or by
+  /// #pragma once. The error cause, if passed, receives the kind of the first
+  /// error. Compilations exceeding the time budget return CompilationTimeout.
+  /// If a parsed unit is passed, a successful compilation hands over its
+  /// translation unit instead of destroying it; the parsed unit is reset
+  /// when the compilation fails
   Status processAST(const std::string &buffer,
-                    IASTVisitorRef ast_visitor = IASTVisitorRef());
+                    IASTVisitorRef ast_visitor = IASTVisitorRef(),
+                    StringList *dependency_list = nullptr,
+                    StringList *guarded_file_list = nullptr,
+                    CompilationErrorCause *error_cause = nullptr,
+                    ParsedTranslationUnitRef *parsed_unit = nullptr);
+
+  /// Runs the preprocessor on the given source code, without building the
+  /// AST. This is much faster than processAST but will only catch the errors
+  /// reported by the preprocessor. The dependency and guarded file lists and
+  /// the error cause are filled as in processAST; the token count, if
+  /// passed, receives the amount of tokens produced by the preprocessor
+  Status preprocess(const std::string &buffer,
+                    StringList *dependency_list = nullptr,
+                    StringList *guarded_file_list = nullptr,
+                    CompilationErrorCause *error_cause = nullptr,
+                    std::size_t *token_count = nullptr);
+
+  /// Parses the prefix buffer once, then forks a child process for each of
+  /// the given include directives; each child parses its directive on top
+  /// of the in-memory clang state, which is shared copy-on-write with this
+  /// process, and reports the outcome through its exit code. At most the
+  /// given amount of children run at the same time, and each one gets the
+  /// full time budget. The accepted list receives one flag for each include
+  /// directive; the returned status is the one of the prefix. Nothing is
+  /// forked unless canForkProcess() is true when the prefix has been
+  /// parsed, and the children that outlive the time budget are killed
+  Status forkProcessAST(const std::string &prefix_buffer,
+                        const StringList &include_directive_list,
+                        std::size_t process_count,
+                        std::vector<bool> &accepted_list);
+
+  /// Returns true if the calling thread is the only one of the process. A
+  /// child forked while other threads run may inherit a lock one of them
+  /// holds, and hang on it; only Linux can tell, the other platforms always
+  /// return false
+  static bool canForkProcess();
+
+  /// Compiles the given source code into a precompiled header. If a
+  /// dependency list is passed, it will receive the path of each file that
+  /// has been read
+  Status generatePrecompiledHeader(const std::string &buffer,
+                                   const std::string &output_path,
+                                   StringList *dependency_list = nullptr);
+
+  /// Sets the precompiled header to load before each processAST call; pass an
+  /// empty path to disable it
+  void setPrecompiledHeader(const std::string &path);
+
+  /// Sets the flag that aborts the running processAST and preprocess calls
+  /// once another thread raises it; they then return CompilationCancelled.
+  /// The flag is checked like the time budget, and it must outlive the
+  /// calls. Pass nullptr to disable it
+  void setCancellationFlag(const std::atomic_bool *cancellation_flag);
+
+  /// Returns the memory used by the AST, the source manager and the
+  /// preprocessor at the end of the last processAST or preprocess call, in
+  /// bytes; zero if the compiler instance could not be created
+  std::size_t frontendMemoryUsage() const;
+
+  /// Returns the frontend statistics of the last processAST or preprocess
+  /// call; the declarations and the template instantiations are only counted
+  /// by processAST
+  const FrontendStatistics &frontendStatistics() const;
 
   /// Disable the copy constructor
   CompilerInstance(const CompilerInstance &other) = delete;
 
   /// Disable the assignment operator
   CompilerInstance &operator=(const CompilerInstance &other) = delete;
+
+ private:
+  /// Runs the clang frontend on the given source code; when preprocess_only
+  /// is true, the parser and the semantic analysis are skipped, and the
+  /// tokens are counted. The parsed unit is only filled by processAST
+  Status runFrontend(const std::string &buffer, IASTVisitorRef ast_visitor,
+                     StringList *dependency_list, StringList *guarded_file_list,
+                     CompilationErrorCause *error_cause, bool preprocess_only,
+                     std::size_t *token_count,
+                     ParsedTranslationUnitRef *parsed_unit);
+};
+
+/// A translation unit built by CompilerInstance::processAST and kept alive
+/// afterwards, so that an AST visitor can be run on it without parsing the
+/// source buffer again
+class ParsedTranslationUnit final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use CompilerInstance::processAST() instead
+  ParsedTranslationUnit();
+
+  friend class CompilerInstance;
+
+ public:
+  /// Destructor
+  ~ParsedTranslationUnit();
+
+  /// Returns the source buffer that has been parsed
+  const std::string &sourceBuffer() const;
+
+  /// Returns the settings of the compiler instance that parsed the buffer
+  const CompilerInstanceSettings &settings() const;
+
+  /// Runs the given visitor on the translation unit, as processAST would
+  /// have done. The traversal folders, the shards, the output paths and the
+  /// time report are taken from the given settings; the dependency list, if
+  /// passed, receives the path of each file that has been read. This method
+  /// can be called more than once, but not concurrently
+  CompilerInstance::Status visit(IASTVisitorRef ast_visitor,
+                                 const CompilerInstanceSettings &settings,
+                                 StringList *dependency_list = nullptr);
+
+  /// Disable the copy constructor
+  ParsedTranslationUnit(const ParsedTranslationUnit &other) = delete;
+
+  /// Disable the assignment operator
+  ParsedTranslationUnit &operator=(const ParsedTranslationUnit &other) =
+      delete;
 };
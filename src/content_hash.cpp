@@ -0,0 +1,310 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "content_hash.h"
+#include "profile_pack.h"
+
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+/// The FNV-1a prime
+const ContentHash kContentHashPrime = 0x100000001B3ULL;
+
+/// The tag starting each dependency line
+const std::string kDependencyLineTag = "dependency ";
+
+/// How many characters a content hash takes once converted to a string
+const std::size_t kContentHashStringSize = 16U;
+
+/// The primes used by hashBuffer(); these are the XXH64 ones
+const std::uint64_t kBufferHashPrime1 = 0x9E3779B185EBCA87ULL;
+const std::uint64_t kBufferHashPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const std::uint64_t kBufferHashPrime3 = 0x165667B19E3779F9ULL;
+const std::uint64_t kBufferHashPrime4 = 0x85EBCA77C2B2AE63ULL;
+const std::uint64_t kBufferHashPrime5 = 0x27D4EB2F165667C5ULL;
+
+/// Rotates the given value to the left
+std::uint64_t rotateLeft(std::uint64_t value, unsigned int bit_count) {
+  return (value << bit_count) | (value >> (64U - bit_count));
+}
+
+/// Reads a 64-bit value from a buffer that may not be aligned
+std::uint64_t read64(const std::uint8_t *buffer) {
+  std::uint64_t value;
+  std::memcpy(&value, buffer, sizeof(value));
+  return value;
+}
+
+/// Reads a 32-bit value from a buffer that may not be aligned
+std::uint32_t read32(const std::uint8_t *buffer) {
+  std::uint32_t value;
+  std::memcpy(&value, buffer, sizeof(value));
+  return value;
+}
+
+/// Mixes a 64-bit input into one of the lanes
+std::uint64_t mixLane(std::uint64_t lane, std::uint64_t input) {
+  lane += input * kBufferHashPrime2;
+  lane = rotateLeft(lane, 31U);
+  return lane * kBufferHashPrime1;
+}
+
+/// Folds one of the lanes into the hash
+std::uint64_t mergeLane(std::uint64_t hash, std::uint64_t lane) {
+  hash ^= mixLane(0U, lane);
+  return hash * kBufferHashPrime1 + kBufferHashPrime4;
+}
+}  // namespace
+
+ContentHash updateContentHash(ContentHash hash, const void *buffer,
+                              std::size_t size) {
+  auto byte_buffer = static_cast<const std::uint8_t *>(buffer);
+
+  for (std::size_t i = 0U; i < size; ++i) {
+    hash ^= byte_buffer[i];
+    hash *= kContentHashPrime;
+  }
+
+  return hash;
+}
+
+ContentHash updateContentHash(ContentHash hash, const std::string &buffer) {
+  hash = updateContentHash(hash, static_cast<std::uint64_t>(buffer.size()));
+  return updateContentHash(hash, buffer.data(), buffer.size());
+}
+
+ContentHash updateContentHash(ContentHash hash, const StringList &string_list) {
+  hash =
+      updateContentHash(hash, static_cast<std::uint64_t>(string_list.size()));
+
+  for (const auto &str : string_list) {
+    hash = updateContentHash(hash, str);
+  }
+
+  return hash;
+}
+
+ContentHash updateContentHash(ContentHash hash, std::uint64_t value) {
+  std::array<std::uint8_t, sizeof(value)> buffer;
+  for (std::size_t i = 0U; i < buffer.size(); ++i) {
+    buffer[i] = static_cast<std::uint8_t>(value >> (i * 8U));
+  }
+
+  return updateContentHash(hash, buffer.data(), buffer.size());
+}
+
+ContentHash hashBuffer(const void *buffer, std::size_t size) {
+  auto current = static_cast<const std::uint8_t *>(buffer);
+  auto end = current + size;
+
+  std::uint64_t hash;
+
+  // The lanes do not depend on each other, so the compiler can interleave
+  // (or vectorize) them
+  if (size >= 32U) {
+    std::uint64_t lane1 = kBufferHashPrime1 + kBufferHashPrime2;
+    std::uint64_t lane2 = kBufferHashPrime2;
+    std::uint64_t lane3 = 0U;
+    std::uint64_t lane4 = 0U - kBufferHashPrime1;
+
+    auto stripe_end = end - 32U;
+
+    do {
+      lane1 = mixLane(lane1, read64(current));
+      lane2 = mixLane(lane2, read64(current + 8U));
+      lane3 = mixLane(lane3, read64(current + 16U));
+      lane4 = mixLane(lane4, read64(current + 24U));
+
+      current += 32U;
+    } while (current <= stripe_end);
+
+    hash = rotateLeft(lane1, 1U) + rotateLeft(lane2, 7U) +
+           rotateLeft(lane3, 12U) + rotateLeft(lane4, 18U);
+
+    hash = mergeLane(hash, lane1);
+    hash = mergeLane(hash, lane2);
+    hash = mergeLane(hash, lane3);
+    hash = mergeLane(hash, lane4);
+
+  } else {
+    hash = kBufferHashPrime5;
+  }
+
+  hash += static_cast<std::uint64_t>(size);
+
+  while (current + 8U <= end) {
+    hash ^= mixLane(0U, read64(current));
+    hash = rotateLeft(hash, 27U) * kBufferHashPrime1 + kBufferHashPrime4;
+    current += 8U;
+  }
+
+  if (current + 4U <= end) {
+    hash ^= static_cast<std::uint64_t>(read32(current)) * kBufferHashPrime1;
+    hash = rotateLeft(hash, 23U) * kBufferHashPrime2 + kBufferHashPrime3;
+    current += 4U;
+  }
+
+  while (current < end) {
+    hash ^= static_cast<std::uint64_t>(*current) * kBufferHashPrime5;
+    hash = rotateLeft(hash, 11U) * kBufferHashPrime1;
+    ++current;
+  }
+
+  hash ^= hash >> 33U;
+  hash *= kBufferHashPrime2;
+  hash ^= hash >> 29U;
+  hash *= kBufferHashPrime3;
+  hash ^= hash >> 32U;
+
+  return hash;
+}
+
+bool hashFileContents(ContentHash &hash, const std::string &path) {
+  hash = kInitialContentHash;
+
+  // The files located inside a header archive are hashed from memory
+  std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+  if (!file) {
+    llvm::StringRef contents;
+    if (!readHeaderArchiveFile(contents, path)) {
+      return false;
+    }
+
+    hash = hashBuffer(contents.data(), contents.size());
+    return true;
+  }
+
+  // Headers are small enough to be hashed in a single pass
+  auto file_size = file.tellg();
+  if (file_size < 0) {
+    return false;
+  }
+
+  std::string buffer(static_cast<std::size_t>(file_size), '\0');
+
+  file.seekg(0);
+  file.read(&buffer[0], static_cast<std::streamsize>(buffer.size()));
+  if (!file) {
+    return false;
+  }
+
+  hash = hashBuffer(buffer.data(), buffer.size());
+  return true;
+}
+
+std::string contentHashToString(ContentHash hash) {
+  std::stringstream buffer;
+  buffer << std::hex << std::setfill('0') << std::setw(16) << hash;
+
+  return buffer.str();
+}
+
+bool contentHashFromString(ContentHash &hash, const std::string &buffer) {
+  hash = 0U;
+
+  if (buffer.size() != 16U) {
+    return false;
+  }
+
+  try {
+    std::size_t processed_chars = 0U;
+    hash = std::stoull(buffer, &processed_chars, 16);
+
+    return (processed_chars == buffer.size());
+
+  } catch (...) {
+    return false;
+  }
+}
+
+void writeDependencyLine(std::ostream &stream, const std::string &path,
+                         ContentHash hash) {
+  stream << kDependencyLineTag << contentHashToString(hash) << " " << path
+         << "\n";
+}
+
+bool parseDependencyLine(std::string &path, ContentHash &hash,
+                         const std::string &line) {
+  path.clear();
+
+  // dependency <hash> <path>; the path is never empty
+  const auto hash_offset = kDependencyLineTag.size();
+  const auto path_offset = hash_offset + kContentHashStringSize + 1U;
+
+  if (line.size() <= path_offset ||
+      line.compare(0U, hash_offset, kDependencyLineTag) != 0 ||
+      line[path_offset - 1U] != ' ') {
+    return false;
+  }
+
+  if (!contentHashFromString(
+          hash, line.substr(hash_offset, kContentHashStringSize))) {
+    return false;
+  }
+
+  path = line.substr(path_offset);
+  return true;
+}
+
+/// Private class data
+struct FileHashCache::PrivateData final {
+  /// Protects the members below
+  std::mutex mutex;
+
+  /// Content hashes of the files that have been read
+  std::unordered_map<std::string, ContentHash> file_hash_map;
+
+  /// Files that could not be read
+  std::unordered_set<std::string> missing_file_set;
+};
+
+FileHashCache::FileHashCache() : d(new PrivateData) {}
+
+FileHashCache::~FileHashCache() {}
+
+bool FileHashCache::getFileHash(ContentHash &hash, const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    auto it = d->file_hash_map.find(path);
+    if (it != d->file_hash_map.end()) {
+      hash = it->second;
+      return true;
+    }
+
+    if (d->missing_file_set.count(path) != 0U) {
+      return false;
+    }
+  }
+
+  auto succeeded = hashFileContents(hash, path);
+
+  std::lock_guard<std::mutex> lock(d->mutex);
+  if (succeeded) {
+    d->file_hash_map.insert({path, hash});
+  } else {
+    d->missing_file_set.insert(path);
+  }
+
+  return succeeded;
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "types.h"
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+
+/// A 64-bit content hash
+using ContentHash = std::uint64_t;
+
+/// The initial value used when starting a new hash
+const ContentHash kInitialContentHash = 0xCBF29CE484222325ULL;
+
+/// Updates the given hash with the specified buffer
+ContentHash updateContentHash(ContentHash hash, const void *buffer,
+                              std::size_t size);
+
+/// Updates the given hash with the specified string; the string size is also
+/// hashed, so that consecutive strings can't be confused
+ContentHash updateContentHash(ContentHash hash, const std::string &buffer);
+
+/// Updates the given hash with each string in the list
+ContentHash updateContentHash(ContentHash hash, const StringList &string_list);
+
+/// Updates the given hash with the specified integer
+ContentHash updateContentHash(ContentHash hash, std::uint64_t value);
+
+/// Hashes the given buffer in 32-byte stripes, using four independent lanes;
+/// this is much faster than updateContentHash() on large buffers, and it is
+/// what the file hashes are computed with. The result depends on the byte
+/// order of the host
+ContentHash hashBuffer(const void *buffer, std::size_t size);
+
+/// Hashes the contents of the given file with hashBuffer()
+bool hashFileContents(ContentHash &hash, const std::string &path);
+
+/// Converts the given hash to a fixed-size hex string
+std::string contentHashToString(ContentHash hash);
+
+/// Converts the given hex string to a hash
+bool contentHashFromString(ContentHash &hash, const std::string &buffer);
+
+/// Writes a "dependency <hash> <path>" line, recording the hash a file had
+/// when a cache entry or a manifest depending on it has been saved
+void writeDependencyLine(std::ostream &stream, const std::string &path,
+                         ContentHash hash);
+
+/// Parses a line written by writeDependencyLine(); returns false if it is
+/// not a dependency line, or if it is malformed
+bool parseDependencyLine(std::string &path, ContentHash &hash,
+                         const std::string &line);
+
+/// Hashes files with hashFileContents(), remembering the result for each
+/// path, including the files that could not be read; the caches use it so
+/// that each file is read at most once per run. It can be used from several
+/// threads at the same time
+class FileHashCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor
+  FileHashCache();
+
+  /// Destructor
+  ~FileHashCache();
+
+  /// Returns the content hash of the given file, reusing the previous result
+  /// if the file has already been hashed
+  bool getFileHash(ContentHash &hash, const std::string &path);
+
+  /// Disable the copy constructor
+  FileHashCache(const FileHashCache &other) = delete;
+
+  /// Disable the assignment operator
+  FileHashCache &operator=(const FileHashCache &other) = delete;
+};
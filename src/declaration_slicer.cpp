@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "declaration_slicer.h"
+
+#include <functional>
+#include <set>
+#include <unordered_set>
+#include <utility>
+
+#include <clang/AST/Attr.h>
+#include <clang/AST/DeclBase.h>
+#include <clang/AST/Type.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+/// Returns the tag that the given type refers to, looking through pointers
+/// and arrays (i.e.: `struct {} *foo[2]`); used to find the declarations
+/// sharing the definition of an anonymous tag
+const clang::TagDecl *getBaseTagDeclaration(clang::QualType type) {
+  auto type_ptr = type.getCanonicalType().getTypePtr();
+
+  while (true) {
+    if (type_ptr->isPointerType() || type_ptr->isReferenceType()) {
+      type_ptr = type_ptr->getPointeeType().getCanonicalType().getTypePtr();
+
+    } else if (type_ptr->isArrayType()) {
+      type_ptr = type_ptr->getArrayElementTypeNoTypeQual();
+
+    } else {
+      break;
+    }
+  }
+
+  auto tag_decl = type_ptr->getAsTagDecl();
+  return tag_decl != nullptr ? tag_decl->getCanonicalDecl() : nullptr;
+}
+
+/// Returns the file scope declaration containing the given one
+const clang::Decl *getTopLevelDeclaration(const clang::Decl *declaration) {
+  while (true) {
+    auto context = declaration->getDeclContext();
+    if (context == nullptr || context->isTranslationUnit()) {
+      return declaration;
+    }
+
+    declaration = clang::Decl::castFromDeclContext(context);
+  }
+}
+
+/// Collects the declarations needed by a set of functions
+class DeclarationSlicer final {
+  /// A type, and whether it has to be complete where it is used
+  using TypeRequirement = std::pair<const clang::Type *, bool>;
+
+  /// The AST context
+  clang::ASTContext &ast_context;
+
+  /// The declarations whose dependencies have been collected
+  std::unordered_set<const clang::Decl *> expanded_declaration_set;
+
+  /// The file scope declarations that are printed
+  std::unordered_set<const clang::Decl *> required_declaration_set;
+
+  /// The records that are only used through pointers, in the order they
+  /// have been found
+  std::vector<const clang::TagDecl *> forward_declaration_list;
+
+  /// Used to only forward declare each record once
+  std::unordered_set<const clang::TagDecl *> forward_declaration_set;
+
+  /// The types that have already been visited
+  std::set<TypeRequirement> visited_type_set;
+
+  /// The types that still have to be visited
+  std::vector<TypeRequirement> type_queue;
+
+  /// Queues the given type; incomplete types are fine in declarations and
+  /// behind pointers, while records used by value need their definition
+  void queueType(clang::QualType type, bool complete) {
+    auto type_ptr = type.getTypePtrOrNull();
+    if (type_ptr != nullptr) {
+      type_queue.push_back({type_ptr, complete});
+    }
+  }
+
+  /// Requires the given tag, either in full or through a forward declaration
+  void requireTag(const clang::TagDecl *tag_decl, bool complete) {
+    // Enums can't be forward declared, and anonymous tags can only be
+    // referenced through their definition
+    auto definition = tag_decl->getDefinition();
+
+    if (definition != nullptr &&
+        (complete || llvm::isa<clang::EnumDecl>(tag_decl) ||
+         tag_decl->getIdentifier() == nullptr)) {
+      requireDeclaration(definition);
+      return;
+    }
+
+    auto canonical_decl = tag_decl->getCanonicalDecl();
+    if (forward_declaration_set.insert(canonical_decl).second) {
+      forward_declaration_list.push_back(canonical_decl);
+    }
+  }
+
+  /// Visits the queued types
+  void processTypeQueue() {
+    while (!type_queue.empty()) {
+      auto requirement = type_queue.back();
+      type_queue.pop_back();
+
+      if (!visited_type_set.insert(requirement).second) {
+        continue;
+      }
+
+      auto type = requirement.first;
+      auto complete = requirement.second;
+
+      // Typedefs are sugar too, but they have to be declared
+      if (auto typedef_type = llvm::dyn_cast<clang::TypedefType>(type)) {
+        auto typedef_decl = typedef_type->getDecl();
+
+        requireDeclaration(typedef_decl);
+        queueType(typedef_decl->getUnderlyingType(), complete);
+
+      } else if (auto tag_type = llvm::dyn_cast<clang::TagType>(type)) {
+        requireTag(tag_type->getDecl(), complete);
+
+      } else if (llvm::isa<clang::PointerType>(type) ||
+                 llvm::isa<clang::ReferenceType>(type) ||
+                 llvm::isa<clang::BlockPointerType>(type)) {
+        queueType(type->getPointeeType(), false);
+
+      } else if (auto array_type = llvm::dyn_cast<clang::ArrayType>(type)) {
+        queueType(array_type->getElementType(), true);
+
+      } else if (auto vector_type = llvm::dyn_cast<clang::VectorType>(type)) {
+        queueType(vector_type->getElementType(), true);
+
+      } else if (auto complex_type = llvm::dyn_cast<clang::ComplexType>(type)) {
+        queueType(complex_type->getElementType(), true);
+
+      } else if (auto atomic_type = llvm::dyn_cast<clang::AtomicType>(type)) {
+        queueType(atomic_type->getValueType(), true);
+
+      } else if (auto function_type =
+                     llvm::dyn_cast<clang::FunctionType>(type)) {
+        queueType(function_type->getReturnType(), false);
+
+        if (auto prototype =
+                llvm::dyn_cast<clang::FunctionProtoType>(function_type)) {
+          for (const auto &parameter_type : prototype->getParamTypes()) {
+            queueType(parameter_type, false);
+          }
+        }
+
+      } else if (type->isSugared()) {
+        // Elaborated names, parentheses, attributes, decayed parameters...
+        queueType(type->getLocallyUnqualifiedSingleStepDesugaredType(),
+                  complete);
+      }
+    }
+  }
+
+ public:
+  /// Constructor
+  DeclarationSlicer(clang::ASTContext &ast_context)
+      : ast_context(ast_context) {}
+
+  /// Requires the given declaration, along with the types it uses; the file
+  /// scope declaration containing it is printed
+  void requireDeclaration(const clang::Decl *declaration) {
+    if (declaration->isImplicit() ||
+        !expanded_declaration_set.insert(declaration).second) {
+      return;
+    }
+
+    if (auto typedef_decl =
+            llvm::dyn_cast<clang::TypedefNameDecl>(declaration)) {
+      queueType(typedef_decl->getUnderlyingType(), false);
+
+    } else if (auto record_decl =
+                   llvm::dyn_cast<clang::RecordDecl>(declaration)) {
+      for (auto field : record_decl->fields()) {
+        queueType(field->getType(), true);
+      }
+
+    } else if (auto function_decl =
+                   llvm::dyn_cast<clang::FunctionDecl>(declaration)) {
+      queueType(function_decl->getType(), false);
+    }
+
+    // Nested records are printed by the declaration containing them, so all
+    // of its members are needed
+    auto top_level_declaration = getTopLevelDeclaration(declaration);
+    required_declaration_set.insert(top_level_declaration);
+
+    if (top_level_declaration != declaration) {
+      requireDeclaration(top_level_declaration);
+    }
+
+    processTypeQueue();
+  }
+
+  /// Prints the required declarations
+  void print(std::string &output) const {
+    llvm::raw_string_ostream stream(output);
+
+    auto policy = ast_context.getPrintingPolicy();
+    auto function_policy = policy;
+    function_policy.TerseOutput = true;
+
+    if (!forward_declaration_list.empty()) {
+      stream << "// Forward declarations\n";
+
+      for (auto tag_decl : forward_declaration_list) {
+        stream << tag_decl->getKindName() << " " << tag_decl->getName()
+               << ";\n";
+      }
+
+      stream << "\n";
+    }
+
+    stream << "// Declarations\n";
+
+    auto L_isRequired = [&](const clang::Decl *declaration) -> bool {
+      return required_declaration_set.count(declaration) != 0U;
+    };
+
+    // Records that have been laid out under #pragma pack carry an implicit
+    // attribute, which is not printed
+    auto L_printDeclaration = [&](const clang::Decl *declaration,
+                             const std::function<void()> &L_print) {
+      const clang::MaxFieldAlignmentAttr *packing = nullptr;
+      if (auto record_decl = llvm::dyn_cast<clang::RecordDecl>(declaration)) {
+        packing = record_decl->getAttr<clang::MaxFieldAlignmentAttr>();
+      }
+
+      if (packing != nullptr) {
+        stream << "#pragma pack(push, " << (packing->getAlignment() / 8U)
+               << ")\n";
+      }
+
+      L_print();
+      stream << ";\n";
+
+      if (packing != nullptr) {
+        stream << "#pragma pack(pop)\n";
+      }
+
+      stream << "\n";
+    };
+
+    std::vector<clang::Decl *> declaration_list(
+        ast_context.getTranslationUnitDecl()->decls_begin(),
+        ast_context.getTranslationUnitDecl()->decls_end());
+
+    for (std::size_t i = 0U; i < declaration_list.size(); ++i) {
+      auto declaration = declaration_list[i];
+
+      // An anonymous tag has to be printed together with the typedefs that
+      // name it (i.e.: typedef struct {} foo_t); the variables declared
+      // along with it are skipped
+      auto tag_decl = llvm::dyn_cast<clang::TagDecl>(declaration);
+      if (tag_decl != nullptr && tag_decl->getIdentifier() == nullptr &&
+          !tag_decl->isFreeStanding()) {
+        std::vector<clang::Decl *> group = {declaration};
+        bool required = L_isRequired(declaration);
+
+        auto canonical_tag_decl = tag_decl->getCanonicalDecl();
+
+        while (i + 1U < declaration_list.size()) {
+          auto next_declaration = declaration_list[i + 1U];
+
+          clang::QualType next_type;
+          if (auto typedef_decl =
+                  llvm::dyn_cast<clang::TypedefNameDecl>(next_declaration)) {
+            next_type = typedef_decl->getUnderlyingType();
+
+          } else if (auto value_decl =
+                         llvm::dyn_cast<clang::ValueDecl>(next_declaration)) {
+            next_type = value_decl->getType();
+          }
+
+          if (next_type.isNull() ||
+              getBaseTagDeclaration(next_type) != canonical_tag_decl) {
+            break;
+          }
+
+          ++i;
+
+          if (llvm::isa<clang::TypedefNameDecl>(next_declaration)) {
+            group.push_back(next_declaration);
+            required = required || L_isRequired(next_declaration);
+          }
+        }
+
+        if (required && group.size() > 1U) {
+          L_printDeclaration(declaration, [&]() {
+            clang::Decl::printGroup(group.data(),
+                                    static_cast<unsigned>(group.size()),
+                                    stream, policy, 0U);
+          });
+        }
+
+        continue;
+      }
+
+      if (!L_isRequired(declaration)) {
+        continue;
+      }
+
+      if (llvm::isa<clang::FunctionDecl>(declaration)) {
+        declaration->print(stream, function_policy);
+        stream << ";\n\n";
+
+      } else {
+        L_printDeclaration(declaration,
+                           [&]() { declaration->print(stream, policy); });
+      }
+    }
+
+    stream.flush();
+  }
+};
+
+/// Returns the redeclaration of the given function that is printed: the
+/// last one in the translation unit, which carries all the attributes
+const clang::FunctionDecl *getPrintedDeclaration(
+    const clang::SourceManager &source_manager,
+    const clang::FunctionDecl *function_decl) {
+  const clang::FunctionDecl *printed_declaration = nullptr;
+
+  for (auto redeclaration : function_decl->redecls()) {
+    if (redeclaration->isImplicit()) {
+      continue;
+    }
+
+    if (printed_declaration == nullptr ||
+        source_manager.isBeforeInTranslationUnit(
+            printed_declaration->getLocation(), redeclaration->getLocation())) {
+      printed_declaration = redeclaration;
+    }
+  }
+
+  return printed_declaration;
+}
+}  // namespace
+
+bool sliceFunctionDeclarations(
+    std::string &output, std::string &error_message,
+    clang::ASTContext &ast_context,
+    const std::vector<clang::FunctionDecl *> &function_list) {
+  output.clear();
+  error_message.clear();
+
+  if (ast_context.getLangOpts().CPlusPlus) {
+    error_message = "Only C translation units can be sliced";
+    return false;
+  }
+
+  DeclarationSlicer slicer(ast_context);
+
+  for (auto function_decl : function_list) {
+    // There is nothing to link against when the function is only defined
+    // in the headers
+    if (!function_decl->isExternallyVisible()) {
+      error_message = "The following function has internal linkage: " +
+                      function_decl->getNameAsString();
+      return false;
+    }
+
+    auto printed_declaration =
+        getPrintedDeclaration(ast_context.getSourceManager(), function_decl);
+
+    if (printed_declaration == nullptr) {
+      error_message = "The following function is only declared implicitly: " +
+                      function_decl->getNameAsString();
+      return false;
+    }
+
+    slicer.requireDeclaration(printed_declaration);
+  }
+
+  slicer.print(output);
+  return true;
+}
@@ -0,0 +1,37 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+
+/// Builds the source code of a self-contained C header declaring the given
+/// functions. Only the declarations they need are extracted from the AST:
+/// the prototypes themselves, the typedefs they use, the definitions of the
+/// types they need in full (enums, and records used by value) and forward
+/// declarations for the records only used through pointers. Declarations
+/// are printed in their original order. Returns false, and sets the error
+/// message, if one of the functions can't be declared on its own (i.e.: it
+/// has internal linkage)
+bool sliceFunctionDeclarations(
+    std::string &output, std::string &error_message,
+    clang::ASTContext &ast_context,
+    const std::vector<clang::FunctionDecl *> &function_list);
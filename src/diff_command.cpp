@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "abi_database.h"
+#include "abi_lib_generator.h"
+#include "cmdline.h"
+
+#include <llvm/ADT/StringRef.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+/// A function of one of the databases, whitelisted or blacklisted
+struct DiffSymbol final {
+  /// The mangled name, pointing inside the string table
+  llvm::StringRef mangled_name;
+
+  /// True if the function is whitelisted
+  bool whitelisted{false};
+
+  /// The index of the function in the whitelisted or blacklisted columns
+  std::uint32_t index{0U};
+};
+
+/// The functions of a database, sorted by mangled name
+struct DiffSide final {
+  /// The database, without the function lists
+  ABIDatabase database;
+
+  /// The functions, in the columnar layout
+  ABILibraryColumns columns;
+
+  /// One symbol for each mangled name
+  std::vector<DiffSymbol> symbol_list;
+};
+
+/// The changes found by the diff
+struct DiffCounters final {
+  /// Functions only found in the new database
+  std::size_t added_count{0U};
+
+  /// Functions only found in the old database
+  std::size_t removed_count{0U};
+
+  /// Functions whose description or blacklist state has changed
+  std::size_t changed_count{0U};
+};
+
+/// Returns the given string of the table, or an empty string if the
+/// identifier is not valid
+llvm::StringRef getColumnString(const ABILibraryColumns &columns,
+                                StringId string_id) {
+  const auto &offset_list = columns.string_offset_list;
+  if (string_id >= offset_list.size() - 1U) {
+    return llvm::StringRef();
+  }
+
+  auto begin = offset_list[string_id];
+  auto end = offset_list[string_id + 1U];
+  if (begin > end || end > columns.string_data.size()) {
+    return llvm::StringRef();
+  }
+
+  return llvm::StringRef(columns.string_data.data() + begin, end - begin);
+}
+
+/// Reads the given database and sorts its functions by mangled name. The
+/// functions blacklisted more than once (i.e.: duplicated names) only
+/// appear once
+bool readDiffSide(DiffSide &side, const std::string &path) {
+  if (!readABIDatabaseColumns(side.database, side.columns, path)) {
+    std::cerr << "Failed to read the ABI database: " << path << "\n";
+    return false;
+  }
+
+  const auto &columns = side.columns;
+
+  auto whitelisted_count = columns.whitelisted_mangled_name_list.size();
+  auto blacklisted_count = columns.blacklisted_mangled_name_list.size();
+
+  side.symbol_list.reserve(whitelisted_count + blacklisted_count);
+
+  for (std::size_t i = 0U; i < whitelisted_count; ++i) {
+    side.symbol_list.push_back(DiffSymbol{
+        getColumnString(columns, columns.whitelisted_mangled_name_list[i]),
+        true, static_cast<std::uint32_t>(i)});
+  }
+
+  for (std::size_t i = 0U; i < blacklisted_count; ++i) {
+    side.symbol_list.push_back(DiffSymbol{
+        getColumnString(columns, columns.blacklisted_mangled_name_list[i]),
+        false, static_cast<std::uint32_t>(i)});
+  }
+
+  // The whitelisted entry wins when a name appears in both lists, and the
+  // first blacklisted entry when it appears more than once
+  std::stable_sort(side.symbol_list.begin(), side.symbol_list.end(),
+                   [](const DiffSymbol &lhs, const DiffSymbol &rhs) -> bool {
+                     if (lhs.mangled_name != rhs.mangled_name) {
+                       return lhs.mangled_name < rhs.mangled_name;
+                     }
+
+                     return lhs.whitelisted && !rhs.whitelisted;
+                   });
+
+  side.symbol_list.erase(
+      std::unique(side.symbol_list.begin(), side.symbol_list.end(),
+                  [](const DiffSymbol &lhs, const DiffSymbol &rhs) -> bool {
+                    return lhs.mangled_name == rhs.mangled_name;
+                  }),
+      side.symbol_list.end());
+
+  return true;
+}
+
+/// Returns the friendly name of the given symbol
+llvm::StringRef getFriendlyName(const DiffSide &side,
+                                const DiffSymbol &symbol) {
+  const auto &columns = side.columns;
+
+  return getColumnString(
+      columns, symbol.whitelisted
+                   ? columns.whitelisted_friendly_name_list[symbol.index]
+                   : columns.blacklisted_friendly_name_list[symbol.index]);
+}
+
+/// Describes the state of the given symbol: whitelisted, or blacklisted
+/// along with the reason
+std::string describeSymbolState(const DiffSide &side,
+                                const DiffSymbol &symbol) {
+  if (symbol.whitelisted) {
+    return "whitelisted";
+  }
+
+  auto reason = static_cast<BlacklistedFunction::Reason>(
+      side.columns.blacklisted_reason_list[symbol.index]);
+
+  return std::string("blacklisted: ") + getBlacklistReasonName(reason);
+}
+
+/// Returns the opaque types of the given whitelisted function; the list is
+/// empty if the offsets are not valid
+TypeIdentityList getOpaqueTypeList(const ABILibraryColumns &columns,
+                                   std::uint32_t index) {
+  auto begin = columns.opaque_type_offset_list[index];
+  auto end = columns.opaque_type_offset_list[index + 1U];
+  if (begin > end || end > columns.opaque_type_data.size()) {
+    return TypeIdentityList();
+  }
+
+  return TypeIdentityList(std::next(columns.opaque_type_data.begin(), begin),
+                          std::next(columns.opaque_type_data.begin(), end));
+}
+
+/// Returns what has changed between the two versions of a whitelisted
+/// function, or an empty string if they are the same
+std::string compareWhitelistedFunctions(const DiffSide &old_side,
+                                        std::uint32_t old_index,
+                                        const DiffSide &new_side,
+                                        std::uint32_t new_index) {
+  const auto &old_columns = old_side.columns;
+  const auto &new_columns = new_side.columns;
+
+  StringList change_list;
+
+  auto old_argument_count =
+      old_columns.whitelisted_argument_count_list[old_index];
+  auto new_argument_count =
+      new_columns.whitelisted_argument_count_list[new_index];
+
+  if (old_argument_count != new_argument_count) {
+    change_list.push_back("argument count " +
+                          std::to_string(old_argument_count) + " -> " +
+                          std::to_string(new_argument_count));
+  }
+
+  if (old_columns.whitelisted_calling_convention_list[old_index] !=
+      new_columns.whitelisted_calling_convention_list[new_index]) {
+    change_list.push_back("calling convention");
+  }
+
+  auto old_no_return = old_columns.whitelisted_no_return_list[old_index];
+  auto new_no_return = new_columns.whitelisted_no_return_list[new_index];
+
+  if (old_no_return != new_no_return) {
+    change_list.push_back(new_no_return != 0U ? "now noreturn"
+                                              : "no longer noreturn");
+  }
+
+  if (getOpaqueTypeList(old_columns, old_index) !=
+      getOpaqueTypeList(new_columns, new_index)) {
+    change_list.push_back("opaque types");
+  }
+
+  std::string description;
+  for (const auto &change : change_list) {
+    description += (description.empty() ? "" : ", ") + change;
+  }
+
+  return description;
+}
+
+/// Writes the changes of the header list; the headers are compared as
+/// sets, since the order only depends on the probing
+void diffHeaderLists(std::ostream &stream, DiffCounters &counters,
+                     StringList old_header_list, StringList new_header_list) {
+  std::sort(old_header_list.begin(), old_header_list.end());
+  std::sort(new_header_list.begin(), new_header_list.end());
+
+  StringList added_header_list;
+  std::set_difference(new_header_list.begin(), new_header_list.end(),
+                      old_header_list.begin(), old_header_list.end(),
+                      std::back_inserter(added_header_list));
+
+  StringList removed_header_list;
+  std::set_difference(old_header_list.begin(), old_header_list.end(),
+                      new_header_list.begin(), new_header_list.end(),
+                      std::back_inserter(removed_header_list));
+
+  stream << "Headers: " << added_header_list.size() << " added, "
+         << removed_header_list.size() << " removed\n";
+
+  for (const auto &header : added_header_list) {
+    stream << "  + " << header << "\n";
+  }
+
+  for (const auto &header : removed_header_list) {
+    stream << "  - " << header << "\n";
+  }
+
+  stream << "\n";
+
+  counters.added_count += added_header_list.size();
+  counters.removed_count += removed_header_list.size();
+}
+
+/// Writes the added, removed and changed functions
+void diffFunctionLists(std::ostream &stream, DiffCounters &counters,
+                       const DiffSide &old_side, const DiffSide &new_side) {
+  std::stringstream added_stream;
+  std::stringstream removed_stream;
+  std::stringstream changed_stream;
+
+  DiffCounters function_counters;
+
+  auto L_describe = [](const DiffSide &side, const DiffSymbol &symbol) {
+    return getFriendlyName(side, symbol).str() + " (" +
+           symbol.mangled_name.str() + ")";
+  };
+
+  auto old_it = old_side.symbol_list.begin();
+  auto new_it = new_side.symbol_list.begin();
+
+  while (old_it != old_side.symbol_list.end() ||
+         new_it != new_side.symbol_list.end()) {
+    if (new_it == new_side.symbol_list.end() ||
+        (old_it != old_side.symbol_list.end() &&
+         old_it->mangled_name < new_it->mangled_name)) {
+      removed_stream << "  - " << L_describe(old_side, *old_it) << " ["
+                     << describeSymbolState(old_side, *old_it) << "]\n";
+
+      function_counters.removed_count++;
+      ++old_it;
+      continue;
+    }
+
+    if (old_it == old_side.symbol_list.end() ||
+        new_it->mangled_name < old_it->mangled_name) {
+      added_stream << "  + " << L_describe(new_side, *new_it) << " ["
+                   << describeSymbolState(new_side, *new_it) << "]\n";
+
+      function_counters.added_count++;
+      ++new_it;
+      continue;
+    }
+
+    std::string change;
+    if (old_it->whitelisted && new_it->whitelisted) {
+      change = compareWhitelistedFunctions(old_side, old_it->index, new_side,
+                                           new_it->index);
+
+    } else {
+      auto old_state = describeSymbolState(old_side, *old_it);
+      auto new_state = describeSymbolState(new_side, *new_it);
+
+      if (old_state != new_state) {
+        change = old_state + " -> " + new_state;
+      }
+    }
+
+    if (!change.empty()) {
+      changed_stream << "  ~ " << L_describe(new_side, *new_it) << ": "
+                     << change << "\n";
+
+      function_counters.changed_count++;
+    }
+
+    ++old_it;
+    ++new_it;
+  }
+
+  stream << "Functions: " << function_counters.added_count << " added, "
+         << function_counters.removed_count << " removed, "
+         << function_counters.changed_count << " changed\n";
+
+  stream << added_stream.str() << removed_stream.str()
+         << changed_stream.str();
+
+  counters.added_count += function_counters.added_count;
+  counters.removed_count += function_counters.removed_count;
+  counters.changed_count += function_counters.changed_count;
+}
+}  // namespace
+
+/// Handler for the 'diff' command
+bool diffCommandHandler(ProfileManagerRef &profile_manager,
+                        const LanguageManager &language_manager,
+                        const CommandLineOptions &cmdline_options) {
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+
+  auto start_time = std::chrono::steady_clock::now();
+
+  DiffSide old_side;
+  DiffSide new_side;
+  if (!readDiffSide(old_side, cmdline_options.diff_old_database) ||
+      !readDiffSide(new_side, cmdline_options.diff_new_database)) {
+    return false;
+  }
+
+  std::stringstream report;
+
+  const auto &old_database = old_side.database;
+  const auto &new_database = new_side.database;
+
+  if (old_database.profile_name != new_database.profile_name ||
+      old_database.language != new_database.language) {
+    report << "Configuration: " << old_database.profile_name << " ("
+           << old_database.language << ") -> " << new_database.profile_name
+           << " (" << new_database.language << ")\n\n";
+  }
+
+  DiffCounters counters;
+  diffHeaderLists(report, counters, old_database.abi_library.header_list,
+                  new_database.abi_library.header_list);
+
+  diffFunctionLists(report, counters, old_side, new_side);
+
+  if (cmdline_options.output.empty()) {
+    std::cout << report.str();
+
+  } else {
+    std::ofstream output_file(cmdline_options.output);
+    output_file << report.str();
+
+    if (!output_file) {
+      std::cerr << "Failed to write the diff: " << cmdline_options.output
+                << "\n";
+      return false;
+    }
+  }
+
+  auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now() - start_time);
+
+  std::cerr << "Diff: " << old_side.symbol_list.size() << " and "
+            << new_side.symbol_list.size() << " functions compared in "
+            << elapsed_time.count() << " ms\n";
+
+  // Like diff(1), so that scripts can detect the changes
+  auto changed = counters.added_count != 0U || counters.removed_count != 0U ||
+                 counters.changed_count != 0U;
+
+  return !(changed && cmdline_options.diff_exit_code);
+}
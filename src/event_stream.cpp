@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "event_stream.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+#include <json11.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// Returns true if the given destination is a file descriptor number
+bool isFileDescriptorNumber(const std::string &destination) {
+  if (destination.empty() || destination.size() > 9U) {
+    return false;
+  }
+
+  for (auto c : destination) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+  }
+
+  return true;
+}
+}  // namespace
+
+/// Private class data
+struct EventStream::PrivateData final {
+  /// Serializes the writes, so that lines are never interleaved
+  std::mutex mutex;
+
+  /// The destination file descriptor
+  int file_descriptor{-1};
+
+  /// True if the file descriptor has been opened by this object
+  bool owns_file_descriptor{false};
+
+  /// When the stream has been created; event times are relative to it
+  std::chrono::steady_clock::time_point start_time;
+
+  /// If set, receives the events instead of the file descriptor
+  EventCallback callback;
+};
+
+EventStream::EventStream(const std::string &destination)
+    : d(new PrivateData) {
+  d->start_time = std::chrono::steady_clock::now();
+
+#if defined(__unix__) || defined(__APPLE__)
+  if (isFileDescriptorNumber(destination)) {
+    d->file_descriptor = std::stoi(destination);
+
+    if (fcntl(d->file_descriptor, F_GETFD) == -1) {
+      throw Status(false, StatusCode::IOError,
+                   "The event file descriptor is not open: " + destination);
+    }
+
+  } else {
+    d->file_descriptor =
+        open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+             0644);
+
+    if (d->file_descriptor == -1) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to create the event file: " + destination);
+    }
+
+    d->owns_file_descriptor = true;
+  }
+
+#else
+  throw Status(false, StatusCode::IOError,
+               "Event streams are not supported on this platform: " +
+                   destination);
+#endif
+}
+
+EventStream::EventStream(EventCallback callback) : d(new PrivateData) {
+  if (!callback) {
+    throw Status(false, StatusCode::Unknown, "The event callback is empty");
+  }
+
+  d->start_time = std::chrono::steady_clock::now();
+  d->callback = std::move(callback);
+}
+
+EventStream::Status EventStream::create(EventStreamRef &obj,
+                                        const std::string &destination) {
+  obj.reset();
+
+  try {
+    auto ptr = new EventStream(destination);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+EventStream::Status EventStream::create(EventStreamRef &obj,
+                                        EventCallback callback) {
+  obj.reset();
+
+  try {
+    auto ptr = new EventStream(std::move(callback));
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+EventStream::~EventStream() {
+#if defined(__unix__) || defined(__APPLE__)
+  if (d->owns_file_descriptor) {
+    close(d->file_descriptor);
+  }
+#endif
+}
+
+void EventStream::emit(const std::string &type,
+                       const EventFieldList &field_list) {
+  auto time = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                            d->start_time)
+                  .count();
+
+  if (d->callback) {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    try {
+      d->callback(time, type, field_list);
+    } catch (...) {
+    }
+
+    return;
+  }
+
+  // The fields are formatted by hand to keep them in order; json11 is only
+  // used to escape the strings
+  std::ostringstream line;
+  line << std::fixed << std::setprecision(6);
+  line << "{\"time\":" << time << ",\"event\":" << json11::Json(type).dump();
+
+  for (const auto &field : field_list) {
+    line << "," << json11::Json(field.first).dump() << ":";
+
+    const auto &value = field.second;
+    if (std::holds_alternative<std::string>(value)) {
+      line << json11::Json(std::get<std::string>(value)).dump();
+
+    } else if (std::holds_alternative<bool>(value)) {
+      line << (std::get<bool>(value) ? "true" : "false");
+
+    } else {
+      // Counts are printed without the fractional part
+      auto number = std::get<double>(value);
+      if (number == std::floor(number) && std::fabs(number) < 1e15) {
+        line << static_cast<long long>(number);
+      } else {
+        line << number;
+      }
+    }
+  }
+
+  line << "}\n";
+  auto buffer = line.str();
+
+#if defined(__unix__) || defined(__APPLE__)
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  const char *data = buffer.data();
+  auto remaining = buffer.size();
+
+  while (remaining > 0U) {
+    auto written = write(d->file_descriptor, data, remaining);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+
+      break;
+    }
+
+    data += written;
+    remaining -= static_cast<std::size_t>(written);
+  }
+#endif
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "istatus.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+/// A value attached to an event
+using EventValue = std::variant<std::string, double, bool>;
+
+/// The fields of an event, in the order they are written
+using EventFieldList = std::vector<std::pair<std::string, EventValue>>;
+
+/// Receives the events of a stream created with a callback; the time is
+/// the one of the "time" field
+using EventCallback =
+    std::function<void(double time, const std::string &type,
+                       const EventFieldList &field_list)>;
+
+class EventStream;
+
+/// A reference to an EventStream object
+using EventStreamRef = std::shared_ptr<EventStream>;
+
+/// The EventStream writes the progress of a run as newline-delimited JSON,
+/// one object per line, so that orchestrators can follow it while it runs.
+/// Each event has a "time" field (seconds since the stream has been
+/// created) and an "event" field with its type, followed by its own fields.
+/// Lines are never interleaved, and write errors are ignored; the stream
+/// must never stop the run. All methods are thread safe
+class EventStream final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  EventStream(const std::string &destination);
+
+  /// Private constructor; use ::create() instead
+  EventStream(EventCallback callback);
+
+ public:
+  /// Status code, used with EventStream::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new EventStream object. The destination is either the number
+  /// of a file descriptor that is already open (i.e.: a pipe set up by the
+  /// orchestrator), or the path of a file that is created or truncated
+  static Status create(EventStreamRef &obj, const std::string &destination);
+
+  /// Creates a new EventStream object passing each event to the given
+  /// callback instead of writing it; used by the programs embedding abigen.
+  /// The callback is never invoked concurrently, and exceptions thrown by
+  /// it are ignored
+  static Status create(EventStreamRef &obj, EventCallback callback);
+
+  /// Destructor
+  ~EventStream();
+
+  /// Writes an event of the given type
+  void emit(const std::string &type, const EventFieldList &field_list = {});
+
+  /// Disable the copy constructor
+  EventStream(const EventStream &other) = delete;
+
+  /// Disable the assignment operator
+  EventStream &operator=(const EventStream &other) = delete;
+};
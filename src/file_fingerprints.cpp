@@ -0,0 +1,508 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "file_fingerprints.h"
+#include "batched_file_io.h"
+#include "header_dependencies.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace {
+/// The first line of the index
+const std::string kFingerprintIndexHeader = "abigen-file-fingerprints 1";
+
+/// Files modified within this interval are hashed again on the next run;
+/// file system timestamps are coarse enough for a write made right after
+/// the hash to keep the same modification time
+const std::int64_t kRacyModificationInterval = 2000000000;
+
+/// The status of a file, along with its content hash
+struct FileFingerprint final {
+  /// The content hash
+  ContentHash hash{0U};
+
+  /// The file size, in bytes
+  std::uint64_t size{0U};
+
+  /// The modification time, in nanoseconds; zero if it can't be trusted
+  std::int64_t modification_time{0};
+
+  /// The device containing the file
+  std::uint64_t device{0U};
+
+  /// The inode of the file
+  std::uint64_t inode{0U};
+};
+
+/// How many files each thread fingerprints at once when the batches are
+/// submitted through io_uring
+const std::size_t kFingerprintBatchSize = 64U;
+
+/// Copies the given status; returns false if it does not describe a regular
+/// file
+bool getFileStatus(FileFingerprint &fingerprint,
+                   const BatchedFileStatus &file_status) {
+  if (!file_status.isRegularFile()) {
+    return false;
+  }
+
+  fingerprint.size = file_status.size;
+  fingerprint.modification_time =
+      file_status.modification_time_sec * 1000000000 +
+      static_cast<std::int64_t>(file_status.modification_time_nsec);
+  fingerprint.device = file_status.device;
+  fingerprint.inode = file_status.inode;
+
+  auto current_time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count();
+
+  if (current_time - fingerprint.modification_time <
+      kRacyModificationInterval) {
+    fingerprint.modification_time = 0;
+  }
+
+  return true;
+}
+
+/// Reads the status of the given file; returns false if it is not a
+/// regular file
+bool getFileStatus(FileFingerprint &fingerprint, const std::string &path) {
+  struct stat file_status = {};
+  if (stat(path.c_str(), &file_status) != 0) {
+    return false;
+  }
+
+#if defined(__APPLE__)
+  const auto &modification_time = file_status.st_mtimespec;
+#else
+  const auto &modification_time = file_status.st_mtim;
+#endif
+
+  BatchedFileStatus status;
+  status.mode = static_cast<std::uint32_t>(file_status.st_mode);
+  status.size = static_cast<std::uint64_t>(file_status.st_size);
+  status.modification_time_sec =
+      static_cast<std::int64_t>(modification_time.tv_sec);
+  status.modification_time_nsec =
+      static_cast<std::uint32_t>(modification_time.tv_nsec);
+  status.device = static_cast<std::uint64_t>(file_status.st_dev);
+  status.inode = static_cast<std::uint64_t>(file_status.st_ino);
+
+  return getFileStatus(fingerprint, status);
+}
+
+/// Returns true if both fingerprints describe the same version of a file
+bool isSameFileStatus(const FileFingerprint &lhs, const FileFingerprint &rhs) {
+  return lhs.modification_time != 0 &&
+         lhs.modification_time == rhs.modification_time &&
+         lhs.size == rhs.size && lhs.device == rhs.device &&
+         lhs.inode == rhs.inode;
+}
+}  // namespace
+
+/// Private class data
+struct FileFingerprintIndex::PrivateData final {
+  /// Where the index is persisted; empty if it is kept in memory
+  std::string index_path;
+
+  /// Protects the other members
+  std::mutex mutex;
+
+  /// The fingerprint of each known file, keyed on the path
+  std::unordered_map<std::string, FileFingerprint> fingerprint_map;
+
+  /// The files that have been checked during this run
+  std::unordered_set<std::string> checked_file_set;
+
+  /// The files that could not be read during this run
+  std::unordered_set<std::string> missing_file_set;
+
+  /// How many files have been read and hashed
+  std::atomic_size_t hashed_file_count{0U};
+
+  /// How many files have been found unchanged in the persisted index
+  std::atomic_size_t reused_file_count{0U};
+
+  /// Records the outcome of a file check
+  bool storeFingerprint(ContentHash &hash, const std::string &path,
+                        const FileFingerprint &fingerprint, bool succeeded) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!succeeded) {
+      fingerprint_map.erase(path);
+      missing_file_set.insert(path);
+      return false;
+    }
+
+    fingerprint_map[path] = fingerprint;
+    checked_file_set.insert(path);
+
+    hash = fingerprint.hash;
+    return true;
+  }
+};
+
+FileFingerprintIndex::FileFingerprintIndex(const std::string &index_path)
+    : d(new PrivateData) {
+  d->index_path = index_path;
+  if (index_path.empty()) {
+    return;
+  }
+
+  // A missing or malformed index only means that every file is hashed
+  std::ifstream index_file(index_path);
+
+  std::string line;
+  if (!index_file || !std::getline(index_file, line) ||
+      line != kFingerprintIndexHeader) {
+    return;
+  }
+
+  while (std::getline(index_file, line)) {
+    std::istringstream line_stream(line);
+
+    std::string hash;
+    FileFingerprint fingerprint;
+    line_stream >> hash >> fingerprint.size >> fingerprint.modification_time >>
+        fingerprint.device >> fingerprint.inode;
+
+    std::string path;
+    if (!line_stream || line_stream.get() != ' ' ||
+        !std::getline(line_stream, path) || path.empty() ||
+        !contentHashFromString(fingerprint.hash, hash)) {
+      d->fingerprint_map.clear();
+      return;
+    }
+
+    d->fingerprint_map[path] = fingerprint;
+  }
+}
+
+FileFingerprintIndex::Status FileFingerprintIndex::create(
+    FileFingerprintIndexRef &obj, const std::string &index_path) {
+  obj.reset();
+
+  try {
+    auto ptr = new FileFingerprintIndex(index_path);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+FileFingerprintIndex::~FileFingerprintIndex() {}
+
+bool FileFingerprintIndex::fingerprint(ContentHash &hash,
+                                       const std::string &path) {
+  FileFingerprint previous_fingerprint;
+  bool previous_fingerprint_found = false;
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    if (d->missing_file_set.count(path) != 0U) {
+      return false;
+    }
+
+    auto it = d->fingerprint_map.find(path);
+    if (it != d->fingerprint_map.end()) {
+      if (d->checked_file_set.count(path) != 0U) {
+        hash = it->second.hash;
+        return true;
+      }
+
+      previous_fingerprint = it->second;
+      previous_fingerprint_found = true;
+    }
+  }
+
+  FileFingerprint fingerprint;
+  bool succeeded = getFileStatus(fingerprint, path);
+
+  if (succeeded && previous_fingerprint_found &&
+      isSameFileStatus(previous_fingerprint, fingerprint)) {
+    fingerprint.hash = previous_fingerprint.hash;
+    d->reused_file_count++;
+
+  } else if (succeeded) {
+    // The status is taken first; if the file changes in between, the next
+    // run sees a different status and hashes it again
+    succeeded = hashFileContents(fingerprint.hash, path);
+    d->hashed_file_count++;
+
+  } else {
+    // The files located inside a header archive have no status of their
+    // own; they are hashed from memory each time
+    succeeded = hashFileContents(fingerprint.hash, path);
+  }
+
+  return d->storeFingerprint(hash, path, fingerprint, succeeded);
+}
+
+void FileFingerprintIndex::fingerprintBatch(BatchedFileReader &file_reader,
+                                            const StringList &path_list) {
+  StringList pending_path_list;
+  std::vector<std::pair<FileFingerprint, bool>> previous_fingerprint_list;
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    for (const auto &path : path_list) {
+      if (d->missing_file_set.count(path) != 0U) {
+        continue;
+      }
+
+      auto it = d->fingerprint_map.find(path);
+      if (it == d->fingerprint_map.end()) {
+        previous_fingerprint_list.emplace_back(FileFingerprint(), false);
+
+      } else if (d->checked_file_set.count(path) == 0U) {
+        previous_fingerprint_list.emplace_back(it->second, true);
+
+      } else {
+        continue;
+      }
+
+      pending_path_list.push_back(path);
+    }
+  }
+
+  std::vector<BatchedFileStatus> status_list;
+  file_reader.status(status_list, pending_path_list);
+
+  StringList changed_path_list;
+  std::vector<FileFingerprint> changed_fingerprint_list;
+
+  for (std::size_t i = 0U; i < pending_path_list.size(); ++i) {
+    const auto &path = pending_path_list[i];
+    const auto &previous_fingerprint = previous_fingerprint_list[i];
+
+    ContentHash hash;
+    FileFingerprint file_fingerprint;
+
+    if (!getFileStatus(file_fingerprint, status_list[i])) {
+      // Missing files, and the ones located inside a header archive
+      fingerprint(hash, path);
+
+    } else if (previous_fingerprint.second &&
+               isSameFileStatus(previous_fingerprint.first, file_fingerprint)) {
+      file_fingerprint.hash = previous_fingerprint.first.hash;
+      d->reused_file_count++;
+
+      d->storeFingerprint(hash, path, file_fingerprint, true);
+
+    } else {
+      changed_path_list.push_back(path);
+      changed_fingerprint_list.push_back(file_fingerprint);
+    }
+  }
+
+  std::vector<std::string> contents_list;
+  std::vector<bool> read_file_list;
+  file_reader.read(contents_list, read_file_list, changed_path_list);
+
+  for (std::size_t i = 0U; i < changed_path_list.size(); ++i) {
+    const auto &path = changed_path_list[i];
+    auto &file_fingerprint = changed_fingerprint_list[i];
+
+    ContentHash hash;
+    if (!read_file_list[i]) {
+      fingerprint(hash, path);
+      continue;
+    }
+
+    const auto &contents = contents_list[i];
+    file_fingerprint.hash = hashBuffer(contents.data(), contents.size());
+    d->hashed_file_count++;
+
+    d->storeFingerprint(hash, path, file_fingerprint, true);
+  }
+}
+
+void FileFingerprintIndex::fingerprintFiles(const StringList &path_list,
+                                            std::size_t thread_count) {
+  std::atomic_size_t next_path_index{0U};
+
+  auto L_worker = [&](std::size_t) {
+    // Without io_uring, each file is checked on its own with the blocking
+    // calls, as fingerprint() does
+    BatchedFileReaderRef file_reader;
+    if (!BatchedFileReader::create(file_reader).succeeded() ||
+        !file_reader->usesIoUring()) {
+      file_reader.reset();
+    }
+
+    auto batch_size = file_reader ? kFingerprintBatchSize : 1U;
+
+    while (true) {
+      auto first_path_index = next_path_index.fetch_add(batch_size);
+      if (first_path_index >= path_list.size()) {
+        break;
+      }
+
+      if (!file_reader) {
+        ContentHash hash;
+        fingerprint(hash, path_list[first_path_index]);
+        continue;
+      }
+
+      auto last_path_index =
+          std::min(first_path_index + batch_size, path_list.size());
+
+      fingerprintBatch(*file_reader,
+                       StringList(path_list.begin() + first_path_index,
+                                  path_list.begin() + last_path_index));
+    }
+  };
+
+  thread_count =
+      std::max<std::size_t>(std::min(thread_count, path_list.size()), 1U);
+
+  runTaskLanes(thread_count, TaskPriority::Normal, L_worker);
+}
+
+std::vector<ContentHash> FileFingerprintIndex::includeClosureHashes(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner *header_scanner) {
+  auto header_count = header_files.size();
+  auto dependency_list = getHeaderDependencies(header_files, header_scanner);
+
+  // Each file contributes its path along with its contents, so that moving
+  // a header changes the closures it belongs to
+  std::vector<ContentHash> file_hash_list(header_count);
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    ContentHash content_hash;
+    if (!fingerprint(content_hash, header_files[i].path)) {
+      content_hash = kInitialContentHash;
+    }
+
+    file_hash_list[i] = updateContentHash(
+        updateContentHash(kInitialContentHash, header_files[i].path),
+        content_hash);
+  }
+
+  // The closures may contain cycles, so the hashes of their members are
+  // sorted instead of being combined in traversal order
+  std::vector<ContentHash> closure_hash_list(header_count);
+  std::vector<std::size_t> visit_mark_list(header_count, header_count);
+  std::vector<std::size_t> pending_list;
+  std::vector<ContentHash> member_hash_list;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    visit_mark_list[i] = i;
+    pending_list.assign(1U, i);
+    member_hash_list.clear();
+
+    while (!pending_list.empty()) {
+      auto current_index = pending_list.back();
+      pending_list.pop_back();
+
+      member_hash_list.push_back(file_hash_list[current_index]);
+
+      for (auto dependency : dependency_list[current_index]) {
+        if (visit_mark_list[dependency] != i) {
+          visit_mark_list[dependency] = i;
+          pending_list.push_back(dependency);
+        }
+      }
+    }
+
+    std::sort(member_hash_list.begin() + 1, member_hash_list.end());
+
+    auto closure_hash = kInitialContentHash;
+    for (auto member_hash : member_hash_list) {
+      closure_hash = updateContentHash(closure_hash, member_hash);
+    }
+
+    closure_hash_list[i] = closure_hash;
+  }
+
+  return closure_hash_list;
+}
+
+bool FileFingerprintIndex::save() {
+  if (d->index_path.empty()) {
+    return true;
+  }
+
+  std::vector<std::pair<std::string, FileFingerprint>> fingerprint_list;
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    fingerprint_list.assign(d->fingerprint_map.begin(),
+                            d->fingerprint_map.end());
+  }
+
+  std::sort(fingerprint_list.begin(), fingerprint_list.end(),
+            [](const std::pair<std::string, FileFingerprint> &lhs,
+               const std::pair<std::string, FileFingerprint> &rhs) -> bool {
+              return lhs.first < rhs.first;
+            });
+
+  std::stringstream buffer;
+  buffer << kFingerprintIndexHeader << "\n";
+
+  for (const auto &p : fingerprint_list) {
+    const auto &path = p.first;
+    const auto &fingerprint = p.second;
+
+    // Untrusted timestamps would never match anyway
+    std::error_code error;
+    if (fingerprint.modification_time == 0 || !stdfs::exists(path, error)) {
+      continue;
+    }
+
+    buffer << contentHashToString(fingerprint.hash) << " " << fingerprint.size
+           << " " << fingerprint.modification_time << " "
+           << fingerprint.device << " " << fingerprint.inode << " " << path
+           << "\n";
+  }
+
+  std::error_code error;
+  stdfs::create_directories(stdfs::path(d->index_path).parent_path(), error);
+
+  return writeFileAtomically(d->index_path, buffer.str());
+}
+
+std::size_t FileFingerprintIndex::hashedFileCount() const {
+  return d->hashed_file_count;
+}
+
+std::size_t FileFingerprintIndex::reusedFileCount() const {
+  return d->reused_file_count;
+}
@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "content_hash.h"
+#include "generate_command.h"
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+#include <vector>
+
+class BatchedFileReader;
+class FileFingerprintIndex;
+class HeaderScanner;
+
+/// A reference to a FileFingerprintIndex object
+using FileFingerprintIndexRef = std::shared_ptr<FileFingerprintIndex>;
+
+/// The FileFingerprintIndex computes the content hash of files, and records
+/// the size, modification time and inode of each one along with it; a file
+/// whose status has not changed since it was hashed is not read again. The
+/// index can be persisted, so that the following runs only hash the files
+/// that have been modified. Within a run, each file is checked once
+class FileFingerprintIndex final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  FileFingerprintIndex(const std::string &index_path);
+
+  /// Fingerprints the given files, reading their status and then the
+  /// contents of the changed ones in batches
+  void fingerprintBatch(BatchedFileReader &file_reader,
+                        const StringList &path_list);
+
+ public:
+  /// Status code, used with FileFingerprintIndex::Status
+  enum class StatusCode { MemoryAllocationFailure, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new FileFingerprintIndex object, loading the given index if
+  /// it exists and is valid. An empty path keeps the index in memory
+  static Status create(FileFingerprintIndexRef &obj,
+                       const std::string &index_path = std::string());
+
+  /// Destructor
+  ~FileFingerprintIndex();
+
+  /// Returns the content hash of the given file, as computed by
+  /// hashFileContents(); returns false if the file can't be read. This
+  /// method is thread safe
+  bool fingerprint(ContentHash &hash, const std::string &path);
+
+  /// Fingerprints the given files ahead of time, using the given amount of
+  /// threads; each thread submits its files in batches through io_uring when
+  /// the kernel supports it
+  void fingerprintFiles(const StringList &path_list, std::size_t thread_count);
+
+  /// Returns the hash of the include closure of each header: its own
+  /// contents, and the ones of every candidate header it reaches through its
+  /// include directives, directly or not. The closure hash changes when any
+  /// of these files does; headers outside of the list are not part of it.
+  /// Unreadable files are hashed as empty ones. When a scanner is passed,
+  /// its shared scans provide the include directives
+  std::vector<ContentHash> includeClosureHashes(
+      const std::vector<HeaderDescriptor> &header_files,
+      HeaderScanner *header_scanner = nullptr);
+
+  /// Saves the index, replacing the previous one atomically; files that no
+  /// longer exist are dropped. Does nothing when the index is not persisted
+  bool save();
+
+  /// Returns how many files have been read and hashed
+  std::size_t hashedFileCount() const;
+
+  /// Returns how many files have been found unchanged in the persisted index
+  std::size_t reusedFileCount() const;
+
+  /// Disable the copy constructor
+  FileFingerprintIndex(const FileFingerprintIndex &other) = delete;
+
+  /// Disable the assignment operator
+  FileFingerprintIndex &operator=(const FileFingerprintIndex &other) = delete;
+};
@@ -0,0 +1,412 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_system_cache.h"
+#include "server_metrics.h"
+#include "shared_status_table.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/Path.h>
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace {
+#if LLVM_MAJOR_VERSION <= 7
+namespace vfs = clang::vfs;
+#else
+namespace vfs = llvm::vfs;
+#endif
+
+/// Returns true if the given error means that the path does not exist; only
+/// these errors are cached
+bool isMissingPathError(std::error_code error) {
+  return error == std::errc::no_such_file_or_directory ||
+         error == std::errc::not_a_directory;
+}
+
+/// Returns the cache key for the given path. Relative paths depend on the
+/// working directory, and are not cached; when the folder list is not
+/// empty, only the paths inside one of the folders are cached
+bool getCacheKey(std::string &key, const llvm::Twine &path,
+                 const std::vector<std::string> &cached_folder_list) {
+  key = path.str();
+  if (!llvm::sys::path::is_absolute(key)) {
+    return false;
+  }
+
+  if (cached_folder_list.empty()) {
+    return true;
+  }
+
+  // Remove the ".." components first, so that they can't be used to leave
+  // a cached folder
+  llvm::SmallString<256> normalized_path(key);
+  llvm::sys::path::remove_dots(normalized_path, true);
+  normalized_path.push_back('/');
+
+  for (const auto &folder : cached_folder_list) {
+    if (normalized_path.startswith(folder)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/// Iterates over a cached folder listing
+class CachedFolderIterator final : public vfs::detail::DirIterImpl {
+  /// The folder contents
+  std::shared_ptr<const VirtualFolderEntryList> folder_contents;
+
+  /// The next entry to return
+  std::size_t next_entry_index{0U};
+
+ public:
+  /// Constructor
+  CachedFolderIterator(
+      std::shared_ptr<const VirtualFolderEntryList> folder_contents)
+      : folder_contents(folder_contents) {
+    increment();
+  }
+
+  /// Destructor
+  virtual ~CachedFolderIterator() override = default;
+
+  /// Moves to the next entry; the current entry is cleared at the end
+  virtual std::error_code increment() override {
+    if (next_entry_index >= folder_contents->size()) {
+      CurrentEntry = VirtualFolderEntry();
+    } else {
+      CurrentEntry = folder_contents->at(next_entry_index);
+      ++next_entry_index;
+    }
+
+    return std::error_code();
+  }
+};
+
+/// A virtual file system answering the status and folder queries through a
+/// FileSystemCache object
+class CachingFileSystem final : public VirtualFileSystem {
+  /// The shared cache
+  FileSystemCacheRef file_system_cache;
+
+  /// Handles the misses and the file reads
+  VirtualFileSystemRef base_file_system;
+
+ public:
+  /// Constructor
+  CachingFileSystem(FileSystemCacheRef file_system_cache,
+                    VirtualFileSystemRef base_file_system)
+      : file_system_cache(file_system_cache),
+        base_file_system(base_file_system) {}
+
+  /// Destructor
+  virtual ~CachingFileSystem() override = default;
+
+  /// Returns the status of the given path
+  virtual llvm::ErrorOr<VirtualFileStatus> status(
+      const llvm::Twine &path) override {
+    return file_system_cache->status(*base_file_system, path);
+  }
+
+  /// Opens the given file; files that are known to be missing are rejected
+  /// without querying the base file system
+  virtual llvm::ErrorOr<std::unique_ptr<vfs::File>> openFileForRead(
+      const llvm::Twine &path) override {
+    if (file_system_cache->isMissing(path)) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    auto file_exp = base_file_system->openFileForRead(path);
+    if (file_exp) {
+      file_system_cache->storeStatus(file_exp.get()->status(), path);
+    } else {
+      file_system_cache->storeStatus(file_exp.getError(), path);
+    }
+
+    return file_exp;
+  }
+
+  /// Enumerates the contents of the given folder
+  virtual vfs::directory_iterator dir_begin(const llvm::Twine &path,
+                                            std::error_code &error) override {
+    std::shared_ptr<const VirtualFolderEntryList> folder_contents;
+    error = file_system_cache->folderContents(folder_contents,
+                                              *base_file_system, path);
+
+    if (error) {
+      return vfs::directory_iterator();
+    }
+
+    return vfs::directory_iterator(
+        std::make_shared<CachedFolderIterator>(folder_contents));
+  }
+
+  /// Returns the working directory of the base file system
+  virtual llvm::ErrorOr<std::string> getCurrentWorkingDirectory()
+      const override {
+    return base_file_system->getCurrentWorkingDirectory();
+  }
+
+  /// Sets the working directory of the base file system
+  virtual std::error_code setCurrentWorkingDirectory(
+      const llvm::Twine &path) override {
+    return base_file_system->setCurrentWorkingDirectory(path);
+  }
+};
+}  // namespace
+
+/// Private class data
+struct FileSystemCache::PrivateData final {
+  /// If not empty, only the paths inside these folders are cached; each
+  /// folder ends with a separator
+  std::vector<std::string> cached_folder_list;
+
+  /// Protects the maps and the shared table pointer; lookups only take
+  /// the shared lock
+  std::shared_mutex mutex;
+
+  /// If set, the statuses are also published here, for the other processes
+  SharedStatusTableRef shared_status_table;
+
+  /// The status of each path that has been queried, including the missing
+  /// ones
+  std::unordered_map<std::string, llvm::ErrorOr<VirtualFileStatus>> status_map;
+
+  /// The contents of each folder that has been listed
+  std::unordered_map<std::string, std::shared_ptr<const VirtualFolderEntryList>>
+      folder_map;
+
+  /// Queries answered from memory
+  std::atomic_size_t hit_count{0U};
+
+  /// Queries forwarded to the base file system
+  std::atomic_size_t miss_count{0U};
+};
+
+FileSystemCache::FileSystemCache(
+    const std::vector<std::string> &cached_folder_list)
+    : d(new PrivateData) {
+  for (const auto &folder : cached_folder_list) {
+    llvm::SmallString<256> normalized_folder(folder);
+    llvm::sys::path::remove_dots(normalized_folder, true);
+
+    while (!normalized_folder.empty() && normalized_folder.back() == '/') {
+      normalized_folder.pop_back();
+    }
+
+    // Terminate the path, so that "/a/b" does not match "/a/bc"
+    normalized_folder.push_back('/');
+    d->cached_folder_list.push_back(normalized_folder.str().str());
+  }
+}
+
+FileSystemCache::~FileSystemCache() {}
+
+llvm::ErrorOr<VirtualFileStatus> FileSystemCache::status(
+    VirtualFileSystem &base_file_system, const llvm::Twine &path) {
+  std::string key;
+  if (!getCacheKey(key, path, d->cached_folder_list)) {
+    d->miss_count++;
+    addServerCounter(ServerCounter::FileSystemCacheMisses);
+    return base_file_system.status(path);
+  }
+
+  {
+    std::shared_lock<std::shared_mutex> lock(d->mutex);
+
+    auto it = d->status_map.find(key);
+    if (it != d->status_map.end()) {
+      d->hit_count++;
+      addServerCounter(ServerCounter::FileSystemCacheHits);
+      return it->second;
+    }
+  }
+
+  // The entries published by the other processes are copied to the local
+  // map, which is faster to query
+  llvm::ErrorOr<VirtualFileStatus> shared_status =
+      std::make_error_code(std::errc::no_such_file_or_directory);
+
+  if (lookupSharedStatus(shared_status, key)) {
+    d->hit_count++;
+    addServerCounter(ServerCounter::FileSystemCacheHits);
+
+    std::unique_lock<std::shared_mutex> lock(d->mutex);
+    d->status_map.insert({key, shared_status});
+
+    return shared_status;
+  }
+
+  d->miss_count++;
+  addServerCounter(ServerCounter::FileSystemCacheMisses);
+
+  auto status = base_file_system.status(path);
+  if (status || isMissingPathError(status.getError())) {
+    saveStatus(status, key);
+  }
+
+  return status;
+}
+
+bool FileSystemCache::isMissing(const llvm::Twine &path) {
+  std::string key;
+  if (!getCacheKey(key, path, d->cached_folder_list)) {
+    return false;
+  }
+
+  {
+    std::shared_lock<std::shared_mutex> lock(d->mutex);
+
+    auto it = d->status_map.find(key);
+    if (it != d->status_map.end()) {
+      if (it->second) {
+        return false;
+      }
+
+      d->hit_count++;
+      addServerCounter(ServerCounter::FileSystemCacheHits);
+      return true;
+    }
+  }
+
+  llvm::ErrorOr<VirtualFileStatus> shared_status =
+      std::make_error_code(std::errc::no_such_file_or_directory);
+
+  if (!lookupSharedStatus(shared_status, key) || shared_status) {
+    return false;
+  }
+
+  d->hit_count++;
+  addServerCounter(ServerCounter::FileSystemCacheHits);
+  return true;
+}
+
+void FileSystemCache::storeStatus(
+    const llvm::ErrorOr<VirtualFileStatus> &status, const llvm::Twine &path) {
+  std::string key;
+  if (!getCacheKey(key, path, d->cached_folder_list)) {
+    return;
+  }
+
+  if (!status && !isMissingPathError(status.getError())) {
+    return;
+  }
+
+  saveStatus(status, key);
+}
+
+bool FileSystemCache::lookupSharedStatus(
+    llvm::ErrorOr<VirtualFileStatus> &status, const std::string &key) {
+  std::shared_lock<std::shared_mutex> lock(d->mutex);
+
+  return d->shared_status_table &&
+         d->shared_status_table->lookup(status, key);
+}
+
+void FileSystemCache::saveStatus(const llvm::ErrorOr<VirtualFileStatus> &status,
+                                 const std::string &key) {
+  std::unique_lock<std::shared_mutex> lock(d->mutex);
+
+  auto insert_status = d->status_map.insert({key, status});
+  if (insert_status.second && d->shared_status_table) {
+    d->shared_status_table->insert(status, key);
+  }
+}
+
+bool FileSystemCache::enableProcessSharing() {
+  std::unique_lock<std::shared_mutex> lock(d->mutex);
+
+  if (d->shared_status_table) {
+    return true;
+  }
+
+  if (!SharedStatusTable::create(d->shared_status_table).succeeded()) {
+    return false;
+  }
+
+  // The statuses found so far are already known to this process, but not
+  // to the ones it will fork
+  for (const auto &p : d->status_map) {
+    d->shared_status_table->insert(p.second, p.first);
+  }
+
+  return true;
+}
+
+std::error_code FileSystemCache::folderContents(
+    std::shared_ptr<const VirtualFolderEntryList> &folder_contents,
+    VirtualFileSystem &base_file_system, const llvm::Twine &path) {
+  folder_contents.reset();
+
+  std::string key;
+  auto cacheable = getCacheKey(key, path, d->cached_folder_list);
+
+  if (cacheable) {
+    std::shared_lock<std::shared_mutex> lock(d->mutex);
+
+    auto it = d->folder_map.find(key);
+    if (it != d->folder_map.end()) {
+      d->hit_count++;
+      addServerCounter(ServerCounter::FileSystemCacheHits);
+
+      folder_contents = it->second;
+      return std::error_code();
+    }
+  }
+
+  d->miss_count++;
+  addServerCounter(ServerCounter::FileSystemCacheMisses);
+
+  std::error_code error;
+  auto output = std::make_shared<VirtualFolderEntryList>();
+
+  for (auto it = base_file_system.dir_begin(path, error);
+       !error && it != vfs::directory_iterator(); it.increment(error)) {
+    output->push_back(*it);
+  }
+
+  if (error) {
+    return error;
+  }
+
+  if (cacheable) {
+    std::unique_lock<std::shared_mutex> lock(d->mutex);
+    d->folder_map.insert({key, output});
+  }
+
+  folder_contents = output;
+  return std::error_code();
+}
+
+std::size_t FileSystemCache::hitCount() const { return d->hit_count; }
+
+std::size_t FileSystemCache::missCount() const { return d->miss_count; }
+
+VirtualFileSystemRef createCachingFileSystem(
+    FileSystemCacheRef file_system_cache,
+    VirtualFileSystemRef base_file_system) {
+  if (!base_file_system) {
+    base_file_system = vfs::getRealFileSystem();
+  }
+
+  return VirtualFileSystemRef(
+      new CachingFileSystem(file_system_cache, base_file_system));
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "virtual_file_system.h"
+
+#include <llvm/ADT/Twine.h>
+#include <llvm/Support/ErrorOr.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class FileSystemCache;
+
+/// A reference to a FileSystemCache object
+using FileSystemCacheRef = std::shared_ptr<FileSystemCache>;
+
+/// A list of folder entries
+using VirtualFolderEntryList = std::vector<VirtualFolderEntry>;
+
+/// The FileSystemCache remembers the outcome of the stat() calls and of the
+/// folder listings made by clang, including the failed lookups, so that they
+/// are performed only once per run. The same object is meant to be shared by
+/// all the compiler instances, including the ones used by parallel probes;
+/// all methods are thread safe. Files are assumed not to change during the
+/// run, unless the cache is restricted to a list of folders; only the paths
+/// inside them are then remembered
+class FileSystemCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Looks up the given key in the shared table, if enabled
+  bool lookupSharedStatus(llvm::ErrorOr<VirtualFileStatus> &status,
+                          const std::string &key);
+
+  /// Saves the status of the given key in the map and in the shared table
+  void saveStatus(const llvm::ErrorOr<VirtualFileStatus> &status,
+                  const std::string &key);
+
+ public:
+  /// Constructor; if the folder list is not empty, only the paths inside
+  /// these folders are cached, and the other queries are always forwarded to
+  /// the base file system
+  FileSystemCache(const std::vector<std::string> &cached_folder_list = {});
+
+  /// Destructor
+  ~FileSystemCache();
+
+  /// Returns the status of the given path, querying the base file system
+  /// only the first time
+  llvm::ErrorOr<VirtualFileStatus> status(VirtualFileSystem &base_file_system,
+                                          const llvm::Twine &path);
+
+  /// Returns true if the given path is known to be missing; used to fail
+  /// file opens without querying the base file system
+  bool isMissing(const llvm::Twine &path);
+
+  /// Records the outcome of a file open; errors other than missing paths are
+  /// ignored
+  void storeStatus(const llvm::ErrorOr<VirtualFileStatus> &status,
+                   const llvm::Twine &path);
+
+  /// Returns the contents of the given folder, querying the base file system
+  /// only the first time
+  std::error_code folderContents(
+      std::shared_ptr<const VirtualFolderEntryList> &folder_contents,
+      VirtualFileSystem &base_file_system, const llvm::Twine &path);
+
+  /// Publishes the statuses in a shared memory table, which is inherited by
+  /// the processes forked afterwards (such as the forked probes); the
+  /// statuses found by any of them are then answered from memory by all the
+  /// others. The folder listings are not shared. Returns false if the table
+  /// can't be created
+  bool enableProcessSharing();
+
+  /// Returns the amount of queries that have been answered from memory
+  std::size_t hitCount() const;
+
+  /// Returns the amount of queries that have been forwarded to the base file
+  /// system
+  std::size_t missCount() const;
+
+  /// Disable the copy constructor
+  FileSystemCache(const FileSystemCache &other) = delete;
+
+  /// Disable the assignment operator
+  FileSystemCache &operator=(const FileSystemCache &other) = delete;
+};
+
+/// Creates a virtual file system that answers the status and folder queries
+/// through the given cache, forwarding the misses and the file reads to the
+/// base file system (or the real one, if not set)
+VirtualFileSystemRef createCachingFileSystem(
+    FileSystemCacheRef file_system_cache,
+    VirtualFileSystemRef base_file_system = VirtualFileSystemRef());
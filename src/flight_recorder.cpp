@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "flight_recorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// The longest dump path that is accepted, including the terminator
+const std::size_t kMaxDumpPathSize = 4096U;
+
+/// The first line of each dump
+const char kFlightRecorderDumpHeader[] = "abigen-flight-recorder 1\n";
+
+/// An event of the ring buffer
+struct FlightEvent final {
+  /// The index of the event plus one once it has been written, zero while
+  /// it is being written
+  std::atomic<std::uint64_t> sequence{0U};
+
+  /// When the event has been recorded, in microseconds since the recorder
+  /// has been created
+  std::uint64_t time{0U};
+
+  /// The thread that recorded the event
+  std::uint32_t thread_index{0U};
+
+  /// The event type
+  FlightEventType type{FlightEventType::PhaseStarted};
+
+  /// The event detail, truncated and terminated
+  char detail[kFlightEventDetailSize];
+};
+
+/// The state shared with the writers and the signal handlers
+struct FlightBuffer final {
+  /// The ring buffer; null when no recorder is active
+  std::atomic<FlightEvent *> event_list{nullptr};
+
+  /// The ring buffer size minus one; the size is a power of two
+  std::size_t index_mask{0U};
+
+  /// The index of the next event
+  std::atomic<std::uint64_t> next_event_index{0U};
+
+  /// How many threads are writing an event
+  std::atomic_int active_writer_count{0};
+
+  /// When the recorder has been created
+  std::chrono::steady_clock::time_point start_time;
+
+  /// Where the dumps are written, terminated
+  char dump_path[kMaxDumpPathSize];
+
+  /// Set while a dump is being written
+  std::atomic_bool dump_in_progress{false};
+
+  /// How many dumps have been written
+  std::atomic_size_t dump_count{0U};
+};
+
+/// The buffer of the active recorder
+FlightBuffer flight_buffer;
+
+/// Set while a FlightRecorder object exists
+std::atomic_bool recorder_created{false};
+
+/// Set while the events are being recorded
+std::atomic_bool recorder_active{false};
+
+/// Assigns a small index to each thread that records an event
+std::atomic<std::uint32_t> next_thread_index{0U};
+
+/// The index of the calling thread
+thread_local std::uint32_t thread_index{next_thread_index++};
+
+/// Returns the name under which the given event type is saved
+const char *getFlightEventTypeName(FlightEventType type) {
+  switch (type) {
+    case FlightEventType::PhaseStarted:
+      return "phase_started";
+
+    case FlightEventType::PhaseFinished:
+      return "phase_finished";
+
+    case FlightEventType::ProbeStarted:
+      return "probe_started";
+
+    case FlightEventType::ProbeFinished:
+      return "probe_finished";
+
+    case FlightEventType::ProbeCacheMiss:
+      return "probe_cache_miss";
+
+    case FlightEventType::PCHCacheMiss:
+      return "pch_cache_miss";
+
+    case FlightEventType::CompileCacheMiss:
+      return "compile_cache_miss";
+  }
+
+  return "unknown";
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+/// The signals that save the events before terminating the process
+const int kCrashSignalList[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+/// The reasons written in the dumps, one for each crash signal
+const char *const kCrashSignalNameList[] = {"SIGSEGV", "SIGBUS", "SIGILL",
+                                            "SIGFPE", "SIGABRT"};
+
+/// How many crash signals there are
+const std::size_t kCrashSignalCount =
+    sizeof(kCrashSignalList) / sizeof(kCrashSignalList[0]);
+
+/// The handlers installed before the recorder, restored before the crash
+/// signals are raised again
+struct sigaction previous_crash_action_list[kCrashSignalCount];
+
+/// The SIGUSR1 handler installed before the recorder
+struct sigaction previous_dump_action;
+
+/// Formats the dump in a fixed buffer, and writes it with write(); nothing
+/// here allocates memory or takes locks, so it can run in a signal handler
+class DumpWriter final {
+  /// The file descriptor of the dump
+  int fd;
+
+  /// The pending output
+  char buffer[4096];
+
+  /// How much of the buffer is used
+  std::size_t size{0U};
+
+  /// Set when a write fails
+  bool failed{false};
+
+ public:
+  /// Constructor
+  DumpWriter(int fd) : fd(fd) {}
+
+  /// Writes the pending output
+  void flush() {
+    std::size_t offset = 0U;
+
+    while (offset < size && !failed) {
+      auto written = ::write(fd, buffer + offset, size - offset);
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+
+      if (written <= 0) {
+        failed = true;
+        break;
+      }
+
+      offset += static_cast<std::size_t>(written);
+    }
+
+    size = 0U;
+  }
+
+  /// Appends the given characters
+  void append(const char *text, std::size_t length) {
+    while (length != 0U) {
+      if (size == sizeof(buffer)) {
+        flush();
+      }
+
+      auto chunk_size = std::min(length, sizeof(buffer) - size);
+      std::memcpy(buffer + size, text, chunk_size);
+
+      size += chunk_size;
+      text += chunk_size;
+      length -= chunk_size;
+    }
+  }
+
+  /// Appends the given string
+  void append(const char *text) { append(text, std::strlen(text)); }
+
+  /// Appends the given number in decimal, padded with zeros to the given
+  /// width
+  void append(std::uint64_t value, std::size_t width = 1U) {
+    char digit_list[20];
+    std::size_t digit_count = 0U;
+
+    do {
+      digit_list[digit_count++] = static_cast<char>('0' + (value % 10U));
+      value /= 10U;
+    } while (value != 0U);
+
+    for (; digit_count < width && digit_count < sizeof(digit_list);
+         ++digit_count) {
+      digit_list[digit_count] = '0';
+    }
+
+    while (digit_count != 0U) {
+      append(&digit_list[--digit_count], 1U);
+    }
+  }
+
+  /// Returns true if all the output has been written
+  bool succeeded() const { return !failed; }
+};
+#endif
+
+/// Saves the events in the ring buffer, oldest first. This is called by
+/// the signal handlers, so it only uses async-signal-safe functions; the
+/// events that are being overwritten while the dump runs are skipped
+bool dumpFlightEvents(const char *reason) {
+#if defined(__linux__) || defined(__APPLE__)
+  auto event_list = flight_buffer.event_list.load(std::memory_order_acquire);
+  if (event_list == nullptr || flight_buffer.dump_in_progress.exchange(true)) {
+    return false;
+  }
+
+  auto fd = ::open(flight_buffer.dump_path,
+                   O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    flight_buffer.dump_in_progress = false;
+    return false;
+  }
+
+  DumpWriter writer(fd);
+  writer.append(kFlightRecorderDumpHeader);
+  writer.append("reason ");
+  writer.append(reason);
+  writer.append("\n");
+
+  auto capacity = static_cast<std::uint64_t>(flight_buffer.index_mask) + 1U;
+  auto last_index = flight_buffer.next_event_index.load();
+  auto first_index = (last_index > capacity) ? last_index - capacity : 0U;
+
+  for (auto index = first_index; index < last_index; ++index) {
+    const auto &event = event_list[index & flight_buffer.index_mask];
+
+    auto sequence = event.sequence.load(std::memory_order_acquire);
+    if (sequence != index + 1U) {
+      continue;
+    }
+
+    auto time = event.time;
+    auto event_thread_index = event.thread_index;
+    auto type = event.type;
+
+    char detail[kFlightEventDetailSize];
+    std::memcpy(detail, event.detail, sizeof(detail));
+    detail[kFlightEventDetailSize - 1U] = '\0';
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (event.sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+
+    writer.append(time / 1000000U);
+    writer.append(".");
+    writer.append(time % 1000000U, 6U);
+    writer.append(" ");
+    writer.append(event_thread_index);
+    writer.append(" ");
+    writer.append(getFlightEventTypeName(type));
+    writer.append(" ");
+    writer.append(detail);
+    writer.append("\n");
+  }
+
+  writer.flush();
+
+  auto succeeded = writer.succeeded() && ::close(fd) == 0;
+  if (succeeded) {
+    ++flight_buffer.dump_count;
+  }
+
+  flight_buffer.dump_in_progress = false;
+  return succeeded;
+
+#else
+  static_cast<void>(reason);
+  return false;
+#endif
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+/// Saves the events, then hands the signal to the handler that was
+/// installed before the recorder
+void crashSignalHandler(int signal_number) {
+  for (std::size_t i = 0U; i < kCrashSignalCount; ++i) {
+    if (kCrashSignalList[i] != signal_number) {
+      continue;
+    }
+
+    dumpFlightEvents(kCrashSignalNameList[i]);
+
+    sigaction(signal_number, &previous_crash_action_list[i], nullptr);
+    raise(signal_number);
+    return;
+  }
+}
+
+/// Saves the events and lets the process continue
+void dumpSignalHandler(int) {
+  auto saved_errno = errno;
+  dumpFlightEvents("SIGUSR1");
+  errno = saved_errno;
+}
+#endif
+}  // namespace
+
+/// Private class data
+struct FlightRecorder::PrivateData final {
+  /// The ring buffer
+  std::unique_ptr<FlightEvent[]> event_list;
+
+  /// The run deadline, in seconds; zero if there is none
+  std::size_t deadline{0U};
+
+  /// Protects the stop flag
+  std::mutex watchdog_mutex;
+
+  /// Wakes up the watchdog when the recorder is destroyed
+  std::condition_variable watchdog_cv;
+
+  /// Set when the recorder is destroyed
+  bool stop_watchdog{false};
+
+  /// Saves the events once the deadline has passed
+  std::thread watchdog;
+};
+
+FlightRecorder::FlightRecorder(const std::string &dump_path,
+                               std::size_t deadline, std::size_t capacity)
+    : d(new PrivateData) {
+#if defined(__linux__) || defined(__APPLE__)
+  if (dump_path.empty() || dump_path.size() >= kMaxDumpPathSize) {
+    throw Status(false, StatusCode::Unknown,
+                 "Invalid flight recorder dump path: " + dump_path);
+  }
+
+  if (recorder_created.exchange(true)) {
+    throw Status(false, StatusCode::AlreadyActive,
+                 "Another flight recorder is already active");
+  }
+
+  std::size_t event_count = 1U;
+  while (event_count < capacity) {
+    event_count <<= 1U;
+  }
+
+  try {
+    d->event_list.reset(new FlightEvent[event_count]);
+
+  } catch (const std::bad_alloc &) {
+    recorder_created = false;
+    throw Status(false, StatusCode::MemoryAllocationFailure);
+  }
+
+  std::memcpy(flight_buffer.dump_path, dump_path.c_str(),
+              dump_path.size() + 1U);
+
+  flight_buffer.index_mask = event_count - 1U;
+  flight_buffer.next_event_index = 0U;
+  flight_buffer.dump_count = 0U;
+  flight_buffer.start_time = std::chrono::steady_clock::now();
+  flight_buffer.event_list.store(d->event_list.get(),
+                                 std::memory_order_release);
+
+  struct sigaction action = {};
+  action.sa_handler = crashSignalHandler;
+  action.sa_flags = SA_NODEFER;
+  sigemptyset(&action.sa_mask);
+
+  auto handlers_installed = true;
+  std::size_t installed_count = 0U;
+
+  for (; installed_count < kCrashSignalCount; ++installed_count) {
+    if (sigaction(kCrashSignalList[installed_count], &action,
+                  &previous_crash_action_list[installed_count]) != 0) {
+      handlers_installed = false;
+      break;
+    }
+  }
+
+  if (handlers_installed) {
+    action.sa_handler = dumpSignalHandler;
+    action.sa_flags = SA_RESTART;
+
+    handlers_installed =
+        sigaction(SIGUSR1, &action, &previous_dump_action) == 0;
+  }
+
+  if (!handlers_installed) {
+    for (std::size_t i = 0U; i < installed_count; ++i) {
+      sigaction(kCrashSignalList[i], &previous_crash_action_list[i], nullptr);
+    }
+
+    flight_buffer.event_list = nullptr;
+    recorder_created = false;
+
+    throw Status(false, StatusCode::SignalError,
+                 "Failed to install the flight recorder signal handlers");
+  }
+
+  recorder_active = true;
+
+  d->deadline = deadline;
+  if (deadline == 0U) {
+    return;
+  }
+
+  d->watchdog = std::thread([this]() {
+    {
+      std::unique_lock<std::mutex> lock(d->watchdog_mutex);
+
+      auto stopped = d->watchdog_cv.wait_for(
+          lock, std::chrono::seconds(d->deadline),
+          [this]() -> bool { return d->stop_watchdog; });
+
+      if (stopped) {
+        return;
+      }
+    }
+
+    if (dumpFlightEvents("deadline")) {
+      std::cerr << "Flight recorder: the run exceeded " << d->deadline
+                << " seconds; the recent events have been saved to "
+                << flight_buffer.dump_path << "\n";
+    }
+  });
+
+#else
+  static_cast<void>(dump_path);
+  static_cast<void>(deadline);
+  static_cast<void>(capacity);
+
+  throw Status(false, StatusCode::NotSupported,
+               "The flight recorder is not supported on this platform");
+#endif
+}
+
+FlightRecorder::Status FlightRecorder::create(FlightRecorderRef &obj,
+                                              const std::string &dump_path,
+                                              std::size_t deadline,
+                                              std::size_t capacity) {
+  obj.reset();
+
+  try {
+    auto ptr = new FlightRecorder(dump_path, deadline, capacity);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+FlightRecorder::~FlightRecorder() {
+#if defined(__linux__) || defined(__APPLE__)
+  if (d->watchdog.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(d->watchdog_mutex);
+      d->stop_watchdog = true;
+    }
+
+    d->watchdog_cv.notify_all();
+    d->watchdog.join();
+  }
+
+  recorder_active = false;
+
+  for (std::size_t i = 0U; i < kCrashSignalCount; ++i) {
+    sigaction(kCrashSignalList[i], &previous_crash_action_list[i], nullptr);
+  }
+
+  sigaction(SIGUSR1, &previous_dump_action, nullptr);
+
+  // Wait for the dumps and for the writers that are still copying an
+  // event, so that the buffer can be released
+  flight_buffer.event_list = nullptr;
+
+  while (flight_buffer.dump_in_progress.load() ||
+         flight_buffer.active_writer_count.load() != 0) {
+    std::this_thread::yield();
+  }
+
+  recorder_created = false;
+#endif
+}
+
+bool FlightRecorder::active() { return recorder_active; }
+
+void FlightRecorder::deactivateInChildProcess() {
+#if defined(__linux__) || defined(__APPLE__)
+  if (!recorder_active) {
+    return;
+  }
+
+  // The buffer belongs to the copy of the recorder inherited from the
+  // parent, which is never destroyed since the child does not return
+  recorder_active = false;
+  flight_buffer.event_list = nullptr;
+
+  for (std::size_t i = 0U; i < kCrashSignalCount; ++i) {
+    sigaction(kCrashSignalList[i], &previous_crash_action_list[i], nullptr);
+  }
+
+  sigaction(SIGUSR1, &previous_dump_action, nullptr);
+#endif
+}
+
+bool FlightRecorder::dump() { return dumpFlightEvents("request"); }
+
+std::size_t FlightRecorder::dumpCount() const {
+  return flight_buffer.dump_count;
+}
+
+void recordFlightEvent(FlightEventType type, const char *detail,
+                       std::size_t detail_size) {
+  if (!recorder_active.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  ++flight_buffer.active_writer_count;
+
+  auto event_list = flight_buffer.event_list.load(std::memory_order_acquire);
+  if (event_list == nullptr) {
+    --flight_buffer.active_writer_count;
+    return;
+  }
+
+  auto index = flight_buffer.next_event_index.fetch_add(
+      1U, std::memory_order_relaxed);
+
+  auto &event = event_list[index & flight_buffer.index_mask];
+  event.sequence.store(0U, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  event.time = static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - flight_buffer.start_time)
+          .count());
+
+  event.thread_index = thread_index;
+  event.type = type;
+
+  detail_size = std::min(detail_size, kFlightEventDetailSize - 1U);
+  std::memcpy(event.detail, detail, detail_size);
+  event.detail[detail_size] = '\0';
+
+  event.sequence.store(index + 1U, std::memory_order_release);
+
+  --flight_buffer.active_writer_count;
+}
+
+void recordFlightEvent(FlightEventType type, const std::string &detail) {
+  recordFlightEvent(type, detail.data(), detail.size());
+}
+
+ScopedFlightEvent::ScopedFlightEvent(FlightEventType start_type,
+                                     const std::string &event_detail)
+    : finish_type(start_type == FlightEventType::PhaseStarted
+                      ? FlightEventType::PhaseFinished
+                      : FlightEventType::ProbeFinished) {
+  if (!FlightRecorder::active()) {
+    return;
+  }
+
+  enabled = true;
+
+  detail_size = std::min(event_detail.size(), kFlightEventDetailSize - 1U);
+  std::memcpy(detail, event_detail.data(), detail_size);
+
+  recordFlightEvent(start_type, detail, detail_size);
+}
+
+ScopedFlightEvent::~ScopedFlightEvent() {
+  if (enabled) {
+    recordFlightEvent(finish_type, detail, detail_size);
+  }
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/// How many bytes of the event details are kept, including the terminator
+const std::size_t kFlightEventDetailSize = 96U;
+
+/// The kinds of events kept by the flight recorder
+enum class FlightEventType : std::uint8_t {
+  PhaseStarted,
+  PhaseFinished,
+  ProbeStarted,
+  ProbeFinished,
+  ProbeCacheMiss,
+  PCHCacheMiss,
+  CompileCacheMiss
+};
+
+class FlightRecorder;
+
+/// A reference to a FlightRecorder object
+using FlightRecorderRef = std::unique_ptr<FlightRecorder>;
+
+/// The FlightRecorder keeps the most recent events of the run in a ring
+/// buffer of fixed size, so that a slow or crashed run can be investigated
+/// without running it again with tracing enabled. Recording an event copies
+/// a few bytes into the buffer, without locks or allocations. The buffer is
+/// saved to disk when the process receives a crash signal (SIGSEGV, SIGBUS,
+/// SIGILL, SIGFPE or SIGABRT) or SIGUSR1, and when the run exceeds its
+/// deadline. Only one recorder can be active at a time
+class FlightRecorder final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  FlightRecorder(const std::string &dump_path, std::size_t deadline,
+                 std::size_t capacity);
+
+ public:
+  /// Status code, used with FlightRecorder::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    AlreadyActive,
+    NotSupported,
+    SignalError,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Starts recording; the events are saved to the given path, replacing
+  /// the previous dump. If the deadline (in seconds) is not zero, the events
+  /// are also saved once the run has lasted that long. The capacity is
+  /// rounded up to a power of two
+  static Status create(FlightRecorderRef &obj, const std::string &dump_path,
+                       std::size_t deadline = 0U,
+                       std::size_t capacity = 8192U);
+
+  /// Destructor; stops recording and restores the signal handlers
+  ~FlightRecorder();
+
+  /// Returns true if a recorder is active
+  static bool active();
+
+  /// Stops recording in a child process forked by the one owning the
+  /// recorder, restoring the signal handlers installed before it; a crash of
+  /// the child must not replace the dump of the parent, which has not
+  /// crashed. Only call this from the child
+  static void deactivateInChildProcess();
+
+  /// Saves the recorded events now; returns false if they could not be
+  /// written, or if another dump is in progress
+  bool dump();
+
+  /// Returns how many times the events have been saved
+  std::size_t dumpCount() const;
+
+  /// Disable the copy constructor
+  FlightRecorder(const FlightRecorder &other) = delete;
+
+  /// Disable the assignment operator
+  FlightRecorder &operator=(const FlightRecorder &other) = delete;
+};
+
+/// Records an event in the active flight recorder; the detail (a phase
+/// name, a header path, ...) is truncated to kFlightEventDetailSize - 1
+/// bytes. Nothing is done when no recorder is active
+void recordFlightEvent(FlightEventType type, const char *detail,
+                       std::size_t detail_size);
+
+/// Records an event in the active flight recorder; see the other overload
+void recordFlightEvent(FlightEventType type, const std::string &detail);
+
+/// Records a start event when created and the matching finish event when
+/// destroyed. Nothing is done when no recorder is active
+class ScopedFlightEvent final {
+  /// The event recorded by the destructor
+  FlightEventType finish_type;
+
+  /// The detail of both events, truncated like the one of the recorded
+  /// events, so that no memory is allocated
+  char detail[kFlightEventDetailSize];
+
+  /// How many bytes of the detail are used
+  std::size_t detail_size{0U};
+
+  /// True if the start event has been recorded
+  bool enabled{false};
+
+ public:
+  /// Constructor; the type is the one of the start event, either
+  /// FlightEventType::PhaseStarted or FlightEventType::ProbeStarted
+  ScopedFlightEvent(FlightEventType start_type, const std::string &detail);
+
+  /// Destructor
+  ~ScopedFlightEvent();
+
+  /// Disable the copy constructor
+  ScopedFlightEvent(const ScopedFlightEvent &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedFlightEvent &operator=(const ScopedFlightEvent &other) = delete;
+};
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "function_filter.h"
+
+#include <clang/AST/DeclCXX.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/Regex.h>
+
+namespace {
+/// Compiles the given expressions, anchored at both ends
+bool compileExpressionList(std::vector<std::unique_ptr<llvm::Regex>> &output,
+                           std::string &error_message,
+                           const StringList &expression_list) {
+  output.clear();
+
+  for (const auto &expression : expression_list) {
+    auto regex = llvm::make_unique<llvm::Regex>("^(" + expression + ")$");
+
+    std::string regex_error;
+    if (!regex->isValid(regex_error)) {
+      error_message =
+          "Invalid regular expression '" + expression + "': " + regex_error;
+      return false;
+    }
+
+    output.push_back(std::move(regex));
+  }
+
+  return true;
+}
+
+/// Returns true if any of the given expressions matches the string
+bool matchesAny(const std::vector<std::unique_ptr<llvm::Regex>> &regex_list,
+                llvm::StringRef str) {
+  for (const auto &regex : regex_list) {
+    if (regex->match(str)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+}  // namespace
+
+/// Private class data
+struct FunctionNameFilter::PrivateData final {
+  /// Matched against the enclosing namespace of each function
+  std::vector<std::unique_ptr<llvm::Regex>> include_namespace_list;
+
+  /// Matched against the qualified name of each function
+  std::vector<std::unique_ptr<llvm::Regex>> exclude_name_list;
+};
+
+FunctionNameFilter::FunctionNameFilter(const StringList &include_namespace_list,
+                                       const StringList &exclude_name_list)
+    : d(new PrivateData) {
+  std::string error_message;
+  if (!compileExpressionList(d->include_namespace_list, error_message,
+                             include_namespace_list) ||
+      !compileExpressionList(d->exclude_name_list, error_message,
+                             exclude_name_list)) {
+    throw Status(false, StatusCode::InvalidExpression, error_message);
+  }
+}
+
+FunctionNameFilter::Status FunctionNameFilter::create(
+    FunctionNameFilterRef &obj, const StringList &include_namespace_list,
+    const StringList &exclude_name_list) {
+  obj.reset();
+
+  if (include_namespace_list.empty() && exclude_name_list.empty()) {
+    return Status(true);
+  }
+
+  try {
+    auto ptr = new FunctionNameFilter(include_namespace_list,
+                                      exclude_name_list);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+FunctionNameFilter::~FunctionNameFilter() {}
+
+bool FunctionNameFilter::accepts(
+    const clang::FunctionDecl *declaration) const {
+  if (!d->include_namespace_list.empty()) {
+    // Methods belong to the namespace of their class
+    std::string namespace_name;
+
+    auto context =
+        declaration->getDeclContext()->getEnclosingNamespaceContext();
+
+    if (auto namespace_decl = llvm::dyn_cast<clang::NamespaceDecl>(context)) {
+      namespace_name = namespace_decl->getQualifiedNameAsString();
+    }
+
+    if (!matchesAny(d->include_namespace_list, namespace_name)) {
+      return false;
+    }
+  }
+
+  if (!d->exclude_name_list.empty() &&
+      matchesAny(d->exclude_name_list,
+                 declaration->getQualifiedNameAsString())) {
+    return false;
+  }
+
+  return true;
+}
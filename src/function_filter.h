@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+
+#include <clang/AST/Decl.h>
+
+class FunctionNameFilter;
+
+/// A reference to a FunctionNameFilter object
+using FunctionNameFilterRef = std::shared_ptr<const FunctionNameFilter>;
+
+/// Selects the functions analyzed by the AST visitor, using regular
+/// expressions matched against the whole qualified names. A function is
+/// analyzed when its enclosing namespace (i.e.: boost::asio, or an empty
+/// string for the global namespace) matches one of the included namespace
+/// expressions, if any, and its qualified name (i.e.: ns::Class::method)
+/// matches none of the excluded name expressions. Anonymous namespaces are
+/// spelled "(anonymous namespace)"
+class FunctionNameFilter final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  FunctionNameFilter(const StringList &include_namespace_list,
+                     const StringList &exclude_name_list);
+
+ public:
+  /// Status code, used with FunctionNameFilter::Status
+  enum class StatusCode { MemoryAllocationFailure, InvalidExpression };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Compiles the given expressions; obj is left empty when both lists are
+  /// empty, since every function would be accepted
+  static Status create(FunctionNameFilterRef &obj,
+                       const StringList &include_namespace_list,
+                       const StringList &exclude_name_list);
+
+  /// Destructor
+  ~FunctionNameFilter();
+
+  /// Returns true if the given function should be analyzed. This method is
+  /// thread safe
+  bool accepts(const clang::FunctionDecl *declaration) const;
+
+  /// Disable the copy constructor
+  FunctionNameFilter(const FunctionNameFilter &other) = delete;
+
+  /// Disable the assignment operator
+  FunctionNameFilter &operator=(const FunctionNameFilter &other) = delete;
+};
@@ -15,135 +15,4521 @@
  */
 
 #include "generate_command.h"
+#include "abi_database.h"
 #include "abi_lib_generator.h"
+#include "analysis_cache.h"
+#include "analysis_shards.h"
+#include "ast_snapshot.h"
 #include "astvisitor.h"
+#include "binary_symbols.h"
+#include "event_stream.h"
+#include "file_fingerprints.h"
+#include "flight_recorder.h"
 #include "generate_utils.h"
+#include "header_dependencies.h"
+#include "header_lockfile.h"
+#include "header_prefetch.h"
+#include "header_scanner.h"
+#include "header_watcher.h"
+#include "huge_pages.h"
+#include "output_capture.h"
+#include "output_file.h"
+#include "pch_cache.h"
+#include "probe_checkpoint.h"
+#include "probe_executor.h"
+#include "probe_strategy.h"
+#include "remote_probes.h"
+#include "resident_state.h"
+#include "sample_profiler.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+#include "time_report.h"
+#include "type_summary.h"
+#include "worker_placement.h"
 
-/// Handler for the 'generate' command
-bool generateCommandHandler(ProfileManagerRef &profile_manager,
-                            const LanguageManager &language_manager,
-                            const CommandLineOptions &cmdline_options) {
-  // Start by enumerating all the include files
-  std::vector<HeaderDescriptor> header_files;
-  if (!enumerateIncludeFiles(header_files, cmdline_options.header_folders)) {
-    return false;
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <csignal>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace {
+/// How many threads read ahead the headers; the prefetch is bound by the
+/// disk, not by the amount of cores
+const std::size_t kHeaderPrefetchThreadCount = 4U;
+
+/// How many headers the automatic strategy selection probes
+const std::size_t kStrategySampleSize = 24U;
+
+/// How many runs a header can go unused before the probe history forgets it
+const std::size_t kProbeHistoryMaxIdleRunCount = 16U;
+
+/// Returns how the clang state of the probes, or of the final pass, is
+/// released. Leaking the state of every probe would exhaust the memory, so
+/// only the final pass of a run that exits afterwards is leaked
+ClangTeardown getClangTeardown(const CommandLineOptions &cmdline_options,
+                               bool final_pass) {
+  if (cmdline_options.clang_teardown == "destroy") {
+    return ClangTeardown::Destroy;
   }
 
-  // Allocate a new compiler instance
-  CompilerInstanceRef compiler;
-  if (!createCompilerInstance(compiler, profile_manager, language_manager,
-                              cmdline_options)) {
-    return false;
+  if (cmdline_options.clang_teardown == "leak" && final_pass &&
+      !cmdline_options.watch && !cmdline_options.resident_state) {
+    return ClangTeardown::Leak;
   }
 
-  // Attempt to include as many headers as possible; stop when we can no longer
-  // add new ones to the list of active ones. We do not care about the AST right
-  // now! Just try to pass the compilation
-  std::cerr << "Processed headers\n\n";
-  std::string total_header_count_str = std::to_string(header_files.size());
-  auto header_counter_digits = static_cast<int>(total_header_count_str.size());
+  return ClangTeardown::Background;
+}
 
-  StringList active_include_headers;
+/// Moves the headers that the lockfile lists as discarded, and whose include
+/// closures have not changed since, out of the header list; the closure
+/// hashes are keyed on the header path
+std::vector<HeaderDescriptor> takeLockedHeaders(
+    std::vector<HeaderDescriptor> &header_files, const HeaderLockfile &lockfile,
+    const std::unordered_map<std::string, ContentHash> &closure_hash_map) {
+  std::vector<bool> locked_header_flags(header_files.size(), false);
+  std::vector<HeaderDescriptor> locked_header_files;
 
-  while (true) {
-    auto previous_active_header_count = active_include_headers.size();
-    for (auto header_desc_it = header_files.begin();
-         header_desc_it != header_files.end();) {
-      auto possible_include_directives =
-          generateIncludeDirectives(*header_desc_it);
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    const auto &header_desc = header_files[i];
 
-      bool include_succeeded = false;
-      for (const auto &include_directive : possible_include_directives) {
-        auto new_include_headers = active_include_headers;
-        new_include_headers.push_back(include_directive);
+    auto it = lockfile.discarded_header_map.find(header_desc.path);
+    if (it == lockfile.discarded_header_map.end()) {
+      continue;
+    }
+
+    auto hash_it = closure_hash_map.find(header_desc.path);
+    if (hash_it != closure_hash_map.end() && hash_it->second == it->second) {
+      locked_header_flags[i] = true;
+      locked_header_files.push_back(header_desc);
+    }
+  }
 
-        auto source_buffer = generateSourceBuffer(
-            new_include_headers, cmdline_options.base_includes);
+  removeFlaggedHeaders(header_files, locked_header_flags);
+  return locked_header_files;
+}
 
-        auto compiler_status = compiler->processAST(source_buffer);
-        include_succeeded = compiler_status.succeeded();
+/// Sorts the headers using the outcome recorded by the previous run: the
+/// ones it accepted come first, in acceptance order, followed by the new
+/// headers and then by the ones it discarded. Headers that the lockfile does
+/// not mention, but that have never been accepted by the probes recorded in
+/// the cost model, are ranked as discarded ones. Headers are otherwise kept
+/// in their original order. Returns how many headers were accepted and
+/// discarded by the previous runs
+std::pair<std::size_t, std::size_t> sortHeadersByHistory(
+    std::vector<HeaderDescriptor> &header_files,
+    const HeaderLockfile &lockfile, ProbeExecutor &probe_executor,
+    const ProbeCostModel &probe_cost_model) {
+  std::unordered_map<std::string, std::size_t> accepted_position_map;
+  for (std::size_t i = 0U; i < lockfile.include_list.size(); ++i) {
+    accepted_position_map.insert({lockfile.include_list[i], i});
+  }
 
-        if (include_succeeded) {
-          active_include_headers.push_back(include_directive);
+  // Accepted headers are ranked by position, and the others follow them
+  const auto new_header_rank = lockfile.include_list.size();
+  const auto discarded_header_rank = new_header_rank + 1U;
 
-          std::cerr << "  [" << std::setfill('0')
-                    << std::setw(header_counter_digits)
-                    << active_include_headers.size();
+  std::vector<std::size_t> header_rank_list;
+  std::size_t accepted_count = 0U;
+  std::size_t discarded_count = 0U;
 
-          std::cerr << "/" << total_header_count_str << "] "
-                    << include_directive << "\n";
+  for (const auto &header_desc : header_files) {
+    auto rank = new_header_rank;
 
-          break;
-        }
+    for (const auto &directive :
+         probe_executor.includeDirectives(header_desc)) {
+      auto it = accepted_position_map.find(directive);
+      if (it != accepted_position_map.end()) {
+        rank = std::min(rank, it->second);
       }
+    }
+
+    double acceptance_ratio = 0.0;
+    if (rank != new_header_rank) {
+      ++accepted_count;
+
+    } else if (lockfile.discarded_header_map.count(header_desc.path) != 0U ||
+               (probe_cost_model.estimateAcceptance(acceptance_ratio,
+                                                    header_desc.path) &&
+                acceptance_ratio == 0.0)) {
+      rank = discarded_header_rank;
+      ++discarded_count;
+    }
+
+    header_rank_list.push_back(rank);
+  }
+
+  std::vector<std::size_t> header_index_list(header_files.size());
+  for (std::size_t i = 0U; i < header_index_list.size(); ++i) {
+    header_index_list[i] = i;
+  }
+
+  std::stable_sort(header_index_list.begin(), header_index_list.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return header_rank_list[lhs] < header_rank_list[rhs];
+                   });
+
+  std::vector<HeaderDescriptor> sorted_header_files;
+  sorted_header_files.reserve(header_files.size());
+
+  for (auto header_index : header_index_list) {
+    sorted_header_files.push_back(std::move(header_files[header_index]));
+  }
+
+  header_files = std::move(sorted_header_files);
+  return {accepted_count, discarded_count};
+}
+
+/// Sorts the headers by the amount of functions they declare, according to
+/// the given header scanner, in descending order; headers declaring the
+/// same amount keep their order. The headers that have not been scanned yet
+/// are scanned by the given amount of threads
+void sortHeadersByFunctionCount(std::vector<HeaderDescriptor> &header_files,
+                                HeaderScanner &header_scanner,
+                                std::size_t thread_count) {
+  StringList header_path_list;
+  for (const auto &header_desc : header_files) {
+    header_path_list.push_back(header_desc.path);
+  }
+
+  header_scanner.scanFiles(header_path_list, thread_count);
+
+  std::vector<std::size_t> function_count_list(header_files.size(), 0U);
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    auto header_scan = header_scanner.scan(header_files[i].path);
+    if (header_scan) {
+      function_count_list[i] = header_scan->function_name_list.size();
+    }
+  }
+
+  std::vector<std::size_t> header_index_list(header_files.size());
+  for (std::size_t i = 0U; i < header_index_list.size(); ++i) {
+    header_index_list[i] = i;
+  }
+
+  std::stable_sort(header_index_list.begin(), header_index_list.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return function_count_list[lhs] >
+                            function_count_list[rhs];
+                   });
+
+  std::vector<HeaderDescriptor> sorted_header_files;
+  sorted_header_files.reserve(header_files.size());
+
+  for (auto header_index : header_index_list) {
+    sorted_header_files.push_back(std::move(header_files[header_index]));
+  }
+
+  header_files = std::move(sorted_header_files);
+}
+
+/// Restores the include list and the pending headers saved by a checkpoint.
+/// The include list is compiled once, to make sure that it is still
+/// accepted; returns false, leaving both lists untouched, if the checkpoint
+/// can't be resumed
+bool restoreProbeCheckpoint(StringList &active_include_headers,
+                            std::vector<HeaderDescriptor> &header_files,
+                            const ProbeCheckpoint &checkpoint,
+                            ProbeExecutor &probe_executor) {
+  std::unordered_map<std::string, std::size_t> header_index_map;
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    header_index_map.insert({header_files[i].path, i});
+  }
+
+  std::vector<HeaderDescriptor> pending_header_files;
+  for (const auto &header_path : checkpoint.header_path_list) {
+    auto it = header_index_map.find(header_path);
+    if (it == header_index_map.end()) {
+      return false;
+    }
+
+    pending_header_files.push_back(header_files[it->second]);
+  }
+
+  if (!checkpoint.include_list.empty() &&
+      !probe_executor.probeIncludeList(StringList(),
+                                       checkpoint.include_list)) {
+    return false;
+  }
+
+  active_include_headers = checkpoint.include_list;
+  header_files = std::move(pending_header_files);
+
+  return true;
+}
+
+/// Drops the accepted headers that no longer compile together, which can
+/// happen when the acceptance order was not monotonic. The shortest failing
+/// prefix of the include list is found with a binary search, and its last
+/// directive is moved to the dropped list; this is repeated until the whole
+/// list compiles, or until the drop limit is reached. The probe cache is not
+/// used, as it would return the outcomes recorded when the headers were
+/// accepted. The callback receives the include list after each drop.
+/// Returns true if the remaining list compiles
+bool dropConflictingIncludeDirectives(
+    StringList &include_list, StringList &dropped_list, std::size_t drop_limit,
+    ProbeExecutor &probe_executor,
+    const std::function<void(const StringList &)> &drop_callback) {
+  std::vector<std::size_t> attributed_directive_list;
+
+  auto L_prefixCompiles = [&](std::size_t count) -> bool {
+    StringList prefix(include_list.begin(),
+                      std::next(include_list.begin(),
+                                static_cast<std::ptrdiff_t>(count)));
+
+    attributed_directive_list.clear();
+    return probe_executor.attributeIncludeList(StringList(), prefix,
+                                               attributed_directive_list);
+  };
 
-      if (include_succeeded) {
-        header_desc_it = header_files.erase(header_desc_it);
+  // Dropping a directive does not change the ones preceding it, so the
+  // prefix known to compile stays valid across the iterations
+  std::size_t compiling_count = 0U;
+
+  while (!L_prefixCompiles(include_list.size())) {
+    if (dropped_list.size() >= drop_limit) {
+      return false;
+    }
+
+    auto failing_count = include_list.size();
+    while (failing_count - compiling_count > 1U) {
+      auto middle = compiling_count + (failing_count - compiling_count) / 2U;
+
+      if (L_prefixCompiles(middle)) {
+        compiling_count = middle;
       } else {
-        header_desc_it++;
+        failing_count = middle;
       }
     }
 
-    if (previous_active_header_count == active_include_headers.size()) {
-      break;
+    auto culprit_it =
+        std::next(include_list.begin(),
+                  static_cast<std::ptrdiff_t>(failing_count - 1U));
+
+    dropped_list.push_back(std::move(*culprit_it));
+    include_list.erase(culprit_it);
+
+    if (drop_callback) {
+      drop_callback(include_list);
     }
   }
 
-  std::cerr << "\n";
+  return true;
+}
 
-  // Print a list of the headers we couldn't import
-  if (!header_files.empty()) {
-    std::cerr << "Discarded headers\n\n";
-    for (const auto &header : header_files) {
-      std::cerr << "  {\"";
-      for (auto it = header.possible_prefixes.begin();
-           it != header.possible_prefixes.end(); it++) {
-        std::cerr << (*it);
-        if (std::next(it, 1) != header.possible_prefixes.end()) {
-          std::cerr << ", ";
+/// Accepts the longest prefix of the given header order (the include list
+/// accepted by another profile) that compiles on top of the active includes.
+/// The whole list is tried first, since most headers behave the same across
+/// profiles; otherwise the prefix is found with a binary search. Accepted
+/// headers are removed from the header list, along with the ones they
+/// include when a tracker is passed. When verify is false, the whole list is
+/// accepted without compiling it. Returns how many headers were accepted
+std::size_t applyHeaderOrderHypothesis(
+    StringList &active_include_headers,
+    std::vector<HeaderDescriptor> &header_files, const StringList &header_order,
+    ProbeExecutor &probe_executor,
+    const AcceptedHeaderCallback &accepted_header_callback,
+    IncludedHeaderTracker *included_header_tracker, bool verify = true) {
+  // Match the include directives against the headers of this profile; the
+  // ones that no longer map to a pending header are dropped
+  std::unordered_map<std::string, std::size_t> header_index_map;
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    for (const auto &directive :
+         probe_executor.includeDirectives(header_files[i])) {
+      header_index_map.insert({directive, i});
+    }
+  }
+
+  StringList candidate_list;
+  std::vector<std::size_t> candidate_index_list;
+  std::vector<bool> accepted_header_flags(header_files.size(), false);
+
+  for (const auto &directive : header_order) {
+    auto it = header_index_map.find(directive);
+    if (it == header_index_map.end() || accepted_header_flags[it->second]) {
+      continue;
+    }
+
+    candidate_list.push_back(directive);
+    candidate_index_list.push_back(it->second);
+    accepted_header_flags[it->second] = true;
+  }
+
+  std::fill(accepted_header_flags.begin(), accepted_header_flags.end(), false);
+
+  auto L_probePrefix = [&](std::size_t count,
+                           StringList &included_header_list) -> bool {
+    StringList prefix(candidate_list.begin(),
+                      std::next(candidate_list.begin(),
+                                static_cast<std::ptrdiff_t>(count)));
+
+    return probe_executor.probeIncludeList(active_include_headers, prefix,
+                                           &included_header_list);
+  };
+
+  std::size_t accepted_count = 0U;
+  StringList included_header_list;
+
+  if (!verify) {
+    accepted_count = candidate_list.size();
+
+  } else if (!candidate_list.empty() &&
+             L_probePrefix(candidate_list.size(), included_header_list)) {
+    accepted_count = candidate_list.size();
+
+  } else {
+    // An empty prefix always compiles, and the whole list does not
+    std::size_t good_count = 0U;
+    auto bad_count = candidate_list.size();
+
+    while (bad_count - good_count > 1U) {
+      auto middle = good_count + (bad_count - good_count) / 2U;
+
+      StringList prefix_included_header_list;
+      if (L_probePrefix(middle, prefix_included_header_list)) {
+        good_count = middle;
+        included_header_list = std::move(prefix_included_header_list);
+      } else {
+        bad_count = middle;
+      }
+    }
+
+    accepted_count = good_count;
+  }
+
+  for (std::size_t i = 0U; i < accepted_count; ++i) {
+    active_include_headers.push_back(candidate_list[i]);
+    accepted_header_flags[candidate_index_list[i]] = true;
+
+    accepted_header_callback(active_include_headers);
+  }
+
+  if (included_header_tracker != nullptr && accepted_count != 0U) {
+    included_header_tracker->markIncludedHeaders(
+        accepted_header_flags, header_files, included_header_list);
+  }
+
+  removeFlaggedHeaders(header_files, accepted_header_flags);
+  return accepted_count;
+}
+
+/// Probes each header on top of the accepted headers it reaches through its
+/// include directives, in the order they have been accepted, instead of the
+/// whole include list; consecutive headers with the same prefix are probed
+/// together. Rejected headers are probed again when their prefix grows.
+/// The header list is left untouched: the accepted include directives are
+/// returned in acceptance order, and have to be confirmed together with
+/// applyHeaderOrderHypothesis()
+StringList runMinimalPrefixProbes(
+    const std::vector<HeaderDescriptor> &header_files,
+    ProbeExecutor &probe_executor, HeaderScanner *header_scanner = nullptr) {
+  auto dependency_list = getHeaderDependencies(header_files, header_scanner);
+
+  std::vector<bool> accepted_header_flags(header_files.size(), false);
+  std::vector<std::size_t> accepted_header_index_list;
+  StringList accepted_include_list;
+
+  // The prefix size of the last probe of each header; prefixes only grow,
+  // so a header whose prefix has the same size can't change its outcome
+  const auto kNeverProbed = std::numeric_limits<std::size_t>::max();
+  std::vector<std::size_t> probed_prefix_size_list(header_files.size(),
+                                                   kNeverProbed);
+
+  auto L_minimalPrefix = [&](std::size_t header_index) -> StringList {
+    std::vector<bool> reached_header_flags(header_files.size(), false);
+    std::vector<std::size_t> pending_header_list = {header_index};
+
+    while (!pending_header_list.empty()) {
+      auto current_index = pending_header_list.back();
+      pending_header_list.pop_back();
+
+      for (auto dependency_index : dependency_list[current_index]) {
+        if (!reached_header_flags[dependency_index]) {
+          reached_header_flags[dependency_index] = true;
+          pending_header_list.push_back(dependency_index);
         }
       }
-      std::cerr << "\"} " << header.name << "\n";
     }
-    std::cerr << "\n";
+
+    StringList prefix;
+    for (std::size_t i = 0U; i < accepted_header_index_list.size(); ++i) {
+      if (reached_header_flags[accepted_header_index_list[i]]) {
+        prefix.push_back(accepted_include_list[i]);
+      }
+    }
+
+    return prefix;
+  };
+
+  auto L_needsProbe = [&](std::size_t header_index,
+                          const StringList &prefix) -> bool {
+    return !accepted_header_flags[header_index] &&
+           probed_prefix_size_list[header_index] != prefix.size();
+  };
+
+  bool accepted_new_header = true;
+
+  while (accepted_new_header) {
+    accepted_new_header = false;
+
+    std::size_t header_index = 0U;
+    while (header_index < header_files.size()) {
+      auto prefix = L_minimalPrefix(header_index);
+      if (!L_needsProbe(header_index, prefix)) {
+        ++header_index;
+        continue;
+      }
+
+      ProbeRequestList request_list = {&header_files[header_index]};
+      std::vector<std::size_t> request_index_list = {header_index};
+
+      auto next_header_index = header_index + 1U;
+      while (next_header_index < header_files.size() &&
+             request_list.size() < probe_executor.workerCount()) {
+        auto next_prefix = L_minimalPrefix(next_header_index);
+
+        if (L_needsProbe(next_header_index, next_prefix)) {
+          if (next_prefix != prefix) {
+            break;
+          }
+
+          request_list.push_back(&header_files[next_header_index]);
+          request_index_list.push_back(next_header_index);
+        }
+
+        ++next_header_index;
+      }
+
+      auto result_list = probe_executor.probe(prefix, request_list);
+
+      for (std::size_t i = 0U; i < result_list.size(); ++i) {
+        auto request_index = request_index_list[i];
+        probed_prefix_size_list[request_index] = prefix.size();
+
+        if (!result_list[i].succeeded) {
+          continue;
+        }
+
+        accepted_header_flags[request_index] = true;
+        accepted_header_index_list.push_back(request_index);
+        accepted_include_list.push_back(result_list[i].include_directive);
+
+        accepted_new_header = true;
+      }
+
+      header_index = next_header_index;
+    }
+  }
+
+  return accepted_include_list;
+}
+
+/// Runs a separate fixpoint probe loop for each connected component of the
+/// include graph. The components are probed concurrently, each thread with
+/// its own probe executor and an equal share of the workers; every loop
+/// starts from an empty include list, and uses the minimal prefix probes
+/// when requested. The header list is left untouched: the accepted include
+/// directives are returned grouped by component, in component order, and
+/// have to be confirmed together with applyHeaderOrderHypothesis()
+bool runComponentProbes(StringList &accepted_include_list,
+                        std::size_t &component_count,
+                        const std::vector<HeaderDescriptor> &header_files,
+                        const ProbeExecutorSettings &probe_executor_settings,
+                        bool minimal_probe_prefix,
+                        HeaderScanner *header_scanner = nullptr) {
+  accepted_include_list.clear();
+
+  auto component_list = getHeaderComponents(header_files, header_scanner);
+  component_count = component_list.size();
+
+  if (component_list.empty()) {
+    return true;
+  }
+
+  auto thread_count = std::max<std::size_t>(
+      1U,
+      std::min(probe_executor_settings.worker_count, component_list.size()));
+
+  // The remote workers, the probe recorder and the event stream stay with
+  // the main executor
+  auto component_settings = probe_executor_settings;
+  component_settings.worker_count = std::max<std::size_t>(
+      1U, probe_executor_settings.worker_count / thread_count);
+  component_settings.memory_budget =
+      probe_executor_settings.memory_budget / thread_count;
+  component_settings.remote_worker_list.clear();
+  component_settings.probe_recorder.reset();
+  component_settings.event_stream.reset();
+  component_settings.retain_parsed_translation_unit = false;
+
+  // The largest components are started first, so that they do not end up
+  // running alone at the end
+  std::vector<std::size_t> component_order(component_list.size());
+  for (std::size_t i = 0U; i < component_order.size(); ++i) {
+    component_order[i] = i;
+  }
+
+  std::stable_sort(component_order.begin(), component_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return component_list[lhs].size() >
+                            component_list[rhs].size();
+                   });
+
+  std::vector<StringList> component_include_lists(component_list.size());
+  std::atomic_size_t next_component{0U};
+
+  std::mutex error_message_mutex;
+  std::string error_message;
+
+  auto L_worker = [&](std::size_t) {
+    ProbeExecutorRef probe_executor;
+    auto status = ProbeExecutor::create(probe_executor, component_settings);
+    if (!status.succeeded()) {
+      std::lock_guard<std::mutex> lock(error_message_mutex);
+      error_message = status.toString();
+      return;
+    }
+
+    ProbeStrategyContext strategy_context;
+    strategy_context.probe_executor = probe_executor.get();
+
+    ProbeStrategyRef probe_strategy;
+    ProbeStrategy::create(probe_strategy, "sequential", strategy_context);
+
+    while (true) {
+      auto order_index = next_component.fetch_add(1U);
+      if (order_index >= component_order.size()) {
+        break;
+      }
+
+      auto component_index = component_order[order_index];
+
+      std::vector<HeaderDescriptor> component_header_files;
+      for (auto header_index : component_list[component_index]) {
+        component_header_files.push_back(header_files[header_index]);
+      }
+
+      auto &component_include_list = component_include_lists[component_index];
+
+      if (minimal_probe_prefix) {
+        component_include_list = runMinimalPrefixProbes(
+            component_header_files, *probe_executor, header_scanner);
+
+      } else {
+        probe_strategy->run(component_include_list, component_header_files);
+      }
+    }
+  };
+
+  runTaskLanes(thread_count, TaskPriority::High, L_worker);
+
+  if (!error_message.empty()) {
+    std::cerr << error_message << "\n";
+    return false;
+  }
+
+  for (const auto &component_include_list : component_include_lists) {
+    accepted_include_list.insert(accepted_include_list.end(),
+                                 component_include_list.begin(),
+                                 component_include_list.end());
+  }
+
+  return true;
+}
+
+/// Runs the AST visitor on the given source buffer, moving the results into
+/// the ABI library. When more than one shard is requested, each shard is
+/// analyzed by its own compiler instance on a separate thread, and the
+/// results are merged afterwards. If passed, the dependency list receives
+/// the path of each file that has been read
+bool runFinalAnalysis(ABILibrary &abi_library, const std::string &source_buffer,
+                      const CompilerInstanceSettings &compiler_settings,
+                      ASTVisitorSettings visitor_settings,
+                      std::size_t shard_count,
+                      const TimeReportRef &time_report,
+                      bool collect_clang_time_trace,
+                      StringList *dependency_list = nullptr,
+                      WorkerPlacement worker_placement =
+                          WorkerPlacement::None) {
+  // Returns an empty string on success
+  auto L_analyzeShard = [&](ABILibrary &shard_library,
+                            std::size_t shard_index) -> std::string {
+    IASTVisitorRef visitor_ref;
+    auto visitor_status = ASTVisitor::create(visitor_ref, visitor_settings);
+    if (!visitor_status.succeeded()) {
+      return "Failed to create the ASTVisitor object: " +
+             visitor_status.toString();
+    }
+
+    auto shard_compiler_settings = compiler_settings;
+    shard_compiler_settings.shard_count = shard_count;
+    shard_compiler_settings.shard_index = shard_index;
+    shard_compiler_settings.traverse_while_parsing =
+        visitor_settings.analyze_while_parsing;
+
+    CompilerInstanceRef compiler;
+    auto compiler_status =
+        CompilerInstance::create(compiler, shard_compiler_settings);
+    if (!compiler_status.succeeded()) {
+      return compiler_status.toString();
+    }
+
+    // The clang time trace is not thread safe on every LLVM version, so it
+    // is only collected when the analysis is not sharded and no other final
+    // pass is running at the same time
+    auto clang_time_trace = time_report && collect_clang_time_trace &&
+                            shard_count <= 1U &&
+                            time_report->startClangTimeTrace();
+
+    // Every shard reads the same files
+    Stopwatch stopwatch;
+    compiler_status = compiler->processAST(
+        source_buffer, visitor_ref,
+        shard_index == 0U ? dependency_list : nullptr);
+
+    if (time_report) {
+      if (clang_time_trace) {
+        time_report->stopClangTimeTrace("clang (final AST pass)");
+      }
+
+      TraceSpan trace_span;
+      trace_span.name = "processAST";
+      trace_span.category = "final";
+      trace_span.start_time = stopwatch.startTime();
+      trace_span.duration = stopwatch.elapsed().wall_time;
+      trace_span.argument_map = {
+          {"shard", std::to_string(shard_index)},
+          {"outcome", compiler_status.succeeded() ? "succeeded" : "failed"}};
+
+      time_report->addSpan(std::move(trace_span));
+    }
+
+    if (!compiler_status.succeeded()) {
+      return compiler_status.toString();
+    }
+
+    visitor_ref->takeResults(shard_library);
+    return std::string();
+  };
+
+  if (shard_count <= 1U) {
+    auto error_message = L_analyzeShard(abi_library, 0U);
+    if (!error_message.empty()) {
+      std::cerr << error_message << "\n";
+      return false;
+    }
+
+    return true;
   }
 
-  // We now have a list of includes that work fine; enable the AST callbacks
+  // Duplicated names can span multiple shards, so they are detected by the
+  // merge step
+  visitor_settings.defer_duplicate_detection = true;
+
+  std::vector<ABILibrary> shard_list(shard_count);
+  std::vector<std::string> error_message_list(shard_count);
+
+  runParallelFor(shard_count, shard_count, TaskPriority::Normal,
+                 [&](std::size_t i) {
+                   ScopedWorkerPlacement placement(worker_placement, i);
+                   error_message_list[i] = L_analyzeShard(shard_list[i], i);
+                 });
+
+  bool succeeded = true;
+  for (const auto &error_message : error_message_list) {
+    if (!error_message.empty()) {
+      std::cerr << error_message << "\n";
+      succeeded = false;
+    }
+  }
+
+  if (!succeeded) {
+    return false;
+  }
+
+  mergeAnalysisShards(abi_library, shard_list);
+  return true;
+}
+
+/// Returns true if the given translation unit, built by a probe, can be
+/// visited by the final analysis instead of parsing the source buffer again:
+/// it must have been parsed from the same buffer, with settings that build
+/// the same AST, and without modules
+bool canReuseParsedTranslationUnit(
+    const ParsedTranslationUnit &parsed_unit, const std::string &source_buffer,
+    const CompilerInstanceSettings &compiler_settings) {
+  const auto &unit_settings = parsed_unit.settings();
+
+  return parsed_unit.sourceBuffer() == source_buffer &&
+         hashCompilerInstanceSettings(unit_settings) ==
+             hashCompilerInstanceSettings(compiler_settings) &&
+         unit_settings.precompiled_header ==
+             compiler_settings.precompiled_header &&
+         compiler_settings.module_cache_path.empty();
+}
+
+/// Runs the AST visitor on a translation unit that has already been parsed,
+/// moving the results into the ABI library; see runFinalAnalysis
+bool runParsedAnalysis(ABILibrary &abi_library,
+                       ParsedTranslationUnit &parsed_unit,
+                       const CompilerInstanceSettings &compiler_settings,
+                       const ASTVisitorSettings &visitor_settings,
+                       const TimeReportRef &time_report,
+                       StringList *dependency_list = nullptr) {
   IASTVisitorRef visitor_ref;
-  auto visitor_status = ASTVisitor::create(visitor_ref);
+  auto visitor_status = ASTVisitor::create(visitor_ref, visitor_settings);
   if (!visitor_status.succeeded()) {
     std::cerr << "Failed to create the ASTVisitor object: "
               << visitor_status.toString() << "\n";
     return false;
   }
 
-  // Compile the source buffer one last time with our ASTVisitor enabled
-  auto source_buffer = generateSourceBuffer(active_include_headers,
-                                            cmdline_options.base_includes);
+  Stopwatch stopwatch;
+  auto compiler_status =
+      parsed_unit.visit(visitor_ref, compiler_settings, dependency_list);
+
+  if (time_report) {
+    TraceSpan trace_span;
+    trace_span.name = "visit";
+    trace_span.category = "final";
+    trace_span.start_time = stopwatch.startTime();
+    trace_span.duration = stopwatch.elapsed().wall_time;
+    trace_span.argument_map = {
+        {"outcome", compiler_status.succeeded() ? "succeeded" : "failed"}};
+
+    time_report->addSpan(std::move(trace_span));
+  }
 
-  auto compiler_status = compiler->processAST(source_buffer, visitor_ref);
   if (!compiler_status.succeeded()) {
     std::cerr << compiler_status.toString() << "\n";
     return false;
   }
 
-  // Render the ABI library
-  Profile profile;
-  auto prof_mgr_status =
-      profile_manager->get(profile, cmdline_options.profile_name);
+  visitor_ref->takeResults(abi_library);
+  return true;
+}
 
-  assert(prof_mgr_status.succeeded());
+/// Analyzes the accepted headers between the given positions of the include
+/// list in their own translation unit. Headers that do not compile on their
+/// own are compiled again on top of the headers preceding them, and the
+/// prefixed flag is set. If passed, the dependency list receives the path of
+/// each file that has been read
+bool analyzeHeaderGroup(ABILibrary &abi_library, bool &prefixed,
+                        const StringList &include_list,
+                        std::size_t group_begin, std::size_t group_end,
+                        const StringList &base_includes,
+                        const CompilerInstanceSettings &compiler_settings,
+                        const ASTVisitorSettings &visitor_settings,
+                        const TimeReportRef &time_report,
+                        StringList *dependency_list = nullptr) {
+  prefixed = false;
 
-  ABILibrary abi_library;
-  abi_library.blacklisted_function_list = visitor_ref->blacklistedFunctions();
-  abi_library.whitelisted_function_list = visitor_ref->whitelistedFunctions();
-  abi_library.header_list = active_include_headers;
+  auto L_analyzeGroup = [&](std::size_t begin) -> bool {
+    auto source_buffer = generateSourceBuffer(
+        StringList(
+            std::next(include_list.begin(),
+                      static_cast<std::ptrdiff_t>(begin)),
+            std::next(include_list.begin(),
+                      static_cast<std::ptrdiff_t>(group_end))),
+        base_includes);
 
-  auto status = generateABILibrary(cmdline_options, abi_library, profile);
-  if (!status.succeeded()) {
-    std::cerr << status.message() << "\n";
+    return runFinalAnalysis(abi_library, source_buffer, compiler_settings,
+                            visitor_settings, 1U, time_report, false,
+                            dependency_list);
+  };
+
+  if (L_analyzeGroup(group_begin)) {
+    return true;
+  }
+
+  if (group_begin == 0U) {
     return false;
   }
 
-  return true;
+  prefixed = true;
+
+  abi_library = {};
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  return L_analyzeGroup(0U);
+}
+
+/// Merges the results of the analyzed groups, along with the files they
+/// have read, which are deduplicated
+void mergeHeaderGroups(ABILibrary &abi_library,
+                       std::vector<ABILibrary> &group_list,
+                       std::vector<StringList> &group_dependency_list,
+                       StringList *dependency_list) {
+  if (dependency_list != nullptr) {
+    std::unordered_set<std::string> dependency_set;
+
+    for (auto &group_dependencies : group_dependency_list) {
+      for (auto &path : group_dependencies) {
+        if (dependency_set.insert(path).second) {
+          dependency_list->push_back(std::move(path));
+        }
+      }
+    }
+  }
+
+  mergeAnalysisShards(abi_library, group_list);
+}
+
+/// Runs the final analysis on consecutive groups of the accepted headers,
+/// each one in its own translation unit, and merges the results; the peak
+/// memory usage is then bounded by the largest group rather than by the
+/// whole library. Up to the given amount of groups are analyzed at the same
+/// time. Groups that do not compile on their own are compiled again on top
+/// of the headers preceding them; the functions these headers declare are
+/// merged with the copies found by the previous groups. If passed, the
+/// dependency list receives the path of each file that has been read
+bool runGroupedFinalAnalysis(ABILibrary &abi_library,
+                             const StringList &include_list,
+                             const StringList &base_includes,
+                             const CompilerInstanceSettings &compiler_settings,
+                             ASTVisitorSettings visitor_settings,
+                             std::size_t group_size, std::size_t worker_count,
+                             const TimeReportRef &time_report,
+                             StringList *dependency_list = nullptr) {
+  // The same function is usually found by more than one group, since the
+  // groups share the headers they include
+  visitor_settings.defer_duplicate_detection = true;
+
+  auto group_count = (include_list.size() + group_size - 1U) / group_size;
+  worker_count = std::max(std::min(worker_count, group_count), std::size_t(1U));
+
+  std::vector<ABILibrary> group_list(group_count);
+  std::vector<StringList> group_dependency_list(group_count);
+  std::vector<bool> group_failure_list(group_count, false);
+
+  std::atomic_size_t next_group_index{0U};
+  std::atomic_size_t prefixed_group_count{0U};
+
+  auto L_worker = [&](std::size_t) {
+    while (true) {
+      auto group_index = next_group_index++;
+      if (group_index >= group_count) {
+        break;
+      }
+
+      auto group_begin = group_index * group_size;
+      auto group_end = std::min(group_begin + group_size, include_list.size());
+
+      bool prefixed = false;
+      if (!analyzeHeaderGroup(
+              group_list[group_index], prefixed, include_list, group_begin,
+              group_end, base_includes, compiler_settings, visitor_settings,
+              time_report,
+              dependency_list != nullptr ? &group_dependency_list[group_index]
+                                         : nullptr)) {
+        group_failure_list[group_index] = true;
+      }
+
+      if (prefixed) {
+        ++prefixed_group_count;
+      }
+    }
+  };
+
+  runTaskLanes(worker_count, TaskPriority::Normal, L_worker);
+
+  if (std::find(group_failure_list.begin(), group_failure_list.end(), true) !=
+      group_failure_list.end()) {
+    return false;
+  }
+
+  std::cerr << "Analysis groups: " << group_count << " groups of up to "
+            << group_size << " headers, " << prefixed_group_count
+            << " compiled on top of the previous headers\n\n";
+
+  mergeHeaderGroups(abi_library, group_list, group_dependency_list,
+                    dependency_list);
+
+  return true;
+}
+
+/// Analyzes the groups of accepted headers while the probing goes on. The
+/// include list only grows, so each group is queued on the executor as soon
+/// as enough headers have been accepted to fill it; the last one is analyzed
+/// once the probing is over. See runGroupedFinalAnalysis
+class PipelinedGroupAnalysis final {
+  /// The outcome of a single group
+  struct GroupResult final {
+    /// The results of the analysis
+    ABILibrary abi_library;
+
+    /// The files read by the analysis
+    StringList dependency_list;
+
+    /// True if the group has been compiled on top of the previous headers
+    bool prefixed{false};
+
+    /// True if the analysis failed
+    bool failed{false};
+  };
+
+  /// A group waiting for a worker
+  struct PendingGroup final {
+    /// The accepted headers up to the end of the group
+    StringList include_list;
+
+    /// The position of the first header of the group
+    std::size_t group_begin{0U};
+
+    /// Receives the outcome
+    GroupResult *result{nullptr};
+  };
+
+  /// The base includes of the source buffers
+  StringList base_includes;
+
+  /// The settings of the final pass
+  CompilerInstanceSettings compiler_settings;
+
+  /// The settings of the AST visitor
+  ASTVisitorSettings visitor_settings;
+
+  /// The amount of headers in each group
+  std::size_t group_size{0U};
+
+  /// Receives the trace spans, if set
+  TimeReportRef time_report;
+
+  /// The accepted headers that have been handed to the workers
+  StringList submitted_include_list;
+
+  /// How many groups have been handed to the workers before finish()
+  std::size_t early_group_count{0U};
+
+  /// How many groups can be analyzed at the same time
+  std::size_t worker_count{1U};
+
+  /// Protects the pending group queue and the flags
+  std::mutex mutex;
+
+  /// The groups waiting for a worker, in include list order
+  std::deque<PendingGroup> pending_group_queue;
+
+  /// The outcome of each group, in include list order
+  std::vector<std::unique_ptr<GroupResult>> group_result_list;
+
+  /// How many workers have been queued on the executor and have not
+  /// returned yet
+  std::size_t active_worker_count{0U};
+
+  /// Set when the queued groups have to be dropped
+  bool aborted{false};
+
+  /// The workers; they only run while there are pending groups, so that
+  /// they do not hold the executor threads that the probes need
+  TaskGroup worker_group;
+
+  /// Analyzes the queued groups until there are none left
+  void runWorker() {
+    while (true) {
+      PendingGroup pending_group;
+
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (aborted || pending_group_queue.empty()) {
+          --active_worker_count;
+          break;
+        }
+
+        pending_group = std::move(pending_group_queue.front());
+        pending_group_queue.pop_front();
+      }
+
+      auto &result = *pending_group.result;
+      result.failed = !analyzeHeaderGroup(
+          result.abi_library, result.prefixed, pending_group.include_list,
+          pending_group.group_begin, pending_group.include_list.size(),
+          base_includes, compiler_settings, visitor_settings, time_report,
+          &result.dependency_list);
+    }
+  }
+
+  /// Queues the headers accepted after the last queued group, up to the
+  /// given position of the include list
+  void submitGroup(const StringList &include_list, std::size_t group_end) {
+    auto group_begin = submitted_include_list.size();
+
+    submitted_include_list.insert(
+        submitted_include_list.end(),
+        std::next(include_list.begin(),
+                  static_cast<std::ptrdiff_t>(group_begin)),
+        std::next(include_list.begin(),
+                  static_cast<std::ptrdiff_t>(group_end)));
+
+    bool start_worker = false;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+
+      group_result_list.emplace_back(new GroupResult);
+
+      PendingGroup pending_group;
+      pending_group.include_list = submitted_include_list;
+      pending_group.group_begin = group_begin;
+      pending_group.result = group_result_list.back().get();
+
+      pending_group_queue.push_back(std::move(pending_group));
+
+      if (active_worker_count < worker_count) {
+        ++active_worker_count;
+        start_worker = true;
+      }
+    }
+
+    if (start_worker) {
+      worker_group.run([this]() { runWorker(); }, TaskPriority::Low);
+    }
+  }
+
+  /// Waits for the workers once the queued groups have been analyzed,
+  /// unless aborting
+  void stopWorkers(bool abort) {
+    if (!abort) {
+      worker_group.wait();
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      aborted = true;
+    }
+
+    worker_group.cancel();
+  }
+
+ public:
+  /// Constructor; up to the given amount of groups are analyzed at the same
+  /// time
+  PipelinedGroupAnalysis(const StringList &base_includes,
+                         const CompilerInstanceSettings &compiler_settings,
+                         const ASTVisitorSettings &visitor_settings,
+                         std::size_t group_size, std::size_t worker_count,
+                         TimeReportRef time_report)
+      : base_includes(base_includes),
+        compiler_settings(compiler_settings),
+        visitor_settings(visitor_settings),
+        group_size(group_size),
+        time_report(std::move(time_report)),
+        worker_count(std::max<std::size_t>(worker_count, 1U)) {
+    // The same function is usually found by more than one group
+    this->visitor_settings.defer_duplicate_detection = true;
+  }
+
+  /// Destructor; the groups that have not been analyzed yet are dropped
+  ~PipelinedGroupAnalysis() { stopWorkers(true); }
+
+  /// Queues the groups that the given include list fills; called each time
+  /// a header is accepted
+  void update(const StringList &include_list) {
+    while (include_list.size() >= submitted_include_list.size() + group_size) {
+      submitGroup(include_list, submitted_include_list.size() + group_size);
+      ++early_group_count;
+    }
+  }
+
+  /// Analyzes the remaining headers of the final include list, waits for
+  /// the workers and merges the results. If headers have been removed from
+  /// the include list after being queued, everything is analyzed again with
+  /// runGroupedFinalAnalysis. If passed, the dependency list receives the
+  /// path of each file that has been read
+  bool finish(ABILibrary &abi_library, const StringList &include_list,
+              std::size_t worker_count, StringList *dependency_list) {
+    if (include_list.size() < submitted_include_list.size() ||
+        !std::equal(submitted_include_list.begin(),
+                    submitted_include_list.end(), include_list.begin())) {
+      stopWorkers(true);
+
+      std::cerr << "Analysis pipeline: the include list has changed after "
+                   "the first groups were analyzed; analyzing it again\n\n";
+
+      return runGroupedFinalAnalysis(
+          abi_library, include_list, base_includes, compiler_settings,
+          visitor_settings, group_size, worker_count, time_report,
+          dependency_list);
+    }
+
+    while (submitted_include_list.size() < include_list.size()) {
+      submitGroup(include_list,
+                  std::min(submitted_include_list.size() + group_size,
+                           include_list.size()));
+    }
+
+    stopWorkers(false);
+
+    std::vector<ABILibrary> group_list;
+    std::vector<StringList> group_dependency_list;
+    std::size_t prefixed_group_count = 0U;
+
+    for (auto &result : group_result_list) {
+      if (result->failed) {
+        return false;
+      }
+
+      if (result->prefixed) {
+        ++prefixed_group_count;
+      }
+
+      group_list.push_back(std::move(result->abi_library));
+      group_dependency_list.push_back(std::move(result->dependency_list));
+    }
+
+    group_result_list.clear();
+
+    std::cerr << "Analysis pipeline: " << early_group_count << "/"
+              << group_list.size()
+              << " groups analyzed while probing, groups of up to "
+              << group_size << " headers, " << prefixed_group_count
+              << " compiled on top of the previous headers\n\n";
+
+    mergeHeaderGroups(abi_library, group_list, group_dependency_list,
+                      dependency_list);
+
+    return true;
+  }
+
+  /// Disable the copy constructor
+  PipelinedGroupAnalysis(const PipelinedGroupAnalysis &other) = delete;
+
+  /// Disable the assignment operator
+  PipelinedGroupAnalysis &operator=(const PipelinedGroupAnalysis &other) =
+      delete;
+};
+
+/// Reads the sliced header written by the final pass into the ABI library,
+/// and removes the file; the header is only kept if it declares all the
+/// whitelisted functions on its own
+bool loadSlicedHeader(ABILibrary &abi_library, const std::string &path,
+                      const CompilerInstanceSettings &compiler_settings) {
+  std::string sliced_header;
+
+  {
+    std::ifstream sliced_header_file(path);
+    if (!sliced_header_file) {
+      return false;
+    }
+
+    std::stringstream buffer;
+    buffer << sliced_header_file.rdbuf();
+    sliced_header = buffer.str();
+  }
+
+  std::error_code error;
+  stdfs::remove(path, error);
+
+  // Compile the declarations together with the references made by the
+  // implementation file
+  std::stringstream verification_buffer;
+  verification_buffer << sliced_header << "\n";
+  verification_buffer << "void *__abigen_sliced_header_check[] = {\n";
+
+  for (const auto &function : abi_library.whitelisted_function_list) {
+    verification_buffer << "  (void *)(" << function.mangled_name << "),\n";
+  }
+
+  verification_buffer << "  (void *)0\n};\n";
+
+  auto verification_settings = compiler_settings;
+  verification_settings.precompiled_header.clear();
+  verification_settings.traversal_folders.clear();
+  verification_settings.stop_at_first_error = false;
+
+  CompilerInstanceRef compiler;
+  auto compiler_status =
+      CompilerInstance::create(compiler, verification_settings);
+  if (compiler_status.succeeded()) {
+    compiler_status = compiler->processAST(verification_buffer.str());
+  }
+
+  if (!compiler_status.succeeded()) {
+    std::cerr << "The sliced header does not compile on its own\n"
+              << compiler_status.message() << "\n";
+    return false;
+  }
+
+  abi_library.sliced_header = std::move(sliced_header);
+  return true;
+}
+
+/// Writes a module map listing the accepted headers found inside the header
+/// folders; each folder becomes a top-level module, with one submodule per
+/// header so that importing a header does not make the others visible.
+/// Include directives are resolved the same way clang does, stopping at the
+/// first search path containing the file. Returns how many headers the map
+/// lists, or zero on failure (nothing is written in that case)
+std::size_t writeModuleMap(const std::string &path,
+                           const StringList &include_list,
+                           const CompilerInstanceSettings &compiler_settings,
+                           const StringList &header_folders) {
+  StringList folder_path_list;
+  for (const auto &folder : header_folders) {
+    std::error_code error;
+    auto canonical_folder = stdfs::canonical(folder, error);
+    if (error) {
+      continue;
+    }
+
+    // Terminate the path, so that "/a/b" does not match "/a/bc"
+    folder_path_list.push_back((canonical_folder / "").string());
+  }
+
+  auto header_search_paths = getHeaderSearchPaths(compiler_settings);
+
+  // Headers outside the header folders (and the ones reached through more
+  // than one directive) keep being parsed as text
+  std::vector<StringList> module_header_list(folder_path_list.size());
+  std::unordered_set<std::string> visited_header_set;
+  std::size_t header_count = 0U;
+
+  for (const auto &include_directive : include_list) {
+    std::string header_path;
+
+    for (const auto &search_path : header_search_paths) {
+      auto candidate_path = stdfs::path(search_path) / include_directive;
+
+      std::error_code error;
+      if (!stdfs::is_regular_file(candidate_path, error)) {
+        continue;
+      }
+
+      auto canonical_path = stdfs::canonical(candidate_path, error);
+      if (!error) {
+        header_path = canonical_path.string();
+      }
+
+      break;
+    }
+
+    if (header_path.empty() || !visited_header_set.insert(header_path).second) {
+      continue;
+    }
+
+    for (std::size_t i = 0U; i < folder_path_list.size(); ++i) {
+      const auto &folder_path = folder_path_list[i];
+
+      if (header_path.compare(0U, folder_path.size(), folder_path) == 0) {
+        module_header_list[i].push_back(header_path);
+        ++header_count;
+        break;
+      }
+    }
+  }
+
+  if (header_count == 0U) {
+    return 0U;
+  }
+
+  std::stringstream buffer;
+  for (std::size_t i = 0U; i < module_header_list.size(); ++i) {
+    const auto &header_list = module_header_list[i];
+    if (header_list.empty()) {
+      continue;
+    }
+
+    buffer << "// " << folder_path_list[i] << "\n";
+    buffer << "module abigen_" << i << " {\n";
+
+    for (std::size_t j = 0U; j < header_list.size(); ++j) {
+      buffer << "  module header_" << j << " {\n";
+      buffer << "    header \"" << header_list[j] << "\"\n";
+      buffer << "    export *\n";
+      buffer << "  }\n";
+    }
+
+    buffer << "}\n\n";
+  }
+
+  std::ofstream module_map_file(path, std::ios::out | std::ios::trunc);
+  module_map_file << buffer.str();
+
+  if (!module_map_file) {
+    return 0U;
+  }
+
+  return header_count;
+}
+
+/// The state shared by the profiles generated by a single command
+struct SharedGenerateSettings final {
+  /// The measurements of the whole command; may be null
+  TimeReportRef time_report;
+
+  /// If set, the counters of every AST visitor are summed here
+  VisitorStatisticsRef visitor_statistics;
+
+  /// If set, the stat cache used by all the profiles
+  FileSystemCacheRef file_system_cache;
+
+  /// If set, the symbols imported by the target binary; only these functions
+  /// are added to the ABI library
+  SymbolNameSetRef imported_symbols;
+
+  /// If set, the symbols exported by the library the ABI library is verified
+  /// against; the other functions are blacklisted
+  SymbolNameSetRef exported_symbols;
+
+  /// If set, the namespace and name filters applied by the AST visitor
+  FunctionNameFilterRef function_filter;
+
+  /// True when more than one profile is generated; the phases are then named
+  /// after each profile, and the clang time trace is disabled
+  bool multiple_profiles{false};
+
+  /// If set, the header folders packed for the remote workers
+  RemoteHeaderPackSetRef remote_header_packs;
+
+  /// If set, the shared cache server the cache folder sits in front of
+  RemoteCacheRef remote_cache;
+
+  /// If set, the progress events of the run are written here
+  EventStreamRef event_stream;
+
+  /// The content hashes of the files read by all the profiles
+  FileFingerprintIndexRef fingerprint_index;
+
+  /// The include directives, include guards and function names of the
+  /// candidate headers, shared by all the profiles
+  HeaderScannerRef header_scanner;
+
+  /// If set, the header and the implementation files are rendered here
+  /// instead of being saved; only used with a single profile
+  RenderedFileMap *rendered_file_map{nullptr};
+};
+
+/// Generates the ABI library of the other name mangling convention, using
+/// the names produced by the alternate mangler. Its files are appended to
+/// the given output list and, when passed, to the rendered file map
+bool generateAlternateABILibrary(const CommandLineOptions &library_options,
+                                 const ABILibrary &abi_library,
+                                 const Profile &profile,
+                                 StringList &output_file_list,
+                                 RenderedFileMap *rendered_file_map) {
+  auto alternate_library = abi_library;
+
+  for (auto &function : alternate_library.whitelisted_function_list) {
+    std::swap(function.mangled_name, function.alternate_mangled_name);
+  }
+
+  for (auto &function : alternate_library.blacklisted_function_list) {
+    std::swap(function.mangled_name, function.alternate_mangled_name);
+  }
+
+  auto alternate_options = library_options;
+  alternate_options.output +=
+      library_options.use_visual_cxx_mangling ? "_itanium" : "_msvc";
+
+  // Both calls clear the list and the map they receive
+  StringList alternate_file_list;
+  RenderedFileMap alternate_file_map;
+
+  auto status = generateABILibrary(
+      alternate_options, alternate_library, profile, &alternate_file_list,
+      (rendered_file_map != nullptr) ? &alternate_file_map : nullptr);
+
+  if (!status.succeeded()) {
+    std::cerr << status.message() << "\n";
+    return false;
+  }
+
+  output_file_list.insert(output_file_list.end(), alternate_file_list.begin(),
+                          alternate_file_list.end());
+
+  if (rendered_file_map != nullptr) {
+    rendered_file_map->insert(alternate_file_map.begin(),
+                              alternate_file_map.end());
+  }
+
+  return true;
+}
+
+/// Returns the worker placement selected by the command line options; the
+/// value has already been validated by the parser
+WorkerPlacement getWorkerPlacement(const CommandLineOptions &cmdline_options) {
+  WorkerPlacement worker_placement{WorkerPlacement::None};
+  parseWorkerPlacement(worker_placement, cmdline_options.worker_placement);
+
+  return worker_placement;
+}
+
+/// Returns the AST visitor settings selected by the command line options
+ASTVisitorSettings getVisitorSettings(
+    const CommandLineOptions &cmdline_options,
+    const SharedGenerateSettings &shared_settings, Language language,
+    const TypeSummaryRef &type_summary) {
+  ASTVisitorSettings visitor_settings;
+  visitor_settings.lazy_type_expansion = cmdline_options.lazy_type_expansion;
+  visitor_settings.analyze_while_parsing =
+      cmdline_options.analyze_while_parsing;
+  visitor_settings.merge_redeclarations =
+      !cmdline_options.report_redeclarations;
+  visitor_settings.imported_symbols = shared_settings.imported_symbols;
+  visitor_settings.exported_symbols = shared_settings.exported_symbols;
+  visitor_settings.function_filter = shared_settings.function_filter;
+  visitor_settings.type_summary = type_summary;
+  visitor_settings.finalize_threads = cmdline_options.finalize_threads;
+  visitor_settings.full_blacklist_causes =
+      cmdline_options.full_blacklist_causes;
+  visitor_settings.type_expansion_threads =
+      cmdline_options.type_expansion_threads;
+  visitor_settings.language = language;
+  visitor_settings.time_report = shared_settings.time_report;
+  visitor_settings.statistics = shared_settings.visitor_statistics;
+
+  return visitor_settings;
+}
+
+/// Generates the ABI library from the AST snapshot selected by the command
+/// line options; the headers are neither probed nor parsed. The compiler
+/// settings must be the ones the snapshot has been saved with. When an
+/// output library is passed, it receives the results
+bool generateSnapshotLibrary(ProfileManagerRef &profile_manager,
+                             const CommandLineOptions &cmdline_options,
+                             const CompilerInstanceSettings &compiler_settings,
+                             const SharedGenerateSettings &shared_settings,
+                             const TypeSummaryRef &type_summary,
+                             ABILibrary *abi_library_output) {
+  const auto &time_report = shared_settings.time_report;
+
+  ASTSnapshot snapshot;
+  if (!readASTSnapshot(snapshot, cmdline_options.ast_snapshot_path)) {
+    std::cerr << "Failed to read the AST snapshot: "
+              << cmdline_options.ast_snapshot_path << "\n";
+    return false;
+  }
+
+  // The AST file is loaded without validation, as the precompiled headers
+  // are; an outdated snapshot would silently describe the old headers
+  if (snapshot.settings_hash !=
+      hashCompilerInstanceSettings(compiler_settings)) {
+    std::cerr << "The AST snapshot has been saved with different compiler "
+                 "settings; run generate --save-ast again\n";
+    return false;
+  }
+
+  auto modified_file_list = getModifiedASTSnapshotFiles(snapshot);
+  if (!modified_file_list.empty()) {
+    std::cerr << "The AST snapshot is out of date; run generate --save-ast "
+                 "again. Modified files:\n\n";
+
+    for (const auto &path : modified_file_list) {
+      std::cerr << "  " << path << "\n";
+    }
+
+    return false;
+  }
+
+  auto final_compiler_settings = compiler_settings;
+  final_compiler_settings.precompiled_header = snapshot.ast_path;
+  final_compiler_settings.clang_teardown =
+      getClangTeardown(cmdline_options, true);
+  final_compiler_settings.huge_page_advice = cmdline_options.huge_pages;
+  if (cmdline_options.scoped_traversal) {
+    final_compiler_settings.traversal_folders = cmdline_options.header_folders;
+  }
+
+  if (cmdline_options.time_report || cmdline_options.hardware_counters ||
+      !cmdline_options.metrics_file.empty()) {
+    final_compiler_settings.time_report = time_report;
+  }
+
+  ABILibrary abi_library;
+  StringList dependency_list;
+
+  {
+    ScopedPhaseTimer phase_timer(time_report, "AST snapshot analysis");
+
+    // The declarations are deserialized as the visitor reaches them
+    if (!runFinalAnalysis(abi_library, std::string(), final_compiler_settings,
+                          getVisitorSettings(cmdline_options, shared_settings,
+                                             compiler_settings.language,
+                                             type_summary),
+                          cmdline_options.analysis_shards, time_report, true,
+                          &dependency_list,
+                          getWorkerPlacement(cmdline_options))) {
+      return false;
+    }
+  }
+
+  std::cerr << "AST snapshot: " << snapshot.header_list.size()
+            << " accepted headers loaded from " << snapshot.ast_path
+            << "\n\n";
+
+  abi_library.header_list = snapshot.header_list;
+
+  if (cmdline_options.emit_header_map) {
+    abi_library.header_path_list = resolveUniqueIncludePaths(
+        abi_library.header_list, getHeaderSearchPaths(compiler_settings));
+  }
+
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, cmdline_options.profile_name);
+
+  assert(prof_mgr_status.succeeded());
+
+  {
+    ScopedPhaseTimer phase_timer(time_report, "ABI library generation");
+
+    auto library_options = cmdline_options;
+    library_options.base_includes = snapshot.base_includes;
+
+    StringList output_file_list;
+    auto status = generateABILibrary(library_options, abi_library, profile,
+                                     &output_file_list,
+                                     shared_settings.rendered_file_map);
+    if (!status.succeeded()) {
+      std::cerr << status.message() << "\n";
+      return false;
+    }
+
+    if (cmdline_options.dual_mangling &&
+        !generateAlternateABILibrary(library_options, abi_library, profile,
+                                     output_file_list,
+                                     shared_settings.rendered_file_map)) {
+      return false;
+    }
+
+    if (!cmdline_options.depfile_path.empty() &&
+        !writeDependencyFile(cmdline_options.depfile_path, output_file_list,
+                             dependency_list)) {
+      std::cerr << "Failed to write the dependency file: "
+                << cmdline_options.depfile_path << "\n";
+      return false;
+    }
+  }
+
+  if (cmdline_options.save_database) {
+    ABIDatabase database;
+    database.profile_name = cmdline_options.profile_name;
+    database.language = cmdline_options.language;
+    database.base_includes = snapshot.base_includes;
+    database.abi_library = abi_library;
+
+    auto database_path = cmdline_options.output + kABIDatabaseExtension;
+    if (!writeABIDatabase(database, database_path)) {
+      std::cerr << "Failed to write the ABI database: " << database_path
+                << "\n";
+      return false;
+    }
+  }
+
+  if (abi_library_output != nullptr) {
+    *abi_library_output = std::move(abi_library);
+  }
+
+  return true;
+}
+
+/// The state of a profile shared by the phases of generateProfileLibrary;
+/// it is filled while the probe executor is being created
+struct ProfileGenerationContext final {
+  /// Loads the profiles
+  ProfileManagerRef *profile_manager{nullptr};
+
+  /// Describes the supported languages
+  const LanguageManager *language_manager{nullptr};
+
+  /// The command line options of the profile
+  const CommandLineOptions *cmdline_options{nullptr};
+
+  /// The state shared by the profiles generated by the command
+  const SharedGenerateSettings *shared_settings{nullptr};
+
+  /// The settings of the profile, before the ones that are specific to the
+  /// probes or to the final pass are applied
+  CompilerInstanceSettings compiler_settings;
+
+  /// The settings the probe executor has been created with
+  ProbeExecutorSettings probe_executor_settings;
+
+  /// Compiles the probes
+  ProbeExecutorRef probe_executor;
+
+  /// If set, the failed headers are scheduled by failure cause; dropped
+  /// when the automatic selection does not pick the sequential strategy
+  std::unique_ptr<ProbeFailureScheduler> failure_scheduler;
+
+  /// If set, reads the candidate headers ahead of the probes
+  std::unique_ptr<HeaderPrefetcher> header_prefetcher;
+
+  /// If set, the outcomes of the probes of the previous runs
+  ProbeCacheRef probe_cache;
+
+  /// If set, the precompiled base includes and prefixes
+  PCHCacheRef pch_cache;
+
+  /// Where the probe costs are saved; empty without a cache folder
+  std::string probe_cost_file;
+
+  /// If set, the system types summarized by the build_profile_summary
+  /// command
+  TypeSummaryRef type_summary;
+
+  /// The base includes of the ABI library, profile headers included
+  StringList base_includes;
+
+  /// The base includes that are not part of the precompiled header
+  StringList parsed_base_includes;
+
+  /// Loaded before the parsed base includes; may be empty
+  std::string precompiled_header;
+
+  /// The precompiled base includes; empty when they are parsed as text
+  std::string base_includes_pch;
+};
+
+/// The order the candidate headers of a profile are probed in, and the state
+/// left by the previous runs it has been derived from
+struct HeaderOrdering final {
+  /// Where the lockfile of the output is saved
+  std::string lockfile_path;
+
+  /// The hash of the settings that can change the outcome of the probes
+  ContentHash lockfile_configuration_hash{0U};
+
+  /// The lockfile saved by the previous run; it may have been parsed in part
+  /// when it could not be read
+  HeaderLockfile lockfile;
+
+  /// True when the lockfile has been saved with the same settings
+  bool use_lockfile{false};
+
+  /// The include directives, include guards and function names of the
+  /// candidate headers; may be null
+  HeaderScannerRef header_scanner;
+
+  /// The hash of the include closure of each candidate header, keyed on the
+  /// path
+  std::unordered_map<std::string, ContentHash> closure_hash_map;
+
+  /// The include list accepted for the previous version of the headers
+  StringList warm_start_include_list;
+
+  /// Where the checkpoints of the output are saved
+  std::string checkpoint_path;
+
+  /// The hash of the settings and of the candidate headers of the checkpoint
+  ContentHash checkpoint_configuration_hash{0U};
+
+  /// The checkpoint saved by the interrupted run
+  ProbeCheckpoint checkpoint;
+
+  /// True when the probing resumes from the checkpoint
+  bool resume_checkpoint{false};
+};
+
+/// The include list accepted by the probes of a profile
+struct ProbingResult final {
+  /// The accepted include directives
+  StringList active_include_headers;
+
+  /// The headers discarded by the locked run, keyed on the path
+  std::unordered_set<std::string> locked_header_set;
+
+  /// If set, analyzes the groups of accepted headers while probing
+  std::unique_ptr<PipelinedGroupAnalysis> pipelined_analysis;
+
+  /// If set, the headers included by the accepted ones
+  std::unique_ptr<IncludedHeaderTracker> included_header_tracker;
+};
+
+/// The results of the final pass of a profile
+struct FinalPassResult final {
+  /// The results are moved instead of copied, and the analysis state is
+  /// released before rendering; this keeps the peak memory usage down on
+  /// large libraries
+  ABILibrary abi_library;
+
+  /// The files read by the final pass, saved to the dependency file
+  StringList dependency_list;
+
+  /// Where the module map is saved, next to the output
+  std::string module_map_path;
+
+  /// How many accepted headers have been imported from clang modules
+  std::size_t module_header_count{0U};
+
+  /// Where the sliced header is saved, next to the output
+  std::string sliced_header_path;
+};
+
+/// Returns the name of a phase of the profile; the profile is named as well
+/// when the command generates more than one
+std::string getPhaseName(const ProfileGenerationContext &context,
+                         const std::string &name) {
+  const auto &cmdline_options = *context.cmdline_options;
+  if (!context.shared_settings->multiple_profiles) {
+    return name;
+  }
+
+  if (!cmdline_options.target_triples.empty()) {
+    return name + " (" + cmdline_options.profile_name + ", " +
+           cmdline_options.target_triples + ")";
+  }
+
+  return name + " (" + cmdline_options.profile_name + ")";
+}
+
+/// Returns the AST visitor settings of the final pass of the profile
+ASTVisitorSettings
+getFinalVisitorSettings(const ProfileGenerationContext &context) {
+  return getVisitorSettings(*context.cmdline_options, *context.shared_settings,
+                            context.compiler_settings.language,
+                            context.type_summary);
+}
+
+/// Returns the compiler settings of the final pass of the profile; the ones
+/// that depend on the accepted headers are added once the probing is over
+CompilerInstanceSettings
+getFinalCompilerSettings(const ProfileGenerationContext &context) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &compiler_settings = context.compiler_settings;
+  const auto &precompiled_header = context.precompiled_header;
+
+  auto final_compiler_settings = compiler_settings;
+  final_compiler_settings.precompiled_header = precompiled_header;
+  final_compiler_settings.clang_teardown =
+      getClangTeardown(cmdline_options, true);
+  final_compiler_settings.huge_page_advice = cmdline_options.huge_pages;
+
+  if (cmdline_options.scoped_traversal) {
+    final_compiler_settings.traversal_folders =
+        cmdline_options.header_folders;
+  }
+
+  // Only the final pass contributes to the memory statistics; the probes
+  // build and destroy far too many translation units for a sum to be
+  // useful
+  if (cmdline_options.time_report || cmdline_options.hardware_counters ||
+      !cmdline_options.metrics_file.empty()) {
+    final_compiler_settings.time_report =
+        context.shared_settings->time_report;
+  }
+
+  return final_compiler_settings;
+}
+
+/// Connects the remote workers and starts the isolated ones, adding them to
+/// the probe executor settings of the profile
+void addRemoteProbeWorkers(ProfileGenerationContext &context) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &shared_settings = *context.shared_settings;
+  const auto &compiler_settings = context.compiler_settings;
+  const auto &base_includes = context.base_includes;
+  auto &probe_executor_settings = context.probe_executor_settings;
+
+  // The remote workers parse all the base includes as text, and read the
+  // header folders from the packs shipped by this process; the outcome of
+  // each probe is the same as if it had been run locally. Isolated workers
+  // speak the same protocol, but share the file system of this process
+  if (shared_settings.remote_header_packs || cmdline_options.isolate_probes) {
+    RemoteProbeSettings remote_settings;
+    remote_settings.profile_name = cmdline_options.profile_name;
+    remote_settings.language = cmdline_options.language;
+    remote_settings.enable_gnu_extensions =
+        compiler_settings.enable_gnu_extensions;
+    remote_settings.use_visual_cxx_mangling =
+        compiler_settings.use_visual_cxx_mangling;
+    remote_settings.target_triple = compiler_settings.target_triple;
+    remote_settings.skip_function_bodies =
+        compiler_settings.skip_function_bodies;
+
+    const auto &probe_compiler_settings =
+        probe_executor_settings.compiler_settings;
+
+    remote_settings.stop_at_first_error =
+        probe_compiler_settings.stop_at_first_error;
+    remote_settings.ignore_warnings = probe_compiler_settings.ignore_warnings;
+    remote_settings.time_budget = probe_compiler_settings.time_budget;
+
+    for (const auto &path : compiler_settings.additional_include_folders) {
+      try {
+        remote_settings.additional_include_folders.push_back(
+            stdfs::absolute(path).string());
+      } catch (...) {
+      }
+    }
+
+    remote_settings.base_includes = base_includes;
+    remote_settings.probe_tiers = cmdline_options.probe_tiers;
+    remote_settings.use_precompiled_prefix =
+        cmdline_options.use_precompiled_prefix;
+    remote_settings.track_included_headers =
+        probe_executor_settings.track_included_headers;
+    remote_settings.classify_failures =
+        probe_executor_settings.classify_failures;
+    if (shared_settings.remote_header_packs) {
+      remote_settings.header_pack_list =
+          shared_settings.remote_header_packs->packList();
+    }
+
+    std::size_t remote_worker_count = 0U;
+
+    for (const auto &address : cmdline_options.remote_workers) {
+      if (!shared_settings.remote_header_packs) {
+        break;
+      }
+
+      RemoteProbeWorkerRef remote_worker;
+      auto status =
+          RemoteProbeWorker::create(remote_worker, address, remote_settings);
+
+      if (!status.succeeded()) {
+        std::cerr << "The remote worker " << address
+                  << " is not available: " << status.toString() << "\n";
+        continue;
+      }
+
+      remote_worker_count += remote_worker->workerCount();
+
+      probe_executor_settings.remote_worker_list.push_back(
+          std::move(remote_worker));
+    }
+
+    if (shared_settings.remote_header_packs) {
+      std::cerr << "Remote workers: "
+                << probe_executor_settings.remote_worker_list.size() << "/"
+                << cmdline_options.remote_workers.size() << " connected, "
+                << remote_worker_count << " remote probe workers\n\n";
+    }
+
+    // One child process for each job, each probing a single header at a
+    // time; the local compiler instances are then only used by the other
+    // compilations of the run
+    if (cmdline_options.isolate_probes) {
+      std::size_t isolated_worker_count = 0U;
+
+      for (std::size_t i = 0U; i < cmdline_options.jobs; ++i) {
+        RemoteProbeWorkerRef isolated_worker;
+        auto status =
+            RemoteProbeWorker::createIsolated(isolated_worker, remote_settings);
+
+        if (!status.succeeded()) {
+          std::cerr << status.toString() << "\n";
+          break;
+        }
+
+        probe_executor_settings.remote_worker_list.push_back(
+            std::move(isolated_worker));
+
+        ++isolated_worker_count;
+      }
+
+      if (isolated_worker_count != 0U) {
+        probe_executor_settings.worker_count = 1U;
+      }
+
+      std::cerr << "Isolated probes: " << isolated_worker_count << "/"
+                << cmdline_options.jobs << " worker processes started";
+
+      if (cmdline_options.component_probes) {
+        std::cerr << ", the component probes are not used";
+      }
+
+      std::cerr << "\n\n";
+    }
+  }
+}
+
+/// Reads the lockfile, the warm start file and the checkpoint left by the
+/// previous runs of the profile, and sorts the candidate headers in the
+/// order they are probed
+void orderCandidateHeaders(HeaderOrdering &ordering,
+                           std::vector<HeaderDescriptor> &header_files,
+                           ProfileGenerationContext &context) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &shared_settings = *context.shared_settings;
+  const auto &time_report = shared_settings.time_report;
+  const auto &compiler_settings = context.compiler_settings;
+  const auto &base_includes = context.base_includes;
+  const auto &probe_cost_file = context.probe_cost_file;
+  const auto &probe_executor = context.probe_executor;
+  const auto &failure_scheduler = context.failure_scheduler;
+  auto &probe_executor_settings = context.probe_executor_settings;
+
+  auto &lockfile_path = ordering.lockfile_path;
+  auto &lockfile_configuration_hash = ordering.lockfile_configuration_hash;
+  auto &lockfile = ordering.lockfile;
+  auto &use_lockfile = ordering.use_lockfile;
+  auto &header_scanner = ordering.header_scanner;
+  auto &closure_hash_map = ordering.closure_hash_map;
+  auto &warm_start_include_list = ordering.warm_start_include_list;
+  auto &checkpoint_path = ordering.checkpoint_path;
+  auto &checkpoint_configuration_hash = ordering.checkpoint_configuration_hash;
+  auto &checkpoint = ordering.checkpoint;
+  auto &resume_checkpoint = ordering.resume_checkpoint;
+
+  // The lockfile is keyed on the settings that can change the outcome of
+  // the probes; new and removed headers are handled by probing them
+  lockfile_path = cmdline_options.output + ".lock";
+
+  lockfile_configuration_hash =
+      hashCompilerInstanceSettings(compiler_settings);
+  lockfile_configuration_hash = updateContentHash(lockfile_configuration_hash,
+                                                  cmdline_options.probe_tiers);
+  lockfile_configuration_hash =
+      updateContentHash(lockfile_configuration_hash, base_includes);
+
+  auto lockfile_found = readHeaderLockfile(lockfile, lockfile_path);
+
+  // A discarded header is only set aside again when none of the candidate
+  // headers it includes has changed either
+  auto fingerprint_index = shared_settings.fingerprint_index;
+  if (!fingerprint_index) {
+    FileFingerprintIndex::create(fingerprint_index);
+  }
+
+  header_scanner = shared_settings.header_scanner;
+  if (!header_scanner) {
+    HeaderScanner::create(header_scanner, fingerprint_index);
+  }
+
+  if (failure_scheduler && cmdline_options.discover_prerequisites &&
+      header_scanner) {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "Identifier indexing"));
+
+    auto identifier_index =
+        getDeclaredIdentifierIndex(header_files, *header_scanner);
+
+    std::cerr << "Identifier index: " << identifier_index.size()
+              << " identifiers declared by the candidate headers\n\n";
+
+    failure_scheduler->setIdentifierIndex(std::move(identifier_index));
+  }
+
+  if (fingerprint_index) {
+    auto closure_hash_list = fingerprint_index->includeClosureHashes(
+        header_files, header_scanner.get());
+
+    for (std::size_t i = 0U; i < header_files.size(); ++i) {
+      closure_hash_map.insert({header_files[i].path, closure_hash_list[i]});
+    }
+  }
+
+  // The outcomes recorded for a header are only kept while its contents
+  // stay the same
+  if (!probe_cost_file.empty() && fingerprint_index) {
+    for (const auto &header_desc : header_files) {
+      ContentHash fingerprint;
+      if (fingerprint_index->fingerprint(fingerprint, header_desc.path)) {
+        probe_executor_settings.probe_cost_model->setFingerprint(
+            header_desc.path, fingerprint);
+      }
+    }
+  }
+
+  // The previous version of the headers lives in another tree, so only the
+  // include directives carry over; the lockfile of this output, when used,
+  // is more precise
+  if (!cmdline_options.warm_start_path.empty()) {
+    bool warm_start_found = false;
+
+    if (stdfs::path(cmdline_options.warm_start_path).extension() ==
+        kABIDatabaseExtension) {
+      ABIDatabase database;
+      warm_start_found =
+          readABIDatabase(database, cmdline_options.warm_start_path);
+
+      warm_start_include_list = std::move(database.abi_library.header_list);
+
+    } else {
+      HeaderLockfile warm_start_lockfile;
+      warm_start_found = readHeaderLockfile(warm_start_lockfile,
+                                            cmdline_options.warm_start_path);
+
+      warm_start_include_list = std::move(warm_start_lockfile.include_list);
+    }
+
+    if (!warm_start_found) {
+      std::cerr << "The warm start file could not be read; all the headers "
+                   "will be probed\n\n";
+
+      warm_start_include_list.clear();
+    }
+  }
+
+  if (cmdline_options.use_lockfile) {
+    if (!lockfile_found) {
+      std::cerr << "The lockfile could not be read; all the headers will be "
+                   "probed\n\n";
+
+    } else if (lockfile.configuration_hash != lockfile_configuration_hash) {
+      std::cerr << "The lockfile has been written with different settings; "
+                   "all the headers will be probed\n\n";
+
+    } else {
+      use_lockfile = true;
+    }
+  }
+
+  // The outcome of the previous run is only used as a hint here, so it is
+  // still valid when the settings have changed; headers that are likely to
+  // be accepted are probed first, and the ones that kept failing are moved
+  // to the end, where they no longer force the following ones to be probed
+  // again
+  if (cmdline_options.header_order == "history") {
+    if (!lockfile_found && probe_cost_file.empty()) {
+      std::cerr << "No outcome has been recorded by a previous run; the "
+                   "headers are probed in walk order\n\n";
+
+    } else {
+      // A lockfile that could not be read may have been parsed in part
+      if (!lockfile_found) {
+        lockfile = {};
+      }
+
+      auto history_counts =
+          sortHeadersByHistory(header_files, lockfile, *probe_executor,
+                               *probe_executor_settings.probe_cost_model);
+
+      std::cerr << "Header order: " << history_counts.first
+                << " headers accepted by the previous run moved first, "
+                << history_counts.second << " discarded ones moved last\n\n";
+    }
+  }
+
+  // When the probing may not get through every header, the ones declaring
+  // the most functions go first; this takes precedence over the history
+  if (cmdline_options.probing_time_budget != 0U && header_scanner) {
+    sortHeadersByFunctionCount(header_files, *header_scanner,
+                               cmdline_options.jobs);
+
+    std::cerr << "Time budget: headers sorted by the amount of functions "
+                 "they declare\n\n";
+  }
+
+  // The simulate command replays the probes against the same candidates,
+  // using the directives they start with
+  if (probe_executor_settings.probe_recorder) {
+    for (const auto &header_desc : header_files) {
+      probe_executor_settings.probe_recorder->recordHeader(
+          header_desc.path, probe_executor->includeDirectives(header_desc));
+    }
+  }
+
+  // Checkpoints are only resumed by a run with the same settings and the
+  // same candidate headers
+  checkpoint_path = cmdline_options.output + ".checkpoint";
+
+  checkpoint_configuration_hash = updateContentHash(
+      lockfile_configuration_hash, cmdline_options.probe_strategy);
+
+  for (const auto &header_desc : header_files) {
+    checkpoint_configuration_hash =
+        updateContentHash(checkpoint_configuration_hash, header_desc.path);
+  }
+
+  if (cmdline_options.resume) {
+    if (!readProbeCheckpoint(checkpoint, checkpoint_path)) {
+      std::cerr << "The checkpoint could not be read; the probing starts "
+                   "from scratch\n\n";
+
+    } else if (checkpoint.configuration_hash !=
+               checkpoint_configuration_hash) {
+      std::cerr << "The checkpoint has been written by a different run; the "
+                   "probing starts from scratch\n\n";
+
+    } else {
+      resume_checkpoint = true;
+    }
+  }
+}
+
+/// Saves the probe state to the checkpoint of the profile. The headers set
+/// aside by the lockfile are saved as pending ones, after the others
+void saveProbeCheckpoint(
+    const HeaderOrdering &ordering, const StringList &include_list,
+    const std::vector<HeaderDescriptor> &pending,
+    const std::vector<bool> &removed_header_flags,
+    const ProbeProgress &progress,
+    const std::vector<HeaderDescriptor> &locked_header_files) {
+  ProbeCheckpoint new_checkpoint;
+  new_checkpoint.configuration_hash = ordering.checkpoint_configuration_hash;
+  new_checkpoint.header_index = progress.header_index;
+  new_checkpoint.sweep_start_count = progress.sweep_start_count;
+  new_checkpoint.include_list = include_list;
+
+  for (std::size_t i = 0U; i < pending.size(); ++i) {
+    if (!removed_header_flags.empty() && removed_header_flags[i]) {
+      if (i < progress.header_index) {
+        --new_checkpoint.header_index;
+      }
+
+      continue;
+    }
+
+    new_checkpoint.header_path_list.push_back(pending[i].path);
+  }
+
+  for (const auto &header_desc : locked_header_files) {
+    new_checkpoint.header_path_list.push_back(header_desc.path);
+  }
+
+  if (!writeProbeCheckpoint(new_checkpoint, ordering.checkpoint_path)) {
+    std::cerr << "Failed to write the checkpoint: "
+              << ordering.checkpoint_path << "\n";
+  }
+}
+
+/// Probes the candidate headers of the profile, starting from the include
+/// list of the checkpoint, of the lockfile, of the warm start file or of the
+/// header order hypothesis; the discarded headers are left in the list
+bool probeCandidateHeaders(
+    ProbingResult &probing, std::vector<HeaderDescriptor> &header_files,
+    HeaderOrdering &ordering, ProfileGenerationContext &context,
+    const std::shared_future<StringList> &header_order_hypothesis,
+    bool verify_hypothesis) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &shared_settings = *context.shared_settings;
+  const auto &time_report = shared_settings.time_report;
+  const auto &parsed_base_includes = context.parsed_base_includes;
+  const auto &probe_executor = context.probe_executor;
+  const auto &probe_executor_settings = context.probe_executor_settings;
+  auto &failure_scheduler = context.failure_scheduler;
+
+  const auto &lockfile = ordering.lockfile;
+  const auto &use_lockfile = ordering.use_lockfile;
+  const auto &header_scanner = ordering.header_scanner;
+  const auto &closure_hash_map = ordering.closure_hash_map;
+  const auto &warm_start_include_list = ordering.warm_start_include_list;
+  const auto &checkpoint = ordering.checkpoint;
+  auto &resume_checkpoint = ordering.resume_checkpoint;
+
+  auto &active_include_headers = probing.active_include_headers;
+  auto &locked_header_set = probing.locked_header_set;
+  auto &pipelined_analysis = probing.pipelined_analysis;
+  auto &included_header_tracker = probing.included_header_tracker;
+
+  // Attempt to include as many headers as possible; stop when we can no longer
+  // add new ones to the list of active ones. We do not care about the AST right
+  // now! Just try to pass the compilation
+  std::cerr << "Processed headers\n\n";
+  std::string total_header_count_str = std::to_string(header_files.size());
+  auto header_counter_digits = static_cast<int>(total_header_count_str.size());
+
+  // The groups of accepted headers are analyzed while the probing goes on;
+  // the outputs that need a single translation unit, and the module map,
+  // which is written from the final include list, can't be combined with it
+  if (cmdline_options.pipeline_analysis) {
+    if (cmdline_options.analysis_group_size == 0U) {
+      std::cerr << "Analysis pipeline: not used, it requires the analysis "
+                   "groups\n\n";
+
+    } else if (cmdline_options.emit_bitcode ||
+               cmdline_options.sliced_header ||
+               cmdline_options.incremental_analysis ||
+               !cmdline_options.module_cache_directory.empty()) {
+      std::cerr << "Analysis pipeline: not used, the bitcode, the sliced "
+                   "header, the incremental analysis and the clang modules "
+                   "require the final include list\n\n";
+
+    } else {
+      pipelined_analysis = llvm::make_unique<PipelinedGroupAnalysis>(
+          parsed_base_includes, getFinalCompilerSettings(context),
+          getFinalVisitorSettings(context),
+          cmdline_options.analysis_group_size,
+          cmdline_options.analysis_shards, time_report);
+    }
+  }
+
+  auto L_acceptHeader = [&](const StringList &include_list) {
+    std::cerr << "  [" << std::setfill('0')
+              << std::setw(header_counter_digits) << include_list.size();
+
+    std::cerr << "/" << total_header_count_str << "] " << include_list.back()
+              << "\n";
+
+    if (pipelined_analysis) {
+      pipelined_analysis->update(include_list);
+    }
+  };
+
+  // Headers that an accepted probe has already included through a guarded
+  // #include are dropped without probing them
+  if (probe_executor_settings.track_included_headers) {
+    included_header_tracker =
+        llvm::make_unique<IncludedHeaderTracker>(header_files);
+  }
+
+  // Headers discarded by the locked run are set aside when they have not
+  // changed and the locked include list is still accepted as a whole; they
+  // are only probed again if another header gets accepted
+  std::vector<HeaderDescriptor> locked_header_files;
+
+  // The probe state is saved at most once per checkpoint interval
+  auto L_writeCheckpoint = [&](const StringList &include_list,
+                               const std::vector<HeaderDescriptor> &pending,
+                               const std::vector<bool> &removed_header_flags,
+                               const ProbeProgress &progress) {
+    saveProbeCheckpoint(ordering, include_list, pending, removed_header_flags,
+                        progress, locked_header_files);
+  };
+
+  auto last_checkpoint_time = std::chrono::steady_clock::now();
+
+  ProbeCheckpointCallback checkpoint_callback;
+  if (cmdline_options.checkpoint_interval != 0U) {
+    checkpoint_callback = [&](const StringList &include_list,
+                              const std::vector<HeaderDescriptor> &pending,
+                              const std::vector<bool> &removed_header_flags,
+                              const ProbeProgress &progress) {
+      // The probes failing after a cancellation have not been compiled
+      if (probe_executor->cancelled()) {
+        return;
+      }
+
+      auto current_time = std::chrono::steady_clock::now();
+      if (current_time - last_checkpoint_time <
+          std::chrono::seconds(cmdline_options.checkpoint_interval)) {
+        return;
+      }
+
+      last_checkpoint_time = current_time;
+      L_writeCheckpoint(include_list, pending, removed_header_flags,
+                        progress);
+    };
+  }
+
+  auto event_stream = shared_settings.event_stream.get();
+
+  // The sampled probes are kept by the probe cache, if any, so the first
+  // sweep does not compile them again
+  auto probe_strategy_name = cmdline_options.probe_strategy;
+  auto batch_size = cmdline_options.batch_size;
+
+  if (probe_strategy_name == "auto") {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "Strategy selection"));
+
+    auto statistics =
+        sampleProbeStatistics(*probe_executor, active_include_headers,
+                              header_files, kStrategySampleSize);
+
+    auto selection = selectProbeStrategy(statistics, header_files.size(),
+                                         probe_executor->workerCount());
+
+    probe_strategy_name = selection.probe_strategy;
+    if (probe_strategy_name == "batch") {
+      batch_size = selection.batch_size;
+    }
+
+    if (probe_strategy_name != "sequential") {
+      failure_scheduler.reset();
+    }
+
+    std::ostringstream message;
+    message << std::fixed << std::setprecision(3)
+            << "Strategy selection: " << statistics.sample_size
+            << " sampled headers, " << statistics.failure_rate * 100.0
+            << "% failed, " << statistics.prefix_cost
+            << "s for the include list and " << statistics.header_cost
+            << "s for each header, dependency density "
+            << statistics.dependency_density << "; selected "
+            << probe_strategy_name;
+
+    if (probe_strategy_name == "batch") {
+      message << " with a batch size of " << batch_size;
+    }
+
+    message << " (predicted " << selection.predicted_time << "s)";
+    std::cerr << message.str() << "\n\n";
+  }
+
+  ProbeStrategyContext strategy_context;
+  strategy_context.probe_executor = probe_executor.get();
+  strategy_context.batch_size = batch_size;
+  strategy_context.accepted_header_callback = L_acceptHeader;
+  strategy_context.included_header_tracker = included_header_tracker.get();
+  strategy_context.failure_scheduler = failure_scheduler.get();
+  strategy_context.event_stream = event_stream;
+  strategy_context.checkpoint_callback = checkpoint_callback;
+
+  ProbeStrategyRef probe_strategy;
+  if (!ProbeStrategy::create(probe_strategy, probe_strategy_name,
+                             strategy_context)) {
+    std::cerr << "Invalid probe strategy: " << probe_strategy_name << "\n";
+    return false;
+  }
+
+  auto L_runProbes = [&](const ProbeProgress &progress) {
+    probe_strategy->run(active_include_headers, header_files, progress);
+  };
+
+  {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "Header probing"));
+
+    ProbeProgress probe_progress;
+    bool probe_headers = true;
+
+    if (resume_checkpoint &&
+        !restoreProbeCheckpoint(active_include_headers, header_files,
+                                checkpoint, *probe_executor)) {
+      std::cerr << "The include list of the checkpoint is no longer "
+                   "accepted; the probing starts from scratch\n\n";
+
+      resume_checkpoint = false;
+    }
+
+    // Resume the interrupted run, or start from the include list of the
+    // lockfile, of the previous version of the headers or of the first
+    // profile; the loops below then only have to go through the headers it
+    // left out
+    if (resume_checkpoint) {
+      probe_progress.header_index = checkpoint.header_index;
+      probe_progress.sweep_start_count = checkpoint.sweep_start_count;
+
+      std::cerr << "Checkpoint: resumed with " << active_include_headers.size()
+                << " accepted headers and " << header_files.size()
+                << " pending ones\n\n";
+
+    } else if (use_lockfile) {
+      auto accepted_count = applyHeaderOrderHypothesis(
+          active_include_headers, header_files, lockfile.include_list,
+          *probe_executor, L_acceptHeader, included_header_tracker.get());
+
+      if (accepted_count == lockfile.include_list.size()) {
+        locked_header_files =
+            takeLockedHeaders(header_files, lockfile, closure_hash_map);
+      }
+
+      std::cerr << "\nLockfile: " << accepted_count << "/"
+                << lockfile.include_list.size()
+                << " locked headers accepted, " << locked_header_files.size()
+                << " unchanged headers discarded without probing them\n\n";
+
+    } else if (!warm_start_include_list.empty()) {
+      auto accepted_count = applyHeaderOrderHypothesis(
+          active_include_headers, header_files, warm_start_include_list,
+          *probe_executor, L_acceptHeader, included_header_tracker.get());
+
+      std::cerr << "\nWarm start: " << accepted_count << "/"
+                << warm_start_include_list.size()
+                << " headers accepted from the previous version\n\n";
+
+    } else if (header_order_hypothesis.valid()) {
+      const auto &header_order = header_order_hypothesis.get();
+
+      auto accepted_count = applyHeaderOrderHypothesis(
+          active_include_headers, header_files, header_order, *probe_executor,
+          L_acceptHeader, included_header_tracker.get(), verify_hypothesis);
+
+      if (verify_hypothesis) {
+        std::cerr << "\nHeader order hypothesis: " << accepted_count << "/"
+                  << header_order.size()
+                  << " headers accepted from the first profile\n\n";
+      } else {
+        std::cerr << "\nHeader order hypothesis: " << accepted_count
+                  << " headers reused from the first target triple without "
+                     "probing them\n\n";
+
+        // The headers it left out are not probed again either
+        probe_headers = false;
+      }
+
+    } else if (cmdline_options.component_probes &&
+               !cmdline_options.isolate_probes) {
+      // A slow component no longer holds back the probes of the others;
+      // the union is verified once, and the headers that need a header of
+      // another component are left to the regular probes
+      StringList component_include_list;
+      std::size_t component_count;
+
+      if (!runComponentProbes(component_include_list, component_count,
+                              header_files, probe_executor_settings,
+                              cmdline_options.minimal_probe_prefix,
+                              header_scanner.get())) {
+        return false;
+      }
+
+      auto accepted_count = applyHeaderOrderHypothesis(
+          active_include_headers, header_files, component_include_list,
+          *probe_executor, L_acceptHeader, included_header_tracker.get());
+
+      std::cerr << "\nInclude graph components: " << component_count
+                << " probed concurrently, " << accepted_count << "/"
+                << component_include_list.size()
+                << " headers confirmed by the verification compile\n\n";
+
+    } else if (cmdline_options.minimal_probe_prefix) {
+      // The headers that only compile on top of unrelated ones are left to
+      // the regular probes, along with the ones the verification drops
+      auto minimal_include_list = runMinimalPrefixProbes(
+          header_files, *probe_executor, header_scanner.get());
+
+      auto accepted_count = applyHeaderOrderHypothesis(
+          active_include_headers, header_files, minimal_include_list,
+          *probe_executor, L_acceptHeader, included_header_tracker.get());
+
+      std::cerr << "\nMinimal prefix probes: " << accepted_count << "/"
+                << minimal_include_list.size()
+                << " headers confirmed by the verification compile\n\n";
+    }
+
+    if (!resume_checkpoint) {
+      probe_progress.sweep_start_count = active_include_headers.size();
+    }
+
+    auto locked_include_count = active_include_headers.size();
+    if (probe_headers) {
+      L_runProbes(probe_progress);
+    }
+
+    // The new headers may have fixed the ones that were set aside
+    if (!locked_header_files.empty() &&
+        active_include_headers.size() != locked_include_count) {
+      header_files.insert(header_files.end(),
+                          std::make_move_iterator(locked_header_files.begin()),
+                          std::make_move_iterator(locked_header_files.end()));
+
+      locked_header_files.clear();
+
+      probe_progress = {};
+      probe_progress.sweep_start_count = active_include_headers.size();
+      L_runProbes(probe_progress);
+    }
+
+    for (auto &header_desc : locked_header_files) {
+      locked_header_set.insert(header_desc.path);
+      header_files.push_back(std::move(header_desc));
+    }
+
+    locked_header_files.clear();
+
+    if (probe_executor->cancelled()) {
+      std::cerr << "\nThe run has been cancelled\n";
+      return false;
+    }
+
+    // A run interrupted during the final pass can skip the probing entirely
+    if (checkpoint_callback) {
+      ProbeProgress final_progress;
+      final_progress.header_index = header_files.size();
+      final_progress.sweep_start_count = active_include_headers.size();
+
+      L_writeCheckpoint(active_include_headers, header_files, {},
+                        final_progress);
+    }
+  }
+
+  return true;
+}
+
+/// Prints the statistics of the probes of the profile, along with the
+/// headers that have been discarded, and saves the probe costs
+void reportProbingResults(ProfileGenerationContext &context,
+                          const ProbingResult &probing,
+                          const std::vector<HeaderDescriptor> &header_files) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &time_report = context.shared_settings->time_report;
+  const auto &compiler_settings = context.compiler_settings;
+  const auto &probe_executor = context.probe_executor;
+  const auto &probe_executor_settings = context.probe_executor_settings;
+  const auto &failure_scheduler = context.failure_scheduler;
+  const auto &probe_cache = context.probe_cache;
+  const auto &pch_cache = context.pch_cache;
+  const auto &probe_cost_file = context.probe_cost_file;
+  const auto &base_includes_pch = context.base_includes_pch;
+  auto &header_prefetcher = context.header_prefetcher;
+
+  const auto &active_include_headers = probing.active_include_headers;
+  const auto &locked_header_set = probing.locked_header_set;
+  const auto &included_header_tracker = probing.included_header_tracker;
+
+  if (header_prefetcher) {
+    std::cerr << "\nHeader prefetch: " << header_prefetcher->fileCount()
+              << " files (" << (header_prefetcher->byteCount() / 1048576U)
+              << " MB) read ahead"
+              << (header_prefetcher->usesIoUring() ? " through io_uring" : "")
+              << "\n";
+
+    header_prefetcher.reset();
+  }
+
+  if (probe_executor_settings.probe_recorder &&
+      !probe_executor_settings.probe_recorder->close()) {
+    std::cerr << "Failed to write the probe log: "
+              << cmdline_options.probe_log_path << "\n";
+  }
+
+  if (!probe_cost_file.empty()) {
+    auto removed_count = probe_executor_settings.probe_cost_model->compact(
+        kProbeHistoryMaxIdleRunCount);
+
+    if (removed_count != 0U) {
+      std::cerr << "Probe history: " << removed_count
+                << " headers not used by the last "
+                << kProbeHistoryMaxIdleRunCount << " runs forgotten\n\n";
+    }
+
+    if (!probe_executor_settings.probe_cost_model->save(probe_cost_file)) {
+      std::cerr << "Failed to save the probe costs: " << probe_cost_file
+                << "\n";
+    }
+  }
+
+  // Saved in the metrics file, so that the benchmarks can tell whether an
+  // option changed the acceptance decisions
+  if (time_report) {
+    time_report->addStatistic(getPhaseName(context, "Accepted headers"),
+                              active_include_headers.size());
+
+    time_report->addStatistic(getPhaseName(context, "Discarded headers"),
+                              header_files.size());
+  }
+
+  std::cerr << "\n";
+
+  if (probe_cache) {
+    std::cerr << "Probe cache: " << probe_cache->hitCount() << " hits, "
+              << probe_cache->missCount() << " misses\n\n";
+
+    if (time_report) {
+      time_report->addStatistic("Probe cache hits", probe_cache->hitCount());
+      time_report->addStatistic("Probe cache misses",
+                                probe_cache->missCount());
+    }
+  }
+
+  if (included_header_tracker) {
+    std::cerr << "Included headers: "
+              << included_header_tracker->includedHeaderCount()
+              << " headers already included by the accepted ones\n\n";
+  }
+
+  if (failure_scheduler) {
+    std::cerr << "Failure classification: "
+              << failure_scheduler->droppedHeaderCount()
+              << " headers dropped after a permanent failure, "
+              << failure_scheduler->waitingHeaderCount()
+              << " waiting on an undeclared identifier\n\n";
+
+    if (cmdline_options.discover_prerequisites) {
+      std::cerr << "Prerequisite discovery: "
+                << failure_scheduler->resolvedPrerequisiteCount()
+                << " headers accepted right after a prerequisite\n\n";
+    }
+  }
+
+  if (cmdline_options.isolate_probes) {
+    std::cerr << "Isolated probes: "
+              << probe_executor->isolatedWorkerCrashCount()
+              << " worker processes lost while probing\n\n";
+  }
+
+  if (cmdline_options.probe_timeout != 0U) {
+    std::cerr << "Probe timeout: " << probe_executor->quarantinedHeaderCount()
+              << " headers quarantined after running for more than "
+              << cmdline_options.probe_timeout << " seconds\n\n";
+  }
+
+  if (probe_executor->timeBudgetExhausted()) {
+    std::cerr << "Time budget: " << probe_executor->unprobedHeaderCount()
+              << " headers left unprobed after "
+              << cmdline_options.probing_time_budget << " seconds\n\n";
+  }
+
+  if (probe_executor->memoryBudget() != 0U) {
+    std::cerr << "Memory admission: "
+              << probe_executor->delayedProbeCount()
+              << " probes delayed to stay within "
+              << (probe_executor->memoryBudget() >> 20U) << " MiB\n\n";
+  }
+
+  if (cmdline_options.resolve_include_directives) {
+    std::cerr << "Include directive resolution: "
+              << probe_executor->discardedDirectiveCount()
+              << " directives discarded without compiling them\n\n";
+  }
+
+  if (pch_cache && !base_includes_pch.empty()) {
+    std::cerr << "Precompiled base includes: "
+              << (pch_cache->hitCount() != 0U ? "loaded from the cache"
+                                               : "generated")
+              << "\n\n";
+  }
+
+  if (pch_cache) {
+    std::cerr << "Precompiled header cache: " << pch_cache->hitCount()
+              << " hits, " << pch_cache->missCount() << " misses, "
+              << (pch_cache->savedByteCount() >> 20U) << " MiB reused, "
+              << pch_cache->evictionCount() << " entries evicted ("
+              << (pch_cache->evictedByteCount() >> 20U) << " MiB)\n\n";
+
+    if (time_report) {
+      time_report->addStatistic("PCH cache hits", pch_cache->hitCount());
+      time_report->addStatistic("PCH cache misses", pch_cache->missCount());
+      time_report->addStatistic(
+          "PCH cache reused bytes",
+          static_cast<std::size_t>(pch_cache->savedByteCount()));
+      time_report->addStatistic("PCH cache evictions",
+                                pch_cache->evictionCount());
+      time_report->addStatistic(
+          "PCH cache evicted bytes",
+          static_cast<std::size_t>(pch_cache->evictedByteCount()));
+    }
+  }
+
+  if (compiler_settings.file_system_cache) {
+    const auto &file_system_cache = compiler_settings.file_system_cache;
+
+    std::cerr << "File system cache: " << file_system_cache->hitCount()
+              << " lookups served from memory, "
+              << file_system_cache->missCount()
+              << " forwarded to the file system\n\n";
+  }
+
+  // Print a list of the headers we couldn't import
+  if (!header_files.empty()) {
+    std::cerr << "Discarded headers\n\n";
+    for (const auto &header : header_files) {
+      std::cerr << "  {\"";
+      for (auto it = header.possible_prefixes.begin();
+           it != header.possible_prefixes.end(); it++) {
+        std::cerr << (*it);
+        if (std::next(it, 1) != header.possible_prefixes.end()) {
+          std::cerr << ", ";
+        }
+      }
+      std::cerr << "\"} " << header.name;
+
+      std::string failure_description;
+      if (probe_executor->isQuarantined(header)) {
+        failure_description = "timed out";
+      } else if (probe_executor->isUnprobed(header)) {
+        failure_description = "not probed within the time budget";
+      } else if (locked_header_set.count(header.path) != 0U) {
+        failure_description = "discarded by the lockfile";
+      } else if (failure_scheduler) {
+        failure_description = failure_scheduler->failureDescription(header);
+      }
+
+      if (!failure_description.empty()) {
+        std::cerr << " (" << failure_description << ")";
+      }
+
+      std::cerr << "\n";
+    }
+    std::cerr << "\n";
+  }
+}
+
+/// Compiles the accepted headers of the profile one last time with the AST
+/// visitor enabled. When the final pass fails, the headers that no longer
+/// compile together are dropped and it runs again, up to the recovery limit
+bool runProfileFinalPass(FinalPassResult &final_pass, ProbingResult &probing,
+                         const std::vector<HeaderDescriptor> &header_files,
+                         const HeaderOrdering &ordering,
+                         const ProfileGenerationContext &context) {
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &shared_settings = *context.shared_settings;
+  const auto &time_report = shared_settings.time_report;
+  const auto &parsed_base_includes = context.parsed_base_includes;
+  const auto &probe_executor = context.probe_executor;
+
+  auto &active_include_headers = probing.active_include_headers;
+  auto &pipelined_analysis = probing.pipelined_analysis;
+
+  auto &abi_library = final_pass.abi_library;
+  auto &dependency_list = final_pass.dependency_list;
+  auto &module_map_path = final_pass.module_map_path;
+  auto &module_header_count = final_pass.module_header_count;
+  auto &sliced_header_path = final_pass.sliced_header_path;
+
+  // We now have a list of includes that work fine; compile the source buffer
+  // one last time with our ASTVisitor enabled
+  auto visitor_settings = getFinalVisitorSettings(context);
+
+  auto source_buffer =
+      generateSourceBuffer(active_include_headers, parsed_base_includes);
+
+  auto final_compiler_settings = getFinalCompilerSettings(context);
+
+  // The bitcode also contains the inline functions used by the ABI library,
+  // so their bodies are needed
+  if (cmdline_options.emit_bitcode) {
+    final_compiler_settings.bitcode_output_path =
+        cmdline_options.output + ".bc";
+
+    final_compiler_settings.skip_function_bodies = false;
+  }
+
+  // Sliced out of the final AST, and verified before being used
+  sliced_header_path = cmdline_options.output + ".slice.h";
+  if (cmdline_options.sliced_header) {
+    final_compiler_settings.sliced_header_output_path = sliced_header_path;
+  }
+
+  // The accepted headers inside the header folders are imported from
+  // modules built once in the module cache, instead of being parsed as text.
+  // The module map is kept next to the output for the compile command
+  module_map_path = cmdline_options.output + ".modulemap";
+
+  if (!cmdline_options.module_cache_directory.empty()) {
+    module_header_count =
+        writeModuleMap(module_map_path, active_include_headers,
+                       final_compiler_settings, cmdline_options.header_folders);
+
+    if (module_header_count != 0U) {
+      final_compiler_settings.module_cache_path =
+          cmdline_options.module_cache_directory;
+
+      final_compiler_settings.module_map_file_list = {module_map_path};
+    }
+  }
+
+  // The analysis cache is keyed on everything that can change the results
+  // but the headers, which are tracked by each entry. The precompiled header
+  // path changes each time it is generated, so the base includes are hashed
+  // instead
+  AnalysisCacheRef analysis_cache;
+  if (cmdline_options.incremental_analysis) {
+    auto configuration_hash =
+        hashCompilerInstanceSettings(final_compiler_settings);
+
+    configuration_hash = updateContentHash(configuration_hash, source_buffer);
+    configuration_hash =
+        updateContentHash(configuration_hash, cmdline_options.base_includes);
+    configuration_hash = updateContentHash(
+        configuration_hash, final_compiler_settings.traversal_folders);
+    configuration_hash = updateContentHash(
+        configuration_hash,
+        static_cast<std::uint64_t>(visitor_settings.lazy_type_expansion));
+    configuration_hash = updateContentHash(
+        configuration_hash,
+        static_cast<std::uint64_t>(visitor_settings.analyze_while_parsing));
+    configuration_hash = updateContentHash(
+        configuration_hash,
+        static_cast<std::uint64_t>(visitor_settings.merge_redeclarations));
+    configuration_hash = updateContentHash(
+        configuration_hash,
+        static_cast<std::uint64_t>(visitor_settings.full_blacklist_causes));
+    configuration_hash = updateContentHash(
+        configuration_hash, cmdline_options.include_namespaces);
+    configuration_hash =
+        updateContentHash(configuration_hash, cmdline_options.exclude_names);
+
+    // The summarized records are no longer expanded, so the causes of the
+    // blacklisted functions depend on the summary
+    ContentHash type_summary_hash{0U};
+    if (visitor_settings.type_summary) {
+      type_summary_hash = hashTypeSummary(*visitor_settings.type_summary);
+    }
+
+    configuration_hash =
+        updateContentHash(configuration_hash, type_summary_hash);
+
+    for (const auto &binary_path :
+         {cmdline_options.binary_path, cmdline_options.verify_library_path}) {
+      ContentHash binary_hash{0U};
+      if (!binary_path.empty()) {
+        hashFileContents(binary_hash, binary_path);
+      }
+
+      configuration_hash = updateContentHash(configuration_hash, binary_path);
+      configuration_hash = updateContentHash(configuration_hash, binary_hash);
+    }
+
+    auto analysis_cache_status =
+        AnalysisCache::create(analysis_cache, cmdline_options.cache_directory,
+                              configuration_hash,
+                              shared_settings.fingerprint_index);
+    if (!analysis_cache_status.succeeded()) {
+      std::cerr << analysis_cache_status.toString() << "\n";
+      return false;
+    }
+
+    visitor_settings.analysis_cache = analysis_cache;
+  }
+
+  // The grouped analysis writes a translation unit per group, while the
+  // bitcode, the sliced header and the analysis cache expect a single one
+  auto analysis_group_size = cmdline_options.analysis_group_size;
+  if (analysis_group_size >= active_include_headers.size()) {
+    analysis_group_size = 0U;
+
+  } else if (analysis_group_size != 0U &&
+             (cmdline_options.emit_bitcode || cmdline_options.sliced_header ||
+              analysis_cache)) {
+    std::cerr << "Analysis groups: not used, the bitcode, the sliced header "
+                 "and the incremental analysis require a single translation "
+                 "unit\n\n";
+
+    analysis_group_size = 0U;
+  }
+
+  // The last accepted probe has already parsed the final source buffer,
+  // unless headers have been accepted or removed without compiling them
+  // afterwards; its translation unit is visited instead of being parsed
+  // again
+  ParsedTranslationUnitRef parsed_unit;
+  if (cmdline_options.reuse_probe_ast) {
+    parsed_unit = probe_executor->takeParsedTranslationUnit();
+
+    if (!parsed_unit) {
+      std::cerr << "Probe AST: not used, no accepted probe has been "
+                   "parsed\n\n";
+
+    } else if (analysis_group_size != 0U ||
+               cmdline_options.analysis_shards > 1U) {
+      std::cerr << "Probe AST: not used, the final analysis is split in "
+                   "multiple translation units\n\n";
+
+      parsed_unit.reset();
+
+    } else if (!canReuseParsedTranslationUnit(*parsed_unit, source_buffer,
+                                              final_compiler_settings)) {
+      std::cerr << "Probe AST: not used, the last accepted probe parsed a "
+                   "different source buffer\n\n";
+
+      parsed_unit.reset();
+
+    } else {
+      std::cerr << "Probe AST: reusing the translation unit of the last "
+                   "accepted probe\n\n";
+    }
+  }
+
+  {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "Final AST pass"));
+
+    bool succeeded = false;
+    if (parsed_unit) {
+      pipelined_analysis.reset();
+
+      succeeded = runParsedAnalysis(abi_library, *parsed_unit,
+                                    final_compiler_settings, visitor_settings,
+                                    time_report, &dependency_list);
+
+      parsed_unit.reset();
+
+    } else if (pipelined_analysis) {
+      succeeded = pipelined_analysis->finish(
+          abi_library, active_include_headers,
+          cmdline_options.analysis_shards, &dependency_list);
+
+    } else if (analysis_group_size != 0U) {
+      succeeded = runGroupedFinalAnalysis(
+          abi_library, active_include_headers, parsed_base_includes,
+          final_compiler_settings, visitor_settings, analysis_group_size,
+          cmdline_options.analysis_shards, time_report, &dependency_list);
+    } else {
+      succeeded = runFinalAnalysis(
+          abi_library, source_buffer, final_compiler_settings,
+          visitor_settings, cmdline_options.analysis_shards, time_report,
+          !shared_settings.multiple_profiles, &dependency_list,
+          getWorkerPlacement(cmdline_options));
+    }
+
+    if (!succeeded && probe_executor->cancelled()) {
+      std::cerr << "\nThe run has been cancelled\n";
+      return false;
+    }
+
+    // Headers that are not self-contained (or that depend on the macros
+    // defined by the previous ones) can't be built as modules; parse them
+    // as text instead
+    if (!succeeded && module_header_count != 0U) {
+      std::cerr << "\nThe headers could not be imported as clang modules; "
+                   "parsing them as text\n\n";
+
+      module_header_count = 0U;
+      final_compiler_settings.module_cache_path.clear();
+      final_compiler_settings.module_map_file_list.clear();
+
+      std::error_code error;
+      stdfs::remove(module_map_path, error);
+
+      if (analysis_group_size != 0U) {
+        succeeded = runGroupedFinalAnalysis(
+            abi_library, active_include_headers, parsed_base_includes,
+            final_compiler_settings, visitor_settings, analysis_group_size,
+            cmdline_options.analysis_shards, time_report, &dependency_list);
+      } else {
+        succeeded = runFinalAnalysis(
+            abi_library, source_buffer, final_compiler_settings,
+            visitor_settings, cmdline_options.analysis_shards, time_report,
+            !shared_settings.multiple_profiles, &dependency_list,
+            getWorkerPlacement(cmdline_options));
+      }
+    }
+
+    // Instead of discarding the probing work, the headers that no longer
+    // compile together are dropped and the final pass runs again. Each drop
+    // is saved to the checkpoint, so that a resumed run starts from the
+    // repaired include list
+    if (!succeeded && cmdline_options.final_pass_recovery_limit != 0U) {
+      std::cerr << "\nThe final pass failed; looking for the accepted headers "
+                   "that no longer compile together\n\n";
+
+      auto L_saveRepairedList = [&](const StringList &include_list) {
+        if (cmdline_options.checkpoint_interval == 0U) {
+          return;
+        }
+
+        ProbeProgress final_progress;
+        final_progress.header_index = header_files.size();
+        final_progress.sweep_start_count = include_list.size();
+
+        saveProbeCheckpoint(ordering, include_list, header_files, {},
+                            final_progress, {});
+      };
+
+      StringList dropped_list;
+      auto repaired = dropConflictingIncludeDirectives(
+          active_include_headers, dropped_list,
+          cmdline_options.final_pass_recovery_limit, *probe_executor,
+          L_saveRepairedList);
+
+      for (const auto &directive : dropped_list) {
+        std::cerr << "  Dropped " << directive << "\n";
+      }
+
+      if (!repaired) {
+        std::cerr << "\nThe include list still does not compile after "
+                     "dropping "
+                  << dropped_list.size() << " headers\n";
+
+      } else if (dropped_list.empty()) {
+        std::cerr << "The include list compiles; the failure is not caused "
+                     "by the accepted headers\n";
+
+      } else {
+        std::cerr << "\nRunning the final pass again without "
+                  << dropped_list.size() << " headers\n\n";
+
+        abi_library = {};
+        dependency_list.clear();
+
+        // The cache configuration has been hashed with the old buffer
+        visitor_settings.analysis_cache.reset();
+
+        source_buffer =
+            generateSourceBuffer(active_include_headers, parsed_base_includes);
+
+        if (analysis_group_size != 0U) {
+          succeeded = runGroupedFinalAnalysis(
+              abi_library, active_include_headers, parsed_base_includes,
+              final_compiler_settings, visitor_settings, analysis_group_size,
+              cmdline_options.analysis_shards, time_report, &dependency_list);
+        } else {
+          succeeded = runFinalAnalysis(
+              abi_library, source_buffer, final_compiler_settings,
+              visitor_settings, cmdline_options.analysis_shards, time_report,
+              !shared_settings.multiple_profiles, &dependency_list,
+              getWorkerPlacement(cmdline_options));
+        }
+      }
+    }
+
+    if (!succeeded) {
+      return false;
+    }
+  }
+
+  if (module_header_count != 0U) {
+    std::cerr << "Clang modules: " << module_header_count
+              << " headers imported from " << module_map_path << "\n\n";
+  } else if (!cmdline_options.module_cache_directory.empty()) {
+    std::cerr << "Clang modules: not used\n\n";
+  }
+
+  if (analysis_cache) {
+    std::cerr << "Analysis cache: " << analysis_cache->hitCount()
+              << " headers reused, " << analysis_cache->missCount()
+              << " analyzed\n\n";
+  }
+
+  return true;
+}
+
+/// Verifies the sliced header, saves the AST snapshot and renders the ABI
+/// library of the profile, along with the files saved next to it: the
+/// dependency file, the compile PCH, the ABI database and the lockfile.
+/// When an output library is passed, it receives the results
+bool writeProfileOutputs(FinalPassResult &final_pass, ProbingResult &probing,
+                         const std::vector<HeaderDescriptor> &header_files,
+                         const HeaderOrdering &ordering,
+                         const ProfileGenerationContext &context,
+                         ABILibrary *abi_library_output) {
+  auto &profile_manager = *context.profile_manager;
+  const auto &language_manager = *context.language_manager;
+  const auto &cmdline_options = *context.cmdline_options;
+  const auto &shared_settings = *context.shared_settings;
+  const auto &time_report = shared_settings.time_report;
+  const auto &compiler_settings = context.compiler_settings;
+  const auto &base_includes = context.base_includes;
+  const auto &probe_executor = context.probe_executor;
+
+  const auto &lockfile_path = ordering.lockfile_path;
+  const auto &lockfile_configuration_hash =
+      ordering.lockfile_configuration_hash;
+  const auto &closure_hash_map = ordering.closure_hash_map;
+  const auto &checkpoint_path = ordering.checkpoint_path;
+
+  auto &active_include_headers = probing.active_include_headers;
+
+  auto &abi_library = final_pass.abi_library;
+  auto &dependency_list = final_pass.dependency_list;
+  const auto &module_map_path = final_pass.module_map_path;
+  const auto &module_header_count = final_pass.module_header_count;
+  const auto &sliced_header_path = final_pass.sliced_header_path;
+
+  if (cmdline_options.sliced_header) {
+    ScopedPhaseTimer phase_timer(
+        time_report, getPhaseName(context, "Sliced header verification"));
+
+    if (loadSlicedHeader(abi_library, sliced_header_path, compiler_settings)) {
+      std::cerr << "Sliced header: " << abi_library.sliced_header.size()
+                << " bytes of declarations\n\n";
+    } else {
+      std::cerr << "Sliced header: not used, the discovered headers are "
+                   "included instead\n\n";
+    }
+  }
+
+  if (shared_settings.imported_symbols) {
+    auto found_symbol_count = abi_library.whitelisted_function_list.size() +
+                              abi_library.blacklisted_function_list.size();
+
+    std::cerr << "Binary imports: " << found_symbol_count << "/"
+              << shared_settings.imported_symbols->size()
+              << " imported symbols found in the headers\n\n";
+  }
+
+  if (shared_settings.exported_symbols) {
+    auto not_exported_count = std::count_if(
+        abi_library.blacklisted_function_list.begin(),
+        abi_library.blacklisted_function_list.end(),
+        [](const BlacklistedFunction &function) -> bool {
+          return function.reason == BlacklistedFunction::Reason::NotExported;
+        });
+
+    std::cerr << "Export verification: " << not_exported_count
+              << " functions not exported by "
+              << cmdline_options.verify_library_path << "\n\n";
+  }
+
+  // The snapshot is parsed from the whole source buffer, base includes
+  // included, since it is loaded without the precompiled headers of this
+  // run
+  if (cmdline_options.save_ast) {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "AST snapshot"));
+
+    ASTSnapshot snapshot;
+    snapshot.profile_name = cmdline_options.profile_name;
+    snapshot.language = cmdline_options.language;
+    snapshot.base_includes = base_includes;
+    snapshot.header_list = active_include_headers;
+
+    auto snapshot_path =
+        getASTSnapshotPath(cmdline_options.cache_directory,
+                           cmdline_options.profile_name,
+                           cmdline_options.language);
+
+    auto status = saveASTSnapshot(
+        snapshot, snapshot_path,
+        generateSourceBuffer(active_include_headers, base_includes),
+        compiler_settings);
+
+    if (status.succeeded()) {
+      std::cerr << "AST snapshot: " << snapshot.dependency_map.size()
+                << " files serialized; analyze it again with --from-ast "
+                << snapshot_path << "\n\n";
+    } else {
+      std::cerr << "AST snapshot: not saved, " << status.toString() << "\n\n";
+    }
+  }
+
+  // Saved once the library has been generated; the following runs can then
+  // verify the include list with a single compilation
+  HeaderLockfile new_lockfile;
+  new_lockfile.configuration_hash = lockfile_configuration_hash;
+  new_lockfile.include_list = active_include_headers;
+
+  for (const auto &header_desc : header_files) {
+    auto it = closure_hash_map.find(header_desc.path);
+    if (it != closure_hash_map.end()) {
+      new_lockfile.discarded_header_map.insert({header_desc.path, it->second});
+    }
+  }
+
+  abi_library.header_list = std::move(active_include_headers);
+
+  // The headers are resolved with the search order used while probing, so
+  // the compile command finds the same files
+  if (cmdline_options.emit_header_map) {
+    abi_library.header_path_list = resolveUniqueIncludePaths(
+        abi_library.header_list, getHeaderSearchPaths(compiler_settings));
+  }
+
+  // Render the ABI library
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, cmdline_options.profile_name);
+
+  assert(prof_mgr_status.succeeded());
+
+  {
+    ScopedPhaseTimer phase_timer(
+        time_report, getPhaseName(context, "ABI library generation"));
+
+    auto library_options = cmdline_options;
+    library_options.base_includes = base_includes;
+
+    StringList output_file_list;
+    auto status = generateABILibrary(library_options, abi_library, profile,
+                                     &output_file_list,
+                                     shared_settings.rendered_file_map);
+    if (!status.succeeded()) {
+      std::cerr << status.message() << "\n";
+      return false;
+    }
+
+    if (cmdline_options.dual_mangling &&
+        !generateAlternateABILibrary(library_options, abi_library, profile,
+                                     output_file_list,
+                                     shared_settings.rendered_file_map)) {
+      return false;
+    }
+
+    // The discarded headers are listed too, since the output changes as
+    // soon as they start to compile
+    if (!cmdline_options.depfile_path.empty()) {
+      for (const auto &header_desc : header_files) {
+        dependency_list.push_back(header_desc.path);
+      }
+
+      if (!writeDependencyFile(cmdline_options.depfile_path, output_file_list,
+                               dependency_list)) {
+        std::cerr << "Failed to write the dependency file: "
+                  << cmdline_options.depfile_path << "\n";
+        return false;
+      }
+    }
+  }
+
+  // The header is precompiled with the options the compile command is
+  // expected to receive: the include folders used while probing, and the
+  // module map and the header map saved next to the output
+  if (cmdline_options.emit_pch && !shared_settings.rendered_file_map) {
+    ScopedPhaseTimer phase_timer(
+        time_report, getPhaseName(context, "Compile PCH generation"));
+
+    auto compile_options = cmdline_options;
+    compile_options.additional_include_folders =
+        compiler_settings.additional_include_folders;
+
+    compile_options.module_map_files.clear();
+    if (module_header_count != 0U) {
+      compile_options.module_map_files.push_back(module_map_path);
+    } else {
+      compile_options.module_cache_directory.clear();
+    }
+
+    compile_options.header_map_path.clear();
+    if (cmdline_options.emit_header_map) {
+      compile_options.header_map_path = cmdline_options.output + ".hmap";
+    }
+
+    auto pch_path = cmdline_options.output + ".pch";
+    if (!buildCompilePrecompiledHeader(profile_manager, language_manager,
+                                       compile_options,
+                                       cmdline_options.output + ".h",
+                                       pch_path)) {
+      return false;
+    }
+
+    std::cerr << "Compile PCH: saved to " << pch_path << "\n\n";
+  }
+
+  if (shared_settings.event_stream) {
+    shared_settings.event_stream->emit(
+        "profile_finished",
+        {{"profile", cmdline_options.profile_name},
+         {"accepted_headers",
+          static_cast<double>(abi_library.header_list.size())},
+         {"discarded_headers", static_cast<double>(header_files.size())},
+         {"whitelisted_functions",
+          static_cast<double>(abi_library.whitelisted_function_list.size())},
+         {"blacklisted_functions",
+          static_cast<double>(
+              abi_library.blacklisted_function_list.size())}});
+  }
+
+  if (cmdline_options.save_database) {
+    ABIDatabase database;
+    database.profile_name = cmdline_options.profile_name;
+    database.language = cmdline_options.language;
+    database.base_includes = base_includes;
+
+    // The library is only copied when the caller also wants the results
+    if (abi_library_output != nullptr) {
+      database.abi_library = abi_library;
+    } else {
+      database.abi_library = std::move(abi_library);
+    }
+
+    auto database_path = cmdline_options.output + kABIDatabaseExtension;
+    if (!writeABIDatabase(database, database_path)) {
+      std::cerr << "Failed to write the ABI database: " << database_path
+                << "\n";
+      return false;
+    }
+  }
+
+  // The headers left unprobed must not be recorded as discarded
+  if (probe_executor->unprobedHeaderCount() != 0U) {
+    std::cerr << "The lockfile has not been updated, since the time budget "
+                 "ran out\n\n";
+
+  } else if (!writeHeaderLockfile(new_lockfile, lockfile_path)) {
+    std::cerr << "Failed to write the lockfile: " << lockfile_path << "\n";
+  }
+
+  std::error_code error;
+  stdfs::remove(checkpoint_path, error);
+
+  if (abi_library_output != nullptr) {
+    *abi_library_output = std::move(abi_library);
+  }
+
+  return true;
+}
+
+/// Receives the include list accepted by a profile
+using HeaderOrderCallback = std::function<void(const StringList &)>;
+
+/// Generates the ABI library of the profile selected by the command line
+/// options. When a valid hypothesis is passed, the include list accepted by
+/// another profile is verified first, and only the headers it leaves out
+/// are probed; if verify_hypothesis is false, it is accepted as is and no
+/// header is probed at all. The accepted include list is otherwise passed
+/// to the header order callback, if any, as soon as the probing is over.
+/// When an output library is passed, it receives the results of the profile
+bool generateProfileLibrary(
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options,
+    std::vector<HeaderDescriptor> header_files,
+    const SharedGenerateSettings &shared_settings,
+    const std::shared_future<StringList> &header_order_hypothesis,
+    bool verify_hypothesis, const HeaderOrderCallback &header_order_callback,
+    ABILibrary *abi_library_output = nullptr) {
+  const auto &time_report = shared_settings.time_report;
+
+  ProfileGenerationContext context;
+  context.profile_manager = &profile_manager;
+  context.language_manager = &language_manager;
+  context.cmdline_options = &cmdline_options;
+  context.shared_settings = &shared_settings;
+
+  // Allocate the compiler instances used to probe the headers; profiles are
+  // loaded on first use
+  auto &compiler_settings = context.compiler_settings;
+
+  {
+    ScopedPhaseTimer phase_timer(time_report,
+                                 getPhaseName(context, "Profile loading"));
+
+    if (!createCompilerInstanceSettings(compiler_settings, profile_manager,
+                                        language_manager, cmdline_options)) {
+      return false;
+    }
+  }
+
+  compiler_settings.clang_teardown = getClangTeardown(cmdline_options, false);
+
+  // The lookups are keyed on the absolute path, so the profiles generated
+  // by the same command can share them
+  if (shared_settings.file_system_cache) {
+    compiler_settings.file_system_cache = shared_settings.file_system_cache;
+  }
+
+  // Requests executed by the serve command share the cached lookups of the
+  // profile folders
+  const auto &resident_state = cmdline_options.resident_state;
+  if (resident_state && !compiler_settings.file_system_cache) {
+    compiler_settings.file_system_cache =
+        resident_state->fileSystemCache(compiler_settings.profile);
+  }
+
+  // Each forked probe would otherwise keep the lookups it makes in its own
+  // copy of the cache, and lose them when it exits
+  if (cmdline_options.fork_probes && compiler_settings.file_system_cache &&
+      !compiler_settings.file_system_cache->enableProcessSharing()) {
+    std::cerr << "File system cache: the forked probes can't share the "
+                 "lookups, the shared memory table could not be created\n\n";
+  }
+
+  // The records defined by the system headers are looked up in the summary
+  // built by the build_profile_summary command instead of being expanded
+  // again for each library
+  auto &type_summary = context.type_summary;
+  if (cmdline_options.use_profile_summary) {
+    auto summary = std::make_shared<TypeSummary>();
+
+    std::string error_message;
+    if (loadTypeSummary(*summary, error_message, compiler_settings,
+                        cmdline_options.cache_directory)) {
+      std::cerr << "Profile type summary: " << summary->reachability_map.size()
+                << " system types loaded\n\n";
+
+      type_summary = std::move(summary);
+
+    } else {
+      std::cerr << error_message << "\n";
+    }
+  }
+
+  if (!cmdline_options.ast_snapshot_path.empty()) {
+    return generateSnapshotLibrary(profile_manager, cmdline_options,
+                                   compiler_settings, shared_settings,
+                                   type_summary, abi_library_output);
+  }
+
+  // The map is built from the whole header list, before any header is
+  // discarded; the included files are found through it as well
+  if (cmdline_options.use_header_map) {
+    StringList header_path_list;
+    for (const auto &header_desc : header_files) {
+      header_path_list.push_back(header_desc.path);
+    }
+
+    auto header_map_status =
+        HeaderMap::create(compiler_settings.header_map, header_path_list,
+                          compiler_settings.additional_include_folders);
+
+    if (!header_map_status.succeeded()) {
+      std::cerr << header_map_status.toString() << "\n";
+      return false;
+    }
+
+    std::cerr << "Header map: " << compiler_settings.header_map->entryCount()
+              << " include names resolved with a single lookup\n\n";
+  }
+
+  // On cold runs the first probes would otherwise wait on the disk for each
+  // #include; the files are read ahead while the probing starts, and the
+  // ones that are still pending once it is over are skipped
+  auto &header_prefetcher = context.header_prefetcher;
+  if (cmdline_options.prefetch_headers) {
+    StringList candidate_header_list;
+    for (const auto &header_desc : header_files) {
+      candidate_header_list.push_back(header_desc.path);
+    }
+
+    header_prefetcher = llvm::make_unique<HeaderPrefetcher>(
+        candidate_header_list, getHeaderSearchPaths(compiler_settings),
+        kHeaderPrefetchThreadCount, compiler_settings.file_system_cache);
+  }
+
+  // The system headers precompiled by the build_profile_pch command are
+  // loaded before the base includes. They are also added to the base
+  // includes of the ABI library, since the accepted headers may depend on
+  // them; the precompiled prefix already contains the base includes, and
+  // can't be combined with them
+  auto &base_includes = context.base_includes;
+  base_includes = cmdline_options.base_includes;
+  std::string profile_pch;
+
+  if (cmdline_options.use_profile_pch &&
+      cmdline_options.use_precompiled_prefix) {
+    std::cerr << "The --profile-pch option is ignored when using the "
+                 "precompiled prefix\n";
+
+  } else if (cmdline_options.use_profile_pch) {
+    ProfilePrecompiledHeader precompiled_header;
+    auto status = profile_manager->getPrecompiledHeader(
+        precompiled_header, compiler_settings.profile,
+        compiler_settings.language, compiler_settings.language_standard,
+        compiler_settings.enable_gnu_extensions,
+        cmdline_options.cache_directory);
+
+    if (!status.succeeded()) {
+      std::cerr << status.message() << "\n";
+
+    } else if (precompiled_header.settings_hash !=
+               hashProfileSettings(compiler_settings)) {
+      std::cerr << "The precompiled system headers have been built with "
+                   "different settings; run the build_profile_pch command "
+                   "again\n";
+
+    } else {
+      profile_pch = precompiled_header.path;
+      base_includes.insert(base_includes.begin(),
+                           precompiled_header.header_list.begin(),
+                           precompiled_header.header_list.end());
+
+      std::cerr << "Profile precompiled header: "
+                << precompiled_header.header_list.size()
+                << " system headers loaded from " << profile_pch << "\n\n";
+    }
+  }
+
+  ProbeTierList probe_tier_list;
+  if (!parseProbeTierList(probe_tier_list, cmdline_options.probe_tiers)) {
+    std::cerr << "Invalid probe tier list: " << cmdline_options.probe_tiers
+              << "\n";
+    return false;
+  }
+
+  // The probe cache is keyed on the compiler settings, the probe tiers, the
+  // base includes and the list of candidate headers; probe outcomes may
+  // change when a header is added or removed, even if none of the files that
+  // the probe read has been modified
+  auto &probe_cache = context.probe_cache;
+  if (!cmdline_options.cache_directory.empty()) {
+    auto configuration_hash = hashCompilerInstanceSettings(compiler_settings);
+    configuration_hash =
+        updateContentHash(configuration_hash, cmdline_options.probe_tiers);
+    configuration_hash =
+        updateContentHash(configuration_hash, base_includes);
+
+    for (const auto &header_desc : header_files) {
+      configuration_hash =
+          updateContentHash(configuration_hash, header_desc.name);
+      configuration_hash = updateContentHash(configuration_hash,
+                                             header_desc.possible_prefixes);
+    }
+
+    auto probe_cache_status =
+        ProbeCache::create(probe_cache, cmdline_options.cache_directory,
+                           configuration_hash, shared_settings.remote_cache,
+                           shared_settings.fingerprint_index);
+    if (!probe_cache_status.succeeded()) {
+      std::cerr << probe_cache_status.toString() << "\n";
+      return false;
+    }
+  }
+
+  auto &probe_executor_settings = context.probe_executor_settings;
+  probe_executor_settings.compiler_settings = compiler_settings;
+  probe_executor_settings.compiler_settings.stop_at_first_error =
+      cmdline_options.stop_at_first_error;
+  probe_executor_settings.compiler_settings.time_budget =
+      cmdline_options.probe_timeout;
+  probe_executor_settings.compiler_settings.ignore_warnings =
+      !cmdline_options.verbose_diagnostics;
+  probe_executor_settings.verbose_diagnostics =
+      cmdline_options.verbose_diagnostics;
+  probe_executor_settings.worker_count = cmdline_options.jobs;
+  probe_executor_settings.worker_placement =
+      getWorkerPlacement(cmdline_options);
+  probe_executor_settings.memory_budget =
+      static_cast<std::uint64_t>(cmdline_options.memory_budget) << 20U;
+  probe_executor_settings.use_precompiled_prefix =
+      cmdline_options.use_precompiled_prefix;
+  probe_executor_settings.probe_tier_list = probe_tier_list;
+  probe_executor_settings.probe_cache = probe_cache;
+  probe_executor_settings.resolve_include_directives =
+      cmdline_options.resolve_include_directives;
+  // Once an umbrella header is accepted, the headers it includes are
+  // satisfied without probing them
+  const auto track_included_headers =
+      cmdline_options.skip_included_headers ||
+      cmdline_options.header_order == "umbrella";
+
+  probe_executor_settings.track_included_headers = track_included_headers;
+
+  // The probe costs measured by the previous run of this profile decide
+  // which headers the parallel workers start from
+  auto &probe_cost_file = context.probe_cost_file;
+  probe_executor_settings.probe_cost_model = std::make_shared<ProbeCostModel>();
+
+  if (!cmdline_options.cache_directory.empty()) {
+    probe_cost_file = (stdfs::path(cmdline_options.cache_directory) /
+                       "probe_costs" / cmdline_options.profile_name)
+                          .string();
+
+    probe_executor_settings.probe_cost_model->load(probe_cost_file);
+  }
+
+  // Only the sequential strategy schedules the probes by failure cause; the
+  // automatic selection may pick it once the executor exists
+  auto &failure_scheduler = context.failure_scheduler;
+  if (cmdline_options.classify_probe_failures &&
+      (cmdline_options.probe_strategy == "sequential" ||
+       cmdline_options.probe_strategy == "auto")) {
+    failure_scheduler = llvm::make_unique<ProbeFailureScheduler>();
+    probe_executor_settings.classify_failures = true;
+  }
+  probe_executor_settings.time_report = time_report;
+  probe_executor_settings.event_stream = shared_settings.event_stream;
+
+  // Probes built on top of the precompiled prefix only parse the new header,
+  // so none of them sees the whole source buffer of the final pass
+  probe_executor_settings.retain_parsed_translation_unit =
+      cmdline_options.reuse_probe_ast &&
+      !cmdline_options.use_precompiled_prefix;
+
+  // The serve and batch commands always run other threads next to the
+  // command; see CompilerInstance::canForkProcess()
+  probe_executor_settings.fork_probes =
+      cmdline_options.fork_probes && !cmdline_options.resident_state;
+  probe_executor_settings.race_include_directives =
+      cmdline_options.race_include_directives;
+  probe_executor_settings.probing_time_budget =
+      cmdline_options.probing_time_budget;
+
+  // The base includes are loaded from a precompiled header, instead of
+  // being parsed again by each probe and by the final pass. The serve and
+  // batch commands always keep one; it can't be combined with the
+  // precompiled prefix, which already contains the base includes
+  auto &pch_cache = context.pch_cache;
+  auto &base_includes_pch = context.base_includes_pch;
+
+  const auto precompile_base_includes =
+      !cmdline_options.use_precompiled_prefix &&
+      !cmdline_options.base_includes.empty() &&
+      (resident_state || cmdline_options.precompile_base_includes);
+
+  // The precompiled prefixes are only kept when there is a cache folder to
+  // reuse them from; otherwise each worker rebuilds them in a temporary one
+  const auto cache_precompiled_prefix =
+      cmdline_options.use_precompiled_prefix &&
+      !cmdline_options.cache_directory.empty();
+
+  if ((precompile_base_includes && !resident_state) ||
+      cache_precompiled_prefix) {
+    auto pch_cache_status = PCHCache::create(
+        pch_cache, cmdline_options.cache_directory,
+        shared_settings.remote_cache,
+        static_cast<std::uint64_t>(cmdline_options.pch_cache_size_limit)
+            << 20U);
+
+    if (!pch_cache_status.succeeded()) {
+      std::cerr << pch_cache_status.toString() << "\n";
+      return false;
+    }
+
+    if (cache_precompiled_prefix) {
+      probe_executor_settings.pch_cache = pch_cache;
+    }
+  }
+
+  if (precompile_base_includes) {
+    ScopedPhaseTimer phase_timer(
+        time_report, getPhaseName(context, "Base include precompilation"));
+
+    if (resident_state) {
+      base_includes_pch = resident_state->precompiledBaseIncludes(
+          compiler_settings, base_includes);
+
+    } else {
+      base_includes_pch =
+          pch_cache->baseIncludes(compiler_settings, base_includes);
+    }
+
+    if (base_includes_pch.empty()) {
+      std::cerr << "The base includes could not be precompiled; they will "
+                   "be parsed by each probe\n";
+    }
+  }
+
+  // The base includes that are not part of the precompiled header still have
+  // to be parsed by the probes and by the final pass
+  auto &precompiled_header = context.precompiled_header;
+  auto &parsed_base_includes = context.parsed_base_includes;
+
+  if (!base_includes_pch.empty()) {
+    precompiled_header = base_includes_pch;
+
+  } else if (!profile_pch.empty()) {
+    precompiled_header = profile_pch;
+    parsed_base_includes = cmdline_options.base_includes;
+
+  } else {
+    parsed_base_includes = base_includes;
+  }
+
+  probe_executor_settings.compiler_settings.precompiled_header =
+      precompiled_header;
+
+  probe_executor_settings.base_includes = parsed_base_includes;
+
+  addRemoteProbeWorkers(context);
+
+  if (!cmdline_options.probe_log_path.empty()) {
+    auto status = ProbeRecorder::create(
+        probe_executor_settings.probe_recorder, cmdline_options.probe_log_path,
+        cmdline_options.jobs, cmdline_options.probe_strategy);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+  }
+
+  auto &probe_executor = context.probe_executor;
+  auto probe_executor_status =
+      ProbeExecutor::create(probe_executor, probe_executor_settings);
+  if (!probe_executor_status.succeeded()) {
+    std::cerr << probe_executor_status.toString() << "\n";
+    return false;
+  }
+
+  if (cmdline_options.fork_probes && !probe_executor->forkedProbesEnabled()) {
+    std::cerr << "Forked probes: not used, the child processes can't report "
+                 "what the probe cache, the precompiled prefix, the probe "
+                 "log, the remote workers, the included header tracking and "
+                 "the failure classification need, the parse tier is "
+                 "required, and the process must not be running other "
+                 "threads, such as the ones of the serve and batch "
+                 "commands\n\n";
+  }
+
+  HeaderOrdering ordering;
+  orderCandidateHeaders(ordering, header_files, context);
+
+  ProbingResult probing;
+  if (!probeCandidateHeaders(probing, header_files, ordering, context,
+                             header_order_hypothesis, verify_hypothesis)) {
+    return false;
+  }
+
+  if (header_order_callback) {
+    header_order_callback(probing.active_include_headers);
+  }
+
+  reportProbingResults(context, probing, header_files);
+
+  FinalPassResult final_pass;
+  if (!runProfileFinalPass(final_pass, probing, header_files, ordering,
+                           context)) {
+    return false;
+  }
+
+  return writeProfileOutputs(final_pass, probing, header_files, ordering,
+                             context, abi_library_output);
+}
+
+/// Set by the signal handler when the watch mode has to stop
+std::atomic_bool watch_mode_interrupted{false};
+
+/// Stops the watch mode on SIGINT and SIGTERM
+void watchModeSignalHandler(int) { watch_mode_interrupted = true; }
+
+/// Runs the 'generate' command, then runs it again each time the header
+/// folders change. The resident state keeps the precompiled base includes
+/// alive across the runs, the probe cache skips the probes whose files did
+/// not change and the analysis cache (when it can be used) only analyzes
+/// the changed headers again; the outputs are only rewritten when their
+/// contents change
+bool runWatchMode(ProfileManagerRef &profile_manager,
+                  const LanguageManager &language_manager,
+                  const CommandLineOptions &cmdline_options) {
+  // The commands executed by serve and batch must return
+  if (cmdline_options.resident_state) {
+    std::cerr << "The --watch option can't be used by the serve and batch "
+                 "commands\n";
+    return false;
+  }
+
+  auto watch_options = cmdline_options;
+  watch_options.watch = false;
+
+  auto resident_state_status = ResidentState::create(
+      watch_options.resident_state, cmdline_options.state_directory);
+
+  if (!resident_state_status.succeeded()) {
+    std::cerr << resident_state_status.toString() << "\n";
+    return false;
+  }
+
+  std::error_code error;
+  stdfs::path temporary_cache_directory;
+
+  if (watch_options.cache_directory.empty()) {
+    std::random_device random_device;
+    temporary_cache_directory =
+        stdfs::temp_directory_path(error) /
+        ("abigen-watch-" + std::to_string(random_device()));
+
+    if (error || !stdfs::create_directories(temporary_cache_directory, error)) {
+      std::cerr << "Failed to create the cache folder for the watch mode\n";
+      return false;
+    }
+
+    watch_options.cache_directory = temporary_cache_directory.string();
+  }
+
+  // Same restrictions as the ones enforced for --incremental-analysis
+  if (watch_options.analysis_shards <= 1U && !watch_options.sliced_header &&
+      !watch_options.emit_bitcode && !watch_options.dual_mangling &&
+      watch_options.ast_snapshot_path.empty()) {
+    watch_options.incremental_analysis = true;
+  }
+
+  HeaderWatcherRef header_watcher;
+  auto header_watcher_status =
+      HeaderWatcher::create(header_watcher, watch_options.header_folders);
+
+  if (!header_watcher_status.succeeded()) {
+    std::cerr << header_watcher_status.toString() << "\n";
+    stdfs::remove_all(temporary_cache_directory, error);
+    return false;
+  }
+
+  // Changes to the files we write ourselves must not start a new run
+  auto L_isGeneratedFile = [&](const std::string &path) -> bool {
+    const auto &cache_directory = watch_options.cache_directory;
+    const auto &output = watch_options.output;
+
+    return path.compare(0U, cache_directory.size(), cache_directory) == 0 ||
+           (!output.empty() && path.compare(0U, output.size(), output) == 0);
+  };
+
+  for (std::size_t run_count = 1U;; ++run_count) {
+    auto succeeded = runGenerateCommand(profile_manager, language_manager,
+                                        watch_options, nullptr);
+
+    std::cerr << "Watch mode: run " << run_count
+              << (succeeded ? " succeeded" : " failed")
+              << "; waiting for changes to the headers (Ctrl+C to stop)\n\n";
+
+    // Only the wait can be interrupted; stopping in the middle of a run
+    // terminates the process as usual
+    watch_mode_interrupted = false;
+    auto previous_sigint_handler =
+        std::signal(SIGINT, watchModeSignalHandler);
+    auto previous_sigterm_handler =
+        std::signal(SIGTERM, watchModeSignalHandler);
+
+    StringList changed_file_list;
+    bool changed = false;
+
+    while (!changed) {
+      if (!header_watcher->wait(changed_file_list, watch_mode_interrupted)) {
+        break;
+      }
+
+      changed_file_list.erase(std::remove_if(changed_file_list.begin(),
+                                             changed_file_list.end(),
+                                             L_isGeneratedFile),
+                              changed_file_list.end());
+
+      changed = !changed_file_list.empty();
+    }
+
+    std::signal(SIGINT, previous_sigint_handler);
+    std::signal(SIGTERM, previous_sigterm_handler);
+
+    if (!changed) {
+      break;
+    }
+
+    std::cerr << "Watch mode: " << changed_file_list.size()
+              << " files changed\n";
+
+    const std::size_t kMaxListedFileCount = 10U;
+    for (std::size_t i = 0U;
+         i < std::min(changed_file_list.size(), kMaxListedFileCount); ++i) {
+      std::cerr << "  " << changed_file_list.at(i) << "\n";
+    }
+
+    if (changed_file_list.size() > kMaxListedFileCount) {
+      std::cerr << "  ...\n";
+    }
+
+    std::cerr << "\n";
+  }
+
+  stdfs::remove_all(temporary_cache_directory, error);
+  return true;
+}
+}  // namespace
+
+bool runGenerateCommand(ProfileManagerRef &profile_manager,
+                        const LanguageManager &language_manager,
+                        const CommandLineOptions &cmdline_options,
+                        ABILibrary *abi_library,
+                        RenderedFileMap *rendered_file_map) {
+  // The bitcode is generated from a single AST, so it can't be combined with
+  // the sharded analysis
+  if (cmdline_options.emit_bitcode && cmdline_options.analysis_shards > 1U) {
+    std::cerr << "The --emit-bitcode option can't be used together with "
+                 "--analysis-shards\n";
+    return false;
+  }
+
+  // The same goes for the sliced header, which is only supported for C
+  if (cmdline_options.sliced_header) {
+    if (cmdline_options.analysis_shards > 1U) {
+      std::cerr << "The --sliced-header option can't be used together with "
+                   "--analysis-shards\n";
+      return false;
+    }
+
+    if (cmdline_options.language.find("cxx") != std::string::npos) {
+      std::cerr << "The --sliced-header option is only supported for C\n";
+      return false;
+    }
+  }
+
+  // Cached results only carry the function lists, while these options also
+  // need the declarations; the cache is also keyed on a single AST
+  if (cmdline_options.incremental_analysis) {
+    if (cmdline_options.cache_directory.empty()) {
+      std::cerr << "The --incremental-analysis option requires --cache-dir\n";
+      return false;
+    }
+
+    if (cmdline_options.analysis_shards > 1U ||
+        cmdline_options.sliced_header || cmdline_options.emit_bitcode) {
+      std::cerr << "The --incremental-analysis option can't be used together "
+                   "with --analysis-shards, --sliced-header or "
+                   "--emit-bitcode\n";
+      return false;
+    }
+
+    // The cached function lists only hold the primary mangled names
+    if (cmdline_options.dual_mangling) {
+      std::cerr << "The --incremental-analysis option can't be used together "
+                   "with --dual-mangling\n";
+      return false;
+    }
+  }
+
+  // Precompiled headers are built without modules, and can't be loaded by
+  // a modules enabled final pass
+  if (!cmdline_options.module_cache_directory.empty() &&
+      (cmdline_options.precompile_base_includes ||
+       cmdline_options.use_profile_pch)) {
+    std::cerr << "The --module-cache option can't be used together with "
+                 "--precompile-base-includes or --use-profile-pch\n";
+    return false;
+  }
+
+  if (!cmdline_options.remote_cache_url.empty() &&
+      cmdline_options.cache_directory.empty()) {
+    std::cerr << "The --remote-cache option requires --cache-dir\n";
+    return false;
+  }
+
+  if (cmdline_options.cache_size_limit != 0U &&
+      cmdline_options.remote_cache_url.empty()) {
+    std::cerr << "The --cache-size-limit option requires --remote-cache\n";
+    return false;
+  }
+
+  if (cmdline_options.save_ast && cmdline_options.cache_directory.empty()) {
+    std::cerr << "The --save-ast option requires --cache-dir\n";
+    return false;
+  }
+
+  if (cmdline_options.discover_prerequisites &&
+      !cmdline_options.classify_probe_failures) {
+    std::cerr << "The --discover-prerequisites option requires "
+                 "--classify-failures\n";
+    return false;
+  }
+
+  // The snapshot only holds the declarations, parsed as a single translation
+  // unit by the run that saved it
+  const auto analyze_ast_snapshot = !cmdline_options.ast_snapshot_path.empty();
+  if (analyze_ast_snapshot &&
+      (cmdline_options.save_ast || cmdline_options.emit_bitcode ||
+       cmdline_options.sliced_header || cmdline_options.incremental_analysis)) {
+    std::cerr << "The --from-ast option can't be used together with "
+                 "--save-ast, --emit-bitcode, --sliced-header or "
+                 "--incremental-analysis\n";
+    return false;
+  }
+
+  StringList profile_name_list;
+  if (!parseProfileNameList(profile_name_list, cmdline_options.profile_name)) {
+    std::cerr << "Invalid profile list: " << cmdline_options.profile_name
+              << "\n";
+    return false;
+  }
+
+  // Without a list, the default target of the host is used
+  StringList target_triple_list;
+  if (cmdline_options.target_triples.empty()) {
+    target_triple_list.push_back(std::string());
+
+  } else if (!parseTargetTripleList(target_triple_list,
+                                    cmdline_options.target_triples)) {
+    std::cerr << "Invalid target triple list: "
+              << cmdline_options.target_triples << "\n";
+    return false;
+  }
+
+  auto multiple_triples = target_triple_list.size() > 1U;
+
+  if ((abi_library != nullptr || rendered_file_map != nullptr) &&
+      (profile_name_list.size() > 1U || multiple_triples)) {
+    std::cerr << "The ABI library can only be returned for a single profile "
+                 "and target triple\n";
+    return false;
+  }
+
+  if (analyze_ast_snapshot &&
+      (profile_name_list.size() > 1U || multiple_triples)) {
+    std::cerr << "The AST snapshot belongs to a single profile and target "
+                 "triple\n";
+    return false;
+  }
+
+  // The trace and metrics files are built from the same measurements as the
+  // report
+  TimeReportRef time_report;
+  if (cmdline_options.time_report || cmdline_options.hardware_counters ||
+      !cmdline_options.trace_file.empty() ||
+      !cmdline_options.metrics_file.empty()) {
+    time_report = std::make_shared<TimeReport>();
+
+    if (cmdline_options.hardware_counters) {
+      time_report->enableHardwareCounters();
+    }
+  }
+
+  // Only the arrays allocated from now on are affected
+  setHugePageBacking(cmdline_options.huge_pages);
+
+  // The samples are tagged by the phase timers, which do not need the time
+  // report for this
+  SampleProfilerRef sample_profiler;
+  if (!cmdline_options.profile_samples.empty()) {
+    auto sample_profiler_status = SampleProfiler::create(sample_profiler);
+    if (!sample_profiler_status.succeeded()) {
+      std::cerr << sample_profiler_status.toString() << "\n";
+      return false;
+    }
+  }
+
+  // The recorder must never stop the run; embedders that already have one
+  // active, or platforms without signals, simply go without it
+  FlightRecorderRef flight_recorder;
+  if (!cmdline_options.disable_flight_recorder && !FlightRecorder::active()) {
+    auto flight_recorder_path = cmdline_options.flight_recorder_path;
+    if (flight_recorder_path.empty()) {
+      flight_recorder_path = cmdline_options.output + ".flight";
+    }
+
+    auto flight_recorder_status =
+        FlightRecorder::create(flight_recorder, flight_recorder_path,
+                               cmdline_options.flight_recorder_deadline);
+
+    if (!flight_recorder_status.succeeded() &&
+        flight_recorder_status.statusCode() !=
+            FlightRecorder::StatusCode::NotSupported) {
+      std::cerr << "The flight recorder could not be started: "
+                << flight_recorder_status.toString() << "\n\n";
+    }
+  }
+
+  if (getWorkerPlacement(cmdline_options) != WorkerPlacement::None) {
+    std::cerr << "Worker placement: " << cmdline_options.worker_placement
+              << ", " << getNUMANodeCount() << " NUMA nodes\n\n";
+  }
+
+  // The phase boundaries are reported by the phase timers, so the time
+  // report is needed as well
+  EventStreamRef event_stream;
+  if (cmdline_options.event_callback ||
+      !cmdline_options.event_destination.empty()) {
+    auto event_stream_status =
+        cmdline_options.event_callback
+            ? EventStream::create(event_stream, cmdline_options.event_callback)
+            : EventStream::create(event_stream,
+                                  cmdline_options.event_destination);
+
+    if (!event_stream_status.succeeded()) {
+      std::cerr << event_stream_status.toString() << "\n";
+      return false;
+    }
+
+    if (!time_report) {
+      time_report = std::make_shared<TimeReport>();
+    }
+
+    time_report->setEventStream(event_stream);
+
+    event_stream->emit(
+        "run_started",
+        {{"profiles", static_cast<double>(profile_name_list.size())}});
+  }
+
+  // Start by enumerating all the include files; the list is shared by all
+  // the profiles
+  std::vector<HeaderDescriptor> header_files;
+  HeaderFilter header_filter;
+  header_filter.include_globs = cmdline_options.include_globs;
+  header_filter.exclude_globs = cmdline_options.exclude_globs;
+
+  // The folder listings are saved in the cache folder; the next runs only
+  // list the folders that have been modified in the meantime
+  HeaderSnapshotSummary snapshot_summary;
+
+  if (!analyze_ast_snapshot) {
+    ScopedPhaseTimer phase_timer(time_report, "Header enumeration");
+
+    if (!enumerateIncludeFiles(header_files, cmdline_options.header_folders,
+                               cmdline_options.jobs, header_filter,
+                               cmdline_options.cache_directory,
+                               &snapshot_summary)) {
+      return false;
+    }
+  }
+
+  if (!cmdline_options.cache_directory.empty() && !analyze_ast_snapshot) {
+    std::cerr << "Header snapshot: " << snapshot_summary.reused_folder_count
+              << " folders unchanged, " << snapshot_summary.listed_folder_count
+              << " listed, " << snapshot_summary.added_header_list.size()
+              << " headers added, "
+              << snapshot_summary.removed_header_list.size()
+              << " removed\n\n";
+
+    for (const auto &header_path : snapshot_summary.added_header_list) {
+      std::cerr << "  + " << header_path << "\n";
+    }
+
+    for (const auto &header_path : snapshot_summary.removed_header_list) {
+      std::cerr << "  - " << header_path << "\n";
+    }
+
+    if (!snapshot_summary.added_header_list.empty() ||
+        !snapshot_summary.removed_header_list.empty()) {
+      std::cerr << "\n";
+    }
+  }
+
+  if (event_stream) {
+    event_stream->emit(
+        "headers_enumerated",
+        {{"headers", static_cast<double>(header_files.size())},
+         {"unchanged_folders",
+          static_cast<double>(snapshot_summary.reused_folder_count)},
+         {"listed_folders",
+          static_cast<double>(snapshot_summary.listed_folder_count)},
+         {"added_headers",
+          static_cast<double>(snapshot_summary.added_header_list.size())},
+         {"removed_headers",
+          static_cast<double>(snapshot_summary.removed_header_list.size())}});
+  }
+
+  SharedGenerateSettings shared_settings;
+  shared_settings.time_report = time_report;
+  shared_settings.rendered_file_map = rendered_file_map;
+
+  if (cmdline_options.visitor_statistics) {
+    shared_settings.visitor_statistics =
+        std::make_shared<VisitorStatistics>();
+  }
+  shared_settings.event_stream = event_stream;
+  shared_settings.multiple_profiles =
+      profile_name_list.size() > 1U || multiple_triples;
+
+  // The candidate headers are hashed in parallel before the caches need
+  // them; the ones whose size, modification time and inode have not changed
+  // since the previous run are not read at all
+  if (!cmdline_options.cache_directory.empty() && !analyze_ast_snapshot) {
+    ScopedPhaseTimer phase_timer(time_report, "Header fingerprinting");
+
+    auto status = FileFingerprintIndex::create(
+        shared_settings.fingerprint_index,
+        (stdfs::path(cmdline_options.cache_directory) / "file_fingerprints")
+            .string());
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+
+    StringList header_path_list;
+    for (const auto &header_desc : header_files) {
+      header_path_list.push_back(header_desc.path);
+    }
+
+    shared_settings.fingerprint_index->fingerprintFiles(header_path_list,
+                                                        cmdline_options.jobs);
+  }
+
+  // The headers are lexed once, in parallel, for all the strategies that
+  // need their include directives, include guards or function names; the
+  // scans are keyed on the file contents, so the ones of the unchanged
+  // headers are loaded from the cache folder
+  if (!analyze_ast_snapshot) {
+    ScopedPhaseTimer phase_timer(time_report, "Header scanning");
+
+    std::string scan_cache_path;
+    if (!cmdline_options.cache_directory.empty()) {
+      scan_cache_path =
+          (stdfs::path(cmdline_options.cache_directory) / "header_scans")
+              .string();
+    }
+
+    auto status =
+        HeaderScanner::create(shared_settings.header_scanner,
+                              shared_settings.fingerprint_index,
+                              scan_cache_path);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+
+    StringList header_path_list;
+    for (const auto &header_desc : header_files) {
+      header_path_list.push_back(header_desc.path);
+    }
+
+    shared_settings.header_scanner->scanFiles(header_path_list,
+                                              cmdline_options.jobs);
+
+    auto header_scanner = shared_settings.header_scanner.get();
+
+    if (cmdline_options.header_order == "dependencies") {
+      sortHeadersByDependencies(header_files, header_scanner);
+
+    } else if (cmdline_options.header_order == "umbrella") {
+      auto largest_fan_out = sortHeadersByFanOut(header_files, header_scanner);
+
+      std::cerr << "Header order: umbrella headers first, the largest one "
+                << "including " << largest_fan_out << " other headers\n\n";
+    }
+  }
+
+  // The header folders are packed once, and shipped to each remote worker
+  // that has not received them yet
+  if (!cmdline_options.remote_workers.empty() && !analyze_ast_snapshot) {
+    ScopedPhaseTimer phase_timer(time_report, "Header packing");
+
+    auto status = RemoteHeaderPackSet::create(
+        shared_settings.remote_header_packs, cmdline_options.header_folders);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+  }
+
+  // The probe results and the precompiled headers missing from the cache
+  // folder are downloaded from the remote cache, along with the ones
+  // computed by the other profiles
+  if (!cmdline_options.remote_cache_url.empty()) {
+    auto status = RemoteCache::create(
+        shared_settings.remote_cache, cmdline_options.remote_cache_url,
+        cmdline_options.cache_directory,
+        static_cast<std::uint64_t>(cmdline_options.cache_size_limit) * 1024U *
+            1024U);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+  }
+
+  if (!cmdline_options.binary_path.empty()) {
+    auto imported_symbols = std::make_shared<SymbolNameSet>();
+
+    std::string error_message;
+    if (!readBinaryImports(*imported_symbols, error_message,
+                           cmdline_options.binary_path)) {
+      std::cerr << error_message << "\n";
+      return false;
+    }
+
+    shared_settings.imported_symbols = std::move(imported_symbols);
+  }
+
+  if (!cmdline_options.verify_library_path.empty()) {
+    auto exported_symbols = std::make_shared<SymbolNameSet>();
+
+    std::string error_message;
+    if (!readBinaryExports(*exported_symbols, error_message,
+                           cmdline_options.verify_library_path)) {
+      std::cerr << error_message << "\n";
+      return false;
+    }
+
+    shared_settings.exported_symbols = std::move(exported_symbols);
+  }
+
+  {
+    auto status = FunctionNameFilter::create(shared_settings.function_filter,
+                                             cmdline_options.include_namespaces,
+                                             cmdline_options.exclude_names);
+
+    if (!status.succeeded()) {
+      std::cerr << status.toString() << "\n";
+      return false;
+    }
+  }
+
+  bool succeeded = true;
+
+  if (!shared_settings.multiple_profiles) {
+    succeeded = generateProfileLibrary(
+        profile_manager, language_manager, cmdline_options,
+        std::move(header_files), shared_settings,
+        std::shared_future<StringList>(), true, HeaderOrderCallback(),
+        abi_library);
+
+  } else {
+    if (cmdline_options.shared_stat_cache && !cmdline_options.resident_state) {
+      shared_settings.file_system_cache = std::make_shared<FileSystemCache>();
+    }
+
+    // The first profile probes the headers as usual, for the first target
+    // triple; the others wait for its include list, and only verify it. The
+    // other triples of the first profile reuse it as is, unless asked to
+    // verify it as well. Each library is saved next to the output path,
+    // followed by the profile name and by the triple
+    std::promise<StringList> header_order_promise;
+    auto header_order_hypothesis = header_order_promise.get_future().share();
+
+    struct GenerateTarget final {
+      /// The profile name
+      std::string profile_name;
+
+      /// The target triple; empty for the default one
+      std::string target_triple;
+    };
+
+    std::vector<GenerateTarget> target_list;
+    for (const auto &profile_name : profile_name_list) {
+      for (const auto &target_triple : target_triple_list) {
+        target_list.push_back({profile_name, target_triple});
+      }
+    }
+
+    struct ProfileResult final {
+      /// The output of the profile
+      std::string output;
+
+      /// True if the library has been generated
+      bool succeeded{false};
+    };
+
+    std::vector<ProfileResult> result_list(target_list.size());
+
+    // Each profile writes to its own buffer, which is printed once all the
+    // profiles are done
+    ScopedOutputCapture output_capture;
+
+    auto L_targetName = [&](const GenerateTarget &target) -> std::string {
+      if (profile_name_list.size() == 1U) {
+        return target.target_triple;
+
+      } else if (!multiple_triples) {
+        return target.profile_name;
+      }
+
+      return target.profile_name + "_" + target.target_triple;
+    };
+
+    auto L_generateProfile = [&](std::size_t profile_index) {
+      auto &result = result_list[profile_index];
+      ScopedOutputCapture::setThreadOutput(&result.output);
+
+      const auto &target = target_list[profile_index];
+      auto target_name = L_targetName(target);
+
+      auto profile_options = cmdline_options;
+      profile_options.profile_name = target.profile_name;
+      profile_options.target_triples = target.target_triple;
+      profile_options.output = cmdline_options.output + "_" + target_name;
+
+      if (!cmdline_options.probe_log_path.empty()) {
+        profile_options.probe_log_path =
+            cmdline_options.probe_log_path + "_" + target_name;
+      }
+
+      if (!cmdline_options.depfile_path.empty()) {
+        profile_options.depfile_path =
+            cmdline_options.depfile_path + "_" + target_name;
+      }
+
+      if (profile_index == 0U) {
+        bool header_order_published = false;
+
+        auto L_publishHeaderOrder = [&](const StringList &header_order) {
+          header_order_promise.set_value(header_order);
+          header_order_published = true;
+        };
+
+        result.succeeded = generateProfileLibrary(
+            profile_manager, language_manager, profile_options, header_files,
+            shared_settings, std::shared_future<StringList>(), true,
+            L_publishHeaderOrder);
+
+        // Do not leave the other profiles waiting when the first one has
+        // failed before the probing was over
+        if (!header_order_published) {
+          header_order_promise.set_value(StringList());
+        }
+
+      } else {
+        auto verify_hypothesis =
+            target.profile_name != target_list.front().profile_name ||
+            cmdline_options.verify_target_triples;
+
+        result.succeeded = generateProfileLibrary(
+            profile_manager, language_manager, profile_options, header_files,
+            shared_settings, header_order_hypothesis, verify_hypothesis,
+            HeaderOrderCallback());
+      }
+
+      ScopedOutputCapture::setThreadOutput(nullptr);
+    };
+
+    runParallelFor(target_list.size(), target_list.size(),
+                   TaskPriority::Normal, L_generateProfile);
+
+    for (std::size_t i = 0U; i < target_list.size(); ++i) {
+      const auto &result = result_list[i];
+
+      std::cerr << "==> " << L_targetName(target_list[i]) << ": "
+                << (result.succeeded ? "succeeded" : "failed") << "\n\n"
+                << result.output;
+
+      if (!result.succeeded) {
+        succeeded = false;
+      }
+    }
+  }
+
+  if (shared_settings.remote_cache) {
+    const auto &remote_cache = shared_settings.remote_cache;
+    remote_cache->waitForUploads();
+
+    std::cerr << "Remote cache: " << remote_cache->downloadCount()
+              << " downloads, " << remote_cache->uploadCount() << " uploads, "
+              << remote_cache->errorCount() << " errors\n\n";
+  }
+
+  if (shared_settings.fingerprint_index) {
+    const auto &fingerprint_index = shared_settings.fingerprint_index;
+
+    std::cerr << "File fingerprints: " << fingerprint_index->hashedFileCount()
+              << " files hashed, " << fingerprint_index->reusedFileCount()
+              << " unchanged since the previous run\n\n";
+
+    if (!fingerprint_index->save()) {
+      std::cerr << "Failed to save the file fingerprints\n";
+    }
+  }
+
+  if (shared_settings.header_scanner) {
+    const auto &header_scanner = shared_settings.header_scanner;
+
+    std::cerr << "Header scans: " << header_scanner->scannedFileCount()
+              << " files scanned, " << header_scanner->reusedScanCount()
+              << " reused from a previous run\n\n";
+
+    if (!header_scanner->save()) {
+      std::cerr << "Failed to save the header scans\n";
+    }
+  }
+
+  if (event_stream) {
+    event_stream->emit("run_finished", {{"succeeded", succeeded}});
+  }
+
+  // The samples are saved even when the run fails, since slow failing runs
+  // are worth profiling too
+  if (sample_profiler) {
+    if (!sample_profiler->writeFoldedStacks(cmdline_options.profile_samples)) {
+      std::cerr << "Failed to write the profile samples: "
+                << cmdline_options.profile_samples << "\n";
+      return false;
+    }
+
+    std::cerr << "Sample profiler: " << sample_profiler->sampleCount()
+              << " samples saved to " << cmdline_options.profile_samples
+              << ", " << sample_profiler->droppedSampleCount()
+              << " dropped\n\n";
+  }
+
+  if (!succeeded) {
+    return false;
+  }
+
+  // Compare the dTLB misses of the final pass with --hw-counters to see
+  // what the huge pages have saved
+  if (time_report && cmdline_options.huge_pages) {
+    auto huge_page_statistics = getHugePageStatistics();
+
+    time_report->addStatistic("Huge page arrays (peak bytes)",
+                              huge_page_statistics.peak_backed_byte_count);
+    time_report->addStatistic("Huge page advised heap (bytes)",
+                              huge_page_statistics.advised_byte_count);
+    time_report->addStatistic("Huge page collapsed heap (bytes)",
+                              huge_page_statistics.collapsed_byte_count);
+  }
+
+  if (cmdline_options.time_report || cmdline_options.hardware_counters) {
+    time_report->print(std::cerr);
+  }
+
+  if (cmdline_options.visitor_statistics) {
+    if (VisitorStatistics::kEnabled) {
+      const auto &visitor_statistics = *shared_settings.visitor_statistics;
+
+      std::cerr << "Visitor statistics\n\n";
+      for (std::size_t i = 0U; i < kVisitorStatisticCount; ++i) {
+        auto statistic = static_cast<VisitorStatistic>(i);
+
+        std::cerr << "  " << getVisitorStatisticName(statistic) << ": "
+                  << visitor_statistics.get(statistic) << "\n";
+      }
+
+      std::cerr << "\n";
+
+    } else {
+      std::cerr << "Visitor statistics: not available in this build\n\n";
+    }
+  }
+
+  if (!cmdline_options.trace_file.empty() &&
+      !time_report->writeTraceFile(cmdline_options.trace_file)) {
+    std::cerr << "Failed to write the trace file: "
+              << cmdline_options.trace_file << "\n";
+    return false;
+  }
+
+  if (!cmdline_options.metrics_file.empty() &&
+      !time_report->writeMetricsFile(cmdline_options.metrics_file)) {
+    std::cerr << "Failed to write the metrics file: "
+              << cmdline_options.metrics_file << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Handler for the 'generate' command
+bool generateCommandHandler(ProfileManagerRef &profile_manager,
+                            const LanguageManager &language_manager,
+                            const CommandLineOptions &cmdline_options) {
+  if (cmdline_options.watch) {
+    return runWatchMode(profile_manager, language_manager, cmdline_options);
+  }
+
+  return runGenerateCommand(profile_manager, language_manager, cmdline_options,
+                            nullptr);
 }
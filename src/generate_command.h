@@ -24,6 +24,9 @@ struct HeaderDescriptor final {
   /// The header name (i.e.: Utils.h)
   std::string name;
 
+  /// The absolute path of the header
+  std::string path;
+
   /// The list of possible prefixes. Take for example clang/Frontend/Utils.h
   /// Possible prefixes are "clang/Frontend" and "Frontend". abigen will try
   /// to find a prefix that will not cause a compile-time error by attempting
@@ -1,10 +1,35 @@
 #include "generate_utils.h"
+#include "declaration_slicer.h"
+#include "header_snapshot.h"
+#include "huge_pages.h"
+#include "profile_pack.h"
 #include "std_filesystem.h"
+#include "task_executor.h"
 
 #include <clang/AST/Decl.h>
+#include <clang/AST/DeclCXX.h>
+#include <clang/AST/DeclFriend.h>
+#include <clang/AST/DeclTemplate.h>
+#include <clang/AST/GlobalDecl.h>
 #include <clang/AST/Mangle.h>
+#include <clang/CodeGen/ModuleBuilder.h>
 #include <clang/Lex/Preprocessor.h>
 #include <clang/Lex/PreprocessorOptions.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
 
 namespace {
 #if LLVM_MAJOR_VERSION <= 4
@@ -28,62 +53,878 @@ class ASTConsumer final : public clang::ASTConsumer {
   /// The mangler used for C++ symbols
   std::unique_ptr<clang::MangleContext> name_mangler;
 
+  /// The mangler for the other convention; only created when dual mangling
+  /// is enabled
+  std::unique_ptr<clang::MangleContext> alternate_name_mangler;
+
+  /// The diagnostics engine, used to detect errors while parsing
+  clang::DiagnosticsEngine &diagnostics_engine;
+
+  /// The compiler instance owning this consumer; its options are used when
+  /// generating the bitcode
+  clang::CompilerInstance &compiler;
+
+  /// If not empty, the whitelisted functions are emitted to this bitcode
+  /// file after the visitor has finished
+  std::string bitcode_output_path;
+
+  /// If not empty, the declarations of the whitelisted functions are sliced
+  /// out of the translation unit and saved to this file
+  std::string sliced_header_output_path;
+
+  /// If true, parsing stops after the first error
+  bool stop_at_first_error{false};
+
+  /// If not empty, only the top-level declarations found inside these
+  /// (canonical) folders are traversed
+  StringList traversal_folder_list;
+
+  /// Whether each file is inside the traversal folders
+  llvm::DenseMap<const clang::FileEntry *, bool> traversal_file_map;
+
+  /// How many shards the declarations are split in
+  std::size_t shard_count{1U};
+
+  /// The shard that is traversed
+  std::size_t shard_index{0U};
+
+  /// If true, the declarations are passed to the visitor while parsing
+  bool traverse_while_parsing{false};
+
+  /// If true, the AST pages are collapsed into huge pages before the
+  /// visitor walks the translation unit
+  bool huge_page_advice{false};
+
+  /// True once Initialize() has initialized the visitor; the declarations
+  /// are then visited by HandleTopLevelDecl() instead of
+  /// HandleTranslationUnit()
+  bool visiting_while_parsing{false};
+
+  /// True if the visitor has stopped the traversal while parsing
+  bool traversal_stopped{false};
+
+  /// The index of the next traversal unit; the units of each top-level
+  /// declaration are numbered as if the whole translation unit had been
+  /// collected at once, so the shards do not change
+  std::size_t next_unit_index{0U};
+
+  /// Adds the declarations that can be traversed independently to the unit
+  /// list; the contents of namespaces and linkage specifications are
+  /// flattened, as the visitor does not need their own declaration
+  static void collectTraversalUnits(std::vector<clang::Decl *> &unit_list,
+                                    clang::Decl *declaration) {
+    if (llvm::isa<clang::NamespaceDecl>(declaration) ||
+        llvm::isa<clang::LinkageSpecDecl>(declaration)) {
+      for (auto child : llvm::cast<clang::DeclContext>(declaration)->decls()) {
+        collectTraversalUnits(unit_list, child);
+      }
+
+    } else {
+      unit_list.push_back(declaration);
+    }
+  }
+
+  /// Passes the functions declared by the given units to the visitor,
+  /// skipping the ones of the other shards and the ones outside of the
+  /// traversal folders. The first unit has the given index. Returns false
+  /// if the visitor has stopped the traversal
+  bool visitTraversalUnits(const std::vector<clang::Decl *> &unit_list,
+                           std::size_t first_unit_index) {
+    // Types declared outside the folders (or in other shards) are still
+    // expanded when they are referenced by a function we visit
+    for (std::size_t i = 0U; i < unit_list.size(); ++i) {
+      if (shard_count > 1U &&
+          (first_unit_index + i) % shard_count != shard_index) {
+        continue;
+      }
+
+      auto declaration = unit_list[i];
+      if (!traversal_folder_list.empty() && !shouldTraverse(declaration)) {
+        continue;
+      }
+
+      if (!visitFunctionDeclarations(declaration)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// Passes the functions declared by the given declaration to the visitor.
+  /// Unlike RecursiveASTVisitor::TraverseDecl, statements and expressions
+  /// (function bodies, initializers, default arguments) are never entered,
+  /// and only the declaration contexts that can declare functions with
+  /// linkage are iterated: namespaces, linkage specifications, records and
+  /// templates. As with the default traversal, implicit declarations and
+  /// implicit template instantiations are skipped. Returns false if the
+  /// visitor has stopped the traversal
+  bool visitFunctionDeclarations(clang::Decl *declaration) {
+    if (declaration == nullptr || declaration->isImplicit()) {
+      return true;
+    }
+
+    // Friend types are not declared here
+    if (auto friend_declaration =
+            llvm::dyn_cast<clang::FriendDecl>(declaration)) {
+      return visitFunctionDeclarations(friend_declaration->getFriendDecl());
+    }
+
+    if (auto function_template =
+            llvm::dyn_cast<clang::FunctionTemplateDecl>(declaration)) {
+      declaration = function_template->getTemplatedDecl();
+
+    } else if (auto class_template =
+                   llvm::dyn_cast<clang::ClassTemplateDecl>(declaration)) {
+      declaration = class_template->getTemplatedDecl();
+    }
+
+    if (auto function = llvm::dyn_cast<clang::FunctionDecl>(declaration)) {
+      return ast_visitor->VisitFunctionDecl(function);
+    }
+
+    // The members of instantiated templates are not written in the source
+    if (auto specialization =
+            llvm::dyn_cast<clang::ClassTemplateSpecializationDecl>(
+                declaration)) {
+      if (specialization->getSpecializationKind() !=
+          clang::TSK_ExplicitSpecialization) {
+        return true;
+      }
+    }
+
+    // Closure types only appear inside function bodies and initializers
+    if (auto record = llvm::dyn_cast<clang::CXXRecordDecl>(declaration)) {
+      if (record->isLambda()) {
+        return true;
+      }
+    }
+
+    if (!llvm::isa<clang::TranslationUnitDecl>(declaration) &&
+        !llvm::isa<clang::NamespaceDecl>(declaration) &&
+        !llvm::isa<clang::LinkageSpecDecl>(declaration) &&
+        !llvm::isa<clang::RecordDecl>(declaration)) {
+      return true;
+    }
+
+    for (auto child : llvm::cast<clang::DeclContext>(declaration)->decls()) {
+      if (!visitFunctionDeclarations(child)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  /// Returns true if the given top-level declaration should be traversed
+  bool shouldTraverse(const clang::Decl *declaration) {
+    auto location = source_manager.getSpellingLoc(declaration->getLocation());
+    auto file_entry =
+        source_manager.getFileEntryForID(source_manager.getFileID(location));
+
+    if (file_entry == nullptr) {
+      return false;
+    }
+
+    auto it = traversal_file_map.find(file_entry);
+    if (it != traversal_file_map.end()) {
+      return it->second;
+    }
+
+    std::error_code error;
+    auto file_path =
+        stdfs::canonical(std::string(file_entry->getName()), error).string();
+
+    bool traverse = false;
+    if (!error) {
+      for (const auto &folder : traversal_folder_list) {
+        if (file_path.compare(0U, folder.size(), folder) == 0) {
+          traverse = true;
+          break;
+        }
+      }
+    }
+
+    traversal_file_map.insert({file_entry, traverse});
+    return traverse;
+  }
+
+  /// Saves the declarations needed by the whitelisted functions to the
+  /// sliced header output path. Slicing is optional, so failures do not fail
+  /// the compilation; they are printed, and no file is written
+  void emitSlicedHeader(clang::ASTContext &ast_context) {
+    std::string sliced_header;
+    std::string error_message;
+    if (!sliceFunctionDeclarations(
+            sliced_header, error_message, ast_context,
+            ast_visitor->whitelistedFunctionDeclarations())) {
+      std::cerr << "The declarations can't be sliced: " << error_message
+                << "\n";
+      return;
+    }
+
+    std::ofstream output_file(sliced_header_output_path,
+                              std::ios::out | std::ios::trunc);
+    output_file << sliced_header;
+
+    if (!output_file) {
+      output_file.close();
+
+      std::error_code error;
+      stdfs::remove(sliced_header_output_path, error);
+
+      std::cerr << "Failed to write the sliced header: "
+                << sliced_header_output_path << "\n";
+    }
+  }
+
+  /// Builds a module referencing the whitelisted functions from the
+  /// __mcsema_externs array, just like the generated implementation file,
+  /// and writes it to the bitcode output path
+  void emitBitcode(clang::ASTContext &ast_context) {
+    auto L_reportError = [&](const std::string &message) {
+      auto diagnostic_id = diagnostics_engine.getCustomDiagID(
+          clang::DiagnosticsEngine::Error, "%0");
+
+      diagnostics_engine.Report(diagnostic_id) << message;
+    };
+
+    llvm::LLVMContext llvm_context;
+    std::unique_ptr<clang::CodeGenerator> code_generator(
+        clang::CreateLLVMCodeGen(diagnostics_engine, bitcode_output_path,
+                                 compiler.getHeaderSearchOpts(),
+                                 compiler.getPreprocessorOpts(),
+                                 compiler.getCodeGenOpts(), llvm_context));
+
+    code_generator->Initialize(ast_context);
+
+    // Only the declarations are requested; no other top-level declaration
+    // is passed to the code generator
+    std::vector<llvm::Constant *> function_address_list;
+    for (auto function_decl : ast_visitor->whitelistedFunctionDeclarations()) {
+      clang::GlobalDecl global_decl;
+      if (auto constructor_decl =
+              llvm::dyn_cast<clang::CXXConstructorDecl>(function_decl)) {
+        global_decl = clang::GlobalDecl(constructor_decl, clang::Ctor_Complete);
+
+      } else if (auto destructor_decl =
+                     llvm::dyn_cast<clang::CXXDestructorDecl>(function_decl)) {
+        global_decl = clang::GlobalDecl(destructor_decl, clang::Dtor_Complete);
+
+      } else {
+        global_decl = clang::GlobalDecl(function_decl);
+      }
+
+      function_address_list.push_back(
+          code_generator->GetAddrOfGlobal(global_decl, false));
+    }
+
+    code_generator->HandleTranslationUnit(ast_context);
+
+    std::unique_ptr<llvm::Module> module(code_generator->ReleaseModule());
+    if (!module) {
+      L_reportError("Failed to generate the bitcode module");
+      return;
+    }
+
+    auto pointer_type = llvm::Type::getInt8PtrTy(llvm_context);
+
+    std::vector<llvm::Constant *> extern_list;
+    for (auto function_address : function_address_list) {
+      extern_list.push_back(
+          llvm::ConstantExpr::getBitCast(function_address, pointer_type));
+    }
+
+    auto array_type = llvm::ArrayType::get(pointer_type, extern_list.size());
+    auto extern_array = new llvm::GlobalVariable(
+        *module, array_type, false, llvm::GlobalValue::ExternalLinkage,
+        llvm::ConstantArray::get(array_type, extern_list), "__mcsema_externs");
+
+    llvm::appendToUsed(*module, {extern_array});
+
+    std::error_code stream_error_code;
+    llvm::raw_fd_ostream output_stream(bitcode_output_path, stream_error_code,
+                                       llvm::sys::fs::F_None);
+
+    if (stream_error_code) {
+      L_reportError("Failed to open the bitcode file: " + bitcode_output_path);
+      return;
+    }
+
+    llvm::WriteBitcodeToFile(*module.get(), output_stream);
+
+    output_stream.flush();
+    if (output_stream.has_error()) {
+      output_stream.clear_error();
+      L_reportError("Failed to write the bitcode file: " + bitcode_output_path);
+    }
+  }
+
  public:
   ASTConsumer(clang::SourceManager &source_manager, IASTVisitorRef ast_visitor,
-              std::unique_ptr<clang::MangleContext> name_mangler)
+              std::unique_ptr<clang::MangleContext> name_mangler,
+              std::unique_ptr<clang::MangleContext> alternate_name_mangler,
+              clang::DiagnosticsEngine &diagnostics_engine,
+              clang::CompilerInstance &compiler,
+              const CompilerInstanceSettings &settings)
       : source_manager(source_manager),
-        ast_visitor(ast_visitor),
-        name_mangler(std::move(name_mangler)) {}
+        name_mangler(std::move(name_mangler)),
+        alternate_name_mangler(std::move(alternate_name_mangler)),
+        diagnostics_engine(diagnostics_engine),
+        compiler(compiler),
+        stop_at_first_error(settings.stop_at_first_error) {
+    configure(ast_visitor, settings);
+  }
 
   virtual ~ASTConsumer() override = default;
 
+  /// Replaces the visitor and the traversal and output settings; used to run
+  /// a new visitor on a translation unit that has already been parsed
+  void configure(IASTVisitorRef visitor,
+                 const CompilerInstanceSettings &settings) {
+    ast_visitor = visitor;
+    bitcode_output_path = settings.bitcode_output_path;
+    sliced_header_output_path = settings.sliced_header_output_path;
+    shard_count = settings.shard_count;
+    shard_index = settings.shard_index;
+    traverse_while_parsing = settings.traverse_while_parsing;
+    huge_page_advice = settings.huge_page_advice;
+
+    visiting_while_parsing = false;
+    traversal_stopped = false;
+    next_unit_index = 0U;
+
+    traversal_folder_list.clear();
+    traversal_file_map.clear();
+
+    for (const auto &folder : settings.traversal_folders) {
+      std::error_code error;
+      auto canonical_folder = stdfs::canonical(folder, error);
+      if (error) {
+        continue;
+      }
+
+      // Terminate the path, so that "/a/b" does not match "/a/bc"
+      auto folder_path = (canonical_folder / "").string();
+      traversal_folder_list.push_back(folder_path);
+    }
+  }
+
+  virtual void Initialize(clang::ASTContext &ast_context) override {
+    // The declarations loaded from an external source are never passed to
+    // HandleTopLevelDecl(); they are visited at the end instead
+    if (!traverse_while_parsing || !ast_visitor ||
+        ast_context.getExternalSource() != nullptr) {
+      return;
+    }
+
+    ast_visitor->initialize(&ast_context, &source_manager, name_mangler.get(),
+                            alternate_name_mangler.get());
+    visiting_while_parsing = true;
+  }
+
+  virtual bool HandleTopLevelDecl(
+      clang::DeclGroupRef declaration_group) override {
+    if (visiting_while_parsing && !traversal_stopped) {
+      for (auto declaration : declaration_group) {
+        if (traversal_folder_list.empty() && shard_count <= 1U) {
+          traversal_stopped = !visitFunctionDeclarations(declaration);
+
+        } else {
+          std::vector<clang::Decl *> unit_list;
+          collectTraversalUnits(unit_list, declaration);
+
+          traversal_stopped = !visitTraversalUnits(unit_list, next_unit_index);
+          next_unit_index += unit_list.size();
+        }
+
+        if (traversal_stopped) {
+          break;
+        }
+      }
+    }
+
+    // Returning false makes clang::ParseAST stop
+    return !stop_at_first_error || !diagnostics_engine.hasErrorOccurred();
+  }
+
+  virtual void HandleTagDeclDefinition(clang::TagDecl *declaration) override {
+    if (!visiting_while_parsing) {
+      return;
+    }
+
+    if (auto record_declaration =
+            llvm::dyn_cast<clang::RecordDecl>(declaration)) {
+      ast_visitor->VisitRecordDefinition(record_declaration);
+    }
+  }
+
   virtual void HandleTranslationUnit(clang::ASTContext &ast_context) override {
     if (!ast_visitor) {
       return;
     }
 
-    ast_visitor->initialize(&ast_context, &source_manager, name_mangler.get());
-    ast_visitor->TraverseDecl(ast_context.getTranslationUnitDecl());
+    if (!visiting_while_parsing) {
+      if (huge_page_advice) {
+        adviseHeapHugePages(true);
+      }
+
+      ast_visitor->initialize(&ast_context, &source_manager,
+                              name_mangler.get(),
+                              alternate_name_mangler.get());
+
+      auto translation_unit = ast_context.getTranslationUnitDecl();
+      if (traversal_folder_list.empty() && shard_count <= 1U) {
+        visitFunctionDeclarations(translation_unit);
+
+      } else {
+        std::vector<clang::Decl *> unit_list;
+        for (auto declaration : translation_unit->decls()) {
+          collectTraversalUnits(unit_list, declaration);
+        }
+
+        visitTraversalUnits(unit_list, 0U);
+      }
+    }
+
     ast_visitor->finalize();
+
+    if (!bitcode_output_path.empty()) {
+      emitBitcode(ast_context);
+    }
+
+    if (!sliced_header_output_path.empty()) {
+      emitSlicedHeader(ast_context);
+    }
+  }
+};
+
+/// A folder visited while enumerating the include files
+struct IncludeFolderNode final {
+  /// The folder path
+  stdfs::path path;
+
+  /// The folder path, relative to the header folder; used by the filters
+  std::string relative_path;
+
+  /// The index of the header folder containing this folder
+  std::size_t root_index{0U};
+
+  /// The prefixes shared by the headers found in this folder, starting from
+  /// the closest one
+  StringList possible_prefixes;
+
+  /// The headers found in this folder
+  std::vector<HeaderDescriptor> header_list;
+
+  /// The folder entries in listing order; the first member is true for the
+  /// child folders, and the second one is the index of the header or of the
+  /// child folder
+  std::vector<std::pair<bool, std::size_t>> entry_list;
+
+  /// The node of the first child folder; the others follow it
+  std::size_t first_child_index{0U};
+
+  /// The unfiltered folder entries, saved in the next snapshot
+  HeaderFolderSnapshot snapshot;
+
+  /// True if the entries have been taken from the previous snapshot
+  bool snapshot_reused{false};
+};
+
+/// Lists the child folders and the headers found in the given folder. The
+/// file type cached by the directory entry is used whenever possible; like
+/// the recursive directory iterator, symbolic links to folders are not
+/// followed. Folders located inside a header archive are listed from its
+/// index instead
+bool listFolderEntries(std::vector<std::pair<bool, std::string>> &entry_list,
+                       const stdfs::path &folder_path) {
+  const static StringList valid_extensions = {".h", ".hh", ".hp", ".hpp",
+                                              ".hxx"};
+
+  auto L_isHeader = [](const stdfs::path &path) -> bool {
+    const auto &ext = path.extension().string();
+
+    return !ext.empty() && std::find(valid_extensions.begin(),
+                                     valid_extensions.end(),
+                                     ext) != valid_extensions.end();
+  };
+
+  entry_list.clear();
+
+  ProfilePackRef header_archive;
+  if (!getHeaderArchive(header_archive, folder_path.string()).succeeded()) {
+    return false;
+  }
+
+  if (header_archive) {
+    std::string relative_path;
+    ProfilePack::Entry folder_entry;
+
+    if (!header_archive->resolvePath(relative_path, folder_path.string()) ||
+        !header_archive->lookup(folder_entry, relative_path) ||
+        !folder_entry.is_directory) {
+      return false;
+    }
+
+    for (auto index : header_archive->folderContents(folder_entry.index)) {
+      auto entry = header_archive->entry(index);
+      auto path = stdfs::path(header_archive->entryPath(index).str());
+
+      if (entry.is_directory) {
+        entry_list.push_back({true, path.filename().string()});
+
+      } else if (L_isHeader(path)) {
+        entry_list.push_back({false, path.filename().string()});
+      }
+    }
+
+    return true;
+  }
+
+  try {
+    for (const auto &directory_entry :
+         stdfs::directory_iterator(folder_path)) {
+      const auto &path = directory_entry.path();
+
+      if (!directory_entry.is_symlink() && directory_entry.is_directory()) {
+        entry_list.push_back({true, path.filename().string()});
+        continue;
+      }
+
+      if (!directory_entry.is_regular_file() || !L_isHeader(path)) {
+        continue;
+      }
+
+      entry_list.push_back({false, path.filename().string()});
+    }
+
+    return true;
+
+  } catch (...) {
+    return false;
+  }
+}
+
+/// Lists a single folder, adding its headers to the given node and returning
+/// its child folders. The entries recorded by the previous snapshot are used
+/// instead when the folder has not been modified since. Excluded folders are
+/// not returned, so their contents are never listed
+bool listIncludeFolder(IncludeFolderNode &node,
+                       std::vector<stdfs::path> &child_folder_list,
+                       const HeaderFilter &header_filter,
+                       const HeaderFolderSnapshot *previous_snapshot) {
+  child_folder_list.clear();
+
+  // The modification time is read before listing the folder, so that the
+  // changes made in the meantime are picked up by the next run
+  node.snapshot.modification_time = getFolderModificationTime(node.path);
+
+  if (previous_snapshot != nullptr &&
+      previous_snapshot->modification_time != 0 &&
+      previous_snapshot->modification_time ==
+          node.snapshot.modification_time) {
+    node.snapshot.entry_list = previous_snapshot->entry_list;
+    node.snapshot_reused = true;
+
+  } else if (!listFolderEntries(node.snapshot.entry_list, node.path)) {
+    return false;
+  }
+
+  auto filter_enabled = !header_filter.include_globs.empty() ||
+                        !header_filter.exclude_globs.empty();
+
+  auto L_relativePath = [&node](const std::string &name) -> std::string {
+    return node.relative_path.empty() ? name : node.relative_path + "/" + name;
+  };
+
+  for (const auto &entry : node.snapshot.entry_list) {
+    const auto &name = entry.second;
+
+    if (entry.first) {
+      if (filter_enabled &&
+          header_filter.excludesFolder(L_relativePath(name))) {
+        continue;
+      }
+
+      node.entry_list.push_back({true, child_folder_list.size()});
+      child_folder_list.push_back(node.path / name);
+      continue;
+    }
+
+    if (filter_enabled && !header_filter.acceptsHeader(L_relativePath(name))) {
+      continue;
+    }
+
+    HeaderDescriptor header_desc = {};
+    header_desc.name = name;
+    header_desc.path = (node.path / name).string();
+    header_desc.possible_prefixes = node.possible_prefixes;
+
+    node.entry_list.push_back({false, node.header_list.size()});
+    node.header_list.push_back(std::move(header_desc));
+  }
+
+  return true;
+}
+
+/// Returns true if the given folder is missing from the other snapshot
+/// because it has been created or deleted, rather than because the header
+/// filter excluded it or one of its parents
+bool isSnapshotFolderChanged(const std::string &relative_path,
+                             const HeaderSnapshot &other_snapshot) {
+  auto path = relative_path;
+
+  while (!path.empty()) {
+    std::string parent_path;
+    std::string name = path;
+
+    auto separator = path.rfind('/');
+    if (separator != std::string::npos) {
+      parent_path = path.substr(0U, separator);
+      name = path.substr(separator + 1U);
+    }
+
+    auto parent_it = other_snapshot.folder_map.find(parent_path);
+    if (parent_it != other_snapshot.folder_map.end()) {
+      const auto &entry_list = parent_it->second.entry_list;
+
+      return std::find(entry_list.begin(), entry_list.end(),
+                       std::make_pair(true, name)) == entry_list.end();
+    }
+
+    path = std::move(parent_path);
+  }
+
+  return false;
+}
+
+/// Appends the headers found in the first folder snapshot but not in the
+/// second one to the given list
+void appendMissingHeaders(StringList &header_list,
+                          const std::string &folder_path,
+                          const HeaderFolderSnapshot &snapshot,
+                          const HeaderFolderSnapshot *other_snapshot) {
+  for (const auto &entry : snapshot.entry_list) {
+    if (entry.first) {
+      continue;
+    }
+
+    if (other_snapshot != nullptr &&
+        std::find(other_snapshot->entry_list.begin(),
+                  other_snapshot->entry_list.end(),
+                  entry) != other_snapshot->entry_list.end()) {
+      continue;
+    }
+
+    header_list.push_back((stdfs::path(folder_path) / entry.second).string());
+  }
+}
+
+/// Compares the previous snapshot of a header folder with the current one,
+/// listing the headers that have been added or removed in between
+void compareHeaderSnapshots(HeaderSnapshotSummary &summary,
+                            const HeaderSnapshot &previous_snapshot,
+                            const HeaderSnapshot &current_snapshot) {
+  // Without a previous snapshot, every header would be reported as new
+  if (previous_snapshot.folder_map.empty()) {
+    return;
+  }
+
+  auto L_folderPath = [&](const std::string &relative_path) -> std::string {
+    auto path = stdfs::path(current_snapshot.root_path);
+    if (!relative_path.empty()) {
+      path /= relative_path;
+    }
+
+    return path.string();
+  };
+
+  for (const auto &p : current_snapshot.folder_map) {
+    auto previous_it = previous_snapshot.folder_map.find(p.first);
+    if (previous_it != previous_snapshot.folder_map.end()) {
+      appendMissingHeaders(summary.added_header_list, L_folderPath(p.first),
+                           p.second, &previous_it->second);
+
+      appendMissingHeaders(summary.removed_header_list, L_folderPath(p.first),
+                           previous_it->second, &p.second);
+
+    } else if (isSnapshotFolderChanged(p.first, previous_snapshot)) {
+      appendMissingHeaders(summary.added_header_list, L_folderPath(p.first),
+                           p.second, nullptr);
+    }
+  }
+
+  for (const auto &p : previous_snapshot.folder_map) {
+    if (current_snapshot.folder_map.count(p.first) == 0U &&
+        isSnapshotFolderChanged(p.first, current_snapshot)) {
+      appendMissingHeaders(summary.removed_header_list, L_folderPath(p.first),
+                           p.second, nullptr);
+    }
   }
+}
+
+/// The system headers introduced by a language standard
+struct SystemHeaderGroup final {
+  /// The language standard
+  int standard;
+
+  /// The headers, in the order they are included
+  StringList header_list;
 };
+
+/// The C standard library headers, from the oldest standard
+const std::vector<SystemHeaderGroup> kCSystemHeaderGroups = {
+    {89,
+     {"assert.h", "ctype.h", "errno.h", "float.h", "limits.h", "locale.h",
+      "math.h", "setjmp.h", "signal.h", "stdarg.h", "stddef.h", "stdio.h",
+      "stdlib.h", "string.h", "time.h"}},
+
+    {94, {"iso646.h", "wchar.h", "wctype.h"}},
+
+    {99,
+     {"complex.h", "fenv.h", "inttypes.h", "stdbool.h", "stdint.h",
+      "tgmath.h"}},
+
+    {11, {"stdalign.h", "stdnoreturn.h", "uchar.h"}}};
+
+/// The C++ standard library headers, from the oldest standard
+const std::vector<SystemHeaderGroup> kCXXSystemHeaderGroups = {
+    {98,
+     {"cassert",   "cctype",    "cerrno",    "cfloat",     "climits",
+      "clocale",   "cmath",     "csetjmp",   "csignal",    "cstdarg",
+      "cstddef",   "cstdio",    "cstdlib",   "cstring",    "ctime",
+      "cwchar",    "cwctype",   "algorithm", "bitset",     "complex",
+      "deque",     "exception", "fstream",   "functional", "iomanip",
+      "ios",       "iosfwd",    "iostream",  "istream",    "iterator",
+      "limits",    "list",      "locale",    "map",        "memory",
+      "new",       "numeric",   "ostream",   "queue",      "set",
+      "sstream",   "stack",     "stdexcept", "streambuf",  "string",
+      "typeinfo",  "utility",   "valarray",  "vector"}},
+
+    {11,
+     {"array", "atomic", "chrono", "condition_variable", "cstdint",
+      "forward_list", "future", "initializer_list", "mutex", "random", "ratio",
+      "regex", "system_error", "thread", "tuple", "type_traits", "typeindex",
+      "unordered_map", "unordered_set"}},
+
+    {14, {"shared_mutex"}}};
+
+/// The POSIX headers that are included by most libraries, regardless of the
+/// language
+const StringList kPOSIXSystemHeaderList = {
+    "sys/types.h", "sys/stat.h", "sys/time.h",   "fcntl.h",     "unistd.h",
+    "dirent.h",    "pthread.h",  "sys/socket.h", "netinet/in.h"};
+
+#if LLVM_MAJOR_VERSION <= 7
+namespace vfs = clang::vfs;
+#else
+namespace vfs = llvm::vfs;
+#endif
+
+/// Creates a virtual file system that serves the given files from memory,
+/// and forwards the other requests to the base file system (or the real
+/// one, if not set); the buffers are not copied
+VirtualFileSystemRef createInMemoryFileSystem(
+    const RenderedFileMap &file_map, VirtualFileSystemRef base_file_system) {
+  if (!base_file_system) {
+    base_file_system = vfs::getRealFileSystem();
+  }
+
+  llvm::IntrusiveRefCntPtr<vfs::InMemoryFileSystem> memory_file_system(
+      new vfs::InMemoryFileSystem());
+
+  auto working_directory = base_file_system->getCurrentWorkingDirectory();
+  if (working_directory) {
+    memory_file_system->setCurrentWorkingDirectory(working_directory.get());
+  }
+
+  for (const auto &p : file_map) {
+    const auto &path = p.first;
+    const auto &contents = p.second;
+
+    memory_file_system->addFile(
+        path, 0, llvm::MemoryBuffer::getMemBuffer(contents, path, false));
+  }
+
+  llvm::IntrusiveRefCntPtr<vfs::OverlayFileSystem> overlay_file_system(
+      new vfs::OverlayFileSystem(base_file_system));
+
+  overlay_file_system->pushOverlay(memory_file_system);
+  return overlay_file_system;
+}
 }  // namespace
 
 SourceCodeLocation getSourceCodeLocation(clang::ASTContext &ast_context,
                                          clang::SourceManager &source_manager,
-                                         const clang::Decl *declaration) {
+                                         const clang::Decl *declaration,
+                                         FilePathTable &file_path_table) {
   auto start_location = declaration->getLocStart();
   auto full_start_location = ast_context.getFullLoc(start_location);
 
-#if LLVM_MAJOR_VERSION > 5
-  static_cast<void>(source_manager);
-  const auto file_entry = full_start_location.getFileEntry();
-#else
-  auto file_id = full_start_location.getFileID();
-  const auto file_entry = source_manager.getFileEntryForID(file_id);
-#endif
+#if LLVM_MAJOR_VERSION > 5
+  const auto file_entry = full_start_location.getFileEntry();
+#else
+  auto file_id = full_start_location.getFileID();
+  const auto file_entry = source_manager.getFileEntryForID(file_id);
+#endif
+
+  SourceCodeLocation output;
+
+  // The path is only copied the first time a file is seen
+  auto file_id = static_cast<FileId>(file_path_table.file_path_list.size());
+  auto insert_status =
+      file_path_table.file_entry_map.insert({file_entry, file_id});
+
+  if (insert_status.second) {
+    std::string file_path;
+    if (file_entry != nullptr) {
+      file_path = file_entry->getName();
+    }
+
+    if (file_path.empty()) {
+      // This is the file we generated in memory for clang
+      file_path = "main.cpp";
+    }
+
+    file_path_table.file_path_list.push_back(std::move(file_path));
+
+    // Walk the include stack up to the main file, to find out which of its
+    // #include directives brought this file in
+    std::uint32_t include_line = 0U;
+
+    auto main_file_id = source_manager.getMainFileID();
+    auto expansion_location = source_manager.getExpansionLoc(start_location);
+    auto include_location = source_manager.getIncludeLoc(
+        source_manager.getFileID(expansion_location));
+
+    while (include_location.isValid()) {
+      auto includer_file_id = source_manager.getFileID(include_location);
+      if (includer_file_id == main_file_id) {
+        include_line = source_manager.getSpellingLineNumber(include_location);
+        break;
+      }
 
-  SourceCodeLocation output;
-  if (file_entry != nullptr) {
-    output.file_path = file_entry->getName();
-  }
+      include_location = source_manager.getIncludeLoc(includer_file_id);
+    }
 
-  if (output.file_path.empty()) {
-    // This is the file we generated in memory for clang
-    output.file_path = "main.cpp";
+    file_path_table.include_line_list.push_back(include_line);
   }
 
+  output.file_id = insert_status.first->second;
+
   output.line = full_start_location.getSpellingLineNumber();
   output.column = full_start_location.getSpellingColumnNumber();
 
   return output;
 }
 
-bool createCompilerInstance(CompilerInstanceRef &compiler,
-                            ProfileManagerRef &profile_manager,
-                            const LanguageManager &language_manager,
-                            const CommandLineOptions &cmdline_options) {
-  CompilerInstanceSettings compiler_settings;
+bool createCompilerInstanceSettings(
+    CompilerInstanceSettings &compiler_settings,
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options) {
+  compiler_settings = {};
+
   auto prof_mgr_status = profile_manager->get(compiler_settings.profile,
                                               cmdline_options.profile_name);
   if (!prof_mgr_status.succeeded()) {
@@ -104,8 +945,147 @@ bool createCompilerInstance(CompilerInstanceRef &compiler,
   compiler_settings.use_visual_cxx_mangling =
       cmdline_options.use_visual_cxx_mangling;
 
+  compiler_settings.dual_mangling = cmdline_options.dual_mangling;
+
+  compiler_settings.target_triple = cmdline_options.target_triples;
+
   compiler_settings.additional_include_folders = cmdline_options.header_folders;
 
+  // Header folders located inside an archive are served to clang from its
+  // index, without extracting it
+  for (const auto &folder : cmdline_options.header_folders) {
+    ProfilePackRef header_archive;
+    auto archive_status = getHeaderArchive(header_archive, folder);
+    if (!archive_status.succeeded()) {
+      std::cerr << archive_status.toString() << "\n";
+      return false;
+    }
+
+    auto &header_pack_list = compiler_settings.header_pack_list;
+    if (header_archive &&
+        std::find(header_pack_list.begin(), header_pack_list.end(),
+                  header_archive) == header_pack_list.end()) {
+      header_pack_list.push_back(header_archive);
+    }
+  }
+
+  compiler_settings.reuse_clang_state = cmdline_options.reuse_clang_state;
+
+  compiler_settings.skip_function_bodies = cmdline_options.skip_function_bodies;
+
+  if (cmdline_options.shared_stat_cache) {
+    compiler_settings.file_system_cache = std::make_shared<FileSystemCache>();
+  }
+
+  compiler_settings.cancellation_flag = cmdline_options.cancellation_flag;
+
+  return true;
+}
+
+StringList getSourceManagerFileList(clang::SourceManager &source_manager) {
+  StringList file_list;
+
+  for (auto it = source_manager.fileinfo_begin();
+       it != source_manager.fileinfo_end(); ++it) {
+    const auto file_entry = it->first;
+    if (file_entry == nullptr) {
+      continue;
+    }
+
+    file_list.push_back(std::string(file_entry->getName()));
+  }
+
+  return file_list;
+}
+
+StringList getSourceManagerGuardedFileList(clang::SourceManager &source_manager,
+                                           clang::HeaderSearch &header_search) {
+  StringList file_list;
+
+  for (auto it = source_manager.fileinfo_begin();
+       it != source_manager.fileinfo_end(); ++it) {
+    const auto file_entry = it->first;
+    if (file_entry == nullptr ||
+        !header_search.isFileMultipleIncludeGuarded(file_entry)) {
+      continue;
+    }
+
+    file_list.push_back(std::string(file_entry->getName()));
+  }
+
+  return file_list;
+}
+
+bool getFileUniqueID(llvm::sys::fs::UniqueID &unique_id,
+                     const std::string &path) {
+  return !llvm::sys::fs::getUniqueID(path, unique_id);
+}
+
+ContentHash hashProfileSettings(
+    const CompilerInstanceSettings &compiler_settings) {
+  auto hash = updateContentHash(kInitialContentHash,
+                                std::string(ABIGEN_COMMIT_HASH));
+
+  hash = updateContentHash(hash,
+                           static_cast<std::uint64_t>(LLVM_MAJOR_VERSION));
+  hash = updateContentHash(hash,
+                           static_cast<std::uint64_t>(LLVM_MINOR_VERSION));
+
+  const auto &profile = compiler_settings.profile;
+  hash = updateContentHash(hash, profile.name);
+  hash = updateContentHash(hash, profile.root_path);
+  hash = updateContentHash(hash, profile.resource_dir);
+
+  // The path maps are unordered; always hash them in the same order
+  for (auto language : {Language::C, Language::CXX}) {
+    for (const auto path_map :
+         {&profile.internal_isystem, &profile.internal_externc_isystem}) {
+      auto it = path_map->find(language);
+      hash = updateContentHash(
+          hash, it != path_map->end() ? it->second : StringList());
+    }
+  }
+
+  hash = updateContentHash(
+      hash, static_cast<std::uint64_t>(compiler_settings.language));
+  hash = updateContentHash(
+      hash, static_cast<std::uint64_t>(compiler_settings.language_standard));
+  hash = updateContentHash(
+      hash,
+      static_cast<std::uint64_t>(compiler_settings.enable_gnu_extensions));
+
+  // The predefined macros depend on the target; the default one is not
+  // hashed, so that the entries saved before it could be changed stay valid
+  if (!compiler_settings.target_triple.empty()) {
+    hash = updateContentHash(hash, compiler_settings.target_triple);
+  }
+
+  return hash;
+}
+
+ContentHash hashCompilerInstanceSettings(
+    const CompilerInstanceSettings &compiler_settings) {
+  auto hash = hashProfileSettings(compiler_settings);
+  hash = updateContentHash(hash, compiler_settings.additional_include_folders);
+  hash = updateContentHash(
+      hash,
+      static_cast<std::uint64_t>(compiler_settings.use_visual_cxx_mangling));
+  hash = updateContentHash(
+      hash, static_cast<std::uint64_t>(compiler_settings.skip_function_bodies));
+
+  return hash;
+}
+
+bool createCompilerInstance(CompilerInstanceRef &compiler,
+                            ProfileManagerRef &profile_manager,
+                            const LanguageManager &language_manager,
+                            const CommandLineOptions &cmdline_options) {
+  CompilerInstanceSettings compiler_settings;
+  if (!createCompilerInstanceSettings(compiler_settings, profile_manager,
+                                      language_manager, cmdline_options)) {
+    return false;
+  }
+
   auto compiler_status = CompilerInstance::create(compiler, compiler_settings);
   if (!compiler_status.succeeded()) {
     std::cerr << compiler_status.toString() << "\n";
@@ -117,69 +1097,267 @@ bool createCompilerInstance(CompilerInstanceRef &compiler,
 
 bool enumerateIncludeFiles(std::vector<HeaderDescriptor> &header_files,
                            const std::string &header_folder) {
-  const static StringList valid_extensions = {".h", ".hh", ".hp", ".hpp",
-                                              ".hxx"};
+  std::vector<HeaderDescriptor> folder_header_files;
+  if (!enumerateIncludeFiles(folder_header_files, StringList{header_folder})) {
+    return false;
+  }
 
-  auto root_header_folder = stdfs::absolute(header_folder);
+  header_files.insert(header_files.end(),
+                      std::make_move_iterator(folder_header_files.begin()),
+                      std::make_move_iterator(folder_header_files.end()));
 
-  try {
-    stdfs::recursive_directory_iterator it(root_header_folder);
-    for (const auto &directory_entry : it) {
-      if (!stdfs::is_regular_file(directory_entry.path())) {
-        continue;
+  return true;
+}
+
+bool enumerateIncludeFiles(std::vector<HeaderDescriptor> &header_files,
+                           const StringList &header_folders,
+                           std::size_t worker_count,
+                           const HeaderFilter &header_filter,
+                           const std::string &snapshot_directory,
+                           HeaderSnapshotSummary *snapshot_summary) {
+  header_files = {};
+  if (snapshot_summary != nullptr) {
+    *snapshot_summary = {};
+  }
+
+  // Each folder is listed by one of the workers; nodes are stored in a deque
+  // so that the ones being filled are not moved when new folders are found
+  std::deque<IncludeFolderNode> node_list;
+  std::vector<std::size_t> pending_node_list;
+
+  for (const auto &folder : header_folders) {
+    IncludeFolderNode root_node;
+
+    try {
+      root_node.path = stdfs::absolute(folder);
+    } catch (...) {
+      std::cerr << "Failed to acquire the absolute path for the following "
+                   "directory: "
+                << folder << "\n";
+
+      return false;
+    }
+
+    // Header archives are indexed here, so that a damaged one is reported
+    // instead of failing the listing of its folders
+    ProfilePackRef header_archive;
+    auto archive_status =
+        getHeaderArchive(header_archive, root_node.path.string());
+    if (!archive_status.succeeded()) {
+      std::cerr << archive_status.toString() << "\n";
+      return false;
+    }
+
+    root_node.root_index = node_list.size();
+
+    pending_node_list.push_back(node_list.size());
+    node_list.push_back(std::move(root_node));
+  }
+
+  // The snapshots are only read here, so the workers can share them
+  std::vector<HeaderSnapshot> previous_snapshot_list(node_list.size());
+  if (!snapshot_directory.empty()) {
+    for (std::size_t i = 0U; i < node_list.size(); ++i) {
+      auto root_path = node_list[i].path.string();
+
+      readHeaderSnapshot(previous_snapshot_list[i],
+                         getHeaderSnapshotPath(snapshot_directory, root_path),
+                         root_path);
+    }
+  }
+
+  std::mutex node_list_mutex;
+  std::condition_variable node_list_cv;
+  std::size_t active_worker_count = 0U;
+  std::string failed_folder;
+
+  auto L_worker = [&](std::size_t) {
+    std::unique_lock<std::mutex> lock(node_list_mutex);
+
+    while (true) {
+      node_list_cv.wait(lock, [&]() -> bool {
+        return !pending_node_list.empty() || active_worker_count == 0U ||
+               !failed_folder.empty();
+      });
+
+      if (pending_node_list.empty() || !failed_folder.empty()) {
+        break;
       }
 
-      auto path = directory_entry.path();
+      auto &node = node_list[pending_node_list.back()];
+      pending_node_list.pop_back();
 
-      const auto &ext = path.extension().string();
-      if (ext.empty() ||
-          std::find(valid_extensions.begin(), valid_extensions.end(), ext) ==
-              valid_extensions.end()) {
-        continue;
+      ++active_worker_count;
+      lock.unlock();
+
+      const HeaderFolderSnapshot *previous_snapshot = nullptr;
+
+      const auto &folder_map =
+          previous_snapshot_list[node.root_index].folder_map;
+      auto folder_it = folder_map.find(node.relative_path);
+      if (folder_it != folder_map.end()) {
+        previous_snapshot = &folder_it->second;
       }
 
-      HeaderDescriptor header_desc = {};
-      header_desc.name = path.filename();
+      std::vector<stdfs::path> child_folder_list;
+      auto succeeded = listIncludeFolder(node, child_folder_list,
+                                         header_filter, previous_snapshot);
 
-      for (auto parent_path = path.parent_path();
-           !parent_path.empty() && parent_path != parent_path.root_path();
-           parent_path = parent_path.parent_path()) {
-        if (parent_path == root_header_folder) {
-          break;
+      // The children share the prefixes of this folder
+      std::vector<StringList> child_prefix_list;
+      for (const auto &child_folder : child_folder_list) {
+        auto folder_prefix = (child_folder.filename() / "").string();
+
+        StringList possible_prefixes = {folder_prefix};
+        for (const auto &prefix : node.possible_prefixes) {
+          possible_prefixes.push_back(
+              (stdfs::path(prefix) / folder_prefix).string());
         }
 
-        auto current_relative_path =
-            parent_path.filename() /
-            (header_desc.possible_prefixes.empty()
-                 ? ""
-                 : header_desc.possible_prefixes.back());
-        header_desc.possible_prefixes.push_back(current_relative_path.string());
+        child_prefix_list.push_back(std::move(possible_prefixes));
+      }
+
+      lock.lock();
+      --active_worker_count;
+
+      if (!succeeded) {
+        failed_folder = node.path.string();
+        node_list_cv.notify_all();
+        break;
+      }
+
+      node.first_child_index = node_list.size();
+
+      for (std::size_t i = 0U; i < child_folder_list.size(); ++i) {
+        IncludeFolderNode child_node;
+        child_node.relative_path =
+            node.relative_path.empty()
+                ? child_folder_list[i].filename().string()
+                : node.relative_path + "/" +
+                      child_folder_list[i].filename().string();
+
+        child_node.root_index = node.root_index;
+        child_node.path = std::move(child_folder_list[i]);
+        child_node.possible_prefixes = std::move(child_prefix_list[i]);
+
+        pending_node_list.push_back(node_list.size());
+        node_list.push_back(std::move(child_node));
       }
 
-      header_files.push_back(header_desc);
+      node_list_cv.notify_all();
     }
+  };
 
-    return true;
+  runTaskLanes(worker_count, TaskPriority::Normal, L_worker);
+
+  if (!failed_folder.empty()) {
+    std::cerr << "Failed to enumerate the include files in the following "
+                 "directory: "
+              << failed_folder << "\n";
 
-  } catch (...) {
     return false;
   }
-}
 
-bool enumerateIncludeFiles(std::vector<HeaderDescriptor> &header_files,
-                           const StringList &header_folders) {
-  header_files = {};
+  // Save the new snapshots; a folder that could not be saved is simply
+  // listed again by the next run
+  if (!snapshot_directory.empty()) {
+    std::vector<HeaderSnapshot> current_snapshot_list(header_folders.size());
+    for (std::size_t i = 0U; i < current_snapshot_list.size(); ++i) {
+      current_snapshot_list[i].root_path = node_list[i].path.string();
+    }
 
-  for (const auto &folder : header_folders) {
-    if (!enumerateIncludeFiles(header_files, folder)) {
-      std::cerr << "Failed to enumerate the include files in the following "
-                   "directory: "
-                << folder << "\n";
+    for (auto &node : node_list) {
+      if (snapshot_summary != nullptr) {
+        if (node.snapshot_reused) {
+          ++snapshot_summary->reused_folder_count;
+        } else {
+          ++snapshot_summary->listed_folder_count;
+        }
+      }
 
-      return false;
+      current_snapshot_list[node.root_index].folder_map.insert(
+          {node.relative_path, std::move(node.snapshot)});
+    }
+
+    for (std::size_t i = 0U; i < current_snapshot_list.size(); ++i) {
+      const auto &current_snapshot = current_snapshot_list[i];
+
+      if (snapshot_summary != nullptr) {
+        compareHeaderSnapshots(*snapshot_summary, previous_snapshot_list[i],
+                               current_snapshot);
+      }
+
+      writeHeaderSnapshot(current_snapshot,
+                          getHeaderSnapshotPath(snapshot_directory,
+                                                current_snapshot.root_path));
+    }
+  }
+
+  // Visit the folders in pre-order, so that the headers are returned in the
+  // same order a recursive directory iterator would use
+  for (std::size_t root_index = 0U; root_index < header_folders.size();
+       ++root_index) {
+    std::vector<std::pair<std::size_t, std::size_t>> visit_stack = {
+        {root_index, 0U}};
+
+    while (!visit_stack.empty()) {
+      auto &current_visit = visit_stack.back();
+      auto &node = node_list[current_visit.first];
+
+      if (current_visit.second >= node.entry_list.size()) {
+        visit_stack.pop_back();
+        continue;
+      }
+
+      const auto &entry = node.entry_list[current_visit.second];
+      ++current_visit.second;
+
+      if (entry.first) {
+        visit_stack.push_back({node.first_child_index + entry.second, 0U});
+      } else {
+        header_files.push_back(std::move(node.header_list[entry.second]));
+      }
+    }
+  }
+
+  // The same file can be reached from more than one header folder, or
+  // through symbolic links; only keep the first descriptor. When the names
+  // match, the prefixes of the duplicates are still valid for the header
+  std::map<llvm::sys::fs::UniqueID, std::size_t> header_index_map;
+  std::vector<HeaderDescriptor> unique_header_files;
+
+  for (auto &header_desc : header_files) {
+    llvm::sys::fs::UniqueID unique_id;
+    if (!getFileUniqueID(unique_id, header_desc.path)) {
+      unique_header_files.push_back(std::move(header_desc));
+      continue;
+    }
+
+    auto insert_status =
+        header_index_map.insert({unique_id, unique_header_files.size()});
+
+    if (insert_status.second) {
+      unique_header_files.push_back(std::move(header_desc));
+      continue;
+    }
+
+    auto &original_header_desc =
+        unique_header_files[insert_status.first->second];
+
+    if (original_header_desc.name != header_desc.name) {
+      continue;
+    }
+
+    auto &possible_prefixes = original_header_desc.possible_prefixes;
+    for (auto &prefix : header_desc.possible_prefixes) {
+      if (std::find(possible_prefixes.begin(), possible_prefixes.end(),
+                    prefix) == possible_prefixes.end()) {
+        possible_prefixes.push_back(std::move(prefix));
+      }
     }
   }
 
+  header_files = std::move(unique_header_files);
   return true;
 }
 
@@ -195,23 +1373,92 @@ StringList generateIncludeDirectives(
   return result;
 }
 
+StringList getHeaderSearchPaths(const CompilerInstanceSettings &settings) {
+  // The system and extern "C" system groups are searched together, in the
+  // order the folders have been added by createClangCompilerInstance
+  StringList header_search_paths;
+
+  stdfs::path profile_root(settings.profile.root_path);
+
+  for (const auto &path_map : {&settings.profile.internal_isystem,
+                               &settings.profile.internal_externc_isystem}) {
+    auto path_list_it = path_map->find(settings.language);
+    if (path_list_it == path_map->end()) {
+      continue;
+    }
+
+    for (const auto &path : path_list_it->second) {
+      header_search_paths.push_back((profile_root / path).string());
+    }
+  }
+
+  // Folders that createClangCompilerInstance fails to add are skipped
+  for (const auto &path : settings.additional_include_folders) {
+    try {
+      header_search_paths.push_back(stdfs::absolute(path).string());
+    } catch (...) {
+    }
+  }
+
+  return header_search_paths;
+}
+
+StringList resolveUniqueIncludePaths(const StringList &include_directive_list,
+                                     const StringList &header_search_paths) {
+  StringList include_path_list;
+
+  for (const auto &include_directive : include_directive_list) {
+    std::string include_path;
+    std::size_t match_count = 0U;
+
+    for (const auto &search_path : header_search_paths) {
+      auto candidate_path = stdfs::path(search_path) / include_directive;
+
+      std::error_code error;
+      if (!stdfs::is_regular_file(candidate_path, error)) {
+        continue;
+      }
+
+      if (++match_count == 1U) {
+        include_path = candidate_path.lexically_normal().string();
+      }
+    }
+
+    if (match_count != 1U) {
+      include_path.clear();
+    }
+
+    include_path_list.push_back(std::move(include_path));
+  }
+
+  return include_path_list;
+}
+
+void appendIncludeDirective(std::string &buffer, const std::string &include) {
+  buffer.append("#include <");
+  buffer.append(include);
+  buffer.append(">\n");
+}
+
 std::string generateSourceBuffer(const StringList &include_list,
                                  const StringList &base_includes) {
-  std::stringstream buffer;
+  std::string buffer;
   for (const auto &include : base_includes) {
-    buffer << "#include <" << include << ">\n";
+    appendIncludeDirective(buffer, include);
   }
 
   for (const auto &include : include_list) {
-    buffer << "#include <" << include << ">\n";
+    appendIncludeDirective(buffer, include);
   }
 
-  return buffer.str();
+  return buffer;
 }
 
 CompilerInstance::Status createClangCompilerInstance(
     std::unique_ptr<clang::CompilerInstance> &compiler,
-    const CompilerInstanceSettings &settings, IASTVisitorRef ast_visitor) {
+    const CompilerInstanceSettings &settings, IASTVisitorRef ast_visitor,
+    clang::TranslationUnitKind translation_unit_kind,
+    ClangSharedState *shared_state) {
   compiler.reset();
 
   std::unique_ptr<clang::CompilerInstance> obj;
@@ -261,6 +1508,15 @@ CompilerInstance::Status createClangCompilerInstance(
     }
   }
 
+  // System and extern "C" system folders are searched in the order they
+  // have been added, so the header map sits right before the folders it
+  // replaces
+  if (settings.header_map) {
+    header_search_options.AddPath(settings.header_map->path(),
+                                  clang::frontend::IncludeDirGroup::System,
+                                  false, false);
+  }
+
   for (const auto &path : settings.additional_include_folders) {
     try {
       auto absolute_path = stdfs::absolute(path);
@@ -269,9 +1525,13 @@ CompilerInstance::Status createClangCompilerInstance(
                                     clang::frontend::IncludeDirGroup::System,
                                     false, false);
     } catch (...) {
-      std::cerr << "Failed to acquire the absolute path for the following "
-                   "include folder: " +
-                       path;
+      // Compilers are created by the worker threads, whose output is not
+      // captured; report the error to the caller instead of printing it
+      return CompilerInstance::Status(
+          false, CompilerInstance::StatusCode::Unknown,
+          "Failed to acquire the absolute path for the following include "
+          "folder: " +
+              path);
     }
   }
 
@@ -338,58 +1598,218 @@ CompilerInstance::Status createClangCompilerInstance(
   language_options.GNUKeywords = 1;
   language_options.Bool = 1;
 
+  // The ASTVisitor only inspects declarations, so the parser does not need
+  // to go through the function bodies
+  obj->getFrontendOpts().SkipFunctionBodies =
+      settings.skip_function_bodies ? 1 : 0;
+
+  auto target_triple = settings.target_triple.empty()
+                           ? llvm::sys::getDefaultTargetTriple()
+                           : settings.target_triple;
+
   auto &invocation = obj->getInvocation();
   invocation.setLangDefaults(language_options, input_kind,
-                             llvm::Triple(llvm::sys::getDefaultTargetTriple()),
+                             llvm::Triple(target_triple),
                              obj->getPreprocessorOpts(), language_standard);
 
-  std::shared_ptr<clang::TargetOptions> target_options =
-      std::make_shared<clang::TargetOptions>();
-
-  target_options->Triple = llvm::sys::getDefaultTargetTriple();
+  // The modules are built by clang on a separate instance created from our
+  // invocation, so the target triple has to be found there as well
+  auto enable_modules = !settings.module_cache_path.empty();
+  if (enable_modules) {
+    language_options.Modules = 1;
+    language_options.ImplicitModules = 1;
+    header_search_options.ModuleCachePath = settings.module_cache_path;
+    obj->getTargetOpts().Triple = target_triple;
+  }
 
   obj->createDiagnostics();
+  obj->getDiagnostics().setIgnoreAllWarnings(settings.ignore_warnings);
+  obj->getDiagnostics().setFatalsAsError(settings.recover_from_fatal_errors);
+
+  if (shared_state != nullptr && shared_state->target_information) {
+    obj->setTarget(shared_state->target_information.get());
+
+  } else {
+    std::shared_ptr<clang::TargetOptions> target_options =
+        std::make_shared<clang::TargetOptions>();
+
+    target_options->Triple = target_triple;
+
+    clang::TargetInfo *target_information =
+        clang::TargetInfo::CreateTargetInfo(obj->getDiagnostics(),
+                                            target_options);
+
+    if (target_information == nullptr) {
+      return CompilerInstance::Status(
+          false, CompilerInstance::StatusCode::InvalidTargetTriple,
+          "Unsupported target triple: " + target_triple);
+    }
+
+    obj->setTarget(target_information);
+
+    if (shared_state != nullptr) {
+      shared_state->target_information = target_information;
+    }
+  }
+
+  if (shared_state != nullptr && shared_state->file_manager) {
+    obj->setFileManager(shared_state->file_manager.get());
+
+  } else {
+    // Serve the profile headers from the packed archive when available
+    ProfilePackRef profile_pack;
+    auto profile_pack_status = getProfilePack(profile_pack, settings.profile);
+    if (!profile_pack_status.succeeded()) {
+      return CompilerInstance::Status(
+          false, CompilerInstance::StatusCode::ProfilePackError,
+          profile_pack_status.toString());
+    }
+
+    // The profile pack is placed on top of the cache, since it does not
+    // need to access the file system
+    VirtualFileSystemRef file_system;
+    if (settings.file_system_cache) {
+      file_system = createCachingFileSystem(settings.file_system_cache);
+    }
+
+    if (profile_pack) {
+      file_system = createProfilePackFileSystem(profile_pack, file_system);
+    }
+
+    for (const auto &header_pack : settings.header_pack_list) {
+      file_system = createProfilePackFileSystem(header_pack, file_system);
+    }
+
+    if (settings.in_memory_file_map) {
+      file_system =
+          createInMemoryFileSystem(*settings.in_memory_file_map, file_system);
+    }
+
+    if (file_system) {
+      obj->setVirtualFileSystem(file_system);
+    }
 
-  clang::TargetInfo *target_information = clang::TargetInfo::CreateTargetInfo(
-      obj->getDiagnostics(), target_options);
+    obj->createFileManager();
 
-  obj->setTarget(target_information);
+    if (shared_state != nullptr) {
+      shared_state->file_manager = &obj->getFileManager();
+    }
+  }
 
-  obj->createFileManager();
   obj->createSourceManager(obj->getFileManager());
 
-  obj->createPreprocessor(clang::TU_Complete);
-  obj->getPreprocessorOpts().UsePredefines = false;
+  obj->createPreprocessor(translation_unit_kind);
+
+  // The instances building the modules would otherwise miss the predefined
+  // macros this translation unit sees
+  if (!enable_modules) {
+    obj->getPreprocessorOpts().UsePredefines = false;
+  }
 
   auto &preprocessor = obj->getPreprocessor();
   preprocessor.getBuiltinInfo().initializeBuiltins(
       preprocessor.getIdentifierTable(), language_options);
 
+  // Once the module maps are loaded, the #include directives naming one of
+  // their headers are turned into module imports
+  if (enable_modules) {
+    for (const auto &module_map_path : settings.module_map_file_list) {
+      auto module_map_entry = obj->getFileManager().getFile(module_map_path);
+
+      if (module_map_entry == nullptr ||
+          preprocessor.getHeaderSearchInfo().loadModuleMapFile(
+              module_map_entry, false)) {
+        return CompilerInstance::Status(
+            false, CompilerInstance::StatusCode::ModuleMapError,
+            "Failed to load the module map: " + module_map_path);
+      }
+    }
+  }
+
   auto &source_manager = obj->getSourceManager();
 
   obj->createASTContext();
 
-  std::unique_ptr<clang::MangleContext> name_mangler;
-  if (settings.use_visual_cxx_mangling) {
-    name_mangler.reset(clang::MicrosoftMangleContext::create(
-        obj->getASTContext(), obj->getDiagnostics()));
-  } else {
-    name_mangler.reset(clang::ItaniumMangleContext::create(
-        obj->getASTContext(), obj->getDiagnostics()));
+  // Attach the precompiled header; the settings are always the same used
+  // to generate it, so it is not necessary to validate it
+  if (!settings.precompiled_header.empty()) {
+    obj->getPreprocessorOpts().DisablePCHValidation = true;
+    obj->createPCHExternalASTSource(settings.precompiled_header, true, false,
+                                    nullptr, false);
+
+    if (obj->getASTContext().getExternalSource() == nullptr) {
+      return CompilerInstance::Status(
+          false, CompilerInstance::StatusCode::PrecompiledHeaderError,
+          "Failed to load the precompiled header: " +
+              settings.precompiled_header);
+    }
+  }
+
+  // Both manglers only read the AST, so the same pass can produce the names
+  // of the Linux and of the Windows libraries
+  auto L_createMangler =
+      [&](bool visual_cxx_mangling) -> std::unique_ptr<clang::MangleContext> {
+    if (visual_cxx_mangling) {
+      return std::unique_ptr<clang::MangleContext>(
+          clang::MicrosoftMangleContext::create(obj->getASTContext(),
+                                                obj->getDiagnostics()));
+    }
+
+    return std::unique_ptr<clang::MangleContext>(
+        clang::ItaniumMangleContext::create(obj->getASTContext(),
+                                            obj->getDiagnostics()));
+  };
+
+  auto name_mangler = L_createMangler(settings.use_visual_cxx_mangling);
+
+  std::unique_ptr<clang::MangleContext> alternate_name_mangler;
+  if (settings.dual_mangling) {
+    alternate_name_mangler = L_createMangler(!settings.use_visual_cxx_mangling);
   }
 
-  if (!name_mangler) {
+  if (!name_mangler || (settings.dual_mangling && !alternate_name_mangler)) {
     return CompilerInstance::Status(
         false, CompilerInstance::StatusCode::MemoryAllocationFailure);
   }
 
   obj->setASTConsumer(llvm::make_unique<ASTConsumer>(
-      source_manager, ast_visitor, std::move(name_mangler)));
-
-  name_mangler.release();
+      source_manager, ast_visitor, std::move(name_mangler),
+      std::move(alternate_name_mangler), obj->getDiagnostics(), *obj,
+      settings));
 
   compiler = std::move(obj);
   obj.release();
 
   return CompilerInstance::Status(true);
 }
+
+void visitParsedTranslationUnit(clang::CompilerInstance &compiler,
+                                IASTVisitorRef ast_visitor,
+                                const CompilerInstanceSettings &settings) {
+  // The consumer has been installed by createClangCompilerInstance
+  auto &consumer = static_cast<ASTConsumer &>(compiler.getASTConsumer());
+
+  consumer.configure(ast_visitor, settings);
+  consumer.HandleTranslationUnit(compiler.getASTContext());
+}
+
+StringList getSystemHeaderList(Language language, int standard) {
+  const auto &header_group_list = (language == Language::C)
+                                      ? kCSystemHeaderGroups
+                                      : kCXXSystemHeaderGroups;
+
+  StringList header_list;
+  for (const auto &header_group : header_group_list) {
+    header_list.insert(header_list.end(), header_group.header_list.begin(),
+                       header_group.header_list.end());
+
+    if (header_group.standard == standard) {
+      break;
+    }
+  }
+
+  header_list.insert(header_list.end(), kPOSIXSystemHeaderList.begin(),
+                     kPOSIXSystemHeaderList.end());
+
+  return header_list;
+}
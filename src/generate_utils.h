@@ -18,20 +18,80 @@
 
 #include "cmdline.h"
 #include "compilerinstance.h"
+#include "content_hash.h"
 #include "generate_command.h"
+#include "header_filter.h"
 #include "types.h"
 
 #include <clang/AST/RecursiveASTVisitor.h>
+#include <clang/Lex/HeaderSearch.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/Support/FileSystem.h>
 
-/// Returns the source code location for the given declaration
+/// Assigns an identifier to each file referenced by a source code location,
+/// so that each path is only stored once
+struct FilePathTable final {
+  /// The file paths, indexed by SourceCodeLocation::file_id
+  StringList file_path_list;
+
+  /// For each file path, the line of the main file whose #include directive
+  /// (directly or otherwise) brought the file in; zero for the main file
+  std::vector<std::uint32_t> include_line_list;
+
+  /// Maps each file entry to its identifier; the main file (the generated
+  /// buffer) has no file entry and uses the null key
+  llvm::DenseMap<const clang::FileEntry *, FileId> file_entry_map;
+};
+
+/// Returns the source code location for the given declaration; the file path
+/// is added to the file path table
 SourceCodeLocation getSourceCodeLocation(clang::ASTContext &ast_context,
                                          clang::SourceManager &source_manager,
-                                         const clang::Decl *declaration);
+                                         const clang::Decl *declaration,
+                                         FilePathTable &file_path_table);
 
 /// Returns true if the given function declaration accepts (directly or
 /// otherwise) a function pointer
 bool containsFunctionPointer(const clang::FunctionDecl *func_decl);
 
+/// Initializes the compiler instance settings according to the command line
+/// options
+bool createCompilerInstanceSettings(
+    CompilerInstanceSettings &compiler_settings,
+    ProfileManagerRef &profile_manager, const LanguageManager &language_manager,
+    const CommandLineOptions &cmdline_options);
+
+/// Returns the path of each file that has been loaded by the source manager
+StringList getSourceManagerFileList(clang::SourceManager &source_manager);
+
+/// Returns the path of each file loaded by the source manager that is
+/// protected by an include guard or by #pragma once; including these files
+/// again has no effect
+StringList getSourceManagerGuardedFileList(clang::SourceManager &source_manager,
+                                           clang::HeaderSearch &header_search);
+
+/// Returns the device and inode pair identifying the given file, so that
+/// paths reaching the same file through different folders or symbolic links
+/// can be matched
+bool getFileUniqueID(llvm::sys::fs::UniqueID &unique_id,
+                     const std::string &path);
+
+/// Hashes the profile, the language and the language extensions, along with
+/// the clang and abigen versions; these are the settings that the
+/// precompiled system headers of a profile depend on
+ContentHash hashProfileSettings(
+    const CompilerInstanceSettings &compiler_settings);
+
+/// Returns the system headers that are precompiled (or summarized) for the
+/// given language standard; each standard also gets the headers of the
+/// previous ones. Headers that a profile can't compile are not filtered out
+StringList getSystemHeaderList(Language language, int standard);
+
+/// Hashes all the compiler settings that can change the result of a
+/// compilation, including the clang and abigen versions
+ContentHash hashCompilerInstanceSettings(
+    const CompilerInstanceSettings &compiler_settings);
+
 /// Creates a new compiler instance object configured according to the command
 /// line options
 bool createCompilerInstance(CompilerInstanceRef &compiler,
@@ -39,18 +99,58 @@ bool createCompilerInstance(CompilerInstanceRef &compiler,
                             const LanguageManager &language_manager,
                             const CommandLineOptions &cmdline_options);
 
-/// Recursively enumerates all the include files found in the given folder
+/// Recursively enumerates all the include files found in the given folder,
+/// appending them to the header list
 bool enumerateIncludeFiles(std::vector<HeaderDescriptor> &header_files,
                            const std::string &header_folder);
 
-/// Recursively enumerates all the include files found in the given folder list
-bool enumerateIncludeFiles(std::vector<HeaderDescriptor> &header_files,
-                           const StringList &header_folders);
+/// Describes how the header folder snapshots have been used by the last
+/// enumeration
+struct HeaderSnapshotSummary final {
+  /// Folders whose entries have been taken from the snapshot
+  std::size_t reused_folder_count{0U};
+
+  /// Folders that had to be listed again
+  std::size_t listed_folder_count{0U};
+
+  /// Headers created since the previous snapshot, before filtering
+  StringList added_header_list;
+
+  /// Headers deleted since the previous snapshot, before filtering
+  StringList removed_header_list;
+};
+
+/// Recursively enumerates all the include files found in the given folder
+/// list. The folders are listed on the given amount of threads, but the
+/// headers are always returned in the directory walk order. Folders excluded
+/// by the filter are skipped without being listed. When a cache folder is
+/// given, the entries of each folder are saved in a snapshot, and the
+/// following runs only list the folders whose modification time changed
+bool enumerateIncludeFiles(
+    std::vector<HeaderDescriptor> &header_files,
+    const StringList &header_folders, std::size_t worker_count = 1U,
+    const HeaderFilter &header_filter = HeaderFilter(),
+    const std::string &snapshot_directory = std::string(),
+    HeaderSnapshotSummary *snapshot_summary = nullptr);
 
 /// Given a header descriptor, it generates al possible include directives that
 /// can import it. It works by mixing the header name with several prefixes
 StringList generateIncludeDirectives(const HeaderDescriptor &header_descriptor);
 
+/// Returns the absolute paths of the folders searched by the compiler
+/// instances for angled include directives, in the same order used by clang
+StringList getHeaderSearchPaths(const CompilerInstanceSettings &settings);
+
+/// Returns the absolute path of the file each include directive resolves to
+/// when searching the given folders in order. An empty string is returned
+/// for the directives that no folder contains, and for the ones found in
+/// more than one folder, since those can be reached again by #include_next
+StringList resolveUniqueIncludePaths(const StringList &include_directive_list,
+                                     const StringList &header_search_paths);
+
+/// Appends the #include line of the given header to the source buffer
+void appendIncludeDirective(std::string &buffer, const std::string &include);
+
 /// Generates a compilable source code buffer that includes all the given
 /// headers
 std::string generateSourceBuffer(const StringList &include_list,
@@ -64,8 +164,19 @@ bool astFunctionCallback(clang::Decl *declaration,
                          void *user_defined,
                          clang::MangleContext *name_mangler);
 
-/// Creates a clang CompilerInstance object
+/// Creates a clang CompilerInstance object. When the shared state is passed,
+/// the objects it contains are reused (or created and saved there if missing)
 CompilerInstance::Status createClangCompilerInstance(
     std::unique_ptr<clang::CompilerInstance> &compiler,
     const CompilerInstanceSettings &settings,
-    IASTVisitorRef ast_visitor = IASTVisitorRef());
+    IASTVisitorRef ast_visitor = IASTVisitorRef(),
+    clang::TranslationUnitKind translation_unit_kind = clang::TU_Complete,
+    ClangSharedState *shared_state = nullptr);
+
+/// Runs the given visitor on the translation unit that the compiler, created
+/// with createClangCompilerInstance, has already parsed. The traversal
+/// folders, the shards and the output paths are taken from the given
+/// settings instead of the ones the compiler has been created with
+void visitParsedTranslationUnit(clang::CompilerInstance &compiler,
+                                IASTVisitorRef ast_visitor,
+                                const CompilerInstanceSettings &settings);
@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_dependencies.h"
+#include "generate_utils.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+/// Collapses the "." and ".." components of the given path, without
+/// accessing the file system
+std::string normalizePath(const stdfs::path &path) {
+  std::vector<std::string> component_list;
+  for (const auto &component : path.relative_path()) {
+    auto name = component.string();
+
+    if (name.empty() || name == ".") {
+      continue;
+    }
+
+    if (name == "..") {
+      if (!component_list.empty()) {
+        component_list.pop_back();
+      }
+
+      continue;
+    }
+
+    component_list.push_back(name);
+  }
+
+  auto output = path.root_path();
+  for (const auto &component : component_list) {
+    output /= component;
+  }
+
+  return output.string();
+}
+}  // namespace
+
+bool scanIncludeDirectives(IncludeDirectiveList &include_directive_list,
+                           const std::string &path) {
+  HeaderScan header_scan;
+  auto succeeded = scanHeaderFile(header_scan, path);
+
+  include_directive_list = std::move(header_scan.include_directive_list);
+  return succeeded;
+}
+
+std::vector<std::vector<std::size_t>> getHeaderDependencies(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner *header_scanner) {
+  auto header_count = header_files.size();
+
+  // Map each header to the directives that can be used to include it
+  std::unordered_map<std::string, std::size_t> path_map;
+  std::unordered_map<std::string, std::vector<std::size_t>> directive_map;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    const auto &header_desc = header_files[i];
+
+    path_map.insert({normalizePath(header_desc.path), i});
+
+    for (const auto &directive : generateIncludeDirectives(header_desc)) {
+      directive_map[directive].push_back(i);
+    }
+  }
+
+  std::vector<std::vector<std::size_t>> dependency_list(header_count);
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    const auto &header_desc = header_files[i];
+
+    IncludeDirectiveList local_include_directive_list;
+    const IncludeDirectiveList *include_directive_list = nullptr;
+
+    HeaderScanRef header_scan;
+    if (header_scanner != nullptr) {
+      header_scan = header_scanner->scan(header_desc.path);
+      if (!header_scan) {
+        continue;
+      }
+
+      include_directive_list = &header_scan->include_directive_list;
+
+    } else if (scanIncludeDirectives(local_include_directive_list,
+                                     header_desc.path)) {
+      include_directive_list = &local_include_directive_list;
+
+    } else {
+      continue;
+    }
+
+    std::unordered_set<std::size_t> dependency_set;
+
+    for (const auto &include_directive : *include_directive_list) {
+      // Quoted includes are first looked up next to the including file
+      if (!include_directive.is_angled) {
+        auto local_path =
+            normalizePath(stdfs::path(header_desc.path).parent_path() /
+                          include_directive.header);
+
+        auto path_it = path_map.find(local_path);
+        if (path_it != path_map.end()) {
+          dependency_set.insert(path_it->second);
+          continue;
+        }
+      }
+
+      // When the name is ambiguous, all the candidates are dependencies;
+      // this only affects the order in which they are probed
+      auto directive_it = directive_map.find(include_directive.header);
+      if (directive_it != directive_map.end()) {
+        dependency_set.insert(directive_it->second.begin(),
+                              directive_it->second.end());
+      }
+    }
+
+    dependency_set.erase(i);
+
+    dependency_list[i].assign(dependency_set.begin(), dependency_set.end());
+  }
+
+  return dependency_list;
+}
+
+void sortHeadersByDependencies(std::vector<HeaderDescriptor> &header_files,
+                               HeaderScanner *header_scanner) {
+  auto header_count = header_files.size();
+  auto dependency_list = getHeaderDependencies(header_files, header_scanner);
+
+  // Edges go from each header to the headers including it
+  std::vector<std::vector<std::size_t>> dependent_list(header_count);
+  std::vector<std::size_t> pending_dependency_count(header_count, 0U);
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    for (auto dependency : dependency_list[i]) {
+      dependent_list[dependency].push_back(i);
+      pending_dependency_count[i]++;
+    }
+  }
+
+  // Kahn's algorithm, always taking the ready header that comes first in the
+  // original order
+  std::priority_queue<std::size_t, std::vector<std::size_t>,
+                      std::greater<std::size_t>>
+      ready_queue;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    if (pending_dependency_count[i] == 0U) {
+      ready_queue.push(i);
+    }
+  }
+
+  std::vector<bool> emitted(header_count, false);
+  std::vector<std::size_t> sorted_index_list;
+  sorted_index_list.reserve(header_count);
+
+  std::size_t next_unvisited_index = 0U;
+
+  while (sorted_index_list.size() < header_count) {
+    std::size_t current_index;
+
+    if (!ready_queue.empty()) {
+      current_index = ready_queue.top();
+      ready_queue.pop();
+
+      if (emitted[current_index]) {
+        continue;
+      }
+
+    } else {
+      // Every remaining header is part of (or depends on) a cycle
+      while (emitted[next_unvisited_index]) {
+        ++next_unvisited_index;
+      }
+
+      current_index = next_unvisited_index;
+    }
+
+    emitted[current_index] = true;
+    sorted_index_list.push_back(current_index);
+
+    for (auto dependent : dependent_list[current_index]) {
+      if (--pending_dependency_count[dependent] == 0U && !emitted[dependent]) {
+        ready_queue.push(dependent);
+      }
+    }
+  }
+
+  std::vector<HeaderDescriptor> sorted_header_files;
+  sorted_header_files.reserve(header_count);
+
+  for (auto index : sorted_index_list) {
+    sorted_header_files.push_back(std::move(header_files[index]));
+  }
+
+  header_files = std::move(sorted_header_files);
+}
+
+std::size_t sortHeadersByFanOut(std::vector<HeaderDescriptor> &header_files,
+                                HeaderScanner *header_scanner) {
+  auto header_count = header_files.size();
+  auto dependency_list = getHeaderDependencies(header_files, header_scanner);
+
+  // Each header is walked from once; the visit marks are reused by storing
+  // the index of the walk that set them
+  std::vector<std::size_t> fan_out_list(header_count, 0U);
+  std::vector<std::size_t> visit_mark_list(header_count, header_count);
+  std::vector<std::size_t> pending_list;
+
+  std::size_t largest_fan_out = 0U;
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    visit_mark_list[i] = i;
+    pending_list.assign(1U, i);
+
+    std::size_t fan_out = 0U;
+
+    while (!pending_list.empty()) {
+      auto current_index = pending_list.back();
+      pending_list.pop_back();
+
+      for (auto dependency : dependency_list[current_index]) {
+        if (visit_mark_list[dependency] == i) {
+          continue;
+        }
+
+        visit_mark_list[dependency] = i;
+        pending_list.push_back(dependency);
+        ++fan_out;
+      }
+    }
+
+    fan_out_list[i] = fan_out;
+    largest_fan_out = std::max(largest_fan_out, fan_out);
+  }
+
+  std::vector<std::size_t> sorted_index_list(header_count);
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    sorted_index_list[i] = i;
+  }
+
+  std::stable_sort(sorted_index_list.begin(), sorted_index_list.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return fan_out_list[lhs] > fan_out_list[rhs];
+                   });
+
+  std::vector<HeaderDescriptor> sorted_header_files;
+  sorted_header_files.reserve(header_count);
+
+  for (auto index : sorted_index_list) {
+    sorted_header_files.push_back(std::move(header_files[index]));
+  }
+
+  header_files = std::move(sorted_header_files);
+  return largest_fan_out;
+}
+
+std::vector<std::vector<std::size_t>> getHeaderComponents(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner *header_scanner) {
+  auto header_count = header_files.size();
+  auto dependency_list = getHeaderDependencies(header_files, header_scanner);
+
+  // Union-find, with path halving; the smallest position is the root, so
+  // that the components come out sorted by their first header
+  std::vector<std::size_t> parent_list(header_count);
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    parent_list[i] = i;
+  }
+
+  auto L_findRoot = [&](std::size_t index) -> std::size_t {
+    while (parent_list[index] != index) {
+      parent_list[index] = parent_list[parent_list[index]];
+      index = parent_list[index];
+    }
+
+    return index;
+  };
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    for (auto dependency : dependency_list[i]) {
+      auto lhs_root = L_findRoot(i);
+      auto rhs_root = L_findRoot(dependency);
+
+      if (lhs_root < rhs_root) {
+        parent_list[rhs_root] = lhs_root;
+      } else if (rhs_root < lhs_root) {
+        parent_list[lhs_root] = rhs_root;
+      }
+    }
+  }
+
+  std::vector<std::vector<std::size_t>> component_list;
+  std::vector<std::size_t> component_index_list(header_count, 0U);
+
+  for (std::size_t i = 0U; i < header_count; ++i) {
+    auto root = L_findRoot(i);
+    if (root == i) {
+      component_index_list[i] = component_list.size();
+      component_list.emplace_back();
+    }
+
+    component_list[component_index_list[root]].push_back(i);
+  }
+
+  return component_list;
+}
+
+DeclaredIdentifierIndex getDeclaredIdentifierIndex(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner &header_scanner) {
+  DeclaredIdentifierIndex identifier_index;
+
+  for (const auto &header_desc : header_files) {
+    auto header_scan = header_scanner.scan(header_desc.path);
+    if (!header_scan) {
+      continue;
+    }
+
+    // Overloads and repeated macro definitions list the same name twice
+    auto L_addIdentifier = [&](const std::string &identifier) {
+      auto &path_list = identifier_index[identifier];
+      if (path_list.empty() || path_list.back() != header_desc.path) {
+        path_list.push_back(header_desc.path);
+      }
+    };
+
+    for (const auto &function_name : header_scan->function_name_list) {
+      L_addIdentifier(function_name);
+    }
+
+    for (const auto &identifier : header_scan->declared_identifier_list) {
+      L_addIdentifier(identifier);
+    }
+  }
+
+  return identifier_index;
+}
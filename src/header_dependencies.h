@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "generate_command.h"
+#include "header_scanner.h"
+#include "types.h"
+
+#include <unordered_map>
+#include <vector>
+
+/// Collects the #include, #include_next and #import directives of the given
+/// file, with scanHeaderFile()
+bool scanIncludeDirectives(IncludeDirectiveList &include_directive_list,
+                           const std::string &path);
+
+/// Returns, for each header, the positions of the other candidate headers
+/// it includes, found with scanIncludeDirectives(); unreadable headers
+/// include nothing. When a scanner is passed, its shared scans are used
+/// instead
+std::vector<std::vector<std::size_t>> getHeaderDependencies(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner *header_scanner = nullptr);
+
+/// Sorts the headers so that each one comes after the headers it includes;
+/// headers are otherwise kept in their original order, and include cycles are
+/// broken by taking the first pending header
+void sortHeadersByDependencies(std::vector<HeaderDescriptor> &header_files,
+                               HeaderScanner *header_scanner = nullptr);
+
+/// Sorts the headers by include fan-out, in descending order: the amount of
+/// other candidate headers each one reaches through its include directives,
+/// directly or not. Umbrella headers come first; headers with the same
+/// fan-out are kept in their original order. Returns the largest fan-out
+std::size_t sortHeadersByFanOut(std::vector<HeaderDescriptor> &header_files,
+                                HeaderScanner *header_scanner = nullptr);
+
+/// Partitions the headers into the connected components of their include
+/// graph, ignoring the direction of the include directives. Each component
+/// lists the positions of its headers in ascending order, and the
+/// components are sorted by their first header
+std::vector<std::vector<std::size_t>> getHeaderComponents(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner *header_scanner = nullptr);
+
+/// Maps each identifier to the paths of the candidate headers that appear
+/// to declare it
+using DeclaredIdentifierIndex = std::unordered_map<std::string, StringList>;
+
+/// Builds the declared identifier index of the given headers from their
+/// function names and declared identifiers (see HeaderScan); each entry
+/// lists its headers in their original order, without duplicates
+DeclaredIdentifierIndex getDeclaredIdentifierIndex(
+    const std::vector<HeaderDescriptor> &header_files,
+    HeaderScanner &header_scanner);
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_filter.h"
+
+#include <cstddef>
+
+namespace {
+/// Matches the pattern starting at the given positions
+bool matchGlobAt(const std::string &pattern, std::size_t pattern_index,
+                 const std::string &path, std::size_t path_index) {
+  while (pattern_index < pattern.size()) {
+    auto c = pattern[pattern_index];
+
+    if (c == '*') {
+      // A double star can also match the path separators; when followed by
+      // a separator, it can match zero folders
+      if (pattern_index + 1U < pattern.size() &&
+          pattern[pattern_index + 1U] == '*') {
+        pattern_index += 2U;
+
+        if (pattern_index < pattern.size() && pattern[pattern_index] == '/' &&
+            matchGlobAt(pattern, pattern_index + 1U, path, path_index)) {
+          return true;
+        }
+
+        for (auto i = path_index; i <= path.size(); ++i) {
+          if (matchGlobAt(pattern, pattern_index, path, i)) {
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      ++pattern_index;
+
+      for (auto i = path_index; i <= path.size(); ++i) {
+        if (matchGlobAt(pattern, pattern_index, path, i)) {
+          return true;
+        }
+
+        if (i < path.size() && path[i] == '/') {
+          break;
+        }
+      }
+
+      return false;
+    }
+
+    if (path_index >= path.size()) {
+      return false;
+    }
+
+    if (c == '?') {
+      if (path[path_index] == '/') {
+        return false;
+      }
+
+    } else if (c == '[') {
+      auto set_end = pattern.find(']', pattern_index + 1U);
+      if (set_end == std::string::npos) {
+        // Not a set; match the bracket itself
+        if (path[path_index] != c) {
+          return false;
+        }
+
+      } else {
+        auto set_start = pattern_index + 1U;
+
+        bool negated = false;
+        if (set_start < set_end &&
+            (pattern[set_start] == '!' || pattern[set_start] == '^')) {
+          negated = true;
+          ++set_start;
+        }
+
+        bool matched = false;
+        for (auto i = set_start; i < set_end; ++i) {
+          if (i + 2U < set_end && pattern[i + 1U] == '-') {
+            if (path[path_index] >= pattern[i] &&
+                path[path_index] <= pattern[i + 2U]) {
+              matched = true;
+            }
+
+            i += 2U;
+
+          } else if (path[path_index] == pattern[i]) {
+            matched = true;
+          }
+        }
+
+        if (matched == negated || path[path_index] == '/') {
+          return false;
+        }
+
+        pattern_index = set_end;
+      }
+
+    } else if (c != path[path_index]) {
+      return false;
+    }
+
+    ++pattern_index;
+    ++path_index;
+  }
+
+  return path_index == path.size();
+}
+
+/// Matches the pattern against the relative path, or against the last path
+/// component if the pattern has no separator
+bool matchFilterPattern(const std::string &pattern,
+                        const std::string &relative_path) {
+  if (pattern.find('/') != std::string::npos) {
+    return matchGlob(pattern, relative_path);
+  }
+
+  auto separator_index = relative_path.rfind('/');
+  if (separator_index == std::string::npos) {
+    return matchGlob(pattern, relative_path);
+  }
+
+  return matchGlob(pattern, relative_path.substr(separator_index + 1U));
+}
+}  // namespace
+
+bool matchGlob(const std::string &pattern, const std::string &path) {
+  return matchGlobAt(pattern, 0U, path, 0U);
+}
+
+bool HeaderFilter::excludesFolder(const std::string &relative_path) const {
+  for (const auto &pattern : exclude_globs) {
+    if (matchFilterPattern(pattern, relative_path)) {
+      return true;
+    }
+
+    // "folder/**" excludes the whole folder; the pattern has a separator, so
+    // it is still matched against the relative path
+    const std::string recursive_suffix = "/**";
+    if (pattern.size() > recursive_suffix.size() &&
+        pattern.compare(pattern.size() - recursive_suffix.size(),
+                        recursive_suffix.size(), recursive_suffix) == 0 &&
+        matchGlob(pattern.substr(0U, pattern.size() - recursive_suffix.size()),
+                  relative_path)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool HeaderFilter::acceptsHeader(const std::string &relative_path) const {
+  for (const auto &pattern : exclude_globs) {
+    if (matchFilterPattern(pattern, relative_path)) {
+      return false;
+    }
+  }
+
+  if (include_globs.empty()) {
+    return true;
+  }
+
+  for (const auto &pattern : include_globs) {
+    if (matchFilterPattern(pattern, relative_path)) {
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "types.h"
+
+#include <string>
+
+/// Returns true if the given path matches the glob pattern. The '*' and '?'
+/// wildcards never match the path separator, '**' matches any sequence of
+/// folders, and '[...]' matches a single character from a set
+bool matchGlob(const std::string &pattern, const std::string &path);
+
+/// The include and exclude patterns used to filter the header folders.
+/// Patterns containing a '/' are matched against the path relative to the
+/// header folder, while the other ones are matched against each file or
+/// folder name
+struct HeaderFilter final {
+  /// If not empty, only the headers matching at least one of these patterns
+  /// are enumerated
+  StringList include_globs;
+
+  /// Headers and folders matching any of these patterns are skipped
+  StringList exclude_globs;
+
+  /// Returns true if the given folder, together with everything inside it,
+  /// should be skipped; the path is relative to the header folder
+  bool excludesFolder(const std::string &relative_path) const;
+
+  /// Returns true if the given header should be enumerated; the path is
+  /// relative to the header folder
+  bool acceptsHeader(const std::string &relative_path) const;
+};
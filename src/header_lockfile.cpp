@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_lockfile.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace {
+/// The first line of each lockfile
+const std::string kHeaderLockfileHeader = "abigen-lockfile 2";
+}  // namespace
+
+bool readHeaderLockfile(HeaderLockfile &lockfile, const std::string &path) {
+  lockfile = {};
+
+  std::ifstream lockfile_file(path);
+  if (!lockfile_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(lockfile_file, line) || line != kHeaderLockfileHeader) {
+    return false;
+  }
+
+  const std::string settings_tag = "settings ";
+  if (!std::getline(lockfile_file, line) ||
+      line.compare(0U, settings_tag.size(), settings_tag) != 0 ||
+      !contentHashFromString(lockfile.configuration_hash,
+                             line.substr(settings_tag.size()))) {
+    return false;
+  }
+
+  const std::string include_tag = "include ";
+  const std::string discarded_tag = "discarded ";
+
+  while (std::getline(lockfile_file, line)) {
+    if (line.compare(0U, include_tag.size(), include_tag) == 0) {
+      lockfile.include_list.push_back(line.substr(include_tag.size()));
+      continue;
+    }
+
+    if (line.compare(0U, discarded_tag.size(), discarded_tag) != 0 ||
+        line.size() < discarded_tag.size() + 18U) {
+      return false;
+    }
+
+    ContentHash hash;
+    if (!contentHashFromString(hash, line.substr(discarded_tag.size(), 16U))) {
+      return false;
+    }
+
+    lockfile.discarded_header_map.insert(
+        {line.substr(discarded_tag.size() + 17U), hash});
+  }
+
+  return true;
+}
+
+bool writeHeaderLockfile(const HeaderLockfile &lockfile,
+                         const std::string &path) {
+  std::stringstream buffer;
+  buffer << kHeaderLockfileHeader << "\n";
+  buffer << "settings " << contentHashToString(lockfile.configuration_hash)
+         << "\n";
+
+  for (const auto &include_directive : lockfile.include_list) {
+    buffer << "include " << include_directive << "\n";
+  }
+
+  for (const auto &p : lockfile.discarded_header_map) {
+    buffer << "discarded " << contentHashToString(p.second) << " " << p.first
+           << "\n";
+  }
+
+  return writeFileAtomically(path, buffer.str());
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "types.h"
+
+#include <map>
+
+/// The outcome of the header probing, saved next to the ABI library so that
+/// the following runs can verify it with a single compilation
+struct HeaderLockfile final {
+  /// The hash of the compiler settings, the probe tiers and the base
+  /// includes used by the run
+  ContentHash configuration_hash{0U};
+
+  /// The accepted include directives, in order
+  StringList include_list;
+
+  /// The include closure hash of each header that has been discarded (see
+  /// FileFingerprintIndex::includeClosureHashes), keyed on its path; sorted,
+  /// so that the lockfile does not change across identical runs
+  std::map<std::string, ContentHash> discarded_header_map;
+};
+
+/// Reads the given lockfile; returns false if it is missing or malformed
+bool readHeaderLockfile(HeaderLockfile &lockfile, const std::string &path);
+
+/// Saves the given lockfile, replacing the previous one atomically
+bool writeHeaderLockfile(const HeaderLockfile &lockfile,
+                         const std::string &path);
@@ -0,0 +1,311 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_map.h"
+#include "std_filesystem.h"
+
+#include <clang/Lex/HeaderMapTypes.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <unordered_map>
+
+namespace {
+/// Returns the lowercase version of the given string; header map lookups
+/// are case insensitive
+std::string toLowerCase(const std::string &str) {
+  auto lowercase_str = str;
+
+  for (auto &c : lowercase_str) {
+    if (c >= 'A' && c <= 'Z') {
+      c = static_cast<char>(c - 'A' + 'a');
+    }
+  }
+
+  return lowercase_str;
+}
+
+/// The hash function used by clang to place the keys in the buckets
+std::uint32_t hashHeaderMapKey(const std::string &key) {
+  std::uint32_t hash = 0U;
+  for (auto c : toLowerCase(key)) {
+    hash += static_cast<std::uint32_t>(static_cast<unsigned char>(c)) * 13U;
+  }
+
+  return hash;
+}
+
+/// A single header map entry
+struct HeaderMapEntry final {
+  /// The include name
+  std::string key;
+
+  /// The include folder, with a trailing separator
+  std::string prefix;
+
+  /// The path of the header inside the include folder
+  std::string suffix;
+};
+
+/// Serializes the given entries in the clang header map format
+std::string serializeHeaderMap(const std::vector<HeaderMapEntry> &entry_list) {
+  // Offset zero marks the empty buckets, so the string table starts with a
+  // placeholder byte
+  std::string string_table(1U, '\0');
+  std::unordered_map<std::string, std::uint32_t> string_offset_map;
+
+  auto L_addString = [&](const std::string &str) -> std::uint32_t {
+    auto it = string_offset_map.find(str);
+    if (it != string_offset_map.end()) {
+      return it->second;
+    }
+
+    auto offset = static_cast<std::uint32_t>(string_table.size());
+    string_table.append(str);
+    string_table.push_back('\0');
+
+    string_offset_map.insert({str, offset});
+    return offset;
+  };
+
+  // Keep at least half of the buckets empty, so that the probe sequences
+  // stay short
+  std::uint32_t bucket_count = 1U;
+  while (bucket_count < entry_list.size() * 2U) {
+    bucket_count *= 2U;
+  }
+
+  std::vector<clang::HMapBucket> bucket_list(bucket_count);
+  for (auto &bucket : bucket_list) {
+    bucket.Key = clang::HMAP_EmptyBucketKey;
+    bucket.Prefix = 0U;
+    bucket.Suffix = 0U;
+  }
+
+  std::uint32_t max_value_length = 0U;
+
+  for (const auto &entry : entry_list) {
+    auto bucket_index = hashHeaderMapKey(entry.key) & (bucket_count - 1U);
+    while (bucket_list[bucket_index].Key != clang::HMAP_EmptyBucketKey) {
+      bucket_index = (bucket_index + 1U) & (bucket_count - 1U);
+    }
+
+    auto &bucket = bucket_list[bucket_index];
+    bucket.Key = L_addString(entry.key);
+    bucket.Prefix = L_addString(entry.prefix);
+    bucket.Suffix = L_addString(entry.suffix);
+
+    max_value_length =
+        std::max(max_value_length,
+                 static_cast<std::uint32_t>(entry.prefix.size() +
+                                            entry.suffix.size()));
+  }
+
+  clang::HMapHeader header = {};
+  header.Magic = clang::HMAP_HeaderMagicNumber;
+  header.Version = clang::HMAP_HeaderVersion;
+  header.Reserved = 0U;
+  header.StringsOffset = static_cast<std::uint32_t>(
+      sizeof(header) + bucket_list.size() * sizeof(clang::HMapBucket));
+  header.NumEntries = static_cast<std::uint32_t>(entry_list.size());
+  header.NumBuckets = bucket_count;
+  header.MaxValueLength = max_value_length;
+
+  std::string buffer(header.StringsOffset, '\0');
+  std::memcpy(&buffer[0], &header, sizeof(header));
+  std::memcpy(&buffer[sizeof(header)], bucket_list.data(),
+              bucket_list.size() * sizeof(clang::HMapBucket));
+
+  buffer.append(string_table);
+  return buffer;
+}
+}  // namespace
+
+/// Private class data
+struct HeaderMap::PrivateData final {
+  /// The path of the header map file
+  std::string path;
+
+  /// How many include names the map resolves
+  std::size_t entry_count{0U};
+};
+
+HeaderMap::HeaderMap(const StringList &header_path_list,
+                     const StringList &include_folder_list)
+    : d(new PrivateData) {
+  StringList folder_list;
+  for (const auto &include_folder : include_folder_list) {
+    std::error_code error;
+    auto folder_path = stdfs::absolute(include_folder, error);
+    if (error) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to acquire the absolute path for the following "
+                   "include folder: " +
+                       include_folder);
+    }
+
+    folder_list.push_back(folder_path.string());
+  }
+
+  // Map each header through the first folder containing it
+  std::unordered_map<std::string, std::size_t> key_folder_map;
+  std::vector<std::string> key_list;
+
+  for (const auto &header_path : header_path_list) {
+    for (std::size_t i = 0U; i < folder_list.size(); ++i) {
+      const auto &folder = folder_list[i];
+      if (header_path.size() <= folder.size() + 1U ||
+          header_path.compare(0U, folder.size(), folder) != 0 ||
+          header_path[folder.size()] != '/') {
+        continue;
+      }
+
+      auto key = header_path.substr(folder.size() + 1U);
+
+      auto insert_status = key_folder_map.insert({key, i});
+      if (insert_status.second) {
+        key_list.push_back(std::move(key));
+
+      } else if (i < insert_status.first->second) {
+        insert_status.first->second = i;
+      }
+    }
+  }
+
+  // The regular search must find the same file; a name that also exists in
+  // another folder (even a file that has been filtered out) may be reached
+  // through #include_next, and names that only differ in case would match
+  // the same entry
+  std::unordered_map<std::string, std::size_t> lowercase_key_count_map;
+  for (const auto &key : key_list) {
+    ++lowercase_key_count_map[toLowerCase(key)];
+  }
+
+  std::vector<HeaderMapEntry> entry_list;
+
+  for (const auto &key : key_list) {
+    if (lowercase_key_count_map[toLowerCase(key)] != 1U) {
+      continue;
+    }
+
+    auto folder_index = key_folder_map[key];
+
+    bool shadowed = false;
+    for (std::size_t i = 0U; i < folder_list.size() && !shadowed; ++i) {
+      std::error_code error;
+      shadowed = i != folder_index &&
+                 stdfs::exists(stdfs::path(folder_list[i]) / key, error);
+    }
+
+    if (shadowed) {
+      continue;
+    }
+
+    HeaderMapEntry entry;
+    entry.key = key;
+    entry.prefix = folder_list[folder_index] + "/";
+    entry.suffix = key;
+
+    entry_list.push_back(std::move(entry));
+  }
+
+  d->entry_count = entry_list.size();
+
+  std::random_device random_device;
+  std::error_code error;
+  d->path = (stdfs::temp_directory_path(error) /
+             ("abigen-" + std::to_string(random_device()) + ".hmap"))
+                .string();
+
+  if (!error) {
+    std::ofstream header_map_file(
+        d->path, std::ios::out | std::ios::trunc | std::ios::binary);
+
+    header_map_file << serializeHeaderMap(entry_list);
+    if (!header_map_file) {
+      error = std::make_error_code(std::errc::io_error);
+    }
+  }
+
+  if (error) {
+    stdfs::remove(d->path, error);
+
+    throw Status(false, StatusCode::IOError,
+                 "Failed to write the header map: " + d->path);
+  }
+}
+
+HeaderMap::Status HeaderMap::create(HeaderMapRef &obj,
+                                    const StringList &header_path_list,
+                                    const StringList &include_folder_list) {
+  obj.reset();
+
+  try {
+    auto ptr = new HeaderMap(header_path_list, include_folder_list);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+HeaderMap::~HeaderMap() {
+  std::error_code error;
+  stdfs::remove(d->path, error);
+}
+
+const std::string &HeaderMap::path() const { return d->path; }
+
+std::size_t HeaderMap::entryCount() const { return d->entry_count; }
+
+std::string serializeResolvedHeaderMap(
+    const std::vector<std::pair<std::string, std::string>> &include_path_list,
+    std::size_t *entry_count) {
+  std::unordered_map<std::string, std::size_t> lowercase_key_count_map;
+  for (const auto &include_path : include_path_list) {
+    ++lowercase_key_count_map[toLowerCase(include_path.first)];
+  }
+
+  std::vector<HeaderMapEntry> entry_list;
+
+  for (const auto &include_path : include_path_list) {
+    if (lowercase_key_count_map[toLowerCase(include_path.first)] != 1U) {
+      continue;
+    }
+
+    stdfs::path path(include_path.second);
+
+    HeaderMapEntry entry;
+    entry.key = include_path.first;
+    entry.prefix = path.parent_path().string() + "/";
+    entry.suffix = path.filename().string();
+
+    entry_list.push_back(std::move(entry));
+  }
+
+  if (entry_count != nullptr) {
+    *entry_count = entry_list.size();
+  }
+
+  return serializeHeaderMap(entry_list);
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+class HeaderMap;
+
+/// A reference to a HeaderMap object
+using HeaderMapRef = std::shared_ptr<HeaderMap>;
+
+/// The HeaderMap writes a clang header map (.hmap) that resolves the headers
+/// found in the include folders with a single hash lookup, instead of
+/// probing every folder in turn. Each header is mapped through its path
+/// relative to the first folder containing it; headers that also exist in
+/// another folder, or whose names only differ in case, are left to the
+/// regular search, so that the map never changes the resolution. The file is
+/// written to a temporary folder, and removed when the object is destroyed
+class HeaderMap final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  HeaderMap(const StringList &header_path_list,
+            const StringList &include_folder_list);
+
+ public:
+  /// Status code, used with HeaderMap::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new HeaderMap object from the absolute paths of the headers
+  /// found inside the include folders, which must be listed in search order
+  static Status create(HeaderMapRef &obj, const StringList &header_path_list,
+                       const StringList &include_folder_list);
+
+  /// Destructor
+  ~HeaderMap();
+
+  /// Returns the path of the header map file
+  const std::string &path() const;
+
+  /// Returns the amount of include names that the map resolves
+  std::size_t entryCount() const;
+
+  /// Disable the copy constructor
+  HeaderMap(const HeaderMap &other) = delete;
+
+  /// Disable the assignment operator
+  HeaderMap &operator=(const HeaderMap &other) = delete;
+};
+
+/// Serializes a clang header map that resolves each include name to the
+/// absolute path paired with it. Lookups are case insensitive, so the names
+/// that only differ in case are left out. If passed, the entry count
+/// receives the amount of names that the map resolves
+std::string serializeResolvedHeaderMap(
+    const std::vector<std::pair<std::string, std::string>> &include_path_list,
+    std::size_t *entry_count = nullptr);
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_prefetch.h"
+#include "batched_file_io.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace {
+/// Files larger than this are not headers, and are not read ahead
+const std::uint64_t kMaxPrefetchFileSize = 16U * 1024U * 1024U;
+
+/// How many files each thread takes from the queue at once; the batch is
+/// submitted with a couple of system calls when io_uring is available
+const std::size_t kPrefetchBatchSize = 32U;
+
+/// Converts the status read by the BatchedFileReader to the one that the
+/// real file system would return
+VirtualFileStatus convertFileStatus(const BatchedFileStatus &status,
+                                    const std::string &path) {
+  auto type = llvm::sys::fs::file_type::type_unknown;
+
+  switch (status.mode & S_IFMT) {
+  case S_IFREG:
+    type = llvm::sys::fs::file_type::regular_file;
+    break;
+
+  case S_IFDIR:
+    type = llvm::sys::fs::file_type::directory_file;
+    break;
+
+  case S_IFLNK:
+    type = llvm::sys::fs::file_type::symlink_file;
+    break;
+
+  case S_IFBLK:
+    type = llvm::sys::fs::file_type::block_file;
+    break;
+
+  case S_IFCHR:
+    type = llvm::sys::fs::file_type::character_file;
+    break;
+
+  case S_IFIFO:
+    type = llvm::sys::fs::file_type::fifo_file;
+    break;
+
+  case S_IFSOCK:
+    type = llvm::sys::fs::file_type::socket_file;
+    break;
+  }
+
+  return VirtualFileStatus(
+      path, llvm::sys::fs::UniqueID(status.device, status.inode),
+      llvm::sys::toTimePoint(
+          static_cast<std::time_t>(status.modification_time_sec),
+          status.modification_time_nsec),
+      status.user_id, status.group_id, status.size, type,
+      static_cast<llvm::sys::fs::perms>(status.mode &
+                                        llvm::sys::fs::all_perms));
+}
+}  // namespace
+
+/// Private class data
+struct HeaderPrefetcher::PrivateData final {
+  /// If set, the status of each file is recorded here
+  FileSystemCacheRef file_system_cache;
+
+  /// The folders that are walked once the file list has been queued
+  StringList folder_list;
+
+  /// Set by the destructor; the pending files are skipped
+  std::atomic_bool stop{false};
+
+  /// Protects the members below
+  std::mutex queue_mutex;
+
+  /// Signaled when a file is queued, or when the folder walk is over
+  std::condition_variable queue_condition;
+
+  /// The files waiting to be read ahead
+  std::deque<std::string> file_queue;
+
+  /// The files that have been queued, so that each one is only read once
+  std::unordered_set<std::string> queued_file_set;
+
+  /// True once all the folders have been walked
+  bool walk_done{false};
+
+  /// The background tasks; they run at the lowest priority, so that they
+  /// only take the executor threads that nothing else needs
+  TaskGroup task_group;
+
+  /// Files that have been read ahead
+  std::atomic_size_t file_count{0U};
+
+  /// Bytes that have been read ahead
+  std::atomic<std::uint64_t> byte_count{0U};
+
+  /// Set when a thread submits its batches through io_uring
+  std::atomic_bool io_uring_used{false};
+
+  /// Queues the given file, unless it has already been queued
+  void queueFile(const std::string &path) {
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex);
+      if (!queued_file_set.insert(path).second) {
+        return;
+      }
+
+      file_queue.push_back(path);
+    }
+
+    queue_condition.notify_one();
+  }
+};
+
+HeaderPrefetcher::HeaderPrefetcher(const StringList &file_list,
+                                   const StringList &folder_list,
+                                   std::size_t thread_count,
+                                   FileSystemCacheRef file_system_cache)
+    : d(new PrivateData) {
+  d->file_system_cache = std::move(file_system_cache);
+  d->folder_list = folder_list;
+
+  for (const auto &path : file_list) {
+    d->queueFile(path);
+  }
+
+  thread_count = std::max<std::size_t>(thread_count, 1U);
+
+  d->task_group.run(
+      [this]() {
+        walkFolders();
+        prefetchThread();
+      },
+      TaskPriority::Low);
+
+  for (std::size_t i = 1U; i < thread_count; ++i) {
+    d->task_group.run([this]() { prefetchThread(); }, TaskPriority::Low);
+  }
+}
+
+HeaderPrefetcher::~HeaderPrefetcher() {
+  d->stop = true;
+
+  {
+    std::lock_guard<std::mutex> lock(d->queue_mutex);
+    d->file_queue.clear();
+  }
+
+  d->queue_condition.notify_all();
+  d->task_group.cancel();
+}
+
+void HeaderPrefetcher::prefetchThread() {
+  // The prefetch is only an optimization; without a reader, the pending
+  // files are skipped
+  BatchedFileReaderRef file_reader;
+  if (!BatchedFileReader::create(file_reader).succeeded()) {
+    d->stop = true;
+    d->queue_condition.notify_all();
+    return;
+  }
+
+  if (file_reader->usesIoUring()) {
+    d->io_uring_used = true;
+  }
+
+  StringList path_list;
+  std::vector<BatchedFileStatus> status_list;
+  std::vector<bool> opened_file_list;
+
+  while (true) {
+    path_list.clear();
+
+    {
+      std::unique_lock<std::mutex> lock(d->queue_mutex);
+      d->queue_condition.wait(lock, [&]() -> bool {
+        return d->stop || d->walk_done || !d->file_queue.empty();
+      });
+
+      if (d->stop || d->file_queue.empty()) {
+        break;
+      }
+
+      while (!d->file_queue.empty() && path_list.size() < kPrefetchBatchSize) {
+        path_list.push_back(std::move(d->file_queue.front()));
+        d->file_queue.pop_front();
+      }
+    }
+
+    file_reader->readAhead(status_list, opened_file_list, path_list,
+                           kMaxPrefetchFileSize);
+
+    for (std::size_t i = 0U; i < path_list.size(); ++i) {
+      const auto &status = status_list[i];
+
+      if (opened_file_list[i]) {
+        d->file_count++;
+        d->byte_count += status.size;
+      }
+
+      // The cache then answers the first stat() of each probe, without
+      // querying the file system again
+      if (!d->file_system_cache) {
+        continue;
+      }
+
+      if (status.error == 0) {
+        d->file_system_cache->storeStatus(
+            convertFileStatus(status, path_list[i]), path_list[i]);
+      } else {
+        d->file_system_cache->storeStatus(
+            std::error_code(status.error, std::generic_category()),
+            path_list[i]);
+      }
+    }
+  }
+}
+
+void HeaderPrefetcher::walkFolders() {
+  for (const auto &folder : d->folder_list) {
+    std::error_code error;
+
+    for (auto it = stdfs::recursive_directory_iterator(folder, error);
+         !error && !d->stop && it != stdfs::recursive_directory_iterator();
+         it.increment(error)) {
+      std::error_code file_error;
+      if (stdfs::is_regular_file(it->path(), file_error)) {
+        d->queueFile(it->path().string());
+      }
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->queue_mutex);
+    d->walk_done = true;
+  }
+
+  d->queue_condition.notify_all();
+}
+
+void HeaderPrefetcher::wait() { d->task_group.wait(); }
+
+std::size_t HeaderPrefetcher::fileCount() const { return d->file_count; }
+
+std::uint64_t HeaderPrefetcher::byteCount() const { return d->byte_count; }
+
+bool HeaderPrefetcher::usesIoUring() const { return d->io_uring_used; }
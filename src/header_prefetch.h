@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "file_system_cache.h"
+#include "types.h"
+
+#include <cstdint>
+#include <memory>
+
+/// The HeaderPrefetcher reads ahead the candidate headers and the system
+/// headers of the profile on low priority executor tasks, so that the first
+/// probes of a cold run do not wait on the disk for each #include. Each task
+/// takes the queued files in batches, which are submitted through io_uring
+/// when the kernel supports it (see BatchedFileReader). On Linux the kernel
+/// is asked to read the files into the page cache; other platforms read them
+/// once. When a file system cache is passed, the status of each file is
+/// recorded in it as well
+class HeaderPrefetcher final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Reads ahead the queued files; runs on each background task
+  void prefetchThread();
+
+  /// Enumerates the files inside the folders, queueing them; runs on the
+  /// first background task
+  void walkFolders();
+
+ public:
+  /// Constructor; starts reading ahead the given files, followed by all the
+  /// files found inside the given folders. Returns immediately
+  HeaderPrefetcher(const StringList &file_list, const StringList &folder_list,
+                   std::size_t thread_count,
+                   FileSystemCacheRef file_system_cache = FileSystemCacheRef());
+
+  /// Destructor; the files that have not been read yet are skipped
+  ~HeaderPrefetcher();
+
+  /// Waits until all the files have been read ahead
+  void wait();
+
+  /// Returns the amount of files that have been read ahead
+  std::size_t fileCount() const;
+
+  /// Returns the size of the files that have been read ahead, in bytes
+  std::uint64_t byteCount() const;
+
+  /// Returns true if the files have been read ahead through io_uring
+  bool usesIoUring() const;
+
+  /// Disable the copy constructor
+  HeaderPrefetcher(const HeaderPrefetcher &other) = delete;
+
+  /// Disable the assignment operator
+  HeaderPrefetcher &operator=(const HeaderPrefetcher &other) = delete;
+};
@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_scanner.h"
+#include "output_file.h"
+#include "profile_pack.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+
+#include <clang/Basic/LangOptions.h>
+#include <clang/Lex/Lexer.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+/// The first line of the scan cache
+const std::string kHeaderScanCacheHeader = "abigen-header-scans 2";
+
+/// The state of the include guard detection
+enum class IncludeGuardState {
+  /// Nothing but comments has been found so far
+  Start,
+
+  /// The file starts with #ifndef, and the #define has not been found yet
+  ExpectingDefine,
+
+  /// Inside the guarded conditional
+  Open,
+
+  /// The guarded conditional has been closed at the end of the file
+  Closed,
+
+  /// The file is not wrapped in an include guard
+  Invalid
+};
+
+/// Parses the header name of an include directive, starting right after its
+/// keyword; returns false when the name is computed with a macro
+bool parseIncludeDirective(IncludeDirective &include_directive,
+                           const char *buffer, const char *buffer_end) {
+  while (buffer < buffer_end && (*buffer == ' ' || *buffer == '\t')) {
+    ++buffer;
+  }
+
+  if (buffer >= buffer_end) {
+    return false;
+  }
+
+  char terminator;
+  if (*buffer == '<') {
+    terminator = '>';
+    include_directive.is_angled = true;
+
+  } else if (*buffer == '"') {
+    terminator = '"';
+    include_directive.is_angled = false;
+
+  } else {
+    return false;
+  }
+
+  auto header_start = ++buffer;
+  while (buffer < buffer_end && *buffer != terminator && *buffer != '\n') {
+    ++buffer;
+  }
+
+  if (buffer >= buffer_end || *buffer != terminator ||
+      buffer == header_start) {
+    return false;
+  }
+
+  include_directive.header.assign(header_start, buffer);
+  return true;
+}
+
+/// Scans the given buffer; see scanHeaderFile()
+void scanHeaderBuffer(HeaderScan &header_scan, const char *buffer_start,
+                      const char *buffer_end) {
+  header_scan = {};
+
+  // Keywords that can't end the return type of a declaration, and the ones
+  // that look like a function name when followed by a parenthesis
+  static const std::unordered_set<std::string> kStatementKeywordSet = {
+      "return", "else", "case", "goto", "throw", "new", "delete", "do"};
+
+  static const std::unordered_set<std::string> kOperatorKeywordSet = {
+      "if",       "while",         "for",            "switch",
+      "sizeof",   "alignof",       "_Alignof",       "alignas",
+      "_Alignas", "decltype",      "typeof",         "__typeof__",
+      "noexcept", "static_assert", "_Static_assert", "__attribute__",
+      "asm",      "__asm__",       "__declspec",     "defined"};
+
+  clang::LangOptions language_options;
+  language_options.CPlusPlus = 1;
+
+  // The raw lexer skips the comments and merges the continued lines for us,
+  // without building a preprocessor
+  clang::Lexer lexer(clang::SourceLocation(), language_options, buffer_start,
+                     buffer_start, buffer_end);
+
+  bool inside_directive = false;
+  std::size_t directive_token_index = 0U;
+  std::string directive_keyword;
+
+  auto guard_state = IncludeGuardState::Start;
+  std::string include_guard;
+  std::size_t conditional_depth = 0U;
+
+  bool previous_ends_type = false;
+  bool candidate_name = false;
+  bool after_parameters = false;
+  std::size_t parenthesis_depth = 0U;
+  std::string last_identifier;
+  std::string function_name;
+
+  // The declared names are tracked on their own nesting levels, since the
+  // parameter lists skipped above may never be entered
+  std::size_t brace_depth = 0U;
+  std::size_t declarator_depth = 0U;
+  bool previous_star = false;
+
+  std::string tag_keyword;
+  std::string tag_name;
+  bool inside_tag_head = false;
+  bool after_tag_colon = false;
+
+  std::size_t enum_body_depth = 0U;
+  bool expecting_enumerator = false;
+
+  bool inside_typedef = false;
+  bool typedef_name_locked = false;
+  std::size_t typedef_brace_depth = 0U;
+  std::string typedef_name;
+
+  auto L_declare = [&](const std::string &name) {
+    if (!name.empty()) {
+      header_scan.declared_identifier_list.push_back(name);
+    }
+  };
+
+  clang::Token token;
+  while (true) {
+    lexer.LexFromRawLexer(token);
+    if (token.is(clang::tok::eof)) {
+      break;
+    }
+
+    // Directives end with the line; anything following the #endif of the
+    // include guard means that it does not wrap the whole file
+    if (token.isAtStartOfLine()) {
+      inside_directive = token.is(clang::tok::hash);
+      directive_token_index = 0U;
+      directive_keyword.clear();
+
+      if (guard_state == IncludeGuardState::Closed ||
+          (!inside_directive && guard_state != IncludeGuardState::Open)) {
+        guard_state = IncludeGuardState::Invalid;
+      }
+    }
+
+    if (inside_directive) {
+      auto token_index = directive_token_index++;
+      if (!token.is(clang::tok::raw_identifier)) {
+        continue;
+      }
+
+      auto identifier = token.getRawIdentifier().str();
+
+      if (token_index == 1U) {
+        directive_keyword = identifier;
+
+        if (identifier == "include" || identifier == "include_next" ||
+            identifier == "import") {
+          IncludeDirective include_directive;
+          if (parseIncludeDirective(include_directive,
+                                    lexer.getBufferLocation(), buffer_end)) {
+            header_scan.include_directive_list.push_back(
+                std::move(include_directive));
+          }
+
+        } else if (identifier == "if" || identifier == "ifdef" ||
+                   identifier == "ifndef") {
+          ++conditional_depth;
+
+        } else if (identifier == "endif" && conditional_depth != 0U) {
+          if (--conditional_depth == 0U &&
+              guard_state == IncludeGuardState::Open) {
+            guard_state = IncludeGuardState::Closed;
+          }
+
+        } else if ((identifier == "else" || identifier == "elif") &&
+                   conditional_depth == 1U &&
+                   guard_state == IncludeGuardState::Open) {
+          guard_state = IncludeGuardState::Invalid;
+        }
+
+        if ((guard_state == IncludeGuardState::Start &&
+             identifier != "ifndef") ||
+            (guard_state == IncludeGuardState::ExpectingDefine &&
+             identifier != "define")) {
+          guard_state = IncludeGuardState::Invalid;
+        }
+
+      } else if (token_index == 2U) {
+        if (directive_keyword == "ifndef" &&
+            guard_state == IncludeGuardState::Start) {
+          include_guard = identifier;
+          guard_state = IncludeGuardState::ExpectingDefine;
+
+        } else if (directive_keyword == "define" &&
+                   guard_state == IncludeGuardState::ExpectingDefine) {
+          guard_state = (identifier == include_guard)
+                            ? IncludeGuardState::Open
+                            : IncludeGuardState::Invalid;
+
+        } else if (directive_keyword == "pragma" && identifier == "once") {
+          header_scan.pragma_once = true;
+        }
+
+        if (directive_keyword == "define" && identifier != include_guard) {
+          L_declare(identifier);
+        }
+      }
+
+      continue;
+    }
+
+    if (parenthesis_depth != 0U) {
+      // Function pointer typedefs name the pointer inside the first group
+      if (inside_typedef && !typedef_name_locked && parenthesis_depth == 1U &&
+          previous_star && token.is(clang::tok::raw_identifier)) {
+        typedef_name = token.getRawIdentifier().str();
+        typedef_name_locked = true;
+      }
+
+      previous_star = token.isOneOf(clang::tok::star, clang::tok::caret);
+
+      if (token.is(clang::tok::l_paren)) {
+        ++parenthesis_depth;
+
+      } else if (token.is(clang::tok::r_paren) && --parenthesis_depth == 0U) {
+        after_parameters = true;
+      }
+
+      continue;
+    }
+
+    if (after_parameters) {
+      after_parameters = false;
+
+      if (token.isOneOf(clang::tok::semi, clang::tok::l_brace,
+                        clang::tok::raw_identifier)) {
+        header_scan.function_name_list.push_back(function_name);
+      }
+    }
+
+    if (candidate_name && token.is(clang::tok::l_paren)) {
+      candidate_name = false;
+      previous_ends_type = false;
+      parenthesis_depth = 1U;
+      function_name = last_identifier;
+      continue;
+    }
+
+    if (token.is(clang::tok::raw_identifier)) {
+      auto identifier = token.getRawIdentifier().str();
+
+      if (expecting_enumerator) {
+        expecting_enumerator = false;
+        L_declare(identifier);
+      }
+
+      if (identifier == "struct" || identifier == "union" ||
+          identifier == "class" || identifier == "enum") {
+        // Scoped enums are introduced by "enum class" or "enum struct"
+        if (!inside_tag_head || tag_keyword != "enum" || !tag_name.empty()) {
+          tag_keyword = identifier;
+          tag_name.clear();
+          inside_tag_head = true;
+          after_tag_colon = false;
+        }
+
+      } else if (inside_tag_head && !after_tag_colon &&
+                 declarator_depth == 0U &&
+                 kOperatorKeywordSet.count(identifier) == 0U) {
+        // The last name before the body skips the leading attribute macros
+        tag_name = identifier;
+      }
+
+      if (identifier == "typedef" && !inside_typedef) {
+        inside_typedef = true;
+        typedef_name_locked = false;
+        typedef_brace_depth = brace_depth;
+        typedef_name.clear();
+
+      } else if (inside_typedef && !typedef_name_locked &&
+                 brace_depth == typedef_brace_depth) {
+        if (declarator_depth == 0U) {
+          typedef_name = identifier;
+
+        } else if (declarator_depth == 1U && previous_star) {
+          typedef_name = identifier;
+          typedef_name_locked = true;
+        }
+      }
+
+    } else if (token.is(clang::tok::l_brace)) {
+      if (inside_tag_head) {
+        L_declare(tag_name);
+
+        if (tag_keyword == "enum") {
+          enum_body_depth = brace_depth + 1U;
+          expecting_enumerator = true;
+        }
+      }
+
+      inside_tag_head = false;
+      ++brace_depth;
+
+    } else if (token.is(clang::tok::r_brace)) {
+      if (enum_body_depth != 0U && brace_depth == enum_body_depth) {
+        enum_body_depth = 0U;
+        expecting_enumerator = false;
+      }
+
+      if (brace_depth != 0U) {
+        --brace_depth;
+      }
+
+    } else if (token.is(clang::tok::comma)) {
+      expecting_enumerator =
+          (enum_body_depth != 0U && brace_depth == enum_body_depth);
+
+    } else if (token.is(clang::tok::colon)) {
+      after_tag_colon = true;
+
+    } else if (token.is(clang::tok::semi)) {
+      if (inside_typedef && brace_depth == typedef_brace_depth) {
+        inside_typedef = false;
+        L_declare(typedef_name);
+      }
+
+      inside_tag_head = false;
+      declarator_depth = 0U;
+
+    } else if (token.is(clang::tok::l_paren)) {
+      ++declarator_depth;
+
+    } else if (token.is(clang::tok::r_paren) && declarator_depth != 0U) {
+      --declarator_depth;
+
+    } else if (declarator_depth == 0U && !token.is(clang::tok::coloncolon)) {
+      // Template arguments, initializers and pointers: not a tag definition
+      inside_tag_head = false;
+    }
+
+    previous_star = token.isOneOf(clang::tok::star, clang::tok::caret);
+
+    if (token.is(clang::tok::raw_identifier)) {
+      last_identifier = token.getRawIdentifier().str();
+
+      auto ends_type = kStatementKeywordSet.count(last_identifier) == 0U &&
+                       kOperatorKeywordSet.count(last_identifier) == 0U;
+
+      candidate_name = previous_ends_type && ends_type;
+      previous_ends_type = ends_type;
+
+    } else {
+      candidate_name = false;
+      previous_ends_type = token.isOneOf(clang::tok::star, clang::tok::amp,
+                                         clang::tok::ampamp,
+                                         clang::tok::greater);
+    }
+  }
+
+  if (guard_state == IncludeGuardState::Closed) {
+    header_scan.include_guard = std::move(include_guard);
+  }
+}
+
+/// Reads the next scan from the given cache file; returns false at the end
+/// of the file or if the entry is malformed, in which case the file is no
+/// longer readable
+bool readCachedScan(ContentHash &hash, HeaderScan &header_scan,
+                    std::istream &cache_file) {
+  std::string line;
+  if (!std::getline(cache_file, line)) {
+    return false;
+  }
+
+  std::istringstream line_stream(line);
+
+  std::string tag;
+  std::string hash_string;
+  std::size_t include_count = 0U;
+  std::size_t function_count = 0U;
+  int pragma_once = 0;
+  std::size_t declared_count = 0U;
+  line_stream >> tag >> hash_string >> include_count >> function_count >>
+      pragma_once >> declared_count;
+
+  if (!line_stream || tag != "scan" ||
+      !contentHashFromString(hash, hash_string)) {
+    cache_file.setstate(std::ios::failbit);
+    return false;
+  }
+
+  header_scan = {};
+  header_scan.pragma_once = (pragma_once != 0);
+
+  auto L_readValue = [&](std::string &value, const std::string &value_tag) {
+    if (!std::getline(cache_file, line) ||
+        line.compare(0U, value_tag.size(), value_tag) != 0) {
+      cache_file.setstate(std::ios::failbit);
+      return false;
+    }
+
+    value = line.substr(value_tag.size());
+    return true;
+  };
+
+  if (!L_readValue(header_scan.include_guard, "guard ")) {
+    return false;
+  }
+
+  for (std::size_t i = 0U; i < include_count; ++i) {
+    std::string value;
+    if (!L_readValue(value, "include ") || value.size() < 3U ||
+        (value[0] != 'a' && value[0] != 'q') || value[1] != ' ') {
+      cache_file.setstate(std::ios::failbit);
+      return false;
+    }
+
+    IncludeDirective include_directive;
+    include_directive.is_angled = (value[0] == 'a');
+    include_directive.header = value.substr(2U);
+
+    header_scan.include_directive_list.push_back(std::move(include_directive));
+  }
+
+  for (std::size_t i = 0U; i < function_count; ++i) {
+    std::string function_name;
+    if (!L_readValue(function_name, "function ")) {
+      return false;
+    }
+
+    header_scan.function_name_list.push_back(std::move(function_name));
+  }
+
+  for (std::size_t i = 0U; i < declared_count; ++i) {
+    std::string identifier;
+    if (!L_readValue(identifier, "declares ")) {
+      return false;
+    }
+
+    header_scan.declared_identifier_list.push_back(std::move(identifier));
+  }
+
+  return true;
+}
+
+/// Reads the given header; the files located inside a header archive are
+/// referenced in place, without a copy
+llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> readHeaderFile(
+    const std::string &path) {
+  auto buffer_or_error = llvm::MemoryBuffer::getFile(path);
+  if (buffer_or_error) {
+    return buffer_or_error;
+  }
+
+  llvm::StringRef contents;
+  if (!readHeaderArchiveFile(contents, path)) {
+    return buffer_or_error;
+  }
+
+  return llvm::MemoryBuffer::getMemBuffer(contents, path);
+}
+}  // namespace
+
+bool scanHeaderFile(HeaderScan &header_scan, const std::string &path) {
+  header_scan = {};
+
+  auto buffer_or_error = readHeaderFile(path);
+  if (!buffer_or_error) {
+    return false;
+  }
+
+  const auto &buffer = *buffer_or_error.get();
+  scanHeaderBuffer(header_scan, buffer.getBufferStart(),
+                   buffer.getBufferEnd());
+
+  return true;
+}
+
+/// Private class data
+struct HeaderScanner::PrivateData final {
+  /// Used to fingerprint the files, when available
+  FileFingerprintIndexRef fingerprint_index;
+
+  /// Where the scans are persisted; empty if they are kept in memory
+  std::string cache_path;
+
+  /// Protects the other members
+  std::mutex mutex;
+
+  /// The known scans, keyed on the content hash of the file
+  std::unordered_map<ContentHash, HeaderScanRef> scan_map;
+
+  /// The content hashes of the files scanned during this run
+  std::unordered_set<ContentHash> used_hash_set;
+
+  /// The scan of each file requested during this run, keyed on the path;
+  /// unreadable files map to nullptr
+  std::unordered_map<std::string, HeaderScanRef> path_scan_map;
+
+  /// How many files have been read and scanned
+  std::atomic_size_t scanned_file_count{0U};
+
+  /// How many scans have been found in the persisted cache
+  std::atomic_size_t reused_scan_count{0U};
+};
+
+HeaderScanner::HeaderScanner(FileFingerprintIndexRef fingerprint_index,
+                             const std::string &cache_path)
+    : d(new PrivateData) {
+  d->fingerprint_index = std::move(fingerprint_index);
+  d->cache_path = cache_path;
+
+  if (cache_path.empty()) {
+    return;
+  }
+
+  // A missing or malformed cache only means that every file is scanned
+  std::ifstream cache_file(cache_path);
+
+  std::string line;
+  if (!cache_file || !std::getline(cache_file, line) ||
+      line != kHeaderScanCacheHeader) {
+    return;
+  }
+
+  ContentHash hash;
+  HeaderScan header_scan;
+  while (readCachedScan(hash, header_scan, cache_file)) {
+    d->scan_map[hash] = std::make_shared<HeaderScan>(std::move(header_scan));
+  }
+
+  if (!cache_file.eof()) {
+    d->scan_map.clear();
+  }
+}
+
+HeaderScanner::Status HeaderScanner::create(
+    HeaderScannerRef &obj, FileFingerprintIndexRef fingerprint_index,
+    const std::string &cache_path) {
+  obj.reset();
+
+  try {
+    auto ptr = new HeaderScanner(std::move(fingerprint_index), cache_path);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+HeaderScanner::~HeaderScanner() {}
+
+HeaderScanRef HeaderScanner::scan(const std::string &path) {
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    auto it = d->path_scan_map.find(path);
+    if (it != d->path_scan_map.end()) {
+      return it->second;
+    }
+  }
+
+  auto L_storeScan = [&](ContentHash hash,
+                         HeaderScanRef header_scan) -> HeaderScanRef {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    if (header_scan) {
+      d->scan_map[hash] = header_scan;
+      d->used_hash_set.insert(hash);
+    }
+
+    // Another thread may have scanned the same file in the meantime; both
+    // scans are identical
+    return d->path_scan_map.insert({path, std::move(header_scan)})
+        .first->second;
+  };
+
+  // With a fingerprint index, unchanged files are not even read
+  ContentHash hash{0U};
+  if (d->fingerprint_index) {
+    if (!d->fingerprint_index->fingerprint(hash, path)) {
+      return L_storeScan(hash, nullptr);
+    }
+
+    HeaderScanRef cached_scan;
+
+    {
+      std::lock_guard<std::mutex> lock(d->mutex);
+
+      auto it = d->scan_map.find(hash);
+      if (it != d->scan_map.end()) {
+        cached_scan = it->second;
+      }
+    }
+
+    if (cached_scan) {
+      d->reused_scan_count++;
+      return L_storeScan(hash, std::move(cached_scan));
+    }
+  }
+
+  auto buffer_or_error = readHeaderFile(path);
+  if (!buffer_or_error) {
+    return L_storeScan(hash, nullptr);
+  }
+
+  const auto &buffer = *buffer_or_error.get();
+
+  // Without a fingerprint index, the buffer is hashed instead; this is still
+  // much cheaper than lexing it
+  if (!d->fingerprint_index) {
+    hash = hashBuffer(buffer.getBufferStart(), buffer.getBufferSize());
+
+    HeaderScanRef cached_scan;
+
+    {
+      std::lock_guard<std::mutex> lock(d->mutex);
+
+      auto it = d->scan_map.find(hash);
+      if (it != d->scan_map.end()) {
+        cached_scan = it->second;
+      }
+    }
+
+    if (cached_scan) {
+      d->reused_scan_count++;
+      return L_storeScan(hash, std::move(cached_scan));
+    }
+  }
+
+  auto header_scan = std::make_shared<HeaderScan>();
+  scanHeaderBuffer(*header_scan, buffer.getBufferStart(),
+                   buffer.getBufferEnd());
+
+  d->scanned_file_count++;
+  return L_storeScan(hash, std::move(header_scan));
+}
+
+void HeaderScanner::scanFiles(const StringList &path_list,
+                              std::size_t thread_count) {
+  runParallelFor(path_list.size(), thread_count, TaskPriority::Normal,
+                 [&](std::size_t path_index) { scan(path_list[path_index]); });
+}
+
+bool HeaderScanner::save() {
+  if (d->cache_path.empty()) {
+    return true;
+  }
+
+  // Only the scans of the files seen during this run are kept, so that the
+  // cache does not grow with each version of the headers
+  std::vector<std::pair<ContentHash, HeaderScanRef>> scan_list;
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    for (auto hash : d->used_hash_set) {
+      scan_list.push_back({hash, d->scan_map.at(hash)});
+    }
+  }
+
+  std::sort(scan_list.begin(), scan_list.end(),
+            [](const std::pair<ContentHash, HeaderScanRef> &lhs,
+               const std::pair<ContentHash, HeaderScanRef> &rhs) -> bool {
+              return lhs.first < rhs.first;
+            });
+
+  std::stringstream buffer;
+  buffer << kHeaderScanCacheHeader << "\n";
+
+  for (const auto &p : scan_list) {
+    const auto &header_scan = *p.second;
+
+    buffer << "scan " << contentHashToString(p.first) << " "
+           << header_scan.include_directive_list.size() << " "
+           << header_scan.function_name_list.size() << " "
+           << (header_scan.pragma_once ? 1 : 0) << " "
+           << header_scan.declared_identifier_list.size() << "\n";
+
+    buffer << "guard " << header_scan.include_guard << "\n";
+
+    for (const auto &include_directive : header_scan.include_directive_list) {
+      buffer << "include " << (include_directive.is_angled ? "a " : "q ")
+             << include_directive.header << "\n";
+    }
+
+    for (const auto &function_name : header_scan.function_name_list) {
+      buffer << "function " << function_name << "\n";
+    }
+
+    for (const auto &identifier : header_scan.declared_identifier_list) {
+      buffer << "declares " << identifier << "\n";
+    }
+  }
+
+  std::error_code error;
+  stdfs::create_directories(stdfs::path(d->cache_path).parent_path(), error);
+
+  return writeFileAtomically(d->cache_path, buffer.str());
+}
+
+std::size_t HeaderScanner::scannedFileCount() const {
+  return d->scanned_file_count;
+}
+
+std::size_t HeaderScanner::reusedScanCount() const {
+  return d->reused_scan_count;
+}
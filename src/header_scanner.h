@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "file_fingerprints.h"
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+/// An #include directive found while scanning a header
+struct IncludeDirective final {
+  /// The header name, as written between the delimiters
+  std::string header;
+
+  /// True for <header> includes, false for "header" ones
+  bool is_angled{false};
+};
+
+/// A list of include directives
+using IncludeDirectiveList = std::vector<IncludeDirective>;
+
+/// What a lexer-only scan of a header found. Conditionals are not
+/// evaluated, and includes using macros are ignored
+struct HeaderScan final {
+  /// The #include, #include_next and #import directives, in order
+  IncludeDirectiveList include_directive_list;
+
+  /// The macro of the include guard wrapping the whole file, if any
+  std::string include_guard;
+
+  /// True if the header contains #pragma once
+  bool pragma_once{false};
+
+  /// The names of the functions the header appears to declare, in order;
+  /// names following a type and followed by a parameter list, and then by
+  /// a semicolon, a body or an attribute. Overloads are listed once per
+  /// declaration
+  StringList function_name_list;
+
+  /// The other names the header appears to declare, in order: the macros it
+  /// defines (except the include guard), the struct, union, class and enum
+  /// tags followed by a body, the typedef names and the enumerators
+  StringList declared_identifier_list;
+};
+
+/// A reference to an immutable HeaderScan object
+using HeaderScanRef = std::shared_ptr<const HeaderScan>;
+
+/// Scans the given file with the raw clang lexer, without preprocessing it;
+/// returns false if the file can't be read
+bool scanHeaderFile(HeaderScan &header_scan, const std::string &path);
+
+class HeaderScanner;
+
+/// A reference to a HeaderScanner object
+using HeaderScannerRef = std::shared_ptr<HeaderScanner>;
+
+/// The HeaderScanner shares the result of scanHeaderFile() between the
+/// strategies that need the include directives, include guards or function
+/// names of the candidate headers. Results are keyed on the content hash
+/// of each file, taken from the fingerprint index when one is passed, and
+/// can be persisted so that the following runs only scan the files that
+/// have changed. Within a run, each file is scanned once
+class HeaderScanner final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  HeaderScanner(FileFingerprintIndexRef fingerprint_index,
+                const std::string &cache_path);
+
+ public:
+  /// Status code, used with HeaderScanner::Status
+  enum class StatusCode { MemoryAllocationFailure, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new HeaderScanner object, loading the given cache if it
+  /// exists and is valid. An empty path keeps the results in memory
+  static Status create(HeaderScannerRef &obj,
+                       FileFingerprintIndexRef fingerprint_index = nullptr,
+                       const std::string &cache_path = std::string());
+
+  /// Destructor
+  ~HeaderScanner();
+
+  /// Returns the scan of the given file, or nullptr if it can't be read.
+  /// This method is thread safe
+  HeaderScanRef scan(const std::string &path);
+
+  /// Scans the given files ahead of time, using the given amount of threads
+  void scanFiles(const StringList &path_list, std::size_t thread_count);
+
+  /// Saves the results of the files scanned during this run, replacing the
+  /// previous cache atomically. Does nothing when the cache is not persisted
+  bool save();
+
+  /// Returns how many files have been read and scanned
+  std::size_t scannedFileCount() const;
+
+  /// Returns how many scans have been found in the persisted cache
+  std::size_t reusedScanCount() const;
+
+  /// Disable the copy constructor
+  HeaderScanner(const HeaderScanner &other) = delete;
+
+  /// Disable the assignment operator
+  HeaderScanner &operator=(const HeaderScanner &other) = delete;
+};
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_snapshot.h"
+#include "content_hash.h"
+#include "output_file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+namespace {
+/// The first line of each snapshot
+const std::string kHeaderSnapshotHeader = "abigen-header-snapshot 1";
+
+/// Folders modified within this interval are listed again on the next run;
+/// file system timestamps are coarse enough for an entry added right after
+/// the listing to keep the same modification time
+const auto kRacyModificationInterval = std::chrono::seconds(2);
+}  // namespace
+
+std::int64_t getFolderModificationTime(const stdfs::path &path) {
+  std::error_code error;
+  auto modification_time = stdfs::last_write_time(path, error);
+  if (error) {
+    return 0;
+  }
+
+  auto current_time = stdfs::file_time_type::clock::now();
+  if (current_time - modification_time < kRacyModificationInterval) {
+    return 0;
+  }
+
+  return static_cast<std::int64_t>(
+      modification_time.time_since_epoch().count());
+}
+
+std::string getHeaderSnapshotPath(const std::string &cache_directory,
+                                  const std::string &root_path) {
+  auto snapshot_name = contentHashToString(
+      updateContentHash(kInitialContentHash, root_path));
+
+  return (stdfs::path(cache_directory) / "header_snapshots" / snapshot_name)
+      .string();
+}
+
+bool readHeaderSnapshot(HeaderSnapshot &snapshot, const std::string &path,
+                        const std::string &root_path) {
+  snapshot = {};
+
+  std::ifstream snapshot_file(path);
+  if (!snapshot_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(snapshot_file, line) || line != kHeaderSnapshotHeader) {
+    return false;
+  }
+
+  // Different folders may still share the same snapshot name
+  const std::string root_tag = "root ";
+  if (!std::getline(snapshot_file, line) ||
+      line.compare(0U, root_tag.size(), root_tag) != 0 ||
+      line.substr(root_tag.size()) != root_path) {
+    return false;
+  }
+
+  snapshot.root_path = root_path;
+
+  const std::string folder_tag = "folder ";
+  const std::string child_tag = "child ";
+  const std::string header_tag = "header ";
+
+  HeaderFolderSnapshot *current_folder = nullptr;
+
+  while (std::getline(snapshot_file, line)) {
+    if (line.compare(0U, folder_tag.size(), folder_tag) == 0) {
+      auto separator = line.find(' ', folder_tag.size());
+      if (separator == std::string::npos) {
+        return false;
+      }
+
+      HeaderFolderSnapshot folder_snapshot;
+
+      try {
+        folder_snapshot.modification_time = std::stoll(
+            line.substr(folder_tag.size(), separator - folder_tag.size()));
+
+      } catch (...) {
+        return false;
+      }
+
+      auto insert_status = snapshot.folder_map.insert(
+          {line.substr(separator + 1U), std::move(folder_snapshot)});
+
+      if (!insert_status.second) {
+        return false;
+      }
+
+      current_folder = &insert_status.first->second;
+      continue;
+    }
+
+    if (current_folder == nullptr) {
+      return false;
+    }
+
+    if (line.compare(0U, child_tag.size(), child_tag) == 0) {
+      current_folder->entry_list.push_back(
+          {true, line.substr(child_tag.size())});
+
+    } else if (line.compare(0U, header_tag.size(), header_tag) == 0) {
+      current_folder->entry_list.push_back(
+          {false, line.substr(header_tag.size())});
+
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool writeHeaderSnapshot(const HeaderSnapshot &snapshot,
+                         const std::string &path) {
+  std::stringstream buffer;
+  buffer << kHeaderSnapshotHeader << "\n";
+  buffer << "root " << snapshot.root_path << "\n";
+
+  // Folders whose listing is not trusted are still saved, so that the next
+  // run can tell which headers have been added or removed
+  for (const auto &p : snapshot.folder_map) {
+    auto L_hasLineBreak = [](const std::string &name) -> bool {
+      return name.find('\n') != std::string::npos;
+    };
+
+    // Names containing a line break can't be saved; the folder is listed
+    // again on the next run
+    if (L_hasLineBreak(p.first) ||
+        std::any_of(p.second.entry_list.begin(), p.second.entry_list.end(),
+                    [&](const std::pair<bool, std::string> &entry) -> bool {
+                      return L_hasLineBreak(entry.second);
+                    })) {
+      continue;
+    }
+
+    buffer << "folder " << p.second.modification_time << " " << p.first
+           << "\n";
+
+    for (const auto &entry : p.second.entry_list) {
+      buffer << (entry.first ? "child " : "header ") << entry.second << "\n";
+    }
+  }
+
+  std::error_code error;
+  auto snapshot_path = stdfs::path(path);
+  stdfs::create_directories(snapshot_path.parent_path(), error);
+  if (error) {
+    return false;
+  }
+
+  return writeFileAtomically(snapshot_path, buffer.str());
+}
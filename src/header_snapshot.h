@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "std_filesystem.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// The entries of a folder, as they were found by the last enumeration
+struct HeaderFolderSnapshot final {
+  /// The modification time of the folder when it was listed; zero if the
+  /// folder changed too recently for its listing to be trusted
+  std::int64_t modification_time{0};
+
+  /// The child folders and headers in listing order; the first member is
+  /// true for the child folders. Entries are recorded before the header
+  /// filter is applied, so the snapshot survives filter changes
+  std::vector<std::pair<bool, std::string>> entry_list;
+};
+
+/// The folders found below one of the header folders, keyed on their path
+/// relative to it; the header folder itself uses an empty path
+struct HeaderSnapshot final {
+  /// The absolute path of the header folder
+  std::string root_path;
+
+  /// The folder snapshots
+  std::map<std::string, HeaderFolderSnapshot> folder_map;
+};
+
+/// Returns the modification time of the given folder, or zero if it can't
+/// be trusted: either because it can't be read, or because the folder has
+/// been modified so recently that a change could still go unnoticed
+std::int64_t getFolderModificationTime(const stdfs::path &path);
+
+/// Returns the path of the snapshot used for the given header folder
+std::string getHeaderSnapshotPath(const std::string &cache_directory,
+                                  const std::string &root_path);
+
+/// Reads the given snapshot; returns false if it is missing, malformed, or
+/// if it belongs to a different header folder
+bool readHeaderSnapshot(HeaderSnapshot &snapshot, const std::string &path,
+                        const std::string &root_path);
+
+/// Saves the given snapshot, replacing the previous one atomically
+bool writeHeaderSnapshot(const HeaderSnapshot &snapshot,
+                         const std::string &path);
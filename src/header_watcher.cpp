@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "header_watcher.h"
+#include "std_filesystem.h"
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// How long the folders have to be quiet before the changes are reported
+const auto kQuietPeriod = std::chrono::milliseconds(300);
+
+/// How often the stop flag is checked while waiting for changes
+const auto kStopCheckInterval = std::chrono::milliseconds(500);
+
+#if !defined(__linux__)
+/// The modification time and size of each file inside the folders
+using FolderSnapshot =
+    std::map<std::string, std::pair<stdfs::file_time_type, std::uintmax_t>>;
+
+/// Records the state of every file inside the given folders
+FolderSnapshot takeFolderSnapshot(const StringList &folder_list) {
+  FolderSnapshot snapshot;
+
+  for (const auto &folder : folder_list) {
+    std::error_code error;
+    for (auto it = stdfs::recursive_directory_iterator(folder, error);
+         !error && it != stdfs::recursive_directory_iterator();
+         it.increment(error)) {
+      std::error_code file_error;
+      if (!stdfs::is_regular_file(it->path(), file_error)) {
+        continue;
+      }
+
+      auto last_write_time = stdfs::last_write_time(it->path(), file_error);
+      auto size = stdfs::file_size(it->path(), file_error);
+      if (!file_error) {
+        snapshot[it->path().string()] = {last_write_time, size};
+      }
+    }
+  }
+
+  return snapshot;
+}
+
+/// Adds the files that differ between the two snapshots to the given set
+void compareFolderSnapshots(std::set<std::string> &changed_file_set,
+                            const FolderSnapshot &previous_snapshot,
+                            const FolderSnapshot &current_snapshot) {
+  for (const auto &p : current_snapshot) {
+    auto it = previous_snapshot.find(p.first);
+    if (it == previous_snapshot.end() || it->second != p.second) {
+      changed_file_set.insert(p.first);
+    }
+  }
+
+  for (const auto &p : previous_snapshot) {
+    if (current_snapshot.count(p.first) == 0U) {
+      changed_file_set.insert(p.first);
+    }
+  }
+}
+#endif
+}  // namespace
+
+/// Private class data
+struct HeaderWatcher::PrivateData final {
+  /// The folders being watched
+  StringList folder_list;
+
+#if defined(__linux__)
+  /// The inotify instance
+  int inotify_descriptor{-1};
+
+  /// The folder of each watch descriptor
+  std::unordered_map<int, stdfs::path> watched_folder_map;
+
+  /// Watches the given folder and all of its subfolders; the files found
+  /// inside are added to the changed file set, if passed, since they may
+  /// have been created before the watch was in place
+  void watchFolder(const stdfs::path &folder,
+                   std::set<std::string> *changed_file_set);
+
+  /// Reads the pending events, waiting up to the given time for the first
+  /// one; returns true if any event has been read
+  bool readEvents(std::set<std::string> &changed_file_set,
+                  std::chrono::milliseconds timeout);
+#else
+  /// The state of the files when the last changes were reported
+  FolderSnapshot snapshot;
+#endif
+};
+
+#if defined(__linux__)
+void HeaderWatcher::PrivateData::watchFolder(
+    const stdfs::path &folder, std::set<std::string> *changed_file_set) {
+  const std::uint32_t kEventMask = IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE |
+                                   IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+
+  auto L_addWatch = [&](const stdfs::path &path) {
+    auto watch_descriptor =
+        inotify_add_watch(inotify_descriptor, path.c_str(), kEventMask);
+
+    if (watch_descriptor >= 0) {
+      watched_folder_map[watch_descriptor] = path;
+    }
+  };
+
+  L_addWatch(folder);
+
+  std::error_code error;
+  for (auto it = stdfs::recursive_directory_iterator(folder, error);
+       !error && it != stdfs::recursive_directory_iterator();
+       it.increment(error)) {
+    std::error_code file_error;
+    if (stdfs::is_directory(it->path(), file_error)) {
+      L_addWatch(it->path());
+
+    } else if (changed_file_set != nullptr) {
+      changed_file_set->insert(it->path().string());
+    }
+  }
+}
+
+bool HeaderWatcher::PrivateData::readEvents(
+    std::set<std::string> &changed_file_set,
+    std::chrono::milliseconds timeout) {
+  pollfd poll_descriptor = {};
+  poll_descriptor.fd = inotify_descriptor;
+  poll_descriptor.events = POLLIN;
+
+  if (poll(&poll_descriptor, 1, static_cast<int>(timeout.count())) <= 0) {
+    return false;
+  }
+
+  alignas(inotify_event) char buffer[64U * 1024U];
+  auto size = read(inotify_descriptor, buffer, sizeof(buffer));
+  if (size <= 0) {
+    return false;
+  }
+
+  for (ssize_t offset = 0; offset < size;) {
+    const auto &event = *reinterpret_cast<const inotify_event *>(
+        buffer + static_cast<std::size_t>(offset));
+
+    offset += static_cast<ssize_t>(sizeof(inotify_event) + event.len);
+
+    if ((event.mask & IN_IGNORED) != 0U) {
+      watched_folder_map.erase(event.wd);
+      continue;
+    }
+
+    auto folder_it = watched_folder_map.find(event.wd);
+    if (folder_it == watched_folder_map.end() || event.len == 0U) {
+      continue;
+    }
+
+    auto path = folder_it->second / event.name;
+
+    if ((event.mask & IN_ISDIR) != 0U) {
+      if ((event.mask & (IN_CREATE | IN_MOVED_TO)) != 0U) {
+        watchFolder(path, &changed_file_set);
+      }
+
+      continue;
+    }
+
+    changed_file_set.insert(path.string());
+  }
+
+  return true;
+}
+#endif
+
+HeaderWatcher::HeaderWatcher(const StringList &folder_list)
+    : d(new PrivateData) {
+  d->folder_list = folder_list;
+
+#if defined(__linux__)
+  d->inotify_descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (d->inotify_descriptor < 0) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to initialize the inotify instance");
+  }
+
+  for (const auto &folder : folder_list) {
+    d->watchFolder(folder, nullptr);
+  }
+
+  if (d->watched_folder_map.empty()) {
+    close(d->inotify_descriptor);
+
+    throw Status(false, StatusCode::IOError,
+                 "None of the header folders could be watched");
+  }
+
+#else
+  d->snapshot = takeFolderSnapshot(folder_list);
+#endif
+}
+
+HeaderWatcher::Status HeaderWatcher::create(HeaderWatcherRef &obj,
+                                            const StringList &folder_list) {
+  obj.reset();
+
+  try {
+    auto ptr = new HeaderWatcher(folder_list);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+HeaderWatcher::~HeaderWatcher() {
+#if defined(__linux__)
+  close(d->inotify_descriptor);
+#endif
+}
+
+bool HeaderWatcher::wait(StringList &changed_file_list,
+                         const std::atomic_bool &stop) {
+  changed_file_list.clear();
+
+  std::set<std::string> changed_file_set;
+
+#if defined(__linux__)
+  while (changed_file_set.empty()) {
+    if (stop) {
+      return false;
+    }
+
+    d->readEvents(changed_file_set, kStopCheckInterval);
+  }
+
+  while (d->readEvents(changed_file_set, kQuietPeriod)) {
+  }
+
+#else
+  auto L_compareSnapshot = [&]() -> bool {
+    auto snapshot = takeFolderSnapshot(d->folder_list);
+
+    auto previous_change_count = changed_file_set.size();
+    compareFolderSnapshots(changed_file_set, d->snapshot, snapshot);
+
+    d->snapshot = std::move(snapshot);
+    return changed_file_set.size() != previous_change_count;
+  };
+
+  while (changed_file_set.empty()) {
+    if (stop) {
+      return false;
+    }
+
+    std::this_thread::sleep_for(kStopCheckInterval * 2);
+    L_compareSnapshot();
+  }
+
+  do {
+    std::this_thread::sleep_for(kQuietPeriod);
+  } while (L_compareSnapshot());
+#endif
+
+  changed_file_list.assign(changed_file_set.begin(), changed_file_set.end());
+  return true;
+}
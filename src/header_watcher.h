@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "types.h"
+
+#include <atomic>
+#include <memory>
+
+class HeaderWatcher;
+
+/// A reference to a HeaderWatcher object
+using HeaderWatcherRef = std::unique_ptr<HeaderWatcher>;
+
+/// The HeaderWatcher reports the files that have been modified, created or
+/// removed inside the header folders. On Linux the folders are watched with
+/// inotify, and the folders created later on are watched as well; other
+/// platforms compare the modification times of the files once per second
+class HeaderWatcher final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  HeaderWatcher(const StringList &folder_list);
+
+ public:
+  /// Status code, used with HeaderWatcher::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new HeaderWatcher object for the given folders, including
+  /// their subfolders
+  static Status create(HeaderWatcherRef &obj, const StringList &folder_list);
+
+  /// Destructor
+  ~HeaderWatcher();
+
+  /// Waits until at least one file has changed, then keeps collecting the
+  /// changes until the folders have been quiet for a short while, so that
+  /// an editor saving several files (or a checkout) only triggers a single
+  /// run. The changed paths are sorted and unique. Returns false if the
+  /// stop flag has been set before anything changed
+  bool wait(StringList &changed_file_list, const std::atomic_bool &stop);
+
+  /// Disable the copy constructor
+  HeaderWatcher(const HeaderWatcher &other) = delete;
+
+  /// Disable the assignment operator
+  HeaderWatcher &operator=(const HeaderWatcher &other) = delete;
+};
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "huge_pages.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+
+// Added in Linux 6.1; older C libraries do not define it, and older kernels
+// reject it
+#if !defined(MADV_COLLAPSE)
+#define MADV_COLLAPSE 25
+#endif
+#endif
+
+namespace {
+/// Smaller heap mappings are not advised; this skips the thread stacks,
+/// which are 8 MiB by default
+const std::size_t kMinimumAdvisedMappingSize = 16U * kHugePageSize;
+
+/// The state shared by the huge page functions
+struct HugePageState final {
+  /// True if the large arrays are backed by huge pages
+  std::atomic_bool enabled{false};
+
+  /// Protects the mapped block map
+  std::mutex block_map_mutex;
+
+  /// The blocks that have been mapped on their own, with their mapped size.
+  /// Only blocks of at least one huge page are looked up, so the small
+  /// allocations never take the lock
+  std::unordered_map<void *, std::size_t> mapped_block_map;
+
+  /// The current size of the mapped blocks, in bytes
+  std::atomic_size_t backed_byte_count{0U};
+
+  /// The peak size of the mapped blocks, in bytes
+  std::atomic_size_t peak_backed_byte_count{0U};
+
+  /// The total size of the advised heap mappings, in bytes
+  std::atomic_size_t advised_byte_count{0U};
+
+  /// The total size of the collapsed heap mappings, in bytes
+  std::atomic_size_t collapsed_byte_count{0U};
+};
+
+/// Returns the huge page state; it is never destroyed, as containers with
+/// static storage may release their blocks during exit
+HugePageState &hugePageState() {
+  static auto state = new HugePageState;
+  return *state;
+}
+
+#if defined(__linux__)
+/// Maps a block of the given size (a multiple of the huge page size),
+/// aligned to a huge page boundary so that the kernel can back all of it
+/// with huge pages. Returns nullptr on error
+void *mapHugePageBlock(std::size_t mapped_size) {
+  auto reserved_size = mapped_size + kHugePageSize;
+
+  auto reservation = mmap(nullptr, reserved_size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (reservation == MAP_FAILED) {
+    return nullptr;
+  }
+
+  // Trim the reservation down to the aligned block
+  auto reservation_start = reinterpret_cast<std::uintptr_t>(reservation);
+  auto block_start =
+      (reservation_start + kHugePageSize - 1U) & ~(kHugePageSize - 1U);
+
+  auto head_size = block_start - reservation_start;
+  if (head_size != 0U) {
+    munmap(reservation, head_size);
+  }
+
+  auto tail_size = kHugePageSize - head_size;
+  if (tail_size != 0U) {
+    munmap(reinterpret_cast<void *>(block_start + mapped_size), tail_size);
+  }
+
+  auto block = reinterpret_cast<void *>(block_start);
+  madvise(block, mapped_size, MADV_HUGEPAGE);
+
+  return block;
+}
+#endif
+
+/// Updates the peak of the mapped block size
+void updatePeakBackedByteCount(HugePageState &state, std::size_t value) {
+  auto peak = state.peak_backed_byte_count.load();
+  while (value > peak &&
+         !state.peak_backed_byte_count.compare_exchange_weak(peak, value)) {
+  }
+}
+}  // namespace
+
+void setHugePageBacking(bool enabled) { hugePageState().enabled = enabled; }
+
+bool hugePageBackingEnabled() { return hugePageState().enabled; }
+
+void *allocateHugePageBlock(std::size_t size) {
+#if defined(__linux__)
+  auto &state = hugePageState();
+
+  if (size >= kHugePageSize && state.enabled) {
+    auto mapped_size = (size + kHugePageSize - 1U) & ~(kHugePageSize - 1U);
+
+    // Fall back to operator new when the address space can't be reserved
+    auto block = mapHugePageBlock(mapped_size);
+    if (block != nullptr) {
+      {
+        std::lock_guard<std::mutex> lock(state.block_map_mutex);
+        state.mapped_block_map.insert({block, mapped_size});
+      }
+
+      auto backed_byte_count = state.backed_byte_count += mapped_size;
+      updatePeakBackedByteCount(state, backed_byte_count);
+
+      return block;
+    }
+  }
+#endif
+
+  return ::operator new(size);
+}
+
+void releaseHugePageBlock(void *block, std::size_t size) {
+#if defined(__linux__)
+  // Large blocks may still come from operator new, if they have been
+  // allocated while the backing was disabled
+  if (size >= kHugePageSize) {
+    auto &state = hugePageState();
+
+    std::size_t mapped_size = 0U;
+
+    {
+      std::lock_guard<std::mutex> lock(state.block_map_mutex);
+
+      auto it = state.mapped_block_map.find(block);
+      if (it != state.mapped_block_map.end()) {
+        mapped_size = it->second;
+        state.mapped_block_map.erase(it);
+      }
+    }
+
+    if (mapped_size != 0U) {
+      munmap(block, mapped_size);
+      state.backed_byte_count -= mapped_size;
+      return;
+    }
+  }
+#else
+  static_cast<void>(size);
+#endif
+
+  ::operator delete(block);
+}
+
+std::size_t adviseHeapHugePages(bool collapse) {
+  std::size_t advised_byte_count = 0U;
+
+#if defined(__linux__)
+  auto &state = hugePageState();
+
+  std::ifstream maps_file("/proc/self/maps");
+
+  std::string line;
+  while (std::getline(maps_file, line)) {
+    // start-end perms offset device inode [path]
+    std::istringstream line_stream(line);
+
+    std::string address_range;
+    std::string permissions;
+    std::string offset;
+    std::string device;
+    std::string inode;
+    std::string path;
+    line_stream >> address_range >> permissions >> offset >> device >> inode;
+    std::getline(line_stream >> std::ws, path);
+
+    // Only the private anonymous mappings hold heap memory
+    if (permissions != "rw-p" || inode != "0" ||
+        (!path.empty() && path != "[heap]")) {
+      continue;
+    }
+
+    auto separator = address_range.find('-');
+    if (separator == std::string::npos) {
+      continue;
+    }
+
+    std::uintptr_t start = 0U;
+    std::uintptr_t end = 0U;
+
+    try {
+      start = std::stoull(address_range.substr(0U, separator), nullptr, 16);
+      end = std::stoull(address_range.substr(separator + 1U), nullptr, 16);
+
+    } catch (...) {
+      continue;
+    }
+
+    // Only whole huge pages can be backed
+    start = (start + kHugePageSize - 1U) & ~(kHugePageSize - 1U);
+    end &= ~(kHugePageSize - 1U);
+
+    if (end <= start || end - start < kMinimumAdvisedMappingSize) {
+      continue;
+    }
+
+    auto range = reinterpret_cast<void *>(start);
+    auto range_size = static_cast<std::size_t>(end - start);
+
+    // The mapping may have been released since the file has been read; the
+    // call then just fails
+    if (madvise(range, range_size, MADV_HUGEPAGE) != 0) {
+      continue;
+    }
+
+    advised_byte_count += range_size;
+
+    // Without a collapse, only the pages faulted in from now on (or the
+    // ones khugepaged eventually gets to) are backed by huge pages
+    if (collapse && madvise(range, range_size, MADV_COLLAPSE) == 0) {
+      state.collapsed_byte_count += range_size;
+    }
+  }
+
+  state.advised_byte_count += advised_byte_count;
+
+#else
+  static_cast<void>(collapse);
+#endif
+
+  return advised_byte_count;
+}
+
+HugePageStatistics getHugePageStatistics() {
+  auto &state = hugePageState();
+
+  HugePageStatistics statistics;
+  statistics.peak_backed_byte_count = state.peak_backed_byte_count;
+  statistics.advised_byte_count = state.advised_byte_count;
+  statistics.collapsed_byte_count = state.collapsed_byte_count;
+
+  return statistics;
+}
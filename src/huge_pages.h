@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// The size of the huge pages used to back the large arrays
+const std::size_t kHugePageSize = 2U * 1024U * 1024U;
+
+/// Enables or disables the huge page backing of the large abigen arrays
+/// (such as the ones of the type dependency graph). Memory that has already
+/// been allocated keeps its backing
+void setHugePageBacking(bool enabled);
+
+/// Returns true if the large abigen arrays are backed by huge pages
+bool hugePageBackingEnabled();
+
+/// Allocates a block of the given size. When the huge page backing is
+/// enabled and the block is at least one huge page in size, it is mapped
+/// on its own and advised as a transparent huge page area (Linux only);
+/// otherwise it comes from operator new. This function is thread safe
+void *allocateHugePageBlock(std::size_t size);
+
+/// Releases a block returned by allocateHugePageBlock(). This function is
+/// thread safe
+void releaseHugePageBlock(void *block, std::size_t size);
+
+/// Advises the large anonymous mappings of the process (the malloc arenas,
+/// which hold the slabs of the clang bump allocators) as transparent huge
+/// page areas. If collapse is true, the pages that are already in use are
+/// also collapsed into huge pages right away, on kernels that support it.
+/// Returns the size of the advised mappings, in bytes
+std::size_t adviseHeapHugePages(bool collapse);
+
+/// The huge page counters of the process
+struct HugePageStatistics final {
+  /// The peak size of the arrays backed by huge pages, in bytes
+  std::size_t peak_backed_byte_count{0U};
+
+  /// The total size of the mappings advised by adviseHeapHugePages(), in
+  /// bytes
+  std::size_t advised_byte_count{0U};
+
+  /// The total size of the mappings collapsed by adviseHeapHugePages(), in
+  /// bytes
+  std::size_t collapsed_byte_count{0U};
+};
+
+/// Returns the huge page counters of the process
+HugePageStatistics getHugePageStatistics();
+
+/// A stateless allocator for the containers whose arrays grow large enough
+/// to be backed by huge pages
+template <typename T>
+class HugePageAllocator {
+ public:
+  using value_type = T;
+
+  /// Constructor
+  HugePageAllocator() = default;
+
+  /// Converting constructor, used by the containers to rebind the allocator
+  template <typename U>
+  HugePageAllocator(const HugePageAllocator<U> &) {}
+
+  /// Allocates the given amount of objects
+  T *allocate(std::size_t count) {
+    return static_cast<T *>(allocateHugePageBlock(count * sizeof(T)));
+  }
+
+  /// Releases the given objects
+  void deallocate(T *pointer, std::size_t count) {
+    releaseHugePageBlock(pointer, count * sizeof(T));
+  }
+};
+
+/// All HugePageAllocator objects are interchangeable
+template <typename T, typename U>
+bool operator==(const HugePageAllocator<T> &, const HugePageAllocator<U> &) {
+  return true;
+}
+
+/// All HugePageAllocator objects are interchangeable
+template <typename T, typename U>
+bool operator!=(const HugePageAllocator<T> &, const HugePageAllocator<U> &) {
+  return false;
+}
+
+/// A vector whose array can be backed by huge pages
+template <typename T>
+using HugePageVector = std::vector<T, HugePageAllocator<T>>;
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "profile_pack.h"
+#include "std_filesystem.h"
+
+#include <iostream>
+
+/// Handler for the 'import_profile' command
+bool importProfileCommandHandler(ProfileManagerRef &profile_manager,
+                                 const LanguageManager &language_manager,
+                                 const CommandLineOptions &cmdline_options) {
+  static_cast<void>(language_manager);
+
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, cmdline_options.profile_name);
+  if (!prof_mgr_status.succeeded()) {
+    std::cerr << prof_mgr_status.toString() << "\n";
+    return false;
+  }
+
+  auto output_path = cmdline_options.output;
+  if (output_path.empty()) {
+    output_path =
+        (stdfs::path(profile.root_path) / kProfileManifestFileName).string();
+  }
+
+  std::error_code error;
+  stdfs::create_directories(cmdline_options.profile_store, error);
+  if (error) {
+    std::cerr << "Failed to create the profile store: "
+              << cmdline_options.profile_store << "\n";
+    return false;
+  }
+
+  ProfilePack::ManifestStatistics statistics;
+  auto status = ProfilePack::writeManifest(statistics, profile.root_path,
+                                           cmdline_options.profile_store,
+                                           output_path);
+  if (!status.succeeded()) {
+    std::cerr << status.toString() << "\n";
+    return false;
+  }
+
+  std::cout << "Profile store: " << statistics.file_count << " files, "
+            << statistics.new_blob_count << " added to the store ("
+            << statistics.new_blob_size << " bytes), "
+            << (statistics.file_count - statistics.new_blob_count)
+            << " already stored\n\n";
+
+  std::cout << "The profile manifest has been saved to " << output_path
+            << "\n";
+
+  return true;
+}
@@ -39,7 +39,8 @@ struct LanguageDescriptor final {
 /// Language map
 using LanguageMap = std::map<std::string, LanguageDescriptor>;
 
-/// Language manager
+/// Language manager; the supported languages never change, so all methods
+/// are thread safe
 class LanguageManager final {
  public:
   /// Constructor
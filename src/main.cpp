@@ -15,6 +15,7 @@
  */
 
 #include "cmdline.h"
+#include "task_executor.h"
 
 #include <iostream>
 
@@ -44,6 +45,8 @@ int main(int argc, char *argv[], char *envp[]) {
     const auto &callback = p.second;
 
     if (cmdline_parser.got_subcommand(subcommand)) {
+      setTaskThreadBudget(getThreadBudget(*subcommand, cmdline_options));
+
       auto succeeded =
           callback(profile_manager, language_manager, cmdline_options);
       return (succeeded ? 0 : 1);
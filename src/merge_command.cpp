@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "cmdline.h"
+#include "output_file.h"
+#include "task_executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+
+namespace {
+/// The prefix of the arrays listing the functions of each ABI library
+const std::string kExternArrayPrefix = "__mcsema_externs";
+
+/// A library taking part in a merge round
+struct MergeInput final {
+  /// The name used in the error messages
+  std::string name;
+
+  /// The serialized module
+  std::string bitcode;
+
+  /// True once the extern arrays of the module have been renamed; only the
+  /// libraries read from disk still need it
+  bool prepared{false};
+
+  /// The position of the library on the command line
+  std::size_t input_index{0U};
+};
+
+/// The size of the libraries read from disk
+struct MergeStatistics final {
+  /// Functions, definitions and declarations alike
+  std::size_t function_count{0U};
+
+  /// Global variables
+  std::size_t global_variable_count{0U};
+
+  /// Named struct types
+  std::size_t struct_type_count{0U};
+};
+
+/// Parses the given library in the specified context
+bool parseMergeInput(std::unique_ptr<llvm::Module> &module,
+                     std::string &error_message, const MergeInput &input,
+                     llvm::LLVMContext &llvm_context) {
+  llvm::MemoryBufferRef bitcode_buffer(input.bitcode, input.name);
+
+  auto module_exp = llvm::parseBitcodeFile(bitcode_buffer, llvm_context);
+  if (!module_exp) {
+    llvm::consumeError(module_exp.takeError());
+    error_message = "Failed to parse the bitcode of " + input.name;
+    return false;
+  }
+
+  module = std::move(module_exp.get());
+  return true;
+}
+
+/// Gives the extern arrays of a library read from disk a name of their own,
+/// as every library defines a __mcsema_externs array; the ones of the
+/// merged library all keep the prefix
+void prepareMergeInput(MergeStatistics &statistics, llvm::Module &module,
+                       std::size_t input_index) {
+  std::vector<llvm::GlobalVariable *> extern_array_list;
+
+  for (auto &global_variable : module.globals()) {
+    if (global_variable.getName().startswith(kExternArrayPrefix)) {
+      extern_array_list.push_back(&global_variable);
+    }
+  }
+
+  for (std::size_t i = 0U; i < extern_array_list.size(); ++i) {
+    extern_array_list[i]->setName(kExternArrayPrefix + "_" +
+                                  std::to_string(input_index) + "_" +
+                                  std::to_string(i));
+  }
+
+  statistics.function_count = module.size();
+  statistics.global_variable_count = module.global_size();
+  statistics.struct_type_count = module.getIdentifiedStructTypes().size();
+}
+
+/// Links the given libraries, in order, into a new one. Each call uses its
+/// own context, so that the pairs of a round can be linked concurrently;
+/// the linker merges the declarations with the same name and maps the
+/// isomorphic struct types onto a single one
+bool mergeLibraries(MergeInput &output, MergeStatistics &statistics,
+                    std::string &error_message, const MergeInput &lhs,
+                    const MergeInput *rhs) {
+  llvm::LLVMContext llvm_context;
+
+  statistics = {};
+
+  auto L_prepare = [&](llvm::Module &module, const MergeInput &input) {
+    if (input.prepared) {
+      return;
+    }
+
+    MergeStatistics input_statistics;
+    prepareMergeInput(input_statistics, module, input.input_index);
+
+    statistics.function_count += input_statistics.function_count;
+    statistics.global_variable_count += input_statistics.global_variable_count;
+    statistics.struct_type_count += input_statistics.struct_type_count;
+  };
+
+  std::unique_ptr<llvm::Module> output_module;
+  if (!parseMergeInput(output_module, error_message, lhs, llvm_context)) {
+    return false;
+  }
+
+  L_prepare(*output_module, lhs);
+
+  if (rhs != nullptr) {
+    std::unique_ptr<llvm::Module> module;
+    if (!parseMergeInput(module, error_message, *rhs, llvm_context)) {
+      return false;
+    }
+
+    L_prepare(*module, *rhs);
+
+    llvm::Linker linker(*output_module);
+    if (linker.linkInModule(std::move(module))) {
+      error_message = "Failed to link " + rhs->name + " into " + lhs.name;
+      return false;
+    }
+  }
+
+  output.name = lhs.name;
+  output.bitcode.clear();
+  output.prepared = true;
+  output.input_index = lhs.input_index;
+
+  llvm::raw_string_ostream output_stream(output.bitcode);
+  llvm::WriteBitcodeToFile(*output_module, output_stream);
+  output_stream.flush();
+
+  return true;
+}
+
+/// Returns the statistics of the given merged library
+bool getLibraryStatistics(MergeStatistics &statistics,
+                          const MergeInput &library) {
+  llvm::LLVMContext llvm_context;
+
+  std::string error_message;
+  std::unique_ptr<llvm::Module> module;
+  if (!parseMergeInput(module, error_message, library, llvm_context)) {
+    return false;
+  }
+
+  statistics.function_count = module->size();
+  statistics.global_variable_count = module->global_size();
+  statistics.struct_type_count = module->getIdentifiedStructTypes().size();
+  return true;
+}
+}  // namespace
+
+bool mergeCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options) {
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+
+  std::vector<MergeInput> library_list;
+
+  for (const auto &path : cmdline_options.merge_input_list) {
+    auto buffer_or_error = llvm::MemoryBuffer::getFile(path);
+    if (!buffer_or_error) {
+      std::cerr << "Failed to read the ABI library: " << path << "\n";
+      return false;
+    }
+
+    MergeInput library;
+    library.name = path;
+    library.bitcode = buffer_or_error.get()->getBuffer().str();
+    library.input_index = library_list.size();
+
+    library_list.push_back(std::move(library));
+  }
+
+  if (library_list.empty()) {
+    std::cerr << "No ABI library to merge\n";
+    return false;
+  }
+
+  // Libraries are linked in pairs, and the pairs of each round are linked
+  // concurrently; the order of the inputs is preserved, so the output does
+  // not depend on the job count
+  MergeStatistics input_statistics;
+  std::size_t round_count = 0U;
+
+  do {
+    auto pair_count = (library_list.size() + 1U) / 2U;
+
+    std::vector<MergeInput> merged_library_list(pair_count);
+    std::vector<MergeStatistics> statistics_list(pair_count);
+    std::vector<std::string> error_message_list(pair_count);
+    std::vector<std::uint8_t> succeeded_list(pair_count, 0U);
+
+    std::atomic_size_t next_pair_index{0U};
+
+    auto L_worker = [&](std::size_t) {
+      while (true) {
+        auto pair_index = next_pair_index++;
+        if (pair_index >= pair_count) {
+          break;
+        }
+
+        const auto &lhs = library_list[pair_index * 2U];
+
+        const MergeInput *rhs = nullptr;
+        if (pair_index * 2U + 1U < library_list.size()) {
+          rhs = &library_list[pair_index * 2U + 1U];
+        }
+
+        succeeded_list[pair_index] = mergeLibraries(
+            merged_library_list[pair_index], statistics_list[pair_index],
+            error_message_list[pair_index], lhs, rhs);
+      }
+    };
+
+    auto thread_count =
+        std::max<std::size_t>(std::min(cmdline_options.jobs, pair_count), 1U);
+
+    runTaskLanes(thread_count, TaskPriority::Normal, L_worker);
+
+    for (std::size_t i = 0U; i < pair_count; ++i) {
+      if (!succeeded_list[i]) {
+        std::cerr << error_message_list[i] << "\n";
+        return false;
+      }
+
+      input_statistics.function_count += statistics_list[i].function_count;
+      input_statistics.global_variable_count +=
+          statistics_list[i].global_variable_count;
+      input_statistics.struct_type_count +=
+          statistics_list[i].struct_type_count;
+    }
+
+    library_list = std::move(merged_library_list);
+    ++round_count;
+
+  } while (library_list.size() > 1U);
+
+  const auto &merged_library = library_list.front();
+
+  MergeStatistics output_statistics;
+  if (!getLibraryStatistics(output_statistics, merged_library)) {
+    std::cerr << "Failed to parse the merged bitcode\n";
+    return false;
+  }
+
+  std::cerr << "Merge: " << cmdline_options.merge_input_list.size()
+            << " libraries linked in " << round_count << " rounds\n";
+
+  std::cerr << "  Functions: " << input_statistics.function_count
+            << " in the inputs, " << output_statistics.function_count
+            << " after the merge\n";
+
+  std::cerr << "  Global variables: "
+            << input_statistics.global_variable_count << " in the inputs, "
+            << output_statistics.global_variable_count << " after the merge\n";
+
+  std::cerr << "  Struct types: " << input_statistics.struct_type_count
+            << " in the inputs, " << output_statistics.struct_type_count
+            << " after the merge\n";
+
+  if (!writeFileIfChanged(cmdline_options.output, merged_library.bitcode)) {
+    std::cerr << "Failed to save the output to file\n";
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "output_capture.h"
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+
+namespace {
+/// The output buffer of the task executed by the current thread, if any
+thread_local std::string *thread_output{nullptr};
+
+/// A stream buffer that sends the output of each thread to the buffer set
+/// with ScopedOutputCapture::setThreadOutput(); the output of the other
+/// threads goes to the original stream buffer
+class ThreadOutputBuffer final : public std::streambuf {
+  /// The stream buffer used when the thread has no output buffer
+  std::streambuf *default_buffer{nullptr};
+
+ public:
+  /// Constructor
+  ThreadOutputBuffer(std::streambuf *default_buffer)
+      : default_buffer(default_buffer) {}
+
+  /// Destructor
+  virtual ~ThreadOutputBuffer() override = default;
+
+  /// Returns the original stream buffer
+  std::streambuf *defaultBuffer() const { return default_buffer; }
+
+ protected:
+  /// Writes a single character
+  virtual int_type overflow(int_type c) override {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      return traits_type::not_eof(c);
+    }
+
+    if (thread_output != nullptr) {
+      thread_output->push_back(traits_type::to_char_type(c));
+      return c;
+    }
+
+    return default_buffer->sputc(traits_type::to_char_type(c));
+  }
+
+  /// Writes a sequence of characters
+  virtual std::streamsize xsputn(const char *buffer,
+                                 std::streamsize size) override {
+    if (thread_output != nullptr) {
+      thread_output->append(buffer, static_cast<std::size_t>(size));
+      return size;
+    }
+
+    return default_buffer->sputn(buffer, size);
+  }
+
+  /// Flushes the default stream buffer
+  virtual int sync() override {
+    return (thread_output != nullptr) ? 0 : default_buffer->pubsync();
+  }
+};
+
+/// The stream buffers are installed by the first ScopedOutputCapture object
+/// and removed by the last one
+struct OutputCaptureState final {
+  /// Protects the other members
+  std::mutex mutex;
+
+  /// How many ScopedOutputCapture objects are alive
+  std::size_t reference_count{0U};
+
+  /// Replaces the std::cout stream buffer
+  std::unique_ptr<ThreadOutputBuffer> cout_thread_buffer;
+
+  /// Replaces the std::cerr stream buffer
+  std::unique_ptr<ThreadOutputBuffer> cerr_thread_buffer;
+};
+
+/// Returns the global output capture state
+OutputCaptureState &outputCaptureState() {
+  static OutputCaptureState state;
+  return state;
+}
+}  // namespace
+
+ScopedOutputCapture::ScopedOutputCapture() {
+  auto &state = outputCaptureState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  if (state.reference_count++ > 0U) {
+    return;
+  }
+
+  state.cout_thread_buffer.reset(new ThreadOutputBuffer(std::cout.rdbuf()));
+  state.cerr_thread_buffer.reset(new ThreadOutputBuffer(std::cerr.rdbuf()));
+
+  std::cout.rdbuf(state.cout_thread_buffer.get());
+  std::cerr.rdbuf(state.cerr_thread_buffer.get());
+}
+
+ScopedOutputCapture::~ScopedOutputCapture() {
+  auto &state = outputCaptureState();
+  std::lock_guard<std::mutex> lock(state.mutex);
+
+  if (--state.reference_count > 0U) {
+    return;
+  }
+
+  std::cout.rdbuf(state.cout_thread_buffer->defaultBuffer());
+  std::cerr.rdbuf(state.cerr_thread_buffer->defaultBuffer());
+
+  state.cout_thread_buffer.reset();
+  state.cerr_thread_buffer.reset();
+}
+
+void ScopedOutputCapture::setThreadOutput(std::string *output) {
+  thread_output = output;
+}
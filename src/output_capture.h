@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+
+/// While at least one of these objects is alive, std::cout and std::cerr can
+/// be redirected to a separate buffer for each thread, so that the output of
+/// the tasks executed concurrently is not interleaved. Threads that have not
+/// called setThreadOutput() (including the workers spawned by a task) keep
+/// writing to the original streams. Objects can be nested, and created from
+/// different threads
+class ScopedOutputCapture final {
+ public:
+  /// Constructor
+  ScopedOutputCapture();
+
+  /// Destructor; the original stream buffers are restored when the last
+  /// object is destroyed
+  ~ScopedOutputCapture();
+
+  /// Sends the output of the calling thread to the given buffer; pass
+  /// nullptr to write to the original streams again
+  static void setThreadOutput(std::string *output);
+
+  /// Disable the copy constructor
+  ScopedOutputCapture(const ScopedOutputCapture &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedOutputCapture &operator=(const ScopedOutputCapture &other) = delete;
+};
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+namespace {
+/// Returns true if the two files have the same contents
+bool compareFileContents(const std::string &lhs_path,
+                         const std::string &rhs_path) {
+  std::error_code error;
+  auto lhs_size = stdfs::file_size(lhs_path, error);
+  if (error) {
+    return false;
+  }
+
+  auto rhs_size = stdfs::file_size(rhs_path, error);
+  if (error || lhs_size != rhs_size) {
+    return false;
+  }
+
+  std::ifstream lhs_file(lhs_path, std::ios::in | std::ios::binary);
+  std::ifstream rhs_file(rhs_path, std::ios::in | std::ios::binary);
+  if (!lhs_file || !rhs_file) {
+    return false;
+  }
+
+  const std::size_t kChunkSize = 64U * 1024U;
+  std::string lhs_chunk(kChunkSize, '\0');
+  std::string rhs_chunk(kChunkSize, '\0');
+
+  while (true) {
+    lhs_file.read(&lhs_chunk[0], static_cast<std::streamsize>(kChunkSize));
+    rhs_file.read(&rhs_chunk[0], static_cast<std::streamsize>(kChunkSize));
+
+    auto lhs_read = lhs_file.gcount();
+    if (lhs_read != rhs_file.gcount() ||
+        lhs_chunk.compare(0U, static_cast<std::size_t>(lhs_read), rhs_chunk,
+                          0U, static_cast<std::size_t>(lhs_read)) != 0) {
+      return false;
+    }
+
+    if (!lhs_file || !rhs_file) {
+      return lhs_file.eof() && rhs_file.eof();
+    }
+  }
+}
+
+/// Escapes the characters that have a special meaning in Make rules
+std::string escapeDependencyPath(const std::string &path) {
+  std::string escaped_path;
+  escaped_path.reserve(path.size());
+
+  for (auto c : path) {
+    if (c == ' ' || c == '#') {
+      escaped_path.push_back('\\');
+    } else if (c == '$') {
+      escaped_path.push_back('$');
+    }
+
+    escaped_path.push_back(c);
+  }
+
+  return escaped_path;
+}
+}  // namespace
+
+std::string getTemporaryOutputPath(const std::string &path) {
+  std::random_device random_device;
+  return path + ".tmp" + std::to_string(random_device());
+}
+
+bool replaceFileIfChanged(const std::string &temporary_path,
+                          const std::string &path) {
+  std::error_code error;
+
+  if (compareFileContents(temporary_path, path)) {
+    stdfs::remove(temporary_path, error);
+    return true;
+  }
+
+  stdfs::rename(temporary_path, path, error);
+  if (error) {
+    stdfs::remove(temporary_path, error);
+    return false;
+  }
+
+  return true;
+}
+
+bool writeFileIfChanged(const std::string &path, const std::string &buffer) {
+  auto temporary_path = getTemporaryOutputPath(path);
+
+  {
+    std::ofstream file(temporary_path,
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+    file << buffer;
+
+    if (!file) {
+      file.close();
+
+      std::error_code error;
+      stdfs::remove(temporary_path, error);
+      return false;
+    }
+  }
+
+  return replaceFileIfChanged(temporary_path, path);
+}
+
+bool writeFileAtomically(const std::string &path, const std::string &buffer) {
+  auto temporary_path = getTemporaryOutputPath(path);
+
+  std::error_code error;
+
+  {
+    std::ofstream file(temporary_path,
+                       std::ios::out | std::ios::trunc | std::ios::binary);
+    file << buffer;
+
+    if (!file) {
+      file.close();
+      stdfs::remove(temporary_path, error);
+      return false;
+    }
+  }
+
+  stdfs::rename(temporary_path, path, error);
+  if (error) {
+    stdfs::remove(temporary_path, error);
+    return false;
+  }
+
+  return true;
+}
+
+bool writeDependencyFile(const std::string &path,
+                         const StringList &target_list,
+                         const StringList &dependency_list) {
+  auto sorted_dependency_list = dependency_list;
+  std::sort(sorted_dependency_list.begin(), sorted_dependency_list.end());
+
+  sorted_dependency_list.erase(std::unique(sorted_dependency_list.begin(),
+                                           sorted_dependency_list.end()),
+                               sorted_dependency_list.end());
+
+  std::stringstream buffer;
+  for (auto it = target_list.begin(); it != target_list.end(); ++it) {
+    if (it != target_list.begin()) {
+      buffer << " ";
+    }
+
+    buffer << escapeDependencyPath(*it);
+  }
+
+  buffer << ":";
+
+  for (const auto &dependency : sorted_dependency_list) {
+    buffer << " \\\n  " << escapeDependencyPath(dependency);
+  }
+
+  buffer << "\n";
+
+  return writeFileIfChanged(path, buffer.str());
+}
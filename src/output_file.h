@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "types.h"
+
+#include <string>
+
+/// Returns a unique path next to the given one, where the new contents of a
+/// file are written before they replace it
+std::string getTemporaryOutputPath(const std::string &path);
+
+/// Moves the temporary file over the destination, unless the destination
+/// already has the same contents; in that case the temporary file is removed
+/// and the destination keeps its modification time, so that the build
+/// systems do not rebuild what depends on it. Returns false in case of error;
+/// the temporary file is always removed
+bool replaceFileIfChanged(const std::string &temporary_path,
+                          const std::string &path);
+
+/// Writes the given buffer to the destination, unless it already contains
+/// exactly the same data
+bool writeFileIfChanged(const std::string &path, const std::string &buffer);
+
+/// Writes the given buffer to a temporary file first, and then renames it to
+/// the destination path, so that concurrent readers never see a partial file
+/// and an interrupted write never replaces the previous one. Returns false
+/// in case of error; the temporary file is always removed
+bool writeFileAtomically(const std::string &path, const std::string &buffer);
+
+/// Writes a Make-style dependency file, stating that the targets depend on
+/// every file in the dependency list. The dependencies are sorted and the
+/// duplicates are removed, so that identical runs produce the same file
+bool writeDependencyFile(const std::string &path,
+                         const StringList &target_list,
+                         const StringList &dependency_list);
@@ -0,0 +1,551 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pch_cache.h"
+#include "content_hash.h"
+#include "flight_recorder.h"
+#include "generate_utils.h"
+#include "output_file.h"
+#include "server_metrics.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+/// The first line of each cache entry
+const std::string kPCHCacheEntryHeader = "abigen-pch-cache 1";
+
+/// The length of the entry names; the files of an entry all start with it
+const std::size_t kEntryNameLength = 16U;
+
+/// Precompiled headers without an entry are either being generated, or have
+/// been left behind by a process that did not finish; they are only evicted
+/// after this long
+const auto kOrphanEvictionDelay = std::chrono::hours(1);
+
+/// Reads the given cache entry, returning true if none of its dependencies
+/// has changed. The name of the precompiled header it references is
+/// returned even when the entry is no longer valid, so that the file can be
+/// removed. If passed, the dependency list receives the path of each file
+/// that the entry depends on
+bool readCacheEntry(std::string &pch_file_name, const stdfs::path &entry_path,
+                    StringList *dependency_list = nullptr) {
+  pch_file_name.clear();
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  std::ifstream entry_file(entry_path.string());
+  if (!entry_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(entry_file, line) || line != kPCHCacheEntryHeader) {
+    return false;
+  }
+
+  const std::string pch_tag = "pch ";
+  if (!std::getline(entry_file, line) ||
+      line.compare(0U, pch_tag.size(), pch_tag) != 0) {
+    return false;
+  }
+
+  pch_file_name = line.substr(pch_tag.size());
+
+  // Validate the dependencies
+  while (std::getline(entry_file, line)) {
+    std::string path;
+    ContentHash expected_hash;
+    if (!parseDependencyLine(path, expected_hash, line)) {
+      return false;
+    }
+
+    ContentHash current_hash;
+    if (!hashFileContents(current_hash, path) ||
+        current_hash != expected_hash) {
+      return false;
+    }
+
+    if (dependency_list != nullptr) {
+      dependency_list->push_back(std::move(path));
+    }
+  }
+
+  return true;
+}
+
+/// Returns the name of the entry the given file belongs to, or an empty
+/// string if it is not part of an entry (i.e.: a temporary file)
+std::string getEntryName(const std::string &file_name) {
+  if (file_name.size() < kEntryNameLength ||
+      !std::all_of(file_name.begin(),
+                   std::next(file_name.begin(), kEntryNameLength),
+                   ::isxdigit)) {
+    return std::string();
+  }
+
+  if (file_name.size() != kEntryNameLength &&
+      file_name[kEntryNameLength] != '_') {
+    return std::string();
+  }
+
+  return file_name.substr(0U, kEntryNameLength);
+}
+}  // namespace
+
+/// Private class data
+struct PCHCache::PrivateData final {
+  /// The folder containing the cache entries
+  stdfs::path cache_directory;
+
+  /// The temporary folder created when no cache folder has been given; it is
+  /// removed by the destructor
+  stdfs::path temporary_directory;
+
+  /// If set, the remote cache in front of which the cache folder sits
+  RemoteCacheRef remote_cache;
+
+  /// The size the cache folder is trimmed to, in bytes; zero means no limit
+  std::uint64_t size_limit{0U};
+
+  /// Serializes the trim operations
+  std::mutex trim_mutex;
+
+  /// Protects the pinned entry map
+  std::mutex pinned_entry_map_mutex;
+
+  /// How many times each entry has been returned and not yet released; the
+  /// pinned entries are never evicted
+  std::unordered_map<std::string, std::size_t> pinned_entry_map;
+
+  /// Protects the entry mutex map
+  std::mutex entry_mutex_map_mutex;
+
+  /// Serializes the lookups of each entry, so that a header is only
+  /// generated once even when requested by multiple threads
+  std::unordered_map<ContentHash, std::shared_ptr<std::mutex>> entry_mutex_map;
+
+  /// Cache hits
+  std::atomic_size_t hit_count{0U};
+
+  /// Cache misses
+  std::atomic_size_t miss_count{0U};
+
+  /// The size of the precompiled headers served from the cache
+  std::atomic<std::uint64_t> saved_byte_count{0U};
+
+  /// Evicted entries
+  std::atomic_size_t eviction_count{0U};
+
+  /// The size of the evicted entries
+  std::atomic<std::uint64_t> evicted_byte_count{0U};
+};
+
+PCHCache::PCHCache(const std::string &cache_directory,
+                   RemoteCacheRef remote_cache, std::uint64_t size_limit)
+    : d(new PrivateData) {
+  d->size_limit = size_limit;
+
+  std::error_code error;
+
+  if (cache_directory.empty()) {
+    std::random_device random_device;
+    d->temporary_directory = stdfs::temp_directory_path(error) /
+                             ("abigen-pch-" + std::to_string(random_device()));
+
+    d->cache_directory = d->temporary_directory;
+
+  } else {
+    d->cache_directory = stdfs::path(cache_directory) / "precompiled_headers";
+    d->remote_cache = std::move(remote_cache);
+  }
+
+  if (!error) {
+    stdfs::create_directories(d->cache_directory, error);
+  }
+
+  if (error) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the precompiled header cache directory: " +
+                     d->cache_directory.string());
+  }
+}
+
+void PCHCache::trim() {
+  if (d->size_limit == 0U) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> trim_lock(d->trim_mutex);
+
+  struct CachedEntry final {
+    std::vector<stdfs::path> file_list;
+    std::uint64_t size{0U};
+    stdfs::file_time_type last_use_time{stdfs::file_time_type::min()};
+    bool has_entry_file{false};
+  };
+
+  std::unordered_map<std::string, CachedEntry> cached_entry_map;
+  std::uint64_t total_size = 0U;
+
+  std::error_code error;
+  for (auto it = stdfs::directory_iterator(d->cache_directory, error);
+       !error && it != stdfs::directory_iterator(); it.increment(error)) {
+    auto file_name = it->path().filename().string();
+
+    auto entry_name = getEntryName(file_name);
+    if (entry_name.empty()) {
+      continue;
+    }
+
+    std::error_code file_error;
+    auto size = stdfs::file_size(it->path(), file_error);
+    auto last_write_time = stdfs::last_write_time(it->path(), file_error);
+    if (file_error) {
+      continue;
+    }
+
+    // The entry file is touched on each hit, while the header keeps the
+    // time it has been generated at
+    auto &cached_entry = cached_entry_map[entry_name];
+    if (file_name.size() == kEntryNameLength) {
+      cached_entry.has_entry_file = true;
+      cached_entry.last_use_time = last_write_time;
+
+    } else if (!cached_entry.has_entry_file) {
+      cached_entry.last_use_time =
+          std::max(cached_entry.last_use_time, last_write_time);
+    }
+
+    cached_entry.file_list.push_back(it->path());
+    cached_entry.size += size;
+    total_size += size;
+  }
+
+  if (total_size <= d->size_limit) {
+    return;
+  }
+
+  std::vector<std::pair<std::string, CachedEntry>> cached_entry_list;
+
+  {
+    std::lock_guard<std::mutex> lock(d->pinned_entry_map_mutex);
+
+    auto orphan_time_limit =
+        stdfs::file_time_type::clock::now() - kOrphanEvictionDelay;
+
+    for (auto &p : cached_entry_map) {
+      if (d->pinned_entry_map.count(p.first) != 0U) {
+        continue;
+      }
+
+      if (!p.second.has_entry_file &&
+          p.second.last_use_time > orphan_time_limit) {
+        continue;
+      }
+
+      cached_entry_list.push_back(std::move(p));
+    }
+  }
+
+  std::sort(cached_entry_list.begin(), cached_entry_list.end(),
+            [](const std::pair<std::string, CachedEntry> &lhs,
+               const std::pair<std::string, CachedEntry> &rhs) -> bool {
+              return lhs.second.last_use_time < rhs.second.last_use_time;
+            });
+
+  for (const auto &p : cached_entry_list) {
+    if (total_size <= d->size_limit) {
+      break;
+    }
+
+    // The entry file goes first, so that the other processes never find an
+    // entry without its header. A process that has already loaded the
+    // header keeps reading the removed file
+    const auto &cached_entry = p.second;
+    auto file_list = cached_entry.file_list;
+    std::sort(file_list.begin(), file_list.end());
+
+    for (const auto &path : file_list) {
+      stdfs::remove(path, error);
+    }
+
+    total_size -= cached_entry.size;
+    d->eviction_count++;
+    d->evicted_byte_count += cached_entry.size;
+  }
+}
+
+PCHCache::Status PCHCache::create(PCHCacheRef &obj,
+                                  const std::string &cache_directory,
+                                  RemoteCacheRef remote_cache,
+                                  std::uint64_t size_limit) {
+  obj.reset();
+
+  try {
+    auto ptr =
+        new PCHCache(cache_directory, std::move(remote_cache), size_limit);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+PCHCache::~PCHCache() {
+  if (!d->temporary_directory.empty()) {
+    std::error_code error;
+    stdfs::remove_all(d->temporary_directory, error);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->pinned_entry_map_mutex);
+    d->pinned_entry_map.clear();
+  }
+
+  trim();
+}
+
+std::string PCHCache::baseIncludes(const CompilerInstanceSettings &settings,
+                                   const StringList &base_includes) {
+  auto compiler_settings = settings;
+  compiler_settings.precompiled_header.clear();
+
+  return precompiledHeader(compiler_settings,
+                           generateSourceBuffer(StringList(), base_includes));
+}
+
+std::string PCHCache::precompiledHeader(
+    const CompilerInstanceSettings &settings, const std::string &source_buffer,
+    StringList *dependency_list) {
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  // The header this one is chained to is part of the key
+  auto entry_hash = hashCompilerInstanceSettings(settings);
+  entry_hash = updateContentHash(entry_hash, source_buffer);
+
+  if (!settings.precompiled_header.empty()) {
+    ContentHash precompiled_header_hash;
+    if (!hashFileContents(precompiled_header_hash,
+                          settings.precompiled_header)) {
+      return std::string();
+    }
+
+    entry_hash = updateContentHash(entry_hash, precompiled_header_hash);
+  }
+
+  std::shared_ptr<std::mutex> entry_mutex;
+
+  {
+    std::lock_guard<std::mutex> lock(d->entry_mutex_map_mutex);
+
+    auto &mutex = d->entry_mutex_map[entry_hash];
+    if (!mutex) {
+      mutex = std::make_shared<std::mutex>();
+    }
+
+    entry_mutex = mutex;
+  }
+
+  std::lock_guard<std::mutex> entry_lock(*entry_mutex);
+
+  auto entry_name = contentHashToString(entry_hash);
+  auto entry_path = d->cache_directory / entry_name;
+
+  // Pin the entry before looking it up, so that a concurrent trim can't
+  // remove it while it is being used or generated
+  {
+    std::lock_guard<std::mutex> lock(d->pinned_entry_map_mutex);
+    d->pinned_entry_map[entry_name]++;
+  }
+
+  auto L_unpinEntry = [&]() {
+    std::lock_guard<std::mutex> lock(d->pinned_entry_map_mutex);
+
+    auto it = d->pinned_entry_map.find(entry_name);
+    if (it != d->pinned_entry_map.end() && --it->second == 0U) {
+      d->pinned_entry_map.erase(it);
+    }
+  };
+
+  // Headers generated on other machines are fetched from the remote cache,
+  // along with the source buffer saved next to them
+  std::error_code error;
+  if (d->remote_cache && !stdfs::exists(entry_path, error) &&
+      d->remote_cache->fetch(entry_path.string())) {
+    std::string remote_pch_file_name;
+    readCacheEntry(remote_pch_file_name, entry_path);
+
+    if (!remote_pch_file_name.empty() &&
+        remote_pch_file_name.find('/') == std::string::npos) {
+      auto remote_pch_path = d->cache_directory / remote_pch_file_name;
+
+      if (d->remote_cache->fetch(remote_pch_path.string())) {
+        d->remote_cache->fetch(remote_pch_path.string() + ".h");
+      }
+    }
+  }
+
+  // The header file may have been replaced by a concurrent writer
+  std::string previous_pch_file_name;
+  if (readCacheEntry(previous_pch_file_name, entry_path, dependency_list) &&
+      stdfs::exists(d->cache_directory / previous_pch_file_name, error)) {
+    d->hit_count++;
+    addServerCounter(ServerCounter::PCHCacheHits);
+
+    auto pch_path = (d->cache_directory / previous_pch_file_name).string();
+    d->saved_byte_count += stdfs::file_size(pch_path, error);
+
+    // The modification time of the entry file is its last use time
+    stdfs::last_write_time(entry_path, stdfs::file_time_type::clock::now(),
+                           error);
+
+    if (d->remote_cache) {
+      d->remote_cache->touch(entry_path.string());
+      d->remote_cache->touch(pch_path);
+      d->remote_cache->touch(pch_path + ".h");
+    }
+
+    return pch_path;
+  }
+
+  d->miss_count++;
+  addServerCounter(ServerCounter::PCHCacheMisses);
+  recordFlightEvent(FlightEventType::PCHCacheMiss, entry_name);
+
+  if (dependency_list != nullptr) {
+    dependency_list->clear();
+  }
+
+  auto compiler_settings = settings;
+  compiler_settings.stop_at_first_error = false;
+
+  CompilerInstanceRef compiler;
+  auto compiler_status = CompilerInstance::create(compiler, compiler_settings);
+  if (!compiler_status.succeeded()) {
+    L_unpinEntry();
+    return std::string();
+  }
+
+  // Each generation gets its own file name, so that the processes loading
+  // the previous one never see a partial file
+  std::random_device random_device;
+  auto pch_file_name =
+      entry_name + "_" + std::to_string(random_device()) + ".pch";
+
+  auto pch_path = (d->cache_directory / pch_file_name).string();
+
+  StringList pch_dependency_list;
+  compiler_status = compiler->generatePrecompiledHeader(
+      source_buffer, pch_path, &pch_dependency_list);
+
+  if (!compiler_status.succeeded()) {
+    stdfs::remove(pch_path, error);
+    stdfs::remove(pch_path + ".h", error);
+    L_unpinEntry();
+    return std::string();
+  }
+
+  // The source buffer is saved next to the precompiled header, and it is
+  // not a dependency
+  std::stringstream buffer;
+  buffer << kPCHCacheEntryHeader << "\n";
+  buffer << "pch " << pch_file_name << "\n";
+
+  bool entry_valid = true;
+
+  for (const auto &path : pch_dependency_list) {
+    if (path == pch_path + ".h") {
+      continue;
+    }
+
+    if (dependency_list != nullptr) {
+      dependency_list->push_back(path);
+    }
+
+    ContentHash hash;
+    if (!hashFileContents(hash, path)) {
+      // We can't validate this entry later on
+      entry_valid = false;
+      break;
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  if (!entry_valid || !writeFileAtomically(entry_path, buffer.str())) {
+    return pch_path;
+  }
+
+  trim();
+
+  // The entry is queued last, so that it never references a header the
+  // remote cache does not have yet
+  if (d->remote_cache) {
+    d->remote_cache->upload(pch_path);
+    d->remote_cache->upload(pch_path + ".h");
+    d->remote_cache->upload(entry_path.string());
+  }
+
+  if (!previous_pch_file_name.empty() &&
+      previous_pch_file_name.find('/') == std::string::npos) {
+    stdfs::remove(d->cache_directory / previous_pch_file_name, error);
+    stdfs::remove(d->cache_directory / (previous_pch_file_name + ".h"),
+                  error);
+  }
+
+  return pch_path;
+}
+
+std::size_t PCHCache::hitCount() const { return d->hit_count; }
+
+void PCHCache::release(const std::string &pch_path) {
+  auto entry_name = getEntryName(stdfs::path(pch_path).filename().string());
+
+  std::lock_guard<std::mutex> lock(d->pinned_entry_map_mutex);
+
+  auto it = d->pinned_entry_map.find(entry_name);
+  if (it != d->pinned_entry_map.end() && --it->second == 0U) {
+    d->pinned_entry_map.erase(it);
+  }
+}
+
+std::size_t PCHCache::missCount() const { return d->miss_count; }
+
+std::uint64_t PCHCache::savedByteCount() const { return d->saved_byte_count; }
+
+std::size_t PCHCache::evictionCount() const { return d->eviction_count; }
+
+std::uint64_t PCHCache::evictedByteCount() const {
+  return d->evicted_byte_count;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "compilerinstance.h"
+#include "istatus.h"
+#include "remote_cache.h"
+#include "types.h"
+
+#include <cstdint>
+#include <memory>
+
+class PCHCache;
+
+/// A reference to a PCHCache object
+using PCHCacheRef = std::shared_ptr<PCHCache>;
+
+/// The PCHCache persists precompiled headers, such as the ones of the base
+/// includes and of the accepted prefixes. Each entry is keyed on the
+/// compiler settings (profile, language and flags) and on the source
+/// buffer, and records the content hash of every header that clang read; an
+/// entry is only used when none of those files has changed. When a size
+/// limit is set, the least recently used entries are evicted each time a
+/// new one is published; the entries returned to this process are kept
+/// until they are released
+class PCHCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  PCHCache(const std::string &cache_directory, RemoteCacheRef remote_cache,
+           std::uint64_t size_limit);
+
+  /// Removes the least recently used entries until the cache folder fits
+  /// in the size limit
+  void trim();
+
+ public:
+  /// Status code, used with PCHCache::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new PCHCache object. If the cache folder is empty, the
+  /// precompiled headers are saved in a temporary folder, which is removed
+  /// when the object is destroyed. If a remote cache is passed, missing
+  /// headers are downloaded from it, and new ones are uploaded. If the size
+  /// limit (in bytes) is not zero, the cache folder is trimmed to it
+  static Status create(PCHCacheRef &obj, const std::string &cache_directory,
+                       RemoteCacheRef remote_cache = nullptr,
+                       std::uint64_t size_limit = 0U);
+
+  /// Destructor
+  ~PCHCache();
+
+  /// Returns the path of a precompiled header containing the given base
+  /// includes, compiled with the specified settings. The header is generated
+  /// and saved when the cache does not contain a valid entry; an empty string
+  /// is returned if the includes can't be compiled. This method is thread
+  /// safe
+  std::string baseIncludes(const CompilerInstanceSettings &settings,
+                           const StringList &base_includes);
+
+  /// Returns the path of a precompiled header containing the given source
+  /// buffer, compiled with the specified settings (including the
+  /// precompiled header they load, if any). The header is generated when
+  /// the cache does not contain a valid entry; an empty string is returned
+  /// if the buffer can't be compiled. If passed, the dependency list
+  /// receives the files the header has been built from. The entry is not
+  /// evicted until it is released. This method is thread safe
+  std::string precompiledHeader(const CompilerInstanceSettings &settings,
+                                const std::string &source_buffer,
+                                StringList *dependency_list = nullptr);
+
+  /// Allows the entry of the given precompiled header to be evicted again.
+  /// This method is thread safe
+  void release(const std::string &pch_path);
+
+  /// Returns the amount of lookups that have been served from the cache
+  std::size_t hitCount() const;
+
+  /// Returns the amount of lookups that could not be served from the cache
+  std::size_t missCount() const;
+
+  /// Returns the size of the precompiled headers that have been served from
+  /// the cache instead of being generated, in bytes
+  std::uint64_t savedByteCount() const;
+
+  /// Returns the amount of entries that have been evicted
+  std::size_t evictionCount() const;
+
+  /// Returns the size of the entries that have been evicted, in bytes
+  std::uint64_t evictedByteCount() const;
+
+  /// Disable the copy constructor
+  PCHCache(const PCHCache &other) = delete;
+
+  /// Disable the assignment operator
+  PCHCache &operator=(const PCHCache &other) = delete;
+};
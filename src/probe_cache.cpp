@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_cache.h"
+#include "flight_recorder.h"
+#include "output_file.h"
+#include "probe_cache_index.h"
+#include "server_metrics.h"
+#include "std_filesystem.h"
+
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+namespace {
+/// The first line of each cache entry
+const std::string kProbeCacheEntryHeader = "abigen-probe-cache 2";
+}  // namespace
+
+/// Private class data
+struct ProbeCache::PrivateData final {
+  /// The folder containing the cache entries
+  stdfs::path cache_directory;
+
+  /// Hash of the settings that can change the outcome of a probe
+  ContentHash configuration_hash{0U};
+
+  /// If set, the remote cache in front of which the cache folder sits
+  RemoteCacheRef remote_cache;
+
+  /// If set, the file hashes are taken from this index instead of the map
+  FileFingerprintIndexRef fingerprint_index;
+
+  /// The index of the entries in the cache folder, if it could be opened
+  ProbeCacheIndexRef index;
+
+  /// Content hashes for the files that have been read during this run
+  FileHashCache file_hash_cache;
+
+  /// Cache hits
+  std::atomic_size_t hit_count{0U};
+
+  /// Cache misses
+  std::atomic_size_t miss_count{0U};
+};
+
+ProbeCache::ProbeCache(const std::string &cache_directory,
+                       ContentHash configuration_hash,
+                       RemoteCacheRef remote_cache,
+                       FileFingerprintIndexRef fingerprint_index)
+    : d(new PrivateData) {
+  d->cache_directory = stdfs::path(cache_directory) / "probes";
+  d->configuration_hash = configuration_hash;
+  d->remote_cache = std::move(remote_cache);
+  d->fingerprint_index = std::move(fingerprint_index);
+
+  std::error_code error;
+  stdfs::create_directories(d->cache_directory, error);
+  if (error) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the probe cache directory: " +
+                     d->cache_directory.string());
+  }
+
+  openIndex();
+}
+
+void ProbeCache::openIndex() {
+  bool created = false;
+  auto index_status =
+      ProbeCacheIndex::create(d->index, (d->cache_directory / "index").string(),
+                              created);
+
+  if (!index_status.succeeded() || !created) {
+    return;
+  }
+
+  // The entries are named after their hash, and grouped in folders named
+  // after its first two digits; the temporary files are skipped
+  std::error_code error;
+  for (auto folder_it = stdfs::directory_iterator(d->cache_directory, error);
+       !error && folder_it != stdfs::directory_iterator();
+       folder_it.increment(error)) {
+    if (!folder_it->is_directory(error)) {
+      continue;
+    }
+
+    std::error_code entry_error;
+    for (auto entry_it = stdfs::directory_iterator(folder_it->path(),
+                                                   entry_error);
+         !entry_error && entry_it != stdfs::directory_iterator();
+         entry_it.increment(entry_error)) {
+      ContentHash entry_hash;
+      if (contentHashFromString(entry_hash,
+                                entry_it->path().filename().string())) {
+        d->index->insert(entry_hash);
+      }
+    }
+
+    // Entries that could not be listed would be reported as missing
+    if (entry_error) {
+      d->index.reset();
+      return;
+    }
+  }
+
+  if (error) {
+    d->index.reset();
+    return;
+  }
+
+  d->index->markReady();
+}
+
+bool ProbeCache::getFileHash(ContentHash &hash, const std::string &path) {
+  if (d->fingerprint_index) {
+    return d->fingerprint_index->fingerprint(hash, path);
+  }
+
+  return d->file_hash_cache.getFileHash(hash, path);
+}
+
+ContentHash ProbeCache::entryHash(ContentHash prefix_hash,
+                                  const std::string &include_directive) const {
+  auto entry_hash =
+      updateContentHash(kInitialContentHash, d->configuration_hash);
+
+  entry_hash = updateContentHash(entry_hash, prefix_hash);
+  return updateContentHash(entry_hash, include_directive);
+}
+
+std::string ProbeCache::entryPath(ContentHash entry_hash) const {
+  auto entry_name = contentHashToString(entry_hash);
+  auto entry_path =
+      d->cache_directory / entry_name.substr(0U, 2U) / entry_name;
+
+  return entry_path.string();
+}
+
+ProbeCache::Status ProbeCache::create(ProbeCacheRef &obj,
+                                      const std::string &cache_directory,
+                                      ContentHash configuration_hash,
+                                      RemoteCacheRef remote_cache,
+                                      FileFingerprintIndexRef
+                                          fingerprint_index) {
+  obj.reset();
+
+  try {
+    auto ptr = new ProbeCache(cache_directory, configuration_hash,
+                              std::move(remote_cache),
+                              std::move(fingerprint_index));
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ProbeCache::~ProbeCache() {}
+
+ContentHash ProbeCache::hashIncludeList(const StringList &include_list) {
+  return updateContentHash(kInitialContentHash, include_list);
+}
+
+bool ProbeCache::lookup(bool &succeeded, ContentHash prefix_hash,
+                        const std::string &include_directive,
+                        StringList *guarded_file_list) {
+  succeeded = false;
+
+  auto L_miss = [&]() -> bool {
+    d->miss_count++;
+    addServerCounter(ServerCounter::ProbeCacheMisses);
+    recordFlightEvent(FlightEventType::ProbeCacheMiss, include_directive);
+    return false;
+  };
+
+  auto entry_hash = entryHash(prefix_hash, include_directive);
+  auto entry_path = entryPath(entry_hash);
+
+  // The cache folder is only accessed when the index knows the entry
+  std::ifstream entry_file;
+  if (!d->index || d->index->mayContain(entry_hash)) {
+    entry_file.open(entry_path);
+  }
+
+  // Entries computed on other machines are fetched from the remote cache
+  if (!entry_file && d->remote_cache && d->remote_cache->fetch(entry_path)) {
+    entry_file.open(entry_path);
+
+    if (entry_file && d->index) {
+      d->index->insert(entry_hash);
+    }
+  }
+
+  if (!entry_file) {
+    return L_miss();
+  }
+
+  // Make sure this is the entry we are looking for, in case of collisions
+  std::string line;
+  if (!std::getline(entry_file, line) || line != kProbeCacheEntryHeader) {
+    return L_miss();
+  }
+
+  if (!std::getline(entry_file, line) ||
+      line != "prefix " + contentHashToString(prefix_hash)) {
+    return L_miss();
+  }
+
+  if (!std::getline(entry_file, line) ||
+      line != "directive " + include_directive) {
+    return L_miss();
+  }
+
+  bool entry_outcome = false;
+  if (!std::getline(entry_file, line)) {
+    return L_miss();
+  }
+
+  if (line == "outcome 1") {
+    entry_outcome = true;
+  } else if (line != "outcome 0") {
+    return L_miss();
+  }
+
+  // The guarded files come before the dependencies
+  const std::string guarded_tag = "guarded ";
+
+  StringList entry_guarded_file_list;
+
+  while (std::getline(entry_file, line)) {
+    if (line.compare(0U, guarded_tag.size(), guarded_tag) == 0) {
+      entry_guarded_file_list.push_back(line.substr(guarded_tag.size()));
+      continue;
+    }
+
+    std::string path;
+    ContentHash expected_hash;
+    if (!parseDependencyLine(path, expected_hash, line)) {
+      return L_miss();
+    }
+
+    ContentHash current_hash;
+    if (!getFileHash(current_hash, path) || current_hash != expected_hash) {
+      return L_miss();
+    }
+  }
+
+  d->hit_count++;
+  addServerCounter(ServerCounter::ProbeCacheHits);
+
+  if (d->remote_cache) {
+    d->remote_cache->touch(entry_path);
+  }
+
+  if (guarded_file_list != nullptr) {
+    *guarded_file_list = std::move(entry_guarded_file_list);
+  }
+
+  succeeded = entry_outcome;
+  return true;
+}
+
+void ProbeCache::store(ContentHash prefix_hash,
+                       const std::string &include_directive, bool succeeded,
+                       const StringList &dependency_list,
+                       const StringList &guarded_file_list) {
+  std::stringstream buffer;
+  buffer << kProbeCacheEntryHeader << "\n";
+  buffer << "prefix " << contentHashToString(prefix_hash) << "\n";
+  buffer << "directive " << include_directive << "\n";
+  buffer << "outcome " << (succeeded ? 1 : 0) << "\n";
+
+  for (const auto &path : guarded_file_list) {
+    buffer << "guarded " << path << "\n";
+  }
+
+  for (const auto &path : dependency_list) {
+    ContentHash hash;
+    if (!getFileHash(hash, path)) {
+      // We can't validate this entry later on
+      return;
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  // Write the entry to a temporary file first, so that concurrent readers
+  // never see a partial entry
+  auto entry_hash = entryHash(prefix_hash, include_directive);
+  stdfs::path entry_path = entryPath(entry_hash);
+
+  std::error_code error;
+  stdfs::create_directories(entry_path.parent_path(), error);
+  if (error) {
+    return;
+  }
+
+  if (!writeFileAtomically(entry_path.string(), buffer.str())) {
+    return;
+  }
+
+  if (d->index) {
+    d->index->insert(entry_hash);
+  }
+
+  if (d->remote_cache) {
+    d->remote_cache->upload(entry_path.string());
+  }
+}
+
+std::size_t ProbeCache::hitCount() const { return d->hit_count; }
+
+std::size_t ProbeCache::missCount() const { return d->miss_count; }
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "file_fingerprints.h"
+#include "istatus.h"
+#include "remote_cache.h"
+#include "types.h"
+
+#include <memory>
+
+class ProbeCache;
+
+/// A reference to a ProbeCache object
+using ProbeCacheRef = std::shared_ptr<ProbeCache>;
+
+/// The ProbeCache persists the outcome of each header probe on disk. Each
+/// entry is keyed on the compiler configuration, the accepted include list
+/// and the probed include directive, and also records the content hash of
+/// every file that clang read; an entry is only used when none of those
+/// files has changed. The files protected by an include guard are listed as
+/// well, so that cached probes report the same included headers. A memory
+/// mapped index of the entries answers most misses without accessing the
+/// cache folder
+class ProbeCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  ProbeCache(const std::string &cache_directory,
+             ContentHash configuration_hash, RemoteCacheRef remote_cache,
+             FileFingerprintIndexRef fingerprint_index);
+
+  /// Returns the content hash of the given file, reusing the previous result
+  /// if the file has already been hashed during this run
+  bool getFileHash(ContentHash &hash, const std::string &path);
+
+  /// Returns the hash identifying the entry for the given probe
+  ContentHash entryHash(ContentHash prefix_hash,
+                        const std::string &include_directive) const;
+
+  /// Returns the path of the entry with the given hash
+  std::string entryPath(ContentHash entry_hash) const;
+
+  /// Opens the entry index, inserting the entries already in the cache
+  /// folder when the index has just been created. The cache works without
+  /// the index if it can't be opened
+  void openIndex();
+
+ public:
+  /// Status code, used with ProbeCache::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new ProbeCache object. The configuration hash should identify
+  /// all the settings that can change the result of a probe. If a remote
+  /// cache is passed, missing entries are downloaded from it, and new ones
+  /// are uploaded. If a fingerprint index is passed, the file hashes are
+  /// taken from it
+  static Status create(ProbeCacheRef &obj, const std::string &cache_directory,
+                       ContentHash configuration_hash,
+                       RemoteCacheRef remote_cache = nullptr,
+                       FileFingerprintIndexRef fingerprint_index = nullptr);
+
+  /// Destructor
+  ~ProbeCache();
+
+  /// Returns the hash of the given include list; used as the prefix hash
+  static ContentHash hashIncludeList(const StringList &include_list);
+
+  /// Looks up the outcome of a probe; returns false if the cache does not
+  /// contain a valid entry. If a guarded file list is passed, it receives
+  /// the guarded files read by the probe. This method is thread safe
+  bool lookup(bool &succeeded, ContentHash prefix_hash,
+              const std::string &include_directive,
+              StringList *guarded_file_list = nullptr);
+
+  /// Saves the outcome of a probe, along with the files it depends on and
+  /// the ones among them that are guarded. This method is thread safe
+  void store(ContentHash prefix_hash, const std::string &include_directive,
+             bool succeeded, const StringList &dependency_list,
+             const StringList &guarded_file_list = StringList());
+
+  /// Returns the amount of lookups that have been served from the cache
+  std::size_t hitCount() const;
+
+  /// Returns the amount of lookups that could not be served from the cache
+  std::size_t missCount() const;
+
+  /// Disable the copy constructor
+  ProbeCache(const ProbeCache &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeCache &operator=(const ProbeCache &other) = delete;
+};
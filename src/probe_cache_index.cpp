@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_cache_index.h"
+
+#include <cerrno>
+#include <cstring>
+#include <random>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace {
+/// The magic string at the start of each index file
+const char kProbeCacheIndexMagic[] = "abigen-probe-index 1";
+
+/// How many slots the table has; the file is sparse, and only the pages
+/// that have been written take disk space
+const std::uint64_t kSlotCount = 1ULL << 22U;
+
+/// How many 64-bit words the Bloom filter has
+const std::uint64_t kBloomWordCount = 1ULL << 20U;
+
+/// How many bits each entry sets in the Bloom filter
+const std::uint64_t kBloomHashCount = 4U;
+
+/// How many slots are visited before the table is considered full
+const std::uint64_t kMaxProbeLength = 32U;
+
+/// The value of the slots that have not been used yet
+const std::uint64_t kEmptySlot = 0U;
+
+/// The header of the index file; the Bloom filter and the table follow it.
+/// The last three fields are updated concurrently, with atomic operations
+struct IndexFileHeader final {
+  /// Contains kProbeCacheIndexMagic
+  char magic[24];
+
+  /// Always kSlotCount
+  std::uint64_t slot_count;
+
+  /// Always kBloomWordCount
+  std::uint64_t bloom_word_count;
+
+  /// How many slots are in use
+  std::uint64_t entry_count;
+
+  /// Not zero once the entries pre-dating the index have been inserted
+  std::uint32_t ready;
+
+  /// Not zero once the table can no longer take new entries
+  std::uint32_t saturated;
+
+  /// Keeps the Bloom filter aligned to a cache line
+  std::uint8_t padding[8];
+};
+
+static_assert(sizeof(IndexFileHeader) == 64U,
+              "The index file header must take a cache line");
+
+/// Returns the size of the index file, in bytes
+constexpr std::uint64_t getIndexFileSize() {
+  return sizeof(IndexFileHeader) + (kBloomWordCount + kSlotCount) * 8U;
+}
+
+/// Mixes the bits of the given hash, so that its low bits can be used as an
+/// index even when the input is not well distributed
+std::uint64_t mixHash(std::uint64_t hash) {
+  hash ^= hash >> 30U;
+  hash *= 0xBF58476D1CE4E5B9ULL;
+  hash ^= hash >> 27U;
+  hash *= 0x94D049BB133111EBULL;
+  hash ^= hash >> 31U;
+  return hash;
+}
+
+/// Returns the Bloom filter bit set by the given hash function of an entry;
+/// double hashing derives all of them from the two halves of the mixed hash
+std::uint64_t getBloomBit(std::uint64_t mixed_hash, std::uint64_t index) {
+  auto first_bit = mixed_hash & 0xFFFFFFFFU;
+  auto bit_stride = (mixed_hash >> 32U) | 1U;
+
+  return (first_bit + index * bit_stride) % (kBloomWordCount * 64U);
+}
+
+/// Returns the value stored in the table for the given entry, which is
+/// never the one of the empty slots
+std::uint64_t getSlotValue(ContentHash entry_hash) {
+  return (entry_hash == kEmptySlot) ? 1U : entry_hash;
+}
+}  // namespace
+
+/// Private class data
+struct ProbeCacheIndex::PrivateData final {
+  /// The mapped index file
+  void *mapping{nullptr};
+
+  /// The header, at the start of the mapping
+  IndexFileHeader *header{nullptr};
+
+  /// The Bloom filter, after the header
+  std::uint64_t *bloom_filter{nullptr};
+
+  /// The table, after the Bloom filter
+  std::uint64_t *slot_list{nullptr};
+};
+
+ProbeCacheIndex::ProbeCacheIndex(const std::string &path, bool &created)
+    : d(new PrivateData) {
+  created = false;
+
+  auto fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+
+  // The new file is initialized under a temporary name, and then linked in
+  // place; this fails if another process has created the index first
+  if (fd == -1 && errno == ENOENT) {
+    std::random_device random_device;
+    auto temp_path = path + ".tmp" + std::to_string(random_device());
+
+    auto temp_fd =
+        open(temp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+
+    if (temp_fd == -1) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to create the probe cache index: " + path);
+    }
+
+    IndexFileHeader header{};
+    std::memcpy(header.magic, kProbeCacheIndexMagic,
+                sizeof(kProbeCacheIndexMagic));
+    header.slot_count = kSlotCount;
+    header.bloom_word_count = kBloomWordCount;
+
+    auto initialized =
+        ftruncate(temp_fd, static_cast<off_t>(getIndexFileSize())) == 0 &&
+        pwrite(temp_fd, &header, sizeof(header), 0) ==
+            static_cast<ssize_t>(sizeof(header));
+
+    if (initialized && link(temp_path.c_str(), path.c_str()) == 0) {
+      created = true;
+    }
+
+    close(temp_fd);
+    unlink(temp_path.c_str());
+
+    fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+  }
+
+  if (fd == -1) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to open the probe cache index: " + path);
+  }
+
+  struct stat file_status {};
+  if (fstat(fd, &file_status) != 0 ||
+      static_cast<std::uint64_t>(file_status.st_size) != getIndexFileSize()) {
+    close(fd);
+    throw Status(false, StatusCode::InvalidIndex,
+                 "The probe cache index has an unexpected size: " + path);
+  }
+
+  d->mapping = mmap(nullptr, getIndexFileSize(), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (d->mapping == MAP_FAILED) {
+    d->mapping = nullptr;
+    throw Status(false, StatusCode::IOError,
+                 "Failed to map the probe cache index: " + path);
+  }
+
+  d->header = static_cast<IndexFileHeader *>(d->mapping);
+  d->bloom_filter = reinterpret_cast<std::uint64_t *>(d->header + 1);
+  d->slot_list = d->bloom_filter + kBloomWordCount;
+
+  if (std::memcmp(d->header->magic, kProbeCacheIndexMagic,
+                  sizeof(kProbeCacheIndexMagic)) != 0 ||
+      d->header->slot_count != kSlotCount ||
+      d->header->bloom_word_count != kBloomWordCount) {
+    munmap(d->mapping, getIndexFileSize());
+    d->mapping = nullptr;
+
+    throw Status(false, StatusCode::InvalidIndex,
+                 "The probe cache index has an unsupported format: " + path);
+  }
+}
+
+ProbeCacheIndex::Status ProbeCacheIndex::create(ProbeCacheIndexRef &obj,
+                                                const std::string &path,
+                                                bool &created) {
+  obj.reset();
+
+  try {
+    auto ptr = new ProbeCacheIndex(path, created);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ProbeCacheIndex::~ProbeCacheIndex() {
+  if (d->mapping != nullptr) {
+    munmap(d->mapping, getIndexFileSize());
+  }
+}
+
+void ProbeCacheIndex::markReady() {
+  __atomic_store_n(&d->header->ready, 1U, __ATOMIC_RELEASE);
+}
+
+bool ProbeCacheIndex::mayContain(ContentHash entry_hash) const {
+  if (__atomic_load_n(&d->header->ready, __ATOMIC_ACQUIRE) == 0U ||
+      __atomic_load_n(&d->header->saturated, __ATOMIC_ACQUIRE) != 0U) {
+    return true;
+  }
+
+  auto slot_value = getSlotValue(entry_hash);
+  auto mixed_hash = mixHash(slot_value);
+
+  for (std::uint64_t i = 0U; i < kBloomHashCount; ++i) {
+    auto bit = getBloomBit(mixed_hash, i);
+
+    auto word = __atomic_load_n(&d->bloom_filter[bit / 64U], __ATOMIC_ACQUIRE);
+    if ((word & (1ULL << (bit % 64U))) == 0U) {
+      return false;
+    }
+  }
+
+  for (std::uint64_t i = 0U; i < kMaxProbeLength; ++i) {
+    auto slot_index = (mixed_hash + i) % kSlotCount;
+
+    auto value =
+        __atomic_load_n(&d->slot_list[slot_index], __ATOMIC_ACQUIRE);
+
+    if (value == slot_value) {
+      return true;
+
+    } else if (value == kEmptySlot) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void ProbeCacheIndex::insert(ContentHash entry_hash) {
+  if (__atomic_load_n(&d->header->saturated, __ATOMIC_ACQUIRE) != 0U) {
+    return;
+  }
+
+  auto slot_value = getSlotValue(entry_hash);
+  auto mixed_hash = mixHash(slot_value);
+
+  // The table is considered full when a slot can't be found quickly, or
+  // when three quarters of it are in use
+  bool inserted = false;
+
+  for (std::uint64_t i = 0U; i < kMaxProbeLength; ++i) {
+    auto slot_index = (mixed_hash + i) % kSlotCount;
+
+    auto expected = kEmptySlot;
+    if (__atomic_compare_exchange_n(&d->slot_list[slot_index], &expected,
+                                    slot_value, false, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE)) {
+      auto entry_count = __atomic_add_fetch(&d->header->entry_count, 1U,
+                                            __ATOMIC_ACQ_REL);
+
+      if (entry_count > (kSlotCount / 4U) * 3U) {
+        __atomic_store_n(&d->header->saturated, 1U, __ATOMIC_RELEASE);
+      }
+
+      inserted = true;
+      break;
+    }
+
+    if (expected == slot_value) {
+      inserted = true;
+      break;
+    }
+  }
+
+  if (!inserted) {
+    __atomic_store_n(&d->header->saturated, 1U, __ATOMIC_RELEASE);
+    return;
+  }
+
+  for (std::uint64_t i = 0U; i < kBloomHashCount; ++i) {
+    auto bit = getBloomBit(mixed_hash, i);
+
+    __atomic_fetch_or(&d->bloom_filter[bit / 64U], 1ULL << (bit % 64U),
+                      __ATOMIC_ACQ_REL);
+  }
+}
+
+std::uint64_t ProbeCacheIndex::entryCount() const {
+  return __atomic_load_n(&d->header->entry_count, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "istatus.h"
+
+#include <cstdint>
+#include <memory>
+
+class ProbeCacheIndex;
+
+/// A reference to a ProbeCacheIndex object
+using ProbeCacheIndexRef = std::unique_ptr<ProbeCacheIndex>;
+
+/// The ProbeCacheIndex is a memory mapped file listing the hash of every
+/// entry in a probe cache folder, so that most misses are answered without
+/// touching the folder. The file holds a Bloom filter, followed by an open
+/// addressing table of fixed-size slots; both are updated in place with
+/// atomic operations, and are shared by all the processes using the cache.
+/// The index only ever answers "absent" when it is sure: until it has been
+/// marked as ready, or once the table is full, every hash may be present
+class ProbeCacheIndex final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  ProbeCacheIndex(const std::string &path, bool &created);
+
+ public:
+  /// Status code, used with ProbeCacheIndex::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    IOError,
+    InvalidIndex,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Opens the given index file, creating it when it does not exist; in
+  /// that case, created is set to true, and the caller should insert the
+  /// entries already in the cache folder before calling markReady()
+  static Status create(ProbeCacheIndexRef &obj, const std::string &path,
+                       bool &created);
+
+  /// Destructor
+  ~ProbeCacheIndex();
+
+  /// Marks the index as complete; until then, mayContain() always returns
+  /// true
+  void markReady();
+
+  /// Returns false if the given entry is certainly not in the cache folder.
+  /// This method is thread safe
+  bool mayContain(ContentHash entry_hash) const;
+
+  /// Adds the given entry. This method is thread safe
+  void insert(ContentHash entry_hash);
+
+  /// Returns the amount of entries in the index
+  std::uint64_t entryCount() const;
+
+  /// Disable the copy constructor
+  ProbeCacheIndex(const ProbeCacheIndex &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeCacheIndex &operator=(const ProbeCacheIndex &other) = delete;
+};
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_checkpoint.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <fstream>
+#include <sstream>
+
+namespace {
+/// The first line of each checkpoint
+const std::string kProbeCheckpointHeader = "abigen-checkpoint 1";
+}  // namespace
+
+bool readProbeCheckpoint(ProbeCheckpoint &checkpoint, const std::string &path) {
+  checkpoint = {};
+
+  std::ifstream checkpoint_file(path);
+  if (!checkpoint_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(checkpoint_file, line) || line != kProbeCheckpointHeader) {
+    return false;
+  }
+
+  const std::string settings_tag = "settings ";
+  if (!std::getline(checkpoint_file, line) ||
+      line.compare(0U, settings_tag.size(), settings_tag) != 0 ||
+      !contentHashFromString(checkpoint.configuration_hash,
+                             line.substr(settings_tag.size()))) {
+    return false;
+  }
+
+  // The sweep line holds the header index and the sweep start count
+  const std::string sweep_tag = "sweep ";
+  if (!std::getline(checkpoint_file, line) ||
+      line.compare(0U, sweep_tag.size(), sweep_tag) != 0) {
+    return false;
+  }
+
+  std::stringstream sweep_buffer(line.substr(sweep_tag.size()));
+  if (!(sweep_buffer >> checkpoint.header_index >>
+        checkpoint.sweep_start_count)) {
+    return false;
+  }
+
+  const std::string include_tag = "include ";
+  const std::string header_tag = "header ";
+
+  while (std::getline(checkpoint_file, line)) {
+    if (line.compare(0U, include_tag.size(), include_tag) == 0) {
+      checkpoint.include_list.push_back(line.substr(include_tag.size()));
+
+    } else if (line.compare(0U, header_tag.size(), header_tag) == 0) {
+      checkpoint.header_path_list.push_back(line.substr(header_tag.size()));
+
+    } else {
+      return false;
+    }
+  }
+
+  return checkpoint.sweep_start_count <= checkpoint.include_list.size() &&
+         checkpoint.header_index <= checkpoint.header_path_list.size();
+}
+
+bool writeProbeCheckpoint(const ProbeCheckpoint &checkpoint,
+                          const std::string &path) {
+  std::stringstream buffer;
+  buffer << kProbeCheckpointHeader << "\n";
+  buffer << "settings " << contentHashToString(checkpoint.configuration_hash)
+         << "\n";
+
+  buffer << "sweep " << checkpoint.header_index << " "
+         << checkpoint.sweep_start_count << "\n";
+
+  for (const auto &include_directive : checkpoint.include_list) {
+    buffer << "include " << include_directive << "\n";
+  }
+
+  for (const auto &header_path : checkpoint.header_path_list) {
+    buffer << "header " << header_path << "\n";
+  }
+
+  return writeFileAtomically(path, buffer.str());
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "content_hash.h"
+#include "types.h"
+
+/// The state of the header probing, saved periodically by the generate
+/// command so that an interrupted run can be resumed
+struct ProbeCheckpoint final {
+  /// The hash of the settings and of the candidate headers of the run; a
+  /// checkpoint is only resumed by an identical run
+  ContentHash configuration_hash{0U};
+
+  /// The position of the next header to probe in the current sweep
+  std::size_t header_index{0U};
+
+  /// How many headers had been accepted when the current sweep started
+  std::size_t sweep_start_count{0U};
+
+  /// The accepted include directives, in order
+  StringList include_list;
+
+  /// The path of each header that is still pending, in order
+  StringList header_path_list;
+};
+
+/// Reads the given checkpoint; returns false if it is missing or malformed
+bool readProbeCheckpoint(ProbeCheckpoint &checkpoint, const std::string &path);
+
+/// Saves the given checkpoint, replacing the previous one atomically
+bool writeProbeCheckpoint(const ProbeCheckpoint &checkpoint,
+                          const std::string &path);
@@ -0,0 +1,1949 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_executor.h"
+#include "generate_utils.h"
+#include "flight_recorder.h"
+#include "remote_probes.h"
+#include "sample_profiler.h"
+#include "server_metrics.h"
+#include "std_filesystem.h"
+#include "task_executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+/// Returns the amount of folders in the prefix of the given include
+/// directive; the bare header name has depth zero
+std::size_t getPrefixDepth(const std::string &include_directive) {
+  stdfs::path path(include_directive);
+
+  auto component_count =
+      static_cast<std::size_t>(std::distance(path.begin(), path.end()));
+
+  return component_count > 0U ? component_count - 1U : 0U;
+}
+
+/// Returns the folder containing the given header; it is used as the key
+/// for the learned prefix depths
+std::string getHeaderFolder(const HeaderDescriptor &header_descriptor) {
+  return stdfs::path(header_descriptor.path).parent_path().string();
+}
+
+/// Returns how likely it is for an error of the given kind to go away once
+/// more headers have been accepted
+int getErrorKindRecoverability(CompilationErrorKind kind) {
+  switch (kind) {
+    case CompilationErrorKind::None:
+    case CompilationErrorKind::Unknown:
+    case CompilationErrorKind::ErrorDirective:
+      return 3;
+
+    case CompilationErrorKind::UndeclaredIdentifier:
+      return 2;
+
+    case CompilationErrorKind::MissingFile:
+    case CompilationErrorKind::Redefinition:
+    case CompilationErrorKind::Timeout:
+      return 1;
+
+    case CompilationErrorKind::MissingIncludeDirective:
+      return 0;
+  }
+
+  return 3;
+}
+
+/// Merges the error cause of an include directive into the one of the whole
+/// probe, keeping the most recoverable one
+void mergeErrorCause(CompilationErrorCause &probe_error_cause,
+                     CompilationErrorCause error_cause) {
+  // Failures without diagnostics (or replayed from the cache) can't be
+  // classified
+  if (error_cause.kind == CompilationErrorKind::None) {
+    error_cause.kind = CompilationErrorKind::Unknown;
+  }
+
+  if (probe_error_cause.kind == CompilationErrorKind::None) {
+    probe_error_cause = std::move(error_cause);
+    return;
+  }
+
+  auto current_recoverability =
+      getErrorKindRecoverability(probe_error_cause.kind);
+  auto recoverability = getErrorKindRecoverability(error_cause.kind);
+
+  if (recoverability > current_recoverability) {
+    probe_error_cause = std::move(error_cause);
+
+  } else if (recoverability == current_recoverability &&
+             error_cause.kind == CompilationErrorKind::UndeclaredIdentifier &&
+             probe_error_cause.name != error_cause.name) {
+    // Waiting on more than one identifier is not supported
+    probe_error_cause.kind = CompilationErrorKind::Unknown;
+    probe_error_cause.name.clear();
+  }
+}
+
+/// Returns the name under which the given failure kind is recorded by the
+/// probe cost model
+std::string getFailureClassName(CompilationErrorKind kind) {
+  switch (kind) {
+    case CompilationErrorKind::MissingIncludeDirective:
+      return "missing-directive";
+
+    case CompilationErrorKind::MissingFile:
+      return "missing-file";
+
+    case CompilationErrorKind::Redefinition:
+      return "redefinition";
+
+    case CompilationErrorKind::ErrorDirective:
+      return "error-directive";
+
+    case CompilationErrorKind::UndeclaredIdentifier:
+      return "undeclared-identifier";
+
+    case CompilationErrorKind::Timeout:
+      return "timeout";
+
+    case CompilationErrorKind::None:
+    case CompilationErrorKind::Unknown:
+      break;
+  }
+
+  return "unknown";
+}
+
+/// The source buffer of a worker: a copy of the active source prefix,
+/// followed by the include directives being probed
+struct WorkerSourceBuffer final {
+  /// The buffer contents
+  std::string text;
+
+  /// How much of the text is a copy of the active source prefix
+  std::size_t prefix_size{0U};
+
+  /// The generation of the active source prefix that has been copied
+  std::size_t prefix_generation{0U};
+};
+}  // namespace
+
+bool parseProbeTierList(ProbeTierList &probe_tier_list,
+                        const std::string &definition) {
+  probe_tier_list.clear();
+
+  std::stringstream buffer(definition);
+  std::string tier_name;
+
+  while (std::getline(buffer, tier_name, ',')) {
+    ProbeTier tier;
+    if (tier_name == "preprocess") {
+      tier = ProbeTier::Preprocess;
+    } else if (tier_name == "parse") {
+      tier = ProbeTier::Parse;
+    } else {
+      return false;
+    }
+
+    if (std::find(probe_tier_list.begin(), probe_tier_list.end(), tier) !=
+        probe_tier_list.end()) {
+      return false;
+    }
+
+    probe_tier_list.push_back(tier);
+  }
+
+  return !probe_tier_list.empty();
+}
+
+/// Private class data
+struct ProbeExecutor::PrivateData final {
+  /// Executor settings
+  ProbeExecutorSettings settings;
+
+  /// One compiler instance for each worker
+  std::vector<CompilerInstanceRef> compiler_list;
+
+  /// The compiler instance used by attributeIncludeList(); it recovers from
+  /// fatal errors, and it is only created when needed
+  CompilerInstanceRef attribution_compiler;
+
+  /// The include list used by the current probe() call
+  StringList active_include_headers;
+
+  /// The source text of the base includes and of the active include list.
+  /// It is extended in place while the include list only grows, and
+  /// rebuilt otherwise
+  std::string active_source_prefix;
+
+  /// Incremented each time the active source prefix is rebuilt
+  std::size_t source_prefix_generation{0U};
+
+  /// One source buffer for each worker; a probe only appends the prefix
+  /// text accepted since the previous one, along with its own directives,
+  /// so the buffers stop allocating once their capacity has grown
+  std::vector<WorkerSourceBuffer> worker_source_buffer_list;
+
+  /// The folder where the precompiled prefixes are stored
+  stdfs::path work_directory;
+
+  /// Protects the precompiled prefix state
+  std::mutex precompiled_prefix_mutex;
+
+  /// The current precompiled prefix, when it comes from the PCH cache
+  std::string cached_prefix_path;
+
+  /// The include list compiled in the current precompiled prefix
+  StringList precompiled_include_headers;
+
+  /// The files read while generating the precompiled prefix
+  StringList precompiled_prefix_dependencies;
+
+  /// True if the precompiled prefix has been generated for the current
+  /// include list
+  bool precompiled_prefix_ready{false};
+
+  /// True if the current precompiled prefix can be used
+  bool precompiled_prefix_valid{false};
+
+  /// Incremented each time a new precompiled prefix is generated
+  std::size_t precompiled_prefix_generation{0U};
+
+  /// The folders searched by clang for angled include directives
+  StringList header_search_paths;
+
+  /// Protects the resolved directive map and the learned prefix depths
+  std::mutex include_directive_mutex;
+
+  /// The include directives that resolve to each header, keyed on the header
+  /// path
+  std::unordered_map<std::string, StringList> resolved_directive_map;
+
+  /// The prefix depth of the last directive accepted in each folder
+  std::unordered_map<std::string, std::size_t> learned_prefix_depth_map;
+
+  /// Directives that have been discarded without compiling them
+  std::atomic_size_t discarded_directive_count{0U};
+
+  /// Protects the quarantined header set
+  std::mutex quarantine_mutex;
+
+  /// The headers whose probe exceeded the time budget or took down an
+  /// isolated worker, keyed on the path
+  std::unordered_set<std::string> quarantined_header_set;
+
+  /// How many times an isolated worker has been lost while probing
+  std::atomic_size_t isolated_worker_crash_count{0U};
+
+  /// When the probing time budget runs out, if there is one
+  std::chrono::steady_clock::time_point probing_deadline;
+
+  /// Protects the unprobed header set
+  std::mutex unprobed_header_mutex;
+
+  /// The headers rejected after the probing time budget ran out, keyed on
+  /// the path
+  std::unordered_set<std::string> unprobed_header_set;
+
+  /// Serializes the diagnostics printed by the workers
+  std::mutex diagnostic_output_mutex;
+
+  /// Keeps the local workers within the memory budget, if any
+  std::unique_ptr<ProbeAdmissionController> admission_controller;
+
+  /// The translation unit of the last accepted probe, when retained
+  ParsedTranslationUnitRef parsed_unit;
+};
+
+ProbeExecutor::ProbeExecutor(const ProbeExecutorSettings &settings)
+    : d(new PrivateData) {
+  if (settings.worker_count == 0U) {
+    throw Status(false, StatusCode::InvalidWorkerCount,
+                 "The worker count must be greater than zero");
+  }
+
+  if (settings.probe_tier_list.empty()) {
+    throw Status(false, StatusCode::InvalidProbeTierList,
+                 "At least one probe tier must be selected");
+  }
+
+  d->settings = settings;
+  if (settings.probing_time_budget != 0U) {
+    d->probing_deadline =
+        std::chrono::steady_clock::now() +
+        std::chrono::seconds(settings.probing_time_budget);
+  }
+
+  if (!d->settings.probe_cost_model) {
+    d->settings.probe_cost_model = std::make_shared<ProbeCostModel>();
+  }
+
+  for (std::size_t i = 0U; i < settings.worker_count; ++i) {
+    CompilerInstanceRef compiler;
+    auto compiler_status =
+        CompilerInstance::create(compiler, settings.compiler_settings);
+    if (!compiler_status.succeeded()) {
+      throw Status(false, StatusCode::CompilerInstanceError,
+                   compiler_status.toString());
+    }
+
+    d->compiler_list.push_back(std::move(compiler));
+  }
+
+  const auto &tier_list = settings.probe_tier_list;
+  if (settings.probe_cache || settings.use_precompiled_prefix ||
+      settings.probe_recorder || !settings.remote_worker_list.empty() ||
+      settings.track_included_headers || settings.classify_failures ||
+      std::find(tier_list.begin(), tier_list.end(), ProbeTier::Parse) ==
+          tier_list.end()) {
+    d->settings.fork_probes = false;
+  }
+
+  // The executor threads started by the earlier stages would rule out the
+  // forked probes; they are started again by the next parallel stage
+  if (d->settings.fork_probes &&
+      (!stopTaskExecutor() || !CompilerInstance::canForkProcess())) {
+    d->settings.fork_probes = false;
+  }
+
+  d->worker_source_buffer_list.resize(settings.worker_count);
+  d->active_source_prefix =
+      generateSourceBuffer(StringList(), settings.base_includes);
+
+  if (settings.resolve_include_directives) {
+    d->header_search_paths = getHeaderSearchPaths(settings.compiler_settings);
+  }
+
+  // The memory budget only matters when more than one probe can run at the
+  // same time; the control group limit applies even when no budget is set
+  if (settings.worker_count > 1U) {
+    auto memory_budget = settings.memory_budget;
+
+    std::uint64_t memory_limit;
+    if (getControlGroupMemoryLimit(memory_limit) &&
+        (memory_budget == 0U || memory_limit < memory_budget)) {
+      memory_budget = memory_limit;
+    }
+
+    if (memory_budget != 0U) {
+      d->admission_controller.reset(
+          new ProbeAdmissionController(memory_budget));
+    }
+  }
+
+  if (settings.use_precompiled_prefix) {
+    std::random_device random_device;
+
+    std::error_code error;
+    d->work_directory = stdfs::temp_directory_path(error) /
+                        ("abigen-" + std::to_string(random_device()));
+
+    if (error || !stdfs::create_directories(d->work_directory, error)) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to create the working directory for the "
+                   "precompiled headers");
+    }
+  }
+}
+
+void ProbeExecutor::ensurePrecompiledPrefix(std::size_t worker_index) {
+  std::lock_guard<std::mutex> lock(d->precompiled_prefix_mutex);
+
+  if (d->precompiled_prefix_ready) {
+    return;
+  }
+
+  d->precompiled_prefix_ready = true;
+
+  auto previous_precompiled_header =
+      d->work_directory /
+      ("prefix_" + std::to_string(d->precompiled_prefix_generation) + ".pch");
+
+  d->precompiled_prefix_generation++;
+  d->precompiled_include_headers = d->active_include_headers;
+
+  auto precompiled_header =
+      d->work_directory /
+      ("prefix_" + std::to_string(d->precompiled_prefix_generation) + ".pch");
+
+  Stopwatch prefix_stopwatch;
+  bool prefix_generated{false};
+
+  // Prefixes that a previous run has already accepted are loaded from the
+  // cache; the previous one is released so that it can be evicted
+  if (d->settings.pch_cache) {
+    auto cached_header = d->settings.pch_cache->precompiledHeader(
+        d->settings.compiler_settings, d->active_source_prefix,
+        &d->precompiled_prefix_dependencies);
+
+    if (!d->cached_prefix_path.empty()) {
+      d->settings.pch_cache->release(d->cached_prefix_path);
+    }
+
+    d->cached_prefix_path = cached_header;
+
+    prefix_generated = !cached_header.empty();
+    if (prefix_generated) {
+      precompiled_header = cached_header;
+    }
+
+  } else {
+    auto &compiler = d->compiler_list.at(worker_index);
+
+    prefix_generated = compiler
+                           ->generatePrecompiledHeader(
+                               d->active_source_prefix,
+                               precompiled_header.string(),
+                               &d->precompiled_prefix_dependencies)
+                           .succeeded();
+  }
+
+  if (d->settings.time_report) {
+    TraceSpan trace_span;
+    trace_span.name = "generatePrecompiledHeader";
+    trace_span.category = "probe";
+    trace_span.start_time = prefix_stopwatch.startTime();
+    trace_span.duration = prefix_stopwatch.elapsed().wall_time;
+    trace_span.argument_map = {
+        {"headers", std::to_string(d->active_include_headers.size())},
+        {"outcome", prefix_generated ? "succeeded" : "failed"}};
+
+    d->settings.time_report->addSpan(std::move(trace_span));
+  }
+
+  // Fall back to full source buffers if the prefix can't be precompiled
+  d->precompiled_prefix_valid = prefix_generated;
+
+  // The prefix file lives in our temporary folder, and it is rebuilt from
+  // the include list; do not track it as a dependency
+  auto prefix_file_path = precompiled_header.string() + ".h";
+  d->precompiled_prefix_dependencies.erase(
+      std::remove(d->precompiled_prefix_dependencies.begin(),
+                  d->precompiled_prefix_dependencies.end(), prefix_file_path),
+      d->precompiled_prefix_dependencies.end());
+
+  for (auto &worker_compiler : d->compiler_list) {
+    worker_compiler->setPrecompiledHeader(
+        d->precompiled_prefix_valid ? precompiled_header.string() : "");
+  }
+
+  std::error_code error;
+  stdfs::remove(previous_precompiled_header, error);
+  stdfs::remove(previous_precompiled_header.string() + ".h", error);
+}
+
+bool ProbeExecutor::compile(std::size_t worker_index,
+                            const StringList &include_directive_list,
+                            ContentHash prefix_hash,
+                            StringList *guarded_file_list,
+                            StringList *read_file_list,
+                            CompilationErrorCause *error_cause,
+                            bool *timed_out, std::uint64_t *memory_usage,
+                            ParsedTranslationUnitRef *parsed_unit,
+                            const std::atomic_bool *cancellation_flag,
+                            bool *cancelled) {
+  if (parsed_unit != nullptr) {
+    parsed_unit->reset();
+  }
+
+  if (cancelled != nullptr) {
+    *cancelled = false;
+  }
+
+  if (this->cancelled()) {
+    if (cancelled != nullptr) {
+      *cancelled = true;
+    }
+
+    return false;
+  }
+
+  if (d->settings.use_precompiled_prefix) {
+    ensurePrecompiledPrefix(worker_index);
+  }
+
+  // When the precompiled prefix is available, only the new headers have to
+  // be parsed. Otherwise the worker buffer copies the part of the active
+  // source prefix it is missing, and the directives follow it; the buffer is
+  // handed to clang without being copied
+  std::string prefix_source_buffer;
+  auto &worker_source_buffer = d->worker_source_buffer_list.at(worker_index);
+
+  auto use_precompiled_prefix = d->precompiled_prefix_valid;
+  if (use_precompiled_prefix) {
+    prefix_source_buffer = generateSourceBuffer(include_directive_list, {});
+
+  } else {
+    auto &text = worker_source_buffer.text;
+
+    if (worker_source_buffer.prefix_generation !=
+        d->source_prefix_generation) {
+      text.assign(d->active_source_prefix);
+      worker_source_buffer.prefix_generation = d->source_prefix_generation;
+
+    } else {
+      text.resize(worker_source_buffer.prefix_size);
+      text.append(d->active_source_prefix, worker_source_buffer.prefix_size,
+                  std::string::npos);
+    }
+
+    worker_source_buffer.prefix_size = d->active_source_prefix.size();
+
+    for (const auto &include_directive : include_directive_list) {
+      appendIncludeDirective(text, include_directive);
+    }
+  }
+
+  const auto &source_buffer = use_precompiled_prefix
+                                  ? prefix_source_buffer
+                                  : worker_source_buffer.text;
+
+  auto &compiler = d->compiler_list.at(worker_index);
+  auto &probe_cache = d->settings.probe_cache;
+
+  // The profiler samples and the flight recorder events are tagged with the
+  // candidate, which is the last directive of the list
+  const std::string candidate = include_directive_list.empty()
+                                    ? std::string()
+                                    : include_directive_list.back();
+
+  ScopedSampleTag sample_tag(SampleTag::Header, candidate);
+  ScopedFlightEvent flight_event(FlightEventType::ProbeStarted, candidate);
+
+  // The clock starts after the precompiled prefix has been generated, so
+  // that its cost is not charged to a single probe
+  Stopwatch probe_stopwatch(CPUTimeScope::Thread);
+  double parse_time = 0.0;
+
+  // Cheaper tiers come first, so most of the bad candidates are rejected
+  // without building the AST
+  bool succeeded = true;
+  bool compilation_timed_out = false;
+  bool compilation_cancelled = false;
+  std::uint64_t peak_memory_usage = 0U;
+  FrontendStatistics frontend_statistics;
+  StringList dependency_list;
+  StringList guarded_dependency_list;
+
+  auto track_guarded_files = probe_cache || guarded_file_list != nullptr;
+
+  compiler->setCancellationFlag(cancellation_flag);
+
+  for (const auto &tier : d->settings.probe_tier_list) {
+    StringList tier_dependency_list;
+    auto tier_dependency_list_ptr = (probe_cache || read_file_list != nullptr)
+                                        ? &tier_dependency_list
+                                        : nullptr;
+
+    StringList tier_guarded_file_list;
+    auto tier_guarded_file_list_ptr =
+        track_guarded_files ? &tier_guarded_file_list : nullptr;
+
+    Stopwatch tier_stopwatch;
+
+    CompilerInstance::Status compiler_status;
+    if (tier == ProbeTier::Preprocess) {
+      compiler_status = compiler->preprocess(
+          source_buffer, tier_dependency_list_ptr, tier_guarded_file_list_ptr,
+          error_cause);
+    } else {
+      compiler_status = compiler->processAST(
+          source_buffer, IASTVisitorRef(), tier_dependency_list_ptr,
+          tier_guarded_file_list_ptr, error_cause, parsed_unit);
+    }
+
+    auto tier_time = tier_stopwatch.elapsed().wall_time;
+    if (tier == ProbeTier::Parse) {
+      parse_time = tier_time;
+    }
+
+    peak_memory_usage = std::max<std::uint64_t>(
+        peak_memory_usage, compiler->frontendMemoryUsage());
+
+    const auto &tier_statistics = compiler->frontendStatistics();
+    frontend_statistics += tier_statistics;
+
+    if (d->settings.verbose_diagnostics &&
+        !compiler_status.message().empty()) {
+      std::lock_guard<std::mutex> lock(d->diagnostic_output_mutex);
+
+      std::cerr << "Diagnostics for " << cacheKey(include_directive_list)
+                << " ("
+                << (compiler_status.succeeded() ? "accepted" : "rejected")
+                << ")\n\n"
+                << compiler_status.message() << "\n";
+    }
+
+    if (d->settings.time_report) {
+      TraceSpan trace_span;
+      trace_span.name =
+          (tier == ProbeTier::Preprocess) ? "preprocess" : "processAST";
+      trace_span.category = "probe";
+      trace_span.start_time = tier_stopwatch.startTime();
+      trace_span.duration = tier_time;
+      trace_span.argument_map = {
+          {"directive", cacheKey(include_directive_list)},
+          {"outcome", compiler_status.succeeded() ? "accepted" : "rejected"},
+          {"source_bytes", std::to_string(tier_statistics.source_bytes)},
+          {"tokens", std::to_string(tier_statistics.token_count)},
+          {"declarations", std::to_string(tier_statistics.declaration_count)},
+          {"template_instantiations",
+           std::to_string(tier_statistics.template_instantiation_count)}};
+
+      d->settings.time_report->addSpan(std::move(trace_span));
+    }
+
+    // Keep the lists from the last tier that ran; it is the one that
+    // decided the outcome
+    dependency_list = std::move(tier_dependency_list);
+    guarded_dependency_list = std::move(tier_guarded_file_list);
+
+    if (!compiler_status.succeeded()) {
+      succeeded = false;
+      compilation_timed_out =
+          compiler_status.statusCode() ==
+          CompilerInstance::StatusCode::CompilationTimeout;
+
+      compilation_cancelled =
+          compiler_status.statusCode() ==
+          CompilerInstance::StatusCode::CompilationCancelled;
+
+      break;
+    }
+  }
+
+  compiler->setCancellationFlag(nullptr);
+
+  if (compilation_cancelled) {
+    if (cancelled != nullptr) {
+      *cancelled = true;
+    }
+
+    if (parsed_unit != nullptr) {
+      parsed_unit->reset();
+    }
+
+    return false;
+  }
+
+  if (d->settings.time_report) {
+    ProbeTiming probe_timing;
+    probe_timing.include_directive = cacheKey(include_directive_list);
+    probe_timing.succeeded = succeeded;
+    probe_timing.total_time = probe_stopwatch.elapsed();
+    probe_timing.parse_time = parse_time;
+    probe_timing.frontend_statistics = frontend_statistics;
+
+    d->settings.time_report->addProbe(std::move(probe_timing));
+  }
+
+  if (d->settings.probe_recorder) {
+    d->settings.probe_recorder->recordProbe(
+        d->active_include_headers, include_directive_list, succeeded,
+        compilation_timed_out, false, probe_stopwatch.elapsed().wall_time);
+  }
+
+  if (read_file_list != nullptr) {
+    *read_file_list = dependency_list;
+  }
+
+  if (timed_out != nullptr) {
+    *timed_out = compilation_timed_out;
+  }
+
+  if (memory_usage != nullptr) {
+    *memory_usage = peak_memory_usage;
+  }
+
+  // The outcome of a timed out probe depends on the machine load
+  if (probe_cache && !compilation_timed_out) {
+    if (d->precompiled_prefix_valid) {
+      dependency_list.insert(dependency_list.end(),
+                             d->precompiled_prefix_dependencies.begin(),
+                             d->precompiled_prefix_dependencies.end());
+    }
+
+    // The guarded files are only needed for accepted probes
+    probe_cache->store(prefix_hash, cacheKey(include_directive_list),
+                       succeeded, dependency_list,
+                       succeeded ? guarded_dependency_list : StringList());
+  }
+
+  if (guarded_file_list != nullptr) {
+    *guarded_file_list = std::move(guarded_dependency_list);
+  }
+
+  return succeeded;
+}
+
+ProbeResultList ProbeExecutor::runForkedProbes(
+    const ProbeRequestList &request_list,
+    const std::vector<StringList> &include_directive_lists) {
+  ProbeResultList result_list(request_list.size());
+
+  // Every include directive is tried at once, instead of stopping at the
+  // first accepted one; the children are cheap compared to the prefix
+  StringList include_directive_list;
+  std::vector<std::size_t> request_index_list;
+
+  for (std::size_t i = 0U; i < request_list.size(); ++i) {
+    if (isQuarantined(*request_list[i])) {
+      continue;
+    }
+
+    for (const auto &include_directive : include_directive_lists[i]) {
+      include_directive_list.push_back(include_directive);
+      request_index_list.push_back(i);
+    }
+  }
+
+  if (include_directive_list.empty()) {
+    return result_list;
+  }
+
+  if (timeBudgetExhausted()) {
+    std::lock_guard<std::mutex> lock(d->unprobed_header_mutex);
+
+    for (auto request_index : request_index_list) {
+      d->unprobed_header_set.insert(request_list[request_index]->path);
+    }
+
+    return result_list;
+  }
+
+  auto &compiler = d->compiler_list.front();
+
+  Stopwatch fork_stopwatch;
+  std::vector<bool> accepted_list;
+  auto compiler_status = compiler->forkProcessAST(
+      d->active_source_prefix, include_directive_list,
+      d->compiler_list.size(), accepted_list);
+
+  if (d->settings.verbose_diagnostics && !compiler_status.message().empty()) {
+    std::lock_guard<std::mutex> lock(d->diagnostic_output_mutex);
+
+    std::cerr << "Diagnostics for the forked probe prefix ("
+              << (compiler_status.succeeded() ? "accepted" : "rejected")
+              << ")\n\n"
+              << compiler_status.message() << "\n";
+  }
+
+  // The statistic tells whether the probes have really been forked, since
+  // the other threads of the process silently rule them out
+  if (d->settings.time_report &&
+      compiler_status.statusCode() !=
+          CompilerInstance::StatusCode::ProcessCreationError) {
+    d->settings.time_report->addStatistic("Forked probes",
+                                          include_directive_list.size());
+  }
+
+  if (d->settings.time_report) {
+    TraceSpan trace_span;
+    trace_span.name = "forkProcessAST";
+    trace_span.category = "probe";
+    trace_span.start_time = fork_stopwatch.startTime();
+    trace_span.duration = fork_stopwatch.elapsed().wall_time;
+    trace_span.argument_map = {
+        {"directives", std::to_string(include_directive_list.size())},
+        {"accepted", std::to_string(std::count(accepted_list.begin(),
+                                               accepted_list.end(), true))}};
+
+    d->settings.time_report->addSpan(std::move(trace_span));
+  }
+
+  for (std::size_t i = 0U; i < include_directive_list.size(); ++i) {
+    auto &result = result_list[request_index_list[i]];
+    if (!result.succeeded && accepted_list[i]) {
+      result.succeeded = true;
+      result.include_directive = include_directive_list[i];
+    }
+  }
+
+  return result_list;
+}
+
+std::string ProbeExecutor::cacheKey(const StringList &include_directive_list) {
+  // A single directive is its own key
+  std::string key;
+  for (const auto &include_directive : include_directive_list) {
+    if (!key.empty()) {
+      key.push_back('|');
+    }
+
+    key += include_directive;
+  }
+
+  return key;
+}
+
+ContentHash ProbeExecutor::setActiveIncludeHeaders(
+    const StringList &active_include_headers) {
+  // Between two calls, the include list usually gains a few headers; only
+  // their lines are added to the source prefix
+  auto &current_include_headers = d->active_include_headers;
+
+  auto extends_current_list =
+      active_include_headers.size() >= current_include_headers.size() &&
+      std::equal(current_include_headers.begin(),
+                 current_include_headers.end(),
+                 active_include_headers.begin());
+
+  if (extends_current_list) {
+    for (auto i = current_include_headers.size();
+         i < active_include_headers.size(); ++i) {
+      current_include_headers.push_back(active_include_headers[i]);
+      appendIncludeDirective(d->active_source_prefix,
+                             active_include_headers[i]);
+    }
+
+  } else {
+    current_include_headers = active_include_headers;
+    d->active_source_prefix = generateSourceBuffer(current_include_headers,
+                                                   d->settings.base_includes);
+
+    ++d->source_prefix_generation;
+  }
+
+  if (d->settings.use_precompiled_prefix &&
+      d->precompiled_include_headers != d->active_include_headers) {
+    d->precompiled_prefix_ready = false;
+  }
+
+  ContentHash prefix_hash = 0U;
+  if (d->settings.probe_cache) {
+    prefix_hash = ProbeCache::hashIncludeList(d->active_include_headers);
+  }
+
+  return prefix_hash;
+}
+
+StringList ProbeExecutor::resolveIncludeDirectives(
+    const HeaderDescriptor &header_descriptor) {
+  {
+    std::lock_guard<std::mutex> lock(d->include_directive_mutex);
+
+    auto it = d->resolved_directive_map.find(header_descriptor.path);
+    if (it != d->resolved_directive_map.end()) {
+      return it->second;
+    }
+  }
+
+  StringList resolved_directive_list;
+  std::size_t discarded_directive_count = 0U;
+
+  for (const auto &include_directive :
+       generateIncludeDirectives(header_descriptor)) {
+    // Clang stops at the first folder containing the file, even when it is
+    // not the header we are probing
+    bool resolves_to_header = false;
+
+    for (const auto &search_path : d->header_search_paths) {
+      auto candidate_path = stdfs::path(search_path) / include_directive;
+
+      std::error_code error;
+      if (!stdfs::is_regular_file(candidate_path, error)) {
+        continue;
+      }
+
+      resolves_to_header =
+          stdfs::equivalent(candidate_path, header_descriptor.path, error) &&
+          !error;
+
+      break;
+    }
+
+    if (resolves_to_header) {
+      resolved_directive_list.push_back(include_directive);
+    } else {
+      ++discarded_directive_count;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(d->include_directive_mutex);
+
+  auto insert_status = d->resolved_directive_map.insert(
+      {header_descriptor.path, std::move(resolved_directive_list)});
+
+  if (insert_status.second) {
+    d->discarded_directive_count += discarded_directive_count;
+  }
+
+  return insert_status.first->second;
+}
+
+ProbeResult ProbeExecutor::probe(
+    std::size_t worker_index, const HeaderDescriptor &header_descriptor,
+    ContentHash prefix_hash, const StringList &possible_include_directives,
+    ParsedTranslationUnitRef *parsed_unit) {
+  const auto &event_stream = d->settings.event_stream;
+
+  if (event_stream) {
+    event_stream->emit("probe_started",
+                       {{"header", header_descriptor.path},
+                        {"worker", static_cast<double>(worker_index)}});
+  }
+
+  if (isQuarantined(header_descriptor)) {
+    ProbeResult result;
+    if (d->settings.classify_failures) {
+      result.failure_cause.kind = CompilationErrorKind::Timeout;
+    }
+
+    if (event_stream) {
+      event_stream->emit("probe_finished",
+                         {{"header", header_descriptor.path},
+                          {"worker", static_cast<double>(worker_index)},
+                          {"outcome", std::string("quarantined")},
+                          {"duration", 0.0},
+                          {"compiled", false}});
+    }
+
+    return result;
+  }
+
+  addServerCounter(ServerCounter::HeaderProbes);
+
+  // The directives are tried in order, until one of them settles the probe
+  Stopwatch probe_stopwatch;
+  DirectiveOutcomeList outcome_list;
+
+  for (const auto &include_directive : possible_include_directives) {
+    outcome_list.emplace_back();
+    auto &outcome = outcome_list.back();
+
+    probeDirective(outcome, worker_index, prefix_hash, include_directive,
+                   parsed_unit != nullptr);
+
+    if (outcome.succeeded || outcome.timed_out || outcome.unprobed) {
+      break;
+    }
+  }
+
+  return settleProbe(worker_index, header_descriptor,
+                     possible_include_directives, outcome_list,
+                     probe_stopwatch.elapsed().wall_time, parsed_unit);
+}
+
+void ProbeExecutor::probeDirective(DirectiveOutcome &outcome,
+                                   std::size_t worker_index,
+                                   ContentHash prefix_hash,
+                                   const std::string &include_directive,
+                                   bool retain_parsed_unit,
+                                   const std::atomic_bool *cancellation_flag) {
+  outcome = DirectiveOutcome();
+
+  auto &probe_cache = d->settings.probe_cache;
+  const auto classify_failures = d->settings.classify_failures;
+
+  auto included_header_list_ptr = d->settings.track_included_headers
+                                      ? &outcome.included_header_list
+                                      : nullptr;
+
+  if (probe_cache &&
+      probe_cache->lookup(outcome.succeeded, prefix_hash, include_directive,
+                          included_header_list_ptr)) {
+    if (d->settings.probe_recorder) {
+      d->settings.probe_recorder->recordProbe(d->active_include_headers,
+                                              {include_directive},
+                                              outcome.succeeded, false, true,
+                                              0.0);
+    }
+
+    return;
+  }
+
+  // Once the time budget has run out, only the cache can answer
+  if (timeBudgetExhausted()) {
+    outcome.unprobed = true;
+    return;
+  }
+
+  Stopwatch directive_stopwatch;
+
+  outcome.succeeded = compile(
+      worker_index, {include_directive}, prefix_hash, included_header_list_ptr,
+      classify_failures ? &outcome.read_file_list : nullptr,
+      classify_failures ? &outcome.error_cause : nullptr, &outcome.timed_out,
+      &outcome.memory_usage,
+      retain_parsed_unit ? &outcome.parsed_unit : nullptr, cancellation_flag,
+      &outcome.cancelled);
+
+  outcome.compiled = true;
+  outcome.duration = directive_stopwatch.elapsed().wall_time;
+}
+
+ProbeResult ProbeExecutor::settleProbe(
+    std::size_t worker_index, const HeaderDescriptor &header_descriptor,
+    const StringList &possible_include_directives,
+    DirectiveOutcomeList &outcome_list, double probe_time,
+    ParsedTranslationUnitRef *parsed_unit) {
+  ProbeResult result;
+
+  const auto classify_failures = d->settings.classify_failures;
+  const auto &event_stream = d->settings.event_stream;
+
+  if (parsed_unit != nullptr) {
+    parsed_unit->reset();
+  }
+
+  // Only the probes that had to compile something update the cost estimate
+  bool compiled = false;
+  std::uint64_t peak_memory_usage = 0U;
+  bool unprobed = false;
+
+  for (const auto &outcome : outcome_list) {
+    compiled = compiled || outcome.compiled;
+    peak_memory_usage = std::max(peak_memory_usage, outcome.memory_usage);
+  }
+
+  for (std::size_t i = 0U; i < outcome_list.size(); ++i) {
+    auto &outcome = outcome_list[i];
+
+    // Directives are only cancelled once a preferred one has settled the
+    // probe, so this is never reached
+    if (outcome.cancelled) {
+      break;
+    }
+
+    if (outcome.unprobed) {
+      unprobed = true;
+      break;
+    }
+
+    if (outcome.succeeded) {
+      result.succeeded = true;
+      result.include_directive = possible_include_directives[i];
+      result.included_header_list = std::move(outcome.included_header_list);
+      result.read_file_list = std::move(outcome.read_file_list);
+
+      if (parsed_unit != nullptr) {
+        *parsed_unit = std::move(outcome.parsed_unit);
+      }
+
+      break;
+    }
+
+    // The other include directives would most likely stall as well
+    if (outcome.timed_out) {
+      {
+        std::lock_guard<std::mutex> lock(d->quarantine_mutex);
+        d->quarantined_header_set.insert(header_descriptor.path);
+      }
+
+      if (classify_failures) {
+        result.failure_cause = std::move(outcome.error_cause);
+      }
+
+      break;
+    }
+
+    if (classify_failures) {
+      mergeErrorCause(result.failure_cause, std::move(outcome.error_cause));
+    }
+  }
+
+  if (unprobed) {
+    std::lock_guard<std::mutex> lock(d->unprobed_header_mutex);
+    d->unprobed_header_set.insert(header_descriptor.path);
+  }
+
+  if (!result.succeeded) {
+    // The header may still be accepted by another run
+    if (classify_failures && unprobed) {
+      result.failure_cause.kind = CompilationErrorKind::Unknown;
+    }
+
+    // None of the include directives resolves to the header
+    if (classify_failures &&
+        result.failure_cause.kind == CompilationErrorKind::None) {
+      result.failure_cause.kind = CompilationErrorKind::MissingIncludeDirective;
+    }
+
+  } else {
+    result.failure_cause = {};
+  }
+
+  if (compiled) {
+    d->settings.probe_cost_model->update(header_descriptor.path, probe_time);
+
+    d->settings.probe_cost_model->updateMemory(header_descriptor.path,
+                                               peak_memory_usage);
+
+    d->settings.probe_cost_model->recordOutcome(
+        header_descriptor.path, result.succeeded,
+        getFailureClassName(result.failure_cause.kind));
+  }
+
+  if (event_stream) {
+    std::string outcome = result.succeeded ? "accepted" : "rejected";
+    if (unprobed) {
+      outcome = "unprobed";
+    }
+
+    EventFieldList field_list = {
+        {"header", header_descriptor.path},
+        {"worker", static_cast<double>(worker_index)},
+        {"outcome", outcome},
+        {"duration", probe_time},
+        {"compiled", compiled}};
+
+    if (result.succeeded) {
+      field_list.push_back({"include_directive", result.include_directive});
+    }
+
+    event_stream->emit("probe_finished", field_list);
+  }
+
+  return result;
+}
+
+ProbeResultList ProbeExecutor::raceProbes(
+    const ProbeRequestList &request_list,
+    const std::vector<StringList> &include_directive_lists,
+    ContentHash prefix_hash,
+    const std::vector<std::uint64_t> &memory_estimate_list,
+    std::vector<ParsedTranslationUnitRef> &parsed_unit_list) {
+  ProbeResultList result_list(request_list.size());
+
+  auto L_parsedUnit = [&](std::size_t request_index) {
+    return parsed_unit_list.empty() ? nullptr
+                                    : &parsed_unit_list[request_index];
+  };
+
+  // Each task compiles a single include directive; the headers that can't
+  // race (a single directive, or a quarantined header) are probed as a whole
+  // by one task. Taking the tasks in order makes the workers start with the
+  // preferred directives
+  struct RaceTask final {
+    std::size_t request_index{0U};
+    std::size_t directive_index{0U};
+    bool whole_request{false};
+  };
+
+  std::vector<RaceTask> task_list;
+  std::vector<std::size_t> first_task_list(request_list.size(), 0U);
+
+  for (std::size_t i = 0U; i < request_list.size(); ++i) {
+    first_task_list[i] = task_list.size();
+
+    const auto &include_directives = include_directive_lists[i];
+    if (include_directives.size() <= 1U || isQuarantined(*request_list[i])) {
+      task_list.push_back({i, 0U, true});
+      continue;
+    }
+
+    for (std::size_t j = 0U; j < include_directives.size(); ++j) {
+      task_list.push_back({i, j, false});
+    }
+  }
+
+  std::vector<DirectiveOutcomeList> outcome_lists(request_list.size());
+  std::vector<std::size_t> worker_index_list(request_list.size(), 0U);
+  std::vector<double> probe_time_list(request_list.size(), 0.0);
+
+  std::unique_ptr<std::atomic_bool[]> cancellation_flag_list(
+      new std::atomic_bool[task_list.size()]);
+
+  std::unique_ptr<std::atomic_size_t[]> decisive_directive_list(
+      new std::atomic_size_t[request_list.size()]);
+
+  for (std::size_t i = 0U; i < task_list.size(); ++i) {
+    cancellation_flag_list[i] = false;
+  }
+
+  for (std::size_t i = 0U; i < request_list.size(); ++i) {
+    decisive_directive_list[i] = include_directive_lists[i].size();
+
+    if (!task_list[first_task_list[i]].whole_request) {
+      outcome_lists[i].resize(include_directive_lists[i].size());
+    }
+  }
+
+  // The first directive that settles a probe makes the following ones
+  // useless; their compilations are cancelled, and the ones that have not
+  // started yet are skipped
+  auto L_settleDirective = [&](const RaceTask &task) {
+    auto &decisive_directive = decisive_directive_list[task.request_index];
+
+    auto current = decisive_directive.load();
+    while (task.directive_index < current &&
+           !decisive_directive.compare_exchange_weak(current,
+                                                     task.directive_index)) {
+    }
+
+    auto directive_count = include_directive_lists[task.request_index].size();
+    auto first_task = first_task_list[task.request_index];
+
+    for (auto j = task.directive_index + 1U; j < directive_count; ++j) {
+      cancellation_flag_list[first_task + j] = true;
+    }
+  };
+
+  std::mutex stopwatch_mutex;
+  std::atomic_size_t next_task{0U};
+
+  auto L_worker = [&](std::size_t worker_index) {
+    ScopedWorkerPlacement placement(d->settings.worker_placement,
+                                    worker_index);
+
+    for (auto task_index = next_task++; task_index < task_list.size();
+         task_index = next_task++) {
+      const auto &task = task_list[task_index];
+      const auto &request = *request_list[task.request_index];
+
+      std::uint64_t memory_estimate = 0U;
+      if (!memory_estimate_list.empty()) {
+        memory_estimate = memory_estimate_list[task.request_index];
+      }
+
+      if (task.whole_request) {
+        if (d->admission_controller) {
+          d->admission_controller->acquire(memory_estimate);
+        }
+
+        result_list[task.request_index] =
+            probe(worker_index, request, prefix_hash,
+                  include_directive_lists[task.request_index],
+                  L_parsedUnit(task.request_index));
+
+        if (d->admission_controller) {
+          d->admission_controller->release(memory_estimate);
+        }
+
+        continue;
+      }
+
+      auto &outcome = outcome_lists[task.request_index][task.directive_index];
+      if (decisive_directive_list[task.request_index] < task.directive_index) {
+        outcome.cancelled = true;
+        continue;
+      }
+
+      if (task.directive_index == 0U) {
+        worker_index_list[task.request_index] = worker_index;
+        addServerCounter(ServerCounter::HeaderProbes);
+
+        if (d->settings.event_stream) {
+          d->settings.event_stream->emit(
+              "probe_started",
+              {{"header", request.path},
+               {"worker", static_cast<double>(worker_index)}});
+        }
+      }
+
+      if (d->admission_controller) {
+        d->admission_controller->acquire(memory_estimate);
+      }
+
+      probeDirective(
+          outcome, worker_index, prefix_hash,
+          include_directive_lists[task.request_index][task.directive_index],
+          !parsed_unit_list.empty(), &cancellation_flag_list[task_index]);
+
+      if (d->admission_controller) {
+        d->admission_controller->release(memory_estimate);
+      }
+
+      if (!outcome.cancelled &&
+          (outcome.succeeded || outcome.timed_out || outcome.unprobed)) {
+        L_settleDirective(task);
+      }
+
+      std::lock_guard<std::mutex> lock(stopwatch_mutex);
+      probe_time_list[task.request_index] += outcome.duration;
+    }
+  };
+
+  auto thread_count = std::min(d->compiler_list.size(), task_list.size());
+  runTaskLanes(thread_count, TaskPriority::High, L_worker);
+
+  // The outcomes are settled in their preference order, exactly as if the
+  // directives had been compiled one after the other
+  for (std::size_t i = 0U; i < request_list.size(); ++i) {
+    if (task_list[first_task_list[i]].whole_request) {
+      continue;
+    }
+
+    result_list[i] = settleProbe(worker_index_list[i], *request_list[i],
+                                 include_directive_lists[i], outcome_lists[i],
+                                 probe_time_list[i], L_parsedUnit(i));
+  }
+
+  return result_list;
+}
+
+ProbeExecutor::Status ProbeExecutor::create(
+    ProbeExecutorRef &obj, const ProbeExecutorSettings &settings) {
+  obj.reset();
+
+  try {
+    auto ptr = new ProbeExecutor(settings);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ProbeExecutor::~ProbeExecutor() {
+  if (d->settings.pch_cache && !d->cached_prefix_path.empty()) {
+    d->settings.pch_cache->release(d->cached_prefix_path);
+  }
+
+  if (!d->work_directory.empty()) {
+    std::error_code error;
+    stdfs::remove_all(d->work_directory, error);
+  }
+}
+
+std::uint64_t ProbeExecutor::memoryBudget() const {
+  return d->admission_controller ? d->admission_controller->memoryBudget()
+                                 : 0U;
+}
+
+std::size_t ProbeExecutor::delayedProbeCount() const {
+  return d->admission_controller
+             ? d->admission_controller->delayedProbeCount()
+             : 0U;
+}
+
+std::size_t ProbeExecutor::workerCount() const {
+  auto worker_count = d->compiler_list.size();
+
+  for (const auto &remote_worker : d->settings.remote_worker_list) {
+    if (remote_worker->connected()) {
+      worker_count += remote_worker->workerCount();
+    }
+  }
+
+  return worker_count;
+}
+
+StringList ProbeExecutor::includeDirectives(
+    const HeaderDescriptor &header_descriptor) {
+  if (!d->settings.resolve_include_directives) {
+    return generateIncludeDirectives(header_descriptor);
+  }
+
+  auto include_directive_list = resolveIncludeDirectives(header_descriptor);
+
+  std::size_t learned_prefix_depth;
+
+  {
+    std::lock_guard<std::mutex> lock(d->include_directive_mutex);
+
+    auto it =
+        d->learned_prefix_depth_map.find(getHeaderFolder(header_descriptor));
+    if (it == d->learned_prefix_depth_map.end()) {
+      return include_directive_list;
+    }
+
+    learned_prefix_depth = it->second;
+  }
+
+  // Sibling headers are usually included with the same prefix
+  std::stable_partition(
+      include_directive_list.begin(), include_directive_list.end(),
+      [learned_prefix_depth](const std::string &include_directive) -> bool {
+        return getPrefixDepth(include_directive) == learned_prefix_depth;
+      });
+
+  return include_directive_list;
+}
+
+std::size_t ProbeExecutor::discardedDirectiveCount() const {
+  return d->discarded_directive_count;
+}
+
+bool ProbeExecutor::cancelled() const {
+  const auto &cancellation_flag =
+      d->settings.compiler_settings.cancellation_flag;
+
+  return cancellation_flag && cancellation_flag->load();
+}
+
+bool ProbeExecutor::isQuarantined(
+    const HeaderDescriptor &header_descriptor) const {
+  std::lock_guard<std::mutex> lock(d->quarantine_mutex);
+  return d->quarantined_header_set.count(header_descriptor.path) != 0U;
+}
+
+std::size_t ProbeExecutor::quarantinedHeaderCount() const {
+  std::lock_guard<std::mutex> lock(d->quarantine_mutex);
+  return d->quarantined_header_set.size();
+}
+
+std::size_t ProbeExecutor::isolatedWorkerCrashCount() const {
+  return d->isolated_worker_crash_count;
+}
+
+bool ProbeExecutor::timeBudgetExhausted() const {
+  return d->settings.probing_time_budget != 0U &&
+         std::chrono::steady_clock::now() >= d->probing_deadline;
+}
+
+bool ProbeExecutor::isUnprobed(
+    const HeaderDescriptor &header_descriptor) const {
+  std::lock_guard<std::mutex> lock(d->unprobed_header_mutex);
+  return d->unprobed_header_set.count(header_descriptor.path) != 0U;
+}
+
+std::size_t ProbeExecutor::unprobedHeaderCount() const {
+  std::lock_guard<std::mutex> lock(d->unprobed_header_mutex);
+  return d->unprobed_header_set.size();
+}
+
+bool ProbeExecutor::probeIncludeList(
+    const StringList &active_include_headers,
+    const StringList &include_directive_list,
+    StringList *included_header_list) {
+  auto prefix_hash = setActiveIncludeHeaders(active_include_headers);
+
+  auto &probe_cache = d->settings.probe_cache;
+
+  if (!d->settings.track_included_headers) {
+    included_header_list = nullptr;
+  }
+
+  ParsedTranslationUnitRef parsed_unit;
+  auto parsed_unit_ptr =
+      d->settings.retain_parsed_translation_unit ? &parsed_unit : nullptr;
+
+  bool succeeded = false;
+  if (!probe_cache ||
+      !probe_cache->lookup(succeeded, prefix_hash,
+                           cacheKey(include_directive_list),
+                           included_header_list)) {
+    if (timeBudgetExhausted()) {
+      return false;
+    }
+
+    succeeded = compile(0U, include_directive_list, prefix_hash,
+                        included_header_list, nullptr, nullptr, nullptr,
+                        nullptr, parsed_unit_ptr);
+
+  } else if (d->settings.probe_recorder) {
+    d->settings.probe_recorder->recordProbe(d->active_include_headers,
+                                            include_directive_list, succeeded,
+                                            false, true, 0.0);
+  }
+
+  if (!succeeded && included_header_list != nullptr) {
+    included_header_list->clear();
+  }
+
+  if (succeeded && parsed_unit_ptr != nullptr) {
+    d->parsed_unit = std::move(parsed_unit);
+  }
+
+  return succeeded;
+}
+
+bool ProbeExecutor::attributeIncludeList(
+    const StringList &active_include_headers,
+    const StringList &include_directive_list,
+    std::vector<std::size_t> &attributed_directive_list,
+    StringList *included_header_list) {
+  attributed_directive_list.clear();
+  setActiveIncludeHeaders(active_include_headers);
+
+  if (!d->settings.track_included_headers) {
+    included_header_list = nullptr;
+  }
+
+  if (timeBudgetExhausted()) {
+    return false;
+  }
+
+  // The time budget is meant for a single header, not for all of them
+  if (!d->attribution_compiler) {
+    auto compiler_settings = d->settings.compiler_settings;
+    compiler_settings.stop_at_first_error = false;
+    compiler_settings.recover_from_fatal_errors = true;
+    compiler_settings.time_budget = 0U;
+
+    auto compiler_status =
+        CompilerInstance::create(d->attribution_compiler, compiler_settings);
+    if (!compiler_status.succeeded()) {
+      d->attribution_compiler.reset();
+      return false;
+    }
+  }
+
+  // Each include directive sits on its own line, after the base includes
+  // and the active ones
+  auto source_buffer = d->active_source_prefix;
+  for (const auto &include_directive : include_directive_list) {
+    appendIncludeDirective(source_buffer, include_directive);
+  }
+
+  auto first_directive_line =
+      d->settings.base_includes.size() + d->active_include_headers.size() + 1U;
+
+  bool succeeded = true;
+  StringList guarded_file_list;
+
+  Stopwatch attribution_stopwatch;
+
+  for (const auto &tier : d->settings.probe_tier_list) {
+    Stopwatch tier_stopwatch;
+
+    CompilationErrorCause error_cause;
+    StringList tier_guarded_file_list;
+    auto tier_guarded_file_list_ptr =
+        (included_header_list != nullptr) ? &tier_guarded_file_list : nullptr;
+
+    CompilerInstance::Status compiler_status;
+    if (tier == ProbeTier::Preprocess) {
+      compiler_status = d->attribution_compiler->preprocess(
+          source_buffer, nullptr, tier_guarded_file_list_ptr, &error_cause);
+    } else {
+      compiler_status = d->attribution_compiler->processAST(
+          source_buffer, IASTVisitorRef(), nullptr, tier_guarded_file_list_ptr,
+          &error_cause);
+    }
+
+    if (d->settings.verbose_diagnostics &&
+        !compiler_status.message().empty()) {
+      std::lock_guard<std::mutex> lock(d->diagnostic_output_mutex);
+
+      std::cerr << "Diagnostics for " << include_directive_list.size()
+                << " headers compiled at once\n\n"
+                << compiler_status.message() << "\n";
+    }
+
+    if (d->settings.time_report) {
+      TraceSpan trace_span;
+      trace_span.name = (tier == ProbeTier::Preprocess)
+                            ? "attribute (preprocess)"
+                            : "attribute (processAST)";
+      trace_span.category = "probe";
+      trace_span.start_time = tier_stopwatch.startTime();
+      trace_span.duration = tier_stopwatch.elapsed().wall_time;
+      trace_span.argument_map = {
+          {"headers", std::to_string(include_directive_list.size())},
+          {"outcome", compiler_status.succeeded() ? "accepted" : "rejected"}};
+
+      d->settings.time_report->addSpan(std::move(trace_span));
+    }
+
+    guarded_file_list = std::move(tier_guarded_file_list);
+
+    if (!compiler_status.succeeded()) {
+      succeeded = false;
+
+      for (auto line : error_cause.include_line_list) {
+        if (line < first_directive_line) {
+          continue;
+        }
+
+        auto directive_index = line - first_directive_line;
+        if (directive_index < include_directive_list.size()) {
+          attributed_directive_list.push_back(directive_index);
+        }
+      }
+
+      break;
+    }
+  }
+
+  if (d->settings.probe_recorder) {
+    d->settings.probe_recorder->recordAttribution(
+        d->active_include_headers, include_directive_list, succeeded,
+        attributed_directive_list, attribution_stopwatch.elapsed().wall_time);
+  }
+
+  if (included_header_list != nullptr) {
+    *included_header_list =
+        succeeded ? std::move(guarded_file_list) : StringList();
+  }
+
+  return succeeded;
+}
+
+bool ProbeExecutor::forkedProbesEnabled() const {
+  return d->settings.fork_probes;
+}
+
+ParsedTranslationUnitRef ProbeExecutor::takeParsedTranslationUnit() {
+  return std::move(d->parsed_unit);
+}
+
+ProbeResultList ProbeExecutor::probe(const StringList &active_include_headers,
+                                     const ProbeRequestList &request_list) {
+  std::vector<StringList> include_directive_lists;
+  include_directive_lists.reserve(request_list.size());
+
+  for (const auto &request : request_list) {
+    include_directive_lists.push_back(includeDirectives(*request));
+  }
+
+  return probe(active_include_headers, request_list, include_directive_lists);
+}
+
+ProbeResultList ProbeExecutor::probe(
+    const StringList &active_include_headers,
+    const ProbeRequestList &request_list,
+    const std::vector<StringList> &include_directive_lists) {
+  ProbeResultList result_list(request_list.size());
+
+  auto prefix_hash = setActiveIncludeHeaders(active_include_headers);
+
+  // The prefix depths are learned once all the requests have been probed,
+  // so that the directive order does not depend on the scheduling
+  auto L_learnPrefixDepths = [&]() {
+    if (!d->settings.resolve_include_directives) {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(d->include_directive_mutex);
+
+    for (std::size_t i = 0U; i < request_list.size(); ++i) {
+      const auto &result = result_list[i];
+      if (result.succeeded) {
+        d->learned_prefix_depth_map[getHeaderFolder(*request_list[i])] =
+            getPrefixDepth(result.include_directive);
+      }
+    }
+  };
+
+  // Every accepted probe keeps its translation unit until the call is over;
+  // only the one of the first accepted header, which is the one the callers
+  // commit, is retained afterwards
+  std::vector<ParsedTranslationUnitRef> parsed_unit_list;
+  if (d->settings.retain_parsed_translation_unit) {
+    parsed_unit_list.resize(request_list.size());
+  }
+
+  auto L_parsedUnit = [&](std::size_t request_index) {
+    return parsed_unit_list.empty() ? nullptr
+                                    : &parsed_unit_list[request_index];
+  };
+
+  auto L_retainParsedUnit = [&]() {
+    if (parsed_unit_list.empty()) {
+      return;
+    }
+
+    for (std::size_t i = 0U; i < request_list.size(); ++i) {
+      if (result_list[i].succeeded) {
+        d->parsed_unit = std::move(parsed_unit_list[i]);
+        break;
+      }
+    }
+  };
+
+  // Threads started after the executor has been created rule out the
+  // forked probes for as long as they run; the task executor is stopped
+  // again, since the stages running between two calls restart it
+  if (d->settings.fork_probes && stopTaskExecutor() &&
+      CompilerInstance::canForkProcess()) {
+    result_list = runForkedProbes(request_list, include_directive_lists);
+
+    L_learnPrefixDepths();
+    return result_list;
+  }
+
+  // Isolated workers that could not be respawned after a crash get another
+  // chance on each call
+  std::vector<RemoteProbeWorker *> remote_worker_list;
+  bool isolated_probes = false;
+
+  for (const auto &remote_worker : d->settings.remote_worker_list) {
+    if (!remote_worker->connected() && remote_worker->isolated()) {
+      remote_worker->respawn();
+    }
+
+    if (remote_worker->connected()) {
+      remote_worker_list.push_back(remote_worker.get());
+      isolated_probes = isolated_probes || remote_worker->isolated();
+    }
+  }
+
+  // Do not spawn any thread when running in serial mode
+  auto thread_count = std::min(d->compiler_list.size(), request_list.size());
+  if (thread_count <= 1U && remote_worker_list.empty()) {
+    for (std::size_t i = 0U; i < request_list.size(); ++i) {
+      result_list[i] = probe(0U, *request_list[i], prefix_hash,
+                             include_directive_lists[i], L_parsedUnit(i));
+    }
+
+    L_learnPrefixDepths();
+    L_retainParsedUnit();
+    return result_list;
+  }
+
+  // Headers that have never been probed are assumed to cost as much as the
+  // average one
+  std::vector<double> cost_list(request_list.size(), -1.0);
+
+  double total_known_cost = 0.0;
+  std::size_t known_cost_count = 0U;
+
+  for (std::size_t i = 0U; i < request_list.size(); ++i) {
+    double cost;
+    if (d->settings.probe_cost_model->estimate(cost, request_list[i]->path)) {
+      cost_list[i] = cost;
+      total_known_cost += cost;
+      known_cost_count++;
+    }
+  }
+
+  auto default_cost =
+      known_cost_count != 0U
+          ? total_known_cost / static_cast<double>(known_cost_count)
+          : 0.0;
+
+  for (auto &cost : cost_list) {
+    if (cost < 0.0) {
+      cost = default_cost;
+    }
+  }
+
+  // Headers whose memory usage is not known yet are assumed to be as large
+  // as the largest known one; when nothing is known, the budget is split
+  // evenly among the workers
+  std::vector<std::uint64_t> memory_estimate_list;
+  if (d->admission_controller) {
+    memory_estimate_list.resize(request_list.size(), 0U);
+    std::vector<bool> memory_known_list(request_list.size(), false);
+
+    std::uint64_t largest_memory_estimate = 0U;
+    bool memory_known = false;
+
+    for (std::size_t i = 0U; i < request_list.size(); ++i) {
+      if (d->settings.probe_cost_model->estimateMemory(
+              memory_estimate_list[i], request_list[i]->path)) {
+        memory_known_list[i] = true;
+        memory_known = true;
+
+        largest_memory_estimate =
+            std::max(largest_memory_estimate, memory_estimate_list[i]);
+      }
+    }
+
+    if (!memory_known) {
+      largest_memory_estimate = d->admission_controller->memoryBudget() /
+                                d->compiler_list.size();
+    }
+
+    for (std::size_t i = 0U; i < request_list.size(); ++i) {
+      if (!memory_known_list[i]) {
+        memory_estimate_list[i] = largest_memory_estimate;
+      }
+    }
+  }
+
+  // Racing the include directives only pays off when the local workers are
+  // the only ones
+  if (d->settings.race_include_directives && remote_worker_list.empty()) {
+    result_list = raceProbes(request_list, include_directive_lists,
+                             prefix_hash, memory_estimate_list,
+                             parsed_unit_list);
+
+    L_learnPrefixDepths();
+    L_retainParsedUnit();
+    return result_list;
+  }
+
+  // The local workers take the most expensive headers first, and steal from
+  // each other when they run out; results are stored by index so that the
+  // output order does not depend on the scheduling
+  ProbeScheduler scheduler(std::max<std::size_t>(thread_count, 1U),
+                           cost_list);
+
+  auto L_worker = [&](std::size_t worker_index) {
+    ScopedWorkerPlacement placement(d->settings.worker_placement,
+                                    worker_index);
+
+    std::size_t request_index;
+    while (scheduler.next(request_index, worker_index)) {
+      if (d->admission_controller) {
+        d->admission_controller->acquire(memory_estimate_list[request_index]);
+      }
+
+      result_list[request_index] =
+          probe(worker_index, *request_list[request_index], prefix_hash,
+                include_directive_lists[request_index],
+                L_parsedUnit(request_index));
+
+      if (d->admission_controller) {
+        d->admission_controller->release(memory_estimate_list[request_index]);
+      }
+    }
+  };
+
+  // Remote workers steal as many requests at a time as they can probe
+  // concurrently; they mostly wait on their connection, so each one gets a
+  // thread of its own instead of a lane of the executor. The requests taken
+  // by a worker whose connection is lost are probed locally once the others
+  // are done
+  std::mutex orphan_request_mutex;
+  std::vector<std::size_t> orphan_request_list;
+
+  auto L_remoteWorker = [&](RemoteProbeWorker &remote_worker) {
+    std::vector<std::size_t> stolen_request_list;
+
+    while (true) {
+      auto chunk_size = std::max<std::size_t>(remote_worker.workerCount(), 1U);
+      if (!scheduler.steal(stolen_request_list, chunk_size)) {
+        break;
+      }
+
+      // Quarantined headers are settled without compiling them, and so is
+      // everything once the time budget has run out
+      std::vector<std::size_t> request_index_list;
+      StringList header_path_list;
+      std::vector<StringList> chunk_directive_lists;
+
+      for (auto i : stolen_request_list) {
+        if (isQuarantined(*request_list[i])) {
+          result_list[i] = probe(0U, *request_list[i], prefix_hash, {});
+          continue;
+        }
+
+        if (timeBudgetExhausted()) {
+          result_list[i] = probe(0U, *request_list[i], prefix_hash,
+                                 include_directive_lists[i]);
+          continue;
+        }
+
+        request_index_list.push_back(i);
+        header_path_list.push_back(request_list[i]->path);
+        chunk_directive_lists.push_back(include_directive_lists[i]);
+      }
+
+      if (request_index_list.empty()) {
+        continue;
+      }
+
+      ProbeResultList chunk_result_list;
+      if (!remote_worker.probe(chunk_result_list, active_include_headers,
+                               header_path_list, chunk_directive_lists)) {
+        // Probing the headers again locally could crash this process, so
+        // they are failed instead
+        if (remote_worker.isolated()) {
+          {
+            std::lock_guard<std::mutex> lock(d->quarantine_mutex);
+            d->quarantined_header_set.insert(header_path_list.begin(),
+                                             header_path_list.end());
+          }
+
+          ++d->isolated_worker_crash_count;
+
+          for (auto request_index : request_index_list) {
+            result_list[request_index] =
+                probe(0U, *request_list[request_index], prefix_hash, {});
+          }
+
+          {
+            std::lock_guard<std::mutex> lock(orphan_request_mutex);
+
+            std::cerr << "The isolated probe worker "
+                      << remote_worker.address()
+                      << " has been lost while probing "
+                      << header_path_list.front()
+                      << "; the header has been quarantined\n";
+          }
+
+          if (remote_worker.respawn()) {
+            continue;
+          }
+
+          std::lock_guard<std::mutex> lock(orphan_request_mutex);
+
+          std::cerr << "The isolated probe worker could not be respawned\n";
+          break;
+        }
+
+        std::lock_guard<std::mutex> lock(orphan_request_mutex);
+
+        std::cerr << "Lost the connection to the remote worker "
+                  << remote_worker.address()
+                  << "; its probes will be run locally\n";
+
+        orphan_request_list.insert(orphan_request_list.end(),
+                                   request_index_list.begin(),
+                                   request_index_list.end());
+        break;
+      }
+
+      for (std::size_t i = 0U; i < request_index_list.size(); ++i) {
+        auto request_index = request_index_list[i];
+        auto &result = chunk_result_list[i];
+
+        // Remote timeouts are only reported when classifying the failures
+        if (result.failure_cause.kind == CompilationErrorKind::Timeout) {
+          std::lock_guard<std::mutex> lock(d->quarantine_mutex);
+          d->quarantined_header_set.insert(request_list[request_index]->path);
+        }
+
+        result_list[request_index] = std::move(result);
+      }
+    }
+  };
+
+  std::vector<std::thread> thread_list;
+  for (auto remote_worker : remote_worker_list) {
+    thread_list.emplace_back(L_remoteWorker, std::ref(*remote_worker));
+  }
+
+  if (!isolated_probes) {
+    runTaskLanes(thread_count, TaskPriority::High, L_worker);
+  }
+
+  for (auto &thread : thread_list) {
+    thread.join();
+  }
+
+  // Requests are only left in the scheduler when all the isolated workers
+  // have been lost
+  std::vector<std::size_t> remaining_request_list;
+  while (scheduler.steal(remaining_request_list, request_list.size())) {
+    orphan_request_list.insert(orphan_request_list.end(),
+                               remaining_request_list.begin(),
+                               remaining_request_list.end());
+  }
+
+  std::sort(orphan_request_list.begin(), orphan_request_list.end());
+  for (auto request_index : orphan_request_list) {
+    result_list[request_index] =
+        probe(0U, *request_list[request_index], prefix_hash,
+              include_directive_lists[request_index],
+              L_parsedUnit(request_index));
+  }
+
+  L_learnPrefixDepths();
+  L_retainParsedUnit();
+  return result_list;
+}
@@ -0,0 +1,459 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "compilerinstance.h"
+#include "event_stream.h"
+#include "generate_command.h"
+#include "istatus.h"
+#include "pch_cache.h"
+#include "probe_cache.h"
+#include "probe_log.h"
+#include "probe_scheduler.h"
+#include "time_report.h"
+#include "types.h"
+#include "worker_placement.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class RemoteProbeWorker;
+
+/// A reference to a RemoteProbeWorker object
+using RemoteProbeWorkerRef = std::shared_ptr<RemoteProbeWorker>;
+
+/// The outcome of a single header probe
+struct ProbeResult final {
+  /// True if one of the include directives could be compiled
+  bool succeeded{false};
+
+  /// The include directive that has been accepted
+  std::string include_directive;
+
+  /// The guarded headers read by the accepted probe, which can not add
+  /// anything when included again; only filled when the executor tracks the
+  /// included headers
+  StringList included_header_list;
+
+  /// Why the probe failed; when more than one include directive has been
+  /// tried, this is the cause that is the most likely to go away once more
+  /// headers are accepted. Only filled when the executor classifies the
+  /// failures
+  CompilationErrorCause failure_cause;
+
+  /// The files read by the accepted probe; only filled when the executor
+  /// classifies the failures, and empty when the result comes from the
+  /// probe cache
+  StringList read_file_list;
+};
+
+/// A list of probe results
+using ProbeResultList = std::vector<ProbeResult>;
+
+/// A list of headers to probe
+using ProbeRequestList = std::vector<const HeaderDescriptor *>;
+
+/// The checks performed by each probe; when more than one tier is selected,
+/// a candidate must pass all of them, in order
+enum class ProbeTier {
+  /// Only run the preprocessor
+  Preprocess,
+
+  /// Build the whole AST, performing the semantic analysis
+  Parse
+};
+
+/// A list of probe tiers
+using ProbeTierList = std::vector<ProbeTier>;
+
+/// Parses a comma separated list of probe tiers (i.e.: "preprocess,parse")
+bool parseProbeTierList(ProbeTierList &probe_tier_list,
+                        const std::string &definition);
+
+/// Settings for the ProbeExecutor class
+struct ProbeExecutorSettings final {
+  /// The settings used for each compiler instance
+  CompilerInstanceSettings compiler_settings;
+
+  /// Include files that are always added at the top of each probe
+  StringList base_includes;
+
+  /// How many headers can be probed concurrently
+  std::size_t worker_count{1U};
+
+  /// Where the local workers run; worker i is always placed on the same
+  /// node, along with the compiler instance and prefix it owns
+  WorkerPlacement worker_placement{WorkerPlacement::None};
+
+  /// The memory that the probes running at the same time can use, in bytes;
+  /// the local workers wait for each other when the estimated memory of the
+  /// next probe does not fit. The memory limit of the control group, if
+  /// lower, is used instead; zero means no budget
+  std::uint64_t memory_budget{0U};
+
+  /// If true, the accepted headers are compiled into a precompiled header
+  /// and each probe will only parse the new header on top of it
+  bool use_precompiled_prefix{false};
+
+  /// If set, the precompiled prefixes are published to this cache instead
+  /// of the temporary folder, so that they can be reused by the next runs
+  PCHCacheRef pch_cache;
+
+  /// The checks that each candidate has to pass
+  ProbeTierList probe_tier_list{ProbeTier::Parse};
+
+  /// An optional cache used to skip probes that have already been performed
+  /// in a previous run
+  ProbeCacheRef probe_cache;
+
+  /// If true, include directives that would not resolve to the probed header
+  /// through the header search paths are discarded without compiling them,
+  /// and the prefix depth accepted for a header is tried first for the other
+  /// headers in the same folder
+  bool resolve_include_directives{false};
+
+  /// If true, accepted probes report the guarded headers they have read
+  bool track_included_headers{false};
+
+  /// If true, failed probes report the cause of the error, and accepted
+  /// probes report the files they have read
+  bool classify_failures{false};
+
+  /// If true, the diagnostics rendered by each probe are printed
+  bool verbose_diagnostics{false};
+
+  /// If set, the timing of each compilation is added to this report
+  TimeReportRef time_report;
+
+  /// If set, the start and the outcome of each local probe are written to
+  /// this event stream
+  EventStreamRef event_stream;
+
+  /// Remote workers the probes are dispatched to, along with the local
+  /// workers. Remote probes do not use the probe cache. When one of them is
+  /// isolated, the local workers do not probe anything, and a header whose
+  /// probe takes down an isolated worker is quarantined
+  std::vector<RemoteProbeWorkerRef> remote_worker_list;
+
+  /// The estimated cost of each header, used to start the most expensive
+  /// probes first; it is updated with the measured costs. The executor
+  /// keeps its own estimates when not set
+  ProbeCostModelRef probe_cost_model;
+
+  /// If set, every local compilation and every probe cache hit is recorded
+  /// in this log, to be replayed by the simulate command
+  ProbeRecorderRef probe_recorder;
+
+  /// If true, the translation unit built by the first accepted header of
+  /// the last probe() or probeIncludeList() call that accepted something is
+  /// kept alive; see takeParsedTranslationUnit(). Only the local parse tier
+  /// produces one
+  bool retain_parsed_translation_unit{false};
+
+  /// If true, the local probes of each probe() call share a single parse of
+  /// the include list: it is parsed once, and a child process is forked for
+  /// each include directive; see CompilerInstance::forkProcessAST. The
+  /// children only report whether their directive has been accepted, so
+  /// this is ignored when the probe cache, the precompiled prefix, the
+  /// probe recorder, the remote workers, the included header tracking or
+  /// the failure classification are enabled, when the parse tier is not
+  /// selected, or while the process has other threads
+  bool fork_probes{false};
+
+  /// If true, the include directives of the headers that have more than one
+  /// are compiled concurrently by the local workers. The first accepted
+  /// directive, in preference order, is still the one that is taken: the
+  /// compilations of the directives it makes useless are cancelled. Ignored
+  /// when the probes are forked, or when remote workers are connected
+  bool race_include_directives{false};
+
+  /// If not zero, the executor stops compiling this many seconds after it
+  /// has been created; the headers that would need a compilation are then
+  /// rejected without probing them, and reported by isUnprobed(). The
+  /// probe cache still answers
+  std::size_t probing_time_budget{0U};
+};
+
+class ProbeExecutor;
+
+/// A reference to a ProbeExecutor object
+using ProbeExecutorRef = std::unique_ptr<ProbeExecutor>;
+
+/// The ProbeExecutor owns a pool of CompilerInstance workers and is used to
+/// test whether headers can be added on top of the list of accepted includes
+class ProbeExecutor final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// The outcome of a single include directive of a probe
+  struct DirectiveOutcome final {
+    /// True if the directive has been accepted
+    bool succeeded{false};
+
+    /// True if the directive had to be compiled
+    bool compiled{false};
+
+    /// True if the compilation exceeded its time budget
+    bool timed_out{false};
+
+    /// True if the compilation has been cancelled; the outcome is then
+    /// meaningless
+    bool cancelled{false};
+
+    /// True if the probing time budget had run out, and the cache could not
+    /// answer
+    bool unprobed{false};
+
+    /// The largest frontend memory of the tiers that ran, in bytes
+    std::uint64_t memory_usage{0U};
+
+    /// The time spent on the directive, in seconds
+    double duration{0.0};
+
+    /// The error cause, when classifying the failures
+    CompilationErrorCause error_cause;
+
+    /// The guarded headers read by the directive, when tracking them
+    StringList included_header_list;
+
+    /// The files read by the compilation, when classifying the failures
+    StringList read_file_list;
+
+    /// The translation unit of an accepted directive, when retained
+    ParsedTranslationUnitRef parsed_unit;
+  };
+
+  /// A list of directive outcomes
+  using DirectiveOutcomeList = std::vector<DirectiveOutcome>;
+
+  /// Private constructor; use ::create() instead
+  ProbeExecutor(const ProbeExecutorSettings &settings);
+
+  /// Makes sure the precompiled prefix matches the current include list;
+  /// the prefix is only generated when a probe actually needs it. This
+  /// method is thread safe
+  void ensurePrecompiledPrefix(std::size_t worker_index);
+
+  /// Compiles the given include directives, in order, using the specified
+  /// worker. If a guarded file list is passed, it receives the guarded files
+  /// read by the compilation; the read file list receives all the files
+  /// read, and the error cause the kind of the first error. The timed out
+  /// flag is set when the compilation exceeded its time budget; such
+  /// outcomes are not saved in the probe cache. The memory usage receives
+  /// the largest frontend memory of the tiers that ran, in bytes. If passed,
+  /// the parsed unit receives the translation unit of a successful parse
+  /// tier. Raising the cancellation flag aborts the compilation, which then
+  /// sets the cancelled flag; cancelled outcomes are neither cached nor
+  /// recorded
+  bool compile(std::size_t worker_index,
+               const StringList &include_directive_list,
+               ContentHash prefix_hash,
+               StringList *guarded_file_list = nullptr,
+               StringList *read_file_list = nullptr,
+               CompilationErrorCause *error_cause = nullptr,
+               bool *timed_out = nullptr,
+               std::uint64_t *memory_usage = nullptr,
+               ParsedTranslationUnitRef *parsed_unit = nullptr,
+               const std::atomic_bool *cancellation_flag = nullptr,
+               bool *cancelled = nullptr);
+
+  /// Probes the given headers with CompilerInstance::forkProcessAST, on top
+  /// of the active include list; each header takes the first of its include
+  /// directives that has been accepted
+  ProbeResultList runForkedProbes(
+      const ProbeRequestList &request_list,
+      const std::vector<StringList> &include_directive_lists);
+
+  /// Returns the probe cache key for the given include directives
+  static std::string cacheKey(const StringList &include_directive_list);
+
+  /// Updates the include list the probes are built on top of, returning its
+  /// hash for the probe cache
+  ContentHash setActiveIncludeHeaders(const StringList &active_include_headers);
+
+  /// Returns the include directives of the given header that resolve to
+  /// the header itself, in the order clang would search them; the result is
+  /// memoized. This method is thread safe
+  StringList resolveIncludeDirectives(
+      const HeaderDescriptor &header_descriptor);
+
+  /// Probes a single header using the given worker, trying the include
+  /// directives in order; headers whose probe exceeds the time budget are
+  /// quarantined. If passed, the parsed unit receives the translation unit
+  /// of the accepted include directive, when it has been compiled
+  ProbeResult probe(std::size_t worker_index,
+                    const HeaderDescriptor &header_descriptor,
+                    ContentHash prefix_hash,
+                    const StringList &possible_include_directives,
+                    ParsedTranslationUnitRef *parsed_unit = nullptr);
+
+  /// Looks up the given include directive in the probe cache, and compiles
+  /// it with the specified worker when the cache can't answer. This method
+  /// is thread safe, as long as each worker is only used by one thread
+  void probeDirective(DirectiveOutcome &outcome, std::size_t worker_index,
+                      ContentHash prefix_hash,
+                      const std::string &include_directive,
+                      bool retain_parsed_unit,
+                      const std::atomic_bool *cancellation_flag = nullptr);
+
+  /// Builds the result of a probe from the outcomes of its include
+  /// directives, which are taken in order until one of them is accepted or
+  /// times out; the following ones are ignored. Updates the quarantine, the
+  /// cost model and the event stream. The probe time is the time spent by
+  /// the workers on the whole probe, in seconds
+  ProbeResult settleProbe(std::size_t worker_index,
+                          const HeaderDescriptor &header_descriptor,
+                          const StringList &possible_include_directives,
+                          DirectiveOutcomeList &outcome_list,
+                          double probe_time,
+                          ParsedTranslationUnitRef *parsed_unit);
+
+  /// Probes the given headers with the local workers, compiling the include
+  /// directives of each header concurrently; see
+  /// ProbeExecutorSettings::race_include_directives. The memory estimates
+  /// are only used when the admission controller is enabled
+  ProbeResultList raceProbes(
+      const ProbeRequestList &request_list,
+      const std::vector<StringList> &include_directive_lists,
+      ContentHash prefix_hash,
+      const std::vector<std::uint64_t> &memory_estimate_list,
+      std::vector<ParsedTranslationUnitRef> &parsed_unit_list);
+
+ public:
+  /// Status code, used with ProbeExecutor::Status
+  enum class StatusCode {
+    InvalidWorkerCount,
+    InvalidProbeTierList,
+    MemoryAllocationFailure,
+    CompilerInstanceError,
+    IOError,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new ProbeExecutor object
+  static Status create(ProbeExecutorRef &obj,
+                       const ProbeExecutorSettings &settings);
+
+  /// Destructor
+  ~ProbeExecutor();
+
+  /// Returns the memory budget of the local workers, in bytes; zero when the
+  /// probes are not throttled
+  std::uint64_t memoryBudget() const;
+
+  /// Returns the amount of probes that had to wait for the memory used by
+  /// the other workers
+  std::size_t delayedProbeCount() const;
+
+  /// Returns the amount of workers, including the ones of the remote workers
+  /// that are still connected
+  std::size_t workerCount() const;
+
+  /// Returns the include directives that a probe will try for the given
+  /// header, in order. This method is thread safe
+  StringList includeDirectives(const HeaderDescriptor &header_descriptor);
+
+  /// Returns the amount of include directives that have been discarded
+  /// because they would not resolve to the probed header
+  std::size_t discardedDirectiveCount() const;
+
+  /// Returns true once the cancellation flag of the compiler settings has
+  /// been raised; the probes then fail without being compiled. This method
+  /// is thread safe
+  bool cancelled() const;
+
+  /// Returns true if a probe of the given header has exceeded the time
+  /// budget of the compiler settings; quarantined headers are never probed
+  /// again. This method is thread safe
+  bool isQuarantined(const HeaderDescriptor &header_descriptor) const;
+
+  /// Returns the amount of quarantined headers
+  std::size_t quarantinedHeaderCount() const;
+
+  /// Returns how many times an isolated worker has been lost while probing
+  std::size_t isolatedWorkerCrashCount() const;
+
+  /// Returns true if the probing time budget has run out. This method is
+  /// thread safe
+  bool timeBudgetExhausted() const;
+
+  /// Returns true if the given header has been rejected without probing it,
+  /// because the probing time budget had run out. This method is thread
+  /// safe
+  bool isUnprobed(const HeaderDescriptor &header_descriptor) const;
+
+  /// Returns the amount of headers rejected without probing them
+  std::size_t unprobedHeaderCount() const;
+
+  /// Returns true if the probes are run by forking child processes; see
+  /// ProbeExecutorSettings::fork_probes
+  bool forkedProbesEnabled() const;
+
+  /// Probes each header on top of the given include list. Headers are
+  /// processed concurrently, and the results are returned in the same order
+  /// as the requests
+  ProbeResultList probe(const StringList &active_include_headers,
+                        const ProbeRequestList &request_list);
+
+  /// Same as above, but each header is probed with the given include
+  /// directives instead of the ones returned by includeDirectives(); used
+  /// to serve the probes dispatched by a remote coordinator
+  ProbeResultList probe(const StringList &active_include_headers,
+                        const ProbeRequestList &request_list,
+                        const std::vector<StringList> &include_directive_lists);
+
+  /// Tests whether all the given include directives can be added, in order,
+  /// on top of the given include list with a single compilation; used to
+  /// probe a group of headers at once. When tracking the included headers,
+  /// the list receives the guarded headers read by an accepted group
+  bool probeIncludeList(const StringList &active_include_headers,
+                        const StringList &include_directive_list,
+                        StringList *included_header_list = nullptr);
+
+  /// Compiles all the given include directives at once on top of the given
+  /// include list, without stopping at fatal errors, and returns true if
+  /// the compilation succeeded. On failure, the attributed directive list
+  /// receives the positions (in the include directive list) of the
+  /// directives through which the errors have been reached; errors that
+  /// can't be traced back to one of them are not reported. The probe cache,
+  /// the precompiled prefix and the time budget are not used. When tracking
+  /// the included headers, the list receives the guarded headers read by a
+  /// successful compilation
+  bool attributeIncludeList(const StringList &active_include_headers,
+                            const StringList &include_directive_list,
+                            std::vector<std::size_t> &attributed_directive_list,
+                            StringList *included_header_list = nullptr);
+
+  /// Returns the translation unit retained by the last call that accepted
+  /// something, releasing it; empty when the retention is disabled, or when
+  /// the accepted outcome came from the probe cache. Its source buffer tells
+  /// which include list it has been built from
+  ParsedTranslationUnitRef takeParsedTranslationUnit();
+
+  /// Disable the copy constructor
+  ProbeExecutor(const ProbeExecutor &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeExecutor &operator=(const ProbeExecutor &other) = delete;
+};
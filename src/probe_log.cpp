@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_log.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace {
+/// The first line of each probe log
+const std::string kProbeLogHeader = "abigen-probe-log 1";
+
+/// Joins the given include directives, using the same separator as the
+/// probe cache keys
+std::string joinIncludeDirectives(const StringList &include_directive_list) {
+  std::string buffer;
+  for (const auto &include_directive : include_directive_list) {
+    if (!buffer.empty()) {
+      buffer.push_back('|');
+    }
+
+    buffer += include_directive;
+  }
+
+  return buffer;
+}
+
+/// Splits a list of include directives joined by joinIncludeDirectives()
+StringList splitIncludeDirectives(const std::string &buffer) {
+  StringList include_directive_list;
+
+  std::stringstream stream(buffer);
+  std::string include_directive;
+
+  while (std::getline(stream, include_directive, '|')) {
+    include_directive_list.push_back(include_directive);
+  }
+
+  return include_directive_list;
+}
+
+/// Converts the given time, in seconds, to microseconds
+std::uint64_t toMicroseconds(double time) {
+  return static_cast<std::uint64_t>(std::llround(std::max(time, 0.0) * 1e6));
+}
+
+/// Splits the first field_count space separated fields out of the given
+/// line; the rest of the line, which may contain spaces, is returned in
+/// the last element. Returns false if the line has fewer fields
+bool splitLogLine(std::vector<std::string> &field_list,
+                  const std::string &line, std::size_t field_count) {
+  field_list.clear();
+
+  std::size_t position = 0U;
+  for (std::size_t i = 0U; i < field_count; ++i) {
+    auto separator_position = line.find(' ', position);
+    if (separator_position == std::string::npos) {
+      return false;
+    }
+
+    field_list.push_back(line.substr(position, separator_position - position));
+    position = separator_position + 1U;
+  }
+
+  field_list.push_back(line.substr(position));
+  return true;
+}
+
+/// Parses an unsigned integer field
+bool parseLogInteger(std::uint64_t &value, const std::string &field) {
+  if (field.empty() ||
+      field.find_first_not_of("0123456789") != std::string::npos) {
+    return false;
+  }
+
+  try {
+    value = static_cast<std::uint64_t>(std::stoull(field));
+  } catch (...) {
+    return false;
+  }
+
+  return true;
+}
+}  // namespace
+
+bool readProbeLog(ProbeLog &probe_log, const std::string &path) {
+  probe_log = {};
+
+  std::ifstream log_file(path);
+  if (!log_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(log_file, line) || line != kProbeLogHeader) {
+    return false;
+  }
+
+  // The records reference the last prefix base
+  probe_log.prefix_base_list.emplace_back();
+
+  std::vector<std::string> field_list;
+  std::uint64_t value;
+
+  while (std::getline(log_file, line)) {
+    auto separator_position = line.find(' ');
+    auto tag = line.substr(0U, separator_position);
+    auto argument = (separator_position != std::string::npos)
+                        ? line.substr(separator_position + 1U)
+                        : std::string();
+
+    if (tag == "run") {
+      if (!splitLogLine(field_list, argument, 1U) ||
+          !parseLogInteger(value, field_list[0]) || value == 0U) {
+        return false;
+      }
+
+      probe_log.worker_count = static_cast<std::size_t>(value);
+      probe_log.probe_strategy = field_list[1];
+
+    } else if (tag == "header") {
+      ProbeLogHeader header;
+      header.path = argument;
+
+      probe_log.header_list.push_back(std::move(header));
+
+    } else if (tag == "directive") {
+      if (probe_log.header_list.empty()) {
+        return false;
+      }
+
+      probe_log.header_list.back().include_directive_list.push_back(argument);
+
+    } else if (tag == "prefix-reset") {
+      probe_log.prefix_base_list.emplace_back();
+
+    } else if (tag == "prefix-push") {
+      probe_log.prefix_base_list.back().push_back(argument);
+
+    } else if (tag == "probe" || tag == "attribute") {
+      ProbeLogRecord record;
+      record.attribution = (tag == "attribute");
+      record.prefix_base = probe_log.prefix_base_list.size() - 1U;
+
+      // probe <outcome> <compiled|cached> <prefix size> <usec> <directives>
+      // attribute <outcome> <prefix size> <usec> <positions> <directives>
+      if (!splitLogLine(field_list, argument, 4U)) {
+        return false;
+      }
+
+      const auto &outcome = field_list[0];
+      record.succeeded = (outcome == "accepted");
+      record.timed_out = (outcome == "timeout");
+
+      if (!record.succeeded && !record.timed_out && outcome != "rejected") {
+        return false;
+      }
+
+      std::size_t field_index = 1U;
+      if (!record.attribution) {
+        record.cached = (field_list[1] == "cached");
+        if (!record.cached && field_list[1] != "compiled") {
+          return false;
+        }
+
+        ++field_index;
+      }
+
+      if (!parseLogInteger(value, field_list[field_index]) ||
+          value > probe_log.prefix_base_list.back().size()) {
+        return false;
+      }
+
+      record.prefix_size = static_cast<std::size_t>(value);
+
+      if (!parseLogInteger(value, field_list[field_index + 1U])) {
+        return false;
+      }
+
+      record.wall_time = static_cast<double>(value) / 1e6;
+
+      record.include_directive_list =
+          splitIncludeDirectives(field_list.back());
+
+      if (record.attribution && field_list[3] != "-") {
+        std::stringstream stream(field_list[3]);
+        std::string position;
+
+        while (std::getline(stream, position, ',')) {
+          if (!parseLogInteger(value, position) ||
+              value >= record.include_directive_list.size()) {
+            return false;
+          }
+
+          record.attributed_directive_list.push_back(
+              static_cast<std::size_t>(value));
+        }
+      }
+
+      probe_log.record_list.push_back(std::move(record));
+
+    } else if (tag == "elapsed") {
+      if (!parseLogInteger(value, argument)) {
+        return false;
+      }
+
+      probe_log.elapsed_time = static_cast<double>(value) / 1e6;
+
+    } else {
+      return false;
+    }
+  }
+
+  return !log_file.bad();
+}
+
+/// Private class data
+struct ProbeRecorder::PrivateData final {
+  /// Protects the other members
+  mutable std::mutex file_mutex;
+
+  /// The log file
+  std::ofstream log_file;
+
+  /// The prefix base the following records are sliced from
+  StringList prefix_base;
+
+  /// When the recorder was created
+  std::chrono::steady_clock::time_point start_time;
+
+  /// Set when the log is closed; true if it has been written successfully
+  bool succeeded{false};
+};
+
+ProbeRecorder::ProbeRecorder(const std::string &path,
+                             std::size_t worker_count,
+                             const std::string &probe_strategy)
+    : d(new PrivateData) {
+  d->start_time = std::chrono::steady_clock::now();
+
+  d->log_file.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+  d->log_file << kProbeLogHeader << "\n";
+  d->log_file << "run " << worker_count << " " << probe_strategy << "\n";
+
+  if (!d->log_file) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the probe log: " + path);
+  }
+}
+
+ProbeRecorder::Status ProbeRecorder::create(ProbeRecorderRef &obj,
+                                            const std::string &path,
+                                            std::size_t worker_count,
+                                            const std::string &probe_strategy) {
+  obj.reset();
+
+  try {
+    auto ptr = new ProbeRecorder(path, worker_count, probe_strategy);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ProbeRecorder::~ProbeRecorder() { close(); }
+
+std::size_t ProbeRecorder::writePrefix(
+    const StringList &active_include_headers) {
+  auto &prefix_base = d->prefix_base;
+
+  auto is_slice =
+      active_include_headers.size() <= prefix_base.size() &&
+      std::equal(active_include_headers.begin(), active_include_headers.end(),
+                 prefix_base.begin());
+
+  if (is_slice) {
+    return active_include_headers.size();
+  }
+
+  auto extends_base =
+      active_include_headers.size() > prefix_base.size() &&
+      std::equal(prefix_base.begin(), prefix_base.end(),
+                 active_include_headers.begin());
+
+  if (!extends_base) {
+    d->log_file << "prefix-reset\n";
+    prefix_base.clear();
+  }
+
+  for (auto i = prefix_base.size(); i < active_include_headers.size(); ++i) {
+    d->log_file << "prefix-push " << active_include_headers[i] << "\n";
+    prefix_base.push_back(active_include_headers[i]);
+  }
+
+  return active_include_headers.size();
+}
+
+void ProbeRecorder::recordHeader(const std::string &path,
+                                 const StringList &include_directive_list) {
+  std::lock_guard<std::mutex> lock(d->file_mutex);
+
+  if (!d->log_file.is_open()) {
+    return;
+  }
+
+  d->log_file << "header " << path << "\n";
+  for (const auto &include_directive : include_directive_list) {
+    d->log_file << "directive " << include_directive << "\n";
+  }
+}
+
+void ProbeRecorder::recordProbe(const StringList &active_include_headers,
+                                const StringList &include_directive_list,
+                                bool succeeded, bool timed_out, bool cached,
+                                double wall_time) {
+  std::lock_guard<std::mutex> lock(d->file_mutex);
+
+  if (!d->log_file.is_open()) {
+    return;
+  }
+
+  auto prefix_size = writePrefix(active_include_headers);
+
+  d->log_file << "probe "
+              << (succeeded ? "accepted" : timed_out ? "timeout" : "rejected")
+              << " " << (cached ? "cached" : "compiled") << " " << prefix_size
+              << " " << (cached ? 0U : toMicroseconds(wall_time)) << " "
+              << joinIncludeDirectives(include_directive_list) << "\n";
+}
+
+void ProbeRecorder::recordAttribution(
+    const StringList &active_include_headers,
+    const StringList &include_directive_list, bool succeeded,
+    const std::vector<std::size_t> &attributed_directive_list,
+    double wall_time) {
+  std::lock_guard<std::mutex> lock(d->file_mutex);
+
+  if (!d->log_file.is_open()) {
+    return;
+  }
+
+  auto prefix_size = writePrefix(active_include_headers);
+
+  std::string position_list;
+  for (auto position : attributed_directive_list) {
+    if (!position_list.empty()) {
+      position_list.push_back(',');
+    }
+
+    position_list += std::to_string(position);
+  }
+
+  if (position_list.empty()) {
+    position_list = "-";
+  }
+
+  d->log_file << "attribute " << (succeeded ? "accepted" : "rejected") << " "
+              << prefix_size << " " << toMicroseconds(wall_time) << " "
+              << position_list << " "
+              << joinIncludeDirectives(include_directive_list) << "\n";
+}
+
+bool ProbeRecorder::close() {
+  std::lock_guard<std::mutex> lock(d->file_mutex);
+
+  if (d->log_file.is_open()) {
+    std::chrono::duration<double> elapsed_time =
+        std::chrono::steady_clock::now() - d->start_time;
+
+    d->log_file << "elapsed " << toMicroseconds(elapsed_time.count())
+                << "\n";
+
+    d->log_file.close();
+    d->succeeded = static_cast<bool>(d->log_file);
+  }
+
+  return d->succeeded;
+}
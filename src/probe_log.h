@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+#include <vector>
+
+/// A compilation recorded while probing the headers
+struct ProbeLogRecord final {
+  /// True if the include directives were compiled at once to attribute the
+  /// errors to them, rather than probed as a single header or a group
+  bool attribution{false};
+
+  /// The include directives compiled on top of the prefix, in order
+  StringList include_directive_list;
+
+  /// The prefix is made of the first prefix_size directives of this entry
+  /// of ProbeLog::prefix_base_list
+  std::size_t prefix_base{0U};
+
+  /// How many directives of the prefix base the probe was built on
+  std::size_t prefix_size{0U};
+
+  /// True if the compilation succeeded
+  bool succeeded{false};
+
+  /// True if the compilation exceeded its time budget
+  bool timed_out{false};
+
+  /// True if the outcome was read from the probe cache
+  bool cached{false};
+
+  /// How long the compilation took, in seconds; zero for cached outcomes
+  double wall_time{0.0};
+
+  /// For failed attributions, the positions (in the include directive list)
+  /// of the directives the errors were attributed to
+  std::vector<std::size_t> attributed_directive_list;
+};
+
+/// A candidate header, along with the include directives the probes try
+struct ProbeLogHeader final {
+  /// The header path
+  std::string path;
+
+  /// The include directives of the header, in the order they are tried
+  StringList include_directive_list;
+};
+
+/// The probes performed by a generate run, saved with --record-probes and
+/// replayed by the simulate command
+struct ProbeLog final {
+  /// How many local workers the run used
+  std::size_t worker_count{1U};
+
+  /// The probe strategy of the run
+  std::string probe_strategy;
+
+  /// The candidate headers, in the order they were enumerated
+  std::vector<ProbeLogHeader> header_list;
+
+  /// The include lists the probes were built on; the prefix of each record
+  /// is a slice of one of them. A new base only starts when the prefix
+  /// stops growing, which is rare
+  std::vector<StringList> prefix_base_list;
+
+  /// The compilations, in the order they completed
+  std::vector<ProbeLogRecord> record_list;
+
+  /// How long the probing lasted, in seconds; zero if the run did not
+  /// complete
+  double elapsed_time{0.0};
+};
+
+/// Reads the given probe log; returns false if it is missing or malformed
+bool readProbeLog(ProbeLog &probe_log, const std::string &path);
+
+class ProbeRecorder;
+
+/// A reference to a ProbeRecorder object
+using ProbeRecorderRef = std::shared_ptr<ProbeRecorder>;
+
+/// The ProbeRecorder appends each compilation performed by the probes to a
+/// log file, along with the prefix it was built on and its timing. Prefixes
+/// are written as the directives added since the previous record, so the
+/// log stays linear in the amount of probes. All methods are thread safe
+class ProbeRecorder final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  ProbeRecorder(const std::string &path, std::size_t worker_count,
+                const std::string &probe_strategy);
+
+  /// Writes the prefix of the next record, returning its size; the caller
+  /// must hold the file lock
+  std::size_t writePrefix(const StringList &active_include_headers);
+
+ public:
+  /// Status code, used with ProbeRecorder::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new ProbeRecorder object, replacing the given log file
+  static Status create(ProbeRecorderRef &obj, const std::string &path,
+                       std::size_t worker_count,
+                       const std::string &probe_strategy);
+
+  /// Destructor; closes the log if needed
+  ~ProbeRecorder();
+
+  /// Records a candidate header and its include directives
+  void recordHeader(const std::string &path,
+                    const StringList &include_directive_list);
+
+  /// Records a probe of a single header or of a group of headers. The wall
+  /// time is in seconds, and it is ignored for cached outcomes
+  void recordProbe(const StringList &active_include_headers,
+                   const StringList &include_directive_list, bool succeeded,
+                   bool timed_out, bool cached, double wall_time);
+
+  /// Records a compilation made to attribute the errors to the include
+  /// directives, along with the positions of the ones that failed
+  void recordAttribution(
+      const StringList &active_include_headers,
+      const StringList &include_directive_list, bool succeeded,
+      const std::vector<std::size_t> &attributed_directive_list,
+      double wall_time);
+
+  /// Records how long the probing lasted and closes the log; the records
+  /// made afterwards are dropped. Returns false if the log could not be
+  /// written
+  bool close();
+
+  /// Disable the copy constructor
+  ProbeRecorder(const ProbeRecorder &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeRecorder &operator=(const ProbeRecorder &other) = delete;
+};
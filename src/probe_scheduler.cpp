@@ -0,0 +1,609 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_scheduler.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+/// The first line of each cost file
+const std::string kProbeCostFileHeader = "abigen-probe-costs 3";
+
+/// Reads the first unsigned integer stored in the given file; returns false
+/// if the file is missing or does not start with a number (such as the "max"
+/// written by cgroup v2 when there is no limit)
+bool readFileInteger(std::uint64_t &value, const std::string &path) {
+  value = 0U;
+
+  std::ifstream file(path);
+  std::string line;
+  if (!file || !std::getline(file, line) || line.empty() ||
+      line.front() < '0' || line.front() > '9') {
+    return false;
+  }
+
+  try {
+    value = static_cast<std::uint64_t>(std::stoull(line));
+  } catch (...) {
+    return false;
+  }
+
+  return true;
+}
+
+/// The requests owned by a single worker
+struct WorkerDeque final {
+  /// Protects the request list
+  std::mutex mutex;
+
+  /// The pending requests, most expensive first
+  std::deque<std::size_t> request_list;
+};
+}  // namespace
+
+/// Private class data
+struct ProbeCostModel::PrivateData final {
+  /// The probe history of a single header
+  struct HeaderHistory final {
+    /// The content fingerprint the outcomes have been measured with; zero
+    /// when it is not known
+    std::uint64_t fingerprint{0U};
+
+    /// True if the cost member is valid
+    bool has_cost{false};
+
+    /// The moving average of the probe costs, in microseconds
+    std::uint64_t cost{0U};
+
+    /// True if the memory usage member is valid
+    bool has_memory_usage{false};
+
+    /// The peak frontend memory used by a probe, in bytes
+    std::uint64_t memory_usage{0U};
+
+    /// How many probes have been recorded
+    std::size_t probe_count{0U};
+
+    /// How many of the recorded probes have been accepted
+    std::size_t accepted_count{0U};
+
+    /// How the last rejection has been classified; empty if the header has
+    /// never been rejected
+    std::string failure_class;
+
+    /// How many of the previous runs did not use the header
+    std::size_t idle_run_count{0U};
+
+    /// True if the header has been used by this run
+    bool used{false};
+  };
+
+  /// Protects the history map
+  mutable std::mutex cost_map_mutex;
+
+  /// The probe history of each header, keyed on the header path
+  std::unordered_map<std::string, HeaderHistory> history_map;
+};
+
+ProbeCostModel::ProbeCostModel() : d(new PrivateData) {}
+
+ProbeCostModel::~ProbeCostModel() {}
+
+bool ProbeCostModel::load(const std::string &path) {
+  std::ifstream cost_file(path);
+  if (!cost_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(cost_file, line) || line != kProbeCostFileHeader) {
+    return false;
+  }
+
+  // Each line looks like "<fingerprint> <microseconds> <bytes> <probes>
+  // <accepted> <failure class> <idle runs> <header path>"; missing values
+  // are written as "-"
+  std::unordered_map<std::string, PrivateData::HeaderHistory> history_map;
+
+  auto L_parseValue = [](std::uint64_t &value, bool &valid,
+                         const std::string &token, int base) -> bool {
+    valid = (token != "-");
+    value = 0U;
+
+    if (!valid) {
+      return true;
+    }
+
+    try {
+      std::size_t processed_size = 0U;
+      value = static_cast<std::uint64_t>(
+          std::stoull(token, &processed_size, base));
+
+      return processed_size == token.size();
+
+    } catch (...) {
+      return false;
+    }
+  };
+
+  while (std::getline(cost_file, line)) {
+    std::istringstream line_stream(line);
+
+    std::string token_list[7];
+    for (auto &token : token_list) {
+      if (!(line_stream >> token)) {
+        return false;
+      }
+    }
+
+    std::string header_path;
+    if (line_stream.get() != ' ' || !std::getline(line_stream, header_path) ||
+        header_path.empty()) {
+      return false;
+    }
+
+    PrivateData::HeaderHistory history;
+    std::uint64_t probe_count = 0U;
+    std::uint64_t accepted_count = 0U;
+    std::uint64_t idle_run_count = 0U;
+    bool valid = false;
+
+    if (!L_parseValue(history.fingerprint, valid, token_list[0], 16) ||
+        !L_parseValue(history.cost, history.has_cost, token_list[1], 10) ||
+        !L_parseValue(history.memory_usage, history.has_memory_usage,
+                      token_list[2], 10) ||
+        !L_parseValue(probe_count, valid, token_list[3], 10) || !valid ||
+        !L_parseValue(accepted_count, valid, token_list[4], 10) || !valid ||
+        !L_parseValue(idle_run_count, valid, token_list[6], 10) || !valid) {
+      return false;
+    }
+
+    history.probe_count = static_cast<std::size_t>(probe_count);
+    history.accepted_count = static_cast<std::size_t>(accepted_count);
+    history.idle_run_count = static_cast<std::size_t>(idle_run_count);
+
+    if (token_list[5] != "-") {
+      history.failure_class = token_list[5];
+    }
+
+    history_map[header_path] = std::move(history);
+  }
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+  d->history_map = std::move(history_map);
+
+  return true;
+}
+
+bool ProbeCostModel::save(const std::string &path) const {
+  std::vector<std::pair<std::string, PrivateData::HeaderHistory>> history_list;
+
+  {
+    std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+    history_list.assign(d->history_map.begin(), d->history_map.end());
+  }
+
+  // Sorted, so that the file does not change across identical runs
+  std::sort(history_list.begin(), history_list.end(),
+            [](const std::pair<std::string, PrivateData::HeaderHistory> &lhs,
+               const std::pair<std::string, PrivateData::HeaderHistory> &rhs)
+                -> bool { return lhs.first < rhs.first; });
+
+  std::stringstream buffer;
+  buffer << kProbeCostFileHeader << "\n";
+
+  for (const auto &p : history_list) {
+    const auto &header_path = p.first;
+    const auto &history = p.second;
+
+    buffer << std::hex << history.fingerprint << std::dec << " ";
+
+    if (history.has_cost) {
+      buffer << history.cost << " ";
+    } else {
+      buffer << "- ";
+    }
+
+    if (history.has_memory_usage) {
+      buffer << history.memory_usage << " ";
+    } else {
+      buffer << "- ";
+    }
+
+    buffer << history.probe_count << " " << history.accepted_count << " "
+           << (history.failure_class.empty() ? "-" : history.failure_class)
+           << " " << (history.used ? 0U : history.idle_run_count + 1U) << " "
+           << header_path << "\n";
+  }
+
+  std::error_code error;
+  stdfs::create_directories(stdfs::path(path).parent_path(), error);
+
+  return writeFileAtomically(path, buffer.str());
+}
+
+void ProbeCostModel::setFingerprint(const std::string &header_path,
+                                    std::uint64_t hash) {
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto &history = d->history_map[header_path];
+  history.used = true;
+
+  if (history.fingerprint != 0U && history.fingerprint != hash) {
+    history.probe_count = 0U;
+    history.accepted_count = 0U;
+    history.failure_class.clear();
+  }
+
+  history.fingerprint = hash;
+}
+
+std::size_t ProbeCostModel::compact(std::size_t max_idle_run_count) {
+  std::size_t removed_count = 0U;
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  for (auto it = d->history_map.begin(); it != d->history_map.end();) {
+    const auto &history = it->second;
+
+    if (!history.used && history.idle_run_count + 1U >= max_idle_run_count) {
+      it = d->history_map.erase(it);
+      ++removed_count;
+
+    } else {
+      ++it;
+    }
+  }
+
+  return removed_count;
+}
+
+bool ProbeCostModel::estimate(double &cost,
+                              const std::string &header_path) const {
+  cost = 0.0;
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto it = d->history_map.find(header_path);
+  if (it == d->history_map.end() || !it->second.has_cost) {
+    return false;
+  }
+
+  cost = static_cast<double>(it->second.cost) / 1000000.0;
+  return true;
+}
+
+void ProbeCostModel::update(const std::string &header_path, double cost) {
+  auto microseconds = static_cast<std::uint64_t>(std::max(cost, 0.0) * 1e6);
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  // Each new sample weighs as much as the whole history, so that the
+  // estimate follows the changes of the header quickly
+  auto &history = d->history_map[header_path];
+  history.cost =
+      history.has_cost ? (history.cost + microseconds) / 2U : microseconds;
+
+  history.has_cost = true;
+  history.used = true;
+}
+
+bool ProbeCostModel::estimateMemory(std::uint64_t &memory_usage,
+                                    const std::string &header_path) const {
+  memory_usage = 0U;
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto it = d->history_map.find(header_path);
+  if (it == d->history_map.end() || !it->second.has_memory_usage) {
+    return false;
+  }
+
+  memory_usage = it->second.memory_usage;
+  return true;
+}
+
+void ProbeCostModel::updateMemory(const std::string &header_path,
+                                  std::uint64_t memory_usage) {
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto &history = d->history_map[header_path];
+  history.memory_usage = history.has_memory_usage
+                             ? std::max(history.memory_usage, memory_usage)
+                             : memory_usage;
+
+  history.has_memory_usage = true;
+  history.used = true;
+}
+
+bool ProbeCostModel::estimateAcceptance(double &acceptance_ratio,
+                                        const std::string &header_path) const {
+  acceptance_ratio = 0.0;
+
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto it = d->history_map.find(header_path);
+  if (it == d->history_map.end() || it->second.probe_count == 0U) {
+    return false;
+  }
+
+  acceptance_ratio = static_cast<double>(it->second.accepted_count) /
+                     static_cast<double>(it->second.probe_count);
+
+  return true;
+}
+
+std::string ProbeCostModel::lastFailureClass(
+    const std::string &header_path) const {
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto it = d->history_map.find(header_path);
+  if (it == d->history_map.end()) {
+    return std::string();
+  }
+
+  return it->second.failure_class;
+}
+
+void ProbeCostModel::recordOutcome(const std::string &header_path,
+                                   bool accepted,
+                                   const std::string &failure_class) {
+  std::lock_guard<std::mutex> lock(d->cost_map_mutex);
+
+  auto &history = d->history_map[header_path];
+  history.used = true;
+
+  ++history.probe_count;
+
+  if (accepted) {
+    ++history.accepted_count;
+  } else {
+    history.failure_class = failure_class.empty() ? "unknown" : failure_class;
+  }
+}
+
+/// Private class data
+struct ProbeScheduler::PrivateData final {
+  /// One deque for each worker
+  std::vector<std::unique_ptr<WorkerDeque>> worker_deque_list;
+
+  /// Requests that have not been taken yet; used to stop looking for
+  /// victims once all the deques are empty
+  std::atomic_size_t pending_request_count{0U};
+
+  /// Requests that have been stolen
+  std::atomic_size_t stolen_request_count{0U};
+
+  /// Takes a request from the back of the first deque that is not empty,
+  /// starting after the given one
+  bool stealOne(std::size_t &request_index, std::size_t first_victim_index) {
+    auto deque_count = worker_deque_list.size();
+
+    for (std::size_t i = 0U;
+         i < deque_count && pending_request_count.load() != 0U; ++i) {
+      auto &victim = *worker_deque_list[(first_victim_index + i) % deque_count];
+
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.request_list.empty()) {
+        continue;
+      }
+
+      request_index = victim.request_list.back();
+      victim.request_list.pop_back();
+
+      pending_request_count--;
+      stolen_request_count++;
+
+      return true;
+    }
+
+    return false;
+  }
+};
+
+ProbeScheduler::ProbeScheduler(std::size_t worker_count,
+                               const std::vector<double> &cost_list)
+    : d(new PrivateData) {
+  worker_count = std::max<std::size_t>(worker_count, 1U);
+
+  for (std::size_t i = 0U; i < worker_count; ++i) {
+    d->worker_deque_list.emplace_back(new WorkerDeque);
+  }
+
+  // Most expensive first; requests with the same estimate keep their order
+  std::vector<std::size_t> request_order(cost_list.size());
+  std::iota(request_order.begin(), request_order.end(), 0U);
+
+  std::stable_sort(request_order.begin(), request_order.end(),
+                   [&](std::size_t lhs, std::size_t rhs) -> bool {
+                     return cost_list[lhs] > cost_list[rhs];
+                   });
+
+  // Each request goes to the worker with the smallest load; ties (such as
+  // when nothing is known about the requests) go to the worker with the
+  // fewest requests, so that the deques start out balanced
+  std::vector<double> worker_load_list(worker_count, 0.0);
+
+  for (auto request_index : request_order) {
+    std::size_t selected_worker = 0U;
+
+    for (std::size_t i = 1U; i < worker_count; ++i) {
+      const auto &selected_deque = d->worker_deque_list[selected_worker];
+      const auto &current_deque = d->worker_deque_list[i];
+
+      if (worker_load_list[i] < worker_load_list[selected_worker] ||
+          (worker_load_list[i] == worker_load_list[selected_worker] &&
+           current_deque->request_list.size() <
+               selected_deque->request_list.size())) {
+        selected_worker = i;
+      }
+    }
+
+    worker_load_list[selected_worker] += cost_list[request_index];
+    d->worker_deque_list[selected_worker]->request_list.push_back(
+        request_index);
+  }
+
+  d->pending_request_count = cost_list.size();
+}
+
+ProbeScheduler::~ProbeScheduler() {}
+
+bool ProbeScheduler::next(std::size_t &request_index,
+                          std::size_t worker_index) {
+  auto &worker_deque =
+      *d->worker_deque_list[worker_index % d->worker_deque_list.size()];
+
+  {
+    std::lock_guard<std::mutex> lock(worker_deque.mutex);
+    if (!worker_deque.request_list.empty()) {
+      request_index = worker_deque.request_list.front();
+      worker_deque.request_list.pop_front();
+
+      d->pending_request_count--;
+      return true;
+    }
+  }
+
+  return d->stealOne(request_index, worker_index + 1U);
+}
+
+bool ProbeScheduler::steal(std::vector<std::size_t> &request_index_list,
+                           std::size_t max_request_count) {
+  request_index_list.clear();
+
+  // Spread the thefts across the deques, starting from a different one each
+  // time
+  std::random_device random_device;
+  std::size_t first_victim_index = random_device();
+
+  while (request_index_list.size() < max_request_count) {
+    std::size_t request_index;
+    if (!d->stealOne(request_index, first_victim_index++)) {
+      break;
+    }
+
+    request_index_list.push_back(request_index);
+  }
+
+  return !request_index_list.empty();
+}
+
+std::size_t ProbeScheduler::stolenRequestCount() const {
+  return d->stolen_request_count;
+}
+
+bool getControlGroupMemoryLimit(std::uint64_t &memory_limit) {
+  memory_limit = 0U;
+
+  // Values this large mean that cgroup v1 has no limit
+  const std::uint64_t kUnlimitedThreshold = std::uint64_t(1U) << 60U;
+
+  std::uint64_t limit;
+  std::uint64_t usage;
+
+  if (readFileInteger(limit, "/sys/fs/cgroup/memory.max")) {
+    readFileInteger(usage, "/sys/fs/cgroup/memory.current");
+
+  } else if (readFileInteger(limit,
+                             "/sys/fs/cgroup/memory/memory.limit_in_bytes") &&
+             limit < kUnlimitedThreshold) {
+    readFileInteger(usage, "/sys/fs/cgroup/memory/memory.usage_in_bytes");
+
+  } else {
+    return false;
+  }
+
+  memory_limit = (usage < limit) ? limit - usage : 0U;
+  return true;
+}
+
+/// Private class data
+struct ProbeAdmissionController::PrivateData final {
+  /// The memory that the running probes can use, in bytes
+  std::uint64_t memory_budget{0U};
+
+  /// Protects the other members
+  std::mutex mutex;
+
+  /// Signaled each time a probe ends
+  std::condition_variable probe_ended;
+
+  /// The sum of the estimates of the running probes
+  std::uint64_t memory_in_use{0U};
+
+  /// The amount of running probes
+  std::size_t running_probe_count{0U};
+
+  /// Probes that had to wait for other ones to end
+  std::size_t delayed_probe_count{0U};
+};
+
+ProbeAdmissionController::ProbeAdmissionController(std::uint64_t memory_budget)
+    : d(new PrivateData) {
+  d->memory_budget = memory_budget;
+}
+
+ProbeAdmissionController::~ProbeAdmissionController() {}
+
+std::uint64_t ProbeAdmissionController::memoryBudget() const {
+  return d->memory_budget;
+}
+
+void ProbeAdmissionController::acquire(std::uint64_t memory_estimate) {
+  std::unique_lock<std::mutex> lock(d->mutex);
+
+  auto L_admitted = [&]() -> bool {
+    return d->running_probe_count == 0U ||
+           d->memory_in_use + memory_estimate <= d->memory_budget;
+  };
+
+  if (!L_admitted()) {
+    d->delayed_probe_count++;
+    d->probe_ended.wait(lock, L_admitted);
+  }
+
+  d->memory_in_use += memory_estimate;
+  d->running_probe_count++;
+}
+
+void ProbeAdmissionController::release(std::uint64_t memory_estimate) {
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    d->memory_in_use -= std::min(memory_estimate, d->memory_in_use);
+    d->running_probe_count--;
+  }
+
+  d->probe_ended.notify_all();
+}
+
+std::size_t ProbeAdmissionController::delayedProbeCount() const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->delayed_probe_count;
+}
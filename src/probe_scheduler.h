@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class ProbeCostModel;
+
+/// A reference to a ProbeCostModel object
+using ProbeCostModelRef = std::shared_ptr<ProbeCostModel>;
+
+/// The ProbeCostModel keeps the probe history of each header, keyed on the
+/// header path: how long probing it took, how much memory the probe needed,
+/// how often it has been accepted and how its last rejection was classified.
+/// The most expensive headers can then be started first, the workers do not
+/// exhaust the memory, and the headers that kept failing can be moved back.
+/// The outcomes are tied to the content fingerprint of the header, and are
+/// forgotten when it changes. The history can be saved and loaded again by
+/// the following runs; all methods are thread safe
+class ProbeCostModel final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor
+  ProbeCostModel();
+
+  /// Destructor
+  ~ProbeCostModel();
+
+  /// Loads the estimates saved by a previous run, replacing the current
+  /// ones; returns false if the file is missing or malformed
+  bool load(const std::string &path);
+
+  /// Saves the estimates, replacing the previous file atomically
+  bool save(const std::string &path) const;
+
+  /// Sets the content fingerprint of the given header; the recorded
+  /// outcomes are discarded if it differs from the one they were measured
+  /// with. The costs are kept, since they are still the best guess
+  void setFingerprint(const std::string &header_path, std::uint64_t hash);
+
+  /// Drops the headers that have not been probed, or fingerprinted, by the
+  /// last given amount of runs (including the current one); returns how
+  /// many have been removed
+  std::size_t compact(std::size_t max_idle_run_count);
+
+  /// Returns the estimated cost of the given header, in seconds; returns
+  /// false if the header has never been probed
+  bool estimate(double &cost, const std::string &header_path) const;
+
+  /// Records the cost of a probe of the given header, in seconds; the
+  /// estimate is a moving average of the recorded costs
+  void update(const std::string &header_path, double cost);
+
+  /// Returns the estimated frontend memory used by a probe of the given
+  /// header, in bytes; returns false if the header has never been probed
+  bool estimateMemory(std::uint64_t &memory_usage,
+                      const std::string &header_path) const;
+
+  /// Records the frontend memory used by a probe of the given header, in
+  /// bytes; the estimate is the peak of the recorded values
+  void updateMemory(const std::string &header_path,
+                    std::uint64_t memory_usage);
+
+  /// Returns the fraction of the probes of the given header that have been
+  /// accepted; returns false if the header has never been probed with its
+  /// current contents
+  bool estimateAcceptance(double &acceptance_ratio,
+                          const std::string &header_path) const;
+
+  /// Returns how the last rejection of the given header has been
+  /// classified; the string is empty if the header has never been rejected
+  std::string lastFailureClass(const std::string &header_path) const;
+
+  /// Records the outcome of a probe of the given header. The failure class
+  /// is a single word, such as "timeout", and is ignored for accepted probes
+  void recordOutcome(const std::string &header_path, bool accepted,
+                     const std::string &failure_class = std::string());
+
+  /// Disable the copy constructor
+  ProbeCostModel(const ProbeCostModel &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeCostModel &operator=(const ProbeCostModel &other) = delete;
+};
+
+/// The ProbeScheduler distributes the requests of a probe() call among the
+/// workers. Requests are sorted by estimated cost, most expensive first, and
+/// dealt to the worker with the smallest estimated load; each worker owns a
+/// deque and takes its requests from the front, while workers that run out
+/// of requests steal from the back of the others. All methods are thread
+/// safe
+class ProbeScheduler final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor; the cost list holds the estimate of each request, in the
+  /// same order as the requests
+  ProbeScheduler(std::size_t worker_count,
+                 const std::vector<double> &cost_list);
+
+  /// Destructor
+  ~ProbeScheduler();
+
+  /// Returns the next request of the given worker, stealing one when its
+  /// deque is empty; returns false when all the requests have been taken
+  bool next(std::size_t &request_index, std::size_t worker_index);
+
+  /// Steals up to the given amount of requests, for workers that do not own
+  /// a deque (such as the remote ones); returns false when all the requests
+  /// have been taken
+  bool steal(std::vector<std::size_t> &request_index_list,
+             std::size_t max_request_count);
+
+  /// Returns the amount of requests that have been stolen
+  std::size_t stolenRequestCount() const;
+
+  /// Disable the copy constructor
+  ProbeScheduler(const ProbeScheduler &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeScheduler &operator=(const ProbeScheduler &other) = delete;
+};
+
+/// Returns the memory that the control group of this process (cgroup v2 or
+/// v1) can still allocate, in bytes; returns false when there is no limit
+bool getControlGroupMemoryLimit(std::uint64_t &memory_limit);
+
+/// The ProbeAdmissionController limits the probes running at the same time,
+/// so that the sum of their estimated memory stays within a budget. A probe
+/// is always admitted when no other one is running, so that a header larger
+/// than the whole budget can still be probed. All methods are thread safe
+class ProbeAdmissionController final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor; the budget is in bytes
+  ProbeAdmissionController(std::uint64_t memory_budget);
+
+  /// Destructor
+  ~ProbeAdmissionController();
+
+  /// Returns the memory budget, in bytes
+  std::uint64_t memoryBudget() const;
+
+  /// Blocks until a probe with the given estimate fits in the budget
+  void acquire(std::uint64_t memory_estimate);
+
+  /// Ends a probe started with acquire(), passing the same estimate
+  void release(std::uint64_t memory_estimate);
+
+  /// Returns the amount of probes that had to wait for other ones to end
+  std::size_t delayedProbeCount() const;
+
+  /// Disable the copy constructor
+  ProbeAdmissionController(const ProbeAdmissionController &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeAdmissionController &operator=(const ProbeAdmissionController &other) =
+      delete;
+};
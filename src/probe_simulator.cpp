@@ -0,0 +1,700 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_simulator.h"
+
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+/// The recorded outcomes of a single include directive
+struct DirectiveModel final {
+  /// True if the directive has been accepted at least once
+  bool ever_succeeded{false};
+
+  /// The headers (as indexes in the header list) that must have been
+  /// accepted for the directive to compile
+  std::vector<std::size_t> required_header_list;
+
+  /// The cost of the directive on its own, in seconds
+  double own_cost{0.0};
+
+  /// True if the cost has been measured
+  bool has_own_cost{false};
+};
+
+/// An include directive compiled on top of the prefix of a record, along
+/// with the directives of the same record that precede it
+struct DirectiveObservation final {
+  /// The record, as an index in the record list
+  std::size_t record_index{0U};
+
+  /// How many directives of the record precede the observed one
+  std::size_t preceding_directive_count{0U};
+};
+
+/// The state of a simulated run
+struct SimulationState final {
+  /// The flag of each accepted header
+  std::vector<bool> accepted_header_flags;
+
+  /// How many headers have been accepted
+  std::size_t accepted_header_count{0U};
+
+  /// The projected cost
+  ProbeSimulationResult result;
+};
+}  // namespace
+
+/// Private class data
+struct ProbeSimulator::PrivateData final {
+  /// The candidate headers of the log
+  std::vector<ProbeLogHeader> header_list;
+
+  /// The header each include directive belongs to
+  std::unordered_map<std::string, std::size_t> directive_header_map;
+
+  /// The model of each include directive that has a recorded outcome
+  std::unordered_map<std::string, DirectiveModel> directive_model_map;
+
+  /// The headers accepted by the recorded run, in order
+  std::vector<std::size_t> accepted_header_list;
+
+  /// The fixed cost of a compilation, in seconds
+  double base_cost{0.0};
+
+  /// The cost of each directive in the prefix of a compilation, in seconds
+  double prefix_directive_cost{0.0};
+
+  /// The cost used for the directives that have never been compiled on
+  /// their own
+  double default_own_cost{0.0};
+
+  /// Returns the projected time of a compilation
+  double compileCost(std::size_t prefix_size,
+                     const StringList &include_directive_list) const;
+
+  /// Returns true if the given directive compiles on top of the headers
+  /// that have been accepted
+  bool succeeds(const SimulationState &state,
+                const std::string &include_directive) const;
+
+  /// Probes a single header, trying its include directives in order; the
+  /// accepted directive is not committed. Returns how long it took
+  double probeHeader(SimulationState &state, std::size_t header_index,
+                     bool &succeeded) const;
+
+  /// Accepts the given header
+  void acceptHeader(SimulationState &state, std::size_t header_index) const;
+
+  /// Returns the candidate headers in the given order
+  bool orderHeaders(std::vector<std::size_t> &header_index_list,
+                    const std::string &header_order) const;
+
+  /// Simulates the sequential strategy
+  void simulateSequential(SimulationState &state,
+                          std::vector<std::size_t> pending_header_list,
+                          std::size_t worker_count) const;
+
+  /// Simulates the batch strategy
+  void simulateBatch(SimulationState &state,
+                     std::vector<std::size_t> pending_header_list,
+                     std::size_t batch_size) const;
+
+  /// Simulates the attribute strategy
+  void simulateAttribution(SimulationState &state,
+                           std::vector<std::size_t> pending_header_list) const;
+
+  /// Probes the [begin, end) range as a single group, bisecting it when it
+  /// fails; see bisectProbes() in generate_command.cpp
+  void bisect(SimulationState &state,
+              const std::vector<std::size_t> &pending_header_list,
+              std::size_t begin, std::size_t end,
+              std::vector<bool> &accepted_pending_flags) const;
+};
+
+ProbeSimulator::ProbeSimulator(const ProbeLog &probe_log)
+    : d(new PrivateData) {
+  d->header_list = probe_log.header_list;
+
+  for (std::size_t i = 0U; i < d->header_list.size(); ++i) {
+    for (const auto &include_directive :
+         d->header_list[i].include_directive_list) {
+      d->directive_header_map.insert({include_directive, i});
+    }
+  }
+
+  const auto &record_list = probe_log.record_list;
+
+  // Go through the records in order, remembering the last failure of each
+  // directive until its first success
+  std::unordered_map<std::string, DirectiveObservation> last_failure_map;
+  std::vector<char> header_marks(d->header_list.size(), 0);
+
+  auto L_forEachPrefixHeader = [&](const DirectiveObservation &observation,
+                                   const auto &callback) {
+    const auto &record = record_list[observation.record_index];
+    const auto &prefix_base = probe_log.prefix_base_list[record.prefix_base];
+
+    auto L_visit = [&](const std::string &include_directive) {
+      auto it = d->directive_header_map.find(include_directive);
+      if (it != d->directive_header_map.end()) {
+        callback(it->second);
+      }
+    };
+
+    for (std::size_t i = 0U; i < record.prefix_size; ++i) {
+      L_visit(prefix_base[i]);
+    }
+
+    for (std::size_t i = 0U; i < observation.preceding_directive_count; ++i) {
+      L_visit(record.include_directive_list[i]);
+    }
+  };
+
+  auto L_observe = [&](const DirectiveObservation &observation,
+                       bool succeeded) {
+    const auto &record = record_list[observation.record_index];
+    const auto &include_directive =
+        record.include_directive_list[observation.preceding_directive_count];
+
+    auto &model = d->directive_model_map[include_directive];
+    if (model.ever_succeeded) {
+      return;
+    }
+
+    if (!succeeded) {
+      last_failure_map[include_directive] = observation;
+      return;
+    }
+
+    model.ever_succeeded = true;
+
+    auto header_it = d->directive_header_map.find(include_directive);
+    if (header_it != d->directive_header_map.end()) {
+      d->accepted_header_list.push_back(header_it->second);
+    }
+
+    // The headers accepted since the last failure are the ones that made
+    // the difference
+    std::vector<std::size_t> marked_header_list;
+    L_forEachPrefixHeader(observation, [&](std::size_t header_index) {
+      if (header_marks[header_index] == 0) {
+        header_marks[header_index] = 1;
+        marked_header_list.push_back(header_index);
+      }
+    });
+
+    auto failure_it = last_failure_map.find(include_directive);
+    if (failure_it != last_failure_map.end()) {
+      L_forEachPrefixHeader(failure_it->second,
+                            [&](std::size_t header_index) {
+                              if (header_marks[header_index] == 1) {
+                                header_marks[header_index] = 2;
+                              }
+                            });
+
+      last_failure_map.erase(failure_it);
+    }
+
+    for (auto header_index : marked_header_list) {
+      if (header_marks[header_index] == 1) {
+        model.required_header_list.push_back(header_index);
+      }
+
+      header_marks[header_index] = 0;
+    }
+  };
+
+  // Single directive probes also give the timings
+  std::unordered_map<std::string, std::vector<std::pair<double, double>>>
+      timing_map;
+
+  double size_sum = 0.0;
+  double time_sum = 0.0;
+  double size_square_sum = 0.0;
+  double size_time_sum = 0.0;
+  std::size_t timing_count = 0U;
+
+  for (std::size_t i = 0U; i < record_list.size(); ++i) {
+    const auto &record = record_list[i];
+    const auto &include_directive_list = record.include_directive_list;
+
+    if (include_directive_list.empty()) {
+      continue;
+    }
+
+    if (!record.attribution && include_directive_list.size() == 1U) {
+      L_observe({i, 0U}, record.succeeded);
+
+      if (!record.cached && !record.timed_out) {
+        auto prefix_size = static_cast<double>(record.prefix_size);
+
+        timing_map[include_directive_list.front()].push_back(
+            {prefix_size, record.wall_time});
+
+        size_sum += prefix_size;
+        time_sum += record.wall_time;
+        size_square_sum += prefix_size * prefix_size;
+        size_time_sum += prefix_size * record.wall_time;
+        ++timing_count;
+      }
+
+      continue;
+    }
+
+    // A failed group does not tell which directive failed, unless the
+    // errors have been attributed
+    if (record.succeeded) {
+      for (std::size_t k = 0U; k < include_directive_list.size(); ++k) {
+        L_observe({i, k}, true);
+      }
+
+    } else if (record.attribution) {
+      for (auto k : record.attributed_directive_list) {
+        L_observe({i, k}, false);
+      }
+    }
+  }
+
+  // Least squares fit of the compilation time against the prefix size
+  if (timing_count != 0U) {
+    auto count = static_cast<double>(timing_count);
+    auto size_mean = size_sum / count;
+    auto time_mean = time_sum / count;
+    auto size_variance = size_square_sum / count - size_mean * size_mean;
+
+    if (timing_count > 1U && size_variance > 0.0) {
+      auto covariance = size_time_sum / count - size_mean * time_mean;
+
+      d->prefix_directive_cost = std::max(covariance / size_variance, 0.0);
+      d->base_cost = time_mean - d->prefix_directive_cost * size_mean;
+
+      if (d->base_cost < 0.0) {
+        d->base_cost = 0.0;
+        d->prefix_directive_cost = time_sum / size_sum;
+      }
+
+    } else {
+      d->base_cost = time_mean;
+    }
+  }
+
+  std::vector<double> own_cost_list;
+
+  for (const auto &p : timing_map) {
+    double residual_sum = 0.0;
+    for (const auto &timing : p.second) {
+      residual_sum += timing.second - d->base_cost -
+                      d->prefix_directive_cost * timing.first;
+    }
+
+    auto &model = d->directive_model_map[p.first];
+    model.own_cost =
+        std::max(residual_sum / static_cast<double>(p.second.size()), 0.0);
+    model.has_own_cost = true;
+
+    own_cost_list.push_back(model.own_cost);
+  }
+
+  if (!own_cost_list.empty()) {
+    auto middle = std::next(
+        own_cost_list.begin(),
+        static_cast<std::ptrdiff_t>(own_cost_list.size() / 2U));
+
+    std::nth_element(own_cost_list.begin(), middle, own_cost_list.end());
+    d->default_own_cost = *middle;
+  }
+}
+
+ProbeSimulator::~ProbeSimulator() {}
+
+std::size_t ProbeSimulator::modeledDirectiveCount() const {
+  return d->directive_model_map.size();
+}
+
+bool ProbeSimulator::simulate(ProbeSimulationResult &result,
+                              const ProbeSimulationSettings &settings) const {
+  result = {};
+
+  if (settings.worker_count == 0U || settings.batch_size == 0U) {
+    return false;
+  }
+
+  std::vector<std::size_t> pending_header_list;
+  if (!d->orderHeaders(pending_header_list, settings.header_order)) {
+    return false;
+  }
+
+  SimulationState state;
+  state.accepted_header_flags.resize(d->header_list.size(), false);
+
+  if (settings.probe_strategy == "sequential") {
+    d->simulateSequential(state, std::move(pending_header_list),
+                          settings.worker_count);
+
+  } else if (settings.probe_strategy == "batch") {
+    d->simulateBatch(state, std::move(pending_header_list),
+                     settings.batch_size);
+
+  } else if (settings.probe_strategy == "attribute") {
+    d->simulateAttribution(state, std::move(pending_header_list));
+
+  } else {
+    return false;
+  }
+
+  result = state.result;
+  result.accepted_header_count = state.accepted_header_count;
+
+  return true;
+}
+
+double ProbeSimulator::PrivateData::compileCost(
+    std::size_t prefix_size, const StringList &include_directive_list) const {
+  auto cost =
+      base_cost + prefix_directive_cost * static_cast<double>(prefix_size);
+
+  for (const auto &include_directive : include_directive_list) {
+    auto it = directive_model_map.find(include_directive);
+    if (it != directive_model_map.end() && it->second.has_own_cost) {
+      cost += it->second.own_cost;
+    } else {
+      cost += default_own_cost;
+    }
+  }
+
+  return cost;
+}
+
+bool ProbeSimulator::PrivateData::succeeds(
+    const SimulationState &state, const std::string &include_directive) const {
+  auto it = directive_model_map.find(include_directive);
+  if (it == directive_model_map.end() || !it->second.ever_succeeded) {
+    return false;
+  }
+
+  for (auto header_index : it->second.required_header_list) {
+    if (!state.accepted_header_flags[header_index]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+double ProbeSimulator::PrivateData::probeHeader(SimulationState &state,
+                                                std::size_t header_index,
+                                                bool &succeeded) const {
+  succeeded = false;
+  double cost = 0.0;
+
+  for (const auto &include_directive :
+       header_list[header_index].include_directive_list) {
+    cost += compileCost(state.accepted_header_count, {include_directive});
+    ++state.result.compile_count;
+
+    if (succeeds(state, include_directive)) {
+      succeeded = true;
+      break;
+    }
+  }
+
+  state.result.cpu_time += cost;
+  return cost;
+}
+
+void ProbeSimulator::PrivateData::acceptHeader(SimulationState &state,
+                                               std::size_t header_index) const {
+  if (!state.accepted_header_flags[header_index]) {
+    state.accepted_header_flags[header_index] = true;
+    ++state.accepted_header_count;
+  }
+}
+
+bool ProbeSimulator::PrivateData::orderHeaders(
+    std::vector<std::size_t> &header_index_list,
+    const std::string &header_order) const {
+  header_index_list.clear();
+
+  if (header_order == "recorded" || header_order == "reverse") {
+    for (std::size_t i = 0U; i < header_list.size(); ++i) {
+      header_index_list.push_back(i);
+    }
+
+    if (header_order == "reverse") {
+      std::reverse(header_index_list.begin(), header_index_list.end());
+    }
+
+    return true;
+  }
+
+  if (header_order != "accepted") {
+    return false;
+  }
+
+  std::vector<bool> header_flags(header_list.size(), false);
+  for (auto header_index : accepted_header_list) {
+    if (!header_flags[header_index]) {
+      header_flags[header_index] = true;
+      header_index_list.push_back(header_index);
+    }
+  }
+
+  for (std::size_t i = 0U; i < header_list.size(); ++i) {
+    if (!header_flags[i]) {
+      header_index_list.push_back(i);
+    }
+  }
+
+  return true;
+}
+
+void ProbeSimulator::PrivateData::simulateSequential(
+    SimulationState &state, std::vector<std::size_t> pending_header_list,
+    std::size_t worker_count) const {
+  // Same as the sequential probe strategy: the headers of each group are
+  // probed concurrently on top of the same include list, and the ones
+  // following the first accepted header are probed again
+  std::size_t header_index = 0U;
+  auto sweep_start_count = state.accepted_header_count;
+
+  while (true) {
+    while (header_index < pending_header_list.size()) {
+      auto group_end =
+          std::min(header_index + worker_count, pending_header_list.size());
+
+      double group_wall_time = 0.0;
+      auto accepted_index = std::numeric_limits<std::size_t>::max();
+
+      for (auto i = header_index; i < group_end; ++i) {
+        bool succeeded;
+        auto cost = probeHeader(state, pending_header_list[i], succeeded);
+
+        group_wall_time = std::max(group_wall_time, cost);
+        if (succeeded && accepted_index > i) {
+          accepted_index = i;
+        }
+      }
+
+      state.result.wall_time += group_wall_time;
+
+      if (accepted_index == std::numeric_limits<std::size_t>::max()) {
+        header_index = group_end;
+        continue;
+      }
+
+      acceptHeader(state, pending_header_list[accepted_index]);
+
+      pending_header_list.erase(std::next(
+          pending_header_list.begin(),
+          static_cast<std::ptrdiff_t>(accepted_index)));
+
+      header_index = accepted_index;
+    }
+
+    if (sweep_start_count == state.accepted_header_count) {
+      break;
+    }
+
+    header_index = 0U;
+    sweep_start_count = state.accepted_header_count;
+  }
+}
+
+void ProbeSimulator::PrivateData::bisect(
+    SimulationState &state,
+    const std::vector<std::size_t> &pending_header_list, std::size_t begin,
+    std::size_t end, std::vector<bool> &accepted_pending_flags) const {
+  if (end - begin == 1U) {
+    if (accepted_pending_flags[begin]) {
+      return;
+    }
+
+    bool succeeded;
+    state.result.wall_time +=
+        probeHeader(state, pending_header_list[begin], succeeded);
+
+    if (succeeded) {
+      acceptHeader(state, pending_header_list[begin]);
+      accepted_pending_flags[begin] = true;
+    }
+
+    return;
+  }
+
+  StringList include_directive_list;
+  std::vector<std::size_t> group_list;
+
+  for (auto i = begin; i < end; ++i) {
+    const auto &header_directive_list =
+        header_list[pending_header_list[i]].include_directive_list;
+
+    if (!accepted_pending_flags[i] && !header_directive_list.empty()) {
+      include_directive_list.push_back(header_directive_list.front());
+      group_list.push_back(i);
+    }
+  }
+
+  if (include_directive_list.empty()) {
+    return;
+  }
+
+  auto cost = compileCost(state.accepted_header_count, include_directive_list);
+  state.result.cpu_time += cost;
+  state.result.wall_time += cost;
+  ++state.result.compile_count;
+
+  // Each directive sees the ones preceding it in the group
+  auto group_state = state;
+  bool succeeded = true;
+
+  for (std::size_t k = 0U; k < group_list.size(); ++k) {
+    if (!succeeds(group_state, include_directive_list[k])) {
+      succeeded = false;
+      break;
+    }
+
+    acceptHeader(group_state, pending_header_list[group_list[k]]);
+  }
+
+  if (succeeded) {
+    for (auto i : group_list) {
+      acceptHeader(state, pending_header_list[i]);
+      accepted_pending_flags[i] = true;
+    }
+
+    return;
+  }
+
+  auto middle = begin + (end - begin) / 2U;
+  bisect(state, pending_header_list, begin, middle, accepted_pending_flags);
+  bisect(state, pending_header_list, middle, end, accepted_pending_flags);
+}
+
+void ProbeSimulator::PrivateData::simulateBatch(
+    SimulationState &state, std::vector<std::size_t> pending_header_list,
+    std::size_t batch_size) const {
+  while (true) {
+    auto previous_accepted_header_count = state.accepted_header_count;
+
+    std::vector<bool> accepted_pending_flags(pending_header_list.size(),
+                                             false);
+
+    for (std::size_t begin = 0U; begin < pending_header_list.size();
+         begin += batch_size) {
+      auto end = std::min(begin + batch_size, pending_header_list.size());
+      bisect(state, pending_header_list, begin, end, accepted_pending_flags);
+    }
+
+    std::vector<std::size_t> next_pending_header_list;
+    for (std::size_t i = 0U; i < pending_header_list.size(); ++i) {
+      if (!accepted_pending_flags[i]) {
+        next_pending_header_list.push_back(pending_header_list[i]);
+      }
+    }
+
+    pending_header_list = std::move(next_pending_header_list);
+
+    if (previous_accepted_header_count == state.accepted_header_count) {
+      break;
+    }
+  }
+}
+
+void ProbeSimulator::PrivateData::simulateAttribution(
+    SimulationState &state,
+    std::vector<std::size_t> pending_header_list) const {
+  while (true) {
+    auto previous_accepted_header_count = state.accepted_header_count;
+
+    // Each candidate is a header, along with the directive being tried
+    std::vector<std::pair<std::size_t, std::size_t>> candidate_list;
+    for (auto header_index : pending_header_list) {
+      if (!header_list[header_index].include_directive_list.empty()) {
+        candidate_list.push_back({header_index, 0U});
+      }
+    }
+
+    while (!candidate_list.empty()) {
+      StringList include_directive_list;
+      for (const auto &candidate : candidate_list) {
+        include_directive_list.push_back(
+            header_list[candidate.first]
+                .include_directive_list[candidate.second]);
+      }
+
+      auto cost =
+          compileCost(state.accepted_header_count, include_directive_list);
+      state.result.cpu_time += cost;
+      state.result.wall_time += cost;
+      ++state.result.compile_count;
+
+      // The errors are attributed exactly; each directive sees the ones
+      // preceding it that compile
+      auto group_state = state;
+      std::vector<bool> failed_candidate_flags(candidate_list.size(), false);
+      bool succeeded = true;
+
+      for (std::size_t k = 0U; k < candidate_list.size(); ++k) {
+        if (succeeds(group_state, include_directive_list[k])) {
+          acceptHeader(group_state, candidate_list[k].first);
+        } else {
+          failed_candidate_flags[k] = true;
+          succeeded = false;
+        }
+      }
+
+      if (succeeded) {
+        for (const auto &candidate : candidate_list) {
+          acceptHeader(state, candidate.first);
+        }
+
+        break;
+      }
+
+      std::vector<std::pair<std::size_t, std::size_t>> next_candidate_list;
+
+      for (std::size_t k = 0U; k < candidate_list.size(); ++k) {
+        auto candidate = candidate_list[k];
+
+        if (failed_candidate_flags[k] &&
+            ++candidate.second >=
+                header_list[candidate.first].include_directive_list.size()) {
+          continue;
+        }
+
+        next_candidate_list.push_back(candidate);
+      }
+
+      candidate_list = std::move(next_candidate_list);
+    }
+
+    std::vector<std::size_t> next_pending_header_list;
+    for (auto header_index : pending_header_list) {
+      if (!state.accepted_header_flags[header_index]) {
+        next_pending_header_list.push_back(header_index);
+      }
+    }
+
+    pending_header_list = std::move(next_pending_header_list);
+
+    if (previous_accepted_header_count == state.accepted_header_count) {
+      break;
+    }
+  }
+}
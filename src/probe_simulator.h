@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "probe_log.h"
+
+#include <memory>
+#include <string>
+
+/// Settings for ProbeSimulator::simulate()
+struct ProbeSimulationSettings final {
+  /// The probe strategy: "sequential", "batch" or "attribute"
+  std::string probe_strategy{"sequential"};
+
+  /// The order of the candidate headers: "recorded" keeps the order of the
+  /// log, "reverse" inverts it, and "accepted" places the headers accepted
+  /// by the recorded run first, in the order they were accepted
+  std::string header_order{"recorded"};
+
+  /// How many headers the sequential strategy probes concurrently
+  std::size_t worker_count{1U};
+
+  /// How many headers are tested at once by the batch strategy
+  std::size_t batch_size{32U};
+};
+
+/// The projected cost of a probe strategy
+struct ProbeSimulationResult final {
+  /// How many compilations the strategy needs
+  std::size_t compile_count{0U};
+
+  /// How many headers end up accepted
+  std::size_t accepted_header_count{0U};
+
+  /// The sum of the compilation times, in seconds
+  double cpu_time{0.0};
+
+  /// How long the probing would last, in seconds
+  double wall_time{0.0};
+};
+
+/// The ProbeSimulator replays a probe log under other strategies, without
+/// compiling anything. The outcome of a directive on a prefix is derived
+/// from the recorded outcomes: a directive that has never been accepted
+/// always fails, while the others need the headers that were accepted
+/// between their last recorded failure and their first success. The cost
+/// of a compilation is the sum of a term that grows with the size of the
+/// prefix, fitted on the recorded timings, and of the cost of each
+/// directive on its own. Headers included by other headers and failure
+/// schedules are not modeled
+class ProbeSimulator final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor; builds the outcome and cost models from the given log
+  ProbeSimulator(const ProbeLog &probe_log);
+
+  /// Destructor
+  ~ProbeSimulator();
+
+  /// Returns the amount of include directives that have a recorded outcome
+  std::size_t modeledDirectiveCount() const;
+
+  /// Simulates the given strategy; returns false if the settings are not
+  /// valid
+  bool simulate(ProbeSimulationResult &result,
+                const ProbeSimulationSettings &settings) const;
+
+  /// Disable the copy constructor
+  ProbeSimulator(const ProbeSimulator &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeSimulator &operator=(const ProbeSimulator &other) = delete;
+};
@@ -0,0 +1,1043 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "probe_strategy.h"
+#include "generate_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+#include <random>
+#include <set>
+
+namespace {
+/// The most prerequisites that are probed for a single failure; common
+/// identifiers may be declared by many of the candidate headers
+const std::size_t kMaxPrerequisiteProbes = 4U;
+
+/// The seed used to pick the headers sampled by the strategy selection, so
+/// that the same header list always selects the same sample
+const std::uint32_t kStrategySampleSeed = 0x41424947U;
+
+/// The batch sizes compared by the strategy selection
+const std::array<std::size_t, 6> kModeledBatchSizeList = {4U,  8U,  16U,
+                                                          32U, 64U, 128U};
+
+/// The most sweeps the cost model expects after the first one
+const double kMaxModeledRetrySweeps = 8.0;
+
+/// Returns how many sweeps the cost model expects after the first one: one
+/// for each level of dependencies between the failed headers, plus a last
+/// one that accepts nothing
+double modeledRetrySweeps(const ProbeSampleStatistics &statistics) {
+  auto remaining_fraction = 1.0 - statistics.dependency_density;
+  if (remaining_fraction * kMaxModeledRetrySweeps <= 1.0) {
+    return kMaxModeledRetrySweeps;
+  }
+
+  return 1.0 / remaining_fraction;
+}
+
+/// Returns the predicted time of a sequential sweep over the given amount
+/// of headers
+double sequentialSweepCost(const ProbeSampleStatistics &statistics,
+                           double header_count, std::size_t worker_count) {
+  return header_count * (statistics.prefix_cost + statistics.header_cost) /
+         static_cast<double>(std::max<std::size_t>(1U, worker_count));
+}
+
+/// Returns the predicted time of a batch sweep over the given amount of
+/// headers; a group that fails is bisected down to each of the headers
+/// breaking it
+double batchSweepCost(const ProbeSampleStatistics &statistics,
+                      double header_count, std::size_t batch_size) {
+  if (header_count <= 0.0) {
+    return 0.0;
+  }
+
+  auto group_size = std::min(static_cast<double>(batch_size), header_count);
+  auto group_count = std::ceil(header_count / group_size);
+  auto group_cost =
+      statistics.prefix_cost + group_size * statistics.header_cost;
+
+  auto failure_probability =
+      1.0 - std::pow(1.0 - statistics.failure_rate, group_size);
+
+  auto failed_header_count =
+      std::max(1.0, statistics.failure_rate * group_size);
+
+  auto bisection_compile_count =
+      std::min(2.0 * group_size - 2.0,
+               2.0 * failed_header_count * std::log2(group_size));
+
+  auto bisection_cost =
+      bisection_compile_count *
+      (statistics.prefix_cost + group_size * statistics.header_cost / 2.0);
+
+  return group_count * (group_cost + failure_probability * bisection_cost);
+}
+
+/// Returns the predicted time of an attribution sweep over the given amount
+/// of headers; each compilation is expected to drop half of the failed
+/// headers that are left
+double attributionSweepCost(const ProbeSampleStatistics &statistics,
+                            double header_count) {
+  if (header_count <= 0.0) {
+    return 0.0;
+  }
+
+  auto compile_count =
+      1.0 + std::ceil(std::log2(1.0 + statistics.failure_rate * header_count));
+
+  return compile_count *
+         (statistics.prefix_cost + header_count * statistics.header_cost);
+}
+
+/// Writes a sweep boundary to the event stream, if any
+void emitSweepEvent(EventStream *event_stream, const std::string &type,
+                    const std::string &strategy,
+                    const StringList &active_include_headers,
+                    const std::vector<HeaderDescriptor> &header_files) {
+  if (event_stream == nullptr) {
+    return;
+  }
+
+  event_stream->emit(
+      type, {{"strategy", strategy},
+             {"accepted_headers",
+              static_cast<double>(active_include_headers.size())},
+             {"pending_headers", static_cast<double>(header_files.size())}});
+}
+
+/// Probes the headers one at a time; the first sweep starts from the given
+/// progress, so that a checkpoint can be resumed. When a failure scheduler
+/// is set, failed headers are only probed again if their failure may have
+/// gone away, and the headers missing an identifier are probed again right
+/// after one of their prerequisites has been accepted
+class SequentialProbeStrategy : public ProbeStrategy {
+  /// The position of each pending header in the current sweep, keyed on
+  /// the header path
+  std::unordered_map<std::string, std::size_t> header_position_map;
+
+  /// Probes the pending prerequisites of the given failed header, until one
+  /// of them is accepted, and then the header itself; returns true if the
+  /// header has been accepted
+  bool probePrerequisites(ProbeSweep &sweep, std::size_t header_index);
+
+ protected:
+  /// Returns true, since the sweeps keep track of their position
+  virtual bool resumable() const override { return true; }
+
+  /// Returns the strategy name written to the sweep events
+  virtual std::string sweepName() const override { return "sequential"; }
+
+  /// Probes the pending headers once
+  virtual void runSweep(ProbeSweep &sweep) override;
+
+ public:
+  /// Constructor
+  SequentialProbeStrategy(const ProbeStrategyContext &context)
+      : ProbeStrategy(context) {}
+
+  /// Destructor
+  virtual ~SequentialProbeStrategy() override = default;
+};
+
+/// Probes the headers in groups of batch_size, bisecting the groups that
+/// fail to compile. The checkpoints are only saved at the start of each
+/// sweep
+class BatchProbeStrategy : public ProbeStrategy {
+  /// Probes the [begin, end) header range as a single group; when the group
+  /// fails, it is split in half and each half is probed again. Single
+  /// headers go through a regular probe, trying every possible include
+  /// directive
+  void bisect(ProbeSweep &sweep, std::size_t begin, std::size_t end);
+
+ protected:
+  /// Returns the strategy name written to the sweep events
+  virtual std::string sweepName() const override { return "batch"; }
+
+  /// Probes the pending headers once
+  virtual void runSweep(ProbeSweep &sweep) override;
+
+ public:
+  /// Constructor
+  BatchProbeStrategy(const ProbeStrategyContext &context)
+      : ProbeStrategy(context) {}
+
+  /// Destructor
+  virtual ~BatchProbeStrategy() override = default;
+};
+
+/// Compiles all the pending headers at once; the headers the errors are
+/// attributed to (through the include stack of each error) move on to their
+/// next include directive, or are left out when they have none, and the
+/// rest is compiled again until it succeeds. When the errors can't be
+/// attributed, the remaining sweeps use the batch strategy
+class AttributionProbeStrategy final : public BatchProbeStrategy {
+  /// Set once the errors could not be attributed
+  bool use_batch_sweeps{false};
+
+ protected:
+  /// Returns the strategy name written to the sweep events
+  virtual std::string sweepName() const override {
+    return use_batch_sweeps ? "batch" : "attribute";
+  }
+
+  /// Probes the pending headers once
+  virtual void runSweep(ProbeSweep &sweep) override;
+
+ public:
+  /// Constructor
+  AttributionProbeStrategy(const ProbeStrategyContext &context)
+      : BatchProbeStrategy(context) {}
+
+  /// Destructor
+  virtual ~AttributionProbeStrategy() override = default;
+};
+
+/// Creates a strategy of the given type
+template <typename StrategyType>
+ProbeStrategy *constructProbeStrategy(const ProbeStrategyContext &context) {
+  return new StrategyType(context);
+}
+
+/// The available strategies; the first one is the default
+const std::vector<std::pair<std::string, ProbeStrategy *(*)(
+                                             const ProbeStrategyContext &)>>
+    kProbeStrategyList = {
+        {"sequential", constructProbeStrategy<SequentialProbeStrategy>},
+        {"batch", constructProbeStrategy<BatchProbeStrategy>},
+        {"attribute", constructProbeStrategy<AttributionProbeStrategy>}};
+
+void SequentialProbeStrategy::runSweep(ProbeSweep &sweep) {
+  auto &probe_executor = probeExecutor();
+  auto failure_scheduler = context().failure_scheduler;
+
+  const auto &header_files = sweep.header_files;
+  const auto &removed_header_flags = sweep.removed_header_flags;
+  auto &header_index = sweep.progress.header_index;
+
+  if (failure_scheduler != nullptr) {
+    header_position_map.clear();
+    for (std::size_t i = 0U; i < header_files.size(); ++i) {
+      header_position_map.insert({header_files[i].path, i});
+    }
+  }
+
+  // Headers are speculatively probed in groups, all on top of the same
+  // include list. Results are committed in order: failures preceding the
+  // first accepted header are final, while the ones following it have to
+  // be probed again with the updated include list. This produces the same
+  // output as probing the headers one at a time. Headers that the failure
+  // scheduler does not expect to succeed are skipped
+  while (header_index < header_files.size()) {
+    checkpoint(sweep);
+
+    ProbeRequestList request_list;
+    std::vector<std::size_t> request_index_list;
+
+    auto next_header_index = header_index;
+    while (next_header_index < header_files.size() &&
+           request_list.size() < probe_executor.workerCount()) {
+      const auto &header_desc = header_files[next_header_index];
+      if (!removed_header_flags[next_header_index] &&
+          (failure_scheduler == nullptr ||
+           failure_scheduler->shouldProbe(header_desc))) {
+        request_list.push_back(&header_desc);
+        request_index_list.push_back(next_header_index);
+      }
+
+      ++next_header_index;
+    }
+
+    if (request_list.empty()) {
+      header_index = next_header_index;
+      continue;
+    }
+
+    auto result_list =
+        probe_executor.probe(sweep.active_include_headers, request_list);
+
+    auto accepted_result_it =
+        std::find_if(result_list.begin(), result_list.end(),
+                     [](const ProbeResult &result) -> bool {
+                       return result.succeeded;
+                     });
+
+    auto accepted_request_index = static_cast<std::size_t>(
+        std::distance(result_list.begin(), accepted_result_it));
+
+    if (failure_scheduler != nullptr) {
+      for (std::size_t i = 0U; i < accepted_request_index; ++i) {
+        failure_scheduler->recordFailure(*request_list[i],
+                                         result_list[i].failure_cause);
+      }
+    }
+
+    // The headers following the accepted one are probed again
+    if (accepted_result_it == result_list.end()) {
+      header_index = next_header_index;
+
+    } else {
+      auto accepted_header_index = request_index_list[accepted_request_index];
+
+      acceptHeader(sweep, accepted_header_index,
+                   accepted_result_it->include_directive,
+                   accepted_result_it->included_header_list);
+
+      if (failure_scheduler != nullptr) {
+        failure_scheduler->recordAcceptedProbe(
+            accepted_result_it->read_file_list);
+      }
+
+      header_index = accepted_header_index + 1U;
+    }
+
+    // Instead of waiting for a later sweep to accept the header declaring
+    // a missing identifier, it is looked up and probed right away
+    if (failure_scheduler != nullptr) {
+      for (std::size_t i = 0U; i < accepted_request_index; ++i) {
+        probePrerequisites(sweep, request_index_list[i]);
+      }
+    }
+  }
+}
+
+bool SequentialProbeStrategy::probePrerequisites(ProbeSweep &sweep,
+                                                 std::size_t header_index) {
+  auto &probe_executor = probeExecutor();
+  auto failure_scheduler = context().failure_scheduler;
+
+  const auto &header_files = sweep.header_files;
+  const auto &header_desc = header_files[header_index];
+
+  if (sweep.removed_header_flags[header_index]) {
+    return false;
+  }
+
+  bool prerequisite_accepted = false;
+  std::size_t probe_count = 0U;
+
+  for (const auto &path : failure_scheduler->prerequisiteList(header_desc)) {
+    auto position_it = header_position_map.find(path);
+    if (position_it == header_position_map.end() ||
+        position_it->second == header_index ||
+        sweep.removed_header_flags[position_it->second]) {
+      continue;
+    }
+
+    auto prerequisite_index = position_it->second;
+    const auto &prerequisite_desc = header_files[prerequisite_index];
+
+    if (!failure_scheduler->shouldProbe(prerequisite_desc) ||
+        probe_executor.isQuarantined(prerequisite_desc)) {
+      continue;
+    }
+
+    if (probe_count++ == kMaxPrerequisiteProbes) {
+      break;
+    }
+
+    auto result_list = probe_executor.probe(sweep.active_include_headers,
+                                            {&prerequisite_desc});
+
+    const auto &result = result_list.front();
+    if (!result.succeeded) {
+      failure_scheduler->recordFailure(prerequisite_desc, result.failure_cause);
+      continue;
+    }
+
+    acceptHeader(sweep, prerequisite_index, result.include_directive,
+                 result.included_header_list);
+
+    failure_scheduler->recordAcceptedProbe(result.read_file_list);
+
+    prerequisite_accepted = true;
+    break;
+  }
+
+  // The prerequisite may have included the header, or it may not declare
+  // the identifier after all
+  if (!prerequisite_accepted || sweep.removed_header_flags[header_index] ||
+      !failure_scheduler->shouldProbe(header_desc)) {
+    return false;
+  }
+
+  auto result_list =
+      probe_executor.probe(sweep.active_include_headers, {&header_desc});
+
+  const auto &result = result_list.front();
+  if (!result.succeeded) {
+    failure_scheduler->recordFailure(header_desc, result.failure_cause);
+    return false;
+  }
+
+  acceptHeader(sweep, header_index, result.include_directive,
+               result.included_header_list);
+
+  failure_scheduler->recordAcceptedProbe(result.read_file_list);
+  failure_scheduler->recordResolvedPrerequisite();
+
+  return true;
+}
+
+void BatchProbeStrategy::bisect(ProbeSweep &sweep, std::size_t begin,
+                                std::size_t end) {
+  auto &probe_executor = probeExecutor();
+
+  const auto &header_files = sweep.header_files;
+  auto &accepted_header_flags = sweep.removed_header_flags;
+
+  if (end - begin == 1U) {
+    if (accepted_header_flags[begin]) {
+      return;
+    }
+
+    auto result_list = probe_executor.probe(sweep.active_include_headers,
+                                            {&header_files[begin]});
+
+    if (result_list.front().succeeded) {
+      acceptHeader(sweep, begin, result_list.front().include_directive,
+                   result_list.front().included_header_list);
+    }
+
+    return;
+  }
+
+  // Groups only use the first include directive of each header; headers
+  // without any usable directive can never be accepted, and are left out
+  // along with the ones that have already been included or quarantined
+  StringList include_directive_list;
+  std::vector<std::size_t> group_header_index_list;
+
+  for (auto i = begin; i < end; ++i) {
+    if (accepted_header_flags[i] ||
+        probe_executor.isQuarantined(header_files[i])) {
+      continue;
+    }
+
+    auto possible_include_directives =
+        probe_executor.includeDirectives(header_files[i]);
+
+    if (!possible_include_directives.empty()) {
+      include_directive_list.push_back(possible_include_directives.front());
+      group_header_index_list.push_back(i);
+    }
+  }
+
+  if (include_directive_list.empty()) {
+    return;
+  }
+
+  StringList included_header_list;
+  if (probe_executor.probeIncludeList(sweep.active_include_headers,
+                                      include_directive_list,
+                                      &included_header_list)) {
+    // The headers included by the group are only matched once
+    for (std::size_t i = 0U; i < include_directive_list.size(); ++i) {
+      auto last_header = (i + 1U == include_directive_list.size());
+
+      acceptHeader(sweep, group_header_index_list[i],
+                   include_directive_list[i],
+                   last_header ? included_header_list : StringList());
+    }
+
+    return;
+  }
+
+  auto middle = begin + (end - begin) / 2U;
+
+  bisect(sweep, begin, middle);
+  bisect(sweep, middle, end);
+}
+
+void BatchProbeStrategy::runSweep(ProbeSweep &sweep) {
+  checkpoint(sweep);
+
+  auto batch_size = std::max<std::size_t>(1U, context().batch_size);
+  auto header_count = sweep.header_files.size();
+
+  for (std::size_t begin = 0U; begin < header_count; begin += batch_size) {
+    bisect(sweep, begin, std::min(begin + batch_size, header_count));
+  }
+}
+
+void AttributionProbeStrategy::runSweep(ProbeSweep &sweep) {
+  if (use_batch_sweeps) {
+    BatchProbeStrategy::runSweep(sweep);
+    return;
+  }
+
+  checkpoint(sweep);
+
+  auto &probe_executor = probeExecutor();
+  const auto &header_files = sweep.header_files;
+
+  // Each candidate is a header index, along with the position of the
+  // include directive that is being tried
+  std::vector<std::pair<std::size_t, std::size_t>> candidate_list;
+  std::vector<StringList> include_directive_lists(header_files.size());
+
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    if (probe_executor.isQuarantined(header_files[i])) {
+      continue;
+    }
+
+    include_directive_lists[i] =
+        probe_executor.includeDirectives(header_files[i]);
+
+    if (!include_directive_lists[i].empty()) {
+      candidate_list.push_back({i, 0U});
+    }
+  }
+
+  while (!candidate_list.empty()) {
+    StringList include_directive_list;
+    for (const auto &candidate : candidate_list) {
+      include_directive_list.push_back(
+          include_directive_lists[candidate.first][candidate.second]);
+    }
+
+    std::vector<std::size_t> attributed_directive_list;
+    StringList included_header_list;
+
+    if (probe_executor.attributeIncludeList(
+            sweep.active_include_headers, include_directive_list,
+            attributed_directive_list, &included_header_list)) {
+      for (std::size_t i = 0U; i < candidate_list.size(); ++i) {
+        auto last_header = (i + 1U == candidate_list.size());
+
+        acceptHeader(sweep, candidate_list[i].first,
+                     include_directive_list[i],
+                     last_header ? included_header_list : StringList());
+      }
+
+      return;
+    }
+
+    // The batch sweeps take over, and the first one always runs
+    if (attributed_directive_list.empty()) {
+      use_batch_sweeps = true;
+      sweep.force_next_sweep = true;
+      return;
+    }
+
+    std::vector<bool> failed_candidate_flags(candidate_list.size(), false);
+    for (auto directive_index : attributed_directive_list) {
+      failed_candidate_flags[directive_index] = true;
+    }
+
+    std::vector<std::pair<std::size_t, std::size_t>> next_candidate_list;
+
+    for (std::size_t i = 0U; i < candidate_list.size(); ++i) {
+      auto candidate = candidate_list[i];
+
+      if (failed_candidate_flags[i] &&
+          ++candidate.second >=
+              include_directive_lists[candidate.first].size()) {
+        continue;
+      }
+
+      next_candidate_list.push_back(candidate);
+    }
+
+    candidate_list = std::move(next_candidate_list);
+  }
+}
+}  // namespace
+
+IncludedHeaderTracker::IncludedHeaderTracker(
+    const std::vector<HeaderDescriptor> &header_files) {
+  for (const auto &header_desc : header_files) {
+    llvm::sys::fs::UniqueID unique_id;
+    if (getFileUniqueID(unique_id, header_desc.path)) {
+      header_id_map.insert({header_desc.path, unique_id});
+    }
+  }
+}
+
+void IncludedHeaderTracker::markIncludedHeaders(
+    std::vector<bool> &header_flags,
+    const std::vector<HeaderDescriptor> &header_files,
+    const StringList &included_file_list) {
+  std::set<llvm::sys::fs::UniqueID> included_id_set;
+  for (const auto &path : included_file_list) {
+    llvm::sys::fs::UniqueID unique_id;
+    if (getFileUniqueID(unique_id, path)) {
+      included_id_set.insert(unique_id);
+    }
+  }
+
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    if (header_flags[i]) {
+      continue;
+    }
+
+    auto it = header_id_map.find(header_files[i].path);
+    if (it != header_id_map.end() && included_id_set.count(it->second)) {
+      header_flags[i] = true;
+      ++included_header_count;
+    }
+  }
+}
+
+std::size_t IncludedHeaderTracker::includedHeaderCount() const {
+  return included_header_count;
+}
+
+bool ProbeFailureScheduler::isPermanent(const CompilationErrorCause &cause) {
+  return cause.kind == CompilationErrorKind::MissingIncludeDirective ||
+         cause.kind == CompilationErrorKind::MissingFile ||
+         cause.kind == CompilationErrorKind::Redefinition ||
+         cause.kind == CompilationErrorKind::Timeout;
+}
+
+bool ProbeFailureScheduler::collectFileIdentifiers(
+    std::unordered_set<std::string> &identifier_set, const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  std::string buffer((std::istreambuf_iterator<char>(file)),
+                     std::istreambuf_iterator<char>());
+
+  if (buffer.find("##") != std::string::npos) {
+    return false;
+  }
+
+  auto L_isIdentifierChar = [](char c) -> bool {
+    return std::isalnum(static_cast<unsigned char>(c)) != 0 || c == '_';
+  };
+
+  std::size_t index = 0U;
+  while (index < buffer.size()) {
+    if (!L_isIdentifierChar(buffer[index])) {
+      ++index;
+      continue;
+    }
+
+    auto start = index;
+    while (index < buffer.size() && L_isIdentifierChar(buffer[index])) {
+      ++index;
+    }
+
+    if (std::isdigit(static_cast<unsigned char>(buffer[start])) == 0) {
+      identifier_set.insert(buffer.substr(start, index - start));
+    }
+  }
+
+  return true;
+}
+
+void ProbeFailureScheduler::setIdentifierIndex(
+    DeclaredIdentifierIndex index) {
+  identifier_index = std::move(index);
+}
+
+bool ProbeFailureScheduler::shouldProbe(
+    const HeaderDescriptor &header_desc) const {
+  auto it = header_failure_map.find(header_desc.path);
+  if (it == header_failure_map.end()) {
+    return true;
+  }
+
+  const auto &header_failure = it->second;
+  return !isPermanent(header_failure.cause) && !header_failure.waiting;
+}
+
+StringList ProbeFailureScheduler::prerequisiteList(
+    const HeaderDescriptor &header_desc) const {
+  auto failure_it = header_failure_map.find(header_desc.path);
+  if (failure_it == header_failure_map.end()) {
+    return StringList();
+  }
+
+  const auto &cause = failure_it->second.cause;
+  if (cause.kind != CompilationErrorKind::UndeclaredIdentifier) {
+    return StringList();
+  }
+
+  auto index_it = identifier_index.find(cause.name);
+  if (index_it == identifier_index.end()) {
+    return StringList();
+  }
+
+  return index_it->second;
+}
+
+void ProbeFailureScheduler::recordFailure(const HeaderDescriptor &header_desc,
+                                          const CompilationErrorCause &cause) {
+  auto &header_failure = header_failure_map[header_desc.path];
+  header_failure.cause = cause;
+  header_failure.waiting =
+      (cause.kind == CompilationErrorKind::UndeclaredIdentifier);
+}
+
+void ProbeFailureScheduler::recordAcceptedProbe(
+    const StringList &read_file_list) {
+  std::unordered_set<std::string> identifier_set;
+  bool wake_all = read_file_list.empty();
+
+  for (const auto &path : read_file_list) {
+    if (wake_all) {
+      break;
+    }
+
+    if (!searched_file_set.insert(path).second) {
+      continue;
+    }
+
+    if (!collectFileIdentifiers(identifier_set, path)) {
+      wake_all = true;
+    }
+  }
+
+  for (auto &p : header_failure_map) {
+    auto &header_failure = p.second;
+    if (header_failure.waiting &&
+        (wake_all || identifier_set.count(header_failure.cause.name) != 0U)) {
+      header_failure.waiting = false;
+    }
+  }
+}
+
+std::string ProbeFailureScheduler::failureDescription(
+    const HeaderDescriptor &header_desc) const {
+  auto it = header_failure_map.find(header_desc.path);
+  if (it == header_failure_map.end()) {
+    return std::string();
+  }
+
+  const auto &cause = it->second.cause;
+  switch (cause.kind) {
+    case CompilationErrorKind::MissingIncludeDirective:
+      return "not found with any prefix";
+
+    case CompilationErrorKind::MissingFile:
+      return "missing file: " + cause.name;
+
+    case CompilationErrorKind::Redefinition:
+      return "redefinition of " + cause.name;
+
+    case CompilationErrorKind::ErrorDirective:
+      return "#error " + cause.name;
+
+    case CompilationErrorKind::UndeclaredIdentifier:
+      return "undeclared identifier: " + cause.name;
+
+    case CompilationErrorKind::Timeout:
+      return "timed out";
+
+    case CompilationErrorKind::None:
+    case CompilationErrorKind::Unknown:
+      break;
+  }
+
+  return std::string();
+}
+
+std::size_t ProbeFailureScheduler::droppedHeaderCount() const {
+  return static_cast<std::size_t>(
+      std::count_if(header_failure_map.begin(), header_failure_map.end(),
+                    [](const std::pair<const std::string, HeaderFailure> &p)
+                        -> bool { return isPermanent(p.second.cause); }));
+}
+
+std::size_t ProbeFailureScheduler::waitingHeaderCount() const {
+  return static_cast<std::size_t>(
+      std::count_if(header_failure_map.begin(), header_failure_map.end(),
+                    [](const std::pair<const std::string, HeaderFailure> &p)
+                        -> bool { return p.second.waiting; }));
+}
+
+void ProbeFailureScheduler::recordResolvedPrerequisite() {
+  ++resolved_prerequisite_count;
+}
+
+std::size_t ProbeFailureScheduler::resolvedPrerequisiteCount() const {
+  return resolved_prerequisite_count;
+}
+
+std::size_t removeFlaggedHeaders(std::vector<HeaderDescriptor> &header_files,
+                                 const std::vector<bool> &header_flags,
+                                 std::size_t position) {
+  std::vector<HeaderDescriptor> remaining_header_files;
+  auto adjusted_position = position;
+
+  for (std::size_t i = 0U; i < header_files.size(); ++i) {
+    if (!header_flags[i]) {
+      remaining_header_files.push_back(std::move(header_files[i]));
+    } else if (i < position) {
+      --adjusted_position;
+    }
+  }
+
+  header_files = std::move(remaining_header_files);
+  return adjusted_position;
+}
+
+ProbeSweep::ProbeSweep(StringList &active_include_headers,
+                       std::vector<HeaderDescriptor> &header_files)
+    : active_include_headers(active_include_headers),
+      header_files(header_files) {}
+
+ProbeStrategy::ProbeStrategy(const ProbeStrategyContext &context)
+    : probe_context(context) {}
+
+const ProbeStrategyContext &ProbeStrategy::context() const {
+  return probe_context;
+}
+
+ProbeExecutor &ProbeStrategy::probeExecutor() const {
+  return *probe_context.probe_executor;
+}
+
+void ProbeStrategy::acceptHeader(ProbeSweep &sweep, std::size_t header_index,
+                                 const std::string &include_directive,
+                                 const StringList &included_header_list) {
+  sweep.active_include_headers.push_back(include_directive);
+  sweep.removed_header_flags[header_index] = true;
+
+  if (probe_context.accepted_header_callback) {
+    probe_context.accepted_header_callback(sweep.active_include_headers);
+  }
+
+  if (probe_context.included_header_tracker != nullptr &&
+      !included_header_list.empty()) {
+    probe_context.included_header_tracker->markIncludedHeaders(
+        sweep.removed_header_flags, sweep.header_files, included_header_list);
+  }
+}
+
+void ProbeStrategy::checkpoint(const ProbeSweep &sweep) const {
+  if (probe_context.checkpoint_callback) {
+    probe_context.checkpoint_callback(sweep.active_include_headers,
+                                      sweep.header_files,
+                                      sweep.removed_header_flags,
+                                      sweep.progress);
+  }
+}
+
+bool ProbeStrategy::resumable() const { return false; }
+
+bool ProbeStrategy::continueProbing(const ProbeSweep &sweep) const {
+  return sweep.progress.sweep_start_count !=
+         sweep.active_include_headers.size();
+}
+
+bool ProbeStrategy::create(ProbeStrategyRef &obj, const std::string &name,
+                           const ProbeStrategyContext &context) {
+  obj.reset();
+
+  for (const auto &strategy : kProbeStrategyList) {
+    if (strategy.first == name) {
+      obj.reset(strategy.second(context));
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const StringList &ProbeStrategy::strategyNameList() {
+  static const StringList name_list = []() -> StringList {
+    StringList list;
+    for (const auto &strategy : kProbeStrategyList) {
+      list.push_back(strategy.first);
+    }
+
+    return list;
+  }();
+
+  return name_list;
+}
+
+ProbeStrategy::~ProbeStrategy() {}
+
+void ProbeStrategy::run(StringList &active_include_headers,
+                        std::vector<HeaderDescriptor> &header_files,
+                        const ProbeProgress &progress) {
+  ProbeSweep sweep(active_include_headers, header_files);
+
+  if (resumable()) {
+    sweep.progress = progress;
+  } else {
+    sweep.progress.sweep_start_count = active_include_headers.size();
+  }
+
+  auto event_stream = probe_context.event_stream;
+
+  while (true) {
+    sweep.removed_header_flags.assign(header_files.size(), false);
+    sweep.force_next_sweep = false;
+
+    // Strategies may switch to another algorithm at the end of a sweep
+    auto sweep_name = sweepName();
+
+    emitSweepEvent(event_stream, "sweep_started", sweep_name,
+                   active_include_headers, header_files);
+
+    runSweep(sweep);
+
+    sweep.progress.header_index = removeFlaggedHeaders(
+        header_files, sweep.removed_header_flags, sweep.progress.header_index);
+
+    emitSweepEvent(event_stream, "sweep_finished", sweep_name,
+                   active_include_headers, header_files);
+
+    if (probeExecutor().cancelled()) {
+      break;
+    }
+
+    if (!sweep.force_next_sweep && !continueProbing(sweep)) {
+      break;
+    }
+
+    sweep.progress = ProbeProgress();
+    sweep.progress.sweep_start_count = active_include_headers.size();
+  }
+}
+
+ProbeSampleStatistics
+sampleProbeStatistics(ProbeExecutor &probe_executor,
+                      const StringList &active_include_headers,
+                      const std::vector<HeaderDescriptor> &header_files,
+                      std::size_t sample_size) {
+  ProbeSampleStatistics statistics;
+
+  std::vector<std::size_t> header_index_list(header_files.size());
+  std::iota(header_index_list.begin(), header_index_list.end(), 0U);
+
+  std::mt19937 random_generator(kStrategySampleSeed);
+  std::shuffle(header_index_list.begin(), header_index_list.end(),
+               random_generator);
+
+  header_index_list.resize(std::min(sample_size, header_index_list.size()));
+  std::sort(header_index_list.begin(), header_index_list.end());
+
+  statistics.sample_size = header_index_list.size();
+  if (header_index_list.empty()) {
+    return statistics;
+  }
+
+  ProbeRequestList request_list;
+  for (auto header_index : header_index_list) {
+    request_list.push_back(&header_files[header_index]);
+  }
+
+  auto L_elapsedTime =
+      [](const std::chrono::steady_clock::time_point &start_time) -> double {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start_time)
+        .count();
+  };
+
+  auto start_time = std::chrono::steady_clock::now();
+  probe_executor.probeIncludeList(active_include_headers, {});
+  statistics.prefix_cost = L_elapsedTime(start_time);
+
+  // The sampled headers are probed concurrently, so the elapsed time is
+  // shared by the workers
+  start_time = std::chrono::steady_clock::now();
+  auto result_list = probe_executor.probe(active_include_headers, request_list);
+
+  auto concurrent_probe_count =
+      std::min(probe_executor.workerCount(), request_list.size());
+
+  auto probe_cost = L_elapsedTime(start_time) *
+                    static_cast<double>(concurrent_probe_count) /
+                    static_cast<double>(request_list.size());
+
+  statistics.header_cost = std::max(0.0, probe_cost - statistics.prefix_cost);
+
+  auto extended_include_list = active_include_headers;
+  ProbeRequestList failed_request_list;
+
+  for (std::size_t i = 0U; i < result_list.size(); ++i) {
+    if (result_list[i].succeeded) {
+      extended_include_list.push_back(result_list[i].include_directive);
+    } else {
+      failed_request_list.push_back(request_list[i]);
+    }
+  }
+
+  statistics.failure_rate = static_cast<double>(failed_request_list.size()) /
+                            static_cast<double>(request_list.size());
+
+  // The failed headers that compile on top of the accepted ones hint at
+  // how many sweeps the probing will need
+  if (!failed_request_list.empty() &&
+      extended_include_list.size() != active_include_headers.size()) {
+    auto retry_result_list =
+        probe_executor.probe(extended_include_list, failed_request_list);
+
+    auto accepted_count = std::count_if(
+        retry_result_list.begin(), retry_result_list.end(),
+        [](const ProbeResult &result) -> bool { return result.succeeded; });
+
+    statistics.dependency_density =
+        static_cast<double>(accepted_count) /
+        static_cast<double>(failed_request_list.size());
+  }
+
+  return statistics;
+}
+
+ProbeStrategySelection
+selectProbeStrategy(const ProbeSampleStatistics &statistics,
+                    std::size_t header_count, std::size_t worker_count) {
+  auto pending_header_count = static_cast<double>(header_count);
+  auto failed_header_count = statistics.failure_rate * pending_header_count;
+  auto retry_sweeps = modeledRetrySweeps(statistics);
+
+  ProbeStrategySelection selection;
+  selection.probe_strategy = "sequential";
+  selection.predicted_time =
+      sequentialSweepCost(statistics, pending_header_count, worker_count) +
+      retry_sweeps *
+          sequentialSweepCost(statistics, failed_header_count, worker_count);
+
+  for (auto batch_size : kModeledBatchSizeList) {
+    auto predicted_time =
+        batchSweepCost(statistics, pending_header_count, batch_size) +
+        retry_sweeps *
+            batchSweepCost(statistics, failed_header_count, batch_size);
+
+    if (predicted_time < selection.predicted_time) {
+      selection.probe_strategy = "batch";
+      selection.batch_size = batch_size;
+      selection.predicted_time = predicted_time;
+    }
+  }
+
+  auto predicted_time =
+      attributionSweepCost(statistics, pending_header_count) +
+      retry_sweeps * attributionSweepCost(statistics, failed_header_count);
+
+  if (predicted_time < selection.predicted_time) {
+    selection.probe_strategy = "attribute";
+    selection.predicted_time = predicted_time;
+  }
+
+  return selection;
+}
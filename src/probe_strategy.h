@@ -0,0 +1,341 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "event_stream.h"
+#include "header_dependencies.h"
+#include "probe_executor.h"
+#include "types.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <llvm/Support/FileSystem.h>
+
+/// Called each time a header is added to the include list
+using AcceptedHeaderCallback =
+    std::function<void(const StringList &active_include_headers)>;
+
+/// The position of the probes within the current sweep
+struct ProbeProgress final {
+  /// The position of the next header to probe
+  std::size_t header_index{0U};
+
+  /// How many headers had been accepted when the sweep started
+  std::size_t sweep_start_count{0U};
+};
+
+/// Called between the probes with the pending headers; used to save the
+/// checkpoints. The headers whose flag is set (if the flag list is not
+/// empty) are no longer pending, and the progress does not account for them
+using ProbeCheckpointCallback = std::function<void(
+    const StringList &active_include_headers,
+    const std::vector<HeaderDescriptor> &header_files,
+    const std::vector<bool> &removed_header_flags,
+    const ProbeProgress &progress)>;
+
+/// Matches the guarded headers read by the accepted probes against the
+/// headers that are still pending; files are compared by device and inode,
+/// since clang may have opened them through a different path
+class IncludedHeaderTracker final {
+  /// The identity of each header, keyed on the header path
+  std::unordered_map<std::string, llvm::sys::fs::UniqueID> header_id_map;
+
+  /// How many headers have been found in the accepted probes
+  std::size_t included_header_count{0U};
+
+ public:
+  /// Constructor
+  IncludedHeaderTracker(const std::vector<HeaderDescriptor> &header_files);
+
+  /// Sets the flag of each header that is one of the given included files
+  void markIncludedHeaders(std::vector<bool> &header_flags,
+                           const std::vector<HeaderDescriptor> &header_files,
+                           const StringList &included_file_list);
+
+  /// Returns how many headers have been found in the accepted probes
+  std::size_t includedHeaderCount() const;
+};
+
+/// Decides which of the failed headers are worth probing again, using the
+/// cause of their last failure. The include list only grows, so headers
+/// including a missing file or redefining an accepted declaration can never
+/// be accepted; headers using an undeclared identifier are only probed again
+/// once an accepted header may have declared it. The other failures are
+/// retried after each accepted header, as usual. When an identifier index is
+/// set, the headers that declare a missing identifier are reported as the
+/// prerequisites of the header using it
+class ProbeFailureScheduler final {
+  /// The last failure of a header
+  struct HeaderFailure final {
+    /// The cause of the failure
+    CompilationErrorCause cause;
+
+    /// True while the header waits for its identifier to be declared
+    bool waiting{false};
+  };
+
+  /// The last failure of each header, keyed on the header path
+  std::unordered_map<std::string, HeaderFailure> header_failure_map;
+
+  /// The files read by the accepted probes that have already been searched
+  std::unordered_set<std::string> searched_file_set;
+
+  /// The candidate headers declaring each identifier; empty when the
+  /// prerequisites are not looked up
+  DeclaredIdentifierIndex identifier_index;
+
+  /// How many headers have been accepted right after a prerequisite
+  std::size_t resolved_prerequisite_count{0U};
+
+  /// Returns true if the given failure can't go away
+  static bool isPermanent(const CompilationErrorCause &cause);
+
+  /// Collects the identifiers found in the given file into the set; returns
+  /// false if the file could not be read, or if it pastes tokens together,
+  /// since it may then declare any identifier
+  static bool collectFileIdentifiers(
+      std::unordered_set<std::string> &identifier_set,
+      const std::string &path);
+
+ public:
+  /// Sets the index used to find the headers declaring the missing
+  /// identifiers
+  void setIdentifierIndex(DeclaredIdentifierIndex index);
+
+  /// Returns true if the given header has to be probed with the current
+  /// include list
+  bool shouldProbe(const HeaderDescriptor &header_desc) const;
+
+  /// Returns the paths of the candidate headers that may declare the
+  /// identifier the last failure of the given header was missing, in their
+  /// original order; empty if the failure had another cause
+  StringList prerequisiteList(const HeaderDescriptor &header_desc) const;
+
+  /// Records a failed probe
+  void recordFailure(const HeaderDescriptor &header_desc,
+                     const CompilationErrorCause &cause);
+
+  /// Records an accepted probe; the headers waiting on an identifier that
+  /// is found in one of the new files are probed again. When the read files
+  /// are not known, all the waiting headers are probed again
+  void recordAcceptedProbe(const StringList &read_file_list);
+
+  /// Returns the cause keeping the given header out of the include list, or
+  /// an empty string if it is not known
+  std::string failureDescription(const HeaderDescriptor &header_desc) const;
+
+  /// Returns how many headers have been dropped after a permanent failure
+  std::size_t droppedHeaderCount() const;
+
+  /// Returns how many headers are still waiting on an undeclared identifier
+  std::size_t waitingHeaderCount() const;
+
+  /// Records a header that has been accepted right after a prerequisite
+  void recordResolvedPrerequisite();
+
+  /// Returns how many headers have been accepted right after a prerequisite
+  std::size_t resolvedPrerequisiteCount() const;
+};
+
+/// Removes the flagged headers; returns the given position, adjusted to
+/// account for the headers removed before it
+std::size_t removeFlaggedHeaders(std::vector<HeaderDescriptor> &header_files,
+                                 const std::vector<bool> &header_flags,
+                                 std::size_t position = 0U);
+
+/// What the probe strategies share: the executor compiling the probes, and
+/// the objects observing the accepted headers. Only the executor is
+/// required
+struct ProbeStrategyContext final {
+  /// Compiles the probes
+  ProbeExecutor *probe_executor{nullptr};
+
+  /// How many headers the group strategies compile at once
+  std::size_t batch_size{32U};
+
+  /// Called each time a header is accepted
+  AcceptedHeaderCallback accepted_header_callback;
+
+  /// If set, the headers included by the accepted ones are dropped
+  IncludedHeaderTracker *included_header_tracker{nullptr};
+
+  /// If set, failed headers are only probed again if their failure may have
+  /// gone away; used by the strategies that probe the headers one by one
+  ProbeFailureScheduler *failure_scheduler{nullptr};
+
+  /// If set, receives the sweep boundaries
+  EventStream *event_stream{nullptr};
+
+  /// If set, invoked between the probes to save the checkpoints
+  ProbeCheckpointCallback checkpoint_callback;
+};
+
+/// The state of a single pass over the pending headers
+struct ProbeSweep final {
+  /// Constructor
+  ProbeSweep(StringList &active_include_headers,
+             std::vector<HeaderDescriptor> &header_files);
+
+  /// The accepted include directives; grows as headers are accepted
+  StringList &active_include_headers;
+
+  /// The pending headers; they are only removed at the end of the sweep
+  std::vector<HeaderDescriptor> &header_files;
+
+  /// The headers that are no longer pending (accepted, or included by an
+  /// accepted header)
+  std::vector<bool> removed_header_flags;
+
+  /// Where the sweep is, and how many headers it started from
+  ProbeProgress progress;
+
+  /// Set by the strategy when the next sweep has to run no matter how many
+  /// headers this one accepted
+  bool force_next_sweep{false};
+};
+
+class ProbeStrategy;
+
+/// A reference to a ProbeStrategy object
+using ProbeStrategyRef = std::unique_ptr<ProbeStrategy>;
+
+/// A header acceptance algorithm, driven by run(): each sweep selects the
+/// candidates among the pending headers, groups them into probes for the
+/// shared executor and commits the results; sweeps are repeated until the
+/// strategy terminates, which by default happens once a sweep accepts no
+/// new header. Strategies are created by name with create()
+class ProbeStrategy {
+  /// The shared objects
+  ProbeStrategyContext probe_context;
+
+ protected:
+  /// Constructor
+  ProbeStrategy(const ProbeStrategyContext &context);
+
+  /// Returns the shared objects
+  const ProbeStrategyContext &context() const;
+
+  /// Returns the executor compiling the probes
+  ProbeExecutor &probeExecutor() const;
+
+  /// Appends the given include directive to the include list, flags the
+  /// header as accepted, and notifies the callback and the tracker
+  void acceptHeader(ProbeSweep &sweep, std::size_t header_index,
+                    const std::string &include_directive,
+                    const StringList &included_header_list);
+
+  /// Saves a checkpoint of the sweep, if a callback has been set
+  void checkpoint(const ProbeSweep &sweep) const;
+
+  /// Returns true if the sweep can resume from the middle of the header
+  /// list; the other strategies start their first sweep over
+  virtual bool resumable() const;
+
+  /// Returns the strategy name written to the sweep events
+  virtual std::string sweepName() const = 0;
+
+  /// Probes the pending headers once, starting from the sweep progress;
+  /// accepted headers are flagged in the sweep, and removed by run()
+  virtual void runSweep(ProbeSweep &sweep) = 0;
+
+  /// Returns true if another sweep has to run after the given one
+  virtual bool continueProbing(const ProbeSweep &sweep) const;
+
+ public:
+  /// Creates the strategy with the given name; returns false if there is
+  /// no such strategy (see strategyNameList())
+  static bool create(ProbeStrategyRef &obj, const std::string &name,
+                     const ProbeStrategyContext &context);
+
+  /// Returns the names of the available strategies
+  static const StringList &strategyNameList();
+
+  /// Destructor
+  virtual ~ProbeStrategy();
+
+  /// Probes the pending headers until the strategy terminates; accepted
+  /// headers are appended to the include list and removed from the header
+  /// list. The first sweep starts from the given progress, so that a
+  /// checkpoint can be resumed
+  void run(StringList &active_include_headers,
+           std::vector<HeaderDescriptor> &header_files,
+           const ProbeProgress &progress = ProbeProgress());
+
+  /// Disable the copy constructor
+  ProbeStrategy(const ProbeStrategy &other) = delete;
+
+  /// Disable the assignment operator
+  ProbeStrategy &operator=(const ProbeStrategy &other) = delete;
+};
+
+/// What the automatic strategy selection measured on a sample of the
+/// pending headers
+struct ProbeSampleStatistics final {
+  /// How many headers have been probed
+  std::size_t sample_size{0U};
+
+  /// The fraction of the sampled headers that could not be accepted
+  double failure_rate{0.0};
+
+  /// The time needed to compile the include list alone, in seconds
+  double prefix_cost{0.0};
+
+  /// The time each header adds to a compilation, in seconds
+  double header_cost{0.0};
+
+  /// The fraction of the failed headers that have been accepted once the
+  /// other sampled headers were added to the include list
+  double dependency_density{0.0};
+};
+
+/// The strategy predicted to be the fastest on the pending headers
+struct ProbeStrategySelection final {
+  /// The name of the strategy
+  std::string probe_strategy{"sequential"};
+
+  /// How many headers the batch strategy compiles at once, when it has
+  /// been selected
+  std::size_t batch_size{32U};
+
+  /// The predicted probing time, in seconds
+  double predicted_time{0.0};
+};
+
+/// Probes a small random sample of the pending headers on top of the given
+/// include list, one at a time and then again on top of the accepted ones,
+/// and measures the compilation costs. The sample is always the same for
+/// the same header list; nothing is added to the include list
+ProbeSampleStatistics
+sampleProbeStatistics(ProbeExecutor &probe_executor,
+                      const StringList &active_include_headers,
+                      const std::vector<HeaderDescriptor> &header_files,
+                      std::size_t sample_size);
+
+/// Returns the strategy and batch size that the cost model predicts to be
+/// the fastest on the given amount of pending headers. The model assumes
+/// that the sample is representative and that the include list does not
+/// get more expensive as it grows; the failed headers are probed again by
+/// one sweep for each level of dependencies, and only the sequential
+/// strategy uses more than one worker
+ProbeStrategySelection
+selectProbeStrategy(const ProbeSampleStatistics &statistics,
+                    std::size_t header_count, std::size_t worker_count);
@@ -0,0 +1,1628 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "profile_pack.h"
+#include "content_hash.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/ErrorOr.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+#if LLVM_MAJOR_VERSION <= 7
+namespace vfs = clang::vfs;
+#else
+namespace vfs = llvm::vfs;
+#endif
+
+/// The first bytes of each pack
+const std::array<char, 8> kProfilePackMagic = {
+    {'A', 'B', 'I', 'G', 'P', 'A', 'C', 'K'}};
+
+/// Incremented each time the pack format changes
+const std::uint32_t kProfilePackVersion = 1U;
+
+/// The first line of each manifest
+const std::string kProfileManifestHeader = "abigen-profile-manifest 1";
+
+/// The device number used for the unique IDs of the entries of the first
+/// pack; each pack that is loaded afterwards takes the next one
+const std::uint64_t kProfilePackDeviceId = 0xAB16E4ULL;
+
+/// The next device number to assign
+std::atomic<std::uint64_t> next_profile_pack_device_id{kProfilePackDeviceId};
+
+/// The size of the tar headers; the contents of each member are padded to
+/// the same size
+const std::uint64_t kTarBlockSize = 512U;
+
+/// Where the magic string is located inside a tar header
+const std::size_t kTarMagicOffset = 257U;
+
+/// The magic string of the ustar and GNU tar headers
+const std::string_view kTarMagic = "ustar";
+
+/// The header at the start of each pack; it is followed by the entry table,
+/// the path of each entry and then the file contents
+struct ProfilePackHeader final {
+  /// Always kProfilePackMagic
+  std::array<char, 8> magic;
+
+  /// Always kProfilePackVersion
+  std::uint32_t version;
+
+  /// How many entries follow the header
+  std::uint32_t entry_count;
+};
+
+/// An entry of the pack table; offsets are relative to the start of the
+/// pack file
+struct ProfilePackTableEntry final {
+  /// Where the path is located; paths are relative to the profile root and
+  /// are not null terminated
+  std::uint64_t path_offset;
+
+  /// Where the file contents are located; the contents are always followed
+  /// by a null terminator, so that clang can use them without a copy
+  std::uint64_t data_offset;
+
+  /// The size of the file contents, excluding the null terminator
+  std::uint64_t data_size;
+
+  /// The size of the path
+  std::uint32_t path_size;
+
+  /// 1 for folders, 0 for files
+  std::uint32_t is_directory;
+};
+
+/// Returns the parent of the given relative path; the parent of top level
+/// entries is the root folder, i.e.: the empty path
+std::string_view parentPath(std::string_view path) {
+  auto separator_index = path.rfind('/');
+  if (separator_index == std::string_view::npos) {
+    return std::string_view();
+  }
+
+  return path.substr(0U, separator_index);
+}
+
+/// Normalizes the given tar member path, removing the separators at both
+/// ends and the "." components; returns false if it points outside of the
+/// archive. The root folder is the empty path
+bool normalizeArchivePath(std::string &normalized_path, std::string_view path) {
+  normalized_path.clear();
+
+  while (!path.empty()) {
+    auto separator_index = path.find('/');
+    auto component = path.substr(0U, separator_index);
+
+    path.remove_prefix((separator_index == std::string_view::npos)
+                           ? path.size()
+                           : separator_index + 1U);
+
+    if (component.empty() || component == ".") {
+      continue;
+    }
+
+    if (component == "..") {
+      if (normalized_path.empty()) {
+        return false;
+      }
+
+      normalized_path.resize(parentPath(normalized_path).size());
+      continue;
+    }
+
+    if (!normalized_path.empty()) {
+      normalized_path.push_back('/');
+    }
+
+    normalized_path.append(component.data(), component.size());
+  }
+
+  return true;
+}
+
+/// A profile file or folder, as found by collectProfileFiles()
+struct PendingEntry final {
+  /// The path, relative to the profile root
+  std::string relative_path;
+
+  /// The path on disk
+  std::string absolute_path;
+
+  /// True if this entry is a folder
+  bool is_directory{false};
+
+  /// The file size
+  std::uint64_t data_size{0U};
+};
+
+/// Enumerates the files and folders found inside the given profile root,
+/// sorted by path; the first entry is always the root folder. Symbolic links
+/// are followed, so that only regular files and folders are returned
+ProfilePack::Status collectProfileFiles(
+    std::vector<PendingEntry> &pending_entry_list,
+    const std::string &profile_root) {
+  pending_entry_list = {{"", profile_root, true, 0U}};
+
+  try {
+    auto root_path = stdfs::path(profile_root).generic_string();
+    while (!root_path.empty() && root_path.back() == '/') {
+      root_path.pop_back();
+    }
+
+    stdfs::recursive_directory_iterator it(
+        root_path, stdfs::directory_options::follow_directory_symlink);
+
+    for (const auto &p : it) {
+      PendingEntry pending_entry;
+      pending_entry.relative_path =
+          p.path().generic_string().substr(root_path.size() + 1U);
+      pending_entry.absolute_path = p.path().string();
+
+      if (stdfs::is_directory(p.path())) {
+        pending_entry.is_directory = true;
+
+      } else if (stdfs::is_regular_file(p.path())) {
+        // The profile descriptor, the packs and the manifests are not needed
+        // by clang
+        if (pending_entry.relative_path == "profile.json" ||
+            pending_entry.relative_path == kProfileManifestFileName ||
+            p.path().extension() == ".pack") {
+          continue;
+        }
+
+        pending_entry.data_size =
+            static_cast<std::uint64_t>(stdfs::file_size(p.path()));
+
+      } else {
+        continue;
+      }
+
+      pending_entry_list.push_back(std::move(pending_entry));
+    }
+
+  } catch (const std::exception &exception) {
+    return ProfilePack::Status(false, ProfilePack::StatusCode::IOError,
+                               "Failed to enumerate the profile files: " +
+                                   std::string(exception.what()));
+  }
+
+  std::sort(pending_entry_list.begin(), pending_entry_list.end(),
+            [](const PendingEntry &lhs, const PendingEntry &rhs) -> bool {
+              return lhs.relative_path < rhs.relative_path;
+            });
+
+  if (pending_entry_list.size() > UINT32_MAX) {
+    return ProfilePack::Status(false, ProfilePack::StatusCode::InvalidFormat,
+                               "The profile contains too many files");
+  }
+
+  return ProfilePack::Status(true);
+}
+
+/// Returns the path of the given blob inside the store; blobs are spread
+/// across subfolders named after the first byte of the hash
+stdfs::path storeBlobPath(const stdfs::path &store_path, ContentHash hash) {
+  auto blob_name = contentHashToString(hash);
+  return store_path / "blobs" / blob_name.substr(0U, 2U) / blob_name;
+}
+
+/// Returns the path of the store relative to the manifest folder, so that
+/// they can be moved together; the absolute path is returned when the two
+/// are on different roots
+std::string relativeStorePath(const stdfs::path &store_path,
+                              const stdfs::path &manifest_path) {
+  std::error_code error;
+  auto absolute_store_path = stdfs::canonical(store_path, error);
+  if (error) {
+    return store_path.string();
+  }
+
+  auto manifest_folder =
+      stdfs::canonical(stdfs::absolute(manifest_path).parent_path(), error);
+  if (error || absolute_store_path.root_path() != manifest_folder.root_path()) {
+    return absolute_store_path.string();
+  }
+
+  auto store_it = absolute_store_path.begin();
+  auto folder_it = manifest_folder.begin();
+  while (store_it != absolute_store_path.end() &&
+         folder_it != manifest_folder.end() && *store_it == *folder_it) {
+    ++store_it;
+    ++folder_it;
+  }
+
+  stdfs::path relative_path;
+  for (; folder_it != manifest_folder.end(); ++folder_it) {
+    relative_path /= "..";
+  }
+
+  for (; store_it != absolute_store_path.end(); ++store_it) {
+    relative_path /= *store_it;
+  }
+
+  return relative_path.empty() ? std::string(".") : relative_path.string();
+}
+
+/// Maps the given blob from the store. Blobs are shared by all the packs
+/// loaded by this process, and are released along with the last pack that
+/// references them; the size is compared with the one in the manifest
+std::shared_ptr<llvm::MemoryBuffer> getStoreBlob(const std::string &store_path,
+                                                 ContentHash hash,
+                                                 std::uint64_t size) {
+  static std::mutex blob_map_mutex;
+  static std::unordered_map<ContentHash, std::weak_ptr<llvm::MemoryBuffer>>
+      blob_map;
+
+  {
+    std::lock_guard<std::mutex> lock(blob_map_mutex);
+
+    auto it = blob_map.find(hash);
+    if (it != blob_map.end()) {
+      auto blob = it->second.lock();
+      if (blob && blob->getBufferSize() == size) {
+        return blob;
+      }
+    }
+  }
+
+  auto buffer_exp =
+      llvm::MemoryBuffer::getFile(storeBlobPath(store_path, hash).string());
+  if (!buffer_exp || buffer_exp.get()->getBufferSize() != size) {
+    return nullptr;
+  }
+
+  std::shared_ptr<llvm::MemoryBuffer> blob(std::move(buffer_exp.get()));
+
+  // Another thread may have mapped the same blob in the meantime
+  std::lock_guard<std::mutex> lock(blob_map_mutex);
+
+  auto &cached_blob_ref = blob_map[hash];
+  auto cached_blob = cached_blob_ref.lock();
+  if (cached_blob && cached_blob->getBufferSize() == size) {
+    return cached_blob;
+  }
+
+  cached_blob_ref = blob;
+  return blob;
+}
+
+/// A file served from a pack
+class ProfilePackFile final : public vfs::File {
+  /// The file status, named after the requested path
+  vfs::Status file_status;
+
+  /// The file contents
+  llvm::StringRef contents;
+
+ public:
+  /// Constructor
+  ProfilePackFile(vfs::Status file_status, llvm::StringRef contents)
+      : file_status(std::move(file_status)), contents(contents) {}
+
+  /// Destructor
+  virtual ~ProfilePackFile() override = default;
+
+  /// Returns the file status
+  virtual llvm::ErrorOr<vfs::Status> status() override { return file_status; }
+
+  /// Returns a buffer referencing the mapped file contents
+  virtual llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> getBuffer(
+      const llvm::Twine &name, int64_t file_size, bool requires_null_terminator,
+      bool is_volatile) override {
+    static_cast<void>(file_size);
+    static_cast<void>(is_volatile);
+
+    return llvm::MemoryBuffer::getMemBuffer(contents, name.str(),
+                                            requires_null_terminator);
+  }
+
+  /// Does nothing; the pack stays mapped until the last reference is released
+  virtual std::error_code close() override { return std::error_code(); }
+};
+
+/// Iterates over the contents of a pack folder
+class ProfilePackFolderIterator final : public vfs::detail::DirIterImpl {
+  /// The pack being iterated
+  ProfilePackRef profile_pack;
+
+  /// The path of the folder, as requested by the caller
+  std::string folder_path;
+
+  /// The folder contents
+  const std::vector<std::uint32_t> &folder_contents;
+
+  /// The next entry to return
+  std::size_t next_entry_index{0U};
+
+ public:
+  /// Constructor
+  ProfilePackFolderIterator(ProfilePackRef profile_pack,
+                            std::string folder_path,
+                            const std::vector<std::uint32_t> &folder_contents)
+      : profile_pack(profile_pack),
+        folder_path(std::move(folder_path)),
+        folder_contents(folder_contents) {
+    increment();
+  }
+
+  /// Destructor
+  virtual ~ProfilePackFolderIterator() override = default;
+
+  /// Moves to the next entry; the current entry is cleared at the end
+  virtual std::error_code increment() override;
+};
+
+/// A virtual file system serving the files under the mount point of a pack
+class ProfilePackFileSystem final : public VirtualFileSystem {
+  /// The pack
+  ProfilePackRef profile_pack;
+
+  /// Handles the files outside of the mount point
+  VirtualFileSystemRef base_file_system;
+
+ public:
+  /// Constructor
+  ProfilePackFileSystem(ProfilePackRef profile_pack,
+                        VirtualFileSystemRef base_file_system)
+      : profile_pack(profile_pack), base_file_system(base_file_system) {}
+
+  /// Destructor
+  virtual ~ProfilePackFileSystem() override = default;
+
+  /// Returns the status of the given entry
+  static vfs::Status entryStatus(const ProfilePack &profile_pack,
+                                 const ProfilePack::Entry &entry,
+                                 llvm::StringRef name) {
+    auto type = entry.is_directory ? llvm::sys::fs::file_type::directory_file
+                                   : llvm::sys::fs::file_type::regular_file;
+
+    return vfs::Status(
+        name, llvm::sys::fs::UniqueID(profile_pack.deviceId(), entry.index),
+        llvm::sys::TimePoint<>(), 0U, 0U, entry.size, type,
+        llvm::sys::fs::perms::all_read);
+  }
+
+  /// Returns the status of the given path
+  virtual llvm::ErrorOr<vfs::Status> status(const llvm::Twine &path) override {
+    std::string relative_path;
+    if (!profile_pack->resolvePath(relative_path, path)) {
+      return base_file_system->status(path);
+    }
+
+    ProfilePack::Entry entry;
+    if (!profile_pack->lookup(entry, relative_path)) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    return entryStatus(*profile_pack, entry, path.str());
+  }
+
+  /// Opens the given file
+  virtual llvm::ErrorOr<std::unique_ptr<vfs::File>> openFileForRead(
+      const llvm::Twine &path) override {
+    std::string relative_path;
+    if (!profile_pack->resolvePath(relative_path, path)) {
+      return base_file_system->openFileForRead(path);
+    }
+
+    ProfilePack::Entry entry;
+    if (!profile_pack->lookup(entry, relative_path)) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+
+    if (entry.is_directory) {
+      return std::make_error_code(std::errc::is_a_directory);
+    }
+
+    llvm::StringRef contents;
+    if (!profile_pack->contents(contents, entry.index)) {
+      return std::make_error_code(std::errc::io_error);
+    }
+
+    std::unique_ptr<vfs::File> file = llvm::make_unique<ProfilePackFile>(
+        entryStatus(*profile_pack, entry, path.str()), contents);
+
+    return std::move(file);
+  }
+
+  /// Enumerates the contents of the given folder
+  virtual vfs::directory_iterator dir_begin(const llvm::Twine &path,
+                                            std::error_code &error) override {
+    std::string relative_path;
+    if (!profile_pack->resolvePath(relative_path, path)) {
+      return base_file_system->dir_begin(path, error);
+    }
+
+    ProfilePack::Entry entry;
+    if (!profile_pack->lookup(entry, relative_path)) {
+      error = std::make_error_code(std::errc::no_such_file_or_directory);
+      return vfs::directory_iterator();
+    }
+
+    if (!entry.is_directory) {
+      error = std::make_error_code(std::errc::not_a_directory);
+      return vfs::directory_iterator();
+    }
+
+    error = std::error_code();
+
+    return vfs::directory_iterator(std::make_shared<ProfilePackFolderIterator>(
+        profile_pack, path.str(), profile_pack->folderContents(entry.index)));
+  }
+
+  /// Returns the working directory of the base file system
+  virtual llvm::ErrorOr<std::string> getCurrentWorkingDirectory()
+      const override {
+    return base_file_system->getCurrentWorkingDirectory();
+  }
+
+  /// Sets the working directory of the base file system
+  virtual std::error_code setCurrentWorkingDirectory(
+      const llvm::Twine &path) override {
+    return base_file_system->setCurrentWorkingDirectory(path);
+  }
+};
+
+std::error_code ProfilePackFolderIterator::increment() {
+  if (next_entry_index >= folder_contents.size()) {
+#if LLVM_MAJOR_VERSION <= 7
+    CurrentEntry = vfs::Status();
+#else
+    CurrentEntry = vfs::directory_entry();
+#endif
+
+    return std::error_code();
+  }
+
+  auto entry_index = folder_contents[next_entry_index];
+  ++next_entry_index;
+
+  auto entry = profile_pack->entry(entry_index);
+
+  auto entry_path = profile_pack->entryPath(entry_index);
+  auto separator_index = entry_path.rfind('/');
+  auto entry_name = (separator_index == llvm::StringRef::npos)
+                        ? entry_path
+                        : entry_path.substr(separator_index + 1U);
+
+  llvm::SmallString<256> path(folder_path);
+  llvm::sys::path::append(path, entry_name);
+
+#if LLVM_MAJOR_VERSION <= 7
+  CurrentEntry =
+      ProfilePackFileSystem::entryStatus(*profile_pack, entry, path);
+#else
+  CurrentEntry = vfs::directory_entry(
+      path.str(), entry.is_directory ? llvm::sys::fs::file_type::directory_file
+                                     : llvm::sys::fs::file_type::regular_file);
+#endif
+
+  return std::error_code();
+}
+
+/// An entry of a loaded pack or manifest
+struct ProfilePackEntry final {
+  /// The path, relative to the mount point
+  std::string_view path;
+
+  /// True if this entry is a folder
+  bool is_directory{false};
+
+  /// The size of the file contents, excluding the null terminator
+  std::uint64_t data_size{0U};
+
+  /// The file contents inside the mapped pack; always null for the files
+  /// listed by a manifest, which are mapped from the store
+  const char *data{nullptr};
+
+  /// The contents of the tar members that are not followed by a null
+  /// terminator; they are copied the first time they are requested
+  const char *unterminated_data{nullptr};
+
+  /// The hash of the file contents, for the files listed by a manifest
+  ContentHash blob_hash{0U};
+};
+}  // namespace
+
+/// Private class data
+struct ProfilePack::PrivateData final {
+  /// The mapped pack file, or the manifest
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+
+  /// Where the files are served
+  std::string mount_point;
+
+  /// The store containing the files listed by the manifest; empty for packs
+  std::string store_path;
+
+  /// The device number used for the unique IDs of the entries
+  std::uint64_t device_id{0U};
+
+  /// The tar member paths that are not stored as a single string inside the
+  /// archive; a deque is used so that the entries can reference them
+  std::deque<std::string> path_storage;
+
+  /// The entry table
+  std::vector<ProfilePackEntry> entry_list;
+
+  /// Maps each path to its entry index
+  std::unordered_map<std::string_view, std::uint32_t> path_map;
+
+  /// The contents of each folder; empty for files
+  std::vector<std::vector<std::uint32_t>> folder_contents;
+
+  /// Protects the blob list
+  std::mutex blob_list_mutex;
+
+  /// The blobs that have been mapped from the store (or copied from a tar
+  /// archive), one slot per entry
+  std::vector<std::shared_ptr<llvm::MemoryBuffer>> blob_list;
+};
+
+ProfilePack::ProfilePack(const std::string &path,
+                         const std::string &mount_point)
+    : d(new PrivateData) {
+  llvm::SmallString<256> normalized_mount_point(mount_point);
+  llvm::sys::path::remove_dots(normalized_mount_point, true);
+
+  d->mount_point = normalized_mount_point.str().rtrim("/").str();
+  d->device_id = next_profile_pack_device_id++;
+
+  // Large files are memory mapped
+  auto buffer_exp = llvm::MemoryBuffer::getFile(path, -1, false);
+  if (!buffer_exp) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to open the profile pack: " + path);
+  }
+
+  d->buffer = std::move(buffer_exp.get());
+
+  const auto buffer_start = d->buffer->getBufferStart();
+  const auto buffer_size =
+      static_cast<std::uint64_t>(d->buffer->getBufferSize());
+
+  auto L_invalidFormat = [&path]() -> Status {
+    return Status(false, StatusCode::InvalidFormat,
+                  "The profile pack is not valid: " + path);
+  };
+
+  auto L_loadPack = [&]() {
+    ProfilePackHeader header;
+    if (buffer_size < sizeof(header)) {
+      throw L_invalidFormat();
+    }
+
+    std::memcpy(&header, buffer_start, sizeof(header));
+    if (header.magic != kProfilePackMagic ||
+        header.version != kProfilePackVersion) {
+      throw L_invalidFormat();
+    }
+
+    auto table_size = static_cast<std::uint64_t>(header.entry_count) *
+                      sizeof(ProfilePackTableEntry);
+
+    if (table_size > buffer_size - sizeof(header)) {
+      throw L_invalidFormat();
+    }
+
+    std::vector<ProfilePackTableEntry> entry_table(header.entry_count);
+    std::memcpy(entry_table.data(), buffer_start + sizeof(header),
+                static_cast<std::size_t>(table_size));
+
+    d->entry_list.reserve(entry_table.size());
+
+    for (const auto &table_entry : entry_table) {
+      if (table_entry.path_offset > buffer_size ||
+          table_entry.path_size > buffer_size - table_entry.path_offset) {
+        throw L_invalidFormat();
+      }
+
+      // The contents must be followed by the null terminator
+      if (table_entry.data_offset > buffer_size ||
+          table_entry.data_size >= buffer_size - table_entry.data_offset ||
+          buffer_start[table_entry.data_offset + table_entry.data_size] !=
+              '\0') {
+        throw L_invalidFormat();
+      }
+
+      ProfilePackEntry entry;
+      entry.path =
+          std::string_view(buffer_start + table_entry.path_offset,
+                           static_cast<std::size_t>(table_entry.path_size));
+
+      entry.is_directory = (table_entry.is_directory != 0U);
+      entry.data_size = table_entry.data_size;
+      entry.data = buffer_start + table_entry.data_offset;
+
+      d->entry_list.push_back(entry);
+    }
+  };
+
+  // Manifests are made of one line per entry; the root folder is implicit
+  auto L_loadManifest = [&]() {
+    std::string_view manifest(buffer_start,
+                              static_cast<std::size_t>(buffer_size));
+
+    auto L_nextLine = [&manifest](std::string_view &line) -> bool {
+      if (manifest.empty()) {
+        return false;
+      }
+
+      auto line_end = manifest.find('\n');
+      line = manifest.substr(0U, line_end);
+
+      manifest.remove_prefix(
+          (line_end == std::string_view::npos) ? manifest.size()
+                                               : line_end + 1U);
+
+      return true;
+    };
+
+    auto L_startsWith = [](std::string_view line,
+                           std::string_view tag) -> bool {
+      return line.substr(0U, tag.size()) == tag;
+    };
+
+    std::string_view line;
+    if (!L_nextLine(line) || line != kProfileManifestHeader) {
+      throw L_invalidFormat();
+    }
+
+    // Relative store paths start from the manifest folder
+    const std::string_view store_tag = "store ";
+    if (!L_nextLine(line) || !L_startsWith(line, store_tag) ||
+        line.size() == store_tag.size()) {
+      throw L_invalidFormat();
+    }
+
+    stdfs::path store_path(std::string(line.substr(store_tag.size())));
+    if (store_path.is_relative()) {
+      store_path = stdfs::absolute(path).parent_path() / store_path;
+    }
+
+    d->store_path = store_path.string();
+
+    ProfilePackEntry root_entry;
+    root_entry.is_directory = true;
+    d->entry_list.push_back(root_entry);
+
+    const std::string_view directory_tag = "directory ";
+    const std::string_view file_tag = "file ";
+
+    while (L_nextLine(line)) {
+      ProfilePackEntry entry;
+
+      if (L_startsWith(line, directory_tag)) {
+        entry.path = line.substr(directory_tag.size());
+        entry.is_directory = true;
+
+      } else if (L_startsWith(line, file_tag)) {
+        // file <hash> <size> <path>
+        auto fields = line.substr(file_tag.size());
+        if (fields.size() < 19U || fields[16U] != ' ' ||
+            !contentHashFromString(entry.blob_hash,
+                                   std::string(fields.substr(0U, 16U)))) {
+          throw L_invalidFormat();
+        }
+
+        auto size_end = fields.find(' ', 17U);
+        if (size_end == std::string_view::npos || size_end == 17U) {
+          throw L_invalidFormat();
+        }
+
+        for (auto c : fields.substr(17U, size_end - 17U)) {
+          if (c < '0' || c > '9') {
+            throw L_invalidFormat();
+          }
+
+          entry.data_size = (entry.data_size * 10U) +
+                            static_cast<std::uint64_t>(c - '0');
+        }
+
+        entry.path = fields.substr(size_end + 1U);
+
+      } else {
+        throw L_invalidFormat();
+      }
+
+      if (entry.path.empty()) {
+        throw L_invalidFormat();
+      }
+
+      d->entry_list.push_back(entry);
+    }
+
+    if (d->entry_list.size() > UINT32_MAX) {
+      throw L_invalidFormat();
+    }
+
+    std::sort(d->entry_list.begin(), d->entry_list.end(),
+              [](const ProfilePackEntry &lhs,
+                 const ProfilePackEntry &rhs) -> bool {
+                return lhs.path < rhs.path;
+              });
+
+    d->blob_list.resize(d->entry_list.size());
+  };
+
+  // Tar archives are indexed in place: each member is made of a header
+  // block followed by its contents. Links to files are served with the
+  // contents of their target; the other special members are skipped
+  auto L_loadTar = [&]() {
+    auto L_parseNumber = [](std::uint64_t &value, const char *field,
+                            std::size_t field_size) -> bool {
+      value = 0U;
+
+      // GNU tar switches to base-256 for the values that don't fit in octal
+      if ((static_cast<unsigned char>(field[0]) & 0x80U) != 0U) {
+        value = static_cast<unsigned char>(field[0]) & 0x7FU;
+
+        for (std::size_t i = 1U; i < field_size; ++i) {
+          if ((value >> 56U) != 0U) {
+            return false;
+          }
+
+          value = (value << 8U) | static_cast<unsigned char>(field[i]);
+        }
+
+        return true;
+      }
+
+      std::size_t i = 0U;
+      while (i < field_size && field[i] == ' ') {
+        ++i;
+      }
+
+      for (; i < field_size && field[i] >= '0' && field[i] <= '7'; ++i) {
+        if ((value >> 61U) != 0U) {
+          return false;
+        }
+
+        value = (value << 3U) | static_cast<std::uint64_t>(field[i] - '0');
+      }
+
+      return true;
+    };
+
+    auto L_stringField = [](const char *field,
+                            std::size_t field_size) -> std::string_view {
+      std::string_view value(field, field_size);
+      return value.substr(0U, value.find('\0'));
+    };
+
+    // The checksum is computed with its own field set to spaces
+    auto L_validChecksum = [&](const char *header) -> bool {
+      std::uint64_t expected_checksum{0U};
+      if (!L_parseNumber(expected_checksum, header + 148U, 8U)) {
+        return false;
+      }
+
+      std::uint64_t checksum{0U};
+      for (std::size_t i = 0U; i < kTarBlockSize; ++i) {
+        checksum += (i >= 148U && i < 156U)
+                        ? static_cast<std::uint64_t>(' ')
+                        : static_cast<unsigned char>(header[i]);
+      }
+
+      return checksum == expected_checksum;
+    };
+
+    ProfilePackEntry root_entry;
+    root_entry.is_directory = true;
+    d->entry_list.push_back(root_entry);
+
+    // Members that appear more than once are replaced by their last copy,
+    // like tar does when extracting the archive
+    std::unordered_map<std::string_view, std::size_t> member_map;
+
+    // The normalized target of each link, keyed on the link path
+    std::unordered_map<std::string_view, std::string> link_map;
+
+    // Long paths are stored in the member that precedes the one they
+    // belong to, either as a GNU long name or as a pax extended header
+    std::string_view long_path;
+    std::string_view long_link_path;
+
+    std::uint64_t offset{0U};
+
+    while (buffer_size - offset >= kTarBlockSize) {
+      const auto header = buffer_start + offset;
+
+      // The archive ends with an empty block
+      if (std::all_of(header, header + kTarBlockSize,
+                      [](char c) -> bool { return c == '\0'; })) {
+        break;
+      }
+
+      std::uint64_t data_size{0U};
+      if (!L_validChecksum(header) ||
+          !L_parseNumber(data_size, header + 124U, 12U)) {
+        throw L_invalidFormat();
+      }
+
+      auto data_offset = offset + kTarBlockSize;
+      if (data_size > buffer_size - data_offset) {
+        throw L_invalidFormat();
+      }
+
+      const auto data = buffer_start + data_offset;
+
+      auto padded_size =
+          ((data_size + kTarBlockSize - 1U) / kTarBlockSize) * kTarBlockSize;
+
+      offset = data_offset + std::min(padded_size, buffer_size - data_offset);
+
+      auto type = header[156U];
+
+      if (type == 'L') {
+        long_path = L_stringField(data, static_cast<std::size_t>(data_size));
+        continue;
+
+      } else if (type == 'K') {
+        long_link_path =
+            L_stringField(data, static_cast<std::size_t>(data_size));
+        continue;
+
+      } else if (type == 'x') {
+        // Each record is "<size> <key>=<value>\n"; the size includes the
+        // whole record
+        std::string_view record_list(data,
+                                     static_cast<std::size_t>(data_size));
+
+        while (!record_list.empty()) {
+          auto space_index = record_list.find(' ');
+          if (space_index == std::string_view::npos || space_index == 0U) {
+            throw L_invalidFormat();
+          }
+
+          std::size_t record_size{0U};
+          for (auto c : record_list.substr(0U, space_index)) {
+            if (c < '0' || c > '9' || record_size > record_list.size()) {
+              throw L_invalidFormat();
+            }
+
+            record_size =
+                (record_size * 10U) + static_cast<std::size_t>(c - '0');
+          }
+
+          if (record_size < space_index + 2U ||
+              record_size > record_list.size() ||
+              record_list[record_size - 1U] != '\n') {
+            throw L_invalidFormat();
+          }
+
+          auto record = record_list.substr(space_index + 1U,
+                                           record_size - space_index - 2U);
+          record_list.remove_prefix(record_size);
+
+          if (record.substr(0U, 5U) == "path=") {
+            long_path = record.substr(5U);
+          } else if (record.substr(0U, 9U) == "linkpath=") {
+            long_link_path = record.substr(9U);
+          }
+        }
+
+        continue;
+
+      } else if (type == 'g') {
+        continue;
+      }
+
+      auto member_path = long_path;
+      auto link_path = long_link_path;
+
+      long_path = std::string_view();
+      long_link_path = std::string_view();
+
+      // Only the POSIX headers split the long paths in two; the same bytes
+      // hold other fields in the old GNU format
+      std::string full_path;
+      if (member_path.empty()) {
+        member_path = L_stringField(header, 100U);
+
+        auto prefix = L_stringField(header + 345U, 155U);
+        if (std::string_view(header + kTarMagicOffset, 6U) ==
+                std::string_view("ustar\0", 6U) &&
+            !prefix.empty()) {
+          full_path.assign(prefix.data(), prefix.size());
+          full_path.push_back('/');
+          full_path.append(member_path.data(), member_path.size());
+
+          member_path = full_path;
+        }
+      }
+
+      if (link_path.empty()) {
+        link_path = L_stringField(header + 157U, 100U);
+      }
+
+      // The root folder and the members outside of it are skipped
+      std::string normalized_path;
+      if (!normalizeArchivePath(normalized_path, member_path) ||
+          normalized_path.empty()) {
+        continue;
+      }
+
+      ProfilePackEntry entry;
+
+      // Most paths are already normalized, and can be referenced in place
+      auto path_index = full_path.empty() ? member_path.find(normalized_path)
+                                          : std::string_view::npos;
+
+      if (path_index != std::string_view::npos) {
+        entry.path = member_path.substr(path_index, normalized_path.size());
+      } else {
+        d->path_storage.push_back(std::move(normalized_path));
+        entry.path = d->path_storage.back();
+      }
+
+      std::string link_target;
+      bool is_link{false};
+
+      if (type == '5') {
+        entry.is_directory = true;
+
+      } else if (type == '0' || type == '\0' || type == '7') {
+        entry.data_size = data_size;
+
+        // The padding provides the null terminator, unless the contents
+        // fill their last block
+        if (data_size < buffer_size - data_offset && data[data_size] == '\0') {
+          entry.data = data;
+        } else {
+          entry.unterminated_data = data;
+        }
+
+      } else if (type == '1' || type == '2') {
+        // Hard links are relative to the archive root, and symbolic links
+        // to the folder containing them; absolute symbolic links point
+        // outside of the archive
+        std::string target_path;
+        if (type == '1') {
+          target_path.assign(link_path.data(), link_path.size());
+
+        } else if (!link_path.empty() && link_path.front() != '/') {
+          auto parent_path = parentPath(entry.path);
+
+          target_path.assign(parent_path.data(), parent_path.size());
+          target_path.push_back('/');
+          target_path.append(link_path.data(), link_path.size());
+
+        } else {
+          continue;
+        }
+
+        if (!normalizeArchivePath(link_target, target_path)) {
+          continue;
+        }
+
+        is_link = true;
+
+      } else {
+        continue;
+      }
+
+      auto member_it = member_map.find(entry.path);
+      if (member_it != member_map.end()) {
+        d->entry_list[member_it->second] = entry;
+      } else {
+        member_map.insert({entry.path, d->entry_list.size()});
+        d->entry_list.push_back(entry);
+      }
+
+      if (is_link) {
+        link_map[entry.path] = std::move(link_target);
+      } else {
+        link_map.erase(entry.path);
+      }
+    }
+
+    // Links are resolved once all the members are known; chains are only
+    // followed up to a fixed depth, so that loops always end. Links to
+    // folders are dropped, like the symbolic links found while listing the
+    // header folders on disk
+    std::unordered_set<std::string_view> unresolved_link_set;
+
+    for (const auto &link : link_map) {
+      const ProfilePackEntry *target_entry = nullptr;
+      std::string_view target_path = link.second;
+
+      for (std::size_t depth = 0U; depth < 16U; ++depth) {
+        auto target_it = member_map.find(target_path);
+        if (target_it == member_map.end()) {
+          break;
+        }
+
+        auto target_link_it = link_map.find(target_path);
+        if (target_link_it == link_map.end()) {
+          target_entry = &d->entry_list[target_it->second];
+          break;
+        }
+
+        target_path = target_link_it->second;
+      }
+
+      if (target_entry == nullptr || target_entry->is_directory) {
+        unresolved_link_set.insert(link.first);
+        continue;
+      }
+
+      auto &link_entry = d->entry_list[member_map.at(link.first)];
+      link_entry.data_size = target_entry->data_size;
+      link_entry.data = target_entry->data;
+      link_entry.unterminated_data = target_entry->unterminated_data;
+    }
+
+    if (!unresolved_link_set.empty()) {
+      d->entry_list.erase(
+          std::remove_if(d->entry_list.begin(), d->entry_list.end(),
+                         [&](const ProfilePackEntry &entry) -> bool {
+                           return unresolved_link_set.count(entry.path) != 0U;
+                         }),
+          d->entry_list.end());
+    }
+
+    // Archives do not always contain an entry for each folder
+    std::unordered_set<std::string_view> path_set;
+    for (const auto &entry : d->entry_list) {
+      path_set.insert(entry.path);
+    }
+
+    auto member_count = d->entry_list.size();
+    for (std::size_t i = 0U; i < member_count; ++i) {
+      auto parent_path = parentPath(d->entry_list[i].path);
+
+      while (!parent_path.empty() && path_set.insert(parent_path).second) {
+        ProfilePackEntry folder_entry;
+        folder_entry.path = parent_path;
+        folder_entry.is_directory = true;
+
+        d->entry_list.push_back(folder_entry);
+        parent_path = parentPath(parent_path);
+      }
+    }
+
+    if (d->entry_list.size() > UINT32_MAX) {
+      throw L_invalidFormat();
+    }
+
+    std::sort(d->entry_list.begin(), d->entry_list.end(),
+              [](const ProfilePackEntry &lhs,
+                 const ProfilePackEntry &rhs) -> bool {
+                return lhs.path < rhs.path;
+              });
+
+    d->blob_list.resize(d->entry_list.size());
+  };
+
+  std::string_view file_header(
+      buffer_start, std::min(static_cast<std::size_t>(buffer_size),
+                             kProfileManifestHeader.size()));
+
+  if (file_header == kProfileManifestHeader) {
+    L_loadManifest();
+
+  } else if (buffer_size >= kTarBlockSize &&
+             std::string_view(buffer_start + kTarMagicOffset,
+                              kTarMagic.size()) == kTarMagic) {
+    L_loadTar();
+
+  } else {
+    L_loadPack();
+  }
+
+  auto entry_count = static_cast<std::uint32_t>(d->entry_list.size());
+  for (std::uint32_t i = 0U; i < entry_count; ++i) {
+    if (!d->path_map.insert({d->entry_list[i].path, i}).second) {
+      throw L_invalidFormat();
+    }
+  }
+
+  // Entries are sorted by path, so each folder comes before its contents;
+  // the first entry is always the root folder
+  if (d->entry_list.empty() || !d->entry_list.front().path.empty() ||
+      !d->entry_list.front().is_directory) {
+    throw L_invalidFormat();
+  }
+
+  d->folder_contents.resize(entry_count);
+
+  for (std::uint32_t i = 1U; i < entry_count; ++i) {
+    auto parent_it = d->path_map.find(parentPath(d->entry_list[i].path));
+
+    if (parent_it == d->path_map.end() ||
+        !d->entry_list[parent_it->second].is_directory) {
+      throw L_invalidFormat();
+    }
+
+    d->folder_contents[parent_it->second].push_back(i);
+  }
+}
+
+ProfilePack::Status ProfilePack::create(ProfilePackRef &obj,
+                                        const std::string &path,
+                                        const std::string &mount_point) {
+  obj.reset();
+
+  try {
+    auto ptr = new ProfilePack(path, mount_point);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ProfilePack::~ProfilePack() {}
+
+ProfilePack::Status ProfilePack::write(const std::string &profile_root,
+                                       const std::string &path) {
+  std::vector<PendingEntry> pending_entry_list;
+  auto status = collectProfileFiles(pending_entry_list, profile_root);
+  if (!status.succeeded()) {
+    return status;
+  }
+
+  // Lay out the paths and the contents after the entry table
+  ProfilePackHeader header;
+  header.magic = kProfilePackMagic;
+  header.version = kProfilePackVersion;
+  header.entry_count = static_cast<std::uint32_t>(pending_entry_list.size());
+
+  std::vector<ProfilePackTableEntry> entry_table(pending_entry_list.size());
+
+  auto current_offset = static_cast<std::uint64_t>(
+      sizeof(header) + entry_table.size() * sizeof(ProfilePackTableEntry));
+
+  for (std::size_t i = 0U; i < pending_entry_list.size(); ++i) {
+    entry_table[i].path_offset = current_offset;
+    entry_table[i].path_size =
+        static_cast<std::uint32_t>(pending_entry_list[i].relative_path.size());
+    entry_table[i].is_directory = pending_entry_list[i].is_directory ? 1U : 0U;
+
+    current_offset += entry_table[i].path_size;
+  }
+
+  for (std::size_t i = 0U; i < pending_entry_list.size(); ++i) {
+    entry_table[i].data_offset = current_offset;
+    entry_table[i].data_size = pending_entry_list[i].data_size;
+
+    current_offset += entry_table[i].data_size + 1U;
+  }
+
+  // Write the pack to a temporary file first, so that processes that are
+  // using the previous one never see a partial pack
+  std::random_device random_device;
+  auto temp_path = path + ".tmp" + std::to_string(random_device());
+
+  auto L_writeError = [&temp_path](const std::string &message) -> Status {
+    std::error_code error;
+    stdfs::remove(temp_path, error);
+
+    return Status(false, StatusCode::IOError, message);
+  };
+
+  {
+    std::ofstream pack_file(temp_path,
+                            std::ios::out | std::ios::trunc | std::ios::binary);
+
+    pack_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    pack_file.write(
+        reinterpret_cast<const char *>(entry_table.data()),
+        static_cast<std::streamsize>(entry_table.size() *
+                                     sizeof(ProfilePackTableEntry)));
+
+    for (const auto &pending_entry : pending_entry_list) {
+      pack_file << pending_entry.relative_path;
+    }
+
+    std::vector<char> copy_buffer(65536U);
+
+    for (const auto &pending_entry : pending_entry_list) {
+      if (!pending_entry.is_directory) {
+        std::ifstream input_file(pending_entry.absolute_path,
+                                 std::ios::in | std::ios::binary);
+
+        std::uint64_t copied_size = 0U;
+        while (input_file) {
+          input_file.read(copy_buffer.data(),
+                          static_cast<std::streamsize>(copy_buffer.size()));
+
+          auto read_size = input_file.gcount();
+          pack_file.write(copy_buffer.data(), read_size);
+          copied_size += static_cast<std::uint64_t>(read_size);
+        }
+
+        // The layout depends on the sizes we have collected before
+        if (!input_file.eof() || copied_size != pending_entry.data_size) {
+          return L_writeError("The following file could not be read: " +
+                              pending_entry.absolute_path);
+        }
+      }
+
+      pack_file.put('\0');
+    }
+
+    if (!pack_file) {
+      return L_writeError("Failed to write the profile pack");
+    }
+  }
+
+  std::error_code error;
+  stdfs::rename(temp_path, path, error);
+  if (error) {
+    return L_writeError("Failed to save the profile pack to " + path);
+  }
+
+  return Status(true);
+}
+
+ProfilePack::Status ProfilePack::writeManifest(ManifestStatistics &statistics,
+                                               const std::string &profile_root,
+                                               const std::string &store_path,
+                                               const std::string &path) {
+  statistics = ManifestStatistics();
+
+  std::vector<PendingEntry> pending_entry_list;
+  auto status = collectProfileFiles(pending_entry_list, profile_root);
+  if (!status.succeeded()) {
+    return status;
+  }
+
+  std::stringstream buffer;
+  buffer << kProfileManifestHeader << "\n";
+  buffer << "store " << relativeStorePath(store_path, path) << "\n";
+
+  std::string file_contents;
+
+  // The root folder is implicit
+  for (auto it = std::next(pending_entry_list.begin());
+       it != pending_entry_list.end(); ++it) {
+    const auto &pending_entry = *it;
+
+    if (pending_entry.relative_path.find('\n') != std::string::npos) {
+      return Status(false, StatusCode::InvalidFormat,
+                    "The following path can't be saved in a manifest: " +
+                        pending_entry.absolute_path);
+    }
+
+    if (pending_entry.is_directory) {
+      buffer << "directory " << pending_entry.relative_path << "\n";
+      continue;
+    }
+
+    {
+      std::ifstream input_file(pending_entry.absolute_path,
+                               std::ios::in | std::ios::binary);
+
+      std::stringstream input_buffer;
+      input_buffer << input_file.rdbuf();
+
+      if (!input_file) {
+        return Status(false, StatusCode::IOError,
+                      "The following file could not be read: " +
+                          pending_entry.absolute_path);
+      }
+
+      file_contents = input_buffer.str();
+    }
+
+    auto hash = hashBuffer(file_contents.data(), file_contents.size());
+    auto blob_path = storeBlobPath(store_path, hash);
+
+    // Blobs are never modified once they have been saved, so the ones that
+    // another profile has already added are kept as they are
+    std::error_code error;
+    if (!stdfs::exists(blob_path, error) ||
+        stdfs::file_size(blob_path, error) != file_contents.size()) {
+      stdfs::create_directories(blob_path.parent_path(), error);
+
+      if (!writeFileAtomically(blob_path, file_contents)) {
+        return Status(false, StatusCode::IOError,
+                      "Failed to save the following file to the store: " +
+                          pending_entry.absolute_path);
+      }
+
+      ++statistics.new_blob_count;
+      statistics.new_blob_size += file_contents.size();
+    }
+
+    ++statistics.file_count;
+
+    buffer << "file " << contentHashToString(hash) << " "
+           << file_contents.size() << " " << pending_entry.relative_path
+           << "\n";
+  }
+
+  if (!writeFileAtomically(path, buffer.str())) {
+    return Status(false, StatusCode::IOError,
+                  "Failed to save the profile manifest to " + path);
+  }
+
+  return Status(true);
+}
+
+const std::string &ProfilePack::mountPoint() const { return d->mount_point; }
+
+bool ProfilePack::resolvePath(std::string &relative_path,
+                              const llvm::Twine &path) const {
+  relative_path.clear();
+
+  llvm::SmallString<256> absolute_path;
+  path.toVector(absolute_path);
+
+  if (!llvm::sys::path::is_absolute(absolute_path)) {
+    return false;
+  }
+
+  llvm::sys::path::remove_dots(absolute_path, true);
+
+  llvm::StringRef normalized_path(absolute_path);
+
+  if (!normalized_path.startswith(d->mount_point)) {
+    return false;
+  }
+
+  auto remainder = normalized_path.substr(d->mount_point.size());
+  if (!remainder.empty() && !llvm::sys::path::is_separator(remainder[0])) {
+    return false;
+  }
+
+  relative_path = remainder.ltrim("/").str();
+  return true;
+}
+
+std::uint64_t ProfilePack::deviceId() const { return d->device_id; }
+
+bool ProfilePack::lookup(Entry &entry, llvm::StringRef relative_path) const {
+  auto it = d->path_map.find(
+      std::string_view(relative_path.data(), relative_path.size()));
+
+  if (it == d->path_map.end()) {
+    return false;
+  }
+
+  entry = this->entry(it->second);
+  return true;
+}
+
+ProfilePack::Entry ProfilePack::entry(std::uint32_t index) const {
+  const auto &pack_entry = d->entry_list.at(index);
+
+  Entry entry;
+  entry.index = index;
+  entry.is_directory = pack_entry.is_directory;
+  entry.size = pack_entry.data_size;
+
+  return entry;
+}
+
+bool ProfilePack::contents(llvm::StringRef &contents,
+                           std::uint32_t index) const {
+  contents = llvm::StringRef();
+
+  const auto &pack_entry = d->entry_list.at(index);
+  if (pack_entry.is_directory) {
+    return false;
+  }
+
+  if (pack_entry.data != nullptr) {
+    contents = llvm::StringRef(pack_entry.data,
+                               static_cast<std::size_t>(pack_entry.data_size));
+    return true;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->blob_list_mutex);
+
+    const auto &blob = d->blob_list[index];
+    if (blob) {
+      contents = blob->getBuffer();
+      return true;
+    }
+  }
+
+  // Map the blob (or copy the tar member) without holding the lock, so that
+  // the other threads can keep reading the files that have already been
+  // loaded
+  std::shared_ptr<llvm::MemoryBuffer> blob;
+  if (pack_entry.unterminated_data != nullptr) {
+    blob = llvm::MemoryBuffer::getMemBufferCopy(
+        llvm::StringRef(pack_entry.unterminated_data,
+                        static_cast<std::size_t>(pack_entry.data_size)));
+  } else {
+    blob = getStoreBlob(d->store_path, pack_entry.blob_hash,
+                        pack_entry.data_size);
+  }
+
+  if (!blob) {
+    return false;
+  }
+
+  // Another thread may have loaded the same file in the meantime; its
+  // buffer may already be in use
+  std::lock_guard<std::mutex> lock(d->blob_list_mutex);
+
+  auto &cached_blob = d->blob_list[index];
+  if (!cached_blob) {
+    cached_blob = blob;
+  }
+
+  contents = cached_blob->getBuffer();
+
+  return true;
+}
+
+llvm::StringRef ProfilePack::entryPath(std::uint32_t index) const {
+  const auto &pack_entry = d->entry_list.at(index);
+
+  return llvm::StringRef(pack_entry.path.data(), pack_entry.path.size());
+}
+
+const std::vector<std::uint32_t> &ProfilePack::folderContents(
+    std::uint32_t index) const {
+  return d->folder_contents.at(index);
+}
+
+ProfilePack::Status getProfilePack(ProfilePackRef &profile_pack,
+                                   const Profile &profile) {
+  static std::mutex profile_pack_map_mutex;
+  static std::unordered_map<std::string, ProfilePackRef> profile_pack_map;
+
+  profile_pack.reset();
+
+  std::lock_guard<std::mutex> lock(profile_pack_map_mutex);
+
+  auto it = profile_pack_map.find(profile.root_path);
+  if (it != profile_pack_map.end()) {
+    profile_pack = it->second;
+    return ProfilePack::Status(true);
+  }
+
+  auto pack_path = stdfs::path(profile.root_path) / kProfilePackFileName;
+
+  std::error_code error;
+  if (!stdfs::exists(pack_path, error)) {
+    pack_path = stdfs::path(profile.root_path) / kProfileManifestFileName;
+  }
+
+  if (stdfs::exists(pack_path, error)) {
+    auto status = ProfilePack::create(profile_pack, pack_path.string(),
+                                      profile.root_path);
+
+    if (!status.succeeded()) {
+      return status;
+    }
+  }
+
+  // Also remember the profiles that have not been packed
+  profile_pack_map.insert({profile.root_path, profile_pack});
+  return ProfilePack::Status(true);
+}
+
+ProfilePack::Status getHeaderArchive(ProfilePackRef &header_archive,
+                                     const std::string &path) {
+  static std::mutex header_archive_map_mutex;
+  static std::unordered_map<std::string, ProfilePackRef> header_archive_map;
+
+  header_archive.reset();
+
+  llvm::SmallString<256> archive_path(path);
+  if (llvm::sys::fs::make_absolute(archive_path)) {
+    return ProfilePack::Status(true);
+  }
+
+  llvm::sys::path::remove_dots(archive_path, true);
+
+  // Walk up the path, stopping at the first component that is named like
+  // an archive
+  while (!archive_path.empty() &&
+         llvm::sys::path::extension(archive_path) != kHeaderArchiveExtension) {
+    auto parent_path = llvm::sys::path::parent_path(archive_path);
+    if (parent_path.size() == archive_path.size()) {
+      return ProfilePack::Status(true);
+    }
+
+    archive_path.resize(parent_path.size());
+  }
+
+  if (archive_path.empty()) {
+    return ProfilePack::Status(true);
+  }
+
+  std::lock_guard<std::mutex> lock(header_archive_map_mutex);
+
+  auto archive_path_str = archive_path.str().str();
+
+  auto it = header_archive_map.find(archive_path_str);
+  if (it != header_archive_map.end()) {
+    header_archive = it->second;
+    return ProfilePack::Status(true);
+  }
+
+  // Folders that are only named like an archive are remembered as well
+  if (llvm::sys::fs::is_regular_file(archive_path_str)) {
+    auto status = ProfilePack::create(header_archive, archive_path_str,
+                                      archive_path_str);
+
+    if (!status.succeeded()) {
+      return status;
+    }
+  }
+
+  header_archive_map.insert({archive_path_str, header_archive});
+  return ProfilePack::Status(true);
+}
+
+bool readHeaderArchiveFile(llvm::StringRef &contents, const std::string &path) {
+  contents = llvm::StringRef();
+
+  ProfilePackRef header_archive;
+  if (!getHeaderArchive(header_archive, path).succeeded() || !header_archive) {
+    return false;
+  }
+
+  llvm::SmallString<256> absolute_path(path);
+  if (llvm::sys::fs::make_absolute(absolute_path)) {
+    return false;
+  }
+
+  std::string relative_path;
+  ProfilePack::Entry entry;
+
+  if (!header_archive->resolvePath(relative_path, absolute_path) ||
+      !header_archive->lookup(entry, relative_path) || entry.is_directory) {
+    return false;
+  }
+
+  return header_archive->contents(contents, entry.index);
+}
+
+VirtualFileSystemRef createProfilePackFileSystem(
+    ProfilePackRef profile_pack, VirtualFileSystemRef base_file_system) {
+  if (!base_file_system) {
+    base_file_system = vfs::getRealFileSystem();
+  }
+
+  return VirtualFileSystemRef(
+      new ProfilePackFileSystem(profile_pack, base_file_system));
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "profilemanager.h"
+#include "virtual_file_system.h"
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Twine.h>
+
+#include <cstdint>
+#include <memory>
+
+/// The name of the pack file, inside the profile root
+const std::string kProfilePackFileName = "profile.pack";
+
+/// The name of the manifest file, inside the profile root; it is used when
+/// the profile has not been packed
+const std::string kProfileManifestFileName = "profile.manifest";
+
+/// The extension of the header archives that can be passed instead of a
+/// header folder
+const std::string kHeaderArchiveExtension = ".tar";
+
+class ProfilePack;
+
+/// A reference to a ProfilePack object
+using ProfilePackRef = std::shared_ptr<ProfilePack>;
+
+/// A ProfilePack is a single, indexed archive containing all the files of a
+/// profile. The archive is memory mapped, and the files are looked up by
+/// path (relative to the profile root) without accessing the file system.
+/// A pack can also be loaded from a manifest, which lists the profile files
+/// along with the hash of their contents; the contents are then mapped from
+/// a store shared by all the profiles, so that identical files are only
+/// saved (and cached by the operating system) once. Uncompressed tar
+/// archives are also accepted, and are indexed in place
+class ProfilePack final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  ProfilePack(const std::string &path, const std::string &mount_point);
+
+ public:
+  /// Status code, used with ProfilePack::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    IOError,
+    InvalidFormat,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// A file or folder inside the pack
+  struct Entry final {
+    /// The entry index, unique within the pack
+    std::uint32_t index{0U};
+
+    /// True if this entry is a folder
+    bool is_directory{false};
+
+    /// The size of the file contents
+    std::uint64_t size{0U};
+  };
+
+  /// Statistics returned by ProfilePack::writeManifest()
+  struct ManifestStatistics final {
+    /// How many files the manifest lists
+    std::size_t file_count{0U};
+
+    /// How many files had to be added to the store
+    std::size_t new_blob_count{0U};
+
+    /// The size of the files added to the store
+    std::uint64_t new_blob_size{0U};
+  };
+
+  /// Loads the given pack, manifest or tar archive; the files will be served
+  /// under the mount point
+  static Status create(ProfilePackRef &obj, const std::string &path,
+                       const std::string &mount_point);
+
+  /// Destructor
+  ~ProfilePack();
+
+  /// Packs all the files found inside the given profile root
+  static Status write(const std::string &profile_root,
+                      const std::string &path);
+
+  /// Copies the files found inside the given profile root to the store
+  /// folder, naming each one after the hash of its contents, and saves a
+  /// manifest referencing them to the given path. Files that are already in
+  /// the store are not copied again; multiple profiles can be imported at
+  /// the same time
+  static Status writeManifest(ManifestStatistics &statistics,
+                              const std::string &profile_root,
+                              const std::string &store_path,
+                              const std::string &path);
+
+  /// Returns the folder where the files are served; it never ends with a
+  /// path separator
+  const std::string &mountPoint() const;
+
+  /// Returns true if the given absolute path is under the mount point;
+  /// relative_path will receive the normalized path, relative to the mount
+  /// point
+  bool resolvePath(std::string &relative_path, const llvm::Twine &path) const;
+
+  /// Returns the device number used for the unique IDs of the entries; each
+  /// loaded pack has its own, so that the files of different packs are
+  /// never mistaken for one another
+  std::uint64_t deviceId() const;
+
+  /// Looks up the given path, relative to the mount point. The root folder
+  /// is the empty path
+  bool lookup(Entry &entry, llvm::StringRef relative_path) const;
+
+  /// Returns the entry with the given index
+  Entry entry(std::uint32_t index) const;
+
+  /// Returns the contents of the given file; the buffer is always followed
+  /// by a null terminator. Files listed by a manifest are mapped from the
+  /// store the first time they are requested. This method is thread safe
+  bool contents(llvm::StringRef &contents, std::uint32_t index) const;
+
+  /// Returns the path of the given entry, relative to the mount point
+  llvm::StringRef entryPath(std::uint32_t index) const;
+
+  /// Returns the entries contained in the given folder, sorted by path
+  const std::vector<std::uint32_t> &folderContents(std::uint32_t index) const;
+
+  /// Disable the copy constructor
+  ProfilePack(const ProfilePack &other) = delete;
+
+  /// Disable the assignment operator
+  ProfilePack &operator=(const ProfilePack &other) = delete;
+};
+
+/// Returns the pack of the given profile, loading it the first time it is
+/// requested; the same object is shared by all the callers. The manifest is
+/// used when the profile has not been packed; if neither file exists, the
+/// reference is left empty and the function succeeds
+ProfilePack::Status getProfilePack(ProfilePackRef &profile_pack,
+                                   const Profile &profile);
+
+/// Returns the header archive containing the given path, loading it the first
+/// time it is requested; the path can be the archive itself or a folder or
+/// file inside it, and the archive is mounted at its own path. Only the path
+/// components ending with kHeaderArchiveExtension are looked up, so regular
+/// paths never access the file system; for those, the reference is left
+/// empty and the function succeeds
+ProfilePack::Status getHeaderArchive(ProfilePackRef &header_archive,
+                                     const std::string &path);
+
+/// Returns the contents of the given file when it is located inside a header
+/// archive; the buffer remains valid until the process exits, and is always
+/// followed by a null terminator. Returns false for the other paths
+bool readHeaderArchiveFile(llvm::StringRef &contents, const std::string &path);
+
+/// Creates a virtual file system that serves the files under the mount point
+/// of the given pack from memory, and forwards the other requests to the
+/// base file system (or the real one, if not set). Paths under the mount
+/// point that are not in the pack are reported as missing, without querying
+/// the base file system
+VirtualFileSystemRef createProfilePackFileSystem(
+    ProfilePackRef profile_pack,
+    VirtualFileSystemRef base_file_system = VirtualFileSystemRef());
@@ -15,13 +15,87 @@
  */
 
 #include "profilemanager.h"
+#include "output_file.h"
 #include "std_filesystem.h"
 
 #include <fstream>
+#include <mutex>
+#include <sstream>
 
 #include <json11.hpp>
 
+#if !defined(ABIGEN_EMBEDDED_PROFILE_INDEX)
+#define ABIGEN_EMBEDDED_PROFILE_INDEX 0
+#endif
+
 namespace {
+#if ABIGEN_EMBEDDED_PROFILE_INDEX
+/// A profile compiled into the executable; the path lists are terminated by
+/// a null pointer
+struct EmbeddedProfile final {
+  /// The profile name
+  const char *name;
+
+  /// The profile folder, relative to the profiles root
+  const char *folder;
+
+  /// The location for the clang resource directory
+  const char *resource_dir;
+
+  /// Default isystem parameters for C
+  const char *const *c_internal_isystem;
+
+  /// Default externc_isystem parameters for C
+  const char *const *c_internal_externc_isystem;
+
+  /// Default isystem parameters for C++
+  const char *const *cxx_internal_isystem;
+
+  /// Default externc_isystem parameters for C++
+  const char *const *cxx_internal_externc_isystem;
+};
+
+// Generated by CMake from the profile index; defines kEmbeddedProfileList
+#include "embedded_profile_index.h"
+
+/// Builds the profile map from the profiles compiled into the executable,
+/// located in the given profiles root
+ProfileMap getEmbeddedProfileMap(const std::string &profiles_root) {
+  auto L_pathList = [](const char *const *path_list) {
+    StringList output;
+    for (auto it = path_list; *it != nullptr; ++it) {
+      output.push_back(*it);
+    }
+
+    return output;
+  };
+
+  ProfileMap profile_map;
+  for (const auto &embedded_profile : kEmbeddedProfileList) {
+    Profile profile;
+    profile.name = embedded_profile.name;
+    profile.root_path =
+        (stdfs::path(profiles_root) / embedded_profile.folder).string();
+    profile.resource_dir = embedded_profile.resource_dir;
+
+    profile.internal_isystem.insert(
+        {Language::C, L_pathList(embedded_profile.c_internal_isystem)});
+    profile.internal_externc_isystem.insert(
+        {Language::C, L_pathList(embedded_profile.c_internal_externc_isystem)});
+
+    profile.internal_isystem.insert(
+        {Language::CXX, L_pathList(embedded_profile.cxx_internal_isystem)});
+    profile.internal_externc_isystem.insert(
+        {Language::CXX,
+         L_pathList(embedded_profile.cxx_internal_externc_isystem)});
+
+    profile_map.insert({profile.name, std::move(profile)});
+  }
+
+  return profile_map;
+}
+
+#else
 /// Locates the closest `data` folder (either at the current working directory
 /// or at the system-wide install location)
 bool getProfilesRootPath(std::string &path) {
@@ -42,6 +116,7 @@ bool getProfilesRootPath(std::string &path) {
 
   return false;
 }
+#endif
 
 /// Loads the profile located at the given path
 bool loadProfile(Profile &profile, const stdfs::path &path) {
@@ -137,33 +212,99 @@ bool loadProfile(Profile &profile, const stdfs::path &path) {
   return true;
 }
 
-/// Enumerates all the profiles found in the specified data directory
-bool enumerateProfiles(std::unordered_map<std::string, Profile> &profile_list,
+#if !ABIGEN_EMBEDDED_PROFILE_INDEX
+/// The optional index mapping each profile name to its folder, relative to
+/// the profiles root
+const std::string kProfileIndexFileName = "index.json";
+
+/// How deep the profile scan goes when the index is missing
+const std::size_t kMaxProfileSearchDepth = 3U;
+
+/// Loads the profile index from the specified data directory; if the index
+/// does not exist, index_found is set to false and the function succeeds
+bool loadProfileIndex(bool &index_found,
+                      std::unordered_map<std::string, std::string> &path_map,
+                      const std::string &profile_root_folder) {
+  index_found = false;
+  path_map = {};
+
+  auto index_path = stdfs::path(profile_root_folder) / kProfileIndexFileName;
+
+  std::error_code error;
+  if (!stdfs::exists(index_path, error)) {
+    return true;
+  }
+
+  index_found = true;
+
+  std::ifstream index_file(index_path.string());
+  std::string json_index((std::istreambuf_iterator<char>(index_file)),
+                         std::istreambuf_iterator<char>());
+
+  std::string error_messages;
+  const auto json = json11::Json::parse(json_index, error_messages);
+  if (!json["profiles"].is_object()) {
+    return false;
+  }
+
+  for (const auto &p : json["profiles"].object_items()) {
+    if (!p.second.is_string()) {
+      return false;
+    }
+
+    auto profile_path = stdfs::path(profile_root_folder) /
+                        p.second.string_value() / "profile.json";
+
+    path_map.insert({p.first, profile_path.string()});
+  }
+
+  return true;
+}
+
+/// Enumerates all the profiles found in the specified data directory. The
+/// scan does not enter the profile folders (which contain the system
+/// headers), and stops after kMaxProfileSearchDepth levels
+bool enumerateProfiles(ProfileMap &profile_list,
                        const std::string &profile_root_folder) {
   profile_list = {};
 
   try {
-    std::unordered_map<std::string, Profile> output;
+    ProfileMap output;
 
-    stdfs::recursive_directory_iterator it(profile_root_folder);
-    for (const auto &p : it) {
-      if (!stdfs::is_regular_file(p.path()) ||
-          p.path().filename().string() != "profile.json") {
-        continue;
-      }
+    std::vector<std::pair<stdfs::path, std::size_t>> pending_folder_list = {
+        {stdfs::path(profile_root_folder), 0U}};
+
+    while (!pending_folder_list.empty()) {
+      auto current_folder = pending_folder_list.back();
+      pending_folder_list.pop_back();
 
-      auto current_path = p.path();
+      const auto &folder_path = current_folder.first;
+      auto depth = current_folder.second;
 
-      Profile profile;
-      if (!loadProfile(profile, current_path)) {
+      auto profile_path = folder_path / "profile.json";
+      if (stdfs::is_regular_file(profile_path)) {
+        Profile profile;
+        if (!loadProfile(profile, profile_path)) {
+          continue;
+        }
+
+        if (output.find(profile.name) != output.end()) {
+          return false;
+        }
+
+        output.insert({profile.name, profile});
         continue;
       }
 
-      if (profile_list.find(profile.name) != profile_list.end()) {
-        return false;
+      if (depth >= kMaxProfileSearchDepth) {
+        continue;
       }
 
-      output.insert({profile.name, profile});
+      for (const auto &p : stdfs::directory_iterator(folder_path)) {
+        if (stdfs::is_directory(p.path())) {
+          pending_folder_list.push_back({p.path(), depth + 1U});
+        }
+      }
     }
 
     profile_list = std::move(output);
@@ -175,6 +316,82 @@ bool enumerateProfiles(std::unordered_map<std::string, Profile> &profile_list,
     return false;
   }
 }
+#endif
+
+/// The first line of each precompiled header manifest
+const std::string kPrecompiledHeaderManifestHeader = "abigen-profile-pch 1";
+
+/// The folder, inside each profile, containing the precompiled system headers
+const std::string kProfilePrecompiledHeaderFolderName = "precompiled";
+
+/// The folder, inside the cache folder, containing the precompiled system
+/// headers of each profile
+const std::string kCachedPrecompiledHeaderFolderName =
+    "profile_precompiled_headers";
+
+/// Reads the given precompiled header manifest, returning true if none of
+/// the dependencies has changed. The path of the precompiled header is
+/// returned even when the manifest is no longer valid, so that the file can
+/// be removed
+bool readPrecompiledHeaderManifest(ProfilePrecompiledHeader &precompiled_header,
+                                   const stdfs::path &manifest_path) {
+  precompiled_header = {};
+
+  std::ifstream manifest_file(manifest_path.string());
+  if (!manifest_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(manifest_file, line) ||
+      line != kPrecompiledHeaderManifestHeader) {
+    return false;
+  }
+
+  const std::string settings_tag = "settings ";
+  if (!std::getline(manifest_file, line) ||
+      line.compare(0U, settings_tag.size(), settings_tag) != 0 ||
+      !contentHashFromString(precompiled_header.settings_hash,
+                             line.substr(settings_tag.size()))) {
+    return false;
+  }
+
+  // The header is always saved next to the manifest
+  const std::string pch_tag = "pch ";
+  if (!std::getline(manifest_file, line) ||
+      line.compare(0U, pch_tag.size(), pch_tag) != 0 ||
+      line.find('/') != std::string::npos) {
+    return false;
+  }
+
+  precompiled_header.path =
+      (manifest_path.parent_path() / line.substr(pch_tag.size())).string();
+
+  const std::string header_tag = "header ";
+
+  while (std::getline(manifest_file, line)) {
+    if (line.compare(0U, header_tag.size(), header_tag) == 0) {
+      precompiled_header.header_list.push_back(line.substr(header_tag.size()));
+      continue;
+    }
+
+    std::string path;
+    ContentHash expected_hash;
+    if (!parseDependencyLine(path, expected_hash, line)) {
+      return false;
+    }
+
+    ContentHash current_hash;
+    if (!hashFileContents(current_hash, path) ||
+        current_hash != expected_hash) {
+      return false;
+    }
+  }
+
+  std::error_code error;
+  return !precompiled_header.header_list.empty() &&
+         stdfs::exists(precompiled_header.path, error);
+}
 }  // namespace
 
 /// Private class data for ProfileManager objects
@@ -184,26 +401,89 @@ struct ProfileManager::PrivateData final {
   // default to the system-wide one if it is not found
   std::string profiles_root;
 
-  /// This is the list of discovered profiles, built scanning the
-  /// `profiles_root` folder
+  /// Protects the profile maps
+  std::mutex profile_map_mutex;
+
+  /// The profiles listed in the index that have not been loaded yet; maps
+  /// each name to the path of its profile.json file
+  std::unordered_map<std::string, std::string> pending_profile_paths;
+
+  /// This is the list of loaded profiles. When the index is missing, it is
+  /// built scanning the `profiles_root` folder
   ProfileMap profile_descriptors;
+
+  /// Protects the precompiled header map
+  std::mutex precompiled_header_map_mutex;
+
+  /// The precompiled headers whose dependencies have been validated, keyed
+  /// on the manifest path; each entry also stores the hash of the manifest,
+  /// so that a header rebuilt in the meantime is validated again
+  std::unordered_map<std::string,
+                     std::pair<ContentHash, ProfilePrecompiledHeader>>
+      precompiled_header_map;
 };
 
 ProfileManager::ProfileManager() : d(new PrivateData) {
+#if ABIGEN_EMBEDDED_PROFILE_INDEX
+  // The installed profiles have been compiled in; neither the profiles root
+  // nor the profile files have to be looked up
+  d->profiles_root =
+      (stdfs::path(PROFILE_INSTALL_FOLDER) / "data" / "platforms").string();
+  d->profile_descriptors = getEmbeddedProfileMap(d->profiles_root);
+
+#else
   if (!getProfilesRootPath(d->profiles_root)) {
     throw Status(false, StatusCode::MissingProfilesRoot,
                  "Failed to locate a suitable profile root folder");
   }
 
-  if (!enumerateProfiles(d->profile_descriptors, d->profiles_root)) {
+  // Only the profiles that are actually used are parsed when the index is
+  // available
+  bool index_found = false;
+  if (!loadProfileIndex(index_found, d->pending_profile_paths,
+                        d->profiles_root)) {
+    throw Status(false, StatusCode::ProfileEnumerationError,
+                 "Failed to load the profile index");
+  }
+
+  if (!index_found &&
+      !enumerateProfiles(d->profile_descriptors, d->profiles_root)) {
     throw Status(false, StatusCode::ProfileEnumerationError,
                  "Failed to locate a suitable profile root folder");
   }
 
-  if (d->profile_descriptors.empty()) {
+  if (d->pending_profile_paths.empty() && d->profile_descriptors.empty()) {
     throw Status(false, StatusCode::ProfilesMissing,
                  "No profile could be found");
   }
+#endif
+}
+
+ProfileManager::Status ProfileManager::loadPendingProfile(
+    const std::string &name) const {
+  auto path_it = d->pending_profile_paths.find(name);
+  if (path_it == d->pending_profile_paths.end()) {
+    return Status(false, StatusCode::ProfileNotFound,
+                  "The specified profile does not exists");
+  }
+
+  auto profile_path = path_it->second;
+  d->pending_profile_paths.erase(path_it);
+
+  Profile profile;
+  if (!loadProfile(profile, profile_path)) {
+    return Status(false, StatusCode::InvalidProfile,
+                  "Failed to load the profile from " + profile_path);
+  }
+
+  if (profile.name != name) {
+    return Status(false, StatusCode::InvalidProfile,
+                  "The profile found in " + profile_path +
+                      " does not match the name in the index");
+  }
+
+  d->profile_descriptors.insert({name, std::move(profile)});
+  return Status(true);
 }
 
 ProfileManager::Status ProfileManager::create(ProfileManagerRef &obj) {
@@ -228,16 +508,178 @@ ProfileManager::~ProfileManager() {}
 
 ProfileManager::Status ProfileManager::get(Profile &profile,
                                            const std::string &name) const {
+  std::lock_guard<std::mutex> lock(d->profile_map_mutex);
+
   auto it = d->profile_descriptors.find(name);
   if (it == d->profile_descriptors.end()) {
-    return Status(false, StatusCode::ProfileNotFound,
-                  "The specified profile does not exists");
+    auto status = loadPendingProfile(name);
+    if (!status.succeeded()) {
+      return status;
+    }
+
+    it = d->profile_descriptors.find(name);
   }
 
   profile = it->second;
   return Status(true);
 }
 
-const ProfileMap &ProfileManager::profileMap() const {
+ProfileMap ProfileManager::profileMap() const {
+  std::lock_guard<std::mutex> lock(d->profile_map_mutex);
+
+  // Profiles that fail to load are skipped, as the directory scan does
+  StringList pending_profile_names;
+  for (const auto &p : d->pending_profile_paths) {
+    pending_profile_names.push_back(p.first);
+  }
+
+  for (const auto &name : pending_profile_names) {
+    loadPendingProfile(name);
+  }
+
   return d->profile_descriptors;
 }
+
+ProfileManager::Status ProfileManager::getPrecompiledHeader(
+    ProfilePrecompiledHeader &precompiled_header, const Profile &profile,
+    Language language, int standard, bool enable_gnu_extensions,
+    const std::string &cache_directory) const {
+  precompiled_header = {};
+
+  auto manifest_name =
+      precompiledHeaderName(language, standard, enable_gnu_extensions) +
+      ".manifest";
+
+  StringList folder_list;
+  if (!cache_directory.empty()) {
+    folder_list.push_back(precompiledHeaderFolder(profile, cache_directory));
+  }
+
+  folder_list.push_back(precompiledHeaderFolder(profile, std::string()));
+
+  bool outdated_manifest_found = false;
+
+  for (const auto &folder : folder_list) {
+    auto manifest_path = (stdfs::path(folder) / manifest_name).string();
+
+    ContentHash manifest_hash;
+    if (!hashFileContents(manifest_hash, manifest_path)) {
+      continue;
+    }
+
+    std::lock_guard<std::mutex> lock(d->precompiled_header_map_mutex);
+
+    auto it = d->precompiled_header_map.find(manifest_path);
+    if (it != d->precompiled_header_map.end() &&
+        it->second.first == manifest_hash) {
+      precompiled_header = it->second.second;
+      return Status(true);
+    }
+
+    ProfilePrecompiledHeader manifest;
+    if (!readPrecompiledHeaderManifest(manifest, manifest_path)) {
+      outdated_manifest_found = true;
+      continue;
+    }
+
+    d->precompiled_header_map[manifest_path] = {manifest_hash, manifest};
+
+    precompiled_header = std::move(manifest);
+    return Status(true);
+  }
+
+  if (outdated_manifest_found) {
+    return Status(false, StatusCode::InvalidPrecompiledHeader,
+                  "The precompiled system headers of the " + profile.name +
+                      " profile are out of date; run the build_profile_pch "
+                      "command again");
+  }
+
+  return Status(false, StatusCode::PrecompiledHeaderNotFound,
+                "The system headers of the " + profile.name +
+                    " profile have not been precompiled; use the "
+                    "build_profile_pch command");
+}
+
+ProfileManager::Status ProfileManager::savePrecompiledHeader(
+    const ProfilePrecompiledHeader &precompiled_header, const Profile &profile,
+    Language language, int standard, bool enable_gnu_extensions,
+    const std::string &cache_directory, const StringList &dependency_list) {
+  auto folder = stdfs::path(precompiledHeaderFolder(profile, cache_directory));
+  auto manifest_path =
+      folder / (precompiledHeaderName(language, standard,
+                                      enable_gnu_extensions) +
+                ".manifest");
+
+  auto pch_path = stdfs::path(precompiled_header.path);
+  if (pch_path.parent_path() != folder) {
+    return Status(false, StatusCode::InvalidPrecompiledHeader,
+                  "The precompiled header must be saved in " +
+                      folder.string());
+  }
+
+  std::stringstream buffer;
+  buffer << kPrecompiledHeaderManifestHeader << "\n";
+  buffer << "settings " << contentHashToString(precompiled_header.settings_hash)
+         << "\n";
+  buffer << "pch " << pch_path.filename().string() << "\n";
+
+  for (const auto &header : precompiled_header.header_list) {
+    buffer << "header " << header << "\n";
+  }
+
+  for (const auto &path : dependency_list) {
+    ContentHash hash;
+    if (!hashFileContents(hash, path)) {
+      return Status(false, StatusCode::IOError,
+                    "Failed to hash the following dependency: " + path);
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  // Processes that are still loading the previous generation keep reading
+  // it until the new manifest replaces the old one
+  ProfilePrecompiledHeader previous_precompiled_header;
+  readPrecompiledHeaderManifest(previous_precompiled_header, manifest_path);
+
+  if (!writeFileAtomically(manifest_path, buffer.str())) {
+    return Status(false, StatusCode::IOError,
+                  "Failed to write the following manifest: " +
+                      manifest_path.string());
+  }
+
+  const auto &previous_path = previous_precompiled_header.path;
+  if (!previous_path.empty() && previous_path != precompiled_header.path) {
+    std::error_code error;
+    stdfs::remove(previous_path, error);
+    stdfs::remove(previous_path + ".h", error);
+  }
+
+  return Status(true);
+}
+
+std::string ProfileManager::precompiledHeaderFolder(
+    const Profile &profile, const std::string &cache_directory) {
+  if (cache_directory.empty()) {
+    return (stdfs::path(profile.root_path) /
+            kProfilePrecompiledHeaderFolderName)
+        .string();
+  }
+
+  return (stdfs::path(cache_directory) / kCachedPrecompiledHeaderFolderName /
+          profile.name)
+      .string();
+}
+
+std::string ProfileManager::precompiledHeaderName(Language language,
+                                                  int standard,
+                                                  bool enable_gnu_extensions) {
+  std::string name = (language == Language::C) ? "c" : "cxx";
+  name += std::to_string(standard);
+  if (enable_gnu_extensions) {
+    name += "-gnu";
+  }
+
+  return name;
+}
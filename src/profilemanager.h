@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include "content_hash.h"
 #include "istatus.h"
 #include "languagemanager.h"
 #include "types.h"
@@ -45,6 +46,20 @@ struct Profile final {
   std::unordered_map<Language, StringList> internal_externc_isystem;
 };
 
+/// A precompiled header containing a standard set of system headers, built
+/// for a profile by the build_profile_pch command
+struct ProfilePrecompiledHeader final {
+  /// Path of the precompiled header
+  std::string path;
+
+  /// Hash of the compiler settings used to build the header; it must match
+  /// the settings of the compiler instances loading it
+  ContentHash settings_hash{0U};
+
+  /// The include directives that have been precompiled, in order
+  StringList header_list;
+};
+
 /// A profile map
 using ProfileMap = std::unordered_map<std::string, Profile>;
 
@@ -69,6 +84,10 @@ class ProfileManager final {
     ProfileEnumerationError,
     ProfilesMissing,
     ProfileNotFound,
+    InvalidProfile,
+    PrecompiledHeaderNotFound,
+    InvalidPrecompiledHeader,
+    IOError,
     Unknown
   };
 
@@ -81,10 +100,43 @@ class ProfileManager final {
   /// Destructor
   ~ProfileManager();
 
-  /// Returns the specified profile
+  /// Returns a copy of the specified profile. Profiles listed in the index
+  /// are only parsed the first time they are requested; this method is
+  /// thread safe
   Status get(Profile &profile, const std::string &name) const;
 
-  /// Enumerates each profile
+  /// Returns the precompiled system headers built for the given profile and
+  /// language. When a cache folder is given, it is searched before the
+  /// profile folder. The dependencies of each header are validated the first
+  /// time it is requested; this method is thread safe
+  Status getPrecompiledHeader(ProfilePrecompiledHeader &precompiled_header,
+                              const Profile &profile, Language language,
+                              int standard, bool enable_gnu_extensions,
+                              const std::string &cache_directory) const;
+
+  /// Saves the manifest describing a precompiled header built for the given
+  /// profile and language, so that ProfileManager::getPrecompiledHeader()
+  /// can find it; the header must have been written in the folder returned
+  /// by ProfileManager::precompiledHeaderFolder()
+  static Status savePrecompiledHeader(
+      const ProfilePrecompiledHeader &precompiled_header,
+      const Profile &profile, Language language, int standard,
+      bool enable_gnu_extensions, const std::string &cache_directory,
+      const StringList &dependency_list);
+
+  /// Returns the folder containing the precompiled system headers of the
+  /// given profile: a subfolder of the cache folder when one is given, or of
+  /// the profile folder otherwise
+  static std::string precompiledHeaderFolder(
+      const Profile &profile, const std::string &cache_directory);
+
+  /// Returns the name identifying the precompiled system headers built for
+  /// the given language (i.e.: cxx14 or c99-gnu)
+  static std::string precompiledHeaderName(Language language, int standard,
+                                           bool enable_gnu_extensions);
+
+  /// Enumerates each profile; the callback receives a copy of the profile
+  /// list, and may call the other methods of this object
   template <typename T>
   void enumerate(bool (*callback)(const Profile &profile, T user_defined),
                  T user_defined) const;
@@ -96,15 +148,23 @@ class ProfileManager final {
   ProfileManager &operator=(const ProfileManager &other) = delete;
 
  private:
-  /// Private accessor used by the ProfileManager::enumerate method
-  const ProfileMap &profileMap() const;
+  /// Private accessor used by the ProfileManager::enumerate method; loads
+  /// all the profiles that are still pending, and returns a copy of the map
+  /// so that it can be walked without holding the lock
+  ProfileMap profileMap() const;
+
+  /// Loads the given profile from the path found in the index; the caller
+  /// must hold the profile map lock
+  Status loadPendingProfile(const std::string &name) const;
 };
 
 template <typename T>
 void ProfileManager::enumerate(bool (*callback)(const Profile &profile,
                                                 T user_defined),
                                T user_defined) const {
-  for (const auto &p : profileMap()) {
+  auto profile_map = profileMap();
+
+  for (const auto &p : profile_map) {
     const auto &profile = p.second;
     if (!callback(profile, user_defined)) {
       break;
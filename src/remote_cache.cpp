@@ -0,0 +1,567 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "remote_cache.h"
+#include "output_file.h"
+#include "socket_io.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// How long a request can wait on the server, in seconds
+const long kRequestTimeout = 30;
+
+/// The largest response that is accepted, in bytes
+const std::size_t kMaxResponseSize = 1024U * 1024U * 1024U;
+
+/// The components of an http:// URL
+struct RemoteCacheURL final {
+  /// Host name or address
+  std::string host;
+
+  /// Port number
+  std::string port{"80"};
+
+  /// Path prefix, without the trailing separator
+  std::string path;
+};
+
+/// Parses the given http:// URL; returns false if it is not valid
+bool parseRemoteCacheURL(RemoteCacheURL &url, const std::string &definition) {
+  url = {};
+
+  const std::string scheme = "http://";
+  if (definition.compare(0U, scheme.size(), scheme) != 0) {
+    return false;
+  }
+
+  auto authority_end = definition.find('/', scheme.size());
+
+  auto authority =
+      definition.substr(scheme.size(), authority_end == std::string::npos
+                                           ? std::string::npos
+                                           : authority_end - scheme.size());
+
+  if (authority_end != std::string::npos) {
+    url.path = definition.substr(authority_end);
+  }
+
+  while (!url.path.empty() && url.path.back() == '/') {
+    url.path.pop_back();
+  }
+
+  auto port_separator = authority.rfind(':');
+  if (port_separator != std::string::npos) {
+    url.port = authority.substr(port_separator + 1U);
+    authority.resize(port_separator);
+
+    if (url.port.empty() ||
+        !std::all_of(url.port.begin(), url.port.end(),
+                     [](char c) -> bool { return c >= '0' && c <= '9'; })) {
+      return false;
+    }
+  }
+
+  url.host = authority;
+  return !url.host.empty();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/// Connects to the server of the given URL; returns -1 on failure
+int connectToServer(const RemoteCacheURL &url) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo *address_list = nullptr;
+  if (getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &address_list) !=
+      0) {
+    return -1;
+  }
+
+  timeval timeout = {};
+  timeout.tv_sec = kRequestTimeout;
+
+  int socket_descriptor = -1;
+  for (auto it = address_list; it != nullptr; it = it->ai_next) {
+    socket_descriptor = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (socket_descriptor < 0) {
+      continue;
+    }
+
+    setsockopt(socket_descriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    setsockopt(socket_descriptor, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+
+    if (connect(socket_descriptor, it->ai_addr, it->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(socket_descriptor);
+    socket_descriptor = -1;
+  }
+
+  freeaddrinfo(address_list);
+  return socket_descriptor;
+}
+
+/// Sends an HTTP/1.0 request, so that the server closes the connection
+/// after a response that is never chunked. Returns the status code of the
+/// response, or -1 if the server could not be reached
+int sendHTTPRequest(std::string &response_body, const RemoteCacheURL &url,
+                    const std::string &method, const std::string &path,
+                    const std::string &request_body) {
+  response_body.clear();
+
+  auto socket_descriptor = connectToServer(url);
+  if (socket_descriptor < 0) {
+    return -1;
+  }
+
+  std::stringstream request;
+  request << method << " " << url.path << "/" << path << " HTTP/1.0\r\n";
+  request << "Host: " << url.host << "\r\n";
+  request << "User-Agent: abigen\r\n";
+  request << "Content-Length: " << request_body.size() << "\r\n\r\n";
+
+  if (!writeSocket(socket_descriptor, request.str()) ||
+      !writeSocket(socket_descriptor, request_body)) {
+    close(socket_descriptor);
+    return -1;
+  }
+
+  std::string response;
+  char buffer[65536];
+
+  while (response.size() < kMaxResponseSize) {
+    auto size = read(socket_descriptor, buffer, sizeof(buffer));
+    if (size < 0) {
+      close(socket_descriptor);
+      return -1;
+    }
+
+    if (size == 0) {
+      break;
+    }
+
+    response.append(buffer, static_cast<std::size_t>(size));
+  }
+
+  close(socket_descriptor);
+
+  // The status line looks like "HTTP/1.1 200 OK"
+  auto header_end = response.find("\r\n\r\n");
+  if (header_end == std::string::npos ||
+      response.compare(0U, 5U, "HTTP/") != 0) {
+    return -1;
+  }
+
+  auto status_position = response.find(' ');
+  if (status_position == std::string::npos || status_position > header_end) {
+    return -1;
+  }
+
+  int status_code = 0;
+  try {
+    status_code = std::stoi(response.substr(status_position + 1U, 3U));
+  } catch (...) {
+    return -1;
+  }
+
+  response_body = response.substr(header_end + 4U);
+
+  // Make sure the body has not been truncated
+  std::string headers = response.substr(0U, header_end);
+  std::transform(headers.begin(), headers.end(), headers.begin(),
+                 [](char c) -> char {
+                   return static_cast<char>(
+                       std::tolower(static_cast<unsigned char>(c)));
+                 });
+
+  const std::string content_length_tag = "\r\ncontent-length:";
+  auto content_length_position = headers.find(content_length_tag);
+  if (content_length_position != std::string::npos) {
+    std::size_t content_length = 0U;
+
+    try {
+      content_length = static_cast<std::size_t>(std::stoull(
+          headers.substr(content_length_position + content_length_tag.size())));
+    } catch (...) {
+      return -1;
+    }
+
+    if (content_length != response_body.size()) {
+      response_body.clear();
+      return -1;
+    }
+  }
+
+  return status_code;
+}
+#endif
+}  // namespace
+
+/// Private class data
+struct RemoteCache::PrivateData final {
+  /// The server
+  RemoteCacheURL url;
+
+  /// The local cache folder; remote paths are relative to it
+  stdfs::path cache_directory;
+
+  /// The local cache folder, as a generic path ending with a separator
+  std::string cache_directory_prefix;
+
+  /// If not zero, the size the local cache folder is trimmed to
+  std::uint64_t local_size_limit{0U};
+
+  /// Cleared when the server can't be reached; the remaining requests are
+  /// then skipped
+  std::atomic_bool server_available{true};
+
+  /// Protects the upload queue
+  std::mutex upload_queue_mutex;
+
+  /// Signaled when a file is queued, or when the upload thread should stop
+  std::condition_variable upload_queue_condition;
+
+  /// Signaled when the last pending upload is done
+  std::condition_variable upload_done_condition;
+
+  /// The files waiting to be uploaded
+  std::deque<std::string> upload_queue;
+
+  /// The queued files, along with the one being uploaded
+  std::size_t pending_upload_count{0U};
+
+  /// Set by the destructor; the upload thread drains the queue, then exits
+  bool stop_upload_thread{false};
+
+  /// Uploads the queued files
+  std::thread upload_thread;
+
+  /// Files downloaded from the server
+  std::atomic_size_t download_count{0U};
+
+  /// Files uploaded to the server
+  std::atomic_size_t upload_count{0U};
+
+  /// Requests that failed
+  std::atomic_size_t error_count{0U};
+
+  /// Marks the server as unreachable, reporting it only once
+  void disableServer() {
+    if (server_available.exchange(false)) {
+      std::cerr << "The remote cache at " << url.host << ":" << url.port
+                << " can't be reached; only the local cache will be used\n";
+    }
+  }
+};
+
+RemoteCache::RemoteCache(const std::string &url,
+                         const std::string &cache_directory,
+                         std::uint64_t local_size_limit)
+    : d(new PrivateData) {
+#if defined(__unix__) || defined(__APPLE__)
+  if (!parseRemoteCacheURL(d->url, url)) {
+    throw Status(false, StatusCode::InvalidURL,
+                 "Invalid remote cache URL (only http:// is supported): " +
+                     url);
+  }
+
+  d->cache_directory = cache_directory;
+  d->local_size_limit = local_size_limit;
+
+  d->cache_directory_prefix = d->cache_directory.generic_string();
+  while (d->cache_directory_prefix.size() > 1U &&
+         d->cache_directory_prefix.back() == '/') {
+    d->cache_directory_prefix.pop_back();
+  }
+
+  d->cache_directory_prefix.push_back('/');
+
+  d->upload_thread = std::thread(&RemoteCache::uploadThread, this);
+
+#else
+  static_cast<void>(url);
+  static_cast<void>(cache_directory);
+  static_cast<void>(local_size_limit);
+
+  throw Status(false, StatusCode::NotSupported,
+               "The remote cache is not supported on this platform");
+#endif
+}
+
+std::string RemoteCache::remotePath(const std::string &local_path) const {
+  auto path = stdfs::path(local_path).generic_string();
+  if (path.size() <= d->cache_directory_prefix.size() ||
+      path.compare(0U, d->cache_directory_prefix.size(),
+                   d->cache_directory_prefix) != 0) {
+    return std::string();
+  }
+
+  return path.substr(d->cache_directory_prefix.size());
+}
+
+void RemoteCache::uploadThread() {
+#if defined(__unix__) || defined(__APPLE__)
+  while (true) {
+    std::string local_path;
+
+    {
+      std::unique_lock<std::mutex> lock(d->upload_queue_mutex);
+      d->upload_queue_condition.wait(lock, [&]() -> bool {
+        return d->stop_upload_thread || !d->upload_queue.empty();
+      });
+
+      if (d->upload_queue.empty()) {
+        break;
+      }
+
+      local_path = std::move(d->upload_queue.front());
+      d->upload_queue.pop_front();
+    }
+
+    auto L_uploadFile = [&]() {
+      auto remote_path = remotePath(local_path);
+      if (remote_path.empty() || !d->server_available) {
+        return;
+      }
+
+      std::ifstream file(local_path, std::ios::in | std::ios::binary);
+      if (!file) {
+        return;
+      }
+
+      std::stringstream buffer;
+      buffer << file.rdbuf();
+
+      std::string response_body;
+      auto status_code = sendHTTPRequest(response_body, d->url, "PUT",
+                                         remote_path, buffer.str());
+
+      if (status_code < 0) {
+        d->error_count++;
+        d->disableServer();
+
+      } else if (status_code >= 200 && status_code < 300) {
+        d->upload_count++;
+
+      } else {
+        d->error_count++;
+      }
+    };
+
+    L_uploadFile();
+
+    std::lock_guard<std::mutex> lock(d->upload_queue_mutex);
+    if (--d->pending_upload_count == 0U) {
+      d->upload_done_condition.notify_all();
+    }
+  }
+#endif
+}
+
+void RemoteCache::trimLocalCache() {
+  struct CachedFile final {
+    stdfs::path path;
+    std::uint64_t size;
+    stdfs::file_time_type last_write_time;
+  };
+
+  std::vector<CachedFile> cached_file_list;
+  std::uint64_t total_size = 0U;
+
+  std::error_code error;
+  for (auto it = stdfs::recursive_directory_iterator(d->cache_directory, error);
+       !error && it != stdfs::recursive_directory_iterator();
+       it.increment(error)) {
+    if (!stdfs::is_regular_file(it->path(), error)) {
+      error.clear();
+      continue;
+    }
+
+    CachedFile cached_file;
+    cached_file.path = it->path();
+    cached_file.size = stdfs::file_size(cached_file.path, error);
+    cached_file.last_write_time =
+        stdfs::last_write_time(cached_file.path, error);
+
+    if (error) {
+      error.clear();
+      continue;
+    }
+
+    total_size += cached_file.size;
+    cached_file_list.push_back(std::move(cached_file));
+  }
+
+  if (total_size <= d->local_size_limit) {
+    return;
+  }
+
+  std::sort(cached_file_list.begin(), cached_file_list.end(),
+            [](const CachedFile &lhs, const CachedFile &rhs) -> bool {
+              return lhs.last_write_time < rhs.last_write_time;
+            });
+
+  for (const auto &cached_file : cached_file_list) {
+    if (total_size <= d->local_size_limit) {
+      break;
+    }
+
+    if (stdfs::remove(cached_file.path, error)) {
+      total_size -= cached_file.size;
+    }
+  }
+}
+
+RemoteCache::Status RemoteCache::create(RemoteCacheRef &obj,
+                                        const std::string &url,
+                                        const std::string &cache_directory,
+                                        std::uint64_t local_size_limit) {
+  obj.reset();
+
+  try {
+    auto ptr = new RemoteCache(url, cache_directory, local_size_limit);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+RemoteCache::~RemoteCache() {
+  {
+    std::lock_guard<std::mutex> lock(d->upload_queue_mutex);
+    d->stop_upload_thread = true;
+  }
+
+  d->upload_queue_condition.notify_all();
+
+  if (d->upload_thread.joinable()) {
+    d->upload_thread.join();
+  }
+
+  if (d->local_size_limit != 0U) {
+    trimLocalCache();
+  }
+}
+
+bool RemoteCache::fetch(const std::string &local_path) {
+#if defined(__unix__) || defined(__APPLE__)
+  auto remote_path = remotePath(local_path);
+  if (remote_path.empty() || !d->server_available) {
+    return false;
+  }
+
+  std::string response_body;
+  auto status_code =
+      sendHTTPRequest(response_body, d->url, "GET", remote_path, "");
+
+  if (status_code < 0) {
+    d->error_count++;
+    d->disableServer();
+    return false;
+  }
+
+  // Anything other than a missing file is reported as an error
+  if (status_code != 200) {
+    if (status_code != 404) {
+      d->error_count++;
+    }
+
+    return false;
+  }
+
+  stdfs::path path(local_path);
+
+  std::error_code error;
+  stdfs::create_directories(path.parent_path(), error);
+  if (error || !writeFileAtomically(path, response_body)) {
+    d->error_count++;
+    return false;
+  }
+
+  d->download_count++;
+  return true;
+
+#else
+  static_cast<void>(local_path);
+  return false;
+#endif
+}
+
+void RemoteCache::upload(const std::string &local_path) {
+  if (!d->server_available) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->upload_queue_mutex);
+    d->upload_queue.push_back(local_path);
+    d->pending_upload_count++;
+  }
+
+  d->upload_queue_condition.notify_one();
+}
+
+void RemoteCache::waitForUploads() {
+  std::unique_lock<std::mutex> lock(d->upload_queue_mutex);
+  d->upload_done_condition.wait(
+      lock, [&]() -> bool { return d->pending_upload_count == 0U; });
+}
+
+void RemoteCache::touch(const std::string &local_path) {
+  if (d->local_size_limit == 0U) {
+    return;
+  }
+
+  std::error_code error;
+  stdfs::last_write_time(local_path, stdfs::file_time_type::clock::now(),
+                         error);
+}
+
+std::size_t RemoteCache::downloadCount() const { return d->download_count; }
+
+std::size_t RemoteCache::uploadCount() const { return d->upload_count; }
+
+std::size_t RemoteCache::errorCount() const { return d->error_count; }
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class RemoteCache;
+
+/// A reference to a RemoteCache object
+using RemoteCacheRef = std::shared_ptr<RemoteCache>;
+
+/// The RemoteCache shares the files of the local cache folder through an
+/// HTTP server, such as an S3 bucket gateway or a build cache server. Each
+/// file is stored under its path inside the cache folder; since the entries
+/// are named after the hash of their key, the remote store is content
+/// addressed. The local cache folder acts as the front of the remote one:
+/// missing files are downloaded on demand, new ones are uploaded in the
+/// background, and the least recently used files are removed when the
+/// folder grows past the size limit
+class RemoteCache final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  RemoteCache(const std::string &url, const std::string &cache_directory,
+              std::uint64_t local_size_limit);
+
+  /// Returns the remote path of the given local file, or an empty string if
+  /// the file is not inside the cache folder
+  std::string remotePath(const std::string &local_path) const;
+
+  /// Uploads the queued files; runs on the upload thread
+  void uploadThread();
+
+  /// Removes the least recently used files until the cache folder fits in
+  /// the size limit
+  void trimLocalCache();
+
+ public:
+  /// Status code, used with RemoteCache::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    InvalidURL,
+    NotSupported,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new RemoteCache object for the given http:// URL. If the size
+  /// limit (in bytes) is not zero, the local cache folder is trimmed when the
+  /// object is destroyed
+  static Status create(RemoteCacheRef &obj, const std::string &url,
+                       const std::string &cache_directory,
+                       std::uint64_t local_size_limit);
+
+  /// Destructor; waits for the pending uploads, then trims the local cache
+  /// folder
+  ~RemoteCache();
+
+  /// Downloads the given file of the local cache folder from the remote
+  /// cache; returns false if the remote cache does not have it. This method
+  /// is thread safe
+  bool fetch(const std::string &local_path);
+
+  /// Queues the upload of the given file of the local cache folder. This
+  /// method is thread safe
+  void upload(const std::string &local_path);
+
+  /// Waits until all the queued files have been uploaded
+  void waitForUploads();
+
+  /// Marks the given file of the local cache folder as recently used. This
+  /// method is thread safe
+  void touch(const std::string &local_path);
+
+  /// Returns the amount of files that have been downloaded
+  std::size_t downloadCount() const;
+
+  /// Returns the amount of files that have been uploaded
+  std::size_t uploadCount() const;
+
+  /// Returns the amount of requests that failed
+  std::size_t errorCount() const;
+
+  /// Disable the copy constructor
+  RemoteCache(const RemoteCache &other) = delete;
+
+  /// Disable the assignment operator
+  RemoteCache &operator=(const RemoteCache &other) = delete;
+};
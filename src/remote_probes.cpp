@@ -0,0 +1,1143 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "remote_probes.h"
+#include "generate_utils.h"
+#include "profile_pack.h"
+#include "socket_io.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <unordered_set>
+
+#include <json11.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__APPLE__)
+#include <mach-o/dyld.h>
+#endif
+
+namespace {
+/// Coordinators and workers must speak the same protocol version
+const int kRemoteProtocolVersion = 1;
+
+/// The largest message that is accepted, in bytes; the header packs are
+/// sent as raw payloads, and do not count
+const std::size_t kMaxMessageSize = 64U * 1024U * 1024U;
+
+/// How long an isolated worker can take to answer on top of the time budget
+/// of the compilations it has been asked for, in seconds
+const std::size_t kIsolatedWorkerGracePeriod = 30U;
+
+/// Returns the abigen and LLVM versions; workers only accept coordinators
+/// built from the same sources, since the probe outcomes may otherwise
+/// change
+std::string getVersionIdentity() {
+  return std::string(ABIGEN_COMMIT_HASH) + "/llvm-" +
+         std::to_string(LLVM_MAJOR_VERSION) + "." +
+         std::to_string(LLVM_MINOR_VERSION);
+}
+
+/// Converts a list of strings to a JSON array
+json11::Json toJson(const StringList &string_list) {
+  json11::Json::array array;
+  for (const auto &str : string_list) {
+    array.push_back(str);
+  }
+
+  return array;
+}
+
+/// Converts a JSON array to a list of strings
+StringList toStringList(const json11::Json &json) {
+  StringList string_list;
+  for (const auto &item : json.array_items()) {
+    string_list.push_back(item.string_value());
+  }
+
+  return string_list;
+}
+
+/// Serializes the remote probe settings
+json11::Json toJson(const RemoteProbeSettings &settings) {
+  json11::Json::array header_pack_array;
+  for (const auto &header_pack : settings.header_pack_list) {
+    header_pack_array.push_back(json11::Json::object{
+        {"hash", contentHashToString(header_pack.hash)},
+        {"mount_point", header_pack.mount_point}});
+  }
+
+  return json11::Json::object{
+      {"profile_name", settings.profile_name},
+      {"language", settings.language},
+      {"enable_gnu_extensions", settings.enable_gnu_extensions},
+      {"use_visual_cxx_mangling", settings.use_visual_cxx_mangling},
+      {"target_triple", settings.target_triple},
+      {"skip_function_bodies", settings.skip_function_bodies},
+      {"stop_at_first_error", settings.stop_at_first_error},
+      {"ignore_warnings", settings.ignore_warnings},
+      {"time_budget", static_cast<double>(settings.time_budget)},
+      {"additional_include_folders",
+       toJson(settings.additional_include_folders)},
+      {"base_includes", toJson(settings.base_includes)},
+      {"probe_tiers", settings.probe_tiers},
+      {"use_precompiled_prefix", settings.use_precompiled_prefix},
+      {"track_included_headers", settings.track_included_headers},
+      {"classify_failures", settings.classify_failures},
+      {"header_packs", header_pack_array}};
+}
+
+/// Deserializes the remote probe settings; the pack paths are left empty
+bool fromJson(RemoteProbeSettings &settings, const json11::Json &json) {
+  settings = {};
+
+  if (!json.is_object()) {
+    return false;
+  }
+
+  settings.profile_name = json["profile_name"].string_value();
+  settings.language = json["language"].string_value();
+  settings.enable_gnu_extensions = json["enable_gnu_extensions"].bool_value();
+  settings.use_visual_cxx_mangling =
+      json["use_visual_cxx_mangling"].bool_value();
+  settings.target_triple = json["target_triple"].string_value();
+  settings.skip_function_bodies = json["skip_function_bodies"].bool_value();
+  settings.stop_at_first_error = json["stop_at_first_error"].bool_value();
+  settings.ignore_warnings = json["ignore_warnings"].bool_value();
+  settings.time_budget =
+      static_cast<std::size_t>(json["time_budget"].number_value());
+  settings.additional_include_folders =
+      toStringList(json["additional_include_folders"]);
+  settings.base_includes = toStringList(json["base_includes"]);
+  settings.probe_tiers = json["probe_tiers"].string_value();
+  settings.use_precompiled_prefix =
+      json["use_precompiled_prefix"].bool_value();
+  settings.track_included_headers =
+      json["track_included_headers"].bool_value();
+  settings.classify_failures = json["classify_failures"].bool_value();
+
+  for (const auto &item : json["header_packs"].array_items()) {
+    RemoteHeaderPack header_pack;
+    if (!contentHashFromString(header_pack.hash,
+                               item["hash"].string_value())) {
+      return false;
+    }
+
+    header_pack.mount_point = item["mount_point"].string_value();
+    settings.header_pack_list.push_back(std::move(header_pack));
+  }
+
+  return true;
+}
+
+/// Serializes a probe result
+json11::Json toJson(const ProbeResult &result) {
+  return json11::Json::object{
+      {"succeeded", result.succeeded},
+      {"include_directive", result.include_directive},
+      {"included_headers", toJson(result.included_header_list)},
+      {"failure_kind", static_cast<int>(result.failure_cause.kind)},
+      {"failure_name", result.failure_cause.name},
+      {"read_files", toJson(result.read_file_list)}};
+}
+
+/// Deserializes a probe result
+bool fromJson(ProbeResult &result, const json11::Json &json) {
+  result = {};
+
+  if (!json.is_object()) {
+    return false;
+  }
+
+  auto failure_kind = json["failure_kind"].int_value();
+  if (failure_kind < static_cast<int>(CompilationErrorKind::None) ||
+      failure_kind > static_cast<int>(CompilationErrorKind::Timeout)) {
+    return false;
+  }
+
+  result.succeeded = json["succeeded"].bool_value();
+  result.include_directive = json["include_directive"].string_value();
+  result.included_header_list = toStringList(json["included_headers"]);
+  result.failure_cause.kind = static_cast<CompilationErrorKind>(failure_kind);
+  result.failure_cause.name = json["failure_name"].string_value();
+  result.read_file_list = toStringList(json["read_files"]);
+
+  return true;
+}
+
+/// Returns the path of the given pack inside the pack folder
+std::string getHeaderPackPath(const std::string &pack_directory,
+                              ContentHash hash) {
+  return (stdfs::path(pack_directory) / (contentHashToString(hash) + ".pack"))
+      .string();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+/// Newline terminated JSON messages, optionally followed by a raw payload,
+/// exchanged over a stream socket
+class MessageChannel final {
+  /// The connected socket; it is not owned by this object
+  int socket_descriptor{-1};
+
+  /// The bytes that have been received but not consumed yet
+  std::string read_buffer;
+
+  /// Receives more data
+  bool receive() {
+    char buffer[65536];
+
+    auto size = read(socket_descriptor, buffer, sizeof(buffer));
+    if (size <= 0) {
+      return false;
+    }
+
+    read_buffer.append(buffer, static_cast<std::size_t>(size));
+    return true;
+  }
+
+ public:
+  /// Constructor
+  MessageChannel(int socket_descriptor)
+      : socket_descriptor(socket_descriptor) {}
+
+  /// Reads the next message
+  bool readMessage(json11::Json &message) {
+    std::size_t terminator_position;
+
+    while ((terminator_position = read_buffer.find('\n')) ==
+           std::string::npos) {
+      if (read_buffer.size() >= kMaxMessageSize || !receive()) {
+        return false;
+      }
+    }
+
+    std::string error;
+    message = json11::Json::parse(read_buffer.substr(0U, terminator_position),
+                                  error);
+
+    read_buffer.erase(0U, terminator_position + 1U);
+    return error.empty() && message.is_object();
+  }
+
+  /// Copies the given amount of bytes to the output stream
+  bool readPayload(std::ostream &output, std::size_t size) {
+    while (size > 0U) {
+      if (read_buffer.empty() && !receive()) {
+        return false;
+      }
+
+      auto chunk_size = std::min(size, read_buffer.size());
+      output.write(read_buffer.data(),
+                   static_cast<std::streamsize>(chunk_size));
+      read_buffer.erase(0U, chunk_size);
+
+      size -= chunk_size;
+    }
+
+    return static_cast<bool>(output);
+  }
+
+  /// Sends the given buffer
+  bool write(const char *buffer, std::size_t size) {
+    return writeSocket(socket_descriptor, buffer, size);
+  }
+
+  /// Sends a message
+  bool writeMessage(const json11::Json &message) {
+    auto buffer = message.dump() + "\n";
+    return write(buffer.data(), buffer.size());
+  }
+
+  /// Sends the contents of the given file
+  bool writePayload(const std::string &path) {
+    std::ifstream input(path, std::ios::in | std::ios::binary);
+
+    char buffer[65536];
+    while (input) {
+      input.read(buffer, sizeof(buffer));
+
+      auto size = static_cast<std::size_t>(input.gcount());
+      if (size != 0U && !write(buffer, size)) {
+        return false;
+      }
+    }
+
+    return input.eof();
+  }
+};
+
+/// Connects to the given address (host:port); returns -1 on failure
+int connectToWorker(const std::string &address) {
+  auto separator_position = address.rfind(':');
+  if (separator_position == std::string::npos || separator_position == 0U) {
+    return -1;
+  }
+
+  auto host = address.substr(0U, separator_position);
+  auto port = address.substr(separator_position + 1U);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+
+  addrinfo *address_list = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address_list) != 0) {
+    return -1;
+  }
+
+  int socket_descriptor = -1;
+  for (auto it = address_list; it != nullptr; it = it->ai_next) {
+    socket_descriptor = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (socket_descriptor < 0) {
+      continue;
+    }
+
+    if (connect(socket_descriptor, it->ai_addr, it->ai_addrlen) == 0) {
+      break;
+    }
+
+    close(socket_descriptor);
+    socket_descriptor = -1;
+  }
+
+  freeaddrinfo(address_list);
+  return socket_descriptor;
+}
+
+/// Returns the path of the running executable; empty on failure
+std::string getExecutablePath() {
+#if defined(__APPLE__)
+  char buffer[4096];
+  std::uint32_t buffer_size = sizeof(buffer);
+  if (_NSGetExecutablePath(buffer, &buffer_size) != 0) {
+    return std::string();
+  }
+
+  return buffer;
+
+#else
+  std::error_code error;
+  auto path = stdfs::read_symlink("/proc/self/exe", error);
+
+  return error ? std::string() : path.string();
+#endif
+}
+
+/// Starts an 'abigen worker' child process serving the probes on one end of
+/// a new socket pair, and returns the other end; returns -1 on failure
+int spawnIsolatedWorker(pid_t &process_id) {
+  process_id = -1;
+
+  auto executable_path = getExecutablePath();
+  if (executable_path.empty()) {
+    return -1;
+  }
+
+  // Neither end may leak into the workers spawned by the other threads, or
+  // the connection of a crashed worker would be kept open by them
+  int socket_type = SOCK_STREAM;
+#if defined(SOCK_CLOEXEC)
+  socket_type |= SOCK_CLOEXEC;
+#endif
+
+  int socket_pair[2];
+  if (socketpair(AF_UNIX, socket_type, 0, socket_pair) != 0) {
+    return -1;
+  }
+
+  for (auto socket_descriptor : socket_pair) {
+    fcntl(socket_descriptor, F_SETFD, FD_CLOEXEC);
+  }
+
+  // Only async-signal-safe calls can be made between fork() and exec() in a
+  // multithreaded process, so the arguments are built beforehand
+  StringList argument_list = {executable_path, "worker", "--connection-fd",
+                              std::to_string(socket_pair[1]), "-j", "1"};
+
+  std::vector<char *> argv;
+  for (auto &argument : argument_list) {
+    argv.push_back(&argument[0]);
+  }
+
+  argv.push_back(nullptr);
+
+  auto child_pid = fork();
+  if (child_pid == 0) {
+    fcntl(socket_pair[1], F_SETFD, 0);
+    execv(argv[0], argv.data());
+
+    _exit(127);
+  }
+
+  close(socket_pair[1]);
+
+  if (child_pid < 0) {
+    close(socket_pair[0]);
+    return -1;
+  }
+
+  process_id = child_pid;
+  return socket_pair[0];
+}
+
+/// Kills the given isolated worker process, if any, and waits for it
+void terminateIsolatedWorker(pid_t &process_id) {
+  if (process_id <= 0) {
+    return;
+  }
+
+  kill(process_id, SIGKILL);
+  waitpid(process_id, nullptr, 0);
+
+  process_id = -1;
+}
+#endif
+}  // namespace
+
+/// Private class data
+struct RemoteHeaderPackSet::PrivateData final {
+  /// The temporary folder containing the packs
+  stdfs::path work_directory;
+
+  /// The packs
+  RemoteHeaderPackList pack_list;
+};
+
+RemoteHeaderPackSet::RemoteHeaderPackSet(const StringList &folder_list)
+    : d(new PrivateData) {
+  std::random_device random_device;
+
+  std::error_code error;
+  d->work_directory = stdfs::temp_directory_path(error) /
+                      ("abigen-packs-" + std::to_string(random_device()));
+
+  if (error || !stdfs::create_directories(d->work_directory, error)) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the folder for the header packs");
+  }
+
+  // Folders are served at the same absolute path the coordinator passes to
+  // clang
+  std::unordered_set<std::string> mount_point_set;
+
+  for (const auto &folder : folder_list) {
+    RemoteHeaderPack header_pack;
+
+    try {
+      header_pack.mount_point = stdfs::absolute(folder).string();
+    } catch (...) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to acquire the absolute path of " + folder);
+    }
+
+    while (header_pack.mount_point.size() > 1U &&
+           header_pack.mount_point.back() == '/') {
+      header_pack.mount_point.pop_back();
+    }
+
+    if (!mount_point_set.insert(header_pack.mount_point).second) {
+      continue;
+    }
+
+    // Header archives are loaded by the workers like the packs, so they are
+    // shipped as they are
+    ProfilePackRef header_archive;
+    auto status = getHeaderArchive(header_archive, header_pack.mount_point);
+    if (!status.succeeded()) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to load " + folder + ": " + status.toString());
+    }
+
+    if (header_archive &&
+        header_archive->mountPoint() == header_pack.mount_point) {
+      header_pack.path = header_pack.mount_point;
+
+    } else {
+      header_pack.path =
+          (d->work_directory /
+           ("folder_" + std::to_string(d->pack_list.size()) + ".pack"))
+              .string();
+
+      status = ProfilePack::write(header_pack.mount_point, header_pack.path);
+      if (!status.succeeded()) {
+        throw Status(false, StatusCode::IOError,
+                     "Failed to pack " + folder + ": " + status.toString());
+      }
+    }
+
+    if (!hashFileContents(header_pack.hash, header_pack.path)) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to read the pack of " + folder);
+    }
+
+    d->pack_list.push_back(std::move(header_pack));
+  }
+}
+
+RemoteHeaderPackSet::Status RemoteHeaderPackSet::create(
+    RemoteHeaderPackSetRef &obj, const StringList &folder_list) {
+  obj.reset();
+
+  try {
+    auto ptr = new RemoteHeaderPackSet(folder_list);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+RemoteHeaderPackSet::~RemoteHeaderPackSet() {
+  std::error_code error;
+  stdfs::remove_all(d->work_directory, error);
+}
+
+const RemoteHeaderPackList &RemoteHeaderPackSet::packList() const {
+  return d->pack_list;
+}
+
+/// Private class data
+struct RemoteProbeWorker::PrivateData final {
+  /// The worker address
+  std::string address;
+
+  /// The connected socket
+  int socket_descriptor{-1};
+
+#if defined(__unix__) || defined(__APPLE__)
+  /// The messages exchanged with the worker
+  std::unique_ptr<MessageChannel> channel;
+
+  /// The child process of an isolated worker
+  pid_t process_id{-1};
+#endif
+
+  /// Whether the worker is a child process of this one
+  bool isolated{false};
+
+  /// The settings a respawned isolated worker is configured with
+  RemoteProbeSettings isolated_settings;
+
+  /// How many probe tiers each include directive can go through
+  std::size_t probe_tier_count{1U};
+
+  /// How many headers the worker probes concurrently
+  std::size_t worker_count{0U};
+
+  /// The include list known by the worker; probe requests only carry the
+  /// headers accepted since the previous one
+  StringList remote_include_headers;
+};
+
+RemoteProbeWorker::RemoteProbeWorker(const std::string &address,
+                                     const RemoteProbeSettings &settings)
+    : d(new PrivateData) {
+  d->address = address;
+
+#if defined(__unix__) || defined(__APPLE__)
+  d->socket_descriptor = connectToWorker(address);
+  if (d->socket_descriptor < 0) {
+    throw Status(false, StatusCode::ConnectionError,
+                 "Failed to connect to " + address);
+  }
+
+  d->channel.reset(new MessageChannel(d->socket_descriptor));
+
+  configure(settings);
+
+#else
+  static_cast<void>(settings);
+
+  throw Status(false, StatusCode::ConnectionError,
+               "Remote workers are only supported on Unix systems");
+#endif
+}
+
+RemoteProbeWorker::RemoteProbeWorker(const RemoteProbeSettings &settings)
+    : d(new PrivateData) {
+  d->isolated = true;
+  d->isolated_settings = settings;
+  d->isolated_settings.header_pack_list.clear();
+
+  const auto &probe_tiers = settings.probe_tiers;
+  d->probe_tier_count = 1U + static_cast<std::size_t>(std::count(
+                                 probe_tiers.begin(), probe_tiers.end(), ','));
+
+#if defined(__unix__) || defined(__APPLE__)
+  d->socket_descriptor = spawnIsolatedWorker(d->process_id);
+  if (d->socket_descriptor < 0) {
+    throw Status(false, StatusCode::ConnectionError,
+                 "Failed to start an isolated probe worker");
+  }
+
+  d->address = "pid " + std::to_string(d->process_id);
+  d->channel.reset(new MessageChannel(d->socket_descriptor));
+
+  try {
+    configure(d->isolated_settings);
+
+  } catch (...) {
+    terminateIsolatedWorker(d->process_id);
+    throw;
+  }
+
+#else
+  throw Status(false, StatusCode::ConnectionError,
+               "Isolated workers are only supported on Unix systems");
+#endif
+}
+
+void RemoteProbeWorker::configure(const RemoteProbeSettings &settings) {
+#if defined(__unix__) || defined(__APPLE__)
+  auto &channel = *d->channel;
+  json11::Json response;
+
+  auto L_checkResponse = [&](const std::string &request_name) {
+    if (!channel.readMessage(response)) {
+      close(d->socket_descriptor);
+      throw Status(false, StatusCode::ProtocolError,
+                   "Invalid " + request_name + " response from " +
+                       d->address);
+    }
+
+    if (!response["succeeded"].bool_value()) {
+      close(d->socket_descriptor);
+      throw Status(false, StatusCode::WorkerError,
+                   "The worker " + d->address + " rejected the " +
+                       request_name + " request: " +
+                       response["error"].string_value());
+    }
+  };
+
+  json11::Json::array pack_hash_array;
+  for (const auto &header_pack : settings.header_pack_list) {
+    pack_hash_array.push_back(contentHashToString(header_pack.hash));
+  }
+
+  channel.writeMessage(
+      json11::Json::object{{"type", "hello"},
+                           {"protocol", kRemoteProtocolVersion},
+                           {"version", getVersionIdentity()},
+                           {"packs", pack_hash_array}});
+
+  L_checkResponse("hello");
+
+  // Only the packs the worker has never received are shipped
+  std::unordered_set<std::string> missing_pack_set;
+  for (const auto &hash : response["missing_packs"].array_items()) {
+    missing_pack_set.insert(hash.string_value());
+  }
+
+  for (const auto &header_pack : settings.header_pack_list) {
+    auto hash = contentHashToString(header_pack.hash);
+    if (missing_pack_set.erase(hash) == 0U) {
+      continue;
+    }
+
+    std::error_code error;
+    auto pack_size = stdfs::file_size(header_pack.path, error);
+    if (error) {
+      close(d->socket_descriptor);
+      throw Status(false, StatusCode::ConnectionError,
+                   "Failed to read the header pack " + header_pack.path);
+    }
+
+    channel.writeMessage(
+        json11::Json::object{{"type", "pack"},
+                             {"hash", hash},
+                             {"size", static_cast<double>(pack_size)}});
+
+    channel.writePayload(header_pack.path);
+    L_checkResponse("pack");
+  }
+
+  channel.writeMessage(json11::Json::object{{"type", "configure"},
+                                            {"settings", toJson(settings)}});
+
+  L_checkResponse("configure");
+
+  d->worker_count =
+      static_cast<std::size_t>(response["worker_count"].int_value());
+
+  if (d->worker_count == 0U) {
+    close(d->socket_descriptor);
+    throw Status(false, StatusCode::ProtocolError,
+                 "The worker " + d->address + " has no probe workers");
+  }
+
+#else
+  static_cast<void>(settings);
+#endif
+}
+
+RemoteProbeWorker::Status RemoteProbeWorker::create(
+    RemoteProbeWorkerRef &obj, const std::string &address,
+    const RemoteProbeSettings &settings) {
+  obj.reset();
+
+  try {
+    auto ptr = new RemoteProbeWorker(address, settings);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+RemoteProbeWorker::Status RemoteProbeWorker::createIsolated(
+    RemoteProbeWorkerRef &obj, const RemoteProbeSettings &settings) {
+  obj.reset();
+
+  try {
+    auto ptr = new RemoteProbeWorker(settings);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+RemoteProbeWorker::~RemoteProbeWorker() {
+#if defined(__unix__) || defined(__APPLE__)
+  if (d->socket_descriptor >= 0) {
+    close(d->socket_descriptor);
+  }
+
+  terminateIsolatedWorker(d->process_id);
+#endif
+}
+
+const std::string &RemoteProbeWorker::address() const { return d->address; }
+
+std::size_t RemoteProbeWorker::workerCount() const { return d->worker_count; }
+
+bool RemoteProbeWorker::connected() const { return d->socket_descriptor >= 0; }
+
+bool RemoteProbeWorker::isolated() const { return d->isolated; }
+
+bool RemoteProbeWorker::respawn() {
+  if (!d->isolated) {
+    return false;
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  if (d->socket_descriptor >= 0) {
+    close(d->socket_descriptor);
+  }
+
+  terminateIsolatedWorker(d->process_id);
+  d->remote_include_headers.clear();
+
+  d->socket_descriptor = spawnIsolatedWorker(d->process_id);
+  if (d->socket_descriptor < 0) {
+    return false;
+  }
+
+  d->address = "pid " + std::to_string(d->process_id);
+  d->channel.reset(new MessageChannel(d->socket_descriptor));
+
+  // The connection has already been closed when the configuration fails
+  try {
+    configure(d->isolated_settings);
+
+  } catch (const Status &) {
+    d->socket_descriptor = -1;
+    terminateIsolatedWorker(d->process_id);
+
+    return false;
+  }
+
+  return true;
+
+#else
+  return false;
+#endif
+}
+
+bool RemoteProbeWorker::probe(
+    ProbeResultList &result_list, const StringList &active_include_headers,
+    const StringList &header_path_list,
+    const std::vector<StringList> &include_directive_lists) {
+  result_list.clear();
+
+#if defined(__unix__) || defined(__APPLE__)
+  if (d->socket_descriptor < 0) {
+    return false;
+  }
+
+  // The include list only grows while probing, so usually the worker just
+  // needs the headers accepted since the last request
+  auto &remote_include_headers = d->remote_include_headers;
+
+  std::size_t prefix_size = 0U;
+  if (remote_include_headers.size() <= active_include_headers.size() &&
+      std::equal(remote_include_headers.begin(), remote_include_headers.end(),
+                 active_include_headers.begin())) {
+    prefix_size = remote_include_headers.size();
+  }
+
+  json11::Json::array appended_header_array;
+  for (auto i = prefix_size; i < active_include_headers.size(); ++i) {
+    appended_header_array.push_back(active_include_headers[i]);
+  }
+
+  json11::Json::array header_array;
+  for (std::size_t i = 0U; i < header_path_list.size(); ++i) {
+    header_array.push_back(json11::Json::object{
+        {"path", header_path_list[i]},
+        {"directives", toJson(include_directive_lists[i])}});
+  }
+
+  auto L_disconnect = [&]() -> bool {
+    close(d->socket_descriptor);
+    d->socket_descriptor = -1;
+
+    terminateIsolatedWorker(d->process_id);
+
+    result_list.clear();
+    return false;
+  };
+
+  // A clang hang that the time budget can not interrupt is handled like a
+  // crash of the isolated worker
+  if (d->isolated && d->isolated_settings.time_budget != 0U) {
+    std::size_t compilation_count = 0U;
+    for (const auto &include_directive_list : include_directive_lists) {
+      compilation_count += include_directive_list.size();
+    }
+
+    timeval timeout = {};
+    timeout.tv_sec = static_cast<decltype(timeout.tv_sec)>(
+        d->isolated_settings.time_budget * compilation_count *
+            d->probe_tier_count +
+        kIsolatedWorkerGracePeriod);
+
+    setsockopt(d->socket_descriptor, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+  }
+
+  auto &channel = *d->channel;
+  if (!channel.writeMessage(json11::Json::object{
+          {"type", "probe"},
+          {"prefix_size", static_cast<double>(prefix_size)},
+          {"appended_headers", appended_header_array},
+          {"headers", header_array}})) {
+    return L_disconnect();
+  }
+
+  json11::Json response;
+  if (!channel.readMessage(response) || !response["succeeded"].bool_value()) {
+    return L_disconnect();
+  }
+
+  remote_include_headers = active_include_headers;
+
+  const auto &result_array = response["results"].array_items();
+  if (result_array.size() != header_path_list.size()) {
+    return L_disconnect();
+  }
+
+  for (const auto &item : result_array) {
+    ProbeResult result;
+    if (!fromJson(result, item)) {
+      return L_disconnect();
+    }
+
+    result_list.push_back(std::move(result));
+  }
+
+  return true;
+
+#else
+  static_cast<void>(active_include_headers);
+  static_cast<void>(header_path_list);
+  static_cast<void>(include_directive_lists);
+
+  return false;
+#endif
+}
+
+void serveRemoteProbes(int connection_socket,
+                       ProfileManagerRef &profile_manager,
+                       const LanguageManager &language_manager,
+                       const std::string &pack_directory,
+                       std::size_t worker_count) {
+#if defined(__unix__) || defined(__APPLE__)
+  MessageChannel channel(connection_socket);
+
+  ProbeExecutorRef probe_executor;
+  StringList active_include_headers;
+
+  // Each handler returns an empty string on success
+  auto L_hello = [&](const json11::Json &request,
+                     json11::Json::object &response) -> std::string {
+    if (request["protocol"].int_value() != kRemoteProtocolVersion ||
+        request["version"].string_value() != getVersionIdentity()) {
+      return "The coordinator runs a different abigen version (" +
+             request["version"].string_value() + ", this worker runs " +
+             getVersionIdentity() + ")";
+    }
+
+    json11::Json::array missing_pack_array;
+    for (const auto &item : request["packs"].array_items()) {
+      ContentHash hash;
+      if (!contentHashFromString(hash, item.string_value())) {
+        return "Invalid pack hash";
+      }
+
+      std::error_code error;
+      if (!stdfs::exists(getHeaderPackPath(pack_directory, hash), error)) {
+        missing_pack_array.push_back(item.string_value());
+      }
+    }
+
+    response["missing_packs"] = missing_pack_array;
+    return std::string();
+  };
+
+  // Returns false if the payload could not be consumed; the connection is
+  // then out of sync
+  bool payload_consumed = true;
+
+  auto L_pack = [&](const json11::Json &request,
+                    json11::Json::object &) -> std::string {
+    auto size = static_cast<std::size_t>(request["size"].number_value());
+
+    ContentHash expected_hash;
+    auto valid_hash =
+        contentHashFromString(expected_hash, request["hash"].string_value());
+
+    std::random_device random_device;
+    auto pack_path = getHeaderPackPath(pack_directory, expected_hash);
+    auto temp_path = pack_path + ".tmp" + std::to_string(random_device());
+
+    {
+      std::ofstream output(temp_path,
+                           std::ios::out | std::ios::trunc | std::ios::binary);
+
+      payload_consumed = channel.readPayload(output, size);
+    }
+
+    std::error_code error;
+    if (!payload_consumed) {
+      stdfs::remove(temp_path, error);
+      return "Failed to receive the header pack";
+    }
+
+    ContentHash hash;
+    if (!valid_hash || !hashFileContents(hash, temp_path) ||
+        hash != expected_hash) {
+      stdfs::remove(temp_path, error);
+      return "The header pack is corrupted";
+    }
+
+    stdfs::rename(temp_path, pack_path, error);
+    if (error) {
+      stdfs::remove(temp_path, error);
+      return "Failed to save the header pack";
+    }
+
+    return std::string();
+  };
+
+  auto L_configure = [&](const json11::Json &request,
+                         json11::Json::object &response) -> std::string {
+    RemoteProbeSettings settings;
+    if (!fromJson(settings, request["settings"])) {
+      return "Invalid settings";
+    }
+
+    CommandLineOptions cmdline_options;
+    cmdline_options.profile_name = settings.profile_name;
+    cmdline_options.language = settings.language;
+    cmdline_options.enable_gnu_extensions = settings.enable_gnu_extensions;
+    cmdline_options.use_visual_cxx_mangling = settings.use_visual_cxx_mangling;
+    cmdline_options.target_triples = settings.target_triple;
+    cmdline_options.skip_function_bodies = settings.skip_function_bodies;
+    cmdline_options.reuse_clang_state = true;
+
+    ProbeExecutorSettings probe_executor_settings;
+    auto &compiler_settings = probe_executor_settings.compiler_settings;
+
+    if (!createCompilerInstanceSettings(compiler_settings, profile_manager,
+                                        language_manager, cmdline_options)) {
+      return "Failed to load the profile " + settings.profile_name +
+             " with the language " + settings.language;
+    }
+
+    compiler_settings.additional_include_folders =
+        settings.additional_include_folders;
+    compiler_settings.stop_at_first_error = settings.stop_at_first_error;
+    compiler_settings.ignore_warnings = settings.ignore_warnings;
+    compiler_settings.time_budget = settings.time_budget;
+
+    for (const auto &header_pack : settings.header_pack_list) {
+      ProfilePackRef pack;
+      auto status = ProfilePack::create(
+          pack, getHeaderPackPath(pack_directory, header_pack.hash),
+          header_pack.mount_point);
+
+      if (!status.succeeded()) {
+        return "Failed to load the header pack for " + header_pack.mount_point +
+               ": " + status.toString();
+      }
+
+      compiler_settings.header_pack_list.push_back(std::move(pack));
+    }
+
+    if (!parseProbeTierList(probe_executor_settings.probe_tier_list,
+                            settings.probe_tiers)) {
+      return "Invalid probe tier list: " + settings.probe_tiers;
+    }
+
+    probe_executor_settings.base_includes = settings.base_includes;
+    probe_executor_settings.worker_count = worker_count;
+    probe_executor_settings.use_precompiled_prefix =
+        settings.use_precompiled_prefix;
+    probe_executor_settings.track_included_headers =
+        settings.track_included_headers;
+    probe_executor_settings.classify_failures = settings.classify_failures;
+
+    auto status =
+        ProbeExecutor::create(probe_executor, probe_executor_settings);
+    if (!status.succeeded()) {
+      return status.toString();
+    }
+
+    active_include_headers.clear();
+
+    std::cerr << "Configured the probes for " << settings.profile_name << " ("
+              << settings.language << "), "
+              << settings.additional_include_folders.size()
+              << " include folders\n";
+
+    response["worker_count"] = static_cast<int>(worker_count);
+    return std::string();
+  };
+
+  auto L_probe = [&](const json11::Json &request,
+                     json11::Json::object &response) -> std::string {
+    if (!probe_executor) {
+      return "The probes have not been configured";
+    }
+
+    auto prefix_size =
+        static_cast<std::size_t>(request["prefix_size"].number_value());
+
+    if (prefix_size > active_include_headers.size()) {
+      return "Unknown include list";
+    }
+
+    active_include_headers.resize(prefix_size);
+    for (const auto &item : request["appended_headers"].array_items()) {
+      active_include_headers.push_back(item.string_value());
+    }
+
+    const auto &header_array = request["headers"].array_items();
+
+    std::vector<HeaderDescriptor> header_list(header_array.size());
+    std::vector<StringList> include_directive_lists;
+    ProbeRequestList request_list;
+
+    for (std::size_t i = 0U; i < header_array.size(); ++i) {
+      header_list[i].path = header_array[i]["path"].string_value();
+      header_list[i].name =
+          stdfs::path(header_list[i].path).filename().string();
+
+      include_directive_lists.push_back(
+          toStringList(header_array[i]["directives"]));
+
+      request_list.push_back(&header_list[i]);
+    }
+
+    auto result_list = probe_executor->probe(
+        active_include_headers, request_list, include_directive_lists);
+
+    json11::Json::array result_array;
+    for (const auto &result : result_list) {
+      result_array.push_back(toJson(result));
+    }
+
+    response["results"] = result_array;
+    return std::string();
+  };
+
+  json11::Json request;
+  while (channel.readMessage(request)) {
+    json11::Json::object response;
+
+    std::string error;
+    auto request_type = request["type"].string_value();
+
+    if (request_type == "hello") {
+      error = L_hello(request, response);
+    } else if (request_type == "pack") {
+      error = L_pack(request, response);
+    } else if (request_type == "configure") {
+      error = L_configure(request, response);
+    } else if (request_type == "probe") {
+      error = L_probe(request, response);
+    } else {
+      error = "Invalid request: " + request_type;
+    }
+
+    response["succeeded"] = error.empty();
+    if (!error.empty()) {
+      response["error"] = error;
+    }
+
+    if (!channel.writeMessage(response) || !payload_consumed) {
+      break;
+    }
+  }
+
+#else
+  static_cast<void>(connection_socket);
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+  static_cast<void>(pack_directory);
+  static_cast<void>(worker_count);
+#endif
+}
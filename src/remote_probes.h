@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "cmdline.h"
+#include "content_hash.h"
+#include "istatus.h"
+#include "probe_executor.h"
+#include "types.h"
+
+#include <memory>
+
+/// A folder shipped to the remote workers as a ProfilePack archive
+struct RemoteHeaderPack final {
+  /// The pack file
+  std::string path;
+
+  /// The content hash of the pack file; workers store the packs they
+  /// receive under this name, so each one is only shipped once
+  ContentHash hash{0U};
+
+  /// The absolute path of the packed folder; remote workers serve the files
+  /// from memory at this same path
+  std::string mount_point;
+};
+
+/// A list of header packs
+using RemoteHeaderPackList = std::vector<RemoteHeaderPack>;
+
+class RemoteHeaderPackSet;
+
+/// A reference to a RemoteHeaderPackSet object
+using RemoteHeaderPackSetRef = std::shared_ptr<RemoteHeaderPackSet>;
+
+/// The RemoteHeaderPackSet packs the folders searched by the probes into a
+/// temporary folder, which is removed when the object is destroyed
+class RemoteHeaderPackSet final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  RemoteHeaderPackSet(const StringList &folder_list);
+
+ public:
+  /// Status code, used with RemoteHeaderPackSet::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Packs each of the given folders
+  static Status create(RemoteHeaderPackSetRef &obj,
+                       const StringList &folder_list);
+
+  /// Destructor
+  ~RemoteHeaderPackSet();
+
+  /// Returns the packs, in the same order as the folders
+  const RemoteHeaderPackList &packList() const;
+
+  /// Disable the copy constructor
+  RemoteHeaderPackSet(const RemoteHeaderPackSet &other) = delete;
+
+  /// Disable the assignment operator
+  RemoteHeaderPackSet &operator=(const RemoteHeaderPackSet &other) = delete;
+};
+
+/// The settings a remote worker uses to build its probe executor. Profiles
+/// are looked up by name on the worker, which must run the same abigen and
+/// LLVM versions as the coordinator
+struct RemoteProbeSettings final {
+  /// The profile name
+  std::string profile_name;
+
+  /// The language definition (i.e.: "c11")
+  std::string language;
+
+  /// Whether GNU extensions are enabled or not
+  bool enable_gnu_extensions{false};
+
+  /// Whether the Visual C++ name mangling is used
+  bool use_visual_cxx_mangling{false};
+
+  /// The target triple; empty for the default target of the worker
+  std::string target_triple;
+
+  /// Whether the function bodies are skipped
+  bool skip_function_bodies{false};
+
+  /// Whether the probes stop at the first error
+  bool stop_at_first_error{false};
+
+  /// Whether warnings are ignored
+  bool ignore_warnings{false};
+
+  /// The time budget of each compilation, in seconds; zero disables it
+  std::size_t time_budget{0U};
+
+  /// The include folders, as absolute paths
+  StringList additional_include_folders;
+
+  /// The base includes, parsed as text by the remote probes
+  StringList base_includes;
+
+  /// The probe tiers (i.e.: "preprocess,parse")
+  std::string probe_tiers;
+
+  /// Whether the remote worker precompiles the accepted headers
+  bool use_precompiled_prefix{false};
+
+  /// Whether accepted probes report the guarded headers they have read
+  bool track_included_headers{false};
+
+  /// Whether failed probes report the cause of the error
+  bool classify_failures{false};
+
+  /// The folders served by the remote worker in place of its own files
+  RemoteHeaderPackList header_pack_list;
+};
+
+/// The RemoteProbeWorker is the connection to an 'abigen worker' process;
+/// the headers are probed by the remote probe executor, on top of an include
+/// list that is only shipped once and then extended as headers are accepted.
+/// Isolated workers are child processes of this one, reached through a
+/// socket pair; a crash of clang only takes down the child, which can then
+/// be replaced with respawn()
+class RemoteProbeWorker final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  RemoteProbeWorker(const std::string &address,
+                    const RemoteProbeSettings &settings);
+
+  /// Private constructor; use ::createIsolated() instead
+  RemoteProbeWorker(const RemoteProbeSettings &settings);
+
+  /// Uploads the missing header packs and configures the probe executor of
+  /// the connected worker; the connection is closed on failure
+  void configure(const RemoteProbeSettings &settings);
+
+ public:
+  /// Status code, used with RemoteProbeWorker::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    ConnectionError,
+    ProtocolError,
+    WorkerError,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Connects to the worker listening on the given address (host:port),
+  /// uploads the header packs it does not have yet and configures its probe
+  /// executor
+  static Status create(RemoteProbeWorkerRef &obj, const std::string &address,
+                       const RemoteProbeSettings &settings);
+
+  /// Starts an 'abigen worker' child process probing a single header at a
+  /// time, and configures it; the header packs of the settings are ignored,
+  /// since the child shares the file system of this process
+  static Status createIsolated(RemoteProbeWorkerRef &obj,
+                               const RemoteProbeSettings &settings);
+
+  /// Destructor
+  ~RemoteProbeWorker();
+
+  /// Returns the address of the worker
+  const std::string &address() const;
+
+  /// Returns how many headers the remote worker probes concurrently
+  std::size_t workerCount() const;
+
+  /// Returns false once the connection has been lost
+  bool connected() const;
+
+  /// Returns true if the worker is a child process of this one
+  bool isolated() const;
+
+  /// Replaces the child process of an isolated worker with a new one, so
+  /// that the worker can be used again after losing the connection; returns
+  /// false if the process could not be started. This method is not thread
+  /// safe
+  bool respawn();
+
+  /// Probes the given headers (identified by their path) on top of the
+  /// include list, trying the include directives of each one in order. If
+  /// the connection is lost, false is returned and the worker can no longer
+  /// be used, unless it is isolated and gets respawned. Isolated workers kill
+  /// their child process when a request outlives the time budget of all its
+  /// compilations. This method is not thread safe
+  bool probe(ProbeResultList &result_list,
+             const StringList &active_include_headers,
+             const StringList &header_path_list,
+             const std::vector<StringList> &include_directive_lists);
+
+  /// Disable the copy constructor
+  RemoteProbeWorker(const RemoteProbeWorker &other) = delete;
+
+  /// Disable the assignment operator
+  RemoteProbeWorker &operator=(const RemoteProbeWorker &other) = delete;
+};
+
+/// Serves the probes dispatched by a single coordinator on the given
+/// connection, until it is closed. Header packs are kept in the pack folder,
+/// and each connection uses its own probe executor with the given amount of
+/// workers
+void serveRemoteProbes(int connection_socket,
+                       ProfileManagerRef &profile_manager,
+                       const LanguageManager &language_manager,
+                       const std::string &pack_directory,
+                       std::size_t worker_count);
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "abi_database.h"
+#include "abi_lib_generator.h"
+#include "ast_snapshot.h"
+#include "cmdline.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <unordered_set>
+
+namespace {
+/// Reads the given symbol list, one mangled name per line; empty lines and
+/// lines starting with '#' are ignored
+bool readSymbolList(std::unordered_set<std::string> &symbol_set,
+                    const std::string &path) {
+  symbol_set.clear();
+
+  std::ifstream symbol_file(path);
+  if (!symbol_file) {
+    return false;
+  }
+
+  std::string line;
+  while (std::getline(symbol_file, line)) {
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos || line[first] == '#') {
+      continue;
+    }
+
+    auto last = line.find_last_not_of(" \t\r");
+    symbol_set.insert(line.substr(first, last - first + 1U));
+  }
+
+  return !symbol_file.bad();
+}
+}  // namespace
+
+/// Handler for the 'render' command
+bool renderCommandHandler(ProfileManagerRef &profile_manager,
+                          const LanguageManager &language_manager,
+                          const CommandLineOptions &cmdline_options) {
+  if (cmdline_options.database_path.empty() ==
+      cmdline_options.ast_snapshot_path.empty()) {
+    std::cerr << "Either --database or --from-ast is required\n";
+    return false;
+  }
+
+  // The snapshot is analyzed again by the generate command; the profile and
+  // the language default to the ones it has been built with
+  if (!cmdline_options.ast_snapshot_path.empty()) {
+    if (!cmdline_options.symbol_list_path.empty()) {
+      std::cerr << "The --symbols option requires --database\n";
+      return false;
+    }
+
+    ASTSnapshot snapshot;
+    if (!readASTSnapshot(snapshot, cmdline_options.ast_snapshot_path)) {
+      std::cerr << "Failed to read the AST snapshot: "
+                << cmdline_options.ast_snapshot_path << "\n";
+      return false;
+    }
+
+    auto generate_options = cmdline_options;
+    if (generate_options.language.empty()) {
+      generate_options.language = snapshot.language;
+    }
+
+    if (generate_options.profile_name.empty()) {
+      generate_options.profile_name = snapshot.profile_name;
+    }
+
+    return runGenerateCommand(profile_manager, language_manager,
+                              generate_options, nullptr);
+  }
+
+  ABIDatabase database;
+  if (!readABIDatabase(database, cmdline_options.database_path)) {
+    std::cerr << "Failed to read the ABI database: "
+              << cmdline_options.database_path << "\n";
+    return false;
+  }
+
+  auto &abi_library = database.abi_library;
+
+  // The blacklist is filtered as well, so that the report in the header
+  // only covers the selected functions
+  if (!cmdline_options.symbol_list_path.empty()) {
+    std::unordered_set<std::string> symbol_set;
+    if (!readSymbolList(symbol_set, cmdline_options.symbol_list_path)) {
+      std::cerr << "Failed to read the symbol list: "
+                << cmdline_options.symbol_list_path << "\n";
+      return false;
+    }
+
+    auto L_notSelected = [&symbol_set](const auto &function) -> bool {
+      return symbol_set.count(function.mangled_name) == 0U;
+    };
+
+    auto &whitelist = abi_library.whitelisted_function_list;
+    whitelist.erase(
+        std::remove_if(whitelist.begin(), whitelist.end(), L_notSelected),
+        whitelist.end());
+
+    auto &blacklist = abi_library.blacklisted_function_list;
+    blacklist.erase(
+        std::remove_if(blacklist.begin(), blacklist.end(), L_notSelected),
+        blacklist.end());
+
+    std::cerr << "Symbol list: " << whitelist.size() << "/"
+              << symbol_set.size()
+              << " symbols found in the whitelisted functions\n";
+  }
+
+  auto library_options = cmdline_options;
+  library_options.base_includes = database.base_includes;
+
+  if (library_options.language.empty()) {
+    library_options.language = database.language;
+  }
+
+  if (library_options.profile_name.empty()) {
+    library_options.profile_name = database.profile_name;
+  }
+
+  // The profile is only used for the comments of the generated files; the
+  // database can be rendered on a machine that does not have it
+  Profile profile;
+  auto prof_mgr_status =
+      profile_manager->get(profile, library_options.profile_name);
+  if (!prof_mgr_status.succeeded()) {
+    profile = {};
+    profile.name = library_options.profile_name;
+  }
+
+  auto status = generateABILibrary(library_options, abi_library, profile);
+  if (!status.succeeded()) {
+    std::cerr << status.message() << "\n";
+    return false;
+  }
+
+  std::cout << "The ABI library has been saved to " << cmdline_options.output
+            << "\n";
+
+  return true;
+}
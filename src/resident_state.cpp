@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "resident_state.h"
+#include "content_hash.h"
+#include "generate_utils.h"
+#include "std_filesystem.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+/// A precompiled header of base includes
+struct PrecompiledBaseIncludes final {
+  /// Serializes the generation of the header
+  std::mutex mutex;
+
+  /// The precompiled header path; empty if it has not been generated yet
+  std::string path;
+
+  /// True if the last compilation failed
+  bool failed{false};
+
+  /// Incremented each time the header is generated; requests that are still
+  /// using the previous file are not affected
+  std::size_t generation{0U};
+
+  /// The files read while compiling the header, along with their last
+  /// modification time
+  std::vector<std::pair<std::string, stdfs::file_time_type>> dependency_list;
+};
+
+/// Returns true if none of the given files has been modified
+bool dependenciesUnchanged(
+    const std::vector<std::pair<std::string, stdfs::file_time_type>>
+        &dependency_list) {
+  for (const auto &dependency : dependency_list) {
+    std::error_code error;
+    auto last_write_time = stdfs::last_write_time(dependency.first, error);
+    if (error || last_write_time != dependency.second) {
+      return false;
+    }
+  }
+
+  return true;
+}
+}  // namespace
+
+/// Private class data
+struct ResidentState::PrivateData final {
+  /// The folder containing the precompiled headers
+  stdfs::path state_directory;
+
+  /// The temporary folder created when no state folder has been given; it is
+  /// removed by the destructor
+  stdfs::path temporary_directory;
+
+  /// Protects the maps
+  std::mutex mutex;
+
+  /// The file system cache of each profile, keyed by the profile root path
+  std::unordered_map<std::string, FileSystemCacheRef> file_system_cache_map;
+
+  /// The precompiled base includes, keyed by the hash of the compiler
+  /// settings and of the include list
+  std::unordered_map<ContentHash, std::shared_ptr<PrecompiledBaseIncludes>>
+      precompiled_header_map;
+
+  /// How many times a precompiled header has been reused
+  std::atomic_size_t precompiled_header_hit_count{0U};
+};
+
+ResidentState::ResidentState(const std::string &state_directory)
+    : d(new PrivateData) {
+  if (state_directory.empty()) {
+    llvm::SmallString<256> temporary_directory;
+    if (llvm::sys::fs::createUniqueDirectory("abigen-state",
+                                             temporary_directory)) {
+      throw Status(false, StatusCode::IOError,
+                   "Failed to create a temporary state directory");
+    }
+
+    d->temporary_directory = temporary_directory.str().str();
+    d->state_directory = d->temporary_directory / "precompiled_headers";
+
+  } else {
+    d->state_directory = stdfs::path(state_directory) / "precompiled_headers";
+  }
+
+  std::error_code error;
+  stdfs::create_directories(d->state_directory, error);
+  if (error) {
+    throw Status(false, StatusCode::IOError,
+                 "Failed to create the state directory: " +
+                     d->state_directory.string());
+  }
+}
+
+ResidentState::Status ResidentState::create(
+    ResidentStateRef &obj, const std::string &state_directory) {
+  obj.reset();
+
+  try {
+    auto ptr = new ResidentState(state_directory);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+ResidentState::~ResidentState() {
+  if (!d->temporary_directory.empty()) {
+    std::error_code error;
+    stdfs::remove_all(d->temporary_directory, error);
+  }
+}
+
+FileSystemCacheRef ResidentState::fileSystemCache(const Profile &profile) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  auto &file_system_cache = d->file_system_cache_map[profile.root_path];
+  if (!file_system_cache) {
+    file_system_cache = std::make_shared<FileSystemCache>(
+        std::vector<std::string>{profile.root_path});
+  }
+
+  return file_system_cache;
+}
+
+std::string ResidentState::precompiledBaseIncludes(
+    const CompilerInstanceSettings &settings,
+    const StringList &base_includes) {
+  auto key = hashCompilerInstanceSettings(settings);
+  key = updateContentHash(key, base_includes);
+
+  std::shared_ptr<PrecompiledBaseIncludes> precompiled_header;
+
+  {
+    std::lock_guard<std::mutex> lock(d->mutex);
+
+    auto &entry = d->precompiled_header_map[key];
+    if (!entry) {
+      entry = std::make_shared<PrecompiledBaseIncludes>();
+    }
+
+    precompiled_header = entry;
+  }
+
+  // Requests sharing the same configuration wait for the first one to
+  // generate the header
+  std::lock_guard<std::mutex> lock(precompiled_header->mutex);
+
+  if (!precompiled_header->path.empty() &&
+      dependenciesUnchanged(precompiled_header->dependency_list)) {
+    d->precompiled_header_hit_count++;
+    return precompiled_header->path;
+  }
+
+  // Do not try again when the includes have already failed to compile,
+  // unless one of the files has changed since then
+  if (precompiled_header->failed &&
+      dependenciesUnchanged(precompiled_header->dependency_list)) {
+    return std::string();
+  }
+
+  // Commands that are still using the previous file keep it open; unlinking
+  // it does not affect them
+  if (!precompiled_header->path.empty()) {
+    std::error_code error;
+    stdfs::remove(precompiled_header->path, error);
+    stdfs::remove(precompiled_header->path + ".h", error);
+  }
+
+  precompiled_header->path.clear();
+  precompiled_header->failed = true;
+  precompiled_header->dependency_list.clear();
+
+  auto compiler_settings = settings;
+  compiler_settings.precompiled_header.clear();
+  compiler_settings.stop_at_first_error = false;
+
+  CompilerInstanceRef compiler;
+  auto status = CompilerInstance::create(compiler, compiler_settings);
+  if (!status.succeeded()) {
+    return std::string();
+  }
+
+  auto file_name = contentHashToString(key) + "_" +
+                   std::to_string(precompiled_header->generation) + ".pch";
+
+  precompiled_header->generation++;
+
+  auto output_path = (d->state_directory / file_name).string();
+
+  StringList dependency_list;
+  status = compiler->generatePrecompiledHeader(
+      generateSourceBuffer(StringList(), base_includes), output_path,
+      &dependency_list);
+
+  // The source buffer is saved next to the precompiled header, and it is
+  // not a dependency
+  auto source_file_path = output_path + ".h";
+
+  for (const auto &dependency : dependency_list) {
+    if (dependency == source_file_path) {
+      continue;
+    }
+
+    std::error_code error;
+    auto last_write_time = stdfs::last_write_time(dependency, error);
+    if (!error) {
+      precompiled_header->dependency_list.push_back(
+          {dependency, last_write_time});
+    }
+  }
+
+  if (!status.succeeded()) {
+    return std::string();
+  }
+
+  precompiled_header->failed = false;
+  precompiled_header->path = output_path;
+
+  return output_path;
+}
+
+std::size_t ResidentState::precompiledHeaderHitCount() const {
+  return d->precompiled_header_hit_count;
+}
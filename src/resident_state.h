@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "compilerinstance.h"
+#include "file_system_cache.h"
+#include "istatus.h"
+#include "types.h"
+
+#include <memory>
+
+class ResidentState;
+
+/// A reference to a ResidentState object
+using ResidentStateRef = std::shared_ptr<ResidentState>;
+
+/// The ResidentState keeps the objects that are expensive to build alive
+/// across the commands executed by a long running process (i.e.: the serve
+/// command). The file system caches only remember the paths inside the
+/// profile folders, which are not expected to change, so that the user
+/// headers are always read again. The precompiled base includes are
+/// generated once for each configuration, and generated again when one of
+/// the files they have read has been modified. All methods are thread safe
+class ResidentState final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  ResidentState(const std::string &state_directory);
+
+ public:
+  /// Status code, used with ResidentState::Status
+  enum class StatusCode { MemoryAllocationFailure, IOError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new ResidentState object; the precompiled headers are saved
+  /// inside the given folder. If the folder is empty, a temporary folder is
+  /// used and then removed when the object is destroyed
+  static Status create(ResidentStateRef &obj,
+                       const std::string &state_directory);
+
+  /// Destructor
+  ~ResidentState();
+
+  /// Returns the file system cache used with the given profile; the cache
+  /// only remembers the paths inside the profile root folder
+  FileSystemCacheRef fileSystemCache(const Profile &profile);
+
+  /// Returns the path of a precompiled header containing the given base
+  /// includes, compiled with the specified settings. The header is generated
+  /// on first use; an empty string is returned if it can't be compiled
+  std::string precompiledBaseIncludes(const CompilerInstanceSettings &settings,
+                                      const StringList &base_includes);
+
+  /// Returns how many times a precompiled header has been reused
+  std::size_t precompiledHeaderHitCount() const;
+
+  /// Disable the copy constructor
+  ResidentState(const ResidentState &other) = delete;
+
+  /// Disable the assignment operator
+  ResidentState &operator=(const ResidentState &other) = delete;
+};
@@ -0,0 +1,518 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sample_profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <cerrno>
+#include <cstdlib>
+#endif
+
+namespace {
+/// The deepest stack recorded by each sample; the frames closer to the root
+/// are dropped
+const std::size_t kMaxFrameCount = 48U;
+
+/// How many samples are allocated at once
+const std::size_t kSampleChunkSize = 4096U;
+
+/// The sample buffer stops growing after this many chunks
+const std::size_t kMaxSampleChunkCount = 4096U;
+
+/// The chunks allocated ahead of the signal handler
+const std::size_t kSpareSampleChunkCount = 2U;
+
+/// A stack sampled by the signal handler
+struct Sample final {
+  /// The return addresses, starting from the signal handler
+  std::array<void *, kMaxFrameCount> frame_list;
+
+  /// How many frames have been recorded
+  int frame_count{0};
+
+  /// The phase tag, if any
+  const char *phase{nullptr};
+
+  /// The header tag, if any
+  const char *header{nullptr};
+
+  /// Set by the signal handler once the sample is complete
+  std::atomic_bool ready{false};
+};
+
+/// The samples are stored in chunks, which are allocated by a helper thread
+/// since the signal handler can't allocate memory; the state is global, as
+/// signal handlers can't receive a context
+struct SampleBuffer final {
+  /// The sample chunks; null for the chunks that have not been allocated
+  std::array<std::atomic<Sample *>, kMaxSampleChunkCount> chunk_list;
+
+  /// The index of the next sample
+  std::atomic_size_t next_sample_index{0U};
+
+  /// The samples that did not fit in the allocated chunks
+  std::atomic_size_t dropped_sample_count{0U};
+
+  /// How many signal handlers are running
+  std::atomic_int active_handler_count{0};
+};
+
+/// The sample buffer
+SampleBuffer sample_buffer;
+
+/// True while a SampleProfiler object exists
+std::atomic_bool profiler_created{false};
+
+/// True while the signal handler records samples
+std::atomic_bool profiler_active{false};
+
+/// The phase of the calling thread, if any
+thread_local std::atomic<const char *> thread_phase{nullptr};
+
+/// The header probed by the calling thread, if any
+thread_local std::atomic<const char *> thread_header{nullptr};
+
+/// The phase most recently entered by any thread
+std::atomic<const char *> process_phase{nullptr};
+
+/// Returns a copy of the given tag that is never released, so that the
+/// signal handler can reference it without copying it
+const char *internSampleTag(const std::string &value) {
+  static std::mutex tag_set_mutex;
+  static std::unordered_set<std::string> tag_set;
+
+  std::lock_guard<std::mutex> lock(tag_set_mutex);
+  return tag_set.insert(value).first->c_str();
+}
+
+#if defined(__linux__) || defined(__APPLE__)
+/// The frames taken by the signal handler and by the signal trampoline
+const int kSkippedFrameCount = 2;
+
+/// Records the stack of the interrupted thread; only async-signal-safe
+/// functions are used here. The unwinder used by backtrace() has already
+/// been loaded by the SampleProfiler constructor
+void sampleSignalHandler(int signal_number) {
+  static_cast<void>(signal_number);
+
+  auto saved_errno = errno;
+  sample_buffer.active_handler_count.fetch_add(1);
+
+  if (profiler_active.load(std::memory_order_acquire)) {
+    auto sample_index = sample_buffer.next_sample_index.fetch_add(
+        1U, std::memory_order_relaxed);
+
+    auto chunk_index = sample_index / kSampleChunkSize;
+
+    Sample *chunk = nullptr;
+    if (chunk_index < kMaxSampleChunkCount) {
+      chunk = sample_buffer.chunk_list[chunk_index].load(
+          std::memory_order_acquire);
+    }
+
+    if (chunk == nullptr) {
+      sample_buffer.dropped_sample_count.fetch_add(1U,
+                                                   std::memory_order_relaxed);
+
+    } else {
+      auto &sample = chunk[sample_index % kSampleChunkSize];
+      sample.frame_count = backtrace(sample.frame_list.data(),
+                                     static_cast<int>(kMaxFrameCount));
+
+      sample.phase = thread_phase.load(std::memory_order_relaxed);
+      if (sample.phase == nullptr) {
+        sample.phase = process_phase.load(std::memory_order_relaxed);
+      }
+
+      sample.header = thread_header.load(std::memory_order_relaxed);
+      sample.ready.store(true, std::memory_order_release);
+    }
+  }
+
+  sample_buffer.active_handler_count.fetch_sub(1);
+  errno = saved_errno;
+}
+
+/// Returns the name of the function containing the given address; return
+/// addresses point after the call instruction, so they are moved back by
+/// one byte first
+std::string frameName(void *address, bool return_address) {
+  auto lookup_address =
+      static_cast<char *>(address) - (return_address ? 1 : 0);
+
+  std::stringstream name;
+
+  Dl_info info = {};
+  if (dladdr(lookup_address, &info) == 0) {
+    name << static_cast<void *>(lookup_address);
+    return name.str();
+  }
+
+  if (info.dli_sname != nullptr) {
+    int status = 0;
+    auto demangled_name =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+
+    if (status == 0 && demangled_name != nullptr) {
+      name << demangled_name;
+    } else {
+      name << info.dli_sname;
+    }
+
+    std::free(demangled_name);
+
+  } else {
+    std::string module_name =
+        (info.dli_fname != nullptr) ? info.dli_fname : "unknown";
+
+    auto separator_index = module_name.rfind('/');
+    if (separator_index != std::string::npos) {
+      module_name = module_name.substr(separator_index + 1U);
+    }
+
+    name << module_name << "+0x" << std::hex
+         << (lookup_address - static_cast<char *>(info.dli_fbase));
+  }
+
+  return name.str();
+}
+#endif
+
+/// Replaces the characters that have a meaning in the folded stack format
+std::string foldedFrameName(std::string name) {
+  for (auto &c : name) {
+    if (c == ';' || c == '\n') {
+      c = '_';
+    }
+  }
+
+  return name;
+}
+}  // namespace
+
+/// Private class data
+struct SampleProfiler::PrivateData final {
+  /// True once the profiler has been stopped
+  bool stopped{false};
+
+  /// How many chunks have been allocated
+  std::size_t allocated_chunk_count{0U};
+
+  /// Protects the collector state
+  std::mutex chunk_allocator_mutex;
+
+  /// Wakes up the chunk allocator
+  std::condition_variable chunk_allocator_cv;
+
+  /// Tells the chunk allocator to exit
+  bool stop_chunk_allocator{false};
+
+  /// Allocates the sample chunks ahead of the signal handler
+  std::thread chunk_allocator;
+};
+
+SampleProfiler::SampleProfiler(unsigned int frequency) : d(new PrivateData) {
+#if defined(__linux__) || defined(__APPLE__)
+  if (profiler_created.exchange(true)) {
+    throw Status(false, StatusCode::AlreadyActive,
+                 "Another sample profiler is already active");
+  }
+
+  // The unwinder is loaded the first time backtrace() is called, and this
+  // is not safe to do inside the signal handler
+  std::array<void *, 1U> frame_list;
+  backtrace(frame_list.data(), static_cast<int>(frame_list.size()));
+
+  auto L_allocateChunks = [this](std::size_t chunk_count) {
+    chunk_count = std::min(chunk_count, kMaxSampleChunkCount);
+
+    for (; d->allocated_chunk_count < chunk_count;
+         ++d->allocated_chunk_count) {
+      sample_buffer.chunk_list[d->allocated_chunk_count].store(
+          new Sample[kSampleChunkSize], std::memory_order_release);
+    }
+  };
+
+  try {
+    L_allocateChunks(kSpareSampleChunkCount);
+
+  } catch (const std::bad_alloc &) {
+    profiler_created = false;
+    throw Status(false, StatusCode::MemoryAllocationFailure);
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = sampleSignalHandler;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    for (std::size_t i = 0U; i < d->allocated_chunk_count; ++i) {
+      delete[] sample_buffer.chunk_list[i].exchange(nullptr);
+    }
+
+    profiler_created = false;
+    throw Status(false, StatusCode::SignalError,
+                 "Failed to install the sampling signal handler");
+  }
+
+  d->chunk_allocator = std::thread([this, L_allocateChunks]() {
+    std::unique_lock<std::mutex> lock(d->chunk_allocator_mutex);
+
+    while (!d->stop_chunk_allocator) {
+      auto chunk_count =
+          (sample_buffer.next_sample_index.load() / kSampleChunkSize) +
+          kSpareSampleChunkCount;
+
+      try {
+        L_allocateChunks(chunk_count);
+
+      } catch (const std::bad_alloc &) {
+        // The signal handler drops the samples that do not fit
+      }
+
+      d->chunk_allocator_cv.wait_for(lock, std::chrono::milliseconds(20));
+    }
+  });
+
+  profiler_active = true;
+
+  auto interval = static_cast<suseconds_t>(1000000U / std::max(frequency, 1U));
+
+  itimerval timer = {};
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value = timer.it_interval;
+
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    stop();
+
+    for (std::size_t i = 0U; i < d->allocated_chunk_count; ++i) {
+      delete[] sample_buffer.chunk_list[i].exchange(nullptr);
+    }
+
+    profiler_created = false;
+    throw Status(false, StatusCode::SignalError,
+                 "Failed to start the sampling timer");
+  }
+
+#else
+  static_cast<void>(frequency);
+
+  throw Status(false, StatusCode::NotSupported,
+               "The sample profiler is not supported on this platform");
+#endif
+}
+
+SampleProfiler::Status SampleProfiler::create(SampleProfilerRef &obj,
+                                              unsigned int frequency) {
+  obj.reset();
+
+  try {
+    auto ptr = new SampleProfiler(frequency);
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+SampleProfiler::~SampleProfiler() {
+  stop();
+
+  for (std::size_t i = 0U; i < d->allocated_chunk_count; ++i) {
+    delete[] sample_buffer.chunk_list[i].exchange(nullptr);
+  }
+
+  sample_buffer.next_sample_index = 0U;
+  sample_buffer.dropped_sample_count = 0U;
+
+  profiler_created = false;
+}
+
+bool SampleProfiler::active() { return profiler_active; }
+
+void SampleProfiler::stop() {
+  if (d->stopped) {
+    return;
+  }
+
+  d->stopped = true;
+
+#if defined(__linux__) || defined(__APPLE__)
+  itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+
+  profiler_active = false;
+
+  // A signal may still be pending, and its default action would terminate
+  // the process; wait for the handlers that are still running, so that the
+  // samples can be read and released
+  struct sigaction action = {};
+  action.sa_handler = SIG_IGN;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, nullptr);
+
+  while (sample_buffer.active_handler_count.load() != 0) {
+    std::this_thread::yield();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(d->chunk_allocator_mutex);
+    d->stop_chunk_allocator = true;
+  }
+
+  d->chunk_allocator_cv.notify_all();
+  d->chunk_allocator.join();
+#endif
+}
+
+bool SampleProfiler::writeFoldedStacks(const std::string &path) {
+  stop();
+
+  std::map<std::string, std::size_t> stack_map;
+
+#if defined(__linux__) || defined(__APPLE__)
+  // Each thread has been interrupted at an exact address, while the other
+  // frames are return addresses
+  std::unordered_map<void *, std::string> frame_name_map;
+  std::unordered_map<void *, std::string> return_frame_name_map;
+
+  auto L_frameName = [&](void *address,
+                         bool return_address) -> const std::string & {
+    auto &name_map = return_address ? return_frame_name_map : frame_name_map;
+
+    auto it = name_map.find(address);
+    if (it == name_map.end()) {
+      it = name_map
+               .insert({address,
+                        foldedFrameName(frameName(address, return_address))})
+               .first;
+    }
+
+    return it->second;
+  };
+
+  auto sample_count =
+      std::min(sample_buffer.next_sample_index.load(),
+               d->allocated_chunk_count * kSampleChunkSize);
+
+  std::string stack;
+
+  for (std::size_t i = 0U; i < sample_count; ++i) {
+    const auto &sample = sample_buffer.chunk_list[i / kSampleChunkSize].load()
+                             [i % kSampleChunkSize];
+
+    if (!sample.ready.load(std::memory_order_acquire)) {
+      continue;
+    }
+
+    stack = "phase: ";
+    stack += (sample.phase != nullptr) ? foldedFrameName(sample.phase)
+                                       : std::string("none");
+
+    if (sample.header != nullptr) {
+      stack += ";header: " + foldedFrameName(sample.header);
+    }
+
+    for (auto frame_index = sample.frame_count - 1;
+         frame_index >= kSkippedFrameCount; --frame_index) {
+      stack += ';';
+      stack += L_frameName(
+          sample.frame_list[static_cast<std::size_t>(frame_index)],
+          frame_index > kSkippedFrameCount);
+    }
+
+    ++stack_map[stack];
+  }
+#endif
+
+  std::ofstream folded_file(path, std::ios::out | std::ios::trunc);
+  for (const auto &p : stack_map) {
+    folded_file << p.first << " " << p.second << "\n";
+  }
+
+  return static_cast<bool>(folded_file);
+}
+
+std::size_t SampleProfiler::sampleCount() const {
+  auto sample_index = sample_buffer.next_sample_index.load();
+  auto dropped_sample_count = sample_buffer.dropped_sample_count.load();
+
+  return sample_index - std::min(sample_index, dropped_sample_count);
+}
+
+std::size_t SampleProfiler::droppedSampleCount() const {
+  return sample_buffer.dropped_sample_count;
+}
+
+ScopedSampleTag::ScopedSampleTag(SampleTag sample_tag,
+                                 const std::string &value)
+    : tag(sample_tag) {
+  if (!SampleProfiler::active()) {
+    return;
+  }
+
+  enabled = true;
+
+  auto interned_value = internSampleTag(value);
+
+  if (tag == SampleTag::Phase) {
+    previous_value = thread_phase.exchange(interned_value);
+    previous_process_phase = process_phase.exchange(interned_value);
+
+  } else {
+    previous_value = thread_header.exchange(interned_value);
+  }
+}
+
+ScopedSampleTag::~ScopedSampleTag() {
+  if (!enabled) {
+    return;
+  }
+
+  if (tag == SampleTag::Phase) {
+    thread_phase = previous_value;
+    process_phase = previous_process_phase;
+
+  } else {
+    thread_header = previous_value;
+  }
+}
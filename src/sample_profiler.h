@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+
+#include <memory>
+#include <string>
+
+class SampleProfiler;
+
+/// A reference to a SampleProfiler object
+using SampleProfilerRef = std::unique_ptr<SampleProfiler>;
+
+/// The SampleProfiler periodically interrupts the process with a CPU time
+/// timer signal, and records the stack of the thread that received it; the
+/// signal is delivered to the threads that are running, so each thread is
+/// sampled in proportion to the CPU time it uses. Each sample is tagged with
+/// the current phase and candidate header (see ScopedSampleTag), and the
+/// samples are saved as folded stacks, which flamegraph.pl, speedscope and
+/// inferno can load. Only one profiler can be active at a time
+class SampleProfiler final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  SampleProfiler(unsigned int frequency);
+
+ public:
+  /// Status code, used with SampleProfiler::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    AlreadyActive,
+    NotSupported,
+    SignalError,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Starts sampling the process at the given frequency, in samples per
+  /// second of CPU time. The default is not a round number, so that the
+  /// samples do not run in lockstep with periodic work
+  static Status create(SampleProfilerRef &obj, unsigned int frequency = 99U);
+
+  /// Destructor; stops sampling
+  ~SampleProfiler();
+
+  /// Returns true if a profiler is sampling the process
+  static bool active();
+
+  /// Stops sampling; the samples that have been recorded are kept
+  void stop();
+
+  /// Stops sampling and saves the samples as folded stacks, one line per
+  /// distinct stack, starting from the phase and header tags. Frames are
+  /// named after the symbols exported by the executable and its libraries;
+  /// the others are written as module+offset
+  bool writeFoldedStacks(const std::string &path);
+
+  /// Returns how many samples have been recorded
+  std::size_t sampleCount() const;
+
+  /// Returns how many samples have been dropped because the sample buffer
+  /// could not grow fast enough
+  std::size_t droppedSampleCount() const;
+
+  /// Disable the copy constructor
+  SampleProfiler(const SampleProfiler &other) = delete;
+
+  /// Disable the assignment operator
+  SampleProfiler &operator=(const SampleProfiler &other) = delete;
+};
+
+/// The tags attached to each sample
+enum class SampleTag {
+  /// The phase the thread is working on; threads without a phase of their
+  /// own (i.e.: workers) use the phase most recently entered by any thread
+  Phase,
+
+  /// The header being probed by the thread
+  Header
+};
+
+/// Tags the samples taken on the calling thread while the object is alive;
+/// the previous value is restored by the destructor. Nothing is done when
+/// the profiler is not active
+class ScopedSampleTag final {
+  /// The tag being set
+  SampleTag tag;
+
+  /// True if the tag has been set
+  bool enabled{false};
+
+  /// The value of the tag before this object was created
+  const char *previous_value{nullptr};
+
+  /// The process-wide phase before this object was created
+  const char *previous_process_phase{nullptr};
+
+ public:
+  /// Constructor
+  ScopedSampleTag(SampleTag tag, const std::string &value);
+
+  /// Destructor
+  ~ScopedSampleTag();
+
+  /// Disable the copy constructor
+  ScopedSampleTag(const ScopedSampleTag &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedSampleTag &operator=(const ScopedSampleTag &other) = delete;
+};
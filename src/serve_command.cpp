@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "command_runner.h"
+#include "output_capture.h"
+#include "resident_state.h"
+#include "server_metrics.h"
+#include "socket_io.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <json11.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+namespace {
+/// How often the request workers check whether the server is stopping, in
+/// milliseconds
+const int kStopCheckInterval = 250;
+
+/// The largest request that is accepted, in bytes
+const std::size_t kMaxRequestSize = 1024U * 1024U;
+
+/// Reads a newline terminated request from the given socket
+bool readRequest(std::string &request, int socket_descriptor) {
+  request.clear();
+
+  char buffer[4096];
+
+  while (request.size() < kMaxRequestSize) {
+    auto size = read(socket_descriptor, buffer, sizeof(buffer));
+    if (size < 0) {
+      return false;
+    }
+
+    if (size == 0) {
+      break;
+    }
+
+    request.append(buffer, static_cast<std::size_t>(size));
+    if (request.find('\n') != std::string::npos) {
+      request.resize(request.find('\n'));
+      return true;
+    }
+  }
+
+  return !request.empty() && request.size() < kMaxRequestSize;
+}
+
+/// Removes the socket left behind by a server that is no longer running.
+/// Returns false if the path is used by anything else, including the socket
+/// of a running server
+bool removeStaleSocket(const sockaddr_un &socket_address) {
+  struct stat file_status = {};
+  if (lstat(socket_address.sun_path, &file_status) != 0) {
+    return errno == ENOENT;
+  }
+
+  if (!S_ISSOCK(file_status.st_mode)) {
+    return false;
+  }
+
+  auto probe_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (probe_socket < 0) {
+    return false;
+  }
+
+  auto connected =
+      connect(probe_socket, reinterpret_cast<const sockaddr *>(&socket_address),
+              sizeof(socket_address)) == 0;
+
+  close(probe_socket);
+
+  if (connected) {
+    return false;
+  }
+
+  return unlink(socket_address.sun_path) == 0;
+}
+}  // namespace
+#endif
+
+/// Handler for the 'serve' command
+bool serveCommandHandler(ProfileManagerRef &profile_manager,
+                         const LanguageManager &language_manager,
+                         const CommandLineOptions &cmdline_options) {
+#if defined(__unix__) || defined(__APPLE__)
+  ResidentStateRef resident_state;
+  auto status = ResidentState::create(resident_state,
+                                      cmdline_options.state_directory);
+  if (!status.succeeded()) {
+    std::cerr << status.toString() << "\n";
+    return false;
+  }
+
+  sockaddr_un socket_address = {};
+  socket_address.sun_family = AF_UNIX;
+
+  const auto &socket_path = cmdline_options.socket_path;
+  if (socket_path.size() >= sizeof(socket_address.sun_path)) {
+    std::cerr << "The socket path is too long: " << socket_path << "\n";
+    return false;
+  }
+
+  socket_path.copy(socket_address.sun_path, socket_path.size());
+
+  auto listen_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listen_socket < 0) {
+    std::cerr << "Failed to create the server socket\n";
+    return false;
+  }
+
+  if (!removeStaleSocket(socket_address)) {
+    std::cerr << "The socket path is already in use: " << socket_path << "\n";
+    close(listen_socket);
+    return false;
+  }
+
+  if (bind(listen_socket, reinterpret_cast<sockaddr *>(&socket_address),
+           sizeof(socket_address)) != 0 ||
+      listen(listen_socket, SOMAXCONN) != 0) {
+    std::cerr << "Failed to listen on " << socket_path << "\n";
+    close(listen_socket);
+    return false;
+  }
+
+  // The workers poll the socket, so that they can notice when the server is
+  // stopping; accept() must not block when another worker got there first
+  fcntl(listen_socket, F_SETFL, fcntl(listen_socket, F_GETFL) | O_NONBLOCK);
+
+  std::cerr << "Listening on " << socket_path << " with "
+            << cmdline_options.jobs << " request workers\n";
+
+  std::atomic_bool stop_server{false};
+  std::atomic_size_t request_count{0U};
+  std::atomic_size_t busy_worker_count{0U};
+  std::atomic_size_t untrimmed_request_count{0U};
+
+  MetricsEndpointRef metrics_endpoint;
+  if (!cmdline_options.metrics_address.empty()) {
+    auto L_sampleGauges = [&]() -> ServerGauges {
+      ServerGauges gauges;
+      gauges.worker_count = cmdline_options.jobs;
+      gauges.busy_worker_count = busy_worker_count;
+
+      return gauges;
+    };
+
+    auto metrics_status = MetricsEndpoint::create(
+        metrics_endpoint, cmdline_options.metrics_address, L_sampleGauges);
+
+    if (!metrics_status.succeeded()) {
+      std::cerr << metrics_status.toString() << "\n";
+      close(listen_socket);
+      unlink(socket_path.c_str());
+      return false;
+    }
+
+    std::cerr << "Serving metrics on " << cmdline_options.metrics_address
+              << "\n";
+  }
+
+  ScopedOutputCapture output_capture;
+
+  auto L_handleConnection = [&](int connection_socket) {
+    std::string request;
+    if (!readRequest(request, connection_socket)) {
+      return;
+    }
+
+    std::string error;
+    auto request_object = json11::Json::parse(request, error);
+
+    json11::Json::object response_object;
+
+    if (!error.empty() || !request_object.is_object()) {
+      response_object = json11::Json::object{
+          {"succeeded", false}, {"output", "Invalid request: " + error}};
+
+    } else if (request_object["shutdown"].bool_value()) {
+      stop_server = true;
+      response_object = json11::Json::object{{"succeeded", true}};
+
+    } else {
+      StringList argument_list;
+      for (const auto &argument : request_object["arguments"].array_items()) {
+        argument_list.push_back(argument.string_value());
+      }
+
+      std::string output;
+      ScopedOutputCapture::setThreadOutput(&output);
+
+      bool succeeded = false;
+
+      busy_worker_count++;
+      auto start_time = std::chrono::steady_clock::now();
+      auto start_heap_memory = getAllocatedHeapMemory();
+
+      try {
+        succeeded = runCommandLine(profile_manager, language_manager,
+                                   resident_state, argument_list);
+
+      } catch (const std::exception &exception) {
+        output += std::string("Unhandled exception: ") + exception.what() +
+                  "\n";
+      }
+
+      ScopedOutputCapture::setThreadOutput(nullptr);
+      request_count++;
+
+      // The growth also includes the allocations of the requests that ran
+      // at the same time
+      auto heap_growth =
+          static_cast<std::int64_t>(getAllocatedHeapMemory()) -
+          static_cast<std::int64_t>(start_heap_memory);
+
+      recordServerRequest(succeeded,
+                          std::chrono::steady_clock::now() - start_time,
+                          heap_growth);
+
+      auto idle = --busy_worker_count == 0U;
+
+      // Trimming walks the whole heap, so it waits until the server is idle
+      auto trim_interval = cmdline_options.heap_trim_interval;
+      if (trim_interval != 0U && ++untrimmed_request_count >= trim_interval &&
+          idle) {
+        untrimmed_request_count = 0U;
+        trimHeap();
+      }
+
+      response_object = json11::Json::object{
+          {"succeeded", succeeded},
+          {"output", output},
+          {"heap_growth_bytes", static_cast<double>(heap_growth)}};
+    }
+
+    writeSocket(connection_socket,
+                  json11::Json(response_object).dump() + "\n");
+  };
+
+  auto L_worker = [&]() {
+    while (!stop_server) {
+      pollfd poll_descriptor = {};
+      poll_descriptor.fd = listen_socket;
+      poll_descriptor.events = POLLIN;
+
+      if (poll(&poll_descriptor, 1, kStopCheckInterval) <= 0) {
+        continue;
+      }
+
+      auto connection_socket = accept(listen_socket, nullptr, nullptr);
+      if (connection_socket < 0) {
+        continue;
+      }
+
+      // Some systems let the accepted socket inherit O_NONBLOCK
+      fcntl(connection_socket, F_SETFL,
+            fcntl(connection_socket, F_GETFL) & ~O_NONBLOCK);
+
+      L_handleConnection(connection_socket);
+      close(connection_socket);
+    }
+  };
+
+  std::vector<std::thread> thread_list;
+  for (std::size_t i = 1U; i < cmdline_options.jobs; ++i) {
+    thread_list.emplace_back(L_worker);
+  }
+
+  L_worker();
+
+  for (auto &thread : thread_list) {
+    thread.join();
+  }
+
+  close(listen_socket);
+  unlink(socket_path.c_str());
+
+  std::cerr << "Served " << request_count << " requests; "
+            << resident_state->precompiledHeaderHitCount()
+            << " reused the precompiled base includes\n";
+
+  return true;
+
+#else
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+  static_cast<void>(cmdline_options);
+
+  std::cerr << "The serve command is only supported on Unix systems\n";
+  return false;
+#endif
+}
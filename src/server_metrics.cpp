@@ -0,0 +1,584 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "server_metrics.h"
+#include "socket_io.h"
+#include "time_report.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace {
+/// The upper bounds of the request latency buckets, in seconds; generate
+/// requests on large libraries can take several minutes
+const std::array<double, 12> kLatencyBucketList = {
+    0.01, 0.05, 0.1, 0.5, 1.0, 5.0, 10.0, 30.0, 60.0, 300.0, 900.0, 1800.0};
+
+/// How many values are kept for the ServerCounter enum
+const std::size_t kServerCounterCount =
+    static_cast<std::size_t>(ServerCounter::HeapTrimmedBytes) + 1U;
+
+/// Where the request values are kept, after the counters: the succeeded
+/// and failed request counts, one (non cumulative) count per latency bucket
+/// plus the +Inf one, the latency sum in microseconds and the sum of the
+/// heap growths
+const std::size_t kSucceededRequestsIndex = kServerCounterCount;
+const std::size_t kFailedRequestsIndex = kSucceededRequestsIndex + 1U;
+const std::size_t kLatencyBucketIndex = kFailedRequestsIndex + 1U;
+const std::size_t kLatencySumIndex =
+    kLatencyBucketIndex + kLatencyBucketList.size() + 1U;
+const std::size_t kHeapGrowthSumIndex = kLatencySumIndex + 1U;
+
+/// How many values each thread keeps
+const std::size_t kValueCount = kHeapGrowthSumIndex + 1U;
+
+/// The values updated by a single thread. Only the owner writes them, so a
+/// relaxed load followed by a relaxed store is enough; the atomics only
+/// make the concurrent reads of the scrapes well defined
+struct CounterSlot final {
+  std::array<std::atomic<std::uint64_t>, kValueCount> value_list{};
+};
+
+/// Every slot that has been handed out; slots are never freed, and the ones
+/// released by exiting threads are reused (their values stay, so the sums
+/// never go back)
+struct CounterRegistry final {
+  /// Protects the other members
+  std::mutex mutex;
+
+  /// All the slots
+  std::vector<std::unique_ptr<CounterSlot>> slot_list;
+
+  /// The slots that no thread owns
+  std::vector<CounterSlot *> free_slot_list;
+};
+
+/// Returns the counter registry; it is never destroyed, since threads may
+/// still update their slots while the process exits
+CounterRegistry &counterRegistry() {
+  static auto registry = new CounterRegistry;
+  return *registry;
+}
+
+/// Owns the slot of the current thread, and gives it back on exit
+class ThreadCounterSlot final {
+  /// The slot, acquired on first use
+  CounterSlot *slot{nullptr};
+
+ public:
+  /// Constructor
+  ThreadCounterSlot() = default;
+
+  /// Destructor
+  ~ThreadCounterSlot() {
+    if (slot == nullptr) {
+      return;
+    }
+
+    auto &registry = counterRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.free_slot_list.push_back(slot);
+  }
+
+  /// Returns the slot of the current thread
+  CounterSlot &get() {
+    if (slot != nullptr) {
+      return *slot;
+    }
+
+    auto &registry = counterRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+
+    if (!registry.free_slot_list.empty()) {
+      slot = registry.free_slot_list.back();
+      registry.free_slot_list.pop_back();
+
+    } else {
+      registry.slot_list.push_back(std::make_unique<CounterSlot>());
+      slot = registry.slot_list.back().get();
+    }
+
+    return *slot;
+  }
+
+  /// Disable the copy constructor
+  ThreadCounterSlot(const ThreadCounterSlot &other) = delete;
+
+  /// Disable the assignment operator
+  ThreadCounterSlot &operator=(const ThreadCounterSlot &other) = delete;
+};
+
+/// The slot of the current thread
+thread_local ThreadCounterSlot thread_counter_slot;
+
+/// Adds the given value to the specified entry of the current thread slot
+void addThreadValue(std::size_t index, std::uint64_t value) {
+  auto &counter = thread_counter_slot.get().value_list[index];
+  counter.store(counter.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+}
+
+/// Sums the values of every slot
+std::array<std::uint64_t, kValueCount> sumThreadValues() {
+  std::array<std::uint64_t, kValueCount> total_list{};
+
+  auto &registry = counterRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+
+  for (const auto &slot : registry.slot_list) {
+    for (std::size_t i = 0U; i < kValueCount; ++i) {
+      total_list[i] += slot->value_list[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  return total_list;
+}
+
+/// Returns the current resident set size of the process, in bytes; zero
+/// when it is not available
+std::uint64_t getResidentMemory() {
+#if defined(__linux__)
+  std::ifstream statm("/proc/self/statm");
+
+  std::uint64_t total_pages = 0U;
+  std::uint64_t resident_pages = 0U;
+  if (!(statm >> total_pages >> resident_pages)) {
+    return 0U;
+  }
+
+  return resident_pages * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0U;
+#endif
+}
+}  // namespace
+
+void addServerCounter(ServerCounter counter, std::uint64_t value) {
+  addThreadValue(static_cast<std::size_t>(counter), value);
+}
+
+void recordServerRequest(bool succeeded,
+                         std::chrono::steady_clock::duration duration,
+                         std::int64_t heap_growth) {
+  addThreadValue(succeeded ? kSucceededRequestsIndex : kFailedRequestsIndex,
+                 1U);
+
+  auto microseconds =
+      std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  if (microseconds < 0) {
+    microseconds = 0;
+  }
+
+  auto seconds = static_cast<double>(microseconds) / 1000000.0;
+
+  std::size_t bucket_index = 0U;
+  while (bucket_index < kLatencyBucketList.size() &&
+         seconds > kLatencyBucketList[bucket_index]) {
+    ++bucket_index;
+  }
+
+  addThreadValue(kLatencyBucketIndex + bucket_index, 1U);
+  addThreadValue(kLatencySumIndex, static_cast<std::uint64_t>(microseconds));
+
+  // Requests that free more than they allocate do not make up for the
+  // others
+  if (heap_growth > 0) {
+    addThreadValue(kHeapGrowthSumIndex,
+                   static_cast<std::uint64_t>(heap_growth));
+  }
+}
+
+std::uint64_t getAllocatedHeapMemory() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  auto heap_info = mallinfo2();
+  return static_cast<std::uint64_t>(heap_info.uordblks) +
+         static_cast<std::uint64_t>(heap_info.hblkhd);
+#else
+  return 0U;
+#endif
+}
+
+std::uint64_t trimHeap() {
+#if defined(__GLIBC__)
+  auto resident_memory = getResidentMemory();
+  malloc_trim(0U);
+
+  auto trimmed_memory = resident_memory - std::min(resident_memory,
+                                                   getResidentMemory());
+
+  addServerCounter(ServerCounter::HeapTrims);
+  addServerCounter(ServerCounter::HeapTrimmedBytes, trimmed_memory);
+
+  return trimmed_memory;
+#else
+  return 0U;
+#endif
+}
+
+std::string renderServerMetrics(const ServerGauges &gauges) {
+  auto value_list = sumThreadValues();
+
+  auto L_value = [&](ServerCounter counter) -> std::uint64_t {
+    return value_list[static_cast<std::size_t>(counter)];
+  };
+
+  std::stringstream output;
+
+  auto L_header = [&](const std::string &name, const std::string &type,
+                      const std::string &help) {
+    output << "# HELP " << name << " " << help << "\n";
+    output << "# TYPE " << name << " " << type << "\n";
+  };
+
+  L_header("abigen_serve_requests_total", "counter",
+           "Requests executed by the serve command.");
+
+  output << "abigen_serve_requests_total{result=\"succeeded\"} "
+         << value_list[kSucceededRequestsIndex] << "\n";
+
+  output << "abigen_serve_requests_total{result=\"failed\"} "
+         << value_list[kFailedRequestsIndex] << "\n";
+
+  L_header("abigen_serve_request_duration_seconds", "histogram",
+           "Time spent executing each request.");
+
+  std::uint64_t cumulative_count = 0U;
+  for (std::size_t i = 0U; i <= kLatencyBucketList.size(); ++i) {
+    cumulative_count += value_list[kLatencyBucketIndex + i];
+
+    output << "abigen_serve_request_duration_seconds_bucket{le=\"";
+    if (i < kLatencyBucketList.size()) {
+      output << kLatencyBucketList[i];
+    } else {
+      output << "+Inf";
+    }
+
+    output << "\"} " << cumulative_count << "\n";
+  }
+
+  output << "abigen_serve_request_duration_seconds_sum " << std::fixed
+         << std::setprecision(6)
+         << static_cast<double>(value_list[kLatencySumIndex]) / 1000000.0
+         << "\n";
+
+  output << "abigen_serve_request_duration_seconds_count " << cumulative_count
+         << "\n";
+
+  // Worker utilization is the rate of the latency sum divided by the worker
+  // count; each worker executes one request at a time
+  L_header("abigen_serve_workers", "gauge", "Request workers of the server.");
+  output << "abigen_serve_workers " << gauges.worker_count << "\n";
+
+  L_header("abigen_serve_busy_workers", "gauge",
+           "Workers that are executing a request.");
+  output << "abigen_serve_busy_workers " << gauges.busy_worker_count << "\n";
+
+  L_header("abigen_header_probes_total", "counter",
+           "Candidate headers probed, including the cached outcomes.");
+  output << "abigen_header_probes_total "
+         << L_value(ServerCounter::HeaderProbes) << "\n";
+
+  L_header("abigen_cache_lookups_total", "counter",
+           "Cache lookups, by cache and outcome.");
+
+  const std::array<std::pair<const char *, ServerCounter>, 5U> cache_list = {
+      {{"probe", ServerCounter::ProbeCacheHits},
+       {"pch", ServerCounter::PCHCacheHits},
+       {"compile", ServerCounter::CompileCacheHits},
+       {"analysis", ServerCounter::AnalysisCacheHits},
+       {"file_system", ServerCounter::FileSystemCacheHits}}};
+
+  // Each miss counter follows the hit counter of the same cache
+  for (const auto &cache : cache_list) {
+    auto hit_index = static_cast<std::size_t>(cache.second);
+
+    output << "abigen_cache_lookups_total{cache=\"" << cache.first
+           << "\",result=\"hit\"} " << value_list[hit_index] << "\n";
+
+    output << "abigen_cache_lookups_total{cache=\"" << cache.first
+           << "\",result=\"miss\"} " << value_list[hit_index + 1U] << "\n";
+  }
+
+  L_header("abigen_serve_request_heap_growth_bytes_total", "counter",
+           "Heap memory still allocated when each request ends, summed over "
+           "the requests; concurrent requests share their growth.");
+  output << "abigen_serve_request_heap_growth_bytes_total "
+         << value_list[kHeapGrowthSumIndex] << "\n";
+
+  auto allocated_heap_memory = getAllocatedHeapMemory();
+  if (allocated_heap_memory != 0U) {
+    L_header("abigen_heap_allocated_bytes", "gauge",
+             "Heap memory allocated and not freed yet.");
+    output << "abigen_heap_allocated_bytes " << allocated_heap_memory << "\n";
+  }
+
+  L_header("abigen_heap_trims_total", "counter",
+           "Times the free heap memory has been returned to the system.");
+  output << "abigen_heap_trims_total " << L_value(ServerCounter::HeapTrims)
+         << "\n";
+
+  L_header("abigen_heap_trimmed_bytes_total", "counter",
+           "Resident memory released by the heap trims.");
+  output << "abigen_heap_trimmed_bytes_total "
+         << L_value(ServerCounter::HeapTrimmedBytes) << "\n";
+
+  auto resident_memory = getResidentMemory();
+  if (resident_memory != 0U) {
+    L_header("process_resident_memory_bytes", "gauge",
+             "Resident memory size in bytes.");
+    output << "process_resident_memory_bytes " << resident_memory << "\n";
+  }
+
+  auto peak_resident_memory = getPeakResidentMemory();
+  if (peak_resident_memory != 0U) {
+    L_header("abigen_peak_resident_memory_bytes", "gauge",
+             "Peak resident memory size in bytes.");
+    output << "abigen_peak_resident_memory_bytes " << peak_resident_memory
+           << "\n";
+  }
+
+  return output.str();
+}
+
+/// Private class data
+struct MetricsEndpoint::PrivateData final {
+  /// Samples the gauges
+  std::function<ServerGauges()> gauge_callback;
+
+  /// The listening socket
+  int listen_socket{-1};
+
+  /// Set by the destructor to stop the thread
+  std::atomic_bool stop{false};
+
+  /// How many scrapes have been answered
+  std::atomic_size_t scrape_count{0U};
+
+  /// The thread answering the scrapes
+  std::thread thread;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+namespace {
+/// How often the endpoint checks whether it is stopping, in milliseconds
+const int kStopCheckInterval = 250;
+
+/// The largest request head that is read, in bytes
+const std::size_t kMaxRequestHeadSize = 8192U;
+}  // namespace
+#endif
+
+MetricsEndpoint::MetricsEndpoint(const std::string &address,
+                                 std::function<ServerGauges()> gauge_callback)
+    : d(new PrivateData) {
+  d->gauge_callback = std::move(gauge_callback);
+
+#if defined(__unix__) || defined(__APPLE__)
+  auto separator_position = address.rfind(':');
+  if (separator_position == std::string::npos ||
+      separator_position + 1U == address.size()) {
+    throw Status(false, StatusCode::InvalidAddress,
+                 "The metrics address must be in the host:port format: " +
+                     address);
+  }
+
+  auto host = address.substr(0U, separator_position);
+  auto port = address.substr(separator_position + 1U);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo *address_list = nullptr;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints,
+                  &address_list) != 0) {
+    throw Status(false, StatusCode::InvalidAddress,
+                 "Failed to resolve the metrics address: " + address);
+  }
+
+  for (auto it = address_list; it != nullptr; it = it->ai_next) {
+    d->listen_socket = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (d->listen_socket < 0) {
+      continue;
+    }
+
+    // Let a restarted server bind the port while old connections linger
+    int enable = 1;
+    setsockopt(d->listen_socket, SOL_SOCKET, SO_REUSEADDR, &enable,
+               sizeof(enable));
+
+    if (bind(d->listen_socket, it->ai_addr, it->ai_addrlen) == 0 &&
+        listen(d->listen_socket, SOMAXCONN) == 0) {
+      break;
+    }
+
+    close(d->listen_socket);
+    d->listen_socket = -1;
+  }
+
+  freeaddrinfo(address_list);
+
+  if (d->listen_socket < 0) {
+    throw Status(false, StatusCode::NetworkError,
+                 "Failed to listen on the metrics address: " + address);
+  }
+
+  d->thread = std::thread([this]() { serve(); });
+
+#else
+  static_cast<void>(address);
+
+  throw Status(false, StatusCode::NotSupported,
+               "The metrics endpoint is only supported on Unix systems");
+#endif
+}
+
+void MetricsEndpoint::serve() {
+#if defined(__unix__) || defined(__APPLE__)
+  while (!d->stop) {
+    pollfd poll_descriptor = {};
+    poll_descriptor.fd = d->listen_socket;
+    poll_descriptor.events = POLLIN;
+
+    if (poll(&poll_descriptor, 1, kStopCheckInterval) <= 0) {
+      continue;
+    }
+
+    auto connection_socket = accept(d->listen_socket, nullptr, nullptr);
+    if (connection_socket < 0) {
+      continue;
+    }
+
+    // A client that never completes its request must not stall the scrapes
+    // of the others
+    timeval timeout = {};
+    timeout.tv_sec = 1;
+    setsockopt(connection_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+
+    while (request.size() < kMaxRequestHeadSize &&
+           request.find("\r\n\r\n") == std::string::npos &&
+           request.find("\n\n") == std::string::npos) {
+      auto size = read(connection_socket, buffer, sizeof(buffer));
+      if (size <= 0) {
+        break;
+      }
+
+      request.append(buffer, static_cast<std::size_t>(size));
+    }
+
+    auto request_line = request.substr(0U, request.find_first_of("\r\n"));
+
+    std::string method;
+    std::string target;
+
+    std::stringstream request_line_stream(request_line);
+    request_line_stream >> method >> target;
+
+    // Scrapers may append a query string
+    target = target.substr(0U, target.find('?'));
+
+    std::string status_line;
+    std::string body;
+
+    if (method != "GET" && method != "HEAD") {
+      status_line = "405 Method Not Allowed";
+      body = "Only GET requests are supported\n";
+
+    } else if (target != "/metrics") {
+      status_line = "404 Not Found";
+      body = "The metrics are served on /metrics\n";
+
+    } else {
+      status_line = "200 OK";
+      body = renderServerMetrics(d->gauge_callback ? d->gauge_callback()
+                                                   : ServerGauges());
+      d->scrape_count++;
+    }
+
+    std::string response = "HTTP/1.0 " + status_line +
+                           "\r\nContent-Type: text/plain; version=0.0.4"
+                           "\r\nContent-Length: " +
+                           std::to_string(body.size()) +
+                           "\r\nConnection: close\r\n\r\n";
+
+    if (method != "HEAD") {
+      response += body;
+    }
+
+    writeSocket(connection_socket, response);
+    close(connection_socket);
+  }
+#endif
+}
+
+MetricsEndpoint::Status MetricsEndpoint::create(
+    MetricsEndpointRef &obj, const std::string &address,
+    std::function<ServerGauges()> gauge_callback) {
+  obj.reset();
+
+  try {
+    auto ptr = new MetricsEndpoint(address, std::move(gauge_callback));
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+  d->stop = true;
+
+  if (d->thread.joinable()) {
+    d->thread.join();
+  }
+
+#if defined(__unix__) || defined(__APPLE__)
+  if (d->listen_socket >= 0) {
+    close(d->listen_socket);
+  }
+#endif
+}
+
+std::size_t MetricsEndpoint::scrapeCount() const { return d->scrape_count; }
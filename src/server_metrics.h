@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+/// The counters updated by the components of a long running process
+enum class ServerCounter {
+  HeaderProbes,
+  ProbeCacheHits,
+  ProbeCacheMisses,
+  PCHCacheHits,
+  PCHCacheMisses,
+  CompileCacheHits,
+  CompileCacheMisses,
+  AnalysisCacheHits,
+  AnalysisCacheMisses,
+  FileSystemCacheHits,
+  FileSystemCacheMisses,
+  HeapTrims,
+  HeapTrimmedBytes
+};
+
+/// Adds the given value to a process-wide counter. Each thread updates its
+/// own copy without locks or read-modify-write atomics, so this can be
+/// called from hot paths; the copies are only summed when the metrics are
+/// rendered
+void addServerCounter(ServerCounter counter, std::uint64_t value = 1U);
+
+/// Records the outcome and the duration of a request executed by the serve
+/// command, along with how much the allocated heap grew while it ran
+void recordServerRequest(bool succeeded,
+                         std::chrono::steady_clock::duration duration,
+                         std::int64_t heap_growth = 0);
+
+/// Returns the heap memory that has been allocated and not freed yet, in
+/// bytes; zero when the allocator can't report it
+std::uint64_t getAllocatedHeapMemory();
+
+/// Gives the free heap pages back to the operating system, and returns how
+/// much the resident memory went down, in bytes; the trims are counted in
+/// the metrics. Does nothing when the allocator does not support it
+std::uint64_t trimHeap();
+
+/// The gauges sampled by the serve command each time the metrics are read
+struct ServerGauges final {
+  /// How many request workers the server runs
+  std::size_t worker_count{0U};
+
+  /// How many workers are executing a request
+  std::size_t busy_worker_count{0U};
+};
+
+/// Renders the counters, the request latency histogram, the given gauges
+/// and the resident memory of the process in the Prometheus text format
+std::string renderServerMetrics(const ServerGauges &gauges);
+
+class MetricsEndpoint;
+
+/// A reference to a MetricsEndpoint object
+using MetricsEndpointRef = std::unique_ptr<MetricsEndpoint>;
+
+/// The MetricsEndpoint serves the output of renderServerMetrics() to
+/// Prometheus scrapers; it answers GET /metrics requests over HTTP from a
+/// thread of its own, until it is destroyed
+class MetricsEndpoint final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  MetricsEndpoint(const std::string &address,
+                  std::function<ServerGauges()> gauge_callback);
+
+  /// Accepts and answers the scrape requests
+  void serve();
+
+ public:
+  /// Status code, used with MetricsEndpoint::Status
+  enum class StatusCode {
+    MemoryAllocationFailure,
+    InvalidAddress,
+    NetworkError,
+    NotSupported,
+    Unknown
+  };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Starts listening on the given address (host:port; an empty host means
+  /// every interface). The callback is invoked by each scrape to sample the
+  /// gauges
+  static Status create(MetricsEndpointRef &obj, const std::string &address,
+                       std::function<ServerGauges()> gauge_callback);
+
+  /// Destructor; stops the endpoint
+  ~MetricsEndpoint();
+
+  /// Returns how many scrape requests have been answered
+  std::size_t scrapeCount() const;
+
+  /// Disable the copy constructor
+  MetricsEndpoint(const MetricsEndpoint &other) = delete;
+
+  /// Disable the assignment operator
+  MetricsEndpoint &operator=(const MetricsEndpoint &other) = delete;
+};
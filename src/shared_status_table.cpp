@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "shared_status_table.h"
+#include "content_hash.h"
+
+#include <chrono>
+#include <cstring>
+
+#include <sys/mman.h>
+
+namespace {
+/// How many slots the table has; the region is mapped without reserving
+/// swap space, and only the pages that have been written take memory
+const std::uint64_t kSlotCount = 1ULL << 18U;
+
+/// The size of the path arena, in bytes
+const std::uint64_t kArenaSize = 32ULL << 20U;
+
+/// How many slots are visited before the table is considered full
+const std::uint64_t kMaxProbeLength = 32U;
+
+/// The key of the slots that have not been claimed yet
+const std::uint64_t kEmptySlot = 0U;
+
+/// The header of the region; the slots and the arena follow it. All the
+/// fields are updated concurrently, with atomic operations
+struct RegionHeader final {
+  /// How many entries have been published
+  std::uint64_t entry_count;
+
+  /// How many bytes of the arena are in use
+  std::uint64_t arena_size;
+
+  /// Not zero once the table or the arena can no longer take new entries
+  std::uint32_t saturated;
+
+  /// Keeps the slots aligned to a cache line
+  std::uint8_t padding[44];
+};
+
+static_assert(sizeof(RegionHeader) == 64U,
+              "The region header must take a cache line");
+
+/// A table slot. The key is claimed first, then the other fields are
+/// written, and the entry is published by setting the ready flag
+struct StatusSlot final {
+  /// The hash of the path; kEmptySlot while the slot is free
+  std::uint64_t key;
+
+  /// Not zero once the slot can be read
+  std::uint32_t ready;
+
+  /// The size of the path, in bytes
+  std::uint32_t path_size;
+
+  /// Where the path starts in the arena
+  std::uint64_t path_offset;
+
+  /// Zero for existing paths, otherwise the std::errc value of the error
+  std::uint32_t error;
+
+  /// The llvm::sys::fs::file_type value
+  std::uint16_t type;
+
+  /// The llvm::sys::fs::perms value
+  std::uint16_t permissions;
+
+  /// The device, from the unique id
+  std::uint64_t device;
+
+  /// The file, from the unique id
+  std::uint64_t file;
+
+  /// The modification time, in nanoseconds since the epoch
+  std::int64_t modification_time;
+
+  /// The file size, in bytes
+  std::uint64_t size;
+
+  /// The owner
+  std::uint32_t user;
+
+  /// The group
+  std::uint32_t group;
+};
+
+static_assert(sizeof(StatusSlot) == 72U, "Unexpected StatusSlot size");
+
+/// Returns the size of the region, in bytes
+constexpr std::uint64_t getRegionSize() {
+  return sizeof(RegionHeader) + kSlotCount * sizeof(StatusSlot) + kArenaSize;
+}
+
+/// Returns the key of the given path, which is never the one of the empty
+/// slots
+std::uint64_t getPathKey(const std::string &path) {
+  auto key = hashBuffer(path.data(), path.size());
+  return (key == kEmptySlot) ? 1U : key;
+}
+
+/// Mixes the bits of the given key, so that its low bits can be used as an
+/// index
+std::uint64_t mixKey(std::uint64_t key) {
+  key ^= key >> 30U;
+  key *= 0xBF58476D1CE4E5B9ULL;
+  key ^= key >> 27U;
+  key *= 0x94D049BB133111EBULL;
+  key ^= key >> 31U;
+  return key;
+}
+}  // namespace
+
+/// Private class data
+struct SharedStatusTable::PrivateData final {
+  /// The shared memory region
+  void *mapping{nullptr};
+
+  /// The header, at the start of the region
+  RegionHeader *header{nullptr};
+
+  /// The table, after the header
+  StatusSlot *slot_list{nullptr};
+
+  /// The path arena, after the table
+  char *arena{nullptr};
+};
+
+SharedStatusTable::SharedStatusTable() : d(new PrivateData) {
+  // Anonymous pages are zero filled, so the table starts empty
+  d->mapping = mmap(nullptr, getRegionSize(), PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+  if (d->mapping == MAP_FAILED) {
+    d->mapping = nullptr;
+    throw Status(false, StatusCode::MappingError,
+                 "Failed to map the shared status table");
+  }
+
+  d->header = static_cast<RegionHeader *>(d->mapping);
+  d->slot_list = reinterpret_cast<StatusSlot *>(d->header + 1);
+  d->arena = reinterpret_cast<char *>(d->slot_list + kSlotCount);
+}
+
+SharedStatusTable::Status SharedStatusTable::create(
+    SharedStatusTableRef &obj) {
+  obj.reset();
+
+  try {
+    auto ptr = new SharedStatusTable();
+    obj.reset(ptr);
+
+    return Status(true);
+
+  } catch (const std::bad_alloc &) {
+    return Status(false, StatusCode::MemoryAllocationFailure);
+
+  } catch (const Status &status) {
+    return status;
+  }
+}
+
+SharedStatusTable::~SharedStatusTable() {
+  if (d->mapping != nullptr) {
+    munmap(d->mapping, getRegionSize());
+  }
+}
+
+bool SharedStatusTable::lookup(llvm::ErrorOr<VirtualFileStatus> &status,
+                               const std::string &path) const {
+  auto key = getPathKey(path);
+  auto mixed_key = mixKey(key);
+
+  for (std::uint64_t i = 0U; i < kMaxProbeLength; ++i) {
+    const auto &slot = d->slot_list[(mixed_key + i) % kSlotCount];
+
+    auto slot_key = __atomic_load_n(&slot.key, __ATOMIC_ACQUIRE);
+    if (slot_key == kEmptySlot) {
+      return false;
+
+    } else if (slot_key != key) {
+      continue;
+    }
+
+    // A slot that is still being written is skipped; the path is then
+    // looked up again by the caller
+    if (__atomic_load_n(&slot.ready, __ATOMIC_ACQUIRE) == 0U ||
+        slot.path_size != path.size() ||
+        std::memcmp(d->arena + slot.path_offset, path.data(), path.size()) !=
+            0) {
+      continue;
+    }
+
+    if (slot.error != 0U) {
+      status = std::make_error_code(static_cast<std::errc>(slot.error));
+      return true;
+    }
+
+    status = VirtualFileStatus(
+        path, llvm::sys::fs::UniqueID(slot.device, slot.file),
+        llvm::sys::TimePoint<>(
+            std::chrono::nanoseconds(slot.modification_time)),
+        slot.user, slot.group, slot.size,
+        static_cast<llvm::sys::fs::file_type>(slot.type),
+        static_cast<llvm::sys::fs::perms>(slot.permissions));
+
+    return true;
+  }
+
+  return false;
+}
+
+void SharedStatusTable::insert(const llvm::ErrorOr<VirtualFileStatus> &status,
+                               const std::string &path) {
+  if (__atomic_load_n(&d->header->saturated, __ATOMIC_ACQUIRE) != 0U) {
+    return;
+  }
+
+  auto key = getPathKey(path);
+  auto mixed_key = mixKey(key);
+
+  StatusSlot *slot = nullptr;
+  for (std::uint64_t i = 0U; i < kMaxProbeLength; ++i) {
+    auto &current_slot = d->slot_list[(mixed_key + i) % kSlotCount];
+
+    auto expected = kEmptySlot;
+    if (__atomic_compare_exchange_n(&current_slot.key, &expected, key, false,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      slot = &current_slot;
+      break;
+    }
+
+    // Another process may publish the same path in the meantime; the
+    // lookups return the first copy
+    if (expected == key &&
+        __atomic_load_n(&current_slot.ready, __ATOMIC_ACQUIRE) != 0U &&
+        current_slot.path_size == path.size() &&
+        std::memcmp(d->arena + current_slot.path_offset, path.data(),
+                    path.size()) == 0) {
+      return;
+    }
+  }
+
+  // A claimed slot that is never published only makes the lookups of its
+  // key go on to the next slots
+  auto path_offset =
+      (slot != nullptr)
+          ? __atomic_fetch_add(&d->header->arena_size, path.size(),
+                               __ATOMIC_ACQ_REL)
+          : kArenaSize;
+
+  if (slot == nullptr || path_offset + path.size() > kArenaSize) {
+    __atomic_store_n(&d->header->saturated, 1U, __ATOMIC_RELEASE);
+    return;
+  }
+
+  std::memcpy(d->arena + path_offset, path.data(), path.size());
+  slot->path_offset = path_offset;
+  slot->path_size = static_cast<std::uint32_t>(path.size());
+
+  if (!status) {
+    slot->error = static_cast<std::uint32_t>(status.getError().value());
+
+  } else {
+    const auto &file_status = status.get();
+
+    slot->error = 0U;
+    slot->type = static_cast<std::uint16_t>(file_status.getType());
+    slot->permissions =
+        static_cast<std::uint16_t>(file_status.getPermissions());
+    slot->device = file_status.getUniqueID().getDevice();
+    slot->file = file_status.getUniqueID().getFile();
+    slot->modification_time =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            file_status.getLastModificationTime().time_since_epoch())
+            .count();
+    slot->size = file_status.getSize();
+    slot->user = file_status.getUser();
+    slot->group = file_status.getGroup();
+  }
+
+  __atomic_store_n(&slot->ready, 1U, __ATOMIC_RELEASE);
+
+  auto entry_count =
+      __atomic_add_fetch(&d->header->entry_count, 1U, __ATOMIC_ACQ_REL);
+
+  if (entry_count > (kSlotCount / 4U) * 3U) {
+    __atomic_store_n(&d->header->saturated, 1U, __ATOMIC_RELEASE);
+  }
+}
+
+std::uint64_t SharedStatusTable::entryCount() const {
+  return __atomic_load_n(&d->header->entry_count, __ATOMIC_ACQUIRE);
+}
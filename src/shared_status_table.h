@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "istatus.h"
+#include "virtual_file_system.h"
+
+#include <llvm/Support/ErrorOr.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+class SharedStatusTable;
+
+/// A reference to a SharedStatusTable object
+using SharedStatusTableRef = std::unique_ptr<SharedStatusTable>;
+
+/// The SharedStatusTable keeps the outcome of the stat() calls in an
+/// anonymous shared memory region, which is inherited by the processes
+/// forked after it has been created; each of them sees the entries added by
+/// the others. The region holds an open addressing table of fixed-size
+/// slots, claimed and published with atomic operations, followed by an
+/// append-only arena with the paths. Entries are never modified once
+/// published; when the table or the arena is full, new entries are dropped
+class SharedStatusTable final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+  /// Private constructor; use ::create() instead
+  SharedStatusTable();
+
+ public:
+  /// Status code, used with SharedStatusTable::Status
+  enum class StatusCode { MemoryAllocationFailure, MappingError, Unknown };
+
+  /// Status object
+  using Status = IStatus<StatusCode>;
+
+  /// Creates a new, empty table
+  static Status create(SharedStatusTableRef &obj);
+
+  /// Destructor
+  ~SharedStatusTable();
+
+  /// Returns true if the status of the given path has been published by
+  /// any of the processes sharing the table; missing paths are returned as
+  /// errors. This method is thread safe
+  bool lookup(llvm::ErrorOr<VirtualFileStatus> &status,
+              const std::string &path) const;
+
+  /// Publishes the status of the given path; errors other than missing
+  /// paths must not be passed. This method is thread safe
+  void insert(const llvm::ErrorOr<VirtualFileStatus> &status,
+              const std::string &path);
+
+  /// Returns the amount of entries published by all the processes
+  std::uint64_t entryCount() const;
+
+  /// Disable the copy constructor
+  SharedStatusTable(const SharedStatusTable &other) = delete;
+
+  /// Disable the assignment operator
+  SharedStatusTable &operator=(const SharedStatusTable &other) = delete;
+};
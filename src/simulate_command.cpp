@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+#include "probe_simulator.h"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+/// Handler for the 'simulate' command
+bool simulateCommandHandler(ProfileManagerRef &profile_manager,
+                            const LanguageManager &language_manager,
+                            const CommandLineOptions &cmdline_options) {
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+
+  ProbeLog probe_log;
+  if (!readProbeLog(probe_log, cmdline_options.probe_log_path)) {
+    std::cerr << "Failed to read the probe log: "
+              << cmdline_options.probe_log_path << "\n";
+    return false;
+  }
+
+  std::size_t cached_record_count = 0U;
+  double recorded_cpu_time = 0.0;
+
+  for (const auto &record : probe_log.record_list) {
+    if (record.cached) {
+      ++cached_record_count;
+    } else {
+      recorded_cpu_time += record.wall_time;
+    }
+  }
+
+  ProbeSimulator probe_simulator(probe_log);
+
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(3);
+
+  output << "Probe log: " << probe_log.header_list.size() << " headers, "
+         << probe_log.record_list.size() << " probes ("
+         << cached_record_count << " from the probe cache), "
+         << probe_simulator.modeledDirectiveCount()
+         << " include directives with a recorded outcome\n\n";
+
+  output << "Recorded run (" << probe_log.probe_strategy << ", "
+         << probe_log.worker_count << " jobs): "
+         << probe_log.record_list.size() - cached_record_count
+         << " compilations, " << recorded_cpu_time << "s compiling, "
+         << probe_log.elapsed_time << "s elapsed\n\n";
+
+  ProbeSimulationSettings settings;
+  settings.header_order = cmdline_options.simulated_header_order;
+  settings.worker_count = (cmdline_options.simulated_jobs != 0U)
+                              ? cmdline_options.simulated_jobs
+                              : probe_log.worker_count;
+  settings.batch_size = cmdline_options.batch_size;
+
+  output << "Projected runs (header order: " << settings.header_order
+         << ", " << settings.worker_count << " jobs, batch size "
+         << settings.batch_size << ")\n\n";
+
+  output << "  Strategy      Compilations  Accepted  CPU (s)  Wall (s)\n";
+
+  for (const auto &probe_strategy : {"sequential", "batch", "attribute"}) {
+    settings.probe_strategy = probe_strategy;
+
+    ProbeSimulationResult result;
+    if (!probe_simulator.simulate(result, settings)) {
+      std::cerr << "Invalid simulation settings\n";
+      return false;
+    }
+
+    output << "  " << std::left << std::setw(12) << probe_strategy
+           << std::right << std::setw(14) << result.compile_count
+           << std::setw(10) << result.accepted_header_count << std::setw(9)
+           << result.cpu_time << std::setw(10) << result.wall_time << "\n";
+  }
+
+  // Only the sequential strategy uses more than one worker
+  output << "\nThe batch and attribute strategies compile on a single "
+            "thread\n";
+
+  std::cout << output.str();
+  return true;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "socket_io.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+bool writeSocket(int socket_descriptor, const char *buffer, std::size_t size) {
+#if defined(__unix__) || defined(__APPLE__)
+  // The platforms without MSG_NOSIGNAL set the option on the socket instead
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+  int no_sigpipe = 1;
+  setsockopt(socket_descriptor, SOL_SOCKET, SO_NOSIGPIPE, &no_sigpipe,
+             sizeof(no_sigpipe));
+#endif
+
+  std::size_t offset = 0U;
+
+  while (offset < size) {
+#if defined(MSG_NOSIGNAL)
+    auto written_size = send(socket_descriptor, buffer + offset,
+                             size - offset, MSG_NOSIGNAL);
+#else
+    auto written_size =
+        ::write(socket_descriptor, buffer + offset, size - offset);
+#endif
+
+    if (written_size <= 0) {
+      return false;
+    }
+
+    offset += static_cast<std::size_t>(written_size);
+  }
+
+  return true;
+
+#else
+  static_cast<void>(socket_descriptor);
+  static_cast<void>(buffer);
+  return size == 0U;
+#endif
+}
+
+bool writeSocket(int socket_descriptor, const std::string &buffer) {
+  return writeSocket(socket_descriptor, buffer.data(), buffer.size());
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/// Writes the whole buffer to the given socket. A peer that has closed the
+/// connection makes the call fail instead of raising a SIGPIPE, which would
+/// terminate the process. Returns false on error; the amount of bytes sent
+/// is then unknown
+bool writeSocket(int socket_descriptor, const char *buffer, std::size_t size);
+
+/// Writes the whole buffer to the given socket; see the other overload
+bool writeSocket(int socket_descriptor, const std::string &buffer);
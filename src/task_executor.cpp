@@ -0,0 +1,428 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "task_executor.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+/// How many priority levels the queues have
+const std::size_t kTaskPriorityCount = 3U;
+
+/// The budget set with setTaskThreadBudget()
+std::atomic_size_t task_thread_budget{0U};
+
+struct TaskGroupState;
+
+/// A queued task; it is started either by an executor thread or by the
+/// thread waiting for its group, whichever takes it first
+struct QueuedTask final {
+  /// The task itself
+  std::function<void()> callback;
+
+  /// The group; only used by the thread that has taken the task
+  TaskGroupState *group{nullptr};
+
+  /// Set by the thread that takes the task
+  std::atomic_bool taken{false};
+};
+
+/// A reference to a QueuedTask object
+using QueuedTaskRef = std::shared_ptr<QueuedTask>;
+
+/// The state shared by the tasks of a group
+struct TaskGroupState final {
+  /// Protects the members below
+  std::mutex mutex;
+
+  /// Signaled when a task is done
+  std::condition_variable condition;
+
+  /// How many tasks have been queued and are not done yet
+  std::size_t pending_task_count{0U};
+
+  /// The first exception thrown by a task
+  std::exception_ptr exception;
+};
+
+/// Runs a task that has just been taken, then updates its group
+void runQueuedTask(QueuedTask &task) {
+  auto &group = *task.group;
+
+  std::exception_ptr exception;
+
+  try {
+    task.callback();
+  } catch (...) {
+    exception = std::current_exception();
+  }
+
+  task.callback = nullptr;
+
+  // The group can be destroyed as soon as the count reaches zero, so it is
+  // signaled with the lock held
+  std::lock_guard<std::mutex> lock(group.mutex);
+  if (exception && !group.exception) {
+    group.exception = exception;
+  }
+
+  --group.pending_task_count;
+  group.condition.notify_all();
+}
+
+/// The tasks queued on one executor thread, or from outside the executor
+struct TaskQueue final {
+  /// Protects the queues
+  std::mutex mutex;
+
+  /// One queue for each priority level
+  std::deque<QueuedTaskRef> queue_list[kTaskPriorityCount];
+};
+
+/// The executor threads; each one has its own queue, and steals from the
+/// others when it is empty. Destroying the executor stops its threads
+class TaskExecutor final {
+  /// One queue for each thread
+  std::vector<std::unique_ptr<TaskQueue>> thread_queue_list;
+
+  /// The threads, joined by the destructor
+  std::vector<std::thread> thread_list;
+
+  /// The tasks queued from outside the executor
+  TaskQueue shared_queue;
+
+  /// Protects the sleeping threads
+  std::mutex sleep_mutex;
+
+  /// Signaled when a task is queued
+  std::condition_variable sleep_condition;
+
+  /// How many tasks are in the queues, including the ones that have already
+  /// been taken by the thread waiting for their group
+  std::size_t queued_task_count{0U};
+
+  /// Set by the destructor; the threads exit once the queues are empty
+  bool stopping{false};
+
+  /// The index of the executor thread running this code, if any
+  static thread_local std::size_t current_thread_index;
+
+  /// Takes the most urgent task, preferring the most recent one of this
+  /// thread's queue, then the oldest shared one, then the oldest one of the
+  /// other threads
+  QueuedTaskRef nextTask(std::size_t thread_index) {
+    auto thread_count = thread_queue_list.size();
+
+    for (std::size_t priority = 0U; priority < kTaskPriorityCount;
+         ++priority) {
+      {
+        auto &thread_queue = *thread_queue_list[thread_index];
+        std::lock_guard<std::mutex> lock(thread_queue.mutex);
+
+        auto &queue = thread_queue.queue_list[priority];
+        if (!queue.empty()) {
+          auto task = std::move(queue.back());
+          queue.pop_back();
+          return task;
+        }
+      }
+
+      for (std::size_t i = 0U; i <= thread_count; ++i) {
+        auto &victim_queue =
+            (i == 0U) ? shared_queue
+                      : *thread_queue_list[(thread_index + i) % thread_count];
+
+        std::lock_guard<std::mutex> lock(victim_queue.mutex);
+
+        auto &queue = victim_queue.queue_list[priority];
+        if (!queue.empty()) {
+          auto task = std::move(queue.front());
+          queue.pop_front();
+          return task;
+        }
+      }
+    }
+
+    return nullptr;
+  }
+
+  /// The loop of each executor thread
+  void threadMain(std::size_t thread_index) {
+    current_thread_index = thread_index;
+
+    while (true) {
+      auto task = nextTask(thread_index);
+
+      if (!task) {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        sleep_condition.wait(lock, [this]() -> bool {
+          return queued_task_count > 0U || stopping;
+        });
+
+        // The queues are empty; the tasks queued from now on are run by
+        // the threads waiting for their groups
+        if (stopping) {
+          return;
+        }
+
+        continue;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        --queued_task_count;
+      }
+
+      if (!task->taken.exchange(true)) {
+        runQueuedTask(*task);
+      }
+    }
+  }
+
+ public:
+  /// Constructor; starts the given amount of threads
+  TaskExecutor(std::size_t thread_count) {
+    for (std::size_t i = 0U; i < thread_count; ++i) {
+      thread_queue_list.emplace_back(new TaskQueue);
+    }
+
+    for (std::size_t i = 0U; i < thread_count; ++i) {
+      thread_list.emplace_back(&TaskExecutor::threadMain, this, i);
+    }
+  }
+
+  /// Destructor; waits for the threads to finish the tasks they have taken
+  ~TaskExecutor() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      stopping = true;
+    }
+
+    sleep_condition.notify_all();
+
+    for (auto &thread : thread_list) {
+      thread.join();
+    }
+  }
+
+  /// Returns true if the calling thread is one of the executor threads
+  static bool insideExecutor() {
+    return current_thread_index != std::numeric_limits<std::size_t>::max();
+  }
+
+  /// Disable the copy constructor
+  TaskExecutor(const TaskExecutor &other) = delete;
+
+  /// Disable the assignment operator
+  TaskExecutor &operator=(const TaskExecutor &other) = delete;
+
+  /// Returns true if the executor has no threads; queued tasks are then
+  /// only run by the threads waiting for them
+  bool empty() const { return thread_queue_list.empty(); }
+
+  /// Queues a task; the tasks queued by an executor thread go to its own
+  /// queue
+  void queue(QueuedTaskRef task, TaskPriority priority) {
+    auto &task_queue = (current_thread_index < thread_queue_list.size())
+                           ? *thread_queue_list[current_thread_index]
+                           : shared_queue;
+
+    {
+      std::lock_guard<std::mutex> lock(task_queue.mutex);
+      task_queue.queue_list[static_cast<std::size_t>(priority)].push_back(
+          std::move(task));
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex);
+      ++queued_task_count;
+    }
+
+    sleep_condition.notify_one();
+  }
+};
+
+thread_local std::size_t TaskExecutor::current_thread_index{
+    std::numeric_limits<std::size_t>::max()};
+
+/// A reference to a TaskExecutor object
+using TaskExecutorRef = std::shared_ptr<TaskExecutor>;
+
+/// Protects the process-wide executor
+std::mutex task_executor_mutex;
+
+/// The process-wide executor, if it is running. It is never destroyed on
+/// exit, since its threads may still be sleeping when the process exits
+TaskExecutorRef *task_executor = new TaskExecutorRef;
+
+/// Returns the process-wide executor, starting it if needed; the calling
+/// thread is part of the budget, so the executor starts one thread less
+TaskExecutorRef getTaskExecutor() {
+  std::lock_guard<std::mutex> lock(task_executor_mutex);
+
+  auto &executor = *task_executor;
+  if (!executor) {
+    executor = std::make_shared<TaskExecutor>(getTaskThreadBudget() - 1U);
+  }
+
+  return executor;
+}
+}  // namespace
+
+void setTaskThreadBudget(std::size_t thread_budget) {
+  task_thread_budget = thread_budget;
+}
+
+std::size_t getTaskThreadBudget() {
+  auto thread_budget = task_thread_budget.load();
+  if (thread_budget == 0U) {
+    thread_budget = std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  return thread_budget;
+}
+
+bool stopTaskExecutor() {
+  if (TaskExecutor::insideExecutor()) {
+    return false;
+  }
+
+  TaskExecutorRef executor;
+
+  {
+    std::lock_guard<std::mutex> lock(task_executor_mutex);
+    std::swap(executor, *task_executor);
+  }
+
+  // The groups queuing a task right now still hold a reference; the threads
+  // must be joined here, since the last reference may be dropped by one of
+  // them
+  while (executor && executor.use_count() > 1) {
+    std::this_thread::yield();
+  }
+
+  executor.reset();
+  return true;
+}
+
+/// Private class data
+struct TaskGroup::PrivateData final {
+  /// The state shared with the tasks
+  TaskGroupState state;
+
+  /// The tasks queued since the last wait
+  std::vector<QueuedTaskRef> task_list;
+};
+
+TaskGroup::TaskGroup() : d(new PrivateData) {}
+
+TaskGroup::~TaskGroup() {
+  try {
+    wait();
+  } catch (...) {
+  }
+}
+
+void TaskGroup::run(std::function<void()> task, TaskPriority priority) {
+  auto queued_task = std::make_shared<QueuedTask>();
+  queued_task->callback = std::move(task);
+  queued_task->group = &d->state;
+
+  {
+    std::lock_guard<std::mutex> lock(d->state.mutex);
+    ++d->state.pending_task_count;
+  }
+
+  d->task_list.push_back(queued_task);
+
+  auto executor = getTaskExecutor();
+  if (!executor->empty()) {
+    executor->queue(std::move(queued_task), priority);
+  }
+}
+
+void TaskGroup::wait() {
+  for (const auto &task : d->task_list) {
+    if (!task->taken.exchange(true)) {
+      runQueuedTask(*task);
+    }
+  }
+
+  d->task_list.clear();
+
+  std::exception_ptr exception;
+
+  {
+    std::unique_lock<std::mutex> lock(d->state.mutex);
+    d->state.condition.wait(
+        lock, [this]() -> bool { return d->state.pending_task_count == 0U; });
+
+    std::swap(exception, d->state.exception);
+  }
+
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+void TaskGroup::cancel() {
+  for (const auto &task : d->task_list) {
+    if (task->taken.exchange(true)) {
+      continue;
+    }
+
+    task->callback = nullptr;
+
+    std::lock_guard<std::mutex> lock(d->state.mutex);
+    --d->state.pending_task_count;
+  }
+
+  wait();
+}
+
+void runTaskLanes(std::size_t lane_count, TaskPriority priority,
+                  const std::function<void(std::size_t)> &lane_callback) {
+  TaskGroup task_group;
+  for (std::size_t i = 1U; i < lane_count; ++i) {
+    task_group.run([&lane_callback, i]() { lane_callback(i); }, priority);
+  }
+
+  lane_callback(0U);
+
+  task_group.wait();
+}
+
+void runParallelFor(std::size_t item_count, std::size_t lane_count,
+                    TaskPriority priority,
+                    const std::function<void(std::size_t)> &callback) {
+  std::atomic_size_t next_index{0U};
+
+  auto L_lane = [&](std::size_t) {
+    for (auto index = next_index++; index < item_count; index = next_index++) {
+      callback(index);
+    }
+  };
+
+  runTaskLanes(std::min(lane_count, item_count), priority, L_lane);
+}
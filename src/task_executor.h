@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+/// The priority of a task queued on the executor; idle threads always take
+/// the most urgent task first
+enum class TaskPriority : std::uint8_t { High, Normal, Low };
+
+/// Sets how many threads the parallel stages can use at the same time,
+/// counting the threads that wait for their tasks; zero means one thread
+/// for each core. The executor is started by the first queued task, and
+/// keeps the budget it has been started with until it is stopped
+void setTaskThreadBudget(std::size_t thread_budget);
+
+/// Returns how many threads the parallel stages can use at the same time
+std::size_t getTaskThreadBudget();
+
+/// Stops the executor threads, waiting for them to finish the tasks they
+/// have taken; the tasks still queued are run by the threads waiting for
+/// their groups, and the next queued task starts the executor again. Used
+/// before forking, which is only safe in a single-threaded process. Returns
+/// false if called from an executor thread, which can't stop itself
+bool stopTaskExecutor();
+
+/// A TaskGroup queues tasks on the process-wide executor, which all the
+/// parallel stages share: its threads prefer the tasks they have queued
+/// themselves, and steal from the other threads when they run out. Waiting
+/// for the group runs the tasks that no thread has taken yet on the calling
+/// thread, so stages can queue tasks from inside other tasks without ever
+/// waiting for a thread to become available
+class TaskGroup final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor
+  TaskGroup();
+
+  /// Destructor; waits for the queued tasks, without rethrowing their
+  /// exceptions
+  ~TaskGroup();
+
+  /// Queues the given task
+  void run(std::function<void()> task,
+           TaskPriority priority = TaskPriority::Normal);
+
+  /// Waits until all the queued tasks are done; the first exception thrown
+  /// by a task is rethrown here
+  void wait();
+
+  /// Drops the tasks that have not started yet, then waits for the others
+  void cancel();
+
+  /// Disable the copy constructor
+  TaskGroup(const TaskGroup &other) = delete;
+
+  /// Disable the assignment operator
+  TaskGroup &operator=(const TaskGroup &other) = delete;
+};
+
+/// Calls the given callback once for each lane, passing the lane index; there
+/// is always at least one lane. Lane zero runs on the calling thread, the
+/// other ones on the executor; returns once all of them are done
+void runTaskLanes(std::size_t lane_count, TaskPriority priority,
+                  const std::function<void(std::size_t)> &lane_callback);
+
+/// Calls the given callback once for each index below the item count, from
+/// up to lane_count lanes (see runTaskLanes)
+void runParallelFor(std::size_t item_count, std::size_t lane_count,
+                    TaskPriority priority,
+                    const std::function<void(std::size_t)> &callback);
@@ -0,0 +1,871 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "time_report.h"
+
+#include <algorithm>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <json11.hpp>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if LLVM_MAJOR_VERSION >= 10
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#endif
+
+namespace {
+#if LLVM_MAJOR_VERSION >= 10
+/// Events shorter than this (in microseconds) are not recorded by the clang
+/// time trace; this matches the -ftime-trace-granularity default
+const unsigned kClangTimeTraceGranularity = 500U;
+#endif
+
+/// The names of the hardware counters, indexed by HardwareCounter
+const std::array<const char *, kHardwareCounterCount> kHardwareCounterNames = {
+    "cycles", "instructions", "llc_misses", "page_faults", "dtlb_misses"};
+
+#if defined(__linux__)
+/// Opens a perf_event counter for the calling thread; when inherited, the
+/// threads it spawns from now on are counted too. Returns -1 on error
+int openPerfEventCounter(std::uint32_t type, std::uint64_t config,
+                         bool inherit) {
+  perf_event_attr attributes = {};
+  attributes.size = sizeof(attributes);
+  attributes.type = type;
+  attributes.config = config;
+  attributes.inherit = inherit ? 1U : 0U;
+
+  // The hardware events are restricted to user space, which is what the
+  // default perf_event_paranoid setting allows
+  if (type == PERF_TYPE_HARDWARE || type == PERF_TYPE_HW_CACHE) {
+    attributes.exclude_kernel = 1U;
+    attributes.exclude_hv = 1U;
+  }
+
+  auto descriptor = syscall(SYS_perf_event_open, &attributes, 0, -1, -1,
+                            PERF_FLAG_FD_CLOEXEC);
+
+  return static_cast<int>(descriptor);
+}
+#endif
+
+/// Converts the given interval to microseconds, the unit used by the trace
+/// event format
+double toMicroseconds(std::chrono::steady_clock::duration interval) {
+  return std::chrono::duration<double, std::micro>(interval).count();
+}
+
+/// Returns the CPU time consumed so far, in seconds
+double getCPUTime(CPUTimeScope cpu_time_scope) {
+#if defined(CLOCK_THREAD_CPUTIME_ID) && defined(CLOCK_PROCESS_CPUTIME_ID)
+  auto clock_id = (cpu_time_scope == CPUTimeScope::Thread)
+                      ? CLOCK_THREAD_CPUTIME_ID
+                      : CLOCK_PROCESS_CPUTIME_ID;
+
+  timespec time_spec = {};
+  if (clock_gettime(clock_id, &time_spec) != 0) {
+    return 0.0;
+  }
+
+  return static_cast<double>(time_spec.tv_sec) +
+         static_cast<double>(time_spec.tv_nsec) / 1000000000.0;
+
+#else
+  // Only the process time is available
+  static_cast<void>(cpu_time_scope);
+  return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+}
+}  // namespace
+
+Stopwatch::Stopwatch(CPUTimeScope cpu_time_scope)
+    : cpu_time_scope(cpu_time_scope),
+      wall_start(std::chrono::steady_clock::now()),
+      cpu_start(getCPUTime(cpu_time_scope)) {}
+
+TimeSample Stopwatch::elapsed() const {
+  TimeSample time_sample;
+
+  time_sample.wall_time = std::chrono::duration<double>(
+                              std::chrono::steady_clock::now() - wall_start)
+                              .count();
+
+  time_sample.cpu_time = getCPUTime(cpu_time_scope) - cpu_start;
+  return time_sample;
+}
+
+std::chrono::steady_clock::time_point Stopwatch::startTime() const {
+  return wall_start;
+}
+
+HardwareCounterSet::HardwareCounterSet(CPUTimeScope cpu_time_scope) {
+  descriptor_list.fill(-1);
+
+#if defined(__linux__)
+  auto inherit = (cpu_time_scope == CPUTimeScope::Process);
+
+  descriptor_list[static_cast<std::size_t>(HardwareCounter::Cycles)] =
+      openPerfEventCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,
+                           inherit);
+
+  descriptor_list[static_cast<std::size_t>(HardwareCounter::Instructions)] =
+      openPerfEventCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,
+                           inherit);
+
+  descriptor_list[static_cast<std::size_t>(HardwareCounter::LLCMisses)] =
+      openPerfEventCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,
+                           inherit);
+
+  descriptor_list[static_cast<std::size_t>(HardwareCounter::PageFaults)] =
+      openPerfEventCounter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,
+                           inherit);
+
+  descriptor_list[static_cast<std::size_t>(HardwareCounter::DTLBMisses)] =
+      openPerfEventCounter(PERF_TYPE_HW_CACHE,
+                           PERF_COUNT_HW_CACHE_DTLB |
+                               (PERF_COUNT_HW_CACHE_OP_READ << 8U) |
+                               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16U),
+                           inherit);
+
+#else
+  static_cast<void>(cpu_time_scope);
+#endif
+}
+
+HardwareCounterSet::~HardwareCounterSet() {
+#if defined(__linux__)
+  for (auto descriptor : descriptor_list) {
+    if (descriptor != -1) {
+      close(descriptor);
+    }
+  }
+#endif
+}
+
+HardwareCounterSample HardwareCounterSet::read() const {
+  HardwareCounterSample sample;
+
+#if defined(__linux__)
+  for (std::size_t i = 0U; i < kHardwareCounterCount; ++i) {
+    if (descriptor_list[i] == -1) {
+      continue;
+    }
+
+    std::uint64_t value = 0U;
+    if (::read(descriptor_list[i], &value, sizeof(value)) !=
+        static_cast<ssize_t>(sizeof(value))) {
+      continue;
+    }
+
+    sample.value_list[i] = value;
+    sample.available_list[i] = true;
+  }
+#endif
+
+  return sample;
+}
+
+std::size_t getPeakResidentMemory() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage resource_usage = {};
+  if (getrusage(RUSAGE_SELF, &resource_usage) != 0) {
+    return 0U;
+  }
+
+  auto peak_resident_memory =
+      static_cast<std::size_t>(resource_usage.ru_maxrss);
+
+#if defined(__APPLE__)
+  // macOS reports bytes, while the other systems report kilobytes
+  return peak_resident_memory;
+#else
+  return peak_resident_memory * 1024U;
+#endif
+
+#else
+  return 0U;
+#endif
+}
+
+/// Private class data
+struct TimeReport::PrivateData final {
+  /// Protects the whole structure
+  mutable std::mutex mutex;
+
+  /// A phase of the run
+  struct Phase final {
+    /// The phase name
+    std::string name;
+
+    /// The time spent in the phase
+    TimeSample time_sample;
+
+    /// The highest peak resident memory recorded for the phase, in bytes
+    std::size_t peak_resident_memory{0U};
+
+    /// The hardware events counted during the phase
+    HardwareCounterSample hardware_counters;
+  };
+
+  /// The phases, in the order they have been first recorded
+  std::vector<Phase> phase_list;
+
+  /// True if the phase timers sample the hardware counters
+  bool hardware_counters_enabled{false};
+
+  /// The event stream the phases are reported to, if any
+  EventStreamRef event_stream;
+
+  /// The statistics, in the order they have been first recorded
+  std::vector<std::pair<std::string, std::size_t>> statistic_list;
+
+  /// The probes, in the order they have been recorded
+  std::vector<ProbeTiming> probe_list;
+
+  /// The costs of the final pass, keyed on the header path
+  std::unordered_map<std::string, HeaderCost> header_cost_map;
+
+  /// When the report has been created; span timestamps are relative to it
+  std::chrono::steady_clock::time_point start_time;
+
+  /// The name of each lane
+  std::vector<std::string> lane_name_list;
+
+  /// Maps each thread to its lane
+  std::map<std::thread::id, std::size_t> thread_lane_map;
+
+  /// The recorded spans, along with their lane
+  std::vector<std::pair<std::size_t, TraceSpan>> span_list;
+
+  /// The events imported from the clang time trace, already converted
+  std::vector<json11::Json> clang_event_list;
+
+  /// True while the clang time trace is being collected
+  bool clang_time_trace_active{false};
+
+  /// When the clang time trace has been started
+  std::chrono::steady_clock::time_point clang_time_trace_start_time;
+
+  /// Returns the lane of the calling thread; the mutex must be held
+  std::size_t currentThreadLane();
+};
+
+std::size_t TimeReport::PrivateData::currentThreadLane() {
+  auto insert_status = thread_lane_map.insert(
+      {std::this_thread::get_id(), lane_name_list.size()});
+
+  if (insert_status.second) {
+    auto thread_index = thread_lane_map.size() - 1U;
+    lane_name_list.push_back(thread_index == 0U
+                                 ? "Main thread"
+                                 : "Thread " + std::to_string(thread_index));
+  }
+
+  return insert_status.first->second;
+}
+
+TimeReport::TimeReport() : d(new PrivateData) {
+  // The thread creating the report always gets the first lane
+  d->start_time = std::chrono::steady_clock::now();
+  d->currentThreadLane();
+}
+
+TimeReport::~TimeReport() {}
+
+void TimeReport::addPhase(const std::string &name,
+                          const TimeSample &time_sample,
+                          std::size_t peak_resident_memory,
+                          const HardwareCounterSample *hardware_counters) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  auto phase_it =
+      std::find_if(d->phase_list.begin(), d->phase_list.end(),
+                   [&name](const PrivateData::Phase &phase) -> bool {
+                     return phase.name == name;
+                   });
+
+  if (phase_it == d->phase_list.end()) {
+    phase_it = d->phase_list.insert(d->phase_list.end(), PrivateData::Phase());
+    phase_it->name = name;
+  }
+
+  phase_it->time_sample.wall_time += time_sample.wall_time;
+  phase_it->time_sample.cpu_time += time_sample.cpu_time;
+  phase_it->peak_resident_memory =
+      std::max(phase_it->peak_resident_memory, peak_resident_memory);
+
+  if (hardware_counters != nullptr) {
+    auto &phase_counters = phase_it->hardware_counters;
+
+    for (std::size_t i = 0U; i < kHardwareCounterCount; ++i) {
+      if (hardware_counters->available_list[i]) {
+        phase_counters.value_list[i] += hardware_counters->value_list[i];
+        phase_counters.available_list[i] = true;
+      }
+    }
+  }
+}
+
+void TimeReport::enableHardwareCounters() {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->hardware_counters_enabled = true;
+}
+
+bool TimeReport::hardwareCountersEnabled() const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->hardware_counters_enabled;
+}
+
+void TimeReport::setEventStream(EventStreamRef event_stream) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->event_stream = std::move(event_stream);
+}
+
+EventStreamRef TimeReport::eventStream() const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  return d->event_stream;
+}
+
+void TimeReport::addStatistic(const std::string &name, std::size_t value) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  auto statistic_it =
+      std::find_if(d->statistic_list.begin(), d->statistic_list.end(),
+                   [&name](const std::pair<std::string, std::size_t> &statistic)
+                       -> bool { return statistic.first == name; });
+
+  if (statistic_it == d->statistic_list.end()) {
+    d->statistic_list.push_back({name, value});
+    return;
+  }
+
+  statistic_it->second += value;
+}
+
+void TimeReport::addProbe(ProbeTiming probe_timing) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->probe_list.push_back(std::move(probe_timing));
+}
+
+void TimeReport::addHeaderCost(const std::string &header_path,
+                               const HeaderCost &header_cost) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+  d->header_cost_map[header_path] += header_cost;
+}
+
+void TimeReport::addSpan(TraceSpan trace_span) {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  auto lane = d->currentThreadLane();
+  d->span_list.push_back({lane, std::move(trace_span)});
+}
+
+bool TimeReport::startClangTimeTrace() {
+#if LLVM_MAJOR_VERSION >= 10
+  std::lock_guard<std::mutex> lock(d->mutex);
+  if (d->clang_time_trace_active || llvm::timeTraceProfilerEnabled()) {
+    return false;
+  }
+
+  d->clang_time_trace_active = true;
+  d->clang_time_trace_start_time = std::chrono::steady_clock::now();
+
+#if LLVM_MAJOR_VERSION >= 11
+  llvm::timeTraceProfilerInitialize(kClangTimeTraceGranularity, "abigen");
+#else
+  llvm::timeTraceProfilerInitialize(kClangTimeTraceGranularity);
+#endif
+
+  return true;
+
+#else
+  return false;
+#endif
+}
+
+void TimeReport::stopClangTimeTrace(const std::string &lane_name) {
+#if LLVM_MAJOR_VERSION >= 10
+  std::lock_guard<std::mutex> lock(d->mutex);
+  if (!d->clang_time_trace_active) {
+    return;
+  }
+
+  d->clang_time_trace_active = false;
+
+  llvm::SmallString<0> trace_buffer;
+  llvm::raw_svector_ostream trace_stream(trace_buffer);
+  llvm::timeTraceProfilerWrite(trace_stream);
+  llvm::timeTraceProfilerCleanup();
+
+  std::string error;
+  auto trace = json11::Json::parse(trace_buffer.str().str(), error);
+  if (!error.empty()) {
+    return;
+  }
+
+  auto lane = d->lane_name_list.size();
+  d->lane_name_list.push_back(lane_name);
+
+  // The clang timestamps are relative to the moment the trace was started
+  auto timestamp_offset =
+      toMicroseconds(d->clang_time_trace_start_time - d->start_time);
+
+  for (const auto &event : trace["traceEvents"].array_items()) {
+    // Skip the metadata and the per-name totals, which all start at zero
+    const auto &event_name = event["name"].string_value();
+    if (event["ph"].string_value() != "X" ||
+        event_name.compare(0U, 6U, "Total ") == 0) {
+      continue;
+    }
+
+    auto event_object = event.object_items();
+    event_object["pid"] = 1;
+    event_object["tid"] = static_cast<int>(lane);
+    event_object["ts"] = event["ts"].number_value() + timestamp_offset;
+
+    d->clang_event_list.push_back(json11::Json(event_object));
+  }
+
+#else
+  static_cast<void>(lane_name);
+#endif
+}
+
+bool TimeReport::writeTraceFile(const std::string &path) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  json11::Json::array event_list;
+
+  event_list.push_back(json11::Json::object{
+      {"name", "process_name"},
+      {"ph", "M"},
+      {"pid", 1},
+      {"args", json11::Json::object{{"name", "abigen"}}}});
+
+  for (std::size_t lane = 0U; lane < d->lane_name_list.size(); ++lane) {
+    event_list.push_back(json11::Json::object{
+        {"name", "thread_name"},
+        {"ph", "M"},
+        {"pid", 1},
+        {"tid", static_cast<int>(lane)},
+        {"args", json11::Json::object{{"name", d->lane_name_list[lane]}}}});
+  }
+
+  for (const auto &p : d->span_list) {
+    const auto &trace_span = p.second;
+
+    json11::Json::object argument_object;
+    for (const auto &argument : trace_span.argument_map) {
+      argument_object.insert({argument.first, argument.second});
+    }
+
+    event_list.push_back(json11::Json::object{
+        {"name", trace_span.name},
+        {"cat", trace_span.category},
+        {"ph", "X"},
+        {"pid", 1},
+        {"tid", static_cast<int>(p.first)},
+        {"ts", toMicroseconds(trace_span.start_time - d->start_time)},
+        {"dur", trace_span.duration * 1000000.0},
+        {"args", argument_object}});
+  }
+
+  event_list.insert(event_list.end(), d->clang_event_list.begin(),
+                    d->clang_event_list.end());
+
+  json11::Json trace = json11::Json::object{{"traceEvents", event_list},
+                                            {"displayTimeUnit", "ms"}};
+
+  std::ofstream trace_file(path, std::ios::out | std::ios::trunc);
+  trace_file << trace.dump() << "\n";
+
+  return static_cast<bool>(trace_file);
+}
+
+bool TimeReport::writeMetricsFile(const std::string &path) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  json11::Json::array phase_array;
+  for (const auto &phase : d->phase_list) {
+    json11::Json::object phase_object{
+        {"name", phase.name},
+        {"wall_time", phase.time_sample.wall_time},
+        {"cpu_time", phase.time_sample.cpu_time},
+        {"peak_resident_memory",
+         static_cast<double>(phase.peak_resident_memory)}};
+
+    if (d->hardware_counters_enabled) {
+      json11::Json::object counter_object;
+
+      const auto &hardware_counters = phase.hardware_counters;
+      for (std::size_t i = 0U; i < kHardwareCounterCount; ++i) {
+        if (hardware_counters.available_list[i]) {
+          counter_object.insert(
+              {kHardwareCounterNames[i],
+               static_cast<double>(hardware_counters.value_list[i])});
+        }
+      }
+
+      phase_object.insert({"hardware_counters", counter_object});
+    }
+
+    phase_array.push_back(phase_object);
+  }
+
+  json11::Json::object statistic_object;
+  for (const auto &statistic : d->statistic_list) {
+    statistic_object.insert(
+        {statistic.first, static_cast<double>(statistic.second)});
+  }
+
+  std::size_t accepted_probe_count = 0U;
+  double probe_wall_time = 0.0;
+  FrontendStatistics probe_statistics;
+
+  for (const auto &probe_timing : d->probe_list) {
+    if (probe_timing.succeeded) {
+      ++accepted_probe_count;
+    }
+
+    probe_wall_time += probe_timing.total_time.wall_time;
+    probe_statistics += probe_timing.frontend_statistics;
+  }
+
+  json11::Json::object probe_object{
+      {"count", static_cast<double>(d->probe_list.size())},
+      {"accepted", static_cast<double>(accepted_probe_count)},
+      {"wall_time", probe_wall_time},
+      {"source_bytes", static_cast<double>(probe_statistics.source_bytes)},
+      {"tokens", static_cast<double>(probe_statistics.token_count)},
+      {"declarations",
+       static_cast<double>(probe_statistics.declaration_count)},
+      {"template_instantiations",
+       static_cast<double>(probe_statistics.template_instantiation_count)}};
+
+  json11::Json metrics = json11::Json::object{
+      {"phases", phase_array},
+      {"statistics", statistic_object},
+      {"probes", probe_object},
+      {"peak_resident_memory", static_cast<double>(getPeakResidentMemory())}};
+
+  std::ofstream metrics_file(path, std::ios::out | std::ios::trunc);
+  metrics_file << metrics.dump() << "\n";
+
+  return static_cast<bool>(metrics_file);
+}
+
+void TimeReport::print(std::ostream &stream, std::size_t slowest_probe_count,
+                       std::size_t costliest_header_count) const {
+  std::lock_guard<std::mutex> lock(d->mutex);
+
+  const std::string phase_column_title = "Phase";
+
+  auto phase_column_width = phase_column_title.size();
+  for (const auto &phase : d->phase_list) {
+    phase_column_width = std::max(phase_column_width, phase.name.size());
+  }
+
+  // The table is formatted in a separate buffer, so that the formatting
+  // state of the output stream does not matter and is left untouched
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(3);
+
+  auto L_seconds = [&output](double value, int width) -> std::ostream & {
+    return output << std::right << std::setw(width) << value;
+  };
+
+  auto phase_column_setw = static_cast<int>(phase_column_width);
+
+  auto L_mebibytes = [&output](std::size_t bytes, int width) -> std::ostream & {
+    return output << std::right << std::setw(width)
+                  << static_cast<double>(bytes) / (1024.0 * 1024.0);
+  };
+
+  output << "Time report\n\n";
+  output << "  " << std::left << std::setw(phase_column_setw)
+         << phase_column_title << "    Wall (s)     CPU (s)  Peak RSS (MiB)\n";
+
+  for (const auto &phase : d->phase_list) {
+    output << "  " << std::left << std::setw(phase_column_setw) << phase.name;
+
+    L_seconds(phase.time_sample.wall_time, 12);
+    L_seconds(phase.time_sample.cpu_time, 12);
+    L_mebibytes(phase.peak_resident_memory, 16) << "\n";
+  }
+
+  output << "\n";
+
+  if (d->hardware_counters_enabled) {
+    auto L_counter = [&output](const HardwareCounterSample &sample,
+                               HardwareCounter counter, int width) {
+      auto index = static_cast<std::size_t>(counter);
+
+      output << std::right << std::setw(width);
+      if (sample.available_list[index]) {
+        output << sample.value_list[index];
+      } else {
+        output << "n/a";
+      }
+    };
+
+    output << "Hardware counters\n\n";
+    output << "  " << std::left << std::setw(phase_column_setw)
+           << phase_column_title
+           << "          Cycles    Instructions     IPC      LLC misses"
+              "     Page faults     dTLB misses\n";
+
+    for (const auto &phase : d->phase_list) {
+      const auto &sample = phase.hardware_counters;
+      output << "  " << std::left << std::setw(phase_column_setw)
+             << phase.name;
+
+      L_counter(sample, HardwareCounter::Cycles, 16);
+      L_counter(sample, HardwareCounter::Instructions, 16);
+
+      auto cycles_index = static_cast<std::size_t>(HardwareCounter::Cycles);
+      auto instructions_index =
+          static_cast<std::size_t>(HardwareCounter::Instructions);
+
+      output << std::right << std::setw(8);
+      if (sample.available_list[cycles_index] &&
+          sample.available_list[instructions_index] &&
+          sample.value_list[cycles_index] != 0U) {
+        output << static_cast<double>(sample.value_list[instructions_index]) /
+                      static_cast<double>(sample.value_list[cycles_index]);
+      } else {
+        output << "n/a";
+      }
+
+      L_counter(sample, HardwareCounter::LLCMisses, 16);
+      L_counter(sample, HardwareCounter::PageFaults, 16);
+      L_counter(sample, HardwareCounter::DTLBMisses, 16);
+      output << "\n";
+    }
+
+    output << "\n";
+  }
+
+  if (!d->statistic_list.empty()) {
+    std::size_t statistic_column_width = 0U;
+    for (const auto &statistic : d->statistic_list) {
+      statistic_column_width =
+          std::max(statistic_column_width, statistic.first.size());
+    }
+
+    output << "Memory statistics\n\n";
+
+    for (const auto &statistic : d->statistic_list) {
+      output << "  " << std::left
+             << std::setw(static_cast<int>(statistic_column_width))
+             << statistic.first << std::right << std::setw(16)
+             << statistic.second << "\n";
+    }
+
+    output << "\n";
+  }
+
+  // The headers of the final pass with the highest parse time; the other
+  // columns tell whether the visitor is what makes them expensive
+  if (!d->header_cost_map.empty() && costliest_header_count != 0U) {
+    std::vector<std::pair<std::string, HeaderCost>> header_cost_list(
+        d->header_cost_map.begin(), d->header_cost_map.end());
+
+    auto printed_header_count =
+        std::min(costliest_header_count, header_cost_list.size());
+
+    auto printed_header_end =
+        std::next(header_cost_list.begin(),
+                  static_cast<std::ptrdiff_t>(printed_header_count));
+
+    std::partial_sort(
+        header_cost_list.begin(), printed_header_end, header_cost_list.end(),
+        [](const std::pair<std::string, HeaderCost> &lhs,
+           const std::pair<std::string, HeaderCost> &rhs) -> bool {
+          if (lhs.second.parse_time != rhs.second.parse_time) {
+            return lhs.second.parse_time > rhs.second.parse_time;
+          }
+
+          return lhs.first < rhs.first;
+        });
+
+    output << "Costliest headers of the final pass\n\n";
+    output << "   Parse (s)   AST (MiB)   Functions  Blacklisted  Type nodes"
+              "  Header\n";
+
+    for (auto it = header_cost_list.begin(); it != printed_header_end; ++it) {
+      const auto &header_cost = it->second;
+
+      L_seconds(header_cost.parse_time, 12);
+      L_mebibytes(static_cast<std::size_t>(header_cost.ast_bytes), 12);
+
+      output << std::right << std::setw(12)
+             << header_cost.visited_function_count << std::setw(13)
+             << header_cost.blacklisted_function_count << std::setw(12)
+             << header_cost.type_node_count << "  " << it->first << "\n";
+    }
+
+    output << "\n";
+  }
+
+  if (d->probe_list.empty()) {
+    stream << output.str();
+    return;
+  }
+
+  // Probe totals
+  std::size_t accepted_probe_count = 0U;
+  TimeSample total_probe_time;
+  double total_parse_time = 0.0;
+  FrontendStatistics total_probe_statistics;
+
+  for (const auto &probe_timing : d->probe_list) {
+    if (probe_timing.succeeded) {
+      ++accepted_probe_count;
+    }
+
+    total_probe_time.wall_time += probe_timing.total_time.wall_time;
+    total_probe_time.cpu_time += probe_timing.total_time.cpu_time;
+    total_parse_time += probe_timing.parse_time;
+    total_probe_statistics += probe_timing.frontend_statistics;
+  }
+
+  output << "  Probes: " << d->probe_list.size() << " ("
+         << accepted_probe_count << " accepted, "
+         << d->probe_list.size() - accepted_probe_count << " rejected); ";
+
+  L_seconds(total_probe_time.wall_time, 0) << " s wall, ";
+  L_seconds(total_probe_time.cpu_time, 0) << " s CPU, ";
+  L_seconds(total_parse_time, 0) << " s building the AST\n\n";
+
+  output << "  Probe frontend: " << total_probe_statistics.source_bytes
+         << " source bytes, " << total_probe_statistics.token_count
+         << " tokens, " << total_probe_statistics.declaration_count
+         << " declarations, "
+         << total_probe_statistics.template_instantiation_count
+         << " template instantiations\n\n";
+
+  // The slowest probes, by wall clock time
+  std::vector<std::size_t> probe_index_list(d->probe_list.size());
+  for (std::size_t i = 0U; i < probe_index_list.size(); ++i) {
+    probe_index_list[i] = i;
+  }
+
+  auto printed_probe_count =
+      std::min(slowest_probe_count, probe_index_list.size());
+
+  auto printed_probe_end =
+      std::next(probe_index_list.begin(),
+                static_cast<std::ptrdiff_t>(printed_probe_count));
+
+  std::partial_sort(probe_index_list.begin(), printed_probe_end,
+                    probe_index_list.end(),
+                    [this](std::size_t lhs, std::size_t rhs) -> bool {
+                      return d->probe_list[lhs].total_time.wall_time >
+                             d->probe_list[rhs].total_time.wall_time;
+                    });
+
+  output << "  Slowest probes\n\n";
+  output << "    Wall (s)     CPU (s)   Parse (s)  Outcome   Include "
+            "directive\n";
+
+  for (auto it = probe_index_list.begin(); it != printed_probe_end; ++it) {
+    const auto &probe_timing = d->probe_list[*it];
+
+    L_seconds(probe_timing.total_time.wall_time, 12);
+    L_seconds(probe_timing.total_time.cpu_time, 12);
+    L_seconds(probe_timing.parse_time, 12);
+
+    output << "  " << std::left << std::setw(8)
+           << (probe_timing.succeeded ? "accepted" : "rejected") << "  "
+           << probe_timing.include_directive << "\n";
+  }
+
+  output << "\n";
+  stream << output.str();
+}
+
+ScopedPhaseTimer::ScopedPhaseTimer(const TimeReportRef &report,
+                                   const std::string &phase_name,
+                                   CPUTimeScope cpu_time_scope)
+    : time_report(report.get()),
+      name(phase_name),
+      stopwatch(cpu_time_scope),
+      sample_tag(SampleTag::Phase, phase_name),
+      flight_event(FlightEventType::PhaseStarted, phase_name) {
+  // Reserve the row now, so that nested phases are printed after this one
+  if (time_report != nullptr) {
+    time_report->addPhase(name, TimeSample());
+
+    if (time_report->hardwareCountersEnabled()) {
+      hardware_counters.reset(new HardwareCounterSet(cpu_time_scope));
+    }
+
+    event_stream = time_report->eventStream();
+    if (event_stream) {
+      event_stream->emit("phase_started", {{"phase", name}});
+    }
+  }
+}
+
+ScopedPhaseTimer::~ScopedPhaseTimer() {
+  if (time_report == nullptr) {
+    return;
+  }
+
+  auto time_sample = stopwatch.elapsed();
+
+  if (hardware_counters) {
+    auto hardware_counter_sample = hardware_counters->read();
+    time_report->addPhase(name, time_sample, getPeakResidentMemory(),
+                          &hardware_counter_sample);
+
+  } else {
+    time_report->addPhase(name, time_sample, getPeakResidentMemory());
+  }
+
+  TraceSpan trace_span;
+  trace_span.name = name;
+  trace_span.category = "phase";
+  trace_span.start_time = stopwatch.startTime();
+  trace_span.duration = time_sample.wall_time;
+
+  time_report->addSpan(std::move(trace_span));
+
+  if (event_stream) {
+    event_stream->emit("phase_finished",
+                       {{"phase", name},
+                        {"wall_time", time_sample.wall_time},
+                        {"cpu_time", time_sample.cpu_time}});
+  }
+}
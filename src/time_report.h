@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "event_stream.h"
+#include "flight_recorder.h"
+#include "sample_profiler.h"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/// Wall clock and CPU time, in seconds
+struct TimeSample final {
+  /// Elapsed real time
+  double wall_time{0.0};
+
+  /// Elapsed CPU time
+  double cpu_time{0.0};
+};
+
+/// The CPU time measured by a Stopwatch
+enum class CPUTimeScope {
+  /// All the threads of the process; used for the phases that spawn workers
+  Process,
+
+  /// The calling thread only; used for the work performed by each worker
+  Thread
+};
+
+/// Measures the time elapsed since it has been created
+class Stopwatch final {
+  /// The CPU time being measured
+  CPUTimeScope cpu_time_scope;
+
+  /// The wall clock time at creation
+  std::chrono::steady_clock::time_point wall_start;
+
+  /// The CPU time at creation, in seconds
+  double cpu_start{0.0};
+
+ public:
+  /// Constructor
+  Stopwatch(CPUTimeScope cpu_time_scope = CPUTimeScope::Process);
+
+  /// Returns the time elapsed since the stopwatch has been created
+  TimeSample elapsed() const;
+
+  /// Returns the wall clock time at creation
+  std::chrono::steady_clock::time_point startTime() const;
+};
+
+/// The hardware counters sampled around each phase
+enum class HardwareCounter {
+  /// CPU cycles
+  Cycles,
+
+  /// Retired instructions
+  Instructions,
+
+  /// Last level cache misses
+  LLCMisses,
+
+  /// Page faults, minor and major
+  PageFaults,
+
+  /// Data TLB load misses
+  DTLBMisses
+};
+
+/// How many hardware counters are sampled
+const std::size_t kHardwareCounterCount = 5U;
+
+/// The values read from the hardware counters
+struct HardwareCounterSample final {
+  /// The counter values, indexed by HardwareCounter
+  std::array<std::uint64_t, kHardwareCounterCount> value_list{};
+
+  /// Tells which counters could be opened; the others are always zero
+  std::array<bool, kHardwareCounterCount> available_list{};
+};
+
+/// Counts the hardware events since it has been created, using perf_event on
+/// Linux; the counters are not available on the other platforms, or when the
+/// kernel does not allow them (see perf_event_paranoid). With the process
+/// scope, the threads spawned after the creation are counted as well, once
+/// they have exited
+class HardwareCounterSet final {
+  /// The perf_event file descriptors; -1 for the counters that could not be
+  /// opened
+  std::array<int, kHardwareCounterCount> descriptor_list;
+
+ public:
+  /// Constructor
+  HardwareCounterSet(CPUTimeScope cpu_time_scope = CPUTimeScope::Process);
+
+  /// Destructor
+  ~HardwareCounterSet();
+
+  /// Returns the events counted so far
+  HardwareCounterSample read() const;
+
+  /// Disable the copy constructor
+  HardwareCounterSet(const HardwareCounterSet &other) = delete;
+
+  /// Disable the assignment operator
+  HardwareCounterSet &operator=(const HardwareCounterSet &other) = delete;
+};
+
+/// Returns the peak resident set size of the process, in bytes; zero when
+/// it is not available on this platform
+std::size_t getPeakResidentMemory();
+
+/// The work done by the clang frontend in one or more compilations
+struct FrontendStatistics final {
+  /// The size of the source files and buffers that have been read, in bytes
+  std::uint64_t source_bytes{0U};
+
+  /// The tokens returned by the preprocessor
+  std::uint64_t token_count{0U};
+
+  /// The declarations in the translation unit, including the nested ones
+  std::uint64_t declaration_count{0U};
+
+  /// The template instantiations performed by Sema
+  std::uint64_t template_instantiation_count{0U};
+
+  /// Adds the statistics of another compilation
+  FrontendStatistics &operator+=(const FrontendStatistics &other) {
+    source_bytes += other.source_bytes;
+    token_count += other.token_count;
+    declaration_count += other.declaration_count;
+    template_instantiation_count += other.template_instantiation_count;
+    return *this;
+  }
+};
+
+/// The cost of the final analysis pass attributed to a single header
+struct HeaderCost final {
+  /// The wall clock time spent while the header was the file being read,
+  /// in seconds; the time spent in the headers it includes is not counted
+  double parse_time{0.0};
+
+  /// The AST memory allocated while the header was the file being read, in
+  /// bytes
+  std::uint64_t ast_bytes{0U};
+
+  /// The function declarations of the header visited by the AST visitor
+  std::uint64_t visited_function_count{0U};
+
+  /// The nodes of the type graph that are records or enums defined by the
+  /// header
+  std::uint64_t type_node_count{0U};
+
+  /// The functions of the header that have been blacklisted
+  std::uint64_t blacklisted_function_count{0U};
+
+  /// Adds the costs of another compilation or analysis shard
+  HeaderCost &operator+=(const HeaderCost &other) {
+    parse_time += other.parse_time;
+    ast_bytes += other.ast_bytes;
+    visited_function_count += other.visited_function_count;
+    type_node_count += other.type_node_count;
+    blacklisted_function_count += other.blacklisted_function_count;
+    return *this;
+  }
+};
+
+/// The timing of a single probe compilation
+struct ProbeTiming final {
+  /// The include directives that have been compiled, separated by '|'
+  std::string include_directive;
+
+  /// True if the compilation succeeded
+  bool succeeded{false};
+
+  /// The time spent on the whole probe, measured on the worker thread
+  TimeSample total_time;
+
+  /// The wall clock time spent building the AST, in seconds; zero when the
+  /// probe has been rejected by an earlier tier
+  double parse_time{0.0};
+
+  /// The frontend statistics, summed across the tiers that ran
+  FrontendStatistics frontend_statistics;
+};
+
+/// A span of the trace file
+struct TraceSpan final {
+  /// The span name
+  std::string name;
+
+  /// The span category, used to filter the spans in the trace viewer
+  std::string category;
+
+  /// When the span started
+  std::chrono::steady_clock::time_point start_time;
+
+  /// The span duration, in seconds
+  double duration{0.0};
+
+  /// Additional values shown along with the span
+  std::map<std::string, std::string> argument_map;
+};
+
+class TimeReport;
+
+/// A reference to a TimeReport object
+using TimeReportRef = std::shared_ptr<TimeReport>;
+
+/// The TimeReport collects the time spent in each phase of a run, along with
+/// the timing of each probe, and prints them as a summary table. Phases and
+/// compilations are also recorded as spans, one lane per thread, and can be
+/// saved as a Chrome trace event file. The peak memory usage at the end of
+/// each phase and the memory statistics of the analysis are printed as well,
+/// along with the hardware counters when they have been enabled. All methods
+/// are thread safe
+class TimeReport final {
+  struct PrivateData;
+
+  /// Private class data
+  std::unique_ptr<PrivateData> d;
+
+ public:
+  /// Constructor
+  TimeReport();
+
+  /// Destructor
+  ~TimeReport();
+
+  /// Adds the given time to a phase; phases are printed in the order they
+  /// are first recorded, and the time of repeated phases is summed. The peak
+  /// resident memory is the highest value seen so far, in bytes
+  void addPhase(const std::string &name, const TimeSample &time_sample,
+                std::size_t peak_resident_memory = 0U,
+                const HardwareCounterSample *hardware_counters = nullptr);
+
+  /// Makes the phase timers sample the hardware counters as well
+  void enableHardwareCounters();
+
+  /// Returns true if the phase timers sample the hardware counters
+  bool hardwareCountersEnabled() const;
+
+  /// Makes the phase timers report the start and the end of each phase to
+  /// the given event stream
+  void setEventStream(EventStreamRef event_stream);
+
+  /// Returns the event stream the phases are reported to, if any
+  EventStreamRef eventStream() const;
+
+  /// Adds the given value to a statistic; statistics are printed in the
+  /// order they are first recorded, and repeated values are summed (i.e.:
+  /// once for each analysis shard)
+  void addStatistic(const std::string &name, std::size_t value);
+
+  /// Records the timing of a probe
+  void addProbe(ProbeTiming probe_timing);
+
+  /// Adds the given costs to a header; the costs of each header are summed
+  /// (i.e.: across the analysis shards)
+  void addHeaderCost(const std::string &header_path,
+                     const HeaderCost &header_cost);
+
+  /// Records a span on the lane of the calling thread
+  void addSpan(TraceSpan trace_span);
+
+  /// Starts collecting the time trace of the clang frontend on the calling
+  /// thread; returns false if it is not supported by this LLVM version, or
+  /// if a trace is already being collected
+  bool startClangTimeTrace();
+
+  /// Stops collecting the clang time trace, adding its events to a lane of
+  /// their own with the given name
+  void stopClangTimeTrace(const std::string &lane_name);
+
+  /// Saves the recorded spans as a Chrome trace event file, which can be
+  /// loaded by chrome://tracing and by Perfetto
+  bool writeTraceFile(const std::string &path) const;
+
+  /// Saves the phases, the statistics, the probe totals and the peak memory
+  /// usage of the process as a JSON file, meant to be read by tools
+  bool writeMetricsFile(const std::string &path) const;
+
+  /// Prints the phase table, the hardware counters, the headers with the
+  /// highest parse time, the probe totals and the slowest probes
+  void print(std::ostream &stream, std::size_t slowest_probe_count = 50U,
+             std::size_t costliest_header_count = 20U) const;
+
+  /// Disable the copy constructor
+  TimeReport(const TimeReport &other) = delete;
+
+  /// Disable the assignment operator
+  TimeReport &operator=(const TimeReport &other) = delete;
+};
+
+/// Adds the time spent in the enclosing scope to a phase of the given time
+/// report, and records it as a span; nothing is recorded when the report is
+/// not set. Phases are ordered by the time they start, so nested phases
+/// follow their parent. The hardware counters are sampled too, if the report
+/// has them enabled, and the phase boundaries are written to the event
+/// stream of the report, if any. The samples taken by the sample profiler
+/// are tagged with the phase, even when the report is not set
+class ScopedPhaseTimer final {
+  /// The time report, if any
+  TimeReport *time_report;
+
+  /// The phase name
+  std::string name;
+
+  /// Measures the time spent in the scope
+  Stopwatch stopwatch;
+
+  /// Counts the hardware events of the scope, if enabled
+  std::unique_ptr<HardwareCounterSet> hardware_counters;
+
+  /// The event stream of the report, if any
+  EventStreamRef event_stream;
+
+  /// Tags the profiler samples with the phase name
+  ScopedSampleTag sample_tag;
+
+  /// Records the phase boundaries in the flight recorder
+  ScopedFlightEvent flight_event;
+
+ public:
+  /// Constructor
+  ScopedPhaseTimer(const TimeReportRef &time_report, const std::string &name,
+                   CPUTimeScope cpu_time_scope = CPUTimeScope::Process);
+
+  /// Destructor; records the elapsed time
+  ~ScopedPhaseTimer();
+
+  /// Disable the copy constructor
+  ScopedPhaseTimer(const ScopedPhaseTimer &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedPhaseTimer &operator=(const ScopedPhaseTimer &other) = delete;
+};
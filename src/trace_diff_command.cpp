@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cmdline.h"
+
+#include <json11.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <vector>
+
+namespace {
+/// Phase changes below this amount of seconds are considered noise
+const double kMinimumPhaseTimeDifference = 0.1;
+
+/// Header changes below this amount of seconds are considered noise
+const double kMinimumHeaderTimeDifference = 0.01;
+
+/// The value of Welch's t statistic above which the probe times of a header
+/// are considered different
+const double kSignificantTStatistic = 2.0;
+
+/// The durations recorded for each name, in seconds
+using TimingSampleMap = std::map<std::string, std::vector<double>>;
+
+/// What a trace file or a metrics file tells about a run
+struct RunTimings final {
+  /// The duration of each phase, and of the probe spans that are not tied
+  /// to a header (such as the precompiled prefixes)
+  TimingSampleMap phase_sample_map;
+
+  /// The duration of each probe, keyed on the include directives
+  TimingSampleMap header_sample_map;
+
+  /// The statistics and the hardware counters; only saved in the metrics
+  /// files
+  std::map<std::string, double> counter_map;
+};
+
+/// The comparison of a phase or of a header
+struct TimingComparison final {
+  /// The phase name, or the include directives of the probe
+  std::string name;
+
+  /// The amount of samples in each run
+  std::size_t old_count{0U};
+  std::size_t new_count{0U};
+
+  /// The total duration in each run, in seconds
+  double old_total{0.0};
+  double new_total{0.0};
+
+  /// True if the slowdown is significant
+  bool regression{false};
+};
+
+/// Returns the sum of the given samples
+double sumSamples(const std::vector<double> &sample_list) {
+  double total = 0.0;
+  for (auto sample : sample_list) {
+    total += sample;
+  }
+
+  return total;
+}
+
+/// Returns Welch's t statistic of the second sample list against the first
+/// one; zero when either list has less than two samples
+double getWelchTStatistic(const std::vector<double> &old_sample_list,
+                          const std::vector<double> &new_sample_list) {
+  if (old_sample_list.size() < 2U || new_sample_list.size() < 2U) {
+    return 0.0;
+  }
+
+  auto L_meanAndVariance = [](double &mean, double &variance,
+                              const std::vector<double> &sample_list) {
+    auto count = static_cast<double>(sample_list.size());
+    mean = sumSamples(sample_list) / count;
+
+    variance = 0.0;
+    for (auto sample : sample_list) {
+      variance += (sample - mean) * (sample - mean);
+    }
+
+    variance /= count - 1.0;
+  };
+
+  double old_mean, old_variance;
+  L_meanAndVariance(old_mean, old_variance, old_sample_list);
+
+  double new_mean, new_variance;
+  L_meanAndVariance(new_mean, new_variance, new_sample_list);
+
+  auto standard_error =
+      std::sqrt(old_variance / static_cast<double>(old_sample_list.size()) +
+                new_variance / static_cast<double>(new_sample_list.size()));
+
+  if (standard_error == 0.0) {
+    return (new_mean > old_mean) ? kSignificantTStatistic : 0.0;
+  }
+
+  return (new_mean - old_mean) / standard_error;
+}
+
+/// Reads a Chrome trace event file saved with generate --trace-file
+void readTraceFile(RunTimings &run_timings, const json11::Json &trace) {
+  for (const auto &event : trace["traceEvents"].array_items()) {
+    if (event["ph"].string_value() != "X") {
+      continue;
+    }
+
+    auto duration = event["dur"].number_value() / 1000000.0;
+    const auto &category = event["cat"].string_value();
+
+    if (category == "phase") {
+      run_timings.phase_sample_map[event["name"].string_value()].push_back(
+          duration);
+
+    } else if (category == "probe") {
+      const auto &directive = event["args"]["directive"].string_value();
+      if (!directive.empty()) {
+        run_timings.header_sample_map[directive].push_back(duration);
+      } else {
+        run_timings.phase_sample_map[event["name"].string_value()].push_back(
+            duration);
+      }
+    }
+  }
+}
+
+/// Reads a metrics file saved with generate --metrics-file
+void readMetricsFile(RunTimings &run_timings, const json11::Json &metrics) {
+  for (const auto &phase : metrics["phases"].array_items()) {
+    const auto &phase_name = phase["name"].string_value();
+
+    run_timings.phase_sample_map[phase_name].push_back(
+        phase["wall_time"].number_value());
+
+    for (const auto &p : phase["hardware_counters"].object_items()) {
+      run_timings.counter_map[phase_name + ": " + p.first] =
+          p.second.number_value();
+    }
+  }
+
+  for (const auto &p : metrics["statistics"].object_items()) {
+    run_timings.counter_map[p.first] = p.second.number_value();
+  }
+
+  for (const auto &p : metrics["probes"].object_items()) {
+    run_timings.counter_map["Probes: " + p.first] = p.second.number_value();
+  }
+
+  run_timings.counter_map["Peak resident memory"] =
+      metrics["peak_resident_memory"].number_value();
+}
+
+/// Reads a trace file or a metrics file, telling them apart by their
+/// contents
+bool readRunTimings(RunTimings &run_timings, const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    std::cerr << "Failed to open the following file: " << path << "\n";
+    return false;
+  }
+
+  std::stringstream buffer;
+  buffer << file.rdbuf();
+
+  std::string error;
+  auto json = json11::Json::parse(buffer.str(), error);
+  if (!error.empty()) {
+    std::cerr << "Failed to parse the following file: " << path << " ("
+              << error << ")\n";
+    return false;
+  }
+
+  if (json["traceEvents"].is_array()) {
+    readTraceFile(run_timings, json);
+
+  } else if (json["phases"].is_array()) {
+    readMetricsFile(run_timings, json);
+
+  } else {
+    std::cerr << "The following file is neither a trace file nor a metrics "
+                 "file: "
+              << path << "\n";
+    return false;
+  }
+
+  return true;
+}
+
+/// Compares the samples of the two runs, ranking the largest slowdowns
+/// first. A slowdown is significant when it is above both the minimum
+/// difference and the relative threshold, and when the samples are too
+/// few to be tested, their mean has grown according to Welch's t-test, or
+/// there are more of them
+std::vector<TimingComparison>
+compareSamples(const TimingSampleMap &old_sample_map,
+               const TimingSampleMap &new_sample_map, double threshold,
+               double minimum_difference) {
+  std::map<std::string, TimingComparison> comparison_map;
+
+  for (const auto &p : old_sample_map) {
+    auto &comparison = comparison_map[p.first];
+    comparison.old_count = p.second.size();
+    comparison.old_total = sumSamples(p.second);
+  }
+
+  for (const auto &p : new_sample_map) {
+    auto &comparison = comparison_map[p.first];
+    comparison.new_count = p.second.size();
+    comparison.new_total = sumSamples(p.second);
+  }
+
+  std::vector<TimingComparison> comparison_list;
+  comparison_list.reserve(comparison_map.size());
+
+  static const std::vector<double> kEmptySampleList;
+
+  for (auto &p : comparison_map) {
+    auto &comparison = p.second;
+    comparison.name = p.first;
+
+    auto difference = comparison.new_total - comparison.old_total;
+
+    if (difference > minimum_difference &&
+        difference > comparison.old_total * threshold) {
+      auto old_it = old_sample_map.find(p.first);
+      auto new_it = new_sample_map.find(p.first);
+
+      const auto &old_sample_list =
+          (old_it != old_sample_map.end()) ? old_it->second : kEmptySampleList;
+      const auto &new_sample_list =
+          (new_it != new_sample_map.end()) ? new_it->second : kEmptySampleList;
+
+      comparison.regression =
+          old_sample_list.size() < 2U || new_sample_list.size() < 2U ||
+          comparison.new_count > comparison.old_count ||
+          getWelchTStatistic(old_sample_list, new_sample_list) >=
+              kSignificantTStatistic;
+    }
+
+    comparison_list.push_back(std::move(comparison));
+  }
+
+  std::stable_sort(comparison_list.begin(), comparison_list.end(),
+                   [](const TimingComparison &lhs,
+                      const TimingComparison &rhs) -> bool {
+                     return lhs.new_total - lhs.old_total >
+                            rhs.new_total - rhs.old_total;
+                   });
+
+  return comparison_list;
+}
+
+/// Returns the relative change between the two values, as a percentage
+std::string describeChange(double old_value, double new_value) {
+  std::ostringstream buffer;
+  buffer << std::fixed << std::setprecision(1) << std::showpos;
+
+  if (old_value == 0.0) {
+    buffer << (new_value == 0.0 ? "0.0%" : "new");
+  } else {
+    buffer << (new_value - old_value) * 100.0 / old_value << "%";
+  }
+
+  return buffer.str();
+}
+
+/// Prints the first entries of the given comparison list; the significant
+/// regressions are marked with an exclamation mark
+void printComparisonList(std::ostream &output, const std::string &title,
+                         const std::vector<TimingComparison> &comparison_list,
+                         std::size_t limit, bool print_counts) {
+  output << title << "\n\n";
+  output << "      Old (s)    New (s)  Delta (s)   Change  Name\n";
+
+  for (std::size_t i = 0U; i < comparison_list.size() && i < limit; ++i) {
+    const auto &comparison = comparison_list[i];
+
+    output << (comparison.regression ? "  ! " : "    ") << std::setw(9)
+           << comparison.old_total << "  " << std::setw(9)
+           << comparison.new_total << "  " << std::showpos << std::setw(9)
+           << comparison.new_total - comparison.old_total << std::noshowpos
+           << "  " << std::setw(7)
+           << describeChange(comparison.old_total, comparison.new_total)
+           << "  " << comparison.name;
+
+    if (print_counts) {
+      output << " (" << comparison.old_count << " -> "
+             << comparison.new_count << " probes)";
+    }
+
+    output << "\n";
+  }
+
+  if (comparison_list.size() > limit) {
+    output << "    ... " << comparison_list.size() - limit
+           << " more entries\n";
+  }
+
+  output << "\n";
+}
+}  // namespace
+
+/// Handler for the 'trace_diff' command
+bool traceDiffCommandHandler(ProfileManagerRef &profile_manager,
+                             const LanguageManager &language_manager,
+                             const CommandLineOptions &cmdline_options) {
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+
+  RunTimings old_run_timings;
+  RunTimings new_run_timings;
+
+  if (!readRunTimings(old_run_timings, cmdline_options.trace_diff_old_file) ||
+      !readRunTimings(new_run_timings, cmdline_options.trace_diff_new_file)) {
+    return false;
+  }
+
+  const auto threshold = cmdline_options.trace_diff_threshold;
+  const auto limit = cmdline_options.trace_diff_limit;
+
+  auto phase_comparison_list =
+      compareSamples(old_run_timings.phase_sample_map,
+                     new_run_timings.phase_sample_map, threshold,
+                     kMinimumPhaseTimeDifference);
+
+  auto header_comparison_list =
+      compareSamples(old_run_timings.header_sample_map,
+                     new_run_timings.header_sample_map, threshold,
+                     kMinimumHeaderTimeDifference);
+
+  std::ostringstream output;
+  output << std::fixed << std::setprecision(3);
+
+  // Every phase is listed; there are only a few dozens of them
+  if (!phase_comparison_list.empty()) {
+    printComparisonList(output, "Phases", phase_comparison_list,
+                        phase_comparison_list.size(), false);
+  }
+
+  if (!header_comparison_list.empty()) {
+    printComparisonList(output, "Probe time per header",
+                        header_comparison_list, limit, true);
+  }
+
+  // Counters are only listed when they have changed; they are not timings,
+  // so the relative threshold is the only criterion
+  std::vector<std::pair<std::string, std::pair<double, double>>>
+      counter_delta_list;
+
+  std::map<std::string, std::pair<double, double>> counter_pair_map;
+  for (const auto &p : old_run_timings.counter_map) {
+    counter_pair_map[p.first].first = p.second;
+  }
+
+  for (const auto &p : new_run_timings.counter_map) {
+    counter_pair_map[p.first].second = p.second;
+  }
+
+  for (const auto &p : counter_pair_map) {
+    if (p.second.first != p.second.second) {
+      counter_delta_list.push_back(p);
+    }
+  }
+
+  auto L_relativeChange = [](const std::pair<double, double> &value) {
+    return (value.first != 0.0)
+               ? std::abs(value.second - value.first) / std::abs(value.first)
+               : std::numeric_limits<double>::infinity();
+  };
+
+  std::stable_sort(
+      counter_delta_list.begin(), counter_delta_list.end(),
+      [&](const std::pair<std::string, std::pair<double, double>> &lhs,
+          const std::pair<std::string, std::pair<double, double>> &rhs)
+          -> bool {
+        return L_relativeChange(lhs.second) > L_relativeChange(rhs.second);
+      });
+
+  if (!counter_delta_list.empty()) {
+    output << "Counters\n\n";
+    output << std::setprecision(0);
+
+    for (std::size_t i = 0U; i < counter_delta_list.size() && i < limit;
+         ++i) {
+      const auto &name = counter_delta_list[i].first;
+      const auto &value = counter_delta_list[i].second;
+
+      output << (L_relativeChange(value) > threshold ? "  ! " : "    ")
+             << std::setw(14) << value.first << " -> " << std::setw(14)
+             << value.second << "  " << std::setw(7)
+             << describeChange(value.first, value.second) << "  " << name
+             << "\n";
+    }
+
+    if (counter_delta_list.size() > limit) {
+      output << "    ... " << counter_delta_list.size() - limit
+             << " more entries\n";
+    }
+
+    output << "\n";
+  }
+
+  auto L_regressionCount =
+      [](const std::vector<TimingComparison> &comparison_list) {
+        return std::count_if(comparison_list.begin(), comparison_list.end(),
+                             [](const TimingComparison &comparison) -> bool {
+                               return comparison.regression;
+                             });
+      };
+
+  auto phase_regression_count = L_regressionCount(phase_comparison_list);
+  auto header_regression_count = L_regressionCount(header_comparison_list);
+
+  output << "Significant regressions: " << phase_regression_count
+         << " phases, " << header_regression_count << " headers\n";
+
+  std::cout << output.str();
+
+  if (cmdline_options.trace_diff_exit_code &&
+      phase_regression_count + header_regression_count != 0) {
+    return false;
+  }
+
+  return true;
+}
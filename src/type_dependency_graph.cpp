@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "type_dependency_graph.h"
+
+#include <algorithm>
+
+namespace {
+/// Builds the CSR arrays for the given edges, grouping them by the first
+/// node of each pair; the edge list must be sorted
+void buildAdjacencyArrays(
+    HugePageVector<std::size_t> &offset_list,
+    HugePageVector<TypeNodeId> &target_list,
+    const HugePageVector<std::pair<TypeNodeId, TypeNodeId>> &edge_list,
+    std::size_t node_count) {
+  offset_list.assign(node_count + 1U, 0U);
+  target_list.clear();
+  target_list.reserve(edge_list.size());
+
+  for (const auto &edge : edge_list) {
+    offset_list[edge.first + 1U]++;
+    target_list.push_back(edge.second);
+  }
+
+  for (std::size_t i = 1U; i < offset_list.size(); ++i) {
+    offset_list[i] += offset_list[i - 1U];
+  }
+}
+}  // namespace
+
+TypeNodeId TypeDependencyGraph::getOrCreateNode(const clang::Type *type,
+                                                bool &created) {
+  auto node_id = static_cast<TypeNodeId>(node_type_list.size());
+
+  auto insert_status = node_id_map.insert({type, node_id});
+  created = insert_status.second;
+
+  if (!created) {
+    return insert_status.first->second;
+  }
+
+  node_type_list.push_back(type);
+  node_identity_list.push_back(0U);
+
+  return node_id;
+}
+
+bool TypeDependencyGraph::findNode(TypeNodeId &node_id,
+                                   const clang::Type *type) const {
+  auto it = node_id_map.find(type);
+  if (it == node_id_map.end()) {
+    return false;
+  }
+
+  node_id = it->second;
+  return true;
+}
+
+void TypeDependencyGraph::addEdge(TypeNodeId parent, TypeNodeId child) {
+  edge_list.emplace_back(parent, child);
+}
+
+void TypeDependencyGraph::finalize() {
+  // Merge the edges from the previous finalize() call, so that the graph can
+  // be extended and finalized again
+  for (std::size_t node_id = 0U; node_id + 1U < child_offset_list.size();
+       ++node_id) {
+    for (auto i = child_offset_list[node_id];
+         i < child_offset_list[node_id + 1U]; ++i) {
+      edge_list.emplace_back(static_cast<TypeNodeId>(node_id), child_list[i]);
+    }
+  }
+
+  std::sort(edge_list.begin(), edge_list.end());
+  edge_list.erase(std::unique(edge_list.begin(), edge_list.end()),
+                  edge_list.end());
+
+  buildAdjacencyArrays(child_offset_list, child_list, edge_list,
+                       node_type_list.size());
+
+  for (auto &edge : edge_list) {
+    std::swap(edge.first, edge.second);
+  }
+
+  std::sort(edge_list.begin(), edge_list.end());
+
+  buildAdjacencyArrays(parent_offset_list, parent_list, edge_list,
+                       node_type_list.size());
+
+  edge_list.clear();
+  edge_list.shrink_to_fit();
+}
+
+void TypeDependencyGraph::clear() {
+  // Swap with empty containers so that the memory is actually released
+  HugePageVector<const clang::Type *>().swap(node_type_list);
+  node_id_map = llvm::DenseMap<const clang::Type *, TypeNodeId>();
+  HugePageVector<TypeIdentity>().swap(node_identity_list);
+  HugePageVector<std::pair<TypeNodeId, TypeNodeId>>().swap(edge_list);
+  HugePageVector<std::size_t>().swap(child_offset_list);
+  HugePageVector<TypeNodeId>().swap(child_list);
+  HugePageVector<std::size_t>().swap(parent_offset_list);
+  HugePageVector<TypeNodeId>().swap(parent_list);
+}
+
+std::size_t TypeDependencyGraph::nodeCount() const {
+  return node_type_list.size();
+}
+
+std::size_t TypeDependencyGraph::edgeCount() const { return child_list.size(); }
+
+std::size_t TypeDependencyGraph::memoryUsage() const {
+  auto L_vectorSize = [](const auto &vector) -> std::size_t {
+    return vector.capacity() * sizeof(vector[0]);
+  };
+
+  return L_vectorSize(node_type_list) + L_vectorSize(node_identity_list) +
+         L_vectorSize(edge_list) + L_vectorSize(child_offset_list) +
+         L_vectorSize(child_list) + L_vectorSize(parent_offset_list) +
+         L_vectorSize(parent_list) + node_id_map.getMemorySize();
+}
+
+const clang::Type *TypeDependencyGraph::type(TypeNodeId node_id) const {
+  return node_type_list.at(node_id);
+}
+
+TypeIdentity TypeDependencyGraph::identity(TypeNodeId node_id) const {
+  return node_identity_list.at(node_id);
+}
+
+void TypeDependencyGraph::setIdentity(TypeNodeId node_id,
+                                      TypeIdentity identity) {
+  node_identity_list.at(node_id) = identity;
+}
+
+llvm::ArrayRef<TypeNodeId> TypeDependencyGraph::children(
+    TypeNodeId node_id) const {
+  if (static_cast<std::size_t>(node_id) + 1U >= child_offset_list.size()) {
+    return {};
+  }
+
+  auto begin = child_offset_list[node_id];
+  auto end = child_offset_list[node_id + 1U];
+
+  return llvm::ArrayRef<TypeNodeId>(child_list.data() + begin, end - begin);
+}
+
+llvm::ArrayRef<TypeNodeId> TypeDependencyGraph::parents(
+    TypeNodeId node_id) const {
+  if (static_cast<std::size_t>(node_id) + 1U >= parent_offset_list.size()) {
+    return {};
+  }
+
+  auto begin = parent_offset_list[node_id];
+  auto end = parent_offset_list[node_id + 1U];
+
+  return llvm::ArrayRef<TypeNodeId>(parent_list.data() + begin, end - begin);
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "huge_pages.h"
+#include "types.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include <clang/AST/Type.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+
+/// A dense node identifier, used to index the graph arrays
+using TypeNodeId = std::uint32_t;
+
+/// A list of node identifiers
+using TypeNodeIdList = std::vector<TypeNodeId>;
+
+/// The type dependency graph. Nodes are stored in flat arrays and are
+/// identified by their index; edges are collected in a single list while the
+/// graph is being built, and then compacted into CSR adjacency arrays by
+/// finalize(). All the memory is released at once by clear(). The arrays
+/// are backed by huge pages when enabled, as the graph walks touch them in
+/// no particular order
+class TypeDependencyGraph final {
+  /// The type of each node
+  HugePageVector<const clang::Type *> node_type_list;
+
+  /// Maps each type to its node
+  llvm::DenseMap<const clang::Type *, TypeNodeId> node_id_map;
+
+  /// The identity of each node; zero until it is set
+  HugePageVector<TypeIdentity> node_identity_list;
+
+  /// The (parent, child) edges added since the last finalize() call
+  HugePageVector<std::pair<TypeNodeId, TypeNodeId>> edge_list;
+
+  /// Where the children of each node start in child_list; has one more
+  /// element than the node list
+  HugePageVector<std::size_t> child_offset_list;
+
+  /// The children of each node, in CSR form
+  HugePageVector<TypeNodeId> child_list;
+
+  /// Where the parents of each node start in parent_list; has one more
+  /// element than the node list
+  HugePageVector<std::size_t> parent_offset_list;
+
+  /// The parents of each node, in CSR form
+  HugePageVector<TypeNodeId> parent_list;
+
+ public:
+  /// Returns the node for the given type, creating it if necessary. The
+  /// created parameter is set to true if a new node has been added
+  TypeNodeId getOrCreateNode(const clang::Type *type, bool &created);
+
+  /// Looks up the node for the given type
+  bool findNode(TypeNodeId &node_id, const clang::Type *type) const;
+
+  /// Adds a new edge; duplicates are removed by finalize()
+  void addEdge(TypeNodeId parent, TypeNodeId child);
+
+  /// Builds the adjacency arrays; must be called before children() and
+  /// parents() are used
+  void finalize();
+
+  /// Releases all the nodes and edges
+  void clear();
+
+  /// Returns the amount of nodes
+  std::size_t nodeCount() const;
+
+  /// Returns the amount of edges compacted by the last finalize() call
+  std::size_t edgeCount() const;
+
+  /// Returns the memory allocated by the graph arrays and by the node map,
+  /// in bytes
+  std::size_t memoryUsage() const;
+
+  /// Returns the type of the given node
+  const clang::Type *type(TypeNodeId node_id) const;
+
+  /// Returns the identity of the given node, or zero if it has not been set
+  TypeIdentity identity(TypeNodeId node_id) const;
+
+  /// Sets the identity of the given node; identities are computed on demand
+  /// by the owner of the graph, as most nodes never need one
+  void setIdentity(TypeNodeId node_id, TypeIdentity identity);
+
+  /// Returns the types referenced by the given node
+  llvm::ArrayRef<TypeNodeId> children(TypeNodeId node_id) const;
+
+  /// Returns the types referencing the given node
+  llvm::ArrayRef<TypeNodeId> parents(TypeNodeId node_id) const;
+};
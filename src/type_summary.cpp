@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "type_summary.h"
+#include "generate_utils.h"
+#include "output_file.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace {
+/// The first line of each summary
+const std::string kTypeSummaryHeader = "abigen-type-summary 1";
+
+/// Returns the path of the summary built for the given settings inside the
+/// precompiled header folder of the profile
+stdfs::path getTypeSummaryPath(const CompilerInstanceSettings &settings,
+                               const std::string &cache_directory) {
+  auto folder = ProfileManager::precompiledHeaderFolder(settings.profile,
+                                                        cache_directory);
+
+  return stdfs::path(folder) /
+         (ProfileManager::precompiledHeaderName(
+              settings.language, settings.language_standard,
+              settings.enable_gnu_extensions) +
+          ".summary");
+}
+
+/// Reads the given summary; returns false if it is malformed, or if one of
+/// its dependencies has changed
+bool readTypeSummary(TypeSummary &summary, const stdfs::path &path) {
+  summary = {};
+
+  std::ifstream summary_file(path.string());
+  if (!summary_file) {
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(summary_file, line) || line != kTypeSummaryHeader) {
+    return false;
+  }
+
+  const std::string settings_tag = "settings ";
+  if (!std::getline(summary_file, line) ||
+      line.compare(0U, settings_tag.size(), settings_tag) != 0 ||
+      !contentHashFromString(summary.settings_hash,
+                             line.substr(settings_tag.size()))) {
+    return false;
+  }
+
+  const std::string type_tag = "type ";
+
+  while (std::getline(summary_file, line)) {
+    // Malformed dependency lines are rejected by the type line check
+    std::string path;
+    ContentHash expected_hash;
+    if (parseDependencyLine(path, expected_hash, line)) {
+      ContentHash current_hash;
+      if (!hashFileContents(current_hash, path) ||
+          current_hash != expected_hash) {
+        return false;
+      }
+
+      continue;
+    }
+
+    // type <identity> <0|1>
+    if (line.compare(0U, type_tag.size(), type_tag) != 0 ||
+        line.size() != type_tag.size() + 18U) {
+      return false;
+    }
+
+    TypeIdentity identity;
+    if (!contentHashFromString(identity, line.substr(type_tag.size(), 16U))) {
+      return false;
+    }
+
+    auto reachable = line.back();
+    if (reachable != '0' && reachable != '1') {
+      return false;
+    }
+
+    summary.reachability_map.insert({identity, reachable == '1'});
+  }
+
+  return true;
+}
+}  // namespace
+
+ContentHash hashTypeSummary(const TypeSummary &summary) {
+  std::vector<std::pair<TypeIdentity, bool>> entry_list(
+      summary.reachability_map.begin(), summary.reachability_map.end());
+
+  std::sort(entry_list.begin(), entry_list.end());
+
+  auto hash = updateContentHash(kInitialContentHash, summary.settings_hash);
+
+  for (const auto &entry : entry_list) {
+    hash = updateContentHash(hash, entry.first);
+    hash = updateContentHash(hash, static_cast<std::uint64_t>(entry.second));
+  }
+
+  return hash;
+}
+
+bool saveTypeSummary(const TypeSummary &summary,
+                     const CompilerInstanceSettings &compiler_settings,
+                     const std::string &cache_directory,
+                     const StringList &dependency_list) {
+  auto summary_path = getTypeSummaryPath(compiler_settings, cache_directory);
+
+  std::error_code error;
+  stdfs::create_directories(summary_path.parent_path(), error);
+  if (error) {
+    return false;
+  }
+
+  std::stringstream buffer;
+  buffer << kTypeSummaryHeader << "\n";
+  buffer << "settings " << contentHashToString(summary.settings_hash) << "\n";
+
+  for (const auto &path : dependency_list) {
+    ContentHash hash;
+    if (!hashFileContents(hash, path)) {
+      return false;
+    }
+
+    writeDependencyLine(buffer, path, hash);
+  }
+
+  for (const auto &p : summary.reachability_map) {
+    buffer << "type " << contentHashToString(p.first) << " "
+           << (p.second ? "1" : "0") << "\n";
+  }
+
+  return writeFileAtomically(summary_path, buffer.str());
+}
+
+bool loadTypeSummary(TypeSummary &summary, std::string &error_message,
+                     const CompilerInstanceSettings &compiler_settings,
+                     const std::string &cache_directory) {
+  summary = {};
+  error_message.clear();
+
+  std::vector<stdfs::path> path_list;
+  if (!cache_directory.empty()) {
+    path_list.push_back(getTypeSummaryPath(compiler_settings, cache_directory));
+  }
+
+  path_list.push_back(getTypeSummaryPath(compiler_settings, std::string()));
+
+  auto settings_hash = hashProfileSettings(compiler_settings);
+  bool outdated_summary_found = false;
+
+  for (const auto &path : path_list) {
+    std::error_code error;
+    if (!stdfs::exists(path, error)) {
+      continue;
+    }
+
+    if (readTypeSummary(summary, path) &&
+        summary.settings_hash == settings_hash) {
+      return true;
+    }
+
+    outdated_summary_found = true;
+  }
+
+  summary = {};
+
+  if (outdated_summary_found) {
+    error_message = "The type summary of this profile is out of date; run "
+                    "the build_profile_summary command again";
+  } else {
+    error_message = "No type summary has been built for this profile and "
+                    "language; run the build_profile_summary command";
+  }
+
+  return false;
+}
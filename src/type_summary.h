@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "compilerinstance.h"
+#include "content_hash.h"
+#include "types.h"
+
+#include <memory>
+#include <unordered_map>
+
+/// Whether the record types defined in the system headers of a profile can
+/// reach a function type, computed once by the build_profile_summary command.
+/// The AST visitor looks up the records it finds here instead of expanding
+/// their members; only the records that do not reach an incomplete one are
+/// listed, so that the opaque types of the whitelisted functions do not
+/// change
+struct TypeSummary final {
+  /// Hash of the profile settings used to build the summary (see
+  /// hashProfileSettings); it must match the ones of the translation units
+  /// using it
+  ContentHash settings_hash{0U};
+
+  /// Maps the identity of each record type to true if it can reach a
+  /// function type
+  std::unordered_map<TypeIdentity, bool> reachability_map;
+};
+
+/// A reference to a shared type summary
+using TypeSummaryRef = std::shared_ptr<const TypeSummary>;
+
+/// Hashes the contents of the given summary; the hash does not depend on
+/// the order in which the types have been inserted
+ContentHash hashTypeSummary(const TypeSummary &summary);
+
+/// Saves the given summary in the folder holding the precompiled system
+/// headers of the profile, along with the content hash of each dependency
+bool saveTypeSummary(const TypeSummary &summary,
+                     const CompilerInstanceSettings &compiler_settings,
+                     const std::string &cache_directory,
+                     const StringList &dependency_list);
+
+/// Loads the summary built for the given settings, searching the cache
+/// folder (when set) before the profile folder. Summaries built with other
+/// settings, or whose dependencies have changed, are ignored; the error
+/// message is set when no valid summary is found
+bool loadTypeSummary(TypeSummary &summary, std::string &error_message,
+                     const CompilerInstanceSettings &compiler_settings,
+                     const std::string &cache_directory);
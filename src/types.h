@@ -25,10 +25,17 @@
 /// A simple string list
 using StringList = std::vector<std::string>;
 
+/// Identifies a file path; see ABILibrary::file_path_list
+using FileId = std::uint32_t;
+
+/// The contents of files that only exist in memory, keyed on their path
+using RenderedFileMap = std::map<std::string, std::string>;
+
 /// This structure is used to hold a location within the source code
 struct SourceCodeLocation final {
-  /// The absolute file path, except for the main file (the generated buffer)
-  std::string file_path;
+  /// The index of the file path in the file path list. Paths are absolute,
+  /// except for the main file (the generated buffer)
+  FileId file_id{0U};
 
   /// The line
   std::uint32_t line;
@@ -37,10 +44,24 @@ struct SourceCodeLocation final {
   std::uint32_t column;
 };
 
+/// Identifies a type across translation units and runs: the content hash of
+/// its canonical spelling. Zero is never used as an identity
+using TypeIdentity = std::uint64_t;
+
+/// A list of type identities
+using TypeIdentityList = std::vector<TypeIdentity>;
+
 /// Describes a blacklisted function
 struct BlacklistedFunction final {
   /// All the possible reasons why a function is blacklisted
-  enum class Reason { Variadic, FunctionPointer, DuplicateName, Templated };
+  enum class Reason {
+    Variadic,
+    FunctionPointer,
+    DuplicateName,
+    Templated,
+    NotExported,
+    InternalLinkage
+  };
 
   /// If this function was blacklisted due to name duplication, this type
   /// can be used to get the location of the other functions
@@ -60,6 +81,10 @@ struct BlacklistedFunction final {
   /// Mangled function name
   std::string mangled_name;
 
+  /// The name mangled with the other convention, when dual mangling is
+  /// enabled; it is not saved in the ABI database
+  std::string alternate_mangled_name;
+
   /// Blacklist reason
   Reason reason;
 
@@ -73,6 +98,9 @@ using BlacklistedFunctionList = std::vector<BlacklistedFunction>;
 
 /// Describes a whitelisted function
 struct WhitelistedFunction final {
+  /// Calling conventions, as understood by the mcsema external definitions
+  enum class CallingConvention { CallerCleanup, CalleeCleanup, FastCall };
+
   /// The location for this symbol
   SourceCodeLocation location;
 
@@ -81,6 +109,25 @@ struct WhitelistedFunction final {
 
   /// Mangled function name
   std::string mangled_name;
+
+  /// The name mangled with the other convention, when dual mangling is
+  /// enabled; it is not saved in the ABI database
+  std::string alternate_mangled_name;
+
+  /// Amount of fixed arguments, including the implicit object parameter of
+  /// the instance methods
+  std::uint32_t argument_count{0U};
+
+  /// How the stack is cleaned up after a call
+  CallingConvention calling_convention{CallingConvention::CallerCleanup};
+
+  /// True if the function never returns
+  bool no_return{false};
+
+  /// The identities of the incomplete classes and structures reachable from
+  /// the prototype, sorted; another translation unit may find a function
+  /// pointer in their definition
+  TypeIdentityList opaque_type_list;
 };
 
 /// List of whitelisted functions
@@ -94,6 +141,30 @@ struct ABILibrary final {
   /// Functions that will appear in the final ABI library
   WhitelistedFunctionList whitelisted_function_list;
 
+  /// The classes and structures reaching a function pointer that caused a
+  /// function to be blacklisted, keyed on their identity, along with the
+  /// locations of their spellings. When results are merged, the whitelisted
+  /// functions that only saw their declaration are blacklisted as well
+  std::map<TypeIdentity, BlacklistedFunction::FunctionPointerLocations>
+      function_pointer_type_map;
+
   /// Headers that have been successfully included
   StringList header_list;
+
+  /// If not empty, the absolute path each header resolved to, in the same
+  /// order as the header list; empty strings mark the headers that can't be
+  /// resolved with a single lookup. Not saved in the ABI database
+  StringList header_path_list;
+
+  /// The file paths referenced by the source code locations
+  StringList file_path_list;
+
+  /// For each file path, the line of the generated source buffer whose
+  /// #include directive brought the file in; zero when unknown
+  std::vector<std::uint32_t> file_include_line_list;
+
+  /// If not empty, the self-contained declarations of the whitelisted
+  /// functions; the header then contains them instead of including the base
+  /// includes and the discovered headers
+  std::string sliced_header;
 };
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <llvm/ADT/IntrusiveRefCntPtr.h>
+
+// clang-format off
+#if LLVM_MAJOR_VERSION <= 7
+  #include <clang/Basic/VirtualFileSystem.h>
+#else
+  #include <llvm/Support/VirtualFileSystem.h>
+#endif
+// clang-format on
+
+#if LLVM_MAJOR_VERSION <= 7
+/// The virtual file system interface used by clang
+using VirtualFileSystem = clang::vfs::FileSystem;
+
+/// The status of a virtual file system entry
+using VirtualFileStatus = clang::vfs::Status;
+
+/// The entries returned when iterating over a folder
+using VirtualFolderEntry = clang::vfs::Status;
+#else
+/// The virtual file system interface used by clang
+using VirtualFileSystem = llvm::vfs::FileSystem;
+
+/// The status of a virtual file system entry
+using VirtualFileStatus = llvm::vfs::Status;
+
+/// The entries returned when iterating over a folder
+using VirtualFolderEntry = llvm::vfs::directory_entry;
+#endif
+
+/// A reference to a virtual file system
+using VirtualFileSystemRef = llvm::IntrusiveRefCntPtr<VirtualFileSystem>;
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "visitor_statistics.h"
+
+const char *getVisitorStatisticName(VisitorStatistic statistic) {
+  switch (statistic) {
+  case VisitorStatistic::FunctionVisits:
+    return "VisitFunctionDecl calls";
+
+  case VisitorStatistic::EarlyRejections:
+    return "Functions rejected before the type expansion";
+
+  case VisitorStatistic::ClassExpansions:
+    return "Classes expanded";
+
+  case VisitorStatistic::RepeatedClassExpansions:
+    return "Classes already expanded";
+
+  case VisitorStatistic::EnqueuedTypes:
+    return "Types enqueued";
+
+  case VisitorStatistic::GraphNodes:
+    return "Type graph nodes";
+
+  case VisitorStatistic::GraphEdges:
+    return "Type graph edges";
+
+  case VisitorStatistic::TaintPropagationSteps:
+    return "Taint propagation steps";
+
+  case VisitorStatistic::ManglingCalls:
+    return "Mangling calls";
+
+  case VisitorStatistic::TypeInformationMapEntries:
+    return "Type information map entries";
+  }
+
+  return "Unknown";
+}
+
+void VisitorStatistics::merge(VisitorStatistics &other) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (std::size_t i = 0U; i < kVisitorStatisticCount; ++i) {
+    value_list[i] += other.value_list[i];
+    other.value_list[i] = 0U;
+  }
+}
+
+std::size_t VisitorStatistics::get(VisitorStatistic statistic) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return value_list[static_cast<std::size_t>(statistic)];
+}
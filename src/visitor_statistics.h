@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+// Minimal builds compile the counters out; see the
+// ABIGEN_ENABLE_VISITOR_STATISTICS CMake option
+#if !defined(ABIGEN_VISITOR_STATISTICS)
+#define ABIGEN_VISITOR_STATISTICS 1
+#endif
+
+/// The counters kept by the AST visitor
+enum class VisitorStatistic {
+  FunctionVisits,
+  EarlyRejections,
+  ClassExpansions,
+  RepeatedClassExpansions,
+  EnqueuedTypes,
+  GraphNodes,
+  GraphEdges,
+  TaintPropagationSteps,
+  ManglingCalls,
+  TypeInformationMapEntries
+};
+
+/// How many counters the VisitorStatistic enum lists
+const std::size_t kVisitorStatisticCount =
+    static_cast<std::size_t>(VisitorStatistic::TypeInformationMapEntries) + 1U;
+
+/// Returns the name printed for the given counter
+const char *getVisitorStatisticName(VisitorStatistic statistic);
+
+/// The work done by the AST visitor, used to tune it. Each visitor updates
+/// its own object without synchronization, and merges it into the shared
+/// one passed with its settings when it is finalized
+class VisitorStatistics final {
+  /// The counter values, indexed by VisitorStatistic
+  std::array<std::size_t, kVisitorStatisticCount> value_list{};
+
+  /// Protects the values while objects are merged
+  mutable std::mutex mutex;
+
+ public:
+  /// True if the counters are compiled in
+  static constexpr bool kEnabled = ABIGEN_VISITOR_STATISTICS != 0;
+
+  /// Constructor
+  VisitorStatistics() = default;
+
+  /// Adds the given value to a counter; this is not thread safe, and does
+  /// nothing when the counters are compiled out
+  void add(VisitorStatistic statistic, std::size_t value = 1U) {
+    if constexpr (kEnabled) {
+      value_list[static_cast<std::size_t>(statistic)] += value;
+    }
+  }
+
+  /// Adds the counters of the other object, and then resets them; merges
+  /// into the same object can run concurrently
+  void merge(VisitorStatistics &other);
+
+  /// Returns the value of the given counter
+  std::size_t get(VisitorStatistic statistic) const;
+
+  /// Disable the copy constructor
+  VisitorStatistics(const VisitorStatistics &other) = delete;
+
+  /// Disable the assignment operator
+  VisitorStatistics &operator=(const VisitorStatistics &other) = delete;
+};
+
+/// A reference to a shared VisitorStatistics object
+using VisitorStatisticsRef = std::shared_ptr<VisitorStatistics>;
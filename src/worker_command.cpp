@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "cmdline.h"
+#include "remote_probes.h"
+#include "std_filesystem.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+/// Handler for the 'worker' command
+bool workerCommandHandler(ProfileManagerRef &profile_manager,
+                          const LanguageManager &language_manager,
+                          const CommandLineOptions &cmdline_options) {
+#if defined(__unix__) || defined(__APPLE__)
+  // Isolated workers share the file system of the generate command that has
+  // started them, and never receive header packs
+  if (cmdline_options.worker_connection_fd >= 0) {
+    serveRemoteProbes(cmdline_options.worker_connection_fd, profile_manager,
+                      language_manager, std::string(), cmdline_options.jobs);
+
+    close(cmdline_options.worker_connection_fd);
+    return true;
+  }
+
+  if (cmdline_options.listen_address.empty()) {
+    std::cerr << "Either a listen address or a connection is required\n";
+    return false;
+  }
+
+  // The header packs are kept across runs when a state folder is given, so
+  // the coordinators only have to ship the folders that have changed
+  std::error_code error;
+  stdfs::path pack_directory;
+
+  if (cmdline_options.state_directory.empty()) {
+    std::random_device random_device;
+    pack_directory = stdfs::temp_directory_path(error) /
+                     ("abigen-worker-" + std::to_string(random_device()));
+  } else {
+    pack_directory =
+        stdfs::path(cmdline_options.state_directory) / "header_packs";
+  }
+
+  if (!error) {
+    stdfs::create_directories(pack_directory, error);
+  }
+
+  if (error) {
+    std::cerr << "Failed to create the header pack folder: "
+              << pack_directory.string() << "\n";
+    return false;
+  }
+
+  const auto &listen_address = cmdline_options.listen_address;
+
+  auto separator_position = listen_address.rfind(':');
+  if (separator_position == std::string::npos) {
+    std::cerr << "Invalid listen address: " << listen_address << "\n";
+    return false;
+  }
+
+  auto host = listen_address.substr(0U, separator_position);
+  auto port = listen_address.substr(separator_position + 1U);
+
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  addrinfo *address_list = nullptr;
+  if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints,
+                  &address_list) != 0) {
+    std::cerr << "Invalid listen address: " << listen_address << "\n";
+    return false;
+  }
+
+  int listen_socket = -1;
+  for (auto it = address_list; it != nullptr; it = it->ai_next) {
+    listen_socket = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+    if (listen_socket < 0) {
+      continue;
+    }
+
+    int reuse_address = 1;
+    setsockopt(listen_socket, SOL_SOCKET, SO_REUSEADDR, &reuse_address,
+               sizeof(reuse_address));
+
+    if (bind(listen_socket, it->ai_addr, it->ai_addrlen) == 0 &&
+        listen(listen_socket, SOMAXCONN) == 0) {
+      break;
+    }
+
+    close(listen_socket);
+    listen_socket = -1;
+  }
+
+  freeaddrinfo(address_list);
+
+  if (listen_socket < 0) {
+    std::cerr << "Failed to listen on " << listen_address << "\n";
+    return false;
+  }
+
+  std::cerr << "Listening on " << listen_address << " with "
+            << cmdline_options.jobs << " probe workers per coordinator\n";
+
+  // Each coordinator (one for each profile of a generate command) gets its
+  // own connection and probe executor; the worker runs until it is stopped
+  while (true) {
+    auto connection_socket = accept(listen_socket, nullptr, nullptr);
+    if (connection_socket < 0) {
+      continue;
+    }
+
+    auto pack_directory_path = pack_directory.string();
+
+    std::thread([&profile_manager, &language_manager, &cmdline_options,
+                 connection_socket, pack_directory_path]() {
+      serveRemoteProbes(connection_socket, profile_manager, language_manager,
+                        pack_directory_path, cmdline_options.jobs);
+
+      close(connection_socket);
+    }).detach();
+  }
+
+#else
+  static_cast<void>(profile_manager);
+  static_cast<void>(language_manager);
+  static_cast<void>(cmdline_options);
+
+  std::cerr << "The worker command is only supported on Unix systems\n";
+  return false;
+#endif
+}
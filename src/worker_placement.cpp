@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "worker_placement.h"
+#include "std_filesystem.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+#if defined(__linux__)
+/// MPOL_LOCAL, from linux/mempolicy.h; the header is not always installed
+const int kLocalMemoryPolicy = 4;
+
+/// The highest node count accepted by the memory policy system calls
+const unsigned long kMaxNodeCount = 1024UL;
+
+/// The CPUs the process can run on, grouped by NUMA node
+struct NUMATopology final {
+  /// The CPUs of each node; nodes without usable CPUs are skipped
+  std::vector<std::vector<int>> node_cpu_lists;
+};
+
+/// Parses a CPU list, as found in sysfs (i.e.: 0-3,8-11)
+bool parseCPUList(std::vector<int> &cpu_list, const std::string &text) {
+  cpu_list.clear();
+
+  std::stringstream stream(text);
+  std::string range;
+
+  while (std::getline(stream, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace),
+                range.end());
+
+    if (range.empty()) {
+      continue;
+    }
+
+    try {
+      auto separator_index = range.find('-');
+      auto first_cpu = std::stoi(range.substr(0U, separator_index));
+      auto last_cpu = (separator_index == std::string::npos)
+                          ? first_cpu
+                          : std::stoi(range.substr(separator_index + 1U));
+
+      for (auto cpu = first_cpu; cpu <= last_cpu; ++cpu) {
+        cpu_list.push_back(cpu);
+      }
+
+    } catch (...) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/// Reads the NUMA topology from sysfs, keeping the CPUs that are part of
+/// the process affinity mask; a single node with all the usable CPUs is
+/// returned when the topology is not available
+NUMATopology readNUMATopology() {
+  NUMATopology topology;
+
+  cpu_set_t allowed_cpu_mask;
+  CPU_ZERO(&allowed_cpu_mask);
+  if (sched_getaffinity(0, sizeof(allowed_cpu_mask), &allowed_cpu_mask) !=
+      0) {
+    return topology;
+  }
+
+  auto L_usableCPUList = [&allowed_cpu_mask](const std::vector<int> &cpu_list) {
+    std::vector<int> usable_cpu_list;
+    for (auto cpu : cpu_list) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed_cpu_mask)) {
+        usable_cpu_list.push_back(cpu);
+      }
+    }
+
+    return usable_cpu_list;
+  };
+
+  std::vector<std::pair<int, std::vector<int>>> node_list;
+
+  std::error_code error;
+  stdfs::directory_iterator it("/sys/devices/system/node", error);
+
+  for (; !error && it != stdfs::directory_iterator(); it.increment(error)) {
+    auto name = it->path().filename().string();
+    if (name.size() <= 4U || name.compare(0U, 4U, "node") != 0 ||
+        !std::all_of(name.begin() + 4, name.end(), ::isdigit)) {
+      continue;
+    }
+
+    std::ifstream cpu_list_file((it->path() / "cpulist").string());
+    std::string cpu_list_text;
+    std::getline(cpu_list_file, cpu_list_text);
+
+    std::vector<int> cpu_list;
+    if (!parseCPUList(cpu_list, cpu_list_text)) {
+      continue;
+    }
+
+    cpu_list = L_usableCPUList(cpu_list);
+    if (!cpu_list.empty()) {
+      node_list.push_back({std::stoi(name.substr(4U)), std::move(cpu_list)});
+    }
+  }
+
+  std::sort(node_list.begin(), node_list.end());
+
+  for (auto &node : node_list) {
+    topology.node_cpu_lists.push_back(std::move(node.second));
+  }
+
+  if (topology.node_cpu_lists.empty()) {
+    std::vector<int> cpu_list;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      cpu_list.push_back(cpu);
+    }
+
+    cpu_list = L_usableCPUList(cpu_list);
+    if (!cpu_list.empty()) {
+      topology.node_cpu_lists.push_back(std::move(cpu_list));
+    }
+  }
+
+  return topology;
+}
+
+/// Returns the NUMA topology; it is read the first time, before any worker
+/// has been pinned
+const NUMATopology &getNUMATopology() {
+  static const NUMATopology topology = readNUMATopology();
+  return topology;
+}
+#endif
+}  // namespace
+
+bool parseWorkerPlacement(WorkerPlacement &placement,
+                          const std::string &name) {
+  if (name == "none") {
+    placement = WorkerPlacement::None;
+  } else if (name == "node") {
+    placement = WorkerPlacement::Node;
+  } else if (name == "core") {
+    placement = WorkerPlacement::Core;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+std::size_t getNUMANodeCount() {
+#if defined(__linux__)
+  return std::max<std::size_t>(getNUMATopology().node_cpu_lists.size(), 1U);
+#else
+  return 1U;
+#endif
+}
+
+ScopedWorkerPlacement::ScopedWorkerPlacement(WorkerPlacement placement,
+                                             std::size_t worker_index) {
+#if defined(__linux__)
+  if (placement == WorkerPlacement::None) {
+    return;
+  }
+
+  const auto &node_cpu_lists = getNUMATopology().node_cpu_lists;
+  if (node_cpu_lists.empty()) {
+    return;
+  }
+
+  // Consecutive workers go to different nodes, so that a few workers still
+  // use the memory bandwidth of all the nodes
+  const auto &cpu_list = node_cpu_lists[worker_index % node_cpu_lists.size()];
+
+  cpu_set_t cpu_mask;
+  CPU_ZERO(&cpu_mask);
+
+  if (placement == WorkerPlacement::Core) {
+    auto cpu_index = (worker_index / node_cpu_lists.size()) % cpu_list.size();
+    CPU_SET(cpu_list[cpu_index], &cpu_mask);
+
+  } else {
+    for (auto cpu : cpu_list) {
+      CPU_SET(cpu, &cpu_mask);
+    }
+  }
+
+  cpu_set_t previous_mask;
+  CPU_ZERO(&previous_mask);
+
+  if (sched_getaffinity(0, sizeof(previous_mask), &previous_mask) != 0 ||
+      sched_setaffinity(0, sizeof(cpu_mask), &cpu_mask) != 0) {
+    return;
+  }
+
+  pinned = true;
+  previous_cpu_mask.resize(sizeof(previous_mask));
+  std::memcpy(previous_cpu_mask.data(), &previous_mask, sizeof(previous_mask));
+
+  // New pages already come from the local node by default; the policy is
+  // only needed when the process has been started with another one (i.e.:
+  // numactl --interleave)
+  int memory_policy = 0;
+  previous_node_mask.resize(kMaxNodeCount / (8U * sizeof(unsigned long)));
+
+  if (syscall(SYS_get_mempolicy, &memory_policy, previous_node_mask.data(),
+              kMaxNodeCount, nullptr, 0UL) == 0 &&
+      syscall(SYS_set_mempolicy, kLocalMemoryPolicy, nullptr, 0UL) == 0) {
+    memory_policy_changed = true;
+    previous_memory_policy = memory_policy;
+  }
+
+#else
+  static_cast<void>(placement);
+  static_cast<void>(worker_index);
+#endif
+}
+
+ScopedWorkerPlacement::~ScopedWorkerPlacement() {
+#if defined(__linux__)
+  if (memory_policy_changed) {
+    syscall(SYS_set_mempolicy, previous_memory_policy,
+            previous_node_mask.data(), kMaxNodeCount);
+  }
+
+  if (pinned) {
+    cpu_set_t previous_mask;
+    std::memcpy(&previous_mask, previous_cpu_mask.data(),
+                sizeof(previous_mask));
+
+    sched_setaffinity(0, sizeof(previous_mask), &previous_mask);
+  }
+#endif
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2018-present, Trail of Bits, Inc.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Where the worker threads are allowed to run
+enum class WorkerPlacement {
+  /// Workers are scheduled freely by the operating system
+  None,
+
+  /// Each worker is pinned to the CPUs of a NUMA node; the nodes are
+  /// assigned round robin, by worker index
+  Node,
+
+  /// Each worker is pinned to a single CPU of its node
+  Core
+};
+
+/// Parses a placement name (none, node or core), returning false if it is
+/// not valid
+bool parseWorkerPlacement(WorkerPlacement &placement, const std::string &name);
+
+/// Returns how many NUMA nodes have CPUs the process can run on; one when
+/// the topology is not available
+std::size_t getNUMANodeCount();
+
+/// Pins the calling thread to the CPUs chosen for the given worker, and
+/// makes its allocations come from the node it runs on; the previous
+/// settings are restored by the destructor. A worker index always maps to
+/// the same node, so that the state the worker keeps across batches (i.e.:
+/// its precompiled prefix) stays in local memory. Nothing is done when the
+/// placement is None, or on platforms other than Linux
+class ScopedWorkerPlacement final {
+  /// True if the thread has been pinned
+  bool pinned{false};
+
+  /// The CPU affinity mask before the thread was pinned
+  std::vector<unsigned char> previous_cpu_mask;
+
+  /// True if the memory policy has been replaced
+  bool memory_policy_changed{false};
+
+  /// The memory policy mode before the thread was pinned
+  int previous_memory_policy{0};
+
+  /// The node mask of the previous memory policy
+  std::vector<unsigned long> previous_node_mask;
+
+ public:
+  /// Constructor
+  ScopedWorkerPlacement(WorkerPlacement placement, std::size_t worker_index);
+
+  /// Destructor
+  ~ScopedWorkerPlacement();
+
+  /// Disable the copy constructor
+  ScopedWorkerPlacement(const ScopedWorkerPlacement &other) = delete;
+
+  /// Disable the assignment operator
+  ScopedWorkerPlacement &operator=(const ScopedWorkerPlacement &other) =
+      delete;
+};
@@ -0,0 +1,48 @@
+# Copyright (c) 2018-present, Trail of Bits, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Runs generate with two jobs and the forked probes, and fails unless the
+# metrics file reports that the probes have been forked
+#
+# Usage: cmake -DABIGEN_PATH=<path> -DPROFILE=<name> -DHEADER_FOLDER=<path>
+#              -DOUTPUT_FOLDER=<path> -P fork_probes_test.cmake
+
+foreach(variable ABIGEN_PATH PROFILE HEADER_FOLDER OUTPUT_FOLDER)
+  if("${${variable}}" STREQUAL "")
+    message(FATAL_ERROR "${variable} is not set")
+  endif()
+endforeach()
+
+file(REMOVE_RECURSE "${OUTPUT_FOLDER}")
+file(MAKE_DIRECTORY "${OUTPUT_FOLDER}")
+
+set(metrics_path "${OUTPUT_FOLDER}/metrics.json")
+
+execute_process(
+  COMMAND "${ABIGEN_PATH}" generate -p "${PROFILE}" -l c11 -f "${HEADER_FOLDER}" -o "${OUTPUT_FOLDER}/abi_library" -j 2 --fork-probes --metrics-file "${metrics_path}"
+  RESULT_VARIABLE exit_code
+  OUTPUT_VARIABLE generate_output
+  ERROR_VARIABLE generate_output
+)
+
+if(NOT exit_code EQUAL 0)
+  message(FATAL_ERROR "The generate command has failed (${exit_code}):\n${generate_output}")
+endif()
+
+file(READ "${metrics_path}" metrics)
+if(NOT metrics MATCHES "\"Forked probes\": [1-9]")
+  message(FATAL_ERROR "The probes have not been forked:\n${generate_output}")
+endif()
+
+message(STATUS "The probes have been forked")